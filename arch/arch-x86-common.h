@@ -17,6 +17,53 @@ static inline void cpuid(unsigned int op,
 extern bool tsc_reliable;
 extern int arch_random;
 
+/*
+ * AVX2 and AVX-512 are only usable if the OS saves the wider register
+ * state too, check OSXSAVE and the XCR0 bits besides the cpuid flags.
+ */
+static inline unsigned int arch_x86_xcr0(void)
+{
+	unsigned int eax, ebx, ecx = 0, edx, xcr0_hi;
+
+	eax = 1;
+	do_cpuid(&eax, &ebx, &ecx, &edx);
+	if (!(ecx & (1U << 27)))
+		return 0;
+
+	__asm__ __volatile__("xgetbv" : "=a" (eax), "=d" (xcr0_hi) : "c" (0));
+	return eax;
+}
+
+static inline bool arch_x86_has_avx2(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if ((arch_x86_xcr0() & 0x6) != 0x6)
+		return false;
+
+	cpuid(7, &eax, &ebx, &ecx, &edx);
+	return (ebx & (1U << 5)) != 0;
+}
+
+static inline bool arch_x86_has_avx512f(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if ((arch_x86_xcr0() & 0xe6) != 0xe6)
+		return false;
+
+	cpuid(7, &eax, &ebx, &ecx, &edx);
+	return (ebx & (1U << 16)) != 0;
+}
+
+static inline bool arch_x86_has_clwb(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	cpuid(7, &eax, &ebx, &ecx, &edx);
+	return (ebx & (1U << 24)) != 0;
+}
+
 static inline void arch_init_intel(void)
 {
 	unsigned int eax, ebx, ecx = 0, edx;
@@ -34,9 +34,35 @@ static inline unsigned long long get_cpu_clock(void)
 	return ((unsigned long long) hi << 32ULL) | lo;
 }
 
+/*
+ * rdtscp also returns IA32_TSC_AUX, which Linux sets to the node and CPU
+ * number, the latter in the low 12 bits.
+ */
+static inline unsigned long long get_cpu_clock_cpu(unsigned int *cpu)
+{
+	unsigned int lo, hi, aux;
+
+	__asm__ __volatile__("rdtscp" : "=a" (lo), "=d" (hi), "=c" (aux));
+	*cpu = aux & 0xfff;
+	return ((unsigned long long) hi << 32ULL) | lo;
+}
+
+static inline bool arch_has_cpu_clock_cpu(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+	if (eax < 0x80000001)
+		return false;
+
+	cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
+	return (edx & (1U << 27)) != 0;
+}
+
 #define ARCH_HAVE_FFZ
 #define ARCH_HAVE_SSE4_2
 #define ARCH_HAVE_CPU_CLOCK
+#define ARCH_HAVE_CPU_CLOCK_CPU
 
 #define RDRAND_LONG	".byte 0x48,0x0f,0xc7,0xf0"
 #define RDSEED_LONG	".byte 0x48,0x0f,0xc7,0xf8"
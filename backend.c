@@ -29,6 +29,7 @@
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <math.h>
+#include <libgen.h>
 #include <pthread.h>
 
 #include "fio.h"
@@ -36,6 +37,14 @@
 #include "verify.h"
 #include "diskutil.h"
 #include "cgroup.h"
+#include "perfcnt.h"
+#include "overhead.h"
+#include "reduction.h"
+#include "outlier.h"
+#include "overlap.h"
+#include "latmap.h"
+#include "filestat.h"
+#include "cpuloc.h"
 #include "profile.h"
 #include "lib/rand.h"
 #include "lib/memalign.h"
@@ -49,6 +58,8 @@
 #include "helper_thread.h"
 #include "pshared.h"
 #include "zone-dist.h"
+#include "zbd.h"
+#include "phase.h"
 
 static struct fio_sem *startup_sem;
 static struct flist_head *cgroup_list;
@@ -67,11 +78,6 @@ unsigned int cur_segment = 0;
 unsigned int stat_number = 0;
 int temp_stall_ts;
 unsigned long done_secs = 0;
-#ifdef PTHREAD_ERRORCHECK_MUTEX_INITIALIZER_NP
-pthread_mutex_t overlap_check = PTHREAD_ERRORCHECK_MUTEX_INITIALIZER_NP;
-#else
-pthread_mutex_t overlap_check = PTHREAD_MUTEX_INITIALIZER;
-#endif
 
 #define JOB_START_TIMEOUT	(5 * 1000)
 
@@ -407,11 +413,38 @@ static void check_update_rusage(struct thread_data *td)
 {
 	if (td->update_rusage) {
 		td->update_rusage = 0;
+		merge_stat_shard(td);
 		update_rusage_stat(td);
 		fio_sem_up(td->rusage_sem);
 	}
 }
 
+#define REAP_EWMA_FRAC		4
+#define REAP_EWMA_WEIGHT	3
+
+/*
+ * Adaptive reaping: keep a moving average of the depth we see when we go
+ * to reap, and wait for half of it. By Little's law the average depth is
+ * the completion rate times the completion latency, so this follows both.
+ * At low load it waits for a single IO rather than spinning, at saturation
+ * it reaps in batches of up to iodepth_batch_complete_max.
+ */
+static int adaptive_reap_min(struct thread_data *td)
+{
+	unsigned int ewma = td->reap_depth_ewma;
+	unsigned int target;
+
+	ewma -= ewma >> REAP_EWMA_WEIGHT;
+	ewma += (td->cur_depth << REAP_EWMA_FRAC) >> REAP_EWMA_WEIGHT;
+	td->reap_depth_ewma = ewma;
+
+	target = (ewma >> REAP_EWMA_FRAC) / 2;
+	target = min(target, td->o.iodepth_batch_complete_max);
+	target = min(target, td->cur_depth);
+
+	return max(target, 1U);
+}
+
 static int wait_for_completions(struct thread_data *td, struct timespec *time)
 {
 	const int full = queue_full(td);
@@ -424,9 +457,13 @@ static int wait_for_completions(struct thread_data *td, struct timespec *time)
 	/*
 	 * if the queue is full, we MUST reap at least 1 event
 	 */
-	min_evts = min(td->o.iodepth_batch_complete_min, td->cur_depth);
-	if ((full && !min_evts) || !td->o.iodepth_batch_complete_min)
-		min_evts = 1;
+	if (td->o.iodepth_batch_complete_adaptive)
+		min_evts = adaptive_reap_min(td);
+	else {
+		min_evts = min(td->o.iodepth_batch_complete_min, td->cur_depth);
+		if ((full && !min_evts) || !td->o.iodepth_batch_complete_min)
+			min_evts = 1;
+	}
 
 	if (time && should_check_rate(td))
 		fio_gettime(time, NULL);
@@ -559,48 +596,21 @@ static int unlink_all_files(struct thread_data *td)
 	return ret;
 }
 
-/*
- * Check if io_u will overlap an in-flight IO in the queue
- */
-bool in_flight_overlap(struct io_u_queue *q, struct io_u *io_u)
-{
-	bool overlap;
-	struct io_u *check_io_u;
-	unsigned long long x1, x2, y1, y2;
-	int i;
-
-	x1 = io_u->offset;
-	x2 = io_u->offset + io_u->buflen;
-	overlap = false;
-	io_u_qiter(q, check_io_u, i) {
-		if (check_io_u->flags & IO_U_F_FLIGHT) {
-			y1 = check_io_u->offset;
-			y2 = check_io_u->offset + check_io_u->buflen;
-
-			if (x1 < y2 && y1 < x2) {
-				overlap = true;
-				dprint(FD_IO, "in-flight overlap: %llu/%llu, %llu/%llu\n",
-						x1, io_u->buflen,
-						y1, check_io_u->buflen);
-				break;
-			}
-		}
-	}
-
-	return overlap;
-}
-
 static enum fio_q_status io_u_submit(struct thread_data *td, struct io_u *io_u)
 {
+	enum fio_q_status ret;
+	int prev;
+
 	/*
-	 * Check for overlap if the user asked us to, and we have
-	 * at least one IO in flight besides this one.
+	 * Check for overlap if the user asked us to
 	 */
-	if (td->o.serialize_overlap && td->cur_depth > 1 &&
-	    in_flight_overlap(&td->io_u_all, io_u))
+	if (td->o.serialize_overlap && !overlap_claim(td, io_u))
 		return FIO_Q_BUSY;
 
-	return td_io_queue(td, io_u);
+	prev = overhead_enter(td, FIO_OVH_SUBMIT);
+	ret = td_io_queue(td, io_u);
+	overhead_leave(td, prev);
+	return ret;
 }
 
 /*
@@ -609,6 +619,7 @@ static enum fio_q_status io_u_submit(struct thread_data *td, struct io_u *io_u)
  */
 static void do_verify(struct thread_data *td, uint64_t verify_bytes)
 {
+	const bool threaded = td_verify_threads(td);
 	struct fio_file *f;
 	struct io_u *io_u;
 	int ret, min_events;
@@ -718,7 +729,11 @@ static void do_verify(struct thread_data *td, uint64_t verify_bytes)
 			break;
 		}
 
-		if (td->o.verify_async)
+		/*
+		 * The worker that reads a block back verifies it too, the
+		 * verify_async threads belong to this thread
+		 */
+		if (td->o.verify_async && !threaded)
 			io_u->end_io = verify_io_u_async;
 		else
 			io_u->end_io = verify_io_u;
@@ -727,6 +742,18 @@ static void do_verify(struct thread_data *td, uint64_t verify_bytes)
 		if (!td->o.disable_slat)
 			fio_gettime(&io_u->start_time, NULL);
 
+		/*
+		 * Workers take the reads off a shared queue, so each block
+		 * is read and checked by exactly one of them. Waiting for a
+		 * free io_u is what throttles us.
+		 */
+		if (threaded) {
+			if (td->error)
+				break;
+			workqueue_enqueue(&td->io_wq, &io_u->work);
+			continue;
+		}
+
 		ret = io_u_submit(td, io_u);
 
 		if (io_queue_event(td, io_u, &ret, ddir, NULL, 1, NULL))
@@ -748,7 +775,9 @@ reap:
 
 	check_update_rusage(td);
 
-	if (!td->error) {
+	if (threaded)
+		workqueue_flush(&td->io_wq);
+	else if (!td->error) {
 		min_events = td->cur_depth;
 
 		if (min_events)
@@ -816,6 +845,9 @@ static long long usec_for_io(struct thread_data *td, enum fio_ddir ddir)
 
 	assert(!(td->flags & TD_F_CHILD));
 
+	if (!bps)
+		return 0;
+
 	if (td->o.rate_process == RATE_PROCESS_POISSON) {
 		uint64_t val, iops;
 
@@ -829,15 +861,13 @@ static long long usec_for_io(struct thread_data *td, enum fio_ddir ddir)
 		}
 		td->last_usec[ddir] += val;
 		return td->last_usec[ddir];
-	} else if (bps) {
+	} else {
 		uint64_t bytes = td->rate_io_issue_bytes[ddir];
 		uint64_t secs = bytes / bps;
 		uint64_t remainder = bytes % bps;
 
 		return remainder * 1000000 / bps + secs * 1000000;
 	}
-
-	return 0;
 }
 
 static void init_thinktime(struct thread_data *td)
@@ -894,8 +924,10 @@ static void handle_thinktime(struct thread_data *td, enum fio_ddir ddir,
 	}
 
 	total = 0;
-	if (left)
+	if (left) {
 		total = usec_spin(left);
+		td->clock_batch_valid = false;
+	}
 
 	left = td->o.thinktime - total;
 	if (td->o.timeout) {
@@ -944,9 +976,24 @@ static void handle_thinktime(struct thread_data *td, enum fio_ddir ddir,
  *
  * Returns number of bytes written and trimmed.
  */
+/*
+ * Hand the io_us held back for io_submit_mode=offload to the submit
+ * workers in one go
+ */
+static void offload_flush(struct thread_data *td,
+			  struct workqueue_work **batch, unsigned int *nr)
+{
+	if (!*nr)
+		return;
+
+	workqueue_enqueue_batch(&td->io_wq, batch, *nr);
+	*nr = 0;
+}
+
 static void do_io(struct thread_data *td, uint64_t *bytes_done)
 {
-	unsigned int i;
+	struct workqueue_work **batch = NULL;
+	unsigned int i, batch_nr = 0, batch_max = 1;
 	int ret = 0;
 	uint64_t total_bytes, bytes_issued = 0;
 
@@ -959,6 +1006,20 @@ static void do_io(struct thread_data *td, uint64_t *bytes_done)
 		td_set_runstate(td, TD_RUNNING);
 
 	lat_target_init(td);
+	phases_start(td);
+	overhead_start(td);
+
+	/*
+	 * Offloaded io_us go to the workers iodepth_batch_submit at a time,
+	 * like inline submission commits them. Rate and thinktime want each
+	 * one out as soon as it's issued.
+	 */
+	if (td->o.io_submit_mode == IO_MODE_OFFLOAD && td->o.iodepth_batch > 1 &&
+	    !td->o.thinktime && !should_check_rate(td)) {
+		batch = malloc(td->o.iodepth_batch * sizeof(*batch));
+		if (batch)
+			batch_max = td->o.iodepth_batch;
+	}
 
 	total_bytes = td->o.size;
 	/*
@@ -983,19 +1044,25 @@ static void do_io(struct thread_data *td, uint64_t *bytes_done)
 		td->o.number_ios *= 2;
 	}
 
-	while ((td->o.read_iolog_file && !flist_empty(&td->io_log_list)) ||
+	while ((td->o.read_iolog_file && read_iolog_pending(td)) ||
 		(!flist_empty(&td->trim_list)) || !io_issue_bytes_exceeded(td) ||
 		td->o.time_based) {
 		struct timespec comp_time;
 		struct io_u *io_u;
-		int full;
+		int full, prev;
 		enum fio_ddir ddir;
 
 		check_update_rusage(td);
 
+		if (td->log_win_pending)
+			drain_log_windows(td);
+
 		if (td->terminate || td->done)
 			break;
 
+		if (td->vstate_ckpt_pending)
+			verify_state_checkpoint(td);
+
 		update_ts_cache(td);
 
 		if (runtime_exceeded(td, &td->ts_cache)) {
@@ -1006,8 +1073,13 @@ static void do_io(struct thread_data *td, uint64_t *bytes_done)
 			}
 		}
 
-		if (flow_threshold_exceeded(td))
+		if (td->phases)
+			phases_update(td);
+
+		if (flow_threshold_exceeded(td)) {
+			offload_flush(td, batch, &batch_nr);
 			continue;
+		}
 
 		/*
 		 * Break if we exceeded the bytes. The exception is time
@@ -1021,7 +1093,9 @@ static void do_io(struct thread_data *td, uint64_t *bytes_done)
 		     (td->o.time_based && td->o.verify != VERIFY_NONE)))
 			break;
 
+		prev = overhead_enter(td, FIO_OVH_GET);
 		io_u = get_io_u(td);
+		overhead_leave(td, prev);
 		if (IS_ERR_OR_NULL(io_u)) {
 			int err = PTR_ERR(io_u);
 
@@ -1046,6 +1120,11 @@ static void do_io(struct thread_data *td, uint64_t *bytes_done)
 
 		ddir = io_u->ddir;
 
+		if (rate_bucket_wait(td, ddir)) {
+			put_io_u(td, io_u);
+			break;
+		}
+
 		/*
 		 * Add verification end_io handler if:
 		 *	- Asked to verify (!td_rw(td))
@@ -1087,7 +1166,16 @@ static void do_io(struct thread_data *td, uint64_t *bytes_done)
 			if (td->error)
 				break;
 
-			workqueue_enqueue(&td->io_wq, &io_u->work);
+			/*
+			 * Flush a full queue too, or we'd sleep on a free io_u
+			 * with the ones that would free it still held here.
+			 */
+			if (batch_max > 1) {
+				batch[batch_nr++] = &io_u->work;
+				if (batch_nr == batch_max || queue_full(td))
+					offload_flush(td, batch, &batch_nr);
+			} else
+				workqueue_enqueue(&td->io_wq, &io_u->work);
 			ret = FIO_Q_QUEUED;
 
 			if (ddir_rw(__ddir)) {
@@ -1096,7 +1184,7 @@ static void do_io(struct thread_data *td, uint64_t *bytes_done)
 				td->rate_io_issue_bytes[__ddir] += blen;
 			}
 
-			if (should_check_rate(td)) {
+			if (should_check_rate(td) && ddir_rw(__ddir)) {
 				td->rate_next_io_time[__ddir] = usec_for_io(td, __ddir);
 				fio_gettime(&comp_time, NULL);
 			}
@@ -1104,7 +1192,7 @@ static void do_io(struct thread_data *td, uint64_t *bytes_done)
 		} else {
 			ret = io_u_submit(td, io_u);
 
-			if (should_check_rate(td))
+			if (should_check_rate(td) && ddir_rw(ddir))
 				td->rate_next_io_time[ddir] = usec_for_io(td, ddir);
 
 			if (io_queue_event(td, io_u, &ret, ddir, &bytes_issued, 0, &comp_time))
@@ -1143,6 +1231,9 @@ reap:
 			lat_target_check(td);
 	}
 
+	offload_flush(td, batch, &batch_nr);
+	free(batch);
+
 	check_update_rusage(td);
 
 	if (td->trim_entries)
@@ -1185,6 +1276,9 @@ reap:
 		cleanup_pending_aio(td);
 	}
 
+	overhead_stop(td);
+	phases_stop(td);
+
 	/*
 	 * stop job if we failed doing any IO
 	 */
@@ -1238,11 +1332,11 @@ static void cleanup_io_u(struct thread_data *td)
 
 		if (td->io_ops->io_u_free)
 			td->io_ops->io_u_free(td, io_u);
-
-		fio_memfree(io_u, sizeof(*io_u), td_offload_overlap(td));
 	}
+	td_io_u_arena_free(td);
 
 	free_io_mem(td);
+	verify_pattern_free(td);
 
 	io_u_rexit(&td->io_u_requeues);
 	io_u_qexit(&td->io_u_freelist, false);
@@ -1262,6 +1356,7 @@ static int init_io_u(struct thread_data *td)
 	err = 0;
 	err += !io_u_rinit(&td->io_u_requeues, td->o.iodepth);
 	err += !io_u_qinit(&td->io_u_freelist, td->o.iodepth, false);
+	td->io_u_freelist.fifo = td->o.freelist_order == FREELIST_ORDER_FIFO;
 	err += !io_u_qinit(&td->io_u_all, td->o.iodepth, td_offload_overlap(td));
 
 	if (err) {
@@ -1271,24 +1366,25 @@ static int init_io_u(struct thread_data *td)
 
 	cl_align = os_cache_line_size();
 
-	for (i = 0; i < max_units; i++) {
-		void *ptr;
+	if (td_io_u_arena_init(td, max_units, cl_align)) {
+		log_err("fio: unable to allocate aligned memory\n");
+		return 1;
+	}
 
+	for (i = 0; i < max_units; i++) {
 		if (td->terminate)
 			return 1;
 
-		ptr = fio_memalign(cl_align, sizeof(*io_u), td_offload_overlap(td));
-		if (!ptr) {
-			log_err("fio: unable to allocate aligned memory\n");
-			return 1;
-		}
-
-		io_u = ptr;
-		memset(io_u, 0, sizeof(*io_u));
+		io_u = td_io_u_arena_slot(td, i);
 		INIT_FLIST_HEAD(&io_u->verify_list);
+		INIT_FLIST_HEAD(&io_u->overlap_list);
 		dprint(FD_MEM, "io_u alloc %p, index %u\n", io_u, i);
 
 		io_u->index = i;
+		if (td->io_ops->io_u_priv_size)
+			io_u->engine_data = (void *) io_u + td->io_u_priv_off;
+		if (td->o.num_range > 1)
+			io_u->trim_ranges = (void *) io_u + td->io_u_trim_off;
 		io_u->flags = IO_U_F_FREE;
 		io_u_qpush(&td->io_u_freelist, io_u);
 
@@ -1321,15 +1417,27 @@ int init_io_u_buffers(struct thread_data *td)
 {
 	struct io_u *io_u;
 	unsigned long long max_bs, min_write;
-	int i, max_units;
+	int i, max_units, nr_bufs;
 	int data_xfer = 1;
-	char *p;
+	char *p, *start;
 
 	max_units = td->o.iodepth;
 	max_bs = td_max_bs(td);
+	if (td->phases)
+		max_bs = max(max_bs, td->phases->phase_max_bs);
 	min_write = td->o.min_bs[DDIR_WRITE];
+
+	/* an iolog may turn out to have writes after the options were checked */
+	if (td->o.shared_read_buffers && td_write(td)) {
+		log_err("fio: shared_read_buffers is for jobs that don't write\n");
+		return 1;
+	}
+
+	nr_bufs = max_units;
+	if (td->o.shared_read_buffers)
+		nr_bufs = shared_read_nr_bufs(td, max_bs);
 	td->orig_buffer_size = (unsigned long long) max_bs
-					* (unsigned long long) max_units;
+					* (unsigned long long) nr_bufs;
 
 	if (td_ioengine_flagged(td, FIO_NOIO) || !(td_read(td) || td_write(td)))
 		data_xfer = 0;
@@ -1359,11 +1467,15 @@ int init_io_u_buffers(struct thread_data *td)
 	if (data_xfer && allocate_io_mem(td))
 		return 1;
 
+	if (data_xfer && verify_pattern_init(td, max_bs))
+		return 1;
+
 	if (td->o.odirect || td->o.mem_align ||
 	    td_ioengine_flagged(td, FIO_RAWIO))
 		p = PTR_ALIGN(td->orig_buffer, page_mask) + td->o.mem_align;
 	else
 		p = td->orig_buffer;
+	start = p;
 
 	for (i = 0; i < max_units; i++) {
 		io_u = td->io_u_all.io_us[i];
@@ -1384,6 +1496,8 @@ int init_io_u_buffers(struct thread_data *td)
 			}
 		}
 		p += max_bs;
+		if (i % nr_bufs == nr_bufs - 1)
+			p = start;
 	}
 
 	return 0;
@@ -1579,7 +1693,7 @@ static uint64_t do_dry_run(struct thread_data *td)
 {
 	td_set_runstate(td, TD_RUNNING);
 
-	while ((td->o.read_iolog_file && !flist_empty(&td->io_log_list)) ||
+	while ((td->o.read_iolog_file && read_iolog_pending(td)) ||
 		(!flist_empty(&td->trim_list)) || !io_complete_bytes_exceeded(td)) {
 		struct io_u *io_u;
 		int ret;
@@ -1632,8 +1746,8 @@ static void *thread_main(void *data)
 	struct sk_out *sk_out = fd->sk_out;
 	uint64_t bytes_done[DDIR_RWDIR_CNT];
 	int deadlock_loop_cnt;
-	bool clear_state;
-	int res, ret;
+	bool clear_state, set_affinity;
+	int ret;
 
 	sk_out_assign(sk_out);
 	free(fd);
@@ -1653,7 +1767,6 @@ static void *thread_main(void *data)
 
 	INIT_FLIST_HEAD(&td->io_log_list);
 	INIT_FLIST_HEAD(&td->io_hist_list);
-	INIT_FLIST_HEAD(&td->verify_list);
 	INIT_FLIST_HEAD(&td->trim_list);
 	td->io_hist_tree = RB_ROOT;
 
@@ -1662,11 +1775,6 @@ static void *thread_main(void *data)
 		td_verror(td, ret, "mutex_cond_init_pshared");
 		goto err;
 	}
-	ret = cond_init_pshared(&td->verify_cond);
-	if (ret) {
-		td_verror(td, ret, "mutex_cond_pshared");
-		goto err;
-	}
 
 	td_set_runstate(td, TD_INITIALIZED);
 	dprint(FD_MUTEX, "up startup_sem\n");
@@ -1689,6 +1797,7 @@ static void *thread_main(void *data)
 	}
 
 	td_zone_gen_index(td);
+	td_bssplit_gen_alias(td);
 
 	/*
 	 * Do this early, we don't want the compress threads to be limited
@@ -1705,12 +1814,25 @@ static void *thread_main(void *data)
 	if (o->gtod_cpu)
 		fio_cpu_clear(&o->cpumask, o->gtod_cpu);
 
+	set_affinity = fio_option_is_set(o, cpumask);
+#ifdef FIO_HAVE_CPUS_AUTO
+	if (o->cpus_allowed_auto) {
+		ret = fio_cpus_auto(td, &o->cpumask);
+		if (ret < 0) {
+			td_verror(td, EINVAL, "cpus_allowed_auto");
+			goto err;
+		}
+		set_affinity = ret;
+	}
+#endif
+
 	/*
 	 * Set affinity first, in case it has an impact on the memory
 	 * allocations.
 	 */
-	if (fio_option_is_set(o, cpumask)) {
-		if (o->cpus_allowed_policy == FIO_CPUS_SPLIT) {
+	if (set_affinity) {
+		if (o->cpus_allowed_policy == FIO_CPUS_SPLIT &&
+		    !o->cpus_allowed_auto) {
 			ret = fio_cpus_split(&o->cpumask, td->thread_number - 1);
 			if (!ret) {
 				log_err("fio: no CPUs set\n");
@@ -1726,6 +1848,9 @@ static void *thread_main(void *data)
 		}
 	}
 
+	if (o->precise_pacing)
+		os_min_timer_slack();
+
 #ifdef CONFIG_LIBNUMA
 	/* numa node setup */
 	if (fio_option_is_set(o, numa_cpunodes) ||
@@ -1776,6 +1901,10 @@ static void *thread_main(void *data)
 
 		}
 	}
+
+	if (fio_option_is_set(o, cpumask) ||
+	    fio_option_is_set(o, numa_cpunodes))
+		fio_td_numa_place(td);
 #endif
 
 	if (fio_pin_memory(td))
@@ -1803,6 +1932,9 @@ static void *thread_main(void *data)
 	if (td_io_init(td))
 		goto err;
 
+	if (td_io_sync_async_init(td, sk_out))
+		goto err;
+
 	if (td_ioengine_flagged(td, FIO_SYNCIO) && td->o.iodepth > 1 && td->o.io_submit_mode != IO_MODE_OFFLOAD) {
 		log_info("note: both iodepth >= 1 and synchronous I/O engine "
 			 "are selected, queue depth will be capped at 1\n");
@@ -1811,6 +1943,9 @@ static void *thread_main(void *data)
 	if (init_io_u(td))
 		goto err;
 
+	if (overlap_index_init(td))
+		goto err;
+
 	if (td->io_ops->post_init && td->io_ops->post_init(td))
 		goto err;
 
@@ -1835,6 +1970,12 @@ static void *thread_main(void *data)
 	if (!init_random_map(td))
 		goto err;
 
+	if (verify_map_init(td))
+		goto err;
+
+	if (verify_table_init(td))
+		goto err;
+
 	if (o->exec_prerun && exec_string(o, o->exec_prerun, "prerun"))
 		goto err;
 
@@ -1843,11 +1984,38 @@ static void *thread_main(void *data)
 
 	fio_verify_init(td);
 
+	if (zbd_reset_worker_init(td))
+		goto err;
+
 	if (rate_submit_init(td, sk_out))
 		goto err;
 
+	if (perfcnt_init(td))
+		goto err;
+
+	if (overhead_init(td))
+		goto err;
+
+	if (reduction_init(td))
+		goto err;
+
 	set_epoch_time(td, o->log_unix_epoch | o->log_alternate_epoch, o->log_alternate_epoch_clock_id);
 	fio_getrusage(&td->ru_start);
+
+	if (lat_outliers_init(td))
+		goto err;
+
+	if (latmap_init(td))
+		goto err;
+
+	if (file_stats_init(td))
+		goto err;
+
+	if (cpu_locality_init(td))
+		goto err;
+
+	mem_acct_add(td, MEM_STATS, sizeof(td->ts));
+
 	memcpy(&td->bw_sample_time, &td->epoch, sizeof(td->epoch));
 	memcpy(&td->iops_sample_time, &td->epoch, sizeof(td->epoch));
 	memcpy(&td->ss.prev_time, &td->epoch, sizeof(td->epoch));
@@ -1880,6 +2048,7 @@ static void *thread_main(void *data)
 				break;
 		}
 
+		invalidate_files_parallel(td);
 		prune_io_piece_log(td);
 
 		if (td->o.verify_only && td_write(td))
@@ -1968,21 +2137,9 @@ static void *thread_main(void *data)
 			break;
 	}
 
-	/*
-	 * Acquire this lock if we were doing overlap checking in
-	 * offload mode so that we don't clean up this job while
-	 * another thread is checking its io_u's for overlap
-	 */
-	if (td_offload_overlap(td)) {
-		int res = pthread_mutex_lock(&overlap_check);
-		assert(res == 0);
-	}
 	td_set_runstate(td, TD_FINISHING);
-	if (td_offload_overlap(td)) {
-		res = pthread_mutex_unlock(&overlap_check);
-		assert(res == 0);
-	}
 
+	merge_stat_shard(td);
 	update_rusage_stat(td);
 	td->ts.total_run_time = mtime_since_now(&td->epoch);
 	for_each_rw_ddir(ddir) {
@@ -1990,7 +2147,8 @@ static void *thread_main(void *data)
 	}
 
 	if (td->o.verify_state_save && !(td->flags & TD_F_VSTATE_SAVED) &&
-	    (td->o.verify != VERIFY_NONE && td_write(td)))
+	    (td->o.verify != VERIFY_NONE && td_write(td)) &&
+	    !td->o.verify_only)
 		verify_save_state(td->thread_number);
 
 	fio_unpin_memory(td);
@@ -1999,6 +2157,7 @@ static void *thread_main(void *data)
 
 	iolog_compress_exit(td);
 	rate_submit_exit(td);
+	lat_target_exit(td);
 
 	if (o->exec_postrun)
 		exec_string(o, o->exec_postrun, "postrun");
@@ -2014,12 +2173,22 @@ err:
 	if (o->verify_async)
 		verify_async_exit(td);
 
+	zbd_reset_worker_exit(td);
+	perfcnt_exit(td);
+	overhead_exit(td);
+	reduction_exit(td);
+	lat_outliers_exit(td);
+	latmap_exit(td);
+	verify_sample_report(td);
+	verify_table_exit(td);
+	overlap_index_exit(td);
 	close_and_free_files(td);
 	cleanup_io_u(td);
 	close_ioengine(td);
 	cgroup_shutdown(td, cgroup_mnt);
 	verify_free_state(td);
 	td_zone_free_index(td);
+	td_bssplit_free_alias(td);
 
 	if (fio_option_is_set(o, cpumask)) {
 		ret = fio_cpuset_exit(&o->cpumask);
@@ -2034,6 +2203,7 @@ err:
 		write_iolog_close(td);
 	if (td->io_log_rfile)
 		fclose(td->io_log_rfile);
+	iolog_replay_exit(td);
 
 	td_set_runstate(td, TD_EXITED);
 
@@ -2153,6 +2323,7 @@ reaped:
 		done_secs += mtime_since_now(&td->epoch) / 1000;
 		profile_td_exit(td);
 		flow_exit_job(td);
+		rate_bucket_exit_job(td);
 	} end_for_each();
 
 	if (*nr_running == cputhreads && !pending && realthreads)
@@ -2300,12 +2471,162 @@ static bool waitee_running(struct thread_data *me)
 	return false;
 }
 
+/*
+ * create_serialize lays files out from here, one job after the other, so
+ * that jobs don't interleave their files on disk. That only matters
+ * within a device, so jobs on different devices are set up in parallel,
+ * one worker per device.
+ */
+struct serial_setup {
+	int group;
+	int ret;
+};
+
+struct serial_worker {
+	struct serial_setup *jobs;
+	int group;
+	pthread_t thread;
+};
+
+/*
+ * The device a job lays its files out on: that of its first file, or of
+ * the directory it goes into if it doesn't exist yet
+ */
+static dev_t job_layout_dev(struct thread_data *td)
+{
+	struct stat sb;
+	dev_t dev = 0;
+	char *dir;
+
+	if (!td->files_index)
+		return 0;
+
+	if (!stat(td->files[0]->file_name, &sb))
+		return S_ISBLK(sb.st_mode) ? sb.st_rdev : sb.st_dev;
+
+	dir = strdup(td->files[0]->file_name);
+	if (dir && !stat(dirname(dir), &sb))
+		dev = sb.st_dev;
+	free(dir);
+	return dev;
+}
+
+static void *serial_setup_thread(void *data)
+{
+	struct serial_worker *w = data;
+
+	for_each_td(td) {
+		struct serial_setup *job = &w->jobs[__td_index];
+		struct fio_file *f;
+		unsigned int j;
+
+		if (job->group != w->group)
+			continue;
+
+		/*
+		 * do file setup here so it happens sequentially,
+		 * we don't want X number of threads getting their
+		 * client data interspersed on disk
+		 */
+		job->ret = setup_files(td);
+		if (job->ret)
+			continue;
+
+		/*
+		 * for sharing to work, each job must always open
+		 * its own files. so close them, if we opened them
+		 * for creation
+		 */
+		for_each_file(td, f, j) {
+			if (fio_file_open(f))
+				td_io_close_file(td, f);
+		}
+	} end_for_each();
+
+	return NULL;
+}
+
+/*
+ * Set up the files of the create_serialize jobs, returns the number that
+ * failed and were reaped
+ */
+static unsigned int serial_setup_files(void)
+{
+	struct serial_worker *workers;
+	struct serial_setup *jobs;
+	unsigned int failed = 0;
+	int i, nr_groups = 0;
+	dev_t *devs;
+
+	jobs = calloc(thread_number, sizeof(*jobs));
+	devs = calloc(thread_number, sizeof(*devs));
+
+	for_each_td(td) {
+		dev_t dev;
+
+		jobs[__td_index].group = -1;
+		if (!td->o.create_serialize)
+			continue;
+
+		if (fio_verify_load_state(td)) {
+			jobs[__td_index].ret = 1;
+			continue;
+		}
+
+		dev = job_layout_dev(td);
+		for (i = 0; i < nr_groups; i++)
+			if (devs[i] == dev)
+				break;
+		if (i == nr_groups)
+			devs[nr_groups++] = dev;
+		jobs[__td_index].group = i;
+	} end_for_each();
+
+	workers = calloc(nr_groups, sizeof(*workers));
+	for (i = 0; i < nr_groups; i++) {
+		workers[i].jobs = jobs;
+		workers[i].group = i;
+		if (i && pthread_create(&workers[i].thread, NULL,
+					serial_setup_thread, &workers[i]))
+			workers[i].group = -1;
+	}
+
+	/* the first device, and any we failed to start a worker for */
+	if (nr_groups)
+		serial_setup_thread(&workers[0]);
+	for (i = 1; i < nr_groups; i++) {
+		if (workers[i].group != -1)
+			pthread_join(workers[i].thread, NULL);
+		else {
+			workers[i].group = i;
+			serial_setup_thread(&workers[i]);
+		}
+	}
+
+	for_each_td(td) {
+		if (!jobs[__td_index].ret)
+			continue;
+
+		exit_value++;
+		if (td->error)
+			log_err("fio: pid=%d, err=%d/%s\n",
+				(int) td->pid, td->error, td->verror);
+		td_set_runstate(td, TD_REAPED);
+		failed++;
+	} end_for_each();
+
+	free(workers);
+	free(devs);
+	free(jobs);
+	return failed;
+}
+
 /*
  * Main function for kicking off and reaping jobs, as needed.
  */
 static void run_threads(struct sk_out *sk_out)
 {
-	struct thread_data *td;
+	struct thread_data *td, **map;
 	unsigned int i, todo, nr_running, nr_started;
 	uint64_t m_rate, t_rate;
 	uint64_t spent;
@@ -2353,51 +2674,22 @@ static void run_threads(struct sk_out *sk_out)
 
 	for_each_td(td) {
 		print_status_init(td->thread_number - 1);
-
-		if (!td->o.create_serialize)
-			continue;
-
-		if (fio_verify_load_state(td))
-			goto reap;
-
-		/*
-		 * do file setup here so it happens sequentially,
-		 * we don't want X number of threads getting their
-		 * client data interspersed on disk
-		 */
-		if (setup_files(td)) {
-reap:
-			exit_value++;
-			if (td->error)
-				log_err("fio: pid=%d, err=%d/%s\n",
-					(int) td->pid, td->error, td->verror);
-			td_set_runstate(td, TD_REAPED);
-			todo--;
-		} else {
-			struct fio_file *f;
-			unsigned int j;
-
-			/*
-			 * for sharing to work, each job must always open
-			 * its own files. so close them, if we opened them
-			 * for creation
-			 */
-			for_each_file(td, f, j) {
-				if (fio_file_open(f))
-					td_io_close_file(td, f);
-			}
-		}
 	} end_for_each();
 
+	todo -= serial_setup_files();
+	mem_acct_check_projected();
+
 	/* start idle threads before io threads start to run */
 	fio_idle_prof_start();
 
+	fio_wait_start_at();
 	set_genesis_time();
 
+	map = malloc(thread_number * sizeof(*map));
+
 	while (todo) {
-		struct thread_data *map[REAL_MAX_JOBS];
 		struct timespec this_start;
-		int this_jobs = 0, left;
+		int this_jobs = 0, spawned = 0, left;
 		struct fork_data *fd;
 
 		/*
@@ -2480,6 +2772,7 @@ reap:
 				if (!pid) {
 					int ret;
 
+					smalloc_job_process();
 					ret = (int)(uintptr_t)thread_main(fd);
 					_exit(ret);
 				} else if (__td_index == fio_debug_jobno)
@@ -2488,30 +2781,34 @@ reap:
 				free(fd);
 				fd = NULL;
 			}
-			dprint(FD_MUTEX, "wait on startup_sem\n");
+			spawned++;
+		} end_for_each();
+
+		/*
+		 * The jobs were all spawned before waiting for any of them,
+		 * so they get going side by side. Each checks in once.
+		 */
+		dprint(FD_MUTEX, "wait on startup_sem for %d jobs\n", spawned);
+		while (spawned) {
 			if (fio_sem_down_timeout(startup_sem, 10000)) {
 				log_err("fio: job startup hung? exiting.\n");
 				fio_terminate_threads(TERMINATE_ALL, TERMINATE_ALL);
 				fio_abort = true;
-				nr_started--;
-				free(fd);
+				nr_started -= spawned;
 				break;
 			}
-			dprint(FD_MUTEX, "done waiting on startup_sem\n");
-		} end_for_each();
+			spawned--;
+		}
+		dprint(FD_MUTEX, "done waiting on startup_sem\n");
 
 		/*
 		 * Wait for the started threads to transition to
-		 * TD_INITIALIZED.
+		 * TD_INITIALIZED. They normally have by the time they
+		 * checked in, so look before sleeping.
 		 */
 		fio_gettime(&this_start, NULL);
 		left = this_jobs;
 		while (left && !fio_abort) {
-			if (mtime_since_now(&this_start) > JOB_START_TIMEOUT)
-				break;
-
-			do_usleep(100000);
-
 			for (i = 0; i < this_jobs; i++) {
 				td = map[i];
 				if (!td)
@@ -2526,6 +2823,12 @@ reap:
 					nr_running++; /* work-around... */
 				}
 			}
+
+			if (!left ||
+			    mtime_since_now(&this_start) > JOB_START_TIMEOUT)
+				break;
+
+			do_usleep(10000);
 		}
 
 		if (left) {
@@ -2565,6 +2868,8 @@ reap:
 			do_usleep(100000);
 	}
 
+	free(map);
+
 	while (nr_running) {
 		reap_threads(&nr_running, &t_rate, &m_rate);
 		do_usleep(10000);
@@ -2643,7 +2948,10 @@ int fio_backend(struct sk_out *sk_out)
 		struct thread_stat *ts = &td->ts;
 
 		free_clat_prio_stats(ts);
+		file_stats_free(td);
+		cpu_locality_free(td);
 		steadystate_free(td);
+		phases_free(td);
 		fio_options_free(td);
 		fio_dump_options_free(td);
 		if (td->rusage_sem) {
@@ -0,0 +1,777 @@
+/*
+ * --bench: time the CPU side kernels fio's data path is built from, and
+ * the lib/ data structures behind it, and report them as JSON. memcpy and
+ * the checksums come from the existing --memcpytest and --crctest code,
+ * the rest is timed here. Inputs come from fixed seeds, so two runs do the
+ * same work. For functions with a runtime selected kernel, the dispatch
+ * section says whether the CPU probe picked the one that measured fastest.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fio.h"
+#include "bench.h"
+#include "json.h"
+#include "crc/test.h"
+#include "lib/memcpy.h"
+#include "lib/rand.h"
+#include "lib/pattern.h"
+#include "lib/lfsr.h"
+#include "lib/axmap.h"
+#include "lib/zipf.h"
+#include "lib/rbtree.h"
+#include "lib/prio_tree.h"
+#include "lib/bloom.h"
+#include "lib/num2str.h"
+#include "flist.h"
+
+#define BENCH_SEED	0x8989
+#define BUF_LEN		131072U
+#define BUF_LOOPS	4096U
+#define NR_BITS		(1U << 24)
+#define NR_SAMPLES	(1U << 22)
+#define NR_LAT		(1U << 16)
+#define NR_PERCENTILE	10000U
+#define NR_NODES	(1U << 20)
+#define NR_NUM2STR	(1U << 20)
+/* flist_sort() complains about lists of more than 2^20 entries */
+#define NR_SORT		(1U << 19)
+#define NR_JSON_JOBS	1024U
+
+/* keeps the compiler from dropping loops whose results aren't used */
+static volatile uint64_t bench_sink;
+
+struct bench_json {
+	struct json_array *results;
+	struct json_array *dispatch;
+};
+
+struct bench_group {
+	const char *name;
+	int (*fn)(struct bench_ops *);
+};
+
+static void report(struct bench_ops *ops, const char *group,
+		   const char *name, const char *kernel,
+		   unsigned long long size, uint64_t nr, struct timespec *ts)
+{
+	struct bench_result res = {
+		.group	= group,
+		.name	= name,
+		.kernel	= kernel,
+		.size	= size,
+		.ops	= nr,
+		.nsec	= ntime_since_now(ts),
+	};
+
+	ops->result(ops, &res);
+}
+
+static int bench_memcpy(struct bench_ops *ops)
+{
+	return fio_memcpy_bench(NULL, ops);
+}
+
+static int bench_crc(struct bench_ops *ops)
+{
+	return fio_crc_bench(NULL, ops);
+}
+
+static void bench_rand_gen(struct bench_ops *ops, const char *name,
+			   unsigned int gen)
+{
+	static struct frand_batch batch;
+	struct frand_state state;
+	struct timespec ts;
+	uint64_t sum = 0;
+	unsigned int i;
+
+	init_rand_seed(&state, BENCH_SEED, gen);
+	fio_gettime(&ts, NULL);
+	for (i = 0; i < NR_SAMPLES; i++)
+		sum += __rand(&state);
+	report(ops, "rand", name, "single", 0, NR_SAMPLES, &ts);
+
+	frand_batch_reset(&batch);
+	fio_gettime(&ts, NULL);
+	for (i = 0; i < NR_SAMPLES; i++)
+		sum += frand_batch_next(&batch, &state);
+	report(ops, "rand", name, "batch", 0, NR_SAMPLES, &ts);
+
+	fio_gettime(&ts, NULL);
+	for (i = 0; i < NR_SAMPLES; i++)
+		sum += rand_between(&state, 1, 100);
+	report(ops, "rand", name, "between", 0, NR_SAMPLES, &ts);
+
+	bench_sink = sum;
+}
+
+static int bench_rand(struct bench_ops *ops)
+{
+	struct frand_state state;
+	struct timespec ts;
+	unsigned int i;
+	void *buf;
+
+	bench_rand_gen(ops, "taus88", FRAND_TAUS88);
+	bench_rand_gen(ops, "taus258", FRAND_TAUS258);
+	bench_rand_gen(ops, "xoshiro256", FRAND_XOSHIRO);
+
+	buf = malloc(BUF_LEN);
+	if (!buf)
+		return 1;
+
+	init_rand_seed(&state, BENCH_SEED, false);
+
+	fio_gettime(&ts, NULL);
+	for (i = 0; i < BUF_LOOPS; i++)
+		fill_random_buf(&state, buf, BUF_LEN, FIO_BUF_GEN_XORSHIFT);
+	report(ops, "rand", "xorshift", fill_random_buf_kernel(), BUF_LEN,
+		BUF_LOOPS, &ts);
+
+	fio_gettime(&ts, NULL);
+	for (i = 0; i < BUF_LOOPS; i++)
+		fill_random_buf(&state, buf, BUF_LEN, FIO_BUF_GEN_HASH);
+	report(ops, "rand", "hash", NULL, BUF_LEN, BUF_LOOPS, &ts);
+
+	free(buf);
+	return 0;
+}
+
+static int bench_pattern(struct bench_ops *ops)
+{
+	static const unsigned int lens[] = { 4, 512 };
+	char pattern[512], name[32];
+	struct frand_state state;
+	struct timespec ts;
+	unsigned int i, j;
+	char *buf;
+
+	buf = malloc(BUF_LEN);
+	if (!buf)
+		return 1;
+
+	init_rand_seed(&state, BENCH_SEED, false);
+	fill_random_buf(&state, pattern, sizeof(pattern), FIO_BUF_GEN_XORSHIFT);
+
+	for (i = 0; i < FIO_ARRAY_SIZE(lens); i++) {
+		snprintf(name, sizeof(name), "fill-%u", lens[i]);
+		fio_gettime(&ts, NULL);
+		for (j = 0; j < BUF_LOOPS; j++)
+			cpy_pattern(pattern, lens[i], buf, BUF_LEN);
+		report(ops, "pattern", name, NULL, BUF_LEN, BUF_LOOPS, &ts);
+
+		snprintf(name, sizeof(name), "cmp-%u", lens[i]);
+		fio_gettime(&ts, NULL);
+		for (j = 0; j < BUF_LOOPS; j++)
+			cmp_pattern(pattern, lens[i], 0, buf, BUF_LEN);
+		report(ops, "pattern", name, NULL, BUF_LEN, BUF_LOOPS, &ts);
+	}
+
+	free(buf);
+	return 0;
+}
+
+static int bench_lfsr(struct bench_ops *ops)
+{
+	struct fio_lfsr fl;
+	struct timespec ts;
+	uint64_t off, nr = 0;
+
+	if (lfsr_init(&fl, NR_BITS, BENCH_SEED, 0))
+		return 1;
+
+	fio_gettime(&ts, NULL);
+	while (!lfsr_next(&fl, &off))
+		nr++;
+	report(ops, "lfsr", "next", NULL, 0, nr, &ts);
+
+	lfsr_free(&fl);
+	return 0;
+}
+
+static int bench_axmap(struct bench_ops *ops)
+{
+	struct timespec ts;
+	struct axmap *map;
+	uint64_t i, hits = 0;
+
+	map = axmap_new(NR_BITS);
+	if (!map)
+		return 1;
+
+	fio_gettime(&ts, NULL);
+	for (i = 0; i < NR_BITS; i += 2)
+		axmap_set(map, i);
+	report(ops, "axmap", "set", NULL, 0, NR_BITS / 2, &ts);
+
+	fio_gettime(&ts, NULL);
+	for (i = 0; i < NR_BITS; i++)
+		hits += axmap_isset(map, i);
+	report(ops, "axmap", "isset", NULL, 0, NR_BITS, &ts);
+
+	/* every other bit is set, so each lookup has to step over one */
+	fio_gettime(&ts, NULL);
+	for (i = 0; i < NR_BITS; i += 2)
+		hits += axmap_next_free(map, i) != -1ULL;
+	report(ops, "axmap", "next_free", NULL, 0, NR_BITS / 2, &ts);
+
+	fio_gettime(&ts, NULL);
+	axmap_reset(map);
+	for (i = 0; i < NR_BITS; i++)
+		hits += axmap_claim(map, i);
+	report(ops, "axmap", "claim", NULL, 0, NR_BITS, &ts);
+
+	bench_sink = hits;
+	axmap_free(map);
+	return 0;
+}
+
+static int bench_zipf(struct bench_ops *ops)
+{
+	struct zipf_state zs;
+	struct timespec ts;
+	uint64_t sum = 0;
+	unsigned int i;
+
+	zipf_init(&zs, NR_BITS, 1.2, 0.0, BENCH_SEED);
+	fio_gettime(&ts, NULL);
+	for (i = 0; i < NR_SAMPLES; i++)
+		sum += zipf_next(&zs);
+	report(ops, "zipf", "zipf", NULL, 0, NR_SAMPLES, &ts);
+
+	pareto_init(&zs, NR_BITS, 0.2, 0.0, BENCH_SEED);
+	fio_gettime(&ts, NULL);
+	for (i = 0; i < NR_SAMPLES; i++)
+		sum += pareto_next(&zs);
+	report(ops, "zipf", "pareto", NULL, 0, NR_SAMPLES, &ts);
+
+	bench_sink = sum;
+	return 0;
+}
+
+static int bench_histogram(struct bench_ops *ops)
+{
+	static const double def_list[] = {
+		1.0, 5.0, 10.0, 20.0, 30.0, 40.0, 50.0, 60.0, 70.0,
+		80.0, 90.0, 95.0, 99.0, 99.5, 99.9, 99.95, 99.99,
+	};
+	fio_fp64_t plist[FIO_IO_U_LIST_MAX_LEN];
+	unsigned long long *ovals, minv, maxv;
+	unsigned long long *lat;
+	struct frand_state state;
+	struct timespec ts;
+	uint64_t *plat;
+	unsigned int i;
+
+	plat = calloc(FIO_IO_U_PLAT_NR, sizeof(*plat));
+	lat = malloc(NR_LAT * sizeof(*lat));
+	if (!plat || !lat) {
+		free(plat);
+		free(lat);
+		return 1;
+	}
+
+	/* latencies from 1us to 100ms, in nsec */
+	init_rand_seed(&state, BENCH_SEED, false);
+	for (i = 0; i < NR_LAT; i++)
+		lat[i] = rand_between(&state, 1000, 100000000);
+
+	fio_gettime(&ts, NULL);
+	for (i = 0; i < NR_SAMPLES; i++)
+		plat[plat_val_to_idx(lat[i & (NR_LAT - 1)])]++;
+	report(ops, "histogram", "insert", NULL, 0, NR_SAMPLES, &ts);
+
+	memset(plist, 0, sizeof(plist));
+	for (i = 0; i < FIO_ARRAY_SIZE(def_list); i++)
+		plist[i].u.f = def_list[i];
+
+	fio_gettime(&ts, NULL);
+	for (i = 0; i < NR_PERCENTILE; i++) {
+		if (calc_clat_percentiles(plat, NR_SAMPLES, plist, &ovals,
+					  &maxv, &minv))
+			free(ovals);
+	}
+	report(ops, "histogram", "percentiles", NULL, 0, NR_PERCENTILE, &ts);
+
+	free(plat);
+	free(lat);
+	return 0;
+}
+
+struct bench_node {
+	struct fio_rb_node rb;
+	struct flist_head list;
+	uint64_t key;
+};
+
+static struct bench_node *alloc_nodes(unsigned int nr)
+{
+	struct frand_state state;
+	struct bench_node *nodes;
+	unsigned int i;
+
+	nodes = calloc(nr, sizeof(*nodes));
+	if (!nodes)
+		return NULL;
+
+	init_rand_seed(&state, BENCH_SEED, true);
+	for (i = 0; i < nr; i++)
+		nodes[i].key = __rand(&state);
+
+	return nodes;
+}
+
+static void rb_insert_node(struct rb_root *root, struct bench_node *node)
+{
+	struct fio_rb_node **p = &root->rb_node, *parent = NULL;
+
+	while (*p) {
+		struct bench_node *n;
+
+		parent = *p;
+		n = rb_entry(parent, struct bench_node, rb);
+		if (node->key < n->key)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+
+	rb_link_node(&node->rb, parent, p);
+	rb_insert_color(&node->rb, root);
+}
+
+static struct bench_node *rb_find_node(struct rb_root *root, uint64_t key)
+{
+	struct fio_rb_node *p = root->rb_node;
+
+	while (p) {
+		struct bench_node *n = rb_entry(p, struct bench_node, rb);
+
+		if (key < n->key)
+			p = p->rb_left;
+		else if (key > n->key)
+			p = p->rb_right;
+		else
+			return n;
+	}
+
+	return NULL;
+}
+
+static int bench_rbtree(struct bench_ops *ops)
+{
+	struct rb_root root = RB_ROOT;
+	struct bench_node *nodes;
+	struct fio_rb_node *n;
+	struct timespec ts;
+	uint64_t hits = 0;
+	unsigned int i;
+
+	nodes = alloc_nodes(NR_NODES);
+	if (!nodes)
+		return 1;
+
+	fio_gettime(&ts, NULL);
+	for (i = 0; i < NR_NODES; i++)
+		rb_insert_node(&root, &nodes[i]);
+	report(ops, "rbtree", "insert", NULL, 0, NR_NODES, &ts);
+
+	fio_gettime(&ts, NULL);
+	for (i = 0; i < NR_NODES; i++)
+		hits += rb_find_node(&root, nodes[i].key) != NULL;
+	report(ops, "rbtree", "lookup", NULL, 0, NR_NODES, &ts);
+
+	fio_gettime(&ts, NULL);
+	for (n = rb_first(&root); n; n = rb_next(n))
+		hits++;
+	report(ops, "rbtree", "walk", NULL, 0, NR_NODES, &ts);
+
+	/* in insert order, so the tree is rebalanced from all over */
+	fio_gettime(&ts, NULL);
+	for (i = 0; i < NR_NODES; i++)
+		rb_erase(&nodes[i].rb, &root);
+	report(ops, "rbtree", "erase", NULL, 0, NR_NODES, &ts);
+
+	bench_sink = hits;
+	free(nodes);
+	return 0;
+}
+
+static int bench_prio_tree(struct bench_ops *ops)
+{
+	struct prio_tree_root root;
+	struct prio_tree_node *nodes, *n;
+	struct prio_tree_iter iter;
+	struct frand_state state;
+	struct timespec ts;
+	uint64_t hits = 0;
+	unsigned int i;
+
+	nodes = calloc(NR_NODES, sizeof(*nodes));
+	if (!nodes)
+		return 1;
+
+	/* intervals of up to 64k in a 4G space, like IO ranges */
+	init_rand_seed(&state, BENCH_SEED, true);
+	for (i = 0; i < NR_NODES; i++) {
+		INIT_PRIO_TREE_NODE(&nodes[i]);
+		nodes[i].start = rand_between(&state, 0, UINT32_MAX);
+		nodes[i].last = nodes[i].start + rand_between(&state, 0, 65535);
+	}
+
+	INIT_PRIO_TREE_ROOT(&root);
+	fio_gettime(&ts, NULL);
+	for (i = 0; i < NR_NODES; i++)
+		hits += prio_tree_insert(&root, &nodes[i]) == &nodes[i];
+	report(ops, "prio_tree", "insert", NULL, 0, NR_NODES, &ts);
+
+	fio_gettime(&ts, NULL);
+	for (i = 0; i < NR_NODES; i++) {
+		INIT_PRIO_TREE_ITER(&iter);
+		prio_tree_iter_init(&iter, &root, nodes[i].start,
+					nodes[i].start);
+		while ((n = prio_tree_next(&iter)) != NULL)
+			hits++;
+	}
+	report(ops, "prio_tree", "stab", NULL, 0, NR_NODES, &ts);
+
+	bench_sink = hits;
+	free(nodes);
+	return 0;
+}
+
+static int bench_bloom(struct bench_ops *ops)
+{
+	struct frand_state state;
+	struct timespec ts;
+	struct bloom *b;
+	uint32_t *keys;
+	uint64_t hits = 0;
+	unsigned int i;
+	char str[32];
+
+	/* 4 words, like the dedupe hash of a block */
+	keys = malloc(NR_NODES * 4 * sizeof(uint32_t));
+	b = bloom_new(NR_NODES);
+	if (!keys || !b) {
+		free(keys);
+		if (b)
+			bloom_free(b);
+		return 1;
+	}
+
+	init_rand_seed(&state, BENCH_SEED, false);
+	for (i = 0; i < NR_NODES * 4; i++)
+		keys[i] = __rand(&state);
+
+	fio_gettime(&ts, NULL);
+	for (i = 0; i < NR_NODES; i++)
+		hits += bloom_set(b, &keys[i * 4], 4);
+	report(ops, "bloom", "set", NULL, 0, NR_NODES, &ts);
+
+	/* everything is set now, so these all hit */
+	fio_gettime(&ts, NULL);
+	for (i = 0; i < NR_NODES; i++)
+		hits += bloom_set(b, &keys[i * 4], 4);
+	report(ops, "bloom", "set-hit", NULL, 0, NR_NODES, &ts);
+
+	fio_gettime(&ts, NULL);
+	for (i = 0; i < NR_NODES; i++) {
+		snprintf(str, sizeof(str), "/fio/file.%u", keys[i]);
+		hits += bloom_string(b, str, strlen(str), true);
+	}
+	report(ops, "bloom", "string", NULL, 0, NR_NODES, &ts);
+
+	bench_sink = hits;
+	bloom_free(b);
+	free(keys);
+	return 0;
+}
+
+static int node_cmp(void *priv, struct flist_head *a, struct flist_head *b)
+{
+	struct bench_node *na = flist_entry(a, struct bench_node, list);
+	struct bench_node *nb = flist_entry(b, struct bench_node, list);
+
+	return na->key > nb->key;
+}
+
+static int bench_sort(struct bench_ops *ops)
+{
+	struct bench_node *nodes;
+	struct timespec ts;
+	unsigned int i;
+	FLIST_HEAD(list);
+
+	nodes = alloc_nodes(NR_SORT);
+	if (!nodes)
+		return 1;
+
+	for (i = 0; i < NR_SORT; i++)
+		flist_add_tail(&nodes[i].list, &list);
+
+	fio_gettime(&ts, NULL);
+	flist_sort(NULL, &list, node_cmp);
+	report(ops, "sort", "random", NULL, 0, NR_SORT, &ts);
+
+	fio_gettime(&ts, NULL);
+	flist_sort(NULL, &list, node_cmp);
+	report(ops, "sort", "sorted", NULL, 0, NR_SORT, &ts);
+
+	free(nodes);
+	return 0;
+}
+
+static int bench_num2str(struct bench_ops *ops)
+{
+	struct frand_state state;
+	struct timespec ts;
+	uint64_t *nums, len = 0;
+	unsigned int i;
+	char *str;
+
+	nums = malloc(NR_NUM2STR * sizeof(*nums));
+	if (!nums)
+		return 1;
+
+	/* spread over the unit prefixes, from bytes to petabytes */
+	init_rand_seed(&state, BENCH_SEED, true);
+	for (i = 0; i < NR_NUM2STR; i++)
+		nums[i] = __rand(&state) >> rand_between(&state, 0, 63);
+
+	fio_gettime(&ts, NULL);
+	for (i = 0; i < NR_NUM2STR; i++) {
+		str = num2str(nums[i], 4, 1, i & 1, N2S_BYTEPERSEC);
+		len += strlen(str);
+		free(str);
+	}
+	report(ops, "num2str", "num2str", NULL, 0, NR_NUM2STR, &ts);
+
+	bench_sink = len;
+	free(nums);
+	return 0;
+}
+
+/*
+ * Roughly the shape of one job in --output-format=json: a few dozen
+ * values per direction, plus a latency percentile list.
+ */
+static void json_fill_job(struct json_object *job, struct frand_state *state,
+			  unsigned int nr)
+{
+	static const char *ddirs[] = { "read", "write", "trim" };
+	struct json_object *dir, *lat, *pct;
+	unsigned int i, j;
+	char name[32];
+
+	json_object_add_value_string(job, "jobname", "bench");
+	json_object_add_value_int(job, "groupid", nr);
+	json_object_add_value_int(job, "error", 0);
+
+	for (i = 0; i < FIO_ARRAY_SIZE(ddirs); i++) {
+		dir = json_create_object();
+		json_object_add_value_object(job, ddirs[i], dir);
+		json_object_add_value_int(dir, "io_bytes", __rand(state));
+		json_object_add_value_int(dir, "bw", __rand(state) >> 40);
+		json_object_add_value_float(dir, "iops",
+					    (double) __rand(state) / 1e12);
+		json_object_add_value_int(dir, "runtime", __rand(state) >> 50);
+
+		lat = json_create_object();
+		json_object_add_value_object(dir, "clat_ns", lat);
+		json_object_add_value_int(lat, "min", __rand(state) >> 48);
+		json_object_add_value_int(lat, "max", __rand(state) >> 32);
+		json_object_add_value_float(lat, "mean",
+					    (double) __rand(state) / 1e10);
+		json_object_add_value_float(lat, "stddev",
+					    (double) __rand(state) / 1e12);
+
+		pct = json_create_object();
+		json_object_add_value_object(lat, "percentile", pct);
+		for (j = 0; j < 17; j++) {
+			snprintf(name, sizeof(name), "%f", 1.0 + j * 5.8);
+			json_object_add_value_int(pct, name,
+						  __rand(state) >> 40);
+		}
+	}
+}
+
+static int bench_json(struct bench_ops *ops)
+{
+	struct frand_state state;
+	struct json_object *root, *job;
+	struct json_array *jobs;
+	struct buf_output out;
+	struct timespec ts;
+	unsigned int i;
+
+	init_rand_seed(&state, BENCH_SEED, true);
+
+	fio_gettime(&ts, NULL);
+	root = json_create_object();
+	jobs = json_create_array();
+	json_object_add_value_array(root, "jobs", jobs);
+	for (i = 0; i < NR_JSON_JOBS; i++) {
+		job = json_create_object();
+		json_array_add_value_object(jobs, job);
+		json_fill_job(job, &state, i);
+	}
+	report(ops, "json", "build", NULL, 0, NR_JSON_JOBS, &ts);
+
+	buf_output_init(&out);
+	fio_gettime(&ts, NULL);
+	json_print_object(root, &out);
+	report(ops, "json", "print", NULL, 0, NR_JSON_JOBS, &ts);
+	bench_sink = out.buflen;
+	buf_output_free(&out);
+
+	fio_gettime(&ts, NULL);
+	json_free_object(root);
+	report(ops, "json", "free", NULL, 0, NR_JSON_JOBS, &ts);
+	return 0;
+}
+
+static struct bench_group groups[] = {
+	{ "memcpy",	bench_memcpy },
+	{ "crc",	bench_crc },
+	{ "rand",	bench_rand },
+	{ "pattern",	bench_pattern },
+	{ "lfsr",	bench_lfsr },
+	{ "axmap",	bench_axmap },
+	{ "zipf",	bench_zipf },
+	{ "histogram",	bench_histogram },
+	{ "rbtree",	bench_rbtree },
+	{ "prio_tree",	bench_prio_tree },
+	{ "bloom",	bench_bloom },
+	{ "sort",	bench_sort },
+	{ "num2str",	bench_num2str },
+	{ "json",	bench_json },
+	{ NULL, },
+};
+
+static void json_result(struct bench_ops *ops, const struct bench_result *r)
+{
+	struct bench_json *bj = ops->priv;
+	struct json_object *obj;
+
+	obj = json_create_object();
+	json_object_add_value_string(obj, "group", r->group);
+	json_object_add_value_string(obj, "name", r->name);
+	if (r->kernel)
+		json_object_add_value_string(obj, "kernel", r->kernel);
+	if (r->size)
+		json_object_add_value_int(obj, "size", r->size);
+	json_object_add_value_int(obj, "ops", r->ops);
+	json_object_add_value_int(obj, "ns", r->nsec);
+	json_object_add_value_float(obj, "ns_per_op",
+			r->ops ? (double) r->nsec / r->ops : 0.0);
+	/* bytes per nsec is GB/s */
+	if (r->size)
+		json_object_add_value_float(obj, "gb_per_sec",
+			r->nsec ? (double) r->size * r->ops / r->nsec : 0.0);
+
+	json_array_add_value_object(bj->results, obj);
+}
+
+static void json_dispatch(struct bench_ops *ops,
+			  const struct bench_dispatch *d)
+{
+	struct bench_json *bj = ops->priv;
+	struct json_object *obj;
+
+	obj = json_create_object();
+	json_object_add_value_string(obj, "group", d->group);
+	json_object_add_value_string(obj, "name", d->name);
+	json_object_add_value_string(obj, "selected", d->selected);
+	json_object_add_value_string(obj, "fastest", d->fastest);
+	json_object_add_value_int(obj, "selected_is_fastest",
+				  !strcmp(d->selected, d->fastest));
+
+	json_array_add_value_object(bj->dispatch, obj);
+}
+
+static unsigned int get_group_mask(const char *type)
+{
+	char *ostr, *str = strdup(type);
+	unsigned int mask = 0;
+	char *name;
+	int i;
+
+	ostr = str;
+	while ((name = strsep(&str, ",")) != NULL) {
+		for (i = 0; groups[i].name; i++) {
+			if (!strcmp(groups[i].name, name)) {
+				mask |= 1U << i;
+				break;
+			}
+		}
+	}
+
+	free(ostr);
+	return mask;
+}
+
+static int list_groups(void)
+{
+	int i;
+
+	for (i = 0; groups[i].name; i++)
+		printf("%s\n", groups[i].name);
+
+	return 1;
+}
+
+int fio_bench(const char *type)
+{
+	struct bench_ops ops = {
+		.result		= json_result,
+		.dispatch	= json_dispatch,
+	};
+	struct json_object *root;
+	struct bench_json bj;
+	struct buf_output out;
+	unsigned int mask;
+	int i, ret = 0;
+
+	if (!type)
+		mask = ~0U;
+	else if (!strcmp(type, "help") || !strcmp(type, "list"))
+		return list_groups();
+	else
+		mask = get_group_mask(type);
+
+	if (!mask) {
+		fprintf(stderr, "fio: unknown bench `%s`. Available:\n", type);
+		return list_groups();
+	}
+
+	root = json_create_object();
+	json_object_add_value_string(root, "fio version", fio_version_string);
+	bj.results = json_create_array();
+	bj.dispatch = json_create_array();
+	json_object_add_value_array(root, "results", bj.results);
+	json_object_add_value_array(root, "dispatch", bj.dispatch);
+	ops.priv = &bj;
+
+	/* spin up the CPU before the first timed loop */
+	usec_spin(100000);
+
+	for (i = 0; groups[i].name; i++) {
+		if (!(mask & (1U << i)))
+			continue;
+		if (groups[i].fn(&ops)) {
+			log_err("fio: bench %s failed\n", groups[i].name);
+			ret = 1;
+		}
+	}
+
+	buf_output_init(&out);
+	json_print_object(root, &out);
+	log_buf(&out, "\n");
+	log_info_buf(out.buf, out.buflen);
+	buf_output_free(&out);
+	json_free_object(root);
+	return ret;
+}
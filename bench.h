@@ -0,0 +1,38 @@
+#ifndef FIO_BENCH_H
+#define FIO_BENCH_H
+
+#include <inttypes.h>
+
+/*
+ * One timed kernel run. 'size' is the bytes handled per op, 0 for ops
+ * that don't work on a buffer (lfsr, zipf, ...).
+ */
+struct bench_result {
+	const char *group;
+	const char *name;
+	const char *kernel;		/* NULL unless several are run */
+	unsigned long long size;
+	uint64_t ops;
+	uint64_t nsec;
+};
+
+/*
+ * For functions with a runtime selected kernel, which one the CPU probe
+ * picked and which one measured fastest.
+ */
+struct bench_dispatch {
+	const char *group;
+	const char *name;
+	const char *selected;
+	const char *fastest;
+};
+
+struct bench_ops {
+	void (*result)(struct bench_ops *, const struct bench_result *);
+	void (*dispatch)(struct bench_ops *, const struct bench_dispatch *);
+	void *priv;
+};
+
+int fio_bench(const char *type);
+
+#endif
@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sys/sysmacros.h>
 
 #include "flist.h"
@@ -398,6 +399,71 @@ static void depth_end(struct blk_io_trace *t, int *this_depth, int *depth)
 	}
 }
 
+/*
+ * replay_queue_depth: the IOs queued and not yet completed at each point
+ * of the trace, oldest first. Stacked devices don't always complete, so
+ * the list is capped like the probed depth is, dropping the oldest.
+ */
+#define TRACE_MAX_INFLIGHT	1024
+
+struct trace_inflight {
+	unsigned int nr;
+	unsigned int max_depth;
+	struct {
+		__u32 device;
+		__u64 sector;
+	} ios[TRACE_MAX_INFLIGHT];
+};
+
+static void inflight_del(struct trace_inflight *ti, unsigned int i)
+{
+	ti->nr--;
+	memmove(&ti->ios[i], &ti->ios[i + 1], (ti->nr - i) * sizeof(ti->ios[0]));
+}
+
+/*
+ * The ipo just queued for t is issued once no more IOs are in flight
+ * than there were when t was queued in the trace
+ */
+static void inflight_queued(struct thread_data *td, struct blk_io_trace *t)
+{
+	struct trace_inflight *ti = td->io_log_inflight;
+	struct io_piece *ipo;
+
+	ipo = flist_last_entry(&td->io_log_list, struct io_piece, list);
+	ipo->depth = ti->nr;
+	ti->max_depth = max(ti->max_depth, ti->nr + 1);
+
+	/* flush completions don't say which flush they belong to */
+	if (ipo->ddir == DDIR_SYNC)
+		return;
+
+	if (ti->nr == TRACE_MAX_INFLIGHT)
+		inflight_del(ti, 0);
+	ti->ios[ti->nr].device = t->device;
+	ti->ios[ti->nr].sector = t->sector;
+	ti->nr++;
+}
+
+/*
+ * A completion covers the IOs that were merged into the request, so drop
+ * every IO queued in its range
+ */
+static void inflight_completed(struct trace_inflight *ti,
+			       struct blk_io_trace *t)
+{
+	__u64 end = t->sector + (t->bytes >> 9);
+	unsigned int i = 0;
+
+	while (i < ti->nr) {
+		if (ti->ios[i].device == t->device &&
+		    ti->ios[i].sector >= t->sector && ti->ios[i].sector < end)
+			inflight_del(ti, i);
+		else
+			i++;
+	}
+}
+
 /*
  * Load a blktrace file by reading all the blk_io_trace entries, and storing
  * them as io_pieces like the fio text version would do.
@@ -457,6 +523,9 @@ bool read_blktrace(struct thread_data* td)
 	int depth[DDIR_RWDIR_CNT] = { };
 	int64_t items_to_fetch = 0;
 
+	if (td->o.replay_queue_depth && !td->io_log_inflight)
+		td->io_log_inflight = calloc(1, sizeof(struct trace_inflight));
+
 	if (td->o.read_iolog_chunked) {
 		items_to_fetch = iolog_items_to_fetch(td);
 		if (!items_to_fetch)
@@ -501,8 +570,12 @@ bool read_blktrace(struct thread_data* td)
 			else if (((t.action & 0xffff) == __BLK_TA_BACKMERGE) ||
 				((t.action & 0xffff) == __BLK_TA_FRONTMERGE))
 				depth_dec(&t, this_depth);
-			else if ((t.action & 0xffff) == __BLK_TA_COMPLETE)
+			else if ((t.action & 0xffff) == __BLK_TA_COMPLETE) {
 				depth_end(&t, this_depth, depth);
+				if (td->io_log_inflight)
+					inflight_completed(td->io_log_inflight,
+							   &t);
+			}
 
 			if (t_is_write(&t) && read_only) {
 				skipped_writes++;
@@ -512,6 +585,8 @@ bool read_blktrace(struct thread_data* td)
 
 		if (!queue_trace(td, &t, ios, rw_bs, &cache))
 			continue;
+		if (td->io_log_inflight)
+			inflight_queued(td, &t);
 
 		if (td->o.read_iolog_chunked) {
 			td->io_log_current++;
@@ -570,6 +645,8 @@ bool read_blktrace(struct thread_data* td)
 			depth[i] = 1;
 		max_depth = max(depth[i], max_depth);
 	}
+	if (td->io_log_inflight)
+		max_depth = max(max_depth, (int) td->io_log_inflight->max_depth);
 
 	if (!ios[DDIR_READ] && !ios[DDIR_WRITE] && !ios[DDIR_TRIM] &&
 	    !ios[DDIR_SYNC]) {
@@ -625,38 +702,6 @@ static int init_merge_param_list(fio_fp64_t *vals, struct blktrace_cursor *bcs,
 
 }
 
-static int find_earliest_io(struct blktrace_cursor *bcs, int nr_logs)
-{
-	__u64 time = ~(__u64)0;
-	int idx = 0, i;
-
-	for (i = 0; i < nr_logs; i++) {
-		if (bcs[i].t.time < time) {
-			time = bcs[i].t.time;
-			idx = i;
-		}
-	}
-
-	return idx;
-}
-
-static void merge_finish_file(struct blktrace_cursor *bcs, int i, int *nr_logs)
-{
-	bcs[i].iter++;
-	if (bcs[i].iter < bcs[i].nr_iter) {
-		fseek(bcs[i].f, 0, SEEK_SET);
-		return;
-	}
-
-	*nr_logs -= 1;
-
-	/* close file */
-	fclose(bcs[i].f);
-
-	/* keep active files contiguous */
-	memmove(&bcs[i], &bcs[*nr_logs], sizeof(bcs[i]));
-}
-
 static int read_trace(struct thread_data *td, struct blktrace_cursor *bc)
 {
 	int ret = 0;
@@ -664,7 +709,7 @@ static int read_trace(struct thread_data *td, struct blktrace_cursor *bc)
 
 read_skip:
 	/* read an io trace */
-	ret = fread(&t, 1, sizeof(t), bc->f);
+	ret = fread(t, 1, sizeof(*t), bc->f);
 	if (ferror(bc->f)) {
 		td_verror(td, errno, "read blktrace file");
 		return ret;
@@ -703,15 +748,203 @@ static int write_trace(FILE *fp, struct blk_io_trace *t)
 	return fwrite((void *)t, sizeof(*t), 1, fp);
 }
 
+/*
+ * Each file being merged is decoded by its own reader thread, which hands
+ * the traces fio replays to the merge in batches. The merge picks the
+ * earliest trace of all files from a heap ordered by time.
+ */
+#define BLKTRACE_BATCH		1024
+#define BLKTRACE_NR_BATCHES	4
+
+struct blktrace_batch {
+	unsigned int nr;
+	struct blk_io_trace t[BLKTRACE_BATCH];
+};
+
+/*
+ * Read the next trace to merge from the file, rewinding for the next
+ * iteration at the end of it. Returns 1 if a trace was read, 0 at the
+ * end of the last iteration and < 0 on error.
+ */
+static int merge_read_trace(struct blktrace_cursor *bc)
+{
+	int ret;
+
+	do {
+		ret = read_trace(bc->td, bc);
+		if (ret > 0) {
+			/* skip over the pdu */
+			ret = discard_pdu(bc->f, &bc->t);
+			if (ret < 0) {
+				td_verror(bc->td, -ret, "blktrace lseek");
+				return ret;
+			}
+			return 1;
+		} else if (ret < 0)
+			return ret;
+
+		bc->iter++;
+		if (bc->iter >= bc->nr_iter)
+			return 0;
+		fseek(bc->f, 0, SEEK_SET);
+	} while (1);
+}
+
+static void *merge_reader_thread(void *data)
+{
+	struct blktrace_cursor *bc = data;
+	struct blktrace_batch *b;
+	bool stop;
+	int ret = 1;
+
+	while (ret > 0) {
+		pthread_mutex_lock(&bc->lock);
+		while (bc->wr - bc->rd == BLKTRACE_NR_BATCHES && !bc->stop)
+			pthread_cond_wait(&bc->cond, &bc->lock);
+		stop = bc->stop;
+		pthread_mutex_unlock(&bc->lock);
+		if (stop)
+			break;
+
+		b = &bc->batches[bc->wr % BLKTRACE_NR_BATCHES];
+		b->nr = 0;
+		while (b->nr < BLKTRACE_BATCH) {
+			ret = merge_read_trace(bc);
+			if (ret <= 0)
+				break;
+			b->t[b->nr++] = bc->t;
+		}
+
+		pthread_mutex_lock(&bc->lock);
+		if (b->nr)
+			bc->wr++;
+		if (ret <= 0) {
+			bc->err = ret;
+			bc->done = true;
+		}
+		pthread_cond_signal(&bc->cond);
+		pthread_mutex_unlock(&bc->lock);
+	}
+
+	return NULL;
+}
+
+/*
+ * Return the next trace of the file, or NULL once all of it is merged
+ */
+static struct blk_io_trace *merge_next_trace(struct blktrace_cursor *bc)
+{
+	if (bc->cur && ++bc->pos < bc->cur->nr)
+		return &bc->cur->t[bc->pos];
+
+	pthread_mutex_lock(&bc->lock);
+	if (bc->cur) {
+		bc->rd++;
+		pthread_cond_signal(&bc->cond);
+	}
+	while (bc->rd == bc->wr && !bc->done)
+		pthread_cond_wait(&bc->cond, &bc->lock);
+	if (bc->rd == bc->wr)
+		bc->cur = NULL;
+	else
+		bc->cur = &bc->batches[bc->rd % BLKTRACE_NR_BATCHES];
+	bc->pos = 0;
+	pthread_mutex_unlock(&bc->lock);
+
+	return bc->cur ? &bc->cur->t[0] : NULL;
+}
+
+static inline struct blk_io_trace *cursor_trace(struct blktrace_cursor *bc)
+{
+	return &bc->cur->t[bc->pos];
+}
+
+/*
+ * Order by time, and by position on the command line for equal times
+ */
+static bool cursor_before(struct blktrace_cursor *a, struct blktrace_cursor *b)
+{
+	__u64 ta = cursor_trace(a)->time, tb = cursor_trace(b)->time;
+
+	return ta < tb || (ta == tb && a->idx < b->idx);
+}
+
+static void heap_sift_down(struct blktrace_cursor **heap, int nr, int i)
+{
+	struct blktrace_cursor *tmp;
+	int child;
+
+	while ((child = 2 * i + 1) < nr) {
+		if (child + 1 < nr && cursor_before(heap[child + 1], heap[child]))
+			child++;
+		if (!cursor_before(heap[child], heap[i]))
+			break;
+		tmp = heap[i];
+		heap[i] = heap[child];
+		heap[child] = tmp;
+		i = child;
+	}
+}
+
+static void heap_init(struct blktrace_cursor **heap, int nr)
+{
+	int i;
+
+	for (i = nr / 2 - 1; i >= 0; i--)
+		heap_sift_down(heap, nr, i);
+}
+
+static struct blktrace_cursor *find_earliest_io(struct blktrace_cursor **heap)
+{
+	return heap[0];
+}
+
+static int merge_start_reader(struct blktrace_cursor *bc)
+{
+	bc->batches = malloc(BLKTRACE_NR_BATCHES * sizeof(*bc->batches));
+	if (!bc->batches)
+		return -ENOMEM;
+
+	pthread_mutex_init(&bc->lock, NULL);
+	pthread_cond_init(&bc->cond, NULL);
+	if (pthread_create(&bc->thread, NULL, merge_reader_thread, bc)) {
+		pthread_cond_destroy(&bc->cond);
+		pthread_mutex_destroy(&bc->lock);
+		free(bc->batches);
+		bc->batches = NULL;
+		return -errno;
+	}
+
+	return 0;
+}
+
+static void merge_stop_reader(struct blktrace_cursor *bc)
+{
+	if (!bc->batches)
+		return;
+
+	pthread_mutex_lock(&bc->lock);
+	bc->stop = true;
+	pthread_cond_signal(&bc->cond);
+	pthread_mutex_unlock(&bc->lock);
+	pthread_join(bc->thread, NULL);
+
+	pthread_cond_destroy(&bc->cond);
+	pthread_mutex_destroy(&bc->lock);
+	free(bc->batches);
+	bc->batches = NULL;
+}
+
 int merge_blktrace_iologs(struct thread_data *td)
 {
 	int nr_logs = get_max_str_idx(td->o.read_iolog_file);
-	struct blktrace_cursor *bcs = malloc(sizeof(struct blktrace_cursor) *
-					     nr_logs);
+	struct blktrace_cursor *bcs = calloc(nr_logs,
+					     sizeof(struct blktrace_cursor));
+	struct blktrace_cursor **heap = calloc(nr_logs, sizeof(*heap));
 	struct blktrace_cursor *bc;
 	FILE *merge_fp;
-	char *str, *ptr, *name, *merge_buf;
-	int i, ret;
+	char *str, *ptr, *name, *merge_buf = NULL;
+	int i, ret, nr_files = 0, nr_heap = 0;
 
 	ret = init_merge_param_list(td->o.merge_blktrace_scalars, bcs, nr_logs,
 				    100, offsetof(struct blktrace_cursor,
@@ -733,77 +966,93 @@ int merge_blktrace_iologs(struct thread_data *td)
 
 	/* setup output file */
 	merge_fp = fopen(td->o.merge_blktrace_file, "w");
+	if (!merge_fp) {
+		log_err("fio: could not open merge file: %s\n",
+			td->o.merge_blktrace_file);
+		ret = -errno;
+		goto err_param;
+	}
 	merge_buf = malloc(128 * 1024);
-	if (!merge_buf)
+	if (!merge_buf) {
+		ret = -ENOMEM;
 		goto err_out_file;
+	}
 	ret = setvbuf(merge_fp, merge_buf, _IOFBF, 128 * 1024);
 	if (ret)
-		goto err_merge_buf;
+		goto err_out_file;
 
-	/* setup input files */
+	/* setup input files, and start a reader for each */
 	str = ptr = strdup(td->o.read_iolog_file);
-	nr_logs = 0;
 	for (i = 0; (name = get_next_str(&ptr)) != NULL; i++) {
-		bcs[i].f = fopen(name, "rb");
-		if (!bcs[i].f) {
+		bc = &bcs[i];
+		bc->f = fopen(name, "rb");
+		if (!bc->f) {
 			log_err("fio: could not open file: %s\n", name);
 			ret = -errno;
 			free(str);
 			goto err_file;
 		}
-		nr_logs++;
+		nr_files++;
 
-		if (!is_blktrace(name, &bcs[i].swap)) {
+		if (!is_blktrace(name, &bc->swap)) {
 			log_err("fio: file is not a blktrace: %s\n", name);
+			ret = -EINVAL;
 			free(str);
 			goto err_file;
 		}
 
-		ret = read_trace(td, &bcs[i]);
-		if (ret < 0) {
+		bc->td = td;
+		bc->idx = i;
+		ret = merge_start_reader(bc);
+		if (ret) {
+			log_err("fio: failed to start blktrace reader: %s\n",
+				strerror(-ret));
 			free(str);
 			goto err_file;
-		} else if (!ret) {
-			merge_finish_file(bcs, i, &nr_logs);
-			i--;
 		}
 	}
 	free(str);
 
+	for (i = 0; i < nr_files; i++) {
+		if (merge_next_trace(&bcs[i]))
+			heap[nr_heap++] = &bcs[i];
+	}
+	heap_init(heap, nr_heap);
+
 	/* merge files */
-	while (nr_logs) {
-		i = find_earliest_io(bcs, nr_logs);
-		bc = &bcs[i];
-		/* skip over the pdu */
-		ret = discard_pdu(bc->f, &bc->t);
-		if (ret < 0) {
-			td_verror(td, -ret, "blktrace lseek");
-			goto err_file;
-		}
+	while (nr_heap) {
+		bc = find_earliest_io(heap);
+		write_trace(merge_fp, cursor_trace(bc));
+		if (!merge_next_trace(bc))
+			heap[0] = heap[--nr_heap];
+		heap_sift_down(heap, nr_heap, 0);
+	}
 
-		ret = write_trace(merge_fp, &bc->t);
-		ret = read_trace(td, bc);
-		if (ret < 0)
-			goto err_file;
-		else if (!ret)
-			merge_finish_file(bcs, i, &nr_logs);
+	ret = 0;
+	for (i = 0; i < nr_files; i++) {
+		if (bcs[i].err < 0)
+			ret = bcs[i].err;
 	}
 
 	/* set iolog file to read from the newly merged file */
-	td->o.read_iolog_file = td->o.merge_blktrace_file;
-	ret = 0;
+	if (!ret) {
+		free(td->o.read_iolog_file);
+		td->o.read_iolog_file = strdup(td->o.merge_blktrace_file);
+	}
 
 err_file:
 	/* cleanup */
-	for (i = 0; i < nr_logs; i++) {
+	for (i = 0; i < nr_files; i++) {
+		merge_stop_reader(&bcs[i]);
 		fclose(bcs[i].f);
 	}
-err_merge_buf:
-	free(merge_buf);
 err_out_file:
+	/* the stream uses merge_buf, close it first */
 	fflush(merge_fp);
 	fclose(merge_fp);
+	free(merge_buf);
 err_param:
+	free(heap);
 	free(bcs);
 
 	return ret;
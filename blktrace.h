@@ -5,9 +5,12 @@
 #ifdef FIO_HAVE_BLKTRACE
 
 #include <asm/types.h>
+#include <pthread.h>
 
 #include "blktrace_api.h"
 
+struct blktrace_batch;
+
 struct blktrace_cursor {
 	struct fifo		*fifo;	// fifo queue for reading
 	FILE			*f;	// blktrace file
@@ -17,6 +20,24 @@ struct blktrace_cursor {
 	int			scalar;	// scale percentage
 	int			iter;	// current iteration
 	int			nr_iter; // number of iterations to run
+
+	/*
+	 * Merging: traces are decoded by a reader thread per file into
+	 * batches, and handed to the merge in order
+	 */
+	struct thread_data	*td;
+	int			idx;	// position in the read_iolog list
+	pthread_t		thread;
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	struct blktrace_batch	*batches;
+	unsigned int		rd;	// batches consumed by the merge
+	unsigned int		wr;	// batches filled by the reader
+	struct blktrace_batch	*cur;	// batch the merge is consuming
+	unsigned int		pos;	// position in cur
+	bool			done;	// reader hit end of file or error
+	bool			stop;	// merge asks the reader to exit
+	int			err;
 };
 
 bool is_blktrace(const char *, int *);
@@ -47,6 +47,13 @@ static void free_thread_options_to_cpu(struct thread_options *o)
 	free(o->ioscheduler);
 	free(o->profile);
 	free(o->cgroup);
+	free(o->phases);
+	free(o->sweep);
+	free(o->precondition);
+	free(o->cgroup_io_max);
+	free(o->cgroup_io_latency);
+	free(o->cgroup_io_cost_qos);
+	free(o->latency_log_file);
 
 	free(o->verify_pattern);
 	free(o->buffer_pattern);
@@ -94,6 +101,13 @@ int convert_thread_options_to_cpu(struct thread_options *o,
 	string_to_cpu(&o->ioscheduler, top->ioscheduler);
 	string_to_cpu(&o->profile, top->profile);
 	string_to_cpu(&o->cgroup, top->cgroup);
+	string_to_cpu(&o->phases, top->phases);
+	string_to_cpu(&o->sweep, top->sweep);
+	string_to_cpu(&o->precondition, top->precondition);
+	string_to_cpu(&o->cgroup_io_max, top->cgroup_io_max);
+	string_to_cpu(&o->cgroup_io_latency, top->cgroup_io_latency);
+	string_to_cpu(&o->cgroup_io_cost_qos, top->cgroup_io_cost_qos);
+	string_to_cpu(&o->latency_log_file, top->latency_log_file);
 
 	o->allow_create = le32_to_cpu(top->allow_create);
 	o->allow_mounted_write = le32_to_cpu(top->allow_mounted_write);
@@ -108,6 +122,7 @@ int convert_thread_options_to_cpu(struct thread_options *o,
 	o->iodepth_batch = le32_to_cpu(top->iodepth_batch);
 	o->iodepth_batch_complete_min = le32_to_cpu(top->iodepth_batch_complete_min);
 	o->iodepth_batch_complete_max = le32_to_cpu(top->iodepth_batch_complete_max);
+	o->iodepth_batch_complete_adaptive = le32_to_cpu(top->iodepth_batch_complete_adaptive);
 	o->serialize_overlap = le32_to_cpu(top->serialize_overlap);
 	o->size = le64_to_cpu(top->size);
 	o->io_size = le64_to_cpu(top->io_size);
@@ -151,6 +166,8 @@ int convert_thread_options_to_cpu(struct thread_options *o,
 		o->ratemin[i] = le64_to_cpu(top->ratemin[i]);
 		o->rate_iops[i] = le32_to_cpu(top->rate_iops[i]);
 		o->rate_iops_min[i] = le32_to_cpu(top->rate_iops_min[i]);
+		o->rate_bucket_iops[i] = le32_to_cpu(top->rate_bucket_iops[i]);
+		o->rate_bucket_burst[i] = le32_to_cpu(top->rate_bucket_burst[i]);
 
 		o->perc_rand[i] = le32_to_cpu(top->perc_rand[i]);
 
@@ -159,17 +176,24 @@ int convert_thread_options_to_cpu(struct thread_options *o,
 
 	o->ratecycle = le32_to_cpu(top->ratecycle);
 	o->io_submit_mode = le32_to_cpu(top->io_submit_mode);
+	o->freelist_order = le32_to_cpu(top->freelist_order);
+	o->sync_workers = le32_to_cpu(top->sync_workers);
 	o->unique_filename = le32_to_cpu(top->unique_filename);
 	o->nr_files = le32_to_cpu(top->nr_files);
 	o->open_files = le32_to_cpu(top->open_files);
 	o->file_lock_mode = le32_to_cpu(top->file_lock_mode);
+	o->lockfile_stripe = le32_to_cpu(top->lockfile_stripe);
 	o->odirect = le32_to_cpu(top->odirect);
 	o->oatomic = le32_to_cpu(top->oatomic);
 	o->invalidate_cache = le32_to_cpu(top->invalidate_cache);
 	o->create_serialize = le32_to_cpu(top->create_serialize);
 	o->create_fsync = le32_to_cpu(top->create_fsync);
 	o->create_on_open = le32_to_cpu(top->create_on_open);
+	o->tree_depth = le32_to_cpu(top->tree_depth);
+	o->tree_fanout = le32_to_cpu(top->tree_fanout);
+	o->tree_files = le32_to_cpu(top->tree_files);
 	o->create_only = le32_to_cpu(top->create_only);
+	o->create_threads = le32_to_cpu(top->create_threads);
 	o->end_fsync = le32_to_cpu(top->end_fsync);
 	o->pre_read = le32_to_cpu(top->pre_read);
 	o->sync_io = le32_to_cpu(top->sync_io);
@@ -178,6 +202,11 @@ int convert_thread_options_to_cpu(struct thread_options *o,
 	o->do_verify = le32_to_cpu(top->do_verify);
 	o->experimental_verify = le32_to_cpu(top->experimental_verify);
 	o->verify_state = le32_to_cpu(top->verify_state);
+	o->verify_state_interval = le64_to_cpu(top->verify_state_interval);
+	o->verify_bitmap = le32_to_cpu(top->verify_bitmap);
+	o->verify_table = le32_to_cpu(top->verify_table);
+	o->verify_sample_rate.u.f = fio_uint64_to_double(le64_to_cpu(top->verify_sample_rate.u.i));
+	o->verify_sample_mode = le32_to_cpu(top->verify_sample_mode);
 	o->verify_interval = le32_to_cpu(top->verify_interval);
 	o->verify_offset = le32_to_cpu(top->verify_offset);
 
@@ -199,7 +228,9 @@ int convert_thread_options_to_cpu(struct thread_options *o,
 	o->verify_fatal = le32_to_cpu(top->verify_fatal);
 	o->verify_dump = le32_to_cpu(top->verify_dump);
 	o->verify_async = le32_to_cpu(top->verify_async);
+	o->verify_threads = le32_to_cpu(top->verify_threads);
 	o->verify_batch = le32_to_cpu(top->verify_batch);
+	o->verify_backlog_mode = le32_to_cpu(top->verify_backlog_mode);
 	o->use_thread = le32_to_cpu(top->use_thread);
 	o->unlink = le32_to_cpu(top->unlink);
 	o->unlink_each_loop = le32_to_cpu(top->unlink_each_loop);
@@ -215,6 +246,14 @@ int convert_thread_options_to_cpu(struct thread_options *o,
 	o->log_max = le32_to_cpu(top->log_max);
 	o->log_offset = le32_to_cpu(top->log_offset);
 	o->log_prio = le32_to_cpu(top->log_prio);
+	o->log_binary = le32_to_cpu(top->log_binary);
+	o->log_write_behind = le32_to_cpu(top->log_write_behind);
+	o->log_mmap = le32_to_cpu(top->log_mmap);
+	o->log_sample = le32_to_cpu(top->log_sample);
+	o->log_sample_nth = le32_to_cpu(top->log_sample_nth);
+	o->log_sample_reservoir = le32_to_cpu(top->log_sample_reservoir);
+	o->log_sample_msec = le32_to_cpu(top->log_sample_msec);
+	o->log_sample_percentile.u.f = fio_uint64_to_double(le64_to_cpu(top->log_sample_percentile.u.i));
 	o->log_gz = le32_to_cpu(top->log_gz);
 	o->log_gz_store = le32_to_cpu(top->log_gz_store);
 	o->log_unix_epoch = le32_to_cpu(top->log_unix_epoch);
@@ -222,9 +261,13 @@ int convert_thread_options_to_cpu(struct thread_options *o,
 	o->log_alternate_epoch_clock_id = le32_to_cpu(top->log_alternate_epoch_clock_id);
 	o->norandommap = le32_to_cpu(top->norandommap);
 	o->softrandommap = le32_to_cpu(top->softrandommap);
+	o->randommap_shared = le32_to_cpu(top->randommap_shared);
 	o->bs_unaligned = le32_to_cpu(top->bs_unaligned);
 	o->fsync_on_close = le32_to_cpu(top->fsync_on_close);
 	o->bs_is_seq_rand = le32_to_cpu(top->bs_is_seq_rand);
+	o->num_range = le32_to_cpu(top->num_range);
+	o->trim_mode = le32_to_cpu(top->trim_mode);
+	o->phases_loop = le32_to_cpu(top->phases_loop);
 	o->random_distribution = le32_to_cpu(top->random_distribution);
 	o->exitall_error = le32_to_cpu(top->exitall_error);
 	o->zipf_theta.u.f = fio_uint64_to_double(le64_to_cpu(top->zipf_theta.u.i));
@@ -232,10 +275,14 @@ int convert_thread_options_to_cpu(struct thread_options *o,
 	o->gauss_dev.u.f = fio_uint64_to_double(le64_to_cpu(top->gauss_dev.u.i));
 	o->random_center.u.f = fio_uint64_to_double(le64_to_cpu(top->random_center.u.i));
 	o->random_generator = le32_to_cpu(top->random_generator);
+	o->random_partition = le32_to_cpu(top->random_partition);
 	o->hugepage_size = le32_to_cpu(top->hugepage_size);
+	o->iomem_numa = le32_to_cpu(top->iomem_numa);
+	o->iomem_numa_node = le32_to_cpu(top->iomem_numa_node);
 	o->rw_min_bs = le64_to_cpu(top->rw_min_bs);
 	o->thinktime = le32_to_cpu(top->thinktime);
 	o->thinktime_spin = le32_to_cpu(top->thinktime_spin);
+	o->precise_pacing = le32_to_cpu(top->precise_pacing);
 	o->thinktime_blocks = le32_to_cpu(top->thinktime_blocks);
 	o->thinktime_blocks_type = le32_to_cpu(top->thinktime_blocks_type);
 	o->thinktime_iotime = le32_to_cpu(top->thinktime_iotime);
@@ -253,6 +300,8 @@ int convert_thread_options_to_cpu(struct thread_options *o,
 	o->ss_state = le32_to_cpu(top->ss_state);
 	o->ss_limit.u.f = fio_uint64_to_double(le64_to_cpu(top->ss_limit.u.i));
 	o->ss_check_interval = le64_to_cpu(top->ss_check_interval);
+	o->ss_percentile.u.f = fio_uint64_to_double(le64_to_cpu(top->ss_percentile.u.i));
+	o->ss_per_ddir = le32_to_cpu(top->ss_per_ddir);
 	o->zone_range = le64_to_cpu(top->zone_range);
 	o->zone_size = le64_to_cpu(top->zone_size);
 	o->zone_capacity = le64_to_cpu(top->zone_capacity);
@@ -260,6 +309,9 @@ int convert_thread_options_to_cpu(struct thread_options *o,
 	o->zone_mode = le32_to_cpu(top->zone_mode);
 	o->max_open_zones = __le32_to_cpu(top->max_open_zones);
 	o->ignore_zone_limits = le32_to_cpu(top->ignore_zone_limits);
+	o->zone_append = le32_to_cpu(top->zone_append);
+	o->zone_reset_async = le32_to_cpu(top->zone_reset_async);
+	o->zone_owner = le32_to_cpu(top->zone_owner);
 	o->lockmem = le64_to_cpu(top->lockmem);
 	o->offset_increment_percent = le32_to_cpu(top->offset_increment_percent);
 	o->offset_increment = le64_to_cpu(top->offset_increment);
@@ -271,11 +323,13 @@ int convert_thread_options_to_cpu(struct thread_options *o,
 	o->loops = le32_to_cpu(top->loops);
 	o->mem_type = le32_to_cpu(top->mem_type);
 	o->mem_align = le32_to_cpu(top->mem_align);
+	o->shared_read_buffers = le32_to_cpu(top->shared_read_buffers);
 	o->exit_what = le32_to_cpu(top->exit_what);
 	o->stonewall = le32_to_cpu(top->stonewall);
 	o->new_group = le32_to_cpu(top->new_group);
 	o->numjobs = le32_to_cpu(top->numjobs);
 	o->cpus_allowed_policy = le32_to_cpu(top->cpus_allowed_policy);
+	o->cpus_allowed_auto = le32_to_cpu(top->cpus_allowed_auto);
 	o->gpu_dev_id = le32_to_cpu(top->gpu_dev_id);
 	o->iolog = le32_to_cpu(top->iolog);
 	o->rwmixcycle = le32_to_cpu(top->rwmixcycle);
@@ -285,15 +339,27 @@ int convert_thread_options_to_cpu(struct thread_options *o,
 	o->file_service_type = le32_to_cpu(top->file_service_type);
 	o->group_reporting = le32_to_cpu(top->group_reporting);
 	o->stats = le32_to_cpu(top->stats);
+	o->stats_shard = le32_to_cpu(top->stats_shard);
 	o->fadvise_hint = le32_to_cpu(top->fadvise_hint);
 	o->fallocate_mode = le32_to_cpu(top->fallocate_mode);
 	o->zero_buffers = le32_to_cpu(top->zero_buffers);
 	o->refill_buffers = le32_to_cpu(top->refill_buffers);
 	o->scramble_buffers = le32_to_cpu(top->scramble_buffers);
+	o->buffer_generator = le32_to_cpu(top->buffer_generator);
 	o->time_based = le32_to_cpu(top->time_based);
 	o->disable_lat = le32_to_cpu(top->disable_lat);
 	o->disable_clat = le32_to_cpu(top->disable_clat);
 	o->disable_slat = le32_to_cpu(top->disable_slat);
+	o->clock_batch = le32_to_cpu(top->clock_batch);
+	o->perf_counters = le32_to_cpu(top->perf_counters);
+	o->overhead_stats = le32_to_cpu(top->overhead_stats);
+	o->lat_outliers = le32_to_cpu(top->lat_outliers);
+	o->lat_outliers_msec = le32_to_cpu(top->lat_outliers_msec);
+	o->lat_heatmap = le32_to_cpu(top->lat_heatmap);
+	o->per_file_stats = le32_to_cpu(top->per_file_stats);
+	o->cpu_locality_stats = le32_to_cpu(top->cpu_locality_stats);
+	o->mem_report = le32_to_cpu(top->mem_report);
+	o->clat_source = le32_to_cpu(top->clat_source);
 	o->disable_bw = le32_to_cpu(top->disable_bw);
 	o->unified_rw_rep = le32_to_cpu(top->unified_rw_rep);
 	o->gtod_reduce = le32_to_cpu(top->gtod_reduce);
@@ -306,32 +372,46 @@ int convert_thread_options_to_cpu(struct thread_options *o,
 	o->clat_percentiles = le32_to_cpu(top->clat_percentiles);
 	o->lat_percentiles = le32_to_cpu(top->lat_percentiles);
 	o->slat_percentiles = le32_to_cpu(top->slat_percentiles);
+	o->lat_hist_bits = le32_to_cpu(top->lat_hist_bits);
 	o->percentile_precision = le32_to_cpu(top->percentile_precision);
 	o->sig_figs = le32_to_cpu(top->sig_figs);
 	o->continue_on_error = le32_to_cpu(top->continue_on_error);
 	o->cgroup_weight = le32_to_cpu(top->cgroup_weight);
 	o->cgroup_nodelete = le32_to_cpu(top->cgroup_nodelete);
+	o->cgroup_stat_interval = le64_to_cpu(top->cgroup_stat_interval);
 	o->uid = le32_to_cpu(top->uid);
 	o->gid = le32_to_cpu(top->gid);
 	o->flow_id = __le32_to_cpu(top->flow_id);
 	o->flow = le32_to_cpu(top->flow);
 	o->flow_sleep = le32_to_cpu(top->flow_sleep);
+	o->rate_bucket_id = le32_to_cpu(top->rate_bucket_id);
 	o->sync_file_range = le32_to_cpu(top->sync_file_range);
 	o->latency_target = le64_to_cpu(top->latency_target);
 	o->latency_window = le64_to_cpu(top->latency_window);
 	o->latency_percentile.u.f = fio_uint64_to_double(le64_to_cpu(top->latency_percentile.u.i));
 	o->latency_run = le32_to_cpu(top->latency_run);
+	o->latency_mode = le32_to_cpu(top->latency_mode);
 	o->compress_percentage = le32_to_cpu(top->compress_percentage);
 	o->compress_chunk = le32_to_cpu(top->compress_chunk);
+	o->compress_mode = le32_to_cpu(top->compress_mode);
 	o->dedupe_percentage = le32_to_cpu(top->dedupe_percentage);
 	o->dedupe_mode = le32_to_cpu(top->dedupe_mode);
 	o->dedupe_working_set_percentage = le32_to_cpu(top->dedupe_working_set_percentage);
 	o->dedupe_global = le32_to_cpu(top->dedupe_global);
+	o->dedupe_similar_bits = le32_to_cpu(top->dedupe_similar_bits);
+	o->data_reduction_sample = le32_to_cpu(top->data_reduction_sample);
+	o->buffer_stamp = le32_to_cpu(top->buffer_stamp);
 	o->block_error_hist = le32_to_cpu(top->block_error_hist);
 	o->replay_align = le32_to_cpu(top->replay_align);
 	o->replay_scale = le32_to_cpu(top->replay_scale);
 	o->replay_time_scale = le32_to_cpu(top->replay_time_scale);
 	o->replay_skip = le32_to_cpu(top->replay_skip);
+	o->replay_shard = le32_to_cpu(top->replay_shard);
+	o->precondition_jobs = le32_to_cpu(top->precondition_jobs);
+	o->precondition_iodepth = le32_to_cpu(top->precondition_iodepth);
+	o->precondition_bs = le64_to_cpu(top->precondition_bs);
+	o->write_iolog_format = le32_to_cpu(top->write_iolog_format);
+	o->replay_queue_depth = le32_to_cpu(top->replay_queue_depth);
 	o->per_job_logs = le32_to_cpu(top->per_job_logs);
 	o->write_bw_log = le32_to_cpu(top->write_bw_log);
 	o->write_lat_log = le32_to_cpu(top->write_lat_log);
@@ -353,6 +433,7 @@ int convert_thread_options_to_cpu(struct thread_options *o,
 
 	o->fdp = le32_to_cpu(top->fdp);
 	o->fdp_nrpli = le32_to_cpu(top->fdp_nrpli);
+	o->fdp_pli_select = le32_to_cpu(top->fdp_pli_select);
 	for (i = 0; i < o->fdp_nrpli; i++)
 		o->fdp_plis[i] = le32_to_cpu(top->fdp_plis[i]);
 #if 0
@@ -394,6 +475,13 @@ void convert_thread_options_to_net(struct thread_options_pack *top,
 	string_to_net(top->ioscheduler, o->ioscheduler);
 	string_to_net(top->profile, o->profile);
 	string_to_net(top->cgroup, o->cgroup);
+	string_to_net(top->phases, o->phases);
+	string_to_net(top->sweep, o->sweep);
+	string_to_net(top->precondition, o->precondition);
+	string_to_net(top->cgroup_io_max, o->cgroup_io_max);
+	string_to_net(top->cgroup_io_latency, o->cgroup_io_latency);
+	string_to_net(top->cgroup_io_cost_qos, o->cgroup_io_cost_qos);
+	string_to_net(top->latency_log_file, o->latency_log_file);
 
 	top->allow_create = cpu_to_le32(o->allow_create);
 	top->allow_mounted_write = cpu_to_le32(o->allow_mounted_write);
@@ -407,6 +495,7 @@ void convert_thread_options_to_net(struct thread_options_pack *top,
 	top->iodepth_batch = cpu_to_le32(o->iodepth_batch);
 	top->iodepth_batch_complete_min = cpu_to_le32(o->iodepth_batch_complete_min);
 	top->iodepth_batch_complete_max = cpu_to_le32(o->iodepth_batch_complete_max);
+	top->iodepth_batch_complete_adaptive = cpu_to_le32(o->iodepth_batch_complete_adaptive);
 	top->serialize_overlap = cpu_to_le32(o->serialize_overlap);
 	top->size_percent = cpu_to_le32(o->size_percent);
 	top->io_size_percent = cpu_to_le32(o->io_size_percent);
@@ -414,17 +503,24 @@ void convert_thread_options_to_net(struct thread_options_pack *top,
 	top->file_append = cpu_to_le32(o->file_append);
 	top->ratecycle = cpu_to_le32(o->ratecycle);
 	top->io_submit_mode = cpu_to_le32(o->io_submit_mode);
+	top->freelist_order = cpu_to_le32(o->freelist_order);
+	top->sync_workers = cpu_to_le32(o->sync_workers);
 	top->nr_files = cpu_to_le32(o->nr_files);
 	top->unique_filename = cpu_to_le32(o->unique_filename);
 	top->open_files = cpu_to_le32(o->open_files);
 	top->file_lock_mode = cpu_to_le32(o->file_lock_mode);
+	top->lockfile_stripe = cpu_to_le32(o->lockfile_stripe);
 	top->odirect = cpu_to_le32(o->odirect);
 	top->oatomic = cpu_to_le32(o->oatomic);
 	top->invalidate_cache = cpu_to_le32(o->invalidate_cache);
 	top->create_serialize = cpu_to_le32(o->create_serialize);
 	top->create_fsync = cpu_to_le32(o->create_fsync);
 	top->create_on_open = cpu_to_le32(o->create_on_open);
+	top->tree_depth = cpu_to_le32(o->tree_depth);
+	top->tree_fanout = cpu_to_le32(o->tree_fanout);
+	top->tree_files = cpu_to_le32(o->tree_files);
 	top->create_only = cpu_to_le32(o->create_only);
+	top->create_threads = cpu_to_le32(o->create_threads);
 	top->end_fsync = cpu_to_le32(o->end_fsync);
 	top->pre_read = cpu_to_le32(o->pre_read);
 	top->sync_io = cpu_to_le32(o->sync_io);
@@ -433,13 +529,20 @@ void convert_thread_options_to_net(struct thread_options_pack *top,
 	top->do_verify = cpu_to_le32(o->do_verify);
 	top->experimental_verify = cpu_to_le32(o->experimental_verify);
 	top->verify_state = cpu_to_le32(o->verify_state);
+	top->verify_state_interval = __cpu_to_le64(o->verify_state_interval);
+	top->verify_bitmap = cpu_to_le32(o->verify_bitmap);
+	top->verify_table = cpu_to_le32(o->verify_table);
+	top->verify_sample_rate.u.i = __cpu_to_le64(fio_double_to_uint64(o->verify_sample_rate.u.f));
+	top->verify_sample_mode = cpu_to_le32(o->verify_sample_mode);
 	top->verify_interval = cpu_to_le32(o->verify_interval);
 	top->verify_offset = cpu_to_le32(o->verify_offset);
 	top->verify_pattern_bytes = cpu_to_le32(o->verify_pattern_bytes);
 	top->verify_fatal = cpu_to_le32(o->verify_fatal);
 	top->verify_dump = cpu_to_le32(o->verify_dump);
 	top->verify_async = cpu_to_le32(o->verify_async);
+	top->verify_threads = cpu_to_le32(o->verify_threads);
 	top->verify_batch = cpu_to_le32(o->verify_batch);
+	top->verify_backlog_mode = cpu_to_le32(o->verify_backlog_mode);
 	top->use_thread = cpu_to_le32(o->use_thread);
 	top->unlink = cpu_to_le32(o->unlink);
 	top->unlink_each_loop = cpu_to_le32(o->unlink_each_loop);
@@ -453,6 +556,14 @@ void convert_thread_options_to_net(struct thread_options_pack *top,
 	top->log_max = cpu_to_le32(o->log_max);
 	top->log_offset = cpu_to_le32(o->log_offset);
 	top->log_prio = cpu_to_le32(o->log_prio);
+	top->log_binary = cpu_to_le32(o->log_binary);
+	top->log_write_behind = cpu_to_le32(o->log_write_behind);
+	top->log_mmap = cpu_to_le32(o->log_mmap);
+	top->log_sample = cpu_to_le32(o->log_sample);
+	top->log_sample_nth = cpu_to_le32(o->log_sample_nth);
+	top->log_sample_reservoir = cpu_to_le32(o->log_sample_reservoir);
+	top->log_sample_msec = cpu_to_le32(o->log_sample_msec);
+	top->log_sample_percentile.u.i = __cpu_to_le64(fio_double_to_uint64(o->log_sample_percentile.u.f));
 	top->log_gz = cpu_to_le32(o->log_gz);
 	top->log_gz_store = cpu_to_le32(o->log_gz_store);
 	top->log_unix_epoch = cpu_to_le32(o->log_unix_epoch);
@@ -460,9 +571,13 @@ void convert_thread_options_to_net(struct thread_options_pack *top,
 	top->log_alternate_epoch_clock_id = cpu_to_le32(o->log_alternate_epoch_clock_id);
 	top->norandommap = cpu_to_le32(o->norandommap);
 	top->softrandommap = cpu_to_le32(o->softrandommap);
+	top->randommap_shared = cpu_to_le32(o->randommap_shared);
 	top->bs_unaligned = cpu_to_le32(o->bs_unaligned);
 	top->fsync_on_close = cpu_to_le32(o->fsync_on_close);
 	top->bs_is_seq_rand = cpu_to_le32(o->bs_is_seq_rand);
+	top->num_range = cpu_to_le32(o->num_range);
+	top->trim_mode = cpu_to_le32(o->trim_mode);
+	top->phases_loop = cpu_to_le32(o->phases_loop);
 	top->random_distribution = cpu_to_le32(o->random_distribution);
 	top->exitall_error = cpu_to_le32(o->exitall_error);
 	top->zipf_theta.u.i = __cpu_to_le64(fio_double_to_uint64(o->zipf_theta.u.f));
@@ -470,10 +585,14 @@ void convert_thread_options_to_net(struct thread_options_pack *top,
 	top->gauss_dev.u.i = __cpu_to_le64(fio_double_to_uint64(o->gauss_dev.u.f));
 	top->random_center.u.i = __cpu_to_le64(fio_double_to_uint64(o->random_center.u.f));
 	top->random_generator = cpu_to_le32(o->random_generator);
+	top->random_partition = cpu_to_le32(o->random_partition);
 	top->hugepage_size = cpu_to_le32(o->hugepage_size);
+	top->iomem_numa = cpu_to_le32(o->iomem_numa);
+	top->iomem_numa_node = cpu_to_le32(o->iomem_numa_node);
 	top->rw_min_bs = __cpu_to_le64(o->rw_min_bs);
 	top->thinktime = cpu_to_le32(o->thinktime);
 	top->thinktime_spin = cpu_to_le32(o->thinktime_spin);
+	top->precise_pacing = cpu_to_le32(o->precise_pacing);
 	top->thinktime_blocks = cpu_to_le32(o->thinktime_blocks);
 	top->thinktime_blocks_type = __cpu_to_le32(o->thinktime_blocks_type);
 	top->thinktime_iotime = __cpu_to_le32(o->thinktime_iotime);
@@ -486,11 +605,13 @@ void convert_thread_options_to_net(struct thread_options_pack *top,
 	top->loops = cpu_to_le32(o->loops);
 	top->mem_type = cpu_to_le32(o->mem_type);
 	top->mem_align = cpu_to_le32(o->mem_align);
+	top->shared_read_buffers = cpu_to_le32(o->shared_read_buffers);
 	top->exit_what = cpu_to_le32(o->exit_what);
 	top->stonewall = cpu_to_le32(o->stonewall);
 	top->new_group = cpu_to_le32(o->new_group);
 	top->numjobs = cpu_to_le32(o->numjobs);
 	top->cpus_allowed_policy = cpu_to_le32(o->cpus_allowed_policy);
+	top->cpus_allowed_auto = cpu_to_le32(o->cpus_allowed_auto);
 	top->gpu_dev_id = cpu_to_le32(o->gpu_dev_id);
 	top->iolog = cpu_to_le32(o->iolog);
 	top->rwmixcycle = cpu_to_le32(o->rwmixcycle);
@@ -500,16 +621,28 @@ void convert_thread_options_to_net(struct thread_options_pack *top,
 	top->file_service_type = cpu_to_le32(o->file_service_type);
 	top->group_reporting = cpu_to_le32(o->group_reporting);
 	top->stats = cpu_to_le32(o->stats);
+	top->stats_shard = cpu_to_le32(o->stats_shard);
 	top->fadvise_hint = cpu_to_le32(o->fadvise_hint);
 	top->fallocate_mode = cpu_to_le32(o->fallocate_mode);
 	top->zero_buffers = cpu_to_le32(o->zero_buffers);
 	top->refill_buffers = cpu_to_le32(o->refill_buffers);
 	top->scramble_buffers = cpu_to_le32(o->scramble_buffers);
+	top->buffer_generator = cpu_to_le32(o->buffer_generator);
 	top->buffer_pattern_bytes = cpu_to_le32(o->buffer_pattern_bytes);
 	top->time_based = cpu_to_le32(o->time_based);
 	top->disable_lat = cpu_to_le32(o->disable_lat);
 	top->disable_clat = cpu_to_le32(o->disable_clat);
 	top->disable_slat = cpu_to_le32(o->disable_slat);
+	top->clock_batch = cpu_to_le32(o->clock_batch);
+	top->perf_counters = cpu_to_le32(o->perf_counters);
+	top->overhead_stats = cpu_to_le32(o->overhead_stats);
+	top->lat_outliers = cpu_to_le32(o->lat_outliers);
+	top->lat_outliers_msec = cpu_to_le32(o->lat_outliers_msec);
+	top->lat_heatmap = cpu_to_le32(o->lat_heatmap);
+	top->per_file_stats = cpu_to_le32(o->per_file_stats);
+	top->cpu_locality_stats = cpu_to_le32(o->cpu_locality_stats);
+	top->mem_report = cpu_to_le32(o->mem_report);
+	top->clat_source = cpu_to_le32(o->clat_source);
 	top->disable_bw = cpu_to_le32(o->disable_bw);
 	top->unified_rw_rep = cpu_to_le32(o->unified_rw_rep);
 	top->gtod_reduce = cpu_to_le32(o->gtod_reduce);
@@ -522,32 +655,46 @@ void convert_thread_options_to_net(struct thread_options_pack *top,
 	top->clat_percentiles = cpu_to_le32(o->clat_percentiles);
 	top->lat_percentiles = cpu_to_le32(o->lat_percentiles);
 	top->slat_percentiles = cpu_to_le32(o->slat_percentiles);
+	top->lat_hist_bits = cpu_to_le32(o->lat_hist_bits);
 	top->percentile_precision = cpu_to_le32(o->percentile_precision);
 	top->sig_figs = cpu_to_le32(o->sig_figs);
 	top->continue_on_error = cpu_to_le32(o->continue_on_error);
 	top->cgroup_weight = cpu_to_le32(o->cgroup_weight);
 	top->cgroup_nodelete = cpu_to_le32(o->cgroup_nodelete);
+	top->cgroup_stat_interval = __cpu_to_le64(o->cgroup_stat_interval);
 	top->uid = cpu_to_le32(o->uid);
 	top->gid = cpu_to_le32(o->gid);
 	top->flow_id = __cpu_to_le32(o->flow_id);
 	top->flow = cpu_to_le32(o->flow);
 	top->flow_sleep = cpu_to_le32(o->flow_sleep);
+	top->rate_bucket_id = cpu_to_le32(o->rate_bucket_id);
 	top->sync_file_range = cpu_to_le32(o->sync_file_range);
 	top->latency_target = __cpu_to_le64(o->latency_target);
 	top->latency_window = __cpu_to_le64(o->latency_window);
 	top->latency_percentile.u.i = __cpu_to_le64(fio_double_to_uint64(o->latency_percentile.u.f));
 	top->latency_run = __cpu_to_le32(o->latency_run);
+	top->latency_mode = __cpu_to_le32(o->latency_mode);
 	top->compress_percentage = cpu_to_le32(o->compress_percentage);
 	top->compress_chunk = cpu_to_le32(o->compress_chunk);
+	top->compress_mode = cpu_to_le32(o->compress_mode);
 	top->dedupe_percentage = cpu_to_le32(o->dedupe_percentage);
 	top->dedupe_mode = cpu_to_le32(o->dedupe_mode);
 	top->dedupe_working_set_percentage = cpu_to_le32(o->dedupe_working_set_percentage);
 	top->dedupe_global = cpu_to_le32(o->dedupe_global);
+	top->dedupe_similar_bits = cpu_to_le32(o->dedupe_similar_bits);
+	top->data_reduction_sample = cpu_to_le32(o->data_reduction_sample);
+	top->buffer_stamp = cpu_to_le32(o->buffer_stamp);
 	top->block_error_hist = cpu_to_le32(o->block_error_hist);
 	top->replay_align = cpu_to_le32(o->replay_align);
 	top->replay_scale = cpu_to_le32(o->replay_scale);
 	top->replay_time_scale = cpu_to_le32(o->replay_time_scale);
 	top->replay_skip = cpu_to_le32(o->replay_skip);
+	top->replay_shard = cpu_to_le32(o->replay_shard);
+	top->precondition_jobs = cpu_to_le32(o->precondition_jobs);
+	top->precondition_iodepth = cpu_to_le32(o->precondition_iodepth);
+	top->precondition_bs = __cpu_to_le64(o->precondition_bs);
+	top->write_iolog_format = cpu_to_le32(o->write_iolog_format);
+	top->replay_queue_depth = cpu_to_le32(o->replay_queue_depth);
 	top->per_job_logs = cpu_to_le32(o->per_job_logs);
 	top->write_bw_log = cpu_to_le32(o->write_bw_log);
 	top->write_lat_log = cpu_to_le32(o->write_lat_log);
@@ -594,6 +741,8 @@ void convert_thread_options_to_net(struct thread_options_pack *top,
 		top->ratemin[i] = cpu_to_le64(o->ratemin[i]);
 		top->rate_iops[i] = cpu_to_le32(o->rate_iops[i]);
 		top->rate_iops_min[i] = cpu_to_le32(o->rate_iops_min[i]);
+		top->rate_bucket_iops[i] = cpu_to_le32(o->rate_bucket_iops[i]);
+		top->rate_bucket_burst[i] = cpu_to_le32(o->rate_bucket_burst[i]);
 
 		top->perc_rand[i] = cpu_to_le32(o->perc_rand[i]);
 
@@ -611,11 +760,13 @@ void convert_thread_options_to_net(struct thread_options_pack *top,
 	top->start_delay_high = __cpu_to_le64(o->start_delay_high);
 	top->timeout = __cpu_to_le64(o->timeout);
 	top->ramp_time = __cpu_to_le64(o->ramp_time);
-	top->ss_dur = __cpu_to_le64(top->ss_dur);
-	top->ss_ramp_time = __cpu_to_le64(top->ss_ramp_time);
-	top->ss_state = cpu_to_le32(top->ss_state);
+	top->ss_dur = __cpu_to_le64(o->ss_dur);
+	top->ss_ramp_time = __cpu_to_le64(o->ss_ramp_time);
+	top->ss_state = cpu_to_le32(o->ss_state);
 	top->ss_limit.u.i = __cpu_to_le64(fio_double_to_uint64(o->ss_limit.u.f));
-	top->ss_check_interval = __cpu_to_le64(top->ss_check_interval);
+	top->ss_check_interval = __cpu_to_le64(o->ss_check_interval);
+	top->ss_percentile.u.i = __cpu_to_le64(fio_double_to_uint64(o->ss_percentile.u.f));
+	top->ss_per_ddir = cpu_to_le32(o->ss_per_ddir);
 	top->zone_range = __cpu_to_le64(o->zone_range);
 	top->zone_size = __cpu_to_le64(o->zone_size);
 	top->zone_capacity = __cpu_to_le64(o->zone_capacity);
@@ -623,6 +774,9 @@ void convert_thread_options_to_net(struct thread_options_pack *top,
 	top->zone_mode = __cpu_to_le32(o->zone_mode);
 	top->max_open_zones = __cpu_to_le32(o->max_open_zones);
 	top->ignore_zone_limits = cpu_to_le32(o->ignore_zone_limits);
+	top->zone_append = cpu_to_le32(o->zone_append);
+	top->zone_reset_async = cpu_to_le32(o->zone_reset_async);
+	top->zone_owner = cpu_to_le32(o->zone_owner);
 	top->lockmem = __cpu_to_le64(o->lockmem);
 	top->ddir_seq_add = __cpu_to_le64(o->ddir_seq_add);
 	top->file_size_low = __cpu_to_le64(o->file_size_low);
@@ -648,6 +802,7 @@ void convert_thread_options_to_net(struct thread_options_pack *top,
 
 	top->fdp = cpu_to_le32(o->fdp);
 	top->fdp_nrpli = cpu_to_le32(o->fdp_nrpli);
+	top->fdp_pli_select = cpu_to_le32(o->fdp_pli_select);
 	for (i = 0; i < o->fdp_nrpli; i++)
 		top->fdp_plis[i] = cpu_to_le32(o->fdp_plis[i]);
 #if 0
@@ -3,12 +3,15 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <mntent.h>
 #include <sys/stat.h>
 #include "fio.h"
 #include "flist.h"
 #include "cgroup.h"
 #include "smalloc.h"
+#include "minmax.h"
 
 static struct fio_sem *lock;
 
@@ -113,12 +116,12 @@ void cgroup_kill(struct flist_head *clist)
 
 static char *get_cgroup_root(struct thread_data *td, struct cgroup_mnt *mnt)
 {
-	char *str = malloc(64);
+	char *str = malloc(PATH_MAX);
 
 	if (td->o.cgroup)
-		sprintf(str, "%s/%s", mnt->path, td->o.cgroup);
+		snprintf(str, PATH_MAX, "%s/%s", mnt->path, td->o.cgroup);
 	else
-		sprintf(str, "%s/%s", mnt->path, td->o.name);
+		snprintf(str, PATH_MAX, "%s/%s", mnt->path, td->o.name);
 
 	return str;
 }
@@ -143,6 +146,240 @@ static int write_int_to_file(struct thread_data *td, const char *path,
 
 }
 
+/*
+ * Write each comma separated entry of @str to the file as its own write,
+ * the cgroup2 io files take one device per write.
+ */
+static int write_str_to_file(struct thread_data *td, const char *path,
+			     const char *filename, const char *str,
+			     const char *onerr)
+{
+	char tmp[PATH_MAX];
+	char *dup, *p, *entry;
+	int fd, ret = 0;
+
+	snprintf(tmp, sizeof(tmp), "%s/%s", path, filename);
+	fd = open(tmp, O_WRONLY);
+	if (fd < 0) {
+		td_verror(td, errno, onerr);
+		log_err("fio: path %s\n", tmp);
+		return 1;
+	}
+
+	dup = p = strdup(str);
+	while ((entry = strsep(&p, ",")) != NULL) {
+		if (!*entry)
+			continue;
+		if (write(fd, entry, strlen(entry)) < 0) {
+			td_verror(td, errno, onerr);
+			log_err("fio: writing \"%s\" to %s\n", entry, tmp);
+			ret = 1;
+			break;
+		}
+	}
+
+	free(dup);
+	close(fd);
+	return ret;
+}
+
+static bool cgroup_io_controls(struct thread_data *td)
+{
+	struct thread_options *o = &td->o;
+
+	return o->cgroup_weight || o->cgroup_io_max || o->cgroup_io_latency;
+}
+
+/*
+ * Set up the cgroup2 io controller files of the job's cgroup. The parent
+ * has to delegate the io controller first.
+ */
+static int cgroup2_io_setup(struct thread_data *td, struct cgroup_mnt *mnt,
+			    const char *root)
+{
+	struct thread_options *o = &td->o;
+	char parent[PATH_MAX], *p;
+
+	if (o->cgroup_io_cost_qos &&
+	    write_str_to_file(td, mnt->path, "io.cost.qos",
+				o->cgroup_io_cost_qos, "cgroup io.cost.qos"))
+		return 1;
+
+	if (!cgroup_io_controls(td))
+		return 0;
+
+	snprintf(parent, sizeof(parent), "%s", root);
+	p = strrchr(parent, '/');
+	if (p)
+		*p = '\0';
+	if (write_str_to_file(td, parent, "cgroup.subtree_control", "+io",
+				"cgroup enable io controller"))
+		return 1;
+
+	if (o->cgroup_weight &&
+	    write_int_to_file(td, root, "io.weight", o->cgroup_weight,
+				"cgroup io.weight"))
+		return 1;
+	if (o->cgroup_io_max &&
+	    write_str_to_file(td, root, "io.max", o->cgroup_io_max,
+				"cgroup io.max"))
+		return 1;
+	if (o->cgroup_io_latency &&
+	    write_str_to_file(td, root, "io.latency", o->cgroup_io_latency,
+				"cgroup io.latency"))
+		return 1;
+
+	return 0;
+}
+
+/*
+ * Sum io.stat over all devices, and read the stall totals and avg10 of
+ * io.pressure.
+ */
+static int cgroup_read_io(const char *root, uint64_t *vals, double *some10,
+			  double *full10)
+{
+	static const char *keys[] = {
+		[FIO_CG_RBYTES]	= "rbytes",
+		[FIO_CG_WBYTES]	= "wbytes",
+		[FIO_CG_RIOS]	= "rios",
+		[FIO_CG_WIOS]	= "wios",
+		[FIO_CG_DBYTES]	= "dbytes",
+		[FIO_CG_DIOS]	= "dios",
+	};
+	char path[PATH_MAX], line[1024];
+	char *p, *tok;
+	FILE *f;
+	int i;
+
+	memset(vals, 0, FIO_CG_NR * sizeof(uint64_t));
+
+	snprintf(path, sizeof(path), "%s/io.stat", root);
+	f = fopen(path, "r");
+	if (!f)
+		return errno;
+	while (fgets(line, sizeof(line), f)) {
+		p = line;
+		while ((tok = strsep(&p, " \n")) != NULL) {
+			char *val = strchr(tok, '=');
+
+			if (!val)
+				continue;
+			*val++ = '\0';
+			for (i = 0; i < FIO_ARRAY_SIZE(keys); i++) {
+				if (!strcmp(tok, keys[i])) {
+					vals[i] += strtoull(val, NULL, 10);
+					break;
+				}
+			}
+		}
+	}
+	fclose(f);
+
+	snprintf(path, sizeof(path), "%s/io.pressure", root);
+	f = fopen(path, "r");
+	if (!f)
+		return errno;
+	while (fgets(line, sizeof(line), f)) {
+		unsigned long long total;
+		double avg10;
+		char kind[8];
+
+		if (sscanf(line, "%7s avg10=%lf avg60=%*f avg300=%*f total=%llu",
+			   kind, &avg10, &total) != 3)
+			continue;
+		if (!strcmp(kind, "some")) {
+			vals[FIO_CG_SOME_USEC] = total;
+			*some10 = avg10;
+		} else if (!strcmp(kind, "full")) {
+			vals[FIO_CG_FULL_USEC] = total;
+			*full10 = avg10;
+		}
+	}
+	fclose(f);
+	return 0;
+}
+
+/*
+ * Update the job's cgroup stats with what the counters grew since it
+ * started. Called from the helper thread while the job runs, and from the
+ * job itself when it is done.
+ */
+static void cgroup_stats_sample(struct thread_data *td)
+{
+	struct thread_stat *ts = &td->ts;
+	uint64_t vals[FIO_CG_NR];
+	double some10 = 0, full10 = 0;
+	int i;
+
+	if (cgroup_read_io(td->cgroup_root, vals, &some10, &full10))
+		return;
+
+	for (i = 0; i < FIO_CG_NR; i++)
+		ts->cgroup_io[i] = vals[i] - td->cgroup_io_base[i];
+	if (some10 > ts->cgroup_some_avg10.u.f)
+		ts->cgroup_some_avg10.u.f = some10;
+	if (full10 > ts->cgroup_full_avg10.u.f)
+		ts->cgroup_full_avg10.u.f = full10;
+	ts->cgroup_stats = 1;
+}
+
+static int cgroup_stats_start(struct thread_data *td, const char *root)
+{
+	double some10, full10;
+	int ret;
+
+	snprintf(td->cgroup_root, sizeof(td->cgroup_root), "%s", root);
+	ret = cgroup_read_io(root, td->cgroup_io_base, &some10, &full10);
+	if (ret) {
+		td_verror(td, ret, "cgroup read io.stat/io.pressure");
+		td->cgroup_root[0] = '\0';
+		return 1;
+	}
+
+	td->cgroup_stat_next = td->o.cgroup_stat_interval / 1000;
+	return 0;
+}
+
+/*
+ * Shortest cgroup_stat_interval of all jobs, for the helper thread timer
+ */
+unsigned int cgroup_stat_interval_ms(void)
+{
+	unsigned int ms = 0;
+
+	for_each_td(td) {
+		if (td->o.cgroup)
+			ms = min_not_zero(ms, (unsigned int)
+					(td->o.cgroup_stat_interval / 1000));
+	} end_for_each();
+
+	return ms;
+}
+
+int cgroup_stats_check(void)
+{
+	unsigned int tick = cgroup_stat_interval_ms();
+
+	for_each_td(td) {
+		uint64_t interval = td->o.cgroup_stat_interval / 1000;
+		uint64_t elapsed;
+
+		if (!interval || !td->cgroup_root[0] ||
+		    td->runstate != TD_RUNNING)
+			continue;
+
+		elapsed = mtime_since_now(&td->epoch);
+		if (elapsed + tick / 2 < td->cgroup_stat_next)
+			continue;
+
+		td->cgroup_stat_next = elapsed + interval;
+		cgroup_stats_sample(td);
+	} end_for_each();
+
+	return 0;
+}
+
 static int cgroup_write_pid(struct thread_data *td, char *path, bool cgroup2)
 {
 	unsigned int val = td->pid;
@@ -168,6 +405,11 @@ int cgroup_setup(struct thread_data *td, struct flist_head *clist, struct cgroup
 	if (!clist)
 		return 1;
 
+	if (td->o.cgroup_stat_interval && td->o.cgroup_stat_interval < 1000) {
+		log_err("fio: cgroup_stat_interval must be at least 1ms\n");
+		return 1;
+	}
+
 	if (!*mnt) {
 		*mnt = find_cgroup_mnt(td);
 		if (!*mnt)
@@ -189,11 +431,14 @@ int cgroup_setup(struct thread_data *td, struct flist_head *clist, struct cgroup
 	} else
 		add_cgroup(td, root, clist);
 
-	if (td->o.cgroup_weight) {
-		if ((*mnt)->cgroup2) {
-			log_err("fio: cgroup weit doesn't work with cgroup2\n");
+	if ((*mnt)->cgroup2) {
+		if (cgroup2_io_setup(td, *mnt, root))
 			goto err;
-		}
+	} else if (td->o.cgroup_io_max || td->o.cgroup_io_latency ||
+		   td->o.cgroup_io_cost_qos || td->o.cgroup_stat_interval) {
+		log_err("fio: cgroup io controller options need cgroup2\n");
+		goto err;
+	} else if (td->o.cgroup_weight) {
 		if (write_int_to_file(td, root, "blkio.weight",
 					td->o.cgroup_weight,
 					"cgroup open weight"))
@@ -201,6 +446,9 @@ int cgroup_setup(struct thread_data *td, struct flist_head *clist, struct cgroup
 	}
 
 	if (!cgroup_write_pid(td, root, (*mnt)->cgroup2)) {
+		if (td->o.cgroup_stat_interval &&
+		    cgroup_stats_start(td, root))
+			goto err;
 		free(root);
 		return 0;
 	}
@@ -217,6 +465,9 @@ void cgroup_shutdown(struct thread_data *td, struct cgroup_mnt *mnt)
 	if (!td->o.cgroup_weight && !td->o.cgroup)
 		goto out;
 
+	if (td->cgroup_root[0])
+		cgroup_stats_sample(td);
+
 	cgroup_del_pid(td, mnt);
 out:
 	if (mnt->path)
@@ -13,6 +13,9 @@ void cgroup_shutdown(struct thread_data *, struct cgroup_mnt *);
 
 void cgroup_kill(struct flist_head *list);
 
+unsigned int cgroup_stat_interval_ms(void);
+int cgroup_stats_check(void);
+
 #else
 
 struct cgroup_mnt;
@@ -32,5 +35,15 @@ static inline void cgroup_kill(struct flist_head *list)
 {
 }
 
+static inline unsigned int cgroup_stat_interval_ms(void)
+{
+	return 0;
+}
+
+static inline int cgroup_stats_check(void)
+{
+	return 0;
+}
+
 #endif
 #endif
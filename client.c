@@ -4,6 +4,9 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <poll.h>
+#ifdef CONFIG_EPOLL
+#include <sys/epoll.h>
+#endif
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
@@ -60,6 +63,25 @@ int sum_stat_clients;
 
 static int sum_stat_nr;
 static struct buf_output allclients;
+
+/*
+ * Final stats summed over all clients, one entry per reporting group.
+ * The thread_stat carries the full latency histograms, so percentiles
+ * of the sum are exact rather than averaged across hosts.
+ */
+struct client_group_sum {
+	struct thread_stat ts;
+	struct group_run_stats gs;
+	struct fio_client *client;
+	bool multi;
+};
+
+static struct client_group_sum *group_sums;
+static unsigned int nr_group_sums;
+bool client_summary;
+unsigned int sync_start_msec;
+bool shard_clients;
+static bool sync_start_pending;
 static struct json_object *root = NULL;
 static struct json_object *job_opt_object = NULL;
 static struct json_array *clients_array = NULL;
@@ -67,12 +89,14 @@ static struct json_array *du_array = NULL;
 
 static int error_clients;
 
+/* clock probes per server for --sync-start, the fastest round trip wins */
+#define FIO_CLOCK_PROBES	8
+
 #define FIO_CLIENT_HASH_BITS	7
 #define FIO_CLIENT_HASH_SZ	(1 << FIO_CLIENT_HASH_BITS)
 #define FIO_CLIENT_HASH_MASK	(FIO_CLIENT_HASH_SZ - 1)
 static struct flist_head client_hash[FIO_CLIENT_HASH_SZ];
 
-static struct cmd_iolog_pdu *convert_iolog(struct fio_net_cmd *, bool *);
 
 static void fio_client_add_hash(struct fio_client *client)
 {
@@ -300,6 +324,8 @@ static void fio_drain_client_text(struct fio_client *client)
 	} while (1);
 }
 
+static void start_synced_clients(void);
+
 static void remove_client(struct fio_client *client)
 {
 	assert(client->refs);
@@ -326,6 +352,9 @@ static void remove_client(struct fio_client *client)
 
 	nr_clients--;
 	fio_put_client(client);
+
+	if (sync_start_pending)
+		start_synced_clients();
 }
 
 struct fio_client *fio_get_client(struct fio_client *client)
@@ -754,12 +783,132 @@ int fio_clients_connect(void)
 	return !nr_clients;
 }
 
+/*
+ * RUN with a payload, for a start time and/or a shard. start_at is on the
+ * client's clock, 0 to start right away.
+ */
+static int send_run_cmd(struct fio_client *client, uint64_t start_at)
+{
+	struct cmd_run_pdu pdu = {
+		.clock_offset	= cpu_to_le64((uint64_t) client->clock_offset),
+		.shard_index	= cpu_to_le32(client->shard_index),
+		.shard_count	= cpu_to_le32(client->shard_count),
+	};
+
+	if (start_at)
+		pdu.start_at = cpu_to_le64(start_at + client->clock_offset);
+
+	return fio_net_send_cmd(client->fd, FIO_NET_CMD_RUN, &pdu, sizeof(pdu),
+				NULL, NULL);
+}
+
 int fio_start_client(struct fio_client *client)
 {
 	dprint(FD_NET, "client: start %s\n", client->hostname);
+	if (client->shard_count)
+		return send_run_cmd(client, 0);
+
 	return fio_net_send_simple_cmd(client->fd, FIO_NET_CMD_RUN, 0, NULL);
 }
 
+static int send_clock_probe(struct fio_client *client)
+{
+	struct cmd_clock_pdu pdu = {
+		.t1	= cpu_to_le64(fio_realtime_ns()),
+	};
+
+	return fio_net_send_cmd(client->fd, FIO_NET_CMD_CLOCK, &pdu,
+				sizeof(pdu), NULL, NULL);
+}
+
+/*
+ * Once every server has answered its clock probes, pick a start time
+ * sync_start_msec from now and tell each server when that is on its own
+ * clock.
+ */
+static void start_synced_clients(void)
+{
+	struct fio_client *client;
+	struct flist_head *entry, *tmp;
+	uint64_t start_at;
+
+	flist_for_each(entry, &client_list) {
+		client = flist_entry(entry, struct fio_client, list);
+		if (client->clock_probes < FIO_CLOCK_PROBES)
+			return;
+	}
+
+	sync_start_pending = false;
+	start_at = fio_realtime_ns() + sync_start_msec * 1000000ULL;
+
+	flist_for_each_safe(entry, tmp, &client_list) {
+		client = flist_entry(entry, struct fio_client, list);
+
+		dprint(FD_NET, "client: start %s at %llu\n", client->hostname,
+			(unsigned long long) start_at + client->clock_offset);
+		if (send_run_cmd(client, start_at))
+			remove_client(client);
+	}
+}
+
+static void handle_clock(struct fio_client *client, struct fio_net_cmd *cmd)
+{
+	struct cmd_clock_pdu *pdu = (struct cmd_clock_pdu *) cmd->payload;
+	int64_t t1, t2, t3, t4;
+	uint64_t delay;
+
+	t4 = fio_realtime_ns();
+	t1 = le64_to_cpu(pdu->t1);
+	t2 = le64_to_cpu(pdu->t2);
+	t3 = le64_to_cpu(pdu->t3);
+
+	/* round trip minus the time the server held on to the probe */
+	delay = (t4 - t1) - (t3 - t2);
+	if (!client->clock_probes || delay < client->clock_delay) {
+		client->clock_delay = delay;
+		client->clock_offset = ((t2 - t1) + (t3 - t4)) / 2;
+	}
+
+	if (++client->clock_probes < FIO_CLOCK_PROBES) {
+		if (send_clock_probe(client))
+			remove_client(client);
+		return;
+	}
+
+	dprint(FD_NET, "client: %s clock offset %lld usec, round trip %llu usec\n",
+		client->hostname, (long long) client->clock_offset / 1000,
+		(unsigned long long) client->clock_delay / 1000);
+
+	if (sync_start_pending)
+		start_synced_clients();
+}
+
+/*
+ * Number the servers for --shard. A relay that was itself handed a shard
+ * splits that one further over its own servers.
+ */
+static void assign_shards(void)
+{
+	unsigned int index = 0, count = 1, i = 0;
+	struct fio_client *client;
+	struct flist_head *entry;
+
+	if (fio_shard_count) {
+		index = fio_shard_index;
+		count = fio_shard_count;
+	}
+
+	flist_for_each(entry, &client_list) {
+		client = flist_entry(entry, struct fio_client, list);
+
+		client->shard_index = index * nr_clients + i++;
+		client->shard_count = count * nr_clients;
+		dprint(FD_NET, "client: %s runs shard %u/%u\n",
+			client->hostname, client->shard_index,
+			client->shard_count);
+	}
+}
+
 int fio_start_all_clients(void)
 {
 	struct fio_client *client;
@@ -770,10 +919,22 @@ int fio_start_all_clients(void)
 
 	fio_client_json_init();
 
+	if (shard_clients || fio_shard_count)
+		assign_shards();
+
+	/*
+	 * With --sync-start, probe the clocks first. The servers are started
+	 * together from handle_clock() once all of them have answered.
+	 */
+	sync_start_pending = sync_start_msec != 0;
+
 	flist_for_each_safe(entry, tmp, &client_list) {
 		client = flist_entry(entry, struct fio_client, list);
 
-		ret = fio_start_client(client);
+		if (sync_start_pending)
+			ret = send_clock_probe(client);
+		else
+			ret = fio_start_client(client);
 		if (ret) {
 			remove_client(client);
 			continue;
@@ -863,6 +1024,52 @@ static int __fio_client_send_local_ini(struct fio_client *client,
 	return ret;
 }
 
+static int __fio_client_send_job_buf(struct fio_client *client,
+				     const void *buf, size_t len)
+{
+	struct cmd_job_pdu *pdu;
+	size_t p_size;
+	int ret;
+
+	dprint(FD_NET, "send job buffer to %s\n", client->hostname);
+
+	p_size = len + sizeof(*pdu);
+	pdu = malloc(p_size);
+	memcpy(pdu->buf, buf, len);
+	pdu->buf_len = __cpu_to_le32(len);
+	pdu->client_type = cpu_to_le32(client->type);
+
+	client->sent_job = true;
+	ret = fio_net_send_cmd(client->fd, FIO_NET_CMD_JOB, pdu, p_size, NULL, NULL);
+	free(pdu);
+	return ret;
+}
+
+/*
+ * Send a job to every client, either the local file 'filename' or the
+ * job file contents in 'buf'. Used by relays, which pass on each job
+ * they get to all of their servers.
+ */
+int fio_clients_send_job(const char *filename, const void *buf, size_t len)
+{
+	struct fio_client *client;
+	struct flist_head *entry, *tmp;
+	int ret;
+
+	flist_for_each_safe(entry, tmp, &client_list) {
+		client = flist_entry(entry, struct fio_client, list);
+
+		if (filename)
+			ret = __fio_client_send_local_ini(client, filename);
+		else
+			ret = __fio_client_send_job_buf(client, buf, len);
+		if (ret)
+			remove_client(client);
+	}
+
+	return !nr_clients;
+}
+
 int fio_client_send_ini(struct fio_client *client, const char *filename,
 			bool remote)
 {
@@ -972,15 +1179,27 @@ static void convert_ts(struct thread_stat *dst, struct thread_stat *src)
 		convert_io_stat(&dst->iops_stat[i], &src->iops_stat[i]);
 	}
 	convert_io_stat(&dst->sync_stat, &src->sync_stat);
+	convert_io_stat(&dst->trim_range_stat, &src->trim_range_stat);
 
 	dst->usr_time		= le64_to_cpu(src->usr_time);
 	dst->sys_time		= le64_to_cpu(src->sys_time);
 	dst->ctx		= le64_to_cpu(src->ctx);
+	for (i = 0; i < FIO_PERF_NR; i++)
+		dst->perf_count[i] = le64_to_cpu(src->perf_count[i]);
+	for (i = 0; i < FIO_OVH_NR; i++)
+		dst->overhead_nsec[i] = le64_to_cpu(src->overhead_nsec[i]);
+	dst->dr_samples		= le64_to_cpu(src->dr_samples);
+	dst->dr_bytes		= le64_to_cpu(src->dr_bytes);
+	dst->dr_zbytes		= le64_to_cpu(src->dr_zbytes);
+	dst->dr_fps		= le64_to_cpu(src->dr_fps);
+	dst->dr_dups		= le64_to_cpu(src->dr_dups);
+	dst->dr_dropped		= le64_to_cpu(src->dr_dropped);
 	dst->minf		= le64_to_cpu(src->minf);
 	dst->majf		= le64_to_cpu(src->majf);
 	dst->clat_percentiles	= le32_to_cpu(src->clat_percentiles);
 	dst->lat_percentiles	= le32_to_cpu(src->lat_percentiles);
 	dst->slat_percentiles	= le32_to_cpu(src->slat_percentiles);
+	dst->lat_hist_bits	= le32_to_cpu(src->lat_hist_bits);
 	dst->percentile_precision = le64_to_cpu(src->percentile_precision);
 
 	for (i = 0; i < FIO_IO_U_LIST_MAX_LEN; i++) {
@@ -1022,6 +1241,34 @@ static void convert_ts(struct thread_stat *dst, struct thread_stat *src)
 	dst->total_submit	= le64_to_cpu(src->total_submit);
 	dst->total_complete	= le64_to_cpu(src->total_complete);
 	dst->nr_zone_resets	= le64_to_cpu(src->nr_zone_resets);
+	dst->clock_batch_err	= le64_to_cpu(src->clock_batch_err);
+
+	for (i = 0; i < FIO_CG_NR; i++)
+		dst->cgroup_io[i]	= le64_to_cpu(src->cgroup_io[i]);
+	dst->cgroup_some_avg10.u.f = fio_uint64_to_double(le64_to_cpu(src->cgroup_some_avg10.u.i));
+	dst->cgroup_full_avg10.u.f = fio_uint64_to_double(le64_to_cpu(src->cgroup_full_avg10.u.i));
+	dst->cgroup_stats	= le32_to_cpu(src->cgroup_stats);
+
+	dst->nr_lat_outliers	= le32_to_cpu(src->nr_lat_outliers);
+	if (dst->nr_lat_outliers > FIO_LAT_OUTLIERS_MAX)
+		dst->nr_lat_outliers = FIO_LAT_OUTLIERS_MAX;
+	for (i = 0; i < dst->nr_lat_outliers; i++) {
+		struct lat_outlier *s = &src->lat_outliers[i];
+		struct lat_outlier *d = &dst->lat_outliers[i];
+
+		d->lat_nsec		= le64_to_cpu(s->lat_nsec);
+		d->offset		= le64_to_cpu(s->offset);
+		d->bs			= le64_to_cpu(s->bs);
+		d->issue_nsec		= le64_to_cpu(s->issue_nsec);
+		d->complete_nsec	= le64_to_cpu(s->complete_nsec);
+		d->ddir			= le32_to_cpu(s->ddir);
+		d->depth		= le32_to_cpu(s->depth);
+		d->prio			= le32_to_cpu(s->prio);
+		d->zone			= __le32_to_cpu(s->zone);
+		d->placement_id		= __le32_to_cpu(s->placement_id);
+		memcpy(d->file, s->file, sizeof(d->file));
+		d->file[sizeof(d->file) - 1] = '\0';
+	}
 
 	for (i = 0; i < DDIR_RWDIR_CNT; i++) {
 		dst->io_bytes[i]	= le64_to_cpu(src->io_bytes[i]);
@@ -1053,6 +1300,8 @@ static void convert_ts(struct thread_stat *dst, struct thread_stat *src)
 	dst->ss_slope.u.f 	= fio_uint64_to_double(le64_to_cpu(src->ss_slope.u.i));
 	dst->ss_deviation.u.f 	= fio_uint64_to_double(le64_to_cpu(src->ss_deviation.u.i));
 	dst->ss_criterion.u.f 	= fio_uint64_to_double(le64_to_cpu(src->ss_criterion.u.i));
+	for (i = 0; i < DDIR_RWDIR_CNT; i++)
+		dst->ss_ddir_criterion[i].u.f = fio_uint64_to_double(le64_to_cpu(src->ss_ddir_criterion[i].u.i));
 
 	for (i = 0; i < DDIR_RWDIR_CNT; i++) {
 		dst->nr_clat_prio[i] = le32_to_cpu(src->nr_clat_prio[i]);
@@ -1107,49 +1356,142 @@ static void json_object_add_client_info(struct json_object *obj,
 	json_object_add_value_int(obj, "port", client->port);
 }
 
+static struct client_group_sum *get_group_sum(uint32_t groupid)
+{
+	struct client_group_sum *sum;
+	unsigned int i;
+
+	for (i = 0; i < nr_group_sums; i++)
+		if (group_sums[i].ts.groupid == groupid)
+			return &group_sums[i];
+
+	sum = realloc(group_sums, (nr_group_sums + 1) * sizeof(*sum));
+	if (!sum) {
+		log_err("fio: client: out of memory for group stats\n");
+		return NULL;
+	}
+	group_sums = sum;
+
+	sum = &group_sums[nr_group_sums++];
+	init_thread_stat(&sum->ts);
+	init_group_run_stat(&sum->gs);
+	sum->ts.groupid = groupid;
+	sum->gs.groupid = groupid;
+	sum->client = NULL;
+	sum->multi = false;
+	return sum;
+}
+
+/*
+ * Called once the last client has sent its final stats. Unless only the
+ * summary was asked for, groups seen from a single client are skipped,
+ * their totals have already been shown with that client's output.
+ */
+static void show_group_sums(struct fio_client *client)
+{
+	struct json_object *tsobj;
+	unsigned int i;
+
+	for (i = 0; i < nr_group_sums; i++) {
+		struct client_group_sum *sum = &group_sums[i];
+
+		if (!sum->multi && !client_summary)
+			continue;
+
+		/* a relay passes the sums upstream instead */
+		if (is_backend) {
+			fio_server_send_ts(&sum->ts, &sum->gs);
+			continue;
+		}
+
+		strcpy(sum->ts.name, "All clients");
+		tsobj = show_thread_status(&sum->ts, &sum->gs, NULL, &allclients);
+		if (tsobj) {
+			json_object_add_client_info(tsobj, client);
+			json_array_add_value_object(clients_array, tsobj);
+		}
+		if (output_format & FIO_OUTPUT_NORMAL)
+			show_group_stats(&sum->gs, &allclients);
+	}
+
+	if (is_backend) {
+		for (i = 0; i < nr_group_sums; i++)
+			fio_server_send_gs(&group_sums[i].gs);
+	}
+}
+
+static void free_group_sums(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_group_sums; i++)
+		free_clat_prio_stats(&group_sums[i].ts);
+
+	free(group_sums);
+	group_sums = NULL;
+	nr_group_sums = 0;
+}
+
 static void handle_ts(struct fio_client *client, struct fio_net_cmd *cmd)
 {
 	struct cmd_ts_pdu *p = (struct cmd_ts_pdu *) cmd->payload;
 	struct flist_head *opt_list = NULL;
+	struct client_group_sum *sum;
 	struct json_object *tsobj;
 
 	if (client->opt_lists && p->ts.thread_number <= client->jobs)
 		opt_list = &client->opt_lists[p->ts.thread_number - 1];
 
-	tsobj = show_thread_status(&p->ts, &p->rs, opt_list, &client->buf);
 	client->did_stat = true;
-	if (tsobj) {
-		json_object_add_client_info(tsobj, client);
-		json_array_add_value_object(clients_array, tsobj);
+	if (!client_summary) {
+		tsobj = show_thread_status(&p->ts, &p->rs, opt_list, &client->buf);
+		if (tsobj) {
+			json_object_add_client_info(tsobj, client);
+			json_array_add_value_object(clients_array, tsobj);
+		}
 	}
 
-	if (sum_stat_clients <= 1)
+	if (sum_stat_clients <= 1 && !client_summary)
 		return;
 
-	sum_thread_stats(&client_ts, &p->ts);
-	sum_group_stats(&client_gs, &p->rs);
-
-	client_ts.members++;
-	client_ts.thread_number = p->ts.thread_number;
-	client_ts.groupid = p->ts.groupid;
-	client_ts.unified_rw_rep = p->ts.unified_rw_rep;
-	client_ts.sig_figs = p->ts.sig_figs;
+	sum = get_group_sum(p->ts.groupid);
+	if (!sum)
+		return;
 
-	if (++sum_stat_nr == sum_stat_clients) {
-		strcpy(client_ts.name, "All clients");
-		tsobj = show_thread_status(&client_ts, &client_gs, NULL, &allclients);
-		if (tsobj) {
-			json_object_add_client_info(tsobj, client);
-			json_array_add_value_object(clients_array, tsobj);
-		}
+	if (!sum->ts.members) {
+		strcpy(sum->ts.name, p->ts.name);
+		strcpy(sum->ts.description, p->ts.description);
+		sum->ts.clat_percentiles = p->ts.clat_percentiles;
+		sum->ts.lat_percentiles = p->ts.lat_percentiles;
+		sum->ts.slat_percentiles = p->ts.slat_percentiles;
+		sum->ts.lat_hist_bits = p->ts.lat_hist_bits;
+		sum->ts.percentile_precision = p->ts.percentile_precision;
+		memcpy(sum->ts.percentile_list, p->ts.percentile_list,
+			sizeof(p->ts.percentile_list));
 	}
+
+	sum_thread_stats(&sum->ts, &p->ts);
+	sum_group_stats(&sum->gs, &p->rs);
+
+	sum->ts.members += p->ts.members;
+	sum->ts.thread_number = p->ts.thread_number;
+	sum->ts.unified_rw_rep = p->ts.unified_rw_rep;
+	sum->ts.sig_figs = p->ts.sig_figs;
+	sum->gs.unified_rw_rep = p->rs.unified_rw_rep;
+
+	if (sum->client && sum->client != client)
+		sum->multi = true;
+	sum->client = client;
+
+	if (++sum_stat_nr == sum_stat_clients)
+		show_group_sums(client);
 }
 
 static void handle_gs(struct fio_client *client, struct fio_net_cmd *cmd)
 {
 	struct group_run_stats *gs = (struct group_run_stats *) cmd->payload;
 
-	if (output_format & FIO_OUTPUT_NORMAL)
+	if ((output_format & FIO_OUTPUT_NORMAL) && !client_summary)
 		show_group_stats(gs, &client->buf);
 }
 
@@ -1282,8 +1624,46 @@ static void convert_jobs_eta(struct jobs_eta *je)
 	je->is_pow2		= le32_to_cpu(je->is_pow2);
 	je->unit_base		= le32_to_cpu(je->unit_base);
 	je->sig_figs		= le32_to_cpu(je->sig_figs);
+	je->run_str_gz		= le32_to_cpu(je->run_str_gz);
 }
 
+#ifdef CONFIG_ZLIB
+/*
+ * Servers deflate long run strings, return an ETA with the plain string.
+ * If it has to be inflated that's a new allocation.
+ */
+static struct jobs_eta *client_inflate_eta(struct jobs_eta *je)
+{
+	uLongf len = __THREAD_RUNSTR_SZ(min(je->nr_threads, (uint32_t) REAL_MAX_JOBS)) + 1;
+	struct jobs_eta *out;
+
+	if (!je->run_str_gz)
+		return je;
+
+	out = malloc(sizeof(*je) + len + 1);
+	if (out && uncompress(out->run_str, &len, je->run_str,
+			      je->run_str_gz) == Z_OK) {
+		memcpy(out, je, sizeof(*je));
+		out->run_str[len] = '\0';
+		out->run_str_gz = 0;
+		return out;
+	}
+
+	log_err("fio: client: failed to inflate ETA run string\n");
+	free(out);
+	je->run_str[0] = '\0';
+	return je;
+}
+#else
+static struct jobs_eta *client_inflate_eta(struct jobs_eta *je)
+{
+	/* we never ask for compression without zlib */
+	if (je->run_str_gz)
+		je->run_str[0] = '\0';
+	return je;
+}
+#endif
+
 void fio_client_sum_jobs_eta(struct jobs_eta *dst, struct jobs_eta *je)
 {
 	int i;
@@ -1311,10 +1691,20 @@ void fio_client_sum_jobs_eta(struct jobs_eta *dst, struct jobs_eta *je)
 	dst->nr_threads		+= je->nr_threads;
 
 	/*
-	 * This wont be correct for multiple strings, but at least it
-	 * works for the basic cases.
+	 * Chain the condensed run strings of each connection, dst is sized
+	 * for REAL_MAX_JOBS threads. Whatever doesn't fit is dropped.
 	 */
-	strcpy((char *) dst->run_str, (char *) je->run_str);
+	if (!dst->run_str[0])
+		strcpy((char *) dst->run_str, (char *) je->run_str);
+	else if (je->run_str[0]) {
+		size_t len = strlen((char *) dst->run_str);
+		size_t left = __THREAD_RUNSTR_SZ(REAL_MAX_JOBS) - len;
+
+		if (strlen((char *) je->run_str) + 1 < left) {
+			dst->run_str[len] = ',';
+			strcpy((char *) dst->run_str + len + 1, (char *) je->run_str);
+		}
+	}
 }
 
 static bool remove_reply_cmd(struct fio_client *client, struct fio_net_cmd *cmd)
@@ -1366,9 +1756,9 @@ int fio_client_wait_for_reply(struct fio_client *client, uint64_t tag)
 	return 0;
 }
 
-static void handle_eta(struct fio_client *client, struct fio_net_cmd *cmd)
+static void handle_eta(struct fio_client *client, struct fio_net_cmd *cmd,
+		       struct jobs_eta *je)
 {
-	struct jobs_eta *je = (struct jobs_eta *) cmd->payload;
 	struct client_eta *eta = (struct client_eta *) (uintptr_t) cmd->tag;
 
 	dprint(FD_NET, "client: got eta tag %p, %d\n", eta, eta->pending);
@@ -1386,29 +1776,75 @@ static void handle_eta(struct fio_client *client, struct fio_net_cmd *cmd)
 	fio_client_dec_jobs_eta(eta, client->ops->eta);
 }
 
+static void convert_iolog_pdu(struct cmd_iolog_pdu *pdu)
+{
+	pdu->nr_samples		= le64_to_cpu(pdu->nr_samples);
+	pdu->thread_number	= le32_to_cpu(pdu->thread_number);
+	pdu->log_type		= le32_to_cpu(pdu->log_type);
+	pdu->compressed		= le32_to_cpu(pdu->compressed);
+	pdu->log_offset		= le32_to_cpu(pdu->log_offset);
+	pdu->log_prio		= le32_to_cpu(pdu->log_prio);
+	pdu->log_hist_coarseness = le32_to_cpu(pdu->log_hist_coarseness);
+	pdu->log_binary		= le32_to_cpu(pdu->log_binary);
+}
+
+/*
+ * Size of one sample on the wire, histogram samples are followed by
+ * their bins.
+ */
+static size_t iolog_pdu_entry_sz(struct cmd_iolog_pdu *pdu)
+{
+	size_t sz = __log_entry_sz(pdu->log_offset);
+
+	if (pdu->log_type == IO_LOG_TYPE_HIST)
+		sz += sizeof(struct io_u_plat_entry);
+
+	return sz;
+}
+
+static void convert_iolog_samples(struct cmd_iolog_pdu *pdu, void *samples,
+				  uint64_t nr_samples)
+{
+	size_t entry_sz = iolog_pdu_entry_sz(pdu);
+	uint64_t i;
+
+	for (i = 0; i < nr_samples; i++) {
+		struct io_sample *s = samples + i * entry_sz;
+
+		s->time		= le64_to_cpu(s->time);
+		if (pdu->log_type != IO_LOG_TYPE_HIST)
+			s->data.val	= le64_to_cpu(s->data.val);
+		s->__ddir	= __le32_to_cpu(s->__ddir);
+		s->bs		= le64_to_cpu(s->bs);
+		s->priority	= le16_to_cpu(s->priority);
+
+		if (pdu->log_offset) {
+			struct io_sample_offset *so = (void *) s;
+
+			so->offset = le64_to_cpu(so->offset);
+		}
+
+		if (pdu->log_type == IO_LOG_TYPE_HIST) {
+			s->data.plat_entry = (void *) s + __log_entry_sz(pdu->log_offset);
+			s->data.plat_entry->list.next = NULL;
+			s->data.plat_entry->list.prev = NULL;
+		}
+	}
+}
+
 static void client_flush_hist_samples(FILE *f, int hist_coarseness, void *samples,
-				      uint64_t sample_size)
+				      uint64_t nr_samples, int log_offset)
 {
+	size_t entry_sz = __log_entry_sz(log_offset) + sizeof(struct io_u_plat_entry);
 	struct io_sample *s;
-	int log_offset;
-	uint64_t i, j, nr_samples;
+	uint64_t i, j;
 	struct io_u_plat_entry *entry;
 	uint64_t *io_u_plat;
 
 	int stride = 1 << hist_coarseness;
 
-	if (!sample_size)
-		return;
-
-	s = __get_sample(samples, 0, 0);
-	log_offset = (s->__ddir & LOG_OFFSET_SAMPLE_BIT) != 0;
-
-	nr_samples = sample_size / __log_entry_sz(log_offset);
-
 	for (i = 0; i < nr_samples; i++) {
-
-		s = (struct io_sample *)((char *)__get_sample(samples, log_offset, i) +
-			i * sizeof(struct io_u_plat_entry));
+		s = samples + i * entry_sz;
 
 		entry = s->data.plat_entry;
 		io_u_plat = entry->io_u_plat;
@@ -1424,20 +1860,113 @@ static void client_flush_hist_samples(FILE *f, int hist_coarseness, void *sample
 	}
 }
 
+static void client_flush_log_samples(FILE *f, struct cmd_iolog_pdu *pdu,
+				     void *samples, uint64_t nr_samples)
+{
+	uint64_t size = nr_samples * __log_entry_sz(pdu->log_offset);
+
+	if (pdu->log_type == IO_LOG_TYPE_HIST &&
+	    pdu->log_binary == LOG_BINARY_COLUMNAR)
+		flush_hist_samples_columnar(f, pdu->log_hist_coarseness,
+			samples, nr_samples,
+			__log_entry_sz(pdu->log_offset) +
+			sizeof(struct io_u_plat_entry), true);
+	else if (pdu->log_type == IO_LOG_TYPE_HIST)
+		client_flush_hist_samples(f, pdu->log_hist_coarseness, samples,
+					  nr_samples, pdu->log_offset);
+	else if (pdu->log_binary == LOG_BINARY_COLUMNAR)
+		flush_samples_columnar(f, samples, size);
+	else if (pdu->log_binary)
+		flush_samples_binary(f, samples, size);
+	else
+		flush_samples(f, samples, size);
+}
+
+#ifdef CONFIG_ZLIB
+#define CLIENT_IOLOG_BATCH	4096
+
+/*
+ * Inflate a compressed log a batch of samples at a time, and write out
+ * each batch as it completes, instead of decompressing all of it first.
+ */
+static int client_inflate_iolog(FILE *f, struct cmd_iolog_pdu *pdu,
+				void *in, size_t in_len)
+{
+	size_t entry_sz = iolog_pdu_entry_sz(pdu);
+	size_t buf_sz = entry_sz * CLIENT_IOLOG_BATCH;
+	uint64_t left = pdu->nr_samples;
+	z_stream stream = {
+		.zalloc	= Z_NULL,
+		.zfree	= Z_NULL,
+		.opaque	= Z_NULL,
+	};
+	size_t have = 0;
+	void *buf;
+	int err = Z_OK;
+
+	if (inflateInit(&stream) != Z_OK)
+		return 1;
+
+	buf = malloc(buf_sz);
+	stream.next_in = in;
+	stream.avail_in = in_len;
+
+	while (left && err != Z_STREAM_END) {
+		uint64_t nr;
+
+		stream.next_out = buf + have;
+		stream.avail_out = buf_sz - have;
+		err = inflate(&stream, Z_NO_FLUSH);
+		/* Z_BUF_ERROR just means no more progress can be made */
+		if (err == Z_BUF_ERROR)
+			break;
+		if (err < 0) {
+			log_err("fio: inflate error %d\n", err);
+			break;
+		}
+
+		have = buf_sz - stream.avail_out;
+		nr = min(have / entry_sz, left);
+		if (!nr)
+			continue;
+
+		convert_iolog_samples(pdu, buf, nr);
+		client_flush_log_samples(f, pdu, buf, nr);
+		left -= nr;
+
+		have -= nr * entry_sz;
+		memmove(buf, buf + nr * entry_sz, have);
+	}
+
+	inflateEnd(&stream);
+	free(buf);
+
+	if (left) {
+		log_err("fio: IO log %s is missing %llu samples\n",
+			(char *) pdu->name, (unsigned long long) left);
+		return 1;
+	}
+
+	return 0;
+}
+#else
+static int client_inflate_iolog(FILE *f, struct cmd_iolog_pdu *pdu,
+				void *in, size_t in_len)
+{
+	log_err("fio: server sent compressed data by mistake\n");
+	return 1;
+}
+#endif
+
 static int fio_client_handle_iolog(struct fio_client *client,
 				   struct fio_net_cmd *cmd)
 {
-	struct cmd_iolog_pdu *pdu = NULL;
-	bool store_direct;
+	struct cmd_iolog_pdu *pdu = (struct cmd_iolog_pdu *) cmd->payload;
+	size_t len = cmd->pdu_len - sizeof(*pdu);
 	char *log_pathname = NULL;
 	int ret = 0;
 
-	pdu = convert_iolog(cmd, &store_direct);
-	if (!pdu) {
-		log_err("fio: failed converting IO log\n");
-		ret = 1;
-		goto out;
-	}
+	convert_iolog_pdu(pdu);
 
         /* allocate buffer big enough for next sprintf() call */
 	log_pathname = malloc(10 + strlen((char *)pdu->name) +
@@ -1450,9 +1979,8 @@ static int fio_client_handle_iolog(struct fio_client *client,
 	/* generate a unique pathname for the log file using hostname */
 	sprintf(log_pathname, "%s.%s", pdu->name, client->hostname);
 
-	if (store_direct) {
+	if (pdu->compressed == STORE_COMPRESSED) {
 		ssize_t wrote;
-		size_t sz;
 		int fd;
 
 		fd = open((const char *) log_pathname,
@@ -1464,11 +1992,10 @@ static int fio_client_handle_iolog(struct fio_client *client,
 			goto out;
 		}
 
-		sz = cmd->pdu_len - sizeof(*pdu);
-		wrote = write(fd, pdu->samples, sz);
+		wrote = write(fd, pdu->samples, len);
 		close(fd);
 
-		if (wrote != sz) {
+		if (wrote != len) {
 			log_err("fio: short write on compressed log\n");
 			ret = 1;
 			goto out;
@@ -1477,7 +2004,8 @@ static int fio_client_handle_iolog(struct fio_client *client,
 		ret = 0;
 	} else {
 		FILE *f;
-		f = fopen((const char *) log_pathname, "w");
+		f = fopen((const char *) log_pathname,
+				pdu->log_binary ? "wb" : "w");
 		if (!f) {
 			log_err("fio: fopen log %s : %s\n",
 				log_pathname, strerror(errno));
@@ -1485,21 +2013,25 @@ static int fio_client_handle_iolog(struct fio_client *client,
 			goto out;
 		}
 
-		if (pdu->log_type == IO_LOG_TYPE_HIST) {
-			client_flush_hist_samples(f, pdu->log_hist_coarseness, pdu->samples,
-					   pdu->nr_samples * sizeof(struct io_sample));
-		} else {
-			flush_samples(f, pdu->samples,
-					pdu->nr_samples * sizeof(struct io_sample));
+		/*
+		 * A compressed log is written out as it is inflated, a
+		 * plain one is converted in place.
+		 */
+		if (pdu->compressed == XMIT_COMPRESSED)
+			ret = client_inflate_iolog(f, pdu, pdu->samples, len);
+		else {
+			uint64_t nr = min(pdu->nr_samples,
+					  len / iolog_pdu_entry_sz(pdu));
+
+			convert_iolog_samples(pdu, pdu->samples, nr);
+			client_flush_log_samples(f, pdu, pdu->samples, nr);
 		}
 		fclose(f);
-		ret = 0;
 	}
 
 out:
-	if (pdu && pdu != (void *) cmd->payload)
-		free(pdu);
-
+	if (ret)
+		log_err("fio: failed converting IO log\n");
 	if (log_pathname)
 		free(log_pathname);
 
@@ -1578,159 +2110,6 @@ static void convert_text(struct fio_net_cmd *cmd)
 	pdu->log_usec	= le64_to_cpu(pdu->log_usec);
 }
 
-static struct cmd_iolog_pdu *convert_iolog_gz(struct fio_net_cmd *cmd,
-					      struct cmd_iolog_pdu *pdu)
-{
-#ifdef CONFIG_ZLIB
-	struct cmd_iolog_pdu *ret;
-	z_stream stream;
-	uint64_t nr_samples;
-	size_t total;
-	char *p;
-
-	stream.zalloc = Z_NULL;
-	stream.zfree = Z_NULL;
-	stream.opaque = Z_NULL;
-	stream.avail_in = 0;
-	stream.next_in = Z_NULL;
-
-	if (inflateInit(&stream) != Z_OK)
-		return NULL;
-
-	/*
-	 * Get header first, it's not compressed
-	 */
-	nr_samples = le64_to_cpu(pdu->nr_samples);
-
-	if (pdu->log_type == IO_LOG_TYPE_HIST)
-		total = nr_samples * (__log_entry_sz(le32_to_cpu(pdu->log_offset)) +
-					sizeof(struct io_u_plat_entry));
-	else
-		total = nr_samples * __log_entry_sz(le32_to_cpu(pdu->log_offset));
-	ret = malloc(total + sizeof(*pdu));
-	ret->nr_samples = nr_samples;
-
-	memcpy(ret, pdu, sizeof(*pdu));
-
-	p = (char *) ret + sizeof(*pdu);
-
-	stream.avail_in = cmd->pdu_len - sizeof(*pdu);
-	stream.next_in = (void *)((char *) pdu + sizeof(*pdu));
-	while (stream.avail_in) {
-		unsigned int this_chunk = 65536;
-		unsigned int this_len;
-		int err;
-
-		if (this_chunk > total)
-			this_chunk = total;
-
-		stream.avail_out = this_chunk;
-		stream.next_out = (void *)p;
-		err = inflate(&stream, Z_NO_FLUSH);
-		/* may be Z_OK, or Z_STREAM_END */
-		if (err < 0) {
-			/*
-			 * Z_STREAM_ERROR and Z_BUF_ERROR can safely be
-			 * ignored */
-			if (err == Z_STREAM_ERROR || err == Z_BUF_ERROR)
-				break;
-			log_err("fio: inflate error %d\n", err);
-			free(ret);
-			ret = NULL;
-			goto err;
-		}
-
-		this_len = this_chunk - stream.avail_out;
-		p += this_len;
-		total -= this_len;
-	}
-
-err:
-	inflateEnd(&stream);
-	return ret;
-#else
-	return NULL;
-#endif
-}
-
-/*
- * This has been compressed on the server side, since it can be big.
- * Uncompress here.
- */
-static struct cmd_iolog_pdu *convert_iolog(struct fio_net_cmd *cmd,
-					   bool *store_direct)
-{
-	struct cmd_iolog_pdu *pdu = (struct cmd_iolog_pdu *) cmd->payload;
-	struct cmd_iolog_pdu *ret;
-	uint64_t i;
-	int compressed;
-	void *samples;
-
-	*store_direct = false;
-
-	/*
-	 * Convert if compressed and we support it. If it's not
-	 * compressed, we need not do anything.
-	 */
-	compressed = le32_to_cpu(pdu->compressed);
-	if (compressed == XMIT_COMPRESSED) {
-#ifndef CONFIG_ZLIB
-		log_err("fio: server sent compressed data by mistake\n");
-		return NULL;
-#endif
-		ret = convert_iolog_gz(cmd, pdu);
-		if (!ret) {
-			log_err("fio: failed decompressing log\n");
-			return NULL;
-		}
-	} else if (compressed == STORE_COMPRESSED) {
-		*store_direct = true;
-		ret = pdu;
-	} else
-		ret = pdu;
-
-	ret->nr_samples		= le64_to_cpu(ret->nr_samples);
-	ret->thread_number	= le32_to_cpu(ret->thread_number);
-	ret->log_type		= le32_to_cpu(ret->log_type);
-	ret->compressed		= le32_to_cpu(ret->compressed);
-	ret->log_offset		= le32_to_cpu(ret->log_offset);
-	ret->log_prio		= le32_to_cpu(ret->log_prio);
-	ret->log_hist_coarseness = le32_to_cpu(ret->log_hist_coarseness);
-
-	if (*store_direct)
-		return ret;
-
-	samples = &ret->samples[0];
-	for (i = 0; i < ret->nr_samples; i++) {
-		struct io_sample *s;
-
-		s = __get_sample(samples, ret->log_offset, i);
-		if (ret->log_type == IO_LOG_TYPE_HIST)
-			s = (struct io_sample *)((char *)s + sizeof(struct io_u_plat_entry) * i);
-
-		s->time		= le64_to_cpu(s->time);
-		if (ret->log_type != IO_LOG_TYPE_HIST)
-			s->data.val	= le64_to_cpu(s->data.val);
-		s->__ddir	= __le32_to_cpu(s->__ddir);
-		s->bs		= le64_to_cpu(s->bs);
-		s->priority	= le16_to_cpu(s->priority);
-
-		if (ret->log_offset) {
-			struct io_sample_offset *so = (void *) s;
-
-			so->offset = le64_to_cpu(so->offset);
-		}
-
-		if (ret->log_type == IO_LOG_TYPE_HIST) {
-			s->data.plat_entry = (struct io_u_plat_entry *)(((char *)s) + sizeof(*s));
-			s->data.plat_entry->list.next = NULL;
-			s->data.plat_entry->list.prev = NULL;
-		}
-	}
-
-	return ret;
-}
-
 static void sendfile_reply(int fd, struct cmd_sendfile_reply *rep,
 			   size_t size, uint64_t tag)
 {
@@ -1772,6 +2151,32 @@ fail:
 	return 0;
 }
 
+/*
+ * The server sends FIO_NET_CMD_TS payloads zero run length encoded, swap
+ * in a command holding the decoded cmd_ts_pdu. Frees the received command.
+ */
+static struct fio_net_cmd *decode_ts_cmd(struct fio_net_cmd *cmd)
+{
+	struct fio_net_cmd *ret = NULL;
+	size_t len;
+	void *pdu;
+
+	pdu = fio_net_zrle_decode(cmd->payload, cmd->pdu_len, &len);
+	if (!pdu || len < sizeof(struct cmd_ts_pdu))
+		goto out;
+
+	ret = malloc(sizeof(*ret) + len);
+	if (ret) {
+		memcpy(ret, cmd, sizeof(*ret));
+		memcpy(ret->payload, pdu, len);
+		ret->pdu_len = len;
+	}
+out:
+	free(pdu);
+	free(cmd);
+	return ret;
+}
+
 int fio_handle_client(struct fio_client *client)
 {
 	struct client_ops *ops = client->ops;
@@ -1808,10 +2213,18 @@ int fio_handle_client(struct fio_client *client)
 		break;
 		}
 	case FIO_NET_CMD_TS: {
-		struct cmd_ts_pdu *p = (struct cmd_ts_pdu *) cmd->payload;
+		struct cmd_ts_pdu *p;
 		uint64_t offset;
 		int i;
 
+		cmd = decode_ts_cmd(cmd);
+		if (!cmd) {
+			log_err("fio: client %s, bad ts pdu\n",
+				client->hostname);
+			return 0;
+		}
+
+		p = (struct cmd_ts_pdu *) cmd->payload;
 		for (i = 0; i < DDIR_RWDIR_CNT; i++) {
 			if (le32_to_cpu(p->ts.nr_clat_prio[i])) {
 				offset = le64_to_cpu(p->ts.clat_prio_offset[i]);
@@ -1851,13 +2264,19 @@ int fio_handle_client(struct fio_client *client)
 		if (!remove_reply_cmd(client, cmd))
 			break;
 		convert_jobs_eta(je);
-		handle_eta(client, cmd);
+		je = client_inflate_eta(je);
+		handle_eta(client, cmd, je);
+		if (je != (struct jobs_eta *) cmd->payload)
+			free(je);
 		break;
 		}
 	case FIO_NET_CMD_PROBE:
 		remove_reply_cmd(client, cmd);
 		ops->probe(client, cmd);
 		break;
+	case FIO_NET_CMD_CLOCK:
+		handle_clock(client, cmd);
+		break;
 	case FIO_NET_CMD_SERVER_START:
 		client->state = Client_running;
 		if (ops->job_start)
@@ -2091,68 +2510,110 @@ static int fio_check_clients_timed_out(void)
 	return ret;
 }
 
-int fio_handle_clients(struct client_ops *ops)
+static bool client_is_idle(struct fio_client *client)
 {
-	struct pollfd *pfds;
-	int i, ret = 0, retval = 0;
+	return !client->sent_job && !client->ops->stay_connected &&
+		flist_empty(&client->cmd_list);
+}
 
-	fio_gettime(&eta_ts, NULL);
+/*
+ * Drop clients that never got a job and have nothing left in flight.
+ * Returns false once no clients are left.
+ */
+static bool prune_idle_clients(void)
+{
+	struct flist_head *entry, *tmp;
+	struct fio_client *client;
 
-	pfds = malloc(nr_clients * sizeof(struct pollfd));
+	flist_for_each_safe(entry, tmp, &client_list) {
+		client = flist_entry(entry, struct fio_client, list);
 
-	init_thread_stat(&client_ts);
-	init_group_run_stat(&client_gs);
+		if (client_is_idle(client))
+			remove_client(client);
+	}
 
-	while (!exit_backend && nr_clients) {
-		struct flist_head *entry, *tmp;
+	return nr_clients != 0;
+}
+
+/*
+ * Request ETAs and check the trigger file when due. Returns how long to
+ * wait for client data, or -1 if clients timed out and were removed.
+ */
+static int client_tick(struct client_ops *ops)
+{
+	struct timespec ts;
+
+	fio_gettime(&ts, NULL);
+	if (eta_time_within_slack(mtime_since(&eta_ts, &ts))) {
+		request_client_etas(ops);
+		memcpy(&eta_ts, &ts, sizeof(ts));
+
+		if (fio_check_clients_timed_out())
+			return -1;
+	}
+
+	check_trigger_file();
+	return min(100u, ops->eta_msec);
+}
+
+/*
+ * Handle a command from a client with data pending, dropping the
+ * reference taken by find_client_by_fd(). Returns 1 if the client
+ * failed or went away.
+ */
+static int handle_ready_client(struct fio_client *client)
+{
+	int ret = 0;
+
+	if (!fio_handle_client(client)) {
+		log_info("client: host=%s disconnected\n", client->hostname);
+		remove_client(client);
+		ret = 1;
+	} else {
+		if (client->error)
+			ret = 1;
+		if (client_is_idle(client))
+			remove_client(client);
+	}
+
+	fio_put_client(client);
+	return ret;
+}
+
+static void handle_clients_poll(struct client_ops *ops, int *retval)
+{
+	struct pollfd *pfds;
+	int i, ret;
+
+	pfds = malloc(nr_clients * sizeof(struct pollfd));
+
+	while (!exit_backend && prune_idle_clients()) {
+		struct flist_head *entry;
 		struct fio_client *client;
+		int timeout;
 
 		i = 0;
-		flist_for_each_safe(entry, tmp, &client_list) {
+		flist_for_each(entry, &client_list) {
 			client = flist_entry(entry, struct fio_client, list);
 
-			if (!client->sent_job && !client->ops->stay_connected &&
-			    flist_empty(&client->cmd_list)) {
-				remove_client(client);
-				continue;
-			}
-
 			pfds[i].fd = client->fd;
 			pfds[i].events = POLLIN;
 			i++;
 		}
 
-		if (!nr_clients)
-			break;
-
 		assert(i == nr_clients);
 
-		do {
-			struct timespec ts;
-			int timeout;
-
-			fio_gettime(&ts, NULL);
-			if (eta_time_within_slack(mtime_since(&eta_ts, &ts))) {
-				request_client_etas(ops);
-				memcpy(&eta_ts, &ts, sizeof(ts));
-
-				if (fio_check_clients_timed_out())
-					break;
-			}
-
-			check_trigger_file();
-
-			timeout = min(100u, ops->eta_msec);
+		timeout = client_tick(ops);
+		if (timeout < 0)
+			continue;
 
-			ret = poll(pfds, nr_clients, timeout);
-			if (ret < 0) {
-				if (errno == EINTR)
-					continue;
+		ret = poll(pfds, nr_clients, timeout);
+		if (ret < 0) {
+			if (errno != EINTR)
 				log_err("fio: poll clients: %s\n", strerror(errno));
-				break;
-			} else if (!ret)
-				continue;
-		} while (ret <= 0);
+			continue;
+		} else if (!ret)
+			continue;
 
 		for (i = 0; i < nr_clients; i++) {
 			if (!(pfds[i].revents & POLLIN))
@@ -2163,24 +2624,105 @@ int fio_handle_clients(struct client_ops *ops)
 				log_err("fio: unknown client fd %ld\n", (long) pfds[i].fd);
 				continue;
 			}
-			if (!fio_handle_client(client)) {
-				log_info("client: host=%s disconnected\n",
-						client->hostname);
-				remove_client(client);
-				retval = 1;
-			} else if (client->error)
-				retval = 1;
-			fio_put_client(client);
+			*retval |= handle_ready_client(client);
+		}
+	}
+
+	free(pfds);
+}
+
+#ifdef CONFIG_EPOLL
+#define CLIENT_EPOLL_EVENTS	64
+
+/*
+ * With many servers, most wakeups only have a few clients with data.
+ * epoll hands back just those instead of having the whole set scanned
+ * on every pass, and the set only needs building once as clients are
+ * never added while running. A closed fd leaves the set by itself.
+ * fio_net_recv_cmd() reads whole commands, so level-triggered is kept.
+ * Returns false if epoll can't be used, poll() then takes over.
+ */
+static bool handle_clients_epoll(struct client_ops *ops, int *retval)
+{
+	struct epoll_event events[CLIENT_EPOLL_EVENTS];
+	struct flist_head *entry;
+	struct fio_client *client;
+	int efd, i, ret;
+
+	if (!prune_idle_clients())
+		return true;
+
+	efd = epoll_create1(EPOLL_CLOEXEC);
+	if (efd < 0) {
+		dprint(FD_NET, "client: epoll_create1: %s\n", strerror(errno));
+		return false;
+	}
+
+	flist_for_each(entry, &client_list) {
+		struct epoll_event ev = { .events = EPOLLIN, };
+
+		client = flist_entry(entry, struct fio_client, list);
+		ev.data.fd = client->fd;
+		if (epoll_ctl(efd, EPOLL_CTL_ADD, client->fd, &ev) < 0) {
+			dprint(FD_NET, "client: epoll_ctl: %s\n", strerror(errno));
+			close(efd);
+			return false;
 		}
 	}
 
+	while (!exit_backend && nr_clients) {
+		int timeout;
+
+		timeout = client_tick(ops);
+		if (timeout < 0)
+			continue;
+
+		ret = epoll_wait(efd, events, CLIENT_EPOLL_EVENTS, timeout);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			log_err("fio: epoll clients: %s\n", strerror(errno));
+			close(efd);
+			return false;
+		}
+
+		for (i = 0; i < ret; i++) {
+			/* may have been removed while handling an earlier one */
+			client = find_client_by_fd(events[i].data.fd);
+			if (client)
+				*retval |= handle_ready_client(client);
+		}
+	}
+
+	close(efd);
+	return true;
+}
+#else
+static bool handle_clients_epoll(struct client_ops *ops, int *retval)
+{
+	return false;
+}
+#endif
+
+int fio_handle_clients(struct client_ops *ops)
+{
+	int retval = 0;
+
+	fio_gettime(&eta_ts, NULL);
+
+	init_thread_stat(&client_ts);
+	init_group_run_stat(&client_gs);
+
+	if (!handle_clients_epoll(ops, &retval))
+		handle_clients_poll(ops, &retval);
+
 	log_info_buf(allclients.buf, allclients.buflen);
 	buf_output_free(&allclients);
 
 	fio_client_json_fini();
 
 	free_clat_prio_stats(&client_ts);
-	free(pfds);
+	free_group_sums();
 	return retval || error_clients;
 }
 
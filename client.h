@@ -75,6 +75,15 @@ struct fio_client {
 	struct client_file *files;
 	unsigned int nr_files;
 
+	/* --sync-start clock probes, offset is the server's clock minus ours */
+	unsigned int clock_probes;
+	int64_t clock_offset;
+	uint64_t clock_delay;
+
+	/* --shard, the slice of every job this server runs */
+	unsigned int shard_index;
+	unsigned int shard_count;
+
 	struct buf_output buf;
 };
 
@@ -127,6 +136,7 @@ extern int fio_clients_connect(void);
 extern int fio_start_client(struct fio_client *);
 extern int fio_start_all_clients(void);
 extern int fio_clients_send_ini(const char *);
+extern int fio_clients_send_job(const char *, const void *, size_t);
 extern int fio_client_send_ini(struct fio_client *, const char *, bool);
 extern int fio_handle_clients(struct client_ops *);
 extern int fio_client_add(struct client_ops *, const char *, void **);
@@ -148,6 +158,9 @@ enum {
 };
 
 extern int sum_stat_clients;
+extern bool client_summary;
+extern unsigned int sync_start_msec;
+extern bool shard_clients;
 extern struct thread_stat client_ts;
 extern struct group_run_stats client_gs;
 
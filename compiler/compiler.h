@@ -13,7 +13,18 @@
 #define fio_init	__attribute__((constructor))
 #define fio_exit	__attribute__((destructor))
 
+/*
+ * For keeping fields written by different threads on separate cache
+ * lines. 64 bytes covers the common cases, a larger line just means
+ * two neighbouring groups may still share one.
+ */
+#ifndef FIO_CACHE_LINE_SIZE
+#define FIO_CACHE_LINE_SIZE	64
+#endif
+#define __fio_cacheline_aligned	__attribute__((aligned(FIO_CACHE_LINE_SIZE)))
+
 #define fio_unlikely(x)	__builtin_expect(!!(x), 0)
+#define fio_prefetch(x)	__builtin_prefetch(x)
 
 /*
  * Check at compile time that something is of a particular type.
@@ -0,0 +1,161 @@
+#include <math.h>
+
+#include "fio.h"
+#include "compress.h"
+
+#ifdef CONFIG_ZLIB
+#include <zlib.h>
+#endif
+
+/*
+ * buffer_compress_mode=entropy and zlib fill buffers with random data of
+ * reduced entropy, see fill_random_buf_entropy(). Zeroed regions are easy
+ * to see through for compressors that work on whole blocks, data where
+ * every byte carries some randomness compresses evenly instead.
+ *
+ * Each mode has a table mapping buffer_compress_percentage to an entropy
+ * level. It's built once, by the first job that needs it, and jobs are
+ * set up before they fork or start their threads.
+ */
+static unsigned int compress_lut[3][101];
+static bool compress_lut_valid[3];
+
+/*
+ * Order 0 entropy of data at 'level', in thousandths of the input size.
+ * This is the best an entropy coder can do, as the bytes are independent.
+ */
+static double entropy_size(unsigned int level)
+{
+	unsigned int bits = level / FIO_ENTROPY_BLOCK;
+	double wide = (double) (level % FIO_ENTROPY_BLOCK) / FIO_ENTROPY_BLOCK;
+	double n, p1, p2, h;
+
+	if (!wide || bits == 8)
+		return 1000.0 * bits / 8;
+
+	/* values below 2^bits come from both byte widths, the rest only wide */
+	n = 1U << bits;
+	p1 = wide / (2 * n) + (1 - wide) / n;
+	p2 = wide / (2 * n);
+	h = -n * (p1 * log2(p1) + p2 * log2(p2));
+	return 1000.0 * h / 8;
+}
+
+#ifdef CONFIG_ZLIB
+#define CALIBRATE_LEN	(64 * 1024)
+#define CALIBRATE_STEP	8
+
+/*
+ * Compressed size at 'level' in thousandths, measured with deflate at the
+ * default compression level.
+ */
+static double zlib_size(unsigned int level, void *src, void *dst,
+			uLong dst_len)
+{
+	__fill_random_buf_entropy(0x9e3779b97f4a7c15ULL + level, src,
+				  CALIBRATE_LEN, level, FIO_BUF_GEN_XORSHIFT);
+	if (compress2(dst, &dst_len, src, CALIBRATE_LEN,
+		      Z_DEFAULT_COMPRESSION) != Z_OK)
+		return -1;
+
+	return 1000.0 * dst_len / CALIBRATE_LEN;
+}
+#endif
+
+/*
+ * Fill 'size' with the compressed size of each level. Returns the step
+ * between the levels that were measured, the others are interpolated.
+ */
+static int measure_levels(enum compress_mode mode, double *size)
+{
+	unsigned int level, step = 1;
+
+	if (mode == COMPRESS_MODE_ENTROPY) {
+		for (level = 0; level <= FIO_ENTROPY_LEVELS; level++)
+			size[level] = entropy_size(level);
+		return step;
+	}
+
+#ifdef CONFIG_ZLIB
+	{
+		uLong dst_len = compressBound(CALIBRATE_LEN);
+		void *src, *dst;
+
+		src = malloc(CALIBRATE_LEN);
+		dst = malloc(dst_len);
+		if (!src || !dst) {
+			free(src);
+			free(dst);
+			return -1;
+		}
+
+		step = CALIBRATE_STEP;
+		for (level = 0; level <= FIO_ENTROPY_LEVELS; level += step) {
+			size[level] = zlib_size(level, src, dst, dst_len);
+			if (size[level] < 0)
+				break;
+		}
+
+		free(src);
+		free(dst);
+		if (level <= FIO_ENTROPY_LEVELS)
+			return -1;
+		return step;
+	}
+#else
+	return -1;
+#endif
+}
+
+static int build_compress_lut(enum compress_mode mode)
+{
+	double size[FIO_ENTROPY_LEVELS + 1], target, frac;
+	unsigned int level;
+	int perc, step;
+
+	step = measure_levels(mode, size);
+	if (step < 0)
+		return 1;
+
+	/*
+	 * The compressed size grows with the level. Pick the level where the
+	 * size crosses the target, interpolating between measured levels.
+	 */
+	level = 0;
+	for (perc = 100; perc >= 0; perc--) {
+		target = 10.0 * (100 - perc);
+		while (level + step <= FIO_ENTROPY_LEVELS &&
+		       size[level + step] < target)
+			level += step;
+
+		if (level + step > FIO_ENTROPY_LEVELS || size[level] >= target) {
+			compress_lut[mode][perc] = level;
+			continue;
+		}
+
+		frac = (target - size[level]) / (size[level + step] - size[level]);
+		compress_lut[mode][perc] = level + (unsigned int) (frac * step + 0.5);
+	}
+
+	compress_lut_valid[mode] = true;
+	return 0;
+}
+
+int init_compress_level(struct thread_data *td)
+{
+	struct thread_options *o = &td->o;
+
+	if (!o->compress_percentage || o->compress_mode == COMPRESS_MODE_FIXED)
+		return 0;
+
+	if (!compress_lut_valid[o->compress_mode] &&
+	    build_compress_lut(o->compress_mode)) {
+		log_err("fio: failed calibrating buffer_compress_mode\n");
+		return 1;
+	}
+
+	td->compress_level = compress_lut[o->compress_mode][o->compress_percentage];
+	dprint(FD_PARSE, "compress: %u%% maps to entropy level %u/%u\n",
+		o->compress_percentage, td->compress_level, FIO_ENTROPY_LEVELS);
+	return 0;
+}
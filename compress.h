@@ -0,0 +1,6 @@
+#ifndef FIO_COMPRESS_H
+#define FIO_COMPRESS_H
+
+int init_compress_level(struct thread_data *td);
+
+#endif
@@ -0,0 +1,290 @@
+/*
+ * Submission and completion CPU locality, see cpuloc.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#ifdef CONFIG_LIBNUMA
+#include <numa.h>
+#endif
+
+#include "fio.h"
+#include "cpuloc.h"
+#include "smalloc.h"
+#include "json.h"
+
+static const char *cpuloc_names[CPULOC_NR] = {
+	"same_cpu", "same_node", "cross_node",
+};
+
+/*
+ * The node of a CPU, from libnuma if there is one, else from the nodeN
+ * link sysfs has in the directory of the CPU. 0 if neither knows.
+ */
+static int cpu_node(int cpu)
+{
+	char path[64];
+	struct dirent *dent;
+	DIR *dir;
+	int node = -1;
+
+#ifdef CONFIG_LIBNUMA
+	if (numa_available() >= 0)
+		return max(numa_node_of_cpu(cpu), 0);
+#endif
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	dir = opendir(path);
+	if (!dir)
+		return 0;
+	while ((dent = readdir(dir)) != NULL) {
+		if (sscanf(dent->d_name, "node%d", &node) == 1)
+			break;
+	}
+	closedir(dir);
+
+	return max(node, 0);
+}
+
+static size_t cpu_locality_size(unsigned int nr_cpus, unsigned int nr_nodes)
+{
+	return sizeof(struct cpu_locality) +
+		nr_cpus * CPULOC_NR * sizeof(uint64_t) +
+		nr_nodes * nr_nodes * sizeof(uint64_t) +
+		nr_cpus * sizeof(int);
+}
+
+static void cpu_locality_setup(struct cpu_locality *cl, unsigned int nr_cpus,
+			       unsigned int nr_nodes)
+{
+	cl->nr_cpus = nr_cpus;
+	cl->nr_nodes = nr_nodes;
+	cl->cpu_ios = (uint64_t *) (cl + 1);
+	cl->node_ios = cl->cpu_ios + nr_cpus * CPULOC_NR;
+	cl->cpu_node = (int *) (cl->node_ios + nr_nodes * nr_nodes);
+}
+
+int cpu_locality_init(struct thread_data *td)
+{
+	unsigned int i, nr_cpus, nr_nodes = 1;
+	struct cpu_locality *cl;
+	int *nodes;
+
+	if (!td->o.cpu_locality_stats)
+		return 0;
+
+	nr_cpus = cpus_configured();
+	nodes = malloc(nr_cpus * sizeof(int));
+	if (!nodes)
+		goto err;
+	for (i = 0; i < nr_cpus; i++) {
+		nodes[i] = cpu_node(i);
+		nr_nodes = max(nr_nodes, (unsigned int) nodes[i] + 1);
+	}
+
+	cl = scalloc(1, cpu_locality_size(nr_cpus, nr_nodes));
+	if (!cl) {
+		free(nodes);
+		goto err;
+	}
+
+	cpu_locality_setup(cl, nr_cpus, nr_nodes);
+	memcpy(cl->cpu_node, nodes, nr_cpus * sizeof(int));
+	free(nodes);
+	mem_acct_add(td, MEM_STATS, cpu_locality_size(nr_cpus, nr_nodes));
+
+	dprint(FD_PROCESS, "cpu locality: %u cpus on %u nodes\n", nr_cpus,
+								nr_nodes);
+	td->cpu_locality = cl;
+	return 0;
+err:
+	td_verror(td, ENOMEM, "cpu_locality_init");
+	return 1;
+}
+
+void cpu_locality_free(struct thread_data *td)
+{
+	sfree(td->cpu_locality);
+	td->cpu_locality = NULL;
+}
+
+void cpu_locality_reset(struct thread_data *td)
+{
+	struct cpu_locality *cl = td->cpu_locality;
+
+	if (!cl)
+		return;
+
+	cl->unknown = 0;
+	memset(cl->ios, 0, sizeof(cl->ios));
+	memset(cl->lat_sum, 0, sizeof(cl->lat_sum));
+	memset(cl->lat_max, 0, sizeof(cl->lat_max));
+	memset(cl->lat_bins, 0, sizeof(cl->lat_bins));
+	memset(cl->cpu_ios, 0, cl->nr_cpus * CPULOC_NR * sizeof(uint64_t));
+	memset(cl->node_ios, 0,
+		cl->nr_nodes * cl->nr_nodes * sizeof(uint64_t));
+}
+
+static void cpu_locality_sum(struct cpu_locality *dst,
+			     const struct cpu_locality *src)
+{
+	unsigned int i, j;
+
+	dst->unknown += src->unknown;
+	for (i = 0; i < CPULOC_NR; i++) {
+		dst->ios[i] += src->ios[i];
+		dst->lat_sum[i] += src->lat_sum[i];
+		dst->lat_max[i] = max(dst->lat_max[i], src->lat_max[i]);
+		for (j = 0; j < LATMAP_BINS; j++)
+			dst->lat_bins[i][j] += src->lat_bins[i][j];
+	}
+	for (i = 0; i < dst->nr_cpus * CPULOC_NR; i++)
+		dst->cpu_ios[i] += src->cpu_ios[i];
+	for (i = 0; i < dst->nr_nodes * dst->nr_nodes; i++)
+		dst->node_ios[i] += src->node_ios[i];
+}
+
+/*
+ * The locality of the jobs ts reports on, summed as group_reporting
+ * does. Only the backend has the jobs around, clients don't get these.
+ * The caller frees the result.
+ */
+static struct cpu_locality *cpu_locality_get(struct thread_stat *ts)
+{
+	struct cpu_locality *sum, *cl;
+	struct thread_data *first = NULL;
+
+	for_each_td(td) {
+		if (td->thread_number == ts->thread_number) {
+			first = td;
+			break;
+		}
+	} end_for_each();
+	if (!first || !first->cpu_locality)
+		return NULL;
+
+	cl = first->cpu_locality;
+	sum = calloc(1, cpu_locality_size(cl->nr_cpus, cl->nr_nodes));
+	if (!sum)
+		return NULL;
+	cpu_locality_setup(sum, cl->nr_cpus, cl->nr_nodes);
+	memcpy(sum->cpu_node, cl->cpu_node, cl->nr_cpus * sizeof(int));
+
+	if (!first->o.group_reporting)
+		cpu_locality_sum(sum, cl);
+	else {
+		for_each_td(td) {
+			if (td->o.group_reporting &&
+			    td->groupid == first->groupid && td->cpu_locality)
+				cpu_locality_sum(sum, td->cpu_locality);
+		} end_for_each();
+	}
+
+	return sum;
+}
+
+static uint64_t cpu_locality_ios(const struct cpu_locality *cl)
+{
+	return cl->ios[CPULOC_SAME_CPU] + cl->ios[CPULOC_SAME_NODE] +
+		cl->ios[CPULOC_CROSS_NODE];
+}
+
+void cpu_locality_json(struct json_object *root, struct thread_stat *ts)
+{
+	static const double pcts[] = { 50.0, 90.0, 99.0, 99.9 };
+	struct json_object *obj, *class, *lat, *pct, *cpu;
+	struct json_array *nodes, *row, *cpus;
+	struct cpu_locality *cl;
+	unsigned int i, j;
+	char name[32];
+
+	cl = cpu_locality_get(ts);
+	if (!cl)
+		return;
+
+	obj = json_create_object();
+	json_object_add_value_object(root, "cpu_locality", obj);
+	json_object_add_value_int(obj, "unknown", cl->unknown);
+
+	for (i = 0; i < CPULOC_NR; i++) {
+		class = json_create_object();
+		json_object_add_value_object(obj, cpuloc_names[i], class);
+		json_object_add_value_int(class, "total_ios", cl->ios[i]);
+		if (!cl->ios[i])
+			continue;
+
+		lat = json_create_object();
+		json_object_add_value_object(class, "clat_ns", lat);
+		json_object_add_value_float(lat, "mean",
+			(double) cl->lat_sum[i] / cl->ios[i]);
+		json_object_add_value_int(lat, "max", cl->lat_max[i]);
+		pct = json_create_object();
+		json_object_add_value_object(lat, "percentile", pct);
+		for (j = 0; j < FIO_ARRAY_SIZE(pcts); j++) {
+			snprintf(name, sizeof(name), "%f", pcts[j]);
+			json_object_add_value_int(pct, name,
+				latmap_pct(cl->lat_bins[i], cl->ios[i],
+					   cl->lat_max[i], pcts[j]));
+		}
+	}
+
+	/* rows are the submit node, columns the completion node */
+	nodes = json_create_array();
+	json_object_add_value_array(obj, "nodes", nodes);
+	for (i = 0; i < cl->nr_nodes; i++) {
+		row = json_create_array();
+		json_array_add_value_array(nodes, row);
+		for (j = 0; j < cl->nr_nodes; j++)
+			json_array_add_value_int(row,
+				cl->node_ios[i * cl->nr_nodes + j]);
+	}
+
+	cpus = json_create_array();
+	json_object_add_value_array(obj, "cpus", cpus);
+	for (i = 0; i < cl->nr_cpus; i++) {
+		const uint64_t *ios = &cl->cpu_ios[i * CPULOC_NR];
+
+		if (!ios[CPULOC_SAME_CPU] && !ios[CPULOC_SAME_NODE] &&
+		    !ios[CPULOC_CROSS_NODE])
+			continue;
+
+		cpu = json_create_object();
+		json_array_add_value_object(cpus, cpu);
+		json_object_add_value_int(cpu, "cpu", i);
+		json_object_add_value_int(cpu, "node", cl->cpu_node[i]);
+		for (j = 0; j < CPULOC_NR; j++)
+			json_object_add_value_int(cpu, cpuloc_names[j], ios[j]);
+	}
+
+	free(cl);
+}
+
+void cpu_locality_show(struct thread_stat *ts, struct buf_output *out)
+{
+	struct cpu_locality *cl;
+	uint64_t total;
+	int i;
+
+	cl = cpu_locality_get(ts);
+	if (!cl)
+		return;
+
+	total = cpu_locality_ios(cl);
+	if (total) {
+		log_buf(out, "  cpu locality :");
+		for (i = 0; i < CPULOC_NR; i++) {
+			log_buf(out, "%s %s=%3.1f%%", i ? "," : "",
+				cpuloc_names[i],
+				(double) cl->ios[i] * 100.0 / total);
+			if (cl->ios[i])
+				log_buf(out, " (p99=%lluus)",
+					(unsigned long long)
+					latmap_pct(cl->lat_bins[i], cl->ios[i],
+						   cl->lat_max[i], 99.0) / 1000);
+		}
+		log_buf(out, "\n");
+	}
+
+	free(cl);
+}
@@ -0,0 +1,76 @@
+#ifndef FIO_CPULOC_H
+#define FIO_CPULOC_H
+
+#include <stdint.h>
+
+#include "latmap.h"
+
+struct thread_data;
+struct thread_stat;
+struct json_object;
+struct buf_output;
+
+/*
+ * cpu_locality_stats=1 notes the CPU an IO was submitted on and the CPU
+ * the job reaped its completion on, and sorts each IO as completed on the
+ * same CPU, on another CPU of the same NUMA node, or on another node. Each
+ * class keeps a completion latency histogram, with the log-linear bins of
+ * lat_heatmap, so the cost of a remote completion shows. Counts are also
+ * kept per submitting CPU and per pair of submit and completion node.
+ */
+enum {
+	CPULOC_SAME_CPU = 0,
+	CPULOC_SAME_NODE,
+	CPULOC_CROSS_NODE,
+	CPULOC_NR,
+};
+
+struct cpu_locality {
+	unsigned int nr_cpus;
+	unsigned int nr_nodes;
+	uint64_t unknown;
+	uint64_t ios[CPULOC_NR];
+	uint64_t lat_sum[CPULOC_NR];
+	uint64_t lat_max[CPULOC_NR];
+	uint32_t lat_bins[CPULOC_NR][LATMAP_BINS];
+	int *cpu_node;		/* nr_cpus */
+	uint64_t *cpu_ios;	/* nr_cpus x CPULOC_NR, by submit CPU */
+	uint64_t *node_ios;	/* nr_nodes x nr_nodes, submit x complete */
+};
+
+extern int cpu_locality_init(struct thread_data *);
+extern void cpu_locality_free(struct thread_data *);
+extern void cpu_locality_reset(struct thread_data *);
+extern void cpu_locality_json(struct json_object *, struct thread_stat *);
+extern void cpu_locality_show(struct thread_stat *, struct buf_output *);
+
+static inline void cpu_locality_add(struct cpu_locality *cl, int submit,
+				    int complete, unsigned long long nsec)
+{
+	int sn, cn, class;
+
+	if (submit < 0 || complete < 0 || submit >= (int) cl->nr_cpus ||
+	    complete >= (int) cl->nr_cpus) {
+		cl->unknown++;
+		return;
+	}
+
+	sn = cl->cpu_node[submit];
+	cn = cl->cpu_node[complete];
+	if (submit == complete)
+		class = CPULOC_SAME_CPU;
+	else if (sn == cn)
+		class = CPULOC_SAME_NODE;
+	else
+		class = CPULOC_CROSS_NODE;
+
+	cl->ios[class]++;
+	cl->lat_sum[class] += nsec;
+	if (nsec > cl->lat_max[class])
+		cl->lat_max[class] = nsec;
+	cl->lat_bins[class][latmap_bin(nsec)]++;
+	cl->cpu_ios[submit * CPULOC_NR + class]++;
+	cl->node_ios[sn * cl->nr_nodes + cn]++;
+}
+
+#endif
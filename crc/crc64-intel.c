@@ -0,0 +1,172 @@
+#include "crc64.h"
+
+/*
+ * crc64 using carry-less multiplication, PCLMULQDQ and, where available,
+ * the 512-bit VPCLMULQDQ. Based on the folding method described in
+ * "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+ * Instruction", Intel, 2009.
+ *
+ * The buffer is folded into 128-bit lanes that are congruent with the
+ * data modulo the polynomial, the last lane is then reduced with the
+ * table driven code. Folding a lane forward by D bits multiplies its low
+ * 64 bits with x^(D+63) mod P and its high 64 bits with x^(D-1) mod P,
+ * the extra x^-1 accounts for the bit reflection of the product.
+ */
+
+#ifdef ARCH_HAVE_X86_CRYPTO
+
+#include <immintrin.h>
+
+/* fold by 128, 256, 384, 512 and 2048 bits */
+#define CRC64_K_128	_mm_set_epi64x(0x381d0015c96f4444ULL, 0xd9d7be7d505da32cULL)
+#define CRC64_K_256	_mm_set_epi64x(0xef3d1d18ed889ed2ULL, 0x6ba4d760ab38201eULL)
+#define CRC64_K_384	_mm_set_epi64x(0x7b3211a760160db8ULL, 0xa062b2319d66692fULL)
+#define CRC64_K_512	_mm_set_epi64x(0xf49784a634f014e4ULL, 0xaf86efb16d9ab4fbULL)
+#define CRC64_K_2048	0x9471a5389095fe44ULL, 0x9a8908341a6d6d52ULL
+
+static bool crc64_probed;
+static bool crc64_vpclmul;
+
+#define CRC64_FOLD(x, k, d)						\
+	_mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128((x), (k), 0x00),\
+				    _mm_clmulepi64_si128((x), (k), 0x11)), (d))
+
+#ifdef ARCH_HAVE_VPCLMULQDQ
+/*
+ * Fold 256 bytes at the time in four 512-bit registers, returns the
+ * remaining lanes folded down to four 128-bit ones.
+ */
+__attribute__((target("sse4.1,pclmul,avx512f,vpclmulqdq")))
+static const unsigned char *crc64_fold_512(const unsigned char *data,
+					   unsigned long *length,
+					   __m128i *x, __m128i crc)
+{
+	const __m512i k = _mm512_set_epi64(CRC64_K_2048, CRC64_K_2048,
+					   CRC64_K_2048, CRC64_K_2048);
+	__m512i z[4], t;
+	int i;
+
+	for (i = 0; i < 4; i++)
+		z[i] = _mm512_loadu_si512((const void *) (data + i * 64));
+	z[0] = _mm512_xor_si512(z[0], _mm512_castsi128_si512(crc));
+	data += 256;
+	*length -= 256;
+
+	while (*length >= 256) {
+		for (i = 0; i < 4; i++) {
+			t = _mm512_loadu_si512((const void *) (data + i * 64));
+			z[i] = _mm512_ternarylogic_epi64(
+					_mm512_clmulepi64_epi128(z[i], k, 0x00),
+					_mm512_clmulepi64_epi128(z[i], k, 0x11),
+					t, 0x96);
+		}
+		data += 256;
+		*length -= 256;
+	}
+
+	/*
+	 * Lane j of z[i] sits at 16 * (4 * i + j) bytes, fold the four
+	 * registers into x[j] = lanes j, 4 + j, 8 + j, 12 + j.
+	 */
+	x[0] = _mm512_extracti32x4_epi32(z[0], 0);
+	x[1] = _mm512_extracti32x4_epi32(z[0], 1);
+	x[2] = _mm512_extracti32x4_epi32(z[0], 2);
+	x[3] = _mm512_extracti32x4_epi32(z[0], 3);
+	for (i = 1; i < 4; i++) {
+		__m128i l[4];
+
+		l[0] = _mm512_extracti32x4_epi32(z[i], 0);
+		l[1] = _mm512_extracti32x4_epi32(z[i], 1);
+		l[2] = _mm512_extracti32x4_epi32(z[i], 2);
+		l[3] = _mm512_extracti32x4_epi32(z[i], 3);
+		x[0] = CRC64_FOLD(x[0], CRC64_K_512, l[0]);
+		x[1] = CRC64_FOLD(x[1], CRC64_K_512, l[1]);
+		x[2] = CRC64_FOLD(x[2], CRC64_K_512, l[2]);
+		x[3] = CRC64_FOLD(x[3], CRC64_K_512, l[3]);
+	}
+
+	return data;
+}
+#endif
+
+__attribute__((target("sse4.1,pclmul")))
+unsigned long long crc64_intel(const unsigned char *data, unsigned long length)
+{
+	unsigned long long crc = 0;
+	unsigned char buf[16];
+	__m128i x[4], k;
+	int i;
+
+	if (length < 64)
+		return crc64_sw(crc, data, length);
+
+#ifdef ARCH_HAVE_VPCLMULQDQ
+	if (crc64_vpclmul && length >= 512)
+		data = crc64_fold_512(data, &length, x, _mm_cvtsi64_si128(crc));
+	else
+#endif
+	{
+		for (i = 0; i < 4; i++)
+			x[i] = _mm_loadu_si128((const __m128i *) (data + i * 16));
+		x[0] = _mm_xor_si128(x[0], _mm_cvtsi64_si128(crc));
+		data += 64;
+		length -= 64;
+	}
+
+	k = CRC64_K_512;
+	while (length >= 64) {
+		for (i = 0; i < 4; i++)
+			x[i] = CRC64_FOLD(x[i], k,
+				_mm_loadu_si128((const __m128i *) (data + i * 16)));
+		data += 64;
+		length -= 64;
+	}
+
+	/* fold the four lanes into the last one */
+	k = CRC64_K_128;
+	x[3] = CRC64_FOLD(x[2], k, x[3]);
+	x[3] = CRC64_FOLD(x[1], CRC64_K_256, x[3]);
+	x[3] = CRC64_FOLD(x[0], CRC64_K_384, x[3]);
+
+	while (length >= 16) {
+		x[3] = CRC64_FOLD(x[3], k,
+				  _mm_loadu_si128((const __m128i *) data));
+		data += 16;
+		length -= 16;
+	}
+
+	_mm_storeu_si128((__m128i *) buf, x[3]);
+	crc = crc64_sw(0, buf, sizeof(buf));
+	return crc64_sw(crc, data, length);
+}
+
+void crc64_intel_probe(void)
+{
+	if (!crc64_probed) {
+		unsigned int eax, ebx, ecx = 0, edx;
+
+		eax = 1;
+		do_cpuid(&eax, &ebx, &ecx, &edx);
+		crc64_intel_available = (ecx & (1 << 1)) &&
+					(ecx & (1 << 19));
+
+#ifdef ARCH_HAVE_VPCLMULQDQ
+		/* AVX-512 state must be enabled by the OS too */
+		if (crc64_intel_available && (ecx & (1 << 27))) {
+			unsigned int xcr0, xcr0_hi;
+
+			__asm__ __volatile__("xgetbv"
+				: "=a" (xcr0), "=d" (xcr0_hi) : "c" (0));
+			eax = 7;
+			ecx = 0;
+			do_cpuid(&eax, &ebx, &ecx, &edx);
+			crc64_vpclmul = (xcr0 & 0xe6) == 0xe6 &&
+					(ebx & (1 << 16)) &&
+					(ecx & (1 << 10));
+		}
+#endif
+		crc64_probed = true;
+	}
+}
+
+#endif /* ARCH_HAVE_X86_CRYPTO */
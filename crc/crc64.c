@@ -92,10 +92,11 @@ static const unsigned long long crctab64[256] = {
   0x29b7d047efec8728ULL
 };
 
-unsigned long long fio_crc64(const unsigned char *buffer, unsigned long length)
-{
-	unsigned long long crc = 0;
+bool crc64_intel_available = false;
 
+unsigned long long crc64_sw(unsigned long long crc, const unsigned char *buffer,
+			    unsigned long length)
+{
 	while (length--)
 		crc = crctab64[(crc ^ *(buffer++)) & 0xff] ^ (crc >> 8);
 
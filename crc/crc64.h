@@ -1,6 +1,32 @@
 #ifndef CRC64_H
 #define CRC64_H
 
-unsigned long long fio_crc64(const unsigned char *, unsigned long);
+#include <stdbool.h>
+
+#include "../arch/arch.h"
+
+extern bool crc64_intel_available;
+
+unsigned long long crc64_sw(unsigned long long, const unsigned char *,
+			    unsigned long);
+
+#ifdef ARCH_HAVE_X86_CRYPTO
+extern unsigned long long crc64_intel(const unsigned char *, unsigned long);
+extern void crc64_intel_probe(void);
+#else
+#define crc64_intel(buf, len)	crc64_sw(0, buf, len)
+static inline void crc64_intel_probe(void)
+{
+}
+#endif /* ARCH_HAVE_X86_CRYPTO */
+
+static inline unsigned long long fio_crc64(const unsigned char *buf,
+					   unsigned long len)
+{
+	if (crc64_intel_available)
+		return crc64_intel(buf, len);
+
+	return crc64_sw(0, buf, len);
+}
 
 #endif
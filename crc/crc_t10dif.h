@@ -0,0 +1,20 @@
+/*
+ *	crc_t10dif.h - T10 Data Integrity Field CRC-16 routine
+ *
+ * Implements the CRC-16 used for the guard tag of T10 DIF and NVMe 16b
+ * guard protection information:
+ *   Width 16
+ *   Poly  0x8BB7 (x^16 + x^15 + x^11 + x^9 + x^8 + x^7 + x^5 + x^4 + x^2 + x + 1)
+ *   Init  0
+ *
+ * This source code is licensed under the GNU General Public License,
+ * Version 2. See the file COPYING for more details.
+ */
+
+#ifndef __CRC_T10DIF_H
+#define __CRC_T10DIF_H
+
+extern unsigned short fio_crc_t10dif(unsigned short crc, const void *buffer,
+				     unsigned int len);
+
+#endif /* __CRC_T10DIF_H */
@@ -0,0 +1,224 @@
+#include <string.h>
+
+#include "md5.h"
+
+/*
+ * Multi-buffer md5 with AVX2, hashes eight buffers of the same length at
+ * the time with one buffer per 32-bit lane.
+ */
+
+bool md5_intel_available = false;
+
+#ifdef ARCH_HAVE_AVX2
+
+#include <immintrin.h>
+
+static bool md5_probed;
+
+#define MD5_MB_TARGET	__attribute__((target("avx2")))
+
+#define MD5_MB_F1(x, y, z)	_mm256_xor_si256(z, _mm256_and_si256(x,	\
+					_mm256_xor_si256(y, z)))
+#define MD5_MB_F2(x, y, z)	MD5_MB_F1(z, x, y)
+#define MD5_MB_F3(x, y, z)	_mm256_xor_si256(_mm256_xor_si256(x, y), z)
+#define MD5_MB_F4(x, y, z)	_mm256_xor_si256(y, _mm256_or_si256(x,	\
+					_mm256_xor_si256(z, ones)))
+
+#define MD5_MB_STEP(f, w, x, y, z, in, k, s) do {			\
+	w = _mm256_add_epi32(w, _mm256_add_epi32(f(x, y, z),		\
+			_mm256_add_epi32(in, _mm256_set1_epi32(k))));	\
+	w = _mm256_add_epi32(_mm256_or_si256(_mm256_slli_epi32(w, s),	\
+			_mm256_srli_epi32(w, 32 - s)), x);		\
+} while (0)
+
+/*
+ * Load 32 bytes from each lane and transpose them, so that in[i] holds
+ * word i of all eight lanes.
+ */
+MD5_MB_TARGET
+static inline void md5_mb_load(__m256i *in, const uint8_t **data,
+			       unsigned int off)
+{
+	__m256i r[8], t[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		r[i] = _mm256_loadu_si256((const __m256i *) (data[i] + off));
+
+	for (i = 0; i < 8; i += 2) {
+		t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+		t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+	}
+	for (i = 0; i < 8; i += 4) {
+		r[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+		r[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+		r[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+		r[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+	}
+	for (i = 0; i < 4; i++) {
+		in[i] = _mm256_permute2x128_si256(r[i], r[i + 4], 0x20);
+		in[i + 4] = _mm256_permute2x128_si256(r[i], r[i + 4], 0x31);
+	}
+}
+
+/* Hash 'blocks' 64-byte blocks of each lane, starting from the md5 IV */
+MD5_MB_TARGET
+static void md5_mb_blocks(uint32_t (*hash)[MD5_HASH_WORDS],
+			  const uint8_t **data, unsigned int blocks)
+{
+	const __m256i ones = _mm256_set1_epi32(-1);
+	__m256i a, b, c, d, sa, sb, sc, sd, in[16];
+	uint32_t state[MD5_HASH_WORDS][8] __attribute__((aligned(32)));
+	unsigned int off = 0;
+	int i, j;
+
+	a = _mm256_set1_epi32(0x67452301);
+	b = _mm256_set1_epi32(0xefcdab89);
+	c = _mm256_set1_epi32(0x98badcfe);
+	d = _mm256_set1_epi32(0x10325476);
+
+	while (blocks--) {
+		md5_mb_load(&in[0], data, off);
+		md5_mb_load(&in[8], data, off + 32);
+		off += 64;
+
+		sa = a;
+		sb = b;
+		sc = c;
+		sd = d;
+
+		MD5_MB_STEP(MD5_MB_F1, a, b, c, d, in[0], 0xd76aa478, 7);
+		MD5_MB_STEP(MD5_MB_F1, d, a, b, c, in[1], 0xe8c7b756, 12);
+		MD5_MB_STEP(MD5_MB_F1, c, d, a, b, in[2], 0x242070db, 17);
+		MD5_MB_STEP(MD5_MB_F1, b, c, d, a, in[3], 0xc1bdceee, 22);
+		MD5_MB_STEP(MD5_MB_F1, a, b, c, d, in[4], 0xf57c0faf, 7);
+		MD5_MB_STEP(MD5_MB_F1, d, a, b, c, in[5], 0x4787c62a, 12);
+		MD5_MB_STEP(MD5_MB_F1, c, d, a, b, in[6], 0xa8304613, 17);
+		MD5_MB_STEP(MD5_MB_F1, b, c, d, a, in[7], 0xfd469501, 22);
+		MD5_MB_STEP(MD5_MB_F1, a, b, c, d, in[8], 0x698098d8, 7);
+		MD5_MB_STEP(MD5_MB_F1, d, a, b, c, in[9], 0x8b44f7af, 12);
+		MD5_MB_STEP(MD5_MB_F1, c, d, a, b, in[10], 0xffff5bb1, 17);
+		MD5_MB_STEP(MD5_MB_F1, b, c, d, a, in[11], 0x895cd7be, 22);
+		MD5_MB_STEP(MD5_MB_F1, a, b, c, d, in[12], 0x6b901122, 7);
+		MD5_MB_STEP(MD5_MB_F1, d, a, b, c, in[13], 0xfd987193, 12);
+		MD5_MB_STEP(MD5_MB_F1, c, d, a, b, in[14], 0xa679438e, 17);
+		MD5_MB_STEP(MD5_MB_F1, b, c, d, a, in[15], 0x49b40821, 22);
+
+		MD5_MB_STEP(MD5_MB_F2, a, b, c, d, in[1], 0xf61e2562, 5);
+		MD5_MB_STEP(MD5_MB_F2, d, a, b, c, in[6], 0xc040b340, 9);
+		MD5_MB_STEP(MD5_MB_F2, c, d, a, b, in[11], 0x265e5a51, 14);
+		MD5_MB_STEP(MD5_MB_F2, b, c, d, a, in[0], 0xe9b6c7aa, 20);
+		MD5_MB_STEP(MD5_MB_F2, a, b, c, d, in[5], 0xd62f105d, 5);
+		MD5_MB_STEP(MD5_MB_F2, d, a, b, c, in[10], 0x02441453, 9);
+		MD5_MB_STEP(MD5_MB_F2, c, d, a, b, in[15], 0xd8a1e681, 14);
+		MD5_MB_STEP(MD5_MB_F2, b, c, d, a, in[4], 0xe7d3fbc8, 20);
+		MD5_MB_STEP(MD5_MB_F2, a, b, c, d, in[9], 0x21e1cde6, 5);
+		MD5_MB_STEP(MD5_MB_F2, d, a, b, c, in[14], 0xc33707d6, 9);
+		MD5_MB_STEP(MD5_MB_F2, c, d, a, b, in[3], 0xf4d50d87, 14);
+		MD5_MB_STEP(MD5_MB_F2, b, c, d, a, in[8], 0x455a14ed, 20);
+		MD5_MB_STEP(MD5_MB_F2, a, b, c, d, in[13], 0xa9e3e905, 5);
+		MD5_MB_STEP(MD5_MB_F2, d, a, b, c, in[2], 0xfcefa3f8, 9);
+		MD5_MB_STEP(MD5_MB_F2, c, d, a, b, in[7], 0x676f02d9, 14);
+		MD5_MB_STEP(MD5_MB_F2, b, c, d, a, in[12], 0x8d2a4c8a, 20);
+
+		MD5_MB_STEP(MD5_MB_F3, a, b, c, d, in[5], 0xfffa3942, 4);
+		MD5_MB_STEP(MD5_MB_F3, d, a, b, c, in[8], 0x8771f681, 11);
+		MD5_MB_STEP(MD5_MB_F3, c, d, a, b, in[11], 0x6d9d6122, 16);
+		MD5_MB_STEP(MD5_MB_F3, b, c, d, a, in[14], 0xfde5380c, 23);
+		MD5_MB_STEP(MD5_MB_F3, a, b, c, d, in[1], 0xa4beea44, 4);
+		MD5_MB_STEP(MD5_MB_F3, d, a, b, c, in[4], 0x4bdecfa9, 11);
+		MD5_MB_STEP(MD5_MB_F3, c, d, a, b, in[7], 0xf6bb4b60, 16);
+		MD5_MB_STEP(MD5_MB_F3, b, c, d, a, in[10], 0xbebfbc70, 23);
+		MD5_MB_STEP(MD5_MB_F3, a, b, c, d, in[13], 0x289b7ec6, 4);
+		MD5_MB_STEP(MD5_MB_F3, d, a, b, c, in[0], 0xeaa127fa, 11);
+		MD5_MB_STEP(MD5_MB_F3, c, d, a, b, in[3], 0xd4ef3085, 16);
+		MD5_MB_STEP(MD5_MB_F3, b, c, d, a, in[6], 0x04881d05, 23);
+		MD5_MB_STEP(MD5_MB_F3, a, b, c, d, in[9], 0xd9d4d039, 4);
+		MD5_MB_STEP(MD5_MB_F3, d, a, b, c, in[12], 0xe6db99e5, 11);
+		MD5_MB_STEP(MD5_MB_F3, c, d, a, b, in[15], 0x1fa27cf8, 16);
+		MD5_MB_STEP(MD5_MB_F3, b, c, d, a, in[2], 0xc4ac5665, 23);
+
+		MD5_MB_STEP(MD5_MB_F4, a, b, c, d, in[0], 0xf4292244, 6);
+		MD5_MB_STEP(MD5_MB_F4, d, a, b, c, in[7], 0x432aff97, 10);
+		MD5_MB_STEP(MD5_MB_F4, c, d, a, b, in[14], 0xab9423a7, 15);
+		MD5_MB_STEP(MD5_MB_F4, b, c, d, a, in[5], 0xfc93a039, 21);
+		MD5_MB_STEP(MD5_MB_F4, a, b, c, d, in[12], 0x655b59c3, 6);
+		MD5_MB_STEP(MD5_MB_F4, d, a, b, c, in[3], 0x8f0ccc92, 10);
+		MD5_MB_STEP(MD5_MB_F4, c, d, a, b, in[10], 0xffeff47d, 15);
+		MD5_MB_STEP(MD5_MB_F4, b, c, d, a, in[1], 0x85845dd1, 21);
+		MD5_MB_STEP(MD5_MB_F4, a, b, c, d, in[8], 0x6fa87e4f, 6);
+		MD5_MB_STEP(MD5_MB_F4, d, a, b, c, in[15], 0xfe2ce6e0, 10);
+		MD5_MB_STEP(MD5_MB_F4, c, d, a, b, in[6], 0xa3014314, 15);
+		MD5_MB_STEP(MD5_MB_F4, b, c, d, a, in[13], 0x4e0811a1, 21);
+		MD5_MB_STEP(MD5_MB_F4, a, b, c, d, in[4], 0xf7537e82, 6);
+		MD5_MB_STEP(MD5_MB_F4, d, a, b, c, in[11], 0xbd3af235, 10);
+		MD5_MB_STEP(MD5_MB_F4, c, d, a, b, in[2], 0x2ad7d2bb, 15);
+		MD5_MB_STEP(MD5_MB_F4, b, c, d, a, in[9], 0xeb86d391, 21);
+
+		a = _mm256_add_epi32(a, sa);
+		b = _mm256_add_epi32(b, sb);
+		c = _mm256_add_epi32(c, sc);
+		d = _mm256_add_epi32(d, sd);
+	}
+
+	_mm256_store_si256((__m256i *) state[0], a);
+	_mm256_store_si256((__m256i *) state[1], b);
+	_mm256_store_si256((__m256i *) state[2], c);
+	_mm256_store_si256((__m256i *) state[3], d);
+	for (i = 0; i < 8; i++)
+		for (j = 0; j < MD5_HASH_WORDS; j++)
+			hash[i][j] = state[j][i];
+}
+
+void md5_intel_mb(const uint8_t **data, unsigned int len,
+		  uint32_t **hash, unsigned int nr)
+{
+	uint32_t state[8][MD5_HASH_WORDS];
+	const uint8_t *lanes[8];
+	unsigned int i, blocks = len / 64;
+
+	/* unused lanes hash the first buffer again */
+	for (i = 0; i < 8; i++)
+		lanes[i] = data[i < nr ? i : 0];
+
+	md5_mb_blocks(state, lanes, blocks);
+
+	/* the tail and the padding are done per buffer */
+	for (i = 0; i < nr; i++) {
+		struct fio_md5_ctx md5_ctx = {
+			.hash = hash[i],
+			.byte_count = blocks * 64,
+		};
+
+		memcpy(hash[i], state[i], sizeof(state[i]));
+		fio_md5_update(&md5_ctx, data[i] + blocks * 64,
+				len - blocks * 64);
+		fio_md5_final(&md5_ctx);
+	}
+}
+
+void md5_intel_probe(void)
+{
+	if (!md5_probed) {
+		unsigned int eax, ebx, ecx = 0, edx;
+
+		eax = 1;
+		do_cpuid(&eax, &ebx, &ecx, &edx);
+
+		/* AVX state must be enabled by the OS */
+		if (ecx & (1 << 27)) {
+			unsigned int xcr0, xcr0_hi;
+
+			__asm__ __volatile__("xgetbv"
+				: "=a" (xcr0), "=d" (xcr0_hi) : "c" (0));
+			eax = 7;
+			ecx = 0;
+			do_cpuid(&eax, &ebx, &ecx, &edx);
+			md5_intel_available = (xcr0 & 0x6) == 0x6 &&
+					      (ebx & (1 << 5));
+		}
+		md5_probed = true;
+	}
+}
+
+#endif /* ARCH_HAVE_AVX2 */
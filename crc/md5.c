@@ -144,3 +144,24 @@ void fio_md5_final(struct fio_md5_ctx *mctx)
 	mctx->block[15] = mctx->byte_count >> 29;
 	md5_transform(mctx->hash, mctx->block);
 }
+
+void fio_md5_mb(const uint8_t **data, unsigned int len, uint32_t **hash,
+		unsigned int nr)
+{
+	unsigned int i;
+
+	if (md5_intel_available && nr > 1) {
+		md5_intel_mb(data, len, hash, nr);
+		return;
+	}
+
+	for (i = 0; i < nr; i++) {
+		struct fio_md5_ctx md5_ctx = {
+			.hash = hash[i],
+		};
+
+		fio_md5_init(&md5_ctx);
+		fio_md5_update(&md5_ctx, data[i], len);
+		fio_md5_final(&md5_ctx);
+	}
+}
@@ -2,6 +2,9 @@
 #define MD5_H
 
 #include <stdint.h>
+#include <stdbool.h>
+
+#include "../arch/arch.h"
 
 #define MD5_DIGEST_SIZE		16
 #define MD5_HMAC_BLOCK_SIZE	64
@@ -26,4 +29,26 @@ extern void fio_md5_update(struct fio_md5_ctx *, const uint8_t *, unsigned int);
 extern void fio_md5_final(struct fio_md5_ctx *);
 extern void fio_md5_init(struct fio_md5_ctx *);
 
+/*
+ * Hash up to MD5_MB_LANES buffers of the same length, the digest of
+ * data[i] is stored in hash[i]
+ */
+#define MD5_MB_LANES		8
+
+extern bool md5_intel_available;
+
+extern void fio_md5_mb(const uint8_t **data, unsigned int len,
+		       uint32_t **hash, unsigned int nr);
+
+#ifdef ARCH_HAVE_AVX2
+extern void md5_intel_mb(const uint8_t **, unsigned int, uint32_t **,
+			 unsigned int);
+extern void md5_intel_probe(void);
+#else
+#define md5_intel_mb(data, len, hash, nr)	do { } while (0)
+static inline void md5_intel_probe(void)
+{
+}
+#endif /* ARCH_HAVE_AVX2 */
+
 #endif
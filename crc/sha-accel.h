@@ -0,0 +1,40 @@
+#ifndef FIO_SHA_ACCEL_H
+#define FIO_SHA_ACCEL_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "../arch/arch.h"
+
+/*
+ * SHA1 and SHA256 block functions using the SHA extensions of x86 and the
+ * ARMv8 crypto extensions. They process 'blocks' 64-byte blocks of data.
+ */
+extern bool sha_intel_available;
+extern bool sha_arm64_available;
+
+#ifdef ARCH_HAVE_X86_CRYPTO
+extern void sha1_intel(uint32_t *, const uint8_t *, unsigned long);
+extern void sha256_intel(uint32_t *, const uint8_t *, unsigned long);
+extern void sha_intel_probe(void);
+#else
+#define sha1_intel(state, data, blocks)		do { } while (0)
+#define sha256_intel(state, data, blocks)	do { } while (0)
+static inline void sha_intel_probe(void)
+{
+}
+#endif /* ARCH_HAVE_X86_CRYPTO */
+
+#ifdef ARCH_HAVE_CRC_CRYPTO
+extern void sha1_arm64(uint32_t *, const uint8_t *, unsigned long);
+extern void sha256_arm64(uint32_t *, const uint8_t *, unsigned long);
+extern void sha_arm64_probe(void);
+#else
+#define sha1_arm64(state, data, blocks)		do { } while (0)
+#define sha256_arm64(state, data, blocks)	do { } while (0)
+static inline void sha_arm64_probe(void)
+{
+}
+#endif /* ARCH_HAVE_CRC_CRYPTO */
+
+#endif
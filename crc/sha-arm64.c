@@ -0,0 +1,141 @@
+#include "sha-accel.h"
+#include "../os/os.h"
+
+/*
+ * SHA1 and SHA256 using the ARMv8 cryptography extensions.
+ */
+
+bool sha_arm64_available = false;
+
+#ifdef ARCH_HAVE_CRC_CRYPTO
+
+#include <arm_neon.h>
+
+static bool sha_probed;
+
+static inline uint32x4_t sha_load_be32(const uint8_t *data)
+{
+	return vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data)));
+}
+
+void sha1_arm64(uint32_t *state, const uint8_t *data, unsigned long blocks)
+{
+	uint32x4_t abcd, abcd_save, w[4], k, t;
+	uint32_t e0, e0_save, e1;
+	int i;
+
+	abcd = vld1q_u32(state);
+	e0 = state[4];
+
+	while (blocks--) {
+		abcd_save = abcd;
+		e0_save = e0;
+
+		for (i = 0; i < 4; i++)
+			w[i] = sha_load_be32(data + i * 16);
+
+		for (i = 0; i < 20; i++) {
+			if (i < 5)
+				k = vdupq_n_u32(0x5a827999);
+			else if (i < 10)
+				k = vdupq_n_u32(0x6ed9eba1);
+			else if (i < 15)
+				k = vdupq_n_u32(0x8f1bbcdc);
+			else
+				k = vdupq_n_u32(0xca62c1d6);
+
+			t = vaddq_u32(w[i & 3], k);
+			e1 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+			if (i < 5)
+				abcd = vsha1cq_u32(abcd, e0, t);
+			else if (i < 10 || i >= 15)
+				abcd = vsha1pq_u32(abcd, e0, t);
+			else
+				abcd = vsha1mq_u32(abcd, e0, t);
+			e0 = e1;
+
+			/* w(i + 4) from w(i) .. w(i + 3) */
+			if (i < 16) {
+				w[i & 3] = vsha1su0q_u32(w[i & 3], w[(i + 1) & 3],
+							 w[(i + 2) & 3]);
+				w[i & 3] = vsha1su1q_u32(w[i & 3], w[(i + 3) & 3]);
+			}
+		}
+
+		e0 += e0_save;
+		abcd = vaddq_u32(abcd, abcd_save);
+		data += 64;
+	}
+
+	vst1q_u32(state, abcd);
+	state[4] = e0;
+}
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+void sha256_arm64(uint32_t *state, const uint8_t *data, unsigned long blocks)
+{
+	uint32x4_t state0, state1, abef_save, cdgh_save, w[4], t, tmp;
+	int i;
+
+	state0 = vld1q_u32(&state[0]);
+	state1 = vld1q_u32(&state[4]);
+
+	while (blocks--) {
+		abef_save = state0;
+		cdgh_save = state1;
+
+		for (i = 0; i < 4; i++)
+			w[i] = sha_load_be32(data + i * 16);
+
+		for (i = 0; i < 16; i++) {
+			t = vaddq_u32(w[i & 3], vld1q_u32(&sha256_k[i * 4]));
+			tmp = state0;
+			state0 = vsha256hq_u32(state0, state1, t);
+			state1 = vsha256h2q_u32(state1, tmp, t);
+
+			/* w(i + 4) from w(i) .. w(i + 3) */
+			if (i < 12) {
+				w[i & 3] = vsha256su0q_u32(w[i & 3],
+							   w[(i + 1) & 3]);
+				w[i & 3] = vsha256su1q_u32(w[i & 3],
+							   w[(i + 2) & 3],
+							   w[(i + 3) & 3]);
+			}
+		}
+
+		state0 = vaddq_u32(state0, abef_save);
+		state1 = vaddq_u32(state1, cdgh_save);
+		data += 64;
+	}
+
+	vst1q_u32(&state[0], state0);
+	vst1q_u32(&state[4], state1);
+}
+
+void sha_arm64_probe(void)
+{
+	if (!sha_probed) {
+		sha_arm64_available = os_cpu_has(CPU_ARM64_SHA);
+		sha_probed = true;
+	}
+}
+
+#endif /* ARCH_HAVE_CRC_CRYPTO */
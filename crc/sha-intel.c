@@ -0,0 +1,240 @@
+#include "sha-accel.h"
+
+/*
+ * SHA1 and SHA256 using the Intel SHA extensions, see "Intel SHA
+ * Extensions: New Instructions Supporting the Secure Hash Algorithm on
+ * Intel Architecture Processors", Intel, 2013.
+ */
+
+bool sha_intel_available = false;
+
+#ifdef ARCH_HAVE_X86_CRYPTO
+
+#include <immintrin.h>
+
+static bool sha_probed;
+
+#define SHA_TARGET	__attribute__((target("sha,sse4.1")))
+
+/*
+ * Four SHA1 rounds. Message words for the next rounds are scheduled
+ * while the current ones run: w1 gets sha1msg1 and w2 the xor, w3 is
+ * finished with sha1msg2.
+ */
+#define SHA1_ROUNDS4(e, en, w, f) do {				\
+	e = _mm_sha1nexte_epu32(e, w);				\
+	en = abcd;						\
+	abcd = _mm_sha1rnds4_epu32(abcd, e, f);			\
+} while (0)
+
+#define SHA1_MSG(w, w1, w2, w3) do {				\
+	w3 = _mm_sha1msg2_epu32(w3, w);				\
+	w1 = _mm_sha1msg1_epu32(w1, w);				\
+	w2 = _mm_xor_si128(w2, w);				\
+} while (0)
+
+SHA_TARGET
+void sha1_intel(uint32_t *state, const uint8_t *data, unsigned long blocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL,
+					    0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, e0, e0_save, e1;
+	__m128i w0, w1, w2, w3;
+
+	abcd = _mm_loadu_si128((const __m128i *) state);
+	abcd = _mm_shuffle_epi32(abcd, 0x1b);
+	e0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+	while (blocks--) {
+		abcd_save = abcd;
+		e0_save = e0;
+
+		w0 = _mm_loadu_si128((const __m128i *) (data + 0));
+		w0 = _mm_shuffle_epi8(w0, mask);
+		w1 = _mm_loadu_si128((const __m128i *) (data + 16));
+		w1 = _mm_shuffle_epi8(w1, mask);
+		w2 = _mm_loadu_si128((const __m128i *) (data + 32));
+		w2 = _mm_shuffle_epi8(w2, mask);
+		w3 = _mm_loadu_si128((const __m128i *) (data + 48));
+		w3 = _mm_shuffle_epi8(w3, mask);
+
+		/* rounds 0-15 */
+		e0 = _mm_add_epi32(e0, w0);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+		SHA1_ROUNDS4(e1, e0, w1, 0);
+		w0 = _mm_sha1msg1_epu32(w0, w1);
+		SHA1_ROUNDS4(e0, e1, w2, 0);
+		w1 = _mm_sha1msg1_epu32(w1, w2);
+		w0 = _mm_xor_si128(w0, w2);
+		SHA1_ROUNDS4(e1, e0, w3, 0);
+		SHA1_MSG(w3, w2, w1, w0);
+
+		/* rounds 16-63 */
+		SHA1_ROUNDS4(e0, e1, w0, 0);
+		SHA1_MSG(w0, w3, w2, w1);
+		SHA1_ROUNDS4(e1, e0, w1, 1);
+		SHA1_MSG(w1, w0, w3, w2);
+		SHA1_ROUNDS4(e0, e1, w2, 1);
+		SHA1_MSG(w2, w1, w0, w3);
+		SHA1_ROUNDS4(e1, e0, w3, 1);
+		SHA1_MSG(w3, w2, w1, w0);
+		SHA1_ROUNDS4(e0, e1, w0, 1);
+		SHA1_MSG(w0, w3, w2, w1);
+		SHA1_ROUNDS4(e1, e0, w1, 1);
+		SHA1_MSG(w1, w0, w3, w2);
+		SHA1_ROUNDS4(e0, e1, w2, 2);
+		SHA1_MSG(w2, w1, w0, w3);
+		SHA1_ROUNDS4(e1, e0, w3, 2);
+		SHA1_MSG(w3, w2, w1, w0);
+		SHA1_ROUNDS4(e0, e1, w0, 2);
+		SHA1_MSG(w0, w3, w2, w1);
+		SHA1_ROUNDS4(e1, e0, w1, 2);
+		SHA1_MSG(w1, w0, w3, w2);
+		SHA1_ROUNDS4(e0, e1, w2, 2);
+		SHA1_MSG(w2, w1, w0, w3);
+		SHA1_ROUNDS4(e1, e0, w3, 3);
+		SHA1_MSG(w3, w2, w1, w0);
+
+		/* rounds 64-79, the schedule is winding down */
+		SHA1_ROUNDS4(e0, e1, w0, 3);
+		w1 = _mm_sha1msg2_epu32(w1, w0);
+		w3 = _mm_sha1msg1_epu32(w3, w0);
+		w2 = _mm_xor_si128(w2, w0);
+		SHA1_ROUNDS4(e1, e0, w1, 3);
+		w2 = _mm_sha1msg2_epu32(w2, w1);
+		w3 = _mm_xor_si128(w3, w1);
+		SHA1_ROUNDS4(e0, e1, w2, 3);
+		w3 = _mm_sha1msg2_epu32(w3, w2);
+		SHA1_ROUNDS4(e1, e0, w3, 3);
+
+		e0 = _mm_sha1nexte_epu32(e0, e0_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+		data += 64;
+	}
+
+	abcd = _mm_shuffle_epi32(abcd, 0x1b);
+	_mm_storeu_si128((__m128i *) state, abcd);
+	state[4] = _mm_extract_epi32(e0, 3);
+}
+
+static const uint32_t sha256_k[64] __attribute__((aligned(16))) = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+/* Four SHA256 rounds using message words w and round constants i..i+3 */
+#define SHA256_ROUNDS4(w, i) do {				\
+	msg = _mm_add_epi32(w,					\
+		_mm_load_si128((const __m128i *) &sha256_k[i]));	\
+	state1 = _mm_sha256rnds2_epu32(state1, state0, msg);	\
+	msg = _mm_shuffle_epi32(msg, 0x0e);			\
+	state0 = _mm_sha256rnds2_epu32(state0, state1, msg);	\
+} while (0)
+
+/* Finish w3 from w3 + w2:w1 + sigma0 from sha256msg1 and sigma1 of w0 */
+#define SHA256_MSG(w3, w0, w1)	do {				\
+	w3 = _mm_add_epi32(w3, _mm_alignr_epi8(w0, w1, 4));	\
+	w3 = _mm_sha256msg2_epu32(w3, w0);			\
+} while (0)
+
+SHA_TARGET
+void sha256_intel(uint32_t *state, const uint8_t *data, unsigned long blocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+					    0x0405060700010203ULL);
+	__m128i state0, state1, abef_save, cdgh_save, msg, tmp;
+	__m128i w0, w1, w2, w3;
+	int i;
+
+	/* state is laid out as ABEF and CDGH for sha256rnds2 */
+	tmp = _mm_loadu_si128((const __m128i *) &state[0]);
+	state1 = _mm_loadu_si128((const __m128i *) &state[4]);
+	tmp = _mm_shuffle_epi32(tmp, 0xb1);
+	state1 = _mm_shuffle_epi32(state1, 0x1b);
+	state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+	while (blocks--) {
+		abef_save = state0;
+		cdgh_save = state1;
+
+		w0 = _mm_loadu_si128((const __m128i *) (data + 0));
+		w0 = _mm_shuffle_epi8(w0, mask);
+		w1 = _mm_loadu_si128((const __m128i *) (data + 16));
+		w1 = _mm_shuffle_epi8(w1, mask);
+		w2 = _mm_loadu_si128((const __m128i *) (data + 32));
+		w2 = _mm_shuffle_epi8(w2, mask);
+		w3 = _mm_loadu_si128((const __m128i *) (data + 48));
+		w3 = _mm_shuffle_epi8(w3, mask);
+
+		SHA256_ROUNDS4(w0, 0);
+		SHA256_ROUNDS4(w1, 4);
+		w0 = _mm_sha256msg1_epu32(w0, w1);
+		SHA256_ROUNDS4(w2, 8);
+		w1 = _mm_sha256msg1_epu32(w1, w2);
+
+		/* rounds 12-59, w(n + 4) is finished after rounds on w(n + 3) */
+		for (i = 12; i < 60; i += 16) {
+			SHA256_ROUNDS4(w3, i);
+			SHA256_MSG(w0, w3, w2);
+			w2 = _mm_sha256msg1_epu32(w2, w3);
+			SHA256_ROUNDS4(w0, i + 4);
+			SHA256_MSG(w1, w0, w3);
+			w3 = _mm_sha256msg1_epu32(w3, w0);
+			SHA256_ROUNDS4(w1, i + 8);
+			SHA256_MSG(w2, w1, w0);
+			w0 = _mm_sha256msg1_epu32(w0, w1);
+			SHA256_ROUNDS4(w2, i + 12);
+			SHA256_MSG(w3, w2, w1);
+			w1 = _mm_sha256msg1_epu32(w1, w2);
+		}
+
+		SHA256_ROUNDS4(w3, 60);
+
+		state0 = _mm_add_epi32(state0, abef_save);
+		state1 = _mm_add_epi32(state1, cdgh_save);
+		data += 64;
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1b);
+	state1 = _mm_shuffle_epi32(state1, 0xb1);
+	state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+	state1 = _mm_alignr_epi8(state1, tmp, 8);
+	_mm_storeu_si128((__m128i *) &state[0], state0);
+	_mm_storeu_si128((__m128i *) &state[4], state1);
+}
+
+void sha_intel_probe(void)
+{
+	if (!sha_probed) {
+		unsigned int eax, ebx, ecx = 0, edx;
+
+		/* SSSE3 and SSE4.1 are needed for the shuffles */
+		eax = 1;
+		do_cpuid(&eax, &ebx, &ecx, &edx);
+		if ((ecx & (1 << 9)) && (ecx & (1 << 19))) {
+			eax = 7;
+			ecx = 0;
+			do_cpuid(&eax, &ebx, &ecx, &edx);
+			sha_intel_available = (ebx & (1 << 29)) != 0;
+		}
+		sha_probed = true;
+	}
+}
+
+#endif /* ARCH_HAVE_X86_CRYPTO */
@@ -8,10 +8,29 @@
 #include <arpa/inet.h>
 
 #include "sha1.h"
+#include "sha-accel.h"
 
 /* Hash one 64-byte block of data */
 static void blk_SHA1Block(struct fio_sha1_ctx *ctx, const unsigned int *data);
 
+static void sha1_blocks(struct fio_sha1_ctx *ctx, const void *data,
+			unsigned long blocks)
+{
+	if (sha_intel_available) {
+		sha1_intel(ctx->H, data, blocks);
+		return;
+	}
+	if (sha_arm64_available) {
+		sha1_arm64(ctx->H, data, blocks);
+		return;
+	}
+
+	while (blocks--) {
+		blk_SHA1Block(ctx, data);
+		data += 64;
+	}
+}
+
 void fio_sha1_init(struct fio_sha1_ctx *ctx)
 {
 	ctx->size = 0;
@@ -44,12 +63,14 @@ void fio_sha1_update(struct fio_sha1_ctx *ctx, const void *data,
 		data += left;
 		if (lenW)
 			return;
-		blk_SHA1Block(ctx, ctx->W);
+		sha1_blocks(ctx, ctx->W, 1);
 	}
-	while (len >= 64) {
-		blk_SHA1Block(ctx, data);
-		data += 64;
-		len -= 64;
+	if (len >= 64) {
+		unsigned long blocks = len / 64;
+
+		sha1_blocks(ctx, data, blocks);
+		data += blocks * 64;
+		len -= blocks * 64;
 	}
 	if (len)
 		memcpy(ctx->W, data, len);
@@ -20,6 +20,7 @@
 
 #include "../lib/bswap.h"
 #include "sha256.h"
+#include "sha-accel.h"
 
 #define SHA256_DIGEST_SIZE	32
 #define SHA256_HMAC_BLOCK_SIZE	64
@@ -226,6 +227,24 @@ static void sha256_transform(uint32_t *state, const uint8_t *input)
 	memset(W, 0, 64 * sizeof(uint32_t));
 }
 
+static void sha256_blocks(uint32_t *state, const uint8_t *data,
+			  unsigned int blocks)
+{
+	if (sha_intel_available) {
+		sha256_intel(state, data, blocks);
+		return;
+	}
+	if (sha_arm64_available) {
+		sha256_arm64(state, data, blocks);
+		return;
+	}
+
+	while (blocks--) {
+		sha256_transform(state, data);
+		data += 64;
+	}
+}
+
 void fio_sha256_init(struct fio_sha256_ctx *sctx)
 {
 	sctx->state[0] = H0;
@@ -242,30 +261,28 @@ void fio_sha256_init(struct fio_sha256_ctx *sctx)
 void fio_sha256_update(struct fio_sha256_ctx *sctx, const uint8_t *data,
 		       unsigned int len)
 {
-	unsigned int partial, done;
-	const uint8_t *src;
+	unsigned int partial, done, blocks;
 
 	partial = sctx->count & 0x3f;
 	sctx->count += len;
 	done = 0;
-	src = data;
 
 	if ((partial + len) > 63) {
 		if (partial) {
-			done = -partial;
-			memcpy(sctx->buf + partial, data, done + 64);
-			src = sctx->buf;
+			done = 64 - partial;
+			memcpy(sctx->buf + partial, data, done);
+			sha256_blocks(sctx->state, sctx->buf, 1);
 		}
 
-		do {
-			sha256_transform(sctx->state, src);
-			done += 64;
-			src = data + done;
-		} while (done + 63 < len);
+		blocks = (len - done) / 64;
+		if (blocks) {
+			sha256_blocks(sctx->state, data + done, blocks);
+			done += blocks * 64;
+		}
 
 		partial = 0;
 	}
-	memcpy(sctx->buf + partial, src, len - done);
+	memcpy(sctx->buf + partial, data + done, len - done);
 }
 
 void fio_sha256_final(struct fio_sha256_ctx *sctx)
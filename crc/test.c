@@ -16,23 +16,37 @@
 #include "../crc/crc7.h"
 #include "../crc/sha1.h"
 #include "../crc/sha256.h"
+#include "../crc/sha-accel.h"
 #include "../crc/sha512.h"
 #include "../crc/sha3.h"
 #include "../crc/xxhash.h"
 #include "../crc/murmur3.h"
 #include "../crc/fnv.h"
 #include "../hash.h"
+#include "../bench.h"
 
 #include "test.h"
 
 #define CHUNK		131072U
 #define NR_CHUNKS	  2048U
 
+/*
+ * An accelerated kernel the hash dispatches to at runtime if 'available'
+ * is set. The bench runs each of them and the generic code.
+ */
+struct test_kernel {
+	const char *name;
+	bool *available;
+};
+
+#define NR_KERNELS	2
+
 struct test_type {
 	const char *name;
 	unsigned int mask;
 	void (*fn)(struct test_type *, void *, size_t);
 	uint32_t output;
+	struct test_kernel kernels[NR_KERNELS];
 };
 
 enum {
@@ -247,11 +261,17 @@ static struct test_type t[] = {
 		.name = "md5",
 		.mask = T_MD5,
 		.fn = t_md5,
+		.kernels = {
+			{ "avx2", &md5_intel_available },
+		},
 	},
 	{
 		.name = "crc64",
 		.mask = T_CRC64,
 		.fn = t_crc64,
+		.kernels = {
+			{ "pclmul", &crc64_intel_available },
+		},
 	},
 	{
 		.name = "crc32",
@@ -262,6 +282,10 @@ static struct test_type t[] = {
 		.name = "crc32c",
 		.mask = T_CRC32C,
 		.fn = t_crc32c,
+		.kernels = {
+			{ "arm64", &crc32c_arm64_available },
+			{ "sse4.2", &crc32c_intel_available },
+		},
 	},
 	{
 		.name = "crc16",
@@ -277,11 +301,19 @@ static struct test_type t[] = {
 		.name = "sha1",
 		.mask = T_SHA1,
 		.fn = t_sha1,
+		.kernels = {
+			{ "arm64", &sha_arm64_available },
+			{ "shani", &sha_intel_available },
+		},
 	},
 	{
 		.name = "sha256",
 		.mask = T_SHA256,
 		.fn = t_sha256,
+		.kernels = {
+			{ "arm64", &sha_arm64_available },
+			{ "shani", &sha_intel_available },
+		},
 	},
 	{
 		.name = "sha512",
@@ -365,7 +397,71 @@ static int list_types(void)
 	return 1;
 }
 
-int fio_crctest(const char *type)
+static uint64_t time_test(struct test_type *t, void *buf)
+{
+	struct timespec ts;
+
+	fio_gettime(&ts, NULL);
+	t->fn(t, buf, CHUNK);
+	return ntime_since_now(&ts);
+}
+
+/*
+ * Time the generic code and every available kernel of a hash, then put
+ * the probed state back.
+ */
+static void bench_kernels(struct test_type *t, void *buf,
+			  struct bench_ops *ops)
+{
+	struct bench_result res = {
+		.group	= "crc",
+		.name	= t->name,
+		.size	= CHUNK,
+		.ops	= NR_CHUNKS,
+	};
+	struct bench_dispatch d = {
+		.group	= "crc",
+		.name	= t->name,
+		.selected = "generic",
+	};
+	bool saved[NR_KERNELS];
+	uint64_t best = -1ULL;
+	int i, k;
+
+	for (i = 0; i < NR_KERNELS && t->kernels[i].name; i++) {
+		saved[i] = *t->kernels[i].available;
+		*t->kernels[i].available = false;
+		if (saved[i] && !strcmp(d.selected, "generic"))
+			d.selected = t->kernels[i].name;
+	}
+
+	for (k = -1; k < i; k++) {
+		if (k >= 0) {
+			if (!saved[k])
+				continue;
+			*t->kernels[k].available = true;
+		}
+
+		res.kernel = k >= 0 ? t->kernels[k].name : "generic";
+		res.nsec = time_test(t, buf);
+		ops->result(ops, &res);
+		if (res.nsec < best) {
+			best = res.nsec;
+			d.fastest = res.kernel;
+		}
+
+		if (k >= 0)
+			*t->kernels[k].available = false;
+	}
+
+	while (i--)
+		*t->kernels[i].available = saved[i];
+
+	if (ops->dispatch)
+		ops->dispatch(ops, &d);
+}
+
+static int crctest(const char *type, struct bench_ops *ops)
 {
 	unsigned int test_mask = 0;
 	uint64_t mb = CHUNK * NR_CHUNKS;
@@ -375,6 +471,10 @@ int fio_crctest(const char *type)
 
 	crc32c_arm64_probe();
 	crc32c_intel_probe();
+	crc64_intel_probe();
+	md5_intel_probe();
+	sha_arm64_probe();
+	sha_intel_probe();
 
 	if (!type)
 		test_mask = ~0U;
@@ -390,10 +490,9 @@ int fio_crctest(const char *type)
 
 	buf = malloc(CHUNK);
 	init_rand_seed(&state, 0x8989, 0);
-	fill_random_buf(&state, buf, CHUNK);
+	fill_random_buf(&state, buf, CHUNK, FIO_BUF_GEN_XORSHIFT);
 
 	for (i = 0; t[i].name; i++) {
-		struct timespec ts;
 		double mb_sec;
 		uint64_t usec;
 		char pre[3];
@@ -409,10 +508,26 @@ int fio_crctest(const char *type)
 			usec_spin(100000);
 			t[i].fn(&t[i], buf, CHUNK);
 		}
+		first = 0;
+
+		if (ops) {
+			if (t[i].kernels[0].name)
+				bench_kernels(&t[i], buf, ops);
+			else {
+				struct bench_result res = {
+					.group	= "crc",
+					.name	= t[i].name,
+					.size	= CHUNK,
+					.ops	= NR_CHUNKS,
+					.nsec	= time_test(&t[i], buf),
+				};
+
+				ops->result(ops, &res);
+			}
+			continue;
+		}
 
-		fio_gettime(&ts, NULL);
-		t[i].fn(&t[i], buf, CHUNK);
-		usec = utime_since_now(&ts);
+		usec = time_test(&t[i], buf) / 1000;
 
 		if (usec) {
 			mb_sec = (double) mb / (double) usec;
@@ -424,9 +539,18 @@ int fio_crctest(const char *type)
 			printf("%s:%s%8.2f MiB/sec\n", t[i].name, pre, mb_sec);
 		} else
 			printf("%s:inf MiB/sec\n", t[i].name);
-		first = 0;
 	}
 
 	free(buf);
 	return 0;
 }
+
+int fio_crctest(const char *type)
+{
+	return crctest(type, NULL);
+}
+
+int fio_crc_bench(const char *type, struct bench_ops *ops)
+{
+	return crctest(type, ops);
+}
@@ -1,6 +1,9 @@
 #ifndef FIO_CRC_TEST_H
 #define FIO_CRC_TEST_H
 
+struct bench_ops;
+
 int fio_crctest(const char *type);
+int fio_crc_bench(const char *type, struct bench_ops *ops);
 
 #endif
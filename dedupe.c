@@ -25,7 +25,7 @@ int init_dedupe_working_set_seeds(struct thread_data *td, bool global_dedup)
 	unsigned long long i, j, num_seed_advancements, pages_per_seed;
 	struct frand_state dedupe_working_set_state = {0};
 
-	if (!td->o.dedupe_percentage || !(td->o.dedupe_mode == DEDUPE_MODE_WORKING_SET))
+	if (!td->o.dedupe_percentage || !dedupe_uses_working_set(&td->o))
 		return 0;
 
 	tindex = td->thread_number - 1;
@@ -69,3 +69,60 @@ int init_dedupe_working_set_seeds(struct thread_data *td, bool global_dedup)
 
 	return 0;
 }
+
+#define DEDUPE_SECTOR	512
+
+/*
+ * Shift the contents of a working set buffer by a random number of
+ * sectors and fill the gap at the start with unique data. Dedupe that
+ * chunks on content rather than on block boundaries still finds the
+ * shifted part.
+ */
+static void dedupe_shift_buffer(struct thread_data *td, char *buf,
+				unsigned long long len)
+{
+	unsigned long long shift;
+
+	if (len < 2 * DEDUPE_SECTOR)
+		return;
+
+	shift = rand_between(&td->dedupe_patch_state, 1,
+				len / DEDUPE_SECTOR - 1) * DEDUPE_SECTOR;
+	memmove(buf + shift, buf, len - shift);
+	fill_random_buf(&td->dedupe_patch_state, buf, shift,
+			td->o.buffer_generator);
+}
+
+/*
+ * Flip dedupe_similar_bits random bits of a working set buffer, so it
+ * is close to but not a duplicate of the original.
+ */
+static void dedupe_similar_buffer(struct thread_data *td, char *buf,
+				  unsigned long long len)
+{
+	unsigned long long bit;
+	unsigned int i;
+
+	for (i = 0; i < td->o.dedupe_similar_bits; i++) {
+		bit = rand_between(&td->dedupe_patch_state, 0, len * 8 - 1);
+		buf[bit / 8] ^= 1 << (bit & 7);
+	}
+}
+
+/*
+ * Called on a buffer that was just generated from the dedupe working set
+ */
+void dedupe_patch_buffer(struct thread_data *td, void *buf,
+			 unsigned long long len)
+{
+	switch (td->o.dedupe_mode) {
+	case DEDUPE_MODE_SHIFTED:
+		dedupe_shift_buffer(td, buf, len);
+		break;
+	case DEDUPE_MODE_SIMILAR:
+		dedupe_similar_buffer(td, buf, len);
+		break;
+	default:
+		break;
+	}
+}
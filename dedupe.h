@@ -3,5 +3,17 @@
 
 int init_dedupe_working_set_seeds(struct thread_data *td, bool global_dedupe);
 int init_global_dedupe_working_set_seeds(void);
+void dedupe_patch_buffer(struct thread_data *td, void *buf,
+			 unsigned long long len);
+
+/*
+ * The shifted and similar modes patch buffers picked from the working set
+ */
+static inline bool dedupe_uses_working_set(struct thread_options *o)
+{
+	return o->dedupe_mode == DEDUPE_MODE_WORKING_SET ||
+		o->dedupe_mode == DEDUPE_MODE_SHIFTED ||
+		o->dedupe_mode == DEDUPE_MODE_SIMILAR;
+}
 
 #endif
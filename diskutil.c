@@ -4,7 +4,9 @@
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <libgen.h>
+#include <unistd.h>
 #ifdef CONFIG_VALGRIND_DEV
 #include <valgrind/drd.h>
 #else
@@ -21,6 +23,17 @@ static struct disk_util *last_du;
 
 static struct fio_sem *disk_util_sem;
 
+/*
+ * /proc/diskstats has the stats of all disks, so one read per tick
+ * replaces opening and reading the sysfs stat file of every disk.
+ */
+#define DISKSTATS_PATH	"/proc/diskstats"
+static int diskstats_fd = -1;
+static bool diskstats_failed;
+static char *diskstats_buf;
+static size_t diskstats_buf_len;
+static unsigned int diskstats_gen;
+
 static struct disk_util *__init_per_file_disk_util(struct thread_data *td,
 		int majdev, int mindev, char *path);
 
@@ -37,35 +50,24 @@ static void disk_util_free(struct disk_util *du)
 		slave->users--;
 	}
 
+	if (du->stat_fd >= 0)
+		close(du->stat_fd);
 	fio_sem_remove(du->lock);
 	free(du->sysfs_root);
 	sfree(du);
 }
 
-static int get_io_ticks(struct disk_util *du, struct disk_util_stat *dus)
+/*
+ * Parse the stat fields shared by the sysfs stat files and the lines of
+ * /proc/diskstats, the latter after the major, minor and name columns.
+ */
+static int parse_io_ticks(const char *p, struct disk_util_stat *dus)
 {
 	unsigned in_flight;
 	unsigned long long sectors[2];
-	char line[256];
-	FILE *f;
-	char *p;
 	int ret;
 
-	dprint(FD_DISKUTIL, "open stat file: %s\n", du->path);
-
-	f = fopen(du->path, "r");
-	if (!f)
-		return 1;
-
-	p = fgets(line, sizeof(line), f);
-	if (!p) {
-		fclose(f);
-		return 1;
-	}
-
-	dprint(FD_DISKUTIL, "%s: %s", du->path, p);
-
-	ret = sscanf(p, "%llu %llu %llu %llu %llu %llu %llu %llu %u %llu %llu\n",
+	ret = sscanf(p, "%llu %llu %llu %llu %llu %llu %llu %llu %u %llu %llu",
 				(unsigned long long *) &dus->s.ios[0],
 				(unsigned long long *) &dus->s.merges[0],
 				&sectors[0],
@@ -77,41 +79,179 @@ static int get_io_ticks(struct disk_util *du, struct disk_util_stat *dus)
 				&in_flight,
 				(unsigned long long *) &dus->s.io_ticks,
 				(unsigned long long *) &dus->s.time_in_queue);
-	fclose(f);
-	dprint(FD_DISKUTIL, "%s: stat read ok? %d\n", du->path, ret == 1);
 	dus->s.sectors[0] = sectors[0];
 	dus->s.sectors[1] = sectors[1];
 	return ret != 11;
 }
 
-static void update_io_tick_disk(struct disk_util *du)
+/*
+ * Disks may be set up from a job process, but are only updated from the
+ * main one. Only cache the stat file fd in the latter, @cache_fd.
+ */
+static int get_io_ticks(struct disk_util *du, struct disk_util_stat *dus,
+			bool cache_fd)
 {
-	struct disk_util_stat __dus, *dus, *ldus;
-	struct timespec t;
+	char line[256];
+	ssize_t len;
+	int fd, ret;
+
+	fd = cache_fd ? du->stat_fd : -1;
+	if (fd < 0) {
+		dprint(FD_DISKUTIL, "open stat file: %s\n", du->path);
+
+		fd = open(du->path, O_RDONLY);
+		if (fd < 0)
+			return 1;
+		if (cache_fd)
+			du->stat_fd = fd;
+	}
 
-	if (!du->users)
-		return;
-	if (get_io_ticks(du, &__dus))
-		return;
+	len = pread(fd, line, sizeof(line) - 1, 0);
+	if (!cache_fd)
+		close(fd);
+	if (len <= 0)
+		return 1;
+	line[len] = '\0';
+
+	dprint(FD_DISKUTIL, "%s: %s", du->path, line);
+
+	ret = parse_io_ticks(line, dus);
+	dprint(FD_DISKUTIL, "%s: stat read ok? %d\n", du->path, ret == 0);
+	return ret;
+}
+
+static void __update_io_tick_disk(struct disk_util *du,
+				  struct disk_util_stat *new_dus)
+{
+	struct disk_util_stat *dus, *ldus;
+	struct timespec t;
 
 	dus = &du->dus;
 	ldus = &du->last_dus;
 
-	dus->s.sectors[0] += (__dus.s.sectors[0] - ldus->s.sectors[0]);
-	dus->s.sectors[1] += (__dus.s.sectors[1] - ldus->s.sectors[1]);
-	dus->s.ios[0] += (__dus.s.ios[0] - ldus->s.ios[0]);
-	dus->s.ios[1] += (__dus.s.ios[1] - ldus->s.ios[1]);
-	dus->s.merges[0] += (__dus.s.merges[0] - ldus->s.merges[0]);
-	dus->s.merges[1] += (__dus.s.merges[1] - ldus->s.merges[1]);
-	dus->s.ticks[0] += (__dus.s.ticks[0] - ldus->s.ticks[0]);
-	dus->s.ticks[1] += (__dus.s.ticks[1] - ldus->s.ticks[1]);
-	dus->s.io_ticks += (__dus.s.io_ticks - ldus->s.io_ticks);
-	dus->s.time_in_queue += (__dus.s.time_in_queue - ldus->s.time_in_queue);
+	dus->s.sectors[0] += (new_dus->s.sectors[0] - ldus->s.sectors[0]);
+	dus->s.sectors[1] += (new_dus->s.sectors[1] - ldus->s.sectors[1]);
+	dus->s.ios[0] += (new_dus->s.ios[0] - ldus->s.ios[0]);
+	dus->s.ios[1] += (new_dus->s.ios[1] - ldus->s.ios[1]);
+	dus->s.merges[0] += (new_dus->s.merges[0] - ldus->s.merges[0]);
+	dus->s.merges[1] += (new_dus->s.merges[1] - ldus->s.merges[1]);
+	dus->s.ticks[0] += (new_dus->s.ticks[0] - ldus->s.ticks[0]);
+	dus->s.ticks[1] += (new_dus->s.ticks[1] - ldus->s.ticks[1]);
+	dus->s.io_ticks += (new_dus->s.io_ticks - ldus->s.io_ticks);
+	dus->s.time_in_queue += (new_dus->s.time_in_queue - ldus->s.time_in_queue);
 
 	fio_gettime(&t, NULL);
 	dus->s.msec += mtime_since(&du->time, &t);
 	memcpy(&du->time, &t, sizeof(t));
-	memcpy(&ldus->s, &__dus.s, sizeof(__dus.s));
+	memcpy(&ldus->s, &new_dus->s, sizeof(new_dus->s));
+}
+
+static void update_io_tick_disk(struct disk_util *du)
+{
+	struct disk_util_stat dus;
+
+	if (!du->users || du->diskstats_gen == diskstats_gen)
+		return;
+	if (get_io_ticks(du, &dus, true))
+		return;
+
+	__update_io_tick_disk(du, &dus);
+}
+
+/*
+ * Read all of /proc/diskstats into diskstats_buf. Returns false if it
+ * can't be read, in which case the per-disk stat files are used.
+ */
+static bool read_diskstats(void)
+{
+	ssize_t ret;
+
+	if (diskstats_failed)
+		return false;
+
+	if (diskstats_fd < 0) {
+		diskstats_fd = open(DISKSTATS_PATH, O_RDONLY);
+		if (diskstats_fd < 0)
+			goto fail;
+	}
+
+	if (!diskstats_buf) {
+		diskstats_buf_len = 16384;
+		diskstats_buf = malloc(diskstats_buf_len);
+		if (!diskstats_buf)
+			goto fail;
+	}
+
+	/* grow the buffer until the whole file fits in one read */
+	while ((ret = pread(diskstats_fd, diskstats_buf,
+			    diskstats_buf_len - 1, 0)) >=
+	       (ssize_t) diskstats_buf_len - 1) {
+		char *buf;
+
+		buf = realloc(diskstats_buf, diskstats_buf_len * 2);
+		if (!buf)
+			goto fail;
+		diskstats_buf = buf;
+		diskstats_buf_len *= 2;
+	}
+
+	if (ret <= 0)
+		goto fail;
+
+	diskstats_buf[ret] = '\0';
+	return true;
+fail:
+	dprint(FD_DISKUTIL, "can't read %s, using per-disk stat files\n",
+			DISKSTATS_PATH);
+	diskstats_failed = true;
+	return false;
+}
+
+/*
+ * Update all disks found in /proc/diskstats. Only the major and minor
+ * numbers are parsed for lines of disks we don't track.
+ */
+static void update_io_ticks_diskstats(void)
+{
+	struct flist_head *entry;
+	struct disk_util *du;
+	char *p, *end;
+
+	diskstats_gen++;
+
+	for (p = diskstats_buf; *p; p = end) {
+		unsigned long major, minor;
+		char *next;
+
+		end = strchr(p, '\n');
+		if (end)
+			*end++ = '\0';
+		else
+			end = p + strlen(p);
+
+		major = strtoul(p, &next, 10);
+		minor = strtoul(next, &next, 10);
+
+		flist_for_each(entry, &disk_list) {
+			struct disk_util_stat dus;
+			char *name;
+
+			du = flist_entry(entry, struct disk_util, list);
+			if (du->major != major || du->minor != minor ||
+			    !du->users)
+				continue;
+
+			/* skip the device name */
+			name = next + strspn(next, " ");
+			name += strcspn(name, " ");
+			if (parse_io_ticks(name, &dus))
+				break;
+
+			__update_io_tick_disk(du, &dus);
+			du->diskstats_gen = diskstats_gen;
+			break;
+		}
+	}
 }
 
 int update_io_ticks(void)
@@ -125,6 +265,10 @@ int update_io_ticks(void)
 	fio_sem_down(disk_util_sem);
 
 	if (!helper_should_exit()) {
+		if (!flist_empty(&disk_list) && read_diskstats())
+			update_io_ticks_diskstats();
+
+		/* anything not in /proc/diskstats is read from sysfs */
 		flist_for_each(entry, &disk_list) {
 			du = flist_entry(entry, struct disk_util, list);
 			update_io_tick_disk(du);
@@ -314,6 +458,7 @@ static struct disk_util *disk_util_add(struct thread_data *td, int majdev,
 	du->sysfs_root = strdup(path);
 	du->major = majdev;
 	du->minor = mindev;
+	du->stat_fd = -1;
 	INIT_FLIST_HEAD(&du->slavelist);
 	INIT_FLIST_HEAD(&du->slaves);
 	du->lock = fio_sem_init(FIO_SEM_UNLOCKED);
@@ -336,7 +481,7 @@ static struct disk_util *disk_util_add(struct thread_data *td, int majdev,
 	dprint(FD_DISKUTIL, "add %s to list\n", du->dus.name);
 
 	fio_gettime(&du->time, NULL);
-	get_io_ticks(du, &du->last_dus);
+	get_io_ticks(du, &du->last_dus, false);
 
 	flist_add_tail(&du->list, &disk_list);
 	fio_sem_up(disk_util_sem);
@@ -507,6 +652,15 @@ void disk_util_prune_entries(void)
 	}
 
 	last_majdev = last_mindev = -1;
+
+	if (diskstats_fd >= 0) {
+		close(diskstats_fd);
+		diskstats_fd = -1;
+	}
+	free(diskstats_buf);
+	diskstats_buf = NULL;
+	diskstats_buf_len = 0;
+
 	fio_sem_up(disk_util_sem);
 	fio_sem_remove(disk_util_sem);
 }
@@ -69,6 +69,12 @@ struct disk_util {
 
 	struct fio_sem *lock;
 	unsigned long users;
+
+	/* cached fd of the stat file, valid in the main process only */
+	int stat_fd;
+
+	/* diskstats pass that last updated this disk */
+	unsigned int diskstats_gen;
 };
 
 static inline void disk_util_mod(struct disk_util *du, int val)
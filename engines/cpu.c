@@ -8,9 +8,20 @@
 #include "../fio.h"
 #include "../optgroup.h"
 
+#ifdef ARCH_HAVE_AVX512
+#include <immintrin.h>
+#endif
+
 // number of 32 bit integers to sort
 size_t qsort_size = (256 * (1ULL << 10)); // 256KB
 
+// bytes copied per membw step, cache lines touched per cachethrash step
+#define CPU_MEMBW_CHUNK		(1U << 20)
+#define CPU_CACHE_TOUCHES	4096
+#define CPU_CACHE_LINE		64
+#define CPU_SYSCALL_BATCH	64
+#define CPU_AVX512_ITERS	1024
+
 struct mwc {
 	uint32_t w;
 	uint32_t z;
@@ -19,6 +30,19 @@ struct mwc {
 enum stress_mode {
 	FIO_CPU_NOOP = 0,
 	FIO_CPU_QSORT = 1,
+	FIO_CPU_MEMBW = 2,
+	FIO_CPU_CACHE = 3,
+	FIO_CPU_AVX512 = 4,
+	FIO_CPU_SYSCALL = 5,
+};
+
+static const char *stress_mode_names[] = {
+	[FIO_CPU_NOOP]		= "noop",
+	[FIO_CPU_QSORT]		= "qsort",
+	[FIO_CPU_MEMBW]		= "membw",
+	[FIO_CPU_CACHE]		= "cachethrash",
+	[FIO_CPU_AVX512]	= "avx512",
+	[FIO_CPU_SYSCALL]	= "syscall",
 };
 
 struct cpu_options {
@@ -27,7 +51,16 @@ struct cpu_options {
 	unsigned int cpucycle;
 	enum stress_mode cpumode;
 	unsigned int exit_io_done;
+	unsigned long long buf_size;
 	int32_t *qsort_data;
+
+	/* state of the membw/cachethrash/avx512/syscall kernels */
+	char *buf;
+	size_t buf_pos;
+	struct mwc mwc;
+	uint64_t work;
+	uint64_t work_usec;
+	double sink;
 };
 
 static struct fio_option options[] = {
@@ -56,6 +89,22 @@ static struct fio_option options[] = {
 			    .oval = FIO_CPU_QSORT,
 			    .help = "QSORT computation",
 			  },
+			  { .ival = "membw",
+			    .oval = FIO_CPU_MEMBW,
+			    .help = "Stream copies through a large buffer",
+			  },
+			  { .ival = "cachethrash",
+			    .oval = FIO_CPU_CACHE,
+			    .help = "Random cache line updates in a large buffer",
+			  },
+			  { .ival = "avx512",
+			    .oval = FIO_CPU_AVX512,
+			    .help = "AVX-512 floating point FMA loop",
+			  },
+			  { .ival = "syscall",
+			    .oval = FIO_CPU_SYSCALL,
+			    .help = "Tight loop of cheap system calls",
+			  },
 		},
 		.category = FIO_OPT_C_ENGINE,
 		.group    = FIO_OPT_G_INVALID,
@@ -72,6 +121,17 @@ static struct fio_option options[] = {
 		.category = FIO_OPT_C_ENGINE,
 		.group	= FIO_OPT_G_INVALID,
 	},
+	{
+		.name	= "cpu_buf_size",
+		.lname	= "CPU stress buffer size",
+		.type	= FIO_OPT_STR_VAL,
+		.off1	= offsetof(struct cpu_options, buf_size),
+		.help	= "Buffer size for the membw and cachethrash modes",
+		.def	= "64m",
+		.minval	= 2 * CPU_MEMBW_CHUNK,
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_INVALID,
+	},
 	{
 		.name	= "exit_on_io_done",
 		.lname	= "Exit when IO threads are done",
@@ -173,6 +233,96 @@ static int do_qsort(struct thread_data *td)
 	return 0;
 }
 
+/*
+ * Copy one chunk from the lower to the upper half of the buffer, walking
+ * through it so that the working set is the whole buffer.
+ */
+static void membw_step(struct cpu_options *co)
+{
+	size_t half = co->buf_size / 2;
+
+	if (co->buf_pos + CPU_MEMBW_CHUNK > half)
+		co->buf_pos = 0;
+
+	memcpy(co->buf + half + co->buf_pos, co->buf + co->buf_pos,
+		CPU_MEMBW_CHUNK);
+	co->buf_pos += CPU_MEMBW_CHUNK;
+	co->work += 2 * CPU_MEMBW_CHUNK;
+}
+
+/*
+ * Read-modify-write of random cache lines, defeating both the caches and
+ * the hardware prefetchers.
+ */
+static void cache_step(struct cpu_options *co)
+{
+	uint32_t lines = co->buf_size / CPU_CACHE_LINE;
+	int i;
+
+	for (i = 0; i < CPU_CACHE_TOUCHES; i++)
+		co->buf[(mwc32(&co->mwc) % lines) * CPU_CACHE_LINE]++;
+
+	co->work += CPU_CACHE_TOUCHES;
+}
+
+static void syscall_step(struct cpu_options *co)
+{
+	int i;
+
+	for (i = 0; i < CPU_SYSCALL_BATCH; i++)
+		co->sink += getppid();
+
+	co->work += CPU_SYSCALL_BATCH;
+}
+
+#ifdef ARCH_HAVE_AVX512
+/*
+ * Dependent chains of 512-bit FMAs, enough to move the core to its
+ * AVX-512 frequency license for as long as the chunk runs.
+ */
+__attribute__((target("avx512f")))
+static void avx512_step(struct cpu_options *co)
+{
+	__m512d acc[8], mul = _mm512_set1_pd(0.999999), add = _mm512_set1_pd(1e-6);
+	double out[8];
+	int i, j;
+
+	for (i = 0; i < 8; i++)
+		acc[i] = _mm512_set1_pd(i + 1.0);
+
+	for (i = 0; i < CPU_AVX512_ITERS; i++)
+		for (j = 0; j < 8; j++)
+			acc[j] = _mm512_fmadd_pd(acc[j], mul, add);
+
+	for (i = 1; i < 8; i++)
+		acc[0] = _mm512_add_pd(acc[0], acc[i]);
+	_mm512_storeu_pd(out, acc[0]);
+	co->sink += out[0];
+	co->work += CPU_AVX512_ITERS * 8 * 8;
+}
+#endif
+
+/*
+ * Run a kernel for one cpuchunks period. Like the noop mode this spins for
+ * the whole chunk, and thinktime provides the idle part of cpuload.
+ */
+static void do_burn(struct thread_data *td,
+		    void (*step)(struct cpu_options *))
+{
+	struct cpu_options *co = td->eo;
+	struct timespec start, now;
+	uint64_t usec;
+
+	fio_get_mono_time(&start);
+	do {
+		step(co);
+		fio_get_mono_time(&now);
+		usec = utime_since(&start, &now);
+	} while (usec < co->cpucycle);
+
+	co->work_usec += usec;
+}
+
 static enum fio_q_status fio_cpuio_queue(struct thread_data *td,
 					 struct io_u fio_unused *io_u)
 {
@@ -190,6 +340,20 @@ static enum fio_q_status fio_cpuio_queue(struct thread_data *td,
 	case FIO_CPU_QSORT:
 		do_qsort(td);
 		break;
+	case FIO_CPU_MEMBW:
+		do_burn(td, membw_step);
+		break;
+	case FIO_CPU_CACHE:
+		do_burn(td, cache_step);
+		break;
+	case FIO_CPU_AVX512:
+#ifdef ARCH_HAVE_AVX512
+		do_burn(td, avx512_step);
+#endif
+		break;
+	case FIO_CPU_SYSCALL:
+		do_burn(td, syscall_step);
+		break;
 	}
 
 	return FIO_Q_COMPLETED;
@@ -240,6 +404,67 @@ static int qsort_init(struct thread_data *td)
 	return 0;
 }
 
+static bool cpu_has_avx512(void)
+{
+#ifdef ARCH_HAVE_AVX512
+	return arch_x86_has_avx512f();
+#else
+	return false;
+#endif
+}
+
+static int burn_init(struct thread_data *td)
+{
+	struct cpu_options *co = td->eo;
+
+	co->mwc.w = 521288629UL;
+	co->mwc.z = 362436069UL;
+
+	if (co->cpumode == FIO_CPU_AVX512 && !cpu_has_avx512()) {
+		td_vmsg(td, EINVAL, "CPU doesn't support AVX-512", "cpuio");
+		return 1;
+	}
+
+	if (co->cpumode == FIO_CPU_MEMBW || co->cpumode == FIO_CPU_CACHE) {
+		co->buf = malloc(co->buf_size);
+		if (!co->buf) {
+			td_verror(td, ENOMEM, "burn_init");
+			return 1;
+		}
+		/* fault the buffer in now, not while measuring */
+		memset(co->buf, 0x5a, co->buf_size);
+	}
+
+	log_info("%s (%s): ioengine=%s, cpuload=%u, cpucycle=%u\n",
+		td->o.name, stress_mode_names[co->cpumode], td->io_ops->name,
+		co->cpuload, co->cpucycle);
+	return 0;
+}
+
+static void burn_cleanup(struct thread_data *td)
+{
+	struct cpu_options *co = td->eo;
+	double rate;
+
+	free(co->buf);
+	co->buf = NULL;
+
+	if (!co->work_usec)
+		return;
+
+	/*
+	 * Report what the kernel achieved while burning, so co-located load
+	 * can be compared across runs and hosts.
+	 */
+	rate = (double) co->work * 1000000.0 / co->work_usec;
+	if (co->cpumode == FIO_CPU_MEMBW)
+		log_info("%s (membw): %.1f MiB/s copied while busy\n",
+			td->o.name, rate / (1024 * 1024));
+	else
+		log_info("%s (%s): %.0f ops/s while busy\n", td->o.name,
+			stress_mode_names[co->cpumode], rate);
+}
+
 static int fio_cpuio_init(struct thread_data *td)
 {
 	struct thread_options *o = &td->o;
@@ -282,6 +507,15 @@ static int fio_cpuio_init(struct thread_data *td)
 	case FIO_CPU_QSORT:
 		qsort_init(td);
 		break;
+	case FIO_CPU_MEMBW:
+	case FIO_CPU_CACHE:
+	case FIO_CPU_AVX512:
+	case FIO_CPU_SYSCALL:
+		if (burn_init(td)) {
+			td_set_runstate(td, td_previous_state);
+			return 1;
+		}
+		break;
 	default:
 		if (asprintf(&msg, "bad cpu engine mode: %d", co->cpumode) < 0)
 			msg = NULL;
@@ -305,6 +539,9 @@ static void fio_cpuio_cleanup(struct thread_data *td)
 	case FIO_CPU_QSORT:
 		qsort_cleanup(td);
 		break;
+	default:
+		burn_cleanup(td);
+		break;
 	}
 }
 
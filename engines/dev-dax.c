@@ -36,6 +36,11 @@
  *
  *     bs should adhere to the device dax alignment at minimally.
  *
+ *     copy_kernel selects what writes are done with, libpmem's
+ *     pmem_memcpy_persist() or one of fio's own movnt, avx512nt or clwb
+ *     kernels. With iodepth > 1, writes are copied as they are queued and
+ *     made durable with a single drain per submitted batch.
+ *
  * libpmem.so
  *   By default, the dev-dax engine will let the system find the libpmem.so
  *   that it uses. You can use an alternative libpmem by setting the
@@ -56,6 +61,8 @@
 
 #include "../fio.h"
 #include "../verify.h"
+#include "../optgroup.h"
+#include "../lib/pmem_copy.h"
 
 /*
  * Limits us to 1GiB of mapped files in total to model after
@@ -63,12 +70,60 @@
  */
 #define MMAP_TOTAL_SZ	(1 * 1024 * 1024 * 1024UL)
 
+#define DEVDAX_COPY_LIBPMEM	0
+
 struct fio_devdax_data {
 	void *devdax_ptr;
 	size_t devdax_sz;
 	off_t devdax_off;
 };
 
+/* iodepth > 1: io_us copied but not yet drained, see fio_devdax_commit() */
+struct fio_devdax_batch {
+	struct io_u **io_us;
+	int queued;
+	int events;
+};
+
+struct fio_devdax_options {
+	void *pad;
+	unsigned int copy_kernel;
+};
+
+static struct fio_option options[] = {
+	{
+		.name	= "copy_kernel",
+		.lname	= "Copy kernel",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct fio_devdax_options, copy_kernel),
+		.help	= "How writes are copied to the DAX device",
+		.def	= "libpmem",
+		.posval = {
+			  { .ival = "libpmem",
+			    .oval = DEVDAX_COPY_LIBPMEM,
+			    .help = "libpmem pmem_memcpy_persist()",
+			  },
+			  { .ival = "movnt",
+			    .oval = PMEM_COPY_MOVNT,
+			    .help = "SSE2 non-temporal stores",
+			  },
+			  { .ival = "avx512nt",
+			    .oval = PMEM_COPY_AVX512NT,
+			    .help = "AVX-512 non-temporal stores",
+			  },
+			  { .ival = "clwb",
+			    .oval = PMEM_COPY_CLWB,
+			    .help = "Regular stores followed by clwb",
+			  },
+		},
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_MMAP,
+	},
+	{
+		.name	= NULL,
+	},
+};
+
 static int fio_devdax_file(struct thread_data *td, struct fio_file *f,
 			   size_t length, off_t off)
 {
@@ -182,19 +237,44 @@ done:
 	return 0;
 }
 
+static void fio_devdax_drain(struct thread_data *td)
+{
+	struct fio_devdax_options *eo = td->eo;
+
+	if (eo->copy_kernel == DEVDAX_COPY_LIBPMEM)
+		pmem_drain();
+	else
+		pmem_copy_drain();
+}
+
 static enum fio_q_status fio_devdax_queue(struct thread_data *td,
 					  struct io_u *io_u)
 {
+	struct fio_devdax_options *eo = td->eo;
+	struct fio_devdax_batch *db = td->io_ops_data;
+
 	fio_ro_check(td, io_u);
 	io_u->error = 0;
 
+	if (db && db->events)
+		return FIO_Q_BUSY;
+
 	switch (io_u->ddir) {
 	case DDIR_READ:
 		memcpy(io_u->xfer_buf, io_u->mmap_data, io_u->xfer_buflen);
 		break;
 	case DDIR_WRITE:
-		pmem_memcpy_persist(io_u->mmap_data, io_u->xfer_buf,
-				    io_u->xfer_buflen);
+		if (eo->copy_kernel != DEVDAX_COPY_LIBPMEM) {
+			pmem_copy_nodrain(eo->copy_kernel, io_u->mmap_data,
+					  io_u->xfer_buf, io_u->xfer_buflen);
+			if (!db)
+				pmem_copy_drain();
+		} else if (db)
+			pmem_memcpy_nodrain(io_u->mmap_data, io_u->xfer_buf,
+					    io_u->xfer_buflen);
+		else
+			pmem_memcpy_persist(io_u->mmap_data, io_u->xfer_buf,
+					    io_u->xfer_buflen);
 		break;
 	case DDIR_SYNC:
 	case DDIR_DATASYNC:
@@ -205,12 +285,63 @@ static enum fio_q_status fio_devdax_queue(struct thread_data *td,
 		break;
 	}
 
+	if (db && !io_u->error) {
+		db->io_us[db->queued++] = io_u;
+		return FIO_Q_QUEUED;
+	}
+
+	/* td_io_queue() leaves this to engines that have a ->commit hook */
+	io_u_mark_submit(td, 1);
+	io_u_mark_complete(td, 1);
 	return FIO_Q_COMPLETED;
 }
 
+/*
+ * Everything queued has already been copied; one drain makes the whole
+ * batch durable, instead of one drain per write.
+ */
+static int fio_devdax_commit(struct thread_data *td)
+{
+	struct fio_devdax_batch *db = td->io_ops_data;
+
+	if (!db || db->events || !db->queued)
+		return 0;
+
+	fio_devdax_drain(td);
+
+	io_u_mark_submit(td, db->queued);
+	db->events = db->queued;
+	db->queued = 0;
+	return 0;
+}
+
+static int fio_devdax_getevents(struct thread_data *td, unsigned int min,
+				unsigned int fio_unused max,
+				const struct timespec fio_unused *t)
+{
+	struct fio_devdax_batch *db = td->io_ops_data;
+	int ret = 0;
+
+	if (min) {
+		ret = db->events;
+		db->events = 0;
+	}
+
+	return ret;
+}
+
+static struct io_u *fio_devdax_event(struct thread_data *td, int event)
+{
+	struct fio_devdax_batch *db = td->io_ops_data;
+
+	return db->io_us[event];
+}
+
 static int fio_devdax_init(struct thread_data *td)
 {
 	struct thread_options *o = &td->o;
+	struct fio_devdax_options *eo = td->eo;
+	struct fio_devdax_batch *db;
 
 	if ((o->rw_min_bs & page_mask) &&
 	    (o->fsync_blocks || o->fdatasync_blocks)) {
@@ -219,9 +350,45 @@ static int fio_devdax_init(struct thread_data *td)
 		return 1;
 	}
 
+	if (eo->copy_kernel != DEVDAX_COPY_LIBPMEM) {
+		if (!pmem_copy_supported(eo->copy_kernel)) {
+			log_err("dev-dax: copy_kernel=%s is not supported by "
+				"this CPU\n", pmem_copy_name(eo->copy_kernel));
+			return 1;
+		}
+		log_info("%s: dev-dax writes use the %s copy kernel\n", o->name,
+			 pmem_copy_name(eo->copy_kernel));
+	}
+
+	if (o->iodepth > 1) {
+		db = calloc(1, sizeof(*db));
+		if (!db)
+			return 1;
+		db->io_us = calloc(o->iodepth, sizeof(struct io_u *));
+		if (!db->io_us) {
+			free(db);
+			return 1;
+		}
+		td->io_ops_data = db;
+		td->io_ops->flags &= ~FIO_SYNCIO;
+	} else
+		td->io_ops->flags |= FIO_SYNCIO;
+
+	td_set_ioengine_flags(td);
 	return 0;
 }
 
+static void fio_devdax_cleanup(struct thread_data *td)
+{
+	struct fio_devdax_batch *db = td->io_ops_data;
+
+	if (db) {
+		free(db->io_us);
+		free(db);
+		td->io_ops_data = NULL;
+	}
+}
+
 static int fio_devdax_open_file(struct thread_data *td, struct fio_file *f)
 {
 	struct fio_devdax_data *fdd;
@@ -333,11 +500,17 @@ FIO_STATIC struct ioengine_ops ioengine = {
 	.version	= FIO_IOOPS_VERSION,
 	.init		= fio_devdax_init,
 	.prep		= fio_devdax_prep,
+	.cleanup	= fio_devdax_cleanup,
 	.queue		= fio_devdax_queue,
+	.commit		= fio_devdax_commit,
+	.getevents	= fio_devdax_getevents,
+	.event		= fio_devdax_event,
 	.open_file	= fio_devdax_open_file,
 	.close_file	= fio_devdax_close_file,
 	.get_file_size	= fio_devdax_get_file_size,
 	.flags		= FIO_SYNCIO | FIO_DISKLESSIO | FIO_NOEXTEND | FIO_NODISKUTIL,
+	.options	= options,
+	.option_struct_size = sizeof(struct fio_devdax_options),
 };
 
 static void fio_init fio_devdax_register(void)
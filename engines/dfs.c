@@ -20,15 +20,29 @@ dfs_t			*dfs; /* dfs mount reference */
 
 struct daos_iou {
 	struct io_u	*io_u;
-	daos_event_t	ev;
 	d_sg_list_t	sgl;
 	d_iov_t		iov;
 	daos_size_t	size;
 	bool		complete;
 };
 
+/*
+ * Events are initialized once, one per io_u, and go back to their event
+ * queue when polled, so they are reused rather than set up for every I/O.
+ * io_u i always uses event i, on event queue i % num_eqs.
+ */
+struct daos_ev {
+	daos_event_t	ev;
+	struct io_u	*io_u;
+};
+
 struct daos_data {
-	daos_handle_t	eqh;
+	daos_handle_t	*eqs;
+	int		num_eqs;
+	int		next_eq;	/* event queue to poll first */
+	struct daos_ev	*evs;
+	int		num_evs;	/* initialized events */
+	daos_event_t	**evp;
 	dfs_obj_t	*obj;
 	struct io_u	**io_us;
 	int		queued;
@@ -41,6 +55,7 @@ struct daos_fio_options {
 	char		*cont;   /* Container UUID */
 	daos_size_t	chsz;    /* Chunk size */
 	char		*oclass; /* object class */
+	unsigned int	eq_count; /* event queues per job */
 #if !defined(DAOS_API_VERSION_MAJOR) || DAOS_API_VERSION_MAJOR < 1
 	char		*svcl;   /* service replica list, deprecated */
 #endif
@@ -84,6 +99,17 @@ static struct fio_option options[] = {
 		.category	= FIO_OPT_C_ENGINE,
 		.group		= FIO_OPT_G_DFS,
 	},
+	{
+		.name           = "eq_count",
+		.lname          = "Event queues",
+		.type           = FIO_OPT_INT,
+		.off1           = offsetof(struct daos_fio_options, eq_count),
+		.help           = "Number of DAOS event queues per job",
+		.def		= "1",
+		.minval		= 1,
+		.category	= FIO_OPT_C_ENGINE,
+		.group		= FIO_OPT_G_DFS,
+	},
 #if !defined(DAOS_API_VERSION_MAJOR) || DAOS_API_VERSION_MAJOR < 1
 	{
 		.name           = "svcl",
@@ -237,6 +263,67 @@ static int daos_fio_setup(struct thread_data *td)
 	return 0;
 }
 
+static int daos_fio_free_queues(struct daos_data *dd)
+{
+	int i, rc, ret = 0;
+
+	for (i = 0; i < dd->num_evs; i++)
+		(void)daos_event_fini(&dd->evs[i].ev);
+	dd->num_evs = 0;
+
+	for (i = 0; i < dd->num_eqs; i++) {
+		rc = daos_eq_destroy(dd->eqs[i], DAOS_EQ_DESTROY_FORCE);
+		if (rc < 0) {
+			log_err("failed to destroy event queue: %d\n", rc);
+			if (ret == 0)
+				ret = rc;
+		}
+	}
+	dd->num_eqs = 0;
+
+	return ret;
+}
+
+static int daos_fio_init_queues(struct thread_data *td, struct daos_data *dd)
+{
+	struct daos_fio_options	*eo = td->eo;
+	int			nr = eo->eq_count;
+	int			i, rc;
+
+	/* queues without an event of their own would only be polled */
+	if (nr > dd->num_ios)
+		nr = dd->num_ios;
+
+	dd->eqs = calloc(nr, sizeof(daos_handle_t));
+	dd->evs = calloc(dd->num_ios, sizeof(struct daos_ev));
+	if (dd->eqs == NULL || dd->evs == NULL) {
+		log_err("Failed to allocate event queues\n");
+		return ENOMEM;
+	}
+
+	for (i = 0; i < nr; i++) {
+		rc = daos_eq_create(&dd->eqs[i]);
+		if (rc) {
+			log_err("Failed to create event queue: %d\n", rc);
+			td_verror(td, rc, "daos_eq_create");
+			return rc;
+		}
+		dd->num_eqs++;
+	}
+
+	for (i = 0; i < dd->num_ios; i++) {
+		rc = daos_event_init(&dd->evs[i].ev, dd->eqs[i % nr], NULL);
+		if (rc) {
+			log_err("Event init failed: %d\n", rc);
+			td_verror(td, rc, "daos_event_init");
+			return rc;
+		}
+		dd->num_evs++;
+	}
+
+	return 0;
+}
+
 static int daos_fio_init(struct thread_data *td)
 {
 	struct daos_data	*dd;
@@ -244,7 +331,7 @@ static int daos_fio_init(struct thread_data *td)
 
 	pthread_mutex_lock(&daos_mutex);
 
-	dd = malloc(sizeof(*dd));
+	dd = calloc(1, sizeof(*dd));
 	if (dd == NULL) {
 		log_err("Failed to allocate DAOS-private data\n");
 		rc = ENOMEM;
@@ -254,7 +341,8 @@ static int daos_fio_init(struct thread_data *td)
 	dd->queued	= 0;
 	dd->num_ios	= td->o.iodepth;
 	dd->io_us	= calloc(dd->num_ios, sizeof(struct io_u *));
-	if (dd->io_us == NULL) {
+	dd->evp		= calloc(dd->num_ios, sizeof(daos_event_t *));
+	if (dd->io_us == NULL || dd->evp == NULL) {
 		log_err("Failed to allocate IO queue\n");
 		rc = ENOMEM;
 		goto out;
@@ -268,18 +356,19 @@ static int daos_fio_init(struct thread_data *td)
 		daos_initialized = true;
 	}
 
-	rc = daos_eq_create(&dd->eqh);
-	if (rc) {
-		log_err("Failed to create event queue: %d\n", rc);
-		td_verror(td, rc, "daos_eq_create");
+	rc = daos_fio_init_queues(td, dd);
+	if (rc)
 		goto out;
-	}
 
 	td->io_ops_data = dd;
 	num_threads++;
 out:
 	if (rc) {
 		if (dd) {
+			(void)daos_fio_free_queues(dd);
+			free(dd->eqs);
+			free(dd->evs);
+			free(dd->evp);
 			free(dd->io_us);
 			free(dd);
 		}
@@ -301,12 +390,12 @@ static void daos_fio_cleanup(struct thread_data *td)
 	if (dd == NULL)
 		return;
 
-	rc = daos_eq_destroy(dd->eqh, DAOS_EQ_DESTROY_FORCE);
-	if (rc < 0) {
-		log_err("failed to destroy event queue: %d\n", rc);
+	rc = daos_fio_free_queues(dd);
+	if (rc < 0)
 		td_verror(td, rc, "daos_eq_destroy");
-	}
-
+	free(dd->eqs);
+	free(dd->evs);
+	free(dd->evp);
 	free(dd->io_us);
 	free(dd);
 
@@ -421,27 +510,11 @@ static int daos_fio_invalidate(struct thread_data *td, struct fio_file *f)
 	return 0;
 }
 
-static void daos_fio_io_u_free(struct thread_data *td, struct io_u *io_u)
-{
-	struct daos_iou *io = io_u->engine_data;
-
-	if (io) {
-		io_u->engine_data = NULL;
-		free(io);
-	}
-}
-
 static int daos_fio_io_u_init(struct thread_data *td, struct io_u *io_u)
 {
-	struct daos_iou *io;
+	struct daos_iou *io = io_u->engine_data;
 
-	io = malloc(sizeof(struct daos_iou));
-	if (!io) {
-		td_verror(td, ENOMEM, "malloc");
-		return ENOMEM;
-	}
 	io->io_u = io_u;
-	io_u->engine_data = io;
 	return 0;
 }
 
@@ -456,38 +529,53 @@ static int daos_fio_getevents(struct thread_data *td, unsigned int min,
 			      unsigned int max, const struct timespec *t)
 {
 	struct daos_data	*dd = td->io_ops_data;
-	daos_event_t		*evp[max];
 	unsigned int		events = 0;
-	int			i;
+	int			i, n;
 	int			rc;
 
-	while (events < min) {
-		rc = daos_eq_poll(dd->eqh, 0, DAOS_EQ_NOWAIT, max, evp);
-		if (rc < 0) {
-			log_err("Event poll failed: %d\n", rc);
-			td_verror(td, rc, "daos_eq_poll");
-			return events;
-		}
+	if (max > dd->num_ios)
+		max = dd->num_ios;
 
-		for (i = 0; i < rc; i++) {
-			struct daos_iou	*io;
-			struct io_u	*io_u;
-
-			io = container_of(evp[i], struct daos_iou, ev);
-			if (io->complete)
-				log_err("Completion on already completed I/O\n");
-
-			io_u = io->io_u;
-			if (io->ev.ev_error)
-				io_u->error = io->ev.ev_error;
-			else
-				io_u->resid = 0;
-
-			dd->io_us[events] = io_u;
-			dd->queued--;
-			daos_event_fini(&io->ev);
-			io->complete = true;
-			events++;
+	/*
+	 * Reap as many as there is room for from each queue in turn, starting
+	 * with a different queue every call so none of them is favoured.
+	 */
+	while (events < min) {
+		for (n = 0; n < dd->num_eqs && events < max; n++) {
+			daos_handle_t eqh = dd->eqs[dd->next_eq];
+
+			if (++dd->next_eq == dd->num_eqs)
+				dd->next_eq = 0;
+
+			rc = daos_eq_poll(eqh, 0, DAOS_EQ_NOWAIT, max - events,
+					  dd->evp);
+			if (rc < 0) {
+				log_err("Event poll failed: %d\n", rc);
+				td_verror(td, rc, "daos_eq_poll");
+				return events;
+			}
+
+			for (i = 0; i < rc; i++) {
+				struct daos_ev	*ev;
+				struct daos_iou	*io;
+				struct io_u	*io_u;
+
+				ev = container_of(dd->evp[i], struct daos_ev, ev);
+				io_u = ev->io_u;
+				io = io_u->engine_data;
+				if (io->complete)
+					log_err("Completion on already completed I/O\n");
+
+				if (ev->ev.ev_error)
+					io_u->error = ev->ev.ev_error;
+				else
+					io_u->resid = 0;
+
+				dd->io_us[events] = io_u;
+				dd->queued--;
+				io->complete = true;
+				events++;
+			}
 		}
 	}
 
@@ -496,11 +584,35 @@ static int daos_fio_getevents(struct thread_data *td, unsigned int min,
 	return events;
 }
 
+/*
+ * A failed submission may still have completed the event on its queue.
+ * Set it up again, so it is not polled later and is ready for the next I/O.
+ */
+static enum fio_q_status daos_fio_queue_error(struct thread_data *td,
+					      struct io_u *io_u,
+					      struct daos_ev *ev, int err)
+{
+	struct daos_data	*dd = td->io_ops_data;
+	int			rc;
+
+	io_u->error = err;
+
+	(void)daos_event_fini(&ev->ev);
+	rc = daos_event_init(&ev->ev, dd->eqs[io_u->index % dd->num_eqs], NULL);
+	if (rc) {
+		log_err("Event init failed: %d\n", rc);
+		td_verror(td, rc, "daos_event_init");
+	}
+
+	return FIO_Q_COMPLETED;
+}
+
 static enum fio_q_status daos_fio_queue(struct thread_data *td,
 					struct io_u *io_u)
 {
 	struct daos_data	*dd = td->io_ops_data;
 	struct daos_iou		*io = io_u->engine_data;
+	struct daos_ev		*ev = &dd->evs[io_u->index];
 	daos_off_t		offset = io_u->offset;
 	int			rc;
 
@@ -514,29 +626,22 @@ static enum fio_q_status daos_fio_queue(struct thread_data *td,
 	io->size = io_u->xfer_buflen;
 
 	io->complete = false;
-	rc = daos_event_init(&io->ev, dd->eqh, NULL);
-	if (rc) {
-		log_err("Event init failed: %d\n", rc);
-		io_u->error = rc;
-		return FIO_Q_COMPLETED;
-	}
+	ev->io_u = io_u;
 
 	switch (io_u->ddir) {
 	case DDIR_WRITE:
-		rc = dfs_write(dfs, dd->obj, &io->sgl, offset, &io->ev);
+		rc = dfs_write(dfs, dd->obj, &io->sgl, offset, &ev->ev);
 		if (rc) {
 			log_err("dfs_write failed: %d\n", rc);
-			io_u->error = rc;
-			return FIO_Q_COMPLETED;
+			return daos_fio_queue_error(td, io_u, ev, rc);
 		}
 		break;
 	case DDIR_READ:
 		rc = dfs_read(dfs, dd->obj, &io->sgl, offset, &io->size,
-			      &io->ev);
+			      &ev->ev);
 		if (rc) {
 			log_err("dfs_read failed: %d\n", rc);
-			io_u->error = rc;
-			return FIO_Q_COMPLETED;
+			return daos_fio_queue_error(td, io_u, ev, rc);
 		}
 		break;
 	case DDIR_SYNC:
@@ -578,9 +683,9 @@ FIO_STATIC struct ioengine_ops ioengine = {
 	.getevents		= daos_fio_getevents,
 	.event			= daos_fio_event,
 	.io_u_init		= daos_fio_io_u_init,
-	.io_u_free		= daos_fio_io_u_free,
 
 	.option_struct_size	= sizeof(struct daos_fio_options),
+	.io_u_priv_size		= sizeof(struct daos_iou),
 	.options		= options,
 };
 
@@ -11,10 +11,17 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <dirent.h>
 #include "../fio.h"
 #include "../optgroup.h"
 #include "../oslib/statx.h"
 
+#ifdef FIO_HAVE_IOURING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "../os/linux/io_uring.h"
+#endif
+
 
 struct fc_data {
 	enum fio_ddir stat_ddir;
@@ -302,12 +309,572 @@ static struct ioengine_ops ioengine_filedelete = {
 				FIO_NOSTATS | FIO_NOFILEHASH,
 };
 
+#ifdef FIO_HAVE_IOURING
+/*
+ * fileuring: metadata operations issued as io_uring requests, so a job
+ * keeps iodepth of them in flight instead of doing one syscall at a time.
+ * Every io_u does one operation on its file, the files themselves are
+ * never opened by fio. Latencies are kept per operation as well and
+ * reported when the job ends.
+ */
+enum {
+	FILEURING_CREATE = 0,
+	FILEURING_STAT,
+	FILEURING_DELETE,
+	FILEURING_MKDIR,
+	FILEURING_RMDIR,
+	FILEURING_RENAME,
+	FILEURING_READDIR,
+	FILEURING_NR_OPS,
+	FILEURING_MIXED = FILEURING_NR_OPS,
+};
+
+static const char *fileuring_op_names[FILEURING_NR_OPS] = {
+	"create", "stat", "delete", "mkdir", "rmdir", "rename", "readdir",
+};
+
+/*
+ * The life cycle file_op=mixed takes every file through, one step per io_u
+ */
+static const unsigned int fileuring_mixed[] = {
+	FILEURING_CREATE, FILEURING_STAT, FILEURING_RENAME, FILEURING_STAT,
+	FILEURING_DELETE,
+};
+
+#ifndef STATX_BASIC_STATS
+#define STATX_BASIC_STATS	0x7ffU
+#endif
+
+/*
+ * Per file state in FILE_ENG_DATA(): one operation at a time per file, so
+ * the steps of a file can't overtake each other, whether it currently
+ * goes by its renamed name, and the number of operations done on it.
+ */
+#define FILEURING_F_BUSY	1UL
+#define FILEURING_F_RENAMED	2UL
+#define FILEURING_STEP_SHIFT	8
+
+struct fileuring_options {
+	void *pad;
+	unsigned int op;
+};
+
+struct fileuring_lat {
+	uint64_t plat[FIO_IO_U_PLAT_NR];
+	uint64_t samples;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+};
+
+struct fileuring_data {
+	int ring_fd;
+	struct io_uring_sqe *sqes;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_array;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+	void *ring_ptr[3];
+	size_t ring_len[3];
+	unsigned int queued;
+
+	/* fds returned by creates, closed through the ring on next commit */
+	int *close_fds;
+	unsigned int nr_close;
+
+	struct io_u **events;
+	unsigned int nr_events;
+
+	struct fileuring_lat lat[FILEURING_NR_OPS];
+};
+
+/*
+ * fileuring per io_u state, see ->io_u_priv_size
+ */
+struct fileuring_io_u {
+	struct timespec start;
+	unsigned int op;
+	char path[PATH_MAX];
+	/* room for a struct statx */
+	uint64_t statx_buf[32];
+};
+
+static struct fio_option fileuring_options[] = {
+	{
+		.name	= "file_op",
+		.lname	= "File operation",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct fileuring_options, op),
+		.help	= "Metadata operation each I/O does on its file",
+		.def	= "create",
+		.posval = {
+			  { .ival = "create",
+			    .oval = FILEURING_CREATE,
+			    .help = "Create the file with IORING_OP_OPENAT",
+			  },
+			  { .ival = "stat",
+			    .oval = FILEURING_STAT,
+			    .help = "Stat the file with IORING_OP_STATX",
+			  },
+			  { .ival = "delete",
+			    .oval = FILEURING_DELETE,
+			    .help = "Unlink the file with IORING_OP_UNLINKAT",
+			  },
+			  { .ival = "mkdir",
+			    .oval = FILEURING_MKDIR,
+			    .help = "Create a directory with IORING_OP_MKDIRAT",
+			  },
+			  { .ival = "rmdir",
+			    .oval = FILEURING_RMDIR,
+			    .help = "Remove a directory with IORING_OP_UNLINKAT",
+			  },
+			  { .ival = "rename",
+			    .oval = FILEURING_RENAME,
+			    .help = "Rename the file back and forth with IORING_OP_RENAMEAT",
+			  },
+			  { .ival = "readdir",
+			    .oval = FILEURING_READDIR,
+			    .help = "List the directory, inline as io_uring has no getdents",
+			  },
+			  { .ival = "mixed",
+			    .oval = FILEURING_MIXED,
+			    .help = "Create, stat, rename, stat and delete every file",
+			  },
+		},
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_FILESTAT,
+	},
+	{
+		.name	= NULL,
+	},
+};
+
+static int fileuring_mmap(struct fileuring_data *fd, struct io_uring_params *p)
+{
+	void *ptr;
+
+	fd->ring_len[0] = p->sq_off.array + p->sq_entries * sizeof(__u32);
+	ptr = mmap(NULL, fd->ring_len[0], PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd->ring_fd,
+			IORING_OFF_SQ_RING);
+	if (ptr == MAP_FAILED)
+		return 1;
+	fd->ring_ptr[0] = ptr;
+	fd->sq_head = ptr + p->sq_off.head;
+	fd->sq_tail = ptr + p->sq_off.tail;
+	fd->sq_array = ptr + p->sq_off.array;
+	fd->sq_mask = *(unsigned *) (ptr + p->sq_off.ring_mask);
+	fd->sq_entries = p->sq_entries;
+
+	fd->ring_len[1] = p->sq_entries * sizeof(struct io_uring_sqe);
+	ptr = mmap(NULL, fd->ring_len[1], PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd->ring_fd,
+			IORING_OFF_SQES);
+	if (ptr == MAP_FAILED)
+		return 1;
+	fd->ring_ptr[1] = ptr;
+	fd->sqes = ptr;
+
+	fd->ring_len[2] = p->cq_off.cqes +
+				p->cq_entries * sizeof(struct io_uring_cqe);
+	ptr = mmap(NULL, fd->ring_len[2], PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd->ring_fd,
+			IORING_OFF_CQ_RING);
+	if (ptr == MAP_FAILED)
+		return 1;
+	fd->ring_ptr[2] = ptr;
+	fd->cq_head = ptr + p->cq_off.head;
+	fd->cq_tail = ptr + p->cq_off.tail;
+	fd->cq_mask = *(unsigned *) (ptr + p->cq_off.ring_mask);
+	fd->cqes = ptr + p->cq_off.cqes;
+	return 0;
+}
+
+static void fileuring_show_lat(struct fileuring_lat *lat, const char *name)
+{
+	fio_fp64_t plist[FIO_IO_U_LIST_MAX_LEN] = { { .u.f = 50.0 },
+						   { .u.f = 99.0 },
+						   { .u.f = 99.9 } };
+	unsigned long long *ovals = NULL, minv, maxv;
+	unsigned int len;
+
+	len = calc_clat_percentiles(lat->plat, lat->samples, plist, &ovals,
+					&maxv, &minv);
+	if (len != 3 || !ovals) {
+		free(ovals);
+		return;
+	}
+
+	log_info("fileuring: %s: %llu ops, lat (usec): min=%.1f, avg=%.1f, "
+		 "max=%.1f, p50=%.1f, p99=%.1f, p99.9=%.1f\n", name,
+		 (unsigned long long) lat->samples, lat->min / 1000.0,
+		 (double) lat->sum / lat->samples / 1000.0, lat->max / 1000.0,
+		 ovals[0] / 1000.0, ovals[1] / 1000.0, ovals[2] / 1000.0);
+	free(ovals);
+}
+
+static void fileuring_cleanup(struct thread_data *td)
+{
+	struct fileuring_data *fd = td->io_ops_data;
+	int i;
+
+	if (!fd)
+		return;
+
+	for (i = 0; i < FILEURING_NR_OPS; i++)
+		if (fd->lat[i].samples)
+			fileuring_show_lat(&fd->lat[i], fileuring_op_names[i]);
+
+	while (fd->nr_close)
+		close(fd->close_fds[--fd->nr_close]);
+
+	for (i = 0; i < 3; i++)
+		if (fd->ring_ptr[i])
+			munmap(fd->ring_ptr[i], fd->ring_len[i]);
+	if (fd->ring_fd != -1)
+		close(fd->ring_fd);
+	free(fd->close_fds);
+	free(fd->events);
+	free(fd);
+	td->io_ops_data = NULL;
+}
+
+static int fileuring_init(struct thread_data *td)
+{
+	struct fileuring_data *fd;
+	struct io_uring_params p;
+
+	fd = calloc(1, sizeof(*fd));
+	if (!fd)
+		return 1;
+	fd->ring_fd = -1;
+	td->io_ops_data = fd;
+
+	fd->events = calloc(td->o.iodepth, sizeof(struct io_u *));
+	fd->close_fds = calloc(td->o.iodepth, sizeof(int));
+	if (!fd->events || !fd->close_fds)
+		goto err;
+
+	/* room for a close behind every create */
+	memset(&p, 0, sizeof(p));
+	fd->ring_fd = syscall(__NR_io_uring_setup, 2 * td->o.iodepth, &p);
+	if (fd->ring_fd < 0) {
+		td_verror(td, errno, "io_uring_setup");
+		goto err;
+	}
+	if (fileuring_mmap(fd, &p)) {
+		td_verror(td, errno, "mmap io_uring");
+		goto err;
+	}
+
+	return 0;
+err:
+	fileuring_cleanup(td);
+	return 1;
+}
+
+static unsigned int fileuring_op(struct thread_data *td, unsigned long state)
+{
+	struct fileuring_options *o = td->eo;
+	unsigned long step = state >> FILEURING_STEP_SHIFT;
+
+	if (o->op != FILEURING_MIXED)
+		return o->op;
+
+	return fileuring_mixed[step % FIO_ARRAY_SIZE(fileuring_mixed)];
+}
+
+/*
+ * Account the operation and move its file on to the next step
+ */
+static void fileuring_done(struct thread_data *td, struct io_u *io_u)
+{
+	struct fileuring_data *fd = td->io_ops_data;
+	struct fileuring_io_u *fio = io_u->engine_data;
+	struct fileuring_lat *lat = &fd->lat[fio->op];
+	struct fio_file *f = io_u->file;
+	unsigned long state = (uintptr_t) FILE_ENG_DATA(f);
+	uint64_t nsec;
+
+	nsec = ntime_since_now(&fio->start);
+	lat->plat[plat_val_to_idx(nsec)]++;
+	if (!lat->samples || nsec < lat->min)
+		lat->min = nsec;
+	if (nsec > lat->max)
+		lat->max = nsec;
+	lat->sum += nsec;
+	lat->samples++;
+
+	state &= ~FILEURING_F_BUSY;
+	if (!io_u->error) {
+		if (fio->op == FILEURING_RENAME)
+			state ^= FILEURING_F_RENAMED;
+		else if (fio->op == FILEURING_DELETE)
+			state &= ~FILEURING_F_RENAMED;
+	}
+	state += 1UL << FILEURING_STEP_SHIFT;
+	FILE_SET_ENG_DATA(f, (void *) (uintptr_t) state);
+}
+
+static void fileuring_readdir(struct io_u *io_u, const char *name)
+{
+	DIR *dir;
+
+	dir = opendir(name);
+	if (!dir) {
+		io_u->error = errno;
+		return;
+	}
+
+	errno = 0;
+	while (readdir(dir))
+		;
+	if (errno)
+		io_u->error = errno;
+	closedir(dir);
+}
+
+static enum fio_q_status fileuring_queue(struct thread_data *td,
+					 struct io_u *io_u)
+{
+	struct fileuring_data *fd = td->io_ops_data;
+	struct fileuring_io_u *fio = io_u->engine_data;
+	struct fio_file *f = io_u->file;
+	unsigned long state = (uintptr_t) FILE_ENG_DATA(f);
+	struct io_uring_sqe *sqe;
+	const char *name;
+	unsigned tail, idx;
+
+	if (state & FILEURING_F_BUSY)
+		return FIO_Q_BUSY;
+
+	tail = *fd->sq_tail + fd->queued;
+	if (tail - atomic_load_acquire(fd->sq_head) >= fd->sq_entries)
+		return FIO_Q_BUSY;
+
+	fio->op = fileuring_op(td, state);
+	if (fio->op == FILEURING_RENAME || (state & FILEURING_F_RENAMED))
+		snprintf(fio->path, sizeof(fio->path), "%s.renamed",
+			 f->file_name);
+	name = (state & FILEURING_F_RENAMED) ? fio->path : f->file_name;
+
+	FILE_SET_ENG_DATA(f, (void *) (uintptr_t) (state | FILEURING_F_BUSY));
+	fio_gettime(&fio->start, NULL);
+
+	if (fio->op == FILEURING_READDIR) {
+		fileuring_readdir(io_u, name);
+		fileuring_done(td, io_u);
+		return FIO_Q_COMPLETED;
+	}
+
+	idx = tail & fd->sq_mask;
+	sqe = &fd->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (unsigned long) name;
+
+	switch (fio->op) {
+	case FILEURING_CREATE:
+		sqe->opcode = IORING_OP_OPENAT;
+		sqe->open_flags = O_CREAT | O_WRONLY;
+		sqe->len = 0600;
+		break;
+	case FILEURING_STAT:
+		sqe->opcode = IORING_OP_STATX;
+		sqe->len = STATX_BASIC_STATS;
+		sqe->off = (unsigned long) fio->statx_buf;
+		break;
+	case FILEURING_DELETE:
+		sqe->opcode = IORING_OP_UNLINKAT;
+		break;
+	case FILEURING_MKDIR:
+		sqe->opcode = IORING_OP_MKDIRAT;
+		sqe->len = 0700;
+		break;
+	case FILEURING_RMDIR:
+		sqe->opcode = IORING_OP_UNLINKAT;
+		sqe->unlink_flags = AT_REMOVEDIR;
+		break;
+	case FILEURING_RENAME:
+		sqe->opcode = IORING_OP_RENAMEAT;
+		sqe->len = AT_FDCWD;
+		sqe->addr2 = (unsigned long) ((state & FILEURING_F_RENAMED) ?
+						f->file_name : fio->path);
+		break;
+	}
+
+	sqe->user_data = (unsigned long) io_u;
+	fd->sq_array[idx] = idx;
+	fd->queued++;
+	return FIO_Q_QUEUED;
+}
+
+static int fileuring_commit(struct thread_data *td)
+{
+	struct fileuring_data *fd = td->io_ops_data;
+	struct io_uring_sqe *sqe;
+	unsigned tail, idx;
+	int ret;
+
+	/* close what the last creates opened, nobody waits for those */
+	tail = *fd->sq_tail + fd->queued;
+	while (fd->nr_close &&
+	       tail - atomic_load_acquire(fd->sq_head) < fd->sq_entries) {
+		idx = tail & fd->sq_mask;
+		sqe = &fd->sqes[idx];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_CLOSE;
+		sqe->fd = fd->close_fds[--fd->nr_close];
+		fd->sq_array[idx] = idx;
+		fd->queued++;
+		tail++;
+	}
+
+	if (!fd->queued)
+		return 0;
+
+	atomic_store_release(fd->sq_tail, *fd->sq_tail + fd->queued);
+
+	while (fd->queued) {
+		ret = syscall(__NR_io_uring_enter, fd->ring_fd, fd->queued, 0,
+				0, NULL, 0);
+		if (ret > 0) {
+			fd->queued -= ret;
+			continue;
+		}
+		if (ret < 0 && (errno == EINTR || errno == EAGAIN ||
+				errno == EBUSY)) {
+			usleep(1);
+			continue;
+		}
+		td_verror(td, ret < 0 ? errno : EIO, "io_uring_enter submit");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void fileuring_reap(struct thread_data *td, unsigned int max)
+{
+	struct fileuring_data *fd = td->io_ops_data;
+	unsigned head = *fd->cq_head;
+
+	while (fd->nr_events < max && head != atomic_load_acquire(fd->cq_tail)) {
+		struct io_uring_cqe *cqe = &fd->cqes[head & fd->cq_mask];
+		struct io_u *io_u = (struct io_u *) (uintptr_t) cqe->user_data;
+		struct fileuring_io_u *fio;
+
+		head++;
+		/* a close */
+		if (!io_u)
+			continue;
+
+		fio = io_u->engine_data;
+		if (cqe->res < 0)
+			io_u->error = -cqe->res;
+		else if (fio->op == FILEURING_CREATE)
+			fd->close_fds[fd->nr_close++] = cqe->res;
+
+		fileuring_done(td, io_u);
+		fd->events[fd->nr_events++] = io_u;
+	}
+
+	atomic_store_release(fd->cq_head, head);
+}
+
+static int fileuring_getevents(struct thread_data *td, unsigned int min,
+			       unsigned int max, const struct timespec *t)
+{
+	struct fileuring_data *fd = td->io_ops_data;
+	int ret;
+
+	fd->nr_events = 0;
+
+	do {
+		fileuring_reap(td, max);
+		if (fd->nr_events >= min || td->terminate)
+			break;
+
+		ret = syscall(__NR_io_uring_enter, fd->ring_fd, 0,
+				min - fd->nr_events, IORING_ENTER_GETEVENTS,
+				NULL, 0);
+		if (ret < 0 && errno != EINTR && errno != EAGAIN) {
+			td_verror(td, errno, "io_uring_enter getevents");
+			return -1;
+		}
+	} while (1);
+
+	return fd->nr_events;
+}
+
+static struct io_u *fileuring_event(struct thread_data *td, int event)
+{
+	struct fileuring_data *fd = td->io_ops_data;
+
+	return fd->events[event];
+}
+
+static int fileuring_open_file(struct thread_data *td, struct fio_file *f)
+{
+	if (f->filetype != FIO_TYPE_FILE) {
+		log_err("fio: only files are supported\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int fileuring_close_file(struct thread_data *td, struct fio_file *f)
+{
+	return 0;
+}
+
+/*
+ * One block per operation, mixed takes each file through all its steps
+ */
+static int fileuring_get_file_size(struct thread_data *td, struct fio_file *f)
+{
+	struct fileuring_options *o = td->eo;
+
+	f->real_file_size = td_min_bs(td);
+	if (o->op == FILEURING_MIXED)
+		f->real_file_size *= FIO_ARRAY_SIZE(fileuring_mixed);
+	return 0;
+}
+
+static struct ioengine_ops ioengine_fileuring = {
+	.name		= "fileuring",
+	.version	= FIO_IOOPS_VERSION,
+	.init		= fileuring_init,
+	.cleanup	= fileuring_cleanup,
+	.queue		= fileuring_queue,
+	.commit		= fileuring_commit,
+	.getevents	= fileuring_getevents,
+	.event		= fileuring_event,
+	.invalidate	= invalidate_do_nothing,
+	.get_file_size	= fileuring_get_file_size,
+	.open_file	= fileuring_open_file,
+	.close_file	= fileuring_close_file,
+	.flags		= FIO_DISKLESSIO | FIO_FAKEIO | FIO_NOFILEHASH,
+	.options	= fileuring_options,
+	.option_struct_size = sizeof(struct fileuring_options),
+	.io_u_priv_size	= sizeof(struct fileuring_io_u),
+};
+#endif
 
 static void fio_init fio_fileoperations_register(void)
 {
 	register_ioengine(&ioengine_filecreate);
 	register_ioengine(&ioengine_filestat);
 	register_ioengine(&ioengine_filedelete);
+#ifdef FIO_HAVE_IOURING
+	register_ioengine(&ioengine_fileuring);
+#endif
 }
 
 static void fio_exit fio_fileoperations_unregister(void)
@@ -315,4 +882,7 @@ static void fio_exit fio_fileoperations_unregister(void)
 	unregister_ioengine(&ioengine_filecreate);
 	unregister_ioengine(&ioengine_filestat);
 	unregister_ioengine(&ioengine_filedelete);
+#ifdef FIO_HAVE_IOURING
+	unregister_ioengine(&ioengine_fileuring);
+#endif
 }
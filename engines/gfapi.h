@@ -10,10 +10,18 @@ struct gf_options {
 
 struct gf_data {
 	glfs_t *fs;
-	glfs_fd_t *fd;
 	struct io_u **aio_events;
+
+	/* gfapi_async completions, see glusterfs_async.c */
+	struct fio_gf_iou *done;	/* pushed by the callbacks */
+	struct fio_gf_iou *reaped;	/* taken off 'done', oldest first */
+	int sleeping;
+	int efd;
 };
 
+/* every file has its own fd, opened along with the file */
+#define GF_FILE_FD(f)	((glfs_fd_t *) FILE_ENG_DATA(f))
+
 extern struct fio_option gfapi_options[];
 extern int fio_gf_setup(struct thread_data *td);
 extern void fio_gf_cleanup(struct thread_data *td);
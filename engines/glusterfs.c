@@ -192,8 +192,8 @@ int fio_gf_setup(struct thread_data *td)
 		log_err("malloc failed.\n");
 		return -ENOMEM;
 	}
-	g->fd = NULL;
-	g->aio_events = NULL;
+	memset(g, 0, sizeof(*g));
+	g->efd = -1;
 
 	g->fs = fio_gf_get_glfs(opt, opt->gf_vol, opt->gf_brick);
 	if (!g->fs)
@@ -215,8 +215,8 @@ void fio_gf_cleanup(struct thread_data *td)
 	if (g) {
 		if (g->aio_events)
 			free(g->aio_events);
-		if (g->fd)
-			glfs_close(g->fd);
+		if (g->efd != -1)
+			close(g->efd);
 		if (g->fs)
 			fio_gf_put_glfs(td->eo, g->fs);
 		free(g);
@@ -258,6 +258,7 @@ int fio_gf_open_file(struct thread_data *td, struct fio_file *f)
 	int ret = 0;
 	struct gf_data *g = td->io_ops_data;
 	struct stat sb = { 0, };
+	glfs_fd_t *fd;
 
 	if (td_write(td)) {
 		if (!read_only)
@@ -275,8 +276,8 @@ int fio_gf_open_file(struct thread_data *td, struct fio_file *f)
 
 	dprint(FD_FILE, "fio file %s open mode %s td rw %s\n", f->file_name,
 	       flags & O_RDONLY ? "ro" : "rw", td_read(td) ? "read" : "write");
-	g->fd = glfs_creat(g->fs, f->file_name, flags, 0644);
-	if (!g->fd) {
+	fd = glfs_creat(g->fs, f->file_name, flags, 0644);
+	if (!fd) {
 		ret = errno;
 		log_err("glfs_creat failed.\n");
 		return ret;
@@ -288,9 +289,9 @@ int fio_gf_open_file(struct thread_data *td, struct fio_file *f)
 			dprint(FD_FILE, "fio extend file %s from %jd to %" PRIu64 "\n",
 			       f->file_name, (intmax_t) sb.st_size, f->real_file_size);
 #if defined(CONFIG_GF_NEW_API)
-			ret = glfs_ftruncate(g->fd, f->real_file_size, NULL, NULL);
+			ret = glfs_ftruncate(fd, f->real_file_size, NULL, NULL);
 #else
-			ret = glfs_ftruncate(g->fd, f->real_file_size);
+			ret = glfs_ftruncate(fd, f->real_file_size);
 #endif
 			if (ret) {
 				log_err("failed fio extend file %s to %" PRIu64 "\n",
@@ -312,7 +313,7 @@ int fio_gf_open_file(struct thread_data *td, struct fio_file *f)
 
 					fill_io_buffer(td, b, bs, bs);
 
-					r = glfs_write(g->fd, b, bs, 0);
+					r = glfs_write(fd, b, bs, 0);
 					dprint(FD_IO,
 					       "fio write %d of %" PRIu64 " file %s\n",
 					       r, f->real_file_size,
@@ -346,7 +347,7 @@ int fio_gf_open_file(struct thread_data *td, struct fio_file *f)
 
 				if (b)
 					free(b);
-				glfs_lseek(g->fd, 0, SEEK_SET);
+				glfs_lseek(fd, 0, SEEK_SET);
 
 				if (td->terminate && td->o.unlink) {
 					dprint(FD_FILE, "terminate unlink %s\n",
@@ -354,16 +355,15 @@ int fio_gf_open_file(struct thread_data *td, struct fio_file *f)
 					glfs_unlink(g->fs, f->file_name);
 				} else if (td->o.create_fsync) {
 #if defined(CONFIG_GF_NEW_API)
-					if (glfs_fsync(g->fd, NULL, NULL) < 0) {
+					if (glfs_fsync(fd, NULL, NULL) < 0) {
 #else
-					if (glfs_fsync(g->fd) < 0) {
+					if (glfs_fsync(fd) < 0) {
 #endif
 						dprint(FD_FILE,
 						       "failed to sync, close %s\n",
 						       f->file_name);
 						td_verror(td, errno, "fsync");
-						glfs_close(g->fd);
-						g->fd = NULL;
+						glfs_close(fd);
 						return 1;
 					}
 				}
@@ -374,10 +374,10 @@ int fio_gf_open_file(struct thread_data *td, struct fio_file *f)
 	{
 		int r = 0;
 		if (td_random(td)) {
-			r = glfs_fadvise(g->fd, 0, f->real_file_size,
+			r = glfs_fadvise(fd, 0, f->real_file_size,
 					 POSIX_FADV_RANDOM);
 		} else {
-			r = glfs_fadvise(g->fd, 0, f->real_file_size,
+			r = glfs_fadvise(fd, 0, f->real_file_size,
 					 POSIX_FADV_SEQUENTIAL);
 		}
 		if (r) {
@@ -387,6 +387,7 @@ int fio_gf_open_file(struct thread_data *td, struct fio_file *f)
 	}
 #endif
 	dprint(FD_FILE, "fio %p created %s\n", g->fs, f->file_name);
+	FILE_SET_ENG_DATA(f, fd);
 	f->fd = -1;
 	f->shadow_fd = -1;
 	td->o.open_files ++;
@@ -401,9 +402,9 @@ int fio_gf_close_file(struct thread_data *td, struct fio_file *f)
 	dprint(FD_FILE, "fd close %s\n", f->file_name);
 
 	if (g) {
-		if (g->fd && glfs_close(g->fd) < 0)
+		if (GF_FILE_FD(f) && glfs_close(GF_FILE_FD(f)) < 0)
 			ret = errno;
-		g->fd = NULL;
+		FILE_SET_ENG_DATA(f, NULL);
 	}
 
 	return ret;
@@ -417,15 +418,15 @@ int fio_gf_unlink_file(struct thread_data *td, struct fio_file *f)
 	dprint(FD_FILE, "fd unlink %s\n", f->file_name);
 
 	if (g) {
-		if (g->fd && glfs_close(g->fd) < 0)
+		if (GF_FILE_FD(f) && glfs_close(GF_FILE_FD(f)) < 0)
 			ret = errno;
+		FILE_SET_ENG_DATA(f, NULL);
 
 		glfs_unlink(g->fs, f->file_name);
 
 		if (g->fs)
 			glfs_fini(g->fs);
 
-		g->fd = NULL;
 		free(g);
 	}
 	td->io_ops_data = NULL;
@@ -4,11 +4,22 @@
  * IO engine using Glusterfs's gfapi async interface
  *
  */
+#include <poll.h>
+#include <sys/eventfd.h>
+
 #include "gfapi.h"
 #define NOT_YET 1
+
+/*
+ * The gfapi callback threads push completed io_us onto a lockless stack,
+ * ->getevents takes the whole stack at once and hands the io_us out oldest
+ * first. A reaper with nothing to reap flags itself as sleeping and waits
+ * on an eventfd, which the next callback writes to.
+ */
 struct fio_gf_iou {
 	struct io_u *io_u;
-	int io_complete;
+	struct gf_data *g;
+	struct fio_gf_iou *next;
 };
 
 static struct io_u *fio_gf_event(struct thread_data *td, int event)
@@ -19,38 +30,94 @@ static struct io_u *fio_gf_event(struct thread_data *td, int event)
 	return gf_data->aio_events[event];
 }
 
+static void fio_gf_push_done(struct gf_data *g, struct fio_gf_iou *io)
+{
+	struct fio_gf_iou *old = __atomic_load_n(&g->done, __ATOMIC_RELAXED);
+	uint64_t val = 1;
+
+	do {
+		io->next = old;
+	} while (!__atomic_compare_exchange_n(&g->done, &old, io, true,
+					      __ATOMIC_SEQ_CST,
+					      __ATOMIC_RELAXED));
+
+	if (__atomic_exchange_n(&g->sleeping, 0, __ATOMIC_SEQ_CST)) {
+		if (write(g->efd, &val, sizeof(val)) < 0)
+			log_err("fio: gfapi wakeup: %s\n", strerror(errno));
+	}
+}
+
+/*
+ * Move everything the callbacks pushed to the reaped list, oldest first.
+ * Returns false if there was nothing.
+ */
+static bool fio_gf_take_done(struct gf_data *g)
+{
+	struct fio_gf_iou *io, *next, *list = NULL, **tail;
+
+	io = __atomic_exchange_n(&g->done, NULL, __ATOMIC_ACQUIRE);
+	if (!io)
+		return false;
+
+	while (io) {
+		next = io->next;
+		io->next = list;
+		list = io;
+		io = next;
+	}
+
+	tail = &g->reaped;
+	while (*tail)
+		tail = &(*tail)->next;
+	*tail = list;
+	return true;
+}
+
+/*
+ * Wait for a callback to push something, until the timeout if there is one.
+ * Returns false on timeout.
+ */
+static bool fio_gf_wait_done(struct gf_data *g, const struct timespec *t)
+{
+	struct pollfd pfd = { .fd = g->efd, .events = POLLIN };
+	int msec = -1, ret;
+	uint64_t val;
+
+	__atomic_store_n(&g->sleeping, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&g->done, __ATOMIC_SEQ_CST)) {
+		__atomic_store_n(&g->sleeping, 0, __ATOMIC_SEQ_CST);
+		return true;
+	}
+
+	if (t)
+		msec = t->tv_sec * 1000 + t->tv_nsec / 1000000;
+
+	ret = poll(&pfd, 1, msec);
+	__atomic_store_n(&g->sleeping, 0, __ATOMIC_SEQ_CST);
+	if (ret > 0 && read(g->efd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+		log_err("fio: gfapi eventfd read: %s\n", strerror(errno));
+
+	return ret != 0;
+}
+
 static int fio_gf_getevents(struct thread_data *td, unsigned int min,
 			    unsigned int max, const struct timespec *t)
 {
 	struct gf_data *g = td->io_ops_data;
 	unsigned int events = 0;
-	struct io_u *io_u;
-	int i;
 
 	dprint(FD_IO, "%s\n", __FUNCTION__);
 	do {
-		io_u_qiter(&td->io_u_all, io_u, i) {
-			struct fio_gf_iou *io;
-
-			if (!(io_u->flags & IO_U_F_FLIGHT))
-				continue;
-
-			io = io_u->engine_data;
-			if (io->io_complete) {
-				io->io_complete = 0;
-				g->aio_events[events] = io_u;
-				events++;
-
-				if (events >= max)
-					break;
-			}
-
+		while (g->reaped && events < max) {
+			g->aio_events[events++] = g->reaped->io_u;
+			g->reaped = g->reaped->next;
 		}
-		if (events < min)
-			usleep(100);
-		else
+		if (events >= min)
+			break;
+		if (fio_gf_take_done(g))
+			continue;
+		if (!fio_gf_wait_done(g, t))
 			break;
-
 	} while (1);
 
 	return events;
@@ -61,26 +128,19 @@ static void fio_gf_io_u_free(struct thread_data *td, struct io_u *io_u)
 	struct fio_gf_iou *io = io_u->engine_data;
 
 	if (io) {
-		if (io->io_complete)
+		if (io_u->flags & IO_U_F_FLIGHT)
 			log_err("incomplete IO found.\n");
 		io_u->engine_data = NULL;
-		free(io);
 	}
 }
 
 static int fio_gf_io_u_init(struct thread_data *td, struct io_u *io_u)
 {
-    struct fio_gf_iou *io;
+	struct fio_gf_iou *io = io_u->engine_data;
+
 	dprint(FD_FILE, "%s\n", __FUNCTION__);
-    
-    io = malloc(sizeof(struct fio_gf_iou));
-    if (!io) {
-        td_verror(td, errno, "malloc");
-        return 1;
-    }
-    io->io_complete = 0;
-    io->io_u = io_u;
-    io_u->engine_data = io;
+	io->io_u = io_u;
+	io->g = td->io_ops_data;
 	return 0;
 }
 
@@ -95,13 +155,18 @@ static void gf_async_cb(glfs_fd_t * fd, ssize_t ret, void *data)
 	struct fio_gf_iou *iou = io_u->engine_data;
 
 	dprint(FD_IO, "%s ret %zd\n", __FUNCTION__, ret);
-	iou->io_complete = 1;
+	if (ret < 0)
+		io_u->error = errno;
+	else if (ddir_rw(io_u->ddir) && ret < io_u->xfer_buflen)
+		io_u->resid = io_u->xfer_buflen - ret;
+
+	fio_gf_push_done(iou->g, iou);
 }
 
 static enum fio_q_status fio_gf_async_queue(struct thread_data fio_unused * td,
 					    struct io_u *io_u)
 {
-	struct gf_data *g = td->io_ops_data;
+	glfs_fd_t *fd = GF_FILE_FD(io_u->file);
 	int r;
 
 	dprint(FD_IO, "%s op %s\n", __FUNCTION__, io_ddir_name(io_u->ddir));
@@ -109,20 +174,20 @@ static enum fio_q_status fio_gf_async_queue(struct thread_data fio_unused * td,
 	fio_ro_check(td, io_u);
 
 	if (io_u->ddir == DDIR_READ)
-		r = glfs_pread_async(g->fd, io_u->xfer_buf, io_u->xfer_buflen,
+		r = glfs_pread_async(fd, io_u->xfer_buf, io_u->xfer_buflen,
 				     io_u->offset, 0, gf_async_cb, io_u);
 	else if (io_u->ddir == DDIR_WRITE)
-		r = glfs_pwrite_async(g->fd, io_u->xfer_buf, io_u->xfer_buflen,
+		r = glfs_pwrite_async(fd, io_u->xfer_buf, io_u->xfer_buflen,
 				      io_u->offset, 0, gf_async_cb, io_u);
 #if defined(CONFIG_GF_TRIM)
 	else if (io_u->ddir == DDIR_TRIM)
-		r = glfs_discard_async(g->fd, io_u->offset, io_u->xfer_buflen,
+		r = glfs_discard_async(fd, io_u->offset, io_u->xfer_buflen,
 				       gf_async_cb, io_u);
 #endif
 	else if (io_u->ddir == DDIR_DATASYNC)
-		r = glfs_fdatasync_async(g->fd, gf_async_cb, io_u);
+		r = glfs_fdatasync_async(fd, gf_async_cb, io_u);
 	else if (io_u->ddir == DDIR_SYNC)
-		r = glfs_fsync_async(g->fd, gf_async_cb, io_u);
+		r = glfs_fsync_async(fd, gf_async_cb, io_u);
 	else
 		r = EINVAL;
 
@@ -160,6 +225,14 @@ static int fio_gf_async_setup(struct thread_data *td)
 		return r;
 	}
 
+	g->efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (g->efd < 0) {
+		r = -errno;
+		log_err("fio: gfapi eventfd: %s\n", strerror(errno));
+		fio_gf_cleanup(td);
+		return r;
+	}
+
 	return r;
 }
 
@@ -179,6 +252,7 @@ static struct ioengine_ops ioengine = {
 	.io_u_free = fio_gf_io_u_free,
 	.options = gfapi_options,
 	.option_struct_size = sizeof(struct gf_options),
+	.io_u_priv_size = sizeof(struct fio_gf_iou),
 	.flags = FIO_DISKLESSIO,
 };
 
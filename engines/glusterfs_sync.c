@@ -11,7 +11,6 @@
 static int fio_gf_prep(struct thread_data *td, struct io_u *io_u)
 {
 	struct fio_file *f = io_u->file;
-	struct gf_data *g = td->io_ops_data;
 
 	dprint(FD_FILE, "fio prep\n");
 
@@ -21,7 +20,7 @@ static int fio_gf_prep(struct thread_data *td, struct io_u *io_u)
 	if (LAST_POS(f) != -1ULL && LAST_POS(f) == io_u->offset)
 		return 0;
 
-	if (glfs_lseek(g->fd, io_u->offset, SEEK_SET) < 0) {
+	if (glfs_lseek(GF_FILE_FD(f), io_u->offset, SEEK_SET) < 0) {
 		td_verror(td, errno, "lseek");
 		return 1;
 	}
@@ -31,27 +30,27 @@ static int fio_gf_prep(struct thread_data *td, struct io_u *io_u)
 
 static enum fio_q_status fio_gf_queue(struct thread_data *td, struct io_u *io_u)
 {
-	struct gf_data *g = td->io_ops_data;
+	glfs_fd_t *fd = GF_FILE_FD(io_u->file);
 	int ret = 0;
 
 	dprint(FD_FILE, "fio queue len %llu\n", io_u->xfer_buflen);
 	fio_ro_check(td, io_u);
 
 	if (io_u->ddir == DDIR_READ)
-		ret = glfs_read(g->fd, io_u->xfer_buf, io_u->xfer_buflen, 0);
+		ret = glfs_read(fd, io_u->xfer_buf, io_u->xfer_buflen, 0);
 	else if (io_u->ddir == DDIR_WRITE)
-		ret = glfs_write(g->fd, io_u->xfer_buf, io_u->xfer_buflen, 0);
+		ret = glfs_write(fd, io_u->xfer_buf, io_u->xfer_buflen, 0);
 	else if (io_u->ddir == DDIR_SYNC)
 #if defined(CONFIG_GF_NEW_API)
-		ret = glfs_fsync(g->fd, NULL, NULL);
+		ret = glfs_fsync(fd, NULL, NULL);
 #else
-		ret = glfs_fsync(g->fd);
+		ret = glfs_fsync(fd);
 #endif
 	else if (io_u->ddir == DDIR_DATASYNC)
 #if defined(CONFIG_GF_NEW_API)
-		ret = glfs_fdatasync(g->fd, NULL, NULL);
+		ret = glfs_fdatasync(fd, NULL, NULL);
 #else
-		ret = glfs_fdatasync(g->fd);
+		ret = glfs_fdatasync(fd);
 #endif
 	else {
 		log_err("unsupported operation.\n");
@@ -1,7 +1,8 @@
 /*
  * HTTP GET/PUT IO engine
  *
- * IO engine to perform HTTP(S) GET/PUT requests via libcurl-easy.
+ * IO engine to perform HTTP(S) GET/PUT requests via libcurl-easy, or
+ * via libcurl-multi with iodepth requests in flight.
  *
  * Copyright (C) 2018 SUSE LLC
  *
@@ -46,6 +47,20 @@ enum {
 
 struct http_data {
 	CURL *curl;
+
+	/* iodepth > 1: requests run on io_u easy handles added to multi */
+	CURLM *multi;
+	struct io_u **events;
+	unsigned int nr_events;
+
+	/*
+	 * S3 signing state. The signing key only changes with the date,
+	 * the SSE customer key headers never do.
+	 */
+	char s3_date[16];
+	unsigned char s3_signing_key[SHA256_DIGEST_LENGTH];
+	char *sse_key_base64;
+	char *sse_key_md5_base64;
 };
 
 struct http_options {
@@ -71,6 +86,16 @@ struct http_curl_stream {
 	size_t max;
 };
 
+/*
+ * Per io_u request state for the multi interface, see ->io_u_priv_size
+ */
+struct http_io_u {
+	CURL *curl;
+	struct curl_slist *slist;
+	struct http_curl_stream stream;
+	char object[512];
+};
+
 static struct fio_option options[] = {
 	{
 		.name     = "https",
@@ -409,9 +434,11 @@ static int _curl_trace(CURL *handle, curl_infotype type,
 /* https://docs.aws.amazon.com/AmazonS3/latest/API/sig-v4-header-based-auth.html
  * https://docs.aws.amazon.com/AmazonS3/latest/API/sig-v4-authenticating-requests.html#signing-request-intro
  */
-static void _add_aws_auth_header(CURL *curl, struct curl_slist *slist, struct http_options *o,
-		int op, const char *uri, char *buf, size_t len)
+static struct curl_slist *_add_aws_auth_header(CURL *curl, struct http_data *http,
+		struct http_options *o, int op, const char *uri, char *buf,
+		size_t len)
 {
+	struct curl_slist *slist = NULL;
 	char date_short[16];
 	char date_iso[32];
 	char method[8];
@@ -426,9 +453,8 @@ static void _add_aws_auth_header(CURL *curl, struct curl_slist *slist, struct ht
 	const char *service = "s3";
 	const char *aws = "aws4_request";
 	unsigned char md[SHA256_DIGEST_LENGTH];
-	unsigned char sse_key[33] = {0};
-	char *sse_key_base64 = NULL;
-	char *sse_key_md5_base64 = NULL;
+	const char *sse_key_base64 = http->sse_key_base64;
+	const char *sse_key_md5_base64 = http->sse_key_md5_base64;
 
 	time_t t = time(NULL);
 	struct tm *gtm = gmtime(&t);
@@ -437,9 +463,6 @@ static void _add_aws_auth_header(CURL *curl, struct curl_slist *slist, struct ht
 	strftime (date_iso, sizeof(date_iso), "%Y%m%dT%H%M%SZ", gtm);
 	uri_encoded = _aws_uriencode(uri);
 
-	if (o->s3_sse_customer_key != NULL)
-		strncpy((char*)sse_key, o->s3_sse_customer_key, sizeof(sse_key) - 1);
-
 	if (op == DDIR_WRITE) {
 		dsha = _gen_hex_sha256(buf, len);
 		sprintf(method, "PUT");
@@ -453,9 +476,7 @@ static void _add_aws_auth_header(CURL *curl, struct curl_slist *slist, struct ht
 	}
 
 	/* Create the canonical request first */
-	if (sse_key[0] != '\0') {
-		sse_key_base64 = _conv_base64_encode(sse_key, sizeof(sse_key) - 1);
-		sse_key_md5_base64 = _gen_base64_md5(sse_key, sizeof(sse_key) - 1);
+	if (sse_key_base64) {
 		snprintf(creq, sizeof(creq),
 			"%s\n"
 			"%s\n"
@@ -498,12 +519,17 @@ static void _add_aws_auth_header(CURL *curl, struct curl_slist *slist, struct ht
 	snprintf(sts, sizeof(sts), "AWS4-HMAC-SHA256\n%s\n%s/%s/%s/%s\n%s",
 			date_iso, date_short, o->s3_region, service, aws, csha);
 
-	snprintf((char *)dkey, sizeof(dkey), "AWS4%s", o->s3_key);
-	_hmac(md, dkey, strlen(dkey), date_short);
-	_hmac(md, md, SHA256_DIGEST_LENGTH, o->s3_region);
-	_hmac(md, md, SHA256_DIGEST_LENGTH, (char*) service);
-	_hmac(md, md, SHA256_DIGEST_LENGTH, (char*) aws);
-	_hmac(md, md, SHA256_DIGEST_LENGTH, sts);
+	/* the signing key is derived once per day */
+	if (strcmp(http->s3_date, date_short)) {
+		snprintf((char *)dkey, sizeof(dkey), "AWS4%s", o->s3_key);
+		_hmac(md, dkey, strlen(dkey), date_short);
+		_hmac(md, md, SHA256_DIGEST_LENGTH, o->s3_region);
+		_hmac(md, md, SHA256_DIGEST_LENGTH, (char*) service);
+		_hmac(md, md, SHA256_DIGEST_LENGTH, (char*) aws);
+		memcpy(http->s3_signing_key, md, SHA256_DIGEST_LENGTH);
+		strcpy(http->s3_date, date_short);
+	}
+	_hmac(md, http->s3_signing_key, SHA256_DIGEST_LENGTH, sts);
 
 	signature = _conv_hex(md, SHA256_DIGEST_LENGTH);
 
@@ -516,7 +542,7 @@ static void _add_aws_auth_header(CURL *curl, struct curl_slist *slist, struct ht
 	snprintf(s, sizeof(s), "x-amz-date: %s", date_iso);
 	slist = curl_slist_append(slist, s);
 
-	if (sse_key[0] != '\0') {
+	if (sse_key_base64) {
 		snprintf(s, sizeof(s), "x-amz-server-side-encryption-customer-algorithm: %s", o->s3_sse_customer_algorithm);
 		slist = curl_slist_append(slist, s);
 		snprintf(s, sizeof(s), "x-amz-server-side-encryption-customer-key: %s", sse_key_base64);
@@ -528,7 +554,7 @@ static void _add_aws_auth_header(CURL *curl, struct curl_slist *slist, struct ht
 	snprintf(s, sizeof(s), "x-amz-storage-class: %s", o->s3_storage_class);
 	slist = curl_slist_append(slist, s);
 
-	if (sse_key[0] != '\0') {
+	if (sse_key_base64) {
 		snprintf(s, sizeof(s), "Authorization: AWS4-HMAC-SHA256 Credential=%s/%s/%s/s3/aws4_request,"
 			"SignedHeaders=host;x-amz-content-sha256;"
 			"x-amz-date;x-amz-server-side-encryption-customer-algorithm;"
@@ -550,15 +576,13 @@ static void _add_aws_auth_header(CURL *curl, struct curl_slist *slist, struct ht
 	free(csha);
 	free(dsha);
 	free(signature);
-	if (sse_key_base64 != NULL) {
-		free(sse_key_base64);
-		free(sse_key_md5_base64);
-	}
+	return slist;
 }
 
-static void _add_swift_header(CURL *curl, struct curl_slist *slist, struct http_options *o,
+static struct curl_slist *_add_swift_header(CURL *curl, struct http_options *o,
 		int op, const char *uri, char *buf, size_t len)
 {
+	struct curl_slist *slist = NULL;
 	char *dsha = NULL;
 	char s[512];
 
@@ -577,6 +601,7 @@ static void _add_swift_header(CURL *curl, struct curl_slist *slist, struct http_
 	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, slist);
 
 	free(dsha);
+	return slist;
 }
 
 static void fio_http_cleanup(struct thread_data *td)
@@ -584,7 +609,12 @@ static void fio_http_cleanup(struct thread_data *td)
 	struct http_data *http = td->io_ops_data;
 
 	if (http) {
+		if (http->multi)
+			curl_multi_cleanup(http->multi);
 		curl_easy_cleanup(http->curl);
+		free(http->events);
+		free(http->sse_key_base64);
+		free(http->sse_key_md5_base64);
 		free(http);
 	}
 }
@@ -628,107 +658,289 @@ static int _http_seek(void *stream, curl_off_t offset, int origin)
 		return CURL_SEEKFUNC_FAIL;
 }
 
-static enum fio_q_status fio_http_queue(struct thread_data *td,
-					 struct io_u *io_u)
+/*
+ * Point curl at the object for this io_u and set up the request for its
+ * data direction. Returns 1 if the direction isn't supported.
+ */
+static int _http_prep(struct thread_data *td, CURL *curl, struct io_u *io_u,
+		      struct http_curl_stream *stream,
+		      struct curl_slist **slist)
 {
 	struct http_data *http = td->io_ops_data;
 	struct http_options *o = td->eo;
-	struct http_curl_stream _curl_stream;
-	struct curl_slist *slist = NULL;
 	char object[512];
 	char url[1024];
-	long status;
-	CURLcode res;
-	int r = -1;
 
-	fio_ro_check(td, io_u);
-	memset(&_curl_stream, 0, sizeof(_curl_stream));
+	memset(stream, 0, sizeof(*stream));
 	snprintf(object, sizeof(object), "%s_%llu_%llu", td->files[0]->file_name,
 		io_u->offset, io_u->xfer_buflen);
 	if (o->https == FIO_HTTPS_OFF)
 		snprintf(url, sizeof(url), "http://%s%s", o->host, object);
 	else
 		snprintf(url, sizeof(url), "https://%s%s", o->host, object);
-	curl_easy_setopt(http->curl, CURLOPT_URL, url);
-	_curl_stream.buf = io_u->xfer_buf;
-	_curl_stream.max = io_u->xfer_buflen;
-	curl_easy_setopt(http->curl, CURLOPT_SEEKDATA, &_curl_stream);
-	curl_easy_setopt(http->curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)io_u->xfer_buflen);
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	stream->buf = io_u->xfer_buf;
+	stream->max = io_u->xfer_buflen;
+	curl_easy_setopt(curl, CURLOPT_SEEKDATA, stream);
+	curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)io_u->xfer_buflen);
 
 	if (o->mode == FIO_HTTP_S3)
-		_add_aws_auth_header(http->curl, slist, o, io_u->ddir, object,
+		*slist = _add_aws_auth_header(curl, http, o, io_u->ddir, object,
 			io_u->xfer_buf, io_u->xfer_buflen);
 	else if (o->mode == FIO_HTTP_SWIFT)
-		_add_swift_header(http->curl, slist, o, io_u->ddir, object,
+		*slist = _add_swift_header(curl, o, io_u->ddir, object,
 			io_u->xfer_buf, io_u->xfer_buflen);
 
+	/* handles are reused, so undo what a previous DELETE left behind */
 	if (io_u->ddir == DDIR_WRITE) {
-		curl_easy_setopt(http->curl, CURLOPT_READDATA, &_curl_stream);
-		curl_easy_setopt(http->curl, CURLOPT_WRITEDATA, NULL);
-		curl_easy_setopt(http->curl, CURLOPT_UPLOAD, 1L);
-		res = curl_easy_perform(http->curl);
-		if (res == CURLE_OK) {
-			curl_easy_getinfo(http->curl, CURLINFO_RESPONSE_CODE, &status);
-			if (status == 100 || (status >= 200 && status <= 204))
-				goto out;
-			log_err("DDIR_WRITE failed with HTTP status code %ld\n", status);
-		}
-		goto err;
+		curl_easy_setopt(curl, CURLOPT_READDATA, stream);
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, NULL);
+		curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, NULL);
+		curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+		return 0;
 	} else if (io_u->ddir == DDIR_READ) {
-		curl_easy_setopt(http->curl, CURLOPT_READDATA, NULL);
-		curl_easy_setopt(http->curl, CURLOPT_WRITEDATA, &_curl_stream);
-		curl_easy_setopt(http->curl, CURLOPT_HTTPGET, 1L);
-		res = curl_easy_perform(http->curl);
-		if (res == CURLE_OK) {
-			curl_easy_getinfo(http->curl, CURLINFO_RESPONSE_CODE, &status);
-			if (status == 200)
-				goto out;
-			else if (status == 404) {
-				/* Object doesn't exist. Pretend we read
-				 * zeroes */
-				memset(io_u->xfer_buf, 0, io_u->xfer_buflen);
-				goto out;
-			}
-			log_err("DDIR_READ failed with HTTP status code %ld\n", status);
-		}
-		goto err;
+		curl_easy_setopt(curl, CURLOPT_READDATA, NULL);
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, stream);
+		curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, NULL);
+		curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+		return 0;
 	} else if (io_u->ddir == DDIR_TRIM) {
-		curl_easy_setopt(http->curl, CURLOPT_HTTPGET, 1L);
-		curl_easy_setopt(http->curl, CURLOPT_CUSTOMREQUEST, "DELETE");
-		curl_easy_setopt(http->curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)0);
-		curl_easy_setopt(http->curl, CURLOPT_READDATA, NULL);
-		curl_easy_setopt(http->curl, CURLOPT_WRITEDATA, NULL);
-		res = curl_easy_perform(http->curl);
-		if (res == CURLE_OK) {
-			curl_easy_getinfo(http->curl, CURLINFO_RESPONSE_CODE, &status);
-			if (status == 200 || status == 202 || status == 204 || status == 404)
-				goto out;
-			log_err("DDIR_TRIM failed with HTTP status code %ld\n", status);
-		}
-		goto err;
+		curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+		curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
+		curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)0);
+		curl_easy_setopt(curl, CURLOPT_READDATA, NULL);
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, NULL);
+		return 0;
 	}
 
 	log_err("WARNING: Only DDIR_READ/DDIR_WRITE/DDIR_TRIM are supported!\n");
+	return 1;
+}
+
+/*
+ * Check the outcome of a finished request and set io_u->error
+ */
+static void _http_done(struct thread_data *td, struct io_u *io_u, CURL *curl,
+		       CURLcode res)
+{
+	long status;
+	int r = -1;
+
+	if (res != CURLE_OK)
+		goto err;
+
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+
+	if (io_u->ddir == DDIR_WRITE) {
+		if (status == 100 || (status >= 200 && status <= 204))
+			return;
+		log_err("DDIR_WRITE failed with HTTP status code %ld\n", status);
+	} else if (io_u->ddir == DDIR_READ) {
+		if (status == 200)
+			return;
+		else if (status == 404) {
+			/* Object doesn't exist. Pretend we read
+			 * zeroes */
+			memset(io_u->xfer_buf, 0, io_u->xfer_buflen);
+			return;
+		}
+		log_err("DDIR_READ failed with HTTP status code %ld\n", status);
+	} else {
+		if (status == 200 || status == 202 || status == 204 || status == 404)
+			return;
+		log_err("DDIR_TRIM failed with HTTP status code %ld\n", status);
+	}
 
 err:
 	io_u->error = r;
 	td_verror(td, io_u->error, "transfer");
+}
+
+static enum fio_q_status fio_http_queue(struct thread_data *td,
+					 struct io_u *io_u)
+{
+	struct http_data *http = td->io_ops_data;
+	struct http_curl_stream _curl_stream;
+	struct curl_slist *slist = NULL;
+	CURLcode res;
+
+	fio_ro_check(td, io_u);
+
+	if (_http_prep(td, http->curl, io_u, &_curl_stream, &slist)) {
+		io_u->error = -1;
+		td_verror(td, io_u->error, "transfer");
+		goto out;
+	}
+
+	res = curl_easy_perform(http->curl);
+	_http_done(td, io_u, http->curl, res);
 out:
 	curl_slist_free_all(slist);
 	return FIO_Q_COMPLETED;
 }
 
+static enum fio_q_status fio_http_multi_queue(struct thread_data *td,
+					       struct io_u *io_u)
+{
+	struct http_data *http = td->io_ops_data;
+	struct http_io_u *hio = io_u->engine_data;
+	CURLMcode mc;
+
+	fio_ro_check(td, io_u);
+
+	if (_http_prep(td, hio->curl, io_u, &hio->stream, &hio->slist))
+		goto err;
+
+	mc = curl_multi_add_handle(http->multi, hio->curl);
+	if (mc != CURLM_OK) {
+		log_err("fio: curl_multi_add_handle: %s\n",
+			curl_multi_strerror(mc));
+		goto err;
+	}
+
+	return FIO_Q_QUEUED;
+err:
+	curl_slist_free_all(hio->slist);
+	hio->slist = NULL;
+	io_u->error = -1;
+	td_verror(td, io_u->error, "transfer");
+	return FIO_Q_COMPLETED;
+}
+
+static int fio_http_commit(struct thread_data *td)
+{
+	struct http_data *http = td->io_ops_data;
+	CURLMcode mc;
+	int running;
+
+	if (!http->multi) {
+		/* sync IO engine - nothing is ever queued */
+		return 0;
+	}
+
+	io_u_mark_submit(td, td->io_u_queued);
+
+	/* get the new requests on the wire */
+	mc = curl_multi_perform(http->multi, &running);
+	if (mc != CURLM_OK) {
+		log_err("fio: curl_multi_perform: %s\n", curl_multi_strerror(mc));
+		return -EIO;
+	}
+
+	return 0;
+}
+
+/*
+ * Move finished requests off the multi handle into http->events
+ */
+static int fio_http_reap(struct thread_data *td, unsigned int max)
+{
+	struct http_data *http = td->io_ops_data;
+	struct http_io_u *hio;
+	struct io_u *io_u;
+	CURLMsg *msg;
+	CURLcode res;
+	int left;
+
+	while (http->nr_events < max &&
+	       (msg = curl_multi_info_read(http->multi, &left)) != NULL) {
+		if (msg->msg != CURLMSG_DONE)
+			continue;
+
+		res = msg->data.result;
+		curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &io_u);
+		hio = io_u->engine_data;
+
+		/* invalidates msg */
+		curl_multi_remove_handle(http->multi, hio->curl);
+
+		_http_done(td, io_u, hio->curl, res);
+		curl_slist_free_all(hio->slist);
+		hio->slist = NULL;
+
+		http->events[http->nr_events++] = io_u;
+	}
+
+	return http->nr_events;
+}
+
 static struct io_u *fio_http_event(struct thread_data *td, int event)
 {
+	struct http_data *http = td->io_ops_data;
+
 	/* sync IO engine - never any outstanding events */
-	return NULL;
+	if (!http->multi)
+		return NULL;
+
+	return http->events[event];
 }
 
 int fio_http_getevents(struct thread_data *td, unsigned int min,
 	unsigned int max, const struct timespec *t)
 {
+	struct http_data *http = td->io_ops_data;
+	int timeout = t ? t->tv_sec * 1000 + t->tv_nsec / 1000000 : 1000;
+	int running, waited = 0;
+	CURLMcode mc;
+
 	/* sync IO engine - never any outstanding events */
-	return 0;
+	if (!http->multi)
+		return 0;
+
+	http->nr_events = 0;
+	do {
+		mc = curl_multi_perform(http->multi, &running);
+		if (mc != CURLM_OK) {
+			log_err("fio: curl_multi_perform: %s\n",
+				curl_multi_strerror(mc));
+			return -1;
+		}
+
+		fio_http_reap(td, max);
+		if (http->nr_events >= min || !running || (t && waited))
+			break;
+
+		mc = curl_multi_wait(http->multi, NULL, 0, timeout, NULL);
+		if (mc != CURLM_OK) {
+			log_err("fio: curl_multi_wait: %s\n",
+				curl_multi_strerror(mc));
+			return -1;
+		}
+		waited = 1;
+	} while (!td->terminate);
+
+	return http->nr_events;
+}
+
+static CURL *_http_easy_init(struct http_options *o)
+{
+	CURL *curl;
+
+	curl = curl_easy_init();
+	if (!curl)
+		return NULL;
+
+	if (o->verbose)
+		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+	if (o->verbose > 1)
+		curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, &_curl_trace);
+	curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1L);
+	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+	curl_easy_setopt(curl, CURLOPT_PROTOCOLS, CURLPROTO_HTTP|CURLPROTO_HTTPS);
+	if (o->https == FIO_HTTPS_INSECURE) {
+		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+	}
+	curl_easy_setopt(curl, CURLOPT_READFUNCTION, _http_read);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _http_write);
+	curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, &_http_seek);
+	if (o->user && o->pass) {
+		curl_easy_setopt(curl, CURLOPT_USERNAME, o->user);
+		curl_easy_setopt(curl, CURLOPT_PASSWORD, o->pass);
+		curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
+	}
+
+	return curl;
 }
 
 static int fio_http_setup(struct thread_data *td)
@@ -743,25 +955,14 @@ static int fio_http_setup(struct thread_data *td)
 		goto cleanup;
 	}
 
-	http->curl = curl_easy_init();
-	if (o->verbose)
-		curl_easy_setopt(http->curl, CURLOPT_VERBOSE, 1L);
-	if (o->verbose > 1)
-		curl_easy_setopt(http->curl, CURLOPT_DEBUGFUNCTION, &_curl_trace);
-	curl_easy_setopt(http->curl, CURLOPT_NOPROGRESS, 1L);
-	curl_easy_setopt(http->curl, CURLOPT_FOLLOWLOCATION, 1L);
-	curl_easy_setopt(http->curl, CURLOPT_PROTOCOLS, CURLPROTO_HTTP|CURLPROTO_HTTPS);
-	if (o->https == FIO_HTTPS_INSECURE) {
-		curl_easy_setopt(http->curl, CURLOPT_SSL_VERIFYPEER, 0L);
-		curl_easy_setopt(http->curl, CURLOPT_SSL_VERIFYHOST, 0L);
-	}
-	curl_easy_setopt(http->curl, CURLOPT_READFUNCTION, _http_read);
-	curl_easy_setopt(http->curl, CURLOPT_WRITEFUNCTION, _http_write);
-	curl_easy_setopt(http->curl, CURLOPT_SEEKFUNCTION, &_http_seek);
-	if (o->user && o->pass) {
-		curl_easy_setopt(http->curl, CURLOPT_USERNAME, o->user);
-		curl_easy_setopt(http->curl, CURLOPT_PASSWORD, o->pass);
-		curl_easy_setopt(http->curl, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
+	http->curl = _http_easy_init(o);
+
+	if (o->s3_sse_customer_key && o->s3_sse_customer_key[0] != '\0') {
+		unsigned char sse_key[33] = {0};
+
+		strncpy((char*)sse_key, o->s3_sse_customer_key, sizeof(sse_key) - 1);
+		http->sse_key_base64 = _conv_base64_encode(sse_key, sizeof(sse_key) - 1);
+		http->sse_key_md5_base64 = _gen_base64_md5(sse_key, sizeof(sse_key) - 1);
 	}
 
 	td->io_ops_data = http;
@@ -775,6 +976,69 @@ cleanup:
 	return 1;
 }
 
+/*
+ * With iodepth > 1 requests run concurrently on a curl multi handle. Its
+ * connection cache keeps up to iodepth connections alive for reuse.
+ */
+static int fio_http_init(struct thread_data *td)
+{
+	struct http_data *http = td->io_ops_data;
+
+	if (td->o.iodepth == 1)
+		return 0;
+
+	http->multi = curl_multi_init();
+	if (!http->multi) {
+		log_err("fio: curl_multi_init failed\n");
+		return 1;
+	}
+	curl_multi_setopt(http->multi, CURLMOPT_MAXCONNECTS, (long) td->o.iodepth);
+
+	http->events = calloc(td->o.iodepth, sizeof(struct io_u *));
+	if (!http->events)
+		return 1;
+
+	td->io_ops->flags &= ~FIO_SYNCIO;
+	td_set_ioengine_flags(td);
+	return 0;
+}
+
+static int fio_http_io_u_init(struct thread_data *td, struct io_u *io_u)
+{
+	struct http_data *http = td->io_ops_data;
+	struct http_io_u *hio = io_u->engine_data;
+
+	if (!http->multi)
+		return 0;
+
+	hio->curl = _http_easy_init(td->eo);
+	if (!hio->curl)
+		return 1;
+
+	curl_easy_setopt(hio->curl, CURLOPT_PRIVATE, io_u);
+	return 0;
+}
+
+static void fio_http_io_u_free(struct thread_data *td, struct io_u *io_u)
+{
+	struct http_io_u *hio = io_u->engine_data;
+
+	if (hio->curl)
+		curl_easy_cleanup(hio->curl);
+	hio->curl = NULL;
+}
+
+static enum fio_q_status fio_http_queue_io(struct thread_data *td,
+					    struct io_u *io_u)
+{
+	struct http_data *http = td->io_ops_data;
+
+	if (http->multi)
+		return fio_http_multi_queue(td, io_u);
+
+	return fio_http_queue(td, io_u);
+}
+
 static int fio_http_open(struct thread_data *td, struct fio_file *f)
 {
 	return 0;
@@ -789,14 +1053,19 @@ FIO_STATIC struct ioengine_ops ioengine = {
 	.version		= FIO_IOOPS_VERSION,
 	.flags			= FIO_DISKLESSIO | FIO_SYNCIO,
 	.setup			= fio_http_setup,
-	.queue			= fio_http_queue,
+	.init			= fio_http_init,
+	.queue			= fio_http_queue_io,
+	.commit			= fio_http_commit,
 	.getevents		= fio_http_getevents,
 	.event			= fio_http_event,
 	.cleanup		= fio_http_cleanup,
 	.open_file		= fio_http_open,
 	.invalidate		= fio_http_invalidate,
+	.io_u_init		= fio_http_io_u_init,
+	.io_u_free		= fio_http_io_u_free,
 	.options		= options,
 	.option_struct_size	= sizeof(struct http_options),
+	.io_u_priv_size		= sizeof(struct http_io_u),
 };
 
 static void fio_init fio_http_register(void)
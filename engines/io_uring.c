@@ -9,6 +9,11 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 
@@ -33,6 +38,30 @@ enum uring_cmd_type {
 	FIO_URING_CMD_NVME = 1,
 };
 
+enum uring_taskrun_mode {
+	FIO_URING_TASKRUN_AUTO = 0,
+	FIO_URING_TASKRUN_DEFER,
+	FIO_URING_TASKRUN_COOP,
+	FIO_URING_TASKRUN_NONE,
+};
+
+/* engine_pos of a file that didn't get a registered file slot */
+#define FIO_IORING_NO_SLOT	(-1ULL)
+
+/*
+ * Hybrid polling keeps a completion latency average per data direction and
+ * power-of-2 block size. Sleeps shorter than FIO_IORING_HP_MIN_SLEEP aren't
+ * worth the context switch.
+ */
+#define FIO_IORING_HP_BUCKETS	32
+#define FIO_IORING_HP_MIN_SLEEP	2000
+
+/* default SQ ring size of a shared_ring, the CQ ring is twice that */
+#define FIO_IORING_SHARED_ENTRIES	1024
+
+/* buffer group ID used for the provided buffer ring */
+#define FIO_IORING_PBUF_BGID	0
+
 struct io_sq_ring {
 	unsigned *head;
 	unsigned *tail;
@@ -55,16 +84,58 @@ struct ioring_mmap {
 	size_t len;
 };
 
+/*
+ * An io_u on its way through a shared_ring, see fio_ioring_shared_thread().
+ * Both the submission queue and the per-job completion queues are lockless
+ * stacks linked through 'next'.
+ */
+struct ioring_shared_req {
+	struct ioring_shared_req *next;
+	struct ioring_data *ld;
+	struct io_u *io_u;
+	int res;
+};
+
 struct ioring_data {
 	int ring_fd;
 
+	/* fd and flags passed to io_uring_enter(), see fio_ioring_register_ring() */
+	int enter_ring_fd;
+	unsigned enter_flags;
+
+	/* IORING_SETUP_* flags the ring was actually created with */
+	unsigned setup_flags;
+
 	struct io_u **io_u_index;
 
 	int *fds;
 
+	/*
+	 * With open_files < nr_files, only open files are registered, each
+	 * in a slot of a sparse table sized for open_files.
+	 */
+	bool sparse_files;
+	unsigned *free_slots;
+	unsigned nr_free_slots;
+
 	struct io_sq_ring sq_ring;
 	struct io_uring_sqe *sqes;
 	struct iovec *iovecs;
+
+	/*
+	 * trim_mode=allocate, punch_hole and truncate trims go through the
+	 * ring as this op, other trims are done inline
+	 */
+	unsigned char trim_op;
+	int falloc_mode;
+
+	/* fixedbufs: the registered buffer each io_u's buffer lies in */
+	unsigned short *fixed_index;
+	struct ioring_fixed_table *fixed_table;
+
+	/* vec_seg_size segments, nr_segs per io_u */
+	struct iovec *seg_iovecs;
+	unsigned int nr_segs;
 	unsigned sq_ring_mask;
 
 	struct io_cq_ring cq_ring;
@@ -73,11 +144,86 @@ struct ioring_data {
 	int queued;
 	int cq_ring_off;
 	unsigned iodepth;
+	unsigned sq_entries;
+	unsigned cq_entries;
 	int prepped;
 
 	struct ioring_mmap mmap[3];
 
 	struct cmdprio cmdprio;
+
+	/*
+	 * Provided buffer ring state, only used with buf_ring. Buffers the
+	 * kernel handed back to us are parked on pbuf_pending until the
+	 * completion has been fully processed, then given back to the ring.
+	 */
+	void **io_u_bufs;
+	struct io_uring_buf_ring *pbuf_ring;
+	void *pbuf_mem;
+	size_t pbuf_mem_len;
+	unsigned long long pbuf_bs;
+	unsigned pbuf_entries;
+	unsigned pbuf_mask;
+	unsigned short pbuf_tail;
+	unsigned pbuf_inflight;
+	unsigned short *pbuf_pending;
+	unsigned pbuf_nr_pending;
+
+	struct ioring_sqpoll_group *sqpoll_group;
+
+	/*
+	 * shared_ring state. Queued requests collect on sh_batch, newest
+	 * first, until commit pushes them to the ring's submitter. It
+	 * pushes completions to sh_done and wakes us through sh_efd if
+	 * sh_sleeping is set.
+	 */
+	struct ioring_shared *shared;
+	struct ioring_shared_req *sh_reqs;
+	struct ioring_shared_req *sh_batch;
+	struct ioring_shared_req *sh_batch_last;
+	struct ioring_shared_req *sh_done;
+	struct ioring_shared_req *sh_pending;
+	struct ioring_shared_req **sh_events;
+	unsigned sh_inflight;
+	int sh_sleeping;
+	int sh_efd;
+
+	/* hybrid polling state, see fio_ioring_hybrid_sleep() */
+	bool hybrid;
+	uint64_t hp_lat[DDIR_RWDIR_CNT][FIO_IORING_HP_BUCKETS];
+	uint64_t hp_oversleep;
+	struct timespec hp_reap_time;
+	struct timespec hp_start;
+	uint64_t hp_sleeps;
+	uint64_t hp_slept_ns;
+
+	/* io_uring_cmd separate metadata buffers and protection info */
+	void *md_buf;
+	struct nvme_cmd_ext_io_opts ext_opts;
+};
+
+/*
+ * One ring per device shared by all shared_ring jobs using it. A submitter
+ * thread owns the ring: it moves requests from the 'subq' stack into the
+ * SQ ring and routes completions back to the job that queued them. An
+ * eventfd read is always pending on the ring, producers write to it to
+ * wake the submitter when it sleeps in io_uring_enter().
+ */
+struct ioring_shared {
+	struct flist_head list;
+	dev_t dev;
+	int refs;
+	struct ioring_data ring;
+	unsigned cq_entries;
+	pthread_t thread;
+	int efd;
+	uint64_t efd_val;
+	struct ioring_shared_req *subq;
+	struct ioring_shared_req *backlog;
+	struct ioring_shared_req *backlog_tail;
+	unsigned inflight;
+	int sleeping;
+	int exit;
 };
 
 struct ioring_options {
@@ -89,11 +235,27 @@ struct ioring_options {
 	unsigned int sqpoll_thread;
 	unsigned int sqpoll_set;
 	unsigned int sqpoll_cpu;
+	unsigned int sqpoll_shared;
 	unsigned int nonvectored;
 	unsigned int uncached;
 	unsigned int nowait;
 	unsigned int force_async;
+	unsigned int buf_ring;
+	unsigned int linked_sync;
+	unsigned int registered_ring;
+	unsigned int sq_entries;
+	unsigned int cq_entries;
+	unsigned int md_per_io_size;
+	unsigned int pi_act;
+	unsigned int apptag;
+	unsigned int apptag_mask;
+	char *pi_chk;
 	enum uring_cmd_type cmd_type;
+	unsigned int taskrun;
+	unsigned int hybrid_poll;
+	unsigned int vec_seg_size;
+	unsigned int report_hwq;
+	unsigned int shared_ring;
 };
 
 static const int ddir_to_op[2][2] = {
@@ -125,6 +287,18 @@ static struct fio_option options[] = {
 		.category = FIO_OPT_C_ENGINE,
 		.group	= FIO_OPT_G_IOURING,
 	},
+	{
+		.name	= "hybrid_poll",
+		.lname	= "Hybrid polling",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct ioring_options, hybrid_poll),
+		.help	= "With hipri, sleep for this percentage of the expected completion latency before polling",
+		.def	= "0",
+		.minval	= 0,
+		.maxval	= 90,
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_IOURING,
+	},
 #ifdef FIO_HAVE_IOPRIO_CLASS
 	{
 		.name	= "cmdprio_percentage",
@@ -242,6 +416,16 @@ static struct fio_option options[] = {
 		.category = FIO_OPT_C_ENGINE,
 		.group	= FIO_OPT_G_IOURING,
 	},
+	{
+		.name	= "sqthread_poll_shared",
+		.lname	= "Shared SQ poll thread",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct ioring_options, sqpoll_shared),
+		.help	= "Share one SQ poll thread between the jobs of a group",
+		.def	= "0",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_IOURING,
+	},
 	{
 		.name	= "nonvectored",
 		.lname	= "Non-vectored",
@@ -252,6 +436,37 @@ static struct fio_option options[] = {
 		.category = FIO_OPT_C_ENGINE,
 		.group	= FIO_OPT_G_IOURING,
 	},
+	{
+		.name	= "vec_seg_size",
+		.lname	= "Vectored segment size",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct ioring_options, vec_seg_size),
+		.help	= "Split each vectored IO into iovec segments of this size",
+		.def	= "0",
+		.interval = 512,
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_IOURING,
+	},
+	{
+		.name	= "shared_ring",
+		.lname	= "Shared ring per device",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct ioring_options, shared_ring),
+		.help	= "Submit through one ring per device, shared by the jobs using it",
+		.def	= "0",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_IOURING,
+	},
+	{
+		.name	= "report_hwq",
+		.lname	= "Report hardware queues",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct ioring_options, report_hwq),
+		.help	= "Print the blk-mq hardware queues the job's CPU maps to",
+		.def	= "0",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_IOURING,
+	},
 	{
 		.name	= "uncached",
 		.lname	= "Uncached",
@@ -279,6 +494,139 @@ static struct fio_option options[] = {
 		.category = FIO_OPT_C_ENGINE,
 		.group	= FIO_OPT_G_IOURING,
 	},
+	{
+		.name	= "buf_ring",
+		.lname	= "Provided buffer ring",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct ioring_options, buf_ring),
+		.help	= "Let the kernel pick read buffers from a ring of this many entries",
+		.minval	= 0,
+		.maxval	= 32768,
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_IOURING,
+	},
+	{
+		.name	= "linked_sync",
+		.lname	= "Linked sync",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct ioring_options, linked_sync),
+		.help	= "Link writes and their trailing fsync/fdatasync into one chain",
+		.def	= "0",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_IOURING,
+	},
+	{
+		.name	= "registered_ring",
+		.lname	= "Registered ring fd",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct ioring_options, registered_ring),
+		.help	= "Register the ring fd to avoid fd lookups on io_uring_enter",
+		.def	= "0",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_IOURING,
+	},
+	{
+		.name	= "taskrun_mode",
+		.lname	= "Task work run mode",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct ioring_options, taskrun),
+		.help	= "When the kernel runs completion task work for the ring",
+		.def	= "auto",
+		.posval = {
+			  { .ival = "auto",
+			    .oval = FIO_URING_TASKRUN_AUTO,
+			    .help = "Best mode the kernel supports",
+			  },
+			  { .ival = "defer",
+			    .oval = FIO_URING_TASKRUN_DEFER,
+			    .help = "Only run task work when reaping (DEFER_TASKRUN)",
+			  },
+			  { .ival = "coop",
+			    .oval = FIO_URING_TASKRUN_COOP,
+			    .help = "Run task work on kernel entry, no IPIs (COOP_TASKRUN)",
+			  },
+			  { .ival = "none",
+			    .oval = FIO_URING_TASKRUN_NONE,
+			    .help = "Classic task work, interrupts the task",
+			  },
+		},
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_IOURING,
+	},
+	{
+		.name	= "sq_entries",
+		.lname	= "SQ ring entries",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct ioring_options, sq_entries),
+		.help	= "Number of SQ ring entries (defaults to iodepth)",
+		.minval	= 0,
+		.maxval	= 32768,
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_IOURING,
+	},
+	{
+		.name	= "cq_entries",
+		.lname	= "CQ ring entries",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct ioring_options, cq_entries),
+		.help	= "Number of CQ ring entries (defaults to the SQ ring size)",
+		.minval	= 0,
+		.maxval	= 65536,
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_IOURING,
+	},
+	{
+		.name	= "md_per_io_size",
+		.lname	= "Separate Metadata Buffer Size per I/O",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct ioring_options, md_per_io_size),
+		.def	= "0",
+		.help	= "Size of separate metadata buffer per I/O (Default: 0)",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_IOURING,
+	},
+	{
+		.name	= "pi_act",
+		.lname	= "Protection Information Action",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct ioring_options, pi_act),
+		.def	= "1",
+		.help	= "Protection Information Action bit (pi_act=1 or pi_act=0)",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_IOURING,
+	},
+	{
+		.name	= "pi_chk",
+		.lname	= "Protection Information Check",
+		.type	= FIO_OPT_STR_STORE,
+		.off1	= offsetof(struct ioring_options, pi_chk),
+		.def	= NULL,
+		.help	= "Control of Protection Information Checking (pi_chk=GUARD,REFTAG,APPTAG)",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_IOURING,
+	},
+	{
+		.name	= "apptag",
+		.lname	= "Application Tag used in Protection Information",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct ioring_options, apptag),
+		.def	= "0x1234",
+		.maxval	= 0xffff,
+		.help	= "Application Tag used in Protection Information field (Default: 0x1234)",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_IOURING,
+	},
+	{
+		.name	= "apptag_mask",
+		.lname	= "Application Tag Mask",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct ioring_options, apptag_mask),
+		.def	= "0xffff",
+		.maxval	= 0xffff,
+		.help	= "Application Tag Mask used with Application Tag (Default: 0xffff)",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_IOURING,
+	},
 	{
 		.name	= "cmd_type",
 		.lname	= "Uring cmd type",
@@ -303,15 +651,58 @@ static struct fio_option options[] = {
 static int io_uring_enter(struct ioring_data *ld, unsigned int to_submit,
 			 unsigned int min_complete, unsigned int flags)
 {
+	flags |= ld->enter_flags;
 #ifdef FIO_ARCH_HAS_SYSCALL
-	return __do_syscall6(__NR_io_uring_enter, ld->ring_fd, to_submit,
+	return __do_syscall6(__NR_io_uring_enter, ld->enter_ring_fd, to_submit,
 				min_complete, flags, NULL, 0);
 #else
-	return syscall(__NR_io_uring_enter, ld->ring_fd, to_submit,
+	return syscall(__NR_io_uring_enter, ld->enter_ring_fd, to_submit,
 			min_complete, flags, NULL, 0);
 #endif
 }
 
+/*
+ * Describe the buffer of io_u as vec_seg_size pieces, the last one may be
+ * shorter. Returns the number of segments.
+ */
+static unsigned int fio_ioring_fill_segs(struct thread_data *td,
+					 struct io_u *io_u,
+					 struct iovec **iovp)
+{
+	struct ioring_data *ld = td->io_ops_data;
+	struct ioring_options *o = td->eo;
+	struct iovec *iov = &ld->seg_iovecs[io_u->index * ld->nr_segs];
+	unsigned long long left = io_u->xfer_buflen;
+	char *p = io_u->xfer_buf;
+	unsigned int nr = 0;
+
+	while (left) {
+		unsigned long long len = min(left,
+					(unsigned long long) o->vec_seg_size);
+
+		iov[nr].iov_base = p;
+		iov[nr].iov_len = len;
+		p += len;
+		left -= len;
+		nr++;
+	}
+
+	*iovp = iov;
+	return nr;
+}
+
+/*
+ * Whether the kernel picks the buffer for this read. The rest of a short
+ * read is read into the io_u's own buffer, after the part the completion
+ * copied there.
+ */
+static inline bool fio_ioring_pbuf_read(struct ioring_data *ld,
+					struct io_u *io_u)
+{
+	return ld->pbuf_ring && io_u->ddir == DDIR_READ &&
+		io_u->xfer_buflen == io_u->buflen;
+}
+
 static int fio_ioring_prep(struct thread_data *td, struct io_u *io_u)
 {
 	struct ioring_data *ld = td->io_ops_data;
@@ -321,7 +712,7 @@ static int fio_ioring_prep(struct thread_data *td, struct io_u *io_u)
 
 	sqe = &ld->sqes[io_u->index];
 
-	if (o->registerfiles) {
+	if (o->registerfiles && f->engine_pos != FIO_IORING_NO_SLOT) {
 		sqe->fd = f->engine_pos;
 		sqe->flags = IOSQE_FIXED_FILE;
 	} else {
@@ -330,11 +721,28 @@ static int fio_ioring_prep(struct thread_data *td, struct io_u *io_u)
 	}
 
 	if (io_u->ddir == DDIR_READ || io_u->ddir == DDIR_WRITE) {
-		if (o->fixedbufs) {
+		if (fio_ioring_pbuf_read(ld, io_u)) {
+			/*
+			 * The kernel picks the buffer, drop any ring buffer
+			 * a previous completion attached to this io_u.
+			 */
+			io_u->buf = ld->io_u_bufs[io_u->index];
+			sqe->opcode = IORING_OP_READ;
+			sqe->flags |= IOSQE_BUFFER_SELECT;
+			sqe->buf_group = FIO_IORING_PBUF_BGID;
+			sqe->addr = 0;
+			sqe->len = io_u->xfer_buflen;
+		} else if (o->fixedbufs) {
 			sqe->opcode = fixed_ddir_to_op[io_u->ddir];
 			sqe->addr = (unsigned long) io_u->xfer_buf;
 			sqe->len = io_u->xfer_buflen;
-			sqe->buf_index = io_u->index;
+			sqe->buf_index = ld->fixed_index[io_u->index];
+		} else if (ld->seg_iovecs) {
+			struct iovec *iov;
+
+			sqe->opcode = ddir_to_op[io_u->ddir][0];
+			sqe->len = fio_ioring_fill_segs(td, io_u, &iov);
+			sqe->addr = (unsigned long) iov;
 		} else {
 			struct iovec *iov = &ld->iovecs[io_u->index];
 
@@ -359,6 +767,8 @@ static int fio_ioring_prep(struct thread_data *td, struct io_u *io_u)
 			sqe->rw_flags |= RWF_UNCACHED;
 		if (o->nowait)
 			sqe->rw_flags |= RWF_NOWAIT;
+		if (td->o.oatomic && io_u->ddir == DDIR_WRITE)
+			sqe->rw_flags |= RWF_ATOMIC;
 
 		/*
 		 * Since io_uring can have a submission context (sqthread_poll)
@@ -387,6 +797,20 @@ static int fio_ioring_prep(struct thread_data *td, struct io_u *io_u)
 				sqe->fsync_flags |= IORING_FSYNC_DATASYNC;
 			sqe->opcode = IORING_OP_FSYNC;
 		}
+	} else if (io_u->ddir == DDIR_TRIM && ld->trim_op) {
+		sqe->opcode = ld->trim_op;
+		sqe->ioprio = 0;
+		sqe->rw_flags = 0;
+		sqe->buf_index = 0;
+		if (ld->trim_op == IORING_OP_FTRUNCATE) {
+			sqe->off = io_u->offset + io_u->xfer_buflen;
+			sqe->addr = 0;
+			sqe->len = 0;
+		} else {
+			sqe->off = io_u->offset;
+			sqe->addr = io_u->xfer_buflen;
+			sqe->len = ld->falloc_mode;
+		}
 	}
 
 	if (o->force_async && ++ld->prepped == o->force_async) {
@@ -405,6 +829,9 @@ static int fio_ioring_cmd_prep(struct thread_data *td, struct io_u *io_u)
 	struct fio_file *f = io_u->file;
 	struct nvme_uring_cmd *cmd;
 	struct io_uring_sqe *sqe;
+	struct nvme_data *data;
+	void *md_buf;
+	int ret;
 
 	/* only supports nvme_uring_cmd */
 	if (o->cmd_type != FIO_URING_CMD_NVME)
@@ -415,7 +842,7 @@ static int fio_ioring_cmd_prep(struct thread_data *td, struct io_u *io_u)
 
 	sqe = &ld->sqes[(io_u->index) << 1];
 
-	if (o->registerfiles) {
+	if (o->registerfiles && f->engine_pos != FIO_IORING_NO_SLOT) {
 		sqe->fd = f->engine_pos;
 		sqe->flags = IOSQE_FIXED_FILE;
 	} else {
@@ -439,105 +866,445 @@ static int fio_ioring_cmd_prep(struct thread_data *td, struct io_u *io_u)
 	}
 	if (o->fixedbufs) {
 		sqe->uring_cmd_flags = IORING_URING_CMD_FIXED;
-		sqe->buf_index = io_u->index;
+		sqe->buf_index = ld->fixed_index[io_u->index];
 	}
 
 	cmd = (struct nvme_uring_cmd *)sqe->cmd;
-	return fio_nvme_uring_cmd_prep(cmd, io_u,
-			o->nonvectored ? NULL : &ld->iovecs[io_u->index]);
+	md_buf = ld->md_buf ? ld->md_buf + io_u->index * o->md_per_io_size :
+			NULL;
+	ret = fio_nvme_uring_cmd_prep(cmd, io_u,
+			o->nonvectored ? NULL : &ld->iovecs[io_u->index],
+			md_buf, &ld->ext_opts);
+	if (ret)
+		return ret;
+
+	if (ld->seg_iovecs) {
+		struct iovec *iov;
+
+		cmd->data_len = fio_ioring_fill_segs(td, io_u, &iov);
+		cmd->addr = (__u64)(uintptr_t) iov;
+	}
+
+	/* with PRACT set, the controller generates the PI for us */
+	data = FILE_ENG_DATA(f);
+	if (io_u->ddir == DDIR_WRITE && data->pi_type && data->ms &&
+	    !o->pi_act)
+		fio_nvme_pi_fill(cmd, io_u, &ld->ext_opts);
+
+	return 0;
 }
 
-static struct io_u *fio_ioring_event(struct thread_data *td, int event)
+static unsigned int fio_ioring_hp_bucket(struct io_u *io_u)
 {
-	struct ioring_data *ld = td->io_ops_data;
-	struct io_uring_cqe *cqe;
-	struct io_u *io_u;
-	unsigned index;
+	unsigned int b = __fls(io_u->xfer_buflen);
 
-	index = (event + ld->cq_ring_off) & ld->cq_ring_mask;
+	return b < FIO_IORING_HP_BUCKETS ? b : FIO_IORING_HP_BUCKETS - 1;
+}
 
-	cqe = &ld->cq_ring.cqes[index];
-	io_u = (struct io_u *) (uintptr_t) cqe->user_data;
+/*
+ * Feed the completion latency of io_u into the average of its bucket. The
+ * completion time is when getevents found it, which is after any sleep, so
+ * sleeping for a fraction of the average keeps the average from creeping
+ * up on itself.
+ */
+static void fio_ioring_hybrid_update(struct ioring_data *ld,
+				     struct io_u *io_u)
+{
+	uint64_t *lat, nsec;
 
-	if (cqe->res != io_u->xfer_buflen) {
-		if (cqe->res > io_u->xfer_buflen)
-			io_u->error = -cqe->res;
-		else
-			io_u->resid = io_u->xfer_buflen - cqe->res;
-	} else
-		io_u->error = 0;
+	if (!ddir_rw(io_u->ddir))
+		return;
 
-	return io_u;
+	nsec = ntime_since(&io_u->issue_time, &ld->hp_reap_time);
+	lat = &ld->hp_lat[io_u->ddir][fio_ioring_hp_bucket(io_u)];
+	if (!*lat)
+		*lat = nsec;
+	else
+		*lat = (*lat * 7 + nsec) / 8;
 }
 
-static struct io_u *fio_ioring_cmd_event(struct thread_data *td, int event)
+/*
+ * Sleep until the first in-flight IO is hybrid_poll percent into its
+ * expected latency, less what nanosleep() tends to overshoot by. Until
+ * every in-flight bucket has seen a completion, just poll.
+ */
+static void fio_ioring_hybrid_sleep(struct thread_data *td)
 {
 	struct ioring_data *ld = td->io_ops_data;
 	struct ioring_options *o = td->eo;
-	struct io_uring_cqe *cqe;
-	struct io_u *io_u;
-	unsigned index;
+	uint64_t wait = -1ULL, slept;
+	struct timespec now, ts;
+	int i;
 
-	index = (event + ld->cq_ring_off) & ld->cq_ring_mask;
-	if (o->cmd_type == FIO_URING_CMD_NVME)
-		index <<= 1;
+	fio_gettime(&now, NULL);
+	for (i = 0; i < td->o.iodepth; i++) {
+		struct io_u *io_u = ld->io_u_index[i];
+		uint64_t lat, elapsed;
 
-	cqe = &ld->cq_ring.cqes[index];
-	io_u = (struct io_u *) (uintptr_t) cqe->user_data;
+		if (!io_u || !(io_u->flags & IO_U_F_FLIGHT) ||
+		    !ddir_rw(io_u->ddir))
+			continue;
 
-	if (cqe->res != 0)
-		io_u->error = -cqe->res;
-	else
-		io_u->error = 0;
+		lat = ld->hp_lat[io_u->ddir][fio_ioring_hp_bucket(io_u)];
+		if (!lat)
+			return;
 
-	return io_u;
+		lat = lat * o->hybrid_poll / 100;
+		elapsed = ntime_since(&io_u->issue_time, &now);
+		if (elapsed >= lat)
+			return;
+		wait = min(wait, lat - elapsed);
+	}
+
+	if (wait == -1ULL || wait < ld->hp_oversleep + FIO_IORING_HP_MIN_SLEEP)
+		return;
+
+	wait -= ld->hp_oversleep;
+	ts.tv_sec = wait / 1000000000ULL;
+	ts.tv_nsec = wait % 1000000000ULL;
+	nanosleep(&ts, NULL);
+
+	slept = ntime_since_now(&now);
+	ld->hp_sleeps++;
+	ld->hp_slept_ns += slept;
+	ld->hp_oversleep = (ld->hp_oversleep * 7 +
+			    (slept > wait ? slept - wait : 0)) / 8;
 }
 
-static int fio_ioring_cqring_reap(struct thread_data *td, unsigned int events,
-				   unsigned int max)
+/*
+ * Push the chain first..last onto the lockless stack at 'head'.
+ */
+static void fio_ioring_shared_push(struct ioring_shared_req **head,
+				   struct ioring_shared_req *first,
+				   struct ioring_shared_req *last)
 {
-	struct ioring_data *ld = td->io_ops_data;
-	struct io_cq_ring *ring = &ld->cq_ring;
-	unsigned head, reaped = 0;
+	struct ioring_shared_req *old = __atomic_load_n(head, __ATOMIC_RELAXED);
 
-	head = *ring->head;
 	do {
-		if (head == atomic_load_acquire(ring->tail))
-			break;
-		reaped++;
-		head++;
-	} while (reaped + events < max);
+		last->next = old;
+	} while (!__atomic_compare_exchange_n(head, &old, first, true,
+					      __ATOMIC_SEQ_CST,
+					      __ATOMIC_RELAXED));
+}
 
-	if (reaped)
-		atomic_store_release(ring->head, head);
+/*
+ * Take everything off the stack at 'head', oldest first.
+ */
+static struct ioring_shared_req *
+fio_ioring_shared_pop_all(struct ioring_shared_req **head)
+{
+	struct ioring_shared_req *req, *next, *list = NULL;
+
+	req = __atomic_exchange_n(head, NULL, __ATOMIC_ACQUIRE);
+	while (req) {
+		next = req->next;
+		req->next = list;
+		list = req;
+		req = next;
+	}
 
-	return reaped;
+	return list;
 }
 
-static int fio_ioring_getevents(struct thread_data *td, unsigned int min,
-				unsigned int max, const struct timespec *t)
+/*
+ * Wake whoever sleeps on 'efd' if it flagged itself as sleeping. The
+ * sleeper sets the flag before checking its queue a last time, so either
+ * it sees our push or we see the flag.
+ */
+static void fio_ioring_shared_wake(int *sleeping, int efd)
+{
+	uint64_t val = 1;
+
+	if (__atomic_exchange_n(sleeping, 0, __ATOMIC_SEQ_CST)) {
+		if (write(efd, &val, sizeof(val)) < 0)
+			log_err("fio: io_uring shared ring wakeup: %s\n",
+				strerror(errno));
+	}
+}
+
+static enum fio_q_status fio_ioring_shared_queue(struct thread_data *td,
+						 struct io_u *io_u)
 {
 	struct ioring_data *ld = td->io_ops_data;
-	unsigned actual_min = td->o.iodepth_batch_complete_min == 0 ? 0 : min;
-	struct ioring_options *o = td->eo;
-	struct io_cq_ring *ring = &ld->cq_ring;
-	unsigned events = 0;
-	int r;
+	struct ioring_shared_req *req = &ld->sh_reqs[io_u->index];
 
-	ld->cq_ring_off = *ring->head;
-	do {
-		r = fio_ioring_cqring_reap(td, events, max);
-		if (r) {
-			events += r;
-			if (actual_min != 0)
-				actual_min -= r;
-			continue;
-		}
+	if (ld->queued == ld->iodepth)
+		return FIO_Q_BUSY;
 
-		if (!o->sqpoll_thread) {
-			r = io_uring_enter(ld, 0, actual_min,
-						IORING_ENTER_GETEVENTS);
-			if (r < 0) {
+	req->ld = ld;
+	req->io_u = io_u;
+	req->next = ld->sh_batch;
+	if (!ld->sh_batch)
+		ld->sh_batch_last = req;
+	ld->sh_batch = req;
+	ld->queued++;
+	return FIO_Q_QUEUED;
+}
+
+static int fio_ioring_shared_commit(struct thread_data *td)
+{
+	struct ioring_data *ld = td->io_ops_data;
+	struct ioring_shared *sh = ld->shared;
+	struct ioring_shared_req *req;
+
+	if (!ld->queued)
+		return 0;
+
+	if (fio_fill_issue_time(td)) {
+		struct timespec now;
+
+		fio_gettime(&now, NULL);
+		for (req = ld->sh_batch; req; req = req->next) {
+			memcpy(&req->io_u->issue_time, &now, sizeof(now));
+			io_u_queued(td, req->io_u);
+		}
+	}
+
+	fio_ioring_shared_push(&sh->subq, ld->sh_batch, ld->sh_batch_last);
+	fio_ioring_shared_wake(&sh->sleeping, sh->efd);
+
+	io_u_mark_submit(td, ld->queued);
+	ld->sh_inflight += ld->queued;
+	ld->sh_batch = NULL;
+	ld->queued = 0;
+	return 0;
+}
+
+static int fio_ioring_shared_getevents(struct thread_data *td,
+				       unsigned int min, unsigned int max)
+{
+	struct ioring_data *ld = td->io_ops_data;
+	struct ioring_shared_req *req;
+	unsigned int events = 0;
+	uint64_t val;
+
+	do {
+		req = fio_ioring_shared_pop_all(&ld->sh_done);
+		if (req) {
+			struct ioring_shared_req **pp = &ld->sh_pending;
+
+			while (*pp)
+				pp = &(*pp)->next;
+			*pp = req;
+		}
+
+		while (ld->sh_pending && events < max) {
+			ld->sh_events[events++] = ld->sh_pending;
+			ld->sh_pending = ld->sh_pending->next;
+		}
+		if (events >= min)
+			break;
+
+		__atomic_store_n(&ld->sh_sleeping, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&ld->sh_done, __ATOMIC_SEQ_CST)) {
+			__atomic_store_n(&ld->sh_sleeping, 0, __ATOMIC_RELAXED);
+			continue;
+		}
+		if (read(ld->sh_efd, &val, sizeof(val)) < 0 && errno != EINTR) {
+			td_verror(td, errno, "io_uring shared ring wait");
+			return -errno;
+		}
+	} while (1);
+
+	ld->sh_inflight -= events;
+	return events;
+}
+
+static struct io_u *fio_ioring_shared_event(struct thread_data *td, int event)
+{
+	struct ioring_data *ld = td->io_ops_data;
+	struct ioring_shared_req *req = ld->sh_events[event];
+	struct io_u *io_u = req->io_u;
+
+	if (req->res != io_u->xfer_buflen) {
+		if (req->res > io_u->xfer_buflen)
+			io_u->error = -req->res;
+		else
+			io_u->resid = io_u->xfer_buflen - req->res;
+	} else
+		io_u->error = 0;
+
+	return io_u;
+}
+
+static struct io_u *fio_ioring_event(struct thread_data *td, int event)
+{
+	struct ioring_data *ld = td->io_ops_data;
+	struct io_uring_cqe *cqe;
+	struct io_u *io_u;
+	unsigned index;
+
+	if (ld->shared)
+		return fio_ioring_shared_event(td, event);
+
+	index = (event + ld->cq_ring_off) & ld->cq_ring_mask;
+
+	cqe = &ld->cq_ring.cqes[index];
+	io_u = (struct io_u *) (uintptr_t) cqe->user_data;
+
+	if (ld->hybrid)
+		fio_ioring_hybrid_update(ld, io_u);
+
+	if (fio_ioring_pbuf_read(ld, io_u)) {
+		ld->pbuf_inflight--;
+		if (cqe->flags & IORING_CQE_F_BUFFER) {
+			unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+			io_u->buf = ld->pbuf_mem + bid * ld->pbuf_bs;
+			io_u->xfer_buf = io_u->buf;
+			ld->pbuf_pending[ld->pbuf_nr_pending++] = bid;
+
+			/*
+			 * The ring buffer goes back to the kernel, move the
+			 * part of a short read to where the rest is read to
+			 */
+			if (cqe->res > 0 && cqe->res < io_u->xfer_buflen) {
+				io_u->buf = ld->io_u_bufs[io_u->index];
+				memcpy(io_u->buf, io_u->xfer_buf, cqe->res);
+				io_u->xfer_buf = io_u->buf;
+			}
+		}
+	}
+
+	/* fallocate and ftruncate return 0 rather than the length */
+	if (io_u->ddir == DDIR_TRIM) {
+		io_u->error = cqe->res < 0 ? -cqe->res : 0;
+		return io_u;
+	}
+
+	if (cqe->res != io_u->xfer_buflen) {
+		if (cqe->res > io_u->xfer_buflen)
+			io_u->error = -cqe->res;
+		else
+			io_u->resid = io_u->xfer_buflen - cqe->res;
+	} else
+		io_u->error = 0;
+
+	return io_u;
+}
+
+static struct io_u *fio_ioring_cmd_event(struct thread_data *td, int event)
+{
+	struct ioring_data *ld = td->io_ops_data;
+	struct ioring_options *o = td->eo;
+	struct io_uring_cqe *cqe;
+	struct io_u *io_u;
+	unsigned index;
+
+	index = (event + ld->cq_ring_off) & ld->cq_ring_mask;
+	if (o->cmd_type == FIO_URING_CMD_NVME)
+		index <<= 1;
+
+	cqe = &ld->cq_ring.cqes[index];
+	io_u = (struct io_u *) (uintptr_t) cqe->user_data;
+
+	if (ld->hybrid)
+		fio_ioring_hybrid_update(ld, io_u);
+
+	if (cqe->res != 0) {
+		io_u->error = -cqe->res;
+		return io_u;
+	}
+
+	io_u->error = 0;
+
+	/* the result of a zone append is the LBA the data went to */
+	if (o->cmd_type == FIO_URING_CMD_NVME &&
+	    (io_u->flags & IO_U_F_ZONE_APPEND))
+		fio_nvme_zone_append_done(io_u, cqe->big_cqe[0]);
+
+	/* check the protection information inline on reads */
+	if (o->cmd_type == FIO_URING_CMD_NVME && io_u->ddir == DDIR_READ &&
+	    (ld->ext_opts.io_flags & NVME_IO_PRINFO_PRCHK_MASK)) {
+		struct nvme_data *data = FILE_ENG_DATA(io_u->file);
+
+		if (data->pi_type && data->ms) {
+			struct nvme_uring_cmd *cmd;
+
+			cmd = (struct nvme_uring_cmd *)
+				ld->sqes[io_u->index << 1].cmd;
+			io_u->error = fio_nvme_pi_verify(data, io_u, cmd,
+							 &ld->ext_opts);
+		}
+	}
+
+	return io_u;
+}
+
+static int fio_ioring_cqring_reap(struct thread_data *td, unsigned int events,
+				   unsigned int max)
+{
+	struct ioring_data *ld = td->io_ops_data;
+	struct io_cq_ring *ring = &ld->cq_ring;
+	unsigned head, reaped = 0;
+
+	head = *ring->head;
+	do {
+		if (head == atomic_load_acquire(ring->tail))
+			break;
+		reaped++;
+		head++;
+	} while (reaped + events < max);
+
+	if (reaped)
+		atomic_store_release(ring->head, head);
+
+	return reaped;
+}
+
+/*
+ * With TASKRUN_FLAG, the kernel sets IORING_SQ_TASKRUN whenever completions
+ * are waiting for us to enter the kernel and run task work. If it isn't set,
+ * there is nothing for io_uring_enter() to flush into the CQ ring. Polled
+ * rings find their completions in io_uring_enter() itself.
+ */
+static bool fio_ioring_taskrun_idle(struct ioring_data *ld)
+{
+	if (!(ld->setup_flags & IORING_SETUP_TASKRUN_FLAG) ||
+	    (ld->setup_flags & IORING_SETUP_IOPOLL))
+		return false;
+
+	return !(atomic_load_acquire(ld->sq_ring.flags) & IORING_SQ_TASKRUN);
+}
+
+static int fio_ioring_getevents(struct thread_data *td, unsigned int min,
+				unsigned int max, const struct timespec *t)
+{
+	struct ioring_data *ld = td->io_ops_data;
+	unsigned actual_min = td->o.iodepth_batch_complete_min == 0 ? 0 : min;
+	struct ioring_options *o = td->eo;
+	struct io_cq_ring *ring = &ld->cq_ring;
+	unsigned events = 0;
+	int r;
+
+	if (ld->shared)
+		return fio_ioring_shared_getevents(td, min, max);
+
+	ld->cq_ring_off = *ring->head;
+	if (ld->hybrid && min &&
+	    ld->cq_ring_off == atomic_load_acquire(ring->tail))
+		fio_ioring_hybrid_sleep(td);
+
+	do {
+		r = fio_ioring_cqring_reap(td, events, max);
+		if (r) {
+			events += r;
+			if (actual_min != 0)
+				actual_min -= r;
+			continue;
+		}
+
+		if (!o->sqpoll_thread) {
+			/*
+			 * Nothing to wait for and no task work pending, the
+			 * syscall would just return.
+			 */
+			if (!actual_min && fio_ioring_taskrun_idle(ld))
+				continue;
+
+			r = io_uring_enter(ld, 0, actual_min,
+						IORING_ENTER_GETEVENTS);
+			if (r < 0) {
 				if (errno == EAGAIN || errno == EINTR)
 					continue;
 				r = -errno;
@@ -547,9 +1314,25 @@ static int fio_ioring_getevents(struct thread_data *td, unsigned int min,
 		}
 	} while (events < min);
 
+	if (ld->hybrid && events)
+		fio_gettime(&ld->hp_reap_time, NULL);
+
 	return r < 0 ? r : events;
 }
 
+static int fio_ioring_reap_batch(struct thread_data *td, struct io_u **io_us,
+				 unsigned int min, unsigned int max,
+				 const struct timespec *t)
+{
+	int i, r;
+
+	r = fio_ioring_getevents(td, min, max, t);
+	for (i = 0; i < r; i++)
+		io_us[i] = fio_ioring_event(td, i);
+
+	return r;
+}
+
 static inline void fio_ioring_cmdprio_prep(struct thread_data *td,
 					   struct io_u *io_u)
 {
@@ -560,6 +1343,66 @@ static inline void fio_ioring_cmdprio_prep(struct thread_data *td,
 		ld->sqes[io_u->index].ioprio = io_u->ioprio;
 }
 
+static void fio_ioring_pbuf_add(struct ioring_data *ld, unsigned short bid)
+{
+	struct io_uring_buf *buf;
+
+	buf = &ld->pbuf_ring->bufs[ld->pbuf_tail & ld->pbuf_mask];
+	buf->addr = (unsigned long) (ld->pbuf_mem + bid * ld->pbuf_bs);
+	buf->len = ld->pbuf_bs;
+	buf->bid = bid;
+	ld->pbuf_tail++;
+}
+
+/*
+ * Hand buffers of completed reads back to the kernel. This is only called
+ * from the queue path, at which point the previous batch of completions has
+ * been fully processed (including verification) and nobody looks at the
+ * buffer contents anymore.
+ */
+static void fio_ioring_pbuf_recycle(struct ioring_data *ld)
+{
+	unsigned i;
+
+	if (!ld->pbuf_nr_pending)
+		return;
+
+	for (i = 0; i < ld->pbuf_nr_pending; i++)
+		fio_ioring_pbuf_add(ld, ld->pbuf_pending[i]);
+
+	atomic_store_release(&ld->pbuf_ring->tail, ld->pbuf_tail);
+	ld->pbuf_nr_pending = 0;
+}
+
+/*
+ * Link the not yet submitted writes queued since the last sync to the sync
+ * that is about to be queued, so the whole batch goes out as one
+ * IOSQE_IO_LINK chain and the sync is ordered after the writes it covers.
+ * Writes that were already submitted, as they all are with the default
+ * iodepth_batch_submit=1, can't join the chain anymore. Drain those with
+ * IOSQE_IO_DRAIN on the sync instead.
+ */
+static void fio_ioring_link_sync(struct thread_data *td, struct io_u *io_u,
+				 unsigned tail)
+{
+	struct ioring_data *ld = td->io_ops_data;
+	struct io_sq_ring *ring = &ld->sq_ring;
+	int i;
+
+	if (td->io_u_in_flight)
+		ld->sqes[io_u->index].flags |= IOSQE_IO_DRAIN;
+
+	for (i = 0; i < ld->queued; i++) {
+		unsigned index = ring->array[(tail - 1 - i) & ld->sq_ring_mask];
+		struct io_u *io_u = ld->io_u_index[index];
+
+		if (ddir_sync(io_u->ddir))
+			break;
+
+		ld->sqes[index].flags |= IOSQE_IO_LINK;
+	}
+}
+
 static int fio_ioring_cmd_io_u_trim(const struct thread_data *td,
 				    struct io_u *io_u)
 {
@@ -574,7 +1417,7 @@ static int fio_ioring_cmd_io_u_trim(const struct thread_data *td,
 			goto err;
 	}
 
-	return fio_nvme_trim(td, f, io_u->offset, io_u->xfer_buflen);
+	return fio_nvme_trim(td, f, io_u);
 
 err:
 	io_u->error = ret;
@@ -585,6 +1428,7 @@ static enum fio_q_status fio_ioring_queue(struct thread_data *td,
 					  struct io_u *io_u)
 {
 	struct ioring_data *ld = td->io_ops_data;
+	struct ioring_options *o = td->eo;
 	struct io_sq_ring *ring = &ld->sq_ring;
 	unsigned tail, next_tail;
 
@@ -593,7 +1437,8 @@ static enum fio_q_status fio_ioring_queue(struct thread_data *td,
 	if (ld->queued == ld->iodepth)
 		return FIO_Q_BUSY;
 
-	if (io_u->ddir == DDIR_TRIM) {
+	if (io_u->ddir == DDIR_TRIM &&
+	    (!ld->trim_op || ld->shared || io_u->nr_trim_ranges)) {
 		if (ld->queued)
 			return FIO_Q_BUSY;
 
@@ -607,14 +1452,32 @@ static enum fio_q_status fio_ioring_queue(struct thread_data *td,
 		return FIO_Q_COMPLETED;
 	}
 
+	if (ld->shared)
+		return fio_ioring_shared_queue(td, io_u);
+
 	tail = *ring->tail;
 	next_tail = tail + 1;
 	if (next_tail == atomic_load_acquire(ring->head))
 		return FIO_Q_BUSY;
 
-	if (ld->cmdprio.mode != CMDPRIO_MODE_NONE)
+	/*
+	 * Never have more reads in flight than we have ring buffers, the
+	 * kernel would fail the excess with -ENOBUFS.
+	 */
+	if (fio_ioring_pbuf_read(ld, io_u)) {
+		fio_ioring_pbuf_recycle(ld);
+		if (ld->pbuf_inflight == ld->pbuf_entries)
+			return FIO_Q_BUSY;
+		ld->pbuf_inflight++;
+	}
+
+	/* the kernel fails a priority on fallocate and ftruncate */
+	if (ld->cmdprio.mode != CMDPRIO_MODE_NONE && io_u->ddir != DDIR_TRIM)
 		fio_ioring_cmdprio_prep(td, io_u);
 
+	if (o->linked_sync && ddir_sync(io_u->ddir))
+		fio_ioring_link_sync(td, io_u, tail);
+
 	ring->array[tail & ld->sq_ring_mask] = io_u->index;
 	atomic_store_release(ring->tail, next_tail);
 
@@ -622,12 +1485,41 @@ static enum fio_q_status fio_ioring_queue(struct thread_data *td,
 	return FIO_Q_QUEUED;
 }
 
+/*
+ * Reads and writes only, their SQEs were set up by ->prep(). The core never
+ * hands us more than the ring has room for.
+ */
+static void fio_ioring_queue_batch(struct thread_data *td,
+				   struct io_u **io_us, unsigned int nr)
+{
+	struct ioring_data *ld = td->io_ops_data;
+	struct io_sq_ring *ring = &ld->sq_ring;
+	unsigned tail = *ring->tail;
+	unsigned int i;
+
+	for (i = 0; i < nr; i++) {
+		struct io_u *io_u = io_us[i];
+
+		fio_ro_check(td, io_u);
+
+		if (ld->cmdprio.mode != CMDPRIO_MODE_NONE)
+			fio_ioring_cmdprio_prep(td, io_u);
+
+		ring->array[tail++ & ld->sq_ring_mask] = io_u->index;
+	}
+
+	atomic_store_release(ring->tail, tail);
+	ld->queued += nr;
+}
+
 static void fio_ioring_queued(struct thread_data *td, int start, int nr)
 {
 	struct ioring_data *ld = td->io_ops_data;
+	bool fill = fio_fill_issue_time(td);
 	struct timespec now;
 
-	if (!fio_fill_issue_time(td))
+	/* hybrid polling needs the issue time, even without latency stats */
+	if (!fill && !ld->hybrid)
 		return;
 
 	fio_gettime(&now, NULL);
@@ -638,7 +1530,8 @@ static void fio_ioring_queued(struct thread_data *td, int start, int nr)
 		struct io_u *io_u = ld->io_u_index[index];
 
 		memcpy(&io_u->issue_time, &now, sizeof(now));
-		io_u_queued(td, io_u);
+		if (fill)
+			io_u_queued(td, io_u);
 
 		start++;
 	}
@@ -654,10 +1547,13 @@ static int fio_ioring_commit(struct thread_data *td)
 {
 	struct ioring_data *ld = td->io_ops_data;
 	struct ioring_options *o = td->eo;
+	unsigned enter_flags = IORING_ENTER_GETEVENTS;
 	int ret;
 
 	if (!ld->queued)
 		return 0;
+	if (ld->shared)
+		return fio_ioring_shared_commit(td);
 
 	/*
 	 * Kernel side does submission. just need to check if the ring is
@@ -680,11 +1576,19 @@ static int fio_ioring_commit(struct thread_data *td)
 		return 0;
 	}
 
+	/*
+	 * With DEFER_TASKRUN, GETEVENTS would run the deferred task work
+	 * here as well. Leave that to fio_ioring_getevents(), so completions
+	 * are only processed when we reap.
+	 */
+	if (ld->setup_flags & IORING_SETUP_DEFER_TASKRUN)
+		enter_flags = 0;
+
 	do {
 		unsigned start = *ld->sq_ring.head;
 		long nr = ld->queued;
 
-		ret = io_uring_enter(ld, nr, 0, IORING_ENTER_GETEVENTS);
+		ret = io_uring_enter(ld, nr, 0, enter_flags);
 		if (ret > 0) {
 			fio_ioring_queued(td, start, ret);
 			io_u_mark_submit(td, ret);
@@ -699,6 +1603,16 @@ static int fio_ioring_commit(struct thread_data *td)
 				ret = fio_ioring_cqring_reap(td, 0, ld->queued);
 				if (ret)
 					continue;
+				/*
+				 * Deferred completions only show up once we
+				 * run the task work, do that rather than
+				 * wait for a CQE that can't arrive.
+				 */
+				if (!enter_flags) {
+					io_uring_enter(ld, 0, 0,
+						       IORING_ENTER_GETEVENTS);
+					continue;
+				}
 				/* Shouldn't happen */
 				usleep(1);
 				continue;
@@ -712,6 +1626,296 @@ static int fio_ioring_commit(struct thread_data *td)
 	return ret;
 }
 
+/*
+ * Jobs in the same group that set sqthread_poll_shared attach their rings to
+ * the SQPOLL thread of the first ring created in that group. The group keeps
+ * a dup of that ring fd, so it stays valid until the last job is done.
+ */
+struct ioring_sqpoll_group {
+	struct flist_head list;
+	unsigned int groupid;
+	int wq_fd;
+	int refs;
+};
+
+static FLIST_HEAD(sqpoll_groups);
+static pthread_mutex_t sqpoll_groups_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct ioring_sqpoll_group *fio_ioring_sqpoll_group(unsigned int groupid)
+{
+	struct flist_head *entry;
+
+	flist_for_each(entry, &sqpoll_groups) {
+		struct ioring_sqpoll_group *grp;
+
+		grp = flist_entry(entry, struct ioring_sqpoll_group, list);
+		if (grp->groupid == groupid)
+			return grp;
+	}
+
+	return NULL;
+}
+
+static int fio_ioring_sqpoll_group_get(struct thread_data *td,
+				       struct ioring_sqpoll_group *grp,
+				       int ring_fd)
+{
+	struct ioring_data *ld = td->io_ops_data;
+
+	if (!grp) {
+		int fd = dup(ring_fd);
+
+		if (fd < 0)
+			return 1;
+
+		grp = malloc(sizeof(*grp));
+		if (!grp) {
+			close(fd);
+			errno = ENOMEM;
+			return 1;
+		}
+		grp->groupid = td->groupid;
+		grp->wq_fd = fd;
+		grp->refs = 0;
+		flist_add_tail(&grp->list, &sqpoll_groups);
+	}
+
+	grp->refs++;
+	ld->sqpoll_group = grp;
+	return 0;
+}
+
+static void fio_ioring_sqpoll_group_put(struct ioring_data *ld)
+{
+	struct ioring_sqpoll_group *grp = ld->sqpoll_group;
+
+	if (!grp)
+		return;
+
+	pthread_mutex_lock(&sqpoll_groups_lock);
+	if (!--grp->refs) {
+		flist_del(&grp->list);
+		close(grp->wq_fd);
+		free(grp);
+	}
+	pthread_mutex_unlock(&sqpoll_groups_lock);
+	ld->sqpoll_group = NULL;
+}
+
+/*
+ * With fixedbufs, the io_u buffers are registered as a few buffers of up
+ * to the 1GiB the kernel takes rather than one per io_u, which spares the
+ * kernel going over every page again for each io_u sharing a huge page.
+ * Jobs whose buffers are the same memory, with shared_read_buffers, share
+ * the registered table too, so the pages are only pinned once. The first
+ * one registers it on a ring that only holds the buffers and they all
+ * clone it from there, a ring set up for a single issuer can't be cloned
+ * from by other threads.
+ */
+#define FIO_IORING_FIXED_MAX	(1ULL << 30)
+
+struct ioring_fixed_table {
+	struct flist_head list;
+	char *base;
+	int ring_fd;
+	int refs;
+	unsigned int nr;
+	struct iovec iov[];
+};
+
+static FLIST_HEAD(fixed_tables);
+static pthread_mutex_t fixed_tables_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int fio_ioring_fixed_find(struct iovec *iov, unsigned int nr,
+				 char *buf, unsigned long long len)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr; i++) {
+		char *start = iov[i].iov_base;
+
+		if (buf >= start && buf + len <= start + iov[i].iov_len)
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+ * Cover the io_u buffers with as few registered buffers as we can. They
+ * come out of one area in order, so each one mostly extends the last.
+ */
+static unsigned int fio_ioring_fixed_build(struct thread_data *td,
+					   struct iovec *iov)
+{
+	struct ioring_data *ld = td->io_ops_data;
+	unsigned long long len = td_max_bs(td);
+	unsigned int i, nr = 0;
+
+	for (i = 0; i < td->o.iodepth; i++) {
+		char *buf = ld->io_u_index[i]->buf;
+		int idx = fio_ioring_fixed_find(iov, nr, buf, len);
+
+		if (idx < 0 && nr) {
+			char *last = iov[nr - 1].iov_base;
+
+			if (buf >= last &&
+			    buf + len - last <= FIO_IORING_FIXED_MAX) {
+				iov[nr - 1].iov_len = buf + len - last;
+				idx = nr - 1;
+			}
+		}
+		if (idx < 0) {
+			iov[nr].iov_base = buf;
+			iov[nr].iov_len = len;
+			idx = nr++;
+		}
+		ld->fixed_index[i] = idx;
+	}
+
+	return nr;
+}
+
+static struct ioring_fixed_table *fio_ioring_fixed_table(char *base)
+{
+	struct flist_head *entry;
+
+	flist_for_each(entry, &fixed_tables) {
+		struct ioring_fixed_table *t;
+
+		t = flist_entry(entry, struct ioring_fixed_table, list);
+		if (t->base == base)
+			return t;
+	}
+
+	return NULL;
+}
+
+static void fio_ioring_fixed_free(struct ioring_fixed_table *t)
+{
+	flist_del(&t->list);
+	close(t->ring_fd);
+	free(t);
+}
+
+static int fio_ioring_fixed_clone(struct thread_data *td,
+				  struct ioring_fixed_table *t)
+{
+	struct ioring_data *ld = td->io_ops_data;
+	struct io_uring_clone_buffers arg = { .src_fd = t->ring_fd, };
+	unsigned long long len = td_max_bs(td);
+	unsigned int i;
+	int idx;
+
+	for (i = 0; i < td->o.iodepth; i++) {
+		idx = fio_ioring_fixed_find(t->iov, t->nr,
+					    ld->io_u_index[i]->buf, len);
+		if (idx < 0)
+			return 1;
+		ld->fixed_index[i] = idx;
+	}
+
+	if (syscall(__NR_io_uring_register, ld->ring_fd,
+		    IORING_REGISTER_CLONE_BUFFERS, &arg, 1) < 0) {
+		dprint(FD_IO, "io_uring: clone buffers: %s\n", strerror(errno));
+		return 1;
+	}
+
+	t->refs++;
+	ld->fixed_table = t;
+	return 0;
+}
+
+static struct ioring_fixed_table *
+fio_ioring_fixed_publish(struct thread_data *td, struct iovec *iov)
+{
+	struct ioring_fixed_table *t;
+	struct io_uring_params p;
+	unsigned int nr;
+
+	nr = fio_ioring_fixed_build(td, iov);
+	t = malloc(sizeof(*t) + nr * sizeof(*iov));
+	if (!t)
+		return NULL;
+
+	memset(&p, 0, sizeof(p));
+	t->ring_fd = syscall(__NR_io_uring_setup, 1, &p);
+	if (t->ring_fd < 0) {
+		free(t);
+		return NULL;
+	}
+	if (syscall(__NR_io_uring_register, t->ring_fd,
+		    IORING_REGISTER_BUFFERS, iov, nr) < 0) {
+		close(t->ring_fd);
+		free(t);
+		return NULL;
+	}
+
+	dprint(FD_IO, "io_uring: shared buffers %p registered as %u\n",
+						td->orig_buffer, nr);
+	t->base = td->orig_buffer;
+	t->refs = 0;
+	t->nr = nr;
+	memcpy(t->iov, iov, nr * sizeof(*iov));
+	flist_add_tail(&t->list, &fixed_tables);
+	return t;
+}
+
+static int fio_ioring_register_fixed(struct thread_data *td)
+{
+	struct ioring_data *ld = td->io_ops_data;
+	bool share = td->shared_read_region != NULL;
+	struct ioring_fixed_table *t;
+	struct iovec *iov;
+	unsigned int nr;
+	int ret = 0;
+
+	ld->fixed_index = calloc(td->o.iodepth, sizeof(unsigned short));
+	iov = calloc(td->o.iodepth, sizeof(*iov));
+	if (!ld->fixed_index || !iov) {
+		free(iov);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if (share) {
+		pthread_mutex_lock(&fixed_tables_lock);
+		t = fio_ioring_fixed_table(td->orig_buffer);
+		if (!t)
+			t = fio_ioring_fixed_publish(td, iov);
+		if (t && fio_ioring_fixed_clone(td, t) && !t->refs) {
+			fio_ioring_fixed_free(t);
+			t = NULL;
+		}
+		pthread_mutex_unlock(&fixed_tables_lock);
+		if (ld->fixed_table)
+			goto out;
+	}
+
+	nr = fio_ioring_fixed_build(td, iov);
+	dprint(FD_IO, "io_uring: %u io_u buffers registered as %u\n",
+						td->o.iodepth, nr);
+	ret = syscall(__NR_io_uring_register, ld->ring_fd,
+			IORING_REGISTER_BUFFERS, iov, nr);
+out:
+	free(iov);
+	return ret;
+}
+
+static void fio_ioring_fixed_put(struct ioring_data *ld)
+{
+	struct ioring_fixed_table *t = ld->fixed_table;
+
+	if (!t)
+		return;
+
+	pthread_mutex_lock(&fixed_tables_lock);
+	if (!--t->refs)
+		fio_ioring_fixed_free(t);
+	pthread_mutex_unlock(&fixed_tables_lock);
+	ld->fixed_table = NULL;
+}
+
 static void fio_ioring_unmap(struct ioring_data *ld)
 {
 	int i;
@@ -721,18 +1925,233 @@ static void fio_ioring_unmap(struct ioring_data *ld)
 	close(ld->ring_fd);
 }
 
+static FLIST_HEAD(shared_rings);
+static pthread_mutex_t shared_rings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void fio_ioring_shared_arm_wakeup(struct ioring_shared *sh)
+{
+	struct ioring_data *ring = &sh->ring;
+	unsigned tail = *ring->sq_ring.tail;
+	struct io_uring_sqe *sqe = &ring->sqes[tail & ring->sq_ring_mask];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = sh->efd;
+	sqe->addr = (unsigned long) &sh->efd_val;
+	sqe->len = sizeof(sh->efd_val);
+	sqe->user_data = 0;
+	atomic_store_release(ring->sq_ring.tail, tail + 1);
+}
+
+/*
+ * Copy as many queued requests into the SQ ring as it and the CQ ring have
+ * room for. Returns the number of new SQEs.
+ */
+static unsigned fio_ioring_shared_fill(struct ioring_shared *sh)
+{
+	struct ioring_data *ring = &sh->ring;
+	struct io_sq_ring *sq = &ring->sq_ring;
+	struct ioring_shared_req *req;
+	unsigned tail = *sq->tail, head, nr = 0;
+
+	req = fio_ioring_shared_pop_all(&sh->subq);
+	if (req) {
+		if (sh->backlog)
+			sh->backlog_tail->next = req;
+		else
+			sh->backlog = req;
+		while (req->next)
+			req = req->next;
+		sh->backlog_tail = req;
+	}
+
+	head = atomic_load_acquire(sq->head);
+	/* one SQE and one CQE are reserved for the wakeup read */
+	while ((req = sh->backlog) != NULL &&
+	       tail - head + 1 < *sq->ring_entries &&
+	       sh->inflight + 1 < sh->cq_entries) {
+		struct io_uring_sqe *sqe = &ring->sqes[tail & ring->sq_ring_mask];
+
+		*sqe = req->ld->sqes[req->io_u->index];
+		sqe->user_data = (unsigned long) req;
+		sh->backlog = req->next;
+		sh->inflight++;
+		tail++;
+		nr++;
+	}
+
+	if (nr)
+		atomic_store_release(sq->tail, tail);
+	return nr;
+}
+
+/*
+ * Hand completions back to the jobs. Returns the number of CQEs seen.
+ */
+static unsigned fio_ioring_shared_reap(struct ioring_shared *sh)
+{
+	struct ioring_data *ring = &sh->ring;
+	struct io_cq_ring *cq = &ring->cq_ring;
+	unsigned head = *cq->head, nr = 0;
+
+	while (head != atomic_load_acquire(cq->tail)) {
+		struct io_uring_cqe *cqe = &cq->cqes[head & ring->cq_ring_mask];
+		struct ioring_shared_req *req;
+
+		req = (struct ioring_shared_req *) (uintptr_t) cqe->user_data;
+		if (!req)
+			fio_ioring_shared_arm_wakeup(sh);
+		else {
+			req->res = cqe->res;
+			sh->inflight--;
+			fio_ioring_shared_push(&req->ld->sh_done, req, req);
+			fio_ioring_shared_wake(&req->ld->sh_sleeping,
+					       req->ld->sh_efd);
+		}
+		head++;
+		nr++;
+	}
+
+	atomic_store_release(cq->head, head);
+	return nr;
+}
+
+static void *fio_ioring_shared_thread(void *data)
+{
+	struct ioring_shared *sh = data;
+	struct ioring_data *ring = &sh->ring;
+	struct io_sq_ring *sq = &ring->sq_ring;
+	unsigned to_submit;
+	int ret = 0;
+
+	fio_ioring_shared_arm_wakeup(sh);
+
+	do {
+		fio_ioring_shared_fill(sh);
+		to_submit = *sq->tail - atomic_load_acquire(sq->head);
+		if (to_submit) {
+			ret = io_uring_enter(ring, to_submit, 0, 0);
+			if (ret < 0 && errno != EAGAIN && errno != EBUSY &&
+			    errno != EINTR) {
+				log_err("fio: io_uring shared ring submit: %s\n",
+					strerror(errno));
+				break;
+			}
+		}
+
+		if (fio_ioring_shared_reap(sh))
+			continue;
+		if (to_submit && ret > 0)
+			continue;
+
+		if (__atomic_load_n(&sh->exit, __ATOMIC_ACQUIRE) &&
+		    !sh->inflight && !sh->backlog)
+			break;
+
+		/* nothing to do, wait for a completion or a wakeup */
+		__atomic_store_n(&sh->sleeping, 1, __ATOMIC_SEQ_CST);
+		if (!__atomic_load_n(&sh->subq, __ATOMIC_SEQ_CST) &&
+		    !__atomic_load_n(&sh->exit, __ATOMIC_SEQ_CST))
+			io_uring_enter(ring, 0, 1, IORING_ENTER_GETEVENTS);
+		__atomic_store_n(&sh->sleeping, 0, __ATOMIC_RELAXED);
+	} while (1);
+
+	return NULL;
+}
+
+static void fio_ioring_shared_put(struct ioring_data *ld)
+{
+	struct ioring_shared *sh = ld->shared;
+	bool last;
+	uint64_t val;
+
+	if (!sh)
+		return;
+
+	/* completions for us must not arrive after we're gone */
+	while (ld->sh_inflight) {
+		struct ioring_shared_req *req;
+
+		req = fio_ioring_shared_pop_all(&ld->sh_done);
+		for (; req; req = req->next)
+			ld->sh_inflight--;
+		if (ld->sh_inflight)
+			usleep(100);
+	}
+
+	pthread_mutex_lock(&shared_rings_lock);
+	last = !--sh->refs;
+	if (last)
+		flist_del(&sh->list);
+	pthread_mutex_unlock(&shared_rings_lock);
+
+	if (last) {
+		__atomic_store_n(&sh->exit, 1, __ATOMIC_SEQ_CST);
+		val = 1;
+		if (write(sh->efd, &val, sizeof(val)) < 0)
+			log_err("fio: io_uring shared ring exit: %s\n",
+				strerror(errno));
+		pthread_join(sh->thread, NULL);
+		fio_ioring_unmap(&sh->ring);
+		close(sh->efd);
+		free(sh);
+	}
+
+	close(ld->sh_efd);
+	ld->shared = NULL;
+}
+
+/*
+ * Time spent in the hybrid sleeps would otherwise have been spent
+ * spinning in the kernel, so that's the CPU time saved.
+ */
+static void fio_ioring_hybrid_report(struct thread_data *td)
+{
+	struct ioring_data *ld = td->io_ops_data;
+	uint64_t nsec = ntime_since_now(&ld->hp_start);
+
+	log_info("%s: hybrid poll: %llu sleeps, avg %.1f usec, %.1f%% of "
+		 "%.1f sec runtime not spent polling\n", td->o.name,
+		 (unsigned long long) ld->hp_sleeps,
+		 ld->hp_sleeps ? ld->hp_slept_ns / 1000.0 / ld->hp_sleeps : 0.0,
+		 nsec ? ld->hp_slept_ns * 100.0 / nsec : 0.0, nsec / 1e9);
+}
+
 static void fio_ioring_cleanup(struct thread_data *td)
 {
 	struct ioring_data *ld = td->io_ops_data;
+	struct ioring_options *o = td->eo;
 
 	if (ld) {
-		if (!(td->flags & TD_F_CHILD))
+		if (ld->hybrid)
+			fio_ioring_hybrid_report(td);
+		if (ld->sh_reqs) {
+			fio_ioring_shared_put(ld);
+			free(ld->sqes);
+			free(ld->sh_reqs);
+			free(ld->sh_events);
+		} else if (!(td->flags & TD_F_CHILD))
 			fio_ioring_unmap(ld);
 
+		fio_ioring_sqpoll_group_put(ld);
+		fio_ioring_fixed_put(ld);
 		fio_cmdprio_cleanup(&ld->cmdprio);
+		if (ld->pbuf_ring)
+			fio_memfree(ld->pbuf_ring, ld->pbuf_entries *
+					sizeof(struct io_uring_buf), false);
+		if (ld->pbuf_mem)
+			fio_memfree(ld->pbuf_mem, ld->pbuf_mem_len, false);
+		free(ld->pbuf_pending);
+		free(ld->io_u_bufs);
+		if (ld->md_buf)
+			fio_memfree(ld->md_buf, td->o.iodepth *
+					o->md_per_io_size, false);
 		free(ld->io_u_index);
 		free(ld->iovecs);
+		free(ld->fixed_index);
+		free(ld->seg_iovecs);
 		free(ld->fds);
+		free(ld->free_slots);
 		free(ld);
 	}
 }
@@ -785,23 +2204,135 @@ static int fio_ioring_mmap(struct ioring_data *ld, struct io_uring_params *p)
 	return 0;
 }
 
+/*
+ * The device a job's ring is shared by: that of its first file, or of the
+ * directory it will be created in.
+ */
+static dev_t fio_ioring_shared_dev(struct thread_data *td)
+{
+	struct fio_file *f = td->files[0];
+	struct stat sb;
+	char *dir;
+	int ret;
+
+	if (!stat(f->file_name, &sb))
+		return S_ISBLK(sb.st_mode) || S_ISCHR(sb.st_mode) ?
+			sb.st_rdev : sb.st_dev;
+
+	dir = strdup(f->file_name);
+	ret = stat(dirname(dir), &sb);
+	free(dir);
+	return ret ? 0 : sb.st_dev;
+}
+
+static struct ioring_shared *fio_ioring_shared_create(struct thread_data *td,
+						      dev_t dev)
+{
+	struct ioring_options *o = td->eo;
+	struct ioring_shared *sh;
+	struct io_uring_params p;
+	unsigned i;
+	int ret;
+
+	sh = calloc(1, sizeof(*sh));
+	if (!sh)
+		return NULL;
+
+	sh->dev = dev;
+	sh->efd = eventfd(0, EFD_CLOEXEC);
+	if (sh->efd < 0)
+		goto err;
+
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+	p.cq_entries = 2 * (o->sq_entries ? o->sq_entries :
+				FIO_IORING_SHARED_ENTRIES);
+retry:
+	ret = syscall(__NR_io_uring_setup, p.cq_entries / 2, &p);
+	if (ret < 0) {
+		if (errno == EINVAL && p.flags & IORING_SETUP_COOP_TASKRUN) {
+			p.flags &= ~IORING_SETUP_COOP_TASKRUN;
+			goto retry;
+		}
+		close(sh->efd);
+		goto err;
+	}
+
+	sh->ring.ring_fd = sh->ring.enter_ring_fd = ret;
+	fio_ioring_mmap(&sh->ring, &p);
+	for (i = 0; i < p.sq_entries; i++)
+		sh->ring.sq_ring.array[i] = i;
+	sh->cq_entries = p.cq_entries;
+
+	ret = pthread_create(&sh->thread, NULL, fio_ioring_shared_thread, sh);
+	if (ret) {
+		errno = ret;
+		fio_ioring_unmap(&sh->ring);
+		close(sh->efd);
+		goto err;
+	}
+
+	dprint(FD_IO, "io_uring: shared ring for device %u:%u, %u entries\n",
+			major(dev), minor(dev), p.sq_entries);
+	return sh;
+err:
+	free(sh);
+	return NULL;
+}
+
+static int fio_ioring_shared_get(struct thread_data *td)
+{
+	struct ioring_data *ld = td->io_ops_data;
+	dev_t dev = fio_ioring_shared_dev(td);
+	struct ioring_shared *sh = NULL;
+	struct flist_head *entry;
+
+	ld->sh_efd = eventfd(0, EFD_CLOEXEC);
+	if (ld->sh_efd < 0)
+		return 1;
+
+	pthread_mutex_lock(&shared_rings_lock);
+	flist_for_each(entry, &shared_rings) {
+		struct ioring_shared *tmp;
+
+		tmp = flist_entry(entry, struct ioring_shared, list);
+		if (tmp->dev == dev) {
+			sh = tmp;
+			break;
+		}
+	}
+	if (!sh) {
+		sh = fio_ioring_shared_create(td, dev);
+		if (sh)
+			flist_add_tail(&sh->list, &shared_rings);
+	}
+	if (sh)
+		sh->refs++;
+	pthread_mutex_unlock(&shared_rings_lock);
+
+	if (!sh) {
+		close(ld->sh_efd);
+		return 1;
+	}
+
+	ld->shared = sh;
+	return 0;
+}
+
 static void fio_ioring_probe(struct thread_data *td)
 {
 	struct ioring_data *ld = td->io_ops_data;
 	struct ioring_options *o = td->eo;
 	struct io_uring_probe *p;
-	int ret;
+	int ret = -1;
 
-	/* already set by user, don't touch */
-	if (o->nonvectored != -1)
+	/* nonvectored already set by user and no trim op to check */
+	if (o->nonvectored != -1 && !ld->trim_op)
 		return;
 
-	/* default to off, as that's always safe */
-	o->nonvectored = 0;
-
 	p = malloc(sizeof(*p) + 256 * sizeof(struct io_uring_probe_op));
 	if (!p)
-		return;
+		goto out;
 
 	memset(p, 0, sizeof(*p) + 256 * sizeof(struct io_uring_probe_op));
 	ret = syscall(__NR_io_uring_register, ld->ring_fd,
@@ -809,21 +2340,141 @@ static void fio_ioring_probe(struct thread_data *td)
 	if (ret < 0)
 		goto out;
 
-	if (IORING_OP_WRITE > p->ops_len)
-		goto out;
-
-	if ((p->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+	if (o->nonvectored == -1 && IORING_OP_WRITE <= p->ops_len &&
+	    (p->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
 	    (p->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED))
 		o->nonvectored = 1;
 out:
-	free(p);
+	/* a kernel that can't queue the trims gets them done inline */
+	if (ld->trim_op && (ret < 0 || !p || ld->trim_op >= p->ops_len ||
+	    !(p->ops[ld->trim_op].flags & IO_URING_OP_SUPPORTED))) {
+		dprint(FD_IO, "io_uring: trim op %u not supported\n",
+							ld->trim_op);
+		ld->trim_op = 0;
+	}
+	/* default to off, as that's always safe */
+	if (o->nonvectored == -1)
+		o->nonvectored = 0;
+	free(p);
+}
+
+/*
+ * Register the ring fd with the ring itself, so io_uring_enter() can skip the
+ * fd table lookup. Falls back to the normal fd if the kernel lacks support.
+ */
+static void fio_ioring_register_ring(struct ioring_data *ld)
+{
+	struct io_uring_rsrc_update up;
+	int ret;
+
+	memset(&up, 0, sizeof(up));
+	up.offset = -1U;
+	up.data = ld->ring_fd;
+
+	ret = syscall(__NR_io_uring_register, ld->ring_fd,
+			IORING_REGISTER_RING_FDS, &up, 1);
+	if (ret != 1) {
+		dprint(FD_IO, "io_uring: ring fd registration failed: %d\n",
+				ret < 0 ? errno : ret);
+		return;
+	}
+
+	ld->enter_ring_fd = up.offset;
+	ld->enter_flags = IORING_ENTER_REGISTERED_RING;
+}
+
+/*
+ * COOP_TASKRUN avoids the IPI to get us to run completion task work, we
+ * pick it up on our next kernel entry. DEFER_TASKRUN goes further and only
+ * runs it when we ask for events, which requires that only one task submits
+ * to the ring. That is always the case for fio. TASKRUN_FLAG lets us see in
+ * the SQ ring flags whether any task work is pending. SQPOLL rings can't
+ * defer, the SQ thread runs their task work.
+ */
+static unsigned fio_ioring_taskrun_flags(struct ioring_options *o)
+{
+	unsigned defer = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+	unsigned coop = IORING_SETUP_COOP_TASKRUN | IORING_SETUP_TASKRUN_FLAG;
+
+	switch (o->taskrun) {
+	case FIO_URING_TASKRUN_DEFER:
+		return defer | IORING_SETUP_TASKRUN_FLAG;
+	case FIO_URING_TASKRUN_COOP:
+		return coop;
+	case FIO_URING_TASKRUN_NONE:
+		return 0;
+	default:
+		if (o->sqpoll_thread)
+			return coop;
+		return defer | coop;
+	}
+}
+
+static int fio_ioring_setup(struct thread_data *td, unsigned int depth,
+			    struct io_uring_params *p)
+{
+	struct ioring_options *o = td->eo;
+	struct ioring_sqpoll_group *grp = NULL;
+	bool shared = o->sqpoll_thread && o->sqpoll_shared;
+	int ret;
+
+	if (shared) {
+		pthread_mutex_lock(&sqpoll_groups_lock);
+		grp = fio_ioring_sqpoll_group(td->groupid);
+		if (grp) {
+			p->flags |= IORING_SETUP_ATTACH_WQ;
+			p->wq_fd = grp->wq_fd;
+		}
+	}
+
+retry:
+	ret = syscall(__NR_io_uring_setup, depth, p);
+	if (ret < 0) {
+		/* only auto falls back, an explicit taskrun_mode must work */
+		if (errno == EINVAL && o->taskrun == FIO_URING_TASKRUN_AUTO &&
+		    p->flags & IORING_SETUP_DEFER_TASKRUN) {
+			p->flags &= ~IORING_SETUP_DEFER_TASKRUN;
+			p->flags &= ~IORING_SETUP_SINGLE_ISSUER;
+			goto retry;
+		}
+		if (errno == EINVAL && o->taskrun == FIO_URING_TASKRUN_AUTO &&
+		    p->flags & IORING_SETUP_COOP_TASKRUN) {
+			p->flags &= ~IORING_SETUP_COOP_TASKRUN;
+			p->flags &= ~IORING_SETUP_TASKRUN_FLAG;
+			goto retry;
+		}
+		if (errno == EINVAL && p->flags & IORING_SETUP_CQSIZE) {
+			p->flags &= ~IORING_SETUP_CQSIZE;
+			goto retry;
+		}
+		/* can't attach, fall back to a private SQPOLL thread */
+		if (errno == EINVAL && p->flags & IORING_SETUP_ATTACH_WQ) {
+			p->flags &= ~IORING_SETUP_ATTACH_WQ;
+			p->wq_fd = 0;
+			grp = NULL;
+			goto retry;
+		}
+		goto out;
+	}
+
+	if (shared && fio_ioring_sqpoll_group_get(td, grp, ret)) {
+		int err = errno;
+
+		close(ret);
+		errno = err;
+		ret = -1;
+	}
+out:
+	if (shared)
+		pthread_mutex_unlock(&sqpoll_groups_lock);
+	return ret;
 }
 
 static int fio_ioring_queue_init(struct thread_data *td)
 {
 	struct ioring_data *ld = td->io_ops_data;
 	struct ioring_options *o = td->eo;
-	int depth = td->o.iodepth;
+	int depth = ld->sq_entries;
 	struct io_uring_params p;
 	int ret;
 
@@ -848,50 +2499,29 @@ static int fio_ioring_queue_init(struct thread_data *td)
 	}
 
 	/*
-	 * Clamp CQ ring size at our SQ ring size, we don't need more entries
-	 * than that.
+	 * Clamp CQ ring size at our SQ ring size unless the user asked for
+	 * an oversized CQ ring, we don't need more entries than that.
 	 */
 	p.flags |= IORING_SETUP_CQSIZE;
-	p.cq_entries = depth;
-
-	/*
-	 * Setup COOP_TASKRUN as we don't need to get IPI interrupted for
-	 * completing IO operations.
-	 */
-	p.flags |= IORING_SETUP_COOP_TASKRUN;
+	p.cq_entries = ld->cq_entries;
 
-	/*
-	 * io_uring is always a single issuer, and we can defer task_work
-	 * runs until we reap events.
-	 */
-	p.flags |= IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+	p.flags |= fio_ioring_taskrun_flags(o);
 
-retry:
-	ret = syscall(__NR_io_uring_setup, depth, &p);
-	if (ret < 0) {
-		if (errno == EINVAL && p.flags & IORING_SETUP_DEFER_TASKRUN) {
-			p.flags &= ~IORING_SETUP_DEFER_TASKRUN;
-			p.flags &= ~IORING_SETUP_SINGLE_ISSUER;
-			goto retry;
-		}
-		if (errno == EINVAL && p.flags & IORING_SETUP_COOP_TASKRUN) {
-			p.flags &= ~IORING_SETUP_COOP_TASKRUN;
-			goto retry;
-		}
-		if (errno == EINVAL && p.flags & IORING_SETUP_CQSIZE) {
-			p.flags &= ~IORING_SETUP_CQSIZE;
-			goto retry;
-		}
+	ret = fio_ioring_setup(td, depth, &p);
+	if (ret < 0)
 		return ret;
-	}
 
 	ld->ring_fd = ret;
+	ld->enter_ring_fd = ret;
+	ld->setup_flags = p.flags;
+	dprint(FD_IO, "io_uring: setup flags 0x%x\n", p.flags);
 
 	fio_ioring_probe(td);
+	if (o->registered_ring)
+		fio_ioring_register_ring(ld);
 
 	if (o->fixedbufs) {
-		ret = syscall(__NR_io_uring_register, ld->ring_fd,
-				IORING_REGISTER_BUFFERS, ld->iovecs, depth);
+		ret = fio_ioring_register_fixed(td);
 		if (ret < 0)
 			return ret;
 	}
@@ -903,7 +2533,7 @@ static int fio_ioring_cmd_queue_init(struct thread_data *td)
 {
 	struct ioring_data *ld = td->io_ops_data;
 	struct ioring_options *o = td->eo;
-	int depth = td->o.iodepth;
+	int depth = ld->sq_entries;
 	struct io_uring_params p;
 	int ret;
 
@@ -932,50 +2562,29 @@ static int fio_ioring_cmd_queue_init(struct thread_data *td)
 	}
 
 	/*
-	 * Clamp CQ ring size at our SQ ring size, we don't need more entries
-	 * than that.
+	 * Clamp CQ ring size at our SQ ring size unless the user asked for
+	 * an oversized CQ ring, we don't need more entries than that.
 	 */
 	p.flags |= IORING_SETUP_CQSIZE;
-	p.cq_entries = depth;
+	p.cq_entries = ld->cq_entries;
 
-	/*
-	 * Setup COOP_TASKRUN as we don't need to get IPI interrupted for
-	 * completing IO operations.
-	 */
-	p.flags |= IORING_SETUP_COOP_TASKRUN;
-
-	/*
-	 * io_uring is always a single issuer, and we can defer task_work
-	 * runs until we reap events.
-	 */
-	p.flags |= IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+	p.flags |= fio_ioring_taskrun_flags(o);
 
-retry:
-	ret = syscall(__NR_io_uring_setup, depth, &p);
-	if (ret < 0) {
-		if (errno == EINVAL && p.flags & IORING_SETUP_DEFER_TASKRUN) {
-			p.flags &= ~IORING_SETUP_DEFER_TASKRUN;
-			p.flags &= ~IORING_SETUP_SINGLE_ISSUER;
-			goto retry;
-		}
-		if (errno == EINVAL && p.flags & IORING_SETUP_COOP_TASKRUN) {
-			p.flags &= ~IORING_SETUP_COOP_TASKRUN;
-			goto retry;
-		}
-		if (errno == EINVAL && p.flags & IORING_SETUP_CQSIZE) {
-			p.flags &= ~IORING_SETUP_CQSIZE;
-			goto retry;
-		}
+	ret = fio_ioring_setup(td, depth, &p);
+	if (ret < 0)
 		return ret;
-	}
 
 	ld->ring_fd = ret;
+	ld->enter_ring_fd = ret;
+	ld->setup_flags = p.flags;
+	dprint(FD_IO, "io_uring: setup flags 0x%x\n", p.flags);
 
 	fio_ioring_probe(td);
+	if (o->registered_ring)
+		fio_ioring_register_ring(ld);
 
 	if (o->fixedbufs) {
-		ret = syscall(__NR_io_uring_register, ld->ring_fd,
-				IORING_REGISTER_BUFFERS, ld->iovecs, depth);
+		ret = fio_ioring_register_fixed(td);
 		if (ret < 0)
 			return ret;
 	}
@@ -983,6 +2592,168 @@ retry:
 	return fio_ioring_mmap(ld, &p);
 }
 
+static int fio_ioring_register_pbuf_ring(struct thread_data *td)
+{
+	struct ioring_data *ld = td->io_ops_data;
+	struct ioring_options *o = td->eo;
+	struct io_uring_buf_reg reg;
+	size_t ring_len;
+	unsigned i;
+	int ret;
+
+	ld->pbuf_entries = roundup_pow2(o->buf_ring);
+	ld->pbuf_mask = ld->pbuf_entries - 1;
+	ld->pbuf_bs = td_max_bs(td);
+
+	/* the ring itself must be page aligned */
+	ring_len = ld->pbuf_entries * sizeof(struct io_uring_buf);
+	ld->pbuf_ring = fio_memalign(page_size, ring_len, false);
+	ld->pbuf_mem_len = ld->pbuf_entries * ld->pbuf_bs;
+	ld->pbuf_mem = fio_memalign(page_size, ld->pbuf_mem_len, false);
+	ld->pbuf_pending = calloc(ld->pbuf_entries, sizeof(unsigned short));
+	if (!ld->pbuf_ring || !ld->pbuf_mem || !ld->pbuf_pending) {
+		errno = ENOMEM;
+		return -1;
+	}
+	memset(ld->pbuf_ring, 0, ring_len);
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long) ld->pbuf_ring;
+	reg.ring_entries = ld->pbuf_entries;
+	reg.bgid = FIO_IORING_PBUF_BGID;
+
+	ret = syscall(__NR_io_uring_register, ld->ring_fd,
+			IORING_REGISTER_PBUF_RING, &reg, 1);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < ld->pbuf_entries; i++)
+		fio_ioring_pbuf_add(ld, i);
+	atomic_store_release(&ld->pbuf_ring->tail, ld->pbuf_tail);
+
+	dprint(FD_IO, "io_uring: registered %u provided buffers of %llu bytes\n",
+			ld->pbuf_entries, ld->pbuf_bs);
+	return 0;
+}
+
+/*
+ * Register a table of open_files empty slots. Files are added to it as
+ * they are opened and removed again when closed, see
+ * fio_ioring_sparse_open().
+ */
+static int fio_ioring_register_sparse_files(struct thread_data *td)
+{
+	struct ioring_data *ld = td->io_ops_data;
+	unsigned int i, nr = td->o.open_files;
+	int ret;
+
+	ld->fds = malloc(nr * sizeof(int));
+	ld->free_slots = malloc(nr * sizeof(unsigned));
+	if (!ld->fds || !ld->free_slots) {
+		errno = ENOMEM;
+		ret = -1;
+		goto err;
+	}
+
+	for (i = 0; i < nr; i++) {
+		ld->fds[i] = -1;
+		ld->free_slots[i] = nr - i - 1;
+	}
+	ld->nr_free_slots = nr;
+
+	ret = syscall(__NR_io_uring_register, ld->ring_fd,
+			IORING_REGISTER_FILES, ld->fds, nr);
+	if (!ret) {
+		ld->sparse_files = true;
+		dprint(FD_FILE, "io_uring: registered %u sparse file slots\n",
+				nr);
+		return 0;
+	}
+err:
+	free(ld->fds);
+	ld->fds = NULL;
+	free(ld->free_slots);
+	ld->free_slots = NULL;
+	return ret;
+}
+
+static int fio_ioring_files_update(struct ioring_data *ld, unsigned slot,
+				   int fd)
+{
+	struct io_uring_files_update up = {
+		.offset	= slot,
+		.fds	= (unsigned long) &fd,
+	};
+	int ret;
+
+	ret = syscall(__NR_io_uring_register, ld->ring_fd,
+			IORING_REGISTER_FILES_UPDATE, &up, 1);
+	if (ret == 1)
+		return 0;
+
+	return ret < 0 ? -errno : -EIO;
+}
+
+static int fio_ioring_sparse_open(struct thread_data *td, struct fio_file *f)
+{
+	struct ioring_data *ld = td->io_ops_data;
+	unsigned slot;
+	int ret;
+
+	ret = generic_open_file(td, f);
+	if (ret)
+		return ret;
+
+	/*
+	 * Verify, trim and iolog replay open files regardless of open_files.
+	 * Files beyond the table are used through their normal fd.
+	 */
+	if (!ld->nr_free_slots) {
+		dprint(FD_FILE, "io_uring: no free file slot for %s\n",
+				f->file_name);
+		f->engine_pos = FIO_IORING_NO_SLOT;
+		return 0;
+	}
+
+	slot = ld->free_slots[--ld->nr_free_slots];
+	ret = fio_ioring_files_update(ld, slot, f->fd);
+	if (ret) {
+		int fio_unused ret2;
+
+		ld->nr_free_slots++;
+		td_verror(td, -ret, "io_uring files update");
+		ret2 = generic_close_file(td, f);
+		return 1;
+	}
+
+	ld->fds[slot] = f->fd;
+	f->engine_pos = slot;
+	return 0;
+}
+
+static int fio_ioring_sparse_close(struct thread_data *td, struct fio_file *f)
+{
+	struct ioring_data *ld = td->io_ops_data;
+	unsigned slot = f->engine_pos;
+	int ret;
+
+	if (f->engine_pos == FIO_IORING_NO_SLOT)
+		return generic_close_file(td, f);
+
+	/*
+	 * The kernel keeps its own reference for requests that are still
+	 * in flight, the slot can be reused right away.
+	 */
+	ret = fio_ioring_files_update(ld, slot, -1);
+	if (ret)
+		log_err("fio: io_uring: failed to unregister %s: %s\n",
+			f->file_name, strerror(-ret));
+
+	ld->fds[slot] = -1;
+	ld->free_slots[ld->nr_free_slots++] = slot;
+	return generic_close_file(td, f);
+}
+
 static int fio_ioring_register_files(struct thread_data *td)
 {
 	struct ioring_data *ld = td->io_ops_data;
@@ -990,6 +2761,9 @@ static int fio_ioring_register_files(struct thread_data *td)
 	unsigned int i;
 	int ret;
 
+	if (td->o.open_files < td->o.nr_files)
+		return fio_ioring_register_sparse_files(td);
+
 	ld->fds = calloc(td->o.nr_files, sizeof(int));
 
 	for_each_file(td, f, i) {
@@ -1023,6 +2797,117 @@ err:
 	return ret;
 }
 
+/*
+ * Does the blk-mq cpu_list 'list' ("0, 4, 8" or ranges) contain 'cpu'?
+ */
+static bool fio_ioring_cpu_list_has(const char *list, long cpu)
+{
+	char *end;
+
+	while (*list) {
+		long first, last;
+
+		first = last = strtol(list, &end, 10);
+		if (end == list)
+			break;
+		if (*end == '-')
+			last = strtol(end + 1, &end, 10);
+		if (cpu >= first && cpu <= last)
+			return true;
+
+		list = end;
+		while (*list == ',' || *list == ' ' || *list == '\n')
+			list++;
+	}
+
+	return false;
+}
+
+/*
+ * Print the hardware queues of the device behind 'f' whose cpu_list has
+ * the CPU this job runs on. NVMe generic char devices (ngXnY) are looked
+ * up through their block device (nvmeXnY).
+ */
+static void fio_ioring_report_hwq(struct thread_data *td, struct fio_file *f)
+{
+	char path[PATH_MAX], queues[256] = "", list[4096];
+	const char *name = strrchr(f->file_name, '/');
+	int cpu = sched_getcpu();
+	unsigned int nr = 0, hit = 0;
+	struct dirent *dent;
+	size_t qlen = 0;
+	DIR *dir;
+
+	if (f->filetype != FIO_TYPE_BLOCK && f->filetype != FIO_TYPE_CHAR)
+		return;
+
+	name = name ? name + 1 : f->file_name;
+	if (!strncmp(name, "ng", 2))
+		snprintf(path, sizeof(path), "/sys/block/nvme%s/mq", name + 2);
+	else
+		snprintf(path, sizeof(path), "/sys/block/%s/mq", name);
+
+	dir = opendir(path);
+	if (!dir) {
+		log_info("%s: %s: no blk-mq queue information\n", td->o.name,
+			 f->file_name);
+		return;
+	}
+
+	while ((dent = readdir(dir)) != NULL) {
+		char file[PATH_MAX + 300];
+		FILE *fp;
+
+		if (dent->d_name[0] < '0' || dent->d_name[0] > '9')
+			continue;
+
+		nr++;
+		snprintf(file, sizeof(file), "%s/%s/cpu_list", path,
+			 dent->d_name);
+		fp = fopen(file, "r");
+		if (!fp)
+			continue;
+		if (fgets(list, sizeof(list), fp) &&
+		    fio_ioring_cpu_list_has(list, cpu) &&
+		    qlen < sizeof(queues)) {
+			qlen += snprintf(queues + qlen, sizeof(queues) - qlen,
+					 "%s%s", hit ? "," : "", dent->d_name);
+			hit++;
+		}
+		fclose(fp);
+	}
+	closedir(dir);
+
+	log_info("%s: %s: cpu %d%s maps to hw queue%s %s of %u\n",
+		 td->o.name, f->file_name, cpu,
+		 fio_option_is_set(&td->o, cpumask) ? "" : " (not pinned)",
+		 hit == 1 ? "" : "s", hit ? queues : "none", nr);
+}
+
+/*
+ * With shared_ring, SQEs are prepared in private memory and copied to the
+ * device's ring by its submitter thread.
+ */
+static int fio_ioring_shared_post_init(struct thread_data *td)
+{
+	struct ioring_data *ld = td->io_ops_data;
+
+	ld->sqes = calloc(td->o.iodepth, sizeof(struct io_uring_sqe));
+	ld->sh_reqs = calloc(td->o.iodepth, sizeof(struct ioring_shared_req));
+	ld->sh_events = calloc(td->o.iodepth, sizeof(struct ioring_shared_req *));
+	if (!ld->sqes || !ld->sh_reqs || !ld->sh_events) {
+		td_verror(td, ENOMEM, "fio_ioring_shared_post_init");
+		return 1;
+	}
+
+	if (fio_ioring_shared_get(td)) {
+		td_verror(td, errno, "io_uring shared ring");
+		return 1;
+	}
+
+	return 0;
+}
+
 static int fio_ioring_post_init(struct thread_data *td)
 {
 	struct ioring_data *ld = td->io_ops_data;
@@ -1030,12 +2915,16 @@ static int fio_ioring_post_init(struct thread_data *td)
 	struct io_u *io_u;
 	int err, i;
 
+	if (o->shared_ring)
+		return fio_ioring_shared_post_init(td);
+
 	for (i = 0; i < td->o.iodepth; i++) {
 		struct iovec *iov = &ld->iovecs[i];
 
 		io_u = ld->io_u_index[i];
 		iov->iov_base = io_u->buf;
 		iov->iov_len = td_max_bs(td);
+		ld->io_u_bufs[i] = io_u->buf;
 	}
 
 	err = fio_ioring_queue_init(td);
@@ -1044,10 +2933,25 @@ static int fio_ioring_post_init(struct thread_data *td)
 
 		if (init_err == ENOSYS)
 			log_err("fio: your kernel doesn't support io_uring\n");
+		else if (init_err == EINVAL &&
+			 o->taskrun != FIO_URING_TASKRUN_AUTO)
+			log_err("fio: your kernel doesn't support this io_uring taskrun_mode\n");
 		td_verror(td, init_err, "io_queue_init");
 		return 1;
 	}
 
+	if (o->buf_ring) {
+		err = fio_ioring_register_pbuf_ring(td);
+		if (err) {
+			int init_err = errno;
+
+			if (init_err == EINVAL)
+				log_err("fio: your kernel doesn't support provided buffer rings\n");
+			td_verror(td, init_err, "ioring_register_pbuf_ring");
+			return 1;
+		}
+	}
+
 	for (i = 0; i < td->o.iodepth; i++) {
 		struct io_uring_sqe *sqe;
 
@@ -1063,6 +2967,13 @@ static int fio_ioring_post_init(struct thread_data *td)
 		}
 	}
 
+	if (o->report_hwq) {
+		struct fio_file *f;
+
+		for_each_file(td, f, i)
+			fio_ioring_report_hwq(td, f);
+	}
+
 	return 0;
 }
 
@@ -1109,6 +3020,13 @@ static int fio_ioring_cmd_post_init(struct thread_data *td)
 		}
 	}
 
+	if (o->report_hwq) {
+		struct fio_file *f;
+
+		for_each_file(td, f, i)
+			fio_ioring_report_hwq(td, f);
+	}
+
 	return 0;
 }
 
@@ -1122,24 +3040,167 @@ static int fio_ioring_init(struct thread_data *td)
 	if (o->sqpoll_thread)
 		o->registerfiles = 1;
 
-	if (o->registerfiles && td->o.nr_files != td->o.open_files) {
-		log_err("fio: io_uring registered files require nr_files to "
-			"be identical to open_files\n");
+	/* the shared ring fd is only meaningful within one process */
+	if (o->sqpoll_thread && o->sqpoll_shared && !td->o.use_thread) {
+		log_err("fio: io_uring sqthread_poll_shared requires thread=1\n");
+		return 1;
+	}
+
+
+	/*
+	 * With SQPOLL the kernel may already have consumed the SQEs we would
+	 * need to retroactively link to the sync.
+	 */
+	if (o->linked_sync && o->sqpoll_thread) {
+		log_err("fio: io_uring linked_sync is not supported with sqthread_poll\n");
+		return 1;
+	}
+	if (o->taskrun == FIO_URING_TASKRUN_DEFER && o->sqpoll_thread) {
+		log_err("fio: io_uring taskrun_mode=defer is not supported with sqthread_poll\n");
+		return 1;
+	}
+	if (o->linked_sync && !strcmp(td->io_ops->name, "io_uring_cmd")) {
+		log_err("fio: linked_sync is not supported by io_uring_cmd\n");
+		return 1;
+	}
+
+	if (o->buf_ring) {
+		if (!strcmp(td->io_ops->name, "io_uring_cmd")) {
+			log_err("fio: buf_ring is not supported by io_uring_cmd\n");
+			return 1;
+		}
+		if (td_write(td)) {
+			log_err("fio: io_uring buf_ring only supports read workloads\n");
+			return 1;
+		}
+		if (o->fixedbufs) {
+			log_err("fio: io_uring buf_ring and fixedbufs are mutually exclusive\n");
+			return 1;
+		}
+		if (td->o.verify_async) {
+			log_err("fio: io_uring buf_ring does not support verify_async\n");
+			return 1;
+		}
+	}
+
+	/*
+	 * Reads on a buf_ring are limited by the buffers left, and a shared
+	 * ring queues to its submitter thread
+	 */
+	if (o->buf_ring || o->shared_ring)
+		td->io_batch = false;
+
+	if (o->sq_entries && o->sq_entries < td->o.iodepth) {
+		log_err("fio: io_uring sq_entries must be at least iodepth\n");
+		return 1;
+	}
+	if (o->shared_ring) {
+		/* the submitter thread uses the jobs' fds and buffers */
+		if (!td->o.use_thread) {
+			log_err("fio: io_uring shared_ring requires thread=1\n");
+			return 1;
+		}
+		if (strcmp(td->io_ops->name, "io_uring") || o->hipri ||
+		    o->sqpoll_thread || o->registerfiles || o->fixedbufs ||
+		    o->buf_ring || o->linked_sync) {
+			log_err("fio: io_uring shared_ring can't be used with io_uring_cmd, hipri, sqthread_poll, registerfiles, fixedbufs, buf_ring or linked_sync\n");
+			return 1;
+		}
+	}
+	if (o->vec_seg_size) {
+		if (o->nonvectored == 1) {
+			log_err("fio: io_uring vec_seg_size requires nonvectored=0\n");
+			return 1;
+		}
+		if (o->fixedbufs || o->buf_ring) {
+			log_err("fio: io_uring vec_seg_size can't be used with fixedbufs or buf_ring\n");
+			return 1;
+		}
+		if ((td_max_bs(td) + o->vec_seg_size - 1) / o->vec_seg_size >
+		    IOV_MAX) {
+			log_err("fio: io_uring vec_seg_size gives more than %d segments\n",
+				IOV_MAX);
+			return 1;
+		}
+		o->nonvectored = 0;
+	}
+	if (o->hybrid_poll && (!o->hipri || o->sqpoll_thread)) {
+		log_err("fio: io_uring hybrid_poll requires hipri and no sqthread_poll\n");
 		return 1;
 	}
 
+	/* have the core back the buffers we register with huge pages */
+	if (o->fixedbufs && !fio_option_is_set(&td->o, mem_type))
+		td->iomem_huge = true;
+
 	ld = calloc(1, sizeof(*ld));
 
+	if (o->hybrid_poll) {
+		ld->hybrid = true;
+		fio_gettime(&ld->hp_start, NULL);
+		/* the default 50 usec slack is longer than most polled IOs */
+		os_min_timer_slack();
+	}
+
 	/* ring depth must be a power-of-2 */
 	ld->iodepth = td->o.iodepth;
 	td->o.iodepth = roundup_pow2(td->o.iodepth);
 
+	/*
+	 * SQEs are indexed by io_u, so the SQ ring can be larger than the
+	 * queue depth but never smaller. The CQ ring can't be smaller than
+	 * the SQ ring.
+	 */
+	ld->sq_entries = td->o.iodepth;
+	if (o->sq_entries)
+		ld->sq_entries = roundup_pow2(o->sq_entries);
+	ld->cq_entries = max(ld->sq_entries, o->cq_entries);
+
 	/* io_u index */
 	ld->io_u_index = calloc(td->o.iodepth, sizeof(struct io_u *));
 	ld->iovecs = calloc(td->o.iodepth, sizeof(struct iovec));
+	ld->io_u_bufs = calloc(td->o.iodepth, sizeof(void *));
+	if (o->vec_seg_size) {
+		ld->nr_segs = (td_max_bs(td) + o->vec_seg_size - 1) /
+				o->vec_seg_size;
+		ld->seg_iovecs = calloc(td->o.iodepth * ld->nr_segs,
+					sizeof(struct iovec));
+	}
 
 	td->io_ops_data = ld;
 
+	if (strcmp(td->io_ops->name, "io_uring_cmd")) {
+		ld->falloc_mode = trim_falloc_mode(td);
+		if (ld->falloc_mode >= 0)
+			ld->trim_op = IORING_OP_FALLOCATE;
+		else if (td->o.trim_mode == TRIM_MODE_TRUNCATE)
+			ld->trim_op = IORING_OP_FTRUNCATE;
+	}
+
+	if (!strcmp(td->io_ops->name, "io_uring_cmd")) {
+		if (o->md_per_io_size) {
+			ld->md_buf = fio_memalign(page_size, td->o.iodepth *
+						  o->md_per_io_size, false);
+			if (!ld->md_buf) {
+				td_verror(td, ENOMEM, "fio_ioring_init");
+				return 1;
+			}
+		}
+
+		if (o->pi_act)
+			ld->ext_opts.io_flags |= NVME_IO_PRINFO_PRACT;
+		if (o->pi_chk) {
+			if (strstr(o->pi_chk, "GUARD"))
+				ld->ext_opts.io_flags |= NVME_IO_PRINFO_PRCHK_GUARD;
+			if (strstr(o->pi_chk, "REFTAG"))
+				ld->ext_opts.io_flags |= NVME_IO_PRINFO_PRCHK_REF;
+			if (strstr(o->pi_chk, "APPTAG"))
+				ld->ext_opts.io_flags |= NVME_IO_PRINFO_PRCHK_APP;
+		}
+		ld->ext_opts.apptag = o->apptag;
+		ld->ext_opts.apptag_mask = o->apptag_mask;
+	}
+
 	ret = fio_cmdprio_init(td, &ld->cmdprio, &o->cmdprio_options);
 	if (ret) {
 		td_verror(td, EINVAL, "fio_ioring_init");
@@ -1164,11 +3225,49 @@ static int fio_ioring_open_file(struct thread_data *td, struct fio_file *f)
 
 	if (!ld || !o->registerfiles)
 		return generic_open_file(td, f);
+	if (ld->sparse_files)
+		return fio_ioring_sparse_open(td, f);
 
 	f->fd = ld->fds[f->engine_pos];
 	return 0;
 }
 
+/*
+ * Make sure the block sizes fit the namespace format: with the extended LBA
+ * format they must be a multiple of data plus metadata size, and a separate
+ * metadata buffer must be able to hold the metadata of the largest IO.
+ */
+static int fio_ioring_cmd_check_format(struct thread_data *td,
+				       struct fio_file *f,
+				       struct nvme_data *data)
+{
+	struct ioring_options *o = td->eo;
+	unsigned long long max_bs = td_max_bs(td);
+	int ddir;
+
+	if (data->lba_ext) {
+		for (ddir = DDIR_READ; ddir <= DDIR_WRITE; ddir++) {
+			if (td->o.min_bs[ddir] % data->lba_ext ||
+			    td->o.max_bs[ddir] % data->lba_ext) {
+				log_err("%s: block size must be a multiple of %u (data + metadata)\n",
+					f->file_name, data->lba_ext);
+				return 1;
+			}
+		}
+	} else if (data->ms) {
+		unsigned long long md_size;
+
+		md_size = (max_bs >> data->lba_shift) * data->ms;
+		if (o->md_per_io_size < md_size) {
+			log_err("%s: md_per_io_size should be at least %llu bytes\n",
+				f->file_name, md_size);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
 static int fio_ioring_cmd_open_file(struct thread_data *td, struct fio_file *f)
 {
 	struct ioring_data *ld = td->io_ops_data;
@@ -1176,26 +3275,30 @@ static int fio_ioring_cmd_open_file(struct thread_data *td, struct fio_file *f)
 
 	if (o->cmd_type == FIO_URING_CMD_NVME) {
 		struct nvme_data *data = NULL;
-		unsigned int nsid, lba_size = 0;
 		__u64 nlba = 0;
 		int ret;
 
 		/* Store the namespace-id and lba size. */
 		data = FILE_ENG_DATA(f);
 		if (data == NULL) {
-			ret = fio_nvme_get_info(f, &nsid, &lba_size, &nlba);
-			if (ret)
-				return ret;
-
 			data = calloc(1, sizeof(struct nvme_data));
-			data->nsid = nsid;
-			data->lba_shift = ilog2(lba_size);
+			ret = fio_nvme_get_info(f, &nlba, o->pi_act, data);
+			if (ret) {
+				free(data);
+				return ret;
+			}
 
 			FILE_SET_ENG_DATA(f, data);
 		}
+
+		ret = fio_ioring_cmd_check_format(td, f, data);
+		if (ret)
+			return ret;
 	}
 	if (!ld || !o->registerfiles)
 		return generic_open_file(td, f);
+	if (ld->sparse_files)
+		return fio_ioring_sparse_open(td, f);
 
 	f->fd = ld->fds[f->engine_pos];
 	return 0;
@@ -1208,6 +3311,8 @@ static int fio_ioring_close_file(struct thread_data *td, struct fio_file *f)
 
 	if (!ld || !o->registerfiles)
 		return generic_close_file(td, f);
+	if (ld->sparse_files)
+		return fio_ioring_sparse_close(td, f);
 
 	f->fd = -1;
 	return 0;
@@ -1227,6 +3332,8 @@ static int fio_ioring_cmd_close_file(struct thread_data *td,
 	}
 	if (!ld || !o->registerfiles)
 		return generic_close_file(td, f);
+	if (ld->sparse_files)
+		return fio_ioring_sparse_close(td, f);
 
 	f->fd = -1;
 	return 0;
@@ -1242,19 +3349,20 @@ static int fio_ioring_cmd_get_file_size(struct thread_data *td,
 
 	if (o->cmd_type == FIO_URING_CMD_NVME) {
 		struct nvme_data *data = NULL;
-		unsigned int nsid, lba_size = 0;
 		__u64 nlba = 0;
 		int ret;
 
-		ret = fio_nvme_get_info(f, &nsid, &lba_size, &nlba);
-		if (ret)
-			return ret;
-
 		data = calloc(1, sizeof(struct nvme_data));
-		data->nsid = nsid;
-		data->lba_shift = ilog2(lba_size);
+		ret = fio_nvme_get_info(f, &nlba, o->pi_act, data);
+		if (ret) {
+			free(data);
+			return ret;
+		}
 
-		f->real_file_size = lba_size * nlba;
+		if (data->lba_ext)
+			f->real_file_size = data->lba_ext * nlba;
+		else
+			f->real_file_size = data->lba_size * nlba;
 		fio_file_set_size_known(f);
 
 		FILE_SET_ENG_DATA(f, data);
@@ -1314,19 +3422,28 @@ free:
 	return ret;
 }
 
+static int fio_ioring_cmd_fetch_fdp_stats(struct thread_data *td,
+					  struct fio_file *f,
+					  struct fio_fdp_stats *stats)
+{
+	return fio_nvme_fdp_stats(td, f, stats);
+}
+
 static struct ioengine_ops ioengine_uring = {
 	.name			= "io_uring",
 	.version		= FIO_IOOPS_VERSION,
 	.flags			= FIO_ASYNCIO_SYNC_TRIM | FIO_NO_OFFLOAD |
-					FIO_ASYNCIO_SETS_ISSUE_TIME,
+					FIO_ASYNCIO_SETS_ISSUE_TIME |
+					FIO_MULTI_RANGE_TRIM | FIO_TRIM_MODES |
+					FIO_ATOMICWRITES,
 	.init			= fio_ioring_init,
 	.post_init		= fio_ioring_post_init,
 	.io_u_init		= fio_ioring_io_u_init,
 	.prep			= fio_ioring_prep,
 	.queue			= fio_ioring_queue,
 	.commit			= fio_ioring_commit,
-	.getevents		= fio_ioring_getevents,
-	.event			= fio_ioring_event,
+	.queue_batch		= fio_ioring_queue_batch,
+	.reap_batch		= fio_ioring_reap_batch,
 	.cleanup		= fio_ioring_cleanup,
 	.open_file		= fio_ioring_open_file,
 	.close_file		= fio_ioring_close_file,
@@ -1340,7 +3457,9 @@ static struct ioengine_ops ioengine_uring_cmd = {
 	.version		= FIO_IOOPS_VERSION,
 	.flags			= FIO_ASYNCIO_SYNC_TRIM | FIO_NO_OFFLOAD |
 					FIO_MEMALIGN | FIO_RAWIO |
-					FIO_ASYNCIO_SETS_ISSUE_TIME,
+					FIO_ASYNCIO_SETS_ISSUE_TIME |
+					FIO_ZONE_APPEND | FIO_MULTI_RANGE_TRIM |
+					FIO_TRIM_MODES,
 	.init			= fio_ioring_init,
 	.post_init		= fio_ioring_cmd_post_init,
 	.io_u_init		= fio_ioring_io_u_init,
@@ -1360,6 +3479,7 @@ static struct ioengine_ops ioengine_uring_cmd = {
 	.options		= options,
 	.option_struct_size	= sizeof(struct ioring_options),
 	.fdp_fetch_ruhs		= fio_ioring_cmd_fetch_ruhs,
+	.fdp_fetch_stats	= fio_ioring_cmd_fetch_fdp_stats,
 };
 
 static void fio_init fio_ioring_register(void)
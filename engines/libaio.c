@@ -10,6 +10,8 @@
 #include <libaio.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 #include "../fio.h"
 #include "../lib/pow2.h"
@@ -52,12 +54,22 @@ struct libaio_data {
 	unsigned int head;
 	unsigned int tail;
 
+	/*
+	 * Completion notification for resfd=1. Every iocb carries
+	 * IOCB_FLAG_RESFD, so the kernel bumps 'event_fd' for each
+	 * completion and we can sleep in epoll instead of io_getevents().
+	 */
+	int event_fd;
+	int epoll_fd;
+
 	struct cmdprio cmdprio;
 };
 
 struct libaio_options {
 	struct thread_data *td;
 	unsigned int userspace_reap;
+	unsigned int userspace_reap_spins;
+	unsigned int resfd;
 	struct cmdprio_options cmdprio_options;
 	unsigned int nowait;
 };
@@ -72,6 +84,26 @@ static struct fio_option options[] = {
 		.category = FIO_OPT_C_ENGINE,
 		.group	= FIO_OPT_G_LIBAIO,
 	},
+	{
+		.name	= "userspace_reap_spins",
+		.lname	= "Libaio userspace reap spins",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct libaio_options, userspace_reap_spins),
+		.help	= "Number of empty ring polls before sleeping for completions",
+		.def	= "0",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_LIBAIO,
+	},
+	{
+		.name	= "resfd",
+		.lname	= "Libaio eventfd completion notification",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct libaio_options, resfd),
+		.help	= "Signal completions through an eventfd (IOCB_FLAG_RESFD)",
+		.def	= "0",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_LIBAIO,
+	},
 #ifdef FIO_HAVE_IOPRIO_CLASS
 	{
 		.name	= "cmdprio_percentage",
@@ -178,6 +210,7 @@ static inline void ring_inc(struct libaio_data *ld, unsigned int *val,
 
 static int fio_libaio_prep(struct thread_data *td, struct io_u *io_u)
 {
+	struct libaio_data *ld = td->io_ops_data;
 	struct libaio_options *o = td->eo;
 	struct fio_file *f = io_u->file;
 	struct iocb *iocb = &io_u->iocb;
@@ -190,9 +223,15 @@ static int fio_libaio_prep(struct thread_data *td, struct io_u *io_u)
 		io_prep_pwrite(iocb, f->fd, io_u->xfer_buf, io_u->xfer_buflen, io_u->offset);
 		if (o->nowait)
 			iocb->aio_rw_flags |= RWF_NOWAIT;
+		if (td->o.oatomic)
+			iocb->aio_rw_flags |= RWF_ATOMIC;
 	} else if (ddir_sync(io_u->ddir))
 		io_prep_fsync(iocb, f->fd);
 
+	if (ld->event_fd != -1 &&
+	    (io_u->ddir == DDIR_READ || io_u->ddir == DDIR_WRITE))
+		io_set_eventfd(iocb, ld->event_fd);
+
 	return 0;
 }
 
@@ -269,6 +308,34 @@ static int user_io_getevents(io_context_t aio_ctx, unsigned int max,
 	return i;
 }
 
+/*
+ * Sleep until the eventfd signals at least one completion, or the timeout
+ * expires. Returns 1 if woken by a completion, 0 on timeout, or -errno.
+ * The eventfd counter is drained on wakeup, the actual events are then
+ * reaped in one go by the caller.
+ */
+static int fio_libaio_wait_resfd(struct libaio_data *ld,
+				 const struct timespec *t)
+{
+	struct epoll_event ev;
+	uint64_t val;
+	int ret, msec = -1;
+
+	if (t)
+		msec = t->tv_sec * 1000 + t->tv_nsec / 1000000;
+
+	ret = epoll_wait(ld->epoll_fd, &ev, 1, msec);
+	if (ret < 0)
+		return -errno;
+	if (!ret)
+		return 0;
+
+	if (read(ld->event_fd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+		return -errno;
+
+	return 1;
+}
+
 static int fio_libaio_getevents(struct thread_data *td, unsigned int min,
 				unsigned int max, const struct timespec *t)
 {
@@ -276,6 +343,8 @@ static int fio_libaio_getevents(struct thread_data *td, unsigned int min,
 	struct libaio_options *o = td->eo;
 	unsigned actual_min = td->o.iodepth_batch_complete_min == 0 ? 0 : min;
 	struct timespec __lt, *lt = NULL;
+	unsigned int spins = 0;
+	bool user_reap;
 	int r, events = 0;
 
 	if (t) {
@@ -283,22 +352,57 @@ static int fio_libaio_getevents(struct thread_data *td, unsigned int min,
 		lt = &__lt;
 	}
 
+	user_reap = o->userspace_reap == 1 &&
+		((struct aio_ring *)(ld->aio_ctx))->magic == AIO_RING_MAGIC;
+
 	do {
-		if (o->userspace_reap == 1
-		    && actual_min == 0
-		    && ((struct aio_ring *)(ld->aio_ctx))->magic
-				== AIO_RING_MAGIC) {
-			r = user_io_getevents(ld->aio_ctx, max,
-				ld->aio_events + events);
+		if (user_reap || ld->event_fd != -1) {
+			/*
+			 * Non-blocking reap first. With userspace_reap this
+			 * reads the ring directly, otherwise it's a zero-wait
+			 * io_getevents().
+			 */
+			if (user_reap)
+				r = user_io_getevents(ld->aio_ctx,
+					max - events, ld->aio_events + events);
+			else
+				r = io_getevents(ld->aio_ctx, 0, max - events,
+					ld->aio_events + events, NULL);
+
+			if (!r && actual_min) {
+				/*
+				 * Nothing there and the caller wants to wait.
+				 * Spin on the ring for a bit, then sleep on
+				 * the eventfd or in io_getevents().
+				 */
+				if (user_reap && spins < o->userspace_reap_spins) {
+					spins++;
+					nop;
+					continue;
+				}
+				spins = 0;
+				if (ld->event_fd != -1) {
+					r = fio_libaio_wait_resfd(ld, lt);
+					if (r > 0)
+						continue;
+					if (!r)
+						break;
+				} else {
+					r = io_getevents(ld->aio_ctx,
+						actual_min - events,
+						max - events,
+						ld->aio_events + events, lt);
+				}
+			}
 		} else {
 			r = io_getevents(ld->aio_ctx, actual_min,
-				max, ld->aio_events + events, lt);
+				max - events, ld->aio_events + events, lt);
 		}
 		if (r > 0)
 			events += r;
 		else if ((min && r == 0) || r == -EAGAIN) {
 			fio_libaio_commit(td);
-			if (actual_min)
+			if (actual_min && !user_reap && ld->event_fd == -1)
 				usleep(10);
 		} else if (r != -EINTR)
 			break;
@@ -307,6 +411,19 @@ static int fio_libaio_getevents(struct thread_data *td, unsigned int min,
 	return r < 0 ? r : events;
 }
 
+static int fio_libaio_reap_batch(struct thread_data *td, struct io_u **io_us,
+				 unsigned int min, unsigned int max,
+				 const struct timespec *t)
+{
+	int i, r;
+
+	r = fio_libaio_getevents(td, min, max, t);
+	for (i = 0; i < r; i++)
+		io_us[i] = fio_libaio_event(td, i);
+
+	return r;
+}
+
 static enum fio_q_status fio_libaio_queue(struct thread_data *td,
 					  struct io_u *io_u)
 {
@@ -351,6 +468,32 @@ static enum fio_q_status fio_libaio_queue(struct thread_data *td,
 	return FIO_Q_QUEUED;
 }
 
+/*
+ * Reads and writes only, syncs and trims still go through ->queue(). The
+ * core never hands us more than iodepth, so the ring has room for them.
+ */
+static void fio_libaio_queue_batch(struct thread_data *td,
+				   struct io_u **io_us, unsigned int nr)
+{
+	struct libaio_data *ld = td->io_ops_data;
+	unsigned int i;
+
+	for (i = 0; i < nr; i++) {
+		struct io_u *io_u = io_us[i];
+
+		fio_ro_check(td, io_u);
+
+		if (ld->cmdprio.mode != CMDPRIO_MODE_NONE)
+			fio_libaio_cmdprio_prep(td, io_u);
+
+		ld->iocbs[ld->head] = &io_u->iocb;
+		ld->io_us[ld->head] = io_u;
+		ring_inc(ld, &ld->head, 1);
+	}
+
+	ld->queued += nr;
+}
+
 static void fio_libaio_queued(struct thread_data *td, struct io_u **io_us,
 			      unsigned int nr)
 {
@@ -467,6 +610,10 @@ static void fio_libaio_cleanup(struct thread_data *td)
 		if (!(td->flags & TD_F_CHILD))
 			io_destroy(ld->aio_ctx);
 
+		if (ld->epoll_fd != -1)
+			close(ld->epoll_fd);
+		if (ld->event_fd != -1)
+			close(ld->event_fd);
 		fio_cmdprio_cleanup(&ld->cmdprio);
 		free(ld->aio_events);
 		free(ld->iocbs);
@@ -502,9 +649,32 @@ static int fio_libaio_init(struct thread_data *td)
 	ld->aio_events = calloc(ld->entries, sizeof(struct io_event));
 	ld->iocbs = calloc(ld->entries, sizeof(struct iocb *));
 	ld->io_us = calloc(ld->entries, sizeof(struct io_u *));
+	ld->event_fd = -1;
+	ld->epoll_fd = -1;
 
 	td->io_ops_data = ld;
 
+	if (o->resfd) {
+		struct epoll_event ev = { .events = EPOLLIN, };
+
+		ld->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (ld->event_fd < 0) {
+			ld->event_fd = -1;
+			td_verror(td, errno, "eventfd");
+			return 1;
+		}
+		ld->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (ld->epoll_fd < 0) {
+			ld->epoll_fd = -1;
+			td_verror(td, errno, "epoll_create1");
+			return 1;
+		}
+		if (epoll_ctl(ld->epoll_fd, EPOLL_CTL_ADD, ld->event_fd, &ev)) {
+			td_verror(td, errno, "epoll_ctl");
+			return 1;
+		}
+	}
+
 	ret = fio_cmdprio_init(td, &ld->cmdprio, &o->cmdprio_options);
 	if (ret) {
 		td_verror(td, EINVAL, "fio_libaio_init");
@@ -518,15 +688,17 @@ FIO_STATIC struct ioengine_ops ioengine = {
 	.name			= "libaio",
 	.version		= FIO_IOOPS_VERSION,
 	.flags			= FIO_ASYNCIO_SYNC_TRIM |
-					FIO_ASYNCIO_SETS_ISSUE_TIME,
+					FIO_ASYNCIO_SETS_ISSUE_TIME |
+					FIO_MULTI_RANGE_TRIM | FIO_TRIM_MODES |
+					FIO_ATOMICWRITES,
 	.init			= fio_libaio_init,
 	.post_init		= fio_libaio_post_init,
 	.prep			= fio_libaio_prep,
 	.queue			= fio_libaio_queue,
 	.commit			= fio_libaio_commit,
+	.queue_batch		= fio_libaio_queue_batch,
+	.reap_batch		= fio_libaio_reap_batch,
 	.cancel			= fio_libaio_cancel,
-	.getevents		= fio_libaio_getevents,
-	.event			= fio_libaio_event,
 	.cleanup		= fio_libaio_cleanup,
 	.open_file		= generic_open_file,
 	.close_file		= generic_close_file,
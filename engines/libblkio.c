@@ -13,6 +13,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <poll.h>
+
 #include <blkio.h>
 
 #include "../fio.h"
@@ -25,8 +27,10 @@ static struct {
 	pthread_mutex_t mutex;
 	int initted_threads;
 	int initted_hipri_threads;
+	int assigned_queues;
+	int assigned_poll_queues;
 	struct blkio *b;
-} proc_state = { PTHREAD_MUTEX_INITIALIZER, 0, 0, NULL };
+} proc_state = { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0, NULL };
 
 static void fio_blkio_proc_lock(void) {
 	int ret;
@@ -40,10 +44,19 @@ static void fio_blkio_proc_unlock(void) {
 	assert(ret == 0);
 }
 
-/* per-thread state */
-struct fio_blkio_data {
+struct fio_blkio_queue {
 	struct blkioq *q;
 	int completion_fd; /* may be -1 if not FIO_BLKIO_WAIT_MODE_EVENTFD */
+	unsigned int inflight;
+};
+
+/* per-thread state */
+struct fio_blkio_data {
+	struct fio_blkio_queue *queues;
+	int nr_queues;
+	int next_queue; /* for FIO_BLKIO_QUEUE_POLICY_ROUNDROBIN */
+	int next_reap; /* queue to reap first, to avoid starving the others */
+	struct pollfd *pfds; /* for FIO_BLKIO_WAIT_MODE_EVENTFD */
 
 	bool has_mem_region; /* whether mem_region is valid */
 	struct blkio_mem_region mem_region; /* only if allocated by libblkio */
@@ -58,6 +71,11 @@ enum fio_blkio_wait_mode {
 	FIO_BLKIO_WAIT_MODE_LOOP,
 };
 
+enum fio_blkio_queue_policy {
+	FIO_BLKIO_QUEUE_POLICY_INDEX,
+	FIO_BLKIO_QUEUE_POLICY_ROUNDROBIN,
+};
+
 struct fio_blkio_options {
 	void *pad; /* option fields must not have offset 0 */
 
@@ -75,6 +93,8 @@ struct fio_blkio_options {
 	unsigned int write_zeroes_on_trim;
 	enum fio_blkio_wait_mode wait_mode;
 	unsigned int force_enable_completion_eventfd;
+	int job_queues;
+	enum fio_blkio_queue_policy queue_policy;
 };
 
 static struct fio_option options[] = {
@@ -198,6 +218,38 @@ static struct fio_option options[] = {
 		.category = FIO_OPT_C_ENGINE,
 		.group	= FIO_OPT_G_LIBBLKIO,
 	},
+	{
+		.name	= "libblkio_job_queues",
+		.lname	= "Number of libblkio queues per job",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct fio_blkio_options, job_queues),
+		.help	= "Number of queues to spread the job's I/O over",
+		.def	= "1",
+		.minval	= 1,
+		.interval = 1,
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_LIBBLKIO,
+	},
+	{
+		.name	= "libblkio_queue_policy",
+		.lname	= "How to pick a queue for each request",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct fio_blkio_options, queue_policy),
+		.help	= "How to distribute requests over the job's queues",
+		.def	= "index",
+		.posval = {
+			  { .ival = "index",
+			    .oval = FIO_BLKIO_QUEUE_POLICY_INDEX,
+			    .help = "Each io_u always uses the same queue",
+			  },
+			  { .ival = "roundrobin",
+			    .oval = FIO_BLKIO_QUEUE_POLICY_ROUNDROBIN,
+			    .help = "Rotate over the queues on each request",
+			  },
+		},
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_LIBBLKIO,
+	},
 	{
 		.name = NULL,
 	},
@@ -277,11 +329,11 @@ static bool possibly_null_strs_equal(const char *a, const char *b)
 }
 
 /*
- * Returns the total number of subjobs using the 'libblkio' ioengine and setting
- * the 'thread' option in the entire workload that have the given value for the
- * 'hipri' option.
+ * Returns the total number of queues needed by subjobs using the 'libblkio'
+ * ioengine and setting the 'thread' option in the entire workload that have
+ * the given value for the 'hipri' option.
  */
-static int total_threaded_subjobs(bool hipri)
+static int total_threaded_queues(bool hipri)
 {
 	int count = 0;
 
@@ -289,7 +341,7 @@ static int total_threaded_subjobs(bool hipri)
 		const struct fio_blkio_options *options = td->eo;
 		if (strcmp(td->o.ioengine, "libblkio") == 0 &&
 		    td->o.use_thread && (bool)options->hipri == hipri)
-			++count;
+			count += options->job_queues;
 	} end_for_each();
 
 	return count;
@@ -495,7 +547,7 @@ static int fio_blkio_init(struct thread_data *td)
 {
 	const struct fio_blkio_options *options = td->eo;
 	struct fio_blkio_data *data;
-	int flags;
+	int flags, i;
 
 	if (td->o.use_thread && incompatible_threaded_subjob_options) {
 		/*
@@ -518,9 +570,13 @@ static int fio_blkio_init(struct thread_data *td)
 		return 1;
 	}
 
+	data->nr_queues = options->job_queues;
+	data->queues = calloc(data->nr_queues, sizeof(data->queues[0]));
+	data->pfds = calloc(data->nr_queues, sizeof(data->pfds[0]));
 	data->iovecs = calloc(td->o.iodepth, sizeof(data->iovecs[0]));
 	data->completions = calloc(td->o.iodepth, sizeof(data->completions[0]));
-	if (!data->iovecs || !data->completions) {
+	if (!data->queues || !data->pfds || !data->iovecs ||
+	    !data->completions) {
 		log_err("fio: calloc() failed\n");
 		goto err_free;
 	}
@@ -532,11 +588,11 @@ static int fio_blkio_init(struct thread_data *td)
 		int num_queues, num_poll_queues;
 
 		if (td->o.use_thread) {
-			num_queues 	= total_threaded_subjobs(false);
-			num_poll_queues = total_threaded_subjobs(true);
+			num_queues 	= total_threaded_queues(false);
+			num_poll_queues = total_threaded_queues(true);
 		} else {
-			num_queues 	= options->hipri ? 0 : 1;
-			num_poll_queues = options->hipri ? 1 : 0;
+			num_queues 	= options->hipri ? 0 : data->nr_queues;
+			num_poll_queues = options->hipri ? data->nr_queues : 0;
 		}
 
 		if (fio_blkio_create_and_connect(td, &proc_state.b) != 0)
@@ -560,41 +616,58 @@ static int fio_blkio_init(struct thread_data *td)
 		}
 	}
 
-	if (options->hipri) {
-		int i = proc_state.initted_hipri_threads;
-		data->q = blkio_get_poll_queue(proc_state.b, i);
-	} else {
-		int i = proc_state.initted_threads -
-				proc_state.initted_hipri_threads;
-		data->q = blkio_get_queue(proc_state.b, i);
-	}
+	for (i = 0; i < data->nr_queues; i++) {
+		struct fio_blkio_queue *bq = &data->queues[i];
+
+		if (options->hipri)
+			bq->q = blkio_get_poll_queue(proc_state.b,
+					proc_state.assigned_poll_queues + i);
+		else
+			bq->q = blkio_get_queue(proc_state.b,
+					proc_state.assigned_queues + i);
+		if (!bq->q) {
+			log_err("fio: libblkio queue %d not available\n", i);
+			goto err_blkio_destroy;
+		}
+
+		bq->completion_fd = -1;
+		if (options->wait_mode != FIO_BLKIO_WAIT_MODE_EVENTFD &&
+		    !options->force_enable_completion_eventfd)
+			continue;
+
+		/*
+		 * Enable completion fd. With a single queue we block in read()
+		 * on it, with several we poll() them all.
+		 */
+		blkioq_set_completion_fd_enabled(bq->q, true);
+		bq->completion_fd = blkioq_get_completion_fd(bq->q);
+		data->pfds[i].fd = bq->completion_fd;
+		data->pfds[i].events = POLLIN;
 
-	if (options->wait_mode == FIO_BLKIO_WAIT_MODE_EVENTFD ||
-		options->force_enable_completion_eventfd) {
-		/* enable completion fd and make it blocking */
-		blkioq_set_completion_fd_enabled(data->q, true);
-		data->completion_fd = blkioq_get_completion_fd(data->q);
+		if (data->nr_queues > 1)
+			continue;
 
-		flags = fcntl(data->completion_fd, F_GETFL);
+		flags = fcntl(bq->completion_fd, F_GETFL);
 		if (flags < 0) {
 			log_err("fio: fcntl(F_GETFL) failed: %s\n",
 				strerror(errno));
 			goto err_blkio_destroy;
 		}
 
-		if (fcntl(data->completion_fd, F_SETFL,
+		if (fcntl(bq->completion_fd, F_SETFL,
 			  flags & ~O_NONBLOCK) != 0) {
 			log_err("fio: fcntl(F_SETFL) failed: %s\n",
 				strerror(errno));
 			goto err_blkio_destroy;
 		}
-	} else {
-		data->completion_fd = -1;
 	}
 
 	++proc_state.initted_threads;
-	if (options->hipri)
+	if (options->hipri) {
 		++proc_state.initted_hipri_threads;
+		proc_state.assigned_poll_queues += data->nr_queues;
+	} else
+		proc_state.assigned_queues += data->nr_queues;
 
 	/* Set data last so cleanup() does nothing if init() fails. */
 	td->io_ops_data = data;
@@ -613,6 +686,8 @@ err_unlock:
 err_free:
 	free(data->completions);
 	free(data->iovecs);
+	free(data->pfds);
+	free(data->queues);
 	free(data);
 	return 1;
 }
@@ -673,12 +748,17 @@ static void fio_blkio_cleanup(struct thread_data *td)
 	if (data) {
 		free(data->completions);
 		free(data->iovecs);
+		free(data->pfds);
+		free(data->queues);
 		free(data);
 
 		fio_blkio_proc_lock();
 		if (--proc_state.initted_threads == 0) {
 			blkio_destroy(&proc_state.b);
 			proc_state.b = NULL;
+			proc_state.initted_hipri_threads = 0;
+			proc_state.assigned_queues = 0;
+			proc_state.assigned_poll_queues = 0;
 		}
 		fio_blkio_proc_unlock();
 	}
@@ -748,11 +828,33 @@ static int fio_blkio_open_file(struct thread_data *td, struct fio_file *f)
 	return 0;
 }
 
+static struct fio_blkio_queue *fio_blkio_pick_queue(struct thread_data *td,
+						    struct io_u *io_u)
+{
+	const struct fio_blkio_options *options = td->eo;
+	struct fio_blkio_data *data = td->io_ops_data;
+	int i;
+
+	if (data->nr_queues == 1)
+		return &data->queues[0];
+
+	if (options->queue_policy == FIO_BLKIO_QUEUE_POLICY_ROUNDROBIN) {
+		i = data->next_queue;
+		if (++data->next_queue == data->nr_queues)
+			data->next_queue = 0;
+	} else
+		i = io_u->index % data->nr_queues;
+
+	return &data->queues[i];
+}
+
 static enum fio_q_status fio_blkio_queue(struct thread_data *td,
 					 struct io_u *io_u)
 {
 	const struct fio_blkio_options *options = td->eo;
 	struct fio_blkio_data *data = td->io_ops_data;
+	struct fio_blkio_queue *bq = fio_blkio_pick_queue(td, io_u);
+	struct blkioq *q = bq->q;
 
 	fio_ro_check(td, io_u);
 
@@ -763,10 +865,10 @@ static enum fio_q_status fio_blkio_queue(struct thread_data *td,
 				iov->iov_base = io_u->xfer_buf;
 				iov->iov_len = (size_t)io_u->xfer_buflen;
 
-				blkioq_readv(data->q, io_u->offset, iov, 1,
+				blkioq_readv(q, io_u->offset, iov, 1,
 					     io_u, 0);
 			} else {
-				blkioq_read(data->q, io_u->offset,
+				blkioq_read(q, io_u->offset,
 					    io_u->xfer_buf,
 					    (size_t)io_u->xfer_buflen, io_u, 0);
 			}
@@ -777,10 +879,10 @@ static enum fio_q_status fio_blkio_queue(struct thread_data *td,
 				iov->iov_base = io_u->xfer_buf;
 				iov->iov_len = (size_t)io_u->xfer_buflen;
 
-				blkioq_writev(data->q, io_u->offset, iov, 1,
+				blkioq_writev(q, io_u->offset, iov, 1,
 					      io_u, 0);
 			} else {
-				blkioq_write(data->q, io_u->offset,
+				blkioq_write(q, io_u->offset,
 					     io_u->xfer_buf,
 					     (size_t)io_u->xfer_buflen, io_u,
 					     0);
@@ -788,16 +890,16 @@ static enum fio_q_status fio_blkio_queue(struct thread_data *td,
 			break;
 		case DDIR_TRIM:
 			if (options->write_zeroes_on_trim) {
-				blkioq_write_zeroes(data->q, io_u->offset,
+				blkioq_write_zeroes(q, io_u->offset,
 						    io_u->xfer_buflen, io_u, 0);
 			} else {
-				blkioq_discard(data->q, io_u->offset,
+				blkioq_discard(q, io_u->offset,
 					       io_u->xfer_buflen, io_u, 0);
 			}
 		        break;
 		case DDIR_SYNC:
 		case DDIR_DATASYNC:
-			blkioq_flush(data->q, io_u, 0);
+			blkioq_flush(q, io_u, 0);
 			break;
 		default:
 			io_u->error = ENOTSUP;
@@ -805,20 +907,118 @@ static enum fio_q_status fio_blkio_queue(struct thread_data *td,
 			return FIO_Q_COMPLETED;
 	}
 
+	bq->inflight++;
 	return FIO_Q_QUEUED;
 }
 
+/*
+ * Reap whatever has completed on all of the job's queues, without blocking.
+ * This also submits requests that were queued but not yet submitted.
+ */
+static int fio_blkio_reap_queues(struct fio_blkio_data *data, int n, int max)
+{
+	int i, ret;
+
+	for (i = 0; i < data->nr_queues && n < max; i++) {
+		struct fio_blkio_queue *bq;
+
+		bq = &data->queues[(data->next_reap + i) % data->nr_queues];
+		if (!bq->inflight)
+			continue;
+
+		ret = blkioq_do_io(bq->q, data->completions + n, 0, max - n,
+				   NULL);
+		if (ret < 0) {
+			fio_blkio_log_err(blkioq_do_io);
+			return -1;
+		}
+
+		bq->inflight -= ret;
+		n += ret;
+	}
+
+	if (++data->next_reap == data->nr_queues)
+		data->next_reap = 0;
+
+	return n;
+}
+
+static int fio_blkio_getevents_multi(struct thread_data *td, unsigned int min,
+				     unsigned int max)
+{
+	const struct fio_blkio_options *options = td->eo;
+	struct fio_blkio_data *data = td->io_ops_data;
+	struct fio_blkio_queue *busiest;
+	uint64_t event;
+	int i, ret, n;
+
+	n = fio_blkio_reap_queues(data, 0, (int)max);
+
+	while (n >= 0 && n < (int)min) {
+		switch (options->wait_mode) {
+		case FIO_BLKIO_WAIT_MODE_BLOCK:
+			/* block on the queue with the most requests in flight */
+			busiest = &data->queues[0];
+			for (i = 1; i < data->nr_queues; i++)
+				if (data->queues[i].inflight > busiest->inflight)
+					busiest = &data->queues[i];
+			if (!busiest->inflight)
+				return n;
+
+			ret = blkioq_do_io(busiest->q, data->completions + n,
+					   1, (int)max - n, NULL);
+			if (ret < 0) {
+				fio_blkio_log_err(blkioq_do_io);
+				return -1;
+			}
+			busiest->inflight -= ret;
+			n += ret;
+			break;
+		case FIO_BLKIO_WAIT_MODE_EVENTFD:
+			ret = poll(data->pfds, data->nr_queues, -1);
+			if (ret < 0 && errno != EINTR) {
+				log_err("fio: poll() on the completion fds failed: %s\n",
+					strerror(errno));
+				return -1;
+			}
+			for (i = 0; ret > 0 && i < data->nr_queues; i++) {
+				if (!(data->pfds[i].revents & POLLIN))
+					continue;
+				if (read(data->pfds[i].fd, &event,
+					 sizeof(event)) < 0 && errno != EAGAIN) {
+					log_err("fio: read() on the completion fd failed: %s\n",
+						strerror(errno));
+					return -1;
+				}
+			}
+			break;
+		case FIO_BLKIO_WAIT_MODE_LOOP:
+			break;
+		default:
+			return -1;
+		}
+
+		n = fio_blkio_reap_queues(data, n, (int)max);
+	}
+
+	return n;
+}
+
 static int fio_blkio_getevents(struct thread_data *td, unsigned int min,
 			       unsigned int max, const struct timespec *t)
 {
 	const struct fio_blkio_options *options = td->eo;
 	struct fio_blkio_data *data = td->io_ops_data;
+	struct blkioq *q = data->queues[0].q;
 	int ret, n;
 	uint64_t event;
 
+	if (data->nr_queues > 1)
+		return fio_blkio_getevents_multi(td, min, max);
+
 	switch (options->wait_mode) {
 	case FIO_BLKIO_WAIT_MODE_BLOCK:
-		n = blkioq_do_io(data->q, data->completions, (int)min, (int)max,
+		n = blkioq_do_io(q, data->completions, (int)min, (int)max,
 				 NULL);
 		if (n < 0) {
 			fio_blkio_log_err(blkioq_do_io);
@@ -826,20 +1026,20 @@ static int fio_blkio_getevents(struct thread_data *td, unsigned int min,
 		}
 		return n;
 	case FIO_BLKIO_WAIT_MODE_EVENTFD:
-		n = blkioq_do_io(data->q, data->completions, 0, (int)max, NULL);
+		n = blkioq_do_io(q, data->completions, 0, (int)max, NULL);
 		if (n < 0) {
 			fio_blkio_log_err(blkioq_do_io);
 			return -1;
 		}
 		while (n < (int)min) {
-			ret = read(data->completion_fd, &event, sizeof(event));
+			ret = read(data->queues[0].completion_fd, &event, sizeof(event));
 			if (ret != sizeof(event)) {
 				log_err("fio: read() on the completion fd returned %d\n",
 					ret);
 				return -1;
 			}
 
-			ret = blkioq_do_io(data->q, data->completions + n, 0,
+			ret = blkioq_do_io(q, data->completions + n, 0,
 					   (int)max - n, NULL);
 			if (ret < 0) {
 				fio_blkio_log_err(blkioq_do_io);
@@ -851,7 +1051,7 @@ static int fio_blkio_getevents(struct thread_data *td, unsigned int min,
 		return n;
 	case FIO_BLKIO_WAIT_MODE_LOOP:
 		for (n = 0; n < (int)min; ) {
-			ret = blkioq_do_io(data->q, data->completions + n, 0,
+			ret = blkioq_do_io(q, data->completions + n, 0,
 					   (int)max - n, NULL);
 			if (ret < 0) {
 				fio_blkio_log_err(blkioq_do_io);
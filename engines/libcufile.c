@@ -33,10 +33,18 @@
 #define GPU_ID_SEP ":"
 
 enum {
-	IO_CUFILE    = 1,
-	IO_POSIX     = 2
+	IO_CUFILE       = 1,
+	IO_POSIX        = 2,
+	IO_CUFILE_BATCH = 3,
+	IO_CUFILE_ASYNC = 4
 };
 
+/*
+ * cuFileStreamRegister() flags: buffer offset, file offset and size are all
+ * known when an I/O is enqueued on its stream.
+ */
+#define LIBCUFILE_STREAM_FLAGS 0x7
+
 struct libcufile_options {
 	struct thread_data *td;
 	char               *gpu_ids;       /* colon-separated list of GPU ids,
@@ -56,6 +64,38 @@ struct fio_libcufile_data {
 	CUfileHandle_t cf_handle;
 };
 
+#ifdef CONFIG_LIBCUFILE_ASYNC
+/*
+ * Per-job state for the cufile_batch and cufile_async I/O types
+ */
+struct libcufile_async_data {
+	CUfileBatchHandle_t batch_id;
+	int                 batch_setup;
+	CUfileIOParams_t   *params;        /* cufile_batch: queued, not yet
+					      submitted */
+	CUfileIOEvents_t   *batch_events;  /* cufile_batch: status buffer */
+	unsigned int        queued;
+	struct io_u       **inflight;      /* cufile_async: submitted io_us */
+	unsigned int        nr_inflight;
+	struct io_u       **events;        /* reaped, handed out by ->event */
+};
+
+/*
+ * Per io_u state, see ->io_u_priv_size. The request fields are handed to
+ * cuFile{Read,Write}Async by reference and must stay put until the stream
+ * has drained.
+ */
+struct libcufile_io_u {
+	size_t              gpu_offset;
+	cudaStream_t        stream;
+	int                 stream_registered;
+	size_t              size;
+	off_t               file_offset;
+	off_t               buf_offset;
+	ssize_t             bytes;
+};
+#endif
+
 static struct fio_option options[] = {
 	{
 		.name	  = "gpu_dev_ids",
@@ -81,7 +121,17 @@ static struct fio_option options[] = {
 			    { .ival = "posix",
 			      .oval = IO_POSIX,
 			      .help = "POSIX I/O"
-			    }
+			    },
+#ifdef CONFIG_LIBCUFILE_ASYNC
+			    { .ival = "cufile_batch",
+			      .oval = IO_CUFILE_BATCH,
+			      .help = "libcufile nvidia-fs, cuFile batch API"
+			    },
+			    { .ival = "cufile_async",
+			      .oval = IO_CUFILE_ASYNC,
+			      .help = "libcufile nvidia-fs, stream-ordered async API"
+			    },
+#endif
 		},
 		.category = FIO_OPT_C_ENGINE,
 		.group	  = FIO_OPT_G_LIBCUFILE,
@@ -107,6 +157,18 @@ static pthread_mutex_t running_lock = PTHREAD_MUTEX_INITIALIZER;
 			rc = 0;                                                     \
 	} while(0)
 
+/* I/O goes through nvidia-fs, as opposed to POSIX plus cudaMemcpy */
+static inline bool fio_libcufile_gds(struct libcufile_options *o)
+{
+	return o->cuda_io != IO_POSIX;
+}
+
+/* I/O is queued and reaped through ->getevents */
+static inline bool fio_libcufile_async(struct libcufile_options *o)
+{
+	return o->cuda_io == IO_CUFILE_BATCH || o->cuda_io == IO_CUFILE_ASYNC;
+}
+
 static const char *fio_libcufile_get_cuda_error(CUfileError_t st)
 {
 	if (IS_CUFILE_ERR(st.err))
@@ -156,6 +218,75 @@ static int fio_libcufile_find_gpu_id(struct thread_data *td)
 	return gpu_id;
 }
 
+#ifdef CONFIG_LIBCUFILE_ASYNC
+static void fio_libcufile_free_async(struct thread_data *td)
+{
+	struct libcufile_async_data *cd = td->io_ops_data;
+
+	if (cd == NULL)
+		return;
+
+	if (cd->batch_setup)
+		cuFileBatchIODestroy(cd->batch_id);
+	free(cd->params);
+	free(cd->batch_events);
+	free(cd->inflight);
+	free(cd->events);
+	free(cd);
+	td->io_ops_data = NULL;
+}
+
+static int fio_libcufile_init_async(struct thread_data *td)
+{
+	struct libcufile_options *o = td->eo;
+	struct libcufile_async_data *cd;
+	unsigned int depth = td->o.iodepth;
+	CUfileError_t status;
+
+	cd = calloc(1, sizeof(*cd));
+	if (cd == NULL) {
+		log_err("libcufile async data calloc failed: err=%d\n", errno);
+		return 1;
+	}
+	td->io_ops_data = cd;
+
+	cd->inflight = calloc(depth, sizeof(struct io_u *));
+	cd->events = calloc(depth, sizeof(struct io_u *));
+	if (cd->inflight == NULL || cd->events == NULL)
+		goto exit_nomem;
+
+	if (o->cuda_io == IO_CUFILE_BATCH) {
+		cd->params = calloc(depth, sizeof(CUfileIOParams_t));
+		cd->batch_events = calloc(depth, sizeof(CUfileIOEvents_t));
+		if (cd->params == NULL || cd->batch_events == NULL)
+			goto exit_nomem;
+
+		/*
+		 * One batch handle carries every in-flight I/O of the job. Its
+		 * size is capped by max_batch_io_size in cufile.json.
+		 */
+		status = cuFileBatchIOSetUp(&cd->batch_id, depth);
+		if (status.err != CU_FILE_SUCCESS) {
+			log_err("cuFileBatchIOSetUp(%u): err=%d:%s\n", depth,
+				status.err, fio_libcufile_get_cuda_error(status));
+			log_err("iodepth may exceed max_batch_io_size in cufile.json\n");
+			goto exit_err;
+		}
+		cd->batch_setup = 1;
+	}
+
+	td->io_ops->flags &= ~FIO_SYNCIO;
+	td_set_ioengine_flags(td);
+	return 0;
+
+exit_nomem:
+	log_err("libcufile async arrays calloc failed: err=%d\n", errno);
+exit_err:
+	fio_libcufile_free_async(td);
+	return 1;
+}
+#endif
+
 static int fio_libcufile_init(struct thread_data *td)
 {
 	struct libcufile_options *o = td->eo;
@@ -166,7 +297,7 @@ static int fio_libcufile_init(struct thread_data *td)
 	pthread_mutex_lock(&running_lock);
 	if (running == 0) {
 		assert(cufile_initialized == 0);
-		if (o->cuda_io == IO_CUFILE) {
+		if (fio_libcufile_gds(o)) {
 			/* only open the driver if this is the first worker thread */
 			status = cuFileDriverOpen();
 			if (status.err != CU_FILE_SUCCESS)
@@ -180,7 +311,7 @@ static int fio_libcufile_init(struct thread_data *td)
 	initialized = cufile_initialized;
 	pthread_mutex_unlock(&running_lock);
 
-	if (o->cuda_io == IO_CUFILE && !initialized)
+	if (fio_libcufile_gds(o) && !initialized)
 		return 1;
 
 	o->my_gpu_id = fio_libcufile_find_gpu_id(td);
@@ -192,6 +323,11 @@ static int fio_libcufile_init(struct thread_data *td)
 	if (rc != 0)
 		return 1;
 
+#ifdef CONFIG_LIBCUFILE_ASYNC
+	if (fio_libcufile_async(o))
+		return fio_libcufile_init_async(td);
+#endif
+
 	return 0;
 }
 
@@ -202,7 +338,7 @@ static inline int fio_libcufile_pre_write(struct thread_data *td,
 {
 	int rc = 0;
 
-	if (o->cuda_io == IO_CUFILE) {
+	if (fio_libcufile_gds(o)) {
 		if (td->o.verify) {
 			/*
 			  Data is being verified, copy the io_u buffer to GPU memory.
@@ -251,7 +387,7 @@ static inline int fio_libcufile_post_read(struct thread_data *td,
 {
 	int rc = 0;
 
-	if (o->cuda_io == IO_CUFILE) {
+	if (fio_libcufile_gds(o)) {
 		if (td->o.verify) {
 			/* Copy GPU memory to CPU buffer for verify */
 			check_cudaruntimecall(cudaMemcpy(io_u->xfer_buf,
@@ -282,6 +418,260 @@ static inline int fio_libcufile_post_read(struct thread_data *td,
 	return rc;
 }
 
+#ifdef CONFIG_LIBCUFILE_ASYNC
+static int fio_libcufile_io_u_init(struct thread_data *td, struct io_u *io_u)
+{
+	struct libcufile_options *o = td->eo;
+	struct libcufile_io_u *cio = io_u->engine_data;
+	CUfileError_t status;
+	int rc;
+
+	if (o->cuda_io != IO_CUFILE_ASYNC)
+		return 0;
+
+	/*
+	 * One stream per io_u, so that up to iodepth transfers are in flight
+	 * and each one completes independently of the others.
+	 */
+	check_cudaruntimecall(cudaStreamCreateWithFlags(&cio->stream,
+						cudaStreamNonBlocking), rc);
+	if (rc != 0)
+		return 1;
+
+	status = cuFileStreamRegister(cio->stream, LIBCUFILE_STREAM_FLAGS);
+	if (status.err != CU_FILE_SUCCESS) {
+		log_err("cuFileStreamRegister: err=%d:%s\n", status.err,
+			fio_libcufile_get_cuda_error(status));
+		cudaStreamDestroy(cio->stream);
+		cio->stream = NULL;
+		return 1;
+	}
+	cio->stream_registered = 1;
+
+	return 0;
+}
+
+static void fio_libcufile_io_u_free(struct thread_data *td, struct io_u *io_u)
+{
+	struct libcufile_io_u *cio = io_u->engine_data;
+
+	if (cio->stream_registered) {
+		cuFileStreamDeregister(cio->stream);
+		cio->stream_registered = 0;
+	}
+	if (cio->stream) {
+		cudaStreamDestroy(cio->stream);
+		cio->stream = NULL;
+	}
+}
+
+/*
+ * Queue a read or write for cufile_batch or cufile_async. Batch I/O is
+ * collected and handed to the driver in ->commit, stream I/O is enqueued
+ * on the io_u stream right away.
+ */
+static int fio_libcufile_queue_async(struct thread_data *td,
+				     struct libcufile_options *o,
+				     struct fio_libcufile_data *fcd,
+				     struct io_u *io_u, size_t gpu_offset)
+{
+	struct libcufile_async_data *cd = td->io_ops_data;
+	struct libcufile_io_u *cio = io_u->engine_data;
+	CUfileError_t status;
+
+	cio->gpu_offset = gpu_offset;
+
+	if (o->cuda_io == IO_CUFILE_BATCH) {
+		CUfileIOParams_t *p = &cd->params[cd->queued++];
+
+		p->mode = CUFILE_BATCH;
+		p->fh = fcd->cf_handle;
+		p->opcode = io_u->ddir == DDIR_READ ? CUFILE_READ : CUFILE_WRITE;
+		p->cookie = io_u;
+		p->u.batch.devPtr_base = o->cu_mem_ptr;
+		p->u.batch.devPtr_offset = gpu_offset;
+		p->u.batch.file_offset = io_u->offset;
+		p->u.batch.size = io_u->xfer_buflen;
+		return 0;
+	}
+
+	cio->size = io_u->xfer_buflen;
+	cio->file_offset = io_u->offset;
+	cio->buf_offset = gpu_offset;
+	cio->bytes = 0;
+
+	if (io_u->ddir == DDIR_READ)
+		status = cuFileReadAsync(fcd->cf_handle, o->cu_mem_ptr,
+					 &cio->size, &cio->file_offset,
+					 &cio->buf_offset, &cio->bytes,
+					 cio->stream);
+	else
+		status = cuFileWriteAsync(fcd->cf_handle, o->cu_mem_ptr,
+					  &cio->size, &cio->file_offset,
+					  &cio->buf_offset, &cio->bytes,
+					  cio->stream);
+	if (status.err != CU_FILE_SUCCESS) {
+		log_err("cuFile%sAsync: err=%d:%s\n",
+			io_u->ddir == DDIR_READ ? "Read" : "Write", status.err,
+			fio_libcufile_get_cuda_error(status));
+		io_u->error = EIO;
+		return 1;
+	}
+
+	cd->inflight[cd->nr_inflight++] = io_u;
+	cd->queued++;
+	return 0;
+}
+
+static int fio_libcufile_commit(struct thread_data *td)
+{
+	struct libcufile_options *o = td->eo;
+	struct libcufile_async_data *cd = td->io_ops_data;
+	CUfileError_t status;
+
+	if (!cd || !cd->queued)
+		return 0;
+
+	if (o->cuda_io == IO_CUFILE_BATCH) {
+		status = cuFileBatchIOSubmit(cd->batch_id, cd->queued,
+					     cd->params, 0);
+		if (status.err != CU_FILE_SUCCESS) {
+			log_err("cuFileBatchIOSubmit(%u): err=%d:%s\n",
+				cd->queued, status.err,
+				fio_libcufile_get_cuda_error(status));
+			return -EIO;
+		}
+	}
+
+	io_u_mark_submit(td, cd->queued);
+	cd->queued = 0;
+	return 0;
+}
+
+/*
+ * Finish a reaped read or write: account short transfers and, for
+ * verify, bring read data back from the GPU.
+ */
+static void fio_libcufile_complete(struct thread_data *td, struct io_u *io_u,
+				   ssize_t bytes)
+{
+	struct libcufile_options *o = td->eo;
+	struct libcufile_io_u *cio = io_u->engine_data;
+
+	if (bytes < 0) {
+		log_err("cuFile %s: err=%ld\n",
+			io_u->ddir == DDIR_READ ? "read" : "write", bytes);
+		io_u->error = EIO;
+	} else if ((unsigned long long) bytes < io_u->xfer_buflen)
+		io_u->resid = io_u->xfer_buflen - bytes;
+
+	if (!io_u->error && io_u->ddir == DDIR_READ)
+		fio_libcufile_post_read(td, o, io_u, cio->gpu_offset);
+}
+
+static int fio_libcufile_getevents_batch(struct thread_data *td,
+					  unsigned int min, unsigned int max,
+					  const struct timespec *t)
+{
+	struct libcufile_async_data *cd = td->io_ops_data;
+	struct timespec ts, *tsp = NULL;
+	CUfileError_t status;
+	unsigned int i, nr;
+
+	if (t) {
+		ts = *t;
+		tsp = &ts;
+	}
+
+	nr = max;
+	status = cuFileBatchIOGetStatus(cd->batch_id, min, &nr,
+					cd->batch_events, tsp);
+	if (status.err != CU_FILE_SUCCESS) {
+		log_err("cuFileBatchIOGetStatus: err=%d:%s\n", status.err,
+			fio_libcufile_get_cuda_error(status));
+		return -EIO;
+	}
+
+	for (i = 0; i < nr; i++) {
+		CUfileIOEvents_t *ev = &cd->batch_events[i];
+		struct io_u *io_u = ev->cookie;
+
+		if (ev->status != CUFILE_COMPLETE) {
+			log_err("cuFile batch %s: status=%d\n",
+				io_u->ddir == DDIR_READ ? "read" : "write",
+				ev->status);
+			io_u->error = EIO;
+		} else
+			fio_libcufile_complete(td, io_u, ev->ret);
+
+		cd->events[i] = io_u;
+	}
+
+	return nr;
+}
+
+static int fio_libcufile_getevents_stream(struct thread_data *td,
+					   unsigned int min, unsigned int max)
+{
+	struct libcufile_async_data *cd = td->io_ops_data;
+	unsigned int i, events = 0;
+	cudaError_t res;
+
+	do {
+		for (i = 0; i < cd->nr_inflight && events < max; ) {
+			struct io_u *io_u = cd->inflight[i];
+			struct libcufile_io_u *cio = io_u->engine_data;
+
+			res = cudaStreamQuery(cio->stream);
+			if (res == cudaErrorNotReady) {
+				i++;
+				continue;
+			}
+
+			if (res != cudaSuccess) {
+				log_err("cudaStreamQuery: err=%d:%s\n", res,
+					cudaGetErrorName(res));
+				io_u->error = EIO;
+			} else
+				fio_libcufile_complete(td, io_u, cio->bytes);
+
+			cd->events[events++] = io_u;
+			cd->inflight[i] = cd->inflight[--cd->nr_inflight];
+		}
+
+		if (events >= min || !cd->nr_inflight)
+			break;
+
+		/*
+		 * Not enough yet, block on the oldest stream still pending
+		 * rather than spinning on cudaStreamQuery().
+		 */
+		cudaStreamSynchronize(((struct libcufile_io_u *)
+				       cd->inflight[0]->engine_data)->stream);
+	} while (1);
+
+	return events;
+}
+
+static int fio_libcufile_getevents(struct thread_data *td, unsigned int min,
+				   unsigned int max, const struct timespec *t)
+{
+	struct libcufile_options *o = td->eo;
+
+	if (o->cuda_io == IO_CUFILE_BATCH)
+		return fio_libcufile_getevents_batch(td, min, max, t);
+
+	return fio_libcufile_getevents_stream(td, min, max);
+}
+
+static struct io_u *fio_libcufile_event(struct thread_data *td, int event)
+{
+	struct libcufile_async_data *cd = td->io_ops_data;
+
+	return cd->events[event];
+}
+#endif
+
 static enum fio_q_status fio_libcufile_queue(struct thread_data *td,
 					     struct io_u *io_u)
 {
@@ -294,14 +684,24 @@ static enum fio_q_status fio_libcufile_queue(struct thread_data *td,
 	size_t gpu_offset;
 	int rc;
 
-	if (o->cuda_io == IO_CUFILE && fcd == NULL) {
+	if (fio_libcufile_gds(o) && fcd == NULL) {
 		io_u->error = EINVAL;
 		td_verror(td, EINVAL, "xfer");
-		return FIO_Q_COMPLETED;
+		goto out;
 	}
 
 	fio_ro_check(td, io_u);
 
+#ifdef CONFIG_LIBCUFILE_ASYNC
+	/* let queued and in-flight transfers finish before a sync */
+	if (fio_libcufile_async(o) && ddir_sync(io_u->ddir)) {
+		struct libcufile_async_data *cd = td->io_ops_data;
+
+		if (cd->queued || td->io_u_in_flight)
+			return FIO_Q_BUSY;
+	}
+#endif
+
 	switch(io_u->ddir) {
 	case DDIR_SYNC:
 		rc = fsync(io_u->file->fd);
@@ -335,7 +735,7 @@ static enum fio_q_status fio_libcufile_queue(struct thread_data *td,
 
 		assert(gpu_offset + io_u->xfer_buflen <= o->total_mem);
 
-		if (o->cuda_io == IO_CUFILE) {
+		if (fio_libcufile_gds(o)) {
 			if (!(ALIGNED_4KB(io_u->xfer_buflen) ||
 			      (o->logged & LOGGED_BUFLEN_NOT_ALIGNED))) {
 				log_err("buflen not 4KB-aligned: %llu\n", io_u->xfer_buflen);
@@ -355,6 +755,14 @@ static enum fio_q_status fio_libcufile_queue(struct thread_data *td,
 		if (io_u->error != 0)
 			break;
 
+#ifdef CONFIG_LIBCUFILE_ASYNC
+		if (fio_libcufile_async(o)) {
+			if (!fio_libcufile_queue_async(td, o, fcd, io_u, gpu_offset))
+				return FIO_Q_QUEUED;
+			break;
+		}
+#endif
+
 		while (remaining > 0) {
 			assert(gpu_offset + xfered <= o->total_mem);
 			if (io_u->ddir == DDIR_READ) {
@@ -441,6 +849,12 @@ static enum fio_q_status fio_libcufile_queue(struct thread_data *td,
 		td_verror(td, io_u->error, "xfer");
 	}
 
+out:
+#ifdef CONFIG_LIBCUFILE_ASYNC
+	/* td_io_queue() leaves this to engines that have a ->commit hook */
+	io_u_mark_submit(td, 1);
+	io_u_mark_complete(td, 1);
+#endif
 	return FIO_Q_COMPLETED;
 }
 
@@ -455,7 +869,7 @@ static int fio_libcufile_open_file(struct thread_data *td, struct fio_file *f)
 	if (rc)
 		return rc;
 
-	if (o->cuda_io == IO_CUFILE) {
+	if (fio_libcufile_gds(o)) {
 		fcd = calloc(1, sizeof(*fcd));
 		if (fcd == NULL) {
 			rc = ENOMEM;
@@ -537,7 +951,7 @@ static int fio_libcufile_iomem_alloc(struct thread_data *td, size_t total_mem)
 	if (rc != 0)
 		goto exit_error;
 
-	if (o->cuda_io == IO_CUFILE) {
+	if (fio_libcufile_gds(o)) {
 		status = cuFileBufRegister(o->cu_mem_ptr, total_mem, 0);
 		if (status.err != CU_FILE_SUCCESS) {
 			log_err("cuFileBufRegister: err=%d:%s\n", status.err,
@@ -573,7 +987,7 @@ static void fio_libcufile_iomem_free(struct thread_data *td)
 		o->junk_buf = NULL;
 	}
 	if (o->cu_mem_ptr) {
-		if (o->cuda_io == IO_CUFILE)
+		if (fio_libcufile_gds(o))
 			cuFileBufDeregister(o->cu_mem_ptr);
 		cudaFree(o->cu_mem_ptr);
 		o->cu_mem_ptr = NULL;
@@ -588,13 +1002,17 @@ static void fio_libcufile_cleanup(struct thread_data *td)
 {
 	struct libcufile_options *o = td->eo;
 
+#ifdef CONFIG_LIBCUFILE_ASYNC
+	fio_libcufile_free_async(td);
+#endif
+
 	pthread_mutex_lock(&running_lock);
 	running--;
 	assert(running >= 0);
 	if (running == 0) {
 		/* only close the driver if initialized and
 		   this is the last worker thread */
-		if (o->cuda_io == IO_CUFILE && cufile_initialized)
+		if (fio_libcufile_gds(o) && cufile_initialized)
 			cuFileDriverClose();
 		cufile_initialized = 0;
 	}
@@ -612,6 +1030,14 @@ FIO_STATIC struct ioengine_ops ioengine = {
 	.iomem_alloc         = fio_libcufile_iomem_alloc,
 	.iomem_free          = fio_libcufile_iomem_free,
 	.cleanup             = fio_libcufile_cleanup,
+#ifdef CONFIG_LIBCUFILE_ASYNC
+	.commit              = fio_libcufile_commit,
+	.getevents           = fio_libcufile_getevents,
+	.event               = fio_libcufile_event,
+	.io_u_init           = fio_libcufile_io_u_init,
+	.io_u_free           = fio_libcufile_io_u_free,
+	.io_u_priv_size      = sizeof(struct libcufile_io_u),
+#endif
 	.flags               = FIO_SYNCIO,
 	.options             = options,
 	.option_struct_size  = sizeof(struct libcufile_options)
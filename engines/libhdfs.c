@@ -20,10 +20,26 @@
 #define CHUNCK_NAME_LENGTH_MAX 80
 #define CHUNCK_CREATION_BUFFER_SIZE 65536
 
+/*
+ * An open chunk. Up to hdfs_open_files of them are kept open, keyed by file,
+ * chunk and open mode, and the least recently used one is closed to make
+ * room for another.
+ */
+struct hdfsio_chunk {
+	struct fio_file *f;
+	uint64_t id;
+	int flags;
+	hdfsFile fp;
+	uint64_t last_use;
+};
+
 struct hdfsio_data {
 	hdfsFS fs;
-	hdfsFile fp;
-	uint64_t curr_file_id;
+	hdfsFile fp;			/* chunk of the io_u being prepped */
+	struct hdfsio_chunk *chunks;
+	unsigned int nr_chunks;
+	uint64_t use_clock;
+	struct hadoopRzOptions *rz;	/* set while zero-copy reads work */
 };
 
 struct hdfsio_options {
@@ -34,6 +50,8 @@ struct hdfsio_options {
 	unsigned int chunck_size;
 	unsigned int single_instance;
 	unsigned int use_direct;
+	unsigned int open_files;
+	unsigned int zero_copy;
 };
 
 static struct fio_option options[] = {
@@ -110,6 +128,27 @@ static struct fio_option options[] = {
 		.category = FIO_OPT_C_ENGINE,
 		.group	= FIO_OPT_G_HDFS,
 	},
+	{
+		.name	= "hdfs_open_files",
+		.lname	= "HDFS open chunks",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct hdfsio_options, open_files),
+		.def    = "1",
+		.minval	= 1,
+		.help	= "Number of chunks to keep open",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_HDFS,
+	},
+	{
+		.name	= "hdfs_zero_copy",
+		.lname	= "HDFS zero-copy reads",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct hdfsio_options, zero_copy),
+		.def    = "0",
+		.help	= "Use hadoopReadZero for reads",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_HDFS,
+	},
 	{
 		.name	= NULL,
 	},
@@ -120,29 +159,34 @@ static int get_chunck_name(char *dest, char *file_name, uint64_t chunk_id) {
 	return snprintf(dest, CHUNCK_NAME_LENGTH_MAX, "%s_%lu", file_name, chunk_id);
 }
 
+static int hdfsio_close_chunk(struct hdfsio_data *hd, struct hdfsio_chunk *c)
+{
+	if (!c->fp)
+		return 0;
+
+	if (hdfsCloseFile(hd->fs, c->fp) == -1) {
+		log_err("hdfs: unable to close file: %s\n", strerror(errno));
+		c->fp = NULL;
+		return errno;
+	}
+	c->fp = NULL;
+	return 0;
+}
+
+/*
+ * Find the open chunk for the io_u, opening it if need be. A chunk open for
+ * the other mode is closed first, HDFS files have a single writer and
+ * readers only see what was written before they opened the file.
+ */
 static int fio_hdfsio_prep(struct thread_data *td, struct io_u *io_u)
 {
 	struct hdfsio_options *options = td->eo;
 	struct hdfsio_data *hd = td->io_ops_data;
+	struct hdfsio_chunk *c, *slot = NULL;
 	unsigned long f_id;
 	char fname[CHUNCK_NAME_LENGTH_MAX];
-	int open_flags;
-
-	/* find out file id based on the offset generated by fio */
-	f_id = floor(io_u->offset / options-> chunck_size);
-
-	if (f_id == hd->curr_file_id) {
-		/* file is already open */
-		return 0;
-	}
-
-	if (hd->curr_file_id != -1) {
-		if ( hdfsCloseFile(hd->fs, hd->fp) == -1) {
-			log_err("hdfs: unable to close file: %s\n", strerror(errno));
-			return errno;
-		}
-		hd->curr_file_id = -1;
-	}
+	unsigned int i;
+	int open_flags, ret;
 
 	if (io_u->ddir == DDIR_READ || io_u->ddir == DDIR_SYNC) {
 		open_flags = O_RDONLY;
@@ -152,19 +196,94 @@ static int fio_hdfsio_prep(struct thread_data *td, struct io_u *io_u)
 		log_err("hdfs: Invalid I/O Operation\n");
 		return 0;
 	}
-	
+
+	/* find out file id based on the offset generated by fio */
+	f_id = floor(io_u->offset / options-> chunck_size);
+
+	for (i = 0; i < hd->nr_chunks; i++) {
+		c = &hd->chunks[i];
+		if (!c->fp) {
+			slot = c;
+			continue;
+		}
+		if (c->f != io_u->file || c->id != f_id)
+			continue;
+		if (c->flags == open_flags) {
+			/* file is already open */
+			c->last_use = ++hd->use_clock;
+			hd->fp = c->fp;
+			return 0;
+		}
+		ret = hdfsio_close_chunk(hd, c);
+		if (ret)
+			return ret;
+		slot = c;
+	}
+
+	/* no room, close the least recently used chunk */
+	if (!slot) {
+		slot = &hd->chunks[0];
+		for (i = 1; i < hd->nr_chunks; i++)
+			if (hd->chunks[i].last_use < slot->last_use)
+				slot = &hd->chunks[i];
+		ret = hdfsio_close_chunk(hd, slot);
+		if (ret)
+			return ret;
+	}
+
 	get_chunck_name(fname, io_u->file->file_name, f_id);
-	hd->fp = hdfsOpenFile(hd->fs, fname, open_flags, 0, 0,
+	slot->fp = hdfsOpenFile(hd->fs, fname, open_flags, 0, 0,
 			      options->chunck_size);
-	if(hd->fp == NULL) {
-		log_err("hdfs: unable to open file: %s: %d\n", fname, strerror(errno));
+	if(slot->fp == NULL) {
+		log_err("hdfs: unable to open file: %s: %s\n", fname, strerror(errno));
 		return errno;
 	}
-	hd->curr_file_id = f_id;
+	slot->f = io_u->file;
+	slot->id = f_id;
+	slot->flags = open_flags;
+	slot->last_use = ++hd->use_clock;
+	hd->fp = slot->fp;
 
 	return 0;
 }
 
+/*
+ * Read through hadoopReadZero, which hands out the chunk's data as a
+ * ByteBuffer: mmapped from a local replica, or a direct buffer filled by
+ * the client otherwise. Either way the data skips the copies into and out
+ * of a Java array that hdfsRead makes. Returns -2 if zero-copy reads aren't
+ * supported, so the caller can fall back.
+ */
+static int hdfsio_read_zero(struct hdfsio_data *hd, struct io_u *io_u)
+{
+	char *p = io_u->xfer_buf;
+	int done = 0;
+
+	while (done < (int)io_u->xfer_buflen) {
+		struct hadoopRzBuffer *buf;
+		int32_t len;
+
+		buf = hadoopReadZero(hd->fp, hd->rz, io_u->xfer_buflen - done);
+		if (!buf) {
+			if (errno == EPROTONOSUPPORT && !done)
+				return -2;
+			return done ? done : -1;
+		}
+
+		len = hadoopRzBufferLength(buf);
+		if (len > 0)
+			memcpy(p + done, hadoopRzBufferGet(buf), len);
+		hadoopRzBufferFree(hd->fp, buf);
+
+		/* end of the chunk */
+		if (len <= 0)
+			break;
+		done += len;
+	}
+
+	return done;
+}
+
 static enum fio_q_status fio_hdfsio_queue(struct thread_data *td,
 					  struct io_u *io_u)
 {
@@ -182,8 +301,20 @@ static enum fio_q_status fio_hdfsio_queue(struct thread_data *td,
 		return FIO_Q_COMPLETED;
 	};
 
+	ret = -2;
+	if (io_u->ddir == DDIR_READ && hd->rz) {
+		ret = hdfsio_read_zero(hd, io_u);
+		if (ret == -2) {
+			log_info("hdfs: zero-copy reads not supported, using hdfsRead\n");
+			hadoopRzOptionsFree(hd->rz);
+			hd->rz = NULL;
+		}
+	}
+
 	// do the IO
-	if (io_u->ddir == DDIR_READ) {
+	if (ret != -2) {
+		/* zero-copy read done */
+	} else if (io_u->ddir == DDIR_READ) {
 		if (options->use_direct) {
 			ret = readDirect(hd->fs, hd->fp, io_u->xfer_buf, io_u->xfer_buflen);
 		} else {
@@ -229,15 +360,17 @@ int fio_hdfsio_open_file(struct thread_data *td, struct fio_file *f)
 int fio_hdfsio_close_file(struct thread_data *td, struct fio_file *f)
 {
 	struct hdfsio_data *hd = td->io_ops_data;
-
-	if (hd->curr_file_id != -1) {
-		if ( hdfsCloseFile(hd->fs, hd->fp) == -1) {
-			log_err("hdfs: unable to close file: %s\n", strerror(errno));
-			return errno;
-		}
-		hd->curr_file_id = -1;
+	unsigned int i;
+	int err, ret = 0;
+
+	for (i = 0; i < hd->nr_chunks; i++) {
+		if (hd->chunks[i].f != f)
+			continue;
+		err = hdfsio_close_chunk(hd, &hd->chunks[i]);
+		if (err && !ret)
+			ret = err;
 	}
-	return 0;
+	return ret;
 }
 
 static int fio_hdfsio_io_u_init(struct thread_data *td, struct io_u *io_u)
@@ -317,8 +450,6 @@ static int fio_hdfsio_setup(struct thread_data *td)
 	if (!td->io_ops_data) {
 		hd = malloc(sizeof(*hd));
 		memset(hd, 0, sizeof(*hd));
-		
-		hd->curr_file_id = -1;
 
 		td->io_ops_data = hd;
 	}
@@ -380,10 +511,45 @@ static int fio_hdfsio_init(struct thread_data *td)
 		log_err("hdfs: invalid working directory %s: %s\n", options->directory, strerror(errno));
 		return failure;
 	}
-	
+
+	hd->nr_chunks = options->open_files;
+	hd->chunks = calloc(hd->nr_chunks, sizeof(*hd->chunks));
+	if (!hd->chunks)
+		return ENOMEM;
+
+	/*
+	 * Checksums have to be skipped for the client to hand out mmapped
+	 * data. The pool provides direct buffers where it can't.
+	 */
+	if (options->zero_copy) {
+		hd->rz = hadoopRzOptionsAlloc();
+		if (!hd->rz ||
+		    hadoopRzOptionsSetSkipChecksum(hd->rz, 1) ||
+		    hadoopRzOptionsSetByteBufferPool(hd->rz,
+					ELASTIC_BYTE_BUFFER_POOL_CLASS)) {
+			failure = errno;
+			log_err("hdfs: unable to set up zero-copy reads: %s\n", strerror(errno));
+			return failure;
+		}
+	}
+
 	return 0;
 }
 
+static void fio_hdfsio_cleanup(struct thread_data *td)
+{
+	struct hdfsio_data *hd = td->io_ops_data;
+
+	if (!hd)
+		return;
+
+	if (hd->rz)
+		hadoopRzOptionsFree(hd->rz);
+	free(hd->chunks);
+	free(hd);
+	td->io_ops_data = NULL;
+}
+
 static void fio_hdfsio_io_u_free(struct thread_data *td, struct io_u *io_u)
 {
 	struct hdfsio_data *hd = td->io_ops_data;
@@ -403,6 +569,7 @@ FIO_STATIC struct ioengine_ops ioengine = {
 	.queue = fio_hdfsio_queue,
 	.open_file = fio_hdfsio_open_file,
 	.close_file = fio_hdfsio_close_file,
+	.cleanup = fio_hdfsio_cleanup,
 	.io_u_init = fio_hdfsio_io_u_init,
 	.io_u_free = fio_hdfsio_io_u_free,
 	.option_struct_size	= sizeof(struct hdfsio_options),
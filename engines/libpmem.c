@@ -36,6 +36,11 @@
  *
  *   direct=1 means PMEM_F_MEM_NONTEMPORAL flag is set in pmem_memcpy().
  *
+ *   copy_kernel selects what writes are done with, libpmem's pmem_memcpy()
+ *   or one of fio's own movnt, avx512nt or clwb kernels. With iodepth > 1,
+ *   writes are copied as they are queued and made durable with a single
+ *   drain per submitted batch instead of one per write.
+ *
  *   The pmem device must have a DAX-capable filesystem and be mounted
  *   with DAX enabled. Directory must point to a mount point of DAX FS.
  *
@@ -55,6 +60,10 @@
 
 #include "../fio.h"
 #include "../verify.h"
+#include "../optgroup.h"
+#include "../lib/pmem_copy.h"
+
+#define LIBPMEM_COPY_LIBPMEM	0
 
 struct fio_libpmem_data {
 	void *libpmem_ptr;
@@ -62,9 +71,57 @@ struct fio_libpmem_data {
 	off_t libpmem_off;
 };
 
+/* iodepth > 1: io_us copied but not yet drained, see fio_libpmem_commit() */
+struct fio_libpmem_batch {
+	struct io_u **io_us;
+	int queued;
+	int events;
+};
+
+struct fio_libpmem_options {
+	void *pad;
+	unsigned int copy_kernel;
+};
+
+static struct fio_option options[] = {
+	{
+		.name	= "copy_kernel",
+		.lname	= "Copy kernel",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct fio_libpmem_options, copy_kernel),
+		.help	= "How writes are copied to persistent memory",
+		.def	= "libpmem",
+		.posval = {
+			  { .ival = "libpmem",
+			    .oval = LIBPMEM_COPY_LIBPMEM,
+			    .help = "libpmem pmem_memcpy()",
+			  },
+			  { .ival = "movnt",
+			    .oval = PMEM_COPY_MOVNT,
+			    .help = "SSE2 non-temporal stores",
+			  },
+			  { .ival = "avx512nt",
+			    .oval = PMEM_COPY_AVX512NT,
+			    .help = "AVX-512 non-temporal stores",
+			  },
+			  { .ival = "clwb",
+			    .oval = PMEM_COPY_CLWB,
+			    .help = "Regular stores followed by clwb",
+			  },
+		},
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_MMAP,
+	},
+	{
+		.name	= NULL,
+	},
+};
+
 static int fio_libpmem_init(struct thread_data *td)
 {
 	struct thread_options *o = &td->o;
+	struct fio_libpmem_options *eo = td->eo;
+	struct fio_libpmem_batch *pb;
 
 	dprint(FD_IO, "o->rw_min_bs %llu\n o->fsync_blocks %u\n o->fdatasync_blocks %u\n",
 			o->rw_min_bs, o->fsync_blocks, o->fdatasync_blocks);
@@ -76,9 +133,46 @@ static int fio_libpmem_init(struct thread_data *td)
 				"%llu bytes\n",	(unsigned long long) page_size);
 		return 1;
 	}
+
+	if (eo->copy_kernel != LIBPMEM_COPY_LIBPMEM) {
+		if (!pmem_copy_supported(eo->copy_kernel)) {
+			log_err("libpmem: copy_kernel=%s is not supported by "
+				"this CPU\n", pmem_copy_name(eo->copy_kernel));
+			return 1;
+		}
+		log_info("%s: libpmem writes use the %s copy kernel\n", o->name,
+			 pmem_copy_name(eo->copy_kernel));
+	}
+
+	if (o->iodepth > 1) {
+		pb = calloc(1, sizeof(*pb));
+		if (!pb)
+			return 1;
+		pb->io_us = calloc(o->iodepth, sizeof(struct io_u *));
+		if (!pb->io_us) {
+			free(pb);
+			return 1;
+		}
+		td->io_ops_data = pb;
+		td->io_ops->flags &= ~FIO_SYNCIO;
+	} else
+		td->io_ops->flags |= FIO_SYNCIO;
+
+	td_set_ioengine_flags(td);
 	return 0;
 }
 
+static void fio_libpmem_cleanup(struct thread_data *td)
+{
+	struct fio_libpmem_batch *pb = td->io_ops_data;
+
+	if (pb) {
+		free(pb->io_us);
+		free(pb);
+		td->io_ops_data = NULL;
+	}
+}
+
 /*
  * This is the pmem_map_file execution function, a helper to
  * fio_libpmem_open_file function.
@@ -166,19 +260,37 @@ static int fio_libpmem_prep(struct thread_data *td, struct io_u *io_u)
 	return 0;
 }
 
+static void fio_libpmem_drain(struct thread_data *td)
+{
+	struct fio_libpmem_options *eo = td->eo;
+
+	if (eo->copy_kernel == LIBPMEM_COPY_LIBPMEM)
+		pmem_drain();
+	else
+		pmem_copy_drain();
+}
+
 static enum fio_q_status fio_libpmem_queue(struct thread_data *td,
 					   struct io_u *io_u)
 {
+	struct fio_libpmem_options *eo = td->eo;
+	struct fio_libpmem_batch *pb = td->io_ops_data;
 	unsigned flags = 0;
 
 	fio_ro_check(td, io_u);
 	io_u->error = 0;
 
+	if (pb && pb->events)
+		return FIO_Q_BUSY;
+
 	dprint(FD_IO, "DEBUG fio_libpmem_queue\n");
 	dprint(FD_IO, "td->o.odirect %d td->o.sync_io %d\n",
 			td->o.odirect, td->o.sync_io);
-	/* map both O_SYNC / DSYNC to not use NODRAIN */
-	flags = td->o.sync_io ? 0 : PMEM_F_MEM_NODRAIN;
+	/*
+	 * map both O_SYNC / DSYNC to not use NODRAIN, unless writes are
+	 * batched and drained once per batch in ->commit
+	 */
+	flags = td->o.sync_io && !pb ? 0 : PMEM_F_MEM_NODRAIN;
 	flags |= td->o.odirect ? PMEM_F_MEM_NONTEMPORAL : PMEM_F_MEM_TEMPORAL;
 
 	switch (io_u->ddir) {
@@ -188,24 +300,81 @@ static enum fio_q_status fio_libpmem_queue(struct thread_data *td,
 	case DDIR_WRITE:
 		dprint(FD_IO, "DEBUG mmap_data=%p, xfer_buf=%p\n",
 				io_u->mmap_data, io_u->xfer_buf);
-		pmem_memcpy(io_u->mmap_data,
-					io_u->xfer_buf,
-					io_u->xfer_buflen,
-					flags);
+		if (eo->copy_kernel == LIBPMEM_COPY_LIBPMEM) {
+			pmem_memcpy(io_u->mmap_data,
+						io_u->xfer_buf,
+						io_u->xfer_buflen,
+						flags);
+			break;
+		}
+		pmem_copy_nodrain(eo->copy_kernel, io_u->mmap_data,
+				  io_u->xfer_buf, io_u->xfer_buflen);
+		if (!(flags & PMEM_F_MEM_NODRAIN))
+			pmem_copy_drain();
 		break;
 	case DDIR_SYNC:
 	case DDIR_DATASYNC:
 	case DDIR_SYNC_FILE_RANGE:
-		pmem_drain();
+		fio_libpmem_drain(td);
 		break;
 	default:
 		io_u->error = EINVAL;
 		break;
 	}
 
+	if (pb && !io_u->error) {
+		pb->io_us[pb->queued++] = io_u;
+		return FIO_Q_QUEUED;
+	}
+
+	/* td_io_queue() leaves this to engines that have a ->commit hook */
+	io_u_mark_submit(td, 1);
+	io_u_mark_complete(td, 1);
 	return FIO_Q_COMPLETED;
 }
 
+/*
+ * Everything queued has already been copied; one drain makes the whole
+ * batch durable, instead of one drain per write.
+ */
+static int fio_libpmem_commit(struct thread_data *td)
+{
+	struct fio_libpmem_batch *pb = td->io_ops_data;
+
+	if (!pb || pb->events || !pb->queued)
+		return 0;
+
+	if (td->o.sync_io)
+		fio_libpmem_drain(td);
+
+	io_u_mark_submit(td, pb->queued);
+	pb->events = pb->queued;
+	pb->queued = 0;
+	return 0;
+}
+
+static int fio_libpmem_getevents(struct thread_data *td, unsigned int min,
+				 unsigned int fio_unused max,
+				 const struct timespec fio_unused *t)
+{
+	struct fio_libpmem_batch *pb = td->io_ops_data;
+	int ret = 0;
+
+	if (min) {
+		ret = pb->events;
+		pb->events = 0;
+	}
+
+	return ret;
+}
+
+static struct io_u *fio_libpmem_event(struct thread_data *td, int event)
+{
+	struct fio_libpmem_batch *pb = td->io_ops_data;
+
+	return pb->io_us[event];
+}
+
 static int fio_libpmem_close_file(struct thread_data *td, struct fio_file *f)
 {
 	struct fio_libpmem_data *fdd = FILE_ENG_DATA(f);
@@ -229,13 +398,19 @@ FIO_STATIC struct ioengine_ops ioengine = {
 	.version	= FIO_IOOPS_VERSION,
 	.init		= fio_libpmem_init,
 	.prep		= fio_libpmem_prep,
+	.cleanup	= fio_libpmem_cleanup,
 	.queue		= fio_libpmem_queue,
+	.commit		= fio_libpmem_commit,
+	.getevents	= fio_libpmem_getevents,
+	.event		= fio_libpmem_event,
 	.open_file	= fio_libpmem_open_file,
 	.close_file	= fio_libpmem_close_file,
 	.get_file_size	= generic_get_file_size,
 	.prepopulate_file = generic_prepopulate_file,
 	.flags		= FIO_SYNCIO | FIO_RAWIO | FIO_DISKLESSIO | FIO_NOEXTEND |
 				FIO_NODISKUTIL | FIO_BARRIER | FIO_MEMALIGN,
+	.options	= options,
+	.option_struct_size = sizeof(struct fio_libpmem_options),
 };
 
 static void fio_init fio_libpmem_register(void)
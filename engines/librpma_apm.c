@@ -19,8 +19,9 @@
 /* client side implementation */
 
 static inline int client_io_flush(struct thread_data *td,
-		struct io_u *first_io_u, struct io_u *last_io_u,
-		unsigned long long int len);
+		struct librpma_fio_client_conn *c,
+		unsigned long long int offset, unsigned long long int len,
+		struct io_u *last_io_u);
 
 static int client_get_io_u_index(struct ibv_wc *wc, unsigned int *io_u_index);
 
@@ -31,6 +32,7 @@ static int client_init(struct thread_data *td)
 	uint32_t cq_size;
 	struct rpma_conn_cfg *cfg = NULL;
 	struct rpma_peer_cfg *pcfg = NULL;
+	unsigned int i;
 	int ret;
 
 	/* not supported readwrite = trim / randtrim / trimwrite */
@@ -123,11 +125,14 @@ static int client_init(struct thread_data *td)
 			goto err_cleanup_common;
 		}
 
-		if ((ret = rpma_conn_apply_remote_peer_cfg(ccd->conn, pcfg))) {
-			librpma_td_verror(td, ret,
-				"rpma_conn_apply_remote_peer_cfg");
-			(void) rpma_peer_cfg_delete(&pcfg);
-			goto err_cleanup_common;
+		for (i = 0; i < ccd->conn_nr; i++) {
+			if ((ret = rpma_conn_apply_remote_peer_cfg(
+					ccd->conns[i].conn, pcfg))) {
+				librpma_td_verror(td, ret,
+					"rpma_conn_apply_remote_peer_cfg");
+				(void) rpma_peer_cfg_delete(&pcfg);
+				goto err_cleanup_common;
+			}
 		}
 
 		(void) rpma_peer_cfg_delete(&pcfg);
@@ -170,14 +175,15 @@ static void client_cleanup(struct thread_data *td)
 }
 
 static inline int client_io_flush(struct thread_data *td,
-		struct io_u *first_io_u, struct io_u *last_io_u,
-		unsigned long long int len)
+		struct librpma_fio_client_conn *c,
+		unsigned long long int offset, unsigned long long int len,
+		struct io_u *last_io_u)
 {
 	struct librpma_fio_client_data *ccd = td->io_ops_data;
-	size_t dst_offset = first_io_u->offset;
+	size_t dst_offset = offset;
 	int ret;
 
-	if ((ret = rpma_flush(ccd->conn, ccd->server_mr, dst_offset, len,
+	if ((ret = rpma_flush(c->conn, c->server_mr, dst_offset, len,
 			ccd->server_mr_flush_type, RPMA_F_COMPLETION_ALWAYS,
 			(void *)(uintptr_t)last_io_u->index))) {
 		librpma_td_verror(td, ret, "rpma_flush");
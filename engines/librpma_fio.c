@@ -62,6 +62,29 @@ struct fio_option librpma_fio_options[] = {
 		.category = FIO_OPT_C_ENGINE,
 		.group	= FIO_OPT_G_LIBRPMA,
 	},
+	{
+		.name	= "connections",
+		.lname	= "Connections per job",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct librpma_fio_options_values,
+					connections),
+		.help	= "Number of connections per job, io_us are spread over them round-robin",
+		.def	= "1",
+		.minval	= 1,
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_LIBRPMA,
+	},
+	{
+		.name	= "flush_batch",
+		.lname	= "Writes per flush",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct librpma_fio_options_values,
+					flush_batch),
+		.help	= "Number of writes covered by one flush (0 flushes every write sequence)",
+		.def	= "0",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_LIBRPMA,
+	},
 	{
 		.name	= NULL,
 	},
@@ -160,100 +183,57 @@ void librpma_fio_free(struct librpma_fio_mem *mem)
 #define LIBRPMA_FIO_RETRY_MAX_NO	10
 #define LIBRPMA_FIO_RETRY_DELAY_S	5
 
-int librpma_fio_client_init(struct thread_data *td,
-		struct rpma_conn_cfg *cfg)
+/*
+ * Connect one of the client's connections to the server. All of them go to
+ * the same server job, which accepts as many as the job has.
+ */
+static int client_connect(struct thread_data *td,
+		struct librpma_fio_client_conn *c, struct rpma_conn_cfg *cfg,
+		const char *port_td)
 {
-	struct librpma_fio_client_data *ccd;
+	struct librpma_fio_client_data *ccd = td->io_ops_data;
 	struct librpma_fio_options_values *o = td->eo;
-	struct ibv_context *dev = NULL;
-	char port_td[LIBRPMA_FIO_PORT_STR_LEN_MAX];
 	struct rpma_conn_req *req = NULL;
 	enum rpma_conn_event event;
 	struct rpma_conn_private_data pdata;
-	enum rpma_log_level log_level_aux = RPMA_LOG_LEVEL_WARNING;
-	int remote_flush_type;
+	struct librpma_fio_workspace *ws;
 	int retry;
 	int ret;
 
-	/* --debug=net sets RPMA_LOG_THRESHOLD_AUX to RPMA_LOG_LEVEL_INFO */
-#ifdef FIO_INC_DEBUG
-	if ((1UL << FD_NET) & fio_debug)
-		log_level_aux = RPMA_LOG_LEVEL_INFO;
-#endif
-
-	/* configure logging thresholds to see more details */
-	rpma_log_set_threshold(RPMA_LOG_THRESHOLD, RPMA_LOG_LEVEL_INFO);
-	rpma_log_set_threshold(RPMA_LOG_THRESHOLD_AUX, log_level_aux);
-
-	/* obtain an IBV context for a remote IP address */
-	if ((ret = rpma_utils_get_ibv_context(o->server_ip,
-			RPMA_UTIL_IBV_CONTEXT_REMOTE, &dev))) {
-		librpma_td_verror(td, ret, "rpma_utils_get_ibv_context");
-		return -1;
-	}
-
-	/* allocate client's data */
-	ccd = calloc(1, sizeof(*ccd));
-	if (ccd == NULL) {
+	/* allocate the connection's in-memory queues */
+	c->io_us_queued = calloc(td->o.iodepth, sizeof(*c->io_us_queued));
+	c->io_us_flight = calloc(td->o.iodepth, sizeof(*c->io_us_flight));
+	if (c->io_us_queued == NULL || c->io_us_flight == NULL) {
 		td_verror(td, errno, "calloc");
 		return -1;
 	}
 
-	/* allocate all in-memory queues */
-	ccd->io_us_queued = calloc(td->o.iodepth, sizeof(*ccd->io_us_queued));
-	if (ccd->io_us_queued == NULL) {
-		td_verror(td, errno, "calloc");
-		goto err_free_ccd;
-	}
-
-	ccd->io_us_flight = calloc(td->o.iodepth, sizeof(*ccd->io_us_flight));
-	if (ccd->io_us_flight == NULL) {
-		td_verror(td, errno, "calloc");
-		goto err_free_io_u_queues;
-	}
-
-	ccd->io_us_completed = calloc(td->o.iodepth,
-			sizeof(*ccd->io_us_completed));
-	if (ccd->io_us_completed == NULL) {
-		td_verror(td, errno, "calloc");
-		goto err_free_io_u_queues;
-	}
-
-	/* create a new peer object */
-	if ((ret = rpma_peer_new(dev, &ccd->peer))) {
-		librpma_td_verror(td, ret, "rpma_peer_new");
-		goto err_free_io_u_queues;
-	}
-
-	/* create a connection request */
-	if (librpma_fio_td_port(o->port, td, port_td))
-		goto err_peer_delete;
-
 	for (retry = 0; retry < LIBRPMA_FIO_RETRY_MAX_NO; retry++) {
 		if ((ret = rpma_conn_req_new(ccd->peer, o->server_ip, port_td,
 				cfg, &req))) {
 			librpma_td_verror(td, ret, "rpma_conn_req_new");
-			goto err_peer_delete;
+			return -1;
 		}
 
 		/*
 		 * Connect the connection request
 		 * and obtain the connection object.
 		 */
-		if ((ret = rpma_conn_req_connect(&req, NULL, &ccd->conn))) {
+		if ((ret = rpma_conn_req_connect(&req, NULL, &c->conn))) {
 			librpma_td_verror(td, ret, "rpma_conn_req_connect");
-			goto err_req_delete;
+			(void) rpma_conn_req_delete(&req);
+			return -1;
 		}
 
 		/* wait for the connection to establish */
-		if ((ret = rpma_conn_next_event(ccd->conn, &event))) {
+		if ((ret = rpma_conn_next_event(c->conn, &event))) {
 			librpma_td_verror(td, ret, "rpma_conn_next_event");
 			goto err_conn_delete;
 		} else if (event == RPMA_CONN_ESTABLISHED) {
 			break;
 		} else if (event == RPMA_CONN_REJECTED) {
-			(void) rpma_conn_disconnect(ccd->conn);
-			(void) rpma_conn_delete(&ccd->conn);
+			(void) rpma_conn_disconnect(c->conn);
+			(void) rpma_conn_delete(&c->conn);
 			if (retry < LIBRPMA_FIO_RETRY_MAX_NO - 1) {
 				log_err("Thread [%d]: Retrying (#%i) ...\n",
 					td->thread_number, retry + 1);
@@ -275,42 +255,167 @@ int librpma_fio_client_init(struct thread_data *td,
 		log_err("Thread [%d]: Connected after retry #%i\n",
 			td->thread_number, retry);
 
-	if (ccd->conn == NULL)
-		goto err_peer_delete;
+	if (c->conn == NULL)
+		return -1;
 
 	/* get the connection's main CQ */
-	if ((ret = rpma_conn_get_cq(ccd->conn, &ccd->cq))) {
+	if ((ret = rpma_conn_get_cq(c->conn, &c->cq))) {
 		librpma_td_verror(td, ret, "rpma_conn_get_cq");
 		goto err_conn_delete;
 	}
 
 	/* get the connection's private data sent from the server */
-	if ((ret = rpma_conn_get_private_data(ccd->conn, &pdata))) {
+	if ((ret = rpma_conn_get_private_data(c->conn, &pdata))) {
 		librpma_td_verror(td, ret, "rpma_conn_get_private_data");
 		goto err_conn_delete;
 	}
 
 	/* get the server's workspace representation */
-	ccd->ws = pdata.ptr;
+	ws = pdata.ptr;
+	if (ccd->ws == NULL)
+		ccd->ws = ws;
 
 	/* create the server's memory representation */
-	if ((ret = rpma_mr_remote_from_descriptor(&ccd->ws->descriptor[0],
-			ccd->ws->mr_desc_size, &ccd->server_mr))) {
+	if ((ret = rpma_mr_remote_from_descriptor(&ws->descriptor[0],
+			ws->mr_desc_size, &c->server_mr))) {
 		librpma_td_verror(td, ret, "rpma_mr_remote_from_descriptor");
 		goto err_conn_delete;
 	}
 
+	return 0;
+
+err_conn_delete:
+	(void) rpma_conn_disconnect(c->conn);
+	(void) rpma_conn_delete(&c->conn);
+
+	return -1;
+}
+
+static void client_disconnect(struct thread_data *td,
+		struct librpma_fio_client_conn *c)
+{
+	enum rpma_conn_event ev;
+	int ret;
+
+	if (c->server_mr &&
+	    (ret = rpma_mr_remote_delete(&c->server_mr)))
+		librpma_td_verror(td, ret, "rpma_mr_remote_delete");
+
+	if (c->conn) {
+		/* initiate disconnection */
+		if ((ret = rpma_conn_disconnect(c->conn)))
+			librpma_td_verror(td, ret, "rpma_conn_disconnect");
+		/* wait for disconnection to end up */
+		if ((ret = rpma_conn_next_event(c->conn, &ev))) {
+			librpma_td_verror(td, ret, "rpma_conn_next_event");
+		} else if (ev != RPMA_CONN_CLOSED) {
+			log_err(
+				"client_cleanup received an unexpected event (%s != RPMA_CONN_CLOSED)\n",
+				rpma_utils_conn_event_2str(ev));
+		}
+		/* delete the connection */
+		if ((ret = rpma_conn_delete(&c->conn)))
+			librpma_td_verror(td, ret, "rpma_conn_delete");
+	}
+
+	/* free the software queues */
+	free(c->io_us_queued);
+	free(c->io_us_flight);
+}
+
+static void client_free(struct thread_data *td)
+{
+	struct librpma_fio_client_data *ccd = td->io_ops_data;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < ccd->conn_nr; i++)
+		client_disconnect(td, &ccd->conns[i]);
+
+	/* delete the peer */
+	if (ccd->peer && (ret = rpma_peer_delete(&ccd->peer)))
+		librpma_td_verror(td, ret, "rpma_peer_delete");
+
+	free(ccd->conns);
+	free(ccd->io_us_completed);
+	free(ccd);
+	td->io_ops_data = NULL; /* zero ccd */
+}
+
+int librpma_fio_client_init(struct thread_data *td,
+		struct rpma_conn_cfg *cfg)
+{
+	struct librpma_fio_client_data *ccd;
+	struct librpma_fio_options_values *o = td->eo;
+	struct ibv_context *dev = NULL;
+	char port_td[LIBRPMA_FIO_PORT_STR_LEN_MAX];
+	enum rpma_log_level log_level_aux = RPMA_LOG_LEVEL_WARNING;
+	int remote_flush_type;
+	unsigned int i;
+	int ret;
+
+	/* --debug=net sets RPMA_LOG_THRESHOLD_AUX to RPMA_LOG_LEVEL_INFO */
+#ifdef FIO_INC_DEBUG
+	if ((1UL << FD_NET) & fio_debug)
+		log_level_aux = RPMA_LOG_LEVEL_INFO;
+#endif
+
+	/* configure logging thresholds to see more details */
+	rpma_log_set_threshold(RPMA_LOG_THRESHOLD, RPMA_LOG_LEVEL_INFO);
+	rpma_log_set_threshold(RPMA_LOG_THRESHOLD_AUX, log_level_aux);
+
+	/* obtain an IBV context for a remote IP address */
+	if ((ret = rpma_utils_get_ibv_context(o->server_ip,
+			RPMA_UTIL_IBV_CONTEXT_REMOTE, &dev))) {
+		librpma_td_verror(td, ret, "rpma_utils_get_ibv_context");
+		return -1;
+	}
+
+	/* allocate client's data */
+	ccd = calloc(1, sizeof(*ccd));
+	if (ccd == NULL) {
+		td_verror(td, errno, "calloc");
+		return -1;
+	}
+	td->io_ops_data = ccd;
+
+	/* allocate the connections and the queue of completed io_us */
+	ccd->conns = calloc(o->connections, sizeof(*ccd->conns));
+	ccd->io_us_completed = calloc(td->o.iodepth,
+			sizeof(*ccd->io_us_completed));
+	if (ccd->conns == NULL || ccd->io_us_completed == NULL) {
+		td_verror(td, errno, "calloc");
+		goto err_free;
+	}
+
+	/* create a new peer object */
+	if ((ret = rpma_peer_new(dev, &ccd->peer))) {
+		librpma_td_verror(td, ret, "rpma_peer_new");
+		goto err_free;
+	}
+
+	/* connect all connections to the port of the job */
+	if (librpma_fio_td_port(o->port, td, port_td))
+		goto err_free;
+
+	for (i = 0; i < o->connections; i++) {
+		ccd->conn_nr++;
+		if (client_connect(td, &ccd->conns[i], cfg, port_td))
+			goto err_free;
+	}
+
 	/* get the total size of the shared server memory */
-	if ((ret = rpma_mr_remote_get_size(ccd->server_mr, &ccd->ws_size))) {
+	if ((ret = rpma_mr_remote_get_size(ccd->conns[0].server_mr,
+			&ccd->ws_size))) {
 		librpma_td_verror(td, ret, "rpma_mr_remote_get_size");
-		goto err_conn_delete;
+		goto err_free;
 	}
 
 	/* get flush type of the remote node */
-	if ((ret = rpma_mr_remote_get_flush_type(ccd->server_mr,
+	if ((ret = rpma_mr_remote_get_flush_type(ccd->conns[0].server_mr,
 			&remote_flush_type))) {
 		librpma_td_verror(td, ret, "rpma_mr_remote_get_flush_type");
-		goto err_conn_delete;
+		goto err_free;
 	}
 
 	ccd->server_mr_flush_type =
@@ -323,27 +428,10 @@ int librpma_fio_client_init(struct thread_data *td,
 	 */
 	td->o.mem_align = page_size;
 
-	td->io_ops_data = ccd;
-
 	return 0;
 
-err_conn_delete:
-	(void) rpma_conn_disconnect(ccd->conn);
-	(void) rpma_conn_delete(&ccd->conn);
-
-err_req_delete:
-	(void) rpma_conn_req_delete(&req);
-
-err_peer_delete:
-	(void) rpma_peer_delete(&ccd->peer);
-
-err_free_io_u_queues:
-	free(ccd->io_us_queued);
-	free(ccd->io_us_flight);
-	free(ccd->io_us_completed);
-
-err_free_ccd:
-	free(ccd);
+err_free:
+	client_free(td);
 
 	return -1;
 }
@@ -351,41 +439,32 @@ err_free_ccd:
 void librpma_fio_client_cleanup(struct thread_data *td)
 {
 	struct librpma_fio_client_data *ccd = td->io_ops_data;
-	enum rpma_conn_event ev;
+	struct librpma_fio_options_values *o = td->eo;
 	int ret;
 
 	if (ccd == NULL)
 		return;
 
+	/* per-connection stats, for spotting uneven spreading */
+	if (o->connections > 1 || o->flush_batch) {
+		unsigned int i;
+
+		for (i = 0; i < ccd->conn_nr; i++) {
+			struct librpma_fio_client_conn *c = &ccd->conns[i];
+
+			log_info("%s: conn %u: reads=%llu, writes=%llu, flushes=%llu, %.2f writes/flush\n",
+				td->o.name, i, (unsigned long long) c->reads,
+				(unsigned long long) c->writes,
+				(unsigned long long) c->flushes,
+				c->flushes ? (double) c->writes / c->flushes : 0.0);
+		}
+	}
+
 	/* delete the iou's memory registration */
 	if ((ret = rpma_mr_dereg(&ccd->orig_mr)))
 		librpma_td_verror(td, ret, "rpma_mr_dereg");
-	/* delete the iou's memory registration */
-	if ((ret = rpma_mr_remote_delete(&ccd->server_mr)))
-		librpma_td_verror(td, ret, "rpma_mr_remote_delete");
-	/* initiate disconnection */
-	if ((ret = rpma_conn_disconnect(ccd->conn)))
-		librpma_td_verror(td, ret, "rpma_conn_disconnect");
-	/* wait for disconnection to end up */
-	if ((ret = rpma_conn_next_event(ccd->conn, &ev))) {
-		librpma_td_verror(td, ret, "rpma_conn_next_event");
-	} else if (ev != RPMA_CONN_CLOSED) {
-		log_err(
-			"client_cleanup received an unexpected event (%s != RPMA_CONN_CLOSED)\n",
-			rpma_utils_conn_event_2str(ev));
-	}
-	/* delete the connection */
-	if ((ret = rpma_conn_delete(&ccd->conn)))
-		librpma_td_verror(td, ret, "rpma_conn_delete");
-	/* delete the peer */
-	if ((ret = rpma_peer_delete(&ccd->peer)))
-		librpma_td_verror(td, ret, "rpma_peer_delete");
-	/* free the software queues */
-	free(ccd->io_us_queued);
-	free(ccd->io_us_flight);
-	free(ccd->io_us_completed);
-	free(ccd);
-	td->io_ops_data = NULL; /* zero ccd */
+
+	client_free(td);
 }
 
 int librpma_fio_file_nop(struct thread_data *td, struct fio_file *f)
@@ -433,8 +512,20 @@ int librpma_fio_client_get_file_size(struct thread_data *td,
 	return 0;
 }
 
+/* the connection the next io_u goes to */
+static struct librpma_fio_client_conn *client_next_conn(
+		struct librpma_fio_client_data *ccd)
+{
+	struct librpma_fio_client_conn *c = &ccd->conns[ccd->conn_next];
+
+	if (++ccd->conn_next == ccd->conn_nr)
+		ccd->conn_next = 0;
+
+	return c;
+}
+
 static enum fio_q_status client_queue_sync(struct thread_data *td,
-		struct io_u *io_u)
+		struct librpma_fio_client_conn *c, struct io_u *io_u)
 {
 	struct librpma_fio_client_data *ccd = td->io_ops_data;
 	struct ibv_wc wc;
@@ -444,15 +535,16 @@ static enum fio_q_status client_queue_sync(struct thread_data *td,
 	/* execute io_u */
 	if (io_u->ddir == DDIR_READ) {
 		/* post an RDMA read operation */
-		if (librpma_fio_client_io_read(td, io_u,
+		if (librpma_fio_client_io_read(td, c, io_u,
 				RPMA_F_COMPLETION_ALWAYS))
 			goto err;
 	} else if (io_u->ddir == DDIR_WRITE) {
 		/* post an RDMA write operation */
-		if (librpma_fio_client_io_write(td, io_u))
+		if (librpma_fio_client_io_write(td, c, io_u))
 			goto err;
-		if (ccd->flush(td, io_u, io_u, io_u->xfer_buflen))
+		if (ccd->flush(td, c, io_u->offset, io_u->xfer_buflen, io_u))
 			goto err;
+		c->flushes++;
 	} else {
 		log_err("unsupported IO mode: %s\n", io_ddir_name(io_u->ddir));
 		goto err;
@@ -460,7 +552,7 @@ static enum fio_q_status client_queue_sync(struct thread_data *td,
 
 	do {
 		/* get a completion */
-		ret = rpma_cq_get_wc(ccd->cq, 1, &wc, NULL);
+		ret = rpma_cq_get_wc(c->cq, 1, &wc, NULL);
 		if (ret == RPMA_E_NO_COMPLETION) {
 			/* lack of completion is not an error */
 			continue;
@@ -475,10 +567,10 @@ static enum fio_q_status client_queue_sync(struct thread_data *td,
 			goto err;
 
 		if (wc.opcode == IBV_WC_SEND)
-			++ccd->op_send_completed;
+			++c->op_send_completed;
 		else {
 			if (wc.opcode == IBV_WC_RECV)
-				++ccd->op_recv_completed;
+				++c->op_recv_completed;
 
 			break;
 		}
@@ -495,7 +587,7 @@ static enum fio_q_status client_queue_sync(struct thread_data *td,
 	}
 
 	/* make sure all SENDs are completed before exit - clean up SQ */
-	if (librpma_fio_client_io_complete_all_sends(td))
+	if (librpma_fio_client_io_complete_all_sends(td, c))
 		goto err;
 
 	return FIO_Q_COMPLETED;
@@ -509,49 +601,104 @@ enum fio_q_status librpma_fio_client_queue(struct thread_data *td,
 		struct io_u *io_u)
 {
 	struct librpma_fio_client_data *ccd = td->io_ops_data;
+	struct librpma_fio_client_conn *c = &ccd->conns[ccd->conn_next];
 
-	if (ccd->io_u_queued_nr == (int)td->o.iodepth)
+	if (c->io_u_queued_nr == (int)td->o.iodepth)
 		return FIO_Q_BUSY;
 
+	c = client_next_conn(ccd);
+
 	if (td->o.sync_io)
-		return client_queue_sync(td, io_u);
+		return client_queue_sync(td, c, io_u);
 
 	/* io_u -> queued[] */
-	ccd->io_us_queued[ccd->io_u_queued_nr] = io_u;
-	ccd->io_u_queued_nr++;
+	c->io_us_queued[c->io_u_queued_nr] = io_u;
+	c->io_u_queued_nr++;
 
 	return FIO_Q_QUEUED;
 }
 
-int librpma_fio_client_commit(struct thread_data *td)
+/*
+ * Flush all writes posted on the connection since its last flush with one
+ * flush of the range they span. Its completion tells they are all
+ * persistent.
+ */
+static int client_flush_pending(struct thread_data *td,
+		struct librpma_fio_client_conn *c)
+{
+	struct librpma_fio_client_data *ccd = td->io_ops_data;
+
+	if (!c->flush_pending)
+		return 0;
+
+	if (ccd->flush(td, c, c->flush_start, c->flush_end - c->flush_start,
+			c->flush_last_io_u))
+		return -1;
+
+	c->flushes++;
+	c->flush_pending = 0;
+	return 0;
+}
+
+/* add a posted write to the ones to be flushed together */
+static int client_flush_add(struct thread_data *td,
+		struct librpma_fio_client_conn *c, struct io_u *io_u)
+{
+	struct librpma_fio_options_values *o = td->eo;
+	unsigned long long int end = io_u->offset + io_u->xfer_buflen;
+
+	if (!c->flush_pending || io_u->offset < c->flush_start)
+		c->flush_start = io_u->offset;
+	if (!c->flush_pending || end > c->flush_end)
+		c->flush_end = end;
+	c->flush_last_io_u = io_u;
+
+	if (++c->flush_pending < o->flush_batch)
+		return 0;
+
+	return client_flush_pending(td, c);
+}
+
+/* post the queued io_us of a connection */
+static int client_commit_conn(struct thread_data *td,
+		struct librpma_fio_client_conn *c)
 {
 	struct librpma_fio_client_data *ccd = td->io_ops_data;
+	struct librpma_fio_options_values *o = td->eo;
 	int flags = RPMA_F_COMPLETION_ON_ERROR;
-	struct timespec now;
-	bool fill_time;
 	int i;
 	struct io_u *flush_first_io_u = NULL;
 	unsigned long long int flush_len = 0;
 
-	if (!ccd->io_us_queued)
-		return -1;
-
 	/* execute all io_us from queued[] */
-	for (i = 0; i < ccd->io_u_queued_nr; i++) {
-		struct io_u *io_u = ccd->io_us_queued[i];
+	for (i = 0; i < c->io_u_queued_nr; i++) {
+		struct io_u *io_u = c->io_us_queued[i];
 
 		if (io_u->ddir == DDIR_READ) {
-			if (i + 1 == ccd->io_u_queued_nr ||
-			    ccd->io_us_queued[i + 1]->ddir == DDIR_WRITE)
+			/*
+			 * The read's completion completes all io_us posted
+			 * before it, so the writes have to be flushed first.
+			 */
+			if (o->flush_batch && client_flush_pending(td, c))
+				return -1;
+			if (i + 1 == c->io_u_queued_nr ||
+			    c->io_us_queued[i + 1]->ddir == DDIR_WRITE)
 				flags = RPMA_F_COMPLETION_ALWAYS;
 			/* post an RDMA read operation */
-			if (librpma_fio_client_io_read(td, io_u, flags))
+			if (librpma_fio_client_io_read(td, c, io_u, flags))
 				return -1;
 		} else if (io_u->ddir == DDIR_WRITE) {
 			/* post an RDMA write operation */
-			if (librpma_fio_client_io_write(td, io_u))
+			if (librpma_fio_client_io_write(td, c, io_u))
 				return -1;
 
+			/* flush_batch writes share a flush */
+			if (o->flush_batch) {
+				if (client_flush_add(td, c, io_u))
+					return -1;
+				continue;
+			}
+
 			/* cache the first io_u in the sequence */
 			if (flush_first_io_u == NULL)
 				flush_first_io_u = io_u;
@@ -575,14 +722,16 @@ int librpma_fio_client_commit(struct thread_data *td)
 				 * cover all of them which build a continuous
 				 * sequence.
 				 */
-				if ((i + 1 < ccd->io_u_queued_nr) &&
-				    (ccd->io_us_queued[i + 1]->ddir == DDIR_WRITE))
+				if ((i + 1 < c->io_u_queued_nr) &&
+				    (c->io_us_queued[i + 1]->ddir == DDIR_WRITE))
 					continue;
 			}
 
 			/* flush all writes which build a continuous sequence */
-			if (ccd->flush(td, flush_first_io_u, io_u, flush_len))
+			if (ccd->flush(td, c, flush_first_io_u->offset,
+					flush_len, io_u))
 				return -1;
+			c->flushes++;
 
 			/*
 			 * reset the flush parameters in preparation for
@@ -597,6 +746,24 @@ int librpma_fio_client_commit(struct thread_data *td)
 		}
 	}
 
+	return 0;
+}
+
+int librpma_fio_client_commit(struct thread_data *td)
+{
+	struct librpma_fio_client_data *ccd = td->io_ops_data;
+	struct timespec now;
+	bool fill_time;
+	unsigned int n;
+	int i, queued_nr = 0;
+
+	if (!ccd->conns)
+		return -1;
+
+	for (n = 0; n < ccd->conn_nr; n++)
+		if (client_commit_conn(td, &ccd->conns[n]))
+			return -1;
+
 	if ((fill_time = fio_fill_issue_time(td))) {
 		fio_gettime(&now, NULL);
 
@@ -608,28 +775,34 @@ int librpma_fio_client_commit(struct thread_data *td)
 
 	}
 	/* move executed io_us from queued[] to flight[] */
-	for (i = 0; i < ccd->io_u_queued_nr; i++) {
-		struct io_u *io_u = ccd->io_us_queued[i];
+	for (n = 0; n < ccd->conn_nr; n++) {
+		struct librpma_fio_client_conn *c = &ccd->conns[n];
 
-		/* FIO does not do this if the engine is asynchronous */
-		if (fill_time)
-			memcpy(&io_u->issue_time, &now, sizeof(now));
+		for (i = 0; i < c->io_u_queued_nr; i++) {
+			struct io_u *io_u = c->io_us_queued[i];
 
-		/* move executed io_us from queued[] to flight[] */
-		ccd->io_us_flight[ccd->io_u_flight_nr] = io_u;
-		ccd->io_u_flight_nr++;
+			/* FIO does not do this if the engine is asynchronous */
+			if (fill_time)
+				memcpy(&io_u->issue_time, &now, sizeof(now));
 
-		/*
-		 * FIO says:
-		 * If an engine has the commit hook
-		 * it has to call io_u_queued() itself.
-		 */
-		io_u_queued(td, io_u);
+			/* move executed io_us from queued[] to flight[] */
+			c->io_us_flight[c->io_u_flight_nr] = io_u;
+			c->io_u_flight_nr++;
+
+			/*
+			 * FIO says:
+			 * If an engine has the commit hook
+			 * it has to call io_u_queued() itself.
+			 */
+			io_u_queued(td, io_u);
+		}
+
+		queued_nr += c->io_u_queued_nr;
+		c->io_u_queued_nr = 0;
 	}
 
 	/* FIO does not do this if an engine has the commit hook. */
-	io_u_mark_submit(td, ccd->io_u_queued_nr);
-	ccd->io_u_queued_nr = 0;
+	io_u_mark_submit(td, queued_nr);
 
 	return 0;
 }
@@ -640,7 +813,8 @@ int librpma_fio_client_commit(struct thread_data *td)
  * -   0  - when no complicitions received
  * - (-1) - when an error occurred
  */
-static int client_getevent_process(struct thread_data *td)
+static int client_getevent_process(struct thread_data *td,
+		struct librpma_fio_client_conn *c)
 {
 	struct librpma_fio_client_data *ccd = td->io_ops_data;
 	struct ibv_wc wc;
@@ -654,7 +828,7 @@ static int client_getevent_process(struct thread_data *td)
 	int ret;
 
 	/* get a completion */
-	if ((ret = rpma_cq_get_wc(ccd->cq, 1, &wc, NULL))) {
+	if ((ret = rpma_cq_get_wc(c->cq, 1, &wc, NULL))) {
 		/* lack of completion is not an error */
 		if (ret == RPMA_E_NO_COMPLETION) {
 			/* lack of completion is not an error */
@@ -673,16 +847,16 @@ static int client_getevent_process(struct thread_data *td)
 	}
 
 	if (wc.opcode == IBV_WC_SEND)
-		++ccd->op_send_completed;
+		++c->op_send_completed;
 	else if (wc.opcode == IBV_WC_RECV)
-		++ccd->op_recv_completed;
+		++c->op_recv_completed;
 
 	if ((ret = ccd->get_io_u_index(&wc, &io_u_index)) != 1)
 		return ret;
 
 	/* look for an io_u being completed */
-	for (i = 0; i < ccd->io_u_flight_nr; ++i) {
-		if (ccd->io_us_flight[i]->index == io_u_index) {
+	for (i = 0; i < c->io_u_flight_nr; ++i) {
+		if (c->io_us_flight[i]->index == io_u_index) {
 			cmpl_num = i + 1;
 			break;
 		}
@@ -699,7 +873,7 @@ static int client_getevent_process(struct thread_data *td)
 	/* move completed io_us to the completed in-memory queue */
 	for (i = 0; i < cmpl_num; ++i) {
 		/* get and prepare io_u */
-		io_u = ccd->io_us_flight[i];
+		io_u = c->io_us_flight[i];
 
 		/* append to the queue */
 		ccd->io_us_completed[ccd->io_u_completed_nr] = io_u;
@@ -707,13 +881,50 @@ static int client_getevent_process(struct thread_data *td)
 	}
 
 	/* remove completed io_us from the flight queue */
-	for (i = cmpl_num; i < ccd->io_u_flight_nr; ++i)
-		ccd->io_us_flight[i - cmpl_num] = ccd->io_us_flight[i];
-	ccd->io_u_flight_nr -= cmpl_num;
+	for (i = cmpl_num; i < c->io_u_flight_nr; ++i)
+		c->io_us_flight[i - cmpl_num] = c->io_us_flight[i];
+	c->io_u_flight_nr -= cmpl_num;
 
 	return cmpl_num;
 }
 
+/*
+ * Writes waiting for their flush_batch to fill up don't complete. Flush
+ * them if fio waits for more io_us than can complete without them.
+ */
+static int client_flush_for_wait(struct thread_data *td, unsigned int min)
+{
+	struct librpma_fio_client_data *ccd = td->io_ops_data;
+	unsigned int flight = 0, pending = 0, n;
+
+	for (n = 0; n < ccd->conn_nr; n++) {
+		flight += ccd->conns[n].io_u_flight_nr;
+		pending += ccd->conns[n].flush_pending;
+	}
+
+	if (!pending || min <= flight - pending)
+		return 0;
+
+	for (n = 0; n < ccd->conn_nr; n++)
+		if (client_flush_pending(td, &ccd->conns[n]))
+			return -1;
+
+	return 0;
+}
+
+/* true if a connection still has to catch up with CQEs for SENDs */
+static bool client_sends_behind(struct librpma_fio_client_data *ccd)
+{
+	unsigned int n;
+
+	for (n = 0; n < ccd->conn_nr; n++)
+		if (ccd->conns[n].op_send_completed <
+		    ccd->conns[n].op_recv_completed)
+			return true;
+
+	return false;
+}
+
 int librpma_fio_client_getevents(struct thread_data *td, unsigned int min,
 		unsigned int max, const struct timespec *t)
 {
@@ -722,9 +933,19 @@ int librpma_fio_client_getevents(struct thread_data *td, unsigned int min,
 	int cmpl_num_total = 0;
 	/* # of completed io_us from a single event */
 	int cmpl_num;
+	unsigned int n = 0;
+
+	if (client_flush_for_wait(td, min))
+		return -1;
 
 	do {
-		cmpl_num = client_getevent_process(td);
+		/* poll the connections in turn */
+		struct librpma_fio_client_conn *c = &ccd->conns[n];
+
+		if (++n == ccd->conn_nr)
+			n = 0;
+
+		cmpl_num = client_getevent_process(td, c);
 		if (cmpl_num > 0) {
 			/* new completions collected */
 			cmpl_num_total += cmpl_num;
@@ -733,8 +954,8 @@ int librpma_fio_client_getevents(struct thread_data *td, unsigned int min,
 			 * It is required to make sure that CQEs for SENDs
 			 * will flow at least at the same pace as CQEs for RECVs.
 			 */
-			if (cmpl_num_total >= min &&
-			    ccd->op_send_completed >= ccd->op_recv_completed)
+			if (cmpl_num_total >= min && n == 0 &&
+			    !client_sends_behind(ccd))
 				break;
 
 			/*
@@ -754,18 +975,21 @@ int librpma_fio_client_getevents(struct thread_data *td, unsigned int min,
 		 * faster than CQEs for SENDs. But it is required to make sure CQEs for
 		 * SENDs will flow at least at the same pace as CQEs for RECVs.
 		 */
-	} while (cmpl_num_total < max ||
-			ccd->op_send_completed < ccd->op_recv_completed);
+	} while (cmpl_num_total < max || client_sends_behind(ccd));
 
 	/*
 	 * All posted SENDs are completed and RECVs for them (responses) are
 	 * completed. This is the initial situation so the counters are reset.
 	 */
-	if (ccd->op_send_posted == ccd->op_send_completed &&
-			ccd->op_send_completed == ccd->op_recv_completed) {
-		ccd->op_send_posted = 0;
-		ccd->op_send_completed = 0;
-		ccd->op_recv_completed = 0;
+	for (n = 0; n < ccd->conn_nr; n++) {
+		struct librpma_fio_client_conn *c = &ccd->conns[n];
+
+		if (c->op_send_posted == c->op_send_completed &&
+				c->op_send_completed == c->op_recv_completed) {
+			c->op_send_posted = 0;
+			c->op_send_completed = 0;
+			c->op_recv_completed = 0;
+		}
 	}
 
 	return cmpl_num_total;
@@ -890,6 +1114,7 @@ int librpma_fio_server_open_file(struct thread_data *td, struct fio_file *f,
 	void *ws_ptr;
 	bool is_dram;
 	int usage_mem_type;
+	unsigned int i;
 	int ret;
 
 	if (!f->file_name) {
@@ -987,28 +1212,43 @@ int librpma_fio_server_open_file(struct thread_data *td, struct fio_file *f,
 	pdata.ptr = &ws;
 	pdata.len = sizeof(ws);
 
-	/* receive an incoming connection request */
-	if ((ret = rpma_ep_next_conn_req(ep, cfg, &conn_req))) {
-		librpma_td_verror(td, ret, "rpma_ep_next_conn_req");
+	csd->conns = calloc(o->connections, sizeof(*csd->conns));
+	if (csd->conns == NULL) {
+		td_verror(td, errno, "calloc");
 		goto err_mr_dereg;
 	}
 
-	if (csd->prepare_connection && csd->prepare_connection(td, conn_req))
-		goto err_req_delete;
+	/* accept as many connections as the client job makes */
+	for (i = 0; i < o->connections; i++) {
+		/* receive an incoming connection request */
+		if ((ret = rpma_ep_next_conn_req(ep, cfg, &conn_req))) {
+			librpma_td_verror(td, ret, "rpma_ep_next_conn_req");
+			goto err_conns_delete;
+		}
 
-	/* accept the connection request and obtain the connection object */
-	if ((ret = rpma_conn_req_connect(&conn_req, &pdata, &conn))) {
-		librpma_td_verror(td, ret, "rpma_conn_req_connect");
-		goto err_req_delete;
-	}
+		if (csd->prepare_connection &&
+		    csd->prepare_connection(td, conn_req))
+			goto err_req_delete;
 
-	/* wait for the connection to be established */
-	if ((ret = rpma_conn_next_event(conn, &conn_event))) {
-		librpma_td_verror(td, ret, "rpma_conn_next_event");
-		goto err_conn_delete;
-	} else if (conn_event != RPMA_CONN_ESTABLISHED) {
-		log_err("rpma_conn_next_event returned an unexptected event\n");
-		goto err_conn_delete;
+		/*
+		 * accept the connection request and obtain
+		 * the connection object
+		 */
+		if ((ret = rpma_conn_req_connect(&conn_req, &pdata, &conn))) {
+			librpma_td_verror(td, ret, "rpma_conn_req_connect");
+			goto err_req_delete;
+		}
+
+		/* wait for the connection to be established */
+		if ((ret = rpma_conn_next_event(conn, &conn_event))) {
+			librpma_td_verror(td, ret, "rpma_conn_next_event");
+			goto err_conn_delete;
+		} else if (conn_event != RPMA_CONN_ESTABLISHED) {
+			log_err("rpma_conn_next_event returned an unexptected event\n");
+			goto err_conn_delete;
+		}
+
+		csd->conns[csd->conn_nr++] = conn;
 	}
 
 	/* end-point is no longer needed */
@@ -1016,12 +1256,11 @@ int librpma_fio_server_open_file(struct thread_data *td, struct fio_file *f,
 
 	csd->ws_mr = mr;
 	csd->ws_ptr = ws_ptr;
-	csd->conn = conn;
 
-	/* get the connection's main CQ */
-	if ((ret = rpma_conn_get_cq(csd->conn, &csd->cq))) {
+	/* get the first connection's main CQ */
+	if ((ret = rpma_conn_get_cq(csd->conns[0], &csd->cq))) {
 		librpma_td_verror(td, ret, "rpma_conn_get_cq");
-		goto err_conn_delete;
+		goto err_conns_delete;
 	}
 
 	return 0;
@@ -1032,6 +1271,15 @@ err_conn_delete:
 err_req_delete:
 	(void) rpma_conn_req_delete(&conn_req);
 
+err_conns_delete:
+	while (csd->conn_nr) {
+		conn = csd->conns[--csd->conn_nr];
+		(void) rpma_conn_disconnect(conn);
+		(void) rpma_conn_delete(&conn);
+	}
+	free(csd->conns);
+	csd->conns = NULL;
+
 err_mr_dereg:
 	(void) rpma_mr_dereg(&mr);
 
@@ -1048,25 +1296,31 @@ int librpma_fio_server_close_file(struct thread_data *td, struct fio_file *f)
 {
 	struct librpma_fio_server_data *csd = td->io_ops_data;
 	enum rpma_conn_event conn_event = RPMA_CONN_UNDEFINED;
+	unsigned int i;
 	int rv = 0;
 	int ret;
 
-	/* wait for the connection to be closed */
-	ret = rpma_conn_next_event(csd->conn, &conn_event);
-	if (!ret && conn_event != RPMA_CONN_CLOSED) {
-		log_err("rpma_conn_next_event returned an unexptected event\n");
-		rv = -1;
-	}
+	for (i = 0; i < csd->conn_nr; i++) {
+		/* wait for the connection to be closed */
+		ret = rpma_conn_next_event(csd->conns[i], &conn_event);
+		if (!ret && conn_event != RPMA_CONN_CLOSED) {
+			log_err("rpma_conn_next_event returned an unexptected event\n");
+			rv = -1;
+		}
 
-	if ((ret = rpma_conn_disconnect(csd->conn))) {
-		librpma_td_verror(td, ret, "rpma_conn_disconnect");
-		rv = -1;
-	}
+		if ((ret = rpma_conn_disconnect(csd->conns[i]))) {
+			librpma_td_verror(td, ret, "rpma_conn_disconnect");
+			rv = -1;
+		}
 
-	if ((ret = rpma_conn_delete(&csd->conn))) {
-		librpma_td_verror(td, ret, "rpma_conn_delete");
-		rv = -1;
+		if ((ret = rpma_conn_delete(&csd->conns[i]))) {
+			librpma_td_verror(td, ret, "rpma_conn_delete");
+			rv = -1;
+		}
 	}
+	free(csd->conns);
+	csd->conns = NULL;
+	csd->conn_nr = 0;
 
 	if ((ret = rpma_mr_dereg(&csd->ws_mr))) {
 		librpma_td_verror(td, ret, "rpma_mr_dereg");
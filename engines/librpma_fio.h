@@ -43,6 +43,10 @@ struct librpma_fio_options_values {
 	unsigned int direct_write_to_pmem;
 	/* Set to 0 to wait for completion instead of busy-wait polling completion. */
 	unsigned int busy_wait_polling;
+	/* # of connections per job */
+	unsigned int connections;
+	/* # of writes covered by one flush, 0 to flush every write sequence */
+	unsigned int flush_batch;
 };
 
 extern struct fio_option librpma_fio_options[];
@@ -89,9 +93,41 @@ void librpma_fio_free(struct librpma_fio_mem *mem);
 
 /* clients' common */
 
+/* one of the connections of a client, io_us are spread over them */
+struct librpma_fio_client_conn {
+	struct rpma_conn *conn;
+	struct rpma_cq *cq;
+
+	/* a server's memory representation */
+	struct rpma_mr_remote *server_mr;
+
+	/* in-memory queues */
+	struct io_u **io_us_queued;
+	int io_u_queued_nr;
+	struct io_u **io_us_flight;
+	int io_u_flight_nr;
+
+	/* SQ control. Note: all of them have to be kept in sync. */
+	uint32_t op_send_posted;
+	uint32_t op_send_completed;
+	uint32_t op_recv_completed;
+
+	/* writes posted but not flushed yet, see flush_batch */
+	struct io_u *flush_last_io_u;
+	unsigned long long int flush_start;
+	unsigned long long int flush_end;
+	unsigned int flush_pending;
+
+	/* stats */
+	uint64_t reads;
+	uint64_t writes;
+	uint64_t flushes;
+};
+
 typedef int (*librpma_fio_flush_t)(struct thread_data *td,
-		struct io_u *first_io_u, struct io_u *last_io_u,
-		unsigned long long int len);
+		struct librpma_fio_client_conn *c,
+		unsigned long long int offset, unsigned long long int len,
+		struct io_u *last_io_u);
 
 /*
  * RETURN VALUE
@@ -104,8 +140,11 @@ typedef int (*librpma_fio_get_io_u_index_t)(struct ibv_wc *wc,
 
 struct librpma_fio_client_data {
 	struct rpma_peer *peer;
-	struct rpma_conn *conn;
-	struct rpma_cq *cq;
+
+	/* connections to the server, io_us are placed round-robin */
+	struct librpma_fio_client_conn *conns;
+	unsigned int conn_nr;
+	unsigned int conn_next;
 
 	/* aligned td->orig_buffer */
 	char *orig_buffer_aligned;
@@ -115,26 +154,15 @@ struct librpma_fio_client_data {
 
 	struct librpma_fio_workspace *ws;
 
-	/* a server's memory representation */
-	struct rpma_mr_remote *server_mr;
 	enum rpma_flush_type server_mr_flush_type;
 
 	/* remote workspace description */
 	size_t ws_size;
 
-	/* in-memory queues */
-	struct io_u **io_us_queued;
-	int io_u_queued_nr;
-	struct io_u **io_us_flight;
-	int io_u_flight_nr;
+	/* completed io_us of all connections */
 	struct io_u **io_us_completed;
 	int io_u_completed_nr;
 
-	/* SQ control. Note: all of them have to be kept in sync. */
-	uint32_t op_send_posted;
-	uint32_t op_send_completed;
-	uint32_t op_recv_completed;
-
 	librpma_fio_flush_t flush;
 	librpma_fio_get_io_u_index_t get_io_u_index;
 
@@ -165,32 +193,33 @@ struct io_u *librpma_fio_client_event(struct thread_data *td, int event);
 char *librpma_fio_client_errdetails(struct io_u *io_u);
 
 static inline int librpma_fio_client_io_read(struct thread_data *td,
-		struct io_u *io_u, int flags)
+		struct librpma_fio_client_conn *c, struct io_u *io_u, int flags)
 {
 	struct librpma_fio_client_data *ccd = td->io_ops_data;
 	size_t dst_offset = (char *)(io_u->xfer_buf) - ccd->orig_buffer_aligned;
 	size_t src_offset = io_u->offset;
 	int ret;
 
-	if ((ret = rpma_read(ccd->conn, ccd->orig_mr, dst_offset,
-			ccd->server_mr, src_offset, io_u->xfer_buflen,
+	if ((ret = rpma_read(c->conn, ccd->orig_mr, dst_offset,
+			c->server_mr, src_offset, io_u->xfer_buflen,
 			flags, (void *)(uintptr_t)io_u->index))) {
 		librpma_td_verror(td, ret, "rpma_read");
 		return -1;
 	}
 
+	c->reads++;
 	return 0;
 }
 
 static inline int librpma_fio_client_io_write(struct thread_data *td,
-		struct io_u *io_u)
+		struct librpma_fio_client_conn *c, struct io_u *io_u)
 {
 	struct librpma_fio_client_data *ccd = td->io_ops_data;
 	size_t src_offset = (char *)(io_u->xfer_buf) - ccd->orig_buffer_aligned;
 	size_t dst_offset = io_u->offset;
 	int ret;
 
-	if ((ret = rpma_write(ccd->conn, ccd->server_mr, dst_offset,
+	if ((ret = rpma_write(c->conn, c->server_mr, dst_offset,
 			ccd->orig_mr, src_offset, io_u->xfer_buflen,
 			RPMA_F_COMPLETION_ON_ERROR,
 			(void *)(uintptr_t)io_u->index))) {
@@ -198,19 +227,19 @@ static inline int librpma_fio_client_io_write(struct thread_data *td,
 		return -1;
 	}
 
+	c->writes++;
 	return 0;
 }
 
 static inline int librpma_fio_client_io_complete_all_sends(
-		struct thread_data *td)
+		struct thread_data *td, struct librpma_fio_client_conn *c)
 {
-	struct librpma_fio_client_data *ccd = td->io_ops_data;
 	struct ibv_wc wc;
 	int ret;
 
-	while (ccd->op_send_posted != ccd->op_send_completed) {
+	while (c->op_send_posted != c->op_send_completed) {
 		/* get a completion */
-		ret = rpma_cq_get_wc(ccd->cq, 1, &wc, NULL);
+		ret = rpma_cq_get_wc(c->cq, 1, &wc, NULL);
 		if (ret == RPMA_E_NO_COMPLETION) {
 			/* lack of completion is not an error */
 			continue;
@@ -224,7 +253,7 @@ static inline int librpma_fio_client_io_complete_all_sends(
 			return -1;
 
 		if (wc.opcode == IBV_WC_SEND)
-			++ccd->op_send_completed;
+			++c->op_send_completed;
 		else {
 			log_err(
 				"A completion other than IBV_WC_SEND got during cleaning up the CQ from SENDs\n");
@@ -236,11 +265,11 @@ static inline int librpma_fio_client_io_complete_all_sends(
 	 * All posted SENDs are completed and RECVs for them (responses) are
 	 * completed. This is the initial situation so the counters are reset.
 	 */
-	if (ccd->op_send_posted == ccd->op_send_completed &&
-			ccd->op_send_completed == ccd->op_recv_completed) {
-		ccd->op_send_posted = 0;
-		ccd->op_send_completed = 0;
-		ccd->op_recv_completed = 0;
+	if (c->op_send_posted == c->op_send_completed &&
+			c->op_send_completed == c->op_recv_completed) {
+		c->op_send_posted = 0;
+		c->op_send_completed = 0;
+		c->op_recv_completed = 0;
 	}
 
 	return 0;
@@ -255,8 +284,9 @@ typedef int (*librpma_fio_prepare_connection_t)(
 struct librpma_fio_server_data {
 	struct rpma_peer *peer;
 
-	/* resources of an incoming connection */
-	struct rpma_conn *conn;
+	/* resources of the incoming connections, cq is the first one's */
+	struct rpma_conn **conns;
+	unsigned int conn_nr;
 	struct rpma_cq *cq;
 
 	char *ws_ptr;
@@ -61,8 +61,9 @@ struct client_data {
 };
 
 static inline int client_io_flush(struct thread_data *td,
-		struct io_u *first_io_u, struct io_u *last_io_u,
-		unsigned long long int len);
+		struct librpma_fio_client_conn *c,
+		unsigned long long int offset, unsigned long long int len,
+		struct io_u *last_io_u);
 
 static int client_get_io_u_index(struct ibv_wc *wc, unsigned int *io_u_index);
 
@@ -84,6 +85,12 @@ static int client_init(struct thread_data *td)
 		return -1;
 	}
 
+	/* the messaging buffers and the server serve a single connection */
+	if (((struct librpma_fio_options_values *) td->eo)->connections > 1) {
+		td_verror(td, EINVAL, "connections > 1 is not supported");
+		return -1;
+	}
+
 	/* allocate client's data */
 	cd = calloc(1, sizeof(*cd));
 	if (cd == NULL) {
@@ -238,7 +245,7 @@ static void client_cleanup(struct thread_data *td)
 	 * Note: If any operation will fail we still can send the termination
 	 * notice.
 	 */
-	(void) librpma_fio_client_io_complete_all_sends(td);
+	(void) librpma_fio_client_io_complete_all_sends(td, &ccd->conns[0]);
 
 	/* prepare the last flush message and pack it to the send buffer */
 	flush_req_size = gpspm_flush_request__get_packed_size(&Flush_req_last);
@@ -253,15 +260,16 @@ static void client_cleanup(struct thread_data *td)
 		(void) gpspm_flush_request__pack(&Flush_req_last, send_ptr);
 
 		/* send the flush message */
-		if ((ret = rpma_send(ccd->conn, cd->msg_mr, send_offset,
-				flush_req_size, RPMA_F_COMPLETION_ALWAYS,
-				NULL)))
+		if ((ret = rpma_send(ccd->conns[0].conn, cd->msg_mr,
+				send_offset, flush_req_size,
+				RPMA_F_COMPLETION_ALWAYS, NULL)))
 			librpma_td_verror(td, ret, "rpma_send");
 
-		++ccd->op_send_posted;
+		++ccd->conns[0].op_send_posted;
 
 		/* Wait for the SEND to complete */
-		(void) librpma_fio_client_io_complete_all_sends(td);
+		(void) librpma_fio_client_io_complete_all_sends(td,
+				&ccd->conns[0]);
 	}
 
 	/* deregister the messaging buffer memory */
@@ -274,8 +282,9 @@ static void client_cleanup(struct thread_data *td)
 }
 
 static inline int client_io_flush(struct thread_data *td,
-		struct io_u *first_io_u, struct io_u *last_io_u,
-		unsigned long long int len)
+		struct librpma_fio_client_conn *c,
+		unsigned long long int offset, unsigned long long int len,
+		struct io_u *last_io_u)
 {
 	struct librpma_fio_client_data *ccd = td->io_ops_data;
 	struct client_data *cd = ccd->client_data;
@@ -289,14 +298,14 @@ static inline int client_io_flush(struct thread_data *td,
 	int ret;
 
 	/* prepare a response buffer */
-	if ((ret = rpma_recv(ccd->conn, cd->msg_mr, recv_offset, MAX_MSG_SIZE,
+	if ((ret = rpma_recv(c->conn, cd->msg_mr, recv_offset, MAX_MSG_SIZE,
 			recv_ptr))) {
 		librpma_td_verror(td, ret, "rpma_recv");
 		return -1;
 	}
 
 	/* prepare a flush message and pack it to a send buffer */
-	flush_req.offset = first_io_u->offset;
+	flush_req.offset = offset;
 	flush_req.length = len;
 	flush_req.op_context = last_io_u->index;
 	flush_req_size = gpspm_flush_request__get_packed_size(&flush_req);
@@ -309,13 +318,13 @@ static inline int client_io_flush(struct thread_data *td,
 	(void) gpspm_flush_request__pack(&flush_req, send_ptr);
 
 	/* send the flush message */
-	if ((ret = rpma_send(ccd->conn, cd->msg_mr, send_offset, flush_req_size,
+	if ((ret = rpma_send(c->conn, cd->msg_mr, send_offset, flush_req_size,
 			RPMA_F_COMPLETION_ALWAYS, NULL))) {
 		librpma_td_verror(td, ret, "rpma_send");
 		return -1;
 	}
 
-	++ccd->op_send_posted;
+	++c->op_send_posted;
 
 	return 0;
 }
@@ -389,6 +398,12 @@ static int server_init(struct thread_data *td)
 	struct server_data *sd;
 	int ret = -1;
 
+	/* the messaging buffers serve a single connection */
+	if (((struct librpma_fio_options_values *) td->eo)->connections > 1) {
+		td_verror(td, EINVAL, "connections > 1 is not supported");
+		return -1;
+	}
+
 	if ((ret = librpma_fio_server_init(td)))
 		return ret;
 
@@ -620,7 +635,7 @@ static int server_qe_process(struct thread_data *td, struct ibv_wc *wc)
 	}
 
 	/* initiate the next receive operation */
-	if ((ret = rpma_recv(csd->conn, sd->msg_mr, recv_buff_offset,
+	if ((ret = rpma_recv(csd->conns[0], sd->msg_mr, recv_buff_offset,
 			MAX_MSG_SIZE,
 			(const void *)(uintptr_t)msg_index))) {
 		librpma_td_verror(td, ret, "rpma_recv");
@@ -640,7 +655,7 @@ static int server_qe_process(struct thread_data *td, struct ibv_wc *wc)
 	(void) gpspm_flush_response__pack(&flush_resp, send_buff_ptr);
 
 	/* send the flush response */
-	if ((ret = rpma_send(csd->conn, sd->msg_mr, send_buff_offset,
+	if ((ret = rpma_send(csd->conns[0], sd->msg_mr, send_buff_offset,
 			flush_resp_size, RPMA_F_COMPLETION_ALWAYS, NULL))) {
 		librpma_td_verror(td, ret, "rpma_send");
 		goto err_free_unpacked;
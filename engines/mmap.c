@@ -13,6 +13,8 @@
 #include "../fio.h"
 #include "../optgroup.h"
 #include "../verify.h"
+#include "../lib/getrusage.h"
+#include "../lib/pmem_copy.h"
 
 /*
  * Limits us to 1GiB of mapped files in total
@@ -27,13 +29,40 @@ struct fio_mmap_data {
 	off_t mmap_off;
 };
 
-#ifdef CONFIG_HAVE_THP
+/*
+ * Per-job fault accounting, reported at cleanup
+ */
+struct fio_mmap_stats {
+	struct rusage ru;
+	struct timespec start;
+};
+
+enum {
+	MMAP_PREFAULT_NONE	= 0,
+	MMAP_PREFAULT_POPULATE,
+	MMAP_PREFAULT_MADVISE,
+};
+
+enum {
+	MMAP_ADV_FADVISE	= 0,
+	MMAP_ADV_NORMAL,
+	MMAP_ADV_SEQUENTIAL,
+	MMAP_ADV_RANDOM,
+	MMAP_ADV_WILLNEED,
+};
+
+#define MMAP_COPY_MEMCPY	0
+
 struct mmap_options {
 	void *pad;
 	unsigned int thp;
+	unsigned int prefault;
+	unsigned int madvise_hint;
+	unsigned int copy_kernel;
 };
 
 static struct fio_option options[] = {
+#ifdef CONFIG_HAVE_THP
 	{
 		.name	= "thp",
 		.lname	= "Transparent Huge Pages",
@@ -43,17 +72,133 @@ static struct fio_option options[] = {
 		.category = FIO_OPT_C_ENGINE,
 		.group	= FIO_OPT_G_MMAP,
 	},
+#endif
+	{
+		.name	= "prefault",
+		.lname	= "Prefault mapping",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct mmap_options, prefault),
+		.help	= "Fault in the mapping before doing I/O to it",
+		.def	= "none",
+		.posval = {
+			  { .ival = "none",
+			    .oval = MMAP_PREFAULT_NONE,
+			    .help = "Fault pages in on first access",
+			  },
+#ifdef MAP_POPULATE
+			  { .ival = "populate",
+			    .oval = MMAP_PREFAULT_POPULATE,
+			    .help = "Map with MAP_POPULATE",
+			  },
+#endif
+#ifdef MADV_POPULATE_READ
+			  { .ival = "madvise",
+			    .oval = MMAP_PREFAULT_MADVISE,
+			    .help = "MADV_POPULATE_READ/WRITE after mapping",
+			  },
+#endif
+		},
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_MMAP,
+	},
+	{
+		.name	= "madvise_hint",
+		.lname	= "madvise hint",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct mmap_options, madvise_hint),
+		.help	= "Access pattern advice for the mapping",
+		.def	= "fadvise",
+		.posval = {
+			  { .ival = "fadvise",
+			    .oval = MMAP_ADV_FADVISE,
+			    .help = "Follow fadvise_hint",
+			  },
+			  { .ival = "normal",
+			    .oval = MMAP_ADV_NORMAL,
+			    .help = "POSIX_MADV_NORMAL",
+			  },
+			  { .ival = "sequential",
+			    .oval = MMAP_ADV_SEQUENTIAL,
+			    .help = "POSIX_MADV_SEQUENTIAL",
+			  },
+			  { .ival = "random",
+			    .oval = MMAP_ADV_RANDOM,
+			    .help = "POSIX_MADV_RANDOM",
+			  },
+			  { .ival = "willneed",
+			    .oval = MMAP_ADV_WILLNEED,
+			    .help = "POSIX_MADV_WILLNEED",
+			  },
+		},
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_MMAP,
+	},
+	{
+		.name	= "copy_kernel",
+		.lname	= "Copy kernel",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct mmap_options, copy_kernel),
+		.help	= "How writes are copied into the mapping",
+		.def	= "memcpy",
+		.posval = {
+			  { .ival = "memcpy",
+			    .oval = MMAP_COPY_MEMCPY,
+			    .help = "libc memcpy",
+			  },
+			  { .ival = "movnt",
+			    .oval = PMEM_COPY_MOVNT,
+			    .help = "SSE2 non-temporal stores",
+			  },
+			  { .ival = "avx512nt",
+			    .oval = PMEM_COPY_AVX512NT,
+			    .help = "AVX-512 non-temporal stores",
+			  },
+		},
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_MMAP,
+	},
 	{
 		.name = NULL,
 	},
 };
-#endif
+
+/*
+ * Map the madvise_hint option, or fadvise_hint if that is what it defers
+ * to, to an advice value. Returns -1 for no advice.
+ */
+static int fio_mmap_advice(struct thread_data *td)
+{
+	struct mmap_options *o = td->eo;
+
+	switch (o->madvise_hint) {
+	case MMAP_ADV_NORMAL:
+		return POSIX_MADV_NORMAL;
+	case MMAP_ADV_SEQUENTIAL:
+		return POSIX_MADV_SEQUENTIAL;
+	case MMAP_ADV_RANDOM:
+		return POSIX_MADV_RANDOM;
+	case MMAP_ADV_WILLNEED:
+		return POSIX_MADV_WILLNEED;
+	}
+
+	switch (td->o.fadvise_hint) {
+	case F_ADV_TYPE:
+		return td_random(td) ? POSIX_MADV_RANDOM : POSIX_MADV_SEQUENTIAL;
+	case F_ADV_RANDOM:
+		return POSIX_MADV_RANDOM;
+	case F_ADV_SEQUENTIAL:
+		return POSIX_MADV_SEQUENTIAL;
+	default:
+		return -1;
+	}
+}
 
 static bool fio_madvise_file(struct thread_data *td, struct fio_file *f,
 			     size_t length)
 
 {
 	struct fio_mmap_data *fmd = FILE_ENG_DATA(f);
+	int advice = fio_mmap_advice(td);
 #ifdef CONFIG_HAVE_THP
 	struct mmap_options *o = td->eo;
 
@@ -62,24 +207,42 @@ static bool fio_madvise_file(struct thread_data *td, struct fio_file *f,
 		madvise(fmd->mmap_ptr, length, MADV_HUGEPAGE);
 #endif
 
-	if (!td->o.fadvise_hint)
+	if (advice == -1)
 		return true;
 
-	if (!td_random(td)) {
-		if (posix_madvise(fmd->mmap_ptr, length, POSIX_MADV_SEQUENTIAL) < 0) {
-			td_verror(td, errno, "madvise");
-			return false;
-		}
-	} else {
-		if (posix_madvise(fmd->mmap_ptr, length, POSIX_MADV_RANDOM) < 0) {
-			td_verror(td, errno, "madvise");
-			return false;
-		}
+	if (posix_madvise(fmd->mmap_ptr, length, advice) < 0) {
+		td_verror(td, errno, "madvise");
+		return false;
 	}
 
 	return true;
 }
 
+/*
+ * Fault the fresh mapping in up front, so the first pass over it measures
+ * copies instead of page faults. Writable mappings are populated for
+ * write, which also takes the write faults on shared file pages.
+ */
+static bool fio_mmap_prefault(struct thread_data *td, struct fio_file *f,
+			      size_t length, int prot)
+{
+#ifdef MADV_POPULATE_READ
+	struct fio_mmap_data *fmd = FILE_ENG_DATA(f);
+	struct mmap_options *o = td->eo;
+	int advice;
+
+	if (o->prefault != MMAP_PREFAULT_MADVISE)
+		return true;
+
+	advice = (prot & PROT_WRITE) ? MADV_POPULATE_WRITE : MADV_POPULATE_READ;
+	if (madvise(fmd->mmap_ptr, length, advice) < 0) {
+		td_verror(td, errno, "madvise populate");
+		return false;
+	}
+#endif
+	return true;
+}
+
 #ifdef CONFIG_HAVE_THP
 static int fio_mmap_get_shared(struct thread_data *td)
 {
@@ -100,6 +263,7 @@ static int fio_mmap_file(struct thread_data *td, struct fio_file *f,
 			 size_t length, off_t off)
 {
 	struct fio_mmap_data *fmd = FILE_ENG_DATA(f);
+	struct mmap_options fio_unused *o = td->eo;
 	int flags = 0, shared = fio_mmap_get_shared(td);
 
 	if (td_rw(td) && !td->o.verify_only)
@@ -112,6 +276,11 @@ static int fio_mmap_file(struct thread_data *td, struct fio_file *f,
 	} else
 		flags = PROT_READ;
 
+#ifdef MAP_POPULATE
+	if (o->prefault == MMAP_PREFAULT_POPULATE)
+		shared |= MAP_POPULATE;
+#endif
+
 	fmd->mmap_ptr = mmap(NULL, length, flags, shared, f->fd, off);
 	if (fmd->mmap_ptr == MAP_FAILED) {
 		fmd->mmap_ptr = NULL;
@@ -132,6 +301,9 @@ static int fio_mmap_file(struct thread_data *td, struct fio_file *f,
 		(void) posix_madvise(fmd->mmap_ptr, fmd->mmap_sz, FIO_MADV_FREE);
 #endif
 
+	if (!fio_mmap_prefault(td, f, length, flags))
+		goto err;
+
 err:
 	if (td->error && fmd->mmap_ptr)
 		munmap(fmd->mmap_ptr, length);
@@ -228,13 +400,21 @@ static enum fio_q_status fio_mmapio_queue(struct thread_data *td,
 {
 	struct fio_file *f = io_u->file;
 	struct fio_mmap_data *fmd = FILE_ENG_DATA(f);
+	struct mmap_options *o = td->eo;
 
 	fio_ro_check(td, io_u);
 
 	if (io_u->ddir == DDIR_READ)
 		memcpy(io_u->xfer_buf, io_u->mmap_data, io_u->xfer_buflen);
-	else if (io_u->ddir == DDIR_WRITE)
-		memcpy(io_u->mmap_data, io_u->xfer_buf, io_u->xfer_buflen);
+	else if (io_u->ddir == DDIR_WRITE) {
+		if (o->copy_kernel == MMAP_COPY_MEMCPY)
+			memcpy(io_u->mmap_data, io_u->xfer_buf, io_u->xfer_buflen);
+		else {
+			pmem_copy_nodrain(o->copy_kernel, io_u->mmap_data,
+					  io_u->xfer_buf, io_u->xfer_buflen);
+			pmem_copy_drain();
+		}
+	}
 	else if (ddir_sync(io_u->ddir)) {
 		if (msync(fmd->mmap_ptr, fmd->mmap_sz, MS_SYNC)) {
 			io_u->error = errno;
@@ -268,6 +448,8 @@ static enum fio_q_status fio_mmapio_queue(struct thread_data *td,
 static int fio_mmapio_init(struct thread_data *td)
 {
 	struct thread_options *o = &td->o;
+	struct mmap_options *eo = td->eo;
+	struct fio_mmap_stats *ms;
 
 	if ((o->rw_min_bs & page_mask) &&
 	    (o->odirect || o->fsync_blocks || o->fdatasync_blocks)) {
@@ -276,10 +458,55 @@ static int fio_mmapio_init(struct thread_data *td)
 		return 1;
 	}
 
+	if (eo->copy_kernel != MMAP_COPY_MEMCPY &&
+	    !pmem_copy_supported(eo->copy_kernel)) {
+		log_err("fio: mmap copy_kernel=%s is not supported by this CPU\n",
+			pmem_copy_name(eo->copy_kernel));
+		return 1;
+	}
+
+	ms = calloc(1, sizeof(*ms));
+	if (!ms)
+		return 1;
+	fio_getrusage(&ms->ru);
+	fio_gettime(&ms->start, NULL);
+	td->io_ops_data = ms;
+
 	mmap_map_size = MMAP_TOTAL_SZ / o->nr_files;
 	return 0;
 }
 
+/*
+ * Report the faults taken while the job ran, as a rate and per I/O, to
+ * tell fault cost apart from copy cost.
+ */
+static void fio_mmapio_cleanup(struct thread_data *td)
+{
+	struct fio_mmap_stats *ms = td->io_ops_data;
+	unsigned long long ios = 0, msec;
+	unsigned long minf, majf;
+	struct rusage ru;
+	int i;
+
+	if (!ms)
+		return;
+
+	fio_getrusage(&ru);
+	minf = ru.ru_minflt - ms->ru.ru_minflt;
+	majf = ru.ru_majflt - ms->ru.ru_majflt;
+	msec = mtime_since_now(&ms->start);
+	for (i = 0; i < DDIR_RWDIR_CNT; i++)
+		ios += td->io_blocks[i];
+
+	log_info("%s: mmap page faults: minor=%lu, major=%lu, %.2f/IO, %.0f/s\n",
+		 td->o.name, minf, majf,
+		 ios ? (double) (minf + majf) / ios : 0.0,
+		 msec ? (minf + majf) * 1000.0 / msec : 0.0);
+
+	free(ms);
+	td->io_ops_data = NULL;
+}
+
 static int fio_mmapio_open_file(struct thread_data *td, struct fio_file *f)
 {
 	struct fio_mmap_data *fmd;
@@ -315,16 +542,15 @@ static struct ioengine_ops ioengine = {
 	.name		= "mmap",
 	.version	= FIO_IOOPS_VERSION,
 	.init		= fio_mmapio_init,
+	.cleanup	= fio_mmapio_cleanup,
 	.prep		= fio_mmapio_prep,
 	.queue		= fio_mmapio_queue,
 	.open_file	= fio_mmapio_open_file,
 	.close_file	= fio_mmapio_close_file,
 	.get_file_size	= generic_get_file_size,
 	.flags		= FIO_SYNCIO | FIO_NOEXTEND,
-#ifdef CONFIG_HAVE_THP
 	.options	= options,
 	.option_struct_size = sizeof(struct mmap_options),
-#endif
 };
 
 static void fio_init fio_mmapio_register(void)
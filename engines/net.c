@@ -22,9 +22,21 @@
 #include "../verify.h"
 #include "../optgroup.h"
 
+#ifdef FIO_HAVE_IOURING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/errqueue.h>
+#include "../os/linux/io_uring.h"
+
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define CONFIG_NET_ZEROCOPY
+#endif
+#endif
+
 struct netio_data {
 	int listenfd;
 	int use_splice;
+	int use_uring;
 	int seq_off;
 	int pipes[2];
 	struct sockaddr_in addr;
@@ -32,7 +44,57 @@ struct netio_data {
 	struct sockaddr_un addr_un;
 	uint64_t udp_send_seq;
 	uint64_t udp_recv_seq;
+
+#ifdef FIO_HAVE_IOURING
+	/*
+	 * neturing: sends and receives are queued on an io_uring
+	 */
+	int ring_fd;
+	struct io_uring_sqe *sqes;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_array;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+	void *ring_ptr[3];
+	size_t ring_len[3];
+	unsigned int queued;
+
+	struct io_u **events;
+	unsigned int nr_events;
+
+	struct pollfd *pfds;
+	uint64_t zc_sends;
+	uint64_t zc_copied;
+#endif
+};
+
+#ifdef FIO_HAVE_IOURING
+/*
+ * zerocopy state of a connection, in FILE_ENG_DATA(). io_u's sent with
+ * MSG_ZEROCOPY wait in the ring, in send order, until the socket's error
+ * queue says the kernel is done with their buffers. The first one in the
+ * ring was sent with first_id, the ids count up per socket.
+ */
+struct netio_zc {
+	unsigned int head;
+	unsigned int nr;
+	unsigned int max;
+	uint32_t first_id;
+	struct io_u *ring[];
+};
+
+/*
+ * neturing per io_u state, see ->io_u_priv_size
+ */
+struct netio_io_u {
+	int zc_done;
 };
+#endif
 
 struct netio_options {
 	struct thread_data *td;
@@ -44,6 +106,8 @@ struct netio_options {
 	unsigned int ttl;
 	unsigned int window_size;
 	unsigned int mss;
+	unsigned int zerocopy;
+	unsigned int num_connections;
 	char *intfc;
 };
 
@@ -202,6 +266,29 @@ static struct fio_option options[] = {
 		.category = FIO_OPT_C_ENGINE,
 		.group	= FIO_OPT_G_NETIO,
 	},
+#endif
+	{
+		.name	= "num_connections",
+		.lname	= "Number of connections",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct netio_options, num_connections),
+		.def	= "1",
+		.minval	= 1,
+		.help	= "Number of stream connections IO is spread across",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_NETIO,
+	},
+#ifdef CONFIG_NET_ZEROCOPY
+	{
+		.name	= "zerocopy",
+		.lname	= "Zero copy sends",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct netio_options, zerocopy),
+		.help	= "Send with MSG_ZEROCOPY (neturing engine, TCP only)",
+		.def	= "0",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_NETIO,
+	},
 #endif
 	{
 		.name	= NULL,
@@ -870,7 +957,12 @@ static int fio_netio_accept(struct thread_data *td, struct fio_file *f)
 	}
 #endif
 
-	reset_all_stats(td);
+	/*
+	 * Only the first connection starts the clock, the others may be
+	 * accepted while IO is already flowing.
+	 */
+	if (!f->fileno)
+		reset_all_stats(td);
 	td_set_runstate(td, state);
 	return 0;
 err:
@@ -905,6 +997,9 @@ static void fio_netio_send_close(struct thread_data *td, struct fio_file *f)
 
 static int fio_netio_close_file(struct thread_data *td, struct fio_file *f)
 {
+	free(FILE_ENG_DATA(f));
+	FILE_SET_ENG_DATA(f, NULL);
+
 	/*
 	 * Notify the receiver that we are closing down the link
 	 */
@@ -992,6 +1087,29 @@ static int fio_netio_open_file(struct thread_data *td, struct fio_file *f)
 		return ret;
 	}
 
+#ifdef CONFIG_NET_ZEROCOPY
+	if (o->zerocopy) {
+		struct netio_zc *zc;
+		int optval = 1;
+
+		if (setsockopt(f->fd, SOL_SOCKET, SO_ZEROCOPY, &optval,
+				sizeof(optval)) < 0) {
+			td_verror(td, errno, "setsockopt SO_ZEROCOPY");
+			fio_netio_close_file(td, f);
+			return 1;
+		}
+
+		zc = calloc(1, sizeof(*zc) +
+				td->o.iodepth * sizeof(struct io_u *));
+		if (!zc) {
+			fio_netio_close_file(td, f);
+			return 1;
+		}
+		zc->max = td->o.iodepth;
+		FILE_SET_ENG_DATA(f, zc);
+	}
+#endif
+
 	if (is_udp(o)) {
 		if (td_write(td))
 			ret = fio_netio_send_open(td, f);
@@ -1284,7 +1402,7 @@ static int fio_netio_setup_listen(struct thread_data *td)
 	if (is_udp(o))
 		return 0;
 
-	if (listen(nd->listenfd, 10) < 0) {
+	if (listen(nd->listenfd, max(10U, o->num_connections)) < 0) {
 		td_verror(td, errno, "listen");
 		nd->listenfd = -1;
 		return 1;
@@ -1335,6 +1453,20 @@ static int fio_netio_init(struct thread_data *td)
 		o->listen = td_read(td);
 	}
 
+	if (o->num_connections > 1 && is_udp(o)) {
+		log_err("fio: num_connections needs a stream socket\n");
+		return 1;
+	}
+
+	if (o->zerocopy) {
+		struct netio_data *nd = td->io_ops_data;
+
+		if (!nd->use_uring || !is_tcp(o) || !td_write(td)) {
+			log_err("fio: zerocopy needs neturing and TCP sends\n");
+			return 1;
+		}
+	}
+
 	if (o->listen)
 		ret = fio_netio_setup_listen(td);
 	else
@@ -1361,6 +1493,7 @@ static void fio_netio_cleanup(struct thread_data *td)
 
 static int fio_netio_setup(struct thread_data *td)
 {
+	struct netio_options *o = td->eo;
 	struct netio_data *nd;
 
 	if (!td->files_index) {
@@ -1369,6 +1502,19 @@ static int fio_netio_setup(struct thread_data *td)
 		td->o.open_files++;
 	}
 
+	/*
+	 * Every connection is a file of its own, so the file service
+	 * type decides which one the next io_u goes to.
+	 */
+	if (o->num_connections > td->files_index) {
+		const char *name = td->files[0]->file_name;
+
+		td->o.nr_files = o->num_connections;
+		while (td->files_index < o->num_connections)
+			add_file(td, name, 0, 0);
+		td->o.open_files = td->files_index;
+	}
+
 	if (!td->io_ops_data) {
 		nd = malloc(sizeof(*nd));
 
@@ -1423,6 +1569,445 @@ static struct ioengine_ops ioengine_splice = {
 };
 #endif
 
+#ifdef FIO_HAVE_IOURING
+/*
+ * neturing: async sends and receives on a single stream socket. Up to
+ * iodepth io_u's are queued on an io_uring, so a single job can keep the
+ * connection busy. With zerocopy, sends are issued directly with
+ * MSG_ZEROCOPY instead and complete once the socket error queue reports
+ * that their buffers were released.
+ */
+static int fio_netio_uring_mmap(struct netio_data *nd, struct io_uring_params *p)
+{
+	void *ptr;
+
+	nd->ring_len[0] = p->sq_off.array + p->sq_entries * sizeof(__u32);
+	ptr = mmap(NULL, nd->ring_len[0], PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, nd->ring_fd,
+			IORING_OFF_SQ_RING);
+	if (ptr == MAP_FAILED)
+		return 1;
+	nd->ring_ptr[0] = ptr;
+	nd->sq_head = ptr + p->sq_off.head;
+	nd->sq_tail = ptr + p->sq_off.tail;
+	nd->sq_array = ptr + p->sq_off.array;
+	nd->sq_mask = *(unsigned *) (ptr + p->sq_off.ring_mask);
+	nd->sq_entries = p->sq_entries;
+
+	nd->ring_len[1] = p->sq_entries * sizeof(struct io_uring_sqe);
+	ptr = mmap(NULL, nd->ring_len[1], PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, nd->ring_fd,
+			IORING_OFF_SQES);
+	if (ptr == MAP_FAILED)
+		return 1;
+	nd->ring_ptr[1] = ptr;
+	nd->sqes = ptr;
+
+	nd->ring_len[2] = p->cq_off.cqes +
+				p->cq_entries * sizeof(struct io_uring_cqe);
+	ptr = mmap(NULL, nd->ring_len[2], PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, nd->ring_fd,
+			IORING_OFF_CQ_RING);
+	if (ptr == MAP_FAILED)
+		return 1;
+	nd->ring_ptr[2] = ptr;
+	nd->cq_head = ptr + p->cq_off.head;
+	nd->cq_tail = ptr + p->cq_off.tail;
+	nd->cq_mask = *(unsigned *) (ptr + p->cq_off.ring_mask);
+	nd->cqes = ptr + p->cq_off.cqes;
+	return 0;
+}
+
+static void fio_netio_uring_exit(struct netio_data *nd)
+{
+	int i;
+
+	for (i = 0; i < 3; i++)
+		if (nd->ring_ptr[i])
+			munmap(nd->ring_ptr[i], nd->ring_len[i]);
+	if (nd->ring_fd != -1)
+		close(nd->ring_fd);
+	free(nd->events);
+	free(nd->pfds);
+}
+
+static int fio_netio_uring_init(struct thread_data *td)
+{
+	struct netio_data *nd = td->io_ops_data;
+	struct netio_options *o = td->eo;
+	struct io_uring_params p;
+
+	if (!is_tcp(o) && o->proto != FIO_TYPE_UNIX) {
+		log_err("fio: neturing needs a stream socket (tcp or unix)\n");
+		return 1;
+	}
+	if (o->pingpong) {
+		log_err("fio: pingpong isn't supported with neturing\n");
+		return 1;
+	}
+
+	nd->events = calloc(td->o.iodepth, sizeof(struct io_u *));
+	if (!nd->events)
+		return 1;
+
+	if (o->zerocopy) {
+		nd->pfds = calloc(td->o.nr_files, sizeof(struct pollfd));
+		if (!nd->pfds)
+			return 1;
+	} else {
+		memset(&p, 0, sizeof(p));
+		nd->ring_fd = syscall(__NR_io_uring_setup, td->o.iodepth, &p);
+		if (nd->ring_fd < 0) {
+			td_verror(td, errno, "io_uring_setup");
+			return 1;
+		}
+		if (fio_netio_uring_mmap(nd, &p)) {
+			td_verror(td, errno, "mmap io_uring");
+			return 1;
+		}
+	}
+
+	return fio_netio_init(td);
+}
+
+static int fio_netio_uring_enter(struct netio_data *nd, unsigned int submit,
+				 unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, nd->ring_fd, submit, min_complete,
+			flags, NULL, 0);
+}
+
+/*
+ * Mark the zerocopy sends in [lo, hi] done, then let the ones at the head
+ * of the ring, in send order, complete.
+ */
+static void fio_netio_zc_done(struct thread_data *td, struct netio_zc *zc,
+			      uint32_t lo, uint32_t hi)
+{
+	struct netio_data *nd = td->io_ops_data;
+	uint32_t id;
+
+	for (id = lo; id - lo <= hi - lo; id++) {
+		uint32_t off = id - zc->first_id;
+		struct netio_io_u *nio;
+		struct io_u *io_u;
+
+		if (off >= zc->nr)
+			continue;
+
+		io_u = zc->ring[(zc->head + off) % zc->max];
+		nio = io_u->engine_data;
+		nio->zc_done = 1;
+	}
+
+	while (zc->nr) {
+		struct io_u *io_u = zc->ring[zc->head];
+		struct netio_io_u *nio = io_u->engine_data;
+
+		if (!nio->zc_done)
+			break;
+
+		nio->zc_done = 0;
+		nd->events[nd->nr_events++] = io_u;
+		zc->head = (zc->head + 1) % zc->max;
+		zc->nr--;
+		zc->first_id++;
+	}
+}
+
+/*
+ * Read zerocopy notifications off the socket error queue. Returns -1 on
+ * error, 0 once the queue is empty.
+ */
+static int fio_netio_zc_reap(struct thread_data *td, struct fio_file *f)
+{
+	struct netio_data *nd = td->io_ops_data;
+	struct netio_zc *zc = FILE_ENG_DATA(f);
+	char control[CMSG_SPACE(sizeof(struct sock_extended_err))];
+	struct sock_extended_err *serr;
+	struct msghdr msg;
+	struct cmsghdr *cm;
+
+	do {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(f->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			if (errno == EINTR)
+				continue;
+			td_verror(td, errno, "recvmsg errqueue");
+			return -1;
+		}
+
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			serr = (struct sock_extended_err *) CMSG_DATA(cm);
+			if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+			if (serr->ee_errno) {
+				td_verror(td, serr->ee_errno, "zerocopy");
+				return -1;
+			}
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				nd->zc_copied += serr->ee_data - serr->ee_info + 1;
+			fio_netio_zc_done(td, zc, serr->ee_info, serr->ee_data);
+		}
+	} while (1);
+}
+
+static enum fio_q_status fio_netio_zc_queue(struct thread_data *td,
+					    struct io_u *io_u)
+{
+	struct netio_data *nd = td->io_ops_data;
+	struct netio_zc *zc = FILE_ENG_DATA(io_u->file);
+	int ret;
+
+	do {
+		ret = send(io_u->file->fd, io_u->xfer_buf, io_u->xfer_buflen,
+				MSG_ZEROCOPY);
+		if (ret >= 0)
+			break;
+		if (errno == EINTR)
+			continue;
+		/* out of notification memory, reap some sends first */
+		if (errno == ENOBUFS && td->io_u_in_flight)
+			return FIO_Q_BUSY;
+
+		io_u->error = errno;
+		td_verror(td, io_u->error, "xfer");
+		return FIO_Q_COMPLETED;
+	} while (1);
+
+	io_u->resid = io_u->xfer_buflen - ret;
+	if (!ret)
+		return FIO_Q_COMPLETED;
+
+	/* every successful MSG_ZEROCOPY send takes the next id */
+	zc->ring[(zc->head + zc->nr) % zc->max] = io_u;
+	zc->nr++;
+	nd->zc_sends++;
+	return FIO_Q_QUEUED;
+}
+
+static enum fio_q_status fio_netio_uring_queue(struct thread_data *td,
+					       struct io_u *io_u)
+{
+	struct netio_data *nd = td->io_ops_data;
+	struct netio_options *o = td->eo;
+	struct io_uring_sqe *sqe;
+	unsigned tail, idx;
+
+	fio_ro_check(td, io_u);
+
+	if (io_u->ddir != DDIR_READ && io_u->ddir != DDIR_WRITE)
+		return FIO_Q_COMPLETED;
+
+	if (o->zerocopy)
+		return fio_netio_zc_queue(td, io_u);
+
+	tail = *nd->sq_tail + nd->queued;
+	if (tail - atomic_load_acquire(nd->sq_head) >= nd->sq_entries)
+		return FIO_Q_BUSY;
+
+	idx = tail & nd->sq_mask;
+	sqe = &nd->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = io_u->ddir == DDIR_WRITE ? IORING_OP_SEND : IORING_OP_RECV;
+	sqe->fd = io_u->file->fd;
+	sqe->addr = (unsigned long) io_u->xfer_buf;
+	sqe->len = io_u->xfer_buflen;
+	/* don't complete stream IO short, like the sync engine's retries */
+	sqe->msg_flags = MSG_WAITALL;
+	sqe->user_data = (unsigned long) io_u;
+	nd->sq_array[idx] = idx;
+	nd->queued++;
+	return FIO_Q_QUEUED;
+}
+
+static int fio_netio_uring_commit(struct thread_data *td)
+{
+	struct netio_data *nd = td->io_ops_data;
+	int ret;
+
+	if (!nd->queued)
+		return 0;
+
+	atomic_store_release(nd->sq_tail, *nd->sq_tail + nd->queued);
+
+	while (nd->queued) {
+		ret = fio_netio_uring_enter(nd, nd->queued, 0, 0);
+		if (ret > 0) {
+			nd->queued -= ret;
+			continue;
+		}
+		if (ret < 0 && (errno == EINTR || errno == EAGAIN ||
+				errno == EBUSY)) {
+			usleep(1);
+			continue;
+		}
+		td_verror(td, ret < 0 ? errno : EIO, "io_uring_enter submit");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void fio_netio_uring_complete(struct thread_data *td,
+				     struct io_u *io_u, int res)
+{
+	if (res < 0) {
+		io_u->error = -res;
+		return;
+	}
+
+	io_u->resid = io_u->xfer_buflen - res;
+	if (io_u->ddir == DDIR_READ && (!res || is_close_msg(io_u, res))) {
+		/* sender closed the link */
+		io_u->resid = io_u->xfer_buflen;
+		td->done = 1;
+	}
+}
+
+static int fio_netio_uring_reap(struct thread_data *td, unsigned int max)
+{
+	struct netio_data *nd = td->io_ops_data;
+	unsigned head = *nd->cq_head;
+	int reaped = 0;
+
+	while (nd->nr_events < max && head != atomic_load_acquire(nd->cq_tail)) {
+		struct io_uring_cqe *cqe = &nd->cqes[head & nd->cq_mask];
+		struct io_u *io_u = (struct io_u *) (uintptr_t) cqe->user_data;
+
+		fio_netio_uring_complete(td, io_u, cqe->res);
+		nd->events[nd->nr_events++] = io_u;
+		head++;
+		reaped++;
+	}
+
+	if (reaped)
+		atomic_store_release(nd->cq_head, head);
+
+	return reaped;
+}
+
+static int fio_netio_uring_getevents(struct thread_data *td, unsigned int min,
+				     unsigned int max,
+				     const struct timespec *t)
+{
+	struct netio_data *nd = td->io_ops_data;
+	struct netio_options *o = td->eo;
+	int ret;
+
+	nd->nr_events = 0;
+
+	if (o->zerocopy) {
+		int timeout = t ? t->tv_sec * 1000 + t->tv_nsec / 1000000 : -1;
+		struct fio_file *f;
+		unsigned int i, nr;
+
+		do {
+			nr = 0;
+			for_each_file(td, f, i) {
+				if (!fio_file_open(f))
+					continue;
+				if (fio_netio_zc_reap(td, f) < 0)
+					return -1;
+				/* POLLERR is always reported, nothing to ask for */
+				nd->pfds[nr].fd = f->fd;
+				nd->pfds[nr].events = 0;
+				nr++;
+			}
+			if (nd->nr_events >= min || td->terminate || !nr)
+				break;
+			ret = poll(nd->pfds, nr, timeout);
+			if (ret < 0 && errno != EINTR) {
+				td_verror(td, errno, "poll");
+				return -1;
+			}
+			if (!ret)
+				break;
+		} while (1);
+
+		return nd->nr_events;
+	}
+
+	do {
+		fio_netio_uring_reap(td, max);
+		if (nd->nr_events >= min || td->terminate)
+			break;
+
+		ret = fio_netio_uring_enter(nd, 0, min - nd->nr_events,
+						IORING_ENTER_GETEVENTS);
+		if (ret < 0 && errno != EINTR && errno != EAGAIN) {
+			td_verror(td, errno, "io_uring_enter getevents");
+			return -1;
+		}
+	} while (1);
+
+	return nd->nr_events;
+}
+
+static struct io_u *fio_netio_uring_event(struct thread_data *td, int event)
+{
+	struct netio_data *nd = td->io_ops_data;
+
+	return nd->events[event];
+}
+
+static int fio_netio_setup_uring(struct thread_data *td)
+{
+	struct netio_data *nd;
+
+	fio_netio_setup(td);
+
+	nd = td->io_ops_data;
+	if (!nd)
+		return 1;
+
+	nd->use_uring = 1;
+	nd->ring_fd = -1;
+	return 0;
+}
+
+static void fio_netio_uring_cleanup(struct thread_data *td)
+{
+	struct netio_data *nd = td->io_ops_data;
+
+	if (nd) {
+		if (nd->zc_copied)
+			log_info("fio: %llu of %llu zerocopy sends were copied\n",
+				(unsigned long long) nd->zc_copied,
+				(unsigned long long) nd->zc_sends);
+		fio_netio_uring_exit(nd);
+	}
+
+	fio_netio_cleanup(td);
+}
+
+static struct ioengine_ops ioengine_uring = {
+	.name			= "neturing",
+	.version		= FIO_IOOPS_VERSION,
+	.prep			= fio_netio_prep,
+	.queue			= fio_netio_uring_queue,
+	.commit			= fio_netio_uring_commit,
+	.getevents		= fio_netio_uring_getevents,
+	.event			= fio_netio_uring_event,
+	.setup			= fio_netio_setup_uring,
+	.init			= fio_netio_uring_init,
+	.cleanup		= fio_netio_uring_cleanup,
+	.open_file		= fio_netio_open_file,
+	.close_file		= fio_netio_close_file,
+	.terminate		= fio_netio_terminate,
+	.options		= options,
+	.option_struct_size	= sizeof(struct netio_options),
+	.io_u_priv_size		= sizeof(struct netio_io_u),
+	.flags			= FIO_DISKLESSIO | FIO_UNIDIR | FIO_PIPEIO |
+				  FIO_BIT_BASED | FIO_NO_OFFLOAD,
+};
+#endif
+
 static struct ioengine_ops ioengine_rw = {
 	.name			= "net",
 	.version		= FIO_IOOPS_VERSION,
@@ -1456,6 +2041,9 @@ static void fio_init fio_netio_register(void)
 #ifdef CONFIG_LINUX_SPLICE
 	register_ioengine(&ioengine_splice);
 #endif
+#ifdef FIO_HAVE_IOURING
+	register_ioengine(&ioengine_uring);
+#endif
 }
 
 static void fio_exit fio_netio_unregister(void)
@@ -1464,4 +2052,7 @@ static void fio_exit fio_netio_unregister(void)
 #ifdef CONFIG_LINUX_SPLICE
 	unregister_ioengine(&ioengine_splice);
 #endif
+#ifdef FIO_HAVE_IOURING
+	unregister_ioengine(&ioengine_uring);
+#endif
 }
@@ -14,9 +14,17 @@ enum nfs_op_type {
 };
 
 struct fio_libnfs_options {
-	struct nfs_context *context;
+	struct nfs_context *context; /* == contexts[0] */
 	char *nfs_url;
+	unsigned int nr_conns; /* nfs_connections option */
+	unsigned int conn_depth; /* nfs_conn_depth option */
 	unsigned int queue_depth; /* nfs_callback needs this info, but doesn't have fio td structure to pull it from */
+	/* one context per emulated nconnect connection, each its own TCP socket */
+	struct nfs_context **contexts;
+	struct pollfd *pfds;
+	unsigned int *conn_outstanding; /* IOs in flight per connection */
+	unsigned int *io_u_conn; /* connection each io_u was issued on, by io_u->index */
+	unsigned int max_outstanding; /* min(iodepth, nr_conns * conn_depth) */
 	/* the following implement a circular queue of outstanding IOs */
 	int outstanding_events; /* IOs issued to libnfs, that have not returned yet */
 	int prev_requested_event_index; /* event last returned via fio_libnfs_event */
@@ -27,7 +35,7 @@ struct fio_libnfs_options {
 };
 
 struct nfs_data {
-	struct nfsfh *nfsfh;
+	struct nfsfh **nfsfh; /* one handle per connection */
 	struct fio_libnfs_options *options;
 };
 
@@ -41,6 +49,27 @@ static struct fio_option options[] = {
 		.category = FIO_OPT_C_ENGINE,
 		.group	= __FIO_OPT_G_NFS,
 	},
+	{
+		.name     = "nfs_connections",
+		.lname    = "nfs_connections",
+		.type     = FIO_OPT_INT,
+		.help	= "Number of NFS connections per job, emulating nconnect",
+		.off1     = offsetof(struct fio_libnfs_options, nr_conns),
+		.def	= "1",
+		.minval	= 1,
+		.category = FIO_OPT_C_ENGINE,
+		.group	= __FIO_OPT_G_NFS,
+	},
+	{
+		.name     = "nfs_conn_depth",
+		.lname    = "nfs_conn_depth",
+		.type     = FIO_OPT_INT,
+		.help	= "Maximum IOs in flight per NFS connection (0 = iodepth split evenly)",
+		.off1     = offsetof(struct fio_libnfs_options, conn_depth),
+		.def	= "0",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= __FIO_OPT_G_NFS,
+	},
 	{
 		.name     = NULL,
 	},
@@ -69,19 +98,23 @@ static struct io_u *fio_libnfs_event(struct thread_data *td, int event)
 
 static int nfs_event_loop(struct thread_data *td, bool flush) {
 	struct fio_libnfs_options *o = td->eo;
-	struct pollfd pfds[1]; /* nfs:0 */
+	unsigned int i;
 	/* we already have stuff queued for fio, no need to waste cpu on poll() */
 	if (o->buffered_event_count)
 		return o->buffered_event_count;
 	/* fio core logic seems to stop calling this event-loop if we ever return with 0 events */
-	#define SHOULD_WAIT() (o->outstanding_events == td->o.iodepth || (flush && o->outstanding_events))
+	#define SHOULD_WAIT() (o->outstanding_events == o->max_outstanding || (flush && o->outstanding_events))
 
 	do {
 		int timeout = SHOULD_WAIT() ? -1 : 0;
 		int ret = 0;
-		pfds[0].fd = nfs_get_fd(o->context);
-		pfds[0].events = nfs_which_events(o->context);
-		ret = poll(&pfds[0], 1, timeout);
+
+		/* poll all connections at once, then service every ready one */
+		for (i = 0; i < o->nr_conns; i++) {
+			o->pfds[i].fd = nfs_get_fd(o->contexts[i]);
+			o->pfds[i].events = nfs_which_events(o->contexts[i]);
+		}
+		ret = poll(o->pfds, o->nr_conns, timeout);
 		if (ret < 0) {
 			if (errno == EINTR || errno == EAGAIN) {
 				continue;
@@ -91,11 +124,15 @@ static int nfs_event_loop(struct thread_data *td, bool flush) {
 			break;
 		}
 
-		ret = nfs_service(o->context, pfds[0].revents);
-		if (ret < 0) {
-			log_err("nfs: socket is in an unrecoverable error state.\n");
-			break;
+		for (i = 0; i < o->nr_conns; i++) {
+			ret = nfs_service(o->contexts[i], o->pfds[i].revents);
+			if (ret < 0) {
+				log_err("nfs: socket is in an unrecoverable error state.\n");
+				break;
+			}
 		}
+		if (ret < 0)
+			break;
 	} while (SHOULD_WAIT());
 	return o->buffered_event_count;
 #undef SHOULD_WAIT
@@ -114,7 +151,7 @@ static void nfs_callback(int res, struct nfs_context *nfs, void *data,
 	struct nfs_data *nfs_data = io_u->file->engine_data;
 	struct fio_libnfs_options *o = nfs_data->options;
 	if (res < 0) {
-		log_err("Failed NFS operation(code:%d): %s\n", res, nfs_get_error(o->context));
+		log_err("Failed NFS operation(code:%d): %s\n", res, nfs_get_error(nfs));
 		io_u->error = -res;
 		/* res is used for read math below, don't wanna pass negative there */
 		res = 0;
@@ -130,19 +167,40 @@ static void nfs_callback(int res, struct nfs_context *nfs, void *data,
 	o->events[o->free_event_buffer_index] = io_u;
 	o->free_event_buffer_index = (o->free_event_buffer_index + 1) % o->queue_depth;
 	o->outstanding_events--;
+	o->conn_outstanding[o->io_u_conn[io_u->index]]--;
 	o->buffered_event_count++;
 }
 
-static int queue_write(struct fio_libnfs_options *o, struct io_u *io_u) {
+static int queue_write(struct fio_libnfs_options *o, struct io_u *io_u,
+		       unsigned int conn) {
 	struct nfs_data *nfs_data = io_u->engine_data;
-	return nfs_pwrite_async(o->context, nfs_data->nfsfh,
+	return nfs_pwrite_async(o->contexts[conn], nfs_data->nfsfh[conn],
                            io_u->offset, io_u->buflen, io_u->buf, nfs_callback,
                            io_u);
 }
 
-static int queue_read(struct fio_libnfs_options *o, struct io_u *io_u) {
+static int queue_read(struct fio_libnfs_options *o, struct io_u *io_u,
+		      unsigned int conn) {
 	struct nfs_data *nfs_data = io_u->engine_data;
-	return nfs_pread_async(o->context,  nfs_data->nfsfh, io_u->offset, io_u->buflen, nfs_callback,  io_u);
+	return nfs_pread_async(o->contexts[conn], nfs_data->nfsfh[conn], io_u->offset, io_u->buflen, nfs_callback,  io_u);
+}
+
+/*
+ * Pick the least loaded connection that is below its depth limit, or -1 if
+ * all of them are full.
+ */
+static int pick_conn(struct fio_libnfs_options *o)
+{
+	unsigned int i, best = 0;
+
+	for (i = 1; i < o->nr_conns; i++)
+		if (o->conn_outstanding[i] < o->conn_outstanding[best])
+			best = i;
+
+	if (o->conn_outstanding[best] >= o->conn_depth)
+		return -1;
+
+	return best;
 }
 
 static enum fio_q_status fio_libnfs_queue(struct thread_data *td,
@@ -150,17 +208,22 @@ static enum fio_q_status fio_libnfs_queue(struct thread_data *td,
 {
 	struct nfs_data *nfs_data = io_u->file->engine_data;
 	struct fio_libnfs_options *o = nfs_data->options;
-	struct nfs_context *nfs = o->context;
-	int err;
+	struct nfs_context *nfs;
+	int err, conn;
 	enum fio_q_status ret = FIO_Q_QUEUED;
 
+	conn = pick_conn(o);
+	if (conn < 0)
+		return FIO_Q_BUSY;
+	nfs = o->contexts[conn];
+
 	io_u->engine_data = nfs_data;
 	switch(io_u->ddir) {
 		case DDIR_WRITE:
-			err = queue_write(o, io_u);
+			err = queue_write(o, io_u, conn);
 			break;
 		case DDIR_READ:
-			err = queue_read(o, io_u);
+			err = queue_read(o, io_u, conn);
 			break;
 		case DDIR_TRIM:
 			log_err("nfs: trim is not supported");
@@ -176,17 +239,21 @@ static enum fio_q_status fio_libnfs_queue(struct thread_data *td,
 		return FIO_Q_COMPLETED;
 	}
 	o->outstanding_events++;
+	o->conn_outstanding[conn]++;
+	o->io_u_conn[io_u->index] = conn;
 	return ret;
 }
 
 /*
- * Do a mount if one has not been done before 
+ * Do a mount if one has not been done before. Every connection gets its own
+ * context and mount, and thus its own TCP connection to the server.
  */
 static int do_mount(struct thread_data *td, const char *url)
 {
 	size_t event_size = sizeof(struct io_u **) * td->o.iodepth;
 	struct fio_libnfs_options *options = td->eo;
 	struct nfs_url *nfs_url = NULL;
+	unsigned int i;
 	int ret = 0;
 	int path_len = 0;
 	char *mnt_dir = NULL;
@@ -194,11 +261,19 @@ static int do_mount(struct thread_data *td, const char *url)
 	if (options->context)
 		return 0;
 
-	options->context = nfs_init_context();
-	if (options->context == NULL) {
-		log_err("nfs: failed to init nfs context\n");
-		return -1;
+	options->contexts = calloc(options->nr_conns, sizeof(struct nfs_context *));
+	options->pfds = calloc(options->nr_conns, sizeof(struct pollfd));
+	options->conn_outstanding = calloc(options->nr_conns, sizeof(unsigned int));
+	options->io_u_conn = calloc(td->o.iodepth, sizeof(unsigned int));
+
+	for (i = 0; i < options->nr_conns; i++) {
+		options->contexts[i] = nfs_init_context();
+		if (options->contexts[i] == NULL) {
+			log_err("nfs: failed to init nfs context\n");
+			return -1;
+		}
 	}
+	options->context = options->contexts[0];
 
 	options->events = malloc(event_size);
 	memset(options->events, 0, event_size);
@@ -206,12 +281,24 @@ static int do_mount(struct thread_data *td, const char *url)
 	options->prev_requested_event_index = -1;
 	options->queue_depth = td->o.iodepth;
 
+	if (!options->conn_depth)
+		options->conn_depth = (td->o.iodepth + options->nr_conns - 1) / options->nr_conns;
+	options->max_outstanding = min(td->o.iodepth, options->nr_conns * options->conn_depth);
+
 	nfs_url = nfs_parse_url_full(options->context, url);
 	path_len = strlen(nfs_url->path);
 	mnt_dir = malloc(path_len + strlen(nfs_url->file) + 1);
 	strcpy(mnt_dir, nfs_url->path);
 	strcpy(mnt_dir + strlen(nfs_url->path), nfs_url->file);
-	ret = nfs_mount(options->context, nfs_url->server, mnt_dir);
+	for (i = 0; i < options->nr_conns; i++) {
+		ret = nfs_mount(options->contexts[i], nfs_url->server, mnt_dir);
+		if (ret) {
+			if (i)
+				log_err("nfs: mount for connection %u failed: %s\n",
+					i, nfs_get_error(options->contexts[i]));
+			break;
+		}
+	}
 	free(mnt_dir);
 	nfs_destroy_url(nfs_url);
 	return ret;
@@ -227,8 +314,18 @@ static int fio_libnfs_setup(struct thread_data *td)
 static void fio_libnfs_cleanup(struct thread_data *td)
 {
 	struct fio_libnfs_options *o = td->eo;
-	nfs_umount(o->context);
-	nfs_destroy_context(o->context);
+	unsigned int i;
+
+	for (i = 0; o->contexts && i < o->nr_conns; i++) {
+		if (!o->contexts[i])
+			continue;
+		nfs_umount(o->contexts[i]);
+		nfs_destroy_context(o->contexts[i]);
+	}
+	free(o->contexts);
+	free(o->pfds);
+	free(o->conn_outstanding);
+	free(o->io_u_conn);
 	free(o->events);
 }
 
@@ -237,6 +334,7 @@ static int fio_libnfs_open(struct thread_data *td, struct fio_file *f)
 	int ret;
 	struct fio_libnfs_options *options = td->eo;
 	struct nfs_data *nfs_data = NULL;
+	unsigned int i;
 	int flags = 0;
 
 	if (!options->nfs_url) {
@@ -253,16 +351,20 @@ static int fio_libnfs_open(struct thread_data *td, struct fio_file *f)
 	nfs_data = malloc(sizeof(struct nfs_data));
 	memset(nfs_data, 0, sizeof(struct nfs_data));
 	nfs_data->options = options;
+	nfs_data->nfsfh = calloc(options->nr_conns, sizeof(struct nfsfh *));
 
 	if (td->o.td_ddir == TD_DDIR_WRITE) {
 		flags |= O_CREAT | O_RDWR;
 	} else {
 		flags |= O_RDWR;
 	}
-	ret = nfs_open(options->context, f->file_name, flags, &nfs_data->nfsfh);
-
-	if (ret != 0)
-		log_err("Failed to open %s: %s\n", f->file_name, nfs_get_error(options->context));
+	for (i = 0; i < options->nr_conns; i++) {
+		ret = nfs_open(options->contexts[i], f->file_name, flags, &nfs_data->nfsfh[i]);
+		if (ret != 0) {
+			log_err("Failed to open %s: %s\n", f->file_name, nfs_get_error(options->contexts[i]));
+			break;
+		}
+	}
 	f->engine_data = nfs_data;
 	return ret;
 }
@@ -271,9 +373,16 @@ static int fio_libnfs_close(struct thread_data *td, struct fio_file *f)
 {
 	struct nfs_data *nfs_data = f->engine_data;
 	struct fio_libnfs_options *o = nfs_data->options;
+	unsigned int i;
 	int ret = 0;
-	if (nfs_data->nfsfh)
-		ret = nfs_close(o->context, nfs_data->nfsfh);
+	for (i = 0; i < o->nr_conns; i++) {
+		if (nfs_data->nfsfh[i]) {
+			int err = nfs_close(o->contexts[i], nfs_data->nfsfh[i]);
+			if (err && !ret)
+				ret = err;
+		}
+	}
+	free(nfs_data->nfsfh);
 	free(nfs_data);
 	f->engine_data = NULL;
 	return ret;
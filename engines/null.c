@@ -18,11 +18,13 @@
 #include <assert.h>
 
 #include "../fio.h"
+#include "../optgroup.h"
 
 struct null_data {
 	struct io_u **io_us;
 	int queued;
 	int events;
+	void *model;		/* struct null_model, C engine only */
 };
 
 static struct io_u *null_event(struct null_data *nd, int event)
@@ -123,8 +125,194 @@ static struct null_data *null_init(struct thread_data *td)
 
 #ifndef __cplusplus
 
+#include "svcmodel.h"
+
+/*
+ * Synthetic device model, enabled by service_time, see svcmodel.h. io_us
+ * are striped over nr_queues queues by offset.
+ */
+struct null_options {
+	void *pad;
+	char *service_time;
+	unsigned int service_dist;
+	unsigned int nr_queues;
+	unsigned int queue_parallel;
+};
+
+static struct fio_option options[] = {
+	{
+		.name	= "service_time",
+		.lname	= "Service time",
+		.type	= FIO_OPT_STR_STORE,
+		.off1	= offsetof(struct null_options, service_time),
+		.help	= "Mean service time in usec, colon separated per queue",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "service_dist",
+		.lname	= "Service time distribution",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct null_options, service_dist),
+		.help	= "Distribution of the service times",
+		.def	= "fixed",
+		.posval = {
+			  { .ival = "fixed",
+			    .oval = SVC_DIST_FIXED,
+			    .help = "Always the mean",
+			  },
+			  { .ival = "uniform",
+			    .oval = SVC_DIST_UNIFORM,
+			    .help = "Uniform between 0 and twice the mean",
+			  },
+			  { .ival = "exponential",
+			    .oval = SVC_DIST_EXPONENTIAL,
+			    .help = "Exponential with the given mean",
+			  },
+		},
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "nr_queues",
+		.lname	= "Number of queues",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct null_options, nr_queues),
+		.help	= "Number of modelled device queues",
+		.def	= "1",
+		.minval	= 1,
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "queue_parallel",
+		.lname	= "Per queue parallelism",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct null_options, queue_parallel),
+		.help	= "Requests each modelled queue serves at once",
+		.def	= "1",
+		.minval	= 1,
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= NULL,
+	},
+};
+
+struct null_model {
+	struct svc_model *svc;
+	unsigned long long stripe;
+	struct io_u **events;
+};
+
+static int null_model_commit(struct thread_data *td, struct null_data *nd,
+			     struct null_model *m)
+{
+	int i;
+
+	if (!nd->queued)
+		return 0;
+
+	null_queued(td, nd);
+	io_u_mark_submit(td, nd->queued);
+
+	for (i = 0; i < nd->queued; i++) {
+		struct io_u *io_u = nd->io_us[i];
+		unsigned int q = (io_u->offset / m->stripe) %
+					m->svc->nr_queues;
+
+		svc_model_queue(m->svc, q, 0, io_u);
+	}
+
+	nd->queued = 0;
+	return 0;
+}
+
+static int null_model_getevents(struct null_model *m, unsigned int min,
+				unsigned int max)
+{
+	unsigned int events = 0;
+	struct io_u *io_u;
+	uint64_t now;
+
+	while (m->svc->nr_heap) {
+		now = svc_model_now(m->svc);
+		while (events < max &&
+		       (io_u = svc_model_reap(m->svc, now)) != NULL)
+			m->events[events++] = io_u;
+
+		if (events >= min || events == max || !m->svc->nr_heap)
+			break;
+
+		svc_model_wait(m->svc, now);
+	}
+
+	return events;
+}
+
+static void null_model_free(struct null_model *m)
+{
+	if (!m)
+		return;
+
+	svc_model_free(m->svc);
+	free(m->events);
+	free(m);
+}
+
+static struct null_model *null_model_init(struct thread_data *td,
+					  struct null_data *nd)
+{
+	struct null_options *o = td->eo;
+	struct null_model *m;
+
+	m = calloc(1, sizeof(*m));
+	if (!m)
+		return NULL;
+
+	m->stripe = td->o.min_bs[DDIR_READ];
+	if (!m->stripe || td->o.min_bs[DDIR_WRITE] < m->stripe)
+		m->stripe = td->o.min_bs[DDIR_WRITE];
+	if (!m->stripe)
+		m->stripe = 4096;
+
+	m->svc = svc_model_init(o->service_time, o->service_dist,
+				o->nr_queues, o->queue_parallel, 0,
+				td->o.iodepth);
+	m->events = calloc(td->o.iodepth, sizeof(struct io_u *));
+	if (!m->svc || !m->events)
+		goto err;
+
+	if (!nd->io_us) {
+		nd->io_us = calloc(td->o.iodepth, sizeof(struct io_u *));
+		if (!nd->io_us)
+			goto err;
+	}
+
+	td->io_ops->flags &= ~FIO_SYNCIO;
+	td->io_ops->flags |= FIO_ASYNCIO_SETS_ISSUE_TIME;
+	td_set_ioengine_flags(td);
+	return m;
+err:
+	null_model_free(m);
+	return NULL;
+}
+
+static struct null_model *null_model_get(struct thread_data *td)
+{
+	struct null_data *nd = td->io_ops_data;
+
+	return (struct null_model *) nd->model;
+}
+
 static struct io_u *fio_null_event(struct thread_data *td, int event)
 {
+	struct null_model *m = null_model_get(td);
+
+	if (m)
+		return m->events[event];
+
 	return null_event(td->io_ops_data, event);
 }
 
@@ -132,17 +320,35 @@ static int fio_null_getevents(struct thread_data *td, unsigned int min_events,
 			      unsigned int max, const struct timespec *t)
 {
 	struct null_data *nd = td->io_ops_data;
+	struct null_model *m = null_model_get(td);
+
+	if (m)
+		return null_model_getevents(m, min_events, max);
+
 	return null_getevents(nd, min_events, max, t);
 }
 
 static int fio_null_commit(struct thread_data *td)
 {
+	struct null_model *m = null_model_get(td);
+
+	if (m)
+		return null_model_commit(td, td->io_ops_data, m);
+
 	return null_commit(td, td->io_ops_data);
 }
 
 static enum fio_q_status fio_null_queue(struct thread_data *td,
 					struct io_u *io_u)
 {
+	struct null_data *nd = td->io_ops_data;
+
+	if (nd->model) {
+		fio_ro_check(td, io_u);
+		nd->io_us[nd->queued++] = io_u;
+		return FIO_Q_QUEUED;
+	}
+
 	return null_queue(td, td->io_ops_data, io_u);
 }
 
@@ -153,13 +359,29 @@ static int fio_null_open(struct thread_data *td, struct fio_file *f)
 
 static void fio_null_cleanup(struct thread_data *td)
 {
-	null_cleanup(td->io_ops_data);
+	struct null_data *nd = td->io_ops_data;
+
+	if (nd)
+		null_model_free((struct null_model *) nd->model);
+	null_cleanup(nd);
 }
 
 static int fio_null_init(struct thread_data *td)
 {
-	td->io_ops_data = null_init(td);
+	struct null_options *o = td->eo;
+	struct null_data *nd;
+
+	td->io_ops_data = nd = null_init(td);
 	assert(td->io_ops_data);
+
+	if (o->service_time) {
+		nd->model = null_model_init(td, nd);
+		if (!nd->model) {
+			log_err("null: bad service_time or out of memory\n");
+			return 1;
+		}
+	}
+
 	return 0;
 }
 
@@ -173,7 +395,9 @@ static struct ioengine_ops ioengine = {
 	.init		= fio_null_init,
 	.cleanup	= fio_null_cleanup,
 	.open_file	= fio_null_open,
-	.flags		= FIO_DISKLESSIO | FIO_FAKEIO,
+	.flags		= FIO_DISKLESSIO | FIO_FAKEIO | FIO_MULTI_RANGE_TRIM,
+	.options	= options,
+	.option_struct_size = sizeof(struct null_options),
 };
 
 static void fio_init fio_null_register(void)
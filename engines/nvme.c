@@ -4,9 +4,24 @@
  */
 
 #include "nvme.h"
+#include "../crc/crc_t10dif.h"
+
+/*
+ * With the extended LBA format each LBA in the data buffer carries its
+ * metadata, so it isn't a power of 2 in size.
+ */
+static inline __u64 nvme_bytes_to_lba(struct nvme_data *data,
+				      unsigned long long bytes)
+{
+	if (data->lba_ext)
+		return bytes / data->lba_ext;
+
+	return bytes >> data->lba_shift;
+}
 
 int fio_nvme_uring_cmd_prep(struct nvme_uring_cmd *cmd, struct io_u *io_u,
-			    struct iovec *iov)
+			    struct iovec *iov, void *md_buf,
+			    struct nvme_cmd_ext_io_opts *opts)
 {
 	struct nvme_data *data = FILE_ENG_DATA(io_u->file);
 	__u64 slba;
@@ -16,20 +31,40 @@ int fio_nvme_uring_cmd_prep(struct nvme_uring_cmd *cmd, struct io_u *io_u,
 
 	if (io_u->ddir == DDIR_READ)
 		cmd->opcode = nvme_cmd_read;
-	else if (io_u->ddir == DDIR_WRITE)
+	else if (io_u->ddir == DDIR_WRITE && (io_u->flags & IO_U_F_ZONE_APPEND)) {
+		/* the reference tags would have to be remapped by the drive */
+		if (data->pi_type == NVME_NS_DPS_PI_TYPE1 ||
+		    data->pi_type == NVME_NS_DPS_PI_TYPE2)
+			return -ENOTSUP;
+		cmd->opcode = nvme_zns_cmd_append;
+	} else if (io_u->ddir == DDIR_WRITE)
 		cmd->opcode = nvme_cmd_write;
 	else
 		return -ENOTSUP;
 
-	slba = io_u->offset >> data->lba_shift;
-	nlb = (io_u->xfer_buflen >> data->lba_shift) - 1;
+	slba = nvme_bytes_to_lba(data, io_u->offset);
+	nlb = nvme_bytes_to_lba(data, io_u->xfer_buflen) - 1;
 
-	/* cdw10 and cdw11 represent starting lba */
+	/* cdw10 and cdw11 represent starting lba, the zone start for appends */
 	cmd->cdw10 = slba & 0xffffffff;
 	cmd->cdw11 = slba >> 32;
 	/* cdw12 represent number of lba's for read/write */
 	cmd->cdw12 = nlb | (io_u->dtype << 20);
 	cmd->cdw13 = io_u->dspec << 16;
+
+	if (data->pi_type && opts) {
+		cmd->cdw12 |= opts->io_flags;
+		/* expected initial logical block reference tag */
+		if (data->pi_type != NVME_NS_DPS_PI_TYPE3)
+			cmd->cdw14 = slba & 0xffffffff;
+		cmd->cdw15 = (opts->apptag_mask << 16) | opts->apptag;
+	}
+
+	/* separate metadata buffer, unless PRACT lets the drive own it */
+	if (data->ms && !data->lba_ext && md_buf) {
+		cmd->metadata = (__u64)(uintptr_t)md_buf;
+		cmd->metadata_len = (nlb + 1) * data->ms;
+	}
 	if (iov) {
 		iov->iov_base = io_u->xfer_buf;
 		iov->iov_len = io_u->xfer_buflen;
@@ -43,6 +78,139 @@ int fio_nvme_uring_cmd_prep(struct nvme_uring_cmd *cmd, struct io_u *io_u,
 	return 0;
 }
 
+/*
+ * A zone append completes with the LBA the data was written at.
+ */
+void fio_nvme_zone_append_done(struct io_u *io_u, __u64 result)
+{
+	struct nvme_data *data = FILE_ENG_DATA(io_u->file);
+
+	if (data->lba_ext)
+		io_u->offset = result * data->lba_ext;
+	else
+		io_u->offset = result << data->lba_shift;
+}
+
+static struct nvme_16b_guard_pif *nvme_pi_tuple(struct nvme_data *data,
+						 struct nvme_uring_cmd *cmd,
+						 struct io_u *io_u, __u32 lba,
+						 void **lba_buf, void **md)
+{
+	if (data->lba_ext) {
+		*lba_buf = io_u->xfer_buf + lba * data->lba_ext;
+		*md = *lba_buf + data->lba_size;
+	} else {
+		*lba_buf = io_u->xfer_buf + lba * data->lba_size;
+		*md = (void *)(uintptr_t)cmd->metadata + lba * data->ms;
+	}
+
+	if (data->pi_loc)
+		return *md;
+
+	return *md + data->ms - data->pi_size;
+}
+
+/*
+ * The guard covers the LBA data, plus any metadata bytes that precede the
+ * protection information tuple when it sits at the end of the metadata.
+ */
+static __u16 nvme_pi_guard(struct nvme_data *data, void *lba_buf, void *md)
+{
+	__u16 guard;
+
+	guard = fio_crc_t10dif(0, lba_buf, data->lba_size);
+	if (!data->pi_loc && data->ms > data->pi_size)
+		guard = fio_crc_t10dif(guard, md, data->ms - data->pi_size);
+
+	return guard;
+}
+
+/*
+ * Generate the protection information for a write, so the drive can check
+ * it when PRCHK bits are set.
+ */
+void fio_nvme_pi_fill(struct nvme_uring_cmd *cmd, struct io_u *io_u,
+		      struct nvme_cmd_ext_io_opts *opts)
+{
+	struct nvme_data *data = FILE_ENG_DATA(io_u->file);
+	__u64 slba = ((__u64) cmd->cdw11 << 32) | cmd->cdw10;
+	__u32 nlb = (cmd->cdw12 & 0xffff) + 1;
+	__u32 i;
+
+	for (i = 0; i < nlb; i++) {
+		struct nvme_16b_guard_pif *pi;
+		void *lba_buf, *md;
+		uint16_t guard;
+		uint32_t reftag;
+
+		pi = nvme_pi_tuple(data, cmd, io_u, i, &lba_buf, &md);
+		guard = nvme_pi_guard(data, lba_buf, md);
+		if (data->pi_type == NVME_NS_DPS_PI_TYPE3)
+			reftag = 0xffffffff;
+		else
+			reftag = slba + i;
+
+		pi->guard = cpu_to_be16(guard);
+		pi->apptag = cpu_to_be16(opts->apptag);
+		pi->srtag = cpu_to_be32(reftag);
+	}
+}
+
+/*
+ * Check the protection information of a completed read against the checks
+ * selected with pi_chk. Returns 0 or EIO.
+ */
+int fio_nvme_pi_verify(struct nvme_data *data, struct io_u *io_u,
+		       struct nvme_uring_cmd *cmd,
+		       struct nvme_cmd_ext_io_opts *opts)
+{
+	__u64 slba = ((__u64) cmd->cdw11 << 32) | cmd->cdw10;
+	__u32 nlb = (cmd->cdw12 & 0xffff) + 1;
+	__u32 i;
+
+	for (i = 0; i < nlb; i++) {
+		struct nvme_16b_guard_pif *pi;
+		void *lba_buf, *md;
+		__u16 apptag, guard;
+		__u32 reftag;
+
+		pi = nvme_pi_tuple(data, cmd, io_u, i, &lba_buf, &md);
+		apptag = be16_to_cpu(pi->apptag);
+		if (apptag == NVME_PI_APP_DISABLE)
+			continue;
+
+		if (opts->io_flags & NVME_IO_PRINFO_PRCHK_GUARD) {
+			guard = nvme_pi_guard(data, lba_buf, md);
+			if (be16_to_cpu(pi->guard) != guard) {
+				log_err("fio: PI guard mismatch at lba %llu: 0x%x != 0x%x\n",
+					(unsigned long long) slba + i,
+					be16_to_cpu(pi->guard), guard);
+				return EIO;
+			}
+		}
+
+		if ((opts->io_flags & NVME_IO_PRINFO_PRCHK_APP) &&
+		    (apptag & opts->apptag_mask) !=
+		    (opts->apptag & opts->apptag_mask)) {
+			log_err("fio: PI apptag mismatch at lba %llu: 0x%x != 0x%x\n",
+				(unsigned long long) slba + i, apptag,
+				opts->apptag);
+			return EIO;
+		}
+
+		reftag = be32_to_cpu(pi->srtag);
+		if ((opts->io_flags & NVME_IO_PRINFO_PRCHK_REF) &&
+		    data->pi_type != NVME_NS_DPS_PI_TYPE3 &&
+		    reftag != ((slba + i) & 0xffffffff)) {
+			log_err("fio: PI reftag mismatch at lba %llu: 0x%x\n",
+				(unsigned long long) slba + i, reftag);
+			return EIO;
+		}
+	}
+
+	return 0;
+}
+
 static int nvme_trim(int fd, __u32 nsid, __u32 nr_range, __u32 data_len,
 		     void *data)
 {
@@ -58,21 +226,108 @@ static int nvme_trim(int fd, __u32 nsid, __u32 nr_range, __u32 data_len,
 	return ioctl(fd, NVME_IOCTL_IO_CMD, &cmd);
 }
 
+static int nvme_write_zeroes(int fd, __u32 nsid, __u64 slba, __u32 nlb)
+{
+	struct nvme_passthru_cmd cmd = {
+		.opcode		= nvme_cmd_write_zeroes,
+		.nsid		= nsid,
+		.cdw10		= slba & 0xffffffff,
+		.cdw11		= slba >> 32,
+		.cdw12		= nlb - 1,
+	};
+
+	return ioctl(fd, NVME_IOCTL_IO_CMD, &cmd);
+}
+
+static int nvme_copy(int fd, __u32 nsid, __u64 sdlba, __u64 slba, __u32 nlb)
+{
+	struct nvme_copy_range range = {
+		.slba	= slba,
+		.nlb	= nlb - 1,
+	};
+	struct nvme_passthru_cmd cmd = {
+		.opcode		= nvme_cmd_copy,
+		.nsid		= nsid,
+		.addr		= (__u64)(uintptr_t)&range,
+		.data_len	= sizeof(range),
+		.cdw10		= sdlba & 0xffffffff,
+		.cdw11		= sdlba >> 32,
+		/* one range, descriptor format 0 */
+		.cdw12		= 0,
+	};
+
+	return ioctl(fd, NVME_IOCTL_IO_CMD, &cmd);
+}
+
+/*
+ * trim_mode=write_zeroes and copy, one command per range as neither
+ * takes more than a single destination range.
+ */
+static int nvme_trim_range(const struct thread_data *td, struct fio_file *f,
+			   unsigned long long start, unsigned long long len)
+{
+	struct nvme_data *data = FILE_ENG_DATA(f);
+	unsigned long long src;
+	__u64 slba = nvme_bytes_to_lba(data, start);
+	__u32 nlb = nvme_bytes_to_lba(data, len);
+
+	if (td->o.trim_mode == TRIM_MODE_WRITE_ZEROES)
+		return nvme_write_zeroes(f->fd, data->nsid, slba, nlb);
+
+	src = trim_copy_src(td, f, start, len);
+	return nvme_copy(f->fd, data->nsid, slba, nvme_bytes_to_lba(data, src),
+			 nlb);
+}
+
+/*
+ * One DSM deallocate for the io_u, with every range of a multi-range trim
+ * in a single command.
+ */
 int fio_nvme_trim(const struct thread_data *td, struct fio_file *f,
-		  unsigned long long offset, unsigned long long len)
+		  struct io_u *io_u)
 {
 	struct nvme_data *data = FILE_ENG_DATA(f);
-	struct nvme_dsm_range dsm;
+	struct nvme_dsm_range dsm[256];
+	unsigned int i, nr = 1;
 	int ret;
 
-	dsm.nlb = (len >> data->lba_shift);
-	dsm.slba = (offset >> data->lba_shift);
+	if (td->o.trim_mode != TRIM_MODE_DISCARD) {
+		if (!io_u->nr_trim_ranges)
+			ret = nvme_trim_range(td, f, io_u->offset,
+					      io_u->xfer_buflen);
+		else
+			for (i = 0, ret = 0; !ret && i < io_u->nr_trim_ranges; i++)
+				ret = nvme_trim_range(td, f,
+						io_u->trim_ranges[i].start,
+						io_u->trim_ranges[i].len);
+		if (ret)
+			log_err("%s: trim_mode command failed for offset %llu "
+				"and len %llu, err=%d\n", f->file_name,
+				io_u->offset, io_u->xfer_buflen, ret);
+		return ret;
+	}
 
-	ret = nvme_trim(f->fd, data->nsid, 1, sizeof(struct nvme_dsm_range),
-			&dsm);
+	if (io_u->nr_trim_ranges) {
+		nr = io_u->nr_trim_ranges;
+		for (i = 0; i < nr; i++) {
+			dsm[i].cattr = 0;
+			dsm[i].nlb = nvme_bytes_to_lba(data,
+						io_u->trim_ranges[i].len);
+			dsm[i].slba = nvme_bytes_to_lba(data,
+						io_u->trim_ranges[i].start);
+		}
+	} else {
+		dsm[0].cattr = 0;
+		dsm[0].nlb = nvme_bytes_to_lba(data, io_u->xfer_buflen);
+		dsm[0].slba = nvme_bytes_to_lba(data, io_u->offset);
+	}
+
+	ret = nvme_trim(f->fd, data->nsid, nr,
+			nr * sizeof(struct nvme_dsm_range), dsm);
 	if (ret)
-		log_err("%s: nvme_trim failed for offset %llu and len %llu, err=%d\n",
-			f->file_name, offset, len, ret);
+		log_err("%s: nvme_trim failed for offset %llu and len %llu, "
+			"%u ranges, err=%d\n", f->file_name, io_u->offset,
+			io_u->xfer_buflen, nr, ret);
 
 	return ret;
 }
@@ -93,12 +348,13 @@ static int nvme_identify(int fd, __u32 nsid, enum nvme_identify_cns cns,
 	return ioctl(fd, NVME_IOCTL_ADMIN_CMD, &cmd);
 }
 
-int fio_nvme_get_info(struct fio_file *f, __u32 *nsid, __u32 *lba_sz,
-		      __u64 *nlba)
+int fio_nvme_get_info(struct fio_file *f, __u64 *nlba, __u32 pi_act,
+		      struct nvme_data *data)
 {
 	struct nvme_id_ns ns;
 	int namespace_id;
 	int fd, err;
+	__u32 format_idx;
 
 	if (f->filetype != FIO_TYPE_CHAR) {
 		log_err("ioengine io_uring_cmd only works with nvme ns "
@@ -129,8 +385,35 @@ int fio_nvme_get_info(struct fio_file *f, __u32 *nsid, __u32 *lba_sz,
 		return err;
 	}
 
-	*nsid = namespace_id;
-	*lba_sz = 1 << ns.lbaf[(ns.flbas & 0x0f)].ds;
+	format_idx = ns.flbas & 0x0f;
+
+	data->nsid = namespace_id;
+	data->lba_size = 1 << ns.lbaf[format_idx].ds;
+	data->lba_shift = ns.lbaf[format_idx].ds;
+	data->ms = le16_to_cpu(ns.lbaf[format_idx].ms);
+
+	/*
+	 * Only the 16b guard protection information format is supported, and
+	 * it needs (at least) 8 bytes of metadata per LBA.
+	 */
+	data->pi_type = ns.dps & NVME_NS_DPS_PI_MASK;
+	if (data->pi_type && data->ms >= sizeof(struct nvme_16b_guard_pif)) {
+		data->pi_size = sizeof(struct nvme_16b_guard_pif);
+		data->pi_loc = !!(ns.dps & NVME_NS_DPS_PI_FIRST);
+	} else
+		data->pi_type = NVME_NS_DPS_PI_NONE;
+
+	/*
+	 * If PRACT is set and the metadata is just the protection
+	 * information, the controller inserts and strips it and the host
+	 * never sees any metadata.
+	 */
+	if (pi_act && data->pi_type && data->ms == data->pi_size)
+		data->ms = 0;
+
+	if (data->ms && (ns.flbas & NVME_NS_FLBAS_META_EXT))
+		data->lba_ext = data->lba_size + data->ms;
+
 	*nlba = ns.nsze;
 
 	close(fd);
@@ -417,3 +700,68 @@ int fio_nvme_iomgmt_ruhs(struct thread_data *td, struct fio_file *f,
 	close(fd);
 	return -errno;
 }
+
+static int nvme_get_log_page(int fd, __u32 nsid, __u8 lid, __u16 lsi,
+			     __u32 data_len, void *data)
+{
+	__u32 numd = (data_len >> 2) - 1;
+	struct nvme_passthru_cmd cmd = {
+		.opcode		= nvme_admin_get_log_page,
+		.nsid		= nsid,
+		.addr		= (__u64)(uintptr_t)data,
+		.data_len	= data_len,
+		.cdw10		= lid | ((numd & 0xffff) << 16),
+		.cdw11		= (numd >> 16) | ((__u32)lsi << 16),
+		.timeout_ms	= NVME_DEFAULT_IOCTL_TIMEOUT,
+	};
+
+	return ioctl(fd, NVME_IOCTL_ADMIN_CMD, &cmd);
+}
+
+/*
+ * FDP statistics are kept per endurance group, the namespace tells which
+ * one it belongs to.
+ */
+int fio_nvme_fdp_stats(struct thread_data *td, struct fio_file *f,
+		       struct fio_fdp_stats *stats)
+{
+	struct nvme_fdp_stats_log log;
+	struct nvme_id_ns ns;
+	int fd, nsid, ret;
+	__u16 endgid;
+
+	fd = open(f->file_name, O_RDONLY | O_LARGEFILE);
+	if (fd < 0)
+		return -errno;
+
+	nsid = ioctl(fd, NVME_IOCTL_ID);
+	if (nsid < 0) {
+		ret = -errno;
+		goto out;
+	}
+
+	ret = nvme_identify(fd, nsid, NVME_IDENTIFY_CNS_NS, NVME_CSI_NVM, &ns);
+	if (ret) {
+		log_err("%s: failed to fetch identify namespace, err=%d\n",
+			f->file_name, ret);
+		ret = -ENOTSUP;
+		goto out;
+	}
+
+	endgid = le16_to_cpu(ns.endgid);
+	ret = nvme_get_log_page(fd, 0, NVME_LOG_LID_FDP_STATS, endgid,
+				sizeof(log), &log);
+	if (ret) {
+		log_err("%s: failed to fetch FDP statistics log, err=%d\n",
+			f->file_name, ret);
+		ret = -ENOTSUP;
+		goto out;
+	}
+
+	stats->hbmw = le64_to_cpu((uint64_t) log.hbmw[0]);
+	stats->mbmw = le64_to_cpu((uint64_t) log.mbmw[0]);
+	stats->mbe = le64_to_cpu((uint64_t) log.mbe[0]);
+out:
+	close(fd);
+	return ret;
+}
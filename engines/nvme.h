@@ -50,8 +50,27 @@ struct nvme_uring_cmd {
 
 #define NVME_ATTRIBUTE_DEALLOCATE (1 << 2)
 
+/* Formatted LBA size: metadata is transferred at the end of each LBA */
+#define NVME_NS_FLBAS_META_EXT	(1 << 4)
+/* Protection information is transferred as the first bytes of metadata */
+#define NVME_NS_DPS_PI_FIRST	(1 << 3)
+#define NVME_NS_DPS_PI_MASK	0x7
+
+/* Protection information check and action bits in cdw12 */
+#define NVME_IO_PRINFO_PRCHK_REF	(1U << 26)
+#define NVME_IO_PRINFO_PRCHK_APP	(1U << 27)
+#define NVME_IO_PRINFO_PRCHK_GUARD	(1U << 28)
+#define NVME_IO_PRINFO_PRACT		(1U << 29)
+#define NVME_IO_PRINFO_PRCHK_MASK	(NVME_IO_PRINFO_PRCHK_REF | \
+					 NVME_IO_PRINFO_PRCHK_APP | \
+					 NVME_IO_PRINFO_PRCHK_GUARD)
+
+/* Application tag value that disables checking of an LBA */
+#define NVME_PI_APP_DISABLE	0xffff
+
 enum nvme_identify_cns {
 	NVME_IDENTIFY_CNS_NS		= 0x00,
+	NVME_IDENTIFY_CNS_CTRL		= 0x01,
 	NVME_IDENTIFY_CNS_CSI_NS	= 0x05,
 	NVME_IDENTIFY_CNS_CSI_CTRL	= 0x06,
 };
@@ -63,16 +82,25 @@ enum nvme_csi {
 };
 
 enum nvme_admin_opcode {
+	nvme_admin_get_log_page		= 0x02,
 	nvme_admin_identify		= 0x06,
+	nvme_admin_set_features		= 0x09,
+};
+
+enum nvme_log_page_id {
+	NVME_LOG_LID_FDP_STATS		= 0x22,
 };
 
 enum nvme_io_opcode {
 	nvme_cmd_write			= 0x01,
 	nvme_cmd_read			= 0x02,
+	nvme_cmd_write_zeroes		= 0x08,
 	nvme_cmd_dsm			= 0x09,
+	nvme_cmd_copy			= 0x19,
 	nvme_cmd_io_mgmt_recv		= 0x12,
 	nvme_zns_cmd_mgmt_send		= 0x79,
 	nvme_zns_cmd_mgmt_recv		= 0x7a,
+	nvme_zns_cmd_append		= 0x7d,
 };
 
 enum nvme_zns_zs {
@@ -85,9 +113,40 @@ enum nvme_zns_zs {
 	NVME_ZNS_ZS_OFFLINE		= 0xf,
 };
 
+enum nvme_pi_type {
+	NVME_NS_DPS_PI_NONE		= 0,
+	NVME_NS_DPS_PI_TYPE1		= 1,
+	NVME_NS_DPS_PI_TYPE2		= 2,
+	NVME_NS_DPS_PI_TYPE3		= 3,
+};
+
 struct nvme_data {
 	__u32 nsid;
 	__u32 lba_shift;
+	__u32 lba_size;
+	/*
+	 * Size of one LBA in the data buffer when metadata is interleaved
+	 * with the data (extended LBA format), 0 if it isn't.
+	 */
+	__u32 lba_ext;
+	__u16 ms;
+	__u16 pi_size;
+	__u8 pi_type;
+	__u8 pi_loc;
+};
+
+/* 16b guard protection information tuple */
+struct nvme_16b_guard_pif {
+	__be16 guard;
+	__be16 apptag;
+	__be32 srtag;
+};
+
+/* Per job protection information settings for read/write commands */
+struct nvme_cmd_ext_io_opts {
+	__u32 io_flags;
+	__u16 apptag;
+	__u16 apptag_mask;
 };
 
 struct nvme_lbaf {
@@ -210,23 +269,56 @@ struct nvme_fdp_ruh_status {
 	struct nvme_fdp_ruh_status_desc ruhss[];
 };
 
+/* values are 128 bit, fio only looks at the low 64 bits */
+struct nvme_fdp_stats_log {
+	__le64 hbmw[2];
+	__le64 mbmw[2];
+	__le64 mbe[2];
+	__u8  rsvd48[16];
+};
+
 struct nvme_dsm_range {
 	__le32	cattr;
 	__le32	nlb;
 	__le64	slba;
 };
 
+/* source range entry, descriptor format 0 */
+struct nvme_copy_range {
+	__le64	rsvd0;
+	__le64	slba;
+	__le16	nlb;
+	__le16	rsvd18;
+	__le32	rsvd20;
+	__le32	eilbrt;
+	__le16	elbat;
+	__le16	elbatm;
+};
+
 int fio_nvme_trim(const struct thread_data *td, struct fio_file *f,
-		  unsigned long long offset, unsigned long long len);
+		  struct io_u *io_u);
 
 int fio_nvme_iomgmt_ruhs(struct thread_data *td, struct fio_file *f,
 			 struct nvme_fdp_ruh_status *ruhs, __u32 bytes);
 
-int fio_nvme_get_info(struct fio_file *f, __u32 *nsid, __u32 *lba_sz,
-		      __u64 *nlba);
+int fio_nvme_fdp_stats(struct thread_data *td, struct fio_file *f,
+		       struct fio_fdp_stats *stats);
+
+int fio_nvme_get_info(struct fio_file *f, __u64 *nlba, __u32 pi_act,
+		      struct nvme_data *data);
 
 int fio_nvme_uring_cmd_prep(struct nvme_uring_cmd *cmd, struct io_u *io_u,
-			    struct iovec *iov);
+			    struct iovec *iov, void *md_buf,
+			    struct nvme_cmd_ext_io_opts *opts);
+
+void fio_nvme_zone_append_done(struct io_u *io_u, __u64 result);
+
+void fio_nvme_pi_fill(struct nvme_uring_cmd *cmd, struct io_u *io_u,
+		      struct nvme_cmd_ext_io_opts *opts);
+
+int fio_nvme_pi_verify(struct nvme_data *data, struct io_u *io_u,
+		       struct nvme_uring_cmd *cmd,
+		       struct nvme_cmd_ext_io_opts *opts);
 
 int fio_nvme_get_zoned_model(struct thread_data *td, struct fio_file *f,
 			     enum zbd_zoned_model *model);
@@ -0,0 +1,1609 @@
+/*
+ * NVMe/TCP engine
+ *
+ * Userspace NVMe over Fabrics initiator for the TCP transport. The job
+ * connects its own admin queue and one or more I/O queues to the target,
+ * each queue being a TCP connection of its own as the transport requires.
+ * All I/O queues are driven from a private io_uring: command capsules and
+ * H2C data PDUs go out with IORING_OP_SENDMSG, and every connection keeps
+ * an IORING_OP_RECV posted for the PDUs coming back.
+ *
+ * The filename is the target address, the port, subsystem NQN and
+ * namespace are given with the nvmf_* options.
+ *
+ */
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include "../fio.h"
+#include "../optgroup.h"
+#include "../crc/crc32c.h"
+#include "../os/linux/io_uring.h"
+#include "nvme.h"
+
+enum nvmf_tcp_pdu_type {
+	NVMF_TCP_ICREQ		= 0x00,
+	NVMF_TCP_ICRESP		= 0x01,
+	NVMF_TCP_H2C_TERM	= 0x02,
+	NVMF_TCP_C2H_TERM	= 0x03,
+	NVMF_TCP_CMD		= 0x04,
+	NVMF_TCP_RSP		= 0x05,
+	NVMF_TCP_H2C_DATA	= 0x06,
+	NVMF_TCP_C2H_DATA	= 0x07,
+	NVMF_TCP_R2T		= 0x09,
+};
+
+#define NVMF_TCP_F_HDGST	0x01
+#define NVMF_TCP_F_DDGST	0x02
+#define NVMF_TCP_F_DATA_LAST	0x04
+#define NVMF_TCP_F_DATA_SUCCESS	0x08
+
+#define NVMF_TCP_DIGEST_LEN	4
+#define NVMF_TCP_ADMIN_ICD	8192
+
+#define NVME_CMD_SGL_METABUF	0x40
+#define NVME_SGL_ICD		0x01	/* data block, offset into the capsule */
+#define NVME_SGL_TRANSPORT	0x5a	/* transport data block */
+
+#define nvme_fabrics_command	0x7f
+#define nvme_cmd_flush		0x00
+
+enum nvmf_fctype {
+	nvmf_fctype_prop_set	= 0x00,
+	nvmf_fctype_connect	= 0x01,
+	nvmf_fctype_prop_get	= 0x04,
+};
+
+#define NVME_REG_CAP		0x00
+#define NVME_REG_CC		0x14
+#define NVME_REG_CSTS		0x1c
+#define NVME_CC_ENABLE		(1U << 0)
+#define NVME_CC_IOSQES		(6U << 16)
+#define NVME_CC_IOCQES		(4U << 20)
+#define NVME_CSTS_RDY		(1U << 0)
+#define NVME_CSTS_CFS		(1U << 1)
+
+#define NVME_FEAT_NUM_QUEUES	0x07
+#define NVME_AQ_DEPTH		32
+#define NVMF_CONNECT_DATA_LEN	1024
+
+/* offsets in the identify controller data */
+#define NVME_ID_CTRL_MDTS	77
+#define NVME_ID_CTRL_IOCCSZ	1792
+
+struct nvmf_tcp_hdr {
+	uint8_t type;
+	uint8_t flags;
+	uint8_t hlen;
+	uint8_t pdo;
+	uint32_t plen;
+} __attribute__((packed));
+
+struct nvmf_tcp_icreq {
+	struct nvmf_tcp_hdr hdr;
+	uint16_t pfv;
+	uint8_t hpda;
+	uint8_t digest;
+	uint32_t maxr2t;
+	uint8_t rsvd[112];
+} __attribute__((packed));
+
+struct nvmf_tcp_icresp {
+	struct nvmf_tcp_hdr hdr;
+	uint16_t pfv;
+	uint8_t cpda;
+	uint8_t digest;
+	uint32_t maxdata;
+	uint8_t rsvd[112];
+} __attribute__((packed));
+
+struct nvmf_sgl {
+	uint64_t addr;
+	uint32_t length;
+	uint8_t rsvd[3];
+	uint8_t type;
+} __attribute__((packed));
+
+/* submission queue entry as it goes on the wire */
+struct nvmf_sqe {
+	uint8_t opcode;
+	uint8_t flags;
+	uint16_t cid;
+	uint32_t nsid;
+	uint32_t cdw2;
+	uint32_t cdw3;
+	uint64_t mptr;
+	struct nvmf_sgl sgl;
+	uint32_t cdw10;
+	uint32_t cdw11;
+	uint32_t cdw12;
+	uint32_t cdw13;
+	uint32_t cdw14;
+	uint32_t cdw15;
+} __attribute__((packed));
+
+struct nvmf_cqe {
+	uint32_t dw0;
+	uint32_t dw1;
+	uint16_t sq_head;
+	uint16_t sq_id;
+	uint16_t cid;
+	uint16_t status;
+} __attribute__((packed));
+
+struct nvmf_tcp_cmd {
+	struct nvmf_tcp_hdr hdr;
+	struct nvmf_sqe sqe;
+} __attribute__((packed));
+
+struct nvmf_tcp_rsp {
+	struct nvmf_tcp_hdr hdr;
+	struct nvmf_cqe cqe;
+} __attribute__((packed));
+
+/* C2H and H2C data PDUs, and R2T which has the same layout */
+struct nvmf_tcp_data {
+	struct nvmf_tcp_hdr hdr;
+	uint16_t cid;
+	uint16_t ttag;
+	uint32_t offset;
+	uint32_t length;
+	uint8_t rsvd[4];
+} __attribute__((packed));
+
+struct nvmf_connect_data {
+	uint8_t hostid[16];
+	uint16_t cntlid;
+	uint8_t rsvd[238];
+	char subnqn[256];
+	char hostnqn[256];
+	uint8_t rsvd2[256];
+} __attribute__((packed));
+
+/* one H2C data PDU answering (part of) an R2T */
+struct nvmf_h2c {
+	struct nvmf_tcp_data pdu;
+	uint32_t hdgst;
+	uint32_t ddgst;
+};
+
+/*
+ * A command slot, the command id is its index in the queue. The PDUs we
+ * send for it are built in here, so it must stay put until the send
+ * carrying them has completed.
+ */
+struct nvmf_req {
+	struct nvmf_tcp_cmd cmd;
+	uint32_t hdgst;
+	uint32_t ddgst;
+	struct nvmf_h2c *h2c;
+	struct nvme_dsm_range *dsm;
+
+	struct io_u *io_u;
+	void *buf;
+	uint32_t len;
+	int write;
+	int done;
+	uint16_t status;
+	uint64_t result;
+};
+
+struct nvmf_queue {
+	int fd;
+	uint16_t qid;
+	int hdgst;
+	int ddgst;
+	unsigned int pda;
+	uint32_t maxh2c;
+	uint32_t icd;
+
+	struct nvmf_req *reqs;
+	unsigned int *free_reqs;
+	unsigned int nr_free;
+	unsigned int depth;
+	unsigned int nr_h2c;
+
+	/* stream bytes received, parsed once a whole PDU is in */
+	char *rx_buf;
+	size_t rx_len;
+	size_t rx_size;
+	int recv_posted;
+
+	/*
+	 * PDUs to send. tx_iov collects new ones while tx_busy is owned by
+	 * the sendmsg in flight, the two are swapped when a send is posted.
+	 */
+	struct iovec *tx_iov;
+	unsigned int tx_nr;
+	unsigned int tx_max;
+	struct iovec *tx_busy;
+	unsigned int tx_busy_nr;
+	unsigned int tx_busy_max;
+	struct msghdr msg;
+	int send_posted;
+};
+
+struct nvmf_options {
+	void *pad;
+	unsigned int port;
+	char *subnqn;
+	char *hostnqn;
+	unsigned int nsid;
+	unsigned int nr_queues;
+	unsigned int hdgst;
+	unsigned int ddgst;
+};
+
+struct nvmf_data {
+	struct nvmf_queue admin;
+	struct nvmf_queue *queues;
+	unsigned int nr_queues;
+
+	uint16_t cntlid;
+	uint8_t hostid[16];
+	char hostnqn[256];
+	uint64_t cap;
+	uint32_t icd;
+	uint64_t max_xfer;
+	struct nvme_data ns;
+	uint64_t nlba;
+
+	int ring_fd;
+	struct io_uring_sqe *sqes;
+	unsigned *sq_tail;
+	unsigned *sq_array;
+	unsigned sq_mask;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+	void *ring_ptr[3];
+	size_t ring_len[3];
+	unsigned int to_submit;
+
+	unsigned int queued;
+	struct io_u **events;
+	unsigned int nr_events;
+	unsigned int ev_returned;
+};
+
+static const uint8_t nvmf_zero_pad[128];
+
+static struct fio_option options[] = {
+	{
+		.name	= "nvmf_port",
+		.lname	= "NVMe/TCP target port",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct nvmf_options, port),
+		.def	= "4420",
+		.minval	= 1,
+		.maxval	= 65535,
+		.help	= "TCP port of the NVMe/TCP target",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_NVMETCP,
+	},
+	{
+		.name	= "nvmf_subnqn",
+		.lname	= "Subsystem NQN",
+		.type	= FIO_OPT_STR_STORE,
+		.off1	= offsetof(struct nvmf_options, subnqn),
+		.help	= "NQN of the subsystem to connect to",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_NVMETCP,
+	},
+	{
+		.name	= "nvmf_hostnqn",
+		.lname	= "Host NQN",
+		.type	= FIO_OPT_STR_STORE,
+		.off1	= offsetof(struct nvmf_options, hostnqn),
+		.help	= "Host NQN to connect with (default /etc/nvme/hostnqn)",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_NVMETCP,
+	},
+	{
+		.name	= "nvmf_nsid",
+		.lname	= "Namespace ID",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct nvmf_options, nsid),
+		.def	= "1",
+		.minval	= 1,
+		.help	= "Namespace to do I/O to",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_NVMETCP,
+	},
+	{
+		.name	= "nvmf_queues",
+		.lname	= "Number of I/O queues",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct nvmf_options, nr_queues),
+		.def	= "1",
+		.minval	= 1,
+		.maxval	= 128,
+		.help	= "I/O queues (TCP connections) to spread iodepth over",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_NVMETCP,
+	},
+	{
+		.name	= "nvmf_hdgst",
+		.lname	= "Header digest",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct nvmf_options, hdgst),
+		.def	= "0",
+		.help	= "Request CRC32C header digests",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_NVMETCP,
+	},
+	{
+		.name	= "nvmf_ddgst",
+		.lname	= "Data digest",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct nvmf_options, ddgst),
+		.def	= "0",
+		.help	= "Request CRC32C data digests",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_NVMETCP,
+	},
+	{
+		.name	= NULL,
+	},
+};
+
+/*
+ * NVMe/TCP digests are plain CRC32C, fio_crc32c() leaves out the final
+ * inversion.
+ */
+static inline uint32_t nvmf_digest(const void *buf, unsigned long len)
+{
+	return __cpu_to_le32(~fio_crc32c(buf, len));
+}
+
+/*
+ * Offset of the data in a PDU we send, the target asks for it to be
+ * aligned to its cpda.
+ */
+static inline unsigned int nvmf_pdo(struct nvmf_queue *q, unsigned int hlen)
+{
+	unsigned int off = hlen + (q->hdgst ? NVMF_TCP_DIGEST_LEN : 0);
+
+	return (off + q->pda - 1) / q->pda * q->pda;
+}
+
+static int nvmf_tx_add(struct nvmf_queue *q, const void *base, size_t len)
+{
+	if (!len)
+		return 0;
+
+	if (q->tx_nr == q->tx_max) {
+		unsigned int max = q->tx_max ? q->tx_max * 2 : 64;
+		struct iovec *iov;
+
+		iov = realloc(q->tx_iov, max * sizeof(*iov));
+		if (!iov)
+			return -ENOMEM;
+		q->tx_iov = iov;
+		q->tx_max = max;
+	}
+
+	q->tx_iov[q->tx_nr].iov_base = (void *) base;
+	q->tx_iov[q->tx_nr].iov_len = len;
+	q->tx_nr++;
+	return 0;
+}
+
+/*
+ * Queue the PDUs of a PDU header, its optional header digest and data
+ * with padding and data digest.
+ */
+static int nvmf_tx_pdu(struct nvmf_queue *q, struct nvmf_tcp_hdr *hdr,
+		       uint32_t *hdgst, void *data, uint32_t len,
+		       uint32_t *ddgst)
+{
+	unsigned int hd = q->hdgst ? NVMF_TCP_DIGEST_LEN : 0;
+	unsigned int pdo = len ? nvmf_pdo(q, hdr->hlen) : 0;
+	int ret;
+
+	if (q->hdgst)
+		hdr->flags |= NVMF_TCP_F_HDGST;
+	if (len && q->ddgst)
+		hdr->flags |= NVMF_TCP_F_DDGST;
+
+	hdr->pdo = pdo;
+	hdr->plen = __cpu_to_le32(len ? pdo + len +
+			(q->ddgst ? NVMF_TCP_DIGEST_LEN : 0) : hdr->hlen + hd);
+
+	ret = nvmf_tx_add(q, hdr, hdr->hlen);
+	if (!ret && q->hdgst) {
+		*hdgst = nvmf_digest(hdr, hdr->hlen);
+		ret = nvmf_tx_add(q, hdgst, NVMF_TCP_DIGEST_LEN);
+	}
+	if (!len || ret)
+		return ret;
+
+	ret = nvmf_tx_add(q, nvmf_zero_pad, pdo - hdr->hlen - hd);
+	if (!ret)
+		ret = nvmf_tx_add(q, data, len);
+	if (!ret && q->ddgst) {
+		*ddgst = nvmf_digest(data, len);
+		ret = nvmf_tx_add(q, ddgst, NVMF_TCP_DIGEST_LEN);
+	}
+	return ret;
+}
+
+/*
+ * Queue the capsule for a prepared command. Writes that fit carry their
+ * data in the capsule, everything else uses a transport SGL and the data
+ * moves in C2H data PDUs, or H2C data PDUs once the target sends an R2T.
+ */
+static int nvmf_queue_cmd(struct nvmf_queue *q, struct nvmf_req *req)
+{
+	struct nvmf_tcp_cmd *cmd = &req->cmd;
+	int icd = req->write && req->len <= q->icd;
+
+	memset(&cmd->hdr, 0, sizeof(cmd->hdr));
+	cmd->hdr.type = NVMF_TCP_CMD;
+	cmd->hdr.hlen = sizeof(*cmd);
+
+	cmd->sqe.cid = __cpu_to_le16(req - q->reqs);
+	cmd->sqe.flags |= NVME_CMD_SGL_METABUF;
+	memset(&cmd->sqe.sgl, 0, sizeof(cmd->sqe.sgl));
+	cmd->sqe.sgl.length = __cpu_to_le32(req->len);
+	cmd->sqe.sgl.type = icd ? NVME_SGL_ICD : NVME_SGL_TRANSPORT;
+
+	req->done = 0;
+	req->status = 0;
+	req->result = 0;
+	return nvmf_tx_pdu(q, &cmd->hdr, &req->hdgst, icd ? req->buf : NULL,
+				icd ? req->len : 0, &req->ddgst);
+}
+
+/*
+ * The target is ready for [off, off + len) of a write, send it in as many
+ * H2C data PDUs as its maxh2cdata needs.
+ */
+static int nvmf_queue_h2c(struct nvmf_queue *q, struct nvmf_req *req,
+			  uint16_t ttag, uint32_t off, uint32_t len)
+{
+	unsigned int i = 0;
+	int ret;
+
+	if (!req->write || (uint64_t) off + len > req->len ||
+	    (len + q->maxh2c - 1) / q->maxh2c > q->nr_h2c) {
+		log_err("fio: nvmetcp: bad R2T for command %u\n",
+			(unsigned int) (req - q->reqs));
+		return -EIO;
+	}
+
+	while (len) {
+		struct nvmf_h2c *h2c = &req->h2c[i++];
+		uint32_t this_len = min(len, q->maxh2c);
+
+		memset(&h2c->pdu, 0, sizeof(h2c->pdu));
+		h2c->pdu.hdr.type = NVMF_TCP_H2C_DATA;
+		h2c->pdu.hdr.hlen = sizeof(h2c->pdu);
+		if (this_len == len)
+			h2c->pdu.hdr.flags = NVMF_TCP_F_DATA_LAST;
+		h2c->pdu.cid = __cpu_to_le16(req - q->reqs);
+		h2c->pdu.ttag = ttag;
+		h2c->pdu.offset = __cpu_to_le32(off);
+		h2c->pdu.length = __cpu_to_le32(this_len);
+
+		ret = nvmf_tx_pdu(q, &h2c->pdu.hdr, &h2c->hdgst,
+					req->buf + off, this_len, &h2c->ddgst);
+		if (ret)
+			return ret;
+
+		off += this_len;
+		len -= this_len;
+	}
+
+	return 0;
+}
+
+static void nvmf_req_done(struct nvmf_data *nd, struct nvmf_queue *q,
+			  struct nvmf_req *req, uint16_t status)
+{
+	struct io_u *io_u = req->io_u;
+
+	req->status = status;
+	req->done = 1;
+	if (!io_u)
+		return;
+
+	if (status) {
+		io_u->error = EIO;
+		io_u->resid = io_u->xfer_buflen;
+	}
+	req->io_u = NULL;
+	q->free_reqs[q->nr_free++] = req - q->reqs;
+	nd->events[nd->nr_events++] = io_u;
+}
+
+static struct nvmf_req *nvmf_pdu_req(struct nvmf_queue *q, uint16_t cid)
+{
+	cid = __le16_to_cpu(cid);
+	if (cid >= q->depth || q->reqs[cid].done) {
+		log_err("fio: nvmetcp: PDU for unknown command %u\n", cid);
+		return NULL;
+	}
+
+	return &q->reqs[cid];
+}
+
+static int nvmf_handle_pdu(struct nvmf_data *nd, struct nvmf_queue *q,
+			   char *p)
+{
+	struct nvmf_tcp_hdr *hdr = (struct nvmf_tcp_hdr *) p;
+	struct nvmf_tcp_data *data;
+	struct nvmf_tcp_rsp *rsp;
+	struct nvmf_req *req;
+	uint32_t off, len;
+
+	if ((hdr->flags & NVMF_TCP_F_HDGST) &&
+	    nvmf_digest(p, hdr->hlen) != *(uint32_t *) (p + hdr->hlen)) {
+		log_err("fio: nvmetcp: header digest mismatch\n");
+		return -EIO;
+	}
+
+	switch (hdr->type) {
+	case NVMF_TCP_RSP:
+		rsp = (struct nvmf_tcp_rsp *) p;
+		req = nvmf_pdu_req(q, rsp->cqe.cid);
+		if (!req)
+			return -EIO;
+		req->result = __le32_to_cpu(rsp->cqe.dw0) |
+				((uint64_t) __le32_to_cpu(rsp->cqe.dw1) << 32);
+		nvmf_req_done(nd, q, req, __le16_to_cpu(rsp->cqe.status) >> 1);
+		return 0;
+	case NVMF_TCP_C2H_DATA:
+		data = (struct nvmf_tcp_data *) p;
+		req = nvmf_pdu_req(q, data->cid);
+		if (!req)
+			return -EIO;
+		off = __le32_to_cpu(data->offset);
+		len = __le32_to_cpu(data->length);
+		if (req->write || (uint64_t) off + len > req->len ||
+		    hdr->pdo + len > __le32_to_cpu(hdr->plen)) {
+			log_err("fio: nvmetcp: bad C2H data PDU\n");
+			return -EIO;
+		}
+		if ((hdr->flags & NVMF_TCP_F_DDGST) &&
+		    nvmf_digest(p + hdr->pdo, len) !=
+				*(uint32_t *) (p + hdr->pdo + len)) {
+			log_err("fio: nvmetcp: data digest mismatch\n");
+			return -EIO;
+		}
+		memcpy(req->buf + off, p + hdr->pdo, len);
+		/* the target may skip the response for successful reads */
+		if ((hdr->flags & NVMF_TCP_F_DATA_SUCCESS) &&
+		    (hdr->flags & NVMF_TCP_F_DATA_LAST))
+			nvmf_req_done(nd, q, req, 0);
+		return 0;
+	case NVMF_TCP_R2T:
+		data = (struct nvmf_tcp_data *) p;
+		req = nvmf_pdu_req(q, data->cid);
+		if (!req)
+			return -EIO;
+		return nvmf_queue_h2c(q, req, data->ttag,
+					__le32_to_cpu(data->offset),
+					__le32_to_cpu(data->length));
+	case NVMF_TCP_C2H_TERM:
+		log_err("fio: nvmetcp: target terminated the connection\n");
+		return -ECONNRESET;
+	default:
+		log_err("fio: nvmetcp: unexpected PDU type %u\n", hdr->type);
+		return -EIO;
+	}
+}
+
+/*
+ * Handle all complete PDUs in the receive buffer, and move a trailing
+ * partial one to the front.
+ */
+static int nvmf_rx_parse(struct nvmf_data *nd, struct nvmf_queue *q)
+{
+	size_t off = 0;
+	int ret = 0;
+
+	while (q->rx_len - off >= sizeof(struct nvmf_tcp_hdr)) {
+		struct nvmf_tcp_hdr *hdr = (void *) (q->rx_buf + off);
+		uint32_t plen = __le32_to_cpu(hdr->plen);
+
+		if (plen < sizeof(*hdr) || plen > q->rx_size ||
+		    hdr->hlen > plen) {
+			log_err("fio: nvmetcp: bad PDU length %u\n", plen);
+			return -EIO;
+		}
+		if (q->rx_len - off < plen)
+			break;
+
+		ret = nvmf_handle_pdu(nd, q, q->rx_buf + off);
+		if (ret)
+			return ret;
+		off += plen;
+	}
+
+	if (off) {
+		q->rx_len -= off;
+		memmove(q->rx_buf, q->rx_buf + off, q->rx_len);
+	}
+	return 0;
+}
+
+/*
+ * Blocking send of everything queued, used while setting up queues.
+ */
+static int nvmf_tx_sync(struct nvmf_queue *q)
+{
+	unsigned int i = 0;
+
+	while (i < q->tx_nr) {
+		ssize_t ret = writev(q->fd, &q->tx_iov[i],
+					min(q->tx_nr - i, (unsigned int) IOV_MAX));
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		while (ret && ret >= q->tx_iov[i].iov_len)
+			ret -= q->tx_iov[i++].iov_len;
+		if (ret) {
+			q->tx_iov[i].iov_base += ret;
+			q->tx_iov[i].iov_len -= ret;
+		}
+	}
+
+	q->tx_nr = 0;
+	return 0;
+}
+
+static int nvmf_wait_sync(struct nvmf_data *nd, struct nvmf_queue *q,
+			  struct nvmf_req *req)
+{
+	int ret;
+
+	while (!req->done) {
+		ret = nvmf_tx_sync(q);
+		if (ret)
+			return ret;
+
+		ret = recv(q->fd, q->rx_buf + q->rx_len, q->rx_size - q->rx_len,
+				0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		} else if (!ret)
+			return -ECONNRESET;
+
+		q->rx_len += ret;
+		ret = nvmf_rx_parse(nd, q);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Issue a command on a queue that isn't driven by the ring yet and wait
+ * for it to complete.
+ */
+static int nvmf_cmd_sync(struct nvmf_data *nd, struct nvmf_queue *q,
+			 struct nvmf_sqe *sqe, void *buf, uint32_t len,
+			 int write, uint64_t *result)
+{
+	struct nvmf_req *req = &q->reqs[0];
+	int ret;
+
+	req->cmd.sqe = *sqe;
+	req->io_u = NULL;
+	req->buf = buf;
+	req->len = len;
+	req->write = write;
+
+	ret = nvmf_queue_cmd(q, req);
+	if (!ret)
+		ret = nvmf_wait_sync(nd, q, req);
+	if (ret) {
+		log_err("fio: nvmetcp: queue %u: %s\n", q->qid, strerror(-ret));
+		return ret;
+	}
+
+	/* leave the slot looking done, so stray PDUs for it are caught */
+	if (req->status) {
+		log_err("fio: nvmetcp: command 0x%x on queue %u failed, "
+			"status 0x%x\n", sqe->opcode, q->qid, req->status);
+		return -EIO;
+	}
+	if (result)
+		*result = req->result;
+	return 0;
+}
+
+static int nvmf_prop_get(struct nvmf_data *nd, uint32_t reg, int is64,
+			 uint64_t *val)
+{
+	struct nvmf_sqe sqe = { .opcode = nvme_fabrics_command, };
+
+	/* fctype takes the place of the nsid, attrib and offset of cdw10/11 */
+	sqe.nsid = __cpu_to_le32(nvmf_fctype_prop_get);
+	sqe.cdw10 = __cpu_to_le32(is64 ? 1 : 0);
+	sqe.cdw11 = __cpu_to_le32(reg);
+	return nvmf_cmd_sync(nd, &nd->admin, &sqe, NULL, 0, 0, val);
+}
+
+static int nvmf_prop_set(struct nvmf_data *nd, uint32_t reg, uint32_t val)
+{
+	struct nvmf_sqe sqe = { .opcode = nvme_fabrics_command, };
+
+	sqe.nsid = __cpu_to_le32(nvmf_fctype_prop_set);
+	sqe.cdw11 = __cpu_to_le32(reg);
+	sqe.cdw12 = __cpu_to_le32(val);
+	return nvmf_cmd_sync(nd, &nd->admin, &sqe, NULL, 0, 0, NULL);
+}
+
+static int nvmf_identify(struct nvmf_data *nd, uint32_t nsid,
+			 enum nvme_identify_cns cns, void *buf)
+{
+	struct nvmf_sqe sqe = { .opcode = nvme_admin_identify, };
+
+	sqe.nsid = __cpu_to_le32(nsid);
+	sqe.cdw10 = __cpu_to_le32(cns);
+	return nvmf_cmd_sync(nd, &nd->admin, &sqe, buf,
+				NVME_IDENTIFY_DATA_SIZE, 0, NULL);
+}
+
+static void nvmf_queue_free(struct nvmf_queue *q)
+{
+	unsigned int i;
+
+	if (q->fd != -1)
+		close(q->fd);
+	q->fd = -1;
+
+	if (q->reqs) {
+		for (i = 0; i < q->depth; i++) {
+			free(q->reqs[i].h2c);
+			free(q->reqs[i].dsm);
+		}
+	}
+	free(q->reqs);
+	free(q->free_reqs);
+	free(q->rx_buf);
+	free(q->tx_iov);
+	free(q->tx_busy);
+	q->reqs = NULL;
+	q->free_reqs = NULL;
+	q->rx_buf = NULL;
+	q->tx_iov = NULL;
+	q->tx_busy = NULL;
+}
+
+static int nvmf_tcp_connect(struct thread_data *td, struct nvmf_queue *q)
+{
+	struct nvmf_options *o = td->eo;
+	struct addrinfo hints = {
+		.ai_family	= AF_UNSPEC,
+		.ai_socktype	= SOCK_STREAM,
+	};
+	struct addrinfo *res, *ai;
+	char port[16];
+	int ret, one = 1;
+
+	snprintf(port, sizeof(port), "%u", o->port);
+	ret = getaddrinfo(td->files[0]->file_name, port, &hints, &res);
+	if (ret) {
+		log_err("fio: nvmetcp: %s: %s\n", td->files[0]->file_name,
+			gai_strerror(ret));
+		return -EINVAL;
+	}
+
+	ret = -ECONNREFUSED;
+	for (ai = res; ai; ai = ai->ai_next) {
+		q->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (q->fd < 0)
+			continue;
+		if (!connect(q->fd, ai->ai_addr, ai->ai_addrlen)) {
+			ret = 0;
+			break;
+		}
+		ret = -errno;
+		close(q->fd);
+		q->fd = -1;
+	}
+	freeaddrinfo(res);
+
+	if (!ret)
+		setsockopt(q->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return ret;
+}
+
+/*
+ * Connect one queue: TCP connection, ICReq/ICResp exchange and the fabrics
+ * Connect command. The admin queue connects with cntlid 0xffff and learns
+ * the controller id the I/O queues then connect to.
+ */
+static int nvmf_queue_connect(struct thread_data *td, struct nvmf_data *nd,
+			      struct nvmf_queue *q, uint16_t qid,
+			      unsigned int depth, uint64_t max_len)
+{
+	struct nvmf_options *o = td->eo;
+	struct nvmf_tcp_icreq icreq = { };
+	struct nvmf_tcp_icresp icresp;
+	struct nvmf_connect_data cdata;
+	struct nvmf_sqe sqe = { .opcode = nvme_fabrics_command, };
+	uint64_t result;
+	size_t got = 0;
+	unsigned int i;
+	int ret;
+
+	q->qid = qid;
+	q->depth = depth;
+	ret = nvmf_tcp_connect(td, q);
+	if (ret) {
+		log_err("fio: nvmetcp: connect to %s:%u: %s\n",
+			td->files[0]->file_name, o->port, strerror(-ret));
+		return ret;
+	}
+
+	icreq.hdr.type = NVMF_TCP_ICREQ;
+	icreq.hdr.hlen = sizeof(icreq);
+	icreq.hdr.plen = __cpu_to_le32(sizeof(icreq));
+	icreq.digest = (o->hdgst ? 1 : 0) | (o->ddgst ? 2 : 0);
+	if (send(q->fd, &icreq, sizeof(icreq), MSG_NOSIGNAL) != sizeof(icreq))
+		return errno ? -errno : -EIO;
+
+	while (got < sizeof(icresp)) {
+		ret = recv(q->fd, (char *) &icresp + got, sizeof(icresp) - got, 0);
+		if (ret <= 0)
+			return ret ? -errno : -ECONNRESET;
+		got += ret;
+	}
+	if (icresp.hdr.type != NVMF_TCP_ICRESP || icresp.pfv) {
+		log_err("fio: nvmetcp: bad ICResp from target\n");
+		return -EIO;
+	}
+
+	q->hdgst = icresp.digest & 1;
+	q->ddgst = (icresp.digest >> 1) & 1;
+	q->pda = (icresp.cpda + 1) * 4;
+	q->maxh2c = __le32_to_cpu(icresp.maxdata);
+	if (q->maxh2c < 4096) {
+		log_err("fio: nvmetcp: bad maxh2cdata %u\n", q->maxh2c);
+		return -EIO;
+	}
+	if (o->hdgst != q->hdgst || o->ddgst != q->ddgst)
+		log_info("fio: nvmetcp: target set header digest %s, data "
+			 "digest %s\n", q->hdgst ? "on" : "off",
+			 q->ddgst ? "on" : "off");
+
+	q->nr_h2c = (max_len + q->maxh2c - 1) / q->maxh2c;
+	q->reqs = calloc(depth, sizeof(*q->reqs));
+	q->free_reqs = calloc(depth, sizeof(unsigned int));
+	if (!q->reqs || !q->free_reqs)
+		return -ENOMEM;
+	for (i = 0; i < depth; i++) {
+		q->reqs[i].done = 1;
+		q->reqs[i].h2c = calloc(q->nr_h2c, sizeof(struct nvmf_h2c));
+		q->reqs[i].dsm = calloc(td->o.num_range,
+					sizeof(struct nvme_dsm_range));
+		if (!q->reqs[i].h2c || !q->reqs[i].dsm)
+			return -ENOMEM;
+		q->free_reqs[i] = depth - i - 1;
+	}
+	q->nr_free = depth;
+
+	/* room for the largest C2H data PDU, plus some to batch receives */
+	q->rx_size = max_len + 256 + 64 * 1024;
+	q->rx_buf = malloc(q->rx_size);
+	if (!q->rx_buf)
+		return -ENOMEM;
+
+	memset(&cdata, 0, sizeof(cdata));
+	memcpy(cdata.hostid, nd->hostid, sizeof(cdata.hostid));
+	cdata.cntlid = __cpu_to_le16(qid ? nd->cntlid : 0xffff);
+	snprintf(cdata.subnqn, sizeof(cdata.subnqn), "%s", o->subnqn);
+	snprintf(cdata.hostnqn, sizeof(cdata.hostnqn), "%s", nd->hostnqn);
+
+	/* Connect always carries its data in the capsule */
+	q->icd = qid ? NVMF_CONNECT_DATA_LEN : NVMF_TCP_ADMIN_ICD;
+	sqe.nsid = __cpu_to_le32(nvmf_fctype_connect);
+	sqe.cdw10 = __cpu_to_le32((uint32_t) qid << 16);
+	/* zero based, one entry more than we ever have outstanding */
+	sqe.cdw11 = __cpu_to_le32(qid ? depth : NVME_AQ_DEPTH - 1);
+	ret = nvmf_cmd_sync(nd, q, &sqe, &cdata, sizeof(cdata), 1, &result);
+	if (ret)
+		return ret;
+
+	if (!qid)
+		nd->cntlid = result & 0xffff;
+	else
+		q->icd = nd->icd;
+	return 0;
+}
+
+static int nvmf_enable_ctrl(struct nvmf_data *nd)
+{
+	unsigned int timeout;
+	uint64_t csts;
+	int ret;
+
+	ret = nvmf_prop_get(nd, NVME_REG_CAP, 1, &nd->cap);
+	if (ret)
+		return ret;
+
+	ret = nvmf_prop_set(nd, NVME_REG_CC,
+			NVME_CC_IOSQES | NVME_CC_IOCQES | NVME_CC_ENABLE);
+	if (ret)
+		return ret;
+
+	/* CAP.TO is in units of 500 msec */
+	timeout = ((nd->cap >> 24) & 0xff) * 500 + 500;
+	do {
+		ret = nvmf_prop_get(nd, NVME_REG_CSTS, 0, &csts);
+		if (ret)
+			return ret;
+		if (csts & NVME_CSTS_CFS) {
+			log_err("fio: nvmetcp: controller fatal status\n");
+			return -EIO;
+		}
+		if (csts & NVME_CSTS_RDY)
+			return 0;
+		usleep(1000);
+	} while (--timeout);
+
+	log_err("fio: nvmetcp: timed out enabling controller\n");
+	return -ETIMEDOUT;
+}
+
+static int nvmf_identify_ns(struct thread_data *td, struct nvmf_data *nd)
+{
+	struct nvmf_options *o = td->eo;
+	struct nvme_id_ns *ns;
+	unsigned int mpsmin;
+	uint8_t *ctrl;
+	__u32 format_idx;
+	int ret;
+
+	ctrl = malloc(NVME_IDENTIFY_DATA_SIZE);
+	if (!ctrl)
+		return -ENOMEM;
+
+	ret = nvmf_identify(nd, 0, NVME_IDENTIFY_CNS_CTRL, ctrl);
+	if (ret)
+		goto out;
+
+	/* in-capsule data size, the first 64 bytes are the command */
+	nd->icd = le32_to_cpu(*(uint32_t *) (ctrl + NVME_ID_CTRL_IOCCSZ)) * 16;
+	nd->icd = nd->icd > 64 ? nd->icd - 64 : 0;
+	mpsmin = (nd->cap >> 48) & 0xf;
+	if (ctrl[NVME_ID_CTRL_MDTS])
+		nd->max_xfer = 1ULL << (12 + mpsmin + ctrl[NVME_ID_CTRL_MDTS]);
+	else
+		nd->max_xfer = -1ULL;
+
+	ns = (struct nvme_id_ns *) ctrl;
+	ret = nvmf_identify(nd, o->nsid, NVME_IDENTIFY_CNS_NS, ns);
+	if (ret)
+		goto out;
+
+	if (!ns->nsze) {
+		log_err("fio: nvmetcp: namespace %u isn't active\n", o->nsid);
+		ret = -ENODEV;
+		goto out;
+	}
+
+	format_idx = ns->flbas & 0x0f;
+	nd->ns.nsid = o->nsid;
+	nd->ns.lba_shift = ns->lbaf[format_idx].ds;
+	nd->ns.lba_size = 1 << nd->ns.lba_shift;
+	if (ns->lbaf[format_idx].ms) {
+		log_err("fio: nvmetcp: namespaces with metadata aren't "
+			"supported\n");
+		ret = -EINVAL;
+		goto out;
+	}
+	nd->nlba = __le64_to_cpu(ns->nsze);
+out:
+	free(ctrl);
+	return ret;
+}
+
+static void nvmf_set_hostnqn(struct thread_data *td, struct nvmf_data *nd)
+{
+	struct nvmf_options *o = td->eo;
+	unsigned int i;
+	FILE *fp;
+	int fd;
+
+	fd = open("/dev/urandom", O_RDONLY);
+	if (fd < 0 || read(fd, nd->hostid, sizeof(nd->hostid)) !=
+			sizeof(nd->hostid)) {
+		uint64_t seed = getpid() ^ (uint64_t) time(NULL) << 20;
+
+		memcpy(nd->hostid, &seed, sizeof(seed));
+	}
+	if (fd >= 0)
+		close(fd);
+	/* make it a version 4 UUID */
+	nd->hostid[6] = (nd->hostid[6] & 0x0f) | 0x40;
+	nd->hostid[8] = (nd->hostid[8] & 0x3f) | 0x80;
+
+	if (o->hostnqn) {
+		snprintf(nd->hostnqn, sizeof(nd->hostnqn), "%s", o->hostnqn);
+		return;
+	}
+
+	fp = fopen("/etc/nvme/hostnqn", "r");
+	if (fp) {
+		if (fgets(nd->hostnqn, sizeof(nd->hostnqn), fp)) {
+			nd->hostnqn[strcspn(nd->hostnqn, "\r\n")] = '\0';
+			fclose(fp);
+			if (nd->hostnqn[0])
+				return;
+		} else
+			fclose(fp);
+	}
+
+	snprintf(nd->hostnqn, sizeof(nd->hostnqn),
+			"nqn.2014-08.org.nvmexpress:uuid:");
+	for (i = 0; i < sizeof(nd->hostid); i++)
+		sprintf(nd->hostnqn + strlen(nd->hostnqn), "%s%02x",
+			(i == 4 || i == 6 || i == 8 || i == 10) ? "-" : "",
+			nd->hostid[i]);
+}
+
+static void nvmf_disconnect(struct nvmf_data *nd)
+{
+	unsigned int i;
+
+	for (i = 0; i < nd->nr_queues; i++)
+		nvmf_queue_free(&nd->queues[i]);
+	nvmf_queue_free(&nd->admin);
+	free(nd->queues);
+	nd->queues = NULL;
+}
+
+/*
+ * Bring up a controller association: admin queue, controller enable,
+ * identify, and then nr_io_queues I/O queues of depth each.
+ */
+static int nvmf_ctrl_connect(struct thread_data *td, struct nvmf_data *nd,
+			     unsigned int nr_io_queues, unsigned int depth)
+{
+	struct nvmf_options *o = td->eo;
+	unsigned int i, granted;
+	uint64_t result;
+	int ret;
+
+	if (!o->subnqn) {
+		log_err("fio: nvmetcp: nvmf_subnqn must be set\n");
+		return 1;
+	}
+	if (td->o.nr_files != 1) {
+		log_err("fio: nvmetcp: a job connects to a single target\n");
+		return 1;
+	}
+
+	nvmf_set_hostnqn(td, nd);
+	nd->admin.fd = -1;
+
+	ret = nvmf_queue_connect(td, nd, &nd->admin, 0, 1,
+					NVME_IDENTIFY_DATA_SIZE);
+	if (!ret)
+		ret = nvmf_enable_ctrl(nd);
+	if (!ret)
+		ret = nvmf_identify_ns(td, nd);
+	if (ret || !nr_io_queues)
+		return ret ? 1 : 0;
+
+	if (td_max_bs(td) > nd->max_xfer) {
+		log_err("fio: nvmetcp: block size above the target's limit "
+			"of %llu\n", (unsigned long long) nd->max_xfer);
+		return 1;
+	}
+
+	{
+		struct nvmf_sqe sqe = { .opcode = nvme_admin_set_features, };
+
+		sqe.cdw10 = __cpu_to_le32(NVME_FEAT_NUM_QUEUES);
+		sqe.cdw11 = __cpu_to_le32((nr_io_queues - 1) << 16 |
+						(nr_io_queues - 1));
+		ret = nvmf_cmd_sync(nd, &nd->admin, &sqe, NULL, 0, 0, &result);
+		if (ret)
+			return 1;
+	}
+	granted = min(result & 0xffff, (result >> 16) & 0xffff) + 1;
+	if (granted < nr_io_queues) {
+		log_info("fio: nvmetcp: target allows %u I/O queues\n",
+			 granted);
+		nr_io_queues = granted;
+		depth = (td->o.iodepth + nr_io_queues - 1) / nr_io_queues;
+	}
+
+	nd->queues = calloc(nr_io_queues, sizeof(struct nvmf_queue));
+	if (!nd->queues)
+		return 1;
+	for (i = 0; i < nr_io_queues; i++)
+		nd->queues[i].fd = -1;
+	nd->nr_queues = nr_io_queues;
+
+	for (i = 0; i < nr_io_queues; i++) {
+		ret = nvmf_queue_connect(td, nd, &nd->queues[i], i + 1, depth,
+						td_max_bs(td));
+		if (ret)
+			return 1;
+	}
+
+	return 0;
+}
+
+static int nvmf_ring_init(struct thread_data *td, struct nvmf_data *nd)
+{
+	struct io_uring_params p;
+	void *ptr;
+
+	memset(&p, 0, sizeof(p));
+	/* one send and one receive per connection at most */
+	nd->ring_fd = syscall(__NR_io_uring_setup, 2 * nd->nr_queues, &p);
+	if (nd->ring_fd < 0) {
+		td_verror(td, errno, "io_uring_setup");
+		return 1;
+	}
+
+	nd->ring_len[0] = p.sq_off.array + p.sq_entries * sizeof(__u32);
+	ptr = mmap(NULL, nd->ring_len[0], PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, nd->ring_fd,
+			IORING_OFF_SQ_RING);
+	if (ptr == MAP_FAILED)
+		goto err;
+	nd->ring_ptr[0] = ptr;
+	nd->sq_tail = ptr + p.sq_off.tail;
+	nd->sq_array = ptr + p.sq_off.array;
+	nd->sq_mask = *(unsigned *) (ptr + p.sq_off.ring_mask);
+
+	nd->ring_len[1] = p.sq_entries * sizeof(struct io_uring_sqe);
+	ptr = mmap(NULL, nd->ring_len[1], PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, nd->ring_fd,
+			IORING_OFF_SQES);
+	if (ptr == MAP_FAILED)
+		goto err;
+	nd->ring_ptr[1] = ptr;
+	nd->sqes = ptr;
+
+	nd->ring_len[2] = p.cq_off.cqes +
+				p.cq_entries * sizeof(struct io_uring_cqe);
+	ptr = mmap(NULL, nd->ring_len[2], PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, nd->ring_fd,
+			IORING_OFF_CQ_RING);
+	if (ptr == MAP_FAILED)
+		goto err;
+	nd->ring_ptr[2] = ptr;
+	nd->cq_head = ptr + p.cq_off.head;
+	nd->cq_tail = ptr + p.cq_off.tail;
+	nd->cq_mask = *(unsigned *) (ptr + p.cq_off.ring_mask);
+	nd->cqes = ptr + p.cq_off.cqes;
+	return 0;
+err:
+	td_verror(td, errno, "mmap io_uring");
+	return 1;
+}
+
+static struct io_uring_sqe *nvmf_get_sqe(struct nvmf_data *nd,
+					 unsigned int qi, int send)
+{
+	unsigned tail = *nd->sq_tail;
+	unsigned idx = tail & nd->sq_mask;
+	struct io_uring_sqe *sqe = &nd->sqes[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data = ((uint64_t) qi << 1) | send;
+	nd->sq_array[idx] = idx;
+	atomic_store_release(nd->sq_tail, tail + 1);
+	nd->to_submit++;
+	return sqe;
+}
+
+/*
+ * Post a send for whatever a connection has queued, and make sure it
+ * always has a receive posted.
+ */
+static void nvmf_post(struct nvmf_data *nd)
+{
+	unsigned int i;
+
+	for (i = 0; i < nd->nr_queues; i++) {
+		struct nvmf_queue *q = &nd->queues[i];
+		struct io_uring_sqe *sqe;
+
+		if (!q->send_posted && q->tx_nr) {
+			struct iovec *iov = q->tx_busy;
+			unsigned int max = q->tx_busy_max;
+
+			q->tx_busy = q->tx_iov;
+			q->tx_busy_max = q->tx_max;
+			q->tx_busy_nr = q->tx_nr;
+			q->tx_iov = iov;
+			q->tx_max = max;
+			q->tx_nr = 0;
+
+			memset(&q->msg, 0, sizeof(q->msg));
+			q->msg.msg_iov = q->tx_busy;
+			q->msg.msg_iovlen = min(q->tx_busy_nr,
+						(unsigned int) IOV_MAX);
+
+			sqe = nvmf_get_sqe(nd, i, 1);
+			sqe->opcode = IORING_OP_SENDMSG;
+			sqe->fd = q->fd;
+			sqe->addr = (unsigned long) &q->msg;
+			sqe->msg_flags = MSG_NOSIGNAL;
+			q->send_posted = 1;
+		}
+
+		if (!q->recv_posted) {
+			sqe = nvmf_get_sqe(nd, i, 0);
+			sqe->opcode = IORING_OP_RECV;
+			sqe->fd = q->fd;
+			sqe->addr = (unsigned long) (q->rx_buf + q->rx_len);
+			sqe->len = q->rx_size - q->rx_len;
+			q->recv_posted = 1;
+		}
+	}
+}
+
+/*
+ * A sendmsg completed, possibly short. Whatever it didn't get to goes back
+ * in front of the PDUs queued meanwhile.
+ */
+static int nvmf_send_done(struct nvmf_queue *q, int res)
+{
+	unsigned int i = 0, left;
+
+	q->send_posted = 0;
+	if (res < 0) {
+		if (res != -EINTR && res != -EAGAIN)
+			return res;
+		res = 0;
+	}
+
+	while (i < q->tx_busy_nr && res >= q->tx_busy[i].iov_len)
+		res -= q->tx_busy[i++].iov_len;
+	if (i == q->tx_busy_nr)
+		return 0;
+
+	q->tx_busy[i].iov_base += res;
+	q->tx_busy[i].iov_len -= res;
+	left = q->tx_busy_nr - i;
+
+	if (q->tx_nr + left > q->tx_max) {
+		struct iovec *iov;
+
+		iov = realloc(q->tx_iov, (q->tx_nr + left) * sizeof(*iov));
+		if (!iov)
+			return -ENOMEM;
+		q->tx_iov = iov;
+		q->tx_max = q->tx_nr + left;
+	}
+	memmove(q->tx_iov + left, q->tx_iov, q->tx_nr * sizeof(struct iovec));
+	memcpy(q->tx_iov, q->tx_busy + i, left * sizeof(struct iovec));
+	q->tx_nr += left;
+	return 0;
+}
+
+static int nvmf_reap(struct thread_data *td, struct nvmf_data *nd)
+{
+	unsigned head = *nd->cq_head;
+	int ret = 0;
+
+	while (!ret && head != atomic_load_acquire(nd->cq_tail)) {
+		struct io_uring_cqe *cqe = &nd->cqes[head & nd->cq_mask];
+		struct nvmf_queue *q = &nd->queues[cqe->user_data >> 1];
+
+		if (cqe->user_data & 1) {
+			ret = nvmf_send_done(q, cqe->res);
+		} else {
+			q->recv_posted = 0;
+			if (cqe->res > 0) {
+				q->rx_len += cqe->res;
+				ret = nvmf_rx_parse(nd, q);
+			} else if (!cqe->res)
+				ret = -ECONNRESET;
+			else if (cqe->res != -EINTR && cqe->res != -EAGAIN)
+				ret = cqe->res;
+		}
+		head++;
+	}
+
+	atomic_store_release(nd->cq_head, head);
+	if (ret)
+		td_verror(td, -ret, "nvmetcp");
+	return ret;
+}
+
+static int nvmf_enter(struct thread_data *td, struct nvmf_data *nd,
+		      unsigned int min_complete)
+{
+	int ret;
+
+	ret = syscall(__NR_io_uring_enter, nd->ring_fd, nd->to_submit,
+			min_complete, min_complete ? IORING_ENTER_GETEVENTS : 0,
+			NULL, 0);
+	if (ret < 0) {
+		if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+			return 0;
+		td_verror(td, errno, "io_uring_enter");
+		return -1;
+	}
+
+	nd->to_submit -= ret;
+	return 0;
+}
+
+static void nvmf_dsm_range(struct nvme_dsm_range *dsm, struct nvmf_data *nd,
+			   uint64_t start, uint64_t len)
+{
+	dsm->cattr = 0;
+	dsm->nlb = __cpu_to_le32(len >> nd->ns.lba_shift);
+	dsm->slba = __cpu_to_le64(start >> nd->ns.lba_shift);
+}
+
+static enum fio_q_status fio_nvmf_queue(struct thread_data *td,
+					struct io_u *io_u)
+{
+	struct nvmf_data *nd = td->io_ops_data;
+	struct nvme_uring_cmd ucmd;
+	struct nvmf_queue *q = NULL;
+	struct nvmf_req *req;
+	struct nvmf_sqe *sqe;
+	unsigned int i;
+	int ret;
+
+	fio_ro_check(td, io_u);
+
+	/* least busy connection that has a free command slot */
+	for (i = 0; i < nd->nr_queues; i++)
+		if (nd->queues[i].nr_free &&
+		    (!q || nd->queues[i].nr_free > q->nr_free))
+			q = &nd->queues[i];
+	if (!q)
+		return FIO_Q_BUSY;
+
+	req = &q->reqs[q->free_reqs[q->nr_free - 1]];
+	sqe = &req->cmd.sqe;
+	memset(sqe, 0, sizeof(*sqe));
+	req->buf = io_u->xfer_buf;
+	req->len = io_u->xfer_buflen;
+	req->write = io_u->ddir == DDIR_WRITE;
+
+	if (io_u->ddir == DDIR_TRIM) {
+		unsigned int nr = 1;
+
+		if (io_u->nr_trim_ranges) {
+			nr = io_u->nr_trim_ranges;
+			for (i = 0; i < nr; i++)
+				nvmf_dsm_range(&req->dsm[i], nd,
+						io_u->trim_ranges[i].start,
+						io_u->trim_ranges[i].len);
+		} else
+			nvmf_dsm_range(&req->dsm[0], nd, io_u->offset,
+					io_u->xfer_buflen);
+		req->buf = req->dsm;
+		req->len = nr * sizeof(struct nvme_dsm_range);
+		req->write = 1;
+		sqe->opcode = nvme_cmd_dsm;
+		sqe->nsid = __cpu_to_le32(nd->ns.nsid);
+		sqe->cdw10 = __cpu_to_le32(nr - 1);
+		sqe->cdw11 = __cpu_to_le32(NVME_ATTRIBUTE_DEALLOCATE);
+	} else if (ddir_rw(io_u->ddir)) {
+		ret = fio_nvme_uring_cmd_prep(&ucmd, io_u, NULL, NULL, NULL);
+		if (ret) {
+			io_u->error = -ret;
+			return FIO_Q_COMPLETED;
+		}
+		sqe->opcode = ucmd.opcode;
+		sqe->nsid = __cpu_to_le32(ucmd.nsid);
+		sqe->cdw10 = __cpu_to_le32(ucmd.cdw10);
+		sqe->cdw11 = __cpu_to_le32(ucmd.cdw11);
+		sqe->cdw12 = __cpu_to_le32(ucmd.cdw12);
+		sqe->cdw13 = __cpu_to_le32(ucmd.cdw13);
+	} else {
+		req->buf = NULL;
+		req->len = 0;
+		req->write = 0;
+		sqe->opcode = nvme_cmd_flush;
+		sqe->nsid = __cpu_to_le32(nd->ns.nsid);
+	}
+
+	req->io_u = io_u;
+	ret = nvmf_queue_cmd(q, req);
+	if (ret) {
+		req->io_u = NULL;
+		io_u->error = -ret;
+		return FIO_Q_COMPLETED;
+	}
+
+	q->nr_free--;
+	nd->queued++;
+	return FIO_Q_QUEUED;
+}
+
+static int fio_nvmf_commit(struct thread_data *td)
+{
+	struct nvmf_data *nd = td->io_ops_data;
+
+	if (!nd->queued)
+		return 0;
+
+	io_u_mark_submit(td, nd->queued);
+	nd->queued = 0;
+
+	nvmf_post(nd);
+	return nvmf_enter(td, nd, 0);
+}
+
+static int fio_nvmf_getevents(struct thread_data *td, unsigned int min,
+			      unsigned int max, const struct timespec *t)
+{
+	struct nvmf_data *nd = td->io_ops_data;
+
+	/* drop the events handed out last time, keep any extra ones */
+	nd->nr_events -= nd->ev_returned;
+	memmove(nd->events, nd->events + nd->ev_returned,
+		nd->nr_events * sizeof(struct io_u *));
+	nd->ev_returned = 0;
+
+	do {
+		if (nvmf_reap(td, nd))
+			return -1;
+		if (nd->nr_events >= min || td->terminate)
+			break;
+
+		nvmf_post(nd);
+		if (nvmf_enter(td, nd, 1))
+			return -1;
+	} while (1);
+
+	nd->ev_returned = min(nd->nr_events, max);
+	return nd->ev_returned;
+}
+
+static struct io_u *fio_nvmf_event(struct thread_data *td, int event)
+{
+	struct nvmf_data *nd = td->io_ops_data;
+
+	return nd->events[event];
+}
+
+static int fio_nvmf_init(struct thread_data *td)
+{
+	struct nvmf_options *o = td->eo;
+	struct nvmf_data *nd;
+	unsigned int nr_queues, depth;
+
+	nd = calloc(1, sizeof(*nd));
+	if (!nd) {
+		td_verror(td, errno, "calloc");
+		return 1;
+	}
+	nd->ring_fd = -1;
+	td->io_ops_data = nd;
+
+	nd->events = calloc(td->o.iodepth, sizeof(struct io_u *));
+	if (!nd->events)
+		return 1;
+
+	nr_queues = min(o->nr_queues, td->o.iodepth);
+	depth = (td->o.iodepth + nr_queues - 1) / nr_queues;
+	if (nvmf_ctrl_connect(td, nd, nr_queues, depth))
+		return 1;
+
+	if (nvmf_ring_init(td, nd))
+		return 1;
+
+	log_info("fio: nvmetcp: connected to %s, controller %u, %u I/O "
+		 "queue(s)\n", o->subnqn, nd->cntlid, nd->nr_queues);
+	return 0;
+}
+
+static void fio_nvmf_cleanup(struct thread_data *td)
+{
+	struct nvmf_data *nd = td->io_ops_data;
+	struct fio_file *f;
+	unsigned int j;
+	int i;
+
+	for_each_file(td, f, j) {
+		free(FILE_ENG_DATA(f));
+		FILE_SET_ENG_DATA(f, NULL);
+	}
+
+	if (!nd)
+		return;
+
+	nvmf_disconnect(nd);
+	for (i = 0; i < 3; i++)
+		if (nd->ring_ptr[i])
+			munmap(nd->ring_ptr[i], nd->ring_len[i]);
+	if (nd->ring_fd != -1)
+		close(nd->ring_fd);
+	free(nd->events);
+	free(nd);
+}
+
+/*
+ * The size comes from a short lived association of its own, as this runs
+ * before the job's ->init() when files are set up up front.
+ */
+static int fio_nvmf_get_file_size(struct thread_data *td, struct fio_file *f)
+{
+	struct nvmf_data nd = { };
+	struct nvme_data *data;
+	int ret;
+
+	if (FILE_ENG_DATA(f))
+		return 0;
+
+	ret = nvmf_ctrl_connect(td, &nd, 0, 0);
+	nvmf_disconnect(&nd);
+	if (ret)
+		return 1;
+
+	data = malloc(sizeof(*data));
+	if (!data)
+		return 1;
+	*data = nd.ns;
+	FILE_SET_ENG_DATA(f, data);
+
+	f->real_file_size = nd.nlba << data->lba_shift;
+	fio_file_set_size_known(f);
+	return 0;
+}
+
+static int fio_nvmf_open_file(struct thread_data *td, struct fio_file *f)
+{
+	return 0;
+}
+
+static int fio_nvmf_close_file(struct thread_data *td, struct fio_file *f)
+{
+	return 0;
+}
+
+static struct ioengine_ops ioengine = {
+	.name			= "nvmetcp",
+	.version		= FIO_IOOPS_VERSION,
+	.flags			= FIO_DISKLESSIO | FIO_NOEXTEND |
+					FIO_MULTI_RANGE_TRIM,
+	.init			= fio_nvmf_init,
+	.cleanup		= fio_nvmf_cleanup,
+	.queue			= fio_nvmf_queue,
+	.commit			= fio_nvmf_commit,
+	.getevents		= fio_nvmf_getevents,
+	.event			= fio_nvmf_event,
+	.open_file		= fio_nvmf_open_file,
+	.close_file		= fio_nvmf_close_file,
+	.get_file_size		= fio_nvmf_get_file_size,
+	.options		= options,
+	.option_struct_size	= sizeof(struct nvmf_options),
+};
+
+static void fio_init fio_nvmf_register(void)
+{
+	register_ioengine(&ioengine);
+}
+
+static void fio_exit fio_nvmf_unregister(void)
+{
+	unregister_ioengine(&ioengine);
+}
@@ -9,12 +9,42 @@
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#ifdef CONFIG_POSIXAIO_KQUEUE
+#include <sys/types.h>
+#include <sys/event.h>
+#endif
 
 #include "../fio.h"
 
+/*
+ * io_us are queued on 'pending' by ->queue and submitted with lio_listio()
+ * by ->commit, up to listio_max at a time. Without kqueue, submitted io_us
+ * are kept on the compact 'inflight' array, so a reap only looks at IO
+ * that is actually outstanding. With kqueue (FreeBSD), each aiocb posts an
+ * EVFILT_AIO event when done, so a reap only sees IO that has completed.
+ * io_us that lio_listio() refused with an error go on 'failed', to be
+ * completed by the next reap.
+ */
 struct posixaio_data {
 	struct io_u **aio_events;
 	unsigned int queued;
+
+	struct io_u **pending;
+	os_aiocb_t **listio;
+	unsigned int nr_pending;
+	unsigned int listio_max;
+
+	struct io_u **inflight;
+	os_aiocb_t **suspend_list;
+	unsigned int nr_inflight;
+
+	struct io_u **failed;
+	unsigned int nr_failed;
+
+#ifdef CONFIG_POSIXAIO_KQUEUE
+	int kq;
+	struct kevent *kevents;
+#endif
 };
 
 static unsigned long long ts_utime_since_now(const struct timespec *start)
@@ -39,8 +69,7 @@ static int fio_posixaio_cancel(struct thread_data fio_unused *td,
 	return 1;
 }
 
-static int fio_posixaio_prep(struct thread_data fio_unused *td,
-			     struct io_u *io_u)
+static int fio_posixaio_prep(struct thread_data *td, struct io_u *io_u)
 {
 	os_aiocb_t *aiocb = &io_u->aiocb;
 	struct fio_file *f = io_u->file;
@@ -49,140 +78,347 @@ static int fio_posixaio_prep(struct thread_data fio_unused *td,
 	aiocb->aio_buf = io_u->xfer_buf;
 	aiocb->aio_nbytes = io_u->xfer_buflen;
 	aiocb->aio_offset = io_u->offset;
+
+	if (io_u->ddir == DDIR_READ)
+		aiocb->aio_lio_opcode = LIO_READ;
+	else if (io_u->ddir == DDIR_WRITE)
+		aiocb->aio_lio_opcode = LIO_WRITE;
+	else
+		aiocb->aio_lio_opcode = LIO_NOP;
+
+#ifdef CONFIG_POSIXAIO_KQUEUE
+	{
+		struct posixaio_data *pd = td->io_ops_data;
+
+		aiocb->aio_sigevent.sigev_notify = SIGEV_KEVENT;
+		aiocb->aio_sigevent.sigev_notify_kqueue = pd->kq;
+		aiocb->aio_sigevent.sigev_value.sival_ptr = io_u;
+	}
+#else
 	aiocb->aio_sigevent.sigev_notify = SIGEV_NONE;
+#endif
 
 	io_u->seen = 0;
 	return 0;
 }
 
+/*
+ * Fill in the result of a finished aiocb, err being its aio_error()
+ */
+static void posixaio_complete(struct posixaio_data *pd, struct io_u *io_u,
+			      int err, unsigned int *r)
+{
+	io_u->seen = 1;
+	pd->queued--;
+	pd->aio_events[(*r)++] = io_u;
+
+	if (err == ECANCELED)
+		io_u->resid = io_u->xfer_buflen;
+	else if (!err) {
+		ssize_t retval = aio_return(&io_u->aiocb);
+
+		io_u->resid = io_u->xfer_buflen - retval;
+	} else
+		io_u->error = err;
+}
+
+#ifdef CONFIG_POSIXAIO_KQUEUE
+static int posixaio_reap(struct thread_data *td, unsigned int min,
+			 unsigned int max, const struct timespec *t,
+			 unsigned int *r)
+{
+	struct posixaio_data *pd = td->io_ops_data;
+	struct timespec zero = { 0, 0 };
+	int i, ret;
+
+	ret = kevent(pd->kq, NULL, 0, pd->kevents, max - *r,
+		     *r >= min ? &zero : t);
+	if (ret < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	for (i = 0; i < ret; i++) {
+		struct io_u *io_u = pd->kevents[i].udata;
+
+		/*
+		 * An io_u refused by lio_listio() but already completed may
+		 * still post its event after being reaped from 'failed'
+		 */
+		if (io_u->seen)
+			continue;
+
+		pd->nr_inflight--;
+		posixaio_complete(pd, io_u, aio_error(&io_u->aiocb), r);
+	}
+
+	return 0;
+}
+#else
+/* waiting on more than a few makes aio_suspend() itself expensive */
 #define SUSPEND_ENTRIES	8
 
+static int posixaio_reap(struct thread_data *td, unsigned int min,
+			 unsigned int max, const struct timespec *t,
+			 unsigned int *r)
+{
+	struct posixaio_data *pd = td->io_ops_data;
+	unsigned int i = 0, n;
+
+	while (i < pd->nr_inflight && *r < max) {
+		struct io_u *io_u = pd->inflight[i];
+		int err = aio_error(&io_u->aiocb);
+
+		if (err == EINPROGRESS) {
+			i++;
+			continue;
+		}
+
+		pd->inflight[i] = pd->inflight[--pd->nr_inflight];
+		posixaio_complete(pd, io_u, err, r);
+	}
+
+	if (*r >= min || !pd->nr_inflight)
+		return 0;
+
+	/*
+	 * must have some in-flight, wait for at least one
+	 */
+	n = min(pd->nr_inflight, (unsigned int) SUSPEND_ENTRIES);
+	for (i = 0; i < n; i++)
+		pd->suspend_list[i] = &pd->inflight[i]->aiocb;
+	aio_suspend((const os_aiocb_t * const *)pd->suspend_list, n, t);
+	return 0;
+}
+#endif
+
+static int fio_posixaio_commit(struct thread_data *td);
+
 static int fio_posixaio_getevents(struct thread_data *td, unsigned int min,
 				  unsigned int max, const struct timespec *t)
 {
 	struct posixaio_data *pd = td->io_ops_data;
-	os_aiocb_t *suspend_list[SUSPEND_ENTRIES];
 	struct timespec start;
 	int have_timeout = 0;
-	int suspend_entries;
-	struct io_u *io_u;
-	unsigned int r;
-	int i;
+	unsigned int r = 0;
+	int ret;
 
 	if (t && fio_get_mono_time(&start) == 0)
 		have_timeout = 1;
 	else
 		memset(&start, 0, sizeof(start));
 
-	r = 0;
-restart:
-	memset(suspend_list, 0, sizeof(suspend_list));
-	suspend_entries = 0;
-	io_u_qiter(&td->io_u_all, io_u, i) {
-		int err;
+	do {
+		while (pd->nr_failed && r < max) {
+			pd->queued--;
+			pd->aio_events[r++] = pd->failed[--pd->nr_failed];
+		}
 
-		if (io_u->seen || !(io_u->flags & IO_U_F_FLIGHT))
-			continue;
+		/* retry what lio_listio() had no room for */
+		if (pd->nr_pending && r < min) {
+			ret = fio_posixaio_commit(td);
+			if (ret)
+				return ret;
+		}
 
-		err = aio_error(&io_u->aiocb);
-		if (err == EINPROGRESS) {
-			if (suspend_entries < SUSPEND_ENTRIES) {
-				suspend_list[suspend_entries] = &io_u->aiocb;
-				suspend_entries++;
-			}
-			continue;
+		ret = posixaio_reap(td, min, max, t, &r);
+		if (ret)
+			return ret;
+		if (r >= min)
+			break;
+
+		if (have_timeout) {
+			unsigned long long usec;
+
+			usec = (t->tv_sec * 1000000) + (t->tv_nsec / 1000);
+			if (ts_utime_since_now(&start) > usec)
+				break;
 		}
+	} while (1);
 
-		io_u->seen = 1;
-		pd->queued--;
-		pd->aio_events[r++] = io_u;
+	return r;
+}
 
-		if (err == ECANCELED)
-			io_u->resid = io_u->xfer_buflen;
-		else if (!err) {
-			ssize_t retval = aio_return(&io_u->aiocb);
+static struct io_u *fio_posixaio_event(struct thread_data *td, int event)
+{
+	struct posixaio_data *pd = td->io_ops_data;
 
-			io_u->resid = io_u->xfer_buflen - retval;
-		} else
-			io_u->error = err;
+	return pd->aio_events[event];
+}
+
+static void posixaio_submitted(struct thread_data *td, struct io_u *io_u)
+{
+	struct posixaio_data *pd = td->io_ops_data;
+
+#ifndef CONFIG_POSIXAIO_KQUEUE
+	pd->inflight[pd->nr_inflight] = io_u;
+#endif
+	pd->nr_inflight++;
+
+	if (fio_fill_issue_time(td)) {
+		fio_gettime(&io_u->issue_time, NULL);
+		io_u_queued(td, io_u);
+
+		/*
+		 * only used for iolog
+		 */
+		if (td->o.read_iolog_file)
+			memcpy(&td->last_issue, &io_u->issue_time,
+					sizeof(io_u->issue_time));
 	}
+}
 
-	if (r >= min)
-		return r;
+/*
+ * Submit one lio_listio() batch off the head of the pending list, return
+ * how many of the batch were taken off it. If lio_listio() fails, the
+ * entries still have to be sorted out one by one: EINPROGRESS was
+ * submitted, EAGAIN found no room and stays pending, anything else was
+ * refused (or submitted and done already, which looks the same) and is
+ * completed by the next reap.
+ */
+static unsigned int posixaio_submit_batch(struct thread_data *td,
+					  unsigned int nr, int *error)
+{
+	struct posixaio_data *pd = td->io_ops_data;
+	unsigned int i, kept = 0;
 
-	if (have_timeout) {
-		unsigned long long usec;
+	for (i = 0; i < nr; i++)
+		pd->listio[i] = &pd->pending[i]->aiocb;
 
-		usec = (t->tv_sec * 1000000) + (t->tv_nsec / 1000);
-		if (ts_utime_since_now(&start) > usec)
-			return r;
+	if (!lio_listio(LIO_NOWAIT, pd->listio, nr, NULL)) {
+		for (i = 0; i < nr; i++)
+			posixaio_submitted(td, pd->pending[i]);
+		goto done;
 	}
 
-	/*
-	 * must have some in-flight, wait for at least one
-	 */
-	aio_suspend((const os_aiocb_t * const *)suspend_list,
-							suspend_entries, t);
-	goto restart;
+	if (errno != EAGAIN && errno != EIO && errno != EINTR) {
+		*error = errno;
+		return 0;
+	}
+
+	for (i = 0; i < nr; i++) {
+		struct io_u *io_u = pd->pending[i];
+		int err = aio_error(&io_u->aiocb);
+
+		if (err == EINPROGRESS)
+			posixaio_submitted(td, io_u);
+		else if (err == EAGAIN || err < 0)
+			pd->pending[kept++] = io_u;
+		else {
+			if (!err) {
+				ssize_t retval = aio_return(&io_u->aiocb);
+
+				io_u->resid = io_u->xfer_buflen - retval;
+			} else {
+				io_u->resid = io_u->xfer_buflen;
+				io_u->error = err;
+			}
+			io_u->seen = 1;
+			pd->failed[pd->nr_failed++] = io_u;
+		}
+	}
+
+done:
+	memmove(pd->pending + kept, pd->pending + nr,
+		(pd->nr_pending - nr) * sizeof(struct io_u *));
+	pd->nr_pending -= nr - kept;
+	return nr - kept;
 }
 
-static struct io_u *fio_posixaio_event(struct thread_data *td, int event)
+static int fio_posixaio_commit(struct thread_data *td)
 {
 	struct posixaio_data *pd = td->io_ops_data;
+	struct timespec ts;
+	int wait_start = 0;
+
+	while (pd->nr_pending) {
+		unsigned int nr = min(pd->nr_pending, pd->listio_max);
+		int error = 0;
+
+		nr = posixaio_submit_batch(td, nr, &error);
+		if (error)
+			return -error;
+		if (nr) {
+			io_u_mark_submit(td, nr);
+			wait_start = 0;
+			continue;
+		}
 
-	return pd->aio_events[event];
+		/*
+		 * Out of AIO resources. Like libaio, let the upper layer reap
+		 * if anything is in flight, otherwise wait for a bit. At least
+		 * OSX has a very low limit on the number of pending IOs.
+		 */
+		if (pd->nr_inflight || pd->nr_failed)
+			break;
+		if (!wait_start) {
+			fio_gettime(&ts, NULL);
+			wait_start = 1;
+		} else if (mtime_since_now(&ts) > 30000) {
+			log_err("fio: aio appears to be stalled, giving up\n");
+			return -EAGAIN;
+		}
+		usleep(1);
+	}
+
+	return 0;
 }
 
 static enum fio_q_status fio_posixaio_queue(struct thread_data *td,
 					    struct io_u *io_u)
 {
 	struct posixaio_data *pd = td->io_ops_data;
-	os_aiocb_t *aiocb = &io_u->aiocb;
-	int ret;
 
 	fio_ro_check(td, io_u);
 
-	if (io_u->ddir == DDIR_READ)
-		ret = aio_read(aiocb);
-	else if (io_u->ddir == DDIR_WRITE)
-		ret = aio_write(aiocb);
-	else if (io_u->ddir == DDIR_TRIM) {
+	if (io_u->ddir == DDIR_READ || io_u->ddir == DDIR_WRITE) {
+		pd->pending[pd->nr_pending++] = io_u;
+		pd->queued++;
+		return FIO_Q_QUEUED;
+	}
+
+	/*
+	 * Only reads and writes can be batched. Anything else has to wait
+	 * for the batch ahead of it to be submitted at least.
+	 */
+	if (pd->nr_pending)
+		return FIO_Q_BUSY;
+
+	if (io_u->ddir == DDIR_TRIM) {
 		if (pd->queued)
 			return FIO_Q_BUSY;
 
 		do_io_u_trim(td, io_u);
+		io_u_mark_submit(td, 1);
+		io_u_mark_complete(td, 1);
 		return FIO_Q_COMPLETED;
 	} else {
 #ifdef CONFIG_POSIXAIO_FSYNC
-		ret = aio_fsync(O_SYNC, aiocb);
+		if (aio_fsync(O_SYNC, &io_u->aiocb)) {
+			int aio_err = errno;
+
+			if (aio_err == EAGAIN)
+				return FIO_Q_BUSY;
+
+			io_u->error = aio_err;
+			td_verror(td, io_u->error, "xfer");
+			io_u_mark_submit(td, 1);
+			io_u_mark_complete(td, 1);
+			return FIO_Q_COMPLETED;
+		}
+
+		posixaio_submitted(td, io_u);
+		io_u_mark_submit(td, 1);
+		pd->queued++;
+		return FIO_Q_QUEUED;
 #else
 		if (pd->queued)
 			return FIO_Q_BUSY;
 
 		do_io_u_sync(td, io_u);
+		io_u_mark_submit(td, 1);
+		io_u_mark_complete(td, 1);
 		return FIO_Q_COMPLETED;
 #endif
 	}
-
-	if (ret) {
-		int aio_err = errno;
-
-		/*
-		 * At least OSX has a very low limit on the number of pending
-		 * IOs, so if it returns EAGAIN, we are out of resources
-		 * to queue more. Just return FIO_Q_BUSY to naturally
-		 * drop off at this depth.
-		 */
-		if (aio_err == EAGAIN)
-			return FIO_Q_BUSY;
-
-		io_u->error = aio_err;
-		td_verror(td, io_u->error, "xfer");
-		return FIO_Q_COMPLETED;
-	}
-
-	pd->queued++;
-	return FIO_Q_QUEUED;
 }
 
 static void fio_posixaio_cleanup(struct thread_data *td)
@@ -190,6 +426,16 @@ static void fio_posixaio_cleanup(struct thread_data *td)
 	struct posixaio_data *pd = td->io_ops_data;
 
 	if (pd) {
+#ifdef CONFIG_POSIXAIO_KQUEUE
+		if (pd->kq != -1)
+			close(pd->kq);
+		free(pd->kevents);
+#endif
+		free(pd->failed);
+		free(pd->suspend_list);
+		free(pd->inflight);
+		free(pd->listio);
+		free(pd->pending);
 		free(pd->aio_events);
 		free(pd);
 	}
@@ -197,23 +443,60 @@ static void fio_posixaio_cleanup(struct thread_data *td)
 
 static int fio_posixaio_init(struct thread_data *td)
 {
-	struct posixaio_data *pd = malloc(sizeof(*pd));
-
-	memset(pd, 0, sizeof(*pd));
-	pd->aio_events = malloc(td->o.iodepth * sizeof(struct io_u *));
-	memset(pd->aio_events, 0, td->o.iodepth * sizeof(struct io_u *));
+	unsigned int depth = td->o.iodepth;
+	struct posixaio_data *pd;
+	long listio_max = -1;
 
+	pd = calloc(1, sizeof(*pd));
+	if (!pd)
+		return 1;
 	td->io_ops_data = pd;
+
+#ifdef _SC_AIO_LISTIO_MAX
+	listio_max = sysconf(_SC_AIO_LISTIO_MAX);
+#endif
+	if (listio_max <= 0 || listio_max > depth)
+		listio_max = depth;
+	pd->listio_max = listio_max;
+
+	pd->aio_events = calloc(depth, sizeof(struct io_u *));
+	pd->pending = calloc(depth, sizeof(struct io_u *));
+	pd->listio = calloc(depth, sizeof(os_aiocb_t *));
+	pd->inflight = calloc(depth, sizeof(struct io_u *));
+	pd->suspend_list = calloc(depth, sizeof(os_aiocb_t *));
+	pd->failed = calloc(depth, sizeof(struct io_u *));
+#ifdef CONFIG_POSIXAIO_KQUEUE
+	pd->kevents = calloc(depth, sizeof(struct kevent));
+	pd->kq = kqueue();
+	if (pd->kq == -1) {
+		td_verror(td, errno, "kqueue");
+		return 1;
+	}
+#endif
+	if (!pd->aio_events || !pd->pending || !pd->listio ||
+	    !pd->inflight || !pd->suspend_list || !pd->failed) {
+		td_verror(td, ENOMEM, "posixaio init");
+		return 1;
+	}
+#ifdef CONFIG_POSIXAIO_KQUEUE
+	if (!pd->kevents) {
+		td_verror(td, ENOMEM, "posixaio init");
+		return 1;
+	}
+#endif
+
 	return 0;
 }
 
 static struct ioengine_ops ioengine = {
 	.name		= "posixaio",
 	.version	= FIO_IOOPS_VERSION,
-	.flags		= FIO_ASYNCIO_SYNC_TRIM,
+	.flags		= FIO_ASYNCIO_SYNC_TRIM | FIO_ASYNCIO_SETS_ISSUE_TIME |
+			  FIO_MULTI_RANGE_TRIM | FIO_TRIM_MODES,
 	.init		= fio_posixaio_init,
 	.prep		= fio_posixaio_prep,
 	.queue		= fio_posixaio_queue,
+	.commit		= fio_posixaio_commit,
 	.cancel		= fio_posixaio_cancel,
 	.getevents	= fio_posixaio_getevents,
 	.event		= fio_posixaio_event,
@@ -21,6 +21,9 @@ struct rados_data {
 	struct flist_head completed_operations;
 	uint64_t ops_scheduled;
 	uint64_t ops_completed;
+	/* io_us waiting for commit() with batch_ops */
+	struct io_u **pending;
+	unsigned int nr_pending;
 };
 
 struct fio_rados_iou {
@@ -29,6 +32,16 @@ struct fio_rados_iou {
 	struct io_u *io_u;
 	rados_completion_t completion;
 	rados_write_op_t write_op;
+	rados_read_op_t read_op;
+	/*
+	 * With batch_ops, the first io_u of a batched op owns the completion
+	 * and the op, and the others hang off it through 'next'.
+	 */
+	struct fio_rados_iou *next;
+	bool batched;
+	size_t bytes_read;
+	int prval;
+	int ret;
 };
 
 /* fio configuration options read from the job file */
@@ -40,6 +53,8 @@ struct rados_options {
 	char *conf;
 	int busy_poll;
 	int touch_objects;
+	unsigned long long object_size;
+	int batch_ops;
 };
 
 static struct fio_option options[] = {
@@ -100,6 +115,26 @@ static struct fio_option options[] = {
 		.category = FIO_OPT_C_ENGINE,
 		.group    = FIO_OPT_G_RBD,
 	},
+	{
+		.name     = "object_size",
+		.lname    = "rados object size",
+		.type     = FIO_OPT_STR_VAL,
+		.help     = "Stripe each file over objects of this size (0 = one object per file)",
+		.off1     = offsetof(struct rados_options, object_size),
+		.def	  = "0",
+		.category = FIO_OPT_C_ENGINE,
+		.group    = FIO_OPT_G_RBD,
+	},
+	{
+		.name     = "batch_ops",
+		.lname    = "batch object ops",
+		.type     = FIO_OPT_BOOL,
+		.help     = "Combine queued extents on the same object into one op",
+		.off1     = offsetof(struct rados_options, batch_ops),
+		.def	  = "0",
+		.category = FIO_OPT_C_ENGINE,
+		.group    = FIO_OPT_G_RBD,
+	},
 	{
 		.name     = NULL,
 	},
@@ -122,6 +157,9 @@ static int _fio_setup_rados_data(struct thread_data *td,
 	rados->aio_events = calloc(td->o.iodepth, sizeof(struct io_u *));
 	if (!rados->aio_events)
 		goto failed;
+	rados->pending = calloc(td->o.iodepth, sizeof(struct io_u *));
+	if (!rados->pending)
+		goto failed;
 	pthread_mutex_init(&rados->completed_lock, NULL);
 	pthread_cond_init(&rados->completed_more_io, NULL);
 	INIT_FLIST_HEAD(&rados->completed_operations);
@@ -139,12 +177,51 @@ failed:
 	return 1;
 }
 
+/*
+ * With object_size set, file offset 'off' lives in object
+ * "<file_name>.<off / object_size>" at offset 'off % object_size'. Without
+ * it, the whole file is a single object named after the file.
+ */
+static void _fio_rados_obj_name(struct rados_options *o, struct fio_file *f,
+				uint64_t off, char *name, size_t len)
+{
+	if (!o->object_size)
+		snprintf(name, len, "%s", f->file_name);
+	else
+		snprintf(name, len, "%s.%016llx", f->file_name,
+			 (unsigned long long) (off / o->object_size));
+}
+
+static uint64_t _fio_rados_obj_off(struct rados_options *o, uint64_t off)
+{
+	return o->object_size ? off % o->object_size : off;
+}
+
+static uint64_t _fio_rados_nr_objs(struct rados_options *o, struct fio_file *f)
+{
+	if (!o->object_size)
+		return 1;
+
+	return (f->real_file_size + o->object_size - 1) / o->object_size;
+}
+
+#define RADOS_OBJ_NAME_LEN	(PATH_MAX + 18)
+
 static void _fio_rados_rm_objects(struct thread_data *td, struct rados_data *rados)
 {
+	struct rados_options *o = td->eo;
+	char name[RADOS_OBJ_NAME_LEN];
 	size_t i;
+	uint64_t j;
+
 	for (i = 0; i < td->o.nr_files; i++) {
 		struct fio_file *f = td->files[i];
-		rados_remove(rados->io_ctx, f->file_name);
+
+		for (j = 0; j < _fio_rados_nr_objs(o, f); j++) {
+			_fio_rados_obj_name(o, f, j * o->object_size, name,
+					    sizeof(name));
+			rados_remove(rados->io_ctx, name);
+		}
 	}
 }
 
@@ -155,8 +232,10 @@ static int _fio_rados_connect(struct thread_data *td)
 	int r;
 	const uint64_t file_size =
 		td->o.size / (td->o.nr_files ? td->o.nr_files : 1u);
+	char name[RADOS_OBJ_NAME_LEN];
 	struct fio_file *f;
 	uint32_t i;
+	uint64_t j;
 
 	if (o->cluster_name) {
 		char *client_name = NULL;
@@ -216,8 +295,12 @@ static int _fio_rados_connect(struct thread_data *td)
 	for (i = 0; i < td->o.nr_files; i++) {
 		f = td->files[i];
 		f->real_file_size = file_size;
-		if (o->touch_objects) {
-			r = rados_write(rados->io_ctx, f->file_name, "", 0, 0);
+		if (!o->touch_objects)
+			continue;
+		for (j = 0; j < _fio_rados_nr_objs(o, f); j++) {
+			_fio_rados_obj_name(o, f, j * o->object_size, name,
+					    sizeof(name));
+			r = rados_write(rados->io_ctx, name, "", 0, 0);
 			if (r < 0) {
 				goto failed_obj_create;
 			}
@@ -263,6 +346,7 @@ static void fio_rados_cleanup(struct thread_data *td)
 		_fio_rados_rm_objects(td, rados);
 		_fio_rados_disconnect(rados);
 		free(rados->aio_events);
+		free(rados->pending);
 		free(rados);
 	}
 }
@@ -271,25 +355,198 @@ static void complete_callback(rados_completion_t cb, void *arg)
 {
 	struct fio_rados_iou *fri = (struct fio_rados_iou *)arg;
 	struct rados_data *rados = fri->td->io_ops_data;
+	int ret;
+
 	assert(fri->completion);
 	assert(rados_aio_is_complete(fri->completion));
+	ret = rados_aio_get_return_value(cb);
 	pthread_mutex_lock(&rados->completed_lock);
-	flist_add_tail(&fri->list, &rados->completed_operations);
-	rados->ops_completed++;
+	/* a batched op completes all of its io_us at once */
+	for (; fri; fri = fri->next) {
+		fri->ret = ret;
+		flist_add_tail(&fri->list, &rados->completed_operations);
+		rados->ops_completed++;
+	}
 	pthread_mutex_unlock(&rados->completed_lock);
 	pthread_cond_signal(&rados->completed_more_io);
 }
 
+/*
+ * Stripe mode only maps whole io_us onto objects, they can't straddle two.
+ */
+static int _fio_rados_check_extent(struct rados_options *o, struct io_u *io_u)
+{
+	if (!o->object_size)
+		return 0;
+	if (io_u->offset / o->object_size ==
+	    (io_u->offset + io_u->xfer_buflen - 1) / o->object_size)
+		return 0;
+
+	log_err("rados: io_u at %llu len %llu crosses an object boundary\n",
+		io_u->offset, io_u->xfer_buflen);
+	return -EINVAL;
+}
+
+static bool _fio_rados_same_op(struct rados_options *o, struct io_u *a,
+			       struct io_u *b)
+{
+	if (a->file != b->file)
+		return false;
+	if ((a->ddir == DDIR_READ) != (b->ddir == DDIR_READ))
+		return false;
+	if (!o->object_size)
+		return true;
+
+	return a->offset / o->object_size == b->offset / o->object_size;
+}
+
+/*
+ * Build and issue one op for the leader and every pending io_u that targets
+ * the same object with the same direction class. Writes and trims share a
+ * write op, reads get a read op with one extent per io_u.
+ */
+static int _fio_rados_issue_batch(struct thread_data *td, unsigned int first)
+{
+	struct rados_data *rados = td->io_ops_data;
+	struct rados_options *o = td->eo;
+	struct io_u *leader = rados->pending[first];
+	struct fio_rados_iou *fri = leader->engine_data, *tail = fri;
+	char name[RADOS_OBJ_NAME_LEN];
+	unsigned int i, nr = 0;
+	int r;
+
+	fri->next = NULL;
+	r = rados_aio_create_completion(fri, complete_callback, NULL,
+					&fri->completion);
+	if (r < 0) {
+		log_err("rados_aio_create_completion failed.\n");
+		return r;
+	}
+
+	if (leader->ddir == DDIR_READ) {
+		fri->read_op = rados_create_read_op();
+		if (fri->read_op == NULL) {
+			log_err("rados_create_read_op failed.\n");
+			r = -ENOMEM;
+			goto failed_comp;
+		}
+	} else {
+		fri->write_op = rados_create_write_op();
+		if (fri->write_op == NULL) {
+			log_err("rados_create_write_op failed.\n");
+			r = -ENOMEM;
+			goto failed_comp;
+		}
+	}
+
+	for (i = first; i < rados->nr_pending; i++) {
+		struct io_u *io_u = rados->pending[i];
+		struct fio_rados_iou *cur;
+		uint64_t off;
+
+		if (!io_u || !_fio_rados_same_op(o, leader, io_u))
+			continue;
+
+		cur = io_u->engine_data;
+		cur->batched = true;
+		off = _fio_rados_obj_off(o, io_u->offset);
+		if (cur != fri) {
+			cur->next = NULL;
+			tail->next = cur;
+			tail = cur;
+		}
+
+		if (io_u->ddir == DDIR_READ)
+			rados_read_op_read(fri->read_op, off, io_u->xfer_buflen,
+					   io_u->xfer_buf, &cur->bytes_read,
+					   &cur->prval);
+		else if (io_u->ddir == DDIR_WRITE)
+			rados_write_op_write(fri->write_op, io_u->xfer_buf,
+					     io_u->xfer_buflen, off);
+		else
+			rados_write_op_zero(fri->write_op, off,
+					    io_u->xfer_buflen);
+
+		rados->pending[i] = NULL;
+		nr++;
+	}
+
+	_fio_rados_obj_name(o, leader->file, leader->offset, name, sizeof(name));
+	if (leader->ddir == DDIR_READ)
+		r = rados_aio_read_op_operate(fri->read_op, rados->io_ctx,
+					      fri->completion, name, 0);
+	else
+		r = rados_aio_write_op_operate(fri->write_op, rados->io_ctx,
+					       fri->completion, name, NULL, 0);
+	if (r < 0) {
+		log_err("rados_aio_%s_op_operate failed.\n",
+			leader->ddir == DDIR_READ ? "read" : "write");
+		goto failed_op;
+	}
+
+	rados->ops_scheduled += nr;
+	io_u_mark_submit(td, nr);
+	return 0;
+
+failed_op:
+	if (fri->read_op) {
+		rados_release_read_op(fri->read_op);
+		fri->read_op = NULL;
+	}
+	if (fri->write_op) {
+		rados_release_write_op(fri->write_op);
+		fri->write_op = NULL;
+	}
+failed_comp:
+	rados_aio_release(fri->completion);
+	fri->completion = NULL;
+	return r;
+}
+
+static int fio_rados_commit(struct thread_data *td)
+{
+	struct rados_data *rados = td->io_ops_data;
+	unsigned int i;
+	int r = 0;
+
+	for (i = 0; i < rados->nr_pending; i++) {
+		if (!rados->pending[i])
+			continue;
+		r = _fio_rados_issue_batch(td, i);
+		if (r < 0) {
+			td_verror(td, -r, "commit");
+			break;
+		}
+	}
+
+	rados->nr_pending = 0;
+	return r;
+}
+
 static enum fio_q_status fio_rados_queue(struct thread_data *td,
 					 struct io_u *io_u)
 {
 	struct rados_data *rados = td->io_ops_data;
+	struct rados_options *o = td->eo;
 	struct fio_rados_iou *fri = io_u->engine_data;
-	char *object = io_u->file->file_name;
+	char object[RADOS_OBJ_NAME_LEN];
+	uint64_t offset;
 	int r = -1;
 
 	fio_ro_check(td, io_u);
 
+	r = _fio_rados_check_extent(o, io_u);
+	if (r < 0)
+		goto failed;
+
+	if (o->batch_ops && ddir_rw(io_u->ddir)) {
+		rados->pending[rados->nr_pending++] = io_u;
+		return FIO_Q_QUEUED;
+	}
+
+	_fio_rados_obj_name(o, io_u->file, io_u->offset, object, sizeof(object));
+	offset = _fio_rados_obj_off(o, io_u->offset);
+
 	if (io_u->ddir == DDIR_WRITE) {
 		 r = rados_aio_create_completion(fri, complete_callback,
 			NULL, &fri->completion);
@@ -299,12 +556,13 @@ static enum fio_q_status fio_rados_queue(struct thread_data *td,
 		}
 
 		r = rados_aio_write(rados->io_ctx, object, fri->completion,
-			io_u->xfer_buf, io_u->xfer_buflen, io_u->offset);
+			io_u->xfer_buf, io_u->xfer_buflen, offset);
 		if (r < 0) {
 			log_err("rados_write failed.\n");
 			goto failed_comp;
 		}
 		rados->ops_scheduled++;
+		io_u_mark_submit(td, 1);
 		return FIO_Q_QUEUED;
 	} else if (io_u->ddir == DDIR_READ) {
 		r = rados_aio_create_completion(fri, complete_callback,
@@ -314,12 +572,13 @@ static enum fio_q_status fio_rados_queue(struct thread_data *td,
 			goto failed;
 		}
 		r = rados_aio_read(rados->io_ctx, object, fri->completion,
-			io_u->xfer_buf, io_u->xfer_buflen, io_u->offset);
+			io_u->xfer_buf, io_u->xfer_buflen, offset);
 		if (r < 0) {
 			log_err("rados_aio_read failed.\n");
 			goto failed_comp;
 		}
 		rados->ops_scheduled++;
+		io_u_mark_submit(td, 1);
 		return FIO_Q_QUEUED;
 	} else if (io_u->ddir == DDIR_TRIM) {
 		r = rados_aio_create_completion(fri, complete_callback,
@@ -333,7 +592,7 @@ static enum fio_q_status fio_rados_queue(struct thread_data *td,
 			log_err("rados_create_write_op failed.\n");
 			goto failed_comp;
 		}
-		rados_write_op_zero(fri->write_op, io_u->offset,
+		rados_write_op_zero(fri->write_op, offset,
 			io_u->xfer_buflen);
 		r = rados_aio_write_op_operate(fri->write_op, rados->io_ctx,
 			fri->completion, object, NULL, 0);
@@ -342,6 +601,7 @@ static enum fio_q_status fio_rados_queue(struct thread_data *td,
 			goto failed_write_op;
 		}
 		rados->ops_scheduled++;
+		io_u_mark_submit(td, 1);
 		return FIO_Q_QUEUED;
 	 }
 
@@ -354,6 +614,8 @@ failed_comp:
 failed:
 	io_u->error = -r;
 	td_verror(td, io_u->error, "xfer");
+	io_u_mark_submit(td, 1);
+	io_u_mark_complete(td, 1);
 	return FIO_Q_COMPLETED;
 }
 
@@ -367,32 +629,55 @@ int fio_rados_getevents(struct thread_data *td, unsigned int min,
 	unsigned int max, const struct timespec *t)
 {
 	struct rados_data *rados = td->io_ops_data;
-	unsigned int events = 0;
+	unsigned int i, events = 0;
 	struct fio_rados_iou *fri;
 
+	/*
+	 * Grab as many completions as we can under the lock, the completions
+	 * and ops are released after dropping it.
+	 */
 	pthread_mutex_lock(&rados->completed_lock);
-	while (events < min) {
+	while (events < min || (events < max &&
+				!flist_empty(&rados->completed_operations))) {
 		while (flist_empty(&rados->completed_operations)) {
 			pthread_cond_wait(&rados->completed_more_io, &rados->completed_lock);
 		}
 		assert(!flist_empty(&rados->completed_operations));
-		
+
 		fri = flist_first_entry(&rados->completed_operations, struct fio_rados_iou, list);
-		assert(fri->completion);
-		assert(rados_aio_is_complete(fri->completion));
+		flist_del(&fri->list);
+		rados->aio_events[events] = fri->io_u;
+		events ++;
+	}
+	pthread_mutex_unlock(&rados->completed_lock);
+
+	for (i = 0; i < events; i++) {
+		struct io_u *io_u = rados->aio_events[i];
+
+		fri = io_u->engine_data;
+		if (fri->ret < 0)
+			io_u->error = -fri->ret;
+		else if (fri->batched && io_u->ddir == DDIR_READ) {
+			if (fri->prval < 0)
+				io_u->error = -fri->prval;
+			else
+				io_u->resid = io_u->xfer_buflen - fri->bytes_read;
+		}
+		fri->batched = false;
+		if (fri->read_op != NULL) {
+			rados_release_read_op(fri->read_op);
+			fri->read_op = NULL;
+		}
 		if (fri->write_op != NULL) {
 			rados_release_write_op(fri->write_op);
 			fri->write_op = NULL;
 		}
-		rados_aio_release(fri->completion);
-		fri->completion = NULL;
-
-		rados->aio_events[events] = fri->io_u;
-		events ++;
-		flist_del(&fri->list);
-		if (events >= max) break;
+		if (fri->completion) {
+			assert(rados_aio_is_complete(fri->completion));
+			rados_aio_release(fri->completion);
+			fri->completion = NULL;
+		}
 	}
-	pthread_mutex_unlock(&rados->completed_lock);
 	return events;
 }
 
@@ -452,18 +737,18 @@ static void fio_rados_io_u_free(struct thread_data *td, struct io_u *io_u)
 			rados_aio_release(fri->completion);
 		if (fri->write_op)
 			rados_release_write_op(fri->write_op);
-		free(fri);
+		if (fri->read_op)
+			rados_release_read_op(fri->read_op);
 	}
 }
 
 static int fio_rados_io_u_init(struct thread_data *td, struct io_u *io_u)
 {
-	struct fio_rados_iou *fri;
-	fri = calloc(1, sizeof(*fri));
+	struct fio_rados_iou *fri = io_u->engine_data;
+
 	fri->io_u = io_u;
 	fri->td = td;
 	INIT_FLIST_HEAD(&fri->list);
-	io_u->engine_data = fri;
 	return 0;
 }
 
@@ -474,6 +759,7 @@ FIO_STATIC struct ioengine_ops ioengine = {
 	.flags			= FIO_DISKLESSIO,
 	.setup			= fio_rados_setup,
 	.queue			= fio_rados_queue,
+	.commit			= fio_rados_commit,
 	.getevents		= fio_rados_getevents,
 	.event			= fio_rados_event,
 	.cleanup		= fio_rados_cleanup,
@@ -483,6 +769,7 @@ FIO_STATIC struct ioengine_ops ioengine = {
 	.io_u_init		= fio_rados_io_u_init,
 	.io_u_free		= fio_rados_io_u_free,
 	.option_struct_size	= sizeof(struct rados_options),
+	.io_u_priv_size		= sizeof(struct fio_rados_iou),
 };
 
 static void fio_init fio_rados_register(void)
@@ -6,6 +6,7 @@
  */
 
 #include <rbd/librbd.h>
+#include <pthread.h>
 
 #include "../fio.h"
 #include "../optgroup.h"
@@ -23,14 +24,32 @@ struct fio_rbd_iou {
 	int io_complete;
 };
 
+/*
+ * A cluster connection and image handle shared by all jobs with
+ * share_image set that open the same image
+ */
+struct rbd_shared {
+	struct flist_head list;
+	char *cluster_name;
+	char *client_name;
+	char *pool_name;
+	char *rbd_name;
+	rados_t cluster;
+	rados_ioctx_t io_ctx;
+	rbd_image_t image;
+	int refcount;
+};
+
 struct rbd_data {
 	rados_t cluster;
 	rados_ioctx_t io_ctx;
 	rbd_image_t image;
 	struct io_u **aio_events;
 	struct io_u **sort_events;
+	rbd_completion_t *comps;
 	int fd; /* add for poll */
 	bool connected;
+	struct rbd_shared *shared;
 };
 
 struct rbd_options {
@@ -40,8 +59,12 @@ struct rbd_options {
 	char *pool_name;
 	char *client_name;
 	int busy_poll;
+	int share_image;
 };
 
+static pthread_mutex_t rbd_shared_lock = PTHREAD_MUTEX_INITIALIZER;
+static FLIST_HEAD(rbd_shared_list);
+
 static struct fio_option options[] = {
         {
 		.name		= "clustername",
@@ -89,6 +112,16 @@ static struct fio_option options[] = {
 		.category	= FIO_OPT_C_ENGINE,
 		.group		= FIO_OPT_G_RBD,
 	},
+	{
+		.name		= "share_image",
+		.lname		= "Share image",
+		.type		= FIO_OPT_BOOL,
+		.help		= "Share the cluster connection and image handle between jobs",
+		.off1		= offsetof(struct rbd_options, share_image),
+		.def		= "0",
+		.category	= FIO_OPT_C_ENGINE,
+		.group		= FIO_OPT_G_RBD,
+	},
 	{
 		.name = NULL,
 	},
@@ -119,6 +152,10 @@ static int _fio_setup_rbd_data(struct thread_data *td,
 	if (!rbd->sort_events)
 		goto failed;
 
+	rbd->comps = calloc(td->o.iodepth, sizeof(rbd_completion_t));
+	if (!rbd->comps)
+		goto failed;
+
 	*rbd_data_ptr = rbd;
 	return 0;
 
@@ -139,8 +176,11 @@ static bool _fio_rbd_setup_poll(struct rbd_data *rbd)
 {
 	int r;
 
-	/* add for rbd poll */
-	rbd->fd = eventfd(0, EFD_SEMAPHORE);
+	/*
+	 * add for rbd poll. Not a semaphore, one read clears whatever
+	 * count has built up and rbd_poll_io_events() fetches all of it.
+	 */
+	rbd->fd = eventfd(0, EFD_NONBLOCK);
 	if (rbd->fd < 0) {
 		log_err("eventfd failed.\n");
 		return false;
@@ -163,9 +203,8 @@ static bool _fio_rbd_setup_poll(struct rbd_data *rbd)
 }
 #endif
 
-static int _fio_rbd_connect(struct thread_data *td)
+static int _fio_rbd_open_image(struct thread_data *td, struct rbd_data *rbd)
 {
-	struct rbd_data *rbd = td->io_ops_data;
 	struct rbd_options *o = td->eo;
 	int r;
 
@@ -251,14 +290,8 @@ static int _fio_rbd_connect(struct thread_data *td)
 		}
 	}
 
-	if (!_fio_rbd_setup_poll(rbd))
-		goto failed_poll;
-
 	return 0;
 
-failed_poll:
-	rbd_close(rbd->image);
-	rbd->image = NULL;
 failed_open:
 	rados_ioctx_destroy(rbd->io_ctx);
 	rbd->io_ctx = NULL;
@@ -269,18 +302,8 @@ failed_early:
 	return 1;
 }
 
-static void _fio_rbd_disconnect(struct rbd_data *rbd)
+static void _fio_rbd_close_image(struct rbd_data *rbd)
 {
-	if (!rbd)
-		return;
-
-	/* close eventfd */
-	if (rbd->fd != -1) {
-		close(rbd->fd);
-		rbd->fd = -1;
-	}
-
-	/* shutdown everything */
 	if (rbd->image) {
 		rbd_close(rbd->image);
 		rbd->image = NULL;
@@ -297,6 +320,143 @@ static void _fio_rbd_disconnect(struct rbd_data *rbd)
 	}
 }
 
+static bool rbd_str_eq(const char *a, const char *b)
+{
+	if (!a || !b)
+		return a == b;
+
+	return !strcmp(a, b);
+}
+
+static char *rbd_strdup(const char *s)
+{
+	return s ? strdup(s) : NULL;
+}
+
+/*
+ * Attach to the shared handles of this image, opening it if no other
+ * job has yet.
+ */
+static int _fio_rbd_get_shared(struct thread_data *td, struct rbd_data *rbd)
+{
+	struct rbd_options *o = td->eo;
+	struct rbd_shared *sh = NULL;
+	struct flist_head *entry;
+	int r = 0;
+
+	pthread_mutex_lock(&rbd_shared_lock);
+
+	flist_for_each(entry, &rbd_shared_list) {
+		struct rbd_shared *tmp;
+
+		tmp = flist_entry(entry, struct rbd_shared, list);
+		if (rbd_str_eq(o->cluster_name, tmp->cluster_name) &&
+		    rbd_str_eq(o->client_name, tmp->client_name) &&
+		    rbd_str_eq(o->pool_name, tmp->pool_name) &&
+		    rbd_str_eq(o->rbd_name, tmp->rbd_name)) {
+			sh = tmp;
+			break;
+		}
+	}
+
+	if (sh) {
+		sh->refcount++;
+	} else {
+		r = _fio_rbd_open_image(td, rbd);
+		if (r)
+			goto out;
+
+		sh = calloc(1, sizeof(*sh));
+		if (!sh) {
+			_fio_rbd_close_image(rbd);
+			r = 1;
+			goto out;
+		}
+		sh->cluster_name = rbd_strdup(o->cluster_name);
+		sh->client_name = rbd_strdup(o->client_name);
+		sh->pool_name = rbd_strdup(o->pool_name);
+		sh->rbd_name = rbd_strdup(o->rbd_name);
+		sh->cluster = rbd->cluster;
+		sh->io_ctx = rbd->io_ctx;
+		sh->image = rbd->image;
+		sh->refcount = 1;
+		flist_add_tail(&sh->list, &rbd_shared_list);
+	}
+
+	rbd->cluster = sh->cluster;
+	rbd->io_ctx = sh->io_ctx;
+	rbd->image = sh->image;
+	rbd->shared = sh;
+out:
+	pthread_mutex_unlock(&rbd_shared_lock);
+	return r;
+}
+
+static void _fio_rbd_put_shared(struct rbd_data *rbd)
+{
+	struct rbd_shared *sh = rbd->shared;
+
+	pthread_mutex_lock(&rbd_shared_lock);
+
+	if (!--sh->refcount) {
+		flist_del(&sh->list);
+		_fio_rbd_close_image(rbd);
+		free(sh->cluster_name);
+		free(sh->client_name);
+		free(sh->pool_name);
+		free(sh->rbd_name);
+		free(sh);
+	}
+
+	rbd->image = NULL;
+	rbd->io_ctx = NULL;
+	rbd->cluster = NULL;
+	rbd->shared = NULL;
+
+	pthread_mutex_unlock(&rbd_shared_lock);
+}
+
+static int _fio_rbd_connect(struct thread_data *td)
+{
+	struct rbd_data *rbd = td->io_ops_data;
+	struct rbd_options *o = td->eo;
+
+	/*
+	 * The image eventfd would see the completions of every job, so
+	 * shared images reap through the completion callbacks instead.
+	 */
+	if (o->share_image)
+		return _fio_rbd_get_shared(td, rbd);
+
+	if (_fio_rbd_open_image(td, rbd))
+		return 1;
+
+	if (!_fio_rbd_setup_poll(rbd)) {
+		_fio_rbd_close_image(rbd);
+		return 1;
+	}
+
+	return 0;
+}
+
+static void _fio_rbd_disconnect(struct rbd_data *rbd)
+{
+	if (!rbd)
+		return;
+
+	/* close eventfd */
+	if (rbd->fd != -1) {
+		close(rbd->fd);
+		rbd->fd = -1;
+	}
+
+	/* shutdown everything */
+	if (rbd->shared)
+		_fio_rbd_put_shared(rbd);
+	else
+		_fio_rbd_close_image(rbd);
+}
+
 static void _fio_rbd_finish_aiocb(rbd_completion_t comp, void *data)
 {
 	struct fio_rbd_iou *fri = data;
@@ -342,14 +502,12 @@ static inline int fri_check_complete(struct rbd_data *rbd, struct io_u *io_u,
 	return 0;
 }
 
-#ifndef CONFIG_RBD_POLL
 static inline int rbd_io_u_seen(struct io_u *io_u)
 {
 	struct fio_rbd_iou *fri = io_u->engine_data;
 
 	return fri->io_seen;
 }
-#endif
 
 static void rbd_io_u_wait_complete(struct io_u *io_u)
 {
@@ -375,49 +533,66 @@ static int rbd_io_u_cmp(const void *p1, const void *p2)
 		return 1;
 }
 
-static int rbd_iter_events(struct thread_data *td, unsigned int *events,
-			   unsigned int min_evts, int wait)
+#ifdef CONFIG_RBD_POLL
+/*
+ * Reap up to max_evts completions from the image's event queue, sleeping
+ * on the eventfd first if asked to.
+ */
+static int rbd_iter_events_poll(struct thread_data *td, unsigned int *events,
+				unsigned int max_evts, int wait)
 {
 	struct rbd_data *rbd = td->io_ops_data;
-	unsigned int this_events = 0;
-	struct io_u *io_u;
-	int i, sidx = 0;
-
-#ifdef CONFIG_RBD_POLL
-	int ret = 0;
-	int event_num = 0;
-	struct fio_rbd_iou *fri = NULL;
-	rbd_completion_t comps[min_evts];
+	struct fio_rbd_iou *fri;
 	uint64_t counter;
 	bool completed;
+	int i, event_num;
 
-	struct pollfd pfd;
-	pfd.fd = rbd->fd;
-	pfd.events = POLLIN;
+	if (wait) {
+		struct pollfd pfd;
+		int ret;
 
-	ret = poll(&pfd, 1, wait ? -1 : 0);
-	if (ret <= 0)
-		return 0;
-	if (!(pfd.revents & POLLIN))
-		return 0;
-
-	event_num = rbd_poll_io_events(rbd->image, comps, min_evts);
+		pfd.fd = rbd->fd;
+		pfd.events = POLLIN;
 
-	for (i = 0; i < event_num; i++) {
-		fri = rbd_aio_get_arg(comps[i]);
-		io_u = fri->io_u;
+		ret = poll(&pfd, 1, -1);
+		if (ret <= 0)
+			return 0;
+		if (!(pfd.revents & POLLIN))
+			return 0;
 
-		/* best effort to decrement the semaphore */
+		/*
+		 * Clear the count before fetching, anything that completes
+		 * after this bumps it again and wakes up the next poll.
+		 */
 		ret = read(rbd->fd, &counter, sizeof(counter));
-		if (ret <= 0)
-			log_err("rbd_iter_events failed to decrement semaphore.\n");
+		if (ret < 0 && errno != EAGAIN)
+			log_err("rbd_iter_events failed to clear eventfd.\n");
+	}
 
-		completed = fri_check_complete(rbd, io_u, events);
-		assert(completed);
+	event_num = rbd_poll_io_events(rbd->image, rbd->comps,
+					max_evts - *events);
+	if (event_num <= 0)
+		return 0;
+
+	for (i = 0; i < event_num; i++) {
+		fri = rbd_aio_get_arg(rbd->comps[i]);
 
-		this_events++;
+		completed = fri_check_complete(rbd, fri->io_u, events);
+		assert(completed);
 	}
-#else
+
+	return event_num;
+}
+#endif
+
+static int rbd_iter_events(struct thread_data *td, unsigned int *events,
+			   unsigned int min_evts, int wait)
+{
+	struct rbd_data *rbd = td->io_ops_data;
+	unsigned int this_events = 0;
+	struct io_u *io_u;
+	int i, sidx = 0;
+
 	io_u_qiter(&td->io_u_all, io_u, i) {
 		if (!(io_u->flags & IO_U_F_FLIGHT))
 			continue;
@@ -429,7 +604,6 @@ static int rbd_iter_events(struct thread_data *td, unsigned int *events,
 		else if (wait)
 			rbd->sort_events[sidx++] = io_u;
 	}
-#endif
 
 	if (!wait || !sidx)
 		return this_events;
@@ -466,6 +640,20 @@ static int rbd_iter_events(struct thread_data *td, unsigned int *events,
 	return this_events;
 }
 
+static int rbd_reap_events(struct thread_data *td, unsigned int *events,
+			   unsigned int min_evts, unsigned int max_evts,
+			   int wait)
+{
+#ifdef CONFIG_RBD_POLL
+	struct rbd_data *rbd = td->io_ops_data;
+
+	if (rbd->fd != -1)
+		return rbd_iter_events_poll(td, events, max_evts, wait);
+#endif
+
+	return rbd_iter_events(td, events, min_evts, wait);
+}
+
 static int fio_rbd_getevents(struct thread_data *td, unsigned int min,
 			     unsigned int max, const struct timespec *t)
 {
@@ -474,7 +662,7 @@ static int fio_rbd_getevents(struct thread_data *td, unsigned int min,
 	int wait = 0;
 
 	do {
-		this_events = rbd_iter_events(td, &events, min, wait);
+		this_events = rbd_reap_events(td, &events, min, max, wait);
 
 		if (events >= min)
 			break;
@@ -582,6 +770,7 @@ static void fio_rbd_cleanup(struct thread_data *td)
 		_fio_rbd_disconnect(rbd);
 		free(rbd->aio_events);
 		free(rbd->sort_events);
+		free(rbd->comps);
 		free(rbd);
 	}
 }
@@ -666,23 +855,11 @@ static int fio_rbd_invalidate(struct thread_data *td, struct fio_file *f)
 #endif
 }
 
-static void fio_rbd_io_u_free(struct thread_data *td, struct io_u *io_u)
-{
-	struct fio_rbd_iou *fri = io_u->engine_data;
-
-	if (fri) {
-		io_u->engine_data = NULL;
-		free(fri);
-	}
-}
-
 static int fio_rbd_io_u_init(struct thread_data *td, struct io_u *io_u)
 {
-	struct fio_rbd_iou *fri;
+	struct fio_rbd_iou *fri = io_u->engine_data;
 
-	fri = calloc(1, sizeof(*fri));
 	fri->io_u = io_u;
-	io_u->engine_data = fri;
 	return 0;
 }
 
@@ -699,8 +876,8 @@ FIO_STATIC struct ioengine_ops ioengine = {
 	.invalidate		= fio_rbd_invalidate,
 	.options		= options,
 	.io_u_init		= fio_rbd_io_u_init,
-	.io_u_free		= fio_rbd_io_u_free,
 	.option_struct_size	= sizeof(struct rbd_options),
+	.io_u_priv_size		= sizeof(struct fio_rbd_iou),
 };
 
 static void fio_init fio_rbd_register(void)
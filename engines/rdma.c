@@ -47,6 +47,12 @@
 
 #define FIO_RDMA_MAX_IO_DEPTH    512
 
+/*
+ * Empty CQ polls cq_poll=adaptive spins through before it sleeps on the
+ * completion channel
+ */
+#define FIO_RDMA_ADAPTIVE_SPINS  1024
+
 enum rdma_io_mode {
 	FIO_RDMA_UNKNOWN = 0,
 	FIO_RDMA_MEM_WRITE,
@@ -55,11 +61,21 @@ enum rdma_io_mode {
 	FIO_RDMA_CHA_RECV
 };
 
+enum rdma_cq_poll {
+	FIO_RDMA_CQ_EVENT = 0,
+	FIO_RDMA_CQ_BUSY,
+	FIO_RDMA_CQ_ADAPTIVE,
+};
+
 struct rdmaio_options {
 	struct thread_data *td;
 	unsigned int port;
 	enum rdma_io_mode verb;
 	char *bindname;
+	unsigned int srq;
+	unsigned int inline_size;
+	unsigned int signal_interval;
+	enum rdma_cq_poll cq_poll;
 };
 
 static int str_hostname_cb(void *data, const char *input)
@@ -132,6 +148,61 @@ static struct fio_option options[] = {
 		.category = FIO_OPT_C_ENGINE,
 		.group	= FIO_OPT_G_RDMA,
 	},
+	{
+		.name	= "srq",
+		.lname	= "RDMA shared receive queue",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct rdmaio_options, srq),
+		.help	= "Post receives to a shared receive queue",
+		.def	= "0",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_RDMA,
+	},
+	{
+		.name	= "inline_size",
+		.lname	= "RDMA inline data size",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct rdmaio_options, inline_size),
+		.help	= "Send messages up to this size inline in the work request",
+		.def	= "0",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_RDMA,
+	},
+	{
+		.name	= "signal_interval",
+		.lname	= "RDMA send signal interval",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct rdmaio_options, signal_interval),
+		.help	= "Only request a completion for every Nth send",
+		.def	= "1",
+		.minval	= 1,
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_RDMA,
+	},
+	{
+		.name	= "cq_poll",
+		.lname	= "RDMA completion queue polling",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct rdmaio_options, cq_poll),
+		.help	= "How to wait for completions",
+		.def	= "event",
+		.posval = {
+			  { .ival = "event",
+			    .oval = FIO_RDMA_CQ_EVENT,
+			    .help = "Sleep on the completion channel",
+			  },
+			  { .ival = "busy",
+			    .oval = FIO_RDMA_CQ_BUSY,
+			    .help = "Busy poll the completion queue",
+			  },
+			  { .ival = "adaptive",
+			    .oval = FIO_RDMA_CQ_ADAPTIVE,
+			    .help = "Busy poll, sleep once the queue stays empty",
+			  },
+		},
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_RDMA,
+	},
 	{
 		.name	= NULL,
 	},
@@ -179,6 +250,13 @@ struct rdmaio_data {
 	struct ibv_cq *cq;
 	struct ibv_pd *pd;
 	struct ibv_qp *qp;
+	struct ibv_srq *srq;
+	unsigned int max_inline;
+
+	/* completions are polled in batches of wc_nr */
+	struct ibv_wc *wcs;
+	int wc_nr;
+	unsigned int empty_polls;
 
 	pthread_t cmthread;
 	struct rdma_event_channel *cm_channel;
@@ -191,10 +269,23 @@ struct rdmaio_data {
 	int rmt_nr;
 	struct io_u **io_us_queued;
 	int io_u_queued_nr;
-	struct io_u **io_us_flight;
-	int io_u_flight_nr;
 	struct io_u **io_us_completed;
 	int io_u_completed_nr;
+	int io_u_events_nr;
+
+	/* io_u's by wr_id, see fio_rdmaio_post_init() */
+	struct io_u **io_us_wr;
+	int io_us_wr_nr;
+
+	/*
+	 * Posted sends, in post order. An RC queue pair completes sends in
+	 * order, so a signaled completion also completes every unsignaled
+	 * send posted before it.
+	 */
+	struct io_u **sq_ring;
+	unsigned int sq_head;
+	unsigned int sq_nr;
+	unsigned int sq_unsignaled;
 
 	struct frand_state rand_state;
 };
@@ -266,157 +357,188 @@ static int server_recv(struct thread_data *td, struct ibv_wc *wc)
 	return 0;
 }
 
-static int cq_event_handler(struct thread_data *td, enum ibv_wc_opcode opcode)
+static struct io_u *wr_id_to_io_u(struct rdmaio_data *rd, uint64_t wr_id)
+{
+	if (wr_id >= rd->io_us_wr_nr) {
+		log_err("fio: wr %" PRId64 " not found\n", wr_id);
+		return NULL;
+	}
+
+	return rd->io_us_wr[wr_id];
+}
+
+/*
+ * Complete the sends at the head of the send ring, up to and including
+ * the one that was signaled.
+ */
+static int complete_sends(struct thread_data *td, struct io_u *signaled)
 {
 	struct rdmaio_data *rd = td->io_ops_data;
-	struct ibv_wc wc;
-	struct rdma_io_u_data *r_io_u_d;
+	struct io_u *io_u;
+
+	do {
+		if (!rd->sq_nr) {
+			log_err("fio: send %p not in flight\n", signaled);
+			return 1;
+		}
+
+		io_u = rd->sq_ring[rd->sq_head];
+		rd->sq_head = (rd->sq_head + 1) % td->o.iodepth;
+		rd->sq_nr--;
+
+		rd->io_us_completed[rd->io_u_completed_nr++] = io_u;
+	} while (io_u != signaled);
+
+	return 0;
+}
+
+static int handle_wc(struct thread_data *td, struct ibv_wc *wc)
+{
+	struct rdmaio_data *rd = td->io_ops_data;
+	struct io_u *io_u;
 	int ret;
-	int compevnum = 0;
-	int i;
 
-	while ((ret = ibv_poll_cq(rd->cq, 1, &wc)) == 1) {
-		ret = 0;
-		compevnum++;
+	if (wc->status) {
+		log_err("fio: cq completion status %d(%s)\n",
+			wc->status, ibv_wc_status_str(wc->status));
+		return -1;
+	}
+
+	switch (wc->opcode) {
 
-		if (wc.status) {
-			log_err("fio: cq completion status %d(%s)\n",
-				wc.status, ibv_wc_status_str(wc.status));
+	case IBV_WC_RECV:
+		if (rd->is_client == 1)
+			ret = client_recv(td, wc);
+		else
+			ret = server_recv(td, wc);
+
+		if (ret)
 			return -1;
+
+		if (wc->wr_id == FIO_RDMA_MAX_IO_DEPTH) {
+			rd->cq_event_num++;
+			break;
 		}
 
-		switch (wc.opcode) {
+		io_u = wr_id_to_io_u(rd, wc->wr_id);
+		if (!io_u)
+			break;
 
-		case IBV_WC_RECV:
-			if (rd->is_client == 1)
-				ret = client_recv(td, &wc);
-			else
-				ret = server_recv(td, &wc);
+		io_u->resid = io_u->buflen - wc->byte_len;
+		io_u->error = 0;
+		rd->io_us_completed[rd->io_u_completed_nr++] = io_u;
+		break;
 
-			if (ret)
-				return -1;
+	case IBV_WC_SEND:
+	case IBV_WC_RDMA_WRITE:
+	case IBV_WC_RDMA_READ:
+		if (wc->wr_id == FIO_RDMA_MAX_IO_DEPTH) {
+			rd->cq_event_num++;
+			break;
+		}
 
-			if (wc.wr_id == FIO_RDMA_MAX_IO_DEPTH)
-				break;
-
-			for (i = 0; i < rd->io_u_flight_nr; i++) {
-				r_io_u_d = rd->io_us_flight[i]->engine_data;
-
-				if (wc.wr_id == r_io_u_d->rq_wr.wr_id) {
-					rd->io_us_flight[i]->resid =
-					    rd->io_us_flight[i]->buflen
-					    - wc.byte_len;
-
-					rd->io_us_flight[i]->error = 0;
-
-					rd->io_us_completed[rd->
-							    io_u_completed_nr]
-					    = rd->io_us_flight[i];
-					rd->io_u_completed_nr++;
-					break;
-				}
-			}
-			if (i == rd->io_u_flight_nr)
-				log_err("fio: recv wr %" PRId64 " not found\n",
-					wc.wr_id);
-			else {
-				/* put the last one into middle of the list */
-				rd->io_us_flight[i] =
-				    rd->io_us_flight[rd->io_u_flight_nr - 1];
-				rd->io_u_flight_nr--;
-			}
+		io_u = wr_id_to_io_u(rd, wc->wr_id);
+		if (io_u && complete_sends(td, io_u))
+			return -1;
+		break;
 
-			break;
+	default:
+		log_info("fio: unknown completion event %d\n", wc->opcode);
+		return -1;
+	}
 
-		case IBV_WC_SEND:
-		case IBV_WC_RDMA_WRITE:
-		case IBV_WC_RDMA_READ:
-			if (wc.wr_id == FIO_RDMA_MAX_IO_DEPTH)
-				break;
-
-			for (i = 0; i < rd->io_u_flight_nr; i++) {
-				r_io_u_d = rd->io_us_flight[i]->engine_data;
-
-				if (wc.wr_id == r_io_u_d->sq_wr.wr_id) {
-					rd->io_us_completed[rd->
-							    io_u_completed_nr]
-					    = rd->io_us_flight[i];
-					rd->io_u_completed_nr++;
-					break;
-				}
-			}
-			if (i == rd->io_u_flight_nr)
-				log_err("fio: send wr %" PRId64 " not found\n",
-					wc.wr_id);
-			else {
-				/* put the last one into middle of the list */
-				rd->io_us_flight[i] =
-				    rd->io_us_flight[rd->io_u_flight_nr - 1];
-				rd->io_u_flight_nr--;
-			}
+	return 0;
+}
 
-			break;
+/*
+ * Drain the CQ in batches of rd->wc_nr. Returns the number of work
+ * completions handled, or -1 on error.
+ */
+static int cq_event_handler(struct thread_data *td)
+{
+	struct rdmaio_data *rd = td->io_ops_data;
+	int compevnum = 0;
+	int i, ret;
 
-		default:
-			log_info("fio: unknown completion event %d\n",
-				 wc.opcode);
+	do {
+		ret = ibv_poll_cq(rd->cq, rd->wc_nr, rd->wcs);
+		if (ret < 0) {
+			log_err("fio: poll error %d\n", ret);
 			return -1;
 		}
-		rd->cq_event_num++;
-	}
 
-	if (ret) {
-		log_err("fio: poll error %d\n", ret);
-		return 1;
-	}
+		for (i = 0; i < ret; i++)
+			if (handle_wc(td, &rd->wcs[i]))
+				return -1;
+
+		compevnum += ret;
+	} while (ret == rd->wc_nr);
 
 	return compevnum;
 }
 
 /*
- * Return -1 for error and 'nr events' for a positive number
- * of events
+ * Sleep until the CQ signals the completion channel, and arm it again
  */
-static int rdma_poll_wait(struct thread_data *td, enum ibv_wc_opcode opcode)
+static int rdma_wait_cq_event(struct thread_data *td)
 {
 	struct rdmaio_data *rd = td->io_ops_data;
 	struct ibv_cq *ev_cq;
 	void *ev_ctx;
-	int ret;
-
-	if (rd->cq_event_num > 0) {	/* previous left */
-		rd->cq_event_num--;
-		return 0;
-	}
 
-again:
 	if (ibv_get_cq_event(rd->channel, &ev_cq, &ev_ctx) != 0) {
 		log_err("fio: Failed to get cq event!\n");
-		return -1;
+		return 1;
 	}
 	if (ev_cq != rd->cq) {
 		log_err("fio: Unknown CQ!\n");
-		return -1;
+		return 1;
 	}
+
+	ibv_ack_cq_events(rd->cq, 1);
+
 	if (ibv_req_notify_cq(rd->cq, 0) != 0) {
 		log_err("fio: Failed to set notify!\n");
-		return -1;
+		return 1;
 	}
 
-	ret = cq_event_handler(td, opcode);
-	if (ret == 0)
-		goto again;
+	return 0;
+}
 
-	ibv_ack_cq_events(rd->cq, ret);
+/*
+ * Wait for the next control message completion. Return -1 for error
+ * and 0 once it is in.
+ */
+static int rdma_poll_wait(struct thread_data *td, enum ibv_wc_opcode opcode)
+{
+	struct rdmaio_data *rd = td->io_ops_data;
+	int ret;
+
+	while (!rd->cq_event_num) {
+		ret = cq_event_handler(td);
+		if (ret < 0)
+			return -1;
+		if (!ret && rdma_wait_cq_event(td))
+			return -1;
+	}
 
 	rd->cq_event_num--;
+	return 0;
+}
 
-	return ret;
+static int rdma_post_recv_wr(struct rdmaio_data *rd, struct ibv_recv_wr *wr,
+			     struct ibv_recv_wr **bad_wr)
+{
+	if (rd->srq)
+		return ibv_post_srq_recv(rd->srq, wr, bad_wr);
+
+	return ibv_post_recv(rd->qp, wr, bad_wr);
 }
 
 static int fio_rdmaio_setup_qp(struct thread_data *td)
 {
 	struct rdmaio_data *rd = td->io_ops_data;
+	struct rdmaio_options *o = td->eo;
 	struct ibv_qp_init_attr init_attr;
 	int qp_depth = td->o.iodepth * 2;	/* 2 times of io depth */
 
@@ -458,32 +580,63 @@ static int fio_rdmaio_setup_qp(struct thread_data *td)
 		goto err3;
 	}
 
+	rd->wc_nr = qp_depth;
+	rd->wcs = calloc(rd->wc_nr, sizeof(struct ibv_wc));
+	if (!rd->wcs)
+		goto err3;
+
+	if (o->srq) {
+		struct ibv_srq_init_attr srq_attr;
+
+		memset(&srq_attr, 0, sizeof(srq_attr));
+		srq_attr.attr.max_wr = qp_depth;
+		srq_attr.attr.max_sge = 1;
+
+		rd->srq = ibv_create_srq(rd->pd, &srq_attr);
+		if (rd->srq == NULL) {
+			log_err("fio: ibv_create_srq failed: %m\n");
+			goto err4;
+		}
+	}
+
 	/* create queue pair */
 	memset(&init_attr, 0, sizeof(init_attr));
 	init_attr.cap.max_send_wr = qp_depth;
 	init_attr.cap.max_recv_wr = qp_depth;
 	init_attr.cap.max_recv_sge = 1;
 	init_attr.cap.max_send_sge = 1;
+	init_attr.cap.max_inline_data = o->inline_size;
 	init_attr.qp_type = IBV_QPT_RC;
 	init_attr.send_cq = rd->cq;
 	init_attr.recv_cq = rd->cq;
+	init_attr.srq = rd->srq;
 
 	if (rd->is_client == 0) {
 		if (rdma_create_qp(rd->child_cm_id, rd->pd, &init_attr) != 0) {
 			log_err("fio: rdma_create_qp failed: %m\n");
-			goto err3;
+			goto err5;
 		}
 		rd->qp = rd->child_cm_id->qp;
 	} else {
 		if (rdma_create_qp(rd->cm_id, rd->pd, &init_attr) != 0) {
 			log_err("fio: rdma_create_qp failed: %m\n");
-			goto err3;
+			goto err5;
 		}
 		rd->qp = rd->cm_id->qp;
 	}
 
+	/* the provider may round the inline size either way */
+	rd->max_inline = min(o->inline_size, init_attr.cap.max_inline_data);
+
 	return 0;
 
+err5:
+	if (rd->srq)
+		ibv_destroy_srq(rd->srq);
+	rd->srq = NULL;
+err4:
+	free(rd->wcs);
+	rd->wcs = NULL;
 err3:
 	ibv_destroy_cq(rd->cq);
 err2:
@@ -617,13 +770,8 @@ static struct io_u *fio_rdmaio_event(struct thread_data *td, int event)
 {
 	struct rdmaio_data *rd = td->io_ops_data;
 	struct io_u *io_u;
-	int i;
-
-	io_u = rd->io_us_completed[0];
-	for (i = 0; i < rd->io_u_completed_nr - 1; i++)
-		rd->io_us_completed[i] = rd->io_us_completed[i + 1];
 
-	rd->io_u_completed_nr--;
+	io_u = rd->io_us_completed[event];
 
 	dprint_io_u(io_u, "fio_rdmaio_event");
 
@@ -634,73 +782,74 @@ static int fio_rdmaio_getevents(struct thread_data *td, unsigned int min,
 				unsigned int max, const struct timespec *t)
 {
 	struct rdmaio_data *rd = td->io_ops_data;
-	enum ibv_wc_opcode comp_opcode;
-	struct ibv_cq *ev_cq;
-	void *ev_ctx;
-	int ret, r = 0;
-	comp_opcode = IBV_WC_RDMA_WRITE;
+	struct rdmaio_options *o = td->eo;
+	int ret;
 
-	switch (rd->rdma_protocol) {
-	case FIO_RDMA_MEM_WRITE:
-		comp_opcode = IBV_WC_RDMA_WRITE;
-		break;
-	case FIO_RDMA_MEM_READ:
-		comp_opcode = IBV_WC_RDMA_READ;
-		break;
-	case FIO_RDMA_CHA_SEND:
-		comp_opcode = IBV_WC_SEND;
-		break;
-	case FIO_RDMA_CHA_RECV:
-		comp_opcode = IBV_WC_RECV;
-		break;
-	default:
-		log_err("fio: unknown rdma protocol - %d\n", rd->rdma_protocol);
-		break;
+	/* drop the completions handed out by the last call */
+	if (rd->io_u_events_nr) {
+		rd->io_u_completed_nr -= rd->io_u_events_nr;
+		memmove(rd->io_us_completed,
+			rd->io_us_completed + rd->io_u_events_nr,
+			rd->io_u_completed_nr * sizeof(struct io_u *));
+		rd->io_u_events_nr = 0;
 	}
 
-	if (rd->cq_event_num > 0) {	/* previous left */
-		rd->cq_event_num--;
-		return 0;
-	}
+	while (rd->io_u_completed_nr < (int) min) {
+		ret = cq_event_handler(td);
+		if (ret < 0)
+			return -1;
+		if (ret) {
+			rd->empty_polls = 0;
+			continue;
+		}
 
-again:
-	if (ibv_get_cq_event(rd->channel, &ev_cq, &ev_ctx) != 0) {
-		log_err("fio: Failed to get cq event!\n");
-		return -1;
-	}
-	if (ev_cq != rd->cq) {
-		log_err("fio: Unknown CQ!\n");
-		return -1;
-	}
-	if (ibv_req_notify_cq(rd->cq, 0) != 0) {
-		log_err("fio: Failed to set notify!\n");
-		return -1;
+		if (o->cq_poll == FIO_RDMA_CQ_BUSY)
+			continue;
+		if (o->cq_poll == FIO_RDMA_CQ_ADAPTIVE &&
+		    ++rd->empty_polls < FIO_RDMA_ADAPTIVE_SPINS)
+			continue;
+
+		rd->empty_polls = 0;
+		if (rdma_wait_cq_event(td))
+			return -1;
 	}
 
-	ret = cq_event_handler(td, comp_opcode);
-	if (ret < 1)
-		goto again;
+	rd->io_u_events_nr = rd->io_u_completed_nr;
+	if (rd->io_u_events_nr > (int) max)
+		rd->io_u_events_nr = max;
 
-	ibv_ack_cq_events(rd->cq, ret);
+	return rd->io_u_events_nr;
+}
 
-	r += ret;
-	if (r < min)
-		goto again;
+/*
+ * Ask for a completion on every signal_interval'th send, and on the last
+ * one of a batch, so whatever is in flight always ends in a signaled
+ * send that completes it.
+ */
+static unsigned int send_flags(struct thread_data *td, struct io_u *io_u,
+			       enum ibv_wr_opcode opcode, int last)
+{
+	struct rdmaio_data *rd = td->io_ops_data;
+	struct rdmaio_options *o = td->eo;
+	unsigned int flags = 0;
+
+	if (opcode != IBV_WR_RDMA_READ && io_u->buflen <= rd->max_inline)
+		flags |= IBV_SEND_INLINE;
 
-	rd->cq_event_num -= r;
+	if (last || ++rd->sq_unsignaled >= o->signal_interval ||
+	    rd->sq_nr + 1 == td->o.iodepth) {
+		flags |= IBV_SEND_SIGNALED;
+		rd->sq_unsignaled = 0;
+	}
 
-	return r;
+	return flags;
 }
 
 static int fio_rdmaio_send(struct thread_data *td, struct io_u **io_us,
 			   unsigned int nr)
 {
 	struct rdmaio_data *rd = td->io_ops_data;
-	struct ibv_send_wr *bad_wr;
-#if 0
-	enum ibv_wc_opcode comp_opcode;
-	comp_opcode = IBV_WC_RDMA_WRITE;
-#endif
+	struct ibv_send_wr *bad_wr, *first = NULL, **next = &first;
 	int i;
 	long index;
 	struct rdma_io_u_data *r_io_u_d;
@@ -733,24 +882,31 @@ static int fio_rdmaio_send(struct thread_data *td, struct io_u **io_us,
 		case FIO_RDMA_CHA_SEND:
 			r_io_u_d = io_us[i]->engine_data;
 			r_io_u_d->sq_wr.opcode = IBV_WR_SEND;
-			r_io_u_d->sq_wr.send_flags = IBV_SEND_SIGNALED;
 			break;
 		default:
 			log_err("fio: unknown rdma protocol - %d\n",
 				rd->rdma_protocol);
-			break;
-		}
-
-		if (ibv_post_send(rd->qp, &r_io_u_d->sq_wr, &bad_wr) != 0) {
-			log_err("fio: ibv_post_send fail: %m\n");
 			return -1;
 		}
 
+		r_io_u_d->sq_wr.send_flags = send_flags(td, io_us[i],
+						r_io_u_d->sq_wr.opcode,
+						i == nr - 1);
+		r_io_u_d->sq_wr.next = NULL;
+		*next = &r_io_u_d->sq_wr;
+		next = &r_io_u_d->sq_wr.next;
+
+		rd->sq_ring[(rd->sq_head + rd->sq_nr) % td->o.iodepth] = io_us[i];
+		rd->sq_nr++;
+
 		dprint_io_u(io_us[i], "fio_rdmaio_send");
 	}
 
-	/* wait for completion
-	   rdma_poll_wait(td, comp_opcode); */
+	/* post the whole batch with one doorbell */
+	if (first && ibv_post_send(rd->qp, first, &bad_wr) != 0) {
+		log_err("fio: ibv_post_send fail: %m\n");
+		return -1;
+	}
 
 	return i;
 }
@@ -759,7 +915,7 @@ static int fio_rdmaio_recv(struct thread_data *td, struct io_u **io_us,
 			   unsigned int nr)
 {
 	struct rdmaio_data *rd = td->io_ops_data;
-	struct ibv_recv_wr *bad_wr;
+	struct ibv_recv_wr *bad_wr, *first = NULL, **next = &first;
 	struct rdma_io_u_data *r_io_u_d;
 	int i;
 
@@ -768,16 +924,18 @@ static int fio_rdmaio_recv(struct thread_data *td, struct io_u **io_us,
 		/* post io_u into recv queue */
 		for (i = 0; i < nr; i++) {
 			r_io_u_d = io_us[i]->engine_data;
-			if (ibv_post_recv(rd->qp, &r_io_u_d->rq_wr, &bad_wr) !=
-			    0) {
-				log_err("fio: ibv_post_recv fail: %m\n");
-				return 1;
-			}
+			r_io_u_d->rq_wr.next = NULL;
+			*next = &r_io_u_d->rq_wr;
+			next = &r_io_u_d->rq_wr.next;
+		}
+		if (first && rdma_post_recv_wr(rd, first, &bad_wr) != 0) {
+			log_err("fio: ibv_post_recv fail: %m\n");
+			return 1;
 		}
 	} else if ((rd->rdma_protocol == FIO_RDMA_MEM_READ)
 		   || (rd->rdma_protocol == FIO_RDMA_MEM_WRITE)) {
 		/* re-post the rq_wr */
-		if (ibv_post_recv(rd->qp, &rd->rq_wr, &bad_wr) != 0) {
+		if (rdma_post_recv_wr(rd, &rd->rq_wr, &bad_wr) != 0) {
 			log_err("fio: ibv_post_recv fail: %m\n");
 			return 1;
 		}
@@ -813,7 +971,6 @@ static enum fio_q_status fio_rdmaio_queue(struct thread_data *td,
 static void fio_rdmaio_queued(struct thread_data *td, struct io_u **io_us,
 			      unsigned int nr)
 {
-	struct rdmaio_data *rd = td->io_ops_data;
 	struct timespec now;
 	unsigned int i;
 
@@ -825,10 +982,6 @@ static void fio_rdmaio_queued(struct thread_data *td, struct io_u **io_us,
 	for (i = 0; i < nr; i++) {
 		struct io_u *io_u = io_us[i];
 
-		/* queued -> flight */
-		rd->io_us_flight[rd->io_u_flight_nr] = io_u;
-		rd->io_u_flight_nr++;
-
 		memcpy(&io_u->issue_time, &now, sizeof(now));
 		io_u_queued(td, io_u);
 	}
@@ -1009,6 +1162,8 @@ static int fio_rdmaio_close_file(struct thread_data *td, struct fio_file *f)
 
 	ibv_destroy_cq(rd->cq);
 	ibv_destroy_qp(rd->qp);
+	if (rd->srq)
+		ibv_destroy_srq(rd->srq);
 
 	if (rd->is_client == 1)
 		rdma_destroy_id(rd->cm_id);
@@ -1102,7 +1257,7 @@ static int fio_rdmaio_setup_connect(struct thread_data *td, const char *host,
 		return 1;
 
 	/* post recv buf */
-	err = ibv_post_recv(rd->qp, &rd->rq_wr, &bad_wr);
+	err = rdma_post_recv_wr(rd, &rd->rq_wr, &bad_wr);
 	if (err != 0) {
 		log_err("fio: ibv_post_recv fail: %d\n", err);
 		return 1;
@@ -1155,7 +1310,7 @@ static int fio_rdmaio_setup_listen(struct thread_data *td, short port)
 		return 1;
 
 	/* post recv buf */
-	if (ibv_post_recv(rd->qp, &rd->rq_wr, &bad_wr) != 0) {
+	if (rdma_post_recv_wr(rd, &rd->rq_wr, &bad_wr) != 0) {
 		log_err("fio: ibv_post_recv fail: %m\n");
 		return 1;
 	}
@@ -1307,9 +1462,8 @@ static int fio_rdmaio_init(struct thread_data *td)
 	memset(rd->io_us_queued, 0, td->o.iodepth * sizeof(struct io_u *));
 	rd->io_u_queued_nr = 0;
 
-	rd->io_us_flight = malloc(td->o.iodepth * sizeof(struct io_u *));
-	memset(rd->io_us_flight, 0, td->o.iodepth * sizeof(struct io_u *));
-	rd->io_u_flight_nr = 0;
+	rd->sq_ring = calloc(td->o.iodepth, sizeof(struct io_u *));
+	rd->sq_head = rd->sq_nr = rd->sq_unsignaled = 0;
 
 	rd->io_us_completed = malloc(td->o.iodepth * sizeof(struct io_u *));
 	memset(rd->io_us_completed, 0, td->o.iodepth * sizeof(struct io_u *));
@@ -1335,13 +1489,17 @@ static int fio_rdmaio_post_init(struct thread_data *td)
 	max_bs = max(td->o.max_bs[DDIR_READ], td->o.max_bs[DDIR_WRITE]);
 	rd->send_buf.max_bs = htonl(max_bs);
 
+	rd->io_us_wr = calloc(td->io_u_freelist.nr, sizeof(struct io_u *));
+	if (!rd->io_us_wr)
+		return 1;
+	rd->io_us_wr_nr = td->io_u_freelist.nr;
+
 	/* register each io_u in the free list */
 	for (i = 0; i < td->io_u_freelist.nr; i++) {
 		struct io_u *io_u = td->io_u_freelist.io_us[i];
 
-		io_u->engine_data = malloc(sizeof(struct rdma_io_u_data));
-		memset(io_u->engine_data, 0, sizeof(struct rdma_io_u_data));
 		((struct rdma_io_u_data *)io_u->engine_data)->wr_id = i;
+		rd->io_us_wr[i] = io_u;
 
 		io_u->mr = ibv_reg_mr(rd->pd, io_u->buf, max_bs,
 				      IBV_ACCESS_LOCAL_WRITE |
@@ -1371,8 +1529,12 @@ static void fio_rdmaio_cleanup(struct thread_data *td)
 {
 	struct rdmaio_data *rd = td->io_ops_data;
 
-	if (rd)
+	if (rd) {
+		free(rd->wcs);
+		free(rd->io_us_wr);
+		free(rd->sq_ring);
 		free(rd);
+	}
 }
 
 static int fio_rdmaio_setup(struct thread_data *td)
@@ -1414,6 +1576,7 @@ FIO_STATIC struct ioengine_ops ioengine = {
 					FIO_ASYNCIO_SETS_ISSUE_TIME,
 	.options		= options,
 	.option_struct_size	= sizeof(struct rdmaio_options),
+	.io_u_priv_size		= sizeof(struct rdma_io_u_data),
 };
 
 static void fio_init fio_rdmaio_register(void)
@@ -48,12 +48,21 @@
  *    io_u_mark_submit()		called in commit()
  *    issue_time			set in commit()
  *
+ *  /dev/sgY with sg_mrq=1 (sg v4 driver)
+ *   RWT: all commands are queued in queue() and submitted with a single
+ *        SG_IOSUBMIT multiple requests call in commit(). Completions are
+ *        reaped in batches with SG_IORECEIVE.
+ *    io_u_mark_depth()			called in td_io_commit()
+ *    io_u_mark_submit()		called in commit()
+ *    issue_time			set in commit()
+ *
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
 #include <poll.h>
+#include <linux/bsg.h>
 
 #include "../fio.h"
 #include "../optgroup.h"
@@ -64,6 +73,25 @@
 #define SGV4_FLAG_HIPRI 0x800
 #endif
 
+/*
+ * sg v4 driver interface, not yet in all distro headers
+ */
+#ifndef SG_IOSUBMIT
+#define SG_IOSUBMIT	_IOWR(0x22, 0x41, struct sg_io_v4)
+#endif
+#ifndef SG_IORECEIVE
+#define SG_IORECEIVE	_IOWR(0x22, 0x42, struct sg_io_v4)
+#endif
+#ifndef SGV4_FLAG_IMMED
+#define SGV4_FLAG_IMMED 0x400
+#endif
+#ifndef SGV4_FLAG_MULTIPLE_REQS
+#define SGV4_FLAG_MULTIPLE_REQS 0x40000
+#endif
+
+/* first sg driver version with SG_IOSUBMIT/SG_IORECEIVE */
+#define SG_V4_VERSION_NUM	40000
+
 enum {
 	FIO_SG_WRITE		= 1,
 	FIO_SG_WRITE_VERIFY,
@@ -82,6 +110,7 @@ struct sg_options {
 	unsigned int writefua;
 	unsigned int write_mode;
 	uint16_t stream_id;
+	unsigned int mrq;
 };
 
 static struct fio_option options[] = {
@@ -178,6 +207,16 @@ static struct fio_option options[] = {
 		.category = FIO_OPT_C_ENGINE,
 		.group	= FIO_OPT_G_SG,
 	},
+	{
+		.name	= "sg_mrq",
+		.lname	= "sg v4 multiple requests",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct sg_options, mrq),
+		.help	= "Batch commands with sg v4 SG_IOSUBMIT/SG_IORECEIVE",
+		.def	= "0",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_SG,
+	},
 	{
 		.name	= NULL,
 	},
@@ -212,6 +251,19 @@ struct sgio_data {
 	int type_checked;
 	struct sgio_trim **trim_queues;
 	int current_queue;
+
+	/*
+	 * sg_mrq state. Commands queued for the next SG_IOSUBMIT live in
+	 * 'mrq_reqs', all targeting 'mrq_file'. 'mrq_rsp' receives the
+	 * completions from SG_IORECEIVE.
+	 */
+	int mrq;
+	struct sg_io_v4 *mrq_reqs;
+	struct sg_io_v4 *mrq_rsp;
+	struct io_u **mrq_io_us;
+	unsigned int mrq_nr;
+	unsigned int mrq_inflight;
+	struct fio_file *mrq_file;
 #ifdef FIO_SGIO_DEBUG
 	unsigned int *trim_queue_map;
 #endif
@@ -321,6 +373,176 @@ static int sg_fd_read(int fd, void *data, size_t size)
 	return 0;
 }
 
+/*
+ * The sg driver times each command from submission to completion, with
+ * millisecond resolution.
+ */
+static inline void sgio_set_clat(struct io_u *io_u, struct sg_io_hdr *hdr)
+{
+	io_u->engine_clat = hdr->duration * 1000000ULL;
+}
+
+/*
+ * Translate a prepared v3 header into a v4 request for SG_IOSUBMIT. The
+ * cdb, sense and data buffers are shared, so nothing is copied.
+ */
+static void sgio_hdr_to_v4(struct sg_io_hdr *hdr, struct sg_io_v4 *h4)
+{
+	memset(h4, 0, sizeof(*h4));
+	h4->guard = 'Q';
+	h4->protocol = BSG_PROTOCOL_SCSI;
+	h4->subprotocol = BSG_SUB_PROTOCOL_SCSI_CMD;
+	h4->request_len = hdr->cmd_len;
+	h4->request = (uintptr_t) hdr->cmdp;
+	h4->max_response_len = hdr->mx_sb_len;
+	h4->response = (uintptr_t) hdr->sbp;
+	h4->request_extra = hdr->pack_id;
+	h4->usr_ptr = (uintptr_t) hdr->usr_ptr;
+	h4->timeout = hdr->timeout;
+	h4->flags = hdr->flags;
+
+	if (hdr->dxfer_direction == SG_DXFER_TO_DEV) {
+		h4->dout_xferp = (uintptr_t) hdr->dxferp;
+		h4->dout_xfer_len = hdr->dxfer_len;
+	} else if (hdr->dxfer_direction == SG_DXFER_FROM_DEV) {
+		h4->din_xferp = (uintptr_t) hdr->dxferp;
+		h4->din_xfer_len = hdr->dxfer_len;
+	}
+}
+
+/*
+ * And back again for completions, so the rest of the reap path only ever
+ * needs to look at v3 headers.
+ */
+static void sgio_v4_to_hdr(struct sg_io_v4 *h4, struct sg_io_hdr *hdr)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->interface_id = 'S';
+	hdr->usr_ptr = (void *) (uintptr_t) h4->usr_ptr;
+	hdr->pack_id = h4->request_extra;
+	hdr->status = h4->device_status;
+	hdr->masked_status = (h4->device_status >> 1) & 0x7f;
+	hdr->host_status = h4->transport_status;
+	hdr->driver_status = h4->driver_status;
+	hdr->sb_len_wr = h4->response_len;
+	hdr->duration = h4->duration;
+	hdr->resid = h4->din_xfer_len ? h4->din_resid : h4->dout_resid;
+	hdr->info = h4->info;
+	if (hdr->status || hdr->host_status || hdr->driver_status)
+		hdr->info |= SG_INFO_CHECK;
+}
+
+static int fio_sgio_mrq_submit(struct thread_data *td)
+{
+	struct sgio_data *sd = td->io_ops_data;
+	struct sg_io_v4 ctl;
+	struct timespec now;
+	unsigned int i, nr_rw = 0;
+
+	if (!sd->mrq_nr)
+		return 0;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.guard = 'Q';
+	ctl.flags = SGV4_FLAG_MULTIPLE_REQS;
+	ctl.dout_xferp = (uintptr_t) sd->mrq_reqs;
+	ctl.dout_xfer_len = sd->mrq_nr * sizeof(struct sg_io_v4);
+
+	if (ioctl(sd->mrq_file->fd, SG_IOSUBMIT, &ctl) < 0) {
+		int error = errno;
+
+		for (i = 0; i < sd->mrq_nr; i++) {
+			sd->mrq_io_us[i]->error = error;
+			clear_io_u(td, sd->mrq_io_us[i]);
+		}
+		sd->mrq_nr = 0;
+		td_verror(td, error, "sg_submit");
+		return -error;
+	}
+
+	sd->mrq_inflight += sd->mrq_nr;
+
+	if (fio_fill_issue_time(td))
+		fio_gettime(&now, NULL);
+
+	/* trim io_us are accounted for by fio_sgio_trim_commit() */
+	for (i = 0; i < sd->mrq_nr; i++) {
+		struct io_u *io_u = sd->mrq_io_us[i];
+
+		if (io_u->ddir == DDIR_TRIM)
+			continue;
+		if (fio_fill_issue_time(td)) {
+			memcpy(&io_u->issue_time, &now, sizeof(now));
+			io_u_queued(td, io_u);
+		}
+		nr_rw++;
+	}
+	if (nr_rw)
+		io_u_mark_submit(td, nr_rw);
+
+	sd->mrq_nr = 0;
+	return 0;
+}
+
+/*
+ * Add a command to the pending multiple requests batch. A batch targets a
+ * single sg fd, so switching files flushes what we have first.
+ */
+static enum fio_q_status fio_sgio_mrq_queue(struct thread_data *td,
+					    struct fio_file *f,
+					    struct io_u *io_u)
+{
+	struct sgio_data *sd = td->io_ops_data;
+
+	if (sd->mrq_nr && sd->mrq_file != f) {
+		int ret = fio_sgio_mrq_submit(td);
+
+		if (ret < 0)
+			return ret;
+	}
+
+	sgio_hdr_to_v4(&io_u->hdr, &sd->mrq_reqs[sd->mrq_nr]);
+	sd->mrq_io_us[sd->mrq_nr] = io_u;
+	sd->mrq_file = f;
+	sd->mrq_nr++;
+	return FIO_Q_QUEUED;
+}
+
+/*
+ * Reap up to 'max' completed commands from 'f' in one SG_IORECEIVE call,
+ * storing them as v3 headers in 'hdrs'. Returns the number reaped.
+ */
+static int fio_sgio_mrq_receive(struct sgio_data *sd, struct fio_file *f,
+				struct sg_io_hdr *hdrs, int max, bool wait)
+{
+	struct sg_io_v4 ctl;
+	unsigned int i;
+
+	if (max <= 0)
+		return 0;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.guard = 'Q';
+	ctl.flags = SGV4_FLAG_MULTIPLE_REQS;
+	if (!wait)
+		ctl.flags |= SGV4_FLAG_IMMED;
+	ctl.din_xferp = (uintptr_t) sd->mrq_rsp;
+	ctl.din_xfer_len = max * sizeof(struct sg_io_v4);
+
+	if (ioctl(f->fd, SG_IORECEIVE, &ctl) < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return 0;
+		return -errno;
+	}
+
+	/* the driver reports the number of responses written in info */
+	for (i = 0; i < ctl.info && i < max; i++)
+		sgio_v4_to_hdr(&sd->mrq_rsp[i], &hdrs[i]);
+
+	sd->mrq_inflight -= i;
+	return i;
+}
+
 static int fio_sgio_getevents(struct thread_data *td, unsigned int min,
 			      unsigned int max,
 			      const struct timespec fio_unused *t)
@@ -387,6 +609,25 @@ re_read:
 		p = buf;
 		events = 0;
 		for_each_file(td, f, i) {
+			if (sd->mrq) {
+				ret = fio_sgio_mrq_receive(sd, f,
+						(struct sg_io_hdr *) p,
+						left - events, min != 0);
+				if (ret < 0) {
+					r = ret;
+					td_verror(td, -r, "sg_receive");
+					break;
+				}
+				for (eventNum = 0; eventNum < ret; eventNum++) {
+					io_u = ((struct sg_io_hdr *)p)->usr_ptr;
+					if (io_u->ddir == DDIR_TRIM)
+						events += sd->trim_queues[io_u->index]->unmap_range_count;
+					else
+						events++;
+					p += sizeof(struct sg_io_hdr);
+				}
+				continue;
+			}
 			for (eventNum = 0; eventNum < left; eventNum++) {
 				ret = sg_fd_read(f->fd, p, sizeof(struct sg_io_hdr));
 				dprint(FD_IO, "sgio_getevents: sg_fd_read ret: %d\n", ret);
@@ -421,6 +662,7 @@ re_read:
 			struct sg_io_hdr *hdr = (struct sg_io_hdr *) buf + i;
 			sd->events[i + trims] = hdr->usr_ptr;
 			io_u = (struct io_u *)(hdr->usr_ptr);
+			sgio_set_clat(io_u, hdr);
 
 			if (hdr->info & SG_INFO_CHECK) {
 				/* record if an io error occurred, ignore resid */
@@ -439,6 +681,7 @@ re_read:
 				for (j = 1; j < st->unmap_range_count; j++) {
 					++trims;
 					sd->events[i + trims] = st->trim_io_us[j];
+					sgio_set_clat(st->trim_io_us[j], hdr);
 #ifdef FIO_SGIO_DEBUG
 					dprint(FD_IO, "sgio_getevents: reaped io_u %d and stored in events[%d]\n", st->trim_io_us[j]->index, i+trims);
 					assert(sd->trim_queue_map[st->trim_io_us[j]->index] == io_u->index);
@@ -482,6 +725,8 @@ static enum fio_q_status fio_sgio_ioctl_doio(struct thread_data *td,
 	if (ret < 0)
 		return ret;
 
+	sgio_set_clat(io_u, hdr);
+
 	/* record if an io error occurred */
 	if (hdr->info & SG_INFO_CHECK)
 		io_u->error = EIO;
@@ -493,9 +738,13 @@ static enum fio_q_status fio_sgio_rw_doio(struct thread_data *td,
 					  struct fio_file *f,
 					  struct io_u *io_u, int do_sync)
 {
+	struct sgio_data *sd = td->io_ops_data;
 	struct sg_io_hdr *hdr = &io_u->hdr;
 	int ret;
 
+	if (sd->mrq && !do_sync)
+		return fio_sgio_mrq_queue(td, f, io_u);
+
 	ret = write(f->fd, hdr, sizeof(*hdr));
 	if (ret < 0)
 		return ret;
@@ -514,6 +763,7 @@ static enum fio_q_status fio_sgio_rw_doio(struct thread_data *td,
 				return ret;
 
 			__io_u = hdr->usr_ptr;
+			sgio_set_clat(__io_u, hdr);
 
 			/* record if an io error occurred */
 			if (hdr->info & SG_INFO_CHECK)
@@ -737,6 +987,13 @@ static enum fio_q_status fio_sgio_queue(struct thread_data *td,
 	if (sgio_unbuffered(td) || ddir_sync(io_u->ddir))
 		do_sync = 1;
 
+	/*
+	 * Synchronous commands use write()/read(), don't mix them with
+	 * outstanding multiple requests commands.
+	 */
+	if (sd->mrq && do_sync && (sd->mrq_nr || sd->mrq_inflight))
+		return FIO_Q_BUSY;
+
 	if (io_u->ddir == DDIR_TRIM) {
 		if (do_sync || io_u->file->filetype == FIO_TYPE_BLOCK) {
 			struct sgio_trim *st = sd->trim_queues[sd->current_queue];
@@ -765,7 +1022,7 @@ static enum fio_q_status fio_sgio_queue(struct thread_data *td,
 	else if (hdr->status) {
 		io_u->resid = hdr->resid;
 		io_u->error = EIO;
-	} else if (td->io_ops->commit != NULL) {
+	} else if (td->io_ops->commit != NULL && (do_sync || !sd->mrq)) {
 		if (do_sync && !ddir_sync(io_u->ddir)) {
 			io_u_mark_submit(td, 1);
 			io_u_mark_complete(td, 1);
@@ -783,7 +1040,7 @@ static enum fio_q_status fio_sgio_queue(struct thread_data *td,
 	return ret;
 }
 
-static int fio_sgio_commit(struct thread_data *td)
+static int fio_sgio_trim_commit(struct thread_data *td)
 {
 	struct sgio_data *sd = td->io_ops_data;
 	struct sgio_trim *st;
@@ -839,6 +1096,18 @@ static int fio_sgio_commit(struct thread_data *td)
 	return 0;
 }
 
+static int fio_sgio_commit(struct thread_data *td)
+{
+	struct sgio_data *sd = td->io_ops_data;
+	int ret;
+
+	ret = fio_sgio_trim_commit(td);
+	if (ret || !sd->mrq)
+		return ret;
+
+	return fio_sgio_mrq_submit(td);
+}
+
 static struct io_u *fio_sgio_event(struct thread_data *td, int event)
 {
 	struct sgio_data *sd = td->io_ops_data;
@@ -951,6 +1220,9 @@ static void fio_sgio_cleanup(struct thread_data *td)
 		free(sd->fd_flags);
 		free(sd->pfds);
 		free(sd->sgbuf);
+		free(sd->mrq_reqs);
+		free(sd->mrq_rsp);
+		free(sd->mrq_io_us);
 #ifdef FIO_SGIO_DEBUG
 		free(sd->trim_queue_map);
 #endif
@@ -1007,6 +1279,7 @@ static int fio_sgio_init(struct thread_data *td)
 static int fio_sgio_type_check(struct thread_data *td, struct fio_file *f)
 {
 	struct sgio_data *sd = td->io_ops_data;
+	struct sg_options *o = td->eo;
 	unsigned int bs = 0;
 	unsigned long long max_lba = 0;
 
@@ -1023,6 +1296,17 @@ static int fio_sgio_type_check(struct thread_data *td, struct fio_file *f)
 			return 1;
 		}
 
+		if (o->mrq && !sgio_unbuffered(td)) {
+			if (version >= SG_V4_VERSION_NUM) {
+				sd->mrq_reqs = calloc(td->o.iodepth, sizeof(struct sg_io_v4));
+				sd->mrq_rsp = calloc(td->o.iodepth, sizeof(struct sg_io_v4));
+				sd->mrq_io_us = calloc(td->o.iodepth, sizeof(struct io_u *));
+				sd->mrq = 1;
+			} else
+				log_info("fio: sg driver version %d lacks multiple "
+					 "requests support, sg_mrq ignored\n", version);
+		}
+
 		ret = fio_sgio_read_capacity(td, &bs, &max_lba);
 		if (ret) {
 			td_verror(td, td->error, "fio_sgio_read_capacity");
@@ -1428,7 +1712,8 @@ static struct ioengine_ops ioengine = {
 	.open_file	= fio_sgio_open,
 	.close_file	= fio_sgio_close,
 	.get_file_size	= fio_sgio_get_file_size,
-	.flags		= FIO_SYNCIO | FIO_RAWIO | FIO_RO_NEEDS_RW_OPEN,
+	.flags		= FIO_SYNCIO | FIO_RAWIO | FIO_RO_NEEDS_RW_OPEN |
+			  FIO_ENGINE_CLAT,
 	.options	= options,
 	.option_struct_size	= sizeof(struct sg_options)
 };
@@ -52,7 +52,8 @@ static struct fio_option options[] = {
  * The ->event() hook is called to match an event number with an io_u.
  * After the core has called ->getevents() and it has returned eg 3,
  * the ->event() hook must return the 3 events that have completed for
- * subsequent calls to ->event() with [0-2]. Required.
+ * subsequent calls to ->event() with [0-2]. Required, unless the engine
+ * has a ->reap_batch().
  */
 static struct io_u *fio_skeleton_event(struct thread_data *td, int event)
 {
@@ -63,7 +64,7 @@ static struct io_u *fio_skeleton_event(struct thread_data *td, int event)
  * The ->getevents() hook is used to reap completion events from an async
  * io engine. It returns the number of completed events since the last call,
  * which may then be retrieved by calling the ->event() hook with the event
- * numbers. Required.
+ * numbers. Required, unless the engine has a ->reap_batch().
  */
 static int fio_skeleton_getevents(struct thread_data *td, unsigned int min,
 				  unsigned int max, const struct timespec *t)
@@ -71,6 +72,18 @@ static int fio_skeleton_getevents(struct thread_data *td, unsigned int min,
 	return 0;
 }
 
+/*
+ * The ->reap_batch() hook can replace ->getevents() and ->event(). It
+ * stores up to max completed io_u's in the array passed in, waiting for at
+ * least min of them, and returns how many it stored. Not required.
+ */
+static int fio_skeleton_reap_batch(struct thread_data *td, struct io_u **io_us,
+				   unsigned int min, unsigned int max,
+				   const struct timespec *t)
+{
+	return 0;
+}
+
 /*
  * The ->cancel() hook attempts to cancel the io_u. Only relevant for
  * async io engines, and need not be supported.
@@ -107,6 +120,27 @@ static enum fio_q_status fio_skeleton_queue(struct thread_data *td,
 	return FIO_Q_COMPLETED;
 }
 
+/*
+ * The ->queue_batch() hook is handed the reads and writes queued since the
+ * last ->commit(), right before ->commit() is called, and must take all of
+ * them. Other io_u's still go through ->queue(). Needs ->commit(), not
+ * required.
+ */
+static void fio_skeleton_queue_batch(struct thread_data *td,
+				     struct io_u **io_us, unsigned int nr)
+{
+}
+
+/*
+ * The ->commit() hook submits the io_u's queued since the last call. Only
+ * needed by engines that return FIO_Q_QUEUED from ->queue() or have a
+ * ->queue_batch().
+ */
+static int fio_skeleton_commit(struct thread_data *td)
+{
+	return 0;
+}
+
 /*
  * The ->prep() function is called for each io_u prior to being submitted
  * with ->queue(). This hook allows the io engine to perform any
@@ -214,9 +248,12 @@ struct ioengine_ops ioengine = {
 	.init		= fio_skeleton_init,
 	.prep		= fio_skeleton_prep,
 	.queue		= fio_skeleton_queue,
+	.commit		= fio_skeleton_commit,
+	.queue_batch	= fio_skeleton_queue_batch,
 	.cancel		= fio_skeleton_cancel,
 	.getevents	= fio_skeleton_getevents,
 	.event		= fio_skeleton_event,
+	.reap_batch	= fio_skeleton_reap_batch,
 	.cleanup	= fio_skeleton_cleanup,
 	.open_file	= fio_skeleton_open,
 	.close_file	= fio_skeleton_close,
@@ -10,14 +10,87 @@
 #include <unistd.h>
 #include <errno.h>
 #include <poll.h>
+#include <fcntl.h>
 #include <sys/mman.h>
 
 #include "../fio.h"
+#include "../optgroup.h"
+
+#ifdef ARCH_HAVE_IOURING
+#include "../os/linux/io_uring.h"
+
+/*
+ * Tiny private ring, only used to issue a linked splice-to-pipe and
+ * read-from-pipe pair with a single system call.
+ */
+struct splice_ring {
+	int fd;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *mmap_ptr[3];
+	size_t mmap_len[3];
+};
+#endif
+
+struct spliceio_options {
+	void *pad;
+	unsigned int pipe_size;
+	unsigned int gift;
+	unsigned int uring;
+};
 
 struct spliceio_data {
 	int pipe[2];
 	int vmsplice_to_user;
 	int vmsplice_to_user_map;
+	unsigned int chunk;
+	int gift;
+#ifdef ARCH_HAVE_IOURING
+	struct splice_ring *ring;
+#endif
+};
+
+static struct fio_option options[] = {
+	{
+		.name	= "splice_pipe_size",
+		.lname	= "Splice pipe size",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct spliceio_options, pipe_size),
+		.help	= "Size the pipe to this many bytes (0 means max block size)",
+		.def	= "0",
+		.interval = 4096,
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "splice_gift",
+		.lname	= "Gift pages on vmsplice",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct spliceio_options, gift),
+		.help	= "Pass SPLICE_F_GIFT when vmsplicing write buffers",
+		.def	= "0",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "splice_uring",
+		.lname	= "Splice through io_uring",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct spliceio_options, uring),
+		.help	= "Issue read splices as linked io_uring requests",
+		.def	= "0",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= NULL,
+	},
 };
 
 /*
@@ -39,8 +112,8 @@ static int fio_splice_read_old(struct thread_data *td, struct io_u *io_u)
 	while (buflen) {
 		int this_len = buflen;
 
-		if (this_len > SPLICE_DEF_SIZE)
-			this_len = SPLICE_DEF_SIZE;
+		if (this_len > sd->chunk)
+			this_len = sd->chunk;
 
 		ret = splice(f->fd, &offset, sd->pipe[1], NULL, this_len, SPLICE_F_MORE);
 		if (ret < 0) {
@@ -100,8 +173,8 @@ static int fio_splice_read(struct thread_data *td, struct io_u *io_u)
 		int this_len = buflen;
 		int flags = 0;
 
-		if (this_len > SPLICE_DEF_SIZE) {
-			this_len = SPLICE_DEF_SIZE;
+		if (this_len > sd->chunk) {
+			this_len = sd->chunk;
 			flags = SPLICE_F_MORE;
 		}
 
@@ -160,6 +233,187 @@ static int fio_splice_read(struct thread_data *td, struct io_u *io_u)
 	return io_u->xfer_buflen;
 }
 
+#ifdef ARCH_HAVE_IOURING
+static void splice_ring_exit(struct splice_ring *r)
+{
+	int i;
+
+	for (i = 0; i < 3; i++)
+		if (r->mmap_ptr[i] && r->mmap_ptr[i] != MAP_FAILED)
+			munmap(r->mmap_ptr[i], r->mmap_len[i]);
+	close(r->fd);
+	free(r);
+}
+
+static struct splice_ring *splice_ring_init(void)
+{
+	struct io_uring_params p;
+	struct splice_ring *r;
+	void *ptr;
+
+	memset(&p, 0, sizeof(p));
+	r = calloc(1, sizeof(*r));
+	r->fd = syscall(__NR_io_uring_setup, 2, &p);
+	if (r->fd < 0) {
+		free(r);
+		return NULL;
+	}
+
+	r->mmap_len[0] = p.sq_off.array + p.sq_entries * sizeof(__u32);
+	ptr = mmap(0, r->mmap_len[0], PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	r->mmap_ptr[0] = ptr;
+	if (ptr == MAP_FAILED)
+		goto err;
+	r->sq_tail = ptr + p.sq_off.tail;
+	r->sq_mask = ptr + p.sq_off.ring_mask;
+	r->sq_array = ptr + p.sq_off.array;
+
+	r->mmap_len[1] = p.sq_entries * sizeof(struct io_uring_sqe);
+	ptr = mmap(0, r->mmap_len[1], PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	r->mmap_ptr[1] = ptr;
+	if (ptr == MAP_FAILED)
+		goto err;
+	r->sqes = ptr;
+
+	r->mmap_len[2] = p.cq_off.cqes +
+				p.cq_entries * sizeof(struct io_uring_cqe);
+	ptr = mmap(0, r->mmap_len[2], PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+	r->mmap_ptr[2] = ptr;
+	if (ptr == MAP_FAILED)
+		goto err;
+	r->cq_head = ptr + p.cq_off.head;
+	r->cq_tail = ptr + p.cq_off.tail;
+	r->cq_mask = ptr + p.cq_off.ring_mask;
+	r->cqes = ptr + p.cq_off.cqes;
+	return r;
+err:
+	splice_ring_exit(r);
+	return NULL;
+}
+
+static struct io_uring_sqe *splice_ring_sqe(struct splice_ring *r,
+					    unsigned int nr)
+{
+	unsigned int idx = (*r->sq_tail + nr) & *r->sq_mask;
+	struct io_uring_sqe *sqe = &r->sqes[idx];
+
+	r->sq_array[idx] = idx;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data = nr;
+	return sqe;
+}
+
+/*
+ * Submit the two prepared sqes and wait for both of them. res[] is indexed
+ * by sqe, the splice result in res[0] and the pipe read in res[1].
+ */
+static int splice_ring_submit(struct splice_ring *r, int *res)
+{
+	unsigned int head;
+	int ret, seen = 0;
+
+	atomic_store_release(r->sq_tail, *r->sq_tail + 2);
+
+	do {
+		ret = syscall(__NR_io_uring_enter, r->fd, 2, 2,
+				IORING_ENTER_GETEVENTS, NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return -errno;
+
+	head = *r->cq_head;
+	while (seen < 2) {
+		struct io_uring_cqe *cqe;
+
+		if (head == atomic_load_acquire(r->cq_tail)) {
+			ret = syscall(__NR_io_uring_enter, r->fd, 0, 2 - seen,
+					IORING_ENTER_GETEVENTS, NULL, 0);
+			if (ret < 0 && errno != EINTR)
+				return -errno;
+			continue;
+		}
+		cqe = &r->cqes[head & *r->cq_mask];
+		res[cqe->user_data & 1] = cqe->res;
+		head++;
+		seen++;
+	}
+	atomic_store_release(r->cq_head, head);
+	return 0;
+}
+
+/*
+ * Same transfer as fio_splice_read_old(), but the splice into the pipe
+ * and the read out of it are linked and issued with one io_uring_enter().
+ * A short splice breaks the link, in which case we pick up the remainder
+ * of the pipe with plain reads. Returns -EOPNOTSUPP if the kernel doesn't
+ * support IORING_OP_SPLICE, so the caller can fall back.
+ */
+static int fio_splice_read_uring(struct thread_data *td, struct io_u *io_u)
+{
+	struct spliceio_data *sd = td->io_ops_data;
+	struct fio_file *f = io_u->file;
+	unsigned long long offset = io_u->offset;
+	int ret, buflen = io_u->xfer_buflen;
+	char *p = io_u->xfer_buf;
+
+	while (buflen) {
+		struct io_uring_sqe *sqe;
+		int this_len = buflen;
+		int res[2];
+
+		if (this_len > sd->chunk)
+			this_len = sd->chunk;
+
+		sqe = splice_ring_sqe(sd->ring, 0);
+		sqe->opcode = IORING_OP_SPLICE;
+		sqe->flags = IOSQE_IO_LINK;
+		sqe->fd = sd->pipe[1];
+		sqe->off = -1ULL;
+		sqe->splice_fd_in = f->fd;
+		sqe->splice_off_in = offset;
+		sqe->len = this_len;
+
+		sqe = splice_ring_sqe(sd->ring, 1);
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = sd->pipe[0];
+		sqe->addr = (unsigned long) p;
+		sqe->len = this_len;
+
+		ret = splice_ring_submit(sd->ring, res);
+		if (ret < 0) {
+			td_verror(td, -ret, "io_uring_enter");
+			return ret;
+		}
+		if (res[0] < 0) {
+			if (res[0] == -EINVAL && offset == io_u->offset)
+				return -EOPNOTSUPP;
+			if (res[0] == -ENODATA || res[0] == -EAGAIN)
+				continue;
+			return res[0];
+		} else if (!res[0])
+			break;
+
+		ret = res[1] > 0 ? res[1] : 0;
+		while (ret < res[0]) {
+			int ret2 = read(sd->pipe[0], p + ret, res[0] - ret);
+
+			if (ret2 < 0)
+				return -errno;
+			ret += ret2;
+		}
+
+		offset += res[0];
+		buflen -= res[0];
+		p += res[0];
+	}
+
+	return io_u->xfer_buflen - buflen;
+}
+#endif
+
 /*
  * For splice writing, we can vmsplice our data buffer directly into a
  * pipe and then splice that to a file.
@@ -174,13 +428,22 @@ static int fio_splice_write(struct thread_data *td, struct io_u *io_u)
 	struct pollfd pfd = { .fd = sd->pipe[1], .events = POLLOUT, };
 	struct fio_file *f = io_u->file;
 	off_t off = io_u->offset;
+	unsigned int flags = SPLICE_F_NONBLOCK;
 	int ret, ret2;
 
+	/*
+	 * Gifting is only allowed for whole, page aligned pages. Let the
+	 * kernel move them into the file if it can.
+	 */
+	if (sd->gift &&
+	    !(((uintptr_t) iov.iov_base | iov.iov_len) & (page_size - 1)))
+		flags |= SPLICE_F_GIFT;
+
 	while (iov.iov_len) {
 		if (poll(&pfd, 1, -1) < 0)
 			return errno;
 
-		ret = vmsplice(sd->pipe[1], &iov, 1, SPLICE_F_NONBLOCK);
+		ret = vmsplice(sd->pipe[1], &iov, 1, flags);
 		if (ret < 0)
 			return -errno;
 
@@ -188,7 +451,8 @@ static int fio_splice_write(struct thread_data *td, struct io_u *io_u)
 		iov.iov_base += ret;
 
 		while (ret) {
-			ret2 = splice(sd->pipe[0], NULL, f->fd, &off, ret, 0);
+			ret2 = splice(sd->pipe[0], NULL, f->fd, &off, ret,
+					(flags & SPLICE_F_GIFT) ? SPLICE_F_MOVE : 0);
 			if (ret2 < 0)
 				return -errno;
 
@@ -208,6 +472,20 @@ static enum fio_q_status fio_spliceio_queue(struct thread_data *td,
 	fio_ro_check(td, io_u);
 
 	if (io_u->ddir == DDIR_READ) {
+#ifdef ARCH_HAVE_IOURING
+		if (sd->ring) {
+			ret = fio_splice_read_uring(td, io_u);
+			/*
+			 * No IORING_OP_SPLICE on this kernel, drop the ring
+			 * and use the system call paths from now on.
+			 */
+			if (ret == -EOPNOTSUPP) {
+				splice_ring_exit(sd->ring);
+				sd->ring = NULL;
+			} else
+				goto done;
+		}
+#endif
 		if (sd->vmsplice_to_user) {
 			ret = fio_splice_read(td, io_u);
 			/*
@@ -227,6 +505,9 @@ static enum fio_q_status fio_spliceio_queue(struct thread_data *td,
 	else
 		ret = do_io_u_sync(td, io_u);
 
+#ifdef ARCH_HAVE_IOURING
+done:
+#endif
 	if (ret != (int) io_u->xfer_buflen) {
 		if (ret >= 0) {
 			io_u->resid = io_u->xfer_buflen - ret;
@@ -251,6 +532,10 @@ static void fio_spliceio_cleanup(struct thread_data *td)
 	struct spliceio_data *sd = td->io_ops_data;
 
 	if (sd) {
+#ifdef ARCH_HAVE_IOURING
+		if (sd->ring)
+			splice_ring_exit(sd->ring);
+#endif
 		close(sd->pipe[0]);
 		close(sd->pipe[1]);
 		free(sd);
@@ -259,7 +544,9 @@ static void fio_spliceio_cleanup(struct thread_data *td)
 
 static int fio_spliceio_init(struct thread_data *td)
 {
-	struct spliceio_data *sd = malloc(sizeof(*sd));
+	struct spliceio_options *o = td->eo;
+	struct spliceio_data *sd = calloc(1, sizeof(*sd));
+	unsigned int size;
 
 	if (pipe(sd->pipe) < 0) {
 		td_verror(td, errno, "pipe");
@@ -267,6 +554,38 @@ static int fio_spliceio_init(struct thread_data *td)
 		return 1;
 	}
 
+	/*
+	 * The pipe pair is shared by all io_us of this job. Size it so that
+	 * a whole block moves in a single splice, rather than in default
+	 * sized 64KiB chunks.
+	 */
+	sd->chunk = SPLICE_DEF_SIZE;
+	size = o->pipe_size ? o->pipe_size : td_max_bs(td);
+#ifdef F_SETPIPE_SZ
+	if (size > SPLICE_DEF_SIZE) {
+		int ret = fcntl(sd->pipe[1], F_SETPIPE_SZ, size);
+
+		if (ret < 0)
+			log_info("fio: failed to set pipe size to %u (%s), "
+				 "see /proc/sys/fs/pipe-max-size\n", size,
+				 strerror(errno));
+		else
+			sd->chunk = ret;
+	}
+#endif
+	sd->gift = o->gift;
+
+	if (o->uring) {
+#ifdef ARCH_HAVE_IOURING
+		sd->ring = splice_ring_init();
+		if (!sd->ring)
+			log_info("fio: io_uring setup failed (%s), using "
+				 "splice system calls\n", strerror(errno));
+#else
+		log_info("fio: splice_uring not supported on this platform\n");
+#endif
+	}
+
 	/*
 	 * Assume this work, we'll reset this if it doesn't
 	 */
@@ -292,6 +611,8 @@ static struct ioengine_ops ioengine = {
 	.close_file	= generic_close_file,
 	.get_file_size	= generic_get_file_size,
 	.flags		= FIO_SYNCIO | FIO_PIPEIO,
+	.options	= options,
+	.option_struct_size	= sizeof(struct spliceio_options),
 };
 
 static void fio_init fio_spliceio_register(void)
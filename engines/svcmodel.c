@@ -0,0 +1,172 @@
+/*
+ * Synthetic device model, see svcmodel.h
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "../fio.h"
+#include "svcmodel.h"
+
+static uint64_t svc_model_sample(struct svc_model *m, unsigned int q)
+{
+	uint64_t mean = m->mean[q];
+
+	switch (m->dist) {
+	case SVC_DIST_UNIFORM:
+		return rand_between(&m->rand, 0, 2 * mean);
+	case SVC_DIST_EXPONENTIAL:
+		return -log(1.0 - __rand_0_1(&m->rand)) * mean;
+	default:
+		return mean;
+	}
+}
+
+static void svc_heap_push(struct svc_model *m, uint64_t done, void *data)
+{
+	unsigned int i = m->nr_heap++;
+
+	while (i) {
+		unsigned int parent = (i - 1) / 2;
+
+		if (m->heap[parent].done <= done)
+			break;
+		m->heap[i] = m->heap[parent];
+		i = parent;
+	}
+	m->heap[i].done = done;
+	m->heap[i].data = data;
+}
+
+static void *svc_heap_pop(struct svc_model *m)
+{
+	void *data = m->heap[0].data;
+	struct svc_req last = m->heap[--m->nr_heap];
+	unsigned int i = 0, child;
+
+	while ((child = 2 * i + 1) < m->nr_heap) {
+		if (child + 1 < m->nr_heap &&
+		    m->heap[child + 1].done < m->heap[child].done)
+			child++;
+		if (last.done <= m->heap[child].done)
+			break;
+		m->heap[i] = m->heap[child];
+		i = child;
+	}
+	m->heap[i] = last;
+	return data;
+}
+
+/*
+ * Start a request of 'bytes' on the server of queue q that frees up first.
+ * At most 'depth' requests are in flight.
+ */
+void svc_model_queue(struct svc_model *m, unsigned int q, uint64_t bytes,
+		     void *data)
+{
+	uint64_t *srv = &m->busy_until[q * m->parallel];
+	uint64_t now = svc_model_now(m), start, done;
+	unsigned int j, best = 0;
+
+	for (j = 1; j < m->parallel; j++)
+		if (srv[j] < srv[best])
+			best = j;
+
+	start = srv[best] > now ? srv[best] : now;
+	srv[best] = done = start + svc_model_sample(m, q);
+
+	if (m->bw) {
+		start = m->xfer_until[q] > now ? m->xfer_until[q] : now;
+		m->xfer_until[q] = start + bytes * 1000000000ULL / m->bw;
+		if (m->xfer_until[q] > done)
+			done = m->xfer_until[q];
+	}
+
+	svc_heap_push(m, done, data);
+}
+
+/*
+ * Return a request that is done by 'now', or NULL if there is none
+ */
+void *svc_model_reap(struct svc_model *m, uint64_t now)
+{
+	if (!m->nr_heap || m->heap[0].done > now)
+		return NULL;
+
+	return svc_heap_pop(m);
+}
+
+/*
+ * Wait a bit towards the next completion: sleep off long waits, spin the
+ * last stretch
+ */
+void svc_model_wait(struct svc_model *m, uint64_t now)
+{
+	if (!m->nr_heap || m->heap[0].done <= now)
+		return;
+
+	if (m->heap[0].done - now > 100000)
+		usleep((m->heap[0].done - now - 50000) / 1000);
+	else
+		nop;
+}
+
+void svc_model_free(struct svc_model *m)
+{
+	if (!m)
+		return;
+
+	free(m->mean);
+	free(m->busy_until);
+	free(m->xfer_until);
+	free(m->heap);
+	free(m);
+}
+
+/*
+ * service_time is the mean service time in usec, colon separated per queue.
+ * Queues cycle through the given means if there are fewer of those.
+ */
+struct svc_model *svc_model_init(const char *service_time, unsigned int dist,
+				 unsigned int nr_queues, unsigned int parallel,
+				 uint64_t bw, unsigned int depth)
+{
+	struct svc_model *m;
+	char *str, *p, *tok;
+	unsigned int i, nr_means = 0;
+
+	m = calloc(1, sizeof(*m));
+	if (!m)
+		return NULL;
+
+	m->dist = dist;
+	m->nr_queues = nr_queues;
+	m->parallel = parallel;
+	m->bw = bw;
+
+	m->mean = calloc(nr_queues, sizeof(uint64_t));
+	m->busy_until = calloc(nr_queues * parallel, sizeof(uint64_t));
+	m->xfer_until = calloc(nr_queues, sizeof(uint64_t));
+	m->heap = calloc(depth, sizeof(struct svc_req));
+	if (!m->mean || !m->busy_until || !m->xfer_until || !m->heap)
+		goto err;
+
+	p = str = strdup(service_time);
+	while ((tok = strsep(&p, ":")) != NULL && nr_means < nr_queues) {
+		if (*tok)
+			m->mean[nr_means++] = strtoull(tok, NULL, 10) * 1000;
+	}
+	free(str);
+	if (!nr_means)
+		goto err;
+	for (i = nr_means; i < nr_queues; i++)
+		m->mean[i] = m->mean[i % nr_means];
+
+	init_rand(&m->rand, false);
+	fio_gettime(&m->start, NULL);
+	return m;
+err:
+	svc_model_free(m);
+	return NULL;
+}
@@ -0,0 +1,58 @@
+#ifndef FIO_SVCMODEL_H
+#define FIO_SVCMODEL_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "../lib/rand.h"
+#include "../time.h"
+
+/*
+ * Synthetic device model shared by the null engine and the ublk server.
+ * Requests go to one of nr_queues queues. Each queue serves up to parallel
+ * of them at once, every request taking a service time drawn from that
+ * queue's distribution, so completions come back out of order the way
+ * they do from a real multi-queue device. With a bandwidth set, the data
+ * of a queue's requests also goes through that queue one request after
+ * the other at that rate, and a request is done once both are.
+ */
+enum {
+	SVC_DIST_FIXED = 0,
+	SVC_DIST_UNIFORM,
+	SVC_DIST_EXPONENTIAL,
+};
+
+struct svc_req {
+	uint64_t done;			/* nsec since model start */
+	void *data;
+};
+
+struct svc_model {
+	struct timespec start;
+	struct frand_state rand;
+	unsigned int dist;
+	unsigned int nr_queues;
+	unsigned int parallel;
+	uint64_t bw;			/* bytes/sec per queue, 0 for no limit */
+	uint64_t *mean;			/* per queue, nsec */
+	uint64_t *busy_until;		/* per server, nr_queues * parallel */
+	uint64_t *xfer_until;		/* per queue */
+	struct svc_req *heap;		/* in flight, min-heap on done */
+	unsigned int nr_heap;
+};
+
+extern struct svc_model *svc_model_init(const char *, unsigned int,
+					unsigned int, unsigned int, uint64_t,
+					unsigned int);
+extern void svc_model_free(struct svc_model *);
+extern void svc_model_queue(struct svc_model *, unsigned int, uint64_t,
+			    void *);
+extern void *svc_model_reap(struct svc_model *, uint64_t);
+extern void svc_model_wait(struct svc_model *, uint64_t);
+
+static inline uint64_t svc_model_now(struct svc_model *m)
+{
+	return ntime_since_now(&m->start);
+}
+
+#endif
@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <limits.h>
 #include <sys/uio.h>
 #include <errno.h>
 
@@ -41,6 +42,9 @@ struct psyncv2_options {
 	unsigned int hipri_percentage;
 	unsigned int uncached;
 	unsigned int nowait;
+	unsigned int dsync;
+	unsigned int append;
+	unsigned int vectored;
 };
 
 static struct fio_option options[] = {
@@ -83,6 +87,34 @@ static struct fio_option options[] = {
 		.category = FIO_OPT_C_ENGINE,
 		.group	= FIO_OPT_G_INVALID,
 	},
+	{
+		.name	= "dsync",
+		.lname	= "RWF_DSYNC",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct psyncv2_options, dsync),
+		.help	= "Set RWF_DSYNC for pwritev2",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "append",
+		.lname	= "RWF_APPEND",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct psyncv2_options, append),
+		.help	= "Set RWF_APPEND for pwritev2",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "vectored",
+		.lname	= "Vectored batching",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct psyncv2_options, vectored),
+		.help	= "Coalesce adjacent I/O into one preadv2/pwritev2",
+		.def	= "0",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_INVALID,
+	},
 	{
 		.name	= NULL,
 	},
@@ -133,20 +165,20 @@ static int fio_io_end(struct thread_data *td, struct io_u *io_u, int ret)
 static enum fio_q_status fio_pvsyncio_queue(struct thread_data *td,
 					    struct io_u *io_u)
 {
-	struct syncio_data *sd = td->io_ops_data;
-	struct iovec *iov = &sd->iovecs[0];
+	struct iovec iov = {
+		.iov_base	= io_u->xfer_buf,
+		.iov_len	= io_u->xfer_buflen,
+	};
 	struct fio_file *f = io_u->file;
 	int ret;
 
 	fio_ro_check(td, io_u);
 
-	iov->iov_base = io_u->xfer_buf;
-	iov->iov_len = io_u->xfer_buflen;
-
+	/* iovec on the stack, sync_workers may run this concurrently */
 	if (io_u->ddir == DDIR_READ)
-		ret = preadv(f->fd, iov, 1, io_u->offset);
+		ret = preadv(f->fd, &iov, 1, io_u->offset);
 	else if (io_u->ddir == DDIR_WRITE)
-		ret = pwritev(f->fd, iov, 1, io_u->offset);
+		ret = pwritev(f->fd, &iov, 1, io_u->offset);
 	else if (io_u->ddir == DDIR_TRIM) {
 		do_io_u_trim(td, io_u);
 		return FIO_Q_COMPLETED;
@@ -158,16 +190,11 @@ static enum fio_q_status fio_pvsyncio_queue(struct thread_data *td,
 #endif
 
 #ifdef FIO_HAVE_PWRITEV2
-static enum fio_q_status fio_pvsyncio2_queue(struct thread_data *td,
-					     struct io_u *io_u)
+static int fio_pvsyncio2_flags(struct thread_data *td, enum fio_ddir ddir)
 {
 	struct syncio_data *sd = td->io_ops_data;
 	struct psyncv2_options *o = td->eo;
-	struct iovec *iov = &sd->iovecs[0];
-	struct fio_file *f = io_u->file;
-	int ret, flags = 0;
-
-	fio_ro_check(td, io_u);
+	int flags = 0;
 
 	if (o->hipri &&
 	    (rand_between(&sd->rand_state, 1, 100) <= o->hipri_percentage))
@@ -176,14 +203,61 @@ static enum fio_q_status fio_pvsyncio2_queue(struct thread_data *td,
 		flags |= RWF_UNCACHED;
 	if (o->nowait)
 		flags |= RWF_NOWAIT;
+	if (ddir == DDIR_WRITE) {
+		if (o->dsync)
+			flags |= RWF_DSYNC;
+		if (o->append)
+			flags |= RWF_APPEND;
+		if (td->o.oatomic)
+			flags |= RWF_ATOMIC;
+	}
+
+	return flags;
+}
+
+static ssize_t fio_pvsyncio2_rw(struct fio_file *f, enum fio_ddir ddir,
+				const struct iovec *iov, int nr, off_t offset,
+				int flags)
+{
+	if (ddir == DDIR_READ)
+		return preadv2(f->fd, iov, nr, offset, flags);
+
+	return pwritev2(f->fd, iov, nr, offset, flags);
+}
+
+static enum fio_q_status fio_vsyncio_queue(struct thread_data *td,
+					   struct io_u *io_u);
+
+static enum fio_q_status fio_pvsyncio2_queue(struct thread_data *td,
+					     struct io_u *io_u)
+{
+	struct syncio_data *sd = td->io_ops_data;
+	struct psyncv2_options *o = td->eo;
+	struct iovec *iov = &sd->iovecs[0];
+	struct fio_file *f = io_u->file;
+	int ret;
+
+	/* an atomic write can't be merged with others, it goes on its own */
+	if (o->vectored) {
+		if (io_u->ddir != DDIR_TRIM &&
+		    !(io_u->ddir == DDIR_WRITE && td->o.oatomic))
+			return fio_vsyncio_queue(td, io_u);
+		if (sd->queued)
+			return FIO_Q_BUSY;
+	}
+
+	fio_ro_check(td, io_u);
+
+	/* td_io_queue() leaves this to engines that have a ->commit hook */
+	io_u_mark_submit(td, 1);
+	io_u_mark_complete(td, 1);
 
 	iov->iov_base = io_u->xfer_buf;
 	iov->iov_len = io_u->xfer_buflen;
 
-	if (io_u->ddir == DDIR_READ)
-		ret = preadv2(f->fd, iov, 1, io_u->offset, flags);
-	else if (io_u->ddir == DDIR_WRITE)
-		ret = pwritev2(f->fd, iov, 1, io_u->offset, flags);
+	if (io_u->ddir == DDIR_READ || io_u->ddir == DDIR_WRITE)
+		ret = fio_pvsyncio2_rw(f, io_u->ddir, iov, 1, io_u->offset,
+				       fio_pvsyncio2_flags(td, io_u->ddir));
 	else if (io_u->ddir == DDIR_TRIM) {
 		do_io_u_trim(td, io_u);
 		return FIO_Q_COMPLETED;
@@ -312,7 +386,7 @@ static enum fio_q_status fio_vsyncio_queue(struct thread_data *td,
 		sd->queued_bytes = 0;
 		fio_vsyncio_set_iov(sd, io_u, 0);
 	} else {
-		if (sd->queued == td->o.iodepth) {
+		if (sd->queued == td->o.iodepth || sd->queued == IOV_MAX) {
 			dprint(FD_IO, "vsyncio_queue: max depth %d\n", sd->queued);
 			return FIO_Q_BUSY;
 		}
@@ -398,6 +472,85 @@ static int fio_vsyncio_commit(struct thread_data *td)
 	return fio_vsyncio_end(td, ret);
 }
 
+#ifdef FIO_HAVE_PWRITEV2
+/*
+ * A vectored RWF_NOWAIT call that would block fails with EAGAIN, or stops
+ * short. Rather than failing the io_us, redo what is left of each one as
+ * its own blocking call, much like a database punting to a worker thread.
+ */
+static int fio_pvsyncio2_fallback(struct thread_data *td, ssize_t bytes,
+				  int flags)
+{
+	struct syncio_data *sd = td->io_ops_data;
+	struct iovec iov;
+	unsigned int i;
+	ssize_t ret;
+
+	dprint(FD_IO, "pvsyncio2: nowait fallback after %zd of %lu bytes\n",
+		bytes, sd->queued_bytes);
+
+	if (bytes < 0)
+		bytes = 0;
+	flags &= ~RWF_NOWAIT;
+
+	for (i = 0; i < sd->queued; i++) {
+		struct io_u *io_u = sd->io_us[i];
+		unsigned long long done = io_u->xfer_buflen;
+
+		if (bytes < done)
+			done = bytes;
+		bytes -= done;
+
+		io_u->error = 0;
+		io_u->resid = 0;
+		if (done == io_u->xfer_buflen)
+			continue;
+
+		iov.iov_base = io_u->xfer_buf + done;
+		iov.iov_len = io_u->xfer_buflen - done;
+		ret = fio_pvsyncio2_rw(io_u->file, io_u->ddir, &iov, 1,
+				       io_u->offset + done, flags);
+		if (ret < 0)
+			io_u->error = errno;
+		else
+			io_u->resid = iov.iov_len - ret;
+	}
+
+	return 0;
+}
+
+static int fio_pvsyncio2_commit(struct thread_data *td)
+{
+	struct syncio_data *sd = td->io_ops_data;
+	struct io_u *io_u;
+	ssize_t ret;
+	int flags;
+
+	if (!sd->queued)
+		return 0;
+
+	io_u_mark_submit(td, sd->queued);
+	io_u = sd->io_us[0];
+	flags = fio_pvsyncio2_flags(td, sd->last_ddir);
+
+	ret = fio_pvsyncio2_rw(sd->last_file, sd->last_ddir, sd->iovecs,
+			       sd->queued, io_u->offset, flags);
+
+	dprint(FD_IO, "pvsyncio2_commit: %u io_us, %d\n", sd->queued, (int) ret);
+	sd->events = sd->queued;
+
+	if ((flags & RWF_NOWAIT) &&
+	    ((ret < 0 && errno == EAGAIN) ||
+	     (ret >= 0 && ret < sd->queued_bytes)))
+		ret = fio_pvsyncio2_fallback(td, ret, flags);
+	else
+		ret = fio_vsyncio_end(td, ret);
+
+	sd->queued = 0;
+	return ret;
+}
+#endif
+
 static int fio_vsyncio_init(struct thread_data *td)
 {
 	struct syncio_data *sd;
@@ -432,7 +585,8 @@ static struct ioengine_ops ioengine_rw = {
 	.open_file	= generic_open_file,
 	.close_file	= generic_close_file,
 	.get_file_size	= generic_get_file_size,
-	.flags		= FIO_SYNCIO,
+	.flags		= FIO_SYNCIO | FIO_MULTI_RANGE_TRIM |
+			  FIO_TRIM_MODES,
 };
 
 static struct ioengine_ops ioengine_prw = {
@@ -442,7 +596,8 @@ static struct ioengine_ops ioengine_prw = {
 	.open_file	= generic_open_file,
 	.close_file	= generic_close_file,
 	.get_file_size	= generic_get_file_size,
-	.flags		= FIO_SYNCIO,
+	.flags		= FIO_SYNCIO | FIO_MULTI_RANGE_TRIM |
+			  FIO_TRIM_MODES,
 };
 
 static struct ioengine_ops ioengine_vrw = {
@@ -457,7 +612,8 @@ static struct ioengine_ops ioengine_vrw = {
 	.open_file	= generic_open_file,
 	.close_file	= generic_close_file,
 	.get_file_size	= generic_get_file_size,
-	.flags		= FIO_SYNCIO,
+	.flags		= FIO_SYNCIO | FIO_MULTI_RANGE_TRIM |
+			  FIO_TRIM_MODES,
 };
 
 #ifdef CONFIG_PWRITEV
@@ -470,7 +626,8 @@ static struct ioengine_ops ioengine_pvrw = {
 	.open_file	= generic_open_file,
 	.close_file	= generic_close_file,
 	.get_file_size	= generic_get_file_size,
-	.flags		= FIO_SYNCIO,
+	.flags		= FIO_SYNCIO | FIO_MULTI_RANGE_TRIM |
+			  FIO_TRIM_MODES,
 };
 #endif
 
@@ -481,10 +638,14 @@ static struct ioengine_ops ioengine_pvrw2 = {
 	.init		= fio_vsyncio_init,
 	.cleanup	= fio_vsyncio_cleanup,
 	.queue		= fio_pvsyncio2_queue,
+	.commit		= fio_pvsyncio2_commit,
+	.event		= fio_vsyncio_event,
+	.getevents	= fio_vsyncio_getevents,
 	.open_file	= generic_open_file,
 	.close_file	= generic_close_file,
 	.get_file_size	= generic_get_file_size,
-	.flags		= FIO_SYNCIO,
+	.flags		= FIO_SYNCIO | FIO_MULTI_RANGE_TRIM |
+			  FIO_TRIM_MODES | FIO_ATOMICWRITES,
 	.options	= options,
 	.option_struct_size	= sizeof(struct psyncv2_options),
 };
@@ -0,0 +1,797 @@
+/*
+ * ublk engine
+ *
+ * Turns the job into a ublk server: it creates /dev/ublkbN and serves its
+ * requests from the synthetic device model of the null engine, so other
+ * jobs can benchmark the whole userspace block path, kernel block layer
+ * and ublk driver included, against a target of known latency and
+ * throughput. Every device queue is served by its own thread over its
+ * own io_uring of ublk commands.
+ *
+ * The job doesn't do any IO itself. The device lives from the start of
+ * the job until the other jobs are done (exit_on_io_done) or the job's
+ * runtime is up, so jobs driving the device should wait for it with
+ * startdelay and be run with create_serialize=0.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/time_types.h>
+#include <linux/ublk_cmd.h>
+
+#include "../fio.h"
+#include "../optgroup.h"
+
+#ifdef ARCH_HAVE_IOURING
+
+#include "../os/linux/io_uring.h"
+#include "svcmodel.h"
+
+#define UBLK_MAX_IO		(512 * 1024)
+#define UBLK_CTRL_DEV		"/dev/ublk-control"
+
+struct ublk_options {
+	void *pad;
+	int dev_id;
+	unsigned int nr_queues;
+	char *service_time;
+	unsigned int service_dist;
+	unsigned int queue_parallel;
+	unsigned long long service_bw;
+	unsigned int service_compress;
+	unsigned int exit_io_done;
+};
+
+static struct fio_option options[] = {
+	{
+		.name	= "ublk_dev_id",
+		.lname	= "ublk device id",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct ublk_options, dev_id),
+		.help	= "Id N of the /dev/ublkbN to create, -1 for any free one",
+		.def	= "-1",
+		.minval	= -1,
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "nr_queues",
+		.lname	= "Number of queues",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct ublk_options, nr_queues),
+		.help	= "Number of device queues, each served by a thread",
+		.def	= "1",
+		.minval	= 1,
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "service_time",
+		.lname	= "Service time",
+		.type	= FIO_OPT_STR_STORE,
+		.off1	= offsetof(struct ublk_options, service_time),
+		.help	= "Mean service time in usec, colon separated per queue",
+		.def	= "0",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "service_dist",
+		.lname	= "Service time distribution",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct ublk_options, service_dist),
+		.help	= "Distribution of the service times",
+		.def	= "fixed",
+		.posval = {
+			  { .ival = "fixed",
+			    .oval = SVC_DIST_FIXED,
+			    .help = "Always the mean",
+			  },
+			  { .ival = "uniform",
+			    .oval = SVC_DIST_UNIFORM,
+			    .help = "Uniform between 0 and twice the mean",
+			  },
+			  { .ival = "exponential",
+			    .oval = SVC_DIST_EXPONENTIAL,
+			    .help = "Exponential with the given mean",
+			  },
+		},
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "queue_parallel",
+		.lname	= "Per queue parallelism",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct ublk_options, queue_parallel),
+		.help	= "Requests each queue serves at once, 0 for its depth",
+		.def	= "0",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "service_bw",
+		.lname	= "Service bandwidth",
+		.type	= FIO_OPT_STR_VAL,
+		.off1	= offsetof(struct ublk_options, service_bw),
+		.help	= "Bytes/sec each queue transfers, 0 for no limit",
+		.def	= "0",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "service_compress",
+		.lname	= "Service compression",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct ublk_options, service_compress),
+		.help	= "Percentage written data shrinks by before service_bw",
+		.def	= "0",
+		.minval	= 0,
+		.maxval	= 99,
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "exit_on_io_done",
+		.lname	= "Exit when IO threads are done",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct ublk_options, exit_io_done),
+		.help	= "Remove the device when the IO jobs finish",
+		.def	= "1",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= NULL,
+	},
+};
+
+/*
+ * Just enough of an io_uring for ublk commands, which need 128 byte SQEs.
+ * A ring never has more commands in flight than it has SQEs.
+ */
+struct ublk_ring {
+	int fd;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_array;
+	unsigned sq_mask;
+	unsigned sq_local_tail;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+	struct io_uring_sqe *sqes;
+	void *mmap_ptr[3];
+	size_t mmap_len[3];
+	unsigned to_submit;
+};
+
+struct ublk_data;
+
+struct ublk_queue {
+	struct ublk_data *ud;
+	unsigned int q;
+	struct ublk_ring ring;
+	struct ublksrv_io_desc *iods;
+	size_t iods_len;
+	char *bufs;
+	int *results;
+	struct svc_model *svc;
+	pthread_t thread;
+	bool started;
+	int error;
+
+	uint64_t ops[DDIR_RWDIR_CNT];
+	uint64_t bytes[DDIR_RWDIR_CNT];
+};
+
+struct ublk_data {
+	int ctrl_fd;
+	int cdev_fd;
+	struct ublk_ring ctrl_ring;
+	struct ublksrv_ctrl_dev_info info;
+	bool added;
+	bool started;
+	unsigned int depth;
+	unsigned int compress;
+	struct ublk_queue *queues;
+};
+
+static void ublk_ring_exit(struct ublk_ring *r)
+{
+	int i;
+
+	for (i = 0; i < 3; i++)
+		if (r->mmap_ptr[i] && r->mmap_ptr[i] != MAP_FAILED)
+			munmap(r->mmap_ptr[i], r->mmap_len[i]);
+	if (r->fd >= 0)
+		close(r->fd);
+	r->fd = -1;
+}
+
+static int ublk_ring_init(struct ublk_ring *r, unsigned int entries)
+{
+	struct io_uring_params p;
+	void *ptr;
+
+	memset(r, 0, sizeof(*r));
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_SQE128;
+
+	r->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (r->fd < 0)
+		return -errno;
+
+	r->mmap_len[0] = p.sq_off.array + p.sq_entries * sizeof(__u32);
+	ptr = mmap(0, r->mmap_len[0], PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	r->mmap_ptr[0] = ptr;
+	if (ptr == MAP_FAILED)
+		goto err;
+	r->sq_head = ptr + p.sq_off.head;
+	r->sq_tail = ptr + p.sq_off.tail;
+	r->sq_array = ptr + p.sq_off.array;
+	r->sq_mask = *(unsigned *) (ptr + p.sq_off.ring_mask);
+	r->sq_local_tail = *r->sq_tail;
+
+	r->mmap_len[1] = 2 * p.sq_entries * sizeof(struct io_uring_sqe);
+	ptr = mmap(0, r->mmap_len[1], PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	r->mmap_ptr[1] = ptr;
+	if (ptr == MAP_FAILED)
+		goto err;
+	r->sqes = ptr;
+
+	r->mmap_len[2] = p.cq_off.cqes +
+				p.cq_entries * sizeof(struct io_uring_cqe);
+	ptr = mmap(0, r->mmap_len[2], PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+	r->mmap_ptr[2] = ptr;
+	if (ptr == MAP_FAILED)
+		goto err;
+	r->cq_head = ptr + p.cq_off.head;
+	r->cq_tail = ptr + p.cq_off.tail;
+	r->cq_mask = *(unsigned *) (ptr + p.cq_off.ring_mask);
+	r->cqes = ptr + p.cq_off.cqes;
+	return 0;
+err:
+	ublk_ring_exit(r);
+	return -ENOMEM;
+}
+
+/*
+ * Queue a uring command on fd. Its 80 byte payload follows the SQE header.
+ */
+static void *ublk_ring_cmd(struct ublk_ring *r, int fd, unsigned int op,
+			   uint64_t user_data)
+{
+	unsigned idx = r->sq_local_tail++ & r->sq_mask;
+	struct io_uring_sqe *sqe = (void *) r->sqes + 2 * idx * sizeof(*sqe);
+
+	memset(sqe, 0, 2 * sizeof(*sqe));
+	sqe->opcode = IORING_OP_URING_CMD;
+	sqe->fd = fd;
+	sqe->cmd_op = op;
+	sqe->user_data = user_data;
+	r->sq_array[idx] = idx;
+	r->to_submit++;
+	return sqe->cmd;
+}
+
+/*
+ * Submit what's queued and wait for min_complete completions, or until
+ * 'wait_ns' passes if that isn't 0
+ */
+static int ublk_ring_enter(struct ublk_ring *r, unsigned int min_complete,
+			   uint64_t wait_ns)
+{
+	struct io_uring_getevents_arg arg = { };
+	struct __kernel_timespec ts;
+	unsigned int flags = 0;
+	void *argp = NULL;
+	int ret;
+
+	atomic_store_release(r->sq_tail, r->sq_local_tail);
+
+	if (min_complete)
+		flags |= IORING_ENTER_GETEVENTS;
+	if (min_complete && wait_ns) {
+		ts.tv_sec = wait_ns / 1000000000ULL;
+		ts.tv_nsec = wait_ns % 1000000000ULL;
+		arg.ts = (uintptr_t) &ts;
+		argp = &arg;
+		flags |= IORING_ENTER_EXT_ARG;
+	}
+
+	ret = syscall(__NR_io_uring_enter, r->fd, r->to_submit, min_complete,
+			flags, argp, argp ? sizeof(arg) : 0);
+	if (ret < 0) {
+		ret = -errno;
+		if (ret == -ETIME || ret == -EINTR)
+			ret = 0;
+		return ret;
+	}
+
+	r->to_submit -= ret;
+	return 0;
+}
+
+static struct io_uring_cqe *ublk_ring_peek(struct ublk_ring *r)
+{
+	unsigned head = *r->cq_head;
+
+	if (head == atomic_load_acquire(r->cq_tail))
+		return NULL;
+
+	return &r->cqes[head & r->cq_mask];
+}
+
+static void ublk_ring_advance(struct ublk_ring *r)
+{
+	atomic_store_release(r->cq_head, *r->cq_head + 1);
+}
+
+/*
+ * Run a control command to completion
+ */
+static int ublk_ctrl_cmd(struct ublk_data *ud, unsigned int op, void *buf,
+			 unsigned int len, uint64_t data)
+{
+	struct ublksrv_ctrl_cmd *cmd;
+	struct io_uring_cqe *cqe;
+	int ret;
+
+	cmd = ublk_ring_cmd(&ud->ctrl_ring, ud->ctrl_fd, op, op);
+	cmd->dev_id = ud->info.dev_id;
+	cmd->queue_id = -1;
+	cmd->addr = (uintptr_t) buf;
+	cmd->len = len;
+	cmd->data[0] = data;
+
+	do {
+		ret = ublk_ring_enter(&ud->ctrl_ring, 1, 0);
+		if (ret)
+			return ret;
+	} while (!(cqe = ublk_ring_peek(&ud->ctrl_ring)));
+
+	ret = cqe->res;
+	ublk_ring_advance(&ud->ctrl_ring);
+	return ret;
+}
+
+static void ublk_fetch(struct ublk_queue *uq, unsigned int op,
+		       unsigned int tag, int result)
+{
+	struct ublksrv_io_cmd *cmd;
+
+	cmd = ublk_ring_cmd(&uq->ring, uq->ud->cdev_fd, op, tag);
+	cmd->q_id = uq->q;
+	cmd->tag = tag;
+	cmd->result = result;
+	cmd->addr = (uintptr_t) (uq->bufs + (size_t) tag * UBLK_MAX_IO);
+}
+
+/*
+ * Hand a request that just arrived to the model. Compressed writes only
+ * move the bytes left after compression through the queue.
+ */
+static void ublk_serve(struct ublk_queue *uq, unsigned int tag)
+{
+	const struct ublksrv_io_desc *iod = &uq->iods[tag];
+	uint64_t bytes = (uint64_t) iod->nr_sectors << 9, xfer = 0;
+	enum fio_ddir ddir;
+
+	switch (ublksrv_get_op(iod)) {
+	case UBLK_IO_OP_READ:
+		ddir = DDIR_READ;
+		xfer = bytes;
+		break;
+	case UBLK_IO_OP_WRITE:
+		ddir = DDIR_WRITE;
+		xfer = bytes * (100 - uq->ud->compress) / 100;
+		break;
+	case UBLK_IO_OP_DISCARD:
+	case UBLK_IO_OP_WRITE_ZEROES:
+		ddir = DDIR_TRIM;
+		break;
+	default:
+		ddir = DDIR_INVAL;
+		bytes = 0;
+		break;
+	}
+
+	if (ddir != DDIR_INVAL) {
+		uq->ops[ddir]++;
+		uq->bytes[ddir] += bytes;
+	}
+
+	uq->results[tag] = ddir_rw(ddir) ? bytes : 0;
+	svc_model_queue(uq->svc, uq->q, xfer, (void *) (uintptr_t) (tag + 1));
+}
+
+/*
+ * Every tag has one command in flight, fetching the next request or
+ * committing the last one and fetching the next. The queue is done once
+ * all of them came back aborted by the device stopping.
+ */
+static void *ublk_queue_thread(void *data)
+{
+	struct ublk_queue *uq = data;
+	unsigned int depth = uq->ud->depth, aborted = 0, tag;
+	struct io_uring_cqe *cqe;
+	uint64_t now, wait;
+	void *done;
+
+	for (tag = 0; tag < depth; tag++)
+		ublk_fetch(uq, UBLK_IO_FETCH_REQ, tag, -1);
+
+	while (aborted < depth) {
+		now = svc_model_now(uq->svc);
+		while ((done = svc_model_reap(uq->svc, now)) != NULL) {
+			tag = (uintptr_t) done - 1;
+			ublk_fetch(uq, UBLK_IO_COMMIT_AND_FETCH_REQ, tag,
+				   uq->results[tag]);
+		}
+
+		wait = 0;
+		if (uq->svc->nr_heap)
+			wait = uq->svc->heap[0].done - now;
+
+		uq->error = ublk_ring_enter(&uq->ring, 1, wait);
+		if (uq->error)
+			break;
+
+		while ((cqe = ublk_ring_peek(&uq->ring)) != NULL) {
+			tag = cqe->user_data;
+			if (cqe->res == UBLK_IO_RES_OK)
+				ublk_serve(uq, tag);
+			else
+				aborted++;
+			ublk_ring_advance(&uq->ring);
+		}
+	}
+
+	return NULL;
+}
+
+static int ublk_queue_init(struct thread_data *td, struct ublk_queue *uq)
+{
+	struct ublk_options *o = td->eo;
+	struct ublk_data *ud = uq->ud;
+	size_t mask = page_size - 1, max_iods;
+	off_t off;
+	int ret;
+
+	ret = ublk_ring_init(&uq->ring, ud->depth);
+	if (ret) {
+		td_verror(td, -ret, "io_uring_setup");
+		return 1;
+	}
+
+	/* Each queue's descriptors start on the page after the last's max */
+	max_iods = (UBLK_MAX_QUEUE_DEPTH * sizeof(struct ublksrv_io_desc) +
+			mask) & ~mask;
+	off = UBLKSRV_CMD_BUF_OFFSET + (off_t) uq->q * max_iods;
+	uq->iods_len = (ud->depth * sizeof(struct ublksrv_io_desc) + mask) &
+			~mask;
+	uq->iods = mmap(0, uq->iods_len, PROT_READ, MAP_SHARED | MAP_POPULATE,
+			ud->cdev_fd, off);
+	if (uq->iods == MAP_FAILED) {
+		uq->iods = NULL;
+		td_verror(td, errno, "mmap");
+		return 1;
+	}
+
+	if (posix_memalign((void **) &uq->bufs, page_size,
+			   (size_t) ud->depth * UBLK_MAX_IO)) {
+		td_verror(td, ENOMEM, "posix_memalign");
+		return 1;
+	}
+	memset(uq->bufs, 0, (size_t) ud->depth * UBLK_MAX_IO);
+
+	uq->results = calloc(ud->depth, sizeof(int));
+	uq->svc = svc_model_init(o->service_time, o->service_dist,
+				 o->nr_queues,
+				 o->queue_parallel ? : ud->depth,
+				 o->service_bw, ud->depth);
+	if (!uq->results || !uq->svc) {
+		log_err("ublk: bad service_time or out of memory\n");
+		td_verror(td, EINVAL, "ublk_queue_init");
+		return 1;
+	}
+
+	return 0;
+}
+
+static void ublk_report(struct thread_data *td, struct ublk_data *ud)
+{
+	uint64_t ops[DDIR_RWDIR_CNT] = { }, bytes[DDIR_RWDIR_CNT] = { };
+	unsigned int i;
+
+	for (i = 0; i < ud->info.nr_hw_queues; i++) {
+		for_each_rw_ddir(ddir) {
+			ops[ddir] += ud->queues[i].ops[ddir];
+			bytes[ddir] += ud->queues[i].bytes[ddir];
+		}
+	}
+
+	log_info("%s (ublk): /dev/ublkb%u served", td->o.name,
+		 ud->info.dev_id);
+	for_each_rw_ddir(ddir)
+		log_info(" %s=%llu ops/%llu bytes", io_ddir_name(ddir),
+			 (unsigned long long) ops[ddir],
+			 (unsigned long long) bytes[ddir]);
+	log_info("\n");
+}
+
+static void fio_ublk_cleanup(struct thread_data *td)
+{
+	struct ublk_data *ud = td->io_ops_data;
+	unsigned int i;
+
+	if (!ud)
+		return;
+
+	if (ud->started)
+		ublk_ctrl_cmd(ud, UBLK_CMD_STOP_DEV, NULL, 0, 0);
+
+	for (i = 0; ud->queues && i < ud->info.nr_hw_queues; i++) {
+		struct ublk_queue *uq = &ud->queues[i];
+
+		if (uq->started) {
+			pthread_join(uq->thread, NULL);
+			if (uq->error)
+				log_err("ublk: queue %u: %s\n", i,
+					strerror(-uq->error));
+		}
+	}
+
+	if (ud->started)
+		ublk_report(td, ud);
+
+	for (i = 0; ud->queues && i < ud->info.nr_hw_queues; i++) {
+		struct ublk_queue *uq = &ud->queues[i];
+
+		if (uq->iods)
+			munmap(uq->iods, uq->iods_len);
+		ublk_ring_exit(&uq->ring);
+		svc_model_free(uq->svc);
+		free(uq->results);
+		free(uq->bufs);
+	}
+	free(ud->queues);
+
+	if (ud->cdev_fd >= 0)
+		close(ud->cdev_fd);
+	if (ud->added)
+		ublk_ctrl_cmd(ud, UBLK_CMD_DEL_DEV, NULL, 0, 0);
+	ublk_ring_exit(&ud->ctrl_ring);
+	if (ud->ctrl_fd >= 0)
+		close(ud->ctrl_fd);
+
+	free(ud);
+	td->io_ops_data = NULL;
+}
+
+/*
+ * The char device shows up once udev got to it
+ */
+static int ublk_open_cdev(struct ublk_data *ud)
+{
+	char name[32];
+	int i;
+
+	snprintf(name, sizeof(name), "/dev/ublkc%u", ud->info.dev_id);
+	for (i = 0; i < 100; i++) {
+		ud->cdev_fd = open(name, O_RDWR);
+		if (ud->cdev_fd >= 0 || errno != ENOENT)
+			break;
+		usleep(10000);
+	}
+
+	return ud->cdev_fd < 0 ? errno : 0;
+}
+
+static int ublk_add_dev(struct thread_data *td, struct ublk_data *ud)
+{
+	struct ublk_options *o = td->eo;
+	struct ublk_params params = { };
+	int ret;
+
+	ud->info.nr_hw_queues = o->nr_queues;
+	ud->info.queue_depth = ud->depth;
+	ud->info.max_io_buf_bytes = UBLK_MAX_IO;
+	ud->info.dev_id = o->dev_id;
+	ud->info.ublksrv_pid = getpid();
+
+	ret = ublk_ctrl_cmd(ud, UBLK_CMD_ADD_DEV, &ud->info, sizeof(ud->info),
+			    0);
+	if (ret < 0) {
+		td_verror(td, -ret, "UBLK_CMD_ADD_DEV");
+		return 1;
+	}
+	ud->added = true;
+
+	params.len = sizeof(params);
+	params.types = UBLK_PARAM_TYPE_BASIC;
+	params.basic.logical_bs_shift = 9;
+	params.basic.physical_bs_shift = 12;
+	params.basic.io_opt_shift = 12;
+	params.basic.io_min_shift = 9;
+	params.basic.max_sectors = UBLK_MAX_IO >> 9;
+	params.basic.dev_sectors = td->o.size >> 9;
+
+	ret = ublk_ctrl_cmd(ud, UBLK_CMD_SET_PARAMS, &params, sizeof(params),
+			    0);
+	if (ret < 0) {
+		td_verror(td, -ret, "UBLK_CMD_SET_PARAMS");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int fio_ublk_init(struct thread_data *td)
+{
+	struct ublk_options *o = td->eo;
+	struct ublk_data *ud;
+	unsigned int i;
+	int ret;
+
+	if (!td->o.size) {
+		log_err("ublk: size= is needed for the size of the device\n");
+		td_verror(td, EINVAL, "fio_ublk_init");
+		return 1;
+	}
+	if (td->o.iodepth > UBLK_MAX_QUEUE_DEPTH) {
+		log_err("ublk: iodepth is the device queue depth, at most %u\n",
+			UBLK_MAX_QUEUE_DEPTH);
+		td_verror(td, EINVAL, "fio_ublk_init");
+		return 1;
+	}
+
+	td->o.nr_files = td->o.open_files = 1;
+
+	ud = calloc(1, sizeof(*ud));
+	if (!ud) {
+		td_verror(td, ENOMEM, "fio_ublk_init");
+		return 1;
+	}
+	ud->cdev_fd = -1;
+	ud->ctrl_ring.fd = -1;
+	ud->depth = td->o.iodepth;
+	ud->compress = o->service_compress;
+	td->io_ops_data = ud;
+
+	ud->ctrl_fd = open(UBLK_CTRL_DEV, O_RDWR);
+	if (ud->ctrl_fd < 0) {
+		td_verror(td, errno, "open " UBLK_CTRL_DEV);
+		goto err;
+	}
+
+	ret = ublk_ring_init(&ud->ctrl_ring, 4);
+	if (ret) {
+		td_verror(td, -ret, "io_uring_setup");
+		goto err;
+	}
+
+	if (ublk_add_dev(td, ud))
+		goto err;
+
+	ret = ublk_open_cdev(ud);
+	if (ret) {
+		td_verror(td, ret, "open ublk char device");
+		goto err;
+	}
+
+	ud->queues = calloc(o->nr_queues, sizeof(struct ublk_queue));
+	if (!ud->queues) {
+		td_verror(td, ENOMEM, "fio_ublk_init");
+		goto err;
+	}
+
+	for (i = 0; i < o->nr_queues; i++) {
+		struct ublk_queue *uq = &ud->queues[i];
+
+		uq->ud = ud;
+		uq->q = i;
+		uq->ring.fd = -1;
+	}
+
+	for (i = 0; i < o->nr_queues; i++)
+		if (ublk_queue_init(td, &ud->queues[i]))
+			goto err;
+
+	for (i = 0; i < o->nr_queues; i++) {
+		struct ublk_queue *uq = &ud->queues[i];
+
+		ret = pthread_create(&uq->thread, NULL, ublk_queue_thread, uq);
+		if (ret) {
+			td_verror(td, ret, "pthread_create");
+			goto err;
+		}
+		uq->started = true;
+	}
+
+	/* Returns once every queue fetched all its tags */
+	ret = ublk_ctrl_cmd(ud, UBLK_CMD_START_DEV, NULL, 0, getpid());
+	if (ret < 0) {
+		td_verror(td, -ret, "UBLK_CMD_START_DEV");
+		goto err;
+	}
+	ud->started = true;
+
+	log_info("%s (ublk): serving /dev/ublkb%u, %u queue(s) of depth %u\n",
+		 td->o.name, ud->info.dev_id, o->nr_queues, ud->depth);
+	return 0;
+err:
+	/* Queues that fetched are only aborted by stopping the device */
+	for (i = 0; ud->queues && i < o->nr_queues; i++)
+		ud->started |= ud->queues[i].started;
+	fio_ublk_cleanup(td);
+	return 1;
+}
+
+static enum fio_q_status fio_ublk_queue(struct thread_data *td,
+					struct io_u fio_unused *io_u)
+{
+	struct ublk_options *o = td->eo;
+
+	if (o->exit_io_done && !fio_running_or_pending_io_threads()) {
+		td->done = 1;
+		return FIO_Q_BUSY;
+	}
+
+	usleep(10000);
+	return FIO_Q_COMPLETED;
+}
+
+static int fio_ublk_open(struct thread_data fio_unused *td,
+			 struct fio_file fio_unused *f)
+{
+	return 0;
+}
+
+static struct ioengine_ops ioengine = {
+	.name			= "ublk",
+	.version		= FIO_IOOPS_VERSION,
+	.init			= fio_ublk_init,
+	.queue			= fio_ublk_queue,
+	.cleanup		= fio_ublk_cleanup,
+	.open_file		= fio_ublk_open,
+	.flags			= FIO_SYNCIO | FIO_DISKLESSIO | FIO_NOIO,
+	.options		= options,
+	.option_struct_size	= sizeof(struct ublk_options),
+};
+
+#else /* ARCH_HAVE_IOURING */
+
+static int fio_ublk_init(struct thread_data fio_unused *td)
+{
+	log_err("fio: ublk engine needs io_uring support on this arch\n");
+	return 1;
+}
+
+static struct ioengine_ops ioengine = {
+	.name		= "ublk",
+	.version	= FIO_IOOPS_VERSION,
+	.init		= fio_ublk_init,
+};
+
+#endif /* ARCH_HAVE_IOURING */
+
+static void fio_init fio_ublk_register(void)
+{
+	register_ioengine(&ioengine);
+}
+
+static void fio_exit fio_ublk_unregister(void)
+{
+	unregister_ioengine(&ioengine);
+}
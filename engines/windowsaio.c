@@ -25,6 +25,7 @@ struct fio_overlapped {
 
 struct windowsaio_data {
 	struct io_u **aio_events;
+	OVERLAPPED_ENTRY *entries;
 	HANDLE iocp;
 	HANDLE iothread;
 	HANDLE iocomplete_event;
@@ -39,8 +40,17 @@ struct thread_ctx {
 struct windowsaio_options {
 	struct thread_data *td;
 	unsigned int no_completion_thread;
+	unsigned int completion_thread;
+	unsigned int lock_buffers;
 };
 
+/*
+ * Marks a file whose handle has FILE_SKIP_COMPLETION_PORT_ON_SUCCESS set:
+ * IO on it that completes synchronously queues no completion packet, so
+ * it must be completed from ->queue.
+ */
+#define FIO_WINAIO_SKIP_PORT	((void *) 1)
+
 static struct fio_option options[] = {
 	{
 		.name	= "no_completion_thread",
@@ -51,6 +61,24 @@ static struct fio_option options[] = {
 		.category = FIO_OPT_C_ENGINE,
 		.group	= FIO_OPT_G_WINDOWSAIO,
 	},
+	{
+		.name	= "completion_thread",
+		.lname	= "Completion polling thread",
+		.type	= FIO_OPT_STR_SET,
+		.off1	= offsetof(struct windowsaio_options, completion_thread),
+		.help	= "Reap completions from a separate polling thread",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_WINDOWSAIO,
+	},
+	{
+		.name	= "lock_buffers",
+		.lname	= "Lock IO buffers",
+		.type	= FIO_OPT_STR_SET,
+		.off1	= offsetof(struct windowsaio_options, lock_buffers),
+		.help	= "Lock the IO buffers into the working set",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_WINDOWSAIO,
+	},
 	{
 		.name	= NULL,
 	},
@@ -58,6 +86,13 @@ static struct fio_option options[] = {
 
 static DWORD WINAPI IoCompletionRoutine(LPVOID lpParameter);
 
+static bool use_completion_thread(struct thread_data *td)
+{
+	struct windowsaio_options *o = td->eo;
+
+	return o->completion_thread && !o->no_completion_thread;
+}
+
 static int fio_windowsaio_init(struct thread_data *td)
 {
 	struct windowsaio_data *wd;
@@ -77,6 +112,14 @@ static int fio_windowsaio_init(struct thread_data *td)
 		}
 	}
 
+	if (!rc) {
+		wd->entries = malloc(td->o.iodepth * sizeof(OVERLAPPED_ENTRY));
+		if (wd->entries == NULL) {
+			log_err("windowsaio: failed to allocate memory for completion entries\n");
+			rc = 1;
+		}
+	}
+
 	if (!rc) {
 		/* Create an auto-reset event */
 		wd->iocomplete_event = CreateEvent(NULL, FALSE, FALSE, NULL);
@@ -88,8 +131,8 @@ static int fio_windowsaio_init(struct thread_data *td)
 
 	if (rc) {
 		if (wd != NULL) {
-			if (wd->aio_events != NULL)
-				free(wd->aio_events);
+			free(wd->aio_events);
+			free(wd->entries);
 
 			free(wd);
 		}
@@ -101,7 +144,6 @@ static int fio_windowsaio_init(struct thread_data *td)
 		struct thread_ctx *ctx;
 		struct windowsaio_data *wd;
 		HANDLE hFile;
-		struct windowsaio_options *o = td->eo;
 
 		hFile = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
 		if (hFile == INVALID_HANDLE_VALUE) {
@@ -113,7 +155,7 @@ static int fio_windowsaio_init(struct thread_data *td)
 		wd->iothread_running = TRUE;
 		wd->iocp = hFile;
 
-		if (o->no_completion_thread == 0) {
+		if (use_completion_thread(td)) {
 			if (!rc)
 				ctx = malloc(sizeof(struct thread_ctx));
 
@@ -149,13 +191,17 @@ static void fio_windowsaio_cleanup(struct thread_data *td)
 	wd = td->io_ops_data;
 
 	if (wd != NULL) {
-		wd->iothread_running = FALSE;
-		WaitForSingleObject(wd->iothread, INFINITE);
+		if (wd->iothread) {
+			wd->iothread_running = FALSE;
+			WaitForSingleObject(wd->iothread, INFINITE);
+			CloseHandle(wd->iothread);
+		} else
+			CloseHandle(wd->iocp);
 
-		CloseHandle(wd->iothread);
 		CloseHandle(wd->iocomplete_event);
 
 		free(wd->aio_events);
+		free(wd->entries);
 		free(wd);
 
 		td->io_ops_data = NULL;
@@ -284,6 +330,22 @@ static int fio_windowsaio_open_file(struct thread_data *td, struct fio_file *f)
 		}
 	}
 
+	/*
+	 * Reaping from ->getevents, IO that completes synchronously can be
+	 * completed from ->queue without a round trip through the port. Not
+	 * all file systems allow this, so it is kept per file.
+	 */
+	FILE_SET_ENG_DATA(f, NULL);
+	if (!rc && td->io_ops_data != NULL && !use_completion_thread(td)) {
+		if (SetFileCompletionNotificationModes(f->hFile,
+				FILE_SKIP_COMPLETION_PORT_ON_SUCCESS |
+				FILE_SKIP_SET_EVENT_ON_HANDLE))
+			FILE_SET_ENG_DATA(f, FIO_WINAIO_SKIP_PORT);
+		else
+			dprint(FD_FILE, "windowsaio: %s: no skip on success: %lu\n",
+				f->file_name, GetLastError());
+	}
+
 	return rc;
 }
 
@@ -301,6 +363,7 @@ static int fio_windowsaio_close_file(struct thread_data fio_unused *td, struct f
 	}
 
 	f->hFile = INVALID_HANDLE_VALUE;
+	FILE_SET_ENG_DATA(f, NULL);
 	return rc;
 }
 
@@ -325,7 +388,10 @@ static struct io_u* fio_windowsaio_event(struct thread_data *td, int event)
 	return wd->aio_events[event];
 }
 
-/* dequeue completion entrees directly (no separate completion thread) */
+/*
+ * Dequeue completions directly (no separate completion thread), as many
+ * as are ready and wanted with each GetQueuedCompletionStatusEx call
+ */
 static int fio_windowsaio_getevents_nothread(struct thread_data *td, unsigned int min,
 				    unsigned int max, const struct timespec *t)
 {
@@ -344,36 +410,39 @@ static int fio_windowsaio_getevents_nothread(struct thread_data *td, unsigned in
 	}
 
 	do {
-		BOOL ret;
 		OVERLAPPED *ovl;
-
-		ULONG entries = min(16, max-dequeued);
-		OVERLAPPED_ENTRY oe[16];
-		ret = GetQueuedCompletionStatusEx(wd->iocp, oe, 16, &entries, mswait, 0);
-		if (ret && entries) {
-			int entry_num;
-
-			for (entry_num=0; entry_num<entries; entry_num++) {
-				ovl = oe[entry_num].lpOverlapped;
-				fov = CONTAINING_RECORD(ovl, struct fio_overlapped, o);
-				io_u = fov->io_u;
-
-				if (ovl->Internal == ERROR_SUCCESS) {
-					io_u->resid = io_u->xfer_buflen - ovl->InternalHigh;
-					io_u->error = 0;
-				} else {
-					io_u->resid = io_u->xfer_buflen;
-					io_u->error = win_to_posix_error(GetLastError());
-				}
-
-				fov->io_complete = FALSE;
-				wd->aio_events[dequeued] = io_u;
-				dequeued++;
+		ULONG entries = 0;
+		ULONG i;
+		DWORD bytes;
+
+		/* don't block once min is met, just take what is ready */
+		if (!GetQueuedCompletionStatusEx(wd->iocp, wd->entries,
+						 max - dequeued, &entries,
+						 dequeued >= min ? 0 : mswait,
+						 FALSE))
+			entries = 0;
+
+		for (i = 0; i < entries; i++) {
+			ovl = wd->entries[i].lpOverlapped;
+			fov = CONTAINING_RECORD(ovl, struct fio_overlapped, o);
+			io_u = fov->io_u;
+
+			if (GetOverlappedResult(io_u->file->hFile, ovl, &bytes,
+						FALSE)) {
+				io_u->resid = io_u->xfer_buflen - bytes;
+				io_u->error = 0;
+			} else {
+				io_u->resid = io_u->xfer_buflen;
+				io_u->error = win_to_posix_error(GetLastError());
 			}
+
+			fov->io_complete = FALSE;
+			wd->aio_events[dequeued] = io_u;
+			dequeued++;
 		}
 
-		if (dequeued >= min ||
-			(t != NULL && timeout_expired(start_count, end_count)))
+		if (dequeued >= max || (dequeued >= min && !entries) ||
+		    (t != NULL && timeout_expired(start_count, end_count)))
 			break;
 	} while (1);
 	return dequeued;
@@ -432,11 +501,9 @@ static int fio_windowaio_getevents_thread(struct thread_data *td, unsigned int m
 static int fio_windowsaio_getevents(struct thread_data *td, unsigned int min,
 				    unsigned int max, const struct timespec *t)
 {
-	struct windowsaio_options *o = td->eo;
-
-	if (o->no_completion_thread)
-		return fio_windowsaio_getevents_nothread(td, min, max, t);
-	return fio_windowaio_getevents_thread(td, min, max, t);
+	if (use_completion_thread(td))
+		return fio_windowaio_getevents_thread(td, min, max, t);
+	return fio_windowsaio_getevents_nothread(td, min, max, t);
 }
 
 static enum fio_q_status fio_windowsaio_queue(struct thread_data *td,
@@ -483,7 +550,10 @@ static enum fio_q_status fio_windowsaio_queue(struct thread_data *td,
 		break;
 	}
 
-	if (success || GetLastError() == ERROR_IO_PENDING)
+	if (success && FILE_ENG_DATA(io_u->file) == FIO_WINAIO_SKIP_PORT) {
+		io_u->resid = io_u->xfer_buflen - lpOvl->InternalHigh;
+		io_u->error = 0;
+	} else if (success || GetLastError() == ERROR_IO_PENDING)
 		rc = FIO_Q_QUEUED;
 	else {
 		io_u->error = win_to_posix_error(GetLastError());
@@ -535,6 +605,26 @@ static DWORD WINAPI IoCompletionRoutine(LPVOID lpParameter)
 	return 0;
 }
 
+/*
+ * Files can't be registered with the kernel the way Registered I/O does
+ * for sockets, the nearest is to keep the buffers resident so the memory
+ * manager never has to page them back in before locking them for an IO
+ */
+static int fio_windowsaio_post_init(struct thread_data *td)
+{
+	struct windowsaio_options *o = td->eo;
+
+	if (!o->lock_buffers || !td->orig_buffer)
+		return 0;
+
+	if (mlock(td->orig_buffer, td->orig_buffer_size)) {
+		td_verror(td, errno, "windowsaio: lock_buffers");
+		return 1;
+	}
+
+	return 0;
+}
+
 static void fio_windowsaio_io_u_free(struct thread_data *td, struct io_u *io_u)
 {
 	struct fio_overlapped *o = io_u->engine_data;
@@ -561,6 +651,7 @@ static struct ioengine_ops ioengine = {
 	.name		= "windowsaio",
 	.version	= FIO_IOOPS_VERSION,
 	.init		= fio_windowsaio_init,
+	.post_init	= fio_windowsaio_post_init,
 	.queue		= fio_windowsaio_queue,
 	.getevents	= fio_windowsaio_getevents,
 	.event		= fio_windowsaio_event,
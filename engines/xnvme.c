@@ -62,11 +62,18 @@ struct xnvme_fioe_data {
 
 	struct iovec *iovec;
 
-	uint8_t _pad[8];
+	/* io_us queued by queue() and not yet submitted, for batch_submit */
+	struct io_u **pending;
+	uint32_t npending;
+
+	/* Set when fio-allocated buffers were registered via xnvme_mem_map() */
+	uint32_t mem_mapped;
+
+	uint8_t _pad[56];
 
 	struct xnvme_fioe_fwrap files[];
 };
-XNVME_STATIC_ASSERT(sizeof(struct xnvme_fioe_data) == 64, "Incorrect size")
+XNVME_STATIC_ASSERT(sizeof(struct xnvme_fioe_data) == 128, "Incorrect size")
 
 struct xnvme_fioe_options {
 	void *padding;
@@ -74,6 +81,7 @@ struct xnvme_fioe_options {
 	unsigned int sqpoll_thread;
 	unsigned int xnvme_dev_nsid;
 	unsigned int xnvme_iovec;
+	unsigned int xnvme_batch_submit;
 	char *xnvme_be;
 	char *xnvme_mem;
 	char *xnvme_async;
@@ -174,6 +182,15 @@ static struct fio_option options[] = {
 		.category = FIO_OPT_C_ENGINE,
 		.group = FIO_OPT_G_XNVME,
 	},
+	{
+		.name = "xnvme_batch_submit",
+		.lname = "Batched submission",
+		.type = FIO_OPT_STR_SET,
+		.off1 = offsetof(struct xnvme_fioe_options, xnvme_batch_submit),
+		.help = "Defer submission of queued IOs to commit()",
+		.category = FIO_OPT_C_ENGINE,
+		.group = FIO_OPT_G_XNVME,
+	},
 
 	{
 		.name = NULL,
@@ -241,6 +258,9 @@ static void xnvme_fioe_cleanup(struct thread_data *td)
 		log_err("ioeng->cleanup(): pthread_mutex_lock(), err(%d)\n", err);
 		/* NOTE: not returning here */
 
+	if (xd->mem_mapped && xd->nallocated)
+		xnvme_mem_unmap(xd->files[0].dev, td->orig_buffer);
+
 	for (uint64_t i = 0; i < xd->nallocated; ++i)
 		_dev_close(td, &xd->files[i]);
 
@@ -252,6 +272,7 @@ static void xnvme_fioe_cleanup(struct thread_data *td)
 
 	free(xd->iocq);
 	free(xd->iovec);
+	free(xd->pending);
 	free(xd);
 	td->io_ops_data = NULL;
 }
@@ -358,6 +379,15 @@ static int xnvme_fioe_init(struct thread_data *td)
 		return 1;
 	}
 
+	xd->pending = calloc(td->o.iodepth, sizeof(struct io_u *));
+	if (!xd->pending) {
+		free(xd->iovec);
+		free(xd->iocq);
+		free(xd);
+		log_err("ioeng->init(): !calloc(xd->pending), err(%d)\n", errno);
+		return 1;
+	}
+
 	xd->prev = -1;
 	td->io_ops_data = xd;
 
@@ -383,6 +413,32 @@ static int xnvme_fioe_init(struct thread_data *td)
 	return 0;
 }
 
+/*
+ * When the user picked a fio memory type instead of the xNVMe allocator, map
+ * the io_u arena for the device once, so the backend (e.g. SPDK) can DMA
+ * straight into it.
+ *
+ * NOTE: using the first device for the mapping, as for the buffer-allocators
+ */
+static int xnvme_fioe_post_init(struct thread_data *td)
+{
+	struct xnvme_fioe_data *xd = td->io_ops_data;
+	struct xnvme_fioe_fwrap *fwrap = &xd->files[0];
+	int err;
+
+	if (!fio_option_is_set(&td->o, mem_type) || !td->orig_buffer)
+		return 0;
+
+	err = xnvme_mem_map(fwrap->dev, td->orig_buffer, td->orig_buffer_size);
+	if (err) {
+		log_err("ioeng->post_init(): xnvme_mem_map(), err(%d)\n", err);
+		return 1;
+	}
+	xd->mem_mapped = 1;
+
+	return 0;
+}
+
 /* NOTE: using the first device for buffer-allocators) */
 static int xnvme_fioe_iomem_alloc(struct thread_data *td, size_t total_mem)
 {
@@ -441,6 +497,8 @@ static struct io_u *xnvme_fioe_event(struct thread_data *td, int event)
 	return xd->iocq[event];
 }
 
+static int xnvme_fioe_submit_pending(struct thread_data *td);
+
 static int xnvme_fioe_getevents(struct thread_data *td, unsigned int min, unsigned int max,
 				const struct timespec *t)
 {
@@ -456,6 +514,9 @@ static int xnvme_fioe_getevents(struct thread_data *td, unsigned int min, unsign
 
 	xd->completed = 0;
 	for (;;) {
+		if (xd->npending && xnvme_fioe_submit_pending(td) < 0)
+			return 0;
+
 		if (fwrap == NULL || xd->cur == nfiles) {
 			fwrap = &xd->files[0];
 			xd->cur = 0;
@@ -499,7 +560,7 @@ static int xnvme_fioe_getevents(struct thread_data *td, unsigned int min, unsign
 	return xd->completed;
 }
 
-static enum fio_q_status xnvme_fioe_queue(struct thread_data *td, struct io_u *io_u)
+static enum fio_q_status _submit(struct thread_data *td, struct io_u *io_u)
 {
 	struct xnvme_fioe_data *xd = td->io_ops_data;
 	struct xnvme_fioe_fwrap *fwrap;
@@ -510,8 +571,6 @@ static enum fio_q_status xnvme_fioe_queue(struct thread_data *td, struct io_u *i
 	int err;
 	bool vectored_io = ((struct xnvme_fioe_options *)td->eo)->xnvme_iovec;
 
-	fio_ro_check(td, io_u);
-
 	fwrap = &xd->files[io_u->file->fileno];
 	nsid = xnvme_dev_get_nsid(fwrap->dev);
 
@@ -572,6 +631,77 @@ static enum fio_q_status xnvme_fioe_queue(struct thread_data *td, struct io_u *i
 	}
 }
 
+/*
+ * Submit the io_us deferred by queue() back-to-back. Stops early when the
+ * queue is full, leaving the remainder pending for the next commit() or
+ * getevents(). Returns the number submitted or -errno.
+ */
+static int xnvme_fioe_submit_pending(struct thread_data *td)
+{
+	struct xnvme_fioe_data *xd = td->io_ops_data;
+	uint32_t i;
+
+	for (i = 0; i < xd->npending; i++) {
+		struct io_u *io_u = xd->pending[i];
+
+		if (_submit(td, io_u) == FIO_Q_BUSY)
+			break;
+		if (io_u->error) {
+			td_verror(td, io_u->error, "xnvme_submit");
+			return -io_u->error;
+		}
+	}
+
+	if (i)
+		io_u_mark_submit(td, i);
+
+	xd->npending -= i;
+	if (xd->npending)
+		memmove(xd->pending, xd->pending + i, xd->npending * sizeof(struct io_u *));
+
+	return i;
+}
+
+static enum fio_q_status xnvme_fioe_queue(struct thread_data *td, struct io_u *io_u)
+{
+	struct xnvme_fioe_data *xd = td->io_ops_data;
+	struct xnvme_fioe_options *o = td->eo;
+	enum fio_q_status ret;
+
+	fio_ro_check(td, io_u);
+
+	if (o->xnvme_batch_submit) {
+		if (xd->npending == td->o.iodepth)
+			return FIO_Q_BUSY;
+
+		xd->pending[xd->npending++] = io_u;
+		return FIO_Q_QUEUED;
+	}
+
+	ret = _submit(td, io_u);
+	if (ret == FIO_Q_QUEUED) {
+		io_u_mark_submit(td, 1);
+	} else if (ret == FIO_Q_COMPLETED) {
+		io_u_mark_submit(td, 1);
+		io_u_mark_complete(td, 1);
+	}
+
+	return ret;
+}
+
+static int xnvme_fioe_commit(struct thread_data *td)
+{
+	struct xnvme_fioe_data *xd = td->io_ops_data;
+	int ret;
+
+	if (!xd->npending)
+		return 0;
+
+	ret = xnvme_fioe_submit_pending(td);
+
+	return ret < 0 ? ret : 0;
+}
+
 static int xnvme_fioe_close(struct thread_data *td, struct fio_file *f)
 {
 	struct xnvme_fioe_data *xd = td->io_ops_data;
@@ -987,10 +1117,12 @@ FIO_STATIC struct ioengine_ops ioengine = {
 	.version = FIO_IOOPS_VERSION,
 	.options = options,
 	.option_struct_size = sizeof(struct xnvme_fioe_options),
-	.flags = FIO_DISKLESSIO | FIO_NODISKUTIL | FIO_NOEXTEND | FIO_MEMALIGN | FIO_RAWIO,
+	.flags = FIO_DISKLESSIO | FIO_NODISKUTIL | FIO_NOEXTEND | FIO_MEMALIGN | FIO_RAWIO |
+		 FIO_SKIPPABLE_IOMEM_ALLOC,
 
 	.cleanup = xnvme_fioe_cleanup,
 	.init = xnvme_fioe_init,
+	.post_init = xnvme_fioe_post_init,
 
 	.iomem_free = xnvme_fioe_iomem_free,
 	.iomem_alloc = xnvme_fioe_iomem_alloc,
@@ -1001,6 +1133,7 @@ FIO_STATIC struct ioengine_ops ioengine = {
 	.event = xnvme_fioe_event,
 	.getevents = xnvme_fioe_getevents,
 	.queue = xnvme_fioe_queue,
+	.commit = xnvme_fioe_commit,
 
 	.close_file = xnvme_fioe_close,
 	.open_file = xnvme_fioe_open,
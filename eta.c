@@ -12,10 +12,48 @@
 
 #include "fio.h"
 #include "lib/pow2.h"
+#include "lib/memalign.h"
 
 static char __run_str[REAL_MAX_JOBS + 1];
 static char run_str[__THREAD_RUNSTR_SZ(REAL_MAX_JOBS) + 1];
 
+/*
+ * What the status pass needs from the options of a job, gathered once per
+ * run. A pass then reads one entry and a few live fields of each job,
+ * rather than chasing options spread all over its thread_data.
+ */
+struct eta_job {
+	unsigned int gen;
+	bool stonewall;
+	bool time_based;
+	bool pow2;
+	unsigned int unified_rw_rep;
+	unsigned int unit_base;
+	unsigned int sig_figs;
+	unsigned long long bw_avg_time;
+
+	/* rate options of the data directions the job does */
+	uint64_t t_rate[DDIR_RWDIR_CNT];
+	uint64_t m_rate[DDIR_RWDIR_CNT];
+	uint32_t t_iops[DDIR_RWDIR_CNT];
+	uint32_t m_iops[DDIR_RWDIR_CNT];
+	uint64_t rate_bytes;
+
+	uint64_t timeout;
+	uint64_t start_delay;
+	uint64_t ramp_time;
+
+	/* bytes_total is only recalculated when these change */
+	uint64_t total_io_size;
+	uint64_t fill_device_size;
+	uint64_t bytes_total;
+	bool bytes_unknown;
+} __fio_cacheline_aligned;
+
+static struct eta_job *eta_jobs;
+static unsigned int eta_jobs_nr;
+static unsigned int eta_gen = 1;
+
 static void update_condensed_str(char *rstr, char *run_str_condensed)
 {
 	if (*rstr) {
@@ -117,7 +155,6 @@ static void check_str_update(struct thread_data *td)
 	}
 
 	__run_str[td->thread_number - 1] = c;
-	update_condensed_str(__run_str, run_str);
 }
 
 /*
@@ -154,26 +191,21 @@ void eta_to_str(char *str, unsigned long eta_sec)
 }
 
 /*
- * Best effort calculation of the estimated pending runtime of a job.
+ * Size of the IO the job will do, adjusted for zones skipped and verify
  */
-static unsigned long thread_eta(struct thread_data *td)
+static void eta_bytes_total(struct thread_data *td, struct eta_job *ej)
 {
-	unsigned long long bytes_total, bytes_done;
-	unsigned long eta_sec = 0;
-	unsigned long elapsed;
-	uint64_t timeout;
-
-	elapsed = (mtime_since_now(&td->epoch) + 999) / 1000;
-	timeout = td->o.timeout / 1000000UL;
-
-	bytes_total = td->total_io_size;
+	uint64_t bytes_total = td->total_io_size;
 
-	if (td->flags & TD_F_NO_PROGRESS)
-		return -1;
+	ej->total_io_size = td->total_io_size;
+	ej->fill_device_size = td->fill_device_size;
+	ej->bytes_unknown = false;
 
 	if (td->o.fill_device && td->o.size  == -1ULL) {
-		if (!td->fill_device_size || td->fill_device_size == -1ULL)
-			return 0;
+		if (!td->fill_device_size || td->fill_device_size == -1ULL) {
+			ej->bytes_unknown = true;
+			return;
+		}
 
 		bytes_total = td->fill_device_size;
 	}
@@ -219,19 +251,106 @@ static unsigned long thread_eta(struct thread_data *td)
 			bytes_total <<= 1;
 	}
 
-	if (td->runstate == TD_RUNNING || td->runstate == TD_VERIFYING) {
-		double perc, perc_t;
+	ej->bytes_total = bytes_total;
+}
+
+static void eta_job_init(struct thread_data *td, struct eta_job *ej)
+{
+	struct thread_options *o = &td->o;
+
+	memset(ej, 0, sizeof(*ej));
+	ej->gen = eta_gen;
+	ej->stonewall = o->stonewall;
+	ej->time_based = o->time_based;
+	ej->pow2 = is_power_of_2(o->kb_base);
+	ej->unified_rw_rep = o->unified_rw_rep;
+	ej->unit_base = o->unit_base;
+	ej->sig_figs = o->sig_figs;
+	ej->bw_avg_time = o->bw_avg_time;
 
-		bytes_done = ddir_rw_sum(td->io_bytes);
+	for_each_rw_ddir(ddir) {
+		if (!(o->td_ddir & (1 << ddir)))
+			continue;
+
+		ej->t_rate[ddir] = o->rate[ddir];
+		ej->t_iops[ddir] = o->rate_iops[ddir];
+		ej->m_rate[ddir] = o->ratemin[ddir];
+		ej->m_iops[ddir] = o->rate_iops_min[ddir];
+		ej->rate_bytes += o->rate[ddir];
+	}
+
+	ej->timeout = o->timeout;
+	ej->start_delay = o->start_delay;
+	ej->ramp_time = o->ramp_time;
 
-		if (bytes_total) {
-			perc = (double) bytes_done / (double) bytes_total;
+	eta_bytes_total(td, ej);
+}
+
+static bool eta_jobs_reserve(void)
+{
+	unsigned int nr = eta_jobs_nr;
+	struct eta_job *ej;
+
+	if (thread_number <= nr)
+		return true;
+
+	nr = max((unsigned int) thread_number, 2 * nr);
+	ej = __fio_memalign(FIO_CACHE_LINE_SIZE, nr * sizeof(*ej), malloc);
+	if (!ej)
+		return false;
+
+	memset(ej, 0, nr * sizeof(*ej));
+	if (eta_jobs)
+		__fio_memfree(eta_jobs, eta_jobs_nr * sizeof(*ej), free);
+	eta_jobs = ej;
+	eta_jobs_nr = nr;
+	return true;
+}
+
+static struct eta_job *eta_job_get(struct thread_data *td)
+{
+	struct eta_job *ej = &eta_jobs[td->thread_number - 1];
+
+	if (ej->gen != eta_gen)
+		eta_job_init(td, ej);
+	else if (ej->total_io_size != td->total_io_size ||
+		 ej->fill_device_size != td->fill_device_size)
+		eta_bytes_total(td, ej);
+
+	return ej;
+}
+
+/*
+ * Best effort calculation of the estimated pending runtime of a job.
+ */
+static unsigned long thread_eta(struct thread_data *td, struct eta_job *ej,
+				uint64_t io_bytes, struct timespec *now)
+{
+	int runstate = td->runstate;
+	unsigned long eta_sec = 0;
+	unsigned long elapsed;
+	uint64_t timeout;
+
+	elapsed = (mtime_since(&td->epoch, now) + 999) / 1000;
+	timeout = ej->timeout / 1000000UL;
+
+	if (td->flags & TD_F_NO_PROGRESS)
+		return -1;
+
+	if (ej->bytes_unknown)
+		return 0;
+
+	if (runstate == TD_RUNNING || runstate == TD_VERIFYING) {
+		double perc, perc_t;
+
+		if (ej->bytes_total) {
+			perc = (double) io_bytes / (double) ej->bytes_total;
 			if (perc > 1.0)
 				perc = 1.0;
 		} else
 			perc = 0.0;
 
-		if (td->o.time_based) {
+		if (ej->time_based) {
 			if (timeout) {
 				perc_t = (double) elapsed / (double) timeout;
 				if (perc_t < perc)
@@ -251,52 +370,40 @@ static unsigned long thread_eta(struct thread_data *td)
 			eta_sec = (unsigned long) (elapsed * (1.0 / perc)) - elapsed;
 		}
 
-		if (td->o.timeout &&
+		if (ej->timeout &&
 		    eta_sec > (timeout + done_secs - elapsed))
 			eta_sec = timeout + done_secs - elapsed;
-	} else if (td->runstate == TD_NOT_CREATED || td->runstate == TD_CREATED
-			|| td->runstate == TD_INITIALIZED
-			|| td->runstate == TD_SETTING_UP
-			|| td->runstate == TD_RAMP
-			|| td->runstate == TD_PRE_READING) {
+	} else if (runstate == TD_NOT_CREATED || runstate == TD_CREATED
+			|| runstate == TD_INITIALIZED
+			|| runstate == TD_SETTING_UP
+			|| runstate == TD_RAMP
+			|| runstate == TD_PRE_READING) {
 		int64_t t_eta = 0, r_eta = 0;
-		unsigned long long rate_bytes;
 
 		/*
 		 * We can only guess - assume it'll run the full timeout
 		 * if given, otherwise assume it'll run at the specified rate.
 		 */
-		if (td->o.timeout) {
-			uint64_t __timeout = td->o.timeout;
-			uint64_t start_delay = td->o.start_delay;
-			uint64_t ramp_time = td->o.ramp_time;
-
-			t_eta = __timeout + start_delay;
+		if (ej->timeout) {
+			t_eta = ej->timeout + ej->start_delay;
 			if (!td->ramp_time_over) {
-				t_eta += ramp_time;
+				t_eta += ej->ramp_time;
 			}
 			t_eta /= 1000000ULL;
 
-			if ((td->runstate == TD_RAMP) && in_ramp_time(td)) {
+			if ((runstate == TD_RAMP) && in_ramp_time(td)) {
 				unsigned long ramp_left;
 
-				ramp_left = mtime_since_now(&td->epoch);
+				ramp_left = mtime_since(&td->epoch, now);
 				ramp_left = (ramp_left + 999) / 1000;
 				if (ramp_left <= t_eta)
 					t_eta -= ramp_left;
 			}
 		}
-		rate_bytes = 0;
-		if (td_read(td))
-			rate_bytes  = td->o.rate[DDIR_READ];
-		if (td_write(td))
-			rate_bytes += td->o.rate[DDIR_WRITE];
-		if (td_trim(td))
-			rate_bytes += td->o.rate[DDIR_TRIM];
-
-		if (rate_bytes) {
-			r_eta = bytes_total / rate_bytes;
-			r_eta += (td->o.start_delay / 1000000ULL);
+
+		if (ej->rate_bytes) {
+			r_eta = ej->bytes_total / ej->rate_bytes;
+			r_eta += (ej->start_delay / 1000000ULL);
 		}
 
 		if (r_eta && t_eta)
@@ -383,9 +490,10 @@ bool calc_thread_status(struct jobs_eta *je, int force)
 {
 	int unified_rw_rep;
 	bool any_td_in_ramp;
-	uint64_t rate_time, disp_time, bw_avg_time, *eta_secs;
+	uint64_t rate_time, disp_time, bw_avg_time;
 	unsigned long long io_bytes[DDIR_RWDIR_CNT] = {};
 	unsigned long long io_iops[DDIR_RWDIR_CNT] = {};
+	unsigned long eta_stone = 0;
 	struct timespec now;
 
 	static unsigned long long rate_io_bytes[DDIR_RWDIR_CNT];
@@ -404,111 +512,97 @@ bool calc_thread_status(struct jobs_eta *je, int force)
 			return false;
 	}
 
+	if (!eta_jobs_reserve())
+		return false;
+
 	if (!ddir_rw_sum(rate_io_bytes))
 		fill_start_time(&rate_prev_time);
 	if (!ddir_rw_sum(disp_io_bytes))
 		fill_start_time(&disp_prev_time);
 
-	eta_secs = malloc(thread_number * sizeof(uint64_t));
-	memset(eta_secs, 0, thread_number * sizeof(uint64_t));
-
+	fio_gettime(&now, NULL);
 	je->elapsed_sec = (mtime_since_genesis() + 999) / 1000;
+	je->eta_sec = exitall_on_terminate ? INT_MAX : 0;
 
 	bw_avg_time = ULONG_MAX;
 	unified_rw_rep = 0;
+	any_td_in_ramp = false;
 	for_each_td(td) {
-		unified_rw_rep += td->o.unified_rw_rep;
-		if (is_power_of_2(td->o.kb_base))
+		struct eta_job *ej = eta_job_get(td);
+		uint64_t bytes[DDIR_RWDIR_CNT], eta_sec;
+		int runstate = td->runstate;
+
+		unified_rw_rep += ej->unified_rw_rep;
+		if (ej->pow2)
 			je->is_pow2 = 1;
-		je->unit_base = td->o.unit_base;
-		je->sig_figs = td->o.sig_figs;
-		if (td->o.bw_avg_time < bw_avg_time)
-			bw_avg_time = td->o.bw_avg_time;
-		if (td->runstate == TD_RUNNING || td->runstate == TD_VERIFYING
-		    || td->runstate == TD_FSYNCING
-		    || td->runstate == TD_PRE_READING
-		    || td->runstate == TD_FINISHING) {
+		je->unit_base = ej->unit_base;
+		je->sig_figs = ej->sig_figs;
+		if (ej->bw_avg_time < bw_avg_time)
+			bw_avg_time = ej->bw_avg_time;
+		if (runstate == TD_RUNNING || runstate == TD_VERIFYING
+		    || runstate == TD_FSYNCING
+		    || runstate == TD_PRE_READING
+		    || runstate == TD_FINISHING) {
 			je->nr_running++;
-			if (td_read(td)) {
-				je->t_rate[0] += td->o.rate[DDIR_READ];
-				je->t_iops[0] += td->o.rate_iops[DDIR_READ];
-				je->m_rate[0] += td->o.ratemin[DDIR_READ];
-				je->m_iops[0] += td->o.rate_iops_min[DDIR_READ];
-			}
-			if (td_write(td)) {
-				je->t_rate[1] += td->o.rate[DDIR_WRITE];
-				je->t_iops[1] += td->o.rate_iops[DDIR_WRITE];
-				je->m_rate[1] += td->o.ratemin[DDIR_WRITE];
-				je->m_iops[1] += td->o.rate_iops_min[DDIR_WRITE];
-			}
-			if (td_trim(td)) {
-				je->t_rate[2] += td->o.rate[DDIR_TRIM];
-				je->t_iops[2] += td->o.rate_iops[DDIR_TRIM];
-				je->m_rate[2] += td->o.ratemin[DDIR_TRIM];
-				je->m_iops[2] += td->o.rate_iops_min[DDIR_TRIM];
+			for_each_rw_ddir(ddir) {
+				je->t_rate[ddir] += ej->t_rate[ddir];
+				je->t_iops[ddir] += ej->t_iops[ddir];
+				je->m_rate[ddir] += ej->m_rate[ddir];
+				je->m_iops[ddir] += ej->m_iops[ddir];
 			}
 
 			je->files_open += td->nr_open_files;
-		} else if (td->runstate == TD_RAMP) {
+		} else if (runstate == TD_RAMP) {
 			je->nr_running++;
 			je->nr_ramp++;
-		} else if (td->runstate == TD_SETTING_UP)
+		} else if (runstate == TD_SETTING_UP)
 			je->nr_setting_up++;
-		else if (td->runstate < TD_RUNNING)
+		else if (runstate < TD_RUNNING)
 			je->nr_pending++;
 
+		for_each_rw_ddir(ddir)
+			bytes[ddir] = td->io_bytes[ddir];
+
 		if (je->elapsed_sec >= 3)
-			eta_secs[__td_index] = thread_eta(td);
+			eta_sec = thread_eta(td, ej, ddir_rw_sum(bytes), &now);
 		else
-			eta_secs[__td_index] = INT_MAX;
+			eta_sec = INT_MAX;
+
+		/*
+		 * With exitall the first job to finish ends the run. Otherwise
+		 * it lasts as long as the longest job, plus the jobs still
+		 * waiting behind a stonewall.
+		 */
+		if (exitall_on_terminate) {
+			if (eta_sec < je->eta_sec)
+				je->eta_sec = eta_sec;
+		} else if (runstate == TD_NOT_CREATED && ej->stonewall)
+			eta_stone += eta_sec;
+		else if (eta_sec > je->eta_sec)
+			je->eta_sec = eta_sec;
 
 		check_str_update(td);
+		any_td_in_ramp |= in_ramp_time(td);
 
-		if (td->runstate > TD_SETTING_UP) {
+		if (runstate > TD_SETTING_UP) {
 			int ddir;
 
 			for (ddir = 0; ddir < DDIR_RWDIR_CNT; ddir++) {
 				if (unified_rw_rep) {
-					io_bytes[0] += td->io_bytes[ddir];
+					io_bytes[0] += bytes[ddir];
 					io_iops[0] += td->io_blocks[ddir];
 				} else {
-					io_bytes[ddir] += td->io_bytes[ddir];
+					io_bytes[ddir] += bytes[ddir];
 					io_iops[ddir] += td->io_blocks[ddir];
 				}
 			}
 		}
 	} end_for_each();
 
-	if (exitall_on_terminate) {
-		je->eta_sec = INT_MAX;
-		for_each_td_index() {
-			if (eta_secs[__td_index] < je->eta_sec)
-				je->eta_sec = eta_secs[__td_index];
-		} end_for_each();
-	} else {
-		unsigned long eta_stone = 0;
-
-		je->eta_sec = 0;
-		for_each_td(td) {
-			if ((td->runstate == TD_NOT_CREATED) && td->o.stonewall)
-				eta_stone += eta_secs[__td_index];
-			else {
-				if (eta_secs[__td_index] > je->eta_sec)
-					je->eta_sec = eta_secs[__td_index];
-			}
-		} end_for_each();
-		je->eta_sec += eta_stone;
-	}
-
-	free(eta_secs);
+	je->eta_sec += eta_stone;
 
-	fio_gettime(&now, NULL);
 	rate_time = mtime_since(&rate_prev_time, &now);
 
-	any_td_in_ramp = false;
-	for_each_td(td) {
-		any_td_in_ramp |= in_ramp_time(td);
-	} end_for_each();
 	if (write_bw_log && rate_time > bw_avg_time && !any_td_in_ramp) {
 		calc_rate(unified_rw_rep, rate_time, io_bytes, rate_io_bytes,
 				je->rate);
@@ -583,10 +677,17 @@ void display_thread_status(struct jobs_eta *je)
 	static int eta_new_line_init, eta_new_line_pending;
 	static int linelen_last;
 	static int eta_good;
-	char output[__THREAD_RUNSTR_SZ(REAL_MAX_JOBS) + 512], *p = output;
+	/* room to pad over a longer previous line as well */
+	size_t output_sz = strlen((char *) je->run_str) + linelen_last + 512;
+	char *output, *p;
 	char eta_str[128];
 	double perc = 0.0;
 
+	output = malloc(output_sz);
+	if (!output)
+		return;
+	p = output;
+
 	if (je->eta_sec != INT_MAX && je->elapsed_sec) {
 		perc = (double) je->elapsed_sec / (double) (je->elapsed_sec + je->eta_sec);
 		eta_to_str(eta_str, je->eta_sec);
@@ -650,7 +751,7 @@ void display_thread_status(struct jobs_eta *je)
 			iops_str[ddir] = num2str(je->iops[ddir], 4, 1, 0, N2S_NONE);
 		}
 
-		left = sizeof(output) - (p - output) - 1;
+		left = output_sz - (p - output) - 1;
 		l = snprintf(p, left, ": [%s][%s]", je->run_str, perc_str);
 		l += gen_eta_str(je, p + l, left - l, rate_str, iops_str);
 		l += snprintf(p + l, left - l, "[eta %s]", eta_str);
@@ -672,6 +773,7 @@ void display_thread_status(struct jobs_eta *je)
 	sprintf(p, "\r");
 
 	printf("%s", output);
+	free(output);
 
 	if (!eta_new_line_init) {
 		fio_gettime(&disp_eta_new_line, NULL);
@@ -726,5 +828,7 @@ void print_status_init(int thr_number)
 
 	DRD_IGNORE_VAR(__run_str);
 	__run_str[thr_number] = 'P';
-	update_condensed_str(__run_str, run_str);
+
+	/* a new run, gather the options of each job again */
+	eta_gen++;
 }
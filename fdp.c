@@ -40,6 +40,21 @@ static int fdp_ruh_info(struct thread_data *td, struct fio_file *f,
 	return ret;
 }
 
+static void fdp_stats_start(struct thread_data *td, struct fio_file *f)
+{
+	struct fio_ruhs_info *ruhs = f->ruhs_info;
+
+	if (!td->io_ops->fdp_fetch_stats)
+		return;
+
+	if (td->io_ops->fdp_fetch_stats(td, f, &ruhs->stats)) {
+		log_info("fio: %s: no FDP statistics, WAF not reported\n",
+			 f->file_name);
+		return;
+	}
+	ruhs->have_stats = true;
+}
+
 static int init_ruh_info(struct thread_data *td, struct fio_file *f)
 {
 	struct fio_ruhs_info *ruhs, *tmp;
@@ -61,6 +76,7 @@ static int init_ruh_info(struct thread_data *td, struct fio_file *f)
 
 	if (td->o.fdp_nrpli == 0) {
 		f->ruhs_info = ruhs;
+		fdp_stats_start(td, f);
 		return 0;
 	}
 
@@ -81,6 +97,7 @@ static int init_ruh_info(struct thread_data *td, struct fio_file *f)
 	for (i = 0; i < td->o.fdp_nrpli; i++)
 		tmp->plis[i] = ruhs->plis[td->o.fdp_plis[i]];
 	f->ruhs_info = tmp;
+	fdp_stats_start(td, f);
 out:
 	sfree(ruhs);
 	return ret;
@@ -99,6 +116,38 @@ int fdp_init(struct thread_data *td)
 	return ret;
 }
 
+/*
+ * The statistics log is per endurance group, so this is the write
+ * amplification of everything that wrote to the device while the job ran,
+ * not just of this job.
+ */
+void fdp_report_stats(struct thread_data *td, struct fio_file *f)
+{
+	struct fio_ruhs_info *ruhs = f->ruhs_info;
+	struct fio_fdp_stats end;
+	uint64_t hbmw, mbmw, mbe;
+
+	if (!ruhs || !ruhs->have_stats)
+		return;
+
+	if (td->io_ops->fdp_fetch_stats(td, f, &end)) {
+		log_info("fio: %s: failed fetching FDP statistics\n",
+			 f->file_name);
+		return;
+	}
+
+	hbmw = end.hbmw - ruhs->stats.hbmw;
+	mbmw = end.mbmw - ruhs->stats.mbmw;
+	mbe = end.mbe - ruhs->stats.mbe;
+	log_info("%s: FDP host written=%llu, media written=%llu, media erased=%llu",
+		 f->file_name, (unsigned long long) hbmw,
+		 (unsigned long long) mbmw, (unsigned long long) mbe);
+	if (hbmw)
+		log_info(", WAF=%.3f\n", (double) mbmw / hbmw);
+	else
+		log_info("\n");
+}
+
 void fdp_free_ruhs_info(struct fio_file *f)
 {
 	if (!f->ruhs_info)
@@ -107,22 +156,69 @@ void fdp_free_ruhs_info(struct fio_file *f)
 	f->ruhs_info = NULL;
 }
 
+/*
+ * Index of the random_distribution zone the write falls in, the zones are
+ * laid out back to back from the start of the file.
+ */
+static unsigned int fdp_zone_index(struct thread_data *td, struct io_u *io_u)
+{
+	struct fio_file *f = io_u->file;
+	struct zone_split *zsp = td->o.zone_split[DDIR_WRITE];
+	unsigned int i, nr = td->o.zone_split_nr[DDIR_WRITE];
+	uint64_t offset = io_u->offset - f->file_offset;
+	uint64_t end = 0;
+
+	for (i = 0; i + 1 < nr; i++) {
+		if (td->o.random_distribution == FIO_RAND_DIST_ZONED_ABS)
+			end += zsp[i].size;
+		else
+			end += zsp[i].size_perc * f->io_size / 100;
+		if (offset < end)
+			break;
+	}
+
+	return i;
+}
+
+static unsigned int fdp_pli_index(struct thread_data *td, struct io_u *io_u,
+				  struct fio_ruhs_info *ruhs)
+{
+	struct fio_file *f = io_u->file;
+	unsigned int idx;
+
+	switch (td->o.fdp_pli_select) {
+	case FDP_PLI_RANDOM:
+		return rand_between(&td->fdp_state, 0, ruhs->nr_ruhs - 1);
+	case FDP_PLI_OFFSET:
+		if (!f->io_size)
+			return 0;
+		idx = (io_u->offset - f->file_offset) * ruhs->nr_ruhs / f->io_size;
+		return min(idx, ruhs->nr_ruhs - 1);
+	case FDP_PLI_ZONED:
+		return fdp_zone_index(td, io_u) % ruhs->nr_ruhs;
+	case FDP_PLI_JOB:
+		return (td->thread_number - 1) % ruhs->nr_ruhs;
+	case FDP_PLI_RR:
+	default:
+		if (ruhs->pli_loc >= ruhs->nr_ruhs)
+			ruhs->pli_loc = 0;
+		return ruhs->pli_loc++;
+	}
+}
+
 void fdp_fill_dspec_data(struct thread_data *td, struct io_u *io_u)
 {
 	struct fio_file *f = io_u->file;
 	struct fio_ruhs_info *ruhs = f->ruhs_info;
 	int dspec;
 
-	if (!ruhs || io_u->ddir != DDIR_WRITE) {
+	if (!ruhs || !ruhs->nr_ruhs || io_u->ddir != DDIR_WRITE) {
 		io_u->dtype = 0;
 		io_u->dspec = 0;
 		return;
 	}
 
-	if (ruhs->pli_loc >= ruhs->nr_ruhs)
-		ruhs->pli_loc = 0;
-
-	dspec = ruhs->plis[ruhs->pli_loc++];
+	dspec = ruhs->plis[fdp_pli_index(td, io_u, ruhs)];
 	io_u->dtype = 2;
 	io_u->dspec = dspec;
 }
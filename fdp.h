@@ -3,13 +3,25 @@
 
 #include "io_u.h"
 
+/*
+ * FDP statistics of the endurance group, in bytes
+ */
+struct fio_fdp_stats {
+	uint64_t hbmw;		/* host bytes with metadata written */
+	uint64_t mbmw;		/* media bytes with metadata written */
+	uint64_t mbe;		/* media bytes erased */
+};
+
 struct fio_ruhs_info {
 	uint32_t nr_ruhs;
 	uint32_t pli_loc;
+	bool have_stats;
+	struct fio_fdp_stats stats;	/* at the start of the job */
 	uint16_t plis[];
 };
 
 int fdp_init(struct thread_data *td);
+void fdp_report_stats(struct thread_data *td, struct fio_file *f);
 void fdp_free_ruhs_info(struct fio_file *f);
 void fdp_fill_dspec_data(struct thread_data *td, struct io_u *io_u);
 
@@ -12,6 +12,7 @@
 
 /* Forward declarations */
 struct zoned_block_device_info;
+struct zbd_owned_zones;
 struct fdp_ruh_info;
 
 /*
@@ -35,6 +36,8 @@ enum fio_file_flags {
 	FIO_FILE_axmap		= 1 << 7,	/* uses axmap */
 	FIO_FILE_lfsr		= 1 << 8,	/* lfsr is used */
 	FIO_FILE_smalloc	= 1 << 9,	/* smalloc file/file_name */
+	FIO_FILE_axmap_shared	= 1 << 10,	/* axmap shared with other jobs */
+	FIO_FILE_invalidated	= 1 << 11,	/* cache dropped ahead of open */
 };
 
 enum file_lock_mode {
@@ -43,6 +46,11 @@ enum file_lock_mode {
 	FILE_LOCK_READWRITE,
 };
 
+/*
+ * Number of locks per file with lockfile_stripe
+ */
+#define FILE_LOCK_STRIPES	256
+
 /*
  * How fio chooses what file to service next. Choice of uniformly random, or
  * some skewed random variants, or just sequentially go through them or
@@ -111,6 +119,7 @@ struct fio_file {
 	/* zonemode=zbd working area */
 	uint32_t min_zone;	/* inclusive */
 	uint32_t max_zone;	/* exclusive */
+	struct zbd_owned_zones *zbd_owned;
 
 	/*
 	 * Track last end and last start of IO for a given data direction
@@ -146,6 +155,12 @@ struct fio_file {
 		struct fio_rwlock *rwlock;
 	};
 
+	/*
+	 * with lockfile_stripe, the stripe locks this job holds
+	 */
+	unsigned int lock_stripe;
+	unsigned int lock_stripes;
+
 	/*
 	 * block map or LFSR for random io
 	 */
@@ -154,6 +169,17 @@ struct fio_file {
 		struct fio_lfsr lfsr;
 	};
 
+	/*
+	 * written blocks not yet verified, for verify_bitmap
+	 */
+	struct axmap *verify_map;
+
+	/*
+	 * crc32c per verify_interval block, for verify_table
+	 */
+	uint32_t *verify_table;
+	uint64_t verify_table_nr;
+
 	/*
 	 * Used for zipf random distribution
 	 */
@@ -195,6 +221,8 @@ FILE_FLAG_FNS(partial_mmap);
 FILE_FLAG_FNS(axmap);
 FILE_FLAG_FNS(lfsr);
 FILE_FLAG_FNS(smalloc);
+FILE_FLAG_FNS(axmap_shared);
+FILE_FLAG_FNS(invalidated);
 #undef FILE_FLAG_FNS
 
 /*
@@ -205,6 +233,7 @@ extern void close_files(struct thread_data *);
 extern void close_and_free_files(struct thread_data *);
 extern uint64_t get_start_offset(struct thread_data *, struct fio_file *);
 extern int __must_check setup_files(struct thread_data *);
+extern void invalidate_files_parallel(struct thread_data *);
 extern int __must_check file_invalidate_cache(struct thread_data *, struct fio_file *);
 #ifdef __cplusplus
 extern "C" {
@@ -224,7 +253,8 @@ extern int add_file_exclusive(struct thread_data *, const char *);
 extern void get_file(struct fio_file *);
 extern int __must_check put_file(struct thread_data *, struct fio_file *);
 extern void put_file_log(struct thread_data *, struct fio_file *);
-extern void lock_file(struct thread_data *, struct fio_file *, enum fio_ddir);
+extern void lock_file(struct thread_data *, struct fio_file *, enum fio_ddir,
+		      uint64_t, uint64_t);
 extern void unlock_file(struct thread_data *, struct fio_file *);
 extern void unlock_file_all(struct thread_data *, struct fio_file *);
 extern int add_dir_files(struct thread_data *, const char *);
@@ -6,22 +6,42 @@
 #include "hash.h"
 #include "filehash.h"
 #include "smalloc.h"
+#include "pshared.h"
 #include "lib/bloom.h"
-
-#define HASH_BUCKETS	512
-#define HASH_MASK	(HASH_BUCKETS - 1)
+#include "crc/crc32c.h"
+
+/*
+ * Enough buckets that runs with millions of files don't walk long chains
+ * on every lookup
+ */
+#define HASH_BITS	16
+#define HASH_BUCKETS	(1U << HASH_BITS)
+
+/*
+ * The buckets are protected by striped locks, so jobs opening and closing
+ * different files don't all serialize on one lock.
+ */
+#define HASH_LOCKS	64
+#define HASH_LOCK_MASK	(HASH_LOCKS - 1)
 
 #define BLOOM_SIZE	16*1024*1024
 
 static unsigned int file_hash_size = HASH_BUCKETS * sizeof(struct flist_head);
 
 static struct flist_head *file_hash;
+static pthread_mutex_t *bucket_locks;
 static struct fio_sem *hash_lock;
 static struct bloom *file_bloom;
 
-static unsigned short hash(const char *name)
+/*
+ * crc32c is done in hardware where the CPU can, the multiply spreads it
+ * over the buckets. bloom_new() in file_hash_init() probed for it.
+ */
+static unsigned int hash(const char *name)
 {
-	return jhash(name, strlen(name), 0) & HASH_MASK;
+	uint32_t crc = fio_crc32c((const unsigned char *) name, strlen(name));
+
+	return hash_long(crc, HASH_BITS);
 }
 
 void fio_file_hash_lock(void)
@@ -36,9 +56,16 @@ void fio_file_hash_unlock(void)
 		fio_sem_up(hash_lock);
 }
 
+static pthread_mutex_t *bucket_lock(unsigned int bucket)
+{
+	return &bucket_locks[bucket & HASH_LOCK_MASK];
+}
+
 void remove_file_hash(struct fio_file *f)
 {
-	fio_sem_down(hash_lock);
+	pthread_mutex_t *lock = bucket_lock(hash(f->file_name));
+
+	pthread_mutex_lock(lock);
 
 	if (fio_file_hashed(f)) {
 		assert(!flist_empty(&f->hash_list));
@@ -46,15 +73,15 @@ void remove_file_hash(struct fio_file *f)
 		fio_file_clear_hashed(f);
 	}
 
-	fio_sem_up(hash_lock);
+	pthread_mutex_unlock(lock);
 }
 
-static struct fio_file *__lookup_file_hash(const char *name)
+static struct fio_file *__lookup_file_hash(const char *name,
+					   unsigned int bucket)
 {
-	struct flist_head *bucket = &file_hash[hash(name)];
 	struct flist_head *n;
 
-	flist_for_each(n, bucket) {
+	flist_for_each(n, &file_hash[bucket]) {
 		struct fio_file *f = flist_entry(n, struct fio_file, hash_list);
 
 		if (!f->file_name)
@@ -69,16 +96,18 @@ static struct fio_file *__lookup_file_hash(const char *name)
 
 struct fio_file *lookup_file_hash(const char *name)
 {
+	unsigned int bucket = hash(name);
 	struct fio_file *f;
 
-	fio_sem_down(hash_lock);
-	f = __lookup_file_hash(name);
-	fio_sem_up(hash_lock);
+	pthread_mutex_lock(bucket_lock(bucket));
+	f = __lookup_file_hash(name, bucket);
+	pthread_mutex_unlock(bucket_lock(bucket));
 	return f;
 }
 
 struct fio_file *add_file_hash(struct fio_file *f)
 {
+	unsigned int bucket;
 	struct fio_file *alias;
 
 	if (fio_file_hashed(f))
@@ -86,15 +115,16 @@ struct fio_file *add_file_hash(struct fio_file *f)
 
 	INIT_FLIST_HEAD(&f->hash_list);
 
-	fio_sem_down(hash_lock);
+	bucket = hash(f->file_name);
+	pthread_mutex_lock(bucket_lock(bucket));
 
-	alias = __lookup_file_hash(f->file_name);
+	alias = __lookup_file_hash(f->file_name, bucket);
 	if (!alias) {
 		fio_file_set_hashed(f);
-		flist_add_tail(&f->hash_list, &file_hash[hash(f->file_name)]);
+		flist_add_tail(&f->hash_list, &file_hash[bucket]);
 	}
 
-	fio_sem_up(hash_lock);
+	pthread_mutex_unlock(bucket_lock(bucket));
 	return alias;
 }
 
@@ -107,14 +137,19 @@ void file_hash_exit(void)
 {
 	unsigned int i, has_entries = 0;
 
-	fio_sem_down(hash_lock);
-	for (i = 0; i < HASH_BUCKETS; i++)
+	for (i = 0; i < HASH_BUCKETS; i++) {
+		pthread_mutex_lock(bucket_lock(i));
 		has_entries += !flist_empty(&file_hash[i]);
-	fio_sem_up(hash_lock);
+		pthread_mutex_unlock(bucket_lock(i));
+	}
 
 	if (has_entries)
 		log_err("fio: file hash not empty on exit\n");
 
+	for (i = 0; i < HASH_LOCKS; i++)
+		pthread_mutex_destroy(&bucket_locks[i]);
+	sfree(bucket_locks);
+	bucket_locks = NULL;
 	sfree(file_hash);
 	file_hash = NULL;
 	fio_sem_remove(hash_lock);
@@ -132,6 +167,10 @@ void file_hash_init(void)
 	for (i = 0; i < HASH_BUCKETS; i++)
 		INIT_FLIST_HEAD(&file_hash[i]);
 
+	bucket_locks = smalloc(HASH_LOCKS * sizeof(*bucket_locks));
+	for (i = 0; i < HASH_LOCKS; i++)
+		mutex_init_pshared(&bucket_locks[i]);
+
 	hash_lock = fio_sem_init(FIO_SEM_UNLOCKED);
 	file_bloom = bloom_new(BLOOM_SIZE);
 }
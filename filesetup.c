@@ -5,6 +5,7 @@
 #include <dirent.h>
 #include <libgen.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "fio.h"
 #include "smalloc.h"
@@ -13,8 +14,10 @@
 #include "os/os.h"
 #include "hash.h"
 #include "lib/axmap.h"
+#include "lib/fenwick.h"
 #include "rwlock.h"
 #include "zbd.h"
+#include "precond.h"
 
 #ifdef CONFIG_LINUX_FALLOCATE
 #include <linux/falloc.h>
@@ -22,6 +25,8 @@
 
 static FLIST_HEAD(filename_list);
 
+static int tree_create_file(struct thread_data *td, struct fio_file *f);
+
 /*
  * List entry for filename_list
  */
@@ -652,6 +657,33 @@ int file_invalidate_cache(struct thread_data *td, struct fio_file *f)
 	return __file_invalidate_cache(td, f, -1ULL, -1ULL);
 }
 
+/*
+ * invalidate_cache for a file that isn't open yet, done from
+ * files_parallel(). td_io_open_file() skips the files done here.
+ */
+static int invalidate_one_file(struct thread_data fio_unused *td,
+			       struct fio_file *f)
+{
+	int fd;
+
+	if (f->filetype != FIO_TYPE_FILE || fio_file_open(f))
+		return 0;
+	if (f->io_size == -1ULL || f->file_offset == -1ULL)
+		return 0;
+
+	fd = open(f->file_name, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	dprint(FD_IO, "declare unneeded cache %s: %llu/%llu\n", f->file_name,
+		(unsigned long long) f->file_offset,
+		(unsigned long long) f->io_size);
+	if (!posix_fadvise(fd, f->file_offset, f->io_size, POSIX_FADV_DONTNEED))
+		fio_file_set_invalidated(f);
+	close(fd);
+	return 0;
+}
+
 int generic_close_file(struct thread_data fio_unused *td, struct fio_file *f)
 {
 	int ret = 0;
@@ -717,6 +749,7 @@ static int file_close_shadow_fds(struct thread_data *td)
 
 int generic_open_file(struct thread_data *td, struct fio_file *f)
 {
+	bool tree_created = false;
 	int is_std = 0;
 	int flags = 0;
 	int from_hash = 0;
@@ -758,7 +791,8 @@ open_again:
 		else
 			from_hash = file_lookup_open(f, flags);
 	} else if (td_read(td)) {
-		if (td_ioengine_flagged(td, FIO_RO_NEEDS_RW_OPEN) && !read_only)
+		if ((td_ioengine_flagged(td, FIO_RO_NEEDS_RW_OPEN) ||
+		     td_trim(td)) && !read_only)
 			flags |= O_RDWR;
 		else
 			flags |= O_RDONLY;
@@ -784,6 +818,12 @@ open_again:
 		}
 		if (__e == EMFILE && file_close_shadow_fds(td))
 			goto open_again;
+		if (__e == ENOENT && td->o.tree_depth && !tree_created) {
+			if (tree_create_file(td, f))
+				return 1;
+			tree_created = true;
+			goto open_again;
+		}
 
 		snprintf(buf, sizeof(buf), "open(%s)", f->file_name);
 
@@ -833,6 +873,120 @@ int generic_get_file_size(struct thread_data *td, struct fio_file *f)
 	return get_file_size(td, f);
 }
 
+typedef int (file_work_fn)(struct thread_data *, struct fio_file *);
+
+struct file_work {
+	struct thread_data *td;
+	file_work_fn *fn;
+	unsigned int next_file;
+	int err;
+};
+
+static void *file_work_thread_main(void *data)
+{
+	struct file_work *fw = data;
+	struct thread_data *td = fw->td;
+	unsigned int i;
+	int err;
+
+	while (!__atomic_load_n(&fw->err, __ATOMIC_RELAXED)) {
+		i = __atomic_fetch_add(&fw->next_file, 1, __ATOMIC_RELAXED);
+		if (i >= td->files_index)
+			break;
+
+		err = fw->fn(td, td->files[i]);
+		if (err)
+			__atomic_store_n(&fw->err, err, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+/*
+ * With many files, in particular on network filesystems, setup time is
+ * dominated by the latency of the per file syscalls. Have create_threads
+ * threads run fn on the files of td, each picking the next file. fn may
+ * only change the file it is given.
+ */
+static int files_parallel(struct thread_data *td, file_work_fn *fn,
+			  const char *what)
+{
+	struct file_work fw = { .td = td, .fn = fn, };
+	unsigned int i, nr_threads;
+	pthread_t *threads;
+	int ret;
+
+	nr_threads = min(td->o.create_threads, td->files_index);
+	threads = calloc(nr_threads, sizeof(*threads));
+	if (!threads) {
+		td_verror(td, ENOMEM, "file setup threads");
+		return 1;
+	}
+
+	dprint(FD_FILE, "%s %u files with %u threads\n", what,
+		td->files_index, nr_threads);
+
+	for (i = 0; i < nr_threads; i++) {
+		ret = pthread_create(&threads[i], NULL, file_work_thread_main,
+				     &fw);
+		if (ret) {
+			td_verror(td, ret, "pthread_create");
+			__atomic_store_n(&fw.err, 1, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+
+	nr_threads = i;
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+	return fw.err;
+}
+
+static bool files_parallel_ok(struct thread_data *td)
+{
+	return td->o.create_threads > 1 && td->files_index > 1;
+}
+
+/*
+ * Drop the cache of the files of td ahead of a loop opening them, rather
+ * than one by one as each is opened
+ */
+void invalidate_files_parallel(struct thread_data *td)
+{
+#ifdef CONFIG_ESX
+	return;
+#endif
+	if (!td->o.invalidate_cache || !files_parallel_ok(td))
+		return;
+	if (td->io_ops->invalidate || td_ioengine_flagged(td, FIO_DISKLESSIO))
+		return;
+
+	files_parallel(td, invalidate_one_file, "invalidate");
+}
+
+/*
+ * stat() a regular file. Failures are left for get_file_size() to
+ * report, it runs after this for files whose size isn't known.
+ */
+static int probe_file_size(struct thread_data fio_unused *td,
+			   struct fio_file *f)
+{
+	struct stat st;
+
+	if (f->filetype != FIO_TYPE_FILE || fio_file_size_known(f))
+		return 0;
+	if (stat(f->file_name, &st) == -1)
+		return 0;
+	if (f->file_offset > (uint64_t) st.st_size)
+		return 0;
+
+	f->real_file_size = st.st_size;
+	fio_file_set_size_known(f);
+	return 0;
+}
+
 /*
  * open/close all files, so that ->real_file_size gets set
  */
@@ -842,6 +996,10 @@ static int get_file_sizes(struct thread_data *td)
 	unsigned int i;
 	int err = 0;
 
+	if (files_parallel_ok(td) &&
+	    td->io_ops->get_file_size == generic_get_file_size)
+		files_parallel(td, probe_file_size, "size");
+
 	for_each_file(td, f, i) {
 		dprint(FD_FILE, "get file size for %p/%d/%s\n", f, i,
 								f->file_name);
@@ -1068,6 +1226,165 @@ static bool create_work_dirs(struct thread_data *td, const char *fname)
 	return true;
 }
 
+/*
+ * Extend a file that is smaller than the job needs, and drop what that
+ * wrote from the page cache.
+ */
+static int layout_file(struct thread_data *td, struct fio_file *f)
+{
+	unsigned long long old_len = -1ULL, extend_len = -1ULL;
+	int err;
+
+	assert(f->filetype == FIO_TYPE_FILE);
+	fio_file_clear_extend(f);
+	if (!td->o.fill_device) {
+		old_len = f->real_file_size;
+		extend_len = f->io_size + f->file_offset - old_len;
+	}
+	f->real_file_size = (f->io_size + f->file_offset);
+	err = extend_file(td, f);
+	if (err)
+		return err;
+
+	err = __file_invalidate_cache(td, f, old_len, extend_len);
+
+	/*
+	 * Shut up static checker
+	 */
+	if (f->fd != -1)
+		close(f->fd);
+
+	f->fd = -1;
+	return err;
+}
+
+/*
+ * First open of a file in a generated directory tree. Create the parent
+ * directories, and lay the file out if the job reads it. Writers create
+ * the file themselves when the open is retried.
+ */
+static int tree_create_file(struct thread_data *td, struct fio_file *f)
+{
+	dprint(FD_FILE, "tree create %s\n", f->file_name);
+
+	if (!td->o.allow_create) {
+		log_err("fio: file creation disallowed by "
+				"allow_file_create=0\n");
+		td_verror(td, ENOENT, "open");
+		return 1;
+	}
+	if (!create_work_dirs(td, f->file_name)) {
+		td_verror(td, errno, "mkdir");
+		return 1;
+	}
+	if (td_read(td))
+		return layout_file(td, f);
+
+	return 0;
+}
+
+static int layout_one_file(struct thread_data *td, struct fio_file *f)
+{
+	if (!fio_file_extend(f))
+		return 0;
+
+	return layout_file(td, f);
+}
+
+/*
+ * The slice of its files or range this job runs with --shard: the one of
+ * its server, split further over the clones when they share their files.
+ * The clones of a sequential precondition pass split it the same way.
+ */
+static bool get_shard(struct thread_data *td, unsigned int *index,
+		      unsigned int *count)
+{
+	struct thread_options *o = &td->o;
+	bool split = td->precond_pass == PRECOND_ZERO ||
+			td->precond_pass == PRECOND_SEQ;
+
+	*index = 0;
+	*count = 1;
+	if (fio_shard_count && !o->read_iolog_file) {
+		*index = fio_shard_index;
+		*count = fio_shard_count;
+		split = true;
+	}
+
+	if (split && o->filename && td->nr_subjobs > 1 &&
+	    !o->offset_increment && !o->offset_increment_percent) {
+		*index = *index * td->nr_subjobs + td->subjob_number;
+		*count *= td->nr_subjobs;
+	}
+
+	return *count > 1;
+}
+
+/*
+ * Deal the files out over the shards and drop the ones of the others. The
+ * sizes given for the whole set shrink with it.
+ */
+static void shard_files(struct thread_data *td, unsigned int index,
+			unsigned int count)
+{
+	struct thread_options *o = &td->o;
+	unsigned int i, kept = 0, nr = o->nr_files;
+	struct fio_file *f;
+
+	for_each_file(td, f, i) {
+		if (i % count != index) {
+			fio_file_free(f);
+			continue;
+		}
+		if (td->file_locks)
+			td->file_locks[kept] = td->file_locks[i];
+		td->files[kept++] = f;
+	}
+
+	dprint(FD_FILE, "shard %u/%u: %u of %u files\n", index, count, kept,
+			nr);
+
+	td->files_index = o->nr_files = kept;
+	if (o->open_files > kept)
+		o->open_files = kept;
+	o->size = o->size * kept / nr;
+	o->io_size = o->io_size * kept / nr;
+	if (o->file_service_type & __FIO_FSERVICE_NONUNIFORM)
+		init_rand_file_service(td);
+}
+
+/*
+ * Cut the range of f down to its shard. Slices are block, or zone,
+ * aligned, the last one takes what is left.
+ */
+static int shard_file_range(struct thread_data *td, struct fio_file *f,
+			    unsigned int index, unsigned int count)
+{
+	uint64_t align = td_min_bs(td), slice;
+
+	if (td->o.zone_mode != ZONE_MODE_NONE && td->o.zone_size)
+		align = td->o.zone_size;
+
+	slice = f->io_size / count;
+	slice -= slice % align;
+	if (!slice) {
+		log_err("%s: %s is too small for %u shards\n", td->o.name,
+			f->file_name, count);
+		return 1;
+	}
+
+	f->file_offset += index * slice;
+	if (index < count - 1)
+		f->io_size = slice;
+	else
+		f->io_size -= index * slice;
+
+	dprint(FD_FILE, "shard %u/%u of %s: %llu/%llu\n", index, count,
+			f->file_name, (unsigned long long) f->file_offset,
+			(unsigned long long) f->io_size);
+	return 0;
+}
+
 /*
  * Open the files and setup files sizes, creating files if necessary.
  */
@@ -1080,13 +1397,32 @@ int setup_files(struct thread_data *td)
 	int err = 0, need_extend;
 	int old_state;
 	const unsigned long long bs = td_min_bs(td);
+	unsigned int shard_index = 0, shard_count = 1;
 	uint64_t fs = 0;
+	bool shard;
 
 	dprint(FD_FILE, "setup files\n");
 
 	old_state = td_bump_runstate(td, TD_SETTING_UP);
 
+	/*
+	 * With --shard, a job with enough files gets some of them, one with
+	 * fewer a slice of the range of each.
+	 */
+	shard = get_shard(td, &shard_index, &shard_count);
+	if (shard && o->nr_files >= shard_count) {
+		shard_files(td, shard_index, shard_count);
+		shard = false;
+	} else if (shard && o->io_size)
+		o->io_size /= shard_count;
+
+	/*
+	 * A generated directory tree is created lazily, as files are first
+	 * opened. Don't walk the namespace here.
+	 */
 	for_each_file(td, f, i) {
+		if (o->tree_depth)
+			break;
 		if (!td_ioengine_flagged(td, FIO_DISKLESSIO) &&
 		    strchr(f->file_name, FIO_OS_PATH_SEPARATOR) &&
 		    !(td->flags & TD_F_DIRS_CREATED) &&
@@ -1103,7 +1439,7 @@ int setup_files(struct thread_data *td)
 	 */
 	if (td->io_ops->setup)
 		err = td->io_ops->setup(td);
-	else
+	else if (!o->tree_depth)
 		err = get_file_sizes(td);
 
 	if (err)
@@ -1241,6 +1577,10 @@ int setup_files(struct thread_data *td)
 				f->io_size -= (f->io_size % td_min_bs(td));
 			}
 
+			if (shard && shard_file_range(td, f, shard_index,
+						      shard_count))
+				goto err_out;
+
 			io_size = f->io_size;
 			if (o->io_size_percent && o->io_size_percent != 100) {
 				io_size *= o->io_size_percent;
@@ -1253,7 +1593,7 @@ int setup_files(struct thread_data *td)
 		if (f->filetype == FIO_TYPE_FILE &&
 		    (f->io_size + f->file_offset) > f->real_file_size) {
 			if (!td_ioengine_flagged(td, FIO_DISKLESSIO) &&
-			    !o->create_on_open) {
+			    !o->create_on_open && !o->tree_depth) {
 				need_extend++;
 				extend_size += (f->io_size + f->file_offset);
 				fio_file_set_extend(f);
@@ -1310,36 +1650,17 @@ int setup_files(struct thread_data *td)
 				 extend_size >> 20);
 		}
 
-		for_each_file(td, f, i) {
-			unsigned long long old_len = -1ULL, extend_len = -1ULL;
-
-			if (!fio_file_extend(f))
-				continue;
+		if (o->create_threads > 1 && need_extend > 1)
+			err = files_parallel(td, layout_one_file, "layout");
+		else {
+			for_each_file(td, f, i) {
+				if (!fio_file_extend(f))
+					continue;
 
-			assert(f->filetype == FIO_TYPE_FILE);
-			fio_file_clear_extend(f);
-			if (!o->fill_device) {
-				old_len = f->real_file_size;
-				extend_len = f->io_size + f->file_offset -
-						old_len;
+				err = layout_file(td, f);
+				if (err)
+					break;
 			}
-			f->real_file_size = (f->io_size + f->file_offset);
-			err = extend_file(td, f);
-			if (err)
-				break;
-
-			err = __file_invalidate_cache(td, f, old_len,
-								extend_len);
-
-			/*
-			 * Shut up static checker
-			 */
-			if (f->fd != -1)
-				close(f->fd);
-
-			f->fd = -1;
-			if (err)
-				break;
 		}
 		temp_stall_ts = 0;
 	}
@@ -1422,6 +1743,51 @@ err_out:
 	return 1;
 }
 
+/*
+ * pre_read_file() for files_parallel(), with its own fd and buffer
+ */
+static int pre_read_one_file(struct thread_data *td, struct fio_file *f)
+{
+	unsigned long long left = f->io_size, off = f->file_offset;
+	unsigned long long bs = td->o.max_bs[DDIR_READ];
+	int fd, err = 0;
+	char *b;
+
+	if (f->filetype == FIO_TYPE_CHAR)
+		return 0;
+
+	bs = min(bs, left);
+	if (!bs)
+		return 0;
+
+	fd = open(f->file_name, O_RDONLY);
+	if (fd < 0)
+		return errno;
+
+	b = malloc(bs);
+	if (!b) {
+		close(fd);
+		return ENOMEM;
+	}
+
+	while (left && !td->terminate) {
+		ssize_t r;
+
+		bs = min(bs, left);
+		r = pread(fd, b, bs, off);
+		if (r != (ssize_t) bs) {
+			err = EIO;
+			break;
+		}
+		left -= bs;
+		off += bs;
+	}
+
+	free(b);
+	close(fd);
+	return err;
+}
+
 bool pre_read_files(struct thread_data *td)
 {
 	struct fio_file *f;
@@ -1429,6 +1795,25 @@ bool pre_read_files(struct thread_data *td)
 
 	dprint(FD_FILE, "pre_read files\n");
 
+	if (td_ioengine_flagged(td, FIO_PIPEIO) ||
+	    td_ioengine_flagged(td, FIO_NOIO))
+		return true;
+
+	if (files_parallel_ok(td) &&
+	    td->io_ops->open_file == generic_open_file) {
+		int old_runstate, err;
+
+		old_runstate = td_bump_runstate(td, TD_PRE_READING);
+		err = files_parallel(td, pre_read_one_file, "pre-read");
+		td_restore_runstate(td, old_runstate);
+		if (err) {
+			log_err("fio: pre-read failed\n");
+			td_verror(td, err, "pre_read");
+			return false;
+		}
+		return true;
+	}
+
 	for_each_file(td, f, i) {
 		if (!pre_read_file(td, f))
 			return false;
@@ -1517,6 +1902,104 @@ static int check_rand_gen_limits(struct thread_data *td, struct fio_file *f,
 	return 0;
 }
 
+/*
+ * With randommap_shared, jobs that run on the same file with the same
+ * number of blocks use one axmap and claim blocks in it atomically.
+ * Jobs are threads then, and set up their files concurrently.
+ */
+struct shared_axmap {
+	struct flist_head list;
+	char *file_name;
+	uint64_t blocks;
+	struct axmap *map;
+	unsigned int refs;
+};
+
+static FLIST_HEAD(shared_axmaps);
+static pthread_mutex_t shared_axmap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct axmap *shared_axmap_get(const char *file_name, uint64_t blocks)
+{
+	struct shared_axmap *sm;
+	struct flist_head *n;
+	struct axmap *map = NULL;
+
+	pthread_mutex_lock(&shared_axmap_lock);
+	flist_for_each(n, &shared_axmaps) {
+		sm = flist_entry(n, struct shared_axmap, list);
+		if (sm->blocks == blocks && !strcmp(sm->file_name, file_name)) {
+			sm->refs++;
+			map = sm->map;
+			goto out;
+		}
+	}
+
+	sm = malloc(sizeof(*sm));
+	if (!sm)
+		goto out;
+	sm->map = axmap_new(blocks);
+	sm->file_name = strdup(file_name);
+	if (!sm->map || !sm->file_name) {
+		axmap_free(sm->map);
+		free(sm->file_name);
+		free(sm);
+		goto out;
+	}
+	sm->blocks = blocks;
+	sm->refs = 1;
+	flist_add_tail(&sm->list, &shared_axmaps);
+	map = sm->map;
+out:
+	pthread_mutex_unlock(&shared_axmap_lock);
+	return map;
+}
+
+static void shared_axmap_put(struct axmap *map)
+{
+	struct shared_axmap *sm;
+	struct flist_head *n;
+
+	pthread_mutex_lock(&shared_axmap_lock);
+	flist_for_each(n, &shared_axmaps) {
+		sm = flist_entry(n, struct shared_axmap, list);
+		if (sm->map != map)
+			continue;
+		if (!--sm->refs) {
+			flist_del(&sm->list);
+			axmap_free(sm->map);
+			free(sm->file_name);
+			free(sm);
+		}
+		break;
+	}
+	pthread_mutex_unlock(&shared_axmap_lock);
+}
+
+/*
+ * With random_partition the clones of a job share one LFSR sequence, so
+ * they must use the same seed.
+ */
+static uint64_t lfsr_seed(struct thread_data *td)
+{
+	if (td->o.random_partition)
+		return td->o.rand_seed;
+
+	return td->rand_seeds[FIO_RAND_BLOCK_OFF];
+}
+
+static void account_random_map(struct thread_data *td)
+{
+	struct fio_file *f;
+	uint64_t bytes = 0;
+	unsigned int i;
+
+	for_each_file(td, f, i)
+		if (fio_file_axmap(f))
+			bytes += axmap_size(f->io_axmap);
+
+	mem_acct_set(td, MEM_RANDMAP, bytes);
+}
+
 bool init_random_map(struct thread_data *td)
 {
 	unsigned long long blocks;
@@ -1540,17 +2023,25 @@ bool init_random_map(struct thread_data *td)
 			return false;
 
 		if (td->o.random_generator == FIO_RAND_GEN_LFSR) {
-			uint64_t seed;
+			uint64_t seed = lfsr_seed(td);
 
-			seed = td->rand_seeds[FIO_RAND_BLOCK_OFF];
-
-			if (!lfsr_init(&f->lfsr, blocks, seed, 0)) {
+			if (!lfsr_init(&f->lfsr, blocks, seed, 0) &&
+			    (!td->random_partitions ||
+			     !lfsr_partition(&f->lfsr, seed, td->subjob_number,
+					     td->random_partitions))) {
 				fio_file_set_lfsr(f);
 				continue;
 			} else {
 				log_err("fio: failed initializing LFSR\n");
 				return false;
 			}
+		} else if (!td->o.norandommap && td->o.randommap_shared) {
+			f->io_axmap = shared_axmap_get(f->file_name, blocks);
+			if (f->io_axmap) {
+				fio_file_set_axmap(f);
+				fio_file_set_axmap_shared(f);
+				continue;
+			}
 		} else if (!td->o.norandommap) {
 			f->io_axmap = axmap_new(blocks);
 			if (f->io_axmap) {
@@ -1572,6 +2063,7 @@ bool init_random_map(struct thread_data *td)
 			 "job without.\n", f->file_name);
 	}
 
+	account_random_map(td);
 	return true;
 }
 
@@ -1588,8 +2080,13 @@ void close_files(struct thread_data *td)
 
 void fio_file_free(struct fio_file *f)
 {
-	if (fio_file_axmap(f))
+	if (fio_file_axmap_shared(f))
+		shared_axmap_put(f->io_axmap);
+	else if (fio_file_axmap(f))
 		axmap_free(f->io_axmap);
+	else if (fio_file_lfsr(f))
+		lfsr_free(&f->lfsr);
+	axmap_free(f->verify_map);
 	if (f->ruhs_info)
 		sfree(f->ruhs_info);
 	if (!fio_file_smalloc(f)) {
@@ -1625,11 +2122,14 @@ void close_and_free_files(struct thread_data *td)
 		}
 
 		zbd_close_file(f);
+		fdp_report_stats(td, f);
 		fdp_free_ruhs_info(f);
 		fio_file_free(f);
 	}
 
 	td->o.filename = NULL;
+	fenwick_free(td->active_files);
+	td->active_files = NULL;
 	free(td->files);
 	free(td->file_locks);
 	td->files_index = 0;
@@ -1777,6 +2277,39 @@ bool exists_and_not_regfile(const char *filename)
 	return true;
 }
 
+/*
+ * lockfile_stripe: FILE_LOCK_STRIPES locks in shared memory, stripe n of
+ * the file is guarded by lock n % FILE_LOCK_STRIPES
+ */
+static void *alloc_stripe_locks(struct thread_data *td)
+{
+	bool rw = td->o.file_lock_mode == FILE_LOCK_READWRITE;
+	size_t size = rw ? sizeof(struct fio_rwlock) : sizeof(struct fio_sem);
+	void *locks;
+	int i, ret;
+
+	locks = mmap(NULL, FILE_LOCK_STRIPES * size, PROT_READ | PROT_WRITE,
+			OS_MAP_ANON | MAP_SHARED, -1, 0);
+	if (locks == MAP_FAILED) {
+		perror("mmap file locks");
+		return NULL;
+	}
+
+	for (i = 0; i < FILE_LOCK_STRIPES; i++) {
+		if (rw)
+			ret = __fio_rwlock_init(&((struct fio_rwlock *) locks)[i]);
+		else
+			ret = __fio_sem_init(&((struct fio_sem *) locks)[i],
+						FIO_SEM_UNLOCKED);
+		if (ret) {
+			munmap(locks, FILE_LOCK_STRIPES * size);
+			return NULL;
+		}
+	}
+
+	return locks;
+}
+
 int add_file(struct thread_data *td, const char *fname, int numjob, int inc)
 {
 	int cur_files = td->files_index;
@@ -1842,10 +2375,16 @@ int add_file(struct thread_data *td, const char *fname, int numjob, int inc)
 	case FILE_LOCK_NONE:
 		break;
 	case FILE_LOCK_READWRITE:
-		f->rwlock = fio_rwlock_init();
+		if (td->o.lockfile_stripe)
+			f->rwlock = alloc_stripe_locks(td);
+		else
+			f->rwlock = fio_rwlock_init();
 		break;
 	case FILE_LOCK_EXCLUSIVE:
-		f->lock = fio_sem_init(FIO_SEM_UNLOCKED);
+		if (td->o.lockfile_stripe)
+			f->lock = alloc_stripe_locks(td);
+		else
+			f->lock = fio_sem_init(FIO_SEM_UNLOCKED);
 		break;
 	default:
 		log_err("fio: unknown lock mode: %d\n", td->o.file_lock_mode);
@@ -1925,12 +2464,73 @@ int put_file(struct thread_data *td, struct fio_file *f)
 	return ret;
 }
 
-void lock_file(struct thread_data *td, struct fio_file *f, enum fio_ddir ddir)
+static void stripe_lock(struct thread_data *td, struct fio_file *f,
+			unsigned int i, enum fio_ddir ddir, bool lock)
+{
+	if (td->o.file_lock_mode == FILE_LOCK_READWRITE) {
+		if (!lock)
+			fio_rwlock_unlock(&f->rwlock[i]);
+		else if (ddir == DDIR_READ)
+			fio_rwlock_read(&f->rwlock[i]);
+		else
+			fio_rwlock_write(&f->rwlock[i]);
+	} else if (lock)
+		fio_sem_down(&f->lock[i]);
+	else
+		fio_sem_up(&f->lock[i]);
+}
+
+/*
+ * Take or drop the stripe locks in f->lock_stripe..lock_stripes, in
+ * index order so that ranges wrapping around the stripes can't deadlock
+ * against each other
+ */
+static void stripes_lock(struct thread_data *td, struct fio_file *f,
+			 enum fio_ddir ddir, bool lock)
+{
+	unsigned int i, end = f->lock_stripe + f->lock_stripes;
+
+	if (end > FILE_LOCK_STRIPES) {
+		for (i = 0; i < end - FILE_LOCK_STRIPES; i++)
+			stripe_lock(td, f, i, ddir, lock);
+		end = FILE_LOCK_STRIPES;
+	}
+	for (i = f->lock_stripe; i < end; i++)
+		stripe_lock(td, f, i, ddir, lock);
+}
+
+/*
+ * With lockfile_stripe, lock the stripes of [offset, offset + len). IOs
+ * without a range, like syncs, lock the whole file.
+ */
+static void lock_file_range(struct thread_data *td, struct fio_file *f,
+			    enum fio_ddir ddir, uint64_t offset, uint64_t len)
+{
+	uint64_t first = 0, nr = FILE_LOCK_STRIPES;
+
+	if (ddir_rw(ddir) && len) {
+		first = offset / td->o.lockfile_stripe;
+		nr = (offset + len - 1) / td->o.lockfile_stripe - first + 1;
+	}
+	if (nr >= FILE_LOCK_STRIPES) {
+		first = 0;
+		nr = FILE_LOCK_STRIPES;
+	}
+
+	f->lock_stripe = first % FILE_LOCK_STRIPES;
+	f->lock_stripes = nr;
+	stripes_lock(td, f, ddir, true);
+}
+
+void lock_file(struct thread_data *td, struct fio_file *f, enum fio_ddir ddir,
+	       uint64_t offset, uint64_t len)
 {
 	if (!f->lock || td->o.file_lock_mode == FILE_LOCK_NONE)
 		return;
 
-	if (td->o.file_lock_mode == FILE_LOCK_READWRITE) {
+	if (td->o.lockfile_stripe)
+		lock_file_range(td, f, ddir, offset, len);
+	else if (td->o.file_lock_mode == FILE_LOCK_READWRITE) {
 		if (ddir == DDIR_READ)
 			fio_rwlock_read(f->rwlock);
 		else
@@ -1946,7 +2546,9 @@ void unlock_file(struct thread_data *td, struct fio_file *f)
 	if (!f->lock || td->o.file_lock_mode == FILE_LOCK_NONE)
 		return;
 
-	if (td->o.file_lock_mode == FILE_LOCK_READWRITE)
+	if (td->o.lockfile_stripe)
+		stripes_lock(td, f, DDIR_INVAL, false);
+	else if (td->o.file_lock_mode == FILE_LOCK_READWRITE)
 		fio_rwlock_unlock(f->rwlock);
 	else if (td->o.file_lock_mode == FILE_LOCK_EXCLUSIVE)
 		fio_sem_up(f->lock);
@@ -2096,10 +2698,13 @@ void fio_file_reset(struct thread_data *td, struct fio_file *f)
 		f->last_start[i] = -1ULL;
 	}
 
-	if (fio_file_axmap(f))
+	/*
+	 * A shared map is not reset, the other jobs may still be using it
+	 */
+	if (fio_file_axmap(f) && !fio_file_axmap_shared(f))
 		axmap_reset(f->io_axmap);
 	else if (fio_file_lfsr(f))
-		lfsr_reset(&f->lfsr, td->rand_seeds[FIO_RAND_BLOCK_OFF]);
+		lfsr_reset(&f->lfsr, lfsr_seed(td));
 
 	zbd_file_reset(td, f);
 }
@@ -0,0 +1,191 @@
+/*
+ * Per file IO counters and latency histograms, see filestat.h
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "fio.h"
+#include "filestat.h"
+#include "smalloc.h"
+#include "json.h"
+
+int file_stats_init(struct thread_data *td)
+{
+	struct fio_file *f;
+	unsigned int i;
+
+	if (!td->o.per_file_stats || !td->files_index)
+		return 0;
+
+	td->file_stats = scalloc(td->files_index, sizeof(struct file_stat));
+	if (!td->file_stats)
+		goto err;
+
+	td->nr_file_stats = td->files_index;
+	mem_acct_add(td, MEM_STATS, td->files_index * sizeof(struct file_stat));
+	for_each_file(td, f, i) {
+		td->file_stats[i].name = smalloc_strdup(f->file_name);
+		if (!td->file_stats[i].name) {
+			file_stats_free(td);
+			goto err;
+		}
+	}
+
+	return 0;
+err:
+	td_verror(td, ENOMEM, "file_stats_init");
+	return 1;
+}
+
+void file_stats_free(struct thread_data *td)
+{
+	unsigned int i;
+
+	if (!td->file_stats)
+		return;
+
+	for (i = 0; i < td->nr_file_stats; i++)
+		sfree(td->file_stats[i].name);
+	sfree(td->file_stats);
+	td->file_stats = NULL;
+	td->nr_file_stats = 0;
+}
+
+void file_stats_reset(struct thread_data *td)
+{
+	unsigned int i;
+
+	for (i = 0; i < td->nr_file_stats; i++) {
+		struct file_stat *fs = &td->file_stats[i];
+		char *name = fs->name;
+
+		memset(fs, 0, sizeof(*fs));
+		fs->name = name;
+	}
+}
+
+static void file_stat_sum(struct file_stat *dst, const struct file_stat *src)
+{
+	unsigned int i;
+
+	for_each_rw_ddir(ddir) {
+		dst->ios[ddir] += src->ios[ddir];
+		dst->bytes[ddir] += src->bytes[ddir];
+		dst->lat_sum[ddir] += src->lat_sum[ddir];
+		dst->lat_max[ddir] = max(dst->lat_max[ddir], src->lat_max[ddir]);
+		for (i = 0; i < LATMAP_BINS; i++)
+			dst->lat_bins[ddir][i] += src->lat_bins[ddir][i];
+	}
+}
+
+/*
+ * Add the files of td to sums, by name, as the jobs of a reporting group
+ * may share files
+ */
+static struct file_stat *file_stats_add_job(struct file_stat *sums,
+					    unsigned int *nr,
+					    const struct thread_data *td)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < td->nr_file_stats; i++) {
+		const struct file_stat *fs = &td->file_stats[i];
+
+		for (j = 0; j < *nr; j++)
+			if (!strcmp(sums[j].name, fs->name))
+				break;
+		if (j == *nr) {
+			sums = realloc(sums, (*nr + 1) * sizeof(*sums));
+			memset(&sums[j], 0, sizeof(*sums));
+			sums[j].name = fs->name;
+			(*nr)++;
+		}
+		file_stat_sum(&sums[j], fs);
+	}
+
+	return sums;
+}
+
+static void file_stat_ddir_json(struct json_object *parent,
+				const struct file_stat *fs,
+				const struct thread_stat *ts,
+				enum fio_ddir ddir)
+{
+	static const double pcts[] = { 50.0, 90.0, 99.0, 99.9 };
+	struct json_object *obj, *lat, *pct;
+	unsigned long long runtime = ts->runtime[ddir];
+	char name[32];
+	unsigned int i;
+
+	obj = json_create_object();
+	json_object_add_value_object(parent, io_ddir_name(ddir), obj);
+	json_object_add_value_int(obj, "io_bytes", fs->bytes[ddir]);
+	json_object_add_value_int(obj, "total_ios", fs->ios[ddir]);
+	json_object_add_value_int(obj, "bw_bytes",
+		runtime ? fs->bytes[ddir] * 1000 / runtime : 0);
+	json_object_add_value_float(obj, "iops",
+		runtime ? (double) fs->ios[ddir] * 1000.0 / runtime : 0.0);
+
+	lat = json_create_object();
+	json_object_add_value_object(obj, "clat_ns", lat);
+	json_object_add_value_float(lat, "mean",
+		(double) fs->lat_sum[ddir] / fs->ios[ddir]);
+	json_object_add_value_int(lat, "max", fs->lat_max[ddir]);
+
+	pct = json_create_object();
+	json_object_add_value_object(lat, "percentile", pct);
+	for (i = 0; i < FIO_ARRAY_SIZE(pcts); i++) {
+		snprintf(name, sizeof(name), "%f", pcts[i]);
+		json_object_add_value_int(pct, name,
+			latmap_pct(fs->lat_bins[ddir], fs->ios[ddir],
+				   fs->lat_max[ddir], pcts[i]));
+	}
+}
+
+/*
+ * Add a "files" array to the JSON of ts, if its jobs kept per file stats.
+ * Only the backend has the jobs around, clients don't get these.
+ */
+void file_stats_json(struct json_object *root, struct thread_stat *ts)
+{
+	struct thread_data *first = NULL;
+	struct file_stat *sums = NULL;
+	struct json_array *array;
+	unsigned int nr = 0, i;
+
+	for_each_td(td) {
+		if (td->thread_number == ts->thread_number) {
+			first = td;
+			break;
+		}
+	} end_for_each();
+	if (!first)
+		return;
+
+	if (!first->o.group_reporting)
+		sums = file_stats_add_job(sums, &nr, first);
+	else {
+		for_each_td(td) {
+			if (td->o.group_reporting &&
+			    td->groupid == first->groupid)
+				sums = file_stats_add_job(sums, &nr, td);
+		} end_for_each();
+	}
+	if (!nr)
+		return;
+
+	array = json_create_array();
+	json_object_add_value_array(root, "files", array);
+	for (i = 0; i < nr; i++) {
+		struct json_object *obj = json_create_object();
+
+		json_array_add_value_object(array, obj);
+		json_object_add_value_string(obj, "name", sums[i].name);
+		for_each_rw_ddir(ddir) {
+			if (sums[i].ios[ddir])
+				file_stat_ddir_json(obj, &sums[i], ts, ddir);
+		}
+	}
+
+	free(sums);
+}
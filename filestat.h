@@ -0,0 +1,50 @@
+#ifndef FIO_FILESTAT_H
+#define FIO_FILESTAT_H
+
+#include <stdint.h>
+
+#include "io_ddir.h"
+#include "latmap.h"
+
+struct thread_data;
+struct thread_stat;
+struct json_object;
+
+/*
+ * per_file_stats=1 counts the IOs, bytes and completion latency of each
+ * file of a job, in an array indexed by fileno. The latency histogram
+ * uses the log-linear bins of lat_heatmap. The array is in shared memory,
+ * with the names copied in, so the stats are still there to be reported
+ * once the job has closed and freed its files.
+ */
+struct file_stat {
+	char *name;
+	uint64_t ios[DDIR_RWDIR_CNT];
+	uint64_t bytes[DDIR_RWDIR_CNT];
+	uint64_t lat_sum[DDIR_RWDIR_CNT];
+	uint64_t lat_max[DDIR_RWDIR_CNT];
+	uint32_t lat_bins[DDIR_RWDIR_CNT][LATMAP_BINS];
+};
+
+extern int file_stats_init(struct thread_data *);
+extern void file_stats_free(struct thread_data *);
+extern void file_stats_reset(struct thread_data *);
+extern void file_stats_json(struct json_object *, struct thread_stat *);
+
+static inline void file_stat_add(struct file_stat *fs, unsigned int nr,
+				 unsigned int fileno, enum fio_ddir ddir,
+				 unsigned int bytes, unsigned long long nsec)
+{
+	if (!fs || fileno >= nr)
+		return;
+
+	fs += fileno;
+	fs->ios[ddir]++;
+	fs->bytes[ddir] += bytes;
+	fs->lat_sum[ddir] += nsec;
+	if (nsec > fs->lat_max[ddir])
+		fs->lat_max[ddir] = nsec;
+	fs->lat_bins[ddir][latmap_bin(nsec)]++;
+}
+
+#endif
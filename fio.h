@@ -42,12 +42,15 @@
 #include "server.h"
 #include "stat.h"
 #include "flow.h"
+#include "rate-bucket.h"
 #include "io_u.h"
 #include "io_u_queue.h"
 #include "workqueue.h"
 #include "steadystate.h"
 #include "lib/nowarn_snprintf.h"
+#include "lib/fls.h"
 #include "dedupe.h"
+#include "memacct.h"
 
 #ifdef CONFIG_SOLARISAIO
 #include <sys/asynch.h>
@@ -70,6 +73,14 @@
 #endif
 
 struct fio_sem;
+struct zbd_reset_worker;
+struct fenwick;
+struct alias_table;
+struct iolog_capture;
+struct trace_inflight;
+struct file_stat;
+struct cpu_locality;
+struct shared_read_region;
 
 /*
  * offset generator types
@@ -144,6 +155,8 @@ enum {
 	FIO_RAND_POISSON3_OFF,
 	FIO_RAND_PRIO_CMDS,
 	FIO_RAND_DEDUPE_WORKING_SET_IX,
+	FIO_RAND_DEDUPE_PATCH,
+	FIO_RAND_FDP_OFF,
 	FIO_RAND_NR_OFFS,
 };
 
@@ -156,6 +169,9 @@ enum {
 
 	THINKTIME_BLOCKS_TYPE_COMPLETE = 0,
 	THINKTIME_BLOCKS_TYPE_ISSUE = 1,
+
+	FREELIST_ORDER_LIFO = 0,
+	FREELIST_ORDER_FIFO = 1,
 };
 
 enum {
@@ -186,11 +202,129 @@ struct zone_split_index {
 struct thread_data {
 	struct flist_head opt_list;
 	unsigned long long flags;
-	struct thread_options o;
+
+	/*
+	 * Per-IO state. Only the job thread touches these, on every io_u
+	 * it queues or reaps, so they are kept together at the front and
+	 * on their own cache lines. See td_layout_check().
+	 */
+
+	/*
+	 * IO engine hooks, contains everything needed to submit an io_u
+	 * to any of the available IO engines.
+	 */
+	struct ioengine_ops *io_ops __fio_cacheline_aligned;
+
+	/*
+	 * IO engine private data and dlhandle.
+	 */
+	void *io_ops_data;
+
+	/*
+	 * Queue depth of io_u's that fio MIGHT do
+	 */
+	unsigned int cur_depth;
+
+	/*
+	 * io_u's about to be committed
+	 */
+	unsigned int io_u_queued;
+
+	/*
+	 * io_u's submitted but not completed yet
+	 */
+	unsigned int io_u_in_flight;
+
+	/*
+	 * Reads and writes staged for ->queue_batch(), and the completions
+	 * ->reap_batch() hands back
+	 */
+	struct io_u **io_u_batch;
+	unsigned int io_u_batch_nr;
+	bool io_batch;
+	struct io_u **io_u_reaped;
+
+	/*
+	 * Moving average of cur_depth at reap time, in 1/16ths, used for
+	 * iodepth_batch_complete_adaptive
+	 */
+	unsigned int reap_depth_ewma;
+
+	/*
+	 * List of free and requeued io_u's
+	 */
+	struct io_u_queue io_u_freelist;
+	struct io_u_ring io_u_requeues;
+
+	int error;
+	bool last_was_sync;
+	enum fio_ddir last_ddir;
+	enum fio_ddir rwmix_ddir;
+	unsigned long rwmix_issues;
+	/* io_issues[] when the current rwmix started, moved by phases */
+	uint64_t rwmix_issues_base[DDIR_RWDIR_CNT];
+
+	struct timespec ts_cache;
+	unsigned int ts_cache_nr;
+	unsigned int ts_cache_mask;
+	struct timespec last_issue;
+
+	/*
+	 * Issue side
+	 */
+	uint64_t io_issues[DDIR_RWDIR_CNT];
+	uint64_t io_issue_bytes[DDIR_RWDIR_CNT];
+
+	/*
+	 * Completions
+	 */
+	uint64_t io_blocks[DDIR_RWDIR_CNT];
+	uint64_t this_io_blocks[DDIR_RWDIR_CNT];
+	uint64_t io_bytes[DDIR_RWDIR_CNT];
+	uint64_t this_io_bytes[DDIR_RWDIR_CNT];
+	uint64_t bytes_done[DDIR_RWDIR_CNT];
+
+	/*
+	 * Rate state
+	 */
+	uint64_t rate_bps[DDIR_RWDIR_CNT];
+	uint64_t rate_next_io_time[DDIR_RWDIR_CNT];
+	unsigned long long rate_io_issue_bytes[DDIR_RWDIR_CNT];
+
+	/*
+	 * State for random io, a bitmap of blocks done vs not done
+	 */
+	struct frand_state random_state;
+
+	/*
+	 * Written by the backend, helper or verify threads while the job
+	 * runs. Keep them off the cache lines above, so polling them does
+	 * not bounce the job's per-IO state between CPUs.
+	 */
+	volatile int runstate __fio_cacheline_aligned;
+	volatile bool terminate;
+	int sig;
+	int done;
+	int stop_io;
+	volatile int update_rusage;
+	volatile int log_win_pending;
+	volatile int vstate_ckpt_pending;
+	struct fio_sem *rusage_sem;
+
+	/*
+	 * Shared with offload and verify workers
+	 */
+	pthread_mutex_t io_u_lock __fio_cacheline_aligned;
+	pthread_cond_t free_cond;
+	struct io_u_queue io_u_all;
+	int io_ops_init;
+
+	struct thread_options o __fio_cacheline_aligned;
 	void *eo;
 	pthread_t thread;
 	unsigned int thread_number;
 	unsigned int subjob_number;
+	unsigned int nr_subjobs;
 	unsigned int groupid;
 	struct thread_stat ts __attribute__ ((aligned(8)));
 
@@ -213,17 +347,49 @@ struct thread_data {
 	uint64_t stat_io_blocks[DDIR_RWDIR_CNT];
 	struct timespec iops_sample_time;
 
-	volatile int update_rusage;
-	struct fio_sem *rusage_sem;
+	struct stat_shard stat_shard;
+
 	struct rusage ru_start;
 	struct rusage ru_end;
 
+	/* perf_counters, in FIO_PERF_* order */
+	int perf_fd[FIO_PERF_NR];
+	uint64_t perf_last[FIO_PERF_NR];
+	unsigned int perf_nr;
+
+	/* overhead_stats section timing, NULL if not enabled */
+	struct fio_overhead *ovh;
+
+	/* data_reduction_sample state, NULL if not enabled */
+	struct fio_reduction *reduction;
+
+	/* lat_outliers state, NULL if not enabled */
+	struct lat_outliers *outliers;
+
+	/* lat_heatmap state, NULL if not enabled */
+	struct lat_heatmap *latmap;
+
+	/* per_file_stats, indexed by fileno, NULL if not enabled */
+	struct file_stat *file_stats;
+	unsigned int nr_file_stats;
+
+	/* cpu_locality_stats state, NULL if not enabled */
+	struct cpu_locality *cpu_locality;
+
+	/* what fio allocated for this job, for mem_report */
+	struct mem_acct mem_acct;
+
+	/* serialize_overlap in-flight IOs, overlap_lock guards the pointer */
+	struct overlap_index *overlap;
+	pthread_rwlock_t overlap_lock;
+
 	struct fio_file **files;
 	unsigned char *file_locks;
 	unsigned int files_size;
 	unsigned int files_index;
 	unsigned int nr_open_files;
 	unsigned int nr_done_files;
+	struct fenwick *active_files;	/* not done, for file_service_type=random */
 	union {
 		unsigned int next_file;
 		struct frand_state next_file_state;
@@ -238,26 +404,28 @@ struct thread_data {
 		double gauss_dev;
 	};
 	double random_center;
-	int error;
-	int sig;
-	int done;
-	int stop_io;
 	pid_t pid;
 	char *orig_buffer;
 	size_t orig_buffer_size;
-	volatile int runstate;
-	volatile bool terminate;
-	bool last_was_sync;
-	enum fio_ddir last_ddir;
+	struct shared_read_region *shared_read_region;
+	bool iomem_huge;		/* engine wants huge pages, see alloc_mem_huge() */
+	bool iomem_hugetlb;
+	size_t iomem_huge_len;
+	char *pattern_buf;
+	unsigned long long pattern_buf_len;
+	unsigned int compress_level;
 
 	int mmapfd;
 
 	void *iolog_buf;
 	FILE *iolog_f;
+	struct iolog_capture *iolog_cap;
 
 	uint64_t rand_seeds[FIO_RAND_NR_OFFS];
 
 	struct frand_state bsrange_state[DDIR_RWDIR_CNT];
+	struct frand_batch bsrange_batch[DDIR_RWDIR_CNT];
+	struct frand_batch random_batch;
 	struct frand_state verify_state;
 	struct frand_state verify_state_last_do_io;
 	struct frand_state trim_state;
@@ -266,86 +434,77 @@ struct thread_data {
 	struct frand_state buf_state;
 	struct frand_state buf_state_prev;
 	struct frand_state buf_state_ret;
+	uint64_t stamp_key;		/* buffer_stamp, bumped per write */
 	struct frand_state dedupe_state;
 	struct frand_state zone_state;
 	struct frand_state prio_state;
 	struct frand_state dedupe_working_set_index_state;
+	struct frand_state dedupe_patch_state;
+	struct frand_state fdp_state;
 	struct frand_state *dedupe_working_set_states;
 
 	unsigned long long num_unique_pages;
 
 	struct zone_split_index **zone_state_index;
+	/* bssplit sampling tables, NULL falls back to the percentage scan */
+	struct alias_table *bssplit_alias[DDIR_RWDIR_CNT];
 	unsigned int num_open_zones;
+	struct zbd_reset_worker *zbd_reset_worker;
 
 	unsigned int verify_batch;
 	unsigned int trim_batch;
+	uint64_t verify_interleaved;
 
 	struct thread_io_list *vstate;
 
-	int shm_id;
-
-	/*
-	 * Job default IO priority set with prioclass and prio options.
-	 */
-	unsigned int ioprio;
-
 	/*
-	 * IO engine hooks, contains everything needed to submit an io_u
-	 * to any of the available IO engines.
+	 * Periodic verify state checkpoints. The helper thread sets
+	 * vstate_ckpt_pending, the job appends the checkpoint itself.
+	 * Once vstate_ckpt_written is set, the state file is append only.
 	 */
-	struct ioengine_ops *io_ops;
-	int io_ops_init;
+	unsigned int vstate_ckpt_written;
+	uint64_t vstate_ckpt_next;
+	uint64_t vstate_ckpt_numberio;
 
 	/*
-	 * IO engine private data and dlhandle.
+	 * cgroup2 counters at the start of the job, and the cgroup they
+	 * are read from, for cgroup_stat_interval.
 	 */
-	void *io_ops_data;
-
-	/*
-	 * Queue depth of io_u's that fio MIGHT do
-	 */
-	unsigned int cur_depth;
+	char cgroup_root[PATH_MAX];
+	uint64_t cgroup_io_base[FIO_CG_NR];
+	uint64_t cgroup_stat_next;
 
-	/*
-	 * io_u's about to be committed
-	 */
-	unsigned int io_u_queued;
+	int shm_id;
 
 	/*
-	 * io_u's submitted but not completed yet
+	 * Job default IO priority set with prioclass and prio options.
 	 */
-	unsigned int io_u_in_flight;
+	unsigned int ioprio;
 
-	/*
-	 * List of free and busy io_u's
-	 */
-	struct io_u_ring io_u_requeues;
-	struct io_u_queue io_u_freelist;
-	struct io_u_queue io_u_all;
-	pthread_mutex_t io_u_lock;
-	pthread_cond_t free_cond;
 
 	/*
 	 * async verify offload
 	 */
-	struct flist_head verify_list;
-	pthread_t *verify_threads;
+	struct verify_worker *verify_workers;
+	unsigned int nr_verify_workers;
 	unsigned int nr_verify_threads;
-	pthread_cond_t verify_cond;
-	int verify_thread_exit;
+	unsigned int verify_next;
 
-	/*
-	 * Rate state
-	 */
-	uint64_t rate_bps[DDIR_RWDIR_CNT];
-	uint64_t rate_next_io_time[DDIR_RWDIR_CNT];
 	unsigned long long last_rate_check_bytes[DDIR_RWDIR_CNT];
 	unsigned long last_rate_check_blocks[DDIR_RWDIR_CNT];
-	unsigned long long rate_io_issue_bytes[DDIR_RWDIR_CNT];
 	struct timespec last_rate_check_time[DDIR_RWDIR_CNT];
 	int64_t last_usec[DDIR_RWDIR_CNT];
 	struct frand_state poisson_state[DDIR_RWDIR_CNT];
 
+	/*
+	 * Backing store of all io_u's and their engine data
+	 */
+	void *io_u_arena;
+	size_t io_u_arena_size;
+	size_t io_u_stride;
+	size_t io_u_priv_off;
+	size_t io_u_trim_off;
+
 	/*
 	 * Enforced rate submission/completion workqueue
 	 */
@@ -354,47 +513,43 @@ struct thread_data {
 	uint64_t total_io_size;
 	uint64_t fill_device_size;
 
-	/*
-	 * Issue side
-	 */
-	uint64_t io_issues[DDIR_RWDIR_CNT];
 	uint64_t verify_read_issues;
-	uint64_t io_issue_bytes[DDIR_RWDIR_CNT];
 	uint64_t loops;
-
-	/*
-	 * Completions
-	 */
-	uint64_t io_blocks[DDIR_RWDIR_CNT];
-	uint64_t this_io_blocks[DDIR_RWDIR_CNT];
-	uint64_t io_bytes[DDIR_RWDIR_CNT];
-	uint64_t this_io_bytes[DDIR_RWDIR_CNT];
 	uint64_t io_skip_bytes;
 	uint64_t zone_bytes;
 	struct fio_sem *sem;
-	uint64_t bytes_done[DDIR_RWDIR_CNT];
 	uint64_t bytes_verified;
 
+
 	uint64_t *thinktime_blocks_counter;
 	struct timespec last_thinktime;
 	int64_t last_thinktime_blocks;
 
 	/*
-	 * State for random io, a bitmap of blocks done vs not done
+	 * random_partition: number of clones sharing the LFSR sequence
 	 */
-	struct frand_state random_state;
+	unsigned int random_partitions;
 
 	struct timespec start;	/* start of this loop */
 	struct timespec epoch;	/* time job was started */
 	unsigned long long alternate_epoch; /* Time job was started, clock_gettime's clock_id epoch based. */
-	struct timespec last_issue;
 	long time_offset;
-	struct timespec ts_cache;
 	struct timespec terminate_time;
-	unsigned int ts_cache_nr;
-	unsigned int ts_cache_mask;
 	bool ramp_time_over;
 
+	/*
+	 * Last completion timestamp, reused by clock_batch to time new IO
+	 */
+	struct timespec clock_batch_ts;
+	bool clock_batch_valid;
+	bool clock_batch_used;
+
+	/*
+	 * precise_pacing: how long before a deadline to stop sleeping and
+	 * spin, tracking how late sleeps wake up
+	 */
+	uint64_t pace_spin_nsec;
+
 	/*
 	 * Time since last latency_window was started
 	 */
@@ -406,13 +561,15 @@ struct thread_data {
 	unsigned int latency_stable_count;
 	uint64_t latency_ios;
 	int latency_end_run;
+	unsigned int latency_cuts;
+	unsigned int latency_cut_sum;
+	FILE *latency_log;
 
 	/*
 	 * read/write mixed workload state
 	 */
 	struct frand_state rwmix_state;
-	unsigned long rwmix_issues;
-	enum fio_ddir rwmix_ddir;
+	struct frand_batch rwmix_batch;
 	unsigned int ddir_seq_nr;
 
 	/*
@@ -428,6 +585,14 @@ struct thread_data {
 	struct flist_head io_hist_list;
 	unsigned long io_hist_len;
 
+	/*
+	 * verify_bitmap cursor, file index and block
+	 */
+	unsigned int verify_map_file;
+	uint64_t verify_map_next;
+	uint64_t verify_sampled;
+	uint64_t verify_skipped;
+
 	/*
 	 * For IO replaying
 	 */
@@ -436,6 +601,7 @@ struct thread_data {
 	unsigned int io_log_blktrace;
 	unsigned int io_log_blktrace_swap;
 	unsigned long long io_log_last_ttime;
+	struct trace_inflight *io_log_inflight;
 	struct timespec io_log_start_time;
 	unsigned int io_log_current;
 	unsigned int io_log_checkmark;
@@ -443,6 +609,17 @@ struct thread_data {
 	unsigned int io_log_version;
 	struct timespec io_log_highmark_time;
 
+	/*
+	 * Sharded replay: number of shards the iolog is split into, the
+	 * pre-parsed entries of this shard, and the replay start time shared
+	 * by all clones of the job (lives in the first one).
+	 */
+	unsigned int io_log_shards;
+	struct io_piece *io_log_pieces;
+	uint64_t io_log_epoch;
+	uint64_t *io_log_epochp;
+	struct iolog_map *io_log_map;
+
 	/*
 	 * For tracking/handling discards
 	 */
@@ -472,6 +649,24 @@ struct thread_data {
 	struct fio_flow *flow;
 	unsigned long long flow_counter;
 
+	struct fio_rate_bucket *rate_bucket;
+
+	/*
+	 * phases= schedule, and the queue depth cap of the current phase
+	 */
+	struct phase_data *phases;
+	unsigned int phase_qd;
+
+	/*
+	 * sweep= point this job runs, counting from 1, 0 if not part of a
+	 * sweep, and its param=value list
+	 */
+	unsigned int sweep_point;
+	char sweep_desc[FIO_JOBDESC_SIZE];
+
+	/* precondition= pass this job runs, PRECOND_NONE if it's not one */
+	unsigned int precond_pass;
+
 	/*
 	 * Can be overloaded by profiles
 	 */
@@ -546,9 +741,14 @@ enum {
 #define __fio_stringify_1(x)	#x
 #define __fio_stringify(x)	__fio_stringify_1(x)
 
-#define REAL_MAX_JOBS		4096
+/*
+ * Segment n of the thread area holds JOBS_PER_SEG << n jobs, so the area
+ * doubles every time it grows and a handful of shm segments cover
+ * REAL_MAX_JOBS.
+ */
+#define REAL_MAX_JOBS		65536
 #define JOBS_PER_SEG		8
-#define REAL_MAX_SEG		(REAL_MAX_JOBS / JOBS_PER_SEG)
+#define REAL_MAX_SEG		14
 
 extern bool exitall_on_terminate;
 extern unsigned int thread_number;
@@ -574,6 +774,8 @@ extern int terse_version;
 extern bool is_backend;
 extern bool is_local_backend;
 extern int nr_clients;
+extern unsigned int fio_shard_index;
+extern unsigned int fio_shard_count;
 extern bool log_syslog;
 extern int status_interval;
 extern const char fio_version_string[];
@@ -585,12 +787,16 @@ extern char *aux_path;
 
 extern struct thread_segment segments[REAL_MAX_SEG];
 
+static inline unsigned int seg_nr_jobs(unsigned int seg)
+{
+	return JOBS_PER_SEG << seg;
+}
+
 static inline struct thread_data *tnumber_to_td(unsigned int tnumber)
 {
-	struct thread_segment *seg;
+	unsigned int seg = __fls(tnumber / JOBS_PER_SEG + 1) - 1;
 
-	seg = &segments[tnumber / JOBS_PER_SEG];
-	return &seg->threads[tnumber & (JOBS_PER_SEG - 1)];
+	return &segments[seg].threads[tnumber - (seg_nr_jobs(seg) - JOBS_PER_SEG)];
 }
 
 static inline bool is_running_backend(void)
@@ -637,7 +843,11 @@ extern void fio_options_set_ioengine_opts(struct option *long_options, struct th
 extern void fio_options_dup_and_init(struct option *);
 extern char *fio_option_dup_subs(const char *);
 extern void fio_options_mem_dupe(struct thread_data *);
+#ifdef FIO_HAVE_CPUS_AUTO
+extern int fio_cpus_auto(struct thread_data *, os_cpu_mask_t *);
+#endif
 extern void td_fill_rand_seeds(struct thread_data *);
+extern void init_rand_file_service(struct thread_data *);
 extern void td_fill_verify_state_seed(struct thread_data *);
 extern void add_job_opts(const char **, int);
 extern int ioengine_load(struct thread_data *);
@@ -687,7 +897,7 @@ enum {
 };
 
 #define TD_ENG_FLAG_SHIFT	18
-#define TD_ENG_FLAG_MASK	((1ULL << 18) - 1)
+#define TD_ENG_FLAG_MASK	((1ULL << 21) - 1)
 
 static inline void td_set_ioengine_flags(struct thread_data *td)
 {
@@ -726,9 +936,12 @@ extern void fio_mark_td_terminate(struct thread_data *);
  * Memory helpers
  */
 extern int __must_check fio_pin_memory(struct thread_data *);
+extern void fio_td_numa_place(struct thread_data *);
 extern void fio_unpin_memory(struct thread_data *);
 extern int __must_check allocate_io_mem(struct thread_data *);
 extern void free_io_mem(struct thread_data *);
+extern unsigned int shared_read_nr_bufs(struct thread_data *,
+					unsigned long long);
 extern void free_threads_shm(void);
 
 #ifdef FIO_INTERNAL
@@ -751,6 +964,7 @@ extern int io_queue_event(struct thread_data *td, struct io_u *io_u, int *ret,
 extern void lat_target_check(struct thread_data *);
 extern void lat_target_init(struct thread_data *);
 extern void lat_target_reset(struct thread_data *);
+extern void lat_target_exit(struct thread_data *);
 
 /*
  * Iterates all threads/processes within all the defined jobs
@@ -827,6 +1041,16 @@ static inline bool td_async_processing(struct thread_data *td)
 	return (td->flags & TD_F_NEED_LOCK) != 0;
 }
 
+/*
+ * With verify_threads, the verify phase hands its reads to the offload
+ * workers even though the job otherwise submits inline
+ */
+static inline bool td_verify_threads(struct thread_data *td)
+{
+	return td->o.verify_threads > 1 && !td->o.experimental_verify &&
+		td->o.io_submit_mode != IO_MODE_OFFLOAD;
+}
+
 static inline bool td_offload_overlap(struct thread_data *td)
 {
 	return td->o.serialize_overlap && td->o.io_submit_mode == IO_MODE_OFFLOAD;
@@ -878,12 +1102,14 @@ enum {
 	__FIO_OUTPUT_JSON	= 1,
 	__FIO_OUTPUT_NORMAL	= 2,
         __FIO_OUTPUT_JSON_PLUS  = 3,
-	FIO_OUTPUT_NR		= 4,
+	__FIO_OUTPUT_COLUMNAR	= 4,
+	FIO_OUTPUT_NR		= 5,
 
 	FIO_OUTPUT_TERSE	= 1U << __FIO_OUTPUT_TERSE,
 	FIO_OUTPUT_JSON		= 1U << __FIO_OUTPUT_JSON,
 	FIO_OUTPUT_NORMAL	= 1U << __FIO_OUTPUT_NORMAL,
 	FIO_OUTPUT_JSON_PLUS    = 1U << __FIO_OUTPUT_JSON_PLUS,
+	FIO_OUTPUT_COLUMNAR	= 1U << __FIO_OUTPUT_COLUMNAR,
 };
 
 enum {
@@ -902,6 +1128,7 @@ enum {
 	FIO_RAND_GEN_TAUSWORTHE = 0,
 	FIO_RAND_GEN_LFSR,
 	FIO_RAND_GEN_TAUSWORTHE64,
+	FIO_RAND_GEN_XOSHIRO,
 };
 
 enum {
@@ -912,8 +1139,6 @@ enum {
 extern void exec_trigger(const char *);
 extern void check_trigger_file(void);
 
-extern bool in_flight_overlap(struct io_u_queue *q, struct io_u *io_u);
-extern pthread_mutex_t overlap_check;
 
 static inline void *fio_memalign(size_t alignment, size_t size, bool shared)
 {
@@ -31,5 +31,10 @@ extern bool in_ramp_time(struct thread_data *);
 extern void fio_time_init(void);
 extern void timespec_add_msec(struct timespec *, unsigned int);
 extern void set_epoch_time(struct thread_data *, int, clockid_t);
+extern uint64_t fio_realtime_ns(void);
+extern void fio_wait_start_at(void);
+
+extern uint64_t fio_start_at_ns;
+extern int64_t fio_clock_offset_ns;
 
 #endif
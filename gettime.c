@@ -24,6 +24,33 @@ static unsigned int cycles_wrap;
 #endif
 bool tsc_reliable = false;
 
+#ifdef ARCH_HAVE_CPU_CLOCK
+#ifdef ARCH_HAVE_CPU_CLOCK_CPU
+/*
+ * If the CPU clocks aren't synced, the offset of each CPU clock from
+ * the reference CPU, subtracted from every reading.
+ */
+static int64_t *cpu_clock_offsets;
+static unsigned int nr_cpu_clock_offsets;
+#endif
+
+static inline unsigned long long fio_cpu_clock(void)
+{
+#ifdef ARCH_HAVE_CPU_CLOCK_CPU
+	if (cpu_clock_offsets) {
+		unsigned long long t;
+		unsigned int cpu;
+
+		t = get_cpu_clock_cpu(&cpu);
+		if (cpu < nr_cpu_clock_offsets)
+			t -= cpu_clock_offsets[cpu];
+		return t;
+	}
+#endif
+	return get_cpu_clock();
+}
+#endif
+
 struct tv_valid {
 	int warned;
 };
@@ -188,7 +215,7 @@ static void __fio_gettime(struct timespec *tp)
 		tv = pthread_getspecific(tv_tls_key);
 #endif
 
-		t = get_cpu_clock();
+		t = fio_cpu_clock();
 #ifdef ARCH_CPU_CLOCK_WRAPS
 		if (t < cycles_start && !cycles_wrap)
 			cycles_wrap = 1;
@@ -243,10 +270,10 @@ static unsigned long get_cycles_per_msec(void)
 
 	fio_get_mono_time(&s);
 
-	c_s = get_cpu_clock();
+	c_s = fio_cpu_clock();
 	do {
 		fio_get_mono_time(&e);
-		c_e = get_cpu_clock();
+		c_e = fio_cpu_clock();
 
 		elapsed = ntime_since(&s, &e);
 		if (elapsed >= 1280000)
@@ -364,7 +391,7 @@ static int calibrate_cpu_clock(void)
 			max_cycles_shift, (1ULL << max_cycles_shift),
 			nsecs_for_max_cycles, max_cycles_mask);
 
-	cycles_start = get_cpu_clock();
+	cycles_start = fio_cpu_clock();
 	dprint(FD_TIME, "cycles_start=%llu\n", cycles_start);
 	return 0;
 }
@@ -401,6 +428,34 @@ void fio_local_clock_init(void)
 }
 #endif
 
+static int calibrate_cpu_offsets(void);
+static void clear_cpu_offsets(void);
+
+/*
+ * Check if the CPU clock can be used across all CPUs. If the clocks run
+ * at a constant rate but aren't synced, try again with per-CPU offset
+ * corrections. Corrected readings are in the reference CPU's frame, so
+ * the clock is calibrated again, and cycles_start sampled again, whenever
+ * the corrections change.
+ */
+static bool fio_cpu_clock_usable(void)
+{
+	if (!fio_monotonic_clocktest(0))
+		return true;
+
+	if (calibrate_cpu_offsets())
+		return false;
+
+	if (!calibrate_cpu_clock() && !fio_monotonic_clocktest(0)) {
+		dprint(FD_TIME, "gettime: using per-CPU clock offsets\n");
+		return true;
+	}
+
+	clear_cpu_offsets();
+	calibrate_cpu_clock();
+	return false;
+}
+
 void fio_clock_init(void)
 {
 	if (fio_clock_source == fio_clock_source_inited)
@@ -422,8 +477,12 @@ void fio_clock_init(void)
 	 * runs at a constant rate and is synced across CPU cores.
 	 */
 	if (tsc_reliable) {
-		if (!fio_clock_source_set && !fio_monotonic_clocktest(0))
-			fio_clock_source = CS_CPUCLOCK;
+		if (!fio_clock_source_set) {
+			if (fio_cpu_clock_usable())
+				fio_clock_source = CS_CPUCLOCK;
+		} else if (fio_clock_source == CS_CPUCLOCK &&
+			   !fio_cpu_clock_usable())
+			log_info("fio: clocksource=cpu may not be reliable\n");
 	} else if (fio_clock_source == CS_CPUCLOCK)
 		log_info("fio: clocksource=cpu may not be reliable\n");
 	dprint(FD_TIME, "gettime: clocksource=%d\n", (int) fio_clock_source);
@@ -612,7 +671,7 @@ static void *clock_thread_fn(void *data)
 
 	fio_sem_down(&t->lock);
 
-	first = get_cpu_clock();
+	first = fio_cpu_clock();
 	c = &t->entries[0];
 	for (i = 0; i < t->nr_entries; i++, c++) {
 		uint32_t seq;
@@ -624,7 +683,7 @@ static void *clock_thread_fn(void *data)
 			if (seq == UINT_MAX)
 				break;
 			__sync_synchronize();
-			tsc = get_cpu_clock();
+			tsc = fio_cpu_clock();
 		} while (seq != atomic32_compare_and_swap(t->seq, seq, seq + 1));
 
 		if (seq == UINT_MAX)
@@ -801,6 +860,208 @@ err:
 	return !!failed;
 }
 
+#ifdef ARCH_HAVE_CPU_CLOCK_CPU
+
+#define CLOCK_OFFSET_ROUNDS	1000
+
+struct clock_offset_probe {
+	pthread_t thread;
+	int cpu;
+	uint32_t ping;
+	uint32_t pong;
+	uint64_t tsc;
+};
+
+struct clock_offset_data {
+	os_cpu_mask_t mask;
+	unsigned int nr_cpus;
+	int ref_cpu;
+	int64_t *offsets;
+	int ret;
+};
+
+static int clock_pin_thread(int cpu)
+{
+	os_cpu_mask_t cpu_mask;
+	int ret = 0;
+
+	if (fio_cpuset_init(&cpu_mask))
+		return 1;
+
+	fio_cpu_set(&cpu_mask, cpu);
+	if (fio_setaffinity(gettid(), cpu_mask) == -1)
+		ret = 1;
+
+	fio_cpuset_exit(&cpu_mask);
+	return ret;
+}
+
+/*
+ * Answers each ping from the reference CPU with a clock reading, see
+ * clock_offset_ref_fn().
+ */
+static void *clock_offset_fn(void *data)
+{
+	struct clock_offset_probe *p = data;
+	unsigned int cpu;
+	uint32_t i;
+
+	if (clock_pin_thread(p->cpu)) {
+		__atomic_store_n(&p->pong, UINT_MAX, __ATOMIC_RELEASE);
+		return NULL;
+	}
+
+	for (i = 1; i <= CLOCK_OFFSET_ROUNDS; i++) {
+		while (__atomic_load_n(&p->ping, __ATOMIC_ACQUIRE) != i)
+			nop;
+
+		p->tsc = get_cpu_clock_cpu(&cpu);
+
+		/* TSC_AUX must hold the CPU number for the table to work */
+		if (cpu != p->cpu) {
+			__atomic_store_n(&p->pong, UINT_MAX, __ATOMIC_RELEASE);
+			break;
+		}
+		__atomic_store_n(&p->pong, i, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+/*
+ * Estimate the clock offset of every CPU from the reference CPU by
+ * bouncing a cache line back and forth. With t0 and t1 our clock before
+ * and after a round trip and r the remote clock in between, the remote
+ * CPU is (r - (t0 + t1) / 2) cycles ahead, within half the round trip.
+ * The round with the fastest round trip gives the tightest estimate.
+ */
+static void *clock_offset_ref_fn(void *data)
+{
+	struct clock_offset_data *d = data;
+	unsigned int i, cpu;
+
+	if (clock_pin_thread(d->ref_cpu)) {
+		d->ret = 1;
+		return NULL;
+	}
+
+	for (i = 0; i < d->nr_cpus; i++) {
+		struct clock_offset_probe p = { .cpu = i, };
+		uint64_t t0, t1, best = -1ULL;
+		int64_t offset = 0;
+		uint32_t r, pong;
+
+		if (!fio_cpu_isset(&d->mask, i) || (int) i == d->ref_cpu)
+			continue;
+
+		if (pthread_create(&p.thread, NULL, clock_offset_fn, &p)) {
+			d->ret = 1;
+			break;
+		}
+
+		for (r = 1; r <= CLOCK_OFFSET_ROUNDS; r++) {
+			t0 = get_cpu_clock_cpu(&cpu);
+			__atomic_store_n(&p.ping, r, __ATOMIC_RELEASE);
+			while ((pong = __atomic_load_n(&p.pong, __ATOMIC_ACQUIRE)) != r) {
+				if (pong == UINT_MAX)
+					break;
+				nop;
+			}
+			if (pong == UINT_MAX) {
+				d->ret = 1;
+				break;
+			}
+			t1 = get_cpu_clock_cpu(&cpu);
+
+			if (t1 - t0 < best) {
+				best = t1 - t0;
+				offset = (int64_t) (p.tsc - (t0 + best / 2));
+			}
+		}
+
+		pthread_join(p.thread, NULL);
+		if (d->ret)
+			break;
+
+		d->offsets[i] = offset;
+		dprint(FD_TIME, "cs: cpu%3u: offset=%lld, round trip=%llu\n", i,
+			(long long) offset, (unsigned long long) best);
+	}
+
+	return NULL;
+}
+
+/*
+ * Measure the per-CPU clock offsets and correct every CPU clock reading
+ * with them. Returns 0 if the corrections are in place.
+ */
+static int calibrate_cpu_offsets(void)
+{
+	struct clock_offset_data d = { .ref_cpu = -1, };
+	pthread_t thread;
+	unsigned int i;
+
+	if (!arch_has_cpu_clock_cpu())
+		return 1;
+
+	d.nr_cpus = cpus_configured();
+#ifdef FIO_HAVE_GET_THREAD_AFFINITY
+	fio_get_thread_affinity(d.mask);
+#else
+	memset(&d.mask, 0, sizeof(d.mask));
+	for (i = 0; i < d.nr_cpus; i++)
+		fio_cpu_set(&d.mask, i);
+#endif
+	for (i = 0; i < d.nr_cpus; i++) {
+		if (fio_cpu_isset(&d.mask, i)) {
+			d.ref_cpu = i;
+			break;
+		}
+	}
+	if (d.ref_cpu == -1)
+		return 1;
+
+	d.offsets = calloc(d.nr_cpus, sizeof(int64_t));
+	if (!d.offsets)
+		return 1;
+
+	if (pthread_create(&thread, NULL, clock_offset_ref_fn, &d)) {
+		free(d.offsets);
+		return 1;
+	}
+	pthread_join(thread, NULL);
+
+	if (d.ret) {
+		free(d.offsets);
+		return 1;
+	}
+
+	free(cpu_clock_offsets);
+	nr_cpu_clock_offsets = d.nr_cpus;
+	cpu_clock_offsets = d.offsets;
+	return 0;
+}
+
+static void clear_cpu_offsets(void)
+{
+	free(cpu_clock_offsets);
+	cpu_clock_offsets = NULL;
+	nr_cpu_clock_offsets = 0;
+}
+
+#else
+
+static int calibrate_cpu_offsets(void)
+{
+	return 1;
+}
+
+static void clear_cpu_offsets(void)
+{
+}
+
+#endif /* ARCH_HAVE_CPU_CLOCK_CPU */
+
 #else /* defined(FIO_HAVE_CPU_AFFINITY) && defined(ARCH_HAVE_CPU_CLOCK) */
 
 int fio_monotonic_clocktest(int debug)
@@ -810,4 +1071,13 @@ int fio_monotonic_clocktest(int debug)
 	return 1;
 }
 
+static int calibrate_cpu_offsets(void)
+{
+	return 1;
+}
+
+static void clear_cpu_offsets(void)
+{
+}
+
 #endif
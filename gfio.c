@@ -367,10 +367,15 @@ static int on_expose_drawing_area(GtkWidget *w, GdkEvent *event, gpointer p)
 
 	cr = gdk_cairo_create(gtk_widget_get_window(w));
 
-	if (graph_has_tooltips(g->iops_graph) ||
-	    graph_has_tooltips(g->bandwidth_graph)) {
+	/*
+	 * Only connect once, we get here for every update of the graphs
+	 */
+	if (!g->tooltip_connected &&
+	    (graph_has_tooltips(g->iops_graph) ||
+	     graph_has_tooltips(g->bandwidth_graph))) {
 		g_object_set(w, "has-tooltip", TRUE, NULL);
 		g_signal_connect(w, "query-tooltip", G_CALLBACK(graph_tooltip), g);
+		g->tooltip_connected = 1;
 	}
 
 	cairo_set_source_rgb(cr, 0, 0, 0);
@@ -48,6 +48,7 @@ struct gfio_graphs {
 	graph_label_t read_bw;
 	graph_label_t write_bw;
 	graph_label_t trim_bw;
+	int tooltip_connected;
 };
 
 /*
@@ -22,6 +22,7 @@
  */
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <math.h>
 #include <assert.h>
 #include <stdlib.h>
@@ -40,13 +41,36 @@
  */
 #define TOOLTIP_DELTA	0.08
 
+/*
+ * Long line graphs are drawn from a min/max summary of their values
+ * rather than from the values themselves. Each label keeps a ring of
+ * buckets covering 1 << lod_shift consecutive values each, and merges
+ * buckets pairwise when the ring is full, so the summary stays at most
+ * LOD_BUCKETS entries however long the run is. Summaries are used once a
+ * label holds more than LOD_MIN_VALUES values.
+ */
+#define LOD_BUCKETS	2048
+#define LOD_MIN_VALUES	4096
+
+/*
+ * While a summary is drawn, the x axis is rounded out to 1/LOD_SNAP_STEPS
+ * of its span, so it only moves every so often. In between, only the new
+ * segments are drawn on top of the cached graph.
+ */
+#define LOD_SNAP_STEPS	16
+
 struct xyvalue {
 	double x, y;
 };
 
+struct lod_bucket {
+	struct xyvalue first, last, min, max;
+};
+
 enum {
 	GV_F_ON_PRIO	= 1,
 	GV_F_PRIO_SKIP	= 2,
+	GV_F_NONZERO	= 4,
 };
 
 struct graph_value {
@@ -54,6 +78,7 @@ struct graph_value {
 	struct prio_tree_node node;
 	struct flist_head alias;
 	unsigned int flags;
+	uint64_t seq;
 	char *tooltip;
 	void *value;
 };
@@ -66,7 +91,25 @@ struct graph_label {
 	double r, g, b;
 	int hide;
 	int value_count;
+	unsigned int nonzero_count;
 	struct graph *parent;
+
+	/* sequence number of the next value added */
+	uint64_t seq;
+
+	/* min/max summary, see LOD_BUCKETS */
+	struct lod_bucket *lod;
+	unsigned int lod_head;
+	unsigned int lod_nr;
+	unsigned int lod_shift;
+	uint64_t lod_base;
+	double last_x;
+	int unordered;
+
+	/* last value drawn in the cached graph */
+	uint64_t drawn_seq;
+	double drawn_tx, drawn_ty;
+	int drawn;
 };
 
 struct tick_value {
@@ -100,6 +143,20 @@ struct graph {
 	double ytick_delta;
 	double ytick_zero_val;
 	double ytick_one_val;
+
+	/*
+	 * Line graphs are rendered to 'cache', which is redrawn in full only
+	 * when the range or anything but the values changes.
+	 */
+	cairo_surface_t *cache;
+	int cache_valid;
+	unsigned int cache_xdim, cache_ydim;
+	double cache_minx, cache_maxx, cache_miny, cache_maxy;
+	int cache_good_data;
+
+	/* plot area and data range of the cached graph */
+	double px1, py1, px2, py2;
+	double draw_minx, draw_maxx, draw_miny, draw_maxy;
 };
 
 void graph_set_size(struct graph *g, unsigned int xdim, unsigned int ydim)
@@ -131,6 +188,7 @@ struct graph *graph_new(unsigned int xdim, unsigned int ydim, const char *font)
 void graph_set_font(struct graph *g, const char *font)
 {
 	g->font = font;
+	g->cache_valid = 0;
 }
 
 void graph_x_axis_unit_change_notify(struct graph *g, graph_axis_unit_change_callback f)
@@ -364,6 +422,8 @@ static void graph_draw_x_ticks(struct graph *g, cairo_t *cr,
 		draw_centered_text(cr, g->font, tx, y2 * 1.04, 12.0, tm[i].string);
 		cairo_stroke(cr);
 	}
+
+	free(tm);
 }
 
 static double graph_draw_y_ticks(struct graph *g, cairo_t *cr,
@@ -427,6 +487,8 @@ static double graph_draw_y_ticks(struct graph *g, cairo_t *cr,
 		cairo_stroke(cr);
 	}
 
+	free(tm);
+
 	/*
 	 * Return new max to use
 	 */
@@ -485,8 +547,6 @@ void bar_graph_draw(struct graph *bg, cairo_t *cr)
 	cairo_restore(cr);
 }
 
-typedef double (*xy_value_extractor)(struct graph_value *v);
-
 static double getx(struct graph_value *v)
 {
 	struct xyvalue *xy = v->value;
@@ -499,67 +559,401 @@ static double gety(struct graph_value *v)
 	return xy->y;
 }
 
-static double find_xy_value(struct graph *g, xy_value_extractor getvalue, double_comparator cmp)
+static struct lod_bucket *lod_bucket(struct graph_label *l, unsigned int i)
 {
-	double tmp, answer = 0.0;
-	struct graph_label *i;
-	struct graph_value *j;
-	struct flist_head *jentry, *entry;
-	int first = 1;
+	return &l->lod[(l->lod_head + i) % LOD_BUCKETS];
+}
 
-	flist_for_each(entry, &g->label_list) {
-		i = flist_entry(entry, struct graph_label, list);
+static void lod_bucket_add(struct lod_bucket *b, const struct xyvalue *xy)
+{
+	b->last = *xy;
+	if (xy->y < b->min.y)
+		b->min = *xy;
+	if (xy->y > b->max.y)
+		b->max = *xy;
+}
 
-		flist_for_each(jentry, &i->value_list) {
-			j = flist_entry(jentry, struct graph_value, list);
-			tmp = getvalue(j);
-			if (first) {
-				first = 0;
-				answer = tmp;
-			}
-			answer = cmp(tmp, answer);
+/*
+ * Double the number of values per bucket, merging buckets pairwise
+ */
+static void lod_coarsen(struct graph_label *l)
+{
+	uint64_t base = l->lod_base >> 1;
+	struct lod_bucket *lod;
+	unsigned int i, nr = 0;
+
+	lod = malloc(LOD_BUCKETS * sizeof(*lod));
+	for (i = 0; i < l->lod_nr; i++) {
+		struct lod_bucket *b = lod_bucket(l, i);
+		unsigned int idx = ((l->lod_base + i) >> 1) - base;
+
+		if (idx == nr) {
+			lod[nr++] = *b;
+			continue;
 		}
+
+		lod_bucket_add(&lod[idx], &b->min);
+		lod_bucket_add(&lod[idx], &b->max);
+		lod[idx].last = b->last;
 	}
 
-	return answer;
+	free(l->lod);
+	l->lod = lod;
+	l->lod_head = 0;
+	l->lod_nr = nr;
+	l->lod_base = base;
+	l->lod_shift++;
 }
 
-void line_graph_draw(struct graph *g, cairo_t *cr)
+static void lod_reset(struct graph_label *l)
 {
-	double x1, y1, x2, y2;
-	double minx, miny, maxx, maxy, gminx, gminy, gmaxx, gmaxy;
-	double tx, ty, top_extra, bottom_extra, left_extra, right_extra;
-	struct graph_label *i;
-	struct graph_value *j;
-	int good_data = 1, first = 1;
-	struct flist_head *entry, *lentry;
+	free(l->lod);
+	l->lod = NULL;
+	l->lod_head = l->lod_nr = l->lod_shift = 0;
+	l->lod_base = 0;
+}
 
-	cairo_save(cr);
-	cairo_translate(cr, g->xoffset, g->yoffset);
-	graph_draw_common(g, cr, &x1, &y1, &x2, &y2);
+/*
+ * Add value 'seq' to the summary of 'l'. Summaries rely on x increasing,
+ * a label that goes back in time is always drawn value by value.
+ */
+static void lod_add(struct graph_label *l, uint64_t seq, double x, double y)
+{
+	struct xyvalue xy = { .x = x, .y = y };
+	struct lod_bucket *b;
+	uint64_t nr;
 
-	minx = find_xy_value(g, getx, mindouble);
-	maxx = find_xy_value(g, getx, maxdouble);
-	miny = find_xy_value(g, gety, mindouble);
+	if (l->unordered)
+		return;
+	if (l->value_count && x < l->last_x) {
+		l->unordered = 1;
+		lod_reset(l);
+		return;
+	}
+	l->last_x = x;
 
-	/*
-	 * Start graphs at zero, unless we have a value below. Otherwise
-	 * it's hard to visually compare the read and write graph, since
-	 * the lowest valued one will be the floor of the graph view.
-	 */
-	if (miny > 0)
-		miny = 0;
+	if (!l->lod)
+		l->lod = malloc(LOD_BUCKETS * sizeof(*l->lod));
 
-	maxy = find_xy_value(g, gety, maxdouble);
+	nr = seq >> l->lod_shift;
+	if (l->lod_nr && nr == l->lod_base + l->lod_nr - 1) {
+		lod_bucket_add(lod_bucket(l, l->lod_nr - 1), &xy);
+		return;
+	}
 
-	if (fabs(maxx - minx) < 1e-20 || fabs(maxy - miny) < 1e-20) {
-		good_data = 0;
-		minx = 0.0;
-		miny = 0.0;
-		maxx = 10.0;
-		maxy = 100.0;
+	if (l->lod_nr == LOD_BUCKETS) {
+		lod_coarsen(l);
+		nr = seq >> l->lod_shift;
+		if (nr == l->lod_base + l->lod_nr - 1) {
+			lod_bucket_add(lod_bucket(l, l->lod_nr - 1), &xy);
+			return;
+		}
+	}
+
+	if (!l->lod_nr)
+		l->lod_base = nr;
+	b = lod_bucket(l, l->lod_nr++);
+	b->first = b->last = b->min = b->max = xy;
+}
+
+/*
+ * Drop the buckets that only cover values which left the window. Aliased
+ * values can leave from the middle of it, those stay in the summary until
+ * their bucket goes. They share their x with a value that is still there.
+ */
+static void lod_trim(struct graph_label *l)
+{
+	uint64_t head = l->seq;
+
+	if (!flist_empty(&l->value_list))
+		head = flist_first_entry(&l->value_list, struct graph_value, list)->seq;
+
+	while (l->lod_nr && ((l->lod_base + 1) << l->lod_shift) <= head) {
+		l->lod_head = (l->lod_head + 1) % LOD_BUCKETS;
+		l->lod_base++;
+		l->lod_nr--;
+	}
+}
+
+static int label_use_lod(struct graph_label *l)
+{
+	return !l->unordered && l->value_count > LOD_MIN_VALUES &&
+		l->lod_nr > 1;
+}
+
+/*
+ * Values from this one on are covered by complete buckets. The first
+ * bucket may have lost some values to the window, so those before are
+ * read from the value list.
+ */
+static uint64_t lod_raw_end(struct graph_label *l)
+{
+	return (l->lod_base + 1) << l->lod_shift;
+}
+
+struct xyrange {
+	double minx, maxx, miny, maxy;
+	int empty;
+};
+
+static void xyrange_add(struct xyrange *r, double x, double y)
+{
+	if (r->empty) {
+		r->minx = r->maxx = x;
+		r->miny = r->maxy = y;
+		r->empty = 0;
+		return;
+	}
+
+	r->minx = mindouble(r->minx, x);
+	r->maxx = maxdouble(r->maxx, x);
+	r->miny = mindouble(r->miny, y);
+	r->maxy = maxdouble(r->maxy, y);
+}
+
+static void label_xy_range(struct graph_label *l, struct xyrange *r)
+{
+	uint64_t raw_end = UINT64_MAX;
+	struct flist_head *entry;
+	unsigned int i;
+
+	if (label_use_lod(l))
+		raw_end = lod_raw_end(l);
+
+	flist_for_each(entry, &l->value_list) {
+		struct graph_value *v;
+
+		v = flist_entry(entry, struct graph_value, list);
+		if (v->seq >= raw_end)
+			break;
+		xyrange_add(r, getx(v), gety(v));
+	}
+
+	if (raw_end == UINT64_MAX)
+		return;
+
+	for (i = 1; i < l->lod_nr; i++) {
+		struct lod_bucket *b = lod_bucket(l, i);
+
+		xyrange_add(r, b->first.x, b->min.y);
+		xyrange_add(r, b->last.x, b->max.y);
+	}
+}
+
+/*
+ * Round the range out to a power of two fraction of its span
+ */
+static void graph_snap_range(double *min, double *max)
+{
+	double q;
+
+	q = pow(2.0, ceil(log2((*max - *min) / LOD_SNAP_STEPS)));
+	*min = floor(*min / q) * q;
+	*max = ceil(*max / q) * q;
+}
+
+/*
+ * A line being drawn. Points of ordered labels are gathered per pixel
+ * column, and each column is drawn as its first, lowest, highest and last
+ * point.
+ */
+struct line_path {
+	cairo_t *cr;
+	int unordered;
+	int started;
+	int col;
+	unsigned int nr;
+	struct xyvalue first, last, min, max;
+};
+
+static void path_to(struct line_path *p, double tx, double ty)
+{
+	if (p->started)
+		cairo_line_to(p->cr, tx, ty);
+	else {
+		cairo_move_to(p->cr, tx, ty);
+		p->started = 1;
+	}
+}
+
+static void path_flush(struct line_path *p)
+{
+	struct xyvalue *a = &p->min, *b = &p->max;
+
+	if (!p->nr)
+		return;
+
+	path_to(p, p->first.x, p->first.y);
+	if (p->nr > 2) {
+		if (b->x < a->x) {
+			a = &p->max;
+			b = &p->min;
+		}
+		path_to(p, a->x, a->y);
+		path_to(p, b->x, b->y);
+	}
+	if (p->nr > 1)
+		path_to(p, p->last.x, p->last.y);
+	p->nr = 0;
+}
+
+static void path_add(struct graph *g, struct line_path *p, double x, double y)
+{
+	struct xyvalue t;
+	int col;
+
+	t.x = ((x - g->draw_minx) / (g->draw_maxx - g->draw_minx)) * (g->px2 - g->px1) + g->px1;
+	t.y = g->py2 - ((y - g->draw_miny) / (g->draw_maxy - g->draw_miny)) * (g->py2 - g->py1);
+
+	if (p->unordered) {
+		path_to(p, t.x, t.y);
+		p->last = t;
+		return;
+	}
+
+	col = floor(t.x);
+	if (p->nr && col != p->col)
+		path_flush(p);
+
+	if (!p->nr) {
+		p->col = col;
+		p->first = p->min = p->max = t;
+	} else if (t.y < p->min.y)
+		p->min = t;
+	else if (t.y > p->max.y)
+		p->max = t;
+	p->last = t;
+	p->nr++;
+}
+
+static void path_add_bucket(struct graph *g, struct line_path *p,
+			    struct lod_bucket *b)
+{
+	struct xyvalue *lo = &b->min, *hi = &b->max;
+
+	if (hi->x < lo->x) {
+		lo = &b->max;
+		hi = &b->min;
 	}
 
+	path_add(g, p, b->first.x, b->first.y);
+	path_add(g, p, lo->x, lo->y);
+	path_add(g, p, hi->x, hi->y);
+	path_add(g, p, b->last.x, b->last.y);
+}
+
+static void path_end(struct line_path *p, struct graph_label *l)
+{
+	path_flush(p);
+	cairo_stroke(p->cr);
+
+	l->drawn_seq = l->seq;
+	if (p->started) {
+		l->drawn_tx = p->last.x;
+		l->drawn_ty = p->last.y;
+		l->drawn = 1;
+	}
+}
+
+static void line_graph_draw_label(struct graph *g, struct graph_label *l,
+				  cairo_t *cr)
+{
+	struct line_path p = { .cr = cr, .unordered = l->unordered, };
+	uint64_t raw_end = UINT64_MAX;
+	struct flist_head *entry;
+	unsigned int i;
+
+	if (label_use_lod(l))
+		raw_end = lod_raw_end(l);
+
+	flist_for_each(entry, &l->value_list) {
+		struct graph_value *v;
+
+		v = flist_entry(entry, struct graph_value, list);
+		if (v->seq >= raw_end)
+			break;
+		path_add(g, &p, getx(v), gety(v));
+	}
+
+	if (raw_end != UINT64_MAX) {
+		for (i = 1; i < l->lod_nr; i++)
+			path_add_bucket(g, &p, lod_bucket(l, i));
+	}
+
+	path_end(&p, l);
+}
+
+/*
+ * Draw the values added since the cached graph was last drawn
+ */
+static void line_graph_draw_new(struct graph *g, struct graph_label *l,
+				cairo_t *cr)
+{
+	struct line_path p = { .cr = cr, .unordered = l->unordered, };
+	struct flist_head *entry;
+
+	if (l->drawn_seq == l->seq)
+		return;
+
+	/* new values are at the tail, walk back to the first one */
+	entry = l->value_list.prev;
+	while (entry != &l->value_list) {
+		struct graph_value *v;
+
+		v = flist_entry(entry, struct graph_value, list);
+		if (v->seq < l->drawn_seq)
+			break;
+		entry = entry->prev;
+	}
+
+	if (l->drawn) {
+		cairo_move_to(cr, l->drawn_tx, l->drawn_ty);
+		p.started = 1;
+	}
+
+	for (entry = entry->next; entry != &l->value_list; entry = entry->next) {
+		struct graph_value *v;
+
+		v = flist_entry(entry, struct graph_value, list);
+		path_add(g, &p, getx(v), gety(v));
+	}
+
+	path_end(&p, l);
+}
+
+static int line_graph_cache_valid(struct graph *g, double minx, double maxx,
+				  double miny, double maxy, int good_data)
+{
+	return g->cache_valid && g->cache_xdim == g->xdim &&
+		g->cache_ydim == g->ydim && g->cache_good_data == good_data &&
+		g->cache_minx == minx && g->cache_maxx == maxx &&
+		g->cache_miny == miny && g->cache_maxy == maxy;
+}
+
+static void line_graph_render(struct graph *g, cairo_t *cr, double minx,
+			      double maxx, double miny, double maxy,
+			      int good_data)
+{
+	double x1, y1, x2, y2;
+	double top_extra, bottom_extra, left_extra, right_extra;
+	struct flist_head *lentry;
+
+	g->cache_valid = 1;
+	g->cache_xdim = g->xdim;
+	g->cache_ydim = g->ydim;
+	g->cache_minx = minx;
+	g->cache_maxx = maxx;
+	g->cache_miny = miny;
+	g->cache_maxy = maxy;
+	g->cache_good_data = good_data;
+
+	cairo_save(cr);
+	cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+	cairo_paint(cr);
+	cairo_restore(cr);
+
+	graph_draw_common(g, cr, &x1, &y1, &x2, &y2);
+
 	top_extra = 0.0;
 	bottom_extra = 0.0;
 	left_extra = 0.0;
@@ -574,41 +968,107 @@ void line_graph_draw(struct graph *g, cairo_t *cr)
 	if (g->right_extra > 0.001)
 		right_extra = fabs(maxx - minx) * g->right_extra;
 
-	gminx = minx - left_extra;
-	gmaxx = maxx + right_extra;
-	gminy = miny - bottom_extra;
-	gmaxy = maxy + top_extra;
+	g->draw_minx = minx - left_extra;
+	g->draw_maxx = maxx + right_extra;
+	g->draw_miny = miny - bottom_extra;
+	g->draw_maxy = maxy + top_extra;
+	g->px1 = x1;
+	g->py1 = y1;
+	g->px2 = x2;
+	g->py2 = y2;
 
-	graph_draw_x_ticks(g, cr, x1, y1, x2, y2, gminx, gmaxx, 10, good_data);
-	gmaxy = graph_draw_y_ticks(g, cr, x1, y1, x2, y2, gminy, gmaxy, 10, good_data);
-
-	if (!good_data)
-		goto skip_data;
+	graph_draw_x_ticks(g, cr, x1, y1, x2, y2, g->draw_minx, g->draw_maxx, 10, good_data);
+	g->draw_maxy = graph_draw_y_ticks(g, cr, x1, y1, x2, y2, g->draw_miny, g->draw_maxy, 10, good_data);
 
 	cairo_set_line_width(cr, 1.5);
 	cairo_set_line_join(cr, CAIRO_LINE_JOIN_ROUND);
 
 	flist_for_each(lentry, &g->label_list) {
+		struct graph_label *i;
+
 		i = flist_entry(lentry, struct graph_label, list);
-		first = 1;
-		if (i->hide || i->r < 0) /* invisible data */
+		i->drawn_seq = i->seq;
+		i->drawn = 0;
+		if (!good_data || i->hide || i->r < 0) /* invisible data */
 			continue;
 
 		cairo_set_source_rgb(cr, i->r, i->g, i->b);
-		flist_for_each(entry, &i->value_list) {
-			j = flist_entry(entry, struct graph_value, list);
-			tx = ((getx(j) - gminx) / (gmaxx - gminx)) * (x2 - x1) + x1;
-			ty = y2 - ((gety(j) - gminy) / (gmaxy - gminy)) * (y2 - y1);
-			if (first) {
-				cairo_move_to(cr, tx, ty);
-				first = 0;
-			} else
-				cairo_line_to(cr, tx, ty);
+		line_graph_draw_label(g, i, cr);
+	}
+}
+
+void line_graph_draw(struct graph *g, cairo_t *cr)
+{
+	double minx, miny, maxx, maxy;
+	struct xyrange r = { .empty = 1, };
+	struct flist_head *entry;
+	struct graph_label *i;
+	int good_data = 1, lod = 0;
+	cairo_t *ccr;
+
+	flist_for_each(entry, &g->label_list) {
+		i = flist_entry(entry, struct graph_label, list);
+		label_xy_range(i, &r);
+		lod |= label_use_lod(i);
+	}
+
+	minx = maxx = miny = maxy = 0.0;
+	if (!r.empty) {
+		minx = r.minx;
+		maxx = r.maxx;
+		miny = r.miny;
+		maxy = r.maxy;
+	}
+
+	/*
+	 * Start graphs at zero, unless we have a value below. Otherwise
+	 * it's hard to visually compare the read and write graph, since
+	 * the lowest valued one will be the floor of the graph view.
+	 */
+	if (miny > 0)
+		miny = 0;
+
+	if (fabs(maxx - minx) < 1e-20 || fabs(maxy - miny) < 1e-20) {
+		good_data = 0;
+		minx = 0.0;
+		miny = 0.0;
+		maxx = 10.0;
+		maxy = 100.0;
+	} else if (lod)
+		graph_snap_range(&minx, &maxx);
+
+	if (!g->cache || g->cache_xdim != g->xdim || g->cache_ydim != g->ydim) {
+		if (g->cache)
+			cairo_surface_destroy(g->cache);
+		g->cache = cairo_surface_create_similar(cairo_get_target(cr),
+					CAIRO_CONTENT_COLOR_ALPHA,
+					g->xdim, g->ydim);
+		g->cache_valid = 0;
+	}
+
+	ccr = cairo_create(g->cache);
+	if (!line_graph_cache_valid(g, minx, maxx, miny, maxy, good_data))
+		line_graph_render(g, ccr, minx, maxx, miny, maxy, good_data);
+	else if (good_data) {
+		cairo_set_line_width(ccr, 1.5);
+		cairo_set_line_join(ccr, CAIRO_LINE_JOIN_ROUND);
+
+		flist_for_each(entry, &g->label_list) {
+			i = flist_entry(entry, struct graph_label, list);
+			if (i->hide || i->r < 0) {
+				i->drawn_seq = i->seq;
+				continue;
+			}
+
+			cairo_set_source_rgb(ccr, i->r, i->g, i->b);
+			line_graph_draw_new(g, i, ccr);
 		}
-		cairo_stroke(cr);
 	}
+	cairo_destroy(ccr);
 
-skip_data:
+	cairo_save(cr);
+	cairo_set_source_surface(cr, g->cache, g->xoffset, g->yoffset);
+	cairo_paint(cr);
 	cairo_restore(cr);
 }
 
@@ -621,16 +1081,19 @@ static void setstring(char **str, const char *value)
 void graph_title(struct graph *bg, const char *title)
 {
 	setstring(&bg->title, title);
+	bg->cache_valid = 0;
 }
 
 void graph_x_title(struct graph *bg, const char *title)
 {
 	setstring(&bg->xtitle, title);
+	bg->cache_valid = 0;
 }
 
 void graph_y_title(struct graph *bg, const char *title)
 {
 	setstring(&bg->ytitle, title);
+	bg->cache_valid = 0;
 }
 
 static struct graph_label *graph_find_label(struct graph *bg,
@@ -662,12 +1125,15 @@ graph_label_t graph_add_label(struct graph *bg, const char *label)
 	setstring(&i->label, label);
 	flist_add_tail(&i->list, &bg->label_list);
 	INIT_PRIO_TREE_ROOT(&i->prio_tree);
+	bg->cache_valid = 0;
 	return i;
 }
 
 static void __graph_value_drop(struct graph_label *l, struct graph_value *v)
 {
 	flist_del_init(&v->list);
+	if (v->flags & GV_F_NONZERO)
+		l->nonzero_count--;
 	if (v->tooltip)
 		free(v->tooltip);
 	free(v->value);
@@ -708,7 +1174,7 @@ static void graph_value_drop(struct graph_label *l, struct graph_value *v)
 }
 
 static void graph_label_add_value(struct graph_label *i, void *value,
-				  const char *tooltip)
+				  const char *tooltip, unsigned int flags)
 {
 	struct graph *g = i->parent;
 	struct graph_value *x;
@@ -720,6 +1186,10 @@ static void graph_label_add_value(struct graph_label *i, void *value,
 	flist_add_tail(&x->list, &i->value_list);
 	i->value_count++;
 	x->value = value;
+	x->flags = flags;
+	x->seq = i->seq++;
+	if (flags & GV_F_NONZERO)
+		i->nonzero_count++;
 
 	if (tooltip) {
 		double xval = getx(x);
@@ -755,9 +1225,9 @@ static void graph_label_add_value(struct graph_label *i, void *value,
 			alias = container_of(ret, struct graph_value, node);
 			flist_add_tail(&x->alias, &alias->alias);
 		} else
-			x->flags = GV_F_ON_PRIO;
+			x->flags |= GV_F_ON_PRIO;
 	} else
-		x->flags = GV_F_PRIO_SKIP;
+		x->flags |= GV_F_PRIO_SKIP;
 
 	if (g->per_label_limit != -1 &&
 		i->value_count > g->per_label_limit) {
@@ -782,6 +1252,8 @@ static void graph_label_add_value(struct graph_label *i, void *value,
 			if (i->value_count <= g->per_label_limit)
 				break;
 		}
+
+		lod_trim(i);
 	}
 }
 
@@ -793,22 +1265,7 @@ int graph_add_data(struct graph *bg, graph_label_t label, const double value)
 	d = malloc(sizeof(*d));
 	*d = value;
 
-	graph_label_add_value(i, d, NULL);
-	return 0;
-}
-
-static int graph_nonzero_y(struct graph_label *l)
-{
-	struct flist_head *entry;
-
-	flist_for_each(entry, &l->value_list) {
-		struct graph_value *v;
-
-		v = flist_entry(entry, struct graph_value, list);
-		if (gety(v) != 0.0)
-			return 1;
-	}
-
+	graph_label_add_value(i, d, NULL, 0);
 	return 0;
 }
 
@@ -817,17 +1274,21 @@ int graph_add_xy_data(struct graph *bg, graph_label_t label,
 {
 	struct graph_label *i = label;
 	struct xyvalue *xy;
+	int hide = 0;
 
-	if (bg->dont_graph_all_zeroes && y == 0.0 && !graph_nonzero_y(i))
-		i->hide = 1;
-	else
-		i->hide = 0;
+	if (bg->dont_graph_all_zeroes && y == 0.0 && !i->nonzero_count)
+		hide = 1;
+	if (hide != i->hide) {
+		i->hide = hide;
+		bg->cache_valid = 0;
+	}
 
 	xy = malloc(sizeof(*xy));
 	xy->x = x;
 	xy->y = y;
 
-	graph_label_add_value(i, xy, tooltip);
+	lod_add(i, i->seq, x, y);
+	graph_label_add_value(i, xy, tooltip, y != 0.0 ? GV_F_NONZERO : 0);
 	return 0;
 }
 
@@ -839,6 +1300,10 @@ static void graph_free_values(struct graph_label *l)
 		i = flist_first_entry(&l->value_list, struct graph_value, list);
 		graph_value_drop(l, i);
 	}
+
+	lod_reset(l);
+	l->unordered = 0;
+	l->parent->cache_valid = 0;
 }
 
 static void graph_free_labels(struct graph *g)
@@ -890,6 +1355,7 @@ void graph_set_color(struct graph *gr, graph_label_t label, double red,
 	i->r = r;
 	i->g = g;
 	i->b = b;
+	gr->cache_valid = 0;
 }
 
 void graph_free(struct graph *bg)
@@ -898,6 +1364,8 @@ void graph_free(struct graph *bg)
 	free(bg->xtitle);
 	free(bg->ytitle);
 	graph_free_labels(bg);
+	if (bg->cache)
+		cairo_surface_destroy(bg->cache);
 }
 
 /* For each line in the line graph, up to per_label_limit segments may
@@ -907,6 +1375,7 @@ void graph_free(struct graph *bg)
 void line_graph_set_data_count_limit(struct graph *g, int per_label_limit)
 {
 	g->per_label_limit = per_label_limit;
+	g->cache_valid = 0;
 }
 
 void graph_add_extra_space(struct graph *g, double left_percent,
@@ -917,6 +1386,7 @@ void graph_add_extra_space(struct graph *g, double left_percent,
 	g->right_extra = right_percent;
 	g->top_extra = top_percent;
 	g->bottom_extra = bottom_percent;
+	g->cache_valid = 0;
 }
 
 /*
@@ -927,6 +1397,7 @@ void graph_add_extra_space(struct graph *g, double left_percent,
 void graph_set_base_offset(struct graph *g, unsigned int base_offset)
 {
 	g->base_offset = base_offset;
+	g->cache_valid = 0;
 }
 
 int graph_has_tooltips(struct graph *g)
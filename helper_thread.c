@@ -17,7 +17,11 @@
 #include "smalloc.h"
 #include "helper_thread.h"
 #include "steadystate.h"
+#include "metrics.h"
+#include "statshm.h"
+#include "verify.h"
 #include "pshared.h"
+#include "cgroup.h"
 
 static int sleep_accuracy_ms;
 static int timerfd = -1;
@@ -34,6 +38,10 @@ static struct helper_data {
 	struct sk_out *sk_out;
 	pthread_t thread;
 	struct fio_sem *startup_sem;
+#ifdef FIO_HAVE_DISK_UTIL
+	pthread_t du_thread;
+	struct fio_sem *du_sem;
+#endif
 } *helper_data;
 
 struct interval_timer {
@@ -41,6 +49,8 @@ struct interval_timer {
 	struct timespec	expires;
 	uint32_t	interval_ms;
 	int		(*func)(void);
+	int		fd;	/* own timerfd, or -1 to use expires */
+	bool		fired;
 };
 
 void helper_thread_destroy(void)
@@ -156,6 +166,44 @@ void helper_thread_exit(void)
 	helper_data->exit = 1;
 	submit_action(A_EXIT);
 	pthread_join(helper_data->thread, NULL);
+
+#ifdef FIO_HAVE_DISK_UTIL
+	fio_sem_up(helper_data->du_sem);
+	pthread_join(helper_data->du_thread, NULL);
+	fio_sem_remove(helper_data->du_sem);
+#endif
+}
+
+/*
+ * Give each enabled timer its own periodic timerfd, so a wakeup only runs
+ * the timers that are due. Timers without one fall back to the shared
+ * timeout in wait_for_action().
+ */
+static void open_timers(struct interval_timer timer[], int num_timers)
+{
+	int i;
+
+	for (i = 0; i < num_timers; ++i) {
+		timer[i].fd = -1;
+		timer[i].fired = false;
+#ifdef CONFIG_HAVE_TIMERFD_CREATE
+		if (timer[i].interval_ms)
+			timer[i].fd = timerfd_create(CLOCK_MONOTONIC,
+						     TFD_NONBLOCK);
+#endif
+	}
+}
+
+static void close_timers(struct interval_timer timer[], int num_timers)
+{
+	int i;
+
+	for (i = 0; i < num_timers; ++i) {
+		if (timer[i].fd >= 0) {
+			close(timer[i].fd);
+			timer[i].fd = -1;
+		}
+	}
 }
 
 /* Resets timers and returns the time in milliseconds until the next event. */
@@ -168,6 +216,21 @@ static int reset_timers(struct interval_timer timer[], int num_timers,
 	for (i = 0; i < num_timers; ++i) {
 		timer[i].expires = *now;
 		timespec_add_msec(&timer[i].expires, timer[i].interval_ms);
+		timer[i].fired = false;
+#ifdef CONFIG_HAVE_TIMERFD_CREATE
+		if (timer[i].fd >= 0) {
+			struct itimerspec its = {};
+			int res;
+
+			its.it_value.tv_sec = timer[i].interval_ms / 1000;
+			its.it_value.tv_nsec =
+				(timer[i].interval_ms % 1000) * 1000000;
+			its.it_interval = its.it_value;
+			res = timerfd_settime(timer[i].fd, 0, &its, NULL);
+			assert(res == 0);
+			continue;
+		}
+#endif
 		msec_to_next_event = min_not_zero(msec_to_next_event,
 						  timer[i].interval_ms);
 	}
@@ -176,10 +239,13 @@ static int reset_timers(struct interval_timer timer[], int num_timers,
 }
 
 /*
- * Waits for an action from fd during at least timeout_ms. `fd` must be in
- * non-blocking mode.
+ * Waits for an action from fd during at least timeout_ms, or until one of
+ * the timers with their own timerfd fires. `fd` must be in non-blocking
+ * mode. @timed_out is set if timeout_ms expired.
  */
-static uint8_t wait_for_action(int fd, unsigned int timeout_ms)
+static uint8_t wait_for_action(int fd, struct interval_timer timer[],
+			       int num_timers, unsigned int timeout_ms,
+			       bool *timed_out)
 {
 	struct timeval timeout = {
 		.tv_sec  = timeout_ms / 1000,
@@ -188,15 +254,27 @@ static uint8_t wait_for_action(int fd, unsigned int timeout_ms)
 	fd_set rfds, efds;
 	uint8_t action = 0;
 	uint64_t exp;
-	int res;
+	int res, i, maxfd;
 
+	*timed_out = false;
 	res = read_from_pipe(fd, &action, sizeof(action));
-	if (res > 0 || timeout_ms == 0)
+	if (res > 0)
 		return action;
+	if (timeout_ms == 0) {
+		*timed_out = true;
+		return action;
+	}
 	FD_ZERO(&rfds);
 	FD_SET(fd, &rfds);
 	FD_ZERO(&efds);
 	FD_SET(fd, &efds);
+	maxfd = max(fd, timerfd);
+	for (i = 0; i < num_timers; ++i) {
+		if (timer[i].fd < 0)
+			continue;
+		FD_SET(timer[i].fd, &rfds);
+		maxfd = max(maxfd, timer[i].fd);
+	}
 #ifdef CONFIG_HAVE_TIMERFD_CREATE
 	{
 		/*
@@ -214,18 +292,27 @@ static uint8_t wait_for_action(int fd, unsigned int timeout_ms)
 		FD_SET(timerfd, &rfds);
 	}
 #endif
-	res = select(max(fd, timerfd) + 1, &rfds, NULL, &efds,
+	res = select(maxfd + 1, &rfds, NULL, &efds,
 		     timerfd >= 0 ? NULL : &timeout);
 	if (res < 0) {
 		log_err("fio: select() call in helper thread failed: %s",
 			strerror(errno));
 		return A_EXIT;
 	}
+	if (!res)
+		*timed_out = true;
 	if (FD_ISSET(fd, &rfds))
 		read_from_pipe(fd, &action, sizeof(action));
 	if (timerfd >= 0 && FD_ISSET(timerfd, &rfds)) {
 		res = read(timerfd, &exp, sizeof(exp));
 		assert(res == sizeof(exp));
+		*timed_out = true;
+	}
+	for (i = 0; i < num_timers; ++i) {
+		if (timer[i].fd < 0 || !FD_ISSET(timer[i].fd, &rfds))
+			continue;
+		if (read(timer[i].fd, &exp, sizeof(exp)) == sizeof(exp))
+			timer[i].fired = true;
 	}
 	return action;
 }
@@ -245,6 +332,13 @@ static int eval_timer(struct interval_timer *it, const struct timespec *now,
 	if (it->interval_ms == 0)
 		return 0;
 
+	if (it->fd >= 0) {
+		if (!it->fired)
+			return 0;
+		it->fired = false;
+		return it->func();
+	}
+
 	delta_ms = rel_time_since(now, &it->expires);
 	expired = delta_ms <= sleep_accuracy_ms;
 	if (expired) {
@@ -269,11 +363,6 @@ static void *helper_thread_main(void *data)
 	struct helper_data *hd = data;
 	unsigned int msec_to_next_event, next_log;
 	struct interval_timer timer[] = {
-		{
-			.name = "disk_util",
-			.interval_ms = DISK_UTIL_MSEC,
-			.func = update_io_ticks,
-		},
 		{
 			.name = "status_interval",
 			.interval_ms = status_interval,
@@ -284,9 +373,29 @@ static void *helper_thread_main(void *data)
 			.interval_ms = steadystate_enabled ? ss_check_interval :
 				0,
 			.func = steadystate_check,
+		},
+		{
+			.name = "verify_state",
+			.interval_ms = verify_state_ckpt_msec,
+			.func = verify_state_ckpt_check,
+		},
+		{
+			.name = "metrics",
+			.interval_ms = metrics_push ? metrics_interval : 0,
+			.func = metrics_push_check,
+		},
+		{
+			.name = "status_shm",
+			.interval_ms = statshm_file ? statshm_interval : 0,
+			.func = statshm_update_check,
+		},
+		{
+			.name = "cgroup_stats",
+			.interval_ms = cgroup_stat_interval_ms(),
+			.func = cgroup_stats_check,
 		}
 	};
-	struct timespec ts;
+	struct timespec ts, next_tick;
 	long clk_tck;
 	int ret = 0;
 
@@ -307,16 +416,26 @@ static void *helper_thread_main(void *data)
 	/* Let another thread handle signals. */
 	block_signals();
 
+	open_timers(timer, FIO_ARRAY_SIZE(timer));
+
 	fio_get_mono_time(&ts);
 	msec_to_next_event = reset_timers(timer, FIO_ARRAY_SIZE(timer), &ts);
+	next_tick = ts;
+	timespec_add_msec(&next_tick, DISK_UTIL_MSEC);
+	msec_to_next_event = min(msec_to_next_event,
+				 (unsigned int) DISK_UTIL_MSEC);
 
 	fio_sem_up(hd->startup_sem);
 
 	while (!ret && !hd->exit) {
 		uint8_t action;
+		bool timed_out;
+		int64_t delta_ms;
 		int i;
 
-		action = wait_for_action(hd->pipe[0], msec_to_next_event);
+		action = wait_for_action(hd->pipe[0], timer,
+					 FIO_ARRAY_SIZE(timer),
+					 msec_to_next_event, &timed_out);
 		if (action == A_EXIT)
 			break;
 
@@ -334,19 +453,35 @@ static void *helper_thread_main(void *data)
 		if (action == A_DO_STAT)
 			__show_running_run_stats();
 
-		next_log = calc_log_samples();
-		if (!next_log)
-			next_log = DISK_UTIL_MSEC;
+		/*
+		 * Log samples and the ETA run on their own tick, not on
+		 * every timer that fires.
+		 */
+		if (timed_out || action) {
+			next_log = calc_log_samples();
+			if (!next_log)
+				next_log = DISK_UTIL_MSEC;
+
+			next_tick = ts;
+			timespec_add_msec(&next_tick, next_log);
 
-		msec_to_next_event = min(next_log, msec_to_next_event);
-		dprint(FD_HELPERTHREAD,
-		       "next_log: %u, msec_to_next_event: %u\n",
-		       next_log, msec_to_next_event);
+			if (!is_backend)
+				print_thread_status();
+		}
 
-		if (!is_backend)
-			print_thread_status();
+		delta_ms = rel_time_since(&ts, &next_tick);
+		if (delta_ms < 0)
+			delta_ms = 0;
+		msec_to_next_event = min((unsigned int) delta_ms,
+					 msec_to_next_event);
+		dprint(FD_HELPERTHREAD, "msec_to_next_event: %u\n",
+		       msec_to_next_event);
 	}
 
+	close_timers(timer, FIO_ARRAY_SIZE(timer));
+	metrics_exit();
+	statshm_exit();
+
 	if (timerfd >= 0) {
 		close(timerfd);
 		timerfd = -1;
@@ -358,6 +493,33 @@ static void *helper_thread_main(void *data)
 	return NULL;
 }
 
+#ifdef FIO_HAVE_DISK_UTIL
+/*
+ * Disk util sampling reads the stats of every block device in use. Do it
+ * from its own thread at idle priority, so it neither delays the other
+ * helper timers nor competes with the jobs for CPU time.
+ */
+static void *disk_util_thread_main(void *data)
+{
+	struct helper_data *hd = data;
+
+	block_signals();
+
+#ifdef CONFIG_SCHED_IDLE
+	if (fio_set_sched_idle())
+		dprint(FD_HELPERTHREAD, "disk_util: failed to set SCHED_IDLE\n");
+#endif
+
+	while (!hd->exit) {
+		fio_sem_down_timeout(hd->du_sem, DISK_UTIL_MSEC);
+		if (hd->exit || update_io_ticks())
+			break;
+	}
+
+	return NULL;
+}
+#endif
+
 /*
  * Connect two sockets to each other to emulate the pipe() system call on Windows.
  */
@@ -415,6 +577,8 @@ int helper_thread_create(struct fio_sem *startup_sem, struct sk_out *sk_out)
 
 	setup_disk_util();
 	steadystate_setup();
+	metrics_setup();
+	statshm_setup();
 
 	hd->sk_out = sk_out;
 
@@ -441,6 +605,19 @@ int helper_thread_create(struct fio_sem *startup_sem, struct sk_out *sk_out)
 		return 1;
 	}
 
+#ifdef FIO_HAVE_DISK_UTIL
+	hd->du_sem = fio_sem_init(FIO_SEM_LOCKED);
+	if (!hd->du_sem) {
+		log_err("fio: failed to allocate disk util semaphore\n");
+		return 1;
+	}
+	ret = pthread_create(&hd->du_thread, NULL, disk_util_thread_main, hd);
+	if (ret) {
+		log_err("Can't create disk util thread: %s\n", strerror(ret));
+		return 1;
+	}
+#endif
+
 	helper_data = hd;
 
 	dprint(FD_MUTEX, "wait on startup_sem\n");
@@ -181,6 +181,96 @@ static void calibration_stats(void)
 	ipc.cali_stddev = sqrt(var/(ipc.nr_cpus-1));
 }
 
+/*
+ * Read the per CPU tick counters from /proc/stat. For the start of the
+ * window they are stored, for the end the idleness over the window is
+ * worked out from the deltas. CPUs that are not listed both times are
+ * marked as not valid, they were offline for part of the run.
+ */
+static int read_proc_stat(bool end)
+{
+	unsigned long long user, nice, sys, idle, iowait, irq, softirq, steal;
+	struct idle_prof_thread *ipt;
+	char line[256];
+	FILE *f;
+	int cpu;
+
+	f = fopen("/proc/stat", "r");
+	if (!f) {
+		log_err("fio: idle-prof: open /proc/stat: %s\n", strerror(errno));
+		return 1;
+	}
+
+	for (cpu = 0; cpu < ipc.nr_cpus; cpu++) {
+		ipt = &ipc.ipts[cpu];
+		if (!end)
+			ipt->stat_valid = false;
+		else if (ipt->stat_valid)
+			ipt->idleness = 0.0;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		uint64_t total, didle, dtotal;
+
+		if (strncmp(line, "cpu", 3) || line[3] < '0' || line[3] > '9')
+			continue;
+
+		steal = 0;
+		if (sscanf(line, "cpu%d %llu %llu %llu %llu %llu %llu %llu %llu",
+			   &cpu, &user, &nice, &sys, &idle, &iowait, &irq,
+			   &softirq, &steal) < 8)
+			continue;
+		if (cpu < 0 || cpu >= ipc.nr_cpus)
+			continue;
+
+		ipt = &ipc.ipts[cpu];
+		idle += iowait;
+		total = user + nice + sys + idle + irq + softirq + steal;
+
+		if (!end) {
+			ipt->stat_idle = idle;
+			ipt->stat_total = total;
+			ipt->stat_valid = true;
+			continue;
+		}
+
+		if (!ipt->stat_valid)
+			continue;
+
+		didle = idle - ipt->stat_idle;
+		dtotal = total - ipt->stat_total;
+		ipt->idleness = dtotal ? (double) didle / dtotal : 1.0;
+		ipt->state = TD_EXITED;
+	}
+
+	/* valid at the end only if seen both times */
+	for (cpu = 0; cpu < ipc.nr_cpus; cpu++) {
+		ipt = &ipc.ipts[cpu];
+		if (end && ipt->state != TD_EXITED)
+			ipt->stat_valid = false;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static void fio_idle_prof_stat_init(void)
+{
+	int i;
+
+	ipc.ipts = calloc(ipc.nr_cpus, sizeof(struct idle_prof_thread));
+	if (!ipc.ipts) {
+		log_err("fio: malloc failed\n");
+		ipc.status = IDLE_PROF_STATUS_ABORT;
+		return;
+	}
+
+	for (i = 0; i < ipc.nr_cpus; i++) {
+		ipc.ipts[i].cpu = i;
+		ipc.ipts[i].state = TD_NOT_CREATED;
+	}
+}
+
 void fio_idle_prof_init(void)
 {
 	int i, ret;
@@ -195,6 +285,11 @@ void fio_idle_prof_init(void)
 	if (ipc.opt == IDLE_PROF_OPT_NONE)
 		return;
 
+	if (ipc.use_stat) {
+		fio_idle_prof_stat_init();
+		return;
+	}
+
 	ret = pthread_condattr_init(&cattr);
 	assert(ret == 0);
 #ifdef CONFIG_PTHREAD_CONDATTR_SETCLOCK
@@ -325,6 +420,15 @@ void fio_idle_prof_start(void)
 	if (ipc.opt == IDLE_PROF_OPT_NONE)
 		return;
 
+	if (ipc.use_stat) {
+		if (ipc.status != IDLE_PROF_STATUS_ABORT) {
+			fio_gettime(&ipc.ipts[0].tps, NULL);
+			if (read_proc_stat(false))
+				ipc.status = IDLE_PROF_STATUS_ABORT;
+		}
+		return;
+	}
+
 	/* unlock regardless abort is set or not */
 	for (i = 0; i < ipc.nr_cpus; i++) {
 		ipt = &ipc.ipts[i];
@@ -345,6 +449,15 @@ void fio_idle_prof_stop(void)
 	if (ipc.opt == IDLE_PROF_OPT_CALI)
 		return;
 
+	if (ipc.use_stat) {
+		if (ipc.status != IDLE_PROF_STATUS_ABORT) {
+			fio_gettime(&ipc.ipts[0].tpe, NULL);
+			if (read_proc_stat(true))
+				ipc.status = IDLE_PROF_STATUS_ABORT;
+		}
+		return;
+	}
+
 	ipc.status = IDLE_PROF_STATUS_PROF_STOP;
 
 	/* wait for all threads to exit from profiling */
@@ -395,12 +508,21 @@ static double fio_idle_prof_cpu_stat(int cpu)
 		return 0.0;
 	}
 
+	if (ipc.use_stat && ipc.status == IDLE_PROF_STATUS_ABORT)
+		return 0.0;
+
 	if (cpu == -1) {
+		int nr = 0;
+
 		for (i = 0; i < nr_cpus; i++) {
 			ipt = &ipc.ipts[i];
+			if (ipc.use_stat && !ipt->stat_valid)
+				continue;
 			p += ipt->idleness;
+			nr++;
 		}
-		p /= nr_cpus;
+		if (nr)
+			p /= nr;
 	} else {
 		ipt = &ipc.ipts[cpu];
 		p = ipt->idleness;
@@ -409,6 +531,74 @@ static double fio_idle_prof_cpu_stat(int cpu)
 	return p * 100.0;
 }
 
+/*
+ * Idle percentage of the CPUs the jobs are bound to with cpus_allowed or
+ * cpumask. Returns false if no job is bound.
+ */
+static bool fio_idle_prof_job_cpus(double *idle)
+{
+#if defined(FIO_HAVE_CPU_AFFINITY)
+	int i, nr = 0;
+	double p = 0.0;
+
+	for (i = 0; i < ipc.nr_cpus; i++) {
+		bool used = false;
+
+		for_each_td(td) {
+			if (fio_option_is_set(&td->o, cpumask) &&
+			    fio_cpu_isset(&td->o.cpumask, i)) {
+				used = true;
+				break;
+			}
+		} end_for_each();
+
+		if (!used || (ipc.use_stat && !ipc.ipts[i].stat_valid))
+			continue;
+		p += fio_idle_prof_cpu_stat(i);
+		nr++;
+	}
+
+	if (!nr)
+		return false;
+
+	*idle = p / nr;
+	return true;
+#else
+	return false;
+#endif
+}
+
+/*
+ * Number of CPUs kept busy over the profiling window, and the IOPS all
+ * jobs did per busy CPU.
+ */
+static double fio_idle_prof_busy_cpus(unsigned long long *iops_per_cpu)
+{
+	struct idle_prof_thread *ipt = &ipc.ipts[0];
+	uint64_t ios = 0, runt;
+	double busy = 0.0;
+	int i;
+
+	*iops_per_cpu = 0;
+
+	for (i = 0; i < ipc.nr_cpus; i++) {
+		if (ipc.use_stat && !ipc.ipts[i].stat_valid)
+			continue;
+		busy += 1.0 - fio_idle_prof_cpu_stat(i) / 100.0;
+	}
+
+	for_each_td(td) {
+		for (i = 0; i < DDIR_RWDIR_CNT; i++)
+			ios += td->ts.total_io_u[i];
+	} end_for_each();
+
+	runt = utime_since(&ipt->tps, &ipt->tpe);
+	if (runt && busy > 0.0)
+		*iops_per_cpu = (double) ios * 1000000.0 / runt / busy;
+
+	return busy;
+}
+
 void fio_idle_prof_cleanup(void)
 {
 	if (ipc.ipts) {
@@ -431,6 +621,21 @@ int fio_idle_prof_parse_opt(const char *args)
 		return -1;
 	}	
 
+	/*
+	 * The /proc/stat modes only read the kernel's CPU accounting, so
+	 * they don't need pinned SCHED_IDLE threads.
+	 */
+	ipc.use_stat = false;
+	if (strcmp("stat-system", args) == 0) {
+		ipc.opt = IDLE_PROF_OPT_SYSTEM;
+		ipc.use_stat = true;
+		return 0;
+	} else if (strcmp("stat-percpu", args) == 0) {
+		ipc.opt = IDLE_PROF_OPT_PERCPU;
+		ipc.use_stat = true;
+		return 0;
+	}
+
 #if defined(FIO_HAVE_CPU_AFFINITY) && defined(CONFIG_SCHED_IDLE)
 	if (strcmp("calibrate", args) == 0) {
 		ipc.opt = IDLE_PROF_OPT_CALI;
@@ -478,7 +683,18 @@ void show_idle_prof_stats(int output, struct json_object *parent,
 			log_buf(out, "\n");
 		}
 
-		if (ipc.opt >= IDLE_PROF_OPT_CALI) {
+		if (ipc.opt >= IDLE_PROF_OPT_SYSTEM) {
+			unsigned long long iops;
+			double p;
+
+			if (fio_idle_prof_job_cpus(&p))
+				log_buf(out, "  job cpus: %3.2f%%\n", p);
+			p = fio_idle_prof_busy_cpus(&iops);
+			log_buf(out, "  busy cpus: %3.2f, iops per busy cpu=%llu\n",
+				p, iops);
+		}
+
+		if (ipc.opt >= IDLE_PROF_OPT_CALI && !ipc.use_stat) {
 			log_buf(out, "  unit work: mean=%3.2fus,", ipc.cali_mean);
 			log_buf(out, " stddev=%3.2f\n", ipc.cali_stddev);
 		}
@@ -487,6 +703,9 @@ void show_idle_prof_stats(int output, struct json_object *parent,
 	}
 
 	if ((ipc.opt != IDLE_PROF_OPT_NONE) && (output & FIO_OUTPUT_JSON)) {
+		unsigned long long iops;
+		double p;
+
 		if (!parent)
 			return;
 
@@ -504,6 +723,12 @@ void show_idle_prof_stats(int output, struct json_object *parent,
 			}
 		}
 
+		if (fio_idle_prof_job_cpus(&p))
+			json_object_add_value_float(tmp, "job_cpus", p);
+		p = fio_idle_prof_busy_cpus(&iops);
+		json_object_add_value_float(tmp, "busy_cpus", p);
+		json_object_add_value_int(tmp, "iops_per_busy_cpu", iops);
+
 		json_object_add_value_float(tmp, "unit_mean", ipc.cali_mean);
 		json_object_add_value_float(tmp, "unit_stddev", ipc.cali_stddev);
 	}
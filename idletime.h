@@ -32,6 +32,9 @@ struct idle_prof_thread {
 	double cali_time; /* microseconds to finish a unit work */
 	double loops;
 	double idleness;
+	uint64_t stat_idle;              /* /proc/stat idle+iowait ticks */
+	uint64_t stat_total;             /* /proc/stat ticks */
+	bool stat_valid;
 	unsigned char *data;             /* bytes to be touched */
 	pthread_cond_t  cond;
 	pthread_mutex_t init_lock;
@@ -45,6 +48,7 @@ struct idle_prof_common {
 	int nr_cpus;
 	int status;
 	int opt;
+	bool use_stat;                   /* /proc/stat deltas, no spinning */
 	double cali_mean;
 	double cali_stddev;
 	void *buf;    /* single data allocation for all threads */
@@ -30,7 +30,13 @@
 #include "idletime.h"
 #include "filelock.h"
 #include "steadystate.h"
+#include "phase.h"
+#include "sweep.h"
+#include "precond.h"
 #include "blktrace.h"
+#include "relay.h"
+#include "metrics.h"
+#include "statshm.h"
 
 #include "oslib/asprintf.h"
 #include "oslib/getopt.h"
@@ -39,6 +45,9 @@
 #include "crc/test.h"
 #include "lib/pow2.h"
 #include "lib/memcpy.h"
+#include "bench.h"
+#include "lib/memalign.h"
+#include "compress.h"
 
 const char fio_version_string[] = FIO_VERSION;
 
@@ -68,6 +77,8 @@ bool is_backend = false;
 bool is_local_backend = false;
 int nr_clients = 0;
 bool log_syslog = false;
+unsigned int fio_shard_index;
+unsigned int fio_shard_count;
 
 bool write_bw_log = false;
 bool read_only = false;
@@ -194,6 +205,11 @@ static struct option l_opts[FIO_NR_OPTIONS] = {
 		.val		= 'X' | FIO_CLIENT_FLAG,
 	},
 #endif
+	{
+		.name		= (char *) "iolog-compile",
+		.has_arg	= required_argument,
+		.val		= 'Y' | FIO_CLIENT_FLAG,
+	},
 	{
 		.name		= (char *) "alloc-size",
 		.has_arg	= required_argument,
@@ -260,6 +276,11 @@ static struct option l_opts[FIO_NR_OPTIONS] = {
 		.has_arg	= optional_argument,
 		.val		= 'M',
 	},
+	{
+		.name		= (char *) "bench",
+		.has_arg	= optional_argument,
+		.val		= 'U',
+	},
 	{
 		.name		= (char *) "idle-prof",
 		.has_arg	= required_argument,
@@ -300,6 +321,46 @@ static struct option l_opts[FIO_NR_OPTIONS] = {
 		.has_arg	= no_argument,
 		.val		= 'A' | FIO_CLIENT_FLAG,
 	},
+	{
+		.name		= (char *) "client-summary",
+		.has_arg	= no_argument,
+		.val		= 'Q',
+	},
+	{
+		.name		= (char *) "sync-start",
+		.has_arg	= required_argument,
+		.val		= 'z',
+	},
+	{
+		.name		= (char *) "shard",
+		.has_arg	= no_argument,
+		.val		= 'Z',
+	},
+	{
+		.name		= (char *) "relay",
+		.has_arg	= required_argument,
+		.val		= 'u',
+	},
+	{
+		.name		= (char *) "metrics-push",
+		.has_arg	= required_argument,
+		.val		= 'g' | FIO_CLIENT_FLAG,
+	},
+	{
+		.name		= (char *) "metrics-interval",
+		.has_arg	= required_argument,
+		.val		= 'k' | FIO_CLIENT_FLAG,
+	},
+	{
+		.name		= (char *) "status-shm",
+		.has_arg	= required_argument,
+		.val		= 'n' | FIO_CLIENT_FLAG,
+	},
+	{
+		.name		= (char *) "status-shm-interval",
+		.has_arg	= required_argument,
+		.val		= 'q' | FIO_CLIENT_FLAG,
+	},
 	{
 		.name		= NULL,
 	},
@@ -322,8 +383,10 @@ void free_threads_shm(void)
 			shmctl(seg->shm_id, IPC_RMID, &sbuf);
 			seg->shm_id = -1;
 #else
+			size_t size = seg_nr_jobs(i) * sizeof(struct thread_data);
+
 			seg->threads = NULL;
-			free(tp);
+			__fio_memfree(tp, size + 2 * sizeof(unsigned int), free);
 #endif
 		}
 	}
@@ -337,6 +400,7 @@ static void free_shm(void)
 #ifndef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
 	if (nr_segments) {
 		flow_exit();
+		rate_bucket_exit();
 		fio_debug_jobp = NULL;
 		fio_warned = NULL;
 		free_threads_shm();
@@ -357,10 +421,12 @@ static void free_shm(void)
 static int add_thread_segment(void)
 {
 	struct thread_segment *seg = &segments[nr_segments];
-	size_t size = JOBS_PER_SEG * sizeof(struct thread_data);
-	int i;
+	unsigned int nr_jobs = seg_nr_jobs(nr_segments);
+	size_t size = nr_jobs * sizeof(struct thread_data);
+	int shm_flags = IPC_CREAT | 0600;
+	unsigned int i;
 
-	if (nr_segments + 1 >= REAL_MAX_SEG) {
+	if (nr_segments >= REAL_MAX_SEG) {
 		log_err("error: maximum number of jobs reached.\n");
 		return -1;
 	}
@@ -368,16 +434,22 @@ static int add_thread_segment(void)
 	size += 2 * sizeof(unsigned int);
 
 #ifndef CONFIG_NO_SHM
-	seg->shm_id = shmget(0, size, IPC_CREAT | 0600);
+#ifdef SHM_NORESERVE
+	/* Later segments are large, only the slots in use get pages */
+	shm_flags |= SHM_NORESERVE;
+#endif
+	seg->shm_id = shmget(0, size, shm_flags);
 	if (seg->shm_id == -1) {
 		if (errno != EINVAL && errno != ENOMEM && errno != ENOSPC)
 			perror("shmget");
 		return -1;
 	}
 #else
-	seg->threads = malloc(size);
+	/* thread_data groups fields by cache line, keep that alignment */
+	seg->threads = __fio_memalign(FIO_CACHE_LINE_SIZE, size, malloc);
 	if (!seg->threads)
 		return -1;
+	memset(seg->threads, 0, size);
 #endif
 
 #ifndef CONFIG_NO_SHM
@@ -392,8 +464,8 @@ static int add_thread_segment(void)
 
 	nr_segments++;
 
-	memset(seg->threads, 0, JOBS_PER_SEG * sizeof(struct thread_data));
-	for (i = 0; i < JOBS_PER_SEG; i++)
+	/* a new segment is already zeroed, leave its pages untouched */
+	for (i = 0; i < nr_jobs; i++)
 		DRD_IGNORE_VAR(seg->threads[i]);
 	seg->nr_threads = 0;
 
@@ -409,20 +481,32 @@ static int add_thread_segment(void)
 	*fio_warned = 0;
 
 	flow_init();
+	rate_bucket_init();
 	return 0;
 }
 
 /*
  * The thread areas are shared between the main process and the job
- * threads/processes, and is split into chunks of JOBS_PER_SEG. If the current
- * segment has no more room, add a new chunk.
+ * threads/processes, and is split into chunks that double in size. If the
+ * current segment has no more room, add a new chunk.
  */
 static int expand_thread_area(void)
 {
 	struct thread_segment *seg = &segments[cur_segment];
 
-	if (nr_segments && seg->nr_threads < JOBS_PER_SEG)
+	if (thread_number >= REAL_MAX_JOBS) {
+		log_err("error: maximum number of jobs reached.\n");
+		return -1;
+	}
+
+	if (nr_segments && seg->nr_threads < seg_nr_jobs(cur_segment))
+		return 0;
+
+	/* segments are indexed by job number, reuse any left from before */
+	if (cur_segment + 1 < nr_segments) {
+		cur_segment++;
 		return 0;
+	}
 
 	return add_thread_segment();
 }
@@ -455,14 +539,14 @@ static void dump_opt_list(struct thread_data *td)
 	}
 }
 
-static void copy_opt_list(struct thread_data *dst, struct thread_data *src)
+static void copy_opt_list(struct flist_head *dst, struct flist_head *src)
 {
 	struct flist_head *entry;
 
-	if (flist_empty(&src->opt_list))
+	if (flist_empty(src))
 		return;
 
-	flist_for_each(entry, &src->opt_list) {
+	flist_for_each(entry, src) {
 		struct print_option *srcp, *dstp;
 
 		srcp = flist_entry(entry, struct print_option, list);
@@ -472,10 +556,26 @@ static void copy_opt_list(struct thread_data *dst, struct thread_data *src)
 			dstp->value = strdup(srcp->value);
 		else
 			dstp->value = NULL;
-		flist_add_tail(&dstp->list, &dst->opt_list);
+		flist_add_tail(&dstp->list, dst);
 	}
 }
 
+/*
+ * Copy everything but the stats, which are most of a thread_data. New
+ * slots start out zeroed and add_job() sets up the few stats fields that
+ * matter before the run, so the pages backing them aren't touched until
+ * the job runs.
+ */
+static void copy_parent_td(struct thread_data *td, struct thread_data *parent)
+{
+	const size_t ts_start = offsetof(struct thread_data, ts);
+	const size_t ts_end = ts_start + sizeof(td->ts);
+
+	memcpy(td, parent, ts_start);
+	memcpy((void *) td + ts_end, (void *) parent + ts_end,
+		sizeof(*td) - ts_end);
+}
+
 /*
  * Return a free job structure.
  */
@@ -495,11 +595,13 @@ static struct thread_data *get_new_job(bool global, struct thread_data *parent,
 	seg = &segments[cur_segment];
 	td = &seg->threads[seg->nr_threads++];
 	thread_number++;
-	*td = *parent;
+	copy_parent_td(td, parent);
 
 	INIT_FLIST_HEAD(&td->opt_list);
+	td->overlap = NULL;
+	pthread_rwlock_init(&td->overlap_lock, NULL);
 	if (parent != &def_thread)
-		copy_opt_list(td, parent);
+		copy_opt_list(&td->opt_list, &parent->opt_list);
 
 	td->io_ops = NULL;
 	td->io_ops_init = 0;
@@ -532,6 +634,8 @@ static void put_job(struct thread_data *td)
 
 	profile_td_exit(td);
 	flow_exit_job(td);
+	rate_bucket_exit_job(td);
+	phases_free(td);
 
 	if (td->error)
 		log_info("fio: %s\n", td->verror);
@@ -635,6 +739,11 @@ static int fixup_options(struct thread_data *td)
 		ret |= warnings_fatal;
 	}
 
+	if (o->replay_shard != REPLAY_SHARD_NONE && o->read_iolog_chunked) {
+		log_err("fio: replay_shard can't be combined with read_iolog_chunked\n");
+		ret |= 1;
+	}
+
 	if (o->zone_mode == ZONE_MODE_NONE && o->zone_size) {
 		log_err("fio: --zonemode=none and --zonesize are not compatible.\n");
 		ret |= 1;
@@ -663,6 +772,33 @@ static int fixup_options(struct thread_data *td)
 	if (o->zone_mode == ZONE_MODE_STRIDED && o->open_files > 1)
 		o->zone_mode = ZONE_MODE_NONE;
 
+	if (o->zone_append && o->zone_mode != ZONE_MODE_ZBD) {
+		log_err("fio: --zone_append requires --zonemode=zbd.\n");
+		ret |= 1;
+	}
+
+	if (o->zone_reset_async && o->zone_mode != ZONE_MODE_ZBD) {
+		log_err("fio: --zone_reset_async requires --zonemode=zbd.\n");
+		ret |= 1;
+	}
+	if (o->zone_reset_async && o->verify != VERIFY_NONE) {
+		log_err("fio: --zone_reset_async does not work with verify, zone resets lose the data to verify.\n");
+		ret |= 1;
+	}
+
+	if (o->zone_owner != ZONE_OWNER_SHARED &&
+	    o->zone_mode != ZONE_MODE_ZBD) {
+		log_err("fio: --zone_owner requires --zonemode=zbd.\n");
+		ret |= 1;
+	}
+
+	if (o->fdp_pli_select == FDP_PLI_ZONED &&
+	    o->random_distribution != FIO_RAND_DIST_ZONED &&
+	    o->random_distribution != FIO_RAND_DIST_ZONED_ABS) {
+		log_err("fio: --fdp_pli_select=zoned requires --random_distribution=zoned or zoned_abs.\n");
+		ret |= 1;
+	}
+
 	/*
 	 * If zone_range isn't specified, backward compatibility dictates it
 	 * should be made equal to zone_size.
@@ -705,6 +841,28 @@ static int fixup_options(struct thread_data *td)
 		ret |= warnings_fatal;
 	}
 
+	if (o->oatomic) {
+		o->odirect = 1;
+		if (!td_ioengine_flagged(td, FIO_ATOMICWRITES)) {
+			log_err("fio: IO engine %s doesn't support atomic "
+				"writes\n", td->io_ops->name);
+			ret |= 1;
+		}
+		/*
+		 * The kernel takes a power of 2 sized atomic write that is
+		 * naturally aligned, anything else fails with EINVAL
+		 */
+		if (td_write(td) &&
+		    (o->min_bs[DDIR_WRITE] != o->max_bs[DDIR_WRITE] ||
+		     !is_power_of_2(o->min_bs[DDIR_WRITE]) ||
+		     o->ba[DDIR_WRITE] % o->min_bs[DDIR_WRITE] ||
+		     o->bs_unaligned)) {
+			log_err("fio: atomic writes need a fixed, power of 2 "
+				"write block size and offsets aligned to it\n");
+			ret |= 1;
+		}
+	}
+
 	if (!o->file_size_high)
 		o->file_size_high = o->file_size_low;
 
@@ -750,6 +908,13 @@ static int fixup_options(struct thread_data *td)
 	if (o->iodepth_batch_complete_min > o->iodepth_batch_complete_max)
 		o->iodepth_batch_complete_max = o->iodepth_batch_complete_min;
 
+	/*
+	 * Adaptive reaping scales up to the whole queue unless told otherwise
+	 */
+	if (o->iodepth_batch_complete_adaptive &&
+	    !fio_option_is_set(o, iodepth_batch_complete_max))
+		o->iodepth_batch_complete_max = o->iodepth;
+
 	/*
 	 * There's no need to check for in-flight overlapping IOs if the job
 	 * isn't changing data or the maximum iodepth is guaranteed to be 1
@@ -781,6 +946,23 @@ static int fixup_options(struct thread_data *td)
 		}
 	}
 
+	if (o->rate_bucket_id &&
+	    !(o->rate_bucket_iops[DDIR_READ] + o->rate_bucket_iops[DDIR_WRITE] +
+	      o->rate_bucket_iops[DDIR_TRIM])) {
+		log_err("fio: rate_bucket_id requires rate_bucket_iops\n");
+		ret |= 1;
+	}
+
+	/*
+	 * Offloaded IO is completed by the workqueue threads, so the job
+	 * itself never sees a completion timestamp to reuse.
+	 */
+	if (o->clock_batch && o->io_submit_mode == IO_MODE_OFFLOAD) {
+		log_info("fio: clock_batch is not supported with offload"
+			 " submission, disabling\n");
+		o->clock_batch = 0;
+	}
+
 	if (!o->timeout && o->time_based) {
 		log_err("fio: time_based requires a runtime/timeout setting\n");
 		o->time_based = 0;
@@ -815,7 +997,7 @@ static int fixup_options(struct thread_data *td)
 			ret |= warnings_fatal;
 		}
 
-		if (!fio_option_is_set(o, refill_buffers))
+		if (!fio_option_is_set(o, refill_buffers) && !o->buffer_stamp)
 			o->refill_buffers = 1;
 
 		if (o->max_bs[DDIR_WRITE] != o->min_bs[DDIR_WRITE] &&
@@ -842,6 +1024,93 @@ static int fixup_options(struct thread_data *td)
 							o->max_bs[DDIR_WRITE]);
 	}
 
+	if (o->verify_bitmap && o->verify != VERIFY_NONE) {
+		const char *why = NULL;
+
+		/*
+		 * The bitmap doesn't record the order of writes, so the
+		 * numberio and seed of a block can't be recreated. Stay with
+		 * io_pieces where verification depends on those.
+		 */
+		if (o->min_bs[DDIR_WRITE] != o->max_bs[DDIR_WRITE])
+			why = "a fixed write block size";
+		else if (td_rw(td) && !o->verify_backlog)
+			why = "a write only job or verify_backlog";
+		else if (o->verify_state)
+			why = "verify_state_load to be off";
+		else if (o->trim_percentage)
+			why = "trim_percentage to be off";
+		else if (o->zone_mode == ZONE_MODE_ZBD)
+			why = "zonemode other than zbd";
+
+		if (why) {
+			log_info("fio: verify_bitmap needs %s, disabled\n", why);
+			o->verify_bitmap = 0;
+			ret |= warnings_fatal;
+		}
+	}
+
+	if (o->shared_read_buffers) {
+		if (td_write(td)) {
+			log_err("fio: shared_read_buffers is for jobs that "
+				"don't write\n");
+			ret |= 1;
+		}
+		if (o->verify != VERIFY_NONE) {
+			log_err("fio: shared_read_buffers does not work with "
+				"verify, other reads overwrite the data\n");
+			ret |= 1;
+		}
+		if (o->mem_type == MEM_CUDA_MALLOC) {
+			log_err("fio: shared_read_buffers can't be used with "
+				"mem=cudamalloc\n");
+			ret |= 1;
+		}
+	}
+
+	if (o->verify_table && o->verify != VERIFY_NONE) {
+		if (o->verify != VERIFY_CRC32C &&
+		    o->verify != VERIFY_CRC32C_INTEL) {
+			log_err("fio: verify_table needs verify=crc32c\n");
+			ret |= 1;
+		}
+		if (o->verify_pattern_bytes || o->verify_offset) {
+			log_err("fio: verify_table can't be used with "
+				"verify_pattern or verify_offset\n");
+			ret |= 1;
+		}
+		if (o->zone_mode == ZONE_MODE_ZBD) {
+			log_err("fio: verify_table can't be used with "
+				"zonemode=zbd\n");
+			ret |= 1;
+		}
+	}
+
+	if (o->verify_sample_rate.u.f < 100.0 && o->verify != VERIFY_NONE) {
+		if (o->experimental_verify) {
+			log_err("fio: verify_sample_rate can't be used with "
+				"experimental_verify\n");
+			ret |= 1;
+		}
+		if (o->verify_sample_mode == VERIFY_SAMPLE_RECENT &&
+		    o->verify_bitmap) {
+			log_info("fio: verify_bitmap doesn't know when blocks "
+				 "were written, sampling them uniformly\n");
+			o->verify_sample_mode = VERIFY_SAMPLE_UNIFORM;
+			ret |= warnings_fatal;
+		}
+	}
+
+	if (o->verify_state_interval) {
+		if (o->verify_state_interval < 1000) {
+			log_err("fio: verify_state_interval must be at least 1ms\n");
+			ret |= 1;
+		} else if (o->verify != VERIFY_NONE && o->verify_state_save &&
+			   td_write(td))
+			verify_state_ckpt_msec = min_not_zero(verify_state_ckpt_msec,
+					(unsigned int) (o->verify_state_interval / 1000));
+	}
+
 	if (o->pre_read) {
 		if (o->invalidate_cache)
 			o->invalidate_cache = 0;
@@ -894,7 +1163,8 @@ static int fixup_options(struct thread_data *td)
 		if (o->compress_percentage == 100) {
 			o->zero_buffers = 1;
 			o->compress_percentage = 0;
-		} else if (!fio_option_is_set(o, refill_buffers)) {
+		} else if (!fio_option_is_set(o, refill_buffers) &&
+			   !o->buffer_stamp) {
 			o->refill_buffers = 1;
 			td->flags |= TD_F_REFILL_BUFFERS;
 		}
@@ -907,6 +1177,22 @@ static int fixup_options(struct thread_data *td)
 	if (o->random_distribution != FIO_RAND_DIST_RANDOM)
 		o->norandommap = 1;
 
+	if (o->randommap_shared &&
+	    (!o->use_thread || o->perc_rand[DDIR_READ] != 100 ||
+	     o->perc_rand[DDIR_WRITE] != 100 || o->perc_rand[DDIR_TRIM] != 100)) {
+		log_err("fio: randommap_shared requires thread and fully random "
+			"I/O\n");
+		ret |= 1;
+	}
+
+	if (o->random_partition &&
+	    (o->random_generator != FIO_RAND_GEN_LFSR ||
+	     o->random_distribution != FIO_RAND_DIST_RANDOM)) {
+		log_err("fio: random_partition requires random_generator=lfsr "
+			"and a uniform random_distribution\n");
+		ret |= 1;
+	}
+
 	/*
 	 * If size is set but less than the min block size, complain
 	 */
@@ -927,6 +1213,45 @@ static int fixup_options(struct thread_data *td)
 		ret |= 1;
 	}
 
+	if (o->num_range > 1) {
+		if (!(td->io_ops->flags & FIO_MULTI_RANGE_TRIM)) {
+			log_err("fio: IO engine %s doesn't support multi-range "
+				"trims, num_range must be 1\n", td->io_ops->name);
+			ret |= 1;
+		}
+		if (td_trimwrite(td) || o->zone_mode == ZONE_MODE_ZBD) {
+			log_err("fio: num_range > 1 can't be used with "
+				"trimwrite or zonemode=zbd\n");
+			ret |= 1;
+		}
+	}
+
+	if (o->rwmix[DDIR_TRIM] && o->verify != VERIFY_NONE) {
+		log_err("fio: rwmixtrim can't be used with verify\n");
+		ret |= 1;
+	}
+
+	if (o->trim_mode != TRIM_MODE_DISCARD) {
+		if (!(td->io_ops->flags & FIO_TRIM_MODES)) {
+			log_err("fio: IO engine %s only discards for trims, "
+				"trim_mode must be discard\n", td->io_ops->name);
+			ret |= 1;
+		}
+		if (o->zone_mode == ZONE_MODE_ZBD) {
+			log_err("fio: trim_mode can't be used with "
+				"zonemode=zbd\n");
+			ret |= 1;
+		}
+		if ((o->trim_mode == TRIM_MODE_ALLOCATE ||
+		     o->trim_mode == TRIM_MODE_PUNCH_HOLE ||
+		     o->trim_mode == TRIM_MODE_TRUNCATE) &&
+		    !strcmp(td->io_ops->name, "io_uring_cmd")) {
+			log_err("fio: io_uring_cmd trim_mode must be discard, "
+				"write_zeroes or copy\n");
+			ret |= 1;
+		}
+	}
+
 	if (fio_option_is_set(o, gtod_cpu)) {
 		fio_gtod_init();
 		fio_gtod_set_cpu(o->gtod_cpu);
@@ -944,6 +1269,12 @@ static int fixup_options(struct thread_data *td)
 		ret |= 1;
 	}
 
+	if (o->tree_depth && o->filename) {
+		log_err("fio: tree_depth generates its own file names, "
+			"it can't be combined with filename\n");
+		ret |= 1;
+	}
+
 	if (o->disable_lat)
 		o->lat_percentiles = 0;
 	if (o->disable_clat)
@@ -962,7 +1293,7 @@ static int fixup_options(struct thread_data *td)
 	/*
 	 * Dedupe working set verifications
 	 */
-	if (o->dedupe_percentage && o->dedupe_mode == DEDUPE_MODE_WORKING_SET) {
+	if (o->dedupe_percentage && dedupe_uses_working_set(o)) {
 		if (!fio_option_is_set(o, size)) {
 			log_err("fio: pregenerated dedupe working set "
 					"requires size to be set\n");
@@ -999,11 +1330,19 @@ static int fixup_options(struct thread_data *td)
 		ret |= 1;
 	}
 
+	if (o->log_binary && o->log_gz_store) {
+		log_err("fio: log_binary and log_store_compressed are exclusive\n");
+		ret |= 1;
+	}
+	if (o->log_mmap && (o->log_gz || o->log_gz_store || o->log_write_behind)) {
+		log_err("fio: log_mmap can't be combined with log compression or write behind\n");
+		ret |= 1;
+	}
 
 	return ret;
 }
 
-static void init_rand_file_service(struct thread_data *td)
+void init_rand_file_service(struct thread_data *td)
 {
 	unsigned long nranges = td->o.nr_files << FIO_FSERVICE_SHIFT;
 	const unsigned int seed = td->rand_seeds[FIO_RAND_FILE_OFF];
@@ -1020,21 +1359,34 @@ static void init_rand_file_service(struct thread_data *td)
 	}
 }
 
-void td_fill_verify_state_seed(struct thread_data *td)
+/*
+ * The frand_state generator matching random_generator=
+ */
+static unsigned int td_rand_gen(struct thread_data *td)
 {
-	bool use64;
-
-	if (td->o.random_generator == FIO_RAND_GEN_TAUSWORTHE64)
-		use64 = true;
-	else
-		use64 = false;
+	switch (td->o.random_generator) {
+	case FIO_RAND_GEN_TAUSWORTHE64:
+		return FRAND_TAUS258;
+	case FIO_RAND_GEN_XOSHIRO:
+		return FRAND_XOSHIRO;
+	default:
+		return FRAND_TAUS88;
+	}
+}
 
+void td_fill_verify_state_seed(struct thread_data *td)
+{
 	init_rand_seed(&td->verify_state, td->rand_seeds[FIO_RAND_VER_OFF],
-		use64);
+		td_rand_gen(td));
 }
 
-static void td_fill_rand_seeds_internal(struct thread_data *td, bool use64)
+static void td_fill_rand_seeds_internal(struct thread_data *td, unsigned int gen)
 {
+	/*
+	 * Small range draws stay on taus88 with the tausworthe generators,
+	 * so old job files keep their sequences
+	 */
+	unsigned int small_gen = gen == FRAND_XOSHIRO ? gen : FRAND_TAUS88;
 	uint64_t read_seed = td->rand_seeds[FIO_RAND_BS_OFF];
 	uint64_t write_seed = td->rand_seeds[FIO_RAND_BS1_OFF];
 	uint64_t trim_seed = td->rand_seeds[FIO_RAND_BS2_OFF];
@@ -1052,28 +1404,33 @@ static void td_fill_rand_seeds_internal(struct thread_data *td, bool use64)
 		write_seed = read_seed;
 	if (td_trimwrite(td))
 		trim_seed = write_seed;
-	init_rand_seed(&td->bsrange_state[DDIR_READ], read_seed, use64);
-	init_rand_seed(&td->bsrange_state[DDIR_WRITE], write_seed, use64);
-	init_rand_seed(&td->bsrange_state[DDIR_TRIM], trim_seed, use64);
+	init_rand_seed(&td->bsrange_state[DDIR_READ], read_seed, gen);
+	init_rand_seed(&td->bsrange_state[DDIR_WRITE], write_seed, gen);
+	init_rand_seed(&td->bsrange_state[DDIR_TRIM], trim_seed, gen);
+	for (i = 0; i < DDIR_RWDIR_CNT; i++)
+		frand_batch_reset(&td->bsrange_batch[i]);
 
 	td_fill_verify_state_seed(td);
-	init_rand_seed(&td->rwmix_state, td->rand_seeds[FIO_RAND_MIX_OFF], false);
+	init_rand_seed(&td->rwmix_state, td->rand_seeds[FIO_RAND_MIX_OFF], small_gen);
+	frand_batch_reset(&td->rwmix_batch);
 
 	if (td->o.file_service_type == FIO_FSERVICE_RANDOM)
-		init_rand_seed(&td->next_file_state, td->rand_seeds[FIO_RAND_FILE_OFF], use64);
+		init_rand_seed(&td->next_file_state, td->rand_seeds[FIO_RAND_FILE_OFF], gen);
 	else if (td->o.file_service_type & __FIO_FSERVICE_NONUNIFORM)
 		init_rand_file_service(td);
 
-	init_rand_seed(&td->file_size_state, td->rand_seeds[FIO_RAND_FILE_SIZE_OFF], use64);
-	init_rand_seed(&td->trim_state, td->rand_seeds[FIO_RAND_TRIM_OFF], use64);
-	init_rand_seed(&td->delay_state, td->rand_seeds[FIO_RAND_START_DELAY], use64);
+	init_rand_seed(&td->file_size_state, td->rand_seeds[FIO_RAND_FILE_SIZE_OFF], gen);
+	init_rand_seed(&td->trim_state, td->rand_seeds[FIO_RAND_TRIM_OFF], gen);
+	init_rand_seed(&td->delay_state, td->rand_seeds[FIO_RAND_START_DELAY], gen);
 	init_rand_seed(&td->poisson_state[0], td->rand_seeds[FIO_RAND_POISSON_OFF], 0);
 	init_rand_seed(&td->poisson_state[1], td->rand_seeds[FIO_RAND_POISSON2_OFF], 0);
 	init_rand_seed(&td->poisson_state[2], td->rand_seeds[FIO_RAND_POISSON3_OFF], 0);
-	init_rand_seed(&td->dedupe_state, td->rand_seeds[FIO_DEDUPE_OFF], false);
-	init_rand_seed(&td->zone_state, td->rand_seeds[FIO_RAND_ZONE_OFF], false);
-	init_rand_seed(&td->prio_state, td->rand_seeds[FIO_RAND_PRIO_CMDS], false);
-	init_rand_seed(&td->dedupe_working_set_index_state, td->rand_seeds[FIO_RAND_DEDUPE_WORKING_SET_IX], use64);
+	init_rand_seed(&td->dedupe_state, td->rand_seeds[FIO_DEDUPE_OFF], small_gen);
+	init_rand_seed(&td->zone_state, td->rand_seeds[FIO_RAND_ZONE_OFF], small_gen);
+	init_rand_seed(&td->prio_state, td->rand_seeds[FIO_RAND_PRIO_CMDS], small_gen);
+	init_rand_seed(&td->dedupe_working_set_index_state, td->rand_seeds[FIO_RAND_DEDUPE_WORKING_SET_IX], gen);
+	init_rand_seed(&td->dedupe_patch_state, td->rand_seeds[FIO_RAND_DEDUPE_PATCH], gen);
+	init_rand_seed(&td->fdp_state, td->rand_seeds[FIO_RAND_FDP_OFF], gen);
 
 	if (!td_random(td))
 		return;
@@ -1081,19 +1438,18 @@ static void td_fill_rand_seeds_internal(struct thread_data *td, bool use64)
 	if (td->o.rand_repeatable)
 		td->rand_seeds[FIO_RAND_BLOCK_OFF] = FIO_RANDSEED * td->thread_number;
 
-	init_rand_seed(&td->random_state, td->rand_seeds[FIO_RAND_BLOCK_OFF], use64);
+	init_rand_seed(&td->random_state, td->rand_seeds[FIO_RAND_BLOCK_OFF], gen);
+	frand_batch_reset(&td->random_batch);
 
 	for (i = 0; i < DDIR_RWDIR_CNT; i++) {
 		struct frand_state *s = &td->seq_rand_state[i];
 
-		init_rand_seed(s, td->rand_seeds[FIO_RAND_SEQ_RAND_READ_OFF], false);
+		init_rand_seed(s, td->rand_seeds[FIO_RAND_SEQ_RAND_READ_OFF], small_gen);
 	}
 }
 
 void td_fill_rand_seeds(struct thread_data *td)
 {
-	bool use64;
-
 	if (td->o.allrand_repeatable) {
 		unsigned int i;
 
@@ -1102,15 +1458,13 @@ void td_fill_rand_seeds(struct thread_data *td)
 			       	+ i;
 	}
 
-	if (td->o.random_generator == FIO_RAND_GEN_TAUSWORTHE64)
-		use64 = true;
-	else
-		use64 = false;
-
-	td_fill_rand_seeds_internal(td, use64);
+	td_fill_rand_seeds_internal(td, td_rand_gen(td));
 
-	init_rand_seed(&td->buf_state, td->rand_seeds[FIO_RAND_BUF_OFF], use64);
+	init_rand_seed(&td->buf_state, td->rand_seeds[FIO_RAND_BUF_OFF],
+		       td_rand_gen(td));
 	frand_copy(&td->buf_state_prev, &td->buf_state);
+	td->stamp_key = td->rand_seeds[FIO_RAND_BUF_OFF] ^
+				((uint64_t) td->thread_number << 32);
 }
 
 /*
@@ -1232,7 +1586,8 @@ static void init_flags(struct thread_data *td)
 	if (o->verify != VERIFY_NONE)
 		td->flags |= TD_F_DO_VERIFY;
 
-	if (o->verify_async || o->io_submit_mode == IO_MODE_OFFLOAD)
+	if (o->verify_async || o->io_submit_mode == IO_MODE_OFFLOAD ||
+	    o->sync_workers || o->verify_threads > 1)
 		td->flags |= TD_F_NEED_LOCK;
 
 	if (o->mem_type == MEM_CUDA_MALLOC)
@@ -1407,6 +1762,52 @@ static char *make_filename(char *buf, size_t buf_size,struct thread_options *o,
 	return buf;
 }
 
+/*
+ * Add tree_fanout^tree_depth leaf directories worth of files, tree_files
+ * in each. Only the names are generated here, the directories and files
+ * are created when a file is first opened.
+ */
+static int add_tree_files(struct thread_data *td, const char *jobname,
+			  int jobnum)
+{
+	struct thread_options *o = &td->o;
+	char fname[PATH_MAX], path[PATH_MAX];
+	unsigned long long leaves = 1, divs[16];
+	unsigned int i, level;
+	int len;
+
+	for (level = 0; level < o->tree_depth; level++) {
+		leaves *= o->tree_fanout;
+		if (leaves * o->tree_files > INT_MAX) {
+			log_err("fio: directory tree of depth %u, fanout %u "
+				"has too many files\n", o->tree_depth,
+				o->tree_fanout);
+			return 1;
+		}
+	}
+
+	divs[o->tree_depth - 1] = 1;
+	for (level = o->tree_depth - 1; level > 0; level--)
+		divs[level - 1] = divs[level] * o->tree_fanout;
+
+	o->nr_files = leaves * o->tree_files;
+	for (i = 0; i < o->nr_files; i++) {
+		unsigned long long leaf = i / o->tree_files;
+
+		len = 0;
+		for (level = 0; level < o->tree_depth; level++) {
+			len += snprintf(path + len, sizeof(path) - len, "d%llu%c",
+					(leaf / divs[level]) % o->tree_fanout,
+					FIO_OS_PATH_SEPARATOR);
+		}
+		make_filename(fname, sizeof(fname), o, jobname, jobnum, i);
+		snprintf(path + len, sizeof(path) - len, "%s", fname);
+		add_file(td, path, jobnum, 0);
+	}
+
+	return 0;
+}
+
 bool parse_dryrun(void)
 {
 	return dump_cmdline || parse_only;
@@ -1492,6 +1893,73 @@ static const char *make_log_name(const char *logname, const char *jobname)
 	return jobname;
 }
 
+/*
+ * Drop the files a clone inherited, so it names its own
+ */
+static void clear_job_files(struct thread_data *td)
+{
+	struct fio_file *f;
+	unsigned int i;
+
+	if (td->files) {
+		for_each_file(td, f, i)
+			fio_file_free(f);
+		free(td->files);
+		td->files = NULL;
+	}
+	td->files_index = 0;
+	td->files_size = 0;
+	if (td->o.filename) {
+		free(td->o.filename);
+		td->o.filename = NULL;
+	}
+}
+
+/*
+ * The files of a job and of its clones, as a filename= list for the
+ * precondition passes, and what size= scales by to cover them all. NULL if
+ * the job doesn't name its files up front.
+ */
+static char *precond_files(struct thread_data *td, const char *jobname,
+			   unsigned int *size_mult)
+{
+	struct thread_options *o = &td->o;
+	char fname[PATH_MAX + 1];
+	char **names, *list = NULL;
+	unsigned int i, j, k, nr = 0;
+	size_t len = 0;
+
+	*size_mult = 1;
+	if (o->filename)
+		return strdup(o->filename);
+	if (o->tree_depth || o->read_iolog_file)
+		return NULL;
+	if (o->nr_files == 1 && exists_and_not_regfile(jobname))
+		return strdup(jobname);
+
+	names = calloc(o->numjobs * o->nr_files, sizeof(char *));
+	for (j = 0; j < o->numjobs; j++) {
+		for (i = 0; i < o->nr_files; i++) {
+			make_filename(fname, sizeof(fname), o, jobname, j, i);
+			for (k = 0; k < nr; k++)
+				if (!strcmp(names[k], fname))
+					break;
+			if (k == nr)
+				names[nr++] = strdup(fname);
+		}
+	}
+
+	for (k = 0; k < nr; k++) {
+		list = realloc(list, len + strlen(names[k]) + 2);
+		len += sprintf(list + len, "%s%s", k ? ":" : "", names[k]);
+		free(names[k]);
+	}
+	free(names);
+
+	*size_mult = max(nr / o->nr_files, 1U);
+	return list;
+}
+
 /*
  * Adds a job to the list of things todo. Sanitizes the various options
  * to make sure we don't have conflicts, and initializes various
@@ -1504,6 +1972,12 @@ static int add_job(struct thread_data *td, const char *jobname, int job_add_num,
 	char fname[PATH_MAX + 1];
 	int numjobs, file_alloced;
 	struct thread_options *o = &td->o;
+	struct thread_options *sweep_opts = NULL, *precond_opts = NULL;
+	struct sweep *sweep = NULL;
+	struct precond precond = { .nr = 0, };
+	char *precond_list = NULL, *job_name = NULL;
+	unsigned int size_mult = 1;
+	FLIST_HEAD(precond_optlist);
 	char logname[PATH_MAX + 32];
 
 	/*
@@ -1524,17 +1998,77 @@ static int add_job(struct thread_data *td, const char *jobname, int job_add_num,
 
 	td->client_type = client_type;
 
+	/*
+	 * With preconditioning this job becomes the first pass. The other
+	 * passes and the job itself follow once it is added, from the options
+	 * as they were parsed.
+	 */
+	if (!recursed && o->precondition) {
+		if (precond_parse(o->precondition, &precond))
+			goto err;
+		precond_list = precond_files(td, jobname, &size_mult);
+		if (!precond_list) {
+			log_err("fio: %s: precondition needs files named up "
+				"front\n", jobname);
+			goto err;
+		}
+		precond_opts = fio_options_save(td);
+		if (!precond_opts)
+			goto err;
+		/* jobname may be our o->name, which the pass renames */
+		job_name = strdup(jobname);
+		copy_opt_list(&precond_optlist, &td->opt_list);
+		clear_job_files(td);
+		if (precond_apply(td, precond.pass[0], precond_list, job_name,
+				  size_mult))
+			goto err;
+		jobname = o->name;
+	}
+
+	/*
+	 * A sweep adds this job as its first point, and the others once it
+	 * is done, from the options as they were parsed
+	 */
+	if (!recursed && o->sweep && !td->sweep_point) {
+		sweep = sweep_parse(o->sweep);
+		if (!sweep)
+			goto err;
+		sweep_opts = fio_options_save(td);
+		if (!sweep_opts || sweep_apply(td, sweep, 0))
+			goto err;
+		o->new_group = 1;
+		if (sweep->nr_points > 1)
+			o->unlink = 0;
+	}
+
 	if (profile_td_init(td))
 		goto err;
 
 	if (ioengine_load(td))
 		goto err;
 
+	/*
+	 * Sync engines get their precondition parallelism from the jobs
+	 */
+	if (td->precond_pass && td_ioengine_flagged(td, FIO_SYNCIO) &&
+	    !fio_option_is_set(o, precondition_iodepth))
+		o->iodepth = 1;
+
+	if (o->clat_source == CLAT_SOURCE_ENGINE &&
+	    !td_ioengine_flagged(td, FIO_ENGINE_CLAT)) {
+		log_err("fio: ioengine %s does not report completion latencies,"
+			" clat_source=engine is not supported\n", td->io_ops->name);
+		goto err;
+	}
+
 	file_alloced = 0;
 	if (!o->filename && !td->files_index && !o->read_iolog_file) {
 		file_alloced = 1;
 
-		if (o->nr_files == 1 && exists_and_not_regfile(jobname))
+		if (o->tree_depth) {
+			if (add_tree_files(td, jobname, job_add_num))
+				goto err;
+		} else if (o->nr_files == 1 && exists_and_not_regfile(jobname))
 			add_file(td, jobname, job_add_num, 0);
 		else {
 			for (i = 0; i < o->nr_files; i++)
@@ -1553,6 +2087,9 @@ static int add_job(struct thread_data *td, const char *jobname, int job_add_num,
 	if (!td->o.dedupe_global && init_dedupe_working_set_seeds(td, 0))
 		goto err;
 
+	if (init_compress_level(td))
+		goto err;
+
 	/*
 	 * Belongs to fixup_options, but o->name is not necessarily set as yet
 	 */
@@ -1561,6 +2098,9 @@ static int add_job(struct thread_data *td, const char *jobname, int job_add_num,
 
 	flow_init_job(td);
 
+	if (rate_bucket_init_job(td))
+		goto err;
+
 	/*
 	 * IO engines only need this for option callbacks, and the address may
 	 * change in subprocesses.
@@ -1580,11 +2120,13 @@ static int add_job(struct thread_data *td, const char *jobname, int job_add_num,
 	td->ts.clat_percentiles = o->clat_percentiles;
 	td->ts.lat_percentiles = o->lat_percentiles;
 	td->ts.slat_percentiles = o->slat_percentiles;
+	td->ts.lat_hist_bits = o->lat_hist_bits;
 	td->ts.percentile_precision = o->percentile_precision;
 	memcpy(td->ts.percentile_list, o->percentile_list, sizeof(o->percentile_list));
 	td->ts.sig_figs = o->sig_figs;
 
 	init_thread_stat_min_vals(&td->ts);
+	reset_stat_shard(td);
 
 	/*
 	 * td->>ddir_seq_nr needs to be initialized to 1, NOT o->ddir_seq_nr,
@@ -1613,6 +2155,9 @@ static int add_job(struct thread_data *td, const char *jobname, int job_add_num,
 	if (setup_rate(td))
 		goto err;
 
+	if (td_phases_init(td))
+		goto err;
+
 	if (o->write_lat_log) {
 		struct log_params p = {
 			.td = td,
@@ -1622,6 +2167,9 @@ static int add_job(struct thread_data *td, const char *jobname, int job_add_num,
 			.log_type = IO_LOG_TYPE_LAT,
 			.log_offset = o->log_offset,
 			.log_prio = o->log_prio,
+			.log_binary = o->log_binary,
+			.write_behind = o->log_write_behind,
+			.log_mmap = o->log_mmap,
 			.log_gz = o->log_gz,
 			.log_gz_store = o->log_gz_store,
 		};
@@ -1630,6 +2178,10 @@ static int add_job(struct thread_data *td, const char *jobname, int job_add_num,
 
 		if (p.log_gz_store)
 			suf = "log.fz";
+		else if (p.log_binary == LOG_BINARY_COLUMNAR)
+			suf = "log.col";
+		else if (p.log_binary)
+			suf = "log.bin";
 		else
 			suf = "log";
 
@@ -1675,8 +2227,14 @@ static int add_job(struct thread_data *td, const char *jobname, int job_add_num,
 		}
 #endif
 
+		/* histogram logs only come in text or columnar */
+		if (o->log_binary == LOG_BINARY_COLUMNAR)
+			p.log_binary = LOG_BINARY_COLUMNAR;
+
 		if (p.log_gz_store)
 			suf = "log.fz";
+		else if (p.log_binary == LOG_BINARY_COLUMNAR)
+			suf = "log.col";
 		else
 			suf = "log";
 
@@ -1694,6 +2252,9 @@ static int add_job(struct thread_data *td, const char *jobname, int job_add_num,
 			.log_type = IO_LOG_TYPE_BW,
 			.log_offset = o->log_offset,
 			.log_prio = o->log_prio,
+			.log_binary = o->log_binary,
+			.write_behind = o->log_write_behind,
+			.log_mmap = o->log_mmap,
 			.log_gz = o->log_gz,
 			.log_gz_store = o->log_gz_store,
 		};
@@ -1710,6 +2271,10 @@ static int add_job(struct thread_data *td, const char *jobname, int job_add_num,
 
 		if (p.log_gz_store)
 			suf = "log.fz";
+		else if (p.log_binary == LOG_BINARY_COLUMNAR)
+			suf = "log.col";
+		else if (p.log_binary)
+			suf = "log.bin";
 		else
 			suf = "log";
 
@@ -1726,6 +2291,9 @@ static int add_job(struct thread_data *td, const char *jobname, int job_add_num,
 			.log_type = IO_LOG_TYPE_IOPS,
 			.log_offset = o->log_offset,
 			.log_prio = o->log_prio,
+			.log_binary = o->log_binary,
+			.write_behind = o->log_write_behind,
+			.log_mmap = o->log_mmap,
 			.log_gz = o->log_gz,
 			.log_gz_store = o->log_gz_store,
 		};
@@ -1742,6 +2310,10 @@ static int add_job(struct thread_data *td, const char *jobname, int job_add_num,
 
 		if (p.log_gz_store)
 			suf = "log.fz";
+		else if (p.log_binary == LOG_BINARY_COLUMNAR)
+			suf = "log.col";
+		else if (p.log_binary)
+			suf = "log.bin";
 		else
 			suf = "log";
 
@@ -1805,7 +2377,7 @@ static int add_job(struct thread_data *td, const char *jobname, int job_add_num,
 	if (td_steadystate_init(td))
 		goto err;
 
-	if (o->merge_blktrace_file && !merge_blktrace_iologs(td))
+	if (o->merge_blktrace_file && merge_blktrace_iologs(td))
 		goto err;
 
 	if (merge_blktrace_only) {
@@ -1818,6 +2390,30 @@ static int add_job(struct thread_data *td, const char *jobname, int job_add_num,
 	 * as they don't apply to sub-jobs
 	 */
 	numjobs = o->numjobs;
+
+	/*
+	 * clones of a sharded replay inherit the shard count and the pointer
+	 * to our replay start time
+	 */
+	if (!recursed && o->read_iolog_file &&
+	    o->replay_shard != REPLAY_SHARD_NONE) {
+		td->io_log_shards = numjobs;
+		td->io_log_epoch = 0;
+		td->io_log_epochp = &td->io_log_epoch;
+	}
+
+	/*
+	 * clones take their partition of the LFSR sequence by subjob number
+	 */
+	if (!recursed && o->random_partition)
+		td->random_partitions = numjobs;
+
+	/*
+	 * clones split a --shard over them by subjob number
+	 */
+	if (!recursed)
+		td->nr_subjobs = numjobs;
+
 	while (--numjobs) {
 		struct thread_data *td_new = get_new_job(false, td, true, jobname);
 
@@ -1831,28 +2427,84 @@ static int add_job(struct thread_data *td, const char *jobname, int job_add_num,
 		td_new->o.ss_dur = o->ss_dur * 1000000l;
 		td_new->o.ss_limit = o->ss_limit;
 
-		if (file_alloced) {
-			if (td_new->files) {
-				struct fio_file *f;
-				for_each_file(td_new, f, i)
-					fio_file_free(f);
-				free(td_new->files);
-				td_new->files = NULL;
-			}
-			td_new->files_index = 0;
-			td_new->files_size = 0;
-			if (td_new->o.filename) {
-				free(td_new->o.filename);
-				td_new->o.filename = NULL;
-			}
-		}
+		if (file_alloced)
+			clear_job_files(td_new);
 
 		if (add_job(td_new, jobname, numjobs, 1, client_type))
 			goto err;
 	}
 
+	/*
+	 * The other points of a sweep, each in a group of its own after the
+	 * one before. They name the same files, so only the first point lays
+	 * them out, and only the last one unlinks them.
+	 */
+	for (i = 1; sweep && i < sweep->nr_points; i++) {
+		struct thread_data *td_new = get_new_job(false, td, true, jobname);
+
+		if (!td_new)
+			goto err;
+
+		fio_options_restore(td_new, sweep_opts);
+		if (file_alloced)
+			clear_job_files(td_new);
+		if (sweep_apply(td_new, sweep, i))
+			goto err;
+
+		td_new->o.stonewall = 1;
+		if (i < sweep->nr_points - 1)
+			td_new->o.unlink = 0;
+
+		if (add_job(td_new, jobname, job_add_num, 0, client_type))
+			goto err;
+	}
+
+	/*
+	 * The other precondition passes, then the job itself
+	 */
+	for (i = 1; i <= precond.nr; i++) {
+		struct thread_data *td_new = get_new_job(false, td, true, NULL);
+
+		if (!td_new)
+			goto err;
+
+		fio_options_restore(td_new, precond_opts);
+		fio_dump_options_free(td_new);
+		copy_opt_list(&td_new->opt_list, &precond_optlist);
+		td_new->o.stonewall = 1;
+		if (i < precond.nr) {
+			clear_job_files(td_new);
+			if (precond_apply(td_new, precond.pass[i], precond_list,
+					  job_name, size_mult))
+				goto err;
+			if (add_job(td_new, td_new->o.name, 0, 0, client_type))
+				goto err;
+			continue;
+		}
+
+		if (!td_new->o.filename)
+			clear_job_files(td_new);
+		free(td_new->o.precondition);
+		td_new->o.precondition = NULL;
+		td_new->precond_pass = PRECOND_NONE;
+		if (add_job(td_new, job_name, job_add_num, 0, client_type))
+			goto err;
+	}
+
+	sweep_free(sweep);
+	fio_options_put(sweep_opts);
+	fio_options_put(precond_opts);
+	free(precond_list);
+	free(job_name);
+	fio_dump_list_free(&precond_optlist);
 	return 0;
 err:
+	sweep_free(sweep);
+	fio_options_put(sweep_opts);
+	fio_options_put(precond_opts);
+	free(precond_list);
+	free(job_name);
+	fio_dump_list_free(&precond_optlist);
 	put_job(td);
 	return -1;
 }
@@ -2276,13 +2928,14 @@ static void usage(const char *name)
 	printf("  --output\t\tWrite output to file\n");
 	printf("  --bandwidth-log\tGenerate aggregate bandwidth logs\n");
 	printf("  --minimal\t\tMinimal (terse) output\n");
-	printf("  --output-format=type\tOutput format (terse,json,json+,normal)\n");
+	printf("  --output-format=type\tOutput format (terse,json,json+,normal,columnar)\n");
 	printf("  --terse-version=type\tSet terse version output format"
 		" (default 3, or 2 or 4 or 5)\n");
 	printf("  --version\t\tPrint version info and exit\n");
 	printf("  --help\t\tPrint this page\n");
 	printf("  --cpuclock-test\tPerform test/validation of CPU clock\n");
 	printf("  --crctest=[type]\tTest speed of checksum functions\n");
+	printf("  --bench=[type]\tBenchmark CPU side kernels, JSON output\n");
 	printf("  --cmdhelp=cmd\t\tPrint command help, \"all\" for all of"
 		" them\n");
 	printf("  --enghelp=engine\tPrint ioengine help, or list"
@@ -2296,6 +2949,11 @@ static void usage(const char *name)
 	printf(" period passed\n");
 	printf("  --status-interval=t\tForce full status dump every");
 	printf(" 't' period passed\n");
+	printf("  --metrics-push=addr\tPush live per-job metrics to addr\n");
+	printf("  --metrics-interval=t\tPush live metrics every 't' period\n");
+	printf("  --status-shm=file\tKeep live per-job stats in shared file\n");
+	printf("  --status-shm-interval=t\tUpdate the status-shm file every"
+		" 't' period\n");
 	printf("  --readonly\t\tTurn on safety read-only checks, preventing"
 		" writes\n");
 	printf("  --section=name\tOnly run specified section in job file,"
@@ -2308,12 +2966,17 @@ static void usage(const char *name)
 	printf("  --daemonize=pidfile\tBackground fio server, write pid to file\n");
 	printf("  --client=hostname\tTalk to remote backend(s) fio server at hostname\n");
 	printf("  --remote-config=file\tTell fio server to load this local job file\n");
+	printf("  --client-summary\tOnly show stats summed over all clients\n");
+	printf("  --sync-start=t\tStart all servers at the same time, 't' from now\n");
+	printf("  --shard\t\tSplit each job's range or files across servers\n");
+	printf("  --relay=hostname\tPass server jobs on to hostname and sum the results\n");
 	printf("  --idle-prof=option\tReport cpu idleness on a system or percpu basis\n"
-		"\t\t\t(option=system,percpu) or run unit work\n"
-		"\t\t\tcalibration only (option=calibrate)\n");
+		"\t\t\t(option=system,percpu,stat-system,stat-percpu)\n"
+		"\t\t\tor run unit work calibration only (option=calibrate)\n");
 #ifdef CONFIG_ZLIB
 	printf("  --inflate-log=log\tInflate and output compressed log\n");
 #endif
+	printf("  --iolog-compile=log\tCompile iolog into log.bin for faster replay\n");
 	printf("  --trigger-file=file\tExecute trigger cmd when file exists\n");
 	printf("  --trigger-timeout=t\tExecute trigger at this time\n");
 	printf("  --trigger=cmd\t\tSet this command as local trigger\n");
@@ -2553,6 +3216,8 @@ static int parse_output_format(const char *optarg)
 			output_format |= (FIO_OUTPUT_JSON | FIO_OUTPUT_JSON_PLUS);
 		else if (!strcmp(opt, "normal"))
 			output_format |= FIO_OUTPUT_NORMAL;
+		else if (!strcmp(opt, "columnar"))
+			output_format |= FIO_OUTPUT_COLUMNAR;
 		else {
 			log_err("fio: invalid output format %s\n", opt);
 			ret = 1;
@@ -2743,6 +3408,11 @@ int parse_cmd_line(int argc, char *argv[], int client_type)
 			do_exit++;
 			break;
 #endif
+		case 'Y':
+			exit_val = iolog_compile(optarg);
+			did_arg = true;
+			do_exit++;
+			break;
 		case 'p':
 			did_arg = true;
 			if (exec_profile)
@@ -2954,6 +3624,11 @@ int parse_cmd_line(int argc, char *argv[], int client_type)
 			do_exit++;
 			exit_val = fio_memcpy_test(optarg);
 			break;
+		case 'U':
+			did_arg = true;
+			do_exit++;
+			exit_val = fio_bench(optarg);
+			break;
 		case 'L': {
 			long long val;
 
@@ -3004,6 +3679,84 @@ int parse_cmd_line(int argc, char *argv[], int client_type)
 			did_arg = true;
 			merge_blktrace_only = true;
 			break;
+		case 'Q':
+			client_summary = true;
+			break;
+		case 'z': {
+			long long val;
+
+			if (check_str_time(optarg, &val, 0)) {
+				log_err("fio: failed parsing time %s\n", optarg);
+				do_exit++;
+				exit_val = 1;
+				break;
+			}
+			sync_start_msec = val / 1000;
+			if (!sync_start_msec)
+				sync_start_msec = 1;
+			break;
+			}
+		case 'Z':
+			shard_clients = true;
+			break;
+		case 'u':
+#ifndef WIN32
+			if (fio_relay_add_hosts(optarg)) {
+				do_exit++;
+				exit_val = 1;
+			}
+#else
+			log_err("fio: relay mode isn't supported on this platform\n");
+			do_exit++;
+			exit_val = 1;
+#endif
+			break;
+		case 'g':
+			if (metrics_push_parse(optarg)) {
+				do_exit++;
+				exit_val = 1;
+			}
+			break;
+		case 'k': {
+			long long val;
+
+			if (check_str_time(optarg, &val, 1)) {
+				log_err("fio: failed parsing time %s\n", optarg);
+				do_exit++;
+				exit_val = 1;
+				break;
+			}
+			if (val < 1000) {
+				log_err("fio: metrics interval too small\n");
+				do_exit++;
+				exit_val = 1;
+			}
+			metrics_interval = val / 1000;
+			break;
+			}
+		case 'n':
+			if (statshm_parse(optarg)) {
+				do_exit++;
+				exit_val = 1;
+			}
+			break;
+		case 'q': {
+			long long val;
+
+			if (check_str_time(optarg, &val, 1)) {
+				log_err("fio: failed parsing time %s\n", optarg);
+				do_exit++;
+				exit_val = 1;
+				break;
+			}
+			if (val < 1000) {
+				log_err("fio: status-shm interval too small\n");
+				do_exit++;
+				exit_val = 1;
+			}
+			statshm_interval = val / 1000;
+			break;
+			}
 		case '?':
 			log_err("%s: unrecognized option '%s'\n", argv[0],
 							argv[optind - 1]);
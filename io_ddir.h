@@ -46,7 +46,8 @@ enum td_ddir {
 
 #define td_read(td)		((td)->o.td_ddir & TD_DDIR_READ)
 #define td_write(td)		((td)->o.td_ddir & TD_DDIR_WRITE)
-#define td_trim(td)		((td)->o.td_ddir & TD_DDIR_TRIM)
+#define td_trim(td)		(((td)->o.td_ddir & TD_DDIR_TRIM) || \
+				 (td)->o.rwmix[DDIR_TRIM])
 #define td_rw(td)		(((td)->o.td_ddir & TD_DDIR_RW) == TD_DDIR_RW)
 #define td_random(td)		((td)->o.td_ddir & TD_DDIR_RAND)
 #define file_randommap(td, f)	(!(td)->o.norandommap && fio_file_axmap((f)))
@@ -1,4 +1,5 @@
 #include <unistd.h>
+#include <fcntl.h>
 #include <string.h>
 #include <assert.h>
 
@@ -7,10 +8,17 @@
 #include "trim.h"
 #include "lib/rand.h"
 #include "lib/axmap.h"
+#include "lib/fenwick.h"
+#include "lib/alias.h"
 #include "err.h"
 #include "lib/pow2.h"
 #include "minmax.h"
 #include "zbd.h"
+#include "overhead.h"
+#include "outlier.h"
+#include "filestat.h"
+#include "cpuloc.h"
+#include "overlap.h"
 
 struct io_completion_data {
 	int nr;				/* input */
@@ -44,7 +52,13 @@ static uint64_t mark_random_map(struct thread_data *td, struct io_u *io_u,
 	nr_blocks = (buflen + min_bs - 1) / min_bs;
 	assert(nr_blocks > 0);
 
-	if (!(io_u->flags & IO_U_F_BUSY_OK)) {
+	/*
+	 * The first block of a shared map was claimed when it was picked
+	 */
+	if (fio_file_axmap_shared(f))
+		nr_blocks = 1 + axmap_claim_nr(f->io_axmap, block + 1,
+						nr_blocks - 1);
+	else if (!(io_u->flags & IO_U_F_BUSY_OK)) {
 		nr_blocks = axmap_set_nr(f->io_axmap, block, nr_blocks);
 		assert(nr_blocks > 0);
 	}
@@ -90,10 +104,13 @@ static int __get_next_rand_offset(struct thread_data *td, struct fio_file *f,
 {
 	uint64_t r;
 
-	if (td->o.random_generator == FIO_RAND_GEN_TAUSWORTHE ||
-	    td->o.random_generator == FIO_RAND_GEN_TAUSWORTHE64) {
+	if (td->o.random_generator == FIO_RAND_GEN_XOSHIRO) {
+		*b = frand_batch_between(&td->random_batch, &td->random_state,
+					 0, lastb - 1);
+	} else if (td->o.random_generator == FIO_RAND_GEN_TAUSWORTHE ||
+		   td->o.random_generator == FIO_RAND_GEN_TAUSWORTHE64) {
 
-		r = __rand(&td->random_state);
+		r = frand_batch_next(&td->random_batch, &td->random_state);
 
 		dprint(FD_RANDOM, "off rand %llu\n", (unsigned long long) r);
 
@@ -115,6 +132,19 @@ static int __get_next_rand_offset(struct thread_data *td, struct fio_file *f,
 	if (!file_randommap(td, f))
 		goto ret;
 
+	/*
+	 * Other threads pick from a shared map too, so the block must be
+	 * claimed right away. Keep going until one sticks.
+	 */
+	if (fio_file_axmap_shared(f)) {
+		while (!axmap_claim(f->io_axmap, *b)) {
+			*b = axmap_next_free(f->io_axmap, *b);
+			if (*b == (uint64_t) -1ULL)
+				return 1;
+		}
+		goto ret;
+	}
+
 	/*
 	 * calculate map offset and check if it's free
 	 */
@@ -543,6 +573,35 @@ static inline bool io_u_fits(struct thread_data *td, struct io_u *io_u,
 	return io_u->offset + buflen <= f->io_size + get_start_offset(td, f);
 }
 
+/*
+ * Walk the bssplit entries in percentage order, the first one that covers
+ * the random value and fits in the file wins
+ */
+static unsigned long long bssplit_scan(struct thread_data *td,
+				       struct io_u *io_u, int ddir)
+{
+	uint64_t frand_max = rand_max(&td->bsrange_state[ddir]);
+	uint64_t r = frand_batch_next(&td->bsrange_batch[ddir],
+				      &td->bsrange_state[ddir]);
+	unsigned long long buflen = 0;
+	long long perc = 0;
+	unsigned int i;
+
+	for (i = 0; i < td->o.bssplit_nr[ddir]; i++) {
+		struct bssplit *bsp = &td->o.bssplit[ddir][i];
+
+		if (!bsp->perc)
+			continue;
+		buflen = bsp->bs;
+		perc += bsp->perc;
+		if ((r / perc <= frand_max / 100ULL) &&
+		    io_u_fits(td, io_u, buflen))
+			break;
+	}
+
+	return buflen;
+}
+
 static unsigned long long get_next_buflen(struct thread_data *td, struct io_u *io_u,
 				    bool is_random)
 {
@@ -577,27 +636,25 @@ static unsigned long long get_next_buflen(struct thread_data *td, struct io_u *i
 
 	frand_max = rand_max(&td->bsrange_state[ddir]);
 	do {
-		r = __rand(&td->bsrange_state[ddir]);
-
 		if (!td->o.bssplit_nr[ddir]) {
+			r = frand_batch_next(&td->bsrange_batch[ddir],
+					     &td->bsrange_state[ddir]);
 			buflen = minbs + (unsigned long long) ((double) maxbs *
 					(r / (frand_max + 1.0)));
-		} else {
-			long long perc = 0;
+		} else if (td->bssplit_alias[ddir]) {
+			struct alias_table *at = td->bssplit_alias[ddir];
 			unsigned int i;
 
-			for (i = 0; i < td->o.bssplit_nr[ddir]; i++) {
-				struct bssplit *bsp = &td->o.bssplit[ddir][i];
-
-				if (!bsp->perc)
-					continue;
-				buflen = bsp->bs;
-				perc += bsp->perc;
-				if ((r / perc <= frand_max / 100ULL) &&
-				    io_u_fits(td, io_u, buflen))
-					break;
-			}
-		}
+			/*
+			 * O(1) pick, only scan if it runs past the file end
+			 */
+			i = alias_table_next_batch(at, &td->bsrange_batch[ddir],
+						   &td->bsrange_state[ddir]);
+			buflen = td->o.bssplit[ddir][i].bs;
+			if (!io_u_fits(td, io_u, buflen))
+				buflen = bssplit_scan(td, io_u, ddir);
+		} else
+			buflen = bssplit_scan(td, io_u, ddir);
 
 		power_2 = is_power_of_2(minbs);
 		if (!td->o.bs_unaligned && power_2)
@@ -611,6 +668,12 @@ static unsigned long long get_next_buflen(struct thread_data *td, struct io_u *i
 	return buflen;
 }
 
+static inline uint64_t rwmix_issued(struct thread_data *td,
+				    enum fio_ddir ddir)
+{
+	return td->io_issues[ddir] - td->rwmix_issues_base[ddir];
+}
+
 static void set_rwmix_bytes(struct thread_data *td)
 {
 	unsigned int diff;
@@ -621,14 +684,14 @@ static void set_rwmix_bytes(struct thread_data *td)
 	 * whereas reads do not.
 	 */
 	diff = td->o.rwmix[td->rwmix_ddir ^ 1];
-	td->rwmix_issues = (td->io_issues[td->rwmix_ddir] * diff) / 100;
+	td->rwmix_issues = (rwmix_issued(td, td->rwmix_ddir) * diff) / 100;
 }
 
 static inline enum fio_ddir get_rand_ddir(struct thread_data *td)
 {
 	unsigned int v;
 
-	v = rand_between(&td->rwmix_state, 1, 100);
+	v = frand_batch_between(&td->rwmix_batch, &td->rwmix_state, 1, 100);
 
 	if (v <= td->o.rwmix[DDIR_READ])
 		return DDIR_READ;
@@ -758,11 +821,20 @@ static enum fio_ddir get_rw_ddir(struct thread_data *td)
 			return DDIR_SYNC_FILE_RANGE;
 	}
 
+	/*
+	 * rwmixtrim turns that share of the IOs of a job that reads or
+	 * writes into trims, the read/write mix goes for the others
+	 */
+	if (td->o.rwmix[DDIR_TRIM] && (td_read(td) || td_write(td)) &&
+	    frand_batch_between(&td->rwmix_batch, &td->rwmix_state, 1, 100) <=
+	    td->o.rwmix[DDIR_TRIM])
+		return DDIR_TRIM;
+
 	if (td_rw(td)) {
 		/*
 		 * Check if it's time to seed a new data direction.
 		 */
-		if (td->io_issues[td->rwmix_ddir] >= td->rwmix_issues) {
+		if (rwmix_issued(td, td->rwmix_ddir) >= td->rwmix_issues) {
 			/*
 			 * Put a top limit on how many bytes we do for
 			 * one data direction, to avoid overflowing the
@@ -834,6 +906,7 @@ void put_io_u(struct thread_data *td, struct io_u *io_u)
 	const bool needs_lock = td_async_processing(td);
 
 	zbd_put_io_u(td, io_u);
+	overlap_release(td, io_u);
 
 	if (td->parent)
 		td = td->parent;
@@ -871,6 +944,7 @@ void requeue_io_u(struct thread_data *td, struct io_u **io_u)
 	enum fio_ddir ddir = acct_ddir(__io_u);
 
 	dprint(FD_IO, "requeue %p\n", __io_u);
+	overlap_release(td, __io_u);
 
 	if (td->parent)
 		td = td->parent;
@@ -940,12 +1014,60 @@ static void setup_strided_zone_mode(struct thread_data *td, struct io_u *io_u)
 		fio_file_reset(td, f);
 }
 
+/*
+ * Pick up to num_range offsets and lengths for one trim, each the way a
+ * single range trim would get them.
+ */
+static int fill_trim_ranges(struct thread_data *td, struct io_u *io_u)
+{
+	struct fio_file *f = io_u->file;
+	unsigned long long buflen, total = 0;
+	struct trim_range *r;
+	unsigned int i;
+	bool is_random;
+
+	for (i = 0; i < td->o.num_range; i++) {
+		if (get_next_offset(td, io_u, &is_random))
+			break;
+
+		buflen = get_next_buflen(td, io_u, is_random);
+		if (!buflen)
+			break;
+		if (io_u->offset + buflen > f->real_file_size)
+			break;
+
+		if (td_random(td) && file_randommap(td, f))
+			buflen = mark_random_map(td, io_u, io_u->offset, buflen);
+
+		r = &io_u->trim_ranges[i];
+		r->start = io_u->offset;
+		r->len = buflen;
+		total += buflen;
+
+		/* sequential ranges follow on from the previous one */
+		f->last_start[DDIR_TRIM] = r->start;
+		f->last_pos[DDIR_TRIM] = r->start + r->len;
+	}
+
+	if (!i) {
+		dprint(FD_IO, "io_u %p, failed getting trim range\n", io_u);
+		return 1;
+	}
+
+	io_u->offset = io_u->trim_ranges[0].start;
+	io_u->buflen = total;
+	io_u->nr_trim_ranges = i;
+	return 0;
+}
+
 static int fill_io_u(struct thread_data *td, struct io_u *io_u)
 {
 	bool is_random;
 	uint64_t offset;
 	enum io_u_action ret;
 
+	io_u->nr_trim_ranges = 0;
+
 	if (td_ioengine_flagged(td, FIO_NOIO))
 		goto out;
 
@@ -966,6 +1088,12 @@ static int fill_io_u(struct thread_data *td, struct io_u *io_u)
 	else if (td->o.zone_mode == ZONE_MODE_ZBD)
 		setup_zbd_zone_mode(td, io_u);
 
+	if (io_u->ddir == DDIR_TRIM && td->o.num_range > 1) {
+		if (fill_trim_ranges(td, io_u))
+			return 1;
+		goto out;
+	}
+
 	/*
 	 * No log, let the seq/rand engine retrieve the next buflen and
 	 * position.
@@ -1256,6 +1384,34 @@ static unsigned int __get_next_fileno_rand(struct thread_data *td)
 	return fileno >> FIO_FSERVICE_SHIFT;
 }
 
+/*
+ * Pick one of the files that aren't done yet, uniformly. Only uniform
+ * random file service marks files done, the skewed ones reset them.
+ */
+static int get_next_active_fileno(struct thread_data *td)
+{
+	struct fio_file *f;
+	unsigned int i;
+
+	if (!td->active_files) {
+		td->active_files = fenwick_new(td->o.nr_files);
+		if (!td->active_files)
+			return -1;
+		for (i = 0; i < td->o.nr_files; i++) {
+			f = td->files[i];
+			if (fio_file_done(f))
+				fenwick_add(td->active_files, i, -1);
+		}
+	}
+
+	if (!fenwick_total(td->active_files))
+		return -1;
+
+	i = rand_between(&td->next_file_state, 0,
+			 fenwick_total(td->active_files) - 1);
+	return fenwick_find(td->active_files, i);
+}
+
 /*
  * Get next file to service by choosing one at random
  */
@@ -1272,8 +1428,19 @@ static struct fio_file *get_next_file_rand(struct thread_data *td,
 		fno = __get_next_fileno_rand(td);
 
 		f = td->files[fno];
-		if (fio_file_done(f))
-			continue;
+		if (fio_file_done(f)) {
+			/*
+			 * Drawing again until a file that isn't done comes up
+			 * takes forever once most of them are, go to the set
+			 * of remaining files instead.
+			 */
+			if (td->o.file_service_type != FIO_FSERVICE_RANDOM)
+				continue;
+			fno = get_next_active_fileno(td);
+			if (fno < 0)
+				continue;
+			f = td->files[fno];
+		}
 
 		if (!fio_file_open(f)) {
 			int err;
@@ -1423,6 +1590,8 @@ static long set_io_u_file(struct thread_data *td, struct io_u *io_u)
 			fio_file_reset(td, f);
 		else {
 			fio_file_set_done(f);
+			if (td->active_files)
+				fenwick_add(td->active_files, f->fileno, -1);
 			td->nr_done_files++;
 			dprint(FD_FILE, "%s: is done (%d of %d)\n", f->file_name,
 					td->nr_done_files, td->o.nr_files);
@@ -1446,6 +1615,30 @@ static void lat_fatal(struct thread_data *td, struct io_u *io_u, struct io_compl
 	icd->error = ETIMEDOUT;
 }
 
+/*
+ * Write a latency_log entry: time since fio started, the queue depth we are
+ * now running at and the success rate of the window that decided it.
+ */
+static void lat_target_log(struct thread_data *td, double success_ios)
+{
+	if (!td->latency_log)
+		return;
+
+	fprintf(td->latency_log, "%llu, %u, %.2f\n",
+		(unsigned long long) mtime_since_genesis(),
+		td->latency_qd, success_ios);
+}
+
+static double lat_window_success(struct thread_data *td, uint64_t failed)
+{
+	uint64_t ios = ddir_rw_sum(td->io_blocks) - td->latency_ios;
+
+	if (!ios)
+		return 0.0;
+
+	return (double) (ios - failed) * 100.0 / (double) ios;
+}
+
 static void lat_new_cycle(struct thread_data *td)
 {
 	fio_gettime(&td->latency_ts, NULL);
@@ -1483,8 +1676,15 @@ static bool __lat_target_failed(struct thread_data *td)
 
 static bool lat_target_failed(struct thread_data *td)
 {
-	if (td->o.latency_percentile.u.f == 100.0)
-		return __lat_target_failed(td);
+	if (td->o.latency_mode == LATENCY_MODE_BISECT &&
+	    td->o.latency_percentile.u.f == 100.0) {
+		double success_ios = lat_window_success(td, 1);
+
+		if (__lat_target_failed(td))
+			return true;
+		lat_target_log(td, success_ios);
+		return false;
+	}
 
 	td->latency_failed++;
 	return false;
@@ -1501,6 +1701,21 @@ void lat_target_init(struct thread_data *td)
 		td->latency_qd_high = td->o.iodepth;
 		td->latency_qd_low = 1;
 		td->latency_ios = ddir_rw_sum(td->io_blocks);
+		td->latency_failed = 0;
+		td->latency_cuts = 0;
+		td->latency_cut_sum = 0;
+
+		if (td->o.latency_log_file && !td->latency_log) {
+			char name[PATH_MAX];
+
+			/* one file per job, like the other per job logs */
+			snprintf(name, sizeof(name), "%s.%d",
+				 td->o.latency_log_file, td->thread_number);
+			td->latency_log = fopen(name, "w");
+			if (!td->latency_log)
+				log_err("fio: failed to open latency log %s: %s\n",
+					name, strerror(errno));
+		}
 	} else
 		td->latency_qd = td->o.iodepth;
 }
@@ -1511,6 +1726,87 @@ void lat_target_reset(struct thread_data *td)
 		lat_target_init(td);
 }
 
+void lat_target_exit(struct thread_data *td)
+{
+	if (td->latency_log) {
+		fclose(td->latency_log);
+		td->latency_log = NULL;
+	}
+}
+
+/*
+ * Hold the queue depth we settled on for one more window and only keep
+ * the stats from that run.
+ */
+static void lat_target_end_run(struct thread_data *td)
+{
+	if (td->latency_end_run) {
+		dprint(FD_RATE, "We are done\n");
+		td->done = 1;
+	} else {
+		dprint(FD_RATE, "Quiesce and final run\n");
+		io_u_quiesce(td);
+		td->latency_end_run = 1;
+		reset_all_stats(td);
+		reset_io_stats(td);
+	}
+}
+
+/*
+ * AIMD: double the depth until the first window misses the target, then
+ * grow by one per good window and cut by a quarter on a bad one. Unless
+ * latency_run is set, we settle on the average of the depths just under
+ * the last few cuts.
+ */
+#define LAT_AIMD_CUTS	3
+
+static void lat_target_aimd(struct thread_data *td, bool success)
+{
+	struct thread_options *o = &td->o;
+	unsigned int cut;
+
+	if (td->latency_end_run) {
+		lat_target_end_run(td);
+		return;
+	}
+
+	if (success) {
+		if (!td->latency_cuts)
+			td->latency_qd *= 2;
+		else
+			td->latency_qd++;
+		if (td->latency_qd > o->iodepth)
+			td->latency_qd = o->iodepth;
+
+		dprint(FD_RATE, "AIMD up: %d\n", td->latency_qd);
+		return;
+	}
+
+	td->latency_cut_sum += td->latency_qd > 1 ? td->latency_qd - 1 : 1;
+	td->latency_cuts++;
+
+	cut = td->latency_qd / 4;
+	if (!cut)
+		cut = 1;
+	if (td->latency_qd > cut)
+		td->latency_qd -= cut;
+	else
+		td->latency_qd = 1;
+
+	dprint(FD_RATE, "AIMD down: %d (cut %u)\n", td->latency_qd,
+						td->latency_cuts);
+
+	if (!o->latency_run && td->latency_cuts >= LAT_AIMD_CUTS) {
+		td->latency_qd = td->latency_cut_sum / td->latency_cuts;
+		if (!td->latency_qd)
+			td->latency_qd = 1;
+		lat_target_end_run(td);
+		return;
+	}
+
+	io_u_quiesce(td);
+}
+
 static void lat_target_success(struct thread_data *td)
 {
 	const unsigned int qd = td->latency_qd;
@@ -1552,18 +1848,8 @@ static void lat_target_success(struct thread_data *td)
 	 * Same as last one, we are done. Let it run a latency cycle, so
 	 * we get only the results from the targeted depth.
 	 */
-	if (!o->latency_run && td->latency_qd == qd) {
-		if (td->latency_end_run) {
-			dprint(FD_RATE, "We are done\n");
-			td->done = 1;
-		} else {
-			dprint(FD_RATE, "Quiesce and final run\n");
-			io_u_quiesce(td);
-			td->latency_end_run = 1;
-			reset_all_stats(td);
-			reset_io_stats(td);
-		}
-	}
+	if (!o->latency_run && td->latency_qd == qd)
+		lat_target_end_run(td);
 
 	lat_new_cycle(td);
 }
@@ -1574,23 +1860,27 @@ static void lat_target_success(struct thread_data *td)
 void lat_target_check(struct thread_data *td)
 {
 	uint64_t usec_window;
-	uint64_t ios;
 	double success_ios;
+	bool success;
 
 	usec_window = utime_since_now(&td->latency_ts);
 	if (usec_window < td->o.latency_window)
 		return;
 
-	ios = ddir_rw_sum(td->io_blocks) - td->latency_ios;
-	success_ios = (double) (ios - td->latency_failed) / (double) ios;
-	success_ios *= 100.0;
+	success_ios = lat_window_success(td, td->latency_failed);
+	success = success_ios >= td->o.latency_percentile.u.f;
 
 	dprint(FD_RATE, "Success rate: %.2f%% (target %.2f%%)\n", success_ios, td->o.latency_percentile.u.f);
 
-	if (success_ios >= td->o.latency_percentile.u.f)
+	if (td->o.latency_mode == LATENCY_MODE_AIMD) {
+		lat_target_aimd(td, success);
+		lat_new_cycle(td);
+	} else if (success)
 		lat_target_success(td);
 	else
 		__lat_target_failed(td);
+
+	lat_target_log(td, success_ios);
 }
 
 /*
@@ -1603,6 +1893,8 @@ bool queue_full(const struct thread_data *td)
 
 	if (qempty)
 		return true;
+	if (td->phase_qd && td->cur_depth >= td->phase_qd)
+		return true;
 	if (!td->o.latency_target)
 		return false;
 
@@ -1638,7 +1930,8 @@ again:
 		assert(io_u->flags & IO_U_F_FREE);
 		io_u_clear(td, io_u, IO_U_F_FREE | IO_U_F_NO_FILE_PUT |
 				 IO_U_F_TRIMMED | IO_U_F_BARRIER |
-				 IO_U_F_VER_LIST);
+				 IO_U_F_VER_LIST | IO_U_F_VER_MAP |
+				 IO_U_F_ZONE_APPEND | IO_U_F_TORN_CHECK);
 
 		io_u->error = 0;
 		io_u->acct_ddir = -1;
@@ -1687,11 +1980,39 @@ static bool check_get_trim(struct thread_data *td, struct io_u *io_u)
 	return false;
 }
 
+/*
+ * verify_backlog_mode=interleave: issue verify_backlog_batch reads per
+ * verify_backlog writes like the batch mode, but one at a time between
+ * the writes. A read that can't be had yet, because the oldest write is
+ * still in flight, is issued at a later turn.
+ */
+static bool check_get_verify_interleave(struct thread_data *td,
+					struct io_u *io_u)
+{
+	unsigned long long batch = td->o.verify_batch;
+	uint64_t due;
+
+	if (!batch)
+		batch = td->o.verify_backlog;
+	due = td->io_issues[DDIR_WRITE] * batch / td->o.verify_backlog;
+
+	if (!td->io_hist_len || td->verify_interleaved >= due)
+		return false;
+	if (get_next_verify(td, io_u))
+		return false;
+
+	td->verify_interleaved++;
+	return true;
+}
+
 static bool check_get_verify(struct thread_data *td, struct io_u *io_u)
 {
 	if (!(td->flags & TD_F_VER_BACKLOG))
 		return false;
 
+	if (td->o.verify_backlog_mode == VERIFY_BACKLOG_INTERLEAVE)
+		return check_get_verify_interleave(td, io_u);
+
 	if (td->io_hist_len) {
 		int get_verify = 0;
 
@@ -1761,6 +2082,49 @@ static void small_content_scramble(struct io_u *io_u)
 	}
 }
 
+#define STAMP_BLOCK	4096
+#define STAMP_LINE	64
+
+static inline uint64_t stamp_mix(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+/*
+ * buffer_stamp: XOR a key unique to this write into the last cache line
+ * of every 4KiB of the buffer. It is always the same line, so only that
+ * much of the data ever changes and the buffer compresses as it did. The
+ * words of a line differ by a constant step, which leaves the loop easy
+ * to vectorize.
+ */
+void io_u_stamp_buffer(struct thread_data *td, void *buf,
+		       unsigned long long len)
+{
+	const uint64_t key = stamp_mix(td->stamp_key += 0x9e3779b97f4a7c15ULL);
+	unsigned long long off, blen;
+	unsigned int i, nr;
+	uint64_t k, *p;
+
+	for (off = 0; off < len; off += STAMP_BLOCK) {
+		blen = min(len - off, (unsigned long long) STAMP_BLOCK);
+		if (blen >= STAMP_LINE) {
+			p = buf + off + ((blen - STAMP_LINE) & ~(STAMP_LINE - 1ULL));
+			nr = STAMP_LINE / sizeof(uint64_t);
+		} else {
+			p = buf + off;
+			nr = blen / sizeof(uint64_t);
+		}
+
+		k = stamp_mix(key + off);
+		for (i = 0; i < nr; i++)
+			p[i] ^= k + i * 0xd6e8feb86659fd93ULL;
+	}
+}
+
 /*
  * Return an io_u to be processed. Gets a buflen and offset, sets direction,
  * etc. The returned io_u is fully ready to be prepped, populated and submitted.
@@ -1815,14 +2179,33 @@ struct io_u *get_io_u(struct thread_data *td)
 			goto err_put;
 		}
 
-		f->last_start[io_u->ddir] = io_u->offset;
-		f->last_pos[io_u->ddir] = io_u->offset + io_u->buflen;
+		/* multi-range trims have already moved these along */
+		if (!io_u->nr_trim_ranges) {
+			f->last_start[io_u->ddir] = io_u->offset;
+			f->last_pos[io_u->ddir] = io_u->offset + io_u->buflen;
+		}
 
 		if (io_u->ddir == DDIR_WRITE) {
 			if (td->flags & TD_F_REFILL_BUFFERS) {
 				io_u_fill_buffer(td, io_u,
 					td->o.min_bs[DDIR_WRITE],
 					io_u->buflen);
+			} else if (td->o.buffer_stamp) {
+				/*
+				 * Verify writes are stamped when their
+				 * headers go in, see fill_verify_pattern().
+				 * Fill once, and again after a read.
+				 */
+				if (!(td->flags & TD_F_DO_VERIFY)) {
+					if (io_u->buf_filled_len < io_u->buflen) {
+						io_u_fill_buffer(td, io_u,
+							td->o.min_bs[DDIR_WRITE],
+							io_u->buflen);
+						io_u->buf_filled_len = io_u->buflen;
+					}
+					io_u_stamp_buffer(td, io_u->buf,
+							  io_u->buflen);
+				}
 			} else if ((td->flags & TD_F_SCRAMBLE_BUFFERS) &&
 				   !(td->flags & TD_F_COMPRESS) &&
 				   !(td->flags & TD_F_DO_VERIFY))
@@ -1850,8 +2233,12 @@ struct io_u *get_io_u(struct thread_data *td)
 out:
 	assert(io_u->file);
 	if (!td_io_prep(td, io_u)) {
-		if (!td->o.disable_lat)
-			fio_gettime(&io_u->start_time, NULL);
+		if (!td->o.disable_lat) {
+			if (td->o.clock_batch)
+				io_u_clock_batch_stamp(td, &io_u->start_time);
+			else
+				fio_gettime(&io_u->start_time, NULL);
+		}
 
 		if (do_scramble)
 			small_content_scramble(io_u);
@@ -1912,9 +2299,9 @@ static void trim_block_info(struct thread_data *td, struct io_u *io_u)
 	*info = BLOCK_INFO(BLOCK_STATE_TRIMMED, BLOCK_INFO_TRIMS(*info) + 1);
 }
 
-static void account_io_completion(struct thread_data *td, struct io_u *io_u,
-				  struct io_completion_data *icd,
-				  const enum fio_ddir idx, unsigned int bytes)
+static void __account_io_completion(struct thread_data *td, struct io_u *io_u,
+				    struct io_completion_data *icd,
+				    const enum fio_ddir idx, unsigned int bytes)
 {
 	const int no_reduce = !gtod_reduce(td);
 	unsigned long long llnsec = 0;
@@ -1925,7 +2312,9 @@ static void account_io_completion(struct thread_data *td, struct io_u *io_u,
 	if (!td->o.stats || td_ioengine_flagged(td, FIO_NOSTATS))
 		return;
 
-	if (no_reduce)
+	if (td->o.clat_source == CLAT_SOURCE_ENGINE)
+		llnsec = io_u->engine_clat;
+	else if (no_reduce)
 		llnsec = ntime_since(&io_u->issue_time, &icd->time);
 
 	if (!td->o.disable_lat) {
@@ -1939,7 +2328,8 @@ static void account_io_completion(struct thread_data *td, struct io_u *io_u,
 			struct prof_io_ops *ops = &td->prof_io_ops;
 
 			if (ops->io_u_lat)
-				icd->error = ops->io_u_lat(td, tnsec);
+				icd->error = ops->io_u_lat(td, idx, tnsec,
+							   &icd->time);
 		}
 
 		if (ddir_rw(idx)) {
@@ -1957,12 +2347,24 @@ static void account_io_completion(struct thread_data *td, struct io_u *io_u,
 			add_clat_sample(td, idx, llnsec, bytes, io_u->offset,
 					io_u->ioprio, io_u->clat_prio_index);
 			io_u_mark_latency(td, llnsec);
+			lat_outlier_add(td, io_u, llnsec, &icd->time);
+			if (io_u->nr_trim_ranges)
+				add_trim_range_samples(&td->ts, llnsec,
+						       io_u->nr_trim_ranges);
 		}
 
-		if (!td->o.disable_bw && per_unit_log(td->bw_log))
+		file_stat_add(td->file_stats, td->nr_file_stats,
+			      io_u->file->fileno, idx, bytes, llnsec);
+		if (td->cpu_locality)
+			cpu_locality_add(td->cpu_locality, io_u->submit_cpu,
+					 fio_getcpu(), llnsec);
+
+		if (!td->o.disable_bw && per_unit_log(td->bw_log) &&
+		    !helper_window_log(td->bw_log))
 			add_bw_sample(td, io_u, bytes, llnsec);
 
-		if (no_reduce && per_unit_log(td->iops_log))
+		if (no_reduce && per_unit_log(td->iops_log) &&
+		    !helper_window_log(td->iops_log))
 			add_iops_sample(td, io_u, bytes);
 	} else if (ddir_sync(idx) && !td->o.disable_clat)
 		add_sync_clat_sample(&td->ts, llnsec);
@@ -1971,6 +2373,17 @@ static void account_io_completion(struct thread_data *td, struct io_u *io_u,
 		trim_block_info(td, io_u);
 }
 
+static void account_io_completion(struct thread_data *td, struct io_u *io_u,
+				  struct io_completion_data *icd,
+				  const enum fio_ddir idx, unsigned int bytes)
+{
+	int prev;
+
+	prev = overhead_enter(td, FIO_OVH_STATS);
+	__account_io_completion(td, io_u, icd, idx, bytes);
+	overhead_leave(td, prev);
+}
+
 static void file_log_write_comp(const struct thread_data *td, struct fio_file *f,
 				uint64_t offset, unsigned int bytes)
 {
@@ -2010,6 +2423,7 @@ static void io_completed(struct thread_data *td, struct io_u **io_u_ptr,
 
 	assert(io_u->flags & IO_U_F_FLIGHT);
 	io_u_clear(td, io_u, IO_U_F_FLIGHT | IO_U_F_BUSY_OK | IO_U_F_PATTERN_DONE);
+	overlap_release(td, io_u);
 
 	/*
 	 * Mark IO ok to verify
@@ -2021,11 +2435,21 @@ static void io_completed(struct thread_data *td, struct io_u **io_u_ptr,
 		if (io_u->error)
 			unlog_io_piece(td, io_u);
 		else {
+			if (io_u->flags & IO_U_F_ZONE_APPEND)
+				log_zone_append_piece(td, io_u);
 			atomic_store_release(&io_u->ipo->flags,
 					io_u->ipo->flags & ~IP_F_IN_FLIGHT);
 		}
+	} else if (ddir == DDIR_WRITE && (io_u->flags & IO_U_F_VER_MAP)) {
+		if (io_u->error)
+			unlog_io_piece(td, io_u);
+		else
+			verify_map_complete(td, io_u);
 	}
 
+	if (f && f->verify_table && !io_u->error)
+		verify_table_complete(td, io_u);
+
 	if (ddir_sync(ddir)) {
 		td->last_was_sync = true;
 		if (f) {
@@ -2103,13 +2527,52 @@ static void io_completed(struct thread_data *td, struct io_u **io_u_ptr,
 	}
 }
 
+/*
+ * Make 'now' the timestamp clock_batch hands out. IO stamped with the
+ * previous one started somewhere between that and now, so the gap is the
+ * worst case error for those.
+ */
+static void clock_batch_update(struct thread_data *td, struct timespec *now)
+{
+	if (td->clock_batch_used) {
+		struct thread_data *ptd = td->parent ? td->parent : td;
+		uint64_t err = ntime_since(&td->clock_batch_ts, now);
+
+		if (err > ptd->ts.clock_batch_err)
+			ptd->ts.clock_batch_err = err;
+		td->clock_batch_used = false;
+	}
+
+	td->clock_batch_ts = *now;
+	td->clock_batch_valid = true;
+}
+
+/*
+ * Stamp 'ts' with the last completion time instead of reading the clock.
+ */
+void io_u_clock_batch_stamp(struct thread_data *td, struct timespec *ts)
+{
+	if (!td->clock_batch_valid) {
+		struct timespec now;
+
+		fio_gettime(&now, NULL);
+		clock_batch_update(td, &now);
+	}
+
+	*ts = td->clock_batch_ts;
+	td->clock_batch_used = true;
+}
+
 static void init_icd(struct thread_data *td, struct io_completion_data *icd,
 		     int nr)
 {
 	int ddir;
 
-	if (!gtod_reduce(td))
+	if (!gtod_reduce(td)) {
 		fio_gettime(&icd->time, NULL);
+		if (td->o.clock_batch)
+			clock_batch_update(td, &icd->time);
+	}
 
 	icd->nr = nr;
 
@@ -2121,11 +2584,15 @@ static void init_icd(struct thread_data *td, struct io_completion_data *icd,
 static void ios_completed(struct thread_data *td,
 			  struct io_completion_data *icd)
 {
+	const bool batch = td->io_ops->reap_batch != NULL;
 	struct io_u *io_u;
 	int i;
 
 	for (i = 0; i < icd->nr; i++) {
-		io_u = td->io_ops->event(td, i);
+		if (batch)
+			io_u = td->io_u_reaped[i];
+		else
+			io_u = td->io_ops->event(td, i);
 
 		io_completed(td, &io_u, icd);
 
@@ -2154,7 +2621,9 @@ static void io_u_update_bytes_done(struct thread_data *td,
 int io_u_sync_complete(struct thread_data *td, struct io_u *io_u)
 {
 	struct io_completion_data icd;
+	int prev, ret = 0;
 
+	prev = overhead_enter(td, FIO_OVH_COMPLETE);
 	init_icd(td, &icd, 1);
 	io_completed(td, &io_u, &icd);
 
@@ -2163,12 +2632,12 @@ int io_u_sync_complete(struct thread_data *td, struct io_u *io_u)
 
 	if (icd.error) {
 		td_verror(td, icd.error, "io_u_sync_complete");
-		return -1;
-	}
-
-	io_u_update_bytes_done(td, &icd);
+		ret = -1;
+	} else
+		io_u_update_bytes_done(td, &icd);
 
-	return 0;
+	overhead_leave(td, prev);
+	return ret;
 }
 
 /*
@@ -2180,6 +2649,7 @@ int io_u_queued_complete(struct thread_data *td, int min_evts)
 	struct timespec *tvp = NULL;
 	int ret;
 	struct timespec ts = { .tv_sec = 0, .tv_nsec = 0, };
+	int prev;
 
 	dprint(FD_IO, "io_u_queued_complete: min=%d\n", min_evts);
 
@@ -2188,24 +2658,28 @@ int io_u_queued_complete(struct thread_data *td, int min_evts)
 	else if (min_evts > td->cur_depth)
 		min_evts = td->cur_depth;
 
+	prev = overhead_enter(td, FIO_OVH_COMPLETE);
+
 	/* No worries, td_io_getevents fixes min and max if they are
 	 * set incorrectly */
 	ret = td_io_getevents(td, min_evts, td->o.iodepth_batch_complete_max, tvp);
 	if (ret < 0) {
 		td_verror(td, -ret, "td_io_getevents");
-		return ret;
+		goto out;
 	} else if (!ret)
-		return ret;
+		goto out;
 
 	init_icd(td, &icd, ret);
 	ios_completed(td, &icd);
 	if (icd.error) {
 		td_verror(td, icd.error, "io_u_queued_complete");
-		return -1;
+		ret = -1;
+		goto out;
 	}
 
 	io_u_update_bytes_done(td, &icd);
-
+out:
+	overhead_leave(td, prev);
 	return ret;
 }
 
@@ -2216,7 +2690,9 @@ void io_u_queued(struct thread_data *td, struct io_u *io_u)
 {
 	if (!td->o.disable_slat && ramp_time_over(td) && td->o.stats) {
 		unsigned long slat_time;
+		int prev;
 
+		prev = overhead_enter(td, FIO_OVH_STATS);
 		slat_time = ntime_since(&io_u->start_time, &io_u->issue_time);
 
 		if (td->parent)
@@ -2224,6 +2700,7 @@ void io_u_queued(struct thread_data *td, struct io_u *io_u)
 
 		add_slat_sample(td, io_u->ddir, slat_time, io_u->xfer_buflen,
 				io_u->offset, io_u->ioprio);
+		overhead_leave(td, prev);
 	}
 }
 
@@ -2256,6 +2733,8 @@ static struct frand_state *get_buf_state(struct thread_data *td)
 			frand_copy(&td->buf_state_ret, &td->buf_state_prev);
 			return &td->buf_state_ret;
 		case DEDUPE_MODE_WORKING_SET:
+		case DEDUPE_MODE_SHIFTED:
+		case DEDUPE_MODE_SIMILAR:
 			i = rand_between(&td->dedupe_working_set_index_state, 0, td->num_unique_pages - 1);
 			frand_copy(&td->buf_state_ret, &td->dedupe_working_set_states[i]);
 			return &td->buf_state_ret;
@@ -2288,6 +2767,7 @@ void fill_io_buffer(struct thread_data *td, void *buf, unsigned long long min_wr
 		struct frand_state *rs = NULL;
 		unsigned long long left = max_bs;
 		unsigned long long this_write;
+		void *start = buf;
 
 		do {
 			/*
@@ -2305,21 +2785,31 @@ void fill_io_buffer(struct thread_data *td, void *buf, unsigned long long min_wr
 			this_write = min_not_zero(min_write,
 						(unsigned long long) td->o.compress_chunk);
 
-			fill_random_buf_percentage(rs, buf, perc,
-				this_write, this_write,
-				o->buffer_pattern,
-				o->buffer_pattern_bytes);
+			if (perc && o->compress_mode != COMPRESS_MODE_FIXED)
+				fill_random_buf_entropy(rs, buf, this_write,
+					td->compress_level,
+					o->buffer_generator);
+			else
+				fill_random_buf_percentage(rs, buf, perc,
+					this_write, this_write,
+					o->buffer_pattern,
+					o->buffer_pattern_bytes,
+					o->buffer_generator);
 
 			buf += this_write;
 			left -= this_write;
 			save_buf_state(td, rs);
 		} while (left);
+
+		if (rs == &td->buf_state_ret)
+			dedupe_patch_buffer(td, start, max_bs);
 	} else if (o->buffer_pattern_bytes)
 		fill_buffer_pattern(td, buf, max_bs);
 	else if (o->zero_buffers)
 		memset(buf, 0, max_bs);
 	else
-		fill_random_buf(get_buf_state(td), buf, max_bs);
+		fill_random_buf(get_buf_state(td), buf, max_bs,
+				o->buffer_generator);
 }
 
 /*
@@ -2376,6 +2866,84 @@ int do_io_u_sync(const struct thread_data *td, struct io_u *io_u)
 	return ret;
 }
 
+/*
+ * Where trim_mode=copy reads from when it overwrites [start, start + len):
+ * half the IO range away, so the copy goes across the file instead of to
+ * the blocks next door.
+ */
+unsigned long long trim_copy_src(const struct thread_data *td,
+				 const struct fio_file *f,
+				 unsigned long long start,
+				 unsigned long long len)
+{
+	unsigned long long half, end;
+
+	half = f->io_size / 2;
+	if (td->o.min_bs[DDIR_TRIM])
+		half -= half % td->o.min_bs[DDIR_TRIM];
+	end = f->file_offset + f->io_size;
+
+	if (start + half + len <= end)
+		return start + half;
+	if (start >= f->file_offset + half)
+		return start - half;
+	return f->file_offset;
+}
+
+/*
+ * fallocate() mode of trim_mode=allocate and punch_hole, -1 for the trim
+ * modes that aren't fallocate() calls
+ */
+int trim_falloc_mode(const struct thread_data *td)
+{
+#ifdef CONFIG_LINUX_FALLOCATE
+	switch (td->o.trim_mode) {
+	case TRIM_MODE_ALLOCATE:
+		return 0;
+	case TRIM_MODE_PUNCH_HOLE:
+		return FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
+	}
+#endif
+	return -1;
+}
+
+#ifdef FIO_HAVE_TRIM
+static int trim_range(const struct thread_data *td, struct fio_file *f,
+		      unsigned long long start, unsigned long long len)
+{
+	switch (td->o.trim_mode) {
+	case TRIM_MODE_WRITE_ZEROES:
+#ifdef FIO_HAVE_WRITE_ZEROES
+		return os_write_zeroes(f, start, len);
+#else
+		return EINVAL;
+#endif
+	case TRIM_MODE_COPY:
+#ifdef FIO_HAVE_COPY_RANGE
+		return os_copy_range(f, trim_copy_src(td, f, start, len),
+					start, len);
+#else
+		return EINVAL;
+#endif
+	case TRIM_MODE_ALLOCATE:
+	case TRIM_MODE_PUNCH_HOLE:
+#ifdef CONFIG_LINUX_FALLOCATE
+		if (fallocate(f->fd, trim_falloc_mode(td), start, len) < 0)
+			return errno;
+		return 0;
+#else
+		return EINVAL;
+#endif
+	case TRIM_MODE_TRUNCATE:
+		if (ftruncate(f->fd, start + len) < 0)
+			return errno;
+		return 0;
+	default:
+		return os_trim(f, start, len);
+	}
+}
+#endif
+
 int do_io_u_trim(const struct thread_data *td, struct io_u *io_u)
 {
 #ifndef FIO_HAVE_TRIM
@@ -2393,7 +2961,23 @@ int do_io_u_trim(const struct thread_data *td, struct io_u *io_u)
 			goto err;
 	}
 
-	ret = os_trim(f, io_u->offset, io_u->xfer_buflen);
+	if (io_u->nr_trim_ranges) {
+		unsigned int i;
+
+		/*
+		 * There's no vectored discard, so each range is its own
+		 * call and the command latency covers all of them.
+		 */
+		for (i = 0; i < io_u->nr_trim_ranges; i++) {
+			ret = trim_range(td, f, io_u->trim_ranges[i].start,
+					io_u->trim_ranges[i].len);
+			if (ret)
+				goto err;
+		}
+		return io_u->xfer_buflen;
+	}
+
+	ret = trim_range(td, f, io_u->offset, io_u->xfer_buflen);
 	if (!ret)
 		return io_u->xfer_buflen;
 
@@ -22,6 +22,17 @@ enum {
 	IO_U_F_BARRIER		= 1 << 6,
 	IO_U_F_VER_LIST		= 1 << 7,
 	IO_U_F_PATTERN_DONE	= 1 << 8,
+	IO_U_F_VER_MAP		= 1 << 9,
+	IO_U_F_ZONE_APPEND	= 1 << 10,
+	IO_U_F_TORN_CHECK	= 1 << 11,
+};
+
+/*
+ * One range of a multi-range trim, in bytes
+ */
+struct trim_range {
+	uint64_t start;
+	uint64_t len;
 };
 
 /*
@@ -31,6 +42,12 @@ struct io_u {
 	struct timespec start_time;
 	struct timespec issue_time;
 
+	/*
+	 * Completion latency reported by the engine, in nsec. Only valid
+	 * for FIO_ENGINE_CLAT engines.
+	 */
+	uint64_t engine_clat;
+
 	struct fio_file *file;
 	unsigned int flags;
 	enum fio_ddir ddir;
@@ -60,26 +77,12 @@ struct io_u {
 	unsigned long long verify_offset;	/* is really ->offset */
 	void *buf;
 
-	/*
-	 * Initial seed for generating the buffer contents
-	 */
-	uint64_t rand_seed;
-
 	/*
 	 * IO engine state, may be different from above when we get
 	 * partial transfers / residual data counts
 	 */
 	void *xfer_buf;
 	unsigned long long xfer_buflen;
-
-	/*
-	 * Parameter related to pre-filled buffers and
-	 * their size to handle variable block sizes.
-	 */
-	unsigned long long buf_filled_len;
-
-	struct io_piece *ipo;
-
 	unsigned long long resid;
 	unsigned int error;
 
@@ -92,11 +95,39 @@ struct io_u {
 		void *engine_data;
 	};
 
+	struct io_piece *ipo;
+
+	/*
+	 * Callback for io completion
+	 */
+	int (*end_io)(struct thread_data *, struct io_u **);
+
+	/*
+	 * Everything above is used for every IO and fits the first three
+	 * cache lines of the (cache line aligned) io_u. Less frequently
+	 * used state follows.
+	 */
+
+	/*
+	 * Initial seed for generating the buffer contents
+	 */
+	uint64_t rand_seed;
+
+	/*
+	 * Parameter related to pre-filled buffers and
+	 * their size to handle variable block sizes.
+	 */
+	unsigned long long buf_filled_len;
+
 	union {
 		struct flist_head verify_list;
 		struct workqueue_work work;
 	};
 
+	/* serialize_overlap in-flight index, see overlap.h */
+	struct flist_head overlap_list;
+	struct overlap_bucket *overlap_bucket;
+
 	/*
 	 * ZBD mode zbd_queue_io callback: called after engine->queue operation
 	 * to advance a zone write pointer and eventually unlock the I/O zone.
@@ -113,13 +144,26 @@ struct io_u {
 	 */
 	void (*zbd_put_io)(struct thread_data *td, const struct io_u *);
 
+	uint32_t dtype;
+	uint32_t dspec;
+
 	/*
-	 * Callback for io completion
+	 * With num_range > 1, a trim covers ->nr_trim_ranges ranges, stored in
+	 * the job's io_u arena. ->offset is the first range and ->buflen the
+	 * sum of the range lengths.
 	 */
-	int (*end_io)(struct thread_data *, struct io_u **);
+	struct trim_range *trim_ranges;
+	unsigned int nr_trim_ranges;
 
-	uint32_t dtype;
-	uint32_t dspec;
+	/*
+	 * IOs in flight when this one was queued, for lat_outliers
+	 */
+	unsigned int submit_depth;
+
+	/*
+	 * CPU this one was queued on, for cpu_locality_stats
+	 */
+	int submit_cpu;
 
 	union {
 #ifdef CONFIG_LIBAIO
@@ -152,17 +196,23 @@ extern void requeue_io_u(struct thread_data *, struct io_u **);
 extern int __must_check io_u_sync_complete(struct thread_data *, struct io_u *);
 extern int __must_check io_u_queued_complete(struct thread_data *, int);
 extern void io_u_queued(struct thread_data *, struct io_u *);
+extern void io_u_clock_batch_stamp(struct thread_data *, struct timespec *);
 extern int io_u_quiesce(struct thread_data *);
 extern void io_u_log_error(struct thread_data *, struct io_u *);
 extern void io_u_mark_depth(struct thread_data *, unsigned int);
 extern void fill_io_buffer(struct thread_data *, void *, unsigned long long, unsigned long long);
 extern void io_u_fill_buffer(struct thread_data *td, struct io_u *, unsigned long long, unsigned long long);
+extern void io_u_stamp_buffer(struct thread_data *, void *, unsigned long long);
 void io_u_mark_complete(struct thread_data *, unsigned int);
 void io_u_mark_submit(struct thread_data *, unsigned int);
 bool queue_full(const struct thread_data *);
 
 int do_io_u_sync(const struct thread_data *, struct io_u *);
 int do_io_u_trim(const struct thread_data *, struct io_u *);
+unsigned long long trim_copy_src(const struct thread_data *,
+				 const struct fio_file *, unsigned long long,
+				 unsigned long long);
+int trim_falloc_mode(const struct thread_data *);
 
 #ifdef FIO_INC_DEBUG
 static inline void dprint_io_u(struct io_u *io_u, const char *p)
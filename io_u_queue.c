@@ -15,6 +15,8 @@ bool io_u_qinit(struct io_u_queue *q, unsigned int nr, bool shared)
 
 	q->nr = 0;
 	q->max = nr;
+	q->head = 0;
+	q->fifo = false;
 	return true;
 }
 
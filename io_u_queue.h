@@ -4,33 +4,60 @@
 #include <assert.h>
 #include <stddef.h>
 
+#include "compiler/compiler.h"
 #include "lib/types.h"
 
 struct io_u;
 
+/*
+ * A queue is a stack by default, the last io_u pushed is popped first. A
+ * FIFO queue hands them out in the order they were pushed, the entries
+ * then live in io_us[head] .. io_us[head + nr - 1], wrapping at max.
+ */
 struct io_u_queue {
 	struct io_u **io_us;
 	unsigned int nr;
 	unsigned int max;
+	unsigned int head;
+	bool fifo;
 };
 
-static inline struct io_u *io_u_qpop(struct io_u_queue *q)
+static inline unsigned int io_u_qidx(const struct io_u_queue *q,
+				     unsigned int i)
 {
-	if (q->nr) {
-		const unsigned int next = --q->nr;
-		struct io_u *io_u = q->io_us[next];
+	i += q->head;
+	return i >= q->max ? i - q->max : i;
+}
 
-		q->io_us[next] = NULL;
-		return io_u;
+static inline struct io_u *io_u_qpop(struct io_u_queue *q)
+{
+	unsigned int next;
+	struct io_u *io_u;
+
+	if (!q->nr)
+		return NULL;
+
+	if (q->fifo) {
+		next = q->head;
+		q->head = io_u_qidx(q, 1);
+		q->nr--;
+		if (q->nr)
+			fio_prefetch(q->io_us[q->head]);
+	} else {
+		next = --q->nr;
+		if (q->nr)
+			fio_prefetch(q->io_us[next - 1]);
 	}
 
-	return NULL;
+	io_u = q->io_us[next];
+	q->io_us[next] = NULL;
+	return io_u;
 }
 
 static inline void io_u_qpush(struct io_u_queue *q, struct io_u *io_u)
 {
 	if (q->nr < q->max) {
-		q->io_us[q->nr++] = io_u;
+		q->io_us[io_u_qidx(q, q->nr++)] = io_u;
 		return;
 	}
 
@@ -43,7 +70,7 @@ static inline int io_u_qempty(const struct io_u_queue *q)
 }
 
 #define io_u_qiter(q, io_u, i)	\
-	for (i = 0; i < (q)->nr && (io_u = (q)->io_us[i]); i++)
+	for (i = 0; i < (q)->nr && (io_u = (q)->io_us[io_u_qidx(q, i)]); i++)
 
 bool io_u_qinit(struct io_u_queue *q, unsigned int nr, bool shared);
 void io_u_qexit(struct io_u_queue *q, bool shared);
@@ -21,6 +21,10 @@
 #include "fio.h"
 #include "diskutil.h"
 #include "zbd.h"
+#include "pshared.h"
+#include "overhead.h"
+#include "reduction.h"
+#include "oslib/statx.h"
 
 static FLIST_HEAD(engine_list);
 
@@ -31,6 +35,20 @@ static inline bool async_ioengine_sync_trim(struct thread_data *td,
 		io_u->ddir == DDIR_TRIM;
 }
 
+/*
+ * Hand the staged reads and writes to the engine, see ->queue_batch()
+ */
+static inline void td_io_flush_batch(struct thread_data *td)
+{
+	unsigned int nr = td->io_u_batch_nr;
+
+	if (!nr)
+		return;
+
+	td->io_u_batch_nr = 0;
+	td->io_ops->queue_batch(td, td->io_u_batch, nr);
+}
+
 static bool check_engine_ops(struct thread_data *td, struct ioengine_ops *ops)
 {
 	if (ops->version != FIO_IOOPS_VERSION) {
@@ -44,6 +62,11 @@ static bool check_engine_ops(struct thread_data *td, struct ioengine_ops *ops)
 		return true;
 	}
 
+	if (ops->queue_batch && !ops->commit) {
+		log_err("%s: queue_batch needs a commit handler\n", ops->name);
+		return true;
+	}
+
 	/*
 	 * sync engines only need a ->queue()
 	 */
@@ -60,7 +83,7 @@ static bool check_engine_ops(struct thread_data *td, struct ioengine_ops *ops)
 		return true;
 	}
 
-	if (!ops->event || !ops->getevents) {
+	if (!ops->reap_batch && (!ops->event || !ops->getevents)) {
 		log_err("%s: no event/getevents handler\n", ops->name);
 		return true;
 	}
@@ -257,6 +280,11 @@ void close_ioengine(struct thread_data *td)
 		td->io_ops_data = NULL;
 	}
 
+	free(td->io_u_batch);
+	td->io_u_batch = NULL;
+	free(td->io_u_reaped);
+	td->io_u_reaped = NULL;
+
 	free_ioengine(td);
 }
 
@@ -265,7 +293,7 @@ int td_io_prep(struct thread_data *td, struct io_u *io_u)
 	dprint_io_u(io_u, "prep");
 	fio_ro_check(td, io_u);
 
-	lock_file(td, io_u->file, io_u->ddir);
+	lock_file(td, io_u->file, io_u->ddir, io_u->offset, io_u->buflen);
 
 	if (td->io_ops->prep) {
 		int ret = td->io_ops->prep(td, io_u);
@@ -296,6 +324,7 @@ int td_io_getevents(struct thread_data *td, unsigned int min, unsigned int max,
 		return 0;
 
 	if (min > 0 && td->io_ops->commit) {
+		td_io_flush_batch(td);
 		r = td->io_ops->commit(td);
 		if (r < 0)
 			goto out;
@@ -306,7 +335,9 @@ int td_io_getevents(struct thread_data *td, unsigned int min, unsigned int max,
 		max = min;
 
 	r = 0;
-	if (max && td->io_ops->getevents)
+	if (max && td->io_ops->reap_batch)
+		r = td->io_ops->reap_batch(td, td->io_u_reaped, min, max, t);
+	else if (max && td->io_ops->getevents)
 		r = td->io_ops->getevents(td, min, max, t);
 out:
 	if (r >= 0) {
@@ -335,19 +366,12 @@ enum fio_q_status td_io_queue(struct thread_data *td, struct io_u *io_u)
 	assert((io_u->flags & IO_U_F_FLIGHT) == 0);
 	io_u_set(td, io_u, IO_U_F_FLIGHT);
 
-	/*
-	 * If overlap checking was enabled in offload mode we
-	 * can release this lock that was acquired when we
-	 * started the overlap check because the IO_U_F_FLIGHT
-	 * flag is now set
-	 */
-	if (td_offload_overlap(td)) {
-		int res = pthread_mutex_unlock(&overlap_check);
-		assert(res == 0);
-	}
-
 	assert(fio_file_open(io_u->file));
 
+	if (io_u->ddir == DDIR_WRITE)
+		reduction_sample(td->parent ? td->parent : td, io_u->xfer_buf,
+				 io_u->xfer_buflen);
+
 	/*
 	 * If using a write iolog, store this entry.
 	 */
@@ -356,10 +380,18 @@ enum fio_q_status td_io_queue(struct thread_data *td, struct io_u *io_u)
 	io_u->error = 0;
 	io_u->resid = 0;
 
+	if (td->outliers)
+		io_u->submit_depth = td->io_u_in_flight + td->io_u_queued;
+	if (td->cpu_locality)
+		io_u->submit_cpu = fio_getcpu();
+
 	if (td_ioengine_flagged(td, FIO_SYNCIO) ||
 		async_ioengine_sync_trim(td, io_u)) {
 		if (fio_fill_issue_time(td)) {
-			fio_gettime(&io_u->issue_time, NULL);
+			if (td->o.clock_batch)
+				io_u_clock_batch_stamp(td, &io_u->issue_time);
+			else
+				fio_gettime(&io_u->issue_time, NULL);
 
 			/*
 			 * only used for iolog
@@ -379,7 +411,14 @@ enum fio_q_status td_io_queue(struct thread_data *td, struct io_u *io_u)
 		td->rate_io_issue_bytes[ddir] += buflen;
 	}
 
-	ret = td->io_ops->queue(td, io_u);
+	if (td->io_batch &&
+	    (io_u->ddir == DDIR_READ || io_u->ddir == DDIR_WRITE)) {
+		td->io_u_batch[td->io_u_batch_nr++] = io_u;
+		ret = FIO_Q_QUEUED;
+	} else {
+		td_io_flush_batch(td);
+		ret = td->io_ops->queue(td, io_u);
+	}
 	zbd_queue_io_u(td, io_u, ret);
 
 	unlock_file(td, io_u->file);
@@ -445,7 +484,10 @@ enum fio_q_status td_io_queue(struct thread_data *td, struct io_u *io_u)
 		!async_ioengine_sync_trim(td, io_u)) {
 		if (fio_fill_issue_time(td) &&
 			!td_ioengine_flagged(td, FIO_ASYNCIO_SETS_ISSUE_TIME)) {
-			fio_gettime(&io_u->issue_time, NULL);
+			if (td->o.clock_batch)
+				io_u_clock_batch_stamp(td, &io_u->issue_time);
+			else
+				fio_gettime(&io_u->issue_time, NULL);
 
 			/*
 			 * only used for iolog
@@ -459,10 +501,278 @@ enum fio_q_status td_io_queue(struct thread_data *td, struct io_u *io_u)
 	return ret;
 }
 
+/*
+ * All io_u's of a job, and the engine's private data for each of them, come
+ * from one cache line aligned allocation. Every slot holds an io_u followed
+ * by ->io_u_priv_size bytes and, for multi-range trims, num_range trim
+ * ranges, rounded up to whole cache lines, so setting up or recycling an
+ * io_u never has to allocate.
+ */
+int td_io_u_arena_init(struct thread_data *td, unsigned int nr,
+		       unsigned int align)
+{
+	size_t priv_off = (sizeof(struct io_u) + 15) & ~15UL;
+	size_t trim_off = (priv_off + td->io_ops->io_u_priv_size + 15) & ~15UL;
+	size_t stride = priv_off + td->io_ops->io_u_priv_size;
+
+	if (td->o.num_range > 1)
+		stride = trim_off + td->o.num_range * sizeof(struct trim_range);
+
+	stride = (stride + align - 1) & ~((size_t) align - 1);
+
+	td->io_u_arena_size = stride * nr;
+	td->io_u_arena = fio_memalign(align, td->io_u_arena_size,
+					td_offload_overlap(td));
+	if (!td->io_u_arena) {
+		td->io_u_arena_size = 0;
+		return 1;
+	}
+
+	memset(td->io_u_arena, 0, td->io_u_arena_size);
+	mem_acct_set(td, MEM_IO_U, td->io_u_arena_size);
+	td->io_u_stride = stride;
+	td->io_u_priv_off = priv_off;
+	td->io_u_trim_off = trim_off;
+	return 0;
+}
+
+struct io_u *td_io_u_arena_slot(struct thread_data *td, unsigned int index)
+{
+	return td->io_u_arena + (size_t) index * td->io_u_stride;
+}
+
+void td_io_u_arena_free(struct thread_data *td)
+{
+	if (!td->io_u_arena)
+		return;
+
+	fio_memfree(td->io_u_arena, td->io_u_arena_size,
+			td_offload_overlap(td));
+	td->io_u_arena = NULL;
+	td->io_u_arena_size = 0;
+	mem_acct_set(td, MEM_IO_U, 0);
+}
+
+/*
+ * Generic async adapter for FIO_SYNCIO engines. With sync_workers set, the
+ * engine's ->queue() is run from a per-job pool of worker threads and the
+ * completions are handed back through ->getevents() and ->event(), so
+ * iodepth takes effect for engines that can only block. td->io_ops is
+ * pointed at a copy of the engine's ops with those hooks replaced, the
+ * adapter state is found from it again with container_of().
+ */
+struct sync_async {
+	struct ioengine_ops ops;
+	struct ioengine_ops *sync_ops;
+	struct workqueue wq;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct flist_head done_list;
+	unsigned int nr_done;
+
+	unsigned int queued;
+	unsigned int nr_events;
+	struct io_u *events[];
+};
+
+static inline struct sync_async *td_sync_async(struct thread_data *td)
+{
+	return container_of(td->io_ops, struct sync_async, ops);
+}
+
+static int sync_async_work(struct submit_worker *sw,
+			   struct workqueue_work *work)
+{
+	struct io_u *io_u = container_of(work, struct io_u, work);
+	struct thread_data *td = sw->wq->td;
+	struct sync_async *sa = td_sync_async(td);
+	enum fio_q_status ret;
+
+	ret = sa->sync_ops->queue(td, io_u);
+
+	/*
+	 * A sync engine completes everything inline, there's nobody to
+	 * retry a busy or queued io_u from here.
+	 */
+	if (ret != FIO_Q_COMPLETED && !io_u->error)
+		io_u->error = EIO;
+
+	pthread_mutex_lock(&sa->lock);
+	flist_add_tail(&io_u->work.list, &sa->done_list);
+	sa->nr_done++;
+	pthread_cond_signal(&sa->cond);
+	pthread_mutex_unlock(&sa->lock);
+	return 0;
+}
+
+static enum fio_q_status sync_async_queue(struct thread_data *td,
+					  struct io_u *io_u)
+{
+	struct sync_async *sa = td_sync_async(td);
+
+	sa->queued++;
+	workqueue_enqueue(&sa->wq, &io_u->work);
+	return FIO_Q_QUEUED;
+}
+
+static int sync_async_commit(struct thread_data *td)
+{
+	struct sync_async *sa = td_sync_async(td);
+
+	if (sa->queued) {
+		io_u_mark_submit(td, sa->queued);
+		sa->queued = 0;
+	}
+
+	return 0;
+}
+
+static int sync_async_getevents(struct thread_data *td, unsigned int min,
+				unsigned int max, const struct timespec *t)
+{
+	struct sync_async *sa = td_sync_async(td);
+	struct timespec ts;
+	struct io_u *io_u;
+
+	if (t) {
+#ifdef CONFIG_PTHREAD_CONDATTR_SETCLOCK
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+		clock_gettime(CLOCK_REALTIME, &ts);
+#endif
+		ts.tv_sec += t->tv_sec;
+		ts.tv_nsec += t->tv_nsec;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_nsec -= 1000000000;
+			ts.tv_sec++;
+		}
+	}
+
+	pthread_mutex_lock(&sa->lock);
+	while (sa->nr_done < min) {
+		if (!t)
+			pthread_cond_wait(&sa->cond, &sa->lock);
+		else if (pthread_cond_timedwait(&sa->cond, &sa->lock, &ts) ==
+			 ETIMEDOUT)
+			break;
+	}
+
+	sa->nr_events = 0;
+	while (sa->nr_events < max && !flist_empty(&sa->done_list)) {
+		io_u = flist_first_entry(&sa->done_list, struct io_u,
+					 work.list);
+		flist_del(&io_u->work.list);
+		sa->events[sa->nr_events++] = io_u;
+	}
+	sa->nr_done -= sa->nr_events;
+	pthread_mutex_unlock(&sa->lock);
+
+	return sa->nr_events;
+}
+
+static struct io_u *sync_async_event(struct thread_data *td, int event)
+{
+	return td_sync_async(td)->events[event];
+}
+
+static void sync_async_cleanup(struct thread_data *td)
+{
+	struct sync_async *sa = td_sync_async(td);
+
+	workqueue_exit(&sa->wq);
+
+	td->io_ops = sa->sync_ops;
+	td_set_ioengine_flags(td);
+	if (td->io_ops->cleanup)
+		td->io_ops->cleanup(td);
+
+	pthread_cond_destroy(&sa->cond);
+	pthread_mutex_destroy(&sa->lock);
+	free(sa);
+}
+
+/*
+ * Engines that seek or map in ->prep(), batch on their own, or work on a
+ * single stream can't have several ->queue() calls in flight.
+ */
+static bool sync_async_capable(struct thread_data *td)
+{
+	struct ioengine_ops *ops = td->io_ops;
+
+	if (!td_ioengine_flagged(td, FIO_SYNCIO))
+		return false;
+	if (ops->prep || ops->getevents)
+		return false;
+	if (td_ioengine_flagged(td, FIO_PIPEIO | FIO_NOIO | FIO_UNIDIR))
+		return false;
+
+	return td->o.io_submit_mode != IO_MODE_OFFLOAD;
+}
+
+int td_io_sync_async_init(struct thread_data *td, struct sk_out *sk_out)
+{
+	struct workqueue_ops wq_ops = {
+		.fn	= sync_async_work,
+	};
+	struct sync_async *sa;
+	unsigned int workers;
+
+	if (!td->o.sync_workers || td->o.iodepth == 1)
+		return 0;
+	if (!sync_async_capable(td)) {
+		log_info("fio: %s: engine can't be run by sync_workers, "
+			 "queue depth stays at 1\n", td->io_ops->name);
+		return 0;
+	}
+
+	sa = calloc(1, sizeof(*sa) + td->o.iodepth * sizeof(struct io_u *));
+	if (!sa) {
+		td_verror(td, ENOMEM, "sync_async_init");
+		return 1;
+	}
+
+	sa->ops = *td->io_ops;
+	sa->sync_ops = td->io_ops;
+	sa->ops.flags &= ~FIO_SYNCIO;
+	sa->ops.queue = sync_async_queue;
+	sa->ops.commit = sync_async_commit;
+	sa->ops.getevents = sync_async_getevents;
+	sa->ops.event = sync_async_event;
+	sa->ops.queue_batch = NULL;
+	sa->ops.reap_batch = NULL;
+	sa->ops.cleanup = sync_async_cleanup;
+	INIT_FLIST_HEAD(&sa->done_list);
+
+	if (mutex_cond_init_pshared(&sa->lock, &sa->cond)) {
+		td_verror(td, ESRCH, "sync_async_init");
+		free(sa);
+		return 1;
+	}
+
+	workers = min(td->o.sync_workers, td->o.iodepth);
+	if (workqueue_init(td, &sa->wq, &wq_ops, workers, sk_out)) {
+		pthread_cond_destroy(&sa->cond);
+		pthread_mutex_destroy(&sa->lock);
+		free(sa);
+		return 1;
+	}
+
+	dprint(FD_IO, "%s: running ->queue() on %u workers\n",
+	       sa->sync_ops->name, sa->wq.max_workers);
+	td->io_ops = &sa->ops;
+	td_set_ioengine_flags(td);
+	return 0;
+}
+
 int td_io_init(struct thread_data *td)
 {
 	int ret = 0;
 
+	/* offload workers each queue their own io_u's */
+	td->io_batch = td->io_ops->queue_batch &&
+			td->o.io_submit_mode != IO_MODE_OFFLOAD;
+
 	if (td->io_ops->init) {
 		ret = td->io_ops->init(td);
 		if (ret)
@@ -474,23 +784,41 @@ int td_io_init(struct thread_data *td)
 			td->io_ops_init = 1;
 		if (!td->error)
 			td->error = ret;
+		if (ret)
+			return ret;
 	}
 
-	return ret;
+	if (td->io_batch) {
+		td->io_u_batch = calloc(td->o.iodepth, sizeof(struct io_u *));
+		if (!td->io_u_batch)
+			goto err;
+	}
+	if (td->io_ops->reap_batch) {
+		td->io_u_reaped = calloc(td->o.iodepth, sizeof(struct io_u *));
+		if (!td->io_u_reaped)
+			goto err;
+	}
+
+	return 0;
+err:
+	td_verror(td, ENOMEM, "td_io_init");
+	return 1;
 }
 
 void td_io_commit(struct thread_data *td)
 {
-	int ret;
+	int ret, prev;
 
 	dprint(FD_IO, "calling ->commit(), depth %d\n", td->cur_depth);
 
 	if (!td->cur_depth || !td->io_u_queued)
 		return;
 
+	prev = overhead_enter(td, FIO_OVH_SUBMIT);
 	io_u_mark_depth(td, td->io_u_queued);
 
 	if (td->io_ops->commit) {
+		td_io_flush_batch(td);
 		ret = td->io_ops->commit(td);
 		if (ret)
 			td_verror(td, -ret, "io commit");
@@ -501,6 +829,42 @@ void td_io_commit(struct thread_data *td)
 	 */
 	td->io_u_in_flight += td->io_u_queued;
 	td->io_u_queued = 0;
+	overhead_leave(td, prev);
+}
+
+/*
+ * Check the write block size against the atomic write units the kernel
+ * reports for the file
+ */
+static int file_check_atomic(struct thread_data *td, struct fio_file *f)
+{
+	unsigned long long bs = td->o.min_bs[DDIR_WRITE];
+	unsigned int unit_min, unit_max;
+	int ret;
+
+	ret = statx_atomic_write_units(f->fd, &unit_min, &unit_max);
+	if (ret) {
+		log_err("fio: %s doesn't support atomic writes\n",
+			f->file_name);
+		td_verror(td, ret, "statx atomic write units");
+		return 1;
+	}
+	if (bs < unit_min || bs > unit_max) {
+		log_err("fio: %s: atomic write size %llu outside the "
+			"supported %u-%u\n", f->file_name, bs, unit_min,
+			unit_max);
+		td_verror(td, EINVAL, "atomic write size");
+		return 1;
+	}
+	if (f->file_offset % bs) {
+		log_err("fio: %s: offset %llu isn't aligned to the atomic "
+			"write size %llu\n", f->file_name,
+			(unsigned long long) f->file_offset, bs);
+		td_verror(td, EINVAL, "atomic write offset");
+		return 1;
+	}
+
+	return 0;
 }
 
 int td_io_open_file(struct thread_data *td, struct fio_file *f)
@@ -549,8 +913,10 @@ int td_io_open_file(struct thread_data *td, struct fio_file *f)
 	if (td_ioengine_flagged(td, FIO_DISKLESSIO))
 		goto done;
 
-	if (td->o.invalidate_cache && file_invalidate_cache(td, f))
+	if (td->o.invalidate_cache && !fio_file_invalidated(f) &&
+	    file_invalidate_cache(td, f))
 		goto err;
+	fio_file_clear_invalidated(f);
 
 	if (td->o.fadvise_hint != F_ADV_NONE &&
 	    (f->filetype == FIO_TYPE_BLOCK || f->filetype == FIO_TYPE_FILE)) {
@@ -606,6 +972,9 @@ int td_io_open_file(struct thread_data *td, struct fio_file *f)
 	if (td->o.odirect && !OS_O_DIRECT && fio_set_directio(td, f))
 		goto err;
 
+	if (td->o.oatomic && td_write(td) && file_check_atomic(td, f))
+		goto err;
+
 done:
 	log_file(td, f, FIO_LOG_OPEN_FILE);
 	return 0;
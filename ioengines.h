@@ -9,7 +9,9 @@
 #include "zbd_types.h"
 #include "fdp.h"
 
-#define FIO_IOOPS_VERSION	32
+#define FIO_IOOPS_VERSION	35
+
+struct sk_out;
 
 #ifndef CONFIG_DYNAMIC_ENGINES
 #define FIO_STATIC	static
@@ -26,6 +28,23 @@ enum fio_q_status {
 	FIO_Q_BUSY	= 2,		/* no more room, call ->commit() */
 };
 
+/*
+ * Batch hooks, both optional. Engines without them go through the one io_u
+ * at a time ->queue(), ->getevents() and ->event() calls.
+ *
+ * ->queue_batch() is handed the reads and writes queued since the last
+ * commit, in order, right before ->commit() is called, and must take all
+ * of them. It's never given more io_u's than iodepth, counting the ones
+ * handed to ->queue() that weren't committed yet. Errors are reported on
+ * completion or by ->commit(). Every other io_u still goes through
+ * ->queue(), after the batch has been handed over. Engines that can't take
+ * a batch for some job configuration clear td->io_batch in ->init().
+ *
+ * ->reap_batch() replaces ->getevents() and ->event(): it stores up to max
+ * completed io_u's in the array, waiting for at least min of them, and
+ * returns how many it stored or a negative error.
+ */
+
 struct ioengine_ops {
 	struct flist_head list;
 	const char *name;
@@ -40,6 +59,9 @@ struct ioengine_ops {
 	int (*commit)(struct thread_data *);
 	int (*getevents)(struct thread_data *, unsigned int, unsigned int, const struct timespec *);
 	struct io_u *(*event)(struct thread_data *, int);
+	void (*queue_batch)(struct thread_data *, struct io_u **, unsigned int);
+	int (*reap_batch)(struct thread_data *, struct io_u **, unsigned int,
+			  unsigned int, const struct timespec *);
 	char *(*errdetails)(struct io_u *);
 	int (*cancel)(struct thread_data *, struct io_u *);
 	void (*cleanup)(struct thread_data *);
@@ -66,8 +88,17 @@ struct ioengine_ops {
 			   uint64_t, uint64_t);
 	int (*fdp_fetch_ruhs)(struct thread_data *, struct fio_file *,
 			      struct fio_ruhs_info *);
+	int (*fdp_fetch_stats)(struct thread_data *, struct fio_file *,
+			       struct fio_fdp_stats *);
 	int option_struct_size;
 	struct fio_option *options;
+	/*
+	 * Size of the engine's private per io_u data. If set, it's carved
+	 * out of the io_u arena next to each io_u, zeroed, and passed
+	 * in ->engine_data before ->io_u_init() is called. The engine
+	 * must not free it.
+	 */
+	int io_u_priv_size;
 };
 
 enum fio_ioengine_flags {
@@ -95,6 +126,13 @@ enum fio_ioengine_flags {
 	FIO_RO_NEEDS_RW_OPEN
 			= 1 << 18,	/* open files in rw mode even if we have a read job; only
 					   affects ioengines using generic_open_file */
+	FIO_ZONE_APPEND	= 1 << 19,	/* engine can issue zone append writes */
+	FIO_ENGINE_CLAT	= 1 << 20,	/* engine fills in io_u->engine_clat */
+	FIO_MULTI_RANGE_TRIM
+			= 1 << 21,	/* engine can issue multi-range trims */
+	FIO_TRIM_MODES	= 1 << 22,	/* engine can write zeroes or copy for trims */
+	FIO_ATOMICWRITES
+			= 1 << 23,	/* engine can issue RWF_ATOMIC writes */
 };
 
 /*
@@ -123,4 +161,10 @@ extern void close_ioengine(struct thread_data *);
 
 extern int fio_show_ioengine_help(const char *engine);
 
+extern int td_io_sync_async_init(struct thread_data *, struct sk_out *);
+
+extern int td_io_u_arena_init(struct thread_data *, unsigned int, unsigned int);
+extern struct io_u *td_io_u_arena_slot(struct thread_data *, unsigned int);
+extern void td_io_u_arena_free(struct thread_data *);
+
 #endif
@@ -8,6 +8,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #ifdef CONFIG_ZLIB
 #include <zlib.h>
 #endif
@@ -15,11 +17,13 @@
 #include "flist.h"
 #include "fio.h"
 #include "trim.h"
+#include "verify.h"
 #include "filelock.h"
 #include "smalloc.h"
 #include "blktrace.h"
 #include "pshared.h"
 #include "lib/roundup.h"
+#include "lib/columnar.h"
 
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -29,6 +33,8 @@
 #include <sys/un.h>
 
 static int iolog_flush(struct io_log *log);
+static bool iolog_write_behind_finish(struct io_log *log);
+static void iolog_mmap_exit(struct io_log *log);
 
 static const char iolog_ver2[] = "fio version 2 iolog";
 static const char iolog_ver3[] = "fio version 3 iolog";
@@ -39,6 +45,275 @@ void queue_io_piece(struct thread_data *td, struct io_piece *ipo)
 	td->total_io_size += ipo->len;
 }
 
+/*
+ * write_iolog_format=binary: entries go into one of two buffers, and a full
+ * buffer is handed to a writer thread while the other one fills up. The
+ * submitter only takes the capture lock when it swaps buffers, or for
+ * every entry when offload workers share the capture.
+ */
+#define IOLOG_CAP_ENTRIES	4096
+
+struct iolog_capture {
+	int fd;
+	char *file;
+	struct timespec start;
+
+	struct iolog_bin_entry *buf[2];
+	unsigned int cur;
+	unsigned int nr;
+
+	int pending;
+	unsigned int pending_nr;
+	bool exit;
+	int err;
+	uint64_t nr_entries;
+
+	char **names;
+	uint32_t nr_names;
+
+	bool shared;
+	pthread_mutex_t append_lock;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+};
+
+static int capture_write(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t ret;
+
+	while (len) {
+		ret = write(fd, p, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		p += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static void *capture_thread(void *data)
+{
+	struct iolog_capture *c = data;
+	unsigned int idx, nr;
+	int err;
+
+	pthread_mutex_lock(&c->lock);
+	for (;;) {
+		while (c->pending == -1 && !c->exit)
+			pthread_cond_wait(&c->cond, &c->lock);
+		if (c->pending == -1)
+			break;
+
+		idx = c->pending;
+		nr = c->pending_nr;
+		pthread_mutex_unlock(&c->lock);
+
+		err = 0;
+		if (!c->err)
+			err = capture_write(c->fd, c->buf[idx],
+					    nr * sizeof(struct iolog_bin_entry));
+
+		pthread_mutex_lock(&c->lock);
+		if (err)
+			c->err = err;
+		else
+			c->nr_entries += nr;
+		c->pending = -1;
+		pthread_cond_broadcast(&c->cond);
+	}
+	pthread_mutex_unlock(&c->lock);
+
+	return NULL;
+}
+
+/*
+ * Hand the current buffer to the writer, waiting for it to finish the
+ * previous one first
+ */
+static void capture_swap(struct iolog_capture *c)
+{
+	pthread_mutex_lock(&c->lock);
+	while (c->pending != -1)
+		pthread_cond_wait(&c->cond, &c->lock);
+	c->pending = c->cur;
+	c->pending_nr = c->nr;
+	c->cur ^= 1;
+	c->nr = 0;
+	pthread_cond_broadcast(&c->cond);
+	pthread_mutex_unlock(&c->lock);
+}
+
+static void capture_add(struct iolog_capture *c, const struct fio_file *f,
+			int ddir, unsigned int file_action,
+			unsigned long long offset, unsigned long long len)
+{
+	struct iolog_bin_entry *e;
+
+	/* files added after the log was opened have no name to refer to */
+	if (f->fileno >= c->nr_names)
+		return;
+
+	if (c->shared)
+		pthread_mutex_lock(&c->append_lock);
+
+	e = &c->buf[c->cur][c->nr++];
+	e->time = cpu_to_le64((uint64_t) utime_since_now(&c->start));
+	e->offset = cpu_to_le64((uint64_t) offset);
+	e->len = cpu_to_le32((uint32_t) len);
+	e->fileno = cpu_to_le16((uint16_t) f->fileno);
+	e->ddir = ddir;
+	e->file_action = file_action;
+
+	if (c->nr == IOLOG_CAP_ENTRIES)
+		capture_swap(c);
+
+	if (c->shared)
+		pthread_mutex_unlock(&c->append_lock);
+}
+
+static void capture_free(struct iolog_capture *c)
+{
+	uint32_t i;
+
+	for (i = 0; i < c->nr_names; i++)
+		free(c->names[i]);
+	free(c->names);
+	free(c->buf[0]);
+	free(c->buf[1]);
+	free(c->file);
+	pthread_mutex_destroy(&c->append_lock);
+	pthread_mutex_destroy(&c->lock);
+	pthread_cond_destroy(&c->cond);
+	free(c);
+}
+
+/*
+ * The header is written last, once the number of entries is known. Until
+ * then the file has no magic and won't be taken for a compiled iolog.
+ */
+static bool capture_open(struct thread_data *td)
+{
+	struct iolog_bin_hdr hdr;
+	struct iolog_capture *c;
+	struct fio_file *f;
+	unsigned int i;
+	int ret;
+
+	if (td->files_index > 65536) {
+		log_err("fio: too many files for a binary iolog\n");
+		return false;
+	}
+
+	c = calloc(1, sizeof(*c));
+	c->fd = -1;
+	c->pending = -1;
+	c->shared = td->o.io_submit_mode == IO_MODE_OFFLOAD;
+	c->file = strdup(td->o.write_iolog_file);
+	c->buf[0] = malloc(IOLOG_CAP_ENTRIES * sizeof(struct iolog_bin_entry));
+	c->buf[1] = malloc(IOLOG_CAP_ENTRIES * sizeof(struct iolog_bin_entry));
+	c->names = calloc(td->files_index, sizeof(char *));
+	pthread_mutex_init(&c->append_lock, NULL);
+	pthread_mutex_init(&c->lock, NULL);
+	pthread_cond_init(&c->cond, NULL);
+
+	if (!c->buf[0] || !c->buf[1] || (td->files_index && !c->names)) {
+		log_err("fio: no memory for binary iolog\n");
+		goto err;
+	}
+
+	for_each_file(td, f, i)
+		c->names[c->nr_names++] = strdup(f->file_name);
+
+	c->fd = open(c->file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (c->fd < 0) {
+		log_err("fio: failed to open iolog %s: %s\n", c->file,
+			strerror(errno));
+		goto err;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	ret = capture_write(c->fd, &hdr, sizeof(hdr));
+	if (ret) {
+		log_err("fio: failed to write iolog %s: %s\n", c->file,
+			strerror(ret));
+		goto err;
+	}
+
+	ret = pthread_create(&c->thread, NULL, capture_thread, c);
+	if (ret) {
+		log_err("fio: failed to create iolog writer: %s\n",
+			strerror(ret));
+		goto err;
+	}
+
+	fio_gettime(&c->start, NULL);
+	td->iolog_cap = c;
+	return true;
+err:
+	if (c->fd != -1)
+		close(c->fd);
+	capture_free(c);
+	return false;
+}
+
+/*
+ * Write out what's left, then the names and the header
+ */
+static void capture_close(struct thread_data *td)
+{
+	struct iolog_capture *c = td->iolog_cap;
+	struct iolog_bin_hdr hdr;
+	uint16_t len;
+	uint32_t i;
+	int ret;
+
+	if (c->nr)
+		capture_swap(c);
+
+	pthread_mutex_lock(&c->lock);
+	c->exit = true;
+	pthread_cond_broadcast(&c->cond);
+	pthread_mutex_unlock(&c->lock);
+	pthread_join(c->thread, NULL);
+
+	ret = c->err;
+	for (i = 0; i < c->nr_names && !ret; i++) {
+		len = cpu_to_le16((uint16_t) strlen(c->names[i]));
+		ret = capture_write(c->fd, &len, sizeof(len));
+		if (!ret)
+			ret = capture_write(c->fd, c->names[i],
+					    strlen(c->names[i]));
+	}
+
+	if (!ret) {
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, FIO_IOLOG_BIN_MAGIC, sizeof(hdr.magic));
+		hdr.version = cpu_to_le32((uint32_t) FIO_IOLOG_BIN_VERSION);
+		hdr.iolog_version = cpu_to_le32((uint32_t) 3);
+		hdr.nr_files = cpu_to_le32(c->nr_names);
+		hdr.nr_entries = cpu_to_le64(c->nr_entries);
+		hdr.names_off = cpu_to_le64((uint64_t) (sizeof(hdr) +
+				c->nr_entries * sizeof(struct iolog_bin_entry)));
+		if (pwrite(c->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+			ret = errno ? errno : EIO;
+	}
+
+	if (close(c->fd) && !ret)
+		ret = errno;
+	if (ret)
+		log_err("fio: failed to write iolog %s: %s\n", c->file,
+			strerror(ret));
+
+	capture_free(c);
+	td->iolog_cap = NULL;
+}
+
 void log_io_u(const struct thread_data *td, const struct io_u *io_u)
 {
 	struct timespec now;
@@ -46,6 +321,12 @@ void log_io_u(const struct thread_data *td, const struct io_u *io_u)
 	if (!td->o.write_iolog_file)
 		return;
 
+	if (td->iolog_cap) {
+		capture_add(td->iolog_cap, io_u->file, io_u->ddir, 0,
+			    io_u->offset, io_u->buflen);
+		return;
+	}
+
 	fio_gettime(&now, NULL);
 	fprintf(td->iolog_f, "%llu %s %s %llu %llu\n",
 		(unsigned long long) utime_since_now(&td->io_log_start_time),
@@ -66,6 +347,11 @@ void log_file(struct thread_data *td, struct fio_file *f,
 		return;
 
 
+	if (td->iolog_cap) {
+		capture_add(td->iolog_cap, f, DDIR_INVAL, what, 0, 0);
+		return;
+	}
+
 	/*
 	 * this happens on the pre-open/close done before the job starts
 	 */
@@ -78,6 +364,31 @@ void log_file(struct thread_data *td, struct fio_file *f,
 		f->file_name, act[what]);
 }
 
+/*
+ * Sharded replay: wait until 'usec' into the trace, measured from the replay
+ * start shared by all clones of the job. The first clone to get here sets
+ * the start time.
+ */
+static void iolog_timeline_delay(struct thread_data *td, unsigned long usec)
+{
+	uint64_t *epoch = td->io_log_epochp;
+	uint64_t now, target, this_delay;
+
+	now = utime_since_genesis();
+	if (!*epoch)
+		__sync_val_compare_and_swap(epoch, 0, now + 1);
+
+	target = *epoch + usec;
+	while (now < target && !td->terminate) {
+		this_delay = target - now;
+		if (this_delay > 500000)
+			this_delay = 500000;
+
+		usec_sleep(td, this_delay);
+		now = utime_since_genesis();
+	}
+}
+
 static void iolog_delay(struct thread_data *td, unsigned long delay)
 {
 	uint64_t usec = utime_since_now(&td->last_issue);
@@ -85,6 +396,11 @@ static void iolog_delay(struct thread_data *td, unsigned long delay)
 	uint64_t this_delay;
 	struct timespec ts;
 
+	if (td->io_log_shards) {
+		iolog_timeline_delay(td, delay);
+		return;
+	}
+
 	if (delay < td->time_offset) {
 		td->time_offset = 0;
 		return;
@@ -162,6 +478,29 @@ static int ipo_special(struct thread_data *td, struct io_piece *ipo)
 }
 
 static bool read_iolog(struct thread_data *td);
+static int read_iolog_map_get(struct thread_data *td, struct io_u *io_u);
+static bool read_iolog_map_pending(struct thread_data *td);
+
+/*
+ * Entries of a sharded replay are allocated in one array when the iolog is
+ * parsed, and freed with it.
+ */
+static void iolog_put_ipo(struct io_piece *ipo)
+{
+	if (!(ipo->flags & IP_F_PREPARSED))
+		free(ipo);
+}
+
+static void iolog_map_exit(struct thread_data *td);
+
+void iolog_replay_exit(struct thread_data *td)
+{
+	free(td->io_log_pieces);
+	td->io_log_pieces = NULL;
+	free(td->io_log_inflight);
+	td->io_log_inflight = NULL;
+	iolog_map_exit(td);
+}
 
 unsigned long long delay_since_ttime(const struct thread_data *td,
 	       unsigned long long time)
@@ -170,7 +509,8 @@ unsigned long long delay_since_ttime(const struct thread_data *td,
 	double scale;
 	const unsigned long long *last_ttime = &td->io_log_last_ttime;
 
-	if (!*last_ttime || td->o.no_stall || time < *last_ttime)
+	if (!*last_ttime || td->o.no_stall || td->o.replay_queue_depth ||
+	    time < *last_ttime)
 		return 0;
 	else if (td->o.replay_time_scale == 100)
 		return time - *last_ttime;
@@ -181,10 +521,65 @@ unsigned long long delay_since_ttime(const struct thread_data *td,
 	return tmp * scale;
 }
 
+/*
+ * replay_queue_depth: wait until no more than 'depth' IOs are in flight,
+ * not counting the one about to be issued
+ */
+static void iolog_depth_wait(struct thread_data *td, unsigned int depth)
+{
+	while (td->cur_depth - 1 > depth && !td->terminate) {
+		if (td->io_u_queued)
+			td_io_commit(td);
+		if (!td->io_u_in_flight)
+			break;
+		if (io_u_queued_complete(td, 1) < 0)
+			break;
+	}
+}
+
+/*
+ * Turn a replay entry into an IO. Returns 0 if io_u was filled in, 1 if the
+ * entry was a file action or wait, and < 0 on error.
+ */
+static int iolog_ipo_get(struct thread_data *td, struct io_piece *ipo,
+			 struct io_u *io_u)
+{
+	unsigned long elapsed;
+	int ret;
+
+	ret = ipo_special(td, ipo);
+	if (ret)
+		return ret;
+
+	io_u->ddir = ipo->ddir;
+	if (ipo->ddir != DDIR_WAIT) {
+		io_u->offset = ipo->offset;
+		io_u->verify_offset = ipo->offset;
+		io_u->buflen = ipo->len;
+		io_u->file = td->files[ipo->fileno];
+		get_file(io_u->file);
+		dprint(FD_IO, "iolog: get %llu/%llu/%s\n", io_u->offset,
+					io_u->buflen, io_u->file->file_name);
+		if (td->o.replay_queue_depth)
+			iolog_depth_wait(td, ipo->depth);
+		else if (ipo->delay || td->io_log_shards)
+			iolog_delay(td, ipo->delay);
+		return 0;
+	}
+
+	elapsed = mtime_since_genesis();
+	if (ipo->delay > elapsed)
+		usec_sleep(td, (ipo->delay - elapsed) * 1000);
+
+	return 1;
+}
+
 int read_iolog_get(struct thread_data *td, struct io_u *io_u)
 {
 	struct io_piece *ipo;
-	unsigned long elapsed;
+
+	if (td->io_log_map)
+		return read_iolog_map_get(td, io_u);
 
 	while (!flist_empty(&td->io_log_list)) {
 		int ret;
@@ -205,35 +600,11 @@ int read_iolog_get(struct thread_data *td, struct io_u *io_u)
 		flist_del(&ipo->list);
 		remove_trim_entry(td, ipo);
 
-		ret = ipo_special(td, ipo);
-		if (ret < 0) {
-			free(ipo);
+		ret = iolog_ipo_get(td, ipo, io_u);
+		iolog_put_ipo(ipo);
+		if (ret < 0)
 			break;
-		} else if (ret > 0) {
-			free(ipo);
-			continue;
-		}
-
-		io_u->ddir = ipo->ddir;
-		if (ipo->ddir != DDIR_WAIT) {
-			io_u->offset = ipo->offset;
-			io_u->verify_offset = ipo->offset;
-			io_u->buflen = ipo->len;
-			io_u->file = td->files[ipo->fileno];
-			get_file(io_u->file);
-			dprint(FD_IO, "iolog: get %llu/%llu/%s\n", io_u->offset,
-						io_u->buflen, io_u->file->file_name);
-			if (ipo->delay)
-				iolog_delay(td, ipo->delay);
-		} else {
-			elapsed = mtime_since_genesis();
-			if (ipo->delay > elapsed)
-				usec_sleep(td, (ipo->delay - elapsed) * 1000);
-		}
-
-		free(ipo);
-
-		if (io_u->ddir != DDIR_WAIT)
+		else if (!ret)
 			return 0;
 	}
 
@@ -241,6 +612,26 @@ int read_iolog_get(struct thread_data *td, struct io_u *io_u)
 	return 1;
 }
 
+/*
+ * Returns true if there are replay entries left to issue
+ */
+bool read_iolog_pending(struct thread_data *td)
+{
+	if (td->io_log_map)
+		return read_iolog_map_pending(td);
+
+	return !flist_empty(&td->io_log_list);
+}
+
+/*
+ * Free a piece of the verify history
+ */
+void free_io_piece(struct thread_data *td, struct io_piece *ipo)
+{
+	free(ipo);
+	mem_acct_add(td, MEM_IO_HIST, -(int64_t) sizeof(*ipo));
+}
+
 void prune_io_piece_log(struct thread_data *td)
 {
 	struct io_piece *ipo;
@@ -251,7 +642,7 @@ void prune_io_piece_log(struct thread_data *td)
 		rb_erase(n, &td->io_hist_tree);
 		remove_trim_entry(td, ipo);
 		td->io_hist_len--;
-		free(ipo);
+		free_io_piece(td, ipo);
 	}
 
 	while (!flist_empty(&td->io_hist_list)) {
@@ -259,32 +650,19 @@ void prune_io_piece_log(struct thread_data *td)
 		flist_del(&ipo->list);
 		remove_trim_entry(td, ipo);
 		td->io_hist_len--;
-		free(ipo);
+		free_io_piece(td, ipo);
+	}
+
+	if (td->o.verify_bitmap) {
+		verify_map_reset(td);
+		td->io_hist_len = 0;
 	}
 }
 
-/*
- * log a successful write, so we can unwind the log for verify
- */
-void log_io_piece(struct thread_data *td, struct io_u *io_u)
+static void insert_io_piece(struct thread_data *td, struct io_piece *ipo)
 {
 	struct fio_rb_node **p, *parent;
-	struct io_piece *ipo, *__ipo;
-
-	ipo = calloc(1, sizeof(struct io_piece));
-	init_ipo(ipo);
-	ipo->file = io_u->file;
-	ipo->offset = io_u->offset;
-	ipo->len = io_u->buflen;
-	ipo->numberio = io_u->numberio;
-	ipo->flags = IP_F_IN_FLIGHT;
-
-	io_u->ipo = ipo;
-
-	if (io_u_should_trim(td, io_u)) {
-		flist_add_tail(&ipo->trim_list, &td->trim_list);
-		td->trim_entries++;
-	}
+	struct io_piece *__ipo;
 
 	/*
 	 * Only sort writes if we don't have a random map in which case we need
@@ -295,7 +673,6 @@ void log_io_piece(struct thread_data *td, struct io_u *io_u)
 		INIT_FLIST_HEAD(&ipo->list);
 		flist_add_tail(&ipo->list, &td->io_hist_list);
 		ipo->flags |= IP_F_ONLIST;
-		td->io_hist_len++;
 		return;
 	}
 
@@ -335,7 +712,7 @@ restart:
 			rb_erase(parent, &td->io_hist_tree);
 			remove_trim_entry(td, __ipo);
 			if (!(__ipo->flags & IP_F_IN_FLIGHT))
-				free(__ipo);
+				free_io_piece(td, __ipo);
 			goto restart;
 		}
 	}
@@ -343,7 +720,57 @@ restart:
 	rb_link_node(&ipo->rb_node, parent, p);
 	rb_insert_color(&ipo->rb_node, &td->io_hist_tree);
 	ipo->flags |= IP_F_ONRB;
+}
+
+/*
+ * log a successful write, so we can unwind the log for verify
+ */
+void log_io_piece(struct thread_data *td, struct io_u *io_u)
+{
+	struct io_piece *ipo;
+
+	if (td->o.verify_bitmap && !(io_u->flags & IO_U_F_ZONE_APPEND) &&
+	    verify_map_log(td, io_u))
+		return;
+
+	ipo = calloc(1, sizeof(struct io_piece));
+	mem_acct_add(td, MEM_IO_HIST, sizeof(*ipo));
+	init_ipo(ipo);
+	ipo->file = io_u->file;
+	ipo->offset = io_u->offset;
+	ipo->verify_offset = io_u->verify_offset;
+	ipo->len = io_u->buflen;
+	ipo->numberio = io_u->numberio;
+	ipo->flags = IP_F_IN_FLIGHT;
+
+	io_u->ipo = ipo;
 	td->io_hist_len++;
+
+	if (io_u_should_trim(td, io_u)) {
+		flist_add_tail(&ipo->trim_list, &td->trim_list);
+		td->trim_entries++;
+	}
+
+	/*
+	 * A zone append only knows where it landed once it completes, see
+	 * log_zone_append_piece().
+	 */
+	if (io_u->flags & IO_U_F_ZONE_APPEND)
+		return;
+
+	insert_io_piece(td, ipo);
+}
+
+/*
+ * Sort a completed zone append into the verify log at the offset the device
+ * wrote it to. The headers still carry the zone start it was issued at.
+ */
+void log_zone_append_piece(struct thread_data *td, struct io_u *io_u)
+{
+	struct io_piece *ipo = io_u->ipo;
+
+	ipo->offset = io_u->offset;
+	insert_io_piece(td, ipo);
 }
 
 void unlog_io_piece(struct thread_data *td, struct io_u *io_u)
@@ -362,6 +789,8 @@ void unlog_io_piece(struct thread_data *td, struct io_u *io_u)
 		}
 	}
 
+	io_u_clear(td, io_u, IO_U_F_VER_MAP);
+
 	if (!ipo)
 		return;
 
@@ -370,7 +799,7 @@ void unlog_io_piece(struct thread_data *td, struct io_u *io_u)
 	else if (ipo->flags & IP_F_ONLIST)
 		flist_del(&ipo->list);
 
-	free(ipo);
+	free_io_piece(td, ipo);
 	io_u->ipo = NULL;
 	td->io_hist_len--;
 }
@@ -387,6 +816,11 @@ void trim_io_piece(const struct io_u *io_u)
 
 void write_iolog_close(struct thread_data *td)
 {
+	if (td->iolog_cap) {
+		capture_close(td);
+		return;
+	}
+
 	if (!td->iolog_f)
 		return;
 
@@ -425,29 +859,232 @@ int64_t iolog_items_to_fetch(struct thread_data *td)
 	return items_to_fetch;
 }
 
-#define io_act(_td, _r) (((_td)->io_log_version == 3 && (r) == 5) || \
-					((_td)->io_log_version == 2 && (r) == 4))
-#define file_act(_td, _r) (((_td)->io_log_version == 3 && (r) == 3) || \
-					((_td)->io_log_version == 2 && (r) == 2))
-
 /*
- * Read version 2 and 3 iolog data. It is enhanced to include per-file logging,
- * syncs, etc.
+ * Fill in a replay entry, returns true if it needs a larger buffer
  */
-static bool read_iolog(struct thread_data *td)
+static void iolog_set_ipo(struct thread_data *td, struct io_piece *ipo,
+			  enum fio_ddir rw, unsigned long long delay,
+			  unsigned long long offset, unsigned int bytes,
+			  int fileno, int file_action)
 {
-	unsigned long long offset;
-	unsigned int bytes;
-	unsigned long long delay = 0;
-	int reads, writes, trims, waits, fileno = 0, file_action = 0; /* stupid gcc */
-	char *rfname, *fname, *act;
-	char *str, *p;
-	enum fio_ddir rw;
-	bool realloc = false;
-	int64_t items_to_fetch = 0;
-	int syncs;
+	memset(ipo, 0, sizeof(*ipo));
+	init_ipo(ipo);
+	ipo->ddir = rw;
+	if (td->io_log_version == 3)
+		ipo->delay = delay;
+	if (rw == DDIR_WAIT) {
+		ipo->delay = offset;
+	} else {
+		if (td->o.replay_scale)
+			ipo->offset = offset / td->o.replay_scale;
+		else
+			ipo->offset = offset;
+		ipo_bytes_align(td->o.replay_align, ipo);
 
-	if (td->o.read_iolog_chunked) {
+		ipo->len = bytes;
+		ipo->fileno = fileno;
+		ipo->file_action = file_action;
+	}
+}
+
+static bool iolog_fill_ipo(struct thread_data *td, struct io_piece *ipo,
+			   enum fio_ddir rw, unsigned long long delay,
+			   unsigned long long offset, unsigned int bytes,
+			   int fileno, int file_action)
+{
+	bool realloc = false;
+
+	iolog_set_ipo(td, ipo, rw, delay, offset, bytes, fileno, file_action);
+	if (rw == DDIR_WAIT)
+		return false;
+
+	if (rw != DDIR_INVAL && bytes > td->o.max_bs[rw]) {
+		realloc = true;
+		td->o.max_bs[rw] = bytes;
+	}
+	td->o.size += bytes;
+	return realloc;
+}
+
+/*
+ * A parsed iolog entry, kept until the entries of this shard are picked
+ */
+struct iolog_rec {
+	uint64_t time;
+	uint64_t offset;
+	uint32_t len;
+	int32_t fileno;
+	int32_t ddir;
+	uint32_t file_action;
+};
+
+static struct iolog_rec *iolog_rec_get(struct iolog_rec **recs,
+				       unsigned long *nr, unsigned long *max)
+{
+	if (*nr == *max) {
+		*max = *max ? *max * 2 : 4096;
+		*recs = realloc(*recs, *max * sizeof(struct iolog_rec));
+	}
+
+	return &(*recs)[(*nr)++];
+}
+
+static bool iolog_shard_owns(struct thread_data *td, struct iolog_rec *rec,
+			     uint64_t *stripe)
+{
+	unsigned int shards = td->io_log_shards;
+	unsigned int shard = td->subjob_number;
+
+	if (rec->ddir == DDIR_WAIT)
+		return true;
+	if (rec->fileno < 0 || rec->fileno >= td->files_index)
+		return shard == 0;
+
+	if (td->o.replay_shard == REPLAY_SHARD_FILE)
+		return rec->fileno % shards == shard;
+
+	/*
+	 * Splitting by offset, file actions and syncs apply to every shard
+	 */
+	if (!ddir_rw(rec->ddir))
+		return true;
+
+	return rec->offset / stripe[rec->fileno] == shard;
+}
+
+/*
+ * Queue the entries of the parsed iolog that belong to this clone. With
+ * offset sharding, each file is split into as many contiguous ranges as
+ * there are shards, based on the highest offset the iolog uses in it.
+ */
+static void iolog_queue_shard(struct thread_data *td, struct iolog_rec *recs,
+			      unsigned long nr)
+{
+	uint64_t *stripe = NULL;
+	struct io_piece *ipo;
+	unsigned long i, owned;
+
+	if (td->o.replay_shard == REPLAY_SHARD_OFFSET) {
+		stripe = calloc(td->files_index, sizeof(uint64_t));
+
+		for (i = 0; i < nr; i++) {
+			struct iolog_rec *rec = &recs[i];
+
+			if (!ddir_rw(rec->ddir) || rec->fileno < 0 ||
+			    rec->fileno >= td->files_index)
+				continue;
+			if (rec->offset + rec->len > stripe[rec->fileno])
+				stripe[rec->fileno] = rec->offset + rec->len;
+		}
+		for (i = 0; i < td->files_index; i++) {
+			stripe[i] = (stripe[i] + td->io_log_shards - 1) /
+					td->io_log_shards;
+			if (!stripe[i])
+				stripe[i] = 1;
+		}
+	}
+
+	for (owned = 0, i = 0; i < nr; i++)
+		owned += iolog_shard_owns(td, &recs[i], stripe);
+
+	dprint(FD_IO, "iolog: shard %u/%u has %lu of %lu entries\n",
+		td->subjob_number, td->io_log_shards, owned, nr);
+
+	if (owned)
+		td->io_log_pieces = calloc(owned, sizeof(struct io_piece));
+
+	ipo = td->io_log_pieces;
+	for (i = 0; i < nr; i++) {
+		struct iolog_rec *rec = &recs[i];
+
+		if (!iolog_shard_owns(td, rec, stripe))
+			continue;
+
+		iolog_fill_ipo(td, ipo, rec->ddir, rec->time, rec->offset,
+				rec->len, rec->fileno, rec->file_action);
+		ipo->flags |= IP_F_PREPARSED;
+		queue_io_piece(td, ipo);
+		ipo++;
+	}
+
+	free(stripe);
+}
+
+/*
+ * Time of an entry on the timeline of a sharded replay
+ */
+static uint64_t iolog_timeline_time(struct thread_data *td,
+				    unsigned long long ttime,
+				    unsigned long long first_ttime)
+{
+	if (td->o.no_stall || ttime < first_ttime)
+		return 0;
+	else if (td->o.replay_time_scale == 100)
+		return ttime - first_ttime;
+
+	return (double) (ttime - first_ttime) * 100.0 / td->o.replay_time_scale;
+}
+
+static bool iolog_str_to_ddir(const char *act, enum fio_ddir *ddir)
+{
+	if (!strcmp(act, "wait"))
+		*ddir = DDIR_WAIT;
+	else if (!strcmp(act, "read"))
+		*ddir = DDIR_READ;
+	else if (!strcmp(act, "write"))
+		*ddir = DDIR_WRITE;
+	else if (!strcmp(act, "sync"))
+		*ddir = DDIR_SYNC;
+	else if (!strcmp(act, "datasync"))
+		*ddir = DDIR_DATASYNC;
+	else if (!strcmp(act, "trim"))
+		*ddir = DDIR_TRIM;
+	else
+		return false;
+
+	return true;
+}
+
+static bool iolog_str_to_file_action(const char *act, int *file_action)
+{
+	if (!strcmp(act, "add"))
+		*file_action = FIO_LOG_ADD_FILE;
+	else if (!strcmp(act, "open"))
+		*file_action = FIO_LOG_OPEN_FILE;
+	else if (!strcmp(act, "close"))
+		*file_action = FIO_LOG_CLOSE_FILE;
+	else
+		return false;
+
+	return true;
+}
+
+#define io_act(_td, _r) (((_td)->io_log_version == 3 && (r) == 5) || \
+					((_td)->io_log_version == 2 && (r) == 4))
+#define file_act(_td, _r) (((_td)->io_log_version == 3 && (r) == 3) || \
+					((_td)->io_log_version == 2 && (r) == 2))
+
+/*
+ * Read version 2 and 3 iolog data. It is enhanced to include per-file logging,
+ * syncs, etc.
+ */
+static bool read_iolog(struct thread_data *td)
+{
+	unsigned long long offset;
+	unsigned int bytes;
+	unsigned long long delay = 0;
+	int reads, writes, trims, waits, fileno = 0, file_action = 0; /* stupid gcc */
+	char *rfname, *fname, *act;
+	char *str, *p;
+	enum fio_ddir rw;
+	bool realloc = false;
+	int64_t items_to_fetch = 0;
+	int syncs;
+	struct iolog_rec *recs = NULL;
+	unsigned long nr_recs = 0, max_recs = 0;
+	unsigned long long first_ttime = -1ULL;
+
+	if (td->o.read_iolog_chunked) {
 		items_to_fetch = iolog_items_to_fetch(td);
 		if (!items_to_fetch)
 			return true;
@@ -465,7 +1102,7 @@ static bool read_iolog(struct thread_data *td)
 	while ((p = fgets(str, 4096, td->io_log_rfile)) != NULL) {
 		struct io_piece *ipo;
 		int r;
-		unsigned long long ttime;
+		unsigned long long ttime = 0;
 
 		if (td->io_log_version == 3) {
 			r = sscanf(p, "%llu %256s %256s %llu %u", &ttime, rfname, act,
@@ -490,54 +1127,29 @@ static bool read_iolog(struct thread_data *td)
 			/*
 			 * Check action first
 			 */
-			if (!strcmp(act, "wait"))
-				rw = DDIR_WAIT;
-			else if (!strcmp(act, "read")) {
-				if (td->o.replay_skip & (1u << DDIR_READ))
-					continue;
-				rw = DDIR_READ;
-			} else if (!strcmp(act, "write")) {
-				if (td->o.replay_skip & (1u << DDIR_WRITE))
-					continue;
-				rw = DDIR_WRITE;
-			} else if (!strcmp(act, "sync")) {
-				if (td->o.replay_skip & (1u << DDIR_SYNC))
-					continue;
-				rw = DDIR_SYNC;
-			} else if (!strcmp(act, "datasync"))
-				rw = DDIR_DATASYNC;
-			else if (!strcmp(act, "trim")) {
-				if (td->o.replay_skip & (1u << DDIR_TRIM))
-					continue;
-				rw = DDIR_TRIM;
-			} else {
+			if (!iolog_str_to_ddir(act, &rw)) {
 				log_err("fio: bad iolog file action: %s\n",
 									act);
 				continue;
 			}
+			if (td->o.replay_skip & (1u << rw))
+				continue;
 			fileno = get_fileno(td, fname);
 		} else if (file_act(td, r)) {
 			rw = DDIR_INVAL;
-			if (!strcmp(act, "add")) {
-				if (td->o.replay_redirect &&
-				    get_fileno(td, fname) != -1) {
-					dprint(FD_FILE, "iolog: ignoring"
-						" re-add of file %s\n", fname);
-				} else {
-					fileno = add_file(td, fname, td->subjob_number, 1);
-					file_action = FIO_LOG_ADD_FILE;
-				}
-			} else if (!strcmp(act, "open")) {
-				fileno = get_fileno(td, fname);
-				file_action = FIO_LOG_OPEN_FILE;
-			} else if (!strcmp(act, "close")) {
-				fileno = get_fileno(td, fname);
-				file_action = FIO_LOG_CLOSE_FILE;
-			} else {
+			if (!iolog_str_to_file_action(act, &file_action)) {
 				log_err("fio: bad iolog file action: %s\n",
 									act);
 				continue;
 			}
+			if (file_action != FIO_LOG_ADD_FILE)
+				fileno = get_fileno(td, fname);
+			else if (td->o.replay_redirect &&
+				 get_fileno(td, fname) != -1) {
+				dprint(FD_FILE, "iolog: ignoring"
+					" re-add of file %s\n", fname);
+			} else
+				fileno = add_file(td, fname, td->subjob_number, 1);
 		} else {
 			log_err("bad iolog%d: %s\n", td->io_log_version, p);
 			continue;
@@ -571,32 +1183,33 @@ static bool read_iolog(struct thread_data *td)
 			continue;
 		}
 
+		/*
+		 * Sharded replay, keep the entry until the whole iolog is
+		 * parsed. Times are kept relative to the first entry.
+		 */
+		if (td->io_log_shards) {
+			struct iolog_rec *rec;
+
+			rec = iolog_rec_get(&recs, &nr_recs, &max_recs);
+
+			if (first_ttime == -1ULL)
+				first_ttime = ttime;
+			rec->time = iolog_timeline_time(td, ttime, first_ttime);
+			rec->offset = offset;
+			rec->len = bytes;
+			rec->fileno = fileno;
+			rec->ddir = rw;
+			rec->file_action = file_action;
+			continue;
+		}
+
 		/*
 		 * Make note of file
 		 */
 		ipo = calloc(1, sizeof(*ipo));
-		init_ipo(ipo);
-		ipo->ddir = rw;
-		if (td->io_log_version == 3)
-			ipo->delay = delay;
-		if (rw == DDIR_WAIT) {
-			ipo->delay = offset;
-		} else {
-			if (td->o.replay_scale)
-				ipo->offset = offset / td->o.replay_scale;
-			else
-				ipo->offset = offset;
-			ipo_bytes_align(td->o.replay_align, ipo);
-
-			ipo->len = bytes;
-			if (rw != DDIR_INVAL && bytes > td->o.max_bs[rw]) {
-				realloc = true;
-				td->o.max_bs[rw] = bytes;
-			}
-			ipo->fileno = fileno;
-			ipo->file_action = file_action;
-			td->o.size += bytes;
-		}
+		if (iolog_fill_ipo(td, ipo, rw, delay, offset, bytes, fileno,
+				   file_action))
+			realloc = true;
 
 		queue_io_piece(td, ipo);
 
@@ -608,6 +1221,11 @@ static bool read_iolog(struct thread_data *td)
 		}
 	}
 
+	if (td->io_log_shards) {
+		iolog_queue_shard(td, recs, nr_recs);
+		free(recs);
+	}
+
 	free(str);
 	free(act);
 	free(rfname);
@@ -630,29 +1248,509 @@ static bool read_iolog(struct thread_data *td)
 		if (td->io_log_current == 0) {
 			return false;
 		}
-		td->o.td_ddir = TD_DDIR_RW;
-		if (realloc && td->orig_buffer)
-		{
-			io_u_quiesce(td);
-			free_io_mem(td);
-			if (init_io_u_buffers(td))
-				return false;
+		td->o.td_ddir = TD_DDIR_RW;
+		if (realloc && td->orig_buffer)
+		{
+			io_u_quiesce(td);
+			free_io_mem(td);
+			if (init_io_u_buffers(td))
+				return false;
+		}
+		return true;
+	}
+
+	if (!reads && !writes && !waits && !trims)
+		return false;
+
+	td->o.td_ddir = 0;
+	if (reads)
+		td->o.td_ddir |= TD_DDIR_READ;
+	if (writes)
+		td->o.td_ddir |= TD_DDIR_WRITE;
+	if (trims)
+		td->o.td_ddir |= TD_DDIR_TRIM;
+
+	return true;
+}
+
+/*
+ * State of a compiled iolog replay. Entries are read straight from the
+ * mapping, file numbers of the log are translated to those of the job.
+ */
+struct iolog_map {
+	void *buf;
+	size_t len;
+	const struct iolog_bin_entry *entries;
+	uint64_t nr_entries;
+	uint64_t next;
+	int *files;
+	uint32_t nr_files;
+	uint64_t *stripe;
+	unsigned long long first_ttime;
+};
+
+static void iolog_bin_to_rec(struct iolog_map *m,
+			     const struct iolog_bin_entry *e,
+			     struct iolog_rec *rec)
+{
+	rec->time = le64_to_cpu(e->time);
+	rec->offset = le64_to_cpu(e->offset);
+	rec->len = le32_to_cpu(e->len);
+	rec->fileno = m->files[le16_to_cpu(e->fileno)];
+	rec->ddir = e->ddir;
+	rec->file_action = e->file_action;
+}
+
+/*
+ * Returns true if this job replays the entry
+ */
+static bool iolog_map_wanted(struct thread_data *td, struct iolog_map *m,
+			     struct iolog_rec *rec)
+{
+	if (rec->ddir != DDIR_INVAL && (td->o.replay_skip & (1u << rec->ddir)))
+		return false;
+	if (read_only && (rec->ddir == DDIR_WRITE || rec->ddir == DDIR_TRIM))
+		return false;
+	if (rec->ddir == DDIR_WAIT && td->o.no_stall)
+		return false;
+	if (td->io_log_shards && !iolog_shard_owns(td, rec, m->stripe))
+		return false;
+
+	return true;
+}
+
+static int read_iolog_map_get(struct thread_data *td, struct io_u *io_u)
+{
+	struct iolog_map *m = td->io_log_map;
+	unsigned long long delay = 0;
+	struct iolog_rec rec;
+	struct io_piece ipo;
+	int ret;
+
+	while (m->next < m->nr_entries) {
+		iolog_bin_to_rec(m, &m->entries[m->next++], &rec);
+
+		if (td->io_log_version == 3) {
+			if (td->io_log_shards) {
+				delay = iolog_timeline_time(td, rec.time,
+							    m->first_ttime);
+			} else {
+				delay = delay_since_ttime(td, rec.time);
+				td->io_log_last_ttime = rec.time;
+			}
+		}
+
+		if (!iolog_map_wanted(td, m, &rec))
+			continue;
+
+		iolog_set_ipo(td, &ipo, rec.ddir, delay, rec.offset, rec.len,
+				rec.fileno, rec.file_action);
+		ret = iolog_ipo_get(td, &ipo, io_u);
+		if (ret < 0)
+			break;
+		else if (!ret)
+			return 0;
+	}
+
+	td->done = 1;
+	return 1;
+}
+
+static bool read_iolog_map_pending(struct thread_data *td)
+{
+	struct iolog_map *m = td->io_log_map;
+
+	return m->next < m->nr_entries;
+}
+
+static void iolog_map_exit(struct thread_data *td)
+{
+	struct iolog_map *m = td->io_log_map;
+
+	if (!m)
+		return;
+
+	munmap(m->buf, m->len);
+	free(m->files);
+	free(m->stripe);
+	free(m);
+	td->io_log_map = NULL;
+}
+
+/*
+ * Add the files of a compiled iolog to the job
+ */
+static bool iolog_map_files(struct thread_data *td, struct iolog_map *m,
+			    uint64_t names_off)
+{
+	const uint8_t *p = m->buf + names_off;
+	const uint8_t *end = m->buf + m->len;
+	char name[PATH_MAX];
+	const char *fname;
+	uint16_t len;
+	uint32_t i;
+	int fileno;
+
+	m->files = calloc(m->nr_files, sizeof(int));
+	for (i = 0; i < m->nr_files; i++) {
+		if (end - p < sizeof(len))
+			return false;
+		memcpy(&len, p, sizeof(len));
+		len = le16_to_cpu(len);
+		p += sizeof(len);
+		if (end - p < len || len >= sizeof(name))
+			return false;
+		memcpy(name, p, len);
+		name[len] = '\0';
+		p += len;
+
+		fname = td->o.replay_redirect ? td->o.replay_redirect : name;
+		fileno = get_fileno(td, fname);
+		if (fileno == -1)
+			fileno = add_file(td, fname, td->subjob_number, 1);
+		m->files[i] = fileno;
+	}
+
+	return true;
+}
+
+/*
+ * Work out the split of the files between shards, like iolog_queue_shard()
+ */
+static void iolog_map_stripes(struct thread_data *td, struct iolog_map *m)
+{
+	struct iolog_rec rec;
+	uint64_t i;
+
+	m->stripe = calloc(td->files_index, sizeof(uint64_t));
+	for (i = 0; i < m->nr_entries; i++) {
+		iolog_bin_to_rec(m, &m->entries[i], &rec);
+		if (!ddir_rw(rec.ddir) || rec.fileno < 0 ||
+		    rec.fileno >= td->files_index)
+			continue;
+		if (rec.offset + rec.len > m->stripe[rec.fileno])
+			m->stripe[rec.fileno] = rec.offset + rec.len;
+	}
+	for (i = 0; i < td->files_index; i++) {
+		m->stripe[i] = (m->stripe[i] + td->io_log_shards - 1) /
+				td->io_log_shards;
+		if (!m->stripe[i])
+			m->stripe[i] = 1;
+	}
+}
+
+/*
+ * Check the entries of a compiled iolog and size the job from the ones it
+ * replays
+ */
+static bool iolog_map_scan(struct thread_data *td, struct iolog_map *m)
+{
+	unsigned long reads = 0, writes = 0, trims = 0, waits = 0, syncs = 0;
+	struct iolog_rec rec;
+	uint64_t i;
+
+	for (i = 0; i < m->nr_entries; i++) {
+		const struct iolog_bin_entry *e = &m->entries[i];
+
+		if (le16_to_cpu(e->fileno) >= m->nr_files ||
+		    e->ddir < DDIR_INVAL || e->ddir > DDIR_WAIT ||
+		    (e->ddir == DDIR_INVAL &&
+		     e->file_action > FIO_LOG_UNLINK_FILE)) {
+			log_err("fio: bad compiled iolog entry %llu\n",
+				(unsigned long long) i);
+			return false;
+		}
+	}
+
+	if (m->nr_entries)
+		m->first_ttime = le64_to_cpu(m->entries[0].time);
+	if (td->io_log_shards && td->o.replay_shard == REPLAY_SHARD_OFFSET)
+		iolog_map_stripes(td, m);
+
+	for (i = 0; i < m->nr_entries; i++) {
+		iolog_bin_to_rec(m, &m->entries[i], &rec);
+		if (read_only && rec.ddir == DDIR_WRITE)
+			writes++;
+		if (!iolog_map_wanted(td, m, &rec))
+			continue;
+
+		if (rec.ddir == DDIR_READ)
+			reads++;
+		else if (rec.ddir == DDIR_WRITE)
+			writes++;
+		else if (rec.ddir == DDIR_TRIM)
+			trims++;
+		else if (rec.ddir == DDIR_WAIT)
+			waits++;
+		else if (ddir_sync(rec.ddir))
+			syncs++;
+
+		if (ddir_rw(rec.ddir)) {
+			if (rec.len > td->o.max_bs[rec.ddir])
+				td->o.max_bs[rec.ddir] = rec.len;
+			td->o.size += rec.len;
+			td->total_io_size += rec.len;
+		}
+	}
+
+	if (writes && read_only) {
+		log_err("fio: <%s> skips replay of %lu writes due to"
+			" read-only\n", td->o.name, writes);
+		writes = 0;
+	}
+	if (syncs)
+		td->flags |= TD_F_SYNCS;
+
+	if (!reads && !writes && !waits && !trims)
+		return false;
+
+	td->o.td_ddir = 0;
+	if (reads)
+		td->o.td_ddir |= TD_DDIR_READ;
+	if (writes)
+		td->o.td_ddir |= TD_DDIR_WRITE;
+	if (trims)
+		td->o.td_ddir |= TD_DDIR_TRIM;
+
+	return true;
+}
+
+/*
+ * Map a compiled iolog for replay
+ */
+static bool init_iolog_map(struct thread_data *td, const char *fname)
+{
+	struct iolog_bin_hdr *hdr;
+	struct iolog_map *m;
+	uint64_t nr_entries, names_off;
+	struct stat sb;
+	void *buf;
+	int fd;
+
+	fd = open(fname, O_RDONLY);
+	if (fd < 0) {
+		td_verror(td, errno, "open compiled iolog");
+		return false;
+	}
+	if (fstat(fd, &sb) < 0) {
+		td_verror(td, errno, "stat compiled iolog");
+		close(fd);
+		return false;
+	}
+	if (sb.st_size < sizeof(*hdr)) {
+		log_err("fio: compiled iolog %s is truncated\n", fname);
+		close(fd);
+		return false;
+	}
+
+	buf = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (buf == MAP_FAILED) {
+		td_verror(td, errno, "mmap compiled iolog");
+		return false;
+	}
+
+	hdr = buf;
+	nr_entries = le64_to_cpu(hdr->nr_entries);
+	names_off = le64_to_cpu(hdr->names_off);
+	if (le32_to_cpu(hdr->version) != FIO_IOLOG_BIN_VERSION) {
+		log_err("fio: compiled iolog %s has unsupported version %u\n",
+			fname, le32_to_cpu(hdr->version));
+		munmap(buf, sb.st_size);
+		return false;
+	}
+	if (names_off > sb.st_size ||
+	    names_off != sizeof(*hdr) + nr_entries * sizeof(struct iolog_bin_entry)) {
+		log_err("fio: compiled iolog %s is truncated\n", fname);
+		munmap(buf, sb.st_size);
+		return false;
+	}
+
+	m = calloc(1, sizeof(*m));
+	m->buf = buf;
+	m->len = sb.st_size;
+	m->entries = buf + sizeof(*hdr);
+	m->nr_entries = nr_entries;
+	m->nr_files = le32_to_cpu(hdr->nr_files);
+	td->io_log_map = m;
+	td->io_log_version = le32_to_cpu(hdr->iolog_version);
+
+	free_release_files(td);
+	if (!iolog_map_files(td, m, names_off)) {
+		log_err("fio: compiled iolog %s has a bad file table\n", fname);
+		goto err;
+	}
+	if (!iolog_map_scan(td, m))
+		goto err;
+
+	posix_madvise(buf, m->len, POSIX_MADV_SEQUENTIAL);
+	return true;
+err:
+	iolog_map_exit(td);
+	return false;
+}
+
+static int iolog_bin_fileno(char ***names, uint32_t *nr_names,
+			    uint32_t *last, const char *fname)
+{
+	uint32_t i;
+
+	if (*last < *nr_names && !strcmp((*names)[*last], fname))
+		return *last;
+
+	for (i = 0; i < *nr_names; i++) {
+		if (!strcmp((*names)[i], fname)) {
+			*last = i;
+			return i;
+		}
+	}
+
+	if (*nr_names == 65536)
+		return -1;
+
+	*names = realloc(*names, (*nr_names + 1) * sizeof(char *));
+	(*names)[*nr_names] = strdup(fname);
+	*last = *nr_names;
+	return (*nr_names)++;
+}
+
+/*
+ * Compile a version 2 or 3 text iolog into <file>.bin. Replay options are
+ * applied when the compiled iolog is replayed, not here.
+ */
+int iolog_compile(const char *file)
+{
+	unsigned long long ttime, offset, nr_entries = 0;
+	uint32_t nr_names = 0, last = 0, i;
+	struct iolog_bin_entry e;
+	struct iolog_bin_hdr hdr;
+	char *str, *fname, *act, *outname = NULL;
+	char **names = NULL;
+	int version, file_action, fileno, r, ret = 1;
+	FILE *in, *out = NULL;
+	enum fio_ddir rw;
+	unsigned int bytes;
+	uint16_t len;
+
+	in = fopen(file, "r");
+	if (!in) {
+		log_err("fio: failed to open iolog %s: %s\n", file,
+			strerror(errno));
+		return 1;
+	}
+
+	str = malloc(4096);
+	fname = malloc(256+16);
+	act = malloc(256+16);
+
+	if (!fgets(str, 4096, in)) {
+		log_err("fio: unable to read iolog %s\n", file);
+		goto done;
+	}
+	if (!strncmp(iolog_ver2, str, strlen(iolog_ver2)))
+		version = 2;
+	else if (!strncmp(iolog_ver3, str, strlen(iolog_ver3)))
+		version = 3;
+	else {
+		log_err("fio: %s is not a version 2 or 3 iolog\n", file);
+		goto done;
+	}
+
+	outname = malloc(strlen(file) + 5);
+	sprintf(outname, "%s.bin", file);
+	out = fopen(outname, "w");
+	if (!out) {
+		log_err("fio: failed to open %s: %s\n", outname,
+			strerror(errno));
+		goto done;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	fwrite(&hdr, sizeof(hdr), 1, out);
+
+	while (fgets(str, 4096, in) != NULL) {
+		ttime = 0;
+		if (version == 3)
+			r = sscanf(str, "%llu %256s %256s %llu %u", &ttime,
+					fname, act, &offset, &bytes) - 1;
+		else
+			r = sscanf(str, "%256s %256s %llu %u", fname, act,
+					&offset, &bytes);
+
+		memset(&e, 0, sizeof(e));
+		if (r == 4) {
+			if (!iolog_str_to_ddir(act, &rw)) {
+				log_err("fio: bad iolog file action: %s\n", act);
+				continue;
+			}
+			if (version == 3 && rw == DDIR_WAIT) {
+				log_err("iolog: ignoring wait command with"
+					" version 3 for file %s\n", fname);
+				continue;
+			}
+			e.ddir = rw;
+			e.offset = cpu_to_le64((uint64_t) offset);
+			e.len = cpu_to_le32((uint32_t) bytes);
+		} else if (r == 2) {
+			if (!iolog_str_to_file_action(act, &file_action)) {
+				log_err("fio: bad iolog file action: %s\n", act);
+				continue;
+			}
+			e.ddir = DDIR_INVAL;
+			e.file_action = file_action;
+		} else {
+			log_err("bad iolog%d: %s\n", version, str);
+			continue;
+		}
+
+		fileno = iolog_bin_fileno(&names, &nr_names, &last, fname);
+		if (fileno < 0) {
+			log_err("fio: too many files in iolog %s\n", file);
+			goto done;
 		}
-		return true;
+		e.fileno = cpu_to_le16((uint16_t) fileno);
+		e.time = cpu_to_le64((uint64_t) ttime);
+		fwrite(&e, sizeof(e), 1, out);
+		nr_entries++;
 	}
 
-	if (!reads && !writes && !waits && !trims)
-		return false;
+	for (i = 0; i < nr_names; i++) {
+		len = cpu_to_le16((uint16_t) strlen(names[i]));
+		fwrite(&len, sizeof(len), 1, out);
+		fwrite(names[i], strlen(names[i]), 1, out);
+	}
 
-	td->o.td_ddir = 0;
-	if (reads)
-		td->o.td_ddir |= TD_DDIR_READ;
-	if (writes)
-		td->o.td_ddir |= TD_DDIR_WRITE;
-	if (trims)
-		td->o.td_ddir |= TD_DDIR_TRIM;
+	memcpy(hdr.magic, FIO_IOLOG_BIN_MAGIC, sizeof(hdr.magic));
+	hdr.version = cpu_to_le32((uint32_t) FIO_IOLOG_BIN_VERSION);
+	hdr.iolog_version = cpu_to_le32((uint32_t) version);
+	hdr.nr_files = cpu_to_le32(nr_names);
+	hdr.nr_entries = cpu_to_le64((uint64_t) nr_entries);
+	hdr.names_off = cpu_to_le64((uint64_t) (sizeof(hdr) + nr_entries * sizeof(e)));
+	rewind(out);
+	fwrite(&hdr, sizeof(hdr), 1, out);
+
+	if (ferror(out)) {
+		log_err("fio: failed to write %s\n", outname);
+		goto done;
+	}
 
-	return true;
+	log_info("%s: %llu entries, %u files\n", outname, nr_entries,
+			nr_names);
+	ret = 0;
+done:
+	if (out && fclose(out) && !ret) {
+		log_err("fio: failed to write %s\n", outname);
+		ret = 1;
+	}
+	for (i = 0; i < nr_names; i++)
+		free(names[i]);
+	free(names);
+	free(outname);
+	free(str);
+	free(fname);
+	free(act);
+	fclose(in);
+	return ret;
 }
 
 static bool is_socket(const char *path)
@@ -697,6 +1795,7 @@ static int open_socket(const char *path)
 static bool init_iolog_read(struct thread_data *td, char *fname)
 {
 	char buffer[256], *p;
+	bool stream = false;
 	FILE *f = NULL;
 
 	dprint(FD_IO, "iolog: name=%s\n", fname);
@@ -707,8 +1806,10 @@ static bool init_iolog_read(struct thread_data *td, char *fname)
 		fd = open_socket(fname);
 		if (fd >= 0)
 			f = fdopen(fd, "r");
+		stream = true;
 	} else if (!strcmp(fname, "-")) {
 		f = stdin;
+		stream = true;
 	} else
 		f = fopen(fname, "r");
 
@@ -725,6 +1826,18 @@ static bool init_iolog_read(struct thread_data *td, char *fname)
 		return false;
 	}
 
+	/*
+	 * compiled iologs are mapped rather than read
+	 */
+	if (!strncmp(buffer, FIO_IOLOG_BIN_MAGIC, strlen(FIO_IOLOG_BIN_MAGIC))) {
+		fclose(f);
+		if (stream) {
+			log_err("fio: compiled iolog must be a regular file\n");
+			return false;
+		}
+		return init_iolog_map(td, fname);
+	}
+
 	/*
 	 * versions 2 and 3 of the iolog store a specific string as the
 	 * first line, check for that
@@ -753,6 +1866,15 @@ static bool init_iolog_write(struct thread_data *td)
 	FILE *f;
 	unsigned int i;
 
+	if (td->o.write_iolog_format == IOLOG_FORMAT_BINARY) {
+		if (!capture_open(td))
+			return false;
+
+		for_each_file(td, ff, i)
+			log_file(td, ff, FIO_LOG_ADD_FILE);
+		return true;
+	}
+
 	f = fopen(td->o.write_iolog_file, "a");
 	if (!f) {
 		perror("fopen write iolog");
@@ -798,7 +1920,15 @@ bool init_iolog(struct thread_data *td)
 		 */
 		if (is_blktrace(fname, &need_swap)) {
 			td->io_log_blktrace = 1;
-			ret = init_blktrace_read(td, fname, need_swap);
+			if (td->io_log_shards) {
+				log_err("fio: replay_shard isn't supported for blktrace replay\n");
+				ret = false;
+			} else
+				ret = init_blktrace_read(td, fname, need_swap);
+		} else if (td->o.replay_queue_depth) {
+			log_err("fio: replay_queue_depth needs a blktrace "
+				"trace, iologs don't record completions\n");
+			ret = false;
 		} else {
 			td->io_log_blktrace = 0;
 			ret = init_iolog_read(td, fname);
@@ -828,6 +1958,7 @@ void setup_log(struct io_log **log, struct log_params *p,
 	l->log_type = p->log_type;
 	l->log_offset = p->log_offset;
 	l->log_prio = p->log_prio;
+	l->log_binary = p->log_binary;
 	l->log_gz = p->log_gz;
 	l->log_gz_store = p->log_gz_store;
 	l->avg_msec = p->avg_msec;
@@ -855,9 +1986,15 @@ void setup_log(struct io_log **log, struct log_params *p,
 			def_samples = roundup_pow2(l->td->o.iodepth);
 		__p->max_samples = def_samples;
 		__p->log = calloc(__p->max_samples, log_entry_sz(l));
+		mem_acct_add(l->td, MEM_IO_LOGS,
+			     __p->max_samples * log_entry_sz(l));
 		l->pending = __p;
 	}
 
+	if (l->td && l->td->o.log_sample != LOG_SAMPLE_ALL && !l->avg_msec &&
+	    inline_log(l))
+		l->sampler = log_sampler_init(l->td, l->log_type);
+
 	if (l->log_offset)
 		l->log_ddir_mask = LOG_OFFSET_SAMPLE_BIT;
 	if (l->log_prio)
@@ -871,6 +2008,34 @@ void setup_log(struct io_log **log, struct log_params *p,
 		mutex_init_pshared(&l->chunk_lock);
 		mutex_init_pshared(&l->deferred_free_lock);
 		p->td->flags |= TD_F_COMPRESS_LOG;
+
+		if (l->avg_msec && (l->log_type == IO_LOG_TYPE_BW ||
+				    l->log_type == IO_LOG_TYPE_IOPS)) {
+			l->win = scalloc(IOLOG_WIN_NR, sizeof(*l->win));
+			if (l->win)
+				mutex_init_pshared(&l->win_lock);
+		}
+	} else if (p->log_mmap && p->td && per_unit_log(l) &&
+		   l->log_type != IO_LOG_TYPE_HIST && !is_backend &&
+		   p->td->client_type != FIO_CLIENT_TYPE_GUI) {
+		/*
+		 * Same restrictions as for write behind below, the chunks are
+		 * only read back in when the job flushes its logs.
+		 */
+		l->log_mmap = 1;
+		l->mmap_fd = -1;
+	} else if (p->write_behind && p->td && per_unit_log(l) &&
+		   l->log_type != IO_LOG_TYPE_HIST && !is_backend &&
+		   p->td->client_type != FIO_CLIENT_TYPE_GUI) {
+		/*
+		 * Write behind is done by the log compression workqueue, for
+		 * logs that only the job itself adds samples to and that
+		 * aren't shipped to a client when the job is done.
+		 */
+		l->write_behind = 1;
+		mutex_init_pshared(&l->chunk_lock);
+		mutex_init_pshared(&l->deferred_free_lock);
+		p->td->flags |= TD_F_COMPRESS_LOG;
 	}
 
 	*log = l;
@@ -904,23 +2069,34 @@ static void clear_file_buffer(void *buf)
 
 void free_log(struct io_log *log)
 {
+	if (log->log_mmap)
+		iolog_mmap_exit(log);
+
 	while (!flist_empty(&log->io_logs)) {
 		struct io_logs *cur_log;
 
 		cur_log = flist_first_entry(&log->io_logs, struct io_logs, list);
 		flist_del_init(&cur_log->list);
 		free(cur_log->log);
+		mem_acct_add(log->td, MEM_IO_LOGS,
+			     -(int64_t) (cur_log->max_samples * log_entry_sz(log)));
 		sfree(cur_log);
 	}
 
 	if (log->pending) {
 		free(log->pending->log);
+		mem_acct_add(log->td, MEM_IO_LOGS,
+			     -(int64_t) (log->pending->max_samples *
+					 log_entry_sz(log)));
 		free(log->pending);
 		log->pending = NULL;
 	}
 
 	free(log->pending);
 	free(log->filename);
+	if (log->win)
+		sfree(log->win);
+	log_sampler_free(log->sampler);
 	sfree(log);
 }
 
@@ -1041,6 +2217,264 @@ void flush_samples(FILE *f, void *samples, uint64_t sample_size)
 	}
 }
 
+#define BINLOG_BATCH	256
+
+void flush_samples_binary(FILE *f, void *samples, uint64_t sample_size)
+{
+	struct io_binlog_sample recs[BINLOG_BATCH];
+	struct io_sample *s;
+	int log_offset, log_prio;
+	uint64_t i, nr_samples;
+	unsigned int nr = 0;
+
+	if (!sample_size)
+		return;
+
+	s = __get_sample(samples, 0, 0);
+	log_offset = (s->__ddir & LOG_OFFSET_SAMPLE_BIT) != 0;
+	log_prio = (s->__ddir & LOG_PRIO_SAMPLE_BIT) != 0;
+
+	/*
+	 * Only a new file gets a header, jobs sharing a log append to it
+	 */
+	if (!fseek(f, 0, SEEK_END) && !ftell(f)) {
+		struct io_binlog_hdr hdr;
+		uint32_t version = FIO_BINLOG_VERSION, flags = 0;
+
+		memcpy(hdr.magic, FIO_BINLOG_MAGIC, sizeof(hdr.magic));
+		if (log_offset)
+			flags |= FIO_BINLOG_F_OFFSET;
+		if (log_prio)
+			flags |= FIO_BINLOG_F_PRIO;
+		hdr.version = cpu_to_le32(version);
+		hdr.flags = cpu_to_le32(flags);
+		fwrite(&hdr, sizeof(hdr), 1, f);
+	}
+
+	nr_samples = sample_size / __log_entry_sz(log_offset);
+
+	for (i = 0; i < nr_samples; i++) {
+		struct io_binlog_sample *r = &recs[nr];
+		uint32_t ddir, prio;
+
+		s = __get_sample(samples, log_offset, i);
+
+		ddir = io_sample_ddir(s);
+		if (log_prio)
+			prio = s->priority;
+		else
+			prio = ioprio_value_is_class_rt(s->priority);
+
+		r->time = cpu_to_le64(s->time);
+		r->val = cpu_to_le64(s->data.val);
+		r->bs = cpu_to_le64(s->bs);
+		r->ddir = cpu_to_le32(ddir);
+		r->prio = cpu_to_le32(prio);
+		if (log_offset) {
+			struct io_sample_offset *so = (void *) s;
+
+			r->offset = cpu_to_le64(so->offset);
+		} else
+			r->offset = 0;
+
+		if (++nr == BINLOG_BATCH) {
+			fwrite(recs, sizeof(recs[0]), nr, f);
+			nr = 0;
+		}
+	}
+
+	if (nr)
+		fwrite(recs, sizeof(recs[0]), nr, f);
+}
+
+/*
+ * With log_binary=columnar, each flush of samples becomes one batch of
+ * a "log" table. Timestamps and offsets mostly grow by small steps, so
+ * they are delta encoded.
+ */
+void flush_samples_columnar(FILE *f, void *samples, uint64_t sample_size)
+{
+	uint64_t *time, *val, *ddir, *bs, *offset, *prio;
+	struct io_sample *s;
+	int log_offset, log_prio;
+	uint64_t i, nr_samples;
+	struct buf_output out;
+	struct col_batch *b;
+
+	if (!sample_size)
+		return;
+
+	s = __get_sample(samples, 0, 0);
+	log_offset = (s->__ddir & LOG_OFFSET_SAMPLE_BIT) != 0;
+	log_prio = (s->__ddir & LOG_PRIO_SAMPLE_BIT) != 0;
+	nr_samples = sample_size / __log_entry_sz(log_offset);
+
+	time = malloc(6 * nr_samples * sizeof(uint64_t));
+	b = col_batch_new("log", nr_samples);
+	if (!time || !b) {
+		log_err("fio: failed to allocate columnar log batch\n");
+		free(time);
+		if (b)
+			col_batch_free(b);
+		return;
+	}
+	val = time + nr_samples;
+	ddir = val + nr_samples;
+	bs = ddir + nr_samples;
+	offset = bs + nr_samples;
+	prio = offset + nr_samples;
+
+	for (i = 0; i < nr_samples; i++) {
+		s = __get_sample(samples, log_offset, i);
+
+		time[i] = s->time;
+		val[i] = s->data.val;
+		ddir[i] = io_sample_ddir(s);
+		bs[i] = s->bs;
+		if (log_offset) {
+			struct io_sample_offset *so = (void *) s;
+
+			offset[i] = so->offset;
+		}
+		if (log_prio)
+			prio[i] = s->priority;
+		else
+			prio[i] = ioprio_value_is_class_rt(s->priority);
+	}
+
+	col_add_u64(b, "time", COL_ENC_DELTA, time);
+	col_add_u64(b, "value", COL_ENC_DELTA, val);
+	col_add_u64(b, "ddir", COL_ENC_VARINT, ddir);
+	col_add_u64(b, "bs", COL_ENC_VARINT, bs);
+	if (log_offset)
+		col_add_u64(b, "offset", COL_ENC_DELTA, offset);
+	col_add_u64(b, "prio", COL_ENC_VARINT, prio);
+
+	buf_output_init(&out);
+	/* as with log_binary=1, only a new file gets a header */
+	if (!fseek(f, 0, SEEK_END) && !ftell(f))
+		col_file_header(&out);
+	col_batch_write(b, &out);
+	fwrite(out.buf, out.buflen, 1, f);
+
+	buf_output_free(&out);
+	col_batch_free(b);
+	free(time);
+}
+
+/*
+ * Histogram logs with log_binary=columnar become a "hist_log" table with
+ * a row per bin that counted IOs in the interval, and the columns are
+ * deflated. Most of the bins of an interval stay empty, so this is a
+ * small fraction of the text log. 'entry_sz' is the distance between
+ * samples. Unless 'diffed', a sample holds the running histogram and the
+ * previous one on its list is subtracted, and then freed, as in
+ * flush_hist_samples().
+ */
+static uint64_t *hist_before(struct io_sample *s, bool diffed)
+{
+	struct io_u_plat_entry *entry = s->data.plat_entry;
+
+	if (diffed)
+		return NULL;
+
+	return flist_first_entry(&entry->list, struct io_u_plat_entry,
+				 list)->io_u_plat;
+}
+
+void flush_hist_samples_columnar(FILE *f, int hist_coarseness, void *samples,
+				 uint64_t nr_samples, size_t entry_sz,
+				 bool diffed)
+{
+	uint64_t *time, *ddir, *bs, *coarse, *bin, *count;
+	struct io_u_plat_entry *entry, *entry_before;
+	int stride = 1 << hist_coarseness;
+	uint64_t i, j, cnt, rows = 0;
+	struct buf_output out;
+	struct io_sample *s;
+	struct col_batch *b;
+
+	/* count the rows first, the columns are sized by it */
+	for (i = 0; i < nr_samples; i++) {
+		s = samples + i * entry_sz;
+		for (j = 0; j < FIO_IO_U_PLAT_NR; j += stride)
+			if (hist_sum(j, stride, s->data.plat_entry->io_u_plat,
+				     hist_before(s, diffed)))
+				rows++;
+	}
+
+	time = malloc(6 * (rows ? rows : 1) * sizeof(uint64_t));
+	b = col_batch_new("hist_log", rows);
+	if (!time || !b) {
+		log_err("fio: failed to allocate histogram log batch\n");
+		free(time);
+		if (b)
+			col_batch_free(b);
+		return;
+	}
+	ddir = time + rows;
+	bs = ddir + rows;
+	coarse = bs + rows;
+	bin = coarse + rows;
+	count = bin + rows;
+
+	rows = 0;
+	for (i = 0; i < nr_samples; i++) {
+		s = samples + i * entry_sz;
+		entry = s->data.plat_entry;
+
+		for (j = 0; j < FIO_IO_U_PLAT_NR; j += stride) {
+			cnt = hist_sum(j, stride, entry->io_u_plat,
+					hist_before(s, diffed));
+			if (!cnt)
+				continue;
+			time[rows] = s->time;
+			ddir[rows] = io_sample_ddir(s);
+			bs[rows] = s->bs;
+			coarse[rows] = hist_coarseness;
+			bin[rows] = j / stride;
+			count[rows] = cnt;
+			rows++;
+		}
+
+		if (!diffed) {
+			entry_before = flist_first_entry(&entry->list,
+						struct io_u_plat_entry, list);
+			flist_del(&entry_before->list);
+			free(entry_before);
+		}
+	}
+
+	col_batch_compress(b);
+	col_add_u64(b, "time", COL_ENC_DELTA, time);
+	col_add_u64(b, "ddir", COL_ENC_VARINT, ddir);
+	col_add_u64(b, "bs", COL_ENC_VARINT, bs);
+	col_add_u64(b, "coarseness", COL_ENC_VARINT, coarse);
+	col_add_u64(b, "bin", COL_ENC_DELTA, bin);
+	col_add_u64(b, "count", COL_ENC_VARINT, count);
+
+	buf_output_init(&out);
+	if (!fseek(f, 0, SEEK_END) && !ftell(f))
+		col_file_header(&out);
+	col_batch_write(b, &out);
+	fwrite(out.buf, out.buflen, 1, f);
+
+	buf_output_free(&out);
+	col_batch_free(b);
+	free(time);
+}
+
+static void log_flush_samples(FILE *f, int binary, void *samples,
+			      uint64_t sample_size)
+{
+	if (binary == LOG_BINARY_COLUMNAR)
+		flush_samples_columnar(f, samples, sample_size);
+	else if (binary)
+		flush_samples_binary(f, samples, sample_size);
+	else
+		flush_samples(f, samples, sample_size);
+}
+
 #ifdef CONFIG_ZLIB
 
 struct iolog_flush_data {
@@ -1101,6 +2535,7 @@ struct inflate_chunk_iter {
 	size_t buf_size;
 	size_t buf_used;
 	size_t chunk_sz;
+	int binary;
 };
 
 static void finish_chunk(z_stream *stream, FILE *f,
@@ -1113,7 +2548,7 @@ static void finish_chunk(z_stream *stream, FILE *f,
 		log_err("fio: failed to end log inflation seq %d (%d)\n",
 				iter->seq, ret);
 
-	flush_samples(f, iter->buf, iter->buf_used);
+	log_flush_samples(f, iter->binary, iter->buf, iter->buf_used);
 	free(iter->buf);
 	iter->buf = NULL;
 	iter->buf_size = iter->buf_used = 0;
@@ -1186,7 +2621,10 @@ static size_t inflate_chunk(struct iolog_compress *ic, int gz_hdr, FILE *f,
  */
 static int inflate_gz_chunks(struct io_log *log, FILE *f)
 {
-	struct inflate_chunk_iter iter = { .chunk_sz = log->log_gz, };
+	struct inflate_chunk_iter iter = {
+		.chunk_sz = log->log_gz,
+		.binary = log->log_binary,
+	};
 	z_stream stream;
 
 	while (!flist_empty(&log->chunk_list)) {
@@ -1313,23 +2751,124 @@ int iolog_file_inflate(const char *file)
 
 #endif
 
+/*
+ * With log_mmap, samples are stored in a scratch file next to the log, and
+ * only one chunk of it is mapped at a time. Full chunks are unmapped and
+ * left to the kernel to write back, so memory use stays flat however long
+ * the job runs. They are read back in when the log is flushed.
+ */
+struct io_logs *iolog_mmap_next(struct io_log *log, struct io_logs *cur_log)
+{
+	void *p;
+
+	if (log->mmap_fd == -1) {
+		/* jobs may share a log with per_job_logs=0 */
+		if (asprintf(&log->mmap_filename, "%s.%d.mmap", log->filename,
+				log->td->thread_number) < 0)
+			return NULL;
+
+		log->mmap_fd = open(log->mmap_filename,
+					O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (log->mmap_fd < 0) {
+			log_err("fio: open log %s: %s\n", log->mmap_filename,
+				strerror(errno));
+			free(log->mmap_filename);
+			log->mmap_filename = NULL;
+			return NULL;
+		}
+
+		log->mmap_len = log->cur_log_max * log_entry_sz(log);
+		log->mmap_len = (log->mmap_len + page_mask) & ~page_mask;
+	} else if (cur_log->log) {
+		munmap(cur_log->log, log->mmap_len);
+		cur_log->log = NULL;
+		log->mmap_windows++;
+	}
+
+	if (ftruncate(log->mmap_fd, (log->mmap_windows + 1) * log->mmap_len) < 0) {
+		log_err("fio: extend log %s: %s\n", log->mmap_filename,
+			strerror(errno));
+		return NULL;
+	}
+
+	p = mmap(NULL, log->mmap_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+			log->mmap_fd, log->mmap_windows * log->mmap_len);
+	if (p == MAP_FAILED) {
+		log_err("fio: mmap log %s: %s\n", log->mmap_filename,
+			strerror(errno));
+		return NULL;
+	}
+
+	cur_log->log = p;
+	cur_log->nr_samples = 0;
+	cur_log->max_samples = log->mmap_len / log_entry_sz(log);
+	return cur_log;
+}
+
+static void iolog_mmap_flush(struct io_log *log, FILE *f)
+{
+	const size_t nr = log->mmap_len / log_entry_sz(log);
+	struct io_logs *cur_log = iolog_cur_log(log);
+	uint64_t i;
+
+	for (i = 0; i < log->mmap_windows; i++) {
+		void *p;
+
+		p = mmap(NULL, log->mmap_len, PROT_READ, MAP_SHARED,
+				log->mmap_fd, i * log->mmap_len);
+		if (p == MAP_FAILED) {
+			log_err("fio: mmap log %s: %s\n", log->mmap_filename,
+				strerror(errno));
+			return;
+		}
+
+		madvise(p, log->mmap_len, MADV_SEQUENTIAL);
+		log_flush_samples(f, log->log_binary, p,
+				  nr * log_entry_sz(log));
+		munmap(p, log->mmap_len);
+	}
+
+	if (cur_log && cur_log->log)
+		log_flush_samples(f, log->log_binary, cur_log->log,
+				  log_sample_sz(log, cur_log));
+}
+
+static void iolog_mmap_exit(struct io_log *log)
+{
+	struct io_logs *cur_log = iolog_cur_log(log);
+
+	if (cur_log && cur_log->log) {
+		munmap(cur_log->log, log->mmap_len);
+		cur_log->log = NULL;
+	}
+
+	if (log->mmap_fd != -1) {
+		close(log->mmap_fd);
+		unlink(log->mmap_filename);
+		free(log->mmap_filename);
+		log->mmap_fd = -1;
+	}
+}
+
 void flush_log(struct io_log *log, bool do_append)
 {
+	bool binary;
 	void *buf;
 	FILE *f;
 
 	/*
-	 * If log_gz_store is true, we are writing a binary file.
-	 * Set the mode appropriately (on all platforms) to avoid issues
+	 * If log_gz_store or log_binary is true, we are writing a binary
+	 * file. Set the mode appropriately (on all platforms) to avoid issues
 	 * on windows (line-ending conversions, etc.)
 	 */
+	binary = log->log_gz_store || log->log_binary;
 	if (!do_append)
-		if (log->log_gz_store)
+		if (binary)
 			f = fopen(log->filename, "wb");
 		else
 			f = fopen(log->filename, "w");
 	else
-		if (log->log_gz_store)
+		if (binary)
 			f = fopen(log->filename, "ab");
 		else
 			f = fopen(log->filename, "a");
@@ -1342,17 +2881,29 @@ void flush_log(struct io_log *log, bool do_append)
 
 	inflate_gz_chunks(log, f);
 
-	while (!flist_empty(&log->io_logs)) {
+	/*
+	 * Chunks of a mapped log are released by free_log()
+	 */
+	if (log->log_mmap)
+		iolog_mmap_flush(log, f);
+
+	while (!log->log_mmap && !flist_empty(&log->io_logs)) {
 		struct io_logs *cur_log;
 
 		cur_log = flist_first_entry(&log->io_logs, struct io_logs, list);
 		flist_del_init(&cur_log->list);
 		
-		if (log->td && log == log->td->clat_hist_log)
+		if (log->td && log == log->td->clat_hist_log &&
+		    log->log_binary == LOG_BINARY_COLUMNAR)
+			flush_hist_samples_columnar(f, log->hist_coarseness,
+				cur_log->log, cur_log->nr_samples,
+				log_entry_sz(log), false);
+		else if (log->td && log == log->td->clat_hist_log)
 			flush_hist_samples(f, log->hist_coarseness, cur_log->log,
 			                   log_sample_sz(log, cur_log));
 		else
-			flush_samples(f, cur_log->log, log_sample_sz(log, cur_log));
+			log_flush_samples(f, log->log_binary, cur_log->log,
+					  log_sample_sz(log, cur_log));
 		
 		sfree(cur_log);
 	}
@@ -1363,7 +2914,16 @@ void flush_log(struct io_log *log, bool do_append)
 
 static int finish_log(struct thread_data *td, struct io_log *log, int trylock)
 {
-	if (td->flags & TD_F_COMPRESS_LOG)
+	bool do_append = !td->o.per_job_logs;
+
+	/*
+	 * Once write behind started the file, the rest of the samples are
+	 * appended to it
+	 */
+	if (log->write_behind) {
+		if (iolog_write_behind_finish(log))
+			do_append = true;
+	} else if (td->flags & TD_F_COMPRESS_LOG)
 		iolog_flush(log);
 
 	if (trylock) {
@@ -1375,7 +2935,7 @@ static int finish_log(struct thread_data *td, struct io_log *log, int trylock)
 	if (td->client_type == FIO_CLIENT_TYPE_GUI || is_backend)
 		fio_send_iolog(td, log, log->filename);
 	else
-		flush_log(log, !td->o.per_job_logs);
+		flush_log(log, do_append);
 
 	fio_unlock_file(log->filename);
 	free_log(log);
@@ -1530,6 +3090,10 @@ static int gz_work(struct iolog_flush_data *data)
 
 	iolog_put_deferred(data->log, data->samples);
 
+	/* the samples make way for their compressed chunks */
+	mem_acct_add(data->log->td, MEM_IO_LOGS, (int64_t) total -
+		     data->nr_samples * log_entry_sz(data->log));
+
 	if (!flist_empty(&list)) {
 		pthread_mutex_lock(&data->log->chunk_lock);
 		flist_splice_tail(&list, &data->log->chunk_list);
@@ -1551,6 +3115,109 @@ err:
 	goto done;
 }
 
+/*
+ * Invoked from our compress helper thread with log_write_behind, appends a
+ * full chunk to the log file and hands the buffer back to the job.
+ */
+static int write_behind_work(struct iolog_flush_data *data)
+{
+	struct io_log *log = data->log;
+	const bool shared = !log->td->o.per_job_logs;
+	int ret = 0;
+
+	if (shared)
+		fio_lock_file(log->filename);
+
+	if (!log->wb_file) {
+		const char *mode;
+
+		if (shared)
+			mode = log->log_binary ? "ab" : "a";
+		else
+			mode = log->log_binary ? "wb" : "w";
+
+		log->wb_file = fopen(log->filename, mode);
+		if (log->wb_file)
+			log->wb_file_buf = set_file_buffer(log->wb_file);
+		else if (!fio_did_warn(FIO_WARN_IOLOG_DROP))
+			log_err("fio: open log %s: %s\n", log->filename,
+				strerror(errno));
+	}
+
+	if (log->wb_file) {
+		log_flush_samples(log->wb_file, log->log_binary, data->samples,
+				  data->nr_samples * log_entry_sz(log));
+		if (shared)
+			fflush(log->wb_file);
+	} else
+		ret = 1;
+
+	if (shared)
+		fio_unlock_file(log->filename);
+
+	pthread_mutex_lock(&log->deferred_free_lock);
+	if (!log->wb_spare) {
+		log->wb_spare = data->samples;
+		data->samples = NULL;
+	}
+	pthread_mutex_unlock(&log->deferred_free_lock);
+
+	/*
+	 * If we are behind by more than a chunk, the job allocated new
+	 * buffers meanwhile. Don't hold on to those, the deferred list is
+	 * too short for that.
+	 */
+	if (data->samples)
+		mem_acct_add(log->td, MEM_IO_LOGS,
+			     -(int64_t) (data->nr_samples * log_entry_sz(log)));
+	free(data->samples);
+
+	if (data->free)
+		sfree(data);
+	return ret;
+}
+
+/*
+ * A buffer the size of the current chunk that was written out already, or
+ * NULL if the helper thread hasn't caught up.
+ */
+void *iolog_get_spare(struct io_log *log)
+{
+	void *ret;
+
+	pthread_mutex_lock(&log->deferred_free_lock);
+	ret = log->wb_spare;
+	log->wb_spare = NULL;
+	pthread_mutex_unlock(&log->deferred_free_lock);
+	return ret;
+}
+
+/*
+ * Wait for the chunks queued for write behind, and close the file. Returns
+ * true if the file was started, and the remaining samples should be
+ * appended to it.
+ */
+static bool iolog_write_behind_finish(struct io_log *log)
+{
+	bool started = false;
+
+	workqueue_flush(&log->td->log_compress_wq);
+
+	if (log->wb_file) {
+		fclose(log->wb_file);
+		clear_file_buffer(log->wb_file_buf);
+		log->wb_file = NULL;
+		started = true;
+	}
+
+	if (log->wb_spare)
+		mem_acct_add(log->td, MEM_IO_LOGS,
+			     -(int64_t) (log->cur_log_max * log_entry_sz(log)));
+	free(log->wb_spare);
+	log->wb_spare = NULL;
+	return started;
+}
+
 /*
  * Invoked from our compress helper thread, when logging would have exceeded
  * the specified memory limitation. Compresses the previously stored
@@ -1558,7 +3225,13 @@ err:
  */
 static int gz_work_async(struct submit_worker *sw, struct workqueue_work *work)
 {
-	return gz_work(container_of(work, struct iolog_flush_data, work));
+	struct iolog_flush_data *data;
+
+	data = container_of(work, struct iolog_flush_data, work);
+	if (data->log->write_behind)
+		return write_behind_work(data);
+
+	return gz_work(data);
 }
 
 static int gz_init_worker(struct submit_worker *sw)
@@ -1666,6 +3339,16 @@ static int iolog_flush(struct io_log *log)
 	return 1;
 }
 
+static bool iolog_write_behind_finish(struct io_log *log)
+{
+	return false;
+}
+
+void *iolog_get_spare(struct io_log *log)
+{
+	return NULL;
+}
+
 int iolog_cur_flush(struct io_log *log, struct io_logs *cur_log)
 {
 	return 1;
@@ -51,6 +51,49 @@ struct io_sample_offset {
 	uint64_t offset;
 };
 
+/* log_binary= values */
+enum {
+	LOG_BINARY_NONE		= 0,
+	LOG_BINARY_FIXED	= 1,
+	LOG_BINARY_COLUMNAR	= 2,
+};
+
+/* log_sample= values */
+enum {
+	LOG_SAMPLE_ALL		= 0,
+	LOG_SAMPLE_NTH,
+	LOG_SAMPLE_RESERVOIR,
+	LOG_SAMPLE_TAIL,
+};
+
+/*
+ * With log_binary=1, log files hold this header followed by fixed size
+ * io_binlog_sample records, all little endian. Logs of several jobs that
+ * share a file (per_job_logs=0) are appended without another header.
+ */
+#define FIO_BINLOG_MAGIC	"fiobinlg"
+#define FIO_BINLOG_VERSION	1
+
+enum {
+	FIO_BINLOG_F_OFFSET	= 1U << 0,
+	FIO_BINLOG_F_PRIO	= 1U << 1,
+};
+
+struct io_binlog_hdr {
+	uint8_t magic[8];
+	uint32_t version;
+	uint32_t flags;
+};
+
+struct io_binlog_sample {
+	uint64_t time;
+	uint64_t val;
+	uint64_t bs;
+	uint64_t offset;
+	uint32_t ddir;
+	uint32_t prio;
+};
+
 enum {
 	IO_LOG_TYPE_LAT = 1,
 	IO_LOG_TYPE_CLAT,
@@ -109,6 +152,11 @@ struct io_log {
 	 */
 	unsigned int log_prio;
 
+	/*
+	 * Write fixed size binary records instead of text
+	 */
+	unsigned int log_binary;
+
 	/*
 	 * Max size of log entries before a chunk is compressed
 	 */
@@ -119,6 +167,26 @@ struct io_log {
 	 */
 	unsigned int log_gz_store;
 
+	/*
+	 * Full chunks are written out by the log helper thread while the
+	 * job runs, to the file below. The last chunk it wrote out is kept
+	 * in wb_spare for reuse.
+	 */
+	unsigned int write_behind;
+	FILE *wb_file;
+	void *wb_file_buf;
+	void *wb_spare;
+
+	/*
+	 * Samples are stored in a file mapped one chunk at a time, see
+	 * iolog_mmap_next()
+	 */
+	unsigned int log_mmap;
+	int mmap_fd;
+	char *mmap_filename;
+	size_t mmap_len;
+	uint64_t mmap_windows;
+
 	/*
 	 * Windowed average, for logging single entries average over some
 	 * period of time.
@@ -144,6 +212,31 @@ struct io_log {
 #define IOLOG_MAX_DEFER	8
 	void *deferred_items[IOLOG_MAX_DEFER];
 	unsigned int deferred;
+
+	/*
+	 * Bandwidth and IOPS windows closed by the helper thread, for logs
+	 * that only the job may add samples to. The job picks them up when
+	 * ->td->log_win_pending is set, see drain_log_windows().
+	 */
+	pthread_mutex_t win_lock;
+	struct io_log_win *win;
+	unsigned int win_nr;
+	bool win_closed;
+
+	/*
+	 * Only keep some of the I/Os of a per I/O latency log, see
+	 * log_sample
+	 */
+	struct io_log_sampler *sampler;
+};
+
+#define IOLOG_WIN_NR	32
+
+struct io_log_win {
+	uint64_t val;
+	unsigned long time;
+	unsigned long long bs;
+	enum fio_ddir ddir;
 };
 
 /*
@@ -194,6 +287,7 @@ struct io_logs *iolog_cur_log(struct io_log *);
 uint64_t iolog_nr_samples(struct io_log *);
 void regrow_logs(struct thread_data *);
 void regrow_agg_logs(void);
+void drain_log_windows(struct thread_data *);
 
 static inline struct io_sample *get_sample(struct io_log *iolog,
 					   struct io_logs *cur_log,
@@ -207,6 +301,7 @@ enum {
 	IP_F_ONLIST	= 2,
 	IP_F_TRIMMED	= 4,
 	IP_F_IN_FLIGHT	= 8,
+	IP_F_PREPARSED	= 16,
 };
 
 /*
@@ -223,12 +318,60 @@ struct io_piece {
 		struct fio_file *file;
 	};
 	unsigned long long offset;
+	unsigned long long verify_offset;
 	unsigned short numberio;
 	unsigned long len;
 	unsigned int flags;
 	enum fio_ddir ddir;
 	unsigned long delay;
 	unsigned int file_action;
+	unsigned int depth;
+};
+
+/*
+ * Compiled iolog, written by fio --iolog-compile and mmap'ed for replay. The
+ * header is followed by nr_entries iolog_bin_entry records, and then by the
+ * names of the files the records refer to, each an le16 length followed by
+ * the name. All fields are little endian.
+ */
+#define FIO_IOLOG_BIN_MAGIC	"fioiolgb"
+#define FIO_IOLOG_BIN_VERSION	1
+
+struct iolog_bin_hdr {
+	uint8_t magic[8];
+	uint32_t version;
+	uint32_t iolog_version;
+	uint32_t nr_files;
+	uint32_t pad;
+	uint64_t nr_entries;
+	uint64_t names_off;
+};
+
+struct iolog_bin_entry {
+	uint64_t time;
+	uint64_t offset;
+	uint32_t len;
+	uint16_t fileno;
+	int8_t ddir;
+	uint8_t file_action;
+};
+
+/*
+ * How the entries of a replayed iolog are split between the clones of a job
+ */
+enum {
+	REPLAY_SHARD_NONE = 0,
+	REPLAY_SHARD_FILE,
+	REPLAY_SHARD_OFFSET,
+};
+
+/*
+ * Format of the log written by write_iolog. The binary format is the
+ * compiled iolog above, so it can be replayed as is.
+ */
+enum {
+	IOLOG_FORMAT_TEXT = 0,
+	IOLOG_FORMAT_BINARY,
 };
 
 /*
@@ -247,10 +390,15 @@ extern void log_io_u(const struct thread_data *, const struct io_u *);
 extern void log_file(struct thread_data *, struct fio_file *, enum file_log_act);
 extern bool __must_check init_iolog(struct thread_data *td);
 extern void log_io_piece(struct thread_data *, struct io_u *);
+extern void log_zone_append_piece(struct thread_data *, struct io_u *);
 extern void unlog_io_piece(struct thread_data *, struct io_u *);
 extern void trim_io_piece(const struct io_u *);
 extern void queue_io_piece(struct thread_data *, struct io_piece *);
 extern void prune_io_piece_log(struct thread_data *);
+extern void free_io_piece(struct thread_data *, struct io_piece *);
+extern void iolog_replay_exit(struct thread_data *);
+extern bool read_iolog_pending(struct thread_data *);
+extern int iolog_compile(const char *);
 extern void write_iolog_close(struct thread_data *);
 int64_t iolog_items_to_fetch(struct thread_data *td);
 extern int iolog_compress_init(struct thread_data *, struct sk_out *);
@@ -275,9 +423,12 @@ struct log_params {
 	int log_type;
 	int log_offset;
 	int log_prio;
+	int log_binary;
 	int log_gz;
 	int log_gz_store;
 	int log_compress;
+	int write_behind;
+	int log_mmap;
 };
 
 static inline bool per_unit_log(struct io_log *log)
@@ -285,6 +436,16 @@ static inline bool per_unit_log(struct io_log *log)
 	return log && (!log->avg_msec || log->log_gz || log->log_gz_store);
 }
 
+/*
+ * Windowed bandwidth and IOPS logs are normally written by the helper
+ * thread. Compressed logs have to be flushed by the job, so the helper
+ * only closes their windows and hands the samples over.
+ */
+static inline bool helper_window_log(struct io_log *log)
+{
+	return log && log->win;
+}
+
 static inline bool inline_log(struct io_log *log)
 {
 	return log->log_type == IO_LOG_TYPE_LAT ||
@@ -302,13 +463,21 @@ static inline void ipo_bytes_align(unsigned int replay_align, struct io_piece *i
 
 extern void finalize_logs(struct thread_data *td, bool);
 extern void setup_log(struct io_log **, struct log_params *, const char *);
+extern struct io_log_sampler *log_sampler_init(struct thread_data *, int);
+extern void log_sampler_free(struct io_log_sampler *);
 extern void flush_log(struct io_log *, bool);
 extern void flush_samples(FILE *, void *, uint64_t);
+extern void flush_samples_binary(FILE *, void *, uint64_t);
+extern void flush_samples_columnar(FILE *, void *, uint64_t);
+extern void flush_hist_samples_columnar(FILE *, int, void *, uint64_t, size_t,
+					bool);
 extern uint64_t hist_sum(int, int, uint64_t *, uint64_t *);
 extern void free_log(struct io_log *);
 extern void fio_writeout_logs(bool);
 extern void td_writeout_logs(struct thread_data *, bool);
 extern int iolog_cur_flush(struct io_log *, struct io_logs *);
+extern void *iolog_get_spare(struct io_log *);
+extern struct io_logs *iolog_mmap_next(struct io_log *, struct io_logs *);
 
 static inline void init_ipo(struct io_piece *ipo)
 {
@@ -2,6 +2,8 @@
 #include <string.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <stdio.h>
+#include <assert.h>
 #include "json.h"
 #include "log.h"
 
@@ -272,98 +274,182 @@ int json_array_add_value_type(struct json_array *array,
 	return 0;
 }
 
-static int json_value_level(struct json_value *value);
-static int json_pair_level(struct json_pair *pair);
-static int json_array_level(struct json_array *array);
-static int json_object_level(struct json_object *object)
+void json_stream_init(struct json_stream *js, struct buf_output *out)
 {
-	if (object->parent == NULL)
-		return 0;
-	return json_value_level(object->parent);
+	js->out = out;
+	js->len = 0;
+	js->depth = 0;
 }
 
-static int json_pair_level(struct json_pair *pair)
+void json_stream_flush(struct json_stream *js)
 {
-	return json_object_level(pair->parent) + 1;
+	if (!js->len)
+		return;
+
+	if (js->out)
+		buf_output_add(js->out, js->buf, js->len);
+	else
+		log_info_buf(js->buf, js->len);
+	js->len = 0;
 }
 
-static int json_array_level(struct json_array *array)
+static void json_stream_write(struct json_stream *js, const char *str,
+			      size_t len)
 {
-	return json_value_level(array->parent);
+	while (len) {
+		size_t this_len = sizeof(js->buf) - js->len;
+
+		if (this_len > len)
+			this_len = len;
+		memcpy(&js->buf[js->len], str, this_len);
+		js->len += this_len;
+		str += this_len;
+		len -= this_len;
+
+		if (js->len == sizeof(js->buf))
+			json_stream_flush(js);
+	}
 }
 
-static int json_value_level(struct json_value *value)
+static void json_stream_puts(struct json_stream *js, const char *str)
 {
-	if (value->parent_type == JSON_PARENT_TYPE_PAIR)
-		return json_pair_level(value->parent_pair);
-	else
-		return json_array_level(value->parent_array) + 1;
+	json_stream_write(js, str, strlen(str));
 }
 
-static void json_print_level(int level, struct buf_output *out)
+/*
+ * Start a new value in the current object or array: separator, indent
+ * and, inside an object, the name.
+ */
+static void json_stream_member(struct json_stream *js, const char *name)
 {
-	while (level-- > 0)
-		log_buf(out, "  ");
+	int i;
+
+	if (js->depth) {
+		if (!js->first[js->depth - 1])
+			json_stream_puts(js, ",\n");
+		js->first[js->depth - 1] = false;
+		for (i = 0; i < js->depth; i++)
+			json_stream_puts(js, "  ");
+	}
+
+	if (name) {
+		json_stream_puts(js, "\"");
+		json_stream_puts(js, name);
+		json_stream_puts(js, "\" : ");
+	}
 }
 
-static void json_print_pair(struct json_pair *pair, struct buf_output *);
-static void json_print_value(struct json_value *value, struct buf_output *);
+static void json_stream_open(struct json_stream *js, const char *name,
+			     const char *open)
+{
+	assert(js->depth < JSON_STREAM_DEPTH);
 
-void json_print_object(struct json_object *obj, struct buf_output *out)
+	json_stream_member(js, name);
+	json_stream_puts(js, open);
+	js->first[js->depth++] = true;
+}
+
+static void json_stream_close(struct json_stream *js, const char *close)
 {
 	int i;
 
-	log_buf(out, "{\n");
-	for (i = 0; i < obj->pair_cnt; i++) {
-		if (i > 0)
-			log_buf(out, ",\n");
-		json_print_pair(obj->pairs[i], out);
-	}
-	log_buf(out, "\n");
-	json_print_level(json_object_level(obj), out);
-	log_buf(out, "}");
+	assert(js->depth > 0);
+
+	js->depth--;
+	json_stream_puts(js, "\n");
+	for (i = 0; i < js->depth; i++)
+		json_stream_puts(js, "  ");
+	json_stream_puts(js, close);
 }
 
-static void json_print_pair(struct json_pair *pair, struct buf_output *out)
+void json_stream_object_start(struct json_stream *js, const char *name)
 {
-	json_print_level(json_pair_level(pair), out);
-	log_buf(out, "\"%s\" : ", pair->name);
-	json_print_value(pair->value, out);
+	json_stream_open(js, name, "{\n");
 }
 
-static void json_print_array(struct json_array *array, struct buf_output *out)
+void json_stream_object_end(struct json_stream *js)
 {
-	int i;
+	json_stream_close(js, "}");
+}
 
-	log_buf(out, "[\n");
-	for (i = 0; i < array->value_cnt; i++) {
-		if (i > 0)
-			log_buf(out, ",\n");
-		json_print_level(json_value_level(array->values[i]), out);
-		json_print_value(array->values[i], out);
-	}
-	log_buf(out, "\n");
-	json_print_level(json_array_level(array), out);
-	log_buf(out, "]");
+void json_stream_array_start(struct json_stream *js, const char *name)
+{
+	json_stream_open(js, name, "[\n");
+}
+
+void json_stream_array_end(struct json_stream *js)
+{
+	json_stream_close(js, "]");
 }
 
-static void json_print_value(struct json_value *value, struct buf_output *out)
+static void json_stream_value(struct json_stream *js, const char *name,
+			      struct json_value *value)
 {
+	char tmp[512];
+	int i;
+
 	switch (value->type) {
 	case JSON_TYPE_STRING:
-		log_buf(out, "\"%s\"", value->string);
+		json_stream_member(js, name);
+		json_stream_puts(js, "\"");
+		json_stream_puts(js, value->string);
+		json_stream_puts(js, "\"");
 		break;
 	case JSON_TYPE_INTEGER:
-		log_buf(out, "%lld", value->integer_number);
+		json_stream_member(js, name);
+		snprintf(tmp, sizeof(tmp), "%lld", value->integer_number);
+		json_stream_puts(js, tmp);
 		break;
 	case JSON_TYPE_FLOAT:
-		log_buf(out, "%f", value->float_number);
+		json_stream_member(js, name);
+		snprintf(tmp, sizeof(tmp), "%f", value->float_number);
+		json_stream_puts(js, tmp);
 		break;
 	case JSON_TYPE_OBJECT:
-		json_print_object(value->object, out);
+		json_stream_add_object(js, name, value->object);
 		break;
 	case JSON_TYPE_ARRAY:
-		json_print_array(value->array, out);
+		json_stream_array_start(js, name);
+		for (i = 0; i < value->array->value_cnt; i++)
+			json_stream_value(js, NULL, value->array->values[i]);
+		json_stream_array_end(js);
 		break;
 	}
 }
+
+void json_stream_add_pairs(struct json_stream *js, struct json_object *obj)
+{
+	int i;
+
+	for (i = 0; i < obj->pair_cnt; i++)
+		json_stream_value(js, obj->pairs[i]->name,
+					obj->pairs[i]->value);
+}
+
+void json_stream_add_object(struct json_stream *js, const char *name,
+			    struct json_object *obj)
+{
+	json_stream_object_start(js, name);
+	json_stream_add_pairs(js, obj);
+	json_stream_object_end(js);
+}
+
+void json_stream_finish(struct json_stream *js)
+{
+	json_stream_puts(js, "\n");
+	json_stream_flush(js);
+}
+
+void json_print_object(struct json_object *obj, struct buf_output *out)
+{
+	struct json_stream *js;
+
+	js = malloc(sizeof(*js));
+	if (!js)
+		return;
+
+	json_stream_init(js, out);
+	json_stream_add_object(js, NULL, obj);
+	json_stream_flush(js);
+	free(js);
+}
@@ -1,6 +1,8 @@
 #ifndef __JSON__H
 #define __JSON__H
 
+#include <stdbool.h>
+
 #include "lib/output_buffer.h"
 
 #define JSON_TYPE_STRING 0
@@ -177,4 +179,32 @@ static inline int json_array_add_value_array(struct json_array *obj,
 	(obj->values[obj->value_cnt - 1]->object)
 
 void json_print_object(struct json_object *obj, struct buf_output *out);
+
+#define JSON_STREAM_BUF		16384
+#define JSON_STREAM_DEPTH	32
+
+/*
+ * Writes JSON as it is generated, through a fixed size buffer, so large
+ * output never has to exist as a single json_object tree or string. Goes
+ * to 'out' if set, or straight to the output file otherwise. Formatting
+ * matches json_print_object().
+ */
+struct json_stream {
+	struct buf_output *out;
+	size_t len;
+	int depth;
+	bool first[JSON_STREAM_DEPTH];
+	char buf[JSON_STREAM_BUF];
+};
+
+void json_stream_init(struct json_stream *js, struct buf_output *out);
+void json_stream_flush(struct json_stream *js);
+void json_stream_finish(struct json_stream *js);
+void json_stream_object_start(struct json_stream *js, const char *name);
+void json_stream_object_end(struct json_stream *js);
+void json_stream_array_start(struct json_stream *js, const char *name);
+void json_stream_array_end(struct json_stream *js);
+void json_stream_add_object(struct json_stream *js, const char *name,
+			    struct json_object *obj);
+void json_stream_add_pairs(struct json_stream *js, struct json_object *obj);
 #endif
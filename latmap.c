@@ -0,0 +1,202 @@
+/*
+ * Per offset region latency histograms, see latmap.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "fio.h"
+#include "latmap.h"
+#include "verify.h"
+
+static void latmap_free(struct lat_heatmap *lm)
+{
+	for_each_rw_ddir(ddir)
+		free(lm->regions[ddir]);
+	free(lm);
+}
+
+int latmap_init(struct thread_data *td)
+{
+	struct thread_options *o = &td->o;
+	uint64_t start = -1ULL, end = 0;
+	bool used[DDIR_RWDIR_CNT];
+	struct lat_heatmap *lm;
+	struct fio_file *f;
+	unsigned int i;
+
+	if (!o->lat_heatmap)
+		return 0;
+
+	for_each_file(td, f, i) {
+		if (f->io_size == -1ULL)
+			continue;
+		start = min(start, f->file_offset);
+		end = max(end, f->file_offset + f->io_size);
+	}
+	if (start >= end) {
+		start = 0;
+		end = o->size;
+	}
+
+	lm = calloc(1, sizeof(*lm));
+	if (!lm)
+		goto err;
+
+	lm->start = start;
+	lm->nr_regions = o->lat_heatmap;
+	lm->region_size = (end - start + lm->nr_regions - 1) / lm->nr_regions;
+	if (!lm->region_size)
+		lm->region_size = 1;
+
+	/* verify and trim_percentage read and trim from any job */
+	used[DDIR_READ] = td_read(td) || o->verify != VERIFY_NONE;
+	used[DDIR_WRITE] = td_write(td);
+	used[DDIR_TRIM] = td_trim(td) || o->trim_percentage;
+
+	for_each_rw_ddir(ddir) {
+		if (!used[ddir])
+			continue;
+		lm->regions[ddir] = calloc(lm->nr_regions,
+					   sizeof(struct latmap_region));
+		if (!lm->regions[ddir]) {
+			latmap_free(lm);
+			goto err;
+		}
+		mem_acct_add(td, MEM_STATS,
+			     lm->nr_regions * sizeof(struct latmap_region));
+	}
+
+	dprint(FD_IO, "latmap: %u regions of %llu from %llu\n",
+		lm->nr_regions, (unsigned long long) lm->region_size,
+		(unsigned long long) lm->start);
+	td->latmap = lm;
+	return 0;
+err:
+	td_verror(td, ENOMEM, "latmap_init");
+	return 1;
+}
+
+static uint64_t bin_start(unsigned int bin)
+{
+	unsigned int msb, sub;
+
+	if (!bin)
+		return 0;
+
+	msb = LATMAP_MIN_SHIFT + ((bin - 1) >> LATMAP_SUB_BITS);
+	sub = (bin - 1) & ((1U << LATMAP_SUB_BITS) - 1);
+	return (uint64_t) ((1U << LATMAP_SUB_BITS) + sub) <<
+		(msb - LATMAP_SUB_BITS);
+}
+
+/*
+ * Latency under which 'pct' percent of the 'ios' counted in bins
+ * completed, as the upper edge of the bin it falls in
+ */
+uint64_t latmap_pct(const uint32_t *bins, uint64_t ios, uint64_t max_nsec,
+		    double pct)
+{
+	uint64_t want = ceil(ios * pct / 100.0), seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < LATMAP_BINS - 1; i++) {
+		seen += bins[i];
+		if (seen >= want)
+			return min(bin_start(i + 1), max_nsec);
+	}
+
+	return max_nsec;
+}
+
+static void write_regions(FILE *fp, const struct lat_heatmap *lm,
+			  const struct latmap_region *regions)
+{
+	const char *sep = "";
+	unsigned int i, j;
+
+	fprintf(fp, "[");
+	for (i = 0; i < lm->nr_regions; i++) {
+		const struct latmap_region *r = &regions[i];
+		const char *bsep = "";
+
+		if (!r->ios)
+			continue;
+
+		fprintf(fp, "%s\n    {\"region\": %u, \"ios\": %llu, "
+			"\"mean_nsec\": %llu, \"max_nsec\": %llu, "
+			"\"p50_nsec\": %llu, \"p99_nsec\": %llu, \"bins\": [",
+			sep, i, (unsigned long long) r->ios,
+			(unsigned long long) (r->sum_nsec / r->ios),
+			(unsigned long long) r->max_nsec,
+			(unsigned long long) latmap_pct(r->bins, r->ios,
+							r->max_nsec, 50.0),
+			(unsigned long long) latmap_pct(r->bins, r->ios,
+							r->max_nsec, 99.0));
+		for (j = 0; j < LATMAP_BINS; j++) {
+			if (!r->bins[j])
+				continue;
+			fprintf(fp, "%s[%u, %u]", bsep, j, r->bins[j]);
+			bsep = ", ";
+		}
+		fprintf(fp, "]}");
+		sep = ",";
+	}
+	fprintf(fp, "\n  ]");
+}
+
+/*
+ * Only the regions that saw IO are listed, each with the bins that
+ * counted any, as [bin, count] pairs indexing bin_start_nsec.
+ */
+static int write_latmap(struct thread_data *td, const struct lat_heatmap *lm)
+{
+	char name[PATH_MAX];
+	unsigned int i;
+	FILE *fp;
+
+	snprintf(name, sizeof(name), "%s_latmap.%d.json", td->o.name,
+		 td->thread_number);
+	fp = fopen(name, "w");
+	if (!fp) {
+		log_err("fio: latmap %s: %s\n", name, strerror(errno));
+		return 1;
+	}
+
+	fprintf(fp, "{\n  \"jobname\": \"%s\",\n  \"offset\": %llu,\n"
+		"  \"region_size\": %llu,\n  \"regions\": %u,\n"
+		"  \"bin_start_nsec\": [", td->o.name,
+		(unsigned long long) lm->start,
+		(unsigned long long) lm->region_size, lm->nr_regions);
+	for (i = 0; i < LATMAP_BINS; i++)
+		fprintf(fp, "%s%llu", i ? ", " : "",
+			(unsigned long long) bin_start(i));
+	fprintf(fp, "]");
+
+	for_each_rw_ddir(ddir) {
+		if (!lm->regions[ddir])
+			continue;
+		fprintf(fp, ",\n  \"%s\": ", io_ddir_name(ddir));
+		write_regions(fp, lm, lm->regions[ddir]);
+	}
+	fprintf(fp, "\n}\n");
+
+	if (fclose(fp)) {
+		log_err("fio: latmap %s: %s\n", name, strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+void latmap_exit(struct thread_data *td)
+{
+	struct lat_heatmap *lm = td->latmap;
+
+	if (!lm)
+		return;
+
+	write_latmap(td, lm);
+	latmap_free(lm);
+	td->latmap = NULL;
+}
@@ -0,0 +1,80 @@
+#ifndef FIO_LATMAP_H
+#define FIO_LATMAP_H
+
+#include <stdint.h>
+
+#include "io_ddir.h"
+
+struct thread_data;
+
+/*
+ * lat_heatmap=N splits the offset range of a job into N regions and keeps
+ * a small completion latency histogram per region and data direction, so
+ * a slow band of the device shows up without logging every IO. The bins
+ * are log-linear, four per power of two from 256ns to 2^36ns, so each is
+ * within 25% of the latencies it counts. The map is written out as JSON
+ * when the job ends.
+ */
+#define LATMAP_MIN_SHIFT	8
+#define LATMAP_MAX_SHIFT	36
+#define LATMAP_SUB_BITS		2
+#define LATMAP_BINS		\
+	(1 + ((LATMAP_MAX_SHIFT - LATMAP_MIN_SHIFT) << LATMAP_SUB_BITS))
+
+struct latmap_region {
+	uint64_t ios;
+	uint64_t sum_nsec;
+	uint64_t max_nsec;
+	uint32_t bins[LATMAP_BINS];
+};
+
+struct lat_heatmap {
+	uint64_t start;
+	uint64_t region_size;
+	unsigned int nr_regions;
+	struct latmap_region *regions[DDIR_RWDIR_CNT];
+};
+
+extern int latmap_init(struct thread_data *);
+extern void latmap_exit(struct thread_data *);
+extern uint64_t latmap_pct(const uint32_t *, uint64_t, uint64_t, double);
+
+static inline unsigned int latmap_bin(unsigned long long nsec)
+{
+	unsigned int msb;
+
+	if (nsec < (1ULL << LATMAP_MIN_SHIFT))
+		return 0;
+
+	msb = 63 - __builtin_clzll(nsec);
+	if (msb >= LATMAP_MAX_SHIFT)
+		return LATMAP_BINS - 1;
+
+	return 1 + ((msb - LATMAP_MIN_SHIFT) << LATMAP_SUB_BITS) +
+		((nsec >> (msb - LATMAP_SUB_BITS)) &
+		 ((1U << LATMAP_SUB_BITS) - 1));
+}
+
+static inline void latmap_add(struct lat_heatmap *lm, enum fio_ddir ddir,
+			      uint64_t offset, unsigned long long nsec)
+{
+	struct latmap_region *r;
+	uint64_t idx = 0;
+
+	if (!lm || !lm->regions[ddir])
+		return;
+
+	if (offset > lm->start)
+		idx = (offset - lm->start) / lm->region_size;
+	if (idx >= lm->nr_regions)
+		idx = lm->nr_regions - 1;
+
+	r = &lm->regions[ddir][idx];
+	r->ios++;
+	r->sum_nsec += nsec;
+	if (nsec > r->max_nsec)
+		r->max_nsec = nsec;
+	r->bins[latmap_bin(nsec)]++;
+}
+
+#endif
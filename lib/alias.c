@@ -0,0 +1,123 @@
+/*
+ * Walker alias table over a set of integer weights. Built once in O(n),
+ * after which picking an entry with probability weight / total is O(1)
+ * with a single random draw: the draw selects a column and a coin value,
+ * and the coin decides between the column and its alias. All of it is
+ * integer math, so the distribution is exact.
+ */
+#include <stdlib.h>
+
+#include "alias.h"
+#include "rand.h"
+
+struct alias_table {
+	unsigned int nr;
+	uint64_t total;
+	uint64_t *prob;		/* scaled by nr, compared against total */
+	unsigned int *alias;
+};
+
+struct alias_table *alias_table_new(const uint64_t *weights, unsigned int nr)
+{
+	unsigned int *small, *large, nr_small, nr_large, i;
+	struct alias_table *at;
+
+	if (!nr)
+		return NULL;
+
+	at = calloc(1, sizeof(*at));
+	if (!at)
+		return NULL;
+
+	at->nr = nr;
+	at->prob = malloc(nr * sizeof(*at->prob));
+	at->alias = malloc(nr * sizeof(*at->alias));
+	small = malloc(2 * nr * sizeof(*small));
+	if (!at->prob || !at->alias || !small) {
+		free(small);
+		alias_table_free(at);
+		return NULL;
+	}
+	large = small + nr;
+
+	for (i = 0; i < nr; i++)
+		at->total += weights[i];
+
+	nr_small = nr_large = 0;
+	for (i = 0; i < nr; i++) {
+		at->prob[i] = weights[i] * nr;
+		at->alias[i] = i;
+		if (at->prob[i] < at->total)
+			small[nr_small++] = i;
+		else
+			large[nr_large++] = i;
+	}
+
+	/*
+	 * Top up each short column from a tall one, which then becomes the
+	 * short column's alias
+	 */
+	while (nr_small && nr_large) {
+		unsigned int s = small[--nr_small];
+		unsigned int l = large[nr_large - 1];
+
+		at->alias[s] = l;
+		at->prob[l] -= at->total - at->prob[s];
+		if (at->prob[l] < at->total) {
+			nr_large--;
+			small[nr_small++] = l;
+		}
+	}
+
+	/* whatever is left is exactly full */
+	while (nr_large)
+		at->prob[large[--nr_large]] = at->total;
+	while (nr_small)
+		at->prob[small[--nr_small]] = at->total;
+
+	free(small);
+	return at;
+}
+
+void alias_table_free(struct alias_table *at)
+{
+	if (!at)
+		return;
+
+	free(at->prob);
+	free(at->alias);
+	free(at);
+}
+
+static unsigned int alias_table_pick(struct alias_table *at, uint64_t r)
+{
+	unsigned int col;
+
+	col = r / at->total;
+	if (r % at->total < at->prob[col])
+		return col;
+
+	return at->alias[col];
+}
+
+unsigned int alias_table_next(struct alias_table *at, struct frand_state *fs)
+{
+	if (!at->total)
+		return 0;
+
+	return alias_table_pick(at, rand_between(fs, 0, at->nr * at->total - 1));
+}
+
+/*
+ * alias_table_next() for a generator that is drawn through a batch
+ */
+unsigned int alias_table_next_batch(struct alias_table *at,
+				    struct frand_batch *b,
+				    struct frand_state *fs)
+{
+	if (!at->total)
+		return 0;
+
+	return alias_table_pick(at, frand_batch_between(b, fs, 0,
+						at->nr * at->total - 1));
+}
@@ -0,0 +1,18 @@
+#ifndef FIO_ALIAS_H
+#define FIO_ALIAS_H
+
+#include <inttypes.h>
+
+struct frand_state;
+struct frand_batch;
+
+struct alias_table;
+struct alias_table *alias_table_new(const uint64_t *weights, unsigned int nr);
+void alias_table_free(struct alias_table *at);
+
+unsigned int alias_table_next(struct alias_table *at, struct frand_state *fs);
+unsigned int alias_table_next_batch(struct alias_table *at,
+				    struct frand_batch *b,
+				    struct frand_state *fs);
+
+#endif
@@ -109,6 +109,22 @@ void axmap_free(struct axmap *axmap)
 	free(axmap);
 }
 
+/* Bytes allocated for @axmap. */
+size_t axmap_size(struct axmap *axmap)
+{
+	size_t size;
+	unsigned int i;
+
+	if (!axmap)
+		return 0;
+
+	size = sizeof(*axmap) + axmap->nr_levels * sizeof(struct axmap_level);
+	for (i = 0; i < axmap->nr_levels; i++)
+		size += axmap->levels[i].map_size * sizeof(unsigned long);
+
+	return size;
+}
+
 /* Allocate memory for a set that can store the numbers 0 .. @nr_bits - 1. */
 struct axmap *axmap_new(uint64_t nr_bits)
 {
@@ -188,28 +204,6 @@ static bool axmap_handler(struct axmap *axmap, uint64_t bit_nr,
 	return false;
 }
 
-/*
- * Call @func for each level, starting at the highest level, until a level is
- * found for which @func returns true. Return false if none of the @func calls
- * returns true.
- */
-static bool axmap_handler_topdown(struct axmap *axmap, uint64_t bit_nr,
-	bool (*func)(struct axmap_level *, uint64_t, unsigned int, void *))
-{
-	int i;
-
-	for (i = axmap->nr_levels - 1; i >= 0; i--) {
-		uint64_t index = bit_nr >> (UNIT_SHIFT * i);
-		unsigned long offset = index >> UNIT_SHIFT;
-		unsigned int bit = index & BLOCKS_PER_UNIT_MASK;
-
-		if (func(&axmap->levels[i], offset, bit, NULL))
-			return true;
-	}
-
-	return false;
-}
-
 struct axmap_set_data {
 	unsigned int nr_bits;
 	unsigned int set_bits;
@@ -322,81 +316,90 @@ unsigned int axmap_set_nr(struct axmap *axmap, uint64_t bit_nr,
 	return set_bits;
 }
 
-static bool axmap_isset_fn(struct axmap_level *al, uint64_t offset,
-			   unsigned int bit, void *unused)
-{
-	return (al->map[offset] & (1ULL << bit)) != 0;
-}
-
+/*
+ * Walk top down, a full word at a higher level answers without touching
+ * the much larger levels below. This runs for every random offset, so
+ * the levels are walked inline rather than through a handler.
+ */
 bool axmap_isset(struct axmap *axmap, uint64_t bit_nr)
 {
-	if (bit_nr <= axmap->nr_bits)
-		return axmap_handler_topdown(axmap, bit_nr, axmap_isset_fn);
+	int i;
+
+	if (bit_nr > axmap->nr_bits)
+		return false;
+
+	for (i = axmap->nr_levels - 1; i >= 0; i--) {
+		uint64_t index = bit_nr >> (UNIT_SHIFT * i);
+		unsigned long offset = index >> UNIT_SHIFT;
+		unsigned int bit = index & BLOCKS_PER_UNIT_MASK;
+
+		if (axmap->levels[i].map[offset] & (1UL << bit))
+			return true;
+	}
 
 	return false;
 }
 
 /*
- * Find the first free bit that is at least as large as bit_nr.  Return
- * -1 if no free bit is found before the end of the map.
+ * Find the first free bit that is at least as large as bit_nr. Return -1
+ * if no free bit is found before the end of the map.
+ *
+ * A set bit at level N + 1 means the word at level N is full, so walk up
+ * from level 0 until a level has a free bit at or after the start
+ * position, then back down through the first free bit of each level. That
+ * touches two words per level at most, rather than scanning along a
+ * level that is close to full.
  */
 static uint64_t axmap_find_first_free(struct axmap *axmap, uint64_t bit_nr)
 {
-	int i;
-	unsigned long temp;
-	unsigned int bit;
-	uint64_t offset, base_index, index;
 	struct axmap_level *al;
+	unsigned long temp;
+	uint64_t index = bit_nr, offset = 0;
+	int i = 0;
 
-	index = 0;
-	for (i = axmap->nr_levels - 1; i >= 0; i--) {
+up:
+	for (; i < axmap->nr_levels; i++) {
 		al = &axmap->levels[i];
+		offset = index >> UNIT_SHIFT;
+		if (offset >= al->map_size)
+			return -1ULL;
 
-		/* Shift previously calculated index for next level */
-		index <<= UNIT_SHIFT;
+		temp = ~bit_masks[index & BLOCKS_PER_UNIT_MASK] & ~al->map[offset];
+		if (temp)
+			break;
 
-		/*
-		 * Start from an index that's at least as large as the
-		 * originally passed in bit number.
-		 */
-		base_index = bit_nr >> (UNIT_SHIFT * i);
-		if (index < base_index)
-			index = base_index;
+		/* bit 'offset + 1' at the next level is the next word here */
+		index = offset + 1;
+	}
 
-		/* Get the offset and bit for this level */
-		offset = index >> UNIT_SHIFT;
-		bit = index & BLOCKS_PER_UNIT_MASK;
+	if (i == axmap->nr_levels)
+		return -1ULL;
+
+	index = (offset << UNIT_SHIFT) + ffz(~temp);
+
+	while (i--) {
+		al = &axmap->levels[i];
 
 		/*
-		 * If the previous level had unused bits in its last
-		 * word, the offset could be bigger than the map at
-		 * this level. That means no free bits exist before the
-		 * end of the map, so return -1.
+		 * An unused trailing bit of the level above, there is nothing
+		 * past the end of this level
 		 */
-		if (offset >= al->map_size)
+		if (index >= al->map_size)
 			return -1ULL;
 
-		/* Check the first word starting with the specific bit */
-		temp = ~bit_masks[bit] & ~al->map[offset];
-		if (temp)
-			goto found;
+		temp = ~al->map[index];
 
 		/*
-		 * No free bit in the first word, so iterate
-		 * looking for a word with one or more free bits.
+		 * A shared map can have a full word that is not marked full
+		 * in the level above yet, continue after it.
 		 */
-		for (offset++; offset < al->map_size; offset++) {
-			temp = ~al->map[offset];
-			if (temp)
-				goto found;
+		if (!temp) {
+			i++;
+			index++;
+			goto up;
 		}
 
-		/* Did not find a free bit */
-		return -1ULL;
-
-found:
-		/* Compute the index of the free bit just found */
-		index = (offset << UNIT_SHIFT) + ffz(~temp);
+		index = (index << UNIT_SHIFT) + ffz(~temp);
 	}
 
 	/* If found an unused bit in the last word of level 0, return -1 */
@@ -452,3 +455,101 @@ uint64_t axmap_next_free(struct axmap *axmap, uint64_t bit_nr)
 		ret = axmap_find_first_free(axmap, 0);
 	return ret;
 }
+
+/*
+ * Remove @bit_nr from the @axmap set. The words above it are no longer full,
+ * so clear its bit in every level.
+ */
+void axmap_clear(struct axmap *axmap, uint64_t bit_nr)
+{
+	int i;
+
+	if (bit_nr >= axmap->nr_bits)
+		return;
+
+	for (i = 0; i < axmap->nr_levels; i++) {
+		struct axmap_level *al = &axmap->levels[i];
+		unsigned long offset = bit_nr >> UNIT_SHIFT;
+		unsigned int bit = bit_nr & BLOCKS_PER_UNIT_MASK;
+
+		al->map[offset] &= ~(1UL << bit);
+		bit_nr = offset;
+	}
+}
+
+/*
+ * Find the first set bit that is at least as large as bit_nr. Return -1 if
+ * no bit is set before the end of the map. The upper levels only track full
+ * words, so this walks level 0.
+ */
+uint64_t axmap_next_set(struct axmap *axmap, uint64_t bit_nr)
+{
+	struct axmap_level *al = &axmap->levels[0];
+	unsigned long temp;
+	uint64_t offset;
+
+	if (bit_nr >= axmap->nr_bits)
+		return -1ULL;
+
+	offset = bit_nr >> UNIT_SHIFT;
+	temp = al->map[offset] & ~bit_masks[bit_nr & BLOCKS_PER_UNIT_MASK];
+	while (!temp) {
+		if (++offset >= al->map_size)
+			return -1ULL;
+		temp = al->map[offset];
+	}
+
+	bit_nr = (offset << UNIT_SHIFT) + ffz(~temp);
+	if (bit_nr >= axmap->nr_bits)
+		return -1ULL;
+
+	return bit_nr;
+}
+
+/*
+ * Set @bit_nr in an axmap that is shared between threads. Returns false if
+ * the bit was already set, by us or by another thread. Only the level 0
+ * bit decides who owns it. The bits for full words above it are set after
+ * it, so the other helpers may briefly see a full word that is not marked
+ * full yet, which only costs them a longer search.
+ */
+bool axmap_claim(struct axmap *axmap, uint64_t bit_nr)
+{
+	unsigned long mask, old;
+	int i;
+
+	if (bit_nr >= axmap->nr_bits)
+		return false;
+
+	for (i = 0; i < axmap->nr_levels; i++) {
+		struct axmap_level *al = &axmap->levels[i];
+		unsigned long offset = bit_nr >> UNIT_SHIFT;
+
+		mask = 1UL << (bit_nr & BLOCKS_PER_UNIT_MASK);
+		old = __atomic_fetch_or(&al->map[offset], mask, __ATOMIC_ACQ_REL);
+		if (!i && (old & mask))
+			return false;
+		if ((old | mask) != -1UL)
+			break;
+		bit_nr = offset;
+	}
+
+	return true;
+}
+
+/*
+ * Shared map version of axmap_set_nr(): claim up to @nr_bits from @bit_nr,
+ * stopping at the first bit that is already set. Returns the number of
+ * bits claimed.
+ */
+unsigned int axmap_claim_nr(struct axmap *axmap, uint64_t bit_nr,
+			    unsigned int nr_bits)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_bits; i++)
+		if (!axmap_claim(axmap, bit_nr + i))
+			break;
+
+	return i;
+}
@@ -7,11 +7,16 @@
 struct axmap;
 struct axmap *axmap_new(uint64_t nr_bits);
 void axmap_free(struct axmap *bm);
+size_t axmap_size(struct axmap *axmap);
 
 void axmap_set(struct axmap *axmap, uint64_t bit_nr);
 unsigned int axmap_set_nr(struct axmap *axmap, uint64_t bit_nr, unsigned int nr_bits);
 bool axmap_isset(struct axmap *axmap, uint64_t bit_nr);
 uint64_t axmap_next_free(struct axmap *axmap, uint64_t bit_nr);
+void axmap_clear(struct axmap *axmap, uint64_t bit_nr);
+uint64_t axmap_next_set(struct axmap *axmap, uint64_t bit_nr);
+bool axmap_claim(struct axmap *axmap, uint64_t bit_nr);
+unsigned int axmap_claim_nr(struct axmap *axmap, uint64_t bit_nr, unsigned int nr_bits);
 void axmap_reset(struct axmap *axmap);
 
 #endif
@@ -1,11 +1,9 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "bloom.h"
 #include "../hash.h"
-#include "../crc/xxhash.h"
-#include "../crc/murmur3.h"
 #include "../crc/crc32c.h"
-#include "../crc/fnv.h"
 
 struct bloom {
 	uint64_t nentries;
@@ -16,47 +14,37 @@ struct bloom {
 #define BITS_PER_INDEX	(sizeof(uint32_t) * 8)
 #define BITS_INDEX_MASK	(BITS_PER_INDEX - 1)
 
-struct bloom_hash {
-	unsigned int seed;
-	uint32_t (*fn)(const void *, uint32_t, uint32_t);
-};
+#define BLOOM_SEED	0x8989
+#define N_HASHES	5
 
-static uint32_t bloom_crc32c(const void *buf, uint32_t len, uint32_t seed)
+static inline uint64_t bloom_mix(uint64_t x)
 {
-	return fio_crc32c(buf, len);
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
 }
 
-static uint32_t bloom_fnv(const void *buf, uint32_t len, uint32_t seed)
+/*
+ * A crc32c of the key, done in hardware where the CPU can, together with
+ * the last 8 bytes of the key make up a 64-bit hash. The probes are
+ * derived from that by double hashing, probe i being h1 + i * h2, rather
+ * than from a different hash function run over the key for each one.
+ */
+static void bloom_hash(const void *data, unsigned int len, uint64_t *h1,
+		       uint64_t *h2)
 {
-	return fnv(buf, len, seed);
-}
+	unsigned int tlen = len < sizeof(uint64_t) ? len : sizeof(uint64_t);
+	uint64_t tail = 0, x;
 
-#define BLOOM_SEED	0x8989
+	memcpy(&tail, (const char *) data + len - tlen, tlen);
+	x = ((uint64_t) fio_crc32c(data, len) << 32) ^ tail ^ len;
 
-static struct bloom_hash hashes[] = {
-	{
-		.seed = BLOOM_SEED,
-		.fn = jhash,
-	},
-	{
-		.seed = BLOOM_SEED,
-		.fn = XXH32,
-	},
-	{
-		.seed = BLOOM_SEED,
-		.fn = murmurhash3,
-	},
-	{
-		.seed = BLOOM_SEED,
-		.fn = bloom_crc32c,
-	},
-	{
-		.seed = BLOOM_SEED,
-		.fn = bloom_fnv,
-	},
-};
-
-#define N_HASHES	5
+	*h1 = bloom_mix(x ^ BLOOM_SEED);
+	*h2 = bloom_mix(x + GOLDEN_RATIO_64) | 1;
+}
 
 struct bloom *bloom_new(uint64_t entries)
 {
@@ -87,18 +75,16 @@ void bloom_free(struct bloom *b)
 static bool __bloom_check(struct bloom *b, const void *data, unsigned int len,
 			  bool set)
 {
-	uint32_t hash[N_HASHES];
+	uint64_t h1, h2;
 	int i, was_set;
 
-	for (i = 0; i < N_HASHES; i++) {
-		hash[i] = hashes[i].fn(data, len, hashes[i].seed);
-		hash[i] = hash[i] % b->nentries;
-	}
+	bloom_hash(data, len, &h1, &h2);
 
 	was_set = 0;
 	for (i = 0; i < N_HASHES; i++) {
-		const unsigned int index = hash[i] / BITS_PER_INDEX;
-		const unsigned int bit = hash[i] & BITS_INDEX_MASK;
+		const uint64_t hash = (h1 + i * h2) % b->nentries;
+		const uint64_t index = hash / BITS_PER_INDEX;
+		const unsigned int bit = hash & BITS_INDEX_MASK;
 
 		if (b->map[index] & (1U << bit))
 			was_set++;
@@ -0,0 +1,298 @@
+/*
+ * Writer for fio's columnar result format, see columnar.h
+ */
+#include <stdlib.h>
+#include <string.h>
+#ifdef CONFIG_ZLIB
+#include <zlib.h>
+#endif
+
+#include "columnar.h"
+
+#define COL_TMP_LEN	4096
+
+struct col_batch {
+	char *table;
+	uint64_t rows;
+	uint32_t cols;
+	int compress;
+	struct buf_output data;
+};
+
+/*
+ * Encoded bytes are gathered here before going to the output buffer, so
+ * it isn't grown a byte at a time.
+ */
+struct col_tmp {
+	struct buf_output *out;
+	unsigned int len;
+	uint8_t buf[COL_TMP_LEN];
+};
+
+static void tmp_flush(struct col_tmp *t)
+{
+	buf_output_add(t->out, (const char *) t->buf, t->len);
+	t->len = 0;
+}
+
+static void tmp_put(struct col_tmp *t, const void *data, size_t len)
+{
+	if (t->len + len > sizeof(t->buf))
+		tmp_flush(t);
+	if (len > sizeof(t->buf)) {
+		buf_output_add(t->out, data, len);
+		return;
+	}
+	memcpy(&t->buf[t->len], data, len);
+	t->len += len;
+}
+
+static void tmp_varint(struct col_tmp *t, uint64_t val)
+{
+	if (t->len + 10 > sizeof(t->buf))
+		tmp_flush(t);
+
+	while (val >= 0x80) {
+		t->buf[t->len++] = (val & 0x7f) | 0x80;
+		val >>= 7;
+	}
+	t->buf[t->len++] = val;
+}
+
+static void tmp_le(struct col_tmp *t, uint64_t val, unsigned int bytes)
+{
+	uint8_t le[8];
+	unsigned int i;
+
+	for (i = 0; i < bytes; i++) {
+		le[i] = val & 0xff;
+		val >>= 8;
+	}
+	tmp_put(t, le, bytes);
+}
+
+static void tmp_name(struct col_tmp *t, const char *name)
+{
+	size_t len = strlen(name);
+
+	if (len > UINT16_MAX)
+		len = UINT16_MAX;
+	tmp_le(t, len, 2);
+	tmp_put(t, name, len);
+}
+
+static inline uint64_t zigzag(int64_t val)
+{
+	return ((uint64_t) val << 1) ^ (uint64_t) (val >> 63);
+}
+
+void col_file_header(struct buf_output *out)
+{
+	struct col_tmp t = { .out = out, };
+
+	tmp_put(&t, FIO_COLUMNAR_MAGIC, 8);
+	tmp_le(&t, FIO_COLUMNAR_VERSION, 4);
+	tmp_le(&t, 0, 4);
+	tmp_flush(&t);
+}
+
+struct col_batch *col_batch_new(const char *table, uint64_t rows)
+{
+	struct col_batch *b;
+
+	b = calloc(1, sizeof(*b));
+	if (!b)
+		return NULL;
+
+	b->table = strdup(table);
+	b->rows = rows;
+	buf_output_init(&b->data);
+	return b;
+}
+
+/*
+ * Deflate the columns added from now on. Without zlib, or for a column
+ * that doesn't get any smaller, the data is stored as encoded.
+ */
+void col_batch_compress(struct col_batch *b)
+{
+	b->compress = 1;
+}
+
+#ifdef CONFIG_ZLIB
+static int col_deflate(struct buf_output *enc_buf)
+{
+	uLongf len = compressBound(enc_buf->buflen);
+	Bytef *buf;
+
+	buf = malloc(len);
+	if (!buf)
+		return 0;
+	if (compress2(buf, &len, (const Bytef *) enc_buf->buf,
+		      enc_buf->buflen, Z_DEFAULT_COMPRESSION) != Z_OK ||
+	    len >= enc_buf->buflen) {
+		free(buf);
+		return 0;
+	}
+
+	buf_output_free(enc_buf);
+	buf_output_init(enc_buf);
+	buf_output_add(enc_buf, (const char *) buf, len);
+	free(buf);
+	return 1;
+}
+#else
+static int col_deflate(struct buf_output *enc_buf)
+{
+	return 0;
+}
+#endif
+
+/*
+ * Encode one column into its own buffer first, the header needs the
+ * encoded length.
+ */
+static void col_append(struct col_batch *b, const char *name,
+		       enum col_encoding enc, struct buf_output *enc_buf)
+{
+	struct col_tmp t = { .out = &b->data, };
+
+	if (b->compress && enc_buf->buflen && col_deflate(enc_buf))
+		enc |= COL_ENC_ZLIB;
+
+	tmp_name(&t, name);
+	tmp_le(&t, enc, 1);
+	tmp_le(&t, enc_buf->buflen, 8);
+	tmp_put(&t, enc_buf->buf, enc_buf->buflen);
+	tmp_flush(&t);
+
+	buf_output_free(enc_buf);
+	b->cols++;
+}
+
+void col_add_u64(struct col_batch *b, const char *name,
+		 enum col_encoding enc, const uint64_t *vals)
+{
+	struct col_tmp *t;
+	struct buf_output enc_buf;
+	uint64_t i, last = 0;
+
+	t = malloc(sizeof(*t));
+	if (!t)
+		return;
+
+	buf_output_init(&enc_buf);
+	t->out = &enc_buf;
+	t->len = 0;
+
+	for (i = 0; i < b->rows; i++) {
+		if (enc == COL_ENC_DELTA) {
+			tmp_varint(t, zigzag((int64_t) (vals[i] - last)));
+			last = vals[i];
+		} else
+			tmp_varint(t, vals[i]);
+	}
+	tmp_flush(t);
+	free(t);
+
+	col_append(b, name, enc == COL_ENC_DELTA ? COL_ENC_DELTA :
+			COL_ENC_VARINT, &enc_buf);
+}
+
+void col_add_f64(struct col_batch *b, const char *name, const double *vals)
+{
+	struct col_tmp *t;
+	struct buf_output enc_buf;
+	uint64_t i, bits;
+
+	t = malloc(sizeof(*t));
+	if (!t)
+		return;
+
+	buf_output_init(&enc_buf);
+	t->out = &enc_buf;
+	t->len = 0;
+
+	for (i = 0; i < b->rows; i++) {
+		memcpy(&bits, &vals[i], sizeof(bits));
+		tmp_le(t, bits, 8);
+	}
+	tmp_flush(t);
+	free(t);
+
+	col_append(b, name, COL_ENC_F64, &enc_buf);
+}
+
+/*
+ * Dictionary encode a string column. Columns like job names repeat a
+ * handful of values over many rows, so a linear lookup that starts at
+ * the last hit is plenty.
+ */
+void col_add_str(struct col_batch *b, const char *name, const char **vals)
+{
+	const char **dict;
+	uint64_t *idx, i, nr = 0, last = 0;
+	struct col_tmp *t;
+	struct buf_output enc_buf;
+
+	dict = calloc(b->rows ? b->rows : 1, sizeof(*dict));
+	idx = calloc(b->rows ? b->rows : 1, sizeof(*idx));
+	t = malloc(sizeof(*t));
+	if (!dict || !idx || !t)
+		goto out;
+
+	for (i = 0; i < b->rows; i++) {
+		uint64_t j;
+
+		if (nr && !strcmp(dict[last], vals[i])) {
+			idx[i] = last;
+			continue;
+		}
+		for (j = 0; j < nr; j++)
+			if (!strcmp(dict[j], vals[i]))
+				break;
+		if (j == nr)
+			dict[nr++] = vals[i];
+		idx[i] = last = j;
+	}
+
+	buf_output_init(&enc_buf);
+	t->out = &enc_buf;
+	t->len = 0;
+
+	tmp_varint(t, nr);
+	for (i = 0; i < nr; i++) {
+		size_t len = strlen(dict[i]);
+
+		tmp_varint(t, len);
+		tmp_put(t, dict[i], len);
+	}
+	for (i = 0; i < b->rows; i++)
+		tmp_varint(t, idx[i]);
+	tmp_flush(t);
+
+	col_append(b, name, COL_ENC_DICT, &enc_buf);
+out:
+	free(t);
+	free(idx);
+	free(dict);
+}
+
+void col_batch_write(struct col_batch *b, struct buf_output *out)
+{
+	struct col_tmp t = { .out = out, };
+
+	tmp_name(&t, b->table);
+	tmp_le(&t, b->rows, 8);
+	tmp_le(&t, b->cols, 4);
+	tmp_flush(&t);
+
+	buf_output_add(out, b->data.buf, b->data.buflen);
+}
+
+void col_batch_free(struct col_batch *b)
+{
+	buf_output_free(&b->data);
+	free(b->table);
+	free(b);
+}
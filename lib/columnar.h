@@ -0,0 +1,45 @@
+#ifndef FIO_COLUMNAR_H
+#define FIO_COLUMNAR_H
+
+#include <inttypes.h>
+
+#include "output_buffer.h"
+
+/*
+ * Column oriented result files. A file is a header followed by batches,
+ * each holding a number of rows of one table, stored column by column.
+ * All fixed size fields are little endian:
+ *
+ *	header:	"fiocolmn", u32 version, u32 flags (0)
+ *	batch:	u16 length + table name, u64 rows, u32 columns, then
+ *		for each column: u16 length + name, u8 encoding,
+ *		u64 length + encoded data
+ *
+ * Files can be concatenated, a reader skips headers between batches.
+ */
+#define FIO_COLUMNAR_MAGIC	"fiocolmn"
+#define FIO_COLUMNAR_VERSION	1
+
+enum col_encoding {
+	COL_ENC_VARINT	= 0,	/* unsigned LEB128 */
+	COL_ENC_DELTA	= 1,	/* zigzag LEB128 of the change from the last row */
+	COL_ENC_F64	= 2,	/* IEEE 754 double */
+	COL_ENC_DICT	= 3,	/* LEB128 count and strings, then LEB128 indices */
+
+	COL_ENC_ZLIB	= 0x80,	/* flag, the encoded data is zlib deflated */
+};
+
+struct col_batch;
+
+void col_file_header(struct buf_output *out);
+
+struct col_batch *col_batch_new(const char *table, uint64_t rows);
+void col_add_u64(struct col_batch *b, const char *name,
+		 enum col_encoding enc, const uint64_t *vals);
+void col_add_f64(struct col_batch *b, const char *name, const double *vals);
+void col_add_str(struct col_batch *b, const char *name, const char **vals);
+void col_batch_compress(struct col_batch *b);
+void col_batch_write(struct col_batch *b, struct buf_output *out);
+void col_batch_free(struct col_batch *b);
+
+#endif
@@ -0,0 +1,97 @@
+/*
+ * Fenwick (binary indexed) tree over a set of unsigned weights, giving
+ * O(log n) updates and O(log n) lookup of the element a given cumulative
+ * weight falls into. All weights start out as 1, which makes it an
+ * indexed set: zero an entry to remove it, and fenwick_find(k) returns the
+ * k'th remaining entry.
+ */
+#include <stdlib.h>
+
+#include "fenwick.h"
+
+struct fenwick {
+	unsigned int nr;
+	unsigned int top;	/* highest power of two <= nr */
+	unsigned int total;
+	unsigned int *tree;	/* 1-based */
+};
+
+void fenwick_reset(struct fenwick *fw)
+{
+	unsigned int i;
+
+	/* with all weights 1 a node covers as many entries as its low bit */
+	for (i = 1; i <= fw->nr; i++)
+		fw->tree[i] = i & -i;
+
+	fw->total = fw->nr;
+}
+
+struct fenwick *fenwick_new(unsigned int nr)
+{
+	struct fenwick *fw;
+
+	fw = malloc(sizeof(*fw));
+	if (!fw)
+		return NULL;
+
+	fw->tree = malloc((nr + 1) * sizeof(*fw->tree));
+	if (!fw->tree) {
+		free(fw);
+		return NULL;
+	}
+
+	fw->nr = nr;
+	fw->top = 1;
+	while (fw->top * 2 <= nr)
+		fw->top *= 2;
+
+	fenwick_reset(fw);
+	return fw;
+}
+
+void fenwick_free(struct fenwick *fw)
+{
+	if (!fw)
+		return;
+
+	free(fw->tree);
+	free(fw);
+}
+
+void fenwick_add(struct fenwick *fw, unsigned int idx, int delta)
+{
+	unsigned int i;
+
+	if (idx >= fw->nr)
+		return;
+
+	for (i = idx + 1; i <= fw->nr; i += i & -i)
+		fw->tree[i] += delta;
+
+	fw->total += delta;
+}
+
+unsigned int fenwick_total(struct fenwick *fw)
+{
+	return fw->total;
+}
+
+/*
+ * Return the element that cumulative weight k (0-based) falls into, ie the
+ * smallest idx where the weights of 0..idx sum to more than k. k must be
+ * smaller than fenwick_total().
+ */
+unsigned int fenwick_find(struct fenwick *fw, unsigned int k)
+{
+	unsigned int pos = 0, step;
+
+	for (step = fw->top; step; step >>= 1) {
+		if (pos + step <= fw->nr && fw->tree[pos + step] <= k) {
+			pos += step;
+			k -= fw->tree[pos];
+		}
+	}
+
+	return pos;
+}
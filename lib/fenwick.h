@@ -0,0 +1,15 @@
+#ifndef FIO_FENWICK_H
+#define FIO_FENWICK_H
+
+#include "types.h"
+
+struct fenwick;
+struct fenwick *fenwick_new(unsigned int nr);
+void fenwick_free(struct fenwick *fw);
+
+void fenwick_reset(struct fenwick *fw);
+void fenwick_add(struct fenwick *fw, unsigned int idx, int delta);
+unsigned int fenwick_total(struct fenwick *fw);
+unsigned int fenwick_find(struct fenwick *fw, unsigned int k);
+
+#endif
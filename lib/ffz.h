@@ -3,6 +3,19 @@
 
 #include <inttypes.h>
 
+#ifdef __GNUC__
+/*
+ * A single tzcnt/bsf or rbit+clz. Like the generic version, returns 63 for
+ * a word with no bits set.
+ */
+static inline int ffs64(uint64_t word)
+{
+	if (!word)
+		return 63;
+
+	return __builtin_ctzll(word);
+}
+#else
 static inline int ffs64(uint64_t word)
 {
 	int r = 0;
@@ -32,6 +45,7 @@ static inline int ffs64(uint64_t word)
 
 	return r;
 }
+#endif
 
 #ifndef ARCH_HAVE_FFZ
 
@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "lfsr.h"
 #include "../compiler/compiler.h"
@@ -123,6 +125,8 @@ static inline void __lfsr_next(struct fio_lfsr *fl, unsigned int spin)
 	}
 }
 
+static int lfsr_next_partition(struct fio_lfsr *fl, uint64_t *off);
+
 /*
  * lfsr_next does the following:
  *
@@ -141,6 +145,9 @@ static inline void __lfsr_next(struct fio_lfsr *fl, unsigned int spin)
  */
 int lfsr_next(struct fio_lfsr *fl, uint64_t *off)
 {
+	if (fl->part_count)
+		return lfsr_next_partition(fl, off);
+
 	if (fl->num_vals++ > fl->max_val)
 		return 1;
 
@@ -232,6 +239,105 @@ static int prepare_spin(struct fio_lfsr *fl, unsigned int spin)
 	return 0;
 }
 
+/*
+ * One LFSR step is affine over GF(2): v' = M * v + c, where M shifts right
+ * and folds bit 0 into the taps. n steps are M^n * v + c_n, kept as the
+ * images of the single bits (the columns of M^n) and c_n. That allows
+ * jumping ahead n steps with one pass over the set bits of v.
+ */
+struct lfsr_affine {
+	uint64_t col[64];
+	uint64_t c;
+};
+
+static uint64_t lfsr_affine_lin(const uint64_t *col, uint64_t v)
+{
+	uint64_t r = 0;
+
+	while (v) {
+		r ^= col[__builtin_ctzll(v)];
+		v &= v - 1;
+	}
+
+	return r;
+}
+
+/* a = a after b */
+static void lfsr_affine_mul(struct lfsr_affine *a, const struct lfsr_affine *b,
+			    unsigned int bits)
+{
+	struct lfsr_affine r;
+	unsigned int i;
+
+	for (i = 0; i < bits; i++)
+		r.col[i] = lfsr_affine_lin(a->col, b->col[i]);
+	r.c = lfsr_affine_lin(a->col, b->c) ^ a->c;
+	memcpy(a->col, r.col, bits * sizeof(uint64_t));
+	a->c = r.c;
+}
+
+static void lfsr_affine_pow(struct fio_lfsr *fl, struct lfsr_affine *r,
+			    uint64_t steps)
+{
+	unsigned int i, bits = __builtin_ctzll(fl->cached_bit) + 1;
+	struct lfsr_affine p;
+
+	/* identity */
+	for (i = 0; i < bits; i++)
+		r->col[i] = 1ULL << i;
+	r->c = 0;
+
+	/* one step, see __LFSR_NEXT */
+	p.col[0] = fl->xormask;
+	for (i = 1; i < bits; i++)
+		p.col[i] = 1ULL << (i - 1);
+	p.c = fl->cached_bit ^ fl->xormask;
+
+	while (steps) {
+		if (steps & 1)
+			lfsr_affine_mul(r, &p, bits);
+		steps >>= 1;
+		if (steps)
+			lfsr_affine_mul(&p, &p, bits);
+	}
+}
+
+/*
+ * Partition i of n gets the states at positions i, i + n, i + 2n, ... of
+ * the full LFSR cycle that starts at the seed. The partitions are disjoint
+ * and together hit every value once, like separate LFSRs would on their
+ * own ranges, while each of them still spans the whole range.
+ */
+static int lfsr_next_partition(struct fio_lfsr *fl, uint64_t *off)
+{
+	uint64_t val;
+
+	while (fl->part_left) {
+		val = fl->last_val;
+		fl->part_left--;
+		fl->last_val = lfsr_affine_lin(fl->jump, val) ^ fl->jump_c;
+		if (val <= fl->max_val) {
+			*off = val;
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static void lfsr_reset_partition(struct fio_lfsr *fl)
+{
+	uint64_t cycle = (fl->cached_bit << 1) - 1;
+	struct lfsr_affine start;
+
+	lfsr_affine_pow(fl, &start, fl->part_index);
+	fl->last_val = lfsr_affine_lin(start.col, fl->last_val) ^ start.c;
+	if (fl->part_index < cycle)
+		fl->part_left = (cycle - 1 - fl->part_index) / fl->part_count + 1;
+	else
+		fl->part_left = 0;
+}
+
 int lfsr_reset(struct fio_lfsr *fl, uint64_t seed)
 {
 	uint64_t bitmask = (fl->cached_bit << 1) - 1;
@@ -243,9 +349,47 @@ int lfsr_reset(struct fio_lfsr *fl, uint64_t seed)
 	if (fl->last_val == bitmask)
 		return 1;
 
+	if (fl->part_count)
+		lfsr_reset_partition(fl);
+
 	return 0;
 }
 
+/*
+ * Switch an initialized LFSR to produce partition 'index' of 'count', see
+ * lfsr_next_partition(). All partitions must use the same size and seed.
+ */
+int lfsr_partition(struct fio_lfsr *fl, uint64_t seed, unsigned int index,
+		   unsigned int count)
+{
+	struct lfsr_affine jump;
+	unsigned int bits = __builtin_ctzll(fl->cached_bit) + 1;
+
+	if (!count || index >= count || fl->spin)
+		return 1;
+
+	if (!fl->jump) {
+		fl->jump = malloc(64 * sizeof(uint64_t));
+		if (!fl->jump)
+			return 1;
+	}
+
+	lfsr_affine_pow(fl, &jump, count);
+	memcpy(fl->jump, jump.col, bits * sizeof(uint64_t));
+	fl->jump_c = jump.c;
+	fl->part_index = index;
+	fl->part_count = count;
+
+	return lfsr_reset(fl, seed);
+}
+
+void lfsr_free(struct fio_lfsr *fl)
+{
+	free(fl->jump);
+	fl->jump = NULL;
+	fl->part_count = 0;
+}
+
 int lfsr_init(struct fio_lfsr *fl, uint64_t nums, uint64_t seed,
 	      unsigned int spin)
 {
@@ -258,6 +402,8 @@ int lfsr_init(struct fio_lfsr *fl, uint64_t nums, uint64_t seed,
 	fl->max_val = nums - 1;
 	fl->xormask = lfsr_create_xormask(taps);
 	fl->cached_bit = 1ULL << (taps[0] - 1);
+	fl->part_count = 0;
+	fl->jump = NULL;
 
 	if (prepare_spin(fl, spin))
 		return 1;
@@ -20,11 +20,25 @@ struct fio_lfsr {
 	uint64_t cycle_length;
 	uint64_t cached_cycle_length;
 	unsigned int spin;
+
+	/*
+	 * Partitioned mode, see lfsr_partition(). jump[] and jump_c advance
+	 * the register by part_count steps at once. jump[] is allocated, as
+	 * an fio_lfsr is embedded in every fio_file.
+	 */
+	unsigned int part_index;
+	unsigned int part_count;
+	uint64_t part_left;
+	uint64_t jump_c;
+	uint64_t *jump;
 };
 
 int lfsr_next(struct fio_lfsr *fl, uint64_t *off);
 int lfsr_init(struct fio_lfsr *fl, uint64_t size,
 	      uint64_t seed, unsigned int spin);
 int lfsr_reset(struct fio_lfsr *fl, uint64_t seed);
+int lfsr_partition(struct fio_lfsr *fl, uint64_t seed, unsigned int index,
+		   unsigned int count);
+void lfsr_free(struct fio_lfsr *fl);
 
 #endif
@@ -5,6 +5,7 @@
 
 #include "memcpy.h"
 #include "rand.h"
+#include "../bench.h"
 #include "../fio_time.h"
 #include "../gettime.h"
 #include "../os/os.h"
@@ -213,7 +214,7 @@ static int setup_tests(void)
 	}
 
 	init_rand_seed(&state, 0x8989, 0);
-	fill_random_buf(&state, src, BUF_SIZE);
+	fill_random_buf(&state, src, BUF_SIZE, FIO_BUF_GEN_XORSHIFT);
 
 	for (i = 0; tests[i].name; i++) {
 		test = &tests[i];
@@ -230,7 +231,7 @@ static void free_tests(void)
 	free(tests[0].dst);
 }
 
-int fio_memcpy_test(const char *type)
+static int memcpy_test(const char *type, struct bench_ops *ops)
 {
 	unsigned int test_mask = 0;
 	int j, i;
@@ -255,7 +256,7 @@ int fio_memcpy_test(const char *type)
 	for (i = 0; t[i].name; i++) {
 		struct timespec ts;
 		double mb_sec;
-		uint64_t usec;
+		uint64_t nsec, usec;
 
 		if (!(t[i].mask & test_mask))
 			continue;
@@ -267,13 +268,29 @@ int fio_memcpy_test(const char *type)
 		usec_spin(100000);
 		t[i].fn(&tests[0]);
 
-		printf("%s\n", t[i].name);
+		if (!ops)
+			printf("%s\n", t[i].name);
 
 		for (j = 0; tests[j].name; j++) {
 			fio_gettime(&ts, NULL);
 			t[i].fn(&tests[j]);
-			usec = utime_since_now(&ts);
+			nsec = ntime_since_now(&ts);
+
+			if (ops) {
+				struct bench_result res = {
+					.group	= "memcpy",
+					.name	= t[i].name,
+					.size	= tests[j].size,
+					.ops	= NR_ITERS * ((BUF_SIZE +
+						  tests[j].size - 1) / tests[j].size),
+					.nsec	= nsec,
+				};
+
+				ops->result(ops, &res);
+				continue;
+			}
 
+			usec = nsec / 1000;
 			if (usec) {
 				unsigned long long mb = NR_ITERS * BUF_SIZE;
 
@@ -288,3 +305,13 @@ int fio_memcpy_test(const char *type)
 	free_tests();
 	return 0;
 }
+
+int fio_memcpy_test(const char *type)
+{
+	return memcpy_test(type, NULL);
+}
+
+int fio_memcpy_bench(const char *type, struct bench_ops *ops)
+{
+	return memcpy_test(type, ops);
+}
@@ -1,6 +1,9 @@
 #ifndef FIO_MEMCPY_H
 #define FIO_MEMCPY_H
 
+struct bench_ops;
+
 int fio_memcpy_test(const char *type);
+int fio_memcpy_bench(const char *type, struct bench_ops *ops);
 
 #endif
@@ -0,0 +1,260 @@
+#include <inttypes.h>
+#include <string.h>
+
+#include "memeq.h"
+#include "../arch/arch.h"
+
+/*
+ * Equality checks for the verify fast paths. Unlike memcmp() these don't
+ * have to find the first difference, so the vector loops fold several
+ * vectors together and only test once per iteration. The byte that
+ * differs is found by the caller's slow path, if it matters.
+ */
+
+#ifdef ARCH_HAVE_AVX2
+static bool memeq_probed;
+static bool memeq_avx2;
+#endif
+#ifdef ARCH_HAVE_AVX512
+static bool memeq_avx512;
+#endif
+
+static bool mem_is_zero_sw(const unsigned char *p, size_t len)
+{
+	uint64_t v[4];
+
+	while (len >= sizeof(v)) {
+		memcpy(v, p, sizeof(v));
+		if (v[0] | v[1] | v[2] | v[3])
+			return false;
+		p += sizeof(v);
+		len -= sizeof(v);
+	}
+
+	while (len--)
+		if (*p++)
+			return false;
+
+	return true;
+}
+
+#ifdef ARCH_HAVE_AVX2
+
+#include <immintrin.h>
+
+#define LOAD256(p, i)	_mm256_loadu_si256((const __m256i *) (p) + (i))
+
+__attribute__((target("avx2")))
+static bool mem_is_zero_avx2(const unsigned char *p, size_t len)
+{
+	__m256i v;
+
+	while (len >= 128) {
+		v = _mm256_or_si256(_mm256_or_si256(LOAD256(p, 0), LOAD256(p, 1)),
+				    _mm256_or_si256(LOAD256(p, 2), LOAD256(p, 3)));
+		if (!_mm256_testz_si256(v, v))
+			return false;
+		p += 128;
+		len -= 128;
+	}
+
+	while (len >= 32) {
+		v = LOAD256(p, 0);
+		if (!_mm256_testz_si256(v, v))
+			return false;
+		p += 32;
+		len -= 32;
+	}
+
+	return mem_is_zero_sw(p, len);
+}
+
+#define XOR256(a, b, i)	_mm256_xor_si256(LOAD256(a, i), LOAD256(b, i))
+
+__attribute__((target("avx2")))
+static bool mem_is_equal_avx2(const unsigned char *a, const unsigned char *b,
+			      size_t len)
+{
+	__m256i v;
+
+	while (len >= 128) {
+		v = _mm256_or_si256(_mm256_or_si256(XOR256(a, b, 0), XOR256(a, b, 1)),
+				    _mm256_or_si256(XOR256(a, b, 2), XOR256(a, b, 3)));
+		if (!_mm256_testz_si256(v, v))
+			return false;
+		a += 128;
+		b += 128;
+		len -= 128;
+	}
+
+	while (len >= 32) {
+		v = XOR256(a, b, 0);
+		if (!_mm256_testz_si256(v, v))
+			return false;
+		a += 32;
+		b += 32;
+		len -= 32;
+	}
+
+	return !memcmp(a, b, len);
+}
+
+#endif /* ARCH_HAVE_AVX2 */
+
+#ifdef ARCH_HAVE_AVX512
+
+#define LOAD512(p, i)	_mm512_loadu_si512((const __m512i *) (p) + (i))
+
+__attribute__((target("avx512f")))
+static bool mem_is_zero_avx512(const unsigned char *p, size_t len)
+{
+	__m512i v;
+
+	while (len >= 256) {
+		v = _mm512_or_si512(_mm512_or_si512(LOAD512(p, 0), LOAD512(p, 1)),
+				    _mm512_or_si512(LOAD512(p, 2), LOAD512(p, 3)));
+		if (_mm512_test_epi64_mask(v, v))
+			return false;
+		p += 256;
+		len -= 256;
+	}
+
+	while (len >= 64) {
+		v = LOAD512(p, 0);
+		if (_mm512_test_epi64_mask(v, v))
+			return false;
+		p += 64;
+		len -= 64;
+	}
+
+	return mem_is_zero_sw(p, len);
+}
+
+#define XOR512(a, b, i)	_mm512_xor_si512(LOAD512(a, i), LOAD512(b, i))
+
+__attribute__((target("avx512f")))
+static bool mem_is_equal_avx512(const unsigned char *a, const unsigned char *b,
+				size_t len)
+{
+	__m512i v;
+
+	while (len >= 256) {
+		v = _mm512_or_si512(_mm512_or_si512(XOR512(a, b, 0), XOR512(a, b, 1)),
+				    _mm512_or_si512(XOR512(a, b, 2), XOR512(a, b, 3)));
+		if (_mm512_test_epi64_mask(v, v))
+			return false;
+		a += 256;
+		b += 256;
+		len -= 256;
+	}
+
+	while (len >= 64) {
+		v = XOR512(a, b, 0);
+		if (_mm512_test_epi64_mask(v, v))
+			return false;
+		a += 64;
+		b += 64;
+		len -= 64;
+	}
+
+	return !memcmp(a, b, len);
+}
+
+#endif /* ARCH_HAVE_AVX512 */
+
+#ifdef __aarch64__
+
+#include <arm_neon.h>
+
+/* NEON is part of the base ARMv8-A ISA, no runtime check needed */
+static bool mem_is_zero_neon(const unsigned char *p, size_t len)
+{
+	uint8x16_t v;
+
+	while (len >= 64) {
+		v = vorrq_u8(vorrq_u8(vld1q_u8(p), vld1q_u8(p + 16)),
+			     vorrq_u8(vld1q_u8(p + 32), vld1q_u8(p + 48)));
+		if (vmaxvq_u8(v))
+			return false;
+		p += 64;
+		len -= 64;
+	}
+
+	return mem_is_zero_sw(p, len);
+}
+
+#define XOR128(a, b, i)	veorq_u8(vld1q_u8((a) + (i)), vld1q_u8((b) + (i)))
+
+static bool mem_is_equal_neon(const unsigned char *a, const unsigned char *b,
+			      size_t len)
+{
+	uint8x16_t v;
+
+	while (len >= 64) {
+		v = vorrq_u8(vorrq_u8(XOR128(a, b, 0), XOR128(a, b, 16)),
+			     vorrq_u8(XOR128(a, b, 32), XOR128(a, b, 48)));
+		if (vmaxvq_u8(v))
+			return false;
+		a += 64;
+		b += 64;
+		len -= 64;
+	}
+
+	return !memcmp(a, b, len);
+}
+
+#endif /* __aarch64__ */
+
+/*
+ * Returns true if all of the 'len' bytes at 'data' are zero.
+ */
+bool mem_is_zero(const void *data, size_t len)
+{
+#ifdef ARCH_HAVE_AVX512
+	if (memeq_avx512)
+		return mem_is_zero_avx512(data, len);
+#endif
+#ifdef ARCH_HAVE_AVX2
+	if (memeq_avx2)
+		return mem_is_zero_avx2(data, len);
+#endif
+#ifdef __aarch64__
+	return mem_is_zero_neon(data, len);
+#else
+	return mem_is_zero_sw(data, len);
+#endif
+}
+
+/*
+ * Returns true if the 'len' bytes at 'a' and 'b' are the same.
+ */
+bool mem_is_equal(const void *a, const void *b, size_t len)
+{
+#ifdef ARCH_HAVE_AVX512
+	if (memeq_avx512)
+		return mem_is_equal_avx512(a, b, len);
+#endif
+#ifdef ARCH_HAVE_AVX2
+	if (memeq_avx2)
+		return mem_is_equal_avx2(a, b, len);
+#endif
+#ifdef __aarch64__
+	return mem_is_equal_neon(a, b, len);
+#else
+	return !memcmp(a, b, len);
+#endif
+}
+
+void memeq_probe(void)
+{
+#ifdef ARCH_HAVE_AVX2
+	if (memeq_probed)
+		return;
+
+	memeq_avx2 = arch_x86_has_avx2();
+#ifdef ARCH_HAVE_AVX512
+	memeq_avx512 = arch_x86_has_avx512f();
+#endif
+	memeq_probed = true;
+#endif
+}
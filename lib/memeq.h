@@ -0,0 +1,11 @@
+#ifndef FIO_MEMEQ_H
+#define FIO_MEMEQ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+bool mem_is_zero(const void *data, size_t len);
+bool mem_is_equal(const void *a, const void *b, size_t len);
+void memeq_probe(void);
+
+#endif
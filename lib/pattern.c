@@ -9,6 +9,7 @@
 
 #include "strntol.h"
 #include "pattern.h"
+#include "memeq.h"
 #include "../minmax.h"
 #include "../oslib/strcasestr.h"
 #include "../oslib/strndup.h"
@@ -490,47 +491,77 @@ int cpy_pattern(const char *pattern, unsigned int pattern_len,
 	return dup_pattern(out, out_len, pattern_len);
 }
 
+/*
+ * Patterns up to half of this are unrolled on the stack by cmp_pattern(),
+ * larger ones are compared against the pattern buffer directly.
+ */
+#define CMP_PATTERN_SPAN	1024
+
+/*
+ * Buffers up to this size are expected to stay in the L1 cache, so reading
+ * them twice is cheaper than unrolling the pattern.
+ */
+#define CMP_PATTERN_CACHED	(16 * 1024)
+
 /**
  * cmp_pattern() - Compares pattern and buffer.
  *
- * For the sake of performance this function avoids any loops.
- * Firstly it tries to compare the buffer itself, checking that
- * buffer consists of repeating patterns along the buffer size.
- *
- * If the difference is not found then the function tries to compare
- * buffer and pattern.
+ * Small buffers are compared against themselves shifted by the pattern
+ * size, which leaves only the first pattern to check. Larger buffers are
+ * compared in a single pass: short patterns are first unrolled into a
+ * span that is a multiple of the pattern size, so each compare covers a
+ * useful amount of data and the span stays in cache while the buffer
+ * streams past it.
  *
  * Returns 0 in case of success or errno < 0 in case of failure.
  */
 int cmp_pattern(const char *pattern, unsigned int pattern_size,
 		unsigned int off, const char *buf, unsigned int len)
 {
-	int rc;
-	unsigned int size;
+	char span[CMP_PATTERN_SPAN];
+	unsigned int size, span_len, i;
 
-	/* Find the difference in buffer */
-	if (len > pattern_size) {
-		rc = memcmp(buf, buf + pattern_size, len - pattern_size);
-		if (rc)
+	if (len > pattern_size && len <= CMP_PATTERN_CACHED) {
+		if (!mem_is_equal(buf, buf + pattern_size, len - pattern_size))
 			return -EILSEQ;
+		len = pattern_size;
 	}
-	/* Compare second part of the pattern with buffer */
-	if (off) {
-		size = min(len, pattern_size - off);
-		rc = memcmp(buf, pattern + off, size);
-		if (rc)
+
+	if (len <= pattern_size || pattern_size > sizeof(span) / 2) {
+		while (len) {
+			size = min(len, pattern_size - off);
+			if (!mem_is_equal(buf, pattern + off, size))
+				return -EILSEQ;
+			buf += size;
+			len -= size;
+			off = 0;
+		}
+		return 0;
+	}
+
+	/*
+	 * Unroll no more than the buffer needs, starting at 'off'. Once the
+	 * first rotated copy is in place the span is doubled, which keeps it
+	 * a whole number of patterns.
+	 */
+	span_len = sizeof(span) / pattern_size * pattern_size;
+	span_len = min(span_len, len);
+	size = pattern_size - off;
+	memcpy(span, pattern + off, min(size, span_len));
+	if (size < span_len)
+		memcpy(span + size, pattern, min(off, span_len - size));
+	for (i = pattern_size; i < span_len; i += size) {
+		size = min(i, span_len - i);
+		memcpy(span + i, span, size);
+	}
+
+	while (len) {
+		size = min(len, span_len);
+		if (!mem_is_equal(buf, span, size))
 			return -EILSEQ;
 		buf += size;
 		len -= size;
 	}
-	/* Compare first part of the pattern or the whole pattern
-	 * with buffer */
-	if (len) {
-		size = min(len, (off ? off : pattern_size));
-		rc = memcmp(buf, pattern, size);
-		if (rc)
-			return -EILSEQ;
-	}
 
 	return 0;
 }
@@ -598,3 +629,39 @@ int paste_format(const char *pattern, unsigned int pattern_len,
 	/* Spread filled chunk all over the buffer */
 	return dup_pattern(out, out_len, pattern_len);
 }
+
+/**
+ * paste_format_repeat() - Pastes parsed formats all over a filled buffer.
+ *
+ * @pattern_len - size of the pattern the buffer is filled with
+ * @fmt - format array, see paste_format()
+ * @fmt_sz - size of the format array
+ * @out - buffer already holding the pattern, repeated from offset 0
+ * @out_len - size of the buffer
+ * @priv - private data passed to the paste callbacks
+ *
+ * Leaves the buffer as paste_format() would, but only writes the formats
+ * in each pattern period instead of the whole buffer.
+ *
+ * Returns 0 on success or errno < 0 on failure.
+ */
+int paste_format_repeat(unsigned int pattern_len, struct pattern_fmt *fmt,
+			unsigned int fmt_sz, char *out, unsigned int out_len,
+			void *priv)
+{
+	unsigned int off;
+	int rc;
+
+	if (!pattern_len || !out)
+		return -EINVAL;
+
+	for (off = 0; off < out_len; off += pattern_len) {
+		rc = paste_format_inplace(out + off,
+					  min(pattern_len, out_len - off),
+					  fmt, fmt_sz, priv);
+		if (rc)
+			return rc;
+	}
+
+	return 0;
+}
@@ -46,6 +46,10 @@ int paste_format(const char *pattern, unsigned int pattern_len,
 		 struct pattern_fmt *fmt, unsigned int fmt_sz,
 		 char *out, unsigned int out_len, void *priv);
 
+int paste_format_repeat(unsigned int pattern_len, struct pattern_fmt *fmt,
+			unsigned int fmt_sz, char *out, unsigned int out_len,
+			void *priv);
+
 int cpy_pattern(const char *pattern, unsigned int pattern_len,
 		char *out, unsigned int out_len);
 
@@ -0,0 +1,202 @@
+#include <inttypes.h>
+#include <string.h>
+
+#include "pmem_copy.h"
+#include "../arch/arch.h"
+
+#define PMEM_CACHELINE	64
+
+#if defined(__x86_64__)
+
+#include <immintrin.h>
+
+/* clwb, spelled out for assemblers that predate it */
+static inline void pmem_clwb(const void *p)
+{
+	__asm__ __volatile__(".byte 0x66; xsaveopt %0"
+			     : "+m" (*(volatile char *) p));
+}
+
+/*
+ * Write back the cache lines covering [p, p + len). clflush is always
+ * there on x86-64, so the streaming kernels use it for the partial lines
+ * at either end of an unaligned copy.
+ */
+static void pmem_flush_range(const void *p, size_t len, bool clwb)
+{
+	uintptr_t line = (uintptr_t) p & ~(uintptr_t) (PMEM_CACHELINE - 1);
+	uintptr_t end = (uintptr_t) p + len;
+
+	for (; line < end; line += PMEM_CACHELINE) {
+		if (clwb)
+			pmem_clwb((const void *) line);
+		else
+			_mm_clflush((const void *) line);
+	}
+}
+
+static void pmem_copy_flushed(char *dst, const char *src, size_t len)
+{
+	memcpy(dst, src, len);
+	pmem_flush_range(dst, len, false);
+}
+
+/* bytes to copy before dst is cache line aligned */
+static size_t pmem_copy_head(const char *dst, size_t len)
+{
+	size_t head = -(uintptr_t) dst & (PMEM_CACHELINE - 1);
+
+	return head < len ? head : len;
+}
+
+#define LOAD128(p, i)		_mm_loadu_si128((const __m128i *) (p) + (i))
+#define STREAM128(p, i, v)	_mm_stream_si128((__m128i *) (p) + (i), (v))
+
+static void pmem_copy_movnt(char *dst, const char *src, size_t len)
+{
+	size_t head = pmem_copy_head(dst, len);
+
+	if (head) {
+		pmem_copy_flushed(dst, src, head);
+		dst += head;
+		src += head;
+		len -= head;
+	}
+
+	while (len >= PMEM_CACHELINE) {
+		__m128i v0 = LOAD128(src, 0), v1 = LOAD128(src, 1);
+		__m128i v2 = LOAD128(src, 2), v3 = LOAD128(src, 3);
+
+		STREAM128(dst, 0, v0);
+		STREAM128(dst, 1, v1);
+		STREAM128(dst, 2, v2);
+		STREAM128(dst, 3, v3);
+		dst += PMEM_CACHELINE;
+		src += PMEM_CACHELINE;
+		len -= PMEM_CACHELINE;
+	}
+
+	if (len)
+		pmem_copy_flushed(dst, src, len);
+}
+
+#ifdef ARCH_HAVE_AVX512
+
+#define LOAD512(p, i)		_mm512_loadu_si512((const __m512i *) (p) + (i))
+#define STREAM512(p, i, v)	_mm512_stream_si512((__m512i *) (p) + (i), (v))
+
+__attribute__((target("avx512f")))
+static void pmem_copy_avx512nt(char *dst, const char *src, size_t len)
+{
+	size_t head = pmem_copy_head(dst, len);
+
+	if (head) {
+		pmem_copy_flushed(dst, src, head);
+		dst += head;
+		src += head;
+		len -= head;
+	}
+
+	while (len >= 4 * PMEM_CACHELINE) {
+		__m512i v0 = LOAD512(src, 0), v1 = LOAD512(src, 1);
+		__m512i v2 = LOAD512(src, 2), v3 = LOAD512(src, 3);
+
+		STREAM512(dst, 0, v0);
+		STREAM512(dst, 1, v1);
+		STREAM512(dst, 2, v2);
+		STREAM512(dst, 3, v3);
+		dst += 4 * PMEM_CACHELINE;
+		src += 4 * PMEM_CACHELINE;
+		len -= 4 * PMEM_CACHELINE;
+	}
+
+	while (len >= PMEM_CACHELINE) {
+		STREAM512(dst, 0, LOAD512(src, 0));
+		dst += PMEM_CACHELINE;
+		src += PMEM_CACHELINE;
+		len -= PMEM_CACHELINE;
+	}
+
+	if (len)
+		pmem_copy_flushed(dst, src, len);
+}
+
+#endif /* ARCH_HAVE_AVX512 */
+
+bool pmem_copy_supported(unsigned int kernel)
+{
+	switch (kernel) {
+	case PMEM_COPY_MOVNT:
+		return true;
+	case PMEM_COPY_AVX512NT:
+#ifdef ARCH_HAVE_AVX512
+		return arch_x86_has_avx512f();
+#else
+		return false;
+#endif
+	case PMEM_COPY_CLWB:
+		return arch_x86_has_clwb();
+	default:
+		return false;
+	}
+}
+
+void pmem_copy_nodrain(unsigned int kernel, void *dst, const void *src,
+		       size_t len)
+{
+	switch (kernel) {
+	case PMEM_COPY_MOVNT:
+		pmem_copy_movnt(dst, src, len);
+		break;
+#ifdef ARCH_HAVE_AVX512
+	case PMEM_COPY_AVX512NT:
+		pmem_copy_avx512nt(dst, src, len);
+		break;
+#endif
+	case PMEM_COPY_CLWB:
+		memcpy(dst, src, len);
+		pmem_flush_range(dst, len, true);
+		break;
+	default:
+		memcpy(dst, src, len);
+		break;
+	}
+}
+
+void pmem_copy_drain(void)
+{
+	_mm_sfence();
+}
+
+#else /* !__x86_64__ */
+
+bool pmem_copy_supported(unsigned int kernel)
+{
+	return false;
+}
+
+void pmem_copy_nodrain(unsigned int kernel, void *dst, const void *src,
+		       size_t len)
+{
+	memcpy(dst, src, len);
+}
+
+void pmem_copy_drain(void)
+{
+}
+
+#endif
+
+const char *pmem_copy_name(unsigned int kernel)
+{
+	switch (kernel) {
+	case PMEM_COPY_MOVNT:
+		return "movnt";
+	case PMEM_COPY_AVX512NT:
+		return "avx512nt";
+	case PMEM_COPY_CLWB:
+		return "clwb";
+	default:
+		return "unknown";
+	}
+}
@@ -0,0 +1,24 @@
+#ifndef FIO_PMEM_COPY_H
+#define FIO_PMEM_COPY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Copy kernels for writing to persistent or CXL-attached memory. None
+ * of them fence, the caller issues one pmem_copy_drain() for however
+ * many copies it wants to make durable together.
+ */
+enum {
+	PMEM_COPY_MOVNT		= 1,	/* SSE2 movntdq streaming stores */
+	PMEM_COPY_AVX512NT,		/* AVX-512 streaming stores */
+	PMEM_COPY_CLWB,			/* regular stores, then clwb */
+};
+
+bool pmem_copy_supported(unsigned int kernel);
+const char *pmem_copy_name(unsigned int kernel);
+void pmem_copy_nodrain(unsigned int kernel, void *dst, const void *src,
+		       size_t len);
+void pmem_copy_drain(void);
+
+#endif
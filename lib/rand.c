@@ -37,6 +37,7 @@
 #include "rand.h"
 #include "pattern.h"
 #include "../hash.h"
+#include "../arch/arch.h"
 
 int arch_random;
 
@@ -75,24 +76,66 @@ void __init_rand64(struct taus258_state *state, uint64_t seed)
 		__rand64(state);
 }
 
-void init_rand(struct frand_state *state, bool use64)
+/*
+ * Expand the seed with splitmix64, as the xoshiro authors recommend. It
+ * never leaves the state all zero.
+ */
+static void __init_xoshiro(struct xoshiro256_state *state, uint64_t seed)
 {
-	state->use64 = use64;
+	int i;
 
-	if (!use64)
-		__init_rand32(&state->state32, 1);
-	else
-		__init_rand64(&state->state64, 1);
+	for (i = 0; i < 4; i++) {
+		uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		state->s[i] = z ^ (z >> 31);
+	}
 }
 
-void init_rand_seed(struct frand_state *state, uint64_t seed, bool use64)
+void init_rand(struct frand_state *state, unsigned int gen)
 {
-	state->use64 = use64;
+	init_rand_seed(state, 1, gen);
+}
 
-	if (!use64)
-		__init_rand32(&state->state32, (unsigned int) seed);
-	else
+void init_rand_seed(struct frand_state *state, uint64_t seed, unsigned int gen)
+{
+	state->use64 = gen;
+
+	if (gen == FRAND_XOSHIRO)
+		__init_xoshiro(&state->state256, seed);
+	else if (gen)
 		__init_rand64(&state->state64, seed);
+	else
+		__init_rand32(&state->state32, (unsigned int) seed);
+}
+
+void frand_batch_fill(struct frand_batch *b, struct frand_state *state)
+{
+	int i;
+
+	if (state->use64 == FRAND_XOSHIRO) {
+		struct xoshiro256_state s = state->state256;
+
+		for (i = 0; i < FRAND_BATCH; i++)
+			b->vals[i] = __rand_xoshiro(&s);
+		state->state256 = s;
+	} else if (state->use64) {
+		struct taus258_state s = state->state64;
+
+		for (i = 0; i < FRAND_BATCH; i++)
+			b->vals[i] = __rand64(&s);
+		state->state64 = s;
+	} else {
+		struct taus88_state s = state->state32;
+
+		for (i = 0; i < FRAND_BATCH; i++)
+			b->vals[i] = __rand32(&s);
+		state->state32 = s;
+	}
+
+	b->head = 0;
+	b->nr = FRAND_BATCH;
 }
 
 void __fill_random_buf_small(void *buf, unsigned int len, uint64_t seed)
@@ -110,7 +153,7 @@ void __fill_random_buf_small(void *buf, unsigned int len, uint64_t seed)
 		__builtin_memcpy(e, &seed, rest);
 }
 
-void __fill_random_buf(void *buf, unsigned int len, uint64_t seed)
+static void __fill_random_buf_hash(void *buf, unsigned int len, uint64_t seed)
 {
 	static uint64_t prime[] = {1, 2, 3, 5, 7, 11, 13, 17,
 				   19, 23, 29, 31, 37, 41, 43, 47};
@@ -141,19 +184,249 @@ void __fill_random_buf(void *buf, unsigned int len, uint64_t seed)
 	__fill_random_buf_small(b, rest, s[0]);
 }
 
+/*
+ * The xorshift buffer generator runs RAND_BUF_LANES independent xorshift64
+ * lanes, block n of the buffer holds the n'th output of each lane in lane
+ * order. On aarch64 the lanes map onto NEON registers, on x86 AVX2 or
+ * AVX-512 are used if available. All of them must produce the exact same
+ * output, buffers are regenerated from the seed when verifying.
+ */
+#define RAND_BUF_LANES	32
+#define RAND_BUF_BLOCK	(RAND_BUF_LANES * sizeof(uint64_t))
+
+static bool rand_buf_probed;
+#ifdef ARCH_HAVE_AVX2
+static bool rand_buf_avx2;
+#endif
+#ifdef ARCH_HAVE_AVX512
+static bool rand_buf_avx512;
+#endif
+
+static inline uint64_t rand_buf_step(uint64_t x)
+{
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return x;
+}
+
+#ifndef __aarch64__
+static void rand_buf_fill_sw(void *buf, unsigned int blocks, uint64_t *s)
+{
+	uint64_t x[RAND_BUF_LANES], *b = buf;
+	int p;
+
+	memcpy(x, s, sizeof(x));
+	while (blocks--) {
+		for (p = 0; p < RAND_BUF_LANES; p++) {
+			x[p] = rand_buf_step(x[p]);
+			b[p] = x[p];
+		}
+		b += RAND_BUF_LANES;
+	}
+	memcpy(s, x, sizeof(x));
+}
+#endif
+
+#ifdef ARCH_HAVE_AVX2
+
+#include <immintrin.h>
+
+#define RAND_BUF_STEP256(x)	do {				\
+	x = _mm256_xor_si256(x, _mm256_slli_epi64(x, 13));	\
+	x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 7));	\
+	x = _mm256_xor_si256(x, _mm256_slli_epi64(x, 17));	\
+} while (0)
+
+__attribute__((target("avx2")))
+static void rand_buf_fill_avx2(void *buf, unsigned int blocks, uint64_t *s)
+{
+	__m256i x[RAND_BUF_LANES / 4], *b = buf;
+	int i;
+
+	for (i = 0; i < RAND_BUF_LANES / 4; i++)
+		x[i] = _mm256_loadu_si256((__m256i *) s + i);
+
+	while (blocks--) {
+		for (i = 0; i < RAND_BUF_LANES / 4; i++) {
+			RAND_BUF_STEP256(x[i]);
+			_mm256_storeu_si256(b + i, x[i]);
+		}
+		b += RAND_BUF_LANES / 4;
+	}
+
+	for (i = 0; i < RAND_BUF_LANES / 4; i++)
+		_mm256_storeu_si256((__m256i *) s + i, x[i]);
+}
+
+#endif /* ARCH_HAVE_AVX2 */
+
+#ifdef ARCH_HAVE_AVX512
+
+#define RAND_BUF_STEP512(x)	do {				\
+	x = _mm512_xor_si512(x, _mm512_slli_epi64(x, 13));	\
+	x = _mm512_xor_si512(x, _mm512_srli_epi64(x, 7));	\
+	x = _mm512_xor_si512(x, _mm512_slli_epi64(x, 17));	\
+} while (0)
+
+__attribute__((target("avx512f")))
+static void rand_buf_fill_avx512(void *buf, unsigned int blocks, uint64_t *s)
+{
+	__m512i x[RAND_BUF_LANES / 8], *b = buf;
+	int i;
+
+	for (i = 0; i < RAND_BUF_LANES / 8; i++)
+		x[i] = _mm512_loadu_si512((__m512i *) s + i);
+
+	while (blocks--) {
+		for (i = 0; i < RAND_BUF_LANES / 8; i++) {
+			RAND_BUF_STEP512(x[i]);
+			_mm512_storeu_si512(b + i, x[i]);
+		}
+		b += RAND_BUF_LANES / 8;
+	}
+
+	for (i = 0; i < RAND_BUF_LANES / 8; i++)
+		_mm512_storeu_si512((__m512i *) s + i, x[i]);
+}
+
+#endif /* ARCH_HAVE_AVX512 */
+
+#ifdef __aarch64__
+
+#include <arm_neon.h>
+
+static void rand_buf_fill_neon(void *buf, unsigned int blocks, uint64_t *s)
+{
+	uint64x2_t x[RAND_BUF_LANES / 2];
+	uint64_t *b = buf;
+	int i;
+
+	for (i = 0; i < RAND_BUF_LANES / 2; i++)
+		x[i] = vld1q_u64(s + 2 * i);
+
+	while (blocks--) {
+		for (i = 0; i < RAND_BUF_LANES / 2; i++) {
+			x[i] = veorq_u64(x[i], vshlq_n_u64(x[i], 13));
+			x[i] = veorq_u64(x[i], vshrq_n_u64(x[i], 7));
+			x[i] = veorq_u64(x[i], vshlq_n_u64(x[i], 17));
+			vst1q_u64(b + 2 * i, x[i]);
+		}
+		b += RAND_BUF_LANES;
+	}
+
+	for (i = 0; i < RAND_BUF_LANES / 2; i++)
+		vst1q_u64(s + 2 * i, x[i]);
+}
+
+#endif /* __aarch64__ */
+
+static void rand_buf_probe(void)
+{
+#ifdef ARCH_HAVE_AVX2
+	rand_buf_avx2 = arch_x86_has_avx2();
+#endif
+#ifdef ARCH_HAVE_AVX512
+	rand_buf_avx512 = arch_x86_has_avx512f();
+#endif
+	rand_buf_probed = true;
+}
+
+static void rand_buf_fill(void *buf, unsigned int blocks, uint64_t *s)
+{
+#ifdef ARCH_HAVE_AVX512
+	if (rand_buf_avx512) {
+		rand_buf_fill_avx512(buf, blocks, s);
+		return;
+	}
+#endif
+#ifdef ARCH_HAVE_AVX2
+	if (rand_buf_avx2) {
+		rand_buf_fill_avx2(buf, blocks, s);
+		return;
+	}
+#endif
+#ifdef __aarch64__
+	rand_buf_fill_neon(buf, blocks, s);
+#else
+	rand_buf_fill_sw(buf, blocks, s);
+#endif
+}
+
+/*
+ * Name of the xorshift buffer fill kernel the CPU probe picked
+ */
+const char *fill_random_buf_kernel(void)
+{
+	if (!rand_buf_probed)
+		rand_buf_probe();
+
+#ifdef ARCH_HAVE_AVX512
+	if (rand_buf_avx512)
+		return "avx512";
+#endif
+#ifdef ARCH_HAVE_AVX2
+	if (rand_buf_avx2)
+		return "avx2";
+#endif
+#ifdef __aarch64__
+	return "neon";
+#else
+	return "generic";
+#endif
+}
+
+static void __fill_random_buf_xorshift(void *buf, unsigned int len,
+				       uint64_t seed)
+{
+	uint64_t s[RAND_BUF_LANES], tail[RAND_BUF_LANES];
+	unsigned int rest;
+	int p;
+
+	if (!rand_buf_probed)
+		rand_buf_probe();
+
+	/* splitmix64 spreads the seed over the lanes, none may be zero */
+	for (p = 0; p < RAND_BUF_LANES; p++) {
+		uint64_t z = seed + (p + 1) * 0x9e3779b97f4a7c15ULL;
+
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		s[p] = (z ^ (z >> 31)) | 1;
+	}
+
+	rand_buf_fill(buf, len / RAND_BUF_BLOCK, s);
+
+	rest = len % RAND_BUF_BLOCK;
+	if (rest) {
+		rand_buf_fill(tail, 1, s);
+		memcpy(buf + len - rest, tail, rest);
+	}
+}
+
+void __fill_random_buf(void *buf, unsigned int len, uint64_t seed,
+		       unsigned int gen)
+{
+	if (gen == FIO_BUF_GEN_HASH)
+		__fill_random_buf_hash(buf, len, seed);
+	else
+		__fill_random_buf_xorshift(buf, len, seed);
+}
+
 uint64_t fill_random_buf(struct frand_state *fs, void *buf,
-			 unsigned int len)
+			 unsigned int len, unsigned int gen)
 {
 	uint64_t r = __get_next_seed(fs);
 
-	__fill_random_buf(buf, len, r);
+	__fill_random_buf(buf, len, r, gen);
 	return r;
 }
 
 void __fill_random_buf_percentage(uint64_t seed, void *buf,
 				  unsigned int percentage,
 				  unsigned int segment, unsigned int len,
-				  char *pattern, unsigned int pbytes)
+				  char *pattern, unsigned int pbytes,
+				  unsigned int gen)
 {
 	unsigned int this_len;
 
@@ -176,7 +449,7 @@ void __fill_random_buf_percentage(uint64_t seed, void *buf,
 		if (this_len > len)
 			this_len = len;
 
-		__fill_random_buf(buf, this_len, seed);
+		__fill_random_buf(buf, this_len, seed, gen);
 
 		len -= this_len;
 		if (!len)
@@ -199,14 +472,58 @@ void __fill_random_buf_percentage(uint64_t seed, void *buf,
 	}
 }
 
+/*
+ * Random data with reduced entropy. Byte i of each FIO_ENTROPY_BLOCK keeps
+ * 'level / FIO_ENTROPY_BLOCK' of its low bits, the first
+ * 'level % FIO_ENTROPY_BLOCK' bytes keep one bit more. 'level' is thus
+ * the number of random bits per block, from 0 (all zeroes) to
+ * FIO_ENTROPY_LEVELS (fully random).
+ */
+void __fill_random_buf_entropy(uint64_t seed, void *buf, unsigned int len,
+			       unsigned int level, unsigned int gen)
+{
+	uint64_t mask[FIO_ENTROPY_BLOCK / sizeof(uint64_t)], *b = buf;
+	unsigned char *m = (unsigned char *) mask;
+	unsigned int i, bits, rest;
+
+	__fill_random_buf(buf, len, seed, gen);
+	if (level >= FIO_ENTROPY_LEVELS)
+		return;
+
+	for (i = 0; i < FIO_ENTROPY_BLOCK; i++) {
+		bits = level / FIO_ENTROPY_BLOCK + (i < level % FIO_ENTROPY_BLOCK);
+		m[i] = (1U << bits) - 1;
+	}
+
+	for (rest = len; rest >= FIO_ENTROPY_BLOCK; rest -= FIO_ENTROPY_BLOCK) {
+		for (i = 0; i < FIO_ENTROPY_BLOCK / sizeof(*b); i++)
+			b[i] &= mask[i];
+		b += FIO_ENTROPY_BLOCK / sizeof(*b);
+	}
+
+	for (i = 0; i < rest; i++)
+		((unsigned char *) b)[i] &= m[i];
+}
+
+uint64_t fill_random_buf_entropy(struct frand_state *fs, void *buf,
+				 unsigned int len, unsigned int level,
+				 unsigned int gen)
+{
+	uint64_t r = __get_next_seed(fs);
+
+	__fill_random_buf_entropy(r, buf, len, level, gen);
+	return r;
+}
+
 uint64_t fill_random_buf_percentage(struct frand_state *fs, void *buf,
 				    unsigned int percentage,
 				    unsigned int segment, unsigned int len,
-				    char *pattern, unsigned int pbytes)
+				    char *pattern, unsigned int pbytes,
+				    unsigned int gen)
 {
 	uint64_t r = __get_next_seed(fs);
 
 	__fill_random_buf_percentage(r, buf, percentage, segment, len,
-					pattern, pbytes);
+					pattern, pbytes, gen);
 	return r;
 }
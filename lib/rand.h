@@ -18,11 +18,38 @@ struct taus258_state {
 	uint64_t s1, s2, s3, s4, s5;
 };
 
+struct xoshiro256_state {
+	uint64_t s[4];
+};
+
+/*
+ * Generator behind a frand_state, kept in ->use64. Anything but taus88
+ * has 64-bit output, so ->use64 still reads as a bool for that.
+ */
+#define FRAND_TAUS88	0
+#define FRAND_TAUS258	1
+#define FRAND_XOSHIRO	2
+
+/*
+ * Generators for random buffer contents
+ */
+enum {
+	FIO_BUF_GEN_XORSHIFT = 0,
+	FIO_BUF_GEN_HASH,
+};
+
+/*
+ * Entropy levels for fill_random_buf_entropy(), in random bits per block
+ */
+#define FIO_ENTROPY_BLOCK	64
+#define FIO_ENTROPY_LEVELS	(FIO_ENTROPY_BLOCK * 8)
+
 struct frand_state {
 	unsigned int use64;
 	union {
 		struct taus88_state state32;
 		struct taus258_state state64;
+		struct xoshiro256_state state256;
 	};
 };
 
@@ -54,7 +81,9 @@ static inline void __frand64_copy(struct taus258_state *dst,
 
 static inline void frand_copy(struct frand_state *dst, struct frand_state *src)
 {
-	if (src->use64)
+	if (src->use64 == FRAND_XOSHIRO)
+		dst->state256 = src->state256;
+	else if (src->use64)
 		__frand64_copy(&dst->state64, &src->state64);
 	else
 		__frand32_copy(&dst->state32, &src->state32);
@@ -95,10 +124,44 @@ static inline uint64_t __rand64(struct taus258_state *state)
 	return (state->s1 ^ state->s2 ^ state->s3 ^ state->s4 ^ state->s5);
 }
 
+static inline uint64_t rotl64(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+/*
+ * xoshiro256** by Blackman and Vigna. A handful of shifts, xors and one
+ * multiply per value, against five three-step tausworthe components for
+ * taus258.
+ */
+static inline uint64_t __rand_xoshiro(struct xoshiro256_state *state)
+{
+	uint64_t *s = state->s;
+	const uint64_t r = rotl64(s[1] * 5, 7) * 9;
+	const uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl64(s[3], 45);
+
+	return r;
+}
+
+static inline uint64_t __frand64(struct frand_state *state)
+{
+	if (state->use64 == FRAND_XOSHIRO)
+		return __rand_xoshiro(&state->state256);
+
+	return __rand64(&state->state64);
+}
+
 static inline uint64_t __rand(struct frand_state *state)
 {
 	if (state->use64)
-		return __rand64(&state->state64);
+		return __frand64(state);
 	else
 		return __rand32(&state->state32);
 }
@@ -106,7 +169,7 @@ static inline uint64_t __rand(struct frand_state *state)
 static inline double __rand_0_1(struct frand_state *state)
 {
 	if (state->use64) {
-		uint64_t val = __rand64(&state->state64);
+		uint64_t val = __frand64(state);
 
 		return (val + 1.0) / FRAND64_MAX_PLUS_ONE;
 	} else {
@@ -116,6 +179,18 @@ static inline double __rand_0_1(struct frand_state *state)
 	}
 }
 
+static inline uint32_t __rand32_scale(uint32_t r, uint32_t end)
+{
+	end++;
+	return (int) ((double)end * (r / FRAND32_MAX_PLUS_ONE));
+}
+
+static inline uint64_t __rand64_scale(uint64_t r, uint64_t end)
+{
+	end++;
+	return (uint64_t) ((double)end * (r / FRAND64_MAX_PLUS_ONE));
+}
+
 static inline uint32_t rand32_upto(struct frand_state *state, uint32_t end)
 {
 	uint32_t r;
@@ -123,8 +198,7 @@ static inline uint32_t rand32_upto(struct frand_state *state, uint32_t end)
 	assert(!state->use64);
 
 	r = __rand32(&state->state32);
-	end++;
-	return (int) ((double)end * (r / FRAND32_MAX_PLUS_ONE));
+	return __rand32_scale(r, end);
 }
 
 static inline uint64_t rand64_upto(struct frand_state *state, uint64_t end)
@@ -133,9 +207,47 @@ static inline uint64_t rand64_upto(struct frand_state *state, uint64_t end)
 
 	assert(state->use64);
 
-	r = __rand64(&state->state64);
-	end++;
-	return (uint64_t) ((double)end * (r / FRAND64_MAX_PLUS_ONE));
+	r = __frand64(state);
+	return __rand64_scale(r, end);
+}
+
+/*
+ * Lemire's multiply-shift mapping of 'r' to [0, end]. Unlike scaling it
+ * has no bias: values of 'r' from the uneven tail are rejected, which
+ * returns false and a new value must be drawn. That takes one divide
+ * and happens with probability (end + 1) / 2^64 at most.
+ */
+static inline bool __rand_bounded(uint64_t r, uint64_t end, uint64_t *val)
+{
+#ifdef __SIZEOF_INT128__
+	uint64_t range = end + 1;
+	__uint128_t m;
+
+	if (!range) {
+		*val = r;
+		return true;
+	}
+
+	m = (__uint128_t) r * range;
+	if ((uint64_t) m < range && (uint64_t) m < -range % range)
+		return false;
+
+	*val = m >> 64;
+#else
+	*val = __rand64_scale(r, end);
+#endif
+	return true;
+}
+
+static inline uint64_t rand_xoshiro_upto(struct frand_state *state,
+					 uint64_t end)
+{
+	uint64_t val;
+
+	while (!__rand_bounded(__rand_xoshiro(&state->state256), end, &val))
+		;
+
+	return val;
 }
 
 /*
@@ -144,7 +256,9 @@ static inline uint64_t rand64_upto(struct frand_state *state, uint64_t end)
 static inline uint64_t rand_between(struct frand_state *state, uint64_t start,
 				    uint64_t end)
 {
-	if (state->use64)
+	if (state->use64 == FRAND_XOSHIRO)
+		return start + rand_xoshiro_upto(state, end - start);
+	else if (state->use64)
 		return start + rand64_upto(state, end - start);
 	else
 		return start + rand32_upto(state, end - start);
@@ -160,12 +274,68 @@ static inline uint64_t __get_next_seed(struct frand_state *fs)
 	return r;
 }
 
-extern void init_rand(struct frand_state *, bool);
-extern void init_rand_seed(struct frand_state *, uint64_t seed, bool);
+/*
+ * Values drawn from a frand_state ahead of time, FRAND_BATCH at a time.
+ * Filling them in one go keeps the generator state in registers instead
+ * of a load/store round trip per value. The sequence is the same as
+ * calling __rand() on the state directly, as long as every user of the
+ * state goes through the batch and the batch is reset when the state is
+ * seeded.
+ */
+#define FRAND_BATCH	64
+
+struct frand_batch {
+	uint64_t vals[FRAND_BATCH];
+	unsigned int head;
+	unsigned int nr;
+};
+
+extern void frand_batch_fill(struct frand_batch *, struct frand_state *);
+
+static inline void frand_batch_reset(struct frand_batch *b)
+{
+	b->head = b->nr = 0;
+}
+
+static inline uint64_t frand_batch_next(struct frand_batch *b,
+					struct frand_state *state)
+{
+	if (b->head == b->nr)
+		frand_batch_fill(b, state);
+
+	return b->vals[b->head++];
+}
+
+/*
+ * Batched rand_between()
+ */
+static inline uint64_t frand_batch_between(struct frand_batch *b,
+					   struct frand_state *state,
+					   uint64_t start, uint64_t end)
+{
+	uint64_t r = frand_batch_next(b, state);
+
+	if (state->use64 == FRAND_XOSHIRO) {
+		uint64_t val;
+
+		while (!__rand_bounded(r, end - start, &val))
+			r = frand_batch_next(b, state);
+		return start + val;
+	} else if (state->use64)
+		return start + __rand64_scale(r, end - start);
+	else
+		return start + __rand32_scale(r, end - start);
+}
+
+extern void init_rand(struct frand_state *, unsigned int);
+extern void init_rand_seed(struct frand_state *, uint64_t seed, unsigned int);
 void __init_rand64(struct taus258_state *state, uint64_t seed);
-extern void __fill_random_buf(void *buf, unsigned int len, uint64_t seed);
-extern uint64_t fill_random_buf(struct frand_state *, void *buf, unsigned int len);
-extern void __fill_random_buf_percentage(uint64_t, void *, unsigned int, unsigned int, unsigned int, char *, unsigned int);
-extern uint64_t fill_random_buf_percentage(struct frand_state *, void *, unsigned int, unsigned int, unsigned int, char *, unsigned int);
+extern void __fill_random_buf(void *buf, unsigned int len, uint64_t seed, unsigned int gen);
+extern uint64_t fill_random_buf(struct frand_state *, void *buf, unsigned int len, unsigned int gen);
+extern const char *fill_random_buf_kernel(void);
+extern void __fill_random_buf_percentage(uint64_t, void *, unsigned int, unsigned int, unsigned int, char *, unsigned int, unsigned int);
+extern void __fill_random_buf_entropy(uint64_t, void *, unsigned int, unsigned int, unsigned int);
+extern uint64_t fill_random_buf_entropy(struct frand_state *, void *, unsigned int, unsigned int, unsigned int);
+extern uint64_t fill_random_buf_percentage(struct frand_state *, void *, unsigned int, unsigned int, unsigned int, char *, unsigned int, unsigned int);
 
 #endif
@@ -11,13 +11,19 @@ struct zipf_state {
 	double zeta2;
 	double zetan;
 	double pareto_pow;
+	double hint_x1;
+	double hint_n;
+	double hint_s;
 	struct frand_state rand;
 	uint64_t rand_off;
 	bool disable_hash;
+	bool rejection;
 };
 
 void zipf_init(struct zipf_state *zs, uint64_t nranges, double theta,
 	       double center, unsigned int seed);
+void zipf_init_rejection(struct zipf_state *zs, uint64_t nranges,
+			 double theta, double center, unsigned int seed);
 uint64_t zipf_next(struct zipf_state *zs);
 
 void pareto_init(struct zipf_state *zs, uint64_t nranges, double h,
@@ -34,6 +34,7 @@
 #include "filelock.h"
 #include "helper_thread.h"
 #include "filehash.h"
+#include "lib/fenwick.h"
 
 FLIST_HEAD(disk_list);
 
@@ -121,6 +122,8 @@ void clear_io_state(struct thread_data *td, int all)
 		fio_file_clear_done(f);
 		f->file_offset = get_start_offset(td, f);
 	}
+	if (td->active_files)
+		fenwick_reset(td->active_files);
 
 	/*
 	 * Re-Seed random number generator if rand_repeatable is true
@@ -143,9 +146,11 @@ void reset_all_stats(struct thread_data *td)
 		td->io_bytes[i] = 0;
 		td->io_blocks[i] = 0;
 		td->io_issues[i] = 0;
+		td->rwmix_issues_base[i] = 0;
 		td->ts.total_io_u[i] = 0;
 		td->ts.runtime[i] = 0;
 	}
+	td->verify_interleaved = 0;
 
 	set_epoch_time(td, td->o.log_unix_epoch | td->o.log_alternate_epoch, td->o.log_alternate_epoch_clock_id);
 	memcpy(&td->start, &td->epoch, sizeof(td->epoch));
@@ -353,6 +358,32 @@ static int endian_check(void)
 	return 0;
 }
 
+/*
+ * Catch layout regressions in the structures the IO path lives in. The
+ * per-IO part of thread_data must stay within its cache lines and
+ * clear of fields other threads write, and the fields of an io_u that
+ * every IO touches must stay in its first three lines.
+ */
+#define fio_span(type, first, last)					\
+	(offsetof(type, last) + FIO_FIELD_SIZE(type *, last) -		\
+	 offsetof(type, first))
+
+#define TD_HOT_LINES	8
+#define IO_U_HOT_LINES	3
+
+static void td_layout_check(void)
+{
+	compiletime_assert(fio_span(struct thread_data, io_ops, random_state) <=
+			   TD_HOT_LINES * FIO_CACHE_LINE_SIZE, "td hot fields");
+	compiletime_assert((offsetof(struct thread_data, runstate) % FIO_CACHE_LINE_SIZE) == 0, "td runstate");
+	compiletime_assert(fio_span(struct thread_data, runstate, rusage_sem) <=
+			   FIO_CACHE_LINE_SIZE, "td shared fields");
+	compiletime_assert((offsetof(struct thread_data, io_u_lock) % FIO_CACHE_LINE_SIZE) == 0, "td io_u_lock");
+	compiletime_assert((sizeof(struct thread_data) % FIO_CACHE_LINE_SIZE) == 0, "td size");
+	compiletime_assert(fio_span(struct io_u, start_time, end_io) <=
+			   IO_U_HOT_LINES * FIO_CACHE_LINE_SIZE, "io_u hot fields");
+}
+
 int initialize_fio(char *envp[])
 {
 	long ps;
@@ -374,9 +405,11 @@ int initialize_fio(char *envp[])
 	compiletime_assert((offsetof(struct thread_options_pack, percentile_list) % 8) == 0, "percentile_list");
 	compiletime_assert((offsetof(struct thread_options_pack, latency_percentile) % 8) == 0, "latency_percentile");
 	compiletime_assert((offsetof(struct jobs_eta, m_rate) % 8) == 0, "m_rate");
+	compiletime_assert(sizeof(struct io_binlog_sample) == 40, "io_binlog_sample");
 
 	compiletime_assert(__TD_F_LAST <= TD_ENG_FLAG_SHIFT, "TD_ENG_FLAG_SHIFT");
 	compiletime_assert(BSSPLIT_MAX <= ZONESPLIT_MAX, "bsssplit/zone max");
+	td_layout_check();
 
 	err = endian_check();
 	if (err) {
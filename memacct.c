@@ -0,0 +1,170 @@
+/*
+ * Memory fio holds per job, see memacct.h
+ */
+#include <stdlib.h>
+
+#include "fio.h"
+#include "memacct.h"
+#include "smalloc.h"
+#include "verify.h"
+#include "json.h"
+#include "lib/pow2.h"
+
+static const char *mem_acct_names[MEM_ACCT_NR] = {
+	"io_u", "bufs", "hist", "logs", "randmap", "zones", "stats",
+};
+
+/*
+ * A racing update may miss the peak by its own size, close enough for
+ * a report
+ */
+void mem_acct_add(struct thread_data *td, unsigned int what, int64_t bytes)
+{
+	struct mem_acct *ma;
+	int64_t now;
+
+	if (!td || !bytes)
+		return;
+
+	ma = &td->mem_acct;
+	now = atomic_add(&ma->cur[what], bytes) + bytes;
+	if (now > ma->peak[what])
+		ma->peak[what] = now;
+}
+
+void mem_acct_set(struct thread_data *td, unsigned int what, int64_t bytes)
+{
+	if (td)
+		mem_acct_add(td, what, bytes - td->mem_acct.cur[what]);
+}
+
+/*
+ * Without verify_backlog, every block a job writes stays in its verify
+ * history until the verify pass reads it back
+ */
+static uint64_t hist_projected(struct thread_data *td)
+{
+	struct thread_options *o = &td->o;
+	uint64_t size = o->io_size ? o->io_size : o->size, nr;
+
+	if (o->verify == VERIFY_NONE || !td_write(td) || o->verify_bitmap ||
+	    !o->min_bs[DDIR_WRITE])
+		return 0;
+
+	nr = size / o->min_bs[DDIR_WRITE];
+	if (o->verify_backlog && o->verify_backlog < nr)
+		nr = o->verify_backlog;
+
+	return nr * sizeof(struct io_piece);
+}
+
+/*
+ * Warn before the jobs start if their verify histories can't all fit in
+ * RAM. Jobs whose size is only known once they set up their files don't
+ * count.
+ */
+void mem_acct_check_projected(void)
+{
+	uint64_t total = 0, max = 0, ram = os_phys_mem();
+	struct thread_data *big = NULL;
+	char *total_p, *ram_p;
+
+	for_each_td(td) {
+		uint64_t bytes = hist_projected(td);
+
+		total += bytes;
+		if (bytes > max) {
+			max = bytes;
+			big = td;
+		}
+	} end_for_each();
+
+	if (!ram || total <= ram)
+		return;
+
+	total_p = num2str(total, 4, 1, 1, N2S_BYTE);
+	ram_p = num2str(ram, 4, 1, 1, N2S_BYTE);
+	log_err("fio: verify history projected to reach %s, more than the %s "
+		"of RAM, most of it for job %s. Bound it with verify_backlog "
+		"or verify_bitmap.\n", total_p, ram_p, big->o.name);
+	free(total_p);
+	free(ram_p);
+}
+
+/*
+ * Peaks of the job ts reports, summed over its group with
+ * group_reporting. Only the backend has the jobs around, clients don't
+ * get these.
+ */
+static bool mem_acct_get(struct thread_stat *ts, int64_t *peak)
+{
+	struct thread_data *first = NULL;
+	unsigned int i;
+
+	for_each_td(td) {
+		if (td->thread_number == ts->thread_number) {
+			first = td;
+			break;
+		}
+	} end_for_each();
+	if (!first || !first->o.mem_report)
+		return false;
+
+	memset(peak, 0, MEM_ACCT_NR * sizeof(*peak));
+	for_each_td(td) {
+		if (td != first && (!first->o.group_reporting ||
+				    !td->o.group_reporting ||
+				    td->groupid != first->groupid))
+			continue;
+		for (i = 0; i < MEM_ACCT_NR; i++)
+			peak[i] += td->mem_acct.peak[i];
+	} end_for_each();
+
+	return true;
+}
+
+void mem_acct_show(struct thread_stat *ts, struct buf_output *out)
+{
+	int64_t peak[MEM_ACCT_NR];
+	int i2p = is_power_of_2(ts->kb_base);
+	uint64_t used, size;
+	char *p1, *p2;
+	unsigned int i;
+
+	if (!mem_acct_get(ts, peak))
+		return;
+
+	log_buf(out, "  mem peak     :");
+	for (i = 0; i < MEM_ACCT_NR; i++) {
+		p1 = num2str(peak[i], ts->sig_figs, 1, i2p, N2S_BYTE);
+		log_buf(out, "%s %s=%s", i ? "," : "", mem_acct_names[i], p1);
+		free(p1);
+	}
+
+	smalloc_usage(&used, &size);
+	p1 = num2str(used, ts->sig_figs, 1, i2p, N2S_BYTE);
+	p2 = num2str(size, ts->sig_figs, 1, i2p, N2S_BYTE);
+	log_buf(out, "; smalloc %s of %s\n", p1, p2);
+	free(p1);
+	free(p2);
+}
+
+void mem_acct_json(struct json_object *root, struct thread_stat *ts)
+{
+	int64_t peak[MEM_ACCT_NR];
+	struct json_object *obj;
+	uint64_t used, size;
+	unsigned int i;
+
+	if (!mem_acct_get(ts, peak))
+		return;
+
+	obj = json_create_object();
+	json_object_add_value_object(root, "mem_peak_bytes", obj);
+	for (i = 0; i < MEM_ACCT_NR; i++)
+		json_object_add_value_int(obj, mem_acct_names[i], peak[i]);
+
+	smalloc_usage(&used, &size);
+	json_object_add_value_int(obj, "smalloc_used", used);
+	json_object_add_value_int(obj, "smalloc_size", size);
+}
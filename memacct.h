@@ -0,0 +1,40 @@
+#ifndef FIO_MEMACCT_H
+#define FIO_MEMACCT_H
+
+#include <stdint.h>
+
+struct thread_data;
+struct thread_stat;
+struct json_object;
+struct buf_output;
+
+/*
+ * Memory fio itself holds for a job, by what it holds it for. Counters
+ * are moved where the memory is allocated and freed, by the job and by
+ * the threads flushing its logs. mem_report=1 shows the peak of each,
+ * as most of it is freed by the time the job's stats are reported.
+ * Zone info and shared random maps are counted for every job using them.
+ */
+enum {
+	MEM_IO_U = 0,		/* io_u arena */
+	MEM_IO_BUFS,		/* io_u data buffers */
+	MEM_IO_HIST,		/* io_piece history and verify bitmaps */
+	MEM_IO_LOGS,		/* bw/iops/lat/hist log samples */
+	MEM_RANDMAP,		/* random maps */
+	MEM_ZONES,		/* zbd zone info */
+	MEM_STATS,		/* thread_stat and the optional per job stats */
+	MEM_ACCT_NR,
+};
+
+struct mem_acct {
+	int64_t cur[MEM_ACCT_NR];
+	int64_t peak[MEM_ACCT_NR];
+};
+
+extern void mem_acct_add(struct thread_data *, unsigned int, int64_t);
+extern void mem_acct_set(struct thread_data *, unsigned int, int64_t);
+extern void mem_acct_check_projected(void);
+extern void mem_acct_show(struct thread_stat *, struct buf_output *);
+extern void mem_acct_json(struct json_object *, struct thread_stat *);
+
+#endif
@@ -5,8 +5,14 @@
 #include <unistd.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#ifdef CONFIG_LIBNUMA
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#endif
 
 #include "fio.h"
+#include "lib/ffz.h"
+#include "lib/pow2.h"
 #ifndef FIO_NO_HAVE_SHM_H
 #include <sys/shm.h>
 #endif
@@ -60,6 +66,21 @@ int fio_pin_memory(struct thread_data *td)
 	return 0;
 }
 
+/*
+ * Ask for huge pages of the size given with hugepage-size rather than the
+ * system default one, this is how 1GiB pages get used. mmap and shm share
+ * the encoding.
+ */
+static int hugetlb_size_flags(struct thread_data *td)
+{
+#ifdef MAP_HUGE_SHIFT
+	if (fio_option_is_set(&td->o, hugepage_size) &&
+	    is_power_of_2(td->o.hugepage_size))
+		return ffs64(td->o.hugepage_size) << MAP_HUGE_SHIFT;
+#endif
+	return 0;
+}
+
 static int alloc_mem_shm(struct thread_data *td, unsigned int total_mem)
 {
 #ifndef CONFIG_NO_SHM
@@ -68,7 +89,7 @@ static int alloc_mem_shm(struct thread_data *td, unsigned int total_mem)
 	if (td->o.mem_type == MEM_SHMHUGE) {
 		unsigned long mask = td->o.hugepage_size - 1;
 
-		flags |= SHM_HUGETLB;
+		flags |= SHM_HUGETLB | hugetlb_size_flags(td);
 		total_mem = (total_mem + mask) & ~mask;
 	}
 
@@ -132,7 +153,7 @@ static int alloc_mem_mmap(struct thread_data *td, size_t total_mem)
 
 		/* TODO: make sure the file is a real hugetlbfs file */
 		if (!td->o.mmapfile)
-			flags |= MAP_HUGETLB;
+			flags |= MAP_HUGETLB | hugetlb_size_flags(td);
 		total_mem = (total_mem + mask) & ~mask;
 	}
 
@@ -195,6 +216,51 @@ static void free_mem_mmap(struct thread_data *td, size_t total_mem)
 	}
 }
 
+/*
+ * An engine that registers the io buffers with the kernel has them pinned
+ * page by page, the fewer pages the better. Take hugetlb pages if there
+ * are any to be had, otherwise ask for transparent huge pages.
+ */
+static int alloc_mem_huge(struct thread_data *td, size_t total_mem)
+{
+	size_t mask = td->o.hugepage_size - 1, len = total_mem;
+	void *buf = MAP_FAILED;
+
+	if (MAP_HUGETLB && td->o.hugepage_size &&
+	    total_mem >= td->o.hugepage_size) {
+		len = (total_mem + mask) & ~mask;
+		buf = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			   OS_MAP_ANON | MAP_PRIVATE | MAP_HUGETLB |
+			   hugetlb_size_flags(td), -1, 0);
+	}
+	if (buf != MAP_FAILED)
+		td->iomem_hugetlb = true;
+	else {
+		len = total_mem;
+		buf = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			   OS_MAP_ANON | MAP_PRIVATE, -1, 0);
+		if (buf == MAP_FAILED)
+			return 1;
+#ifdef MADV_HUGEPAGE
+		madvise(buf, len, MADV_HUGEPAGE);
+#endif
+	}
+
+	dprint(FD_MEM, "huge %s %llu %p\n", td->iomem_hugetlb ? "hugetlb" : "thp",
+					(unsigned long long) len, buf);
+	td->orig_buffer = buf;
+	td->iomem_huge_len = len;
+	return 0;
+}
+
+static void free_mem_huge(struct thread_data *td)
+{
+	dprint(FD_MEM, "munmap huge %p\n", td->orig_buffer);
+	munmap(td->orig_buffer, td->iomem_huge_len);
+	td->iomem_huge_len = 0;
+	td->iomem_hugetlb = false;
+}
+
 static int alloc_mem_malloc(struct thread_data *td, size_t total_mem)
 {
 	td->orig_buffer = malloc(total_mem);
@@ -282,12 +348,361 @@ static void free_mem_cudamalloc(struct thread_data *td)
 #endif
 }
 
+#ifdef CONFIG_LIBNUMA
+/*
+ * Walk up a sysfs device path until a device that knows its NUMA node
+ */
+static int sysfs_numa_node(char *path)
+{
+	char file[PATH_MAX + 16];
+	char *p;
+	FILE *fp;
+	int node;
+
+	while ((p = strrchr(path, '/')) != NULL && p != path) {
+		snprintf(file, sizeof(file), "%s/numa_node", path);
+		fp = fopen(file, "r");
+		if (fp) {
+			if (fscanf(fp, "%d", &node) != 1)
+				node = -1;
+			fclose(fp);
+			return node;
+		}
+		*p = '\0';
+	}
+
+	return -1;
+}
+
+static int iomem_device_node(struct thread_data *td)
+{
+	char path[PATH_MAX], real[PATH_MAX];
+	struct fio_file *f;
+	unsigned int i;
+	struct stat sb;
+	dev_t dev;
+	int node;
+
+	for_each_file(td, f, i) {
+		if (stat(f->file_name, &sb) < 0)
+			continue;
+
+		if (S_ISBLK(sb.st_mode) || S_ISCHR(sb.st_mode))
+			dev = sb.st_rdev;
+		else
+			dev = sb.st_dev;
+
+		snprintf(path, sizeof(path), "/sys/dev/%s/%u:%u",
+			 S_ISCHR(sb.st_mode) ? "char" : "block",
+			 major(dev), minor(dev));
+		if (!realpath(path, real))
+			continue;
+
+		node = sysfs_numa_node(real);
+		dprint(FD_MEM, "%s: device %s is on node %d\n", f->file_name,
+							real, node);
+		if (node >= 0)
+			return node;
+	}
+
+	return -1;
+}
+
+/*
+ * The node with the most CPUs this job may run on
+ */
+static int iomem_cpus_node(struct thread_data *td)
+{
+#ifdef FIO_HAVE_CPU_AFFINITY
+	int cpu, node, max_node, ncpus, best = -1;
+	unsigned int *count;
+	os_cpu_mask_t mask;
+
+	if (fio_getaffinity(td->pid, &mask) < 0)
+		return numa_node_of_cpu(sched_getcpu());
+
+	max_node = numa_max_node();
+	count = calloc(max_node + 1, sizeof(*count));
+	if (!count)
+		return numa_node_of_cpu(sched_getcpu());
+
+	ncpus = numa_num_configured_cpus();
+	for (cpu = 0; cpu < ncpus; cpu++) {
+		if (!fio_cpu_isset(&mask, cpu))
+			continue;
+		node = numa_node_of_cpu(cpu);
+		if (node < 0 || node > max_node)
+			continue;
+		if (++count[node] > (best < 0 ? 0 : count[best]))
+			best = node;
+	}
+
+	free(count);
+	return best;
+#else
+	return numa_node_of_cpu(sched_getcpu());
+#endif
+}
+
+/*
+ * Count how many pages of the buffer area ended up on another node.
+ */
+static void iomem_numa_report(struct thread_data *td, char *start,
+			      size_t len, size_t psize, int node)
+{
+	unsigned long long pages = 0, remote = 0;
+	void *addrs[256];
+	int status[256];
+	size_t off = 0;
+	int i, nr;
+
+	while (off < len) {
+		for (nr = 0; nr < 256 && off < len; nr++, off += psize)
+			addrs[nr] = start + off;
+
+		if (numa_move_pages(0, nr, addrs, NULL, status, 0) < 0) {
+			dprint(FD_MEM, "move_pages: %s\n", strerror(errno));
+			return;
+		}
+		for (i = 0; i < nr; i++) {
+			if (status[i] < 0)
+				continue;
+			pages++;
+			if (status[i] != node)
+				remote++;
+		}
+	}
+
+	dprint(FD_MEM, "%llu of %llu io buffer pages off node %d\n", remote,
+							pages, node);
+	if (remote) {
+		log_info("fio: %s: %llu of %llu io buffer pages are not on"
+			 " NUMA node %d\n", td->o.name, remote, pages, node);
+	}
+}
+
+/*
+ * Prefer the node asked for with iomem_numa for the io buffers, fault the
+ * buffers in on it and tell the user about pages that landed elsewhere.
+ */
+static void iomem_numa_place(struct thread_data *td, size_t total_mem)
+{
+	struct bitmask *mask;
+	size_t psize = page_size;
+	uintptr_t start, end, p;
+	int node;
+
+	if (numa_available() < 0) {
+		log_info("fio: %s: no NUMA support, iomem_numa ignored\n",
+								td->o.name);
+		return;
+	}
+
+	switch (td->o.iomem_numa) {
+	case IOMEM_NUMA_CPUS:
+		node = iomem_cpus_node(td);
+		break;
+	case IOMEM_NUMA_DEVICE:
+		node = iomem_device_node(td);
+		break;
+	case IOMEM_NUMA_NODE:
+	default:
+		node = td->o.iomem_numa_node;
+		break;
+	}
+
+	if (node < 0 || node > numa_max_node()) {
+		log_info("fio: %s: no NUMA node found for the io buffers\n",
+								td->o.name);
+		return;
+	}
+
+	if (td->o.mem_type == MEM_SHMHUGE || td->o.mem_type == MEM_MMAPHUGE ||
+	    td->iomem_hugetlb)
+		psize = td->o.hugepage_size;
+
+	start = ((uintptr_t) td->orig_buffer + psize - 1) & ~(psize - 1);
+	end = ((uintptr_t) td->orig_buffer + total_mem) & ~(psize - 1);
+	if (end <= start)
+		return;
+
+	dprint(FD_MEM, "io buffers %p/%llu on node %d\n", td->orig_buffer,
+				(unsigned long long) total_mem, node);
+
+	mask = numa_allocate_nodemask();
+	numa_bitmask_setbit(mask, node);
+	if (syscall(__NR_mbind, start, end - start, MPOL_PREFERRED,
+		    mask->maskp, mask->size + 1, MPOL_MF_MOVE) < 0)
+		log_info("fio: %s: mbind: %s\n", td->o.name, strerror(errno));
+	numa_free_nodemask(mask);
+
+	for (p = start; p < end; p += psize)
+		*(volatile char *) p = 0;
+
+	iomem_numa_report(td, (char *) start, end - start, psize, node);
+}
+
+/*
+ * The thread area is shared and a job's thread_data is set up wherever
+ * it was parsed. Prefer the node the job runs on for it: the pages not
+ * touched yet, which is most of the stats, are then allocated there and
+ * the others are moved where possible.
+ */
+void fio_td_numa_place(struct thread_data *td)
+{
+	uintptr_t start = ((uintptr_t) td + page_mask) & ~page_mask;
+	uintptr_t end = ((uintptr_t) (td + 1)) & ~page_mask;
+	struct bitmask *mask;
+	int node;
+
+	if (end <= start || numa_available() < 0)
+		return;
+
+	node = iomem_cpus_node(td);
+	if (node < 0)
+		return;
+
+	dprint(FD_MEM, "thread data %p on node %d\n", td, node);
+
+	mask = numa_allocate_nodemask();
+	numa_bitmask_setbit(mask, node);
+	if (syscall(__NR_mbind, start, end - start, MPOL_PREFERRED,
+		    mask->maskp, mask->size + 1, MPOL_MF_MOVE) < 0)
+		dprint(FD_MEM, "thread data mbind: %s\n", strerror(errno));
+	numa_free_nodemask(mask);
+}
+#else
+static void iomem_numa_place(struct thread_data *td, size_t total_mem)
+{
+}
+#endif
+
+/*
+ * With shared_read_buffers the data read is never looked at, so the io_us
+ * of all such jobs in a process read into one small region that stays in
+ * the CPU caches, backed by a huge page if one can be had. A job needing
+ * more than an existing region holds gets its own, regions are freed by
+ * the last job using them.
+ */
+#define SHARED_READ_REGION_SIZE	(2 * 1024 * 1024)
+
+struct shared_read_region {
+	struct flist_head list;
+	char *buf;
+	size_t size;
+	unsigned int refs;
+};
+
+static FLIST_HEAD(shared_read_regions);
+static pthread_mutex_t shared_read_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * How many max_bs buffers the io_us of td cycle through, as many as fit
+ * in a region after the alignment slack, but at least one
+ */
+unsigned int shared_read_nr_bufs(struct thread_data *td,
+				 unsigned long long max_bs)
+{
+	unsigned long long slack = 0, nr;
+
+	if (td->o.odirect || td->o.mem_align ||
+	    td_ioengine_flagged(td, FIO_RAWIO))
+		slack = page_mask + td->o.mem_align;
+
+	nr = 1;
+	if (max_bs + slack < SHARED_READ_REGION_SIZE)
+		nr = (SHARED_READ_REGION_SIZE - slack) / max_bs;
+
+	return min(nr, (unsigned long long) td->o.iodepth);
+}
+
+static struct shared_read_region *shared_read_region_new(size_t size)
+{
+	struct shared_read_region *sr;
+	void *buf = MAP_FAILED;
+
+	size = (size + SHARED_READ_REGION_SIZE - 1) &
+		~((size_t) SHARED_READ_REGION_SIZE - 1);
+
+	if (MAP_HUGETLB)
+		buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			   OS_MAP_ANON | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+	if (buf == MAP_FAILED) {
+		buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			   OS_MAP_ANON | MAP_PRIVATE, -1, 0);
+		if (buf == MAP_FAILED)
+			return NULL;
+#ifdef MADV_HUGEPAGE
+		madvise(buf, size, MADV_HUGEPAGE);
+#endif
+	}
+
+	sr = malloc(sizeof(*sr));
+	if (!sr) {
+		munmap(buf, size);
+		return NULL;
+	}
+	sr->buf = buf;
+	sr->size = size;
+	sr->refs = 0;
+	return sr;
+}
+
+static int alloc_mem_shared_read(struct thread_data *td, size_t total_mem)
+{
+	struct shared_read_region *sr;
+	struct flist_head *n;
+
+	if (td->io_ops->iomem_alloc) {
+		log_err("fio: shared_read_buffers conflicts with the IO engine\n");
+		return 1;
+	}
+
+	pthread_mutex_lock(&shared_read_lock);
+	flist_for_each(n, &shared_read_regions) {
+		sr = flist_entry(n, struct shared_read_region, list);
+		if (sr->size >= total_mem)
+			goto found;
+	}
+
+	sr = shared_read_region_new(total_mem);
+	if (!sr) {
+		pthread_mutex_unlock(&shared_read_lock);
+		return 1;
+	}
+	flist_add_tail(&sr->list, &shared_read_regions);
+found:
+	sr->refs++;
+	pthread_mutex_unlock(&shared_read_lock);
+
+	dprint(FD_MEM, "shared read region %p, %llu bytes\n", sr->buf,
+		(unsigned long long) sr->size);
+	td->shared_read_region = sr;
+	td->orig_buffer = sr->buf;
+	return 0;
+}
+
+static void free_mem_shared_read(struct thread_data *td)
+{
+	struct shared_read_region *sr = td->shared_read_region;
+
+	pthread_mutex_lock(&shared_read_lock);
+	if (!--sr->refs) {
+		flist_del(&sr->list);
+		munmap(sr->buf, sr->size);
+		free(sr);
+	}
+	pthread_mutex_unlock(&shared_read_lock);
+	td->shared_read_region = NULL;
+}
+
 /*
  * Set up the buffer area we need for io.
  */
 int allocate_io_mem(struct thread_data *td)
 {
 	size_t total_mem;
+	bool engine_mem = false;
 	int ret = 0;
 
 	if (td_ioengine_flagged(td, FIO_NOIO))
@@ -304,6 +719,15 @@ int allocate_io_mem(struct thread_data *td)
 
 	dprint(FD_MEM, "Alloc %llu for buffers\n", (unsigned long long) total_mem);
 
+	if (td->o.shared_read_buffers) {
+		ret = alloc_mem_shared_read(td, total_mem);
+		if (ret)
+			td_verror(td, ENOMEM, "iomem allocation");
+		else
+			mem_acct_set(td, MEM_IO_BUFS, total_mem);
+		return ret;
+	}
+
 	/*
 	 * If the IO engine has hooks to allocate/free memory and the user
 	 * doesn't explicitly ask for something else, use those. But fail if the
@@ -314,8 +738,11 @@ int allocate_io_mem(struct thread_data *td)
 		log_err("fio: option 'mem/iomem' conflicts with specified IO engine\n");
 		ret = 1;
 	} else if (td->io_ops->iomem_alloc &&
-		   !fio_option_is_set(&td->o, mem_type))
+		   !fio_option_is_set(&td->o, mem_type)) {
 		ret = td->io_ops->iomem_alloc(td, total_mem);
+		engine_mem = true;
+	} else if (td->o.mem_type == MEM_MALLOC && td->iomem_huge)
+		ret = alloc_mem_huge(td, total_mem);
 	else if (td->o.mem_type == MEM_MALLOC)
 		ret = alloc_mem_malloc(td, total_mem);
 	else if (td->o.mem_type == MEM_SHM || td->o.mem_type == MEM_SHMHUGE)
@@ -330,8 +757,15 @@ int allocate_io_mem(struct thread_data *td)
 		ret = 1;
 	}
 
-	if (ret)
+	if (ret) {
 		td_verror(td, ENOMEM, "iomem allocation");
+		return ret;
+	}
+
+	mem_acct_set(td, MEM_IO_BUFS, total_mem);
+	if (td->o.iomem_numa != IOMEM_NUMA_NONE && !engine_mem &&
+	    td->o.mem_type != MEM_CUDA_MALLOC && !td->o.mmapfile)
+		iomem_numa_place(td, total_mem);
 
 	return ret;
 }
@@ -344,10 +778,14 @@ void free_io_mem(struct thread_data *td)
 	if (td->o.odirect)
 		total_mem += page_mask;
 
-	if (td->io_ops->iomem_alloc && !fio_option_is_set(&td->o, mem_type)) {
+	if (td->shared_read_region)
+		free_mem_shared_read(td);
+	else if (td->io_ops->iomem_alloc && !fio_option_is_set(&td->o, mem_type)) {
 		if (td->io_ops->iomem_free)
 			td->io_ops->iomem_free(td);
-	} else if (td->o.mem_type == MEM_MALLOC)
+	} else if (td->iomem_huge_len)
+		free_mem_huge(td);
+	else if (td->o.mem_type == MEM_MALLOC)
 		free_mem_malloc(td);
 	else if (td->o.mem_type == MEM_SHM || td->o.mem_type == MEM_SHMHUGE)
 		free_mem_shm(td);
@@ -361,4 +799,5 @@ void free_io_mem(struct thread_data *td)
 
 	td->orig_buffer = NULL;
 	td->orig_buffer_size = 0;
+	mem_acct_set(td, MEM_IO_BUFS, 0);
 }
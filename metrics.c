@@ -0,0 +1,244 @@
+/*
+ * Push windowed per-job metrics to a collector as compact binary frames,
+ * driven by a helper thread timer. See metrics.h for the frame layout.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#include "fio.h"
+#include "server.h"
+#include "metrics.h"
+
+char *metrics_push = NULL;
+unsigned int metrics_interval = 1000;
+
+static union {
+	struct sockaddr sa;
+	struct sockaddr_in sin;
+	struct sockaddr_in6 sin6;
+	struct sockaddr_un sun;
+} metrics_addr;
+static socklen_t metrics_addr_len;
+
+/* Counters as of the previous push, per job */
+struct metrics_prev {
+	uint64_t io_blocks[DDIR_RWDIR_CNT];
+	uint64_t io_bytes[DDIR_RWDIR_CNT];
+	uint64_t plat[DDIR_RWDIR_CNT][FIO_IO_U_PLAT_NR];
+};
+
+static int metrics_fd = -1;
+static struct metrics_prev *metrics_prev;
+static unsigned int metrics_nr_prev;
+static struct timespec metrics_prev_time;
+static uint64_t metrics_seq;
+static uint64_t metrics_plat[FIO_IO_U_PLAT_NR];
+
+/*
+ * Accepts the same address forms as --client: sock:/path for a unix
+ * datagram socket, or [ip:|ip6:]host[,port] for UDP.
+ */
+int metrics_push_parse(const char *str)
+{
+	struct in_addr addr = { };
+	struct in6_addr addr6 = { };
+	char *dup, *host = NULL;
+	bool is_sock;
+	int port, ipv6, ret;
+
+	dup = strdup(str);
+	ret = fio_server_parse_string(dup, &host, &is_sock, &port, &addr,
+					&addr6, &ipv6);
+	free(dup);
+	if (ret)
+		return 1;
+
+	memset(&metrics_addr, 0, sizeof(metrics_addr));
+	if (is_sock) {
+		if (strlen(host) >= sizeof(metrics_addr.sun.sun_path)) {
+			log_err("fio: metrics socket path too long: %s\n", host);
+			free(host);
+			return 1;
+		}
+		metrics_addr.sun.sun_family = AF_UNIX;
+		strcpy(metrics_addr.sun.sun_path, host);
+		metrics_addr_len = sizeof(metrics_addr.sun);
+	} else if (!host) {
+		log_err("fio: metrics push needs a host: %s\n", str);
+		return 1;
+	} else if (ipv6) {
+		metrics_addr.sin6.sin6_family = AF_INET6;
+		metrics_addr.sin6.sin6_addr = addr6;
+		metrics_addr.sin6.sin6_port = htons(port);
+		metrics_addr_len = sizeof(metrics_addr.sin6);
+	} else {
+		metrics_addr.sin.sin_family = AF_INET;
+		metrics_addr.sin.sin_addr = addr;
+		metrics_addr.sin.sin_port = htons(port);
+		metrics_addr_len = sizeof(metrics_addr.sin);
+	}
+
+	free(host);
+	free(metrics_push);
+	metrics_push = strdup(str);
+	return 0;
+}
+
+void metrics_setup(void)
+{
+	if (!metrics_push || !metrics_interval)
+		return;
+
+	metrics_fd = socket(metrics_addr.sa.sa_family, SOCK_DGRAM, 0);
+	if (metrics_fd < 0) {
+		log_err("fio: metrics socket: %s\n", strerror(errno));
+		return;
+	}
+
+	metrics_nr_prev = thread_number;
+	metrics_prev = calloc(metrics_nr_prev, sizeof(*metrics_prev));
+	metrics_seq = 0;
+	fio_gettime(&metrics_prev_time, NULL);
+}
+
+void metrics_exit(void)
+{
+	if (metrics_fd < 0)
+		return;
+
+	/* one last window, covering the tail end of the run */
+	metrics_push_check();
+
+	close(metrics_fd);
+	metrics_fd = -1;
+	free(metrics_prev);
+	metrics_prev = NULL;
+	metrics_nr_prev = 0;
+}
+
+static uint64_t metrics_delta(uint64_t cur, uint64_t *prev)
+{
+	uint64_t val = cur >= *prev ? cur - *prev : cur;
+
+	*prev = cur;
+	return val;
+}
+
+static void metrics_fill_ddir(struct thread_data *td, struct metrics_prev *p,
+			      int ddir, uint64_t msec,
+			      struct metrics_ddir *md)
+{
+	static const double pcts[FIO_METRICS_NR_PCT] = {
+		50.0, 90.0, 99.0, 99.9,
+	};
+	uint64_t *cur = td->ts.io_u_plat[FIO_CLAT][ddir];
+	unsigned long long *ovals = NULL, minv, maxv, nr = 0;
+	fio_fp64_t plist[FIO_METRICS_NR_PCT + 1];
+	uint64_t ios, bytes;
+	int i;
+
+	ios = metrics_delta(td->io_blocks[ddir], &p->io_blocks[ddir]);
+	bytes = metrics_delta(td->io_bytes[ddir], &p->io_bytes[ddir]);
+
+	for (i = 0; i < FIO_IO_U_PLAT_NR; i++) {
+		metrics_plat[i] = metrics_delta(cur[i], &p->plat[ddir][i]);
+		nr += metrics_plat[i];
+	}
+
+	memset(md, 0, sizeof(*md));
+	md->ios = __cpu_to_le64(ios);
+	md->bytes = __cpu_to_le64(bytes);
+	md->iops = __cpu_to_le64(ios * 1000 / msec);
+	md->bw = __cpu_to_le64(bytes * 1000 / msec);
+
+	if (!nr)
+		return;
+
+	memset(plist, 0, sizeof(plist));
+	for (i = 0; i < FIO_METRICS_NR_PCT; i++)
+		plist[i].u.f = pcts[i];
+
+	if (calc_clat_percentiles(metrics_plat, nr, plist, &ovals, &maxv,
+				  &minv) == FIO_METRICS_NR_PCT) {
+		for (i = 0; i < FIO_METRICS_NR_PCT; i++)
+			md->clat_pct[i] = __cpu_to_le64(ovals[i]);
+	}
+
+	free(ovals);
+}
+
+static void metrics_send(void *buf, size_t len)
+{
+	/*
+	 * Never wait on the collector, a frame that can't be sent right
+	 * away is dropped.
+	 */
+	if (sendto(metrics_fd, buf, len, MSG_DONTWAIT, &metrics_addr.sa,
+		   metrics_addr_len) < 0)
+		dprint(FD_HELPERTHREAD, "metrics: sendto: %s\n",
+			strerror(errno));
+}
+
+int metrics_push_check(void)
+{
+	const unsigned int per_frame = (FIO_METRICS_MAX_FRAME -
+		sizeof(struct metrics_frame_hdr)) / sizeof(struct metrics_job);
+	char buf[FIO_METRICS_MAX_FRAME];
+	struct metrics_frame_hdr *hdr = (void *) buf;
+	struct metrics_job *jobs = (void *) (hdr + 1);
+	unsigned int nr_jobs, nr_frames, frame = 0, nr = 0;
+	struct timespec now;
+	struct timeval tv;
+	uint64_t msec;
+
+	if (metrics_fd < 0 || !metrics_prev)
+		return 0;
+
+	fio_gettime(&now, NULL);
+	msec = mtime_since(&metrics_prev_time, &now);
+	if (!msec)
+		msec = 1;
+	metrics_prev_time = now;
+	gettimeofday(&tv, NULL);
+
+	nr_jobs = min(thread_number, metrics_nr_prev);
+	nr_frames = (nr_jobs + per_frame - 1) / per_frame;
+
+	hdr->magic = __cpu_to_le32(FIO_METRICS_MAGIC);
+	hdr->version = __cpu_to_le16(FIO_METRICS_VERSION);
+	hdr->seq = __cpu_to_le64(metrics_seq++);
+	hdr->timestamp_ms = __cpu_to_le64((uint64_t) tv.tv_sec * 1000 +
+					tv.tv_usec / 1000);
+	hdr->interval_ms = __cpu_to_le32(msec);
+	hdr->nr_frames = __cpu_to_le16(nr_frames);
+
+	for_each_td(td) {
+		struct metrics_job *mj = &jobs[nr];
+		int ddir;
+
+		if (__td_index >= nr_jobs)
+			break;
+
+		mj->thread_number = __cpu_to_le32(td->thread_number);
+		mj->groupid = __cpu_to_le32(td->groupid);
+		mj->runstate = __cpu_to_le32(td->runstate);
+		mj->error = __cpu_to_le32(td->error);
+		for (ddir = 0; ddir < DDIR_RWDIR_CNT; ddir++)
+			metrics_fill_ddir(td, &metrics_prev[__td_index], ddir,
+					  msec, &mj->ddir[ddir]);
+
+		if (++nr == per_frame || __td_index == nr_jobs - 1) {
+			hdr->nr_jobs = __cpu_to_le16(nr);
+			hdr->frame = __cpu_to_le16(frame++);
+			metrics_send(buf, sizeof(*hdr) + nr * sizeof(*mj));
+			nr = 0;
+		}
+	} end_for_each();
+
+	return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef FIO_METRICS_H
+#define FIO_METRICS_H
+
+#include <inttypes.h>
+#include "io_ddir.h"
+
+#define FIO_METRICS_MAGIC	0x6d6f6966	/* "fiom" */
+#define FIO_METRICS_VERSION	1
+
+/* p50, p90, p99 and p99.9 of completion latency */
+#define FIO_METRICS_NR_PCT	4
+
+/* Frames are kept below this, so one interval may take several */
+#define FIO_METRICS_MAX_FRAME	8192
+
+/*
+ * Live metrics are pushed as datagrams, one or more frames per interval.
+ * Each frame is a header followed by nr_jobs job entries. All fields are
+ * little endian. Frames from the same interval share the same seq.
+ */
+struct metrics_frame_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t nr_jobs;
+	uint64_t seq;
+	uint64_t timestamp_ms;		/* wall clock, ms since the epoch */
+	uint32_t interval_ms;		/* window the rates below cover */
+	uint16_t frame;
+	uint16_t nr_frames;
+};
+
+struct metrics_ddir {
+	uint64_t ios;			/* completed in this window */
+	uint64_t bytes;
+	uint64_t iops;
+	uint64_t bw;			/* bytes/sec */
+	uint64_t clat_pct[FIO_METRICS_NR_PCT];	/* nsec */
+};
+
+struct metrics_job {
+	uint32_t thread_number;
+	uint32_t groupid;
+	uint32_t runstate;
+	uint32_t error;
+	struct metrics_ddir ddir[DDIR_RWDIR_CNT];
+};
+
+extern int metrics_push_parse(const char *);
+extern void metrics_setup(void);
+extern void metrics_exit(void);
+extern int metrics_push_check(void);
+
+extern char *metrics_push;
+extern unsigned int metrics_interval;
+
+#endif
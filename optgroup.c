@@ -189,6 +189,14 @@ static const struct opt_group fio_opt_cat_groups[] = {
 		.name	= "NFS I/O engine", /* nfs */
 		.mask	= FIO_OPT_G_NFS,
 	},
+	{
+		.name	= "NVMe/TCP I/O engine", /* nvmetcp */
+		.mask	= FIO_OPT_G_NVMETCP,
+	},
+	{
+		.name	= "LSM key/value store like profile",
+		.mask	= FIO_OPT_G_LSM,
+	},
 	{
 		.name	= NULL,
 	},
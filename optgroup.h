@@ -74,6 +74,8 @@ enum opt_category_group {
 	__FIO_OPT_G_WINDOWSAIO,
 	__FIO_OPT_G_XNVME,
 	__FIO_OPT_G_LIBBLKIO,
+	__FIO_OPT_G_NVMETCP,
+	__FIO_OPT_G_LSM,
 
 	FIO_OPT_G_RATE		= (1ULL << __FIO_OPT_G_RATE),
 	FIO_OPT_G_ZONE		= (1ULL << __FIO_OPT_G_ZONE),
@@ -122,6 +124,8 @@ enum opt_category_group {
 	FIO_OPT_G_WINDOWSAIO	= (1ULL << __FIO_OPT_G_WINDOWSAIO),
 	FIO_OPT_G_XNVME         = (1ULL << __FIO_OPT_G_XNVME),
 	FIO_OPT_G_LIBBLKIO	= (1ULL << __FIO_OPT_G_LIBBLKIO),
+	FIO_OPT_G_NVMETCP	= (1ULL << __FIO_OPT_G_NVMETCP),
+	FIO_OPT_G_LSM		= (1ULL << __FIO_OPT_G_LSM),
 };
 
 extern const struct opt_group *opt_group_from_mask(uint64_t *mask);
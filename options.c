@@ -15,6 +15,10 @@
 #include "options.h"
 #include "optgroup.h"
 #include "zbd.h"
+#ifdef FIO_HAVE_CPUS_AUTO
+#include <sys/sysmacros.h>
+#include "oslib/linux-dev-lookup.h"
+#endif
 
 char client_sockaddr_str[INET6_ADDRSTRLEN] = { 0 };
 
@@ -133,51 +137,52 @@ int split_parse_ddir(struct thread_options *o, struct split *split,
 	return 0;
 }
 
-static int bssplit_ddir(struct thread_options *o, void *eo,
-			enum fio_ddir ddir, char *str, bool data)
+/*
+ * Parse a bs/perc:bs/perc list into a sorted bssplit array, also used for
+ * the per phase block size distributions.
+ */
+int bssplit_parse(struct thread_options *o, char *str, struct bssplit **bssplit,
+		  unsigned int *nr, unsigned long long *min_bs,
+		  unsigned long long *max_bs)
 {
 	unsigned int i, perc, perc_missing;
-	unsigned long long max_bs, min_bs;
+	struct bssplit *bsp;
 	struct split split;
 
 	memset(&split, 0, sizeof(split));
 
-	if (split_parse_ddir(o, &split, str, data, BSSPLIT_MAX))
+	if (split_parse_ddir(o, &split, str, false, BSSPLIT_MAX))
 		return 1;
 	if (!split.nr)
 		return 0;
 
-	max_bs = 0;
-	min_bs = -1;
-	o->bssplit[ddir] = malloc(split.nr * sizeof(struct bssplit));
-	o->bssplit_nr[ddir] = split.nr;
+	*max_bs = 0;
+	*min_bs = -1;
+	bsp = malloc(split.nr * sizeof(struct bssplit));
 	for (i = 0; i < split.nr; i++) {
-		if (split.val1[i] > max_bs)
-			max_bs = split.val1[i];
-		if (split.val1[i] < min_bs)
-			min_bs = split.val1[i];
+		if (split.val1[i] > *max_bs)
+			*max_bs = split.val1[i];
+		if (split.val1[i] < *min_bs)
+			*min_bs = split.val1[i];
 
-		o->bssplit[ddir][i].bs = split.val1[i];
-		o->bssplit[ddir][i].perc =split.val2[i];
+		bsp[i].bs = split.val1[i];
+		bsp[i].perc =split.val2[i];
 	}
 
 	/*
 	 * Now check if the percentages add up, and how much is missing
 	 */
 	perc = perc_missing = 0;
-	for (i = 0; i < o->bssplit_nr[ddir]; i++) {
-		struct bssplit *bsp = &o->bssplit[ddir][i];
-
-		if (bsp->perc == -1U)
+	for (i = 0; i < split.nr; i++) {
+		if (bsp[i].perc == -1U)
 			perc_missing++;
 		else
-			perc += bsp->perc;
+			perc += bsp[i].perc;
 	}
 
 	if (perc > 100 && perc_missing > 1) {
 		log_err("fio: bssplit percentages add to more than 100%%\n");
-		free(o->bssplit[ddir]);
-		o->bssplit[ddir] = NULL;
+		free(bsp);
 		return 1;
 	}
 
@@ -186,23 +191,37 @@ static int bssplit_ddir(struct thread_options *o, void *eo,
 	 * them.
 	 */
 	if (perc_missing) {
-		if (perc_missing == 1 && o->bssplit_nr[ddir] == 1)
+		if (perc_missing == 1 && split.nr == 1)
 			perc = 100;
-		for (i = 0; i < o->bssplit_nr[ddir]; i++) {
-			struct bssplit *bsp = &o->bssplit[ddir][i];
-
-			if (bsp->perc == -1U)
-				bsp->perc = (100 - perc) / perc_missing;
+		for (i = 0; i < split.nr; i++) {
+			if (bsp[i].perc == -1U)
+				bsp[i].perc = (100 - perc) / perc_missing;
 		}
 	}
 
-	o->min_bs[ddir] = min_bs;
-	o->max_bs[ddir] = max_bs;
-
 	/*
 	 * now sort based on percentages, for ease of lookup
 	 */
-	qsort(o->bssplit[ddir], o->bssplit_nr[ddir], sizeof(struct bssplit), bs_cmp);
+	qsort(bsp, split.nr, sizeof(struct bssplit), bs_cmp);
+	*bssplit = bsp;
+	*nr = split.nr;
+	return 0;
+}
+
+static int bssplit_ddir(struct thread_options *o, void *eo,
+			enum fio_ddir ddir, char *str, bool data)
+{
+	unsigned long long min_bs, max_bs;
+	unsigned int nr = 0;
+
+	if (bssplit_parse(o, str, &o->bssplit[ddir], &nr, &min_bs, &max_bs))
+		return 1;
+	if (!nr)
+		return 0;
+
+	o->bssplit_nr[ddir] = nr;
+	o->min_bs[ddir] = min_bs;
+	o->max_bs[ddir] = max_bs;
 	return 0;
 }
 
@@ -778,6 +797,189 @@ static int set_cpus_allowed(struct thread_data *td, os_cpu_mask_t *mask,
 	return ret;
 }
 
+#ifdef FIO_HAVE_CPUS_AUTO
+struct cpus_auto {
+	struct thread_data *td;
+	os_cpu_mask_t local;
+	bool have_local;
+	os_cpu_mask_t *queues;
+	unsigned int nr_queues;
+};
+
+static void cpu_mask_and(os_cpu_mask_t *dst, os_cpu_mask_t *src)
+{
+	long i, max_cpu = cpus_configured();
+
+	for (i = 0; i < max_cpu; i++)
+		if (fio_cpu_isset(dst, i) && !fio_cpu_isset(src, i))
+			fio_cpu_clear(dst, i);
+}
+
+static void cpu_mask_or(os_cpu_mask_t *dst, os_cpu_mask_t *src)
+{
+	long i, max_cpu = cpus_configured();
+
+	for (i = 0; i < max_cpu; i++)
+		if (fio_cpu_isset(src, i))
+			fio_cpu_set(dst, i);
+}
+
+static void cpu_mask_gtod_clear(struct thread_data *td, os_cpu_mask_t *mask)
+{
+	if (td->o.gtod_cpu)
+		fio_cpu_clear(mask, td->o.gtod_cpu);
+}
+
+/*
+ * Keep the CPUs of each hardware queue that are on the node of the device
+ */
+static int cpus_auto_queue(unsigned int queue, const char *list, void *data)
+{
+	struct cpus_auto *ca = data;
+	os_cpu_mask_t mask;
+
+	if (set_cpus_allowed(ca->td, &mask, list))
+		return -1;
+	if (ca->have_local)
+		cpu_mask_and(&mask, &ca->local);
+	cpu_mask_gtod_clear(ca->td, &mask);
+	if (!fio_cpu_count(&mask))
+		return 0;
+
+	ca->queues = realloc(ca->queues,
+			     (ca->nr_queues + 1) * sizeof(*ca->queues));
+	ca->queues[ca->nr_queues++] = mask;
+	return 0;
+}
+
+/*
+ * Look up the node and the hardware queues of the first file of the job
+ * that is on a block device sysfs knows about. A file that is not there
+ * yet is looked up by the directory it will be created in.
+ */
+static int cpus_auto_lookup(struct thread_data *td, struct cpus_auto *ca,
+			    int *node)
+{
+	char cpus[4096], *dir, *p;
+	struct fio_file *f;
+	unsigned int i;
+	struct stat sb;
+	dev_t dev;
+	int ret;
+
+	for_each_file(td, f, i) {
+		if (stat(f->file_name, &sb) < 0) {
+			dir = strdup(f->file_name);
+			p = strrchr(dir, '/');
+			if (p)
+				*p = '\0';
+			ret = stat(p ? (p == dir ? "/" : dir) : ".", &sb);
+			free(dir);
+			if (ret < 0)
+				continue;
+		}
+		dev = S_ISBLK(sb.st_mode) ? sb.st_rdev : sb.st_dev;
+
+		*node = blk_dev_numa_node(major(dev), minor(dev));
+		ca->have_local = false;
+		if (*node >= 0 && !numa_node_cpu_list(*node, cpus, sizeof(cpus))) {
+			if (set_cpus_allowed(td, &ca->local, cpus))
+				return -1;
+			ca->have_local = true;
+		}
+
+		ca->nr_queues = 0;
+		ret = blk_dev_for_each_queue(major(dev), minor(dev),
+					     cpus_auto_queue, ca);
+		if (ret < 0)
+			return -1;
+
+		dprint(FD_PROCESS, "%s: cpus auto: %u:%u node %d, %u of %d "
+			"queues local\n", f->file_name, major(dev), minor(dev),
+			*node, ca->nr_queues, ret);
+		if (ca->have_local || ca->nr_queues)
+			return 0;
+	}
+
+	return 1;
+}
+
+static void cpu_mask_str(os_cpu_mask_t *mask, char *buf, size_t len)
+{
+	long i, start = -1, max_cpu = cpus_configured();
+	size_t off = 0;
+
+	buf[0] = '\0';
+	for (i = 0; i <= max_cpu && off < len; i++) {
+		bool set = i < max_cpu && fio_cpu_isset(mask, i);
+
+		if (set && start < 0)
+			start = i;
+		if (set || start < 0)
+			continue;
+		if (start == i - 1)
+			off += snprintf(buf + off, len - off, "%s%ld",
+					off ? "," : "", start);
+		else
+			off += snprintf(buf + off, len - off, "%s%ld-%ld",
+					off ? "," : "", start, i - 1);
+		start = -1;
+	}
+}
+
+/*
+ * cpus_allowed=auto. With the shared policy, the job may run on any CPU
+ * of the node the device is on. With split, each job gets one CPU of a
+ * node local hardware queue, going round the queues first so that jobs
+ * submit and complete on queues of their own for as long as there are
+ * enough. Returns 1 if mask was set, 0 if there is nothing to go by.
+ */
+int fio_cpus_auto(struct thread_data *td, os_cpu_mask_t *mask)
+{
+	unsigned int index = td->thread_number - 1, q, queue = 0;
+	struct cpus_auto ca = { .td = td, };
+	char str[256];
+	int node, ret;
+
+	ret = cpus_auto_lookup(td, &ca, &node);
+	if (ret) {
+		free(ca.queues);
+		if (ret > 0)
+			log_info("%s: cpus_allowed=auto: no device placement "
+				 "found, not pinning\n", td->o.name);
+		return ret < 0 ? -1 : 0;
+	}
+
+	fio_cpuset_init(mask);
+	if (td->o.cpus_allowed_policy == FIO_CPUS_SPLIT && ca.nr_queues) {
+		queue = index % ca.nr_queues;
+		*mask = ca.queues[queue];
+		fio_cpus_split(mask, index / ca.nr_queues);
+	} else {
+		if (ca.have_local)
+			*mask = ca.local;
+		else {
+			for (q = 0; q < ca.nr_queues; q++)
+				cpu_mask_or(mask, &ca.queues[q]);
+		}
+		cpu_mask_gtod_clear(td, mask);
+		if (td->o.cpus_allowed_policy == FIO_CPUS_SPLIT)
+			fio_cpus_split(mask, index);
+	}
+	free(ca.queues);
+
+	cpu_mask_str(mask, str, sizeof(str));
+	if (td->o.cpus_allowed_policy == FIO_CPUS_SPLIT && ca.nr_queues)
+		log_info("%s: cpus_allowed=auto: node %d, hw queue %u of %u, "
+			 "cpus %s\n", td->o.name, node, queue, ca.nr_queues, str);
+	else
+		log_info("%s: cpus_allowed=auto: node %d, cpus %s\n",
+			 td->o.name, node, str);
+
+	return fio_cpu_count(mask) ? 1 : 0;
+}
+#endif
+
 static int str_cpus_allowed_cb(void *data, const char *input)
 {
 	struct thread_data *td = cb_data_to_td(data);
@@ -785,6 +987,17 @@ static int str_cpus_allowed_cb(void *data, const char *input)
 	if (parse_dryrun())
 		return 0;
 
+	td->o.cpus_allowed_auto = !strcmp(input, "auto");
+	if (td->o.cpus_allowed_auto) {
+#ifdef FIO_HAVE_CPUS_AUTO
+		return fio_cpuset_init(&td->o.cpumask);
+#else
+		log_err("fio: cpus_allowed=auto is not supported on this "
+			"platform\n");
+		return 1;
+#endif
+	}
+
 	return set_cpus_allowed(td, &td->o.cpumask, input);
 }
 
@@ -945,6 +1158,38 @@ static int str_numa_mpol_cb(void *data, char *input)
 out:
 	return 1;
 }
+
+static int str_iomem_numa_cb(void *data, const char *input)
+{
+	struct thread_data *td = cb_data_to_td(data);
+	char *end;
+	long node;
+
+	if (!strcmp(input, "none")) {
+		td->o.iomem_numa = IOMEM_NUMA_NONE;
+		return 0;
+	} else if (!strcmp(input, "cpus")) {
+		td->o.iomem_numa = IOMEM_NUMA_CPUS;
+		return 0;
+	} else if (!strcmp(input, "device")) {
+		td->o.iomem_numa = IOMEM_NUMA_DEVICE;
+		return 0;
+	}
+
+	node = strtol(input, &end, 10);
+	if (end == input || *end || node < 0) {
+		log_err("fio: iomem_numa should be: none, cpus, device or a node\n");
+		return 1;
+	}
+	if (numa_available() < 0 || node > numa_max_node()) {
+		log_err("fio: iomem_numa: NUMA node %ld doesn't exist\n", node);
+		return 1;
+	}
+
+	td->o.iomem_numa = IOMEM_NUMA_NODE;
+	td->o.iomem_numa_node = node;
+	return 0;
+}
 #endif
 
 static int str_fst_cb(void *data, const char *str)
@@ -1270,7 +1515,8 @@ static int str_steadystate_cb(void *data, const char *str)
 	long long ll;
 
 	if (td->o.ss_state != FIO_SS_IOPS && td->o.ss_state != FIO_SS_IOPS_SLOPE &&
-	    td->o.ss_state != FIO_SS_BW && td->o.ss_state != FIO_SS_BW_SLOPE) {
+	    td->o.ss_state != FIO_SS_BW && td->o.ss_state != FIO_SS_BW_SLOPE &&
+	    td->o.ss_state != FIO_SS_LAT && td->o.ss_state != FIO_SS_LAT_SLOPE) {
 		/* should be impossible to get here */
 		log_err("fio: unknown steady state criterion\n");
 		return 1;
@@ -1314,6 +1560,20 @@ static int str_steadystate_cb(void *data, const char *str)
 			return 0;
 
 		td->o.ss_limit.u.f = val;
+	} else if (td->o.ss_state & FIO_SS_LAT) {
+		if (check_str_time(nr, &ll, 0)) {
+			log_err("fio: steadystate latency threshold postfix parsing failed\n");
+			free(nr);
+			return 1;
+		}
+
+		dprint(FD_PARSE, "set steady state latency threshold to %lld usec\n", ll);
+		free(nr);
+		if (parse_dryrun())
+			return 0;
+
+		/* latencies are tracked in nsec */
+		td->o.ss_limit.u.f = (double) ll * 1000.0;
 	} else {	/* bandwidth criterion */
 		if (str_to_decimal(nr, &ll, 1, td, 0, 0)) {
 			log_err("fio: steadystate BW threshold postfix parsing failed\n");
@@ -1913,6 +2173,19 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 			  },
 		},
 	},
+	{
+		.name	= "lockfile_stripe",
+		.lname	= "Lockfile stripe",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct thread_options, lockfile_stripe),
+		.help	= "Lock only the stripes of this size an IO touches",
+		.parent	= "lockfile",
+		.hide	= 1,
+		.def	= "0",
+		.interval = 4096,
+		.category = FIO_OPT_C_FILE,
+		.group	= FIO_OPT_G_FILENAME,
+	},
 	{
 		.name	= "opendir",
 		.lname	= "Open directory",
@@ -2233,6 +2506,18 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_IO,
 		.group	= FIO_OPT_G_IO_BASIC,
 	},
+	{
+		.name	= "iodepth_batch_complete_adaptive",
+		.lname	= "Adaptive IO depth batch complete",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct thread_options, iodepth_batch_complete_adaptive),
+		.help	= "Scale the number of IOs to reap with the average depth",
+		.parent	= "iodepth",
+		.hide	= 1,
+		.def	= "0",
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_IO_BASIC,
+	},
 	{
 		.name	= "iodepth_low",
 		.lname	= "IO Depth batch low",
@@ -2276,6 +2561,39 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 			  },
 		},
 	},
+	{
+		.name	= "sync_workers",
+		.lname	= "Sync engine workers",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct thread_options, sync_workers),
+		.help	= "Run a synchronous engine from this many threads to honour iodepth",
+		.def	= "0",
+		.parent	= "iodepth",
+		.hide	= 1,
+		.interval = 1,
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_IO_BASIC,
+	},
+	{
+		.name	= "freelist_order",
+		.lname	= "Free list order",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct thread_options, freelist_order),
+		.help	= "Order in which completed IO units are reused",
+		.def	= "lifo",
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_IO_BASIC,
+		.posval = {
+			  { .ival = "lifo",
+			    .oval = FREELIST_ORDER_LIFO,
+			    .help = "Reuse the most recently completed IO unit",
+			  },
+			  { .ival = "fifo",
+			    .oval = FREELIST_ORDER_FIFO,
+			    .help = "Reuse IO units in completion order",
+			  },
+		},
+	},
 	{
 		.name	= "size",
 		.lname	= "Size",
@@ -2463,6 +2781,54 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_IO,
 		.group	= FIO_OPT_G_INVALID,
 	},
+	{
+		.name	= "num_range",
+		.lname	= "Number of trim ranges",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct thread_options, num_range),
+		.help	= "Number of ranges to coalesce into one trim command",
+		.def	= "1",
+		.minval	= 1,
+		.maxval	= 256,
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "trim_mode",
+		.lname	= "Trim mode",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct thread_options, trim_mode),
+		.help	= "What a trim does to the blocks it covers",
+		.def	= "discard",
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_INVALID,
+		.posval	= {
+			  { .ival = "discard",
+			    .oval = TRIM_MODE_DISCARD,
+			    .help = "Discard (deallocate) the blocks",
+			  },
+			  { .ival = "write_zeroes",
+			    .oval = TRIM_MODE_WRITE_ZEROES,
+			    .help = "Have the device write zeroes to the blocks",
+			  },
+			  { .ival = "copy",
+			    .oval = TRIM_MODE_COPY,
+			    .help = "Have the device copy other blocks over them",
+			  },
+			  { .ival = "allocate",
+			    .oval = TRIM_MODE_ALLOCATE,
+			    .help = "fallocate() the blocks, extending the file",
+			  },
+			  { .ival = "punch_hole",
+			    .oval = TRIM_MODE_PUNCH_HOLE,
+			    .help = "Punch a hole in the file over the blocks",
+			  },
+			  { .ival = "truncate",
+			    .oval = TRIM_MODE_TRUNCATE,
+			    .help = "ftruncate() the file to the end of the blocks",
+			  },
+		},
+	},
 	{
 		.name	= "randrepeat",
 		.lname	= "Random repeatable",
@@ -2510,6 +2876,16 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_IO,
 		.group	= FIO_OPT_G_RANDOM,
 	},
+	{
+		.name	= "randommap_shared",
+		.lname	= "Shared randommap",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct thread_options, randommap_shared),
+		.help	= "Share the random map with other threads on the same file",
+		.def	= "0",
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_RANDOM,
+	},
 	{
 		.name	= "random_generator",
 		.lname	= "Random Generator",
@@ -2531,10 +2907,26 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 			    .oval = FIO_RAND_GEN_TAUSWORTHE64,
 			    .help = "64-bit Tausworthe variant",
 			  },
+			  {
+			    .ival = "xoshiro256",
+			    .oval = FIO_RAND_GEN_XOSHIRO,
+			    .help = "64-bit xoshiro256** generator",
+			  },
 		},
 		.category = FIO_OPT_C_IO,
 		.group	= FIO_OPT_G_RANDOM,
 	},
+	{
+		.name	= "random_partition",
+		.lname	= "Random partition",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct thread_options, random_partition),
+		.help	= "Split one LFSR sequence between the numjobs clones of a job",
+		.parent	= "random_generator",
+		.def	= "0",
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_RANDOM,
+	},
 	{
 		.name	= "random_distribution",
 		.lname	= "Random Distribution",
@@ -2616,6 +3008,43 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_FILE,
 		.group	= FIO_OPT_G_INVALID,
 	},
+	{
+		.name	= "tree_depth",
+		.lname	= "Directory tree depth",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct thread_options, tree_depth),
+		.help	= "Spread generated files over a directory tree this deep",
+		.def	= "0",
+		.maxval	= 16,
+		.category = FIO_OPT_C_FILE,
+		.group	= FIO_OPT_G_FILENAME,
+	},
+	{
+		.name	= "tree_fanout",
+		.lname	= "Directory tree fanout",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct thread_options, tree_fanout),
+		.help	= "Number of subdirectories in each tree directory",
+		.def	= "8",
+		.minval	= 1,
+		.parent	= "tree_depth",
+		.hide	= 1,
+		.category = FIO_OPT_C_FILE,
+		.group	= FIO_OPT_G_FILENAME,
+	},
+	{
+		.name	= "tree_files",
+		.lname	= "Files per tree leaf",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct thread_options, tree_files),
+		.help	= "Number of files in each leaf directory of the tree",
+		.def	= "16",
+		.minval	= 1,
+		.parent	= "tree_depth",
+		.hide	= 1,
+		.category = FIO_OPT_C_FILE,
+		.group	= FIO_OPT_G_FILENAME,
+	},
 	{
 		.name	= "openfiles",
 		.lname	= "Number of open files",
@@ -2839,7 +3268,7 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.lname	= "Atomic I/O",
 		.type	= FIO_OPT_BOOL,
 		.off1	= offsetof(struct thread_options, oatomic),
-		.help	= "Use Atomic IO with O_DIRECT (implies O_DIRECT)",
+		.help	= "Use atomic writes with O_DIRECT (implies O_DIRECT)",
 		.def	= "0",
 		.category = FIO_OPT_C_IO,
 		.group	= FIO_OPT_G_IO_TYPE,
@@ -3037,6 +3466,16 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_IO,
 		.group	= FIO_OPT_G_INVALID,
 	},
+	{
+		.name	= "shared_read_buffers",
+		.lname	= "Shared read buffers",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct thread_options, shared_read_buffers),
+		.help	= "Read into a small buffer region shared by all jobs",
+		.def	= "0",
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_INVALID,
+	},
 	{
 		.name	= "verify",
 		.lname	= "Verify",
@@ -3229,6 +3668,18 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_IO,
 		.group	= FIO_OPT_G_VERIFY,
 	},
+	{
+		.name	= "verify_threads",
+		.lname	= "Verify threads",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct thread_options, verify_threads),
+		.def	= "0",
+		.help	= "Number of threads the verify phase issues its reads from",
+		.parent	= "verify",
+		.hide	= 1,
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_VERIFY,
+	},
 	{
 		.name	= "verify_backlog",
 		.lname	= "Verify backlog",
@@ -3251,6 +3702,28 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_IO,
 		.group	= FIO_OPT_G_VERIFY,
 	},
+	{
+		.name	= "verify_backlog_mode",
+		.lname	= "Verify backlog mode",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct thread_options, verify_backlog_mode),
+		.help	= "How backlog verify reads are issued",
+		.def	= "batch",
+		.parent	= "verify_backlog",
+		.hide	= 1,
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_VERIFY,
+		.posval	= {
+			  { .ival = "batch",
+			    .oval = VERIFY_BACKLOG_BATCH,
+			    .help = "Verify a batch after each backlog of writes",
+			  },
+			  { .ival = "interleave",
+			    .oval = VERIFY_BACKLOG_INTERLEAVE,
+			    .help = "Spread verify reads between the writes",
+			  },
+		},
+	},
 #ifdef FIO_HAVE_CPU_AFFINITY
 	{
 		.name	= "verify_async_cpus",
@@ -3283,35 +3756,105 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.group	= FIO_OPT_G_VERIFY,
 	},
 	{
-		.name	= "verify_state_load",
-		.lname	= "Load verify state",
-		.off1	= offsetof(struct thread_options, verify_state),
+		.name	= "verify_bitmap",
+		.lname	= "Verify bitmap",
+		.off1	= offsetof(struct thread_options, verify_bitmap),
 		.type	= FIO_OPT_BOOL,
-		.help	= "Load verify termination state",
+		.help	= "Track written blocks for verify in a bitmap",
+		.def	= "0",
 		.parent	= "verify",
 		.category = FIO_OPT_C_IO,
 		.group	= FIO_OPT_G_VERIFY,
 	},
 	{
-		.name	= "verify_state_save",
-		.lname	= "Save verify state",
-		.off1	= offsetof(struct thread_options, verify_state_save),
+		.name	= "verify_table",
+		.lname	= "Verify table",
+		.off1	= offsetof(struct thread_options, verify_table),
 		.type	= FIO_OPT_BOOL,
-		.def	= "1",
-		.help	= "Save verify state on termination",
+		.help	= "Keep block checksums in a table instead of headers",
+		.def	= "0",
 		.parent	= "verify",
 		.category = FIO_OPT_C_IO,
 		.group	= FIO_OPT_G_VERIFY,
 	},
-#ifdef FIO_HAVE_TRIM
 	{
-		.name	= "trim_percentage",
-		.lname	= "Trim percentage",
-		.type	= FIO_OPT_INT,
-		.off1	= offsetof(struct thread_options, trim_percentage),
-		.minval = 0,
-		.maxval = 100,
-		.help	= "Number of verify blocks to trim (i.e., discard)",
+		.name	= "verify_sample_rate",
+		.lname	= "Verify sample rate",
+		.type	= FIO_OPT_FLOAT_LIST,
+		.off1	= offsetof(struct thread_options, verify_sample_rate),
+		.help	= "Percentage of written blocks to verify",
+		.def	= "100",
+		.maxlen	= 1,
+		.minfp	= 0.0,
+		.maxfp	= 100.0,
+		.parent	= "verify",
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_VERIFY,
+	},
+	{
+		.name	= "verify_sample_mode",
+		.lname	= "Verify sample mode",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct thread_options, verify_sample_mode),
+		.help	= "How verify_sample_rate picks the blocks to verify",
+		.def	= "uniform",
+		.parent	= "verify_sample_rate",
+		.posval	= {
+			  { .ival = "uniform",
+			    .oval = VERIFY_SAMPLE_UNIFORM,
+			    .help = "Same chance for every written block",
+			  },
+			  { .ival = "recent",
+			    .oval = VERIFY_SAMPLE_RECENT,
+			    .help = "Chance grows with how recently a block was written",
+			  },
+		},
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_VERIFY,
+	},
+	{
+		.name	= "verify_state_load",
+		.lname	= "Load verify state",
+		.off1	= offsetof(struct thread_options, verify_state),
+		.type	= FIO_OPT_BOOL,
+		.help	= "Load verify termination state",
+		.parent	= "verify",
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_VERIFY,
+	},
+	{
+		.name	= "verify_state_save",
+		.lname	= "Save verify state",
+		.off1	= offsetof(struct thread_options, verify_state_save),
+		.type	= FIO_OPT_BOOL,
+		.def	= "1",
+		.help	= "Save verify state on termination",
+		.parent	= "verify",
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_VERIFY,
+	},
+	{
+		.name	= "verify_state_interval",
+		.lname	= "Verify state checkpoint interval",
+		.type	= FIO_OPT_STR_VAL_TIME,
+		.off1	= offsetof(struct thread_options, verify_state_interval),
+		.help	= "Append a verify state checkpoint at this interval",
+		.def	= "0",
+		.is_seconds = 1,
+		.is_time = 1,
+		.parent	= "verify_state_save",
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_VERIFY,
+	},
+#ifdef FIO_HAVE_TRIM
+	{
+		.name	= "trim_percentage",
+		.lname	= "Trim percentage",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct thread_options, trim_percentage),
+		.minval = 0,
+		.maxval = 100,
+		.help	= "Number of verify blocks to trim (i.e., discard)",
 		.parent	= "verify",
 		.def	= "0",
 		.interval = 1,
@@ -3390,6 +3933,27 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_IO,
 		.group	= FIO_OPT_G_IOLOG,
 	},
+	{
+		.name	= "write_iolog_format",
+		.lname	= "Write I/O log format",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct thread_options, write_iolog_format),
+		.parent	= "write_iolog",
+		.help	= "Format of the IO pattern written by write_iolog",
+		.def	= "text",
+		.posval	= {
+			  { .ival = "text",
+			    .oval = IOLOG_FORMAT_TEXT,
+			    .help = "Version 3 text iolog",
+			  },
+			  { .ival = "binary",
+			    .oval = IOLOG_FORMAT_BINARY,
+			    .help = "Compiled iolog, as written by --iolog-compile",
+			  },
+		},
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_IOLOG,
+	},
 	{
 		.name	= "read_iolog",
 		.lname	= "Read I/O log",
@@ -3422,6 +3986,17 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_IO,
 		.group	= FIO_OPT_G_IOLOG,
 	},
+	{
+		.name	= "replay_queue_depth",
+		.lname	= "Replay queue depth",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct thread_options, replay_queue_depth),
+		.def	= "0",
+		.parent	= "read_iolog",
+		.help	= "Replay with the queue depth profile of a blktrace trace",
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_IOLOG,
+	},
 	{
 		.name	= "replay_redirect",
 		.lname	= "Redirect device for replay",
@@ -3479,6 +4054,31 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_IO,
 		.group	= FIO_OPT_G_IOLOG,
 	},
+	{
+		.name	= "replay_shard",
+		.lname	= "Replay shard",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct thread_options, replay_shard),
+		.parent	= "read_iolog",
+		.help	= "Split the replayed IO between the clones of the job",
+		.def	= "none",
+		.posval	= {
+			  { .ival = "none",
+			    .oval = REPLAY_SHARD_NONE,
+			    .help = "Every clone replays the whole iolog",
+			  },
+			  { .ival = "file",
+			    .oval = REPLAY_SHARD_FILE,
+			    .help = "Split the iolog by file",
+			  },
+			  { .ival = "offset",
+			    .oval = REPLAY_SHARD_OFFSET,
+			    .help = "Split the iolog by offset range of each file",
+			  },
+		},
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_IOLOG,
+	},
 	{
 		.name	= "merge_blktrace_file",
 		.lname	= "Merged blktrace output filename",
@@ -3654,6 +4254,50 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_IO,
 		.group	= FIO_OPT_G_INVALID,
 	},
+	{
+		.name	= "zone_append",
+		.lname	= "Zone append",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct thread_options, zone_append),
+		.def	= "0",
+		.help	= "Use zone append commands for writes with zonemode=zbd",
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "zone_reset_async",
+		.lname	= "Reset zones asynchronously",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct thread_options, zone_reset_async),
+		.def	= "0",
+		.help	= "Reset full zones from a background thread with zonemode=zbd",
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "zone_owner",
+		.lname	= "Zone ownership",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct thread_options, zone_owner),
+		.def	= "shared",
+		.help	= "How jobs writing to a zoned device split its zones with zonemode=zbd",
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_INVALID,
+		.posval	= {
+			  { .ival = "shared",
+			    .oval = ZONE_OWNER_SHARED,
+			    .help = "All jobs write to any zone of their range",
+			  },
+			  { .ival = "stripe",
+			    .oval = ZONE_OWNER_STRIPE,
+			    .help = "Each job writes to every nth zone",
+			  },
+			  { .ival = "lease",
+			    .oval = ZONE_OWNER_LEASE,
+			    .help = "Each job claims free zones until they are full",
+			  },
+		},
+	},
 	{
 		.name	= "zone_reset_threshold",
 		.lname	= "Zone reset threshold",
@@ -3699,6 +4343,38 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_IO,
 		.group	= FIO_OPT_G_INVALID,
 	},
+	{
+		.name	= "fdp_pli_select",
+		.lname	= "FDP Placement ID select",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct thread_options, fdp_pli_select),
+		.help	= "How writes select a placement id",
+		.def	= "roundrobin",
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_INVALID,
+		.posval	= {
+			  { .ival = "roundrobin",
+			    .oval = FDP_PLI_RR,
+			    .help = "Cycle through the placement ids",
+			  },
+			  { .ival = "random",
+			    .oval = FDP_PLI_RANDOM,
+			    .help = "Pick a placement id at random",
+			  },
+			  { .ival = "offset",
+			    .oval = FDP_PLI_OFFSET,
+			    .help = "Split the io range equally between the placement ids",
+			  },
+			  { .ival = "zoned",
+			    .oval = FDP_PLI_ZONED,
+			    .help = "One placement id per random_distribution zone",
+			  },
+			  { .ival = "job",
+			    .oval = FDP_PLI_JOB,
+			    .help = "One placement id per job",
+			  },
+		},
+	},
 	{
 		.name	= "lockmem",
 		.lname	= "Lock memory",
@@ -3738,6 +4414,18 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_IO,
 		.group	= FIO_OPT_G_RWMIX,
 	},
+	{
+		.name	= "rwmixtrim",
+		.lname	= "Read/write mix trim",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct thread_options, rwmix[DDIR_TRIM]),
+		.maxval	= 100,
+		.help	= "Percentage of a reading or writing job's IOs that are trims",
+		.def	= "0",
+		.interval = 5,
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_RWMIX,
+	},
 	{
 		.name	= "rwmixcycle",
 		.lname	= "Read/write mix cycle",
@@ -3827,6 +4515,16 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_IO,
 		.group	= FIO_OPT_G_THINKTIME,
 	},
+	{
+		.name	= "precise_pacing",
+		.lname	= "Precise pacing",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct thread_options, precise_pacing),
+		.help	= "Sleep until just before a thinktime, rate or replay delay ends and spin the rest",
+		.def	= "0",
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_INVALID,
+	},
 	{
 		.name	= "thinktime_blocks",
 		.lname	= "Thinktime blocks",
@@ -3925,6 +4623,42 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_IO,
 		.group	= FIO_OPT_G_RATE,
 	},
+	{
+		.name	= "rate_bucket_id",
+		.lname	= "Rate bucket ID",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct thread_options, rate_bucket_id),
+		.help	= "Share a token bucket rate limit with jobs using this ID",
+		.def	= "0",
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_RATE,
+	},
+	{
+		.name	= "rate_bucket_iops",
+		.lname	= "Rate bucket IOPS",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct thread_options, rate_bucket_iops[DDIR_READ]),
+		.off2	= offsetof(struct thread_options, rate_bucket_iops[DDIR_WRITE]),
+		.off3	= offsetof(struct thread_options, rate_bucket_iops[DDIR_TRIM]),
+		.help	= "Combined IOPS refill rate of the shared rate bucket",
+		.parent	= "rate_bucket_id",
+		.hide	= 1,
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_RATE,
+	},
+	{
+		.name	= "rate_bucket_burst",
+		.lname	= "Rate bucket burst",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct thread_options, rate_bucket_burst[DDIR_READ]),
+		.off2	= offsetof(struct thread_options, rate_bucket_burst[DDIR_WRITE]),
+		.off3	= offsetof(struct thread_options, rate_bucket_burst[DDIR_TRIM]),
+		.help	= "Number of IOs the shared rate bucket can hold",
+		.parent	= "rate_bucket_id",
+		.hide	= 1,
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_RATE,
+	},
 	{
 		.name	= "rate_process",
 		.lname	= "Rate Process",
@@ -3970,6 +4704,84 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_IO,
 		.group	= FIO_OPT_G_RATE,
 	},
+	{
+		.name	= "phases",
+		.lname	= "Workload phases",
+		.type	= FIO_OPT_STR_STORE,
+		.off1	= offsetof(struct thread_options, phases),
+		.help	= "Schedule of duration:param=value phases applied in place",
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_RATE,
+	},
+	{
+		.name	= "phases_loop",
+		.lname	= "Loop workload phases",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct thread_options, phases_loop),
+		.help	= "Restart the phase schedule after the last phase",
+		.def	= "0",
+		.parent	= "phases",
+		.hide	= 1,
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_RATE,
+	},
+	{
+		.name	= "sweep",
+		.lname	= "Parameter sweep",
+		.type	= FIO_OPT_STR_STORE,
+		.off1	= offsetof(struct thread_options, sweep),
+		.help	= "Run the job once per combination of param=v1:v2 lists",
+		.category = FIO_OPT_C_GENERAL,
+		.group	= FIO_OPT_G_RUNTIME,
+	},
+	{
+		.name	= "precondition",
+		.lname	= "Precondition passes",
+		.type	= FIO_OPT_STR_STORE,
+		.off1	= offsetof(struct thread_options, precondition),
+		.help	= "Passes (zero, seq, rand) run over the job's files first",
+		.category = FIO_OPT_C_GENERAL,
+		.group	= FIO_OPT_G_RUNTIME,
+	},
+	{
+		.name	= "precondition_jobs",
+		.lname	= "Precondition jobs",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct thread_options, precondition_jobs),
+		.help	= "Jobs each precondition pass is split over",
+		.def	= "4",
+		.minval	= 1,
+		.parent	= "precondition",
+		.hide	= 1,
+		.category = FIO_OPT_C_GENERAL,
+		.group	= FIO_OPT_G_RUNTIME,
+	},
+	{
+		.name	= "precondition_iodepth",
+		.lname	= "Precondition IO depth",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct thread_options, precondition_iodepth),
+		.help	= "IO depth of each precondition job",
+		.def	= "32",
+		.minval	= 1,
+		.parent	= "precondition",
+		.hide	= 1,
+		.category = FIO_OPT_C_GENERAL,
+		.group	= FIO_OPT_G_RUNTIME,
+	},
+	{
+		.name	= "precondition_bs",
+		.lname	= "Precondition block size",
+		.type	= FIO_OPT_ULL,
+		.off1	= offsetof(struct thread_options, precondition_bs),
+		.help	= "Block size of the sequential passes, 0 for the device's largest",
+		.def	= "0",
+		.parent	= "precondition",
+		.hide	= 1,
+		.interval = 512,
+		.category = FIO_OPT_C_GENERAL,
+		.group	= FIO_OPT_G_RUNTIME,
+	},
 	{
 		.name	= "max_latency",
 		.lname	= "Max Latency (usec)",
@@ -4025,6 +4837,35 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_IO,
 		.group	= FIO_OPT_G_LATPROF,
 	},
+	{
+		.name	= "latency_mode",
+		.lname	= "Latency Mode",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct thread_options, latency_mode),
+		.help	= "How to adjust queue depth to match latency_target",
+		.def	= "bisect",
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_LATPROF,
+		.posval = {
+			  { .ival = "bisect",
+			    .oval = LATENCY_MODE_BISECT,
+			    .help = "Bisect the queue depth",
+			  },
+			  { .ival = "aimd",
+			    .oval = LATENCY_MODE_AIMD,
+			    .help = "Additive increase, multiplicative decrease",
+			  },
+		},
+	},
+	{
+		.name	= "latency_log",
+		.lname	= "Latency Log",
+		.type	= FIO_OPT_STR_STORE,
+		.off1	= offsetof(struct thread_options, latency_log_file),
+		.help	= "Log queue depth changes from latency_target to this file",
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_LATPROF,
+	},
 	{
 		.name	= "invalidate",
 		.lname	= "Cache invalidate",
@@ -4132,6 +4973,17 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_FILE,
 		.def	= "0",
 	},
+	{
+		.name	= "create_threads",
+		.lname	= "Create threads",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct thread_options, create_threads),
+		.help	= "Number of threads laying out job files",
+		.def	= "1",
+		.minval	= 1,
+		.category = FIO_OPT_C_FILE,
+		.group	= FIO_OPT_G_INVALID,
+	},
 	{
 		.name	= "allow_file_create",
 		.lname	= "Allow file create",
@@ -4245,6 +5097,17 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_GENERAL,
 		.group	= FIO_OPT_G_INVALID,
 	},
+	{
+		.name	= "iomem_numa",
+		.lname	= "I/O memory NUMA node",
+		.type	= FIO_OPT_STR,
+		.cb	= str_iomem_numa_cb,
+		.off1	= offsetof(struct thread_options, iomem_numa),
+		.help	= "NUMA node to place I/O buffers on",
+		.def	= "none",
+		.category = FIO_OPT_C_GENERAL,
+		.group	= FIO_OPT_G_INVALID,
+	},
 #else
 	{
 		.name	= "numa_cpu_nodes",
@@ -4258,6 +5121,12 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.type	= FIO_OPT_UNSUPPORTED,
 		.help	= "Build fio with libnuma-dev(el) to enable this option",
 	},
+	{
+		.name	= "iomem_numa",
+		.lname	= "I/O memory NUMA node",
+		.type	= FIO_OPT_UNSUPPORTED,
+		.help	= "Build fio with libnuma-dev(el) to enable this option",
+	},
 #endif
 #ifdef CONFIG_CUDA
 	{
@@ -4509,6 +5378,119 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_LOG,
 		.group	= FIO_OPT_G_INVALID,
 	},
+	{
+		.name	= "log_binary",
+		.lname	= "Binary log format",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct thread_options, log_binary),
+		.help	= "Write logs as binary records or columns",
+		.def	= "0",
+		.category = FIO_OPT_C_LOG,
+		.group	= FIO_OPT_G_INVALID,
+		.posval = {
+			  { .ival = "0",
+			    .oval = LOG_BINARY_NONE,
+			    .help = "Text logs",
+			  },
+			  { .ival = "1",
+			    .oval = LOG_BINARY_FIXED,
+			    .help = "Fixed size binary records",
+			  },
+			  { .ival = "columnar",
+			    .oval = LOG_BINARY_COLUMNAR,
+			    .help = "Delta encoded columns",
+			  },
+		},
+	},
+	{
+		.name	= "log_sample",
+		.lname	= "Log sampling",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct thread_options, log_sample),
+		.help	= "Which I/Os per I/O latency logs keep",
+		.def	= "all",
+		.category = FIO_OPT_C_LOG,
+		.group	= FIO_OPT_G_INVALID,
+		.posval = {
+			  { .ival = "all",
+			    .oval = LOG_SAMPLE_ALL,
+			    .help = "Log every I/O",
+			  },
+			  { .ival = "nth",
+			    .oval = LOG_SAMPLE_NTH,
+			    .help = "Log one in log_sample_nth I/Os",
+			  },
+			  { .ival = "reservoir",
+			    .oval = LOG_SAMPLE_RESERVOIR,
+			    .help = "Log random I/Os from each log_sample_msec",
+			  },
+			  { .ival = "tail",
+			    .oval = LOG_SAMPLE_TAIL,
+			    .help = "Log I/Os above log_sample_percentile",
+			  },
+		},
+	},
+	{
+		.name	= "log_sample_nth",
+		.lname	= "Log one in N I/Os",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct thread_options, log_sample_nth),
+		.help	= "With log_sample=nth, log one in this many I/Os",
+		.def	= "100",
+		.minval	= 1,
+		.parent	= "log_sample",
+		.category = FIO_OPT_C_LOG,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "log_sample_reservoir",
+		.lname	= "Log reservoir size",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct thread_options, log_sample_reservoir),
+		.help	= "With log_sample=reservoir, I/Os logged per period",
+		.def	= "100",
+		.minval	= 1,
+		.maxval	= 65536,
+		.parent	= "log_sample",
+		.category = FIO_OPT_C_LOG,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "log_sample_msec",
+		.lname	= "Log reservoir period",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct thread_options, log_sample_msec),
+		.help	= "With log_sample=reservoir, length of a period",
+		.def	= "1000",
+		.minval	= 1,
+		.parent	= "log_sample",
+		.category = FIO_OPT_C_LOG,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "log_sample_percentile",
+		.lname	= "Log tail percentile",
+		.type	= FIO_OPT_FLOAT_LIST,
+		.off1	= offsetof(struct thread_options, log_sample_percentile),
+		.maxlen	= 1,
+		.help	= "With log_sample=tail, log I/Os above this percentile",
+		.def	= "99.0",
+		.minfp	= 0.0,
+		.maxfp	= 100.0,
+		.parent	= "log_sample",
+		.category = FIO_OPT_C_LOG,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "log_mmap",
+		.lname	= "Log to mapped file",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct thread_options, log_mmap),
+		.help	= "Store log entries in a mapped file instead of memory",
+		.def	= "0",
+		.category = FIO_OPT_C_LOG,
+		.group	= FIO_OPT_G_INVALID,
+	},
 #ifdef CONFIG_ZLIB
 	{
 		.name	= "log_compression",
@@ -4550,6 +5532,16 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_LOG,
 		.group	= FIO_OPT_G_INVALID,
 	},
+	{
+		.name	= "log_write_behind",
+		.lname	= "Log write behind",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct thread_options, log_write_behind),
+		.help	= "Write full log chunks out in the background",
+		.def	= "0",
+		.category = FIO_OPT_C_LOG,
+		.group	= FIO_OPT_G_INVALID,
+	},
 #else
 	{
 		.name	= "log_compression",
@@ -4563,6 +5555,12 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.type	= FIO_OPT_UNSUPPORTED,
 		.help	= "Install libz-dev(el) to get compression support",
 	},
+	{
+		.name	= "log_write_behind",
+		.lname	= "Log write behind",
+		.type	= FIO_OPT_UNSUPPORTED,
+		.help	= "Install libz-dev(el) to get the log helper thread",
+	},
 #endif
 	{
 		.name = "log_unix_epoch",
@@ -4647,6 +5645,18 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_STAT,
 		.group	= FIO_OPT_G_INVALID,
 	},
+	{
+		.name	= "stats_shard",
+		.lname	= "Private latency stats",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct thread_options, stats_shard),
+		.help	= "Accumulate latency stats privately, merge on demand",
+		.def	= "0",
+		.parent	= "stats",
+		.hide	= 1,
+		.category = FIO_OPT_C_STAT,
+		.group	= FIO_OPT_G_INVALID,
+	},
 	{
 		.name	= "zero_buffers",
 		.lname	= "Zero I/O buffers",
@@ -4675,6 +5685,36 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_IO,
 		.group	= FIO_OPT_G_IO_BUF,
 	},
+	{
+		.name	= "buffer_stamp",
+		.lname	= "Stamp I/O buffers",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct thread_options, buffer_stamp),
+		.help	= "Make every write unique with a per-IO key in one cache line per 4KiB",
+		.def	= "0",
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_IO_BUF,
+	},
+	{
+		.name	= "buffer_generator",
+		.lname	= "Buffer generator",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct thread_options, buffer_generator),
+		.help	= "Type of generator for random buffer contents",
+		.def	= "xorshift",
+		.posval	= {
+			  { .ival = "xorshift",
+			    .oval = FIO_BUF_GEN_XORSHIFT,
+			    .help = "Parallel xorshift lanes, vectorized",
+			  },
+			  { .ival = "hash",
+			    .oval = FIO_BUF_GEN_HASH,
+			    .help = "Multiplicative hash, as in older fio versions",
+			  },
+		},
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_IO_BUF,
+	},
 	{
 		.name	= "buffer_pattern",
 		.lname	= "Buffer pattern",
@@ -4711,6 +5751,33 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_IO,
 		.group	= FIO_OPT_G_IO_BUF,
 	},
+	{
+		.name	= "buffer_compress_mode",
+		.lname	= "Buffer compression mode",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct thread_options, compress_mode),
+		.parent	= "buffer_compress_percentage",
+		.help	= "How compressible buffer data is generated",
+		.def	= "fixed",
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_IO_BUF,
+		.posval	= {
+			  { .ival = "fixed",
+			    .oval = COMPRESS_MODE_FIXED,
+			    .help = "Random data followed by fixed pattern data",
+			  },
+			  { .ival = "entropy",
+			    .oval = COMPRESS_MODE_ENTROPY,
+			    .help = "Reduced entropy data, sized by an entropy model",
+			  },
+#ifdef CONFIG_ZLIB
+			  { .ival = "zlib",
+			    .oval = COMPRESS_MODE_ZLIB,
+			    .help = "Reduced entropy data, calibrated against zlib",
+			  },
+#endif
+		},
+	},
 	{
 		.name	= "dedupe_percentage",
 		.lname	= "Dedupe percentage",
@@ -4753,6 +5820,14 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 			     .oval = DEDUPE_MODE_WORKING_SET,
 			     .help = "choose a page randomly from limited working set defined in dedupe_working_set_percentage",
 			   },
+			   { .ival = "shifted",
+			     .oval = DEDUPE_MODE_SHIFTED,
+			     .help = "like working_set, shifted by a random number of sectors",
+			   },
+			   { .ival = "similar",
+			     .oval = DEDUPE_MODE_SIMILAR,
+			     .help = "like working_set, with dedupe_similar_bits bits flipped",
+			   },
 		},
 	},
 	{
@@ -4768,6 +5843,28 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_IO,
 		.group	= FIO_OPT_G_IO_BUF,
 	},
+	{
+		.name	= "dedupe_similar_bits",
+		.lname	= "Dedupe similar bits",
+		.help	= "Number of bits flipped in similar dedupe buffers",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct thread_options, dedupe_similar_bits),
+		.parent	= "dedupe_mode",
+		.def	= "8",
+		.minval	= 1,
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_IO_BUF,
+	},
+	{
+		.name	= "data_reduction_sample",
+		.lname	= "Data reduction sample",
+		.help	= "Measure compression and dedupe of about 1 in this many written blocks",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct thread_options, data_reduction_sample),
+		.def	= "0",
+		.category = FIO_OPT_C_IO,
+		.group	= FIO_OPT_G_IO_BUF,
+	},
 	{
 		.name	= "clat_percentiles",
 		.lname	= "Completion latency percentiles",
@@ -4798,6 +5895,19 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_STAT,
 		.group	= FIO_OPT_G_INVALID,
 	},
+	{
+		.name	= "lat_hist_bits",
+		.lname	= "Latency histogram precision",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct thread_options, lat_hist_bits),
+		.help	= "Bits of precision of the latency histogram buckets",
+		.def	= __fio_stringify(FIO_IO_U_PLAT_BITS),
+		.minval	= 1,
+		.maxval	= FIO_IO_U_PLAT_BITS,
+		.interval = 1,
+		.category = FIO_OPT_C_STAT,
+		.group	= FIO_OPT_G_INVALID,
+	},
 	{
 		.name	= "percentile_list",
 		.lname	= "Percentile list",
@@ -4893,6 +6003,121 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_STAT,
 		.group	= FIO_OPT_G_INVALID,
 	},
+	{
+		.name	= "clock_batch",
+		.lname	= "Batch clock reads",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct thread_options, clock_batch),
+		.help	= "Reuse the last completion timestamp to time new IO",
+		.def	= "0",
+		.category = FIO_OPT_C_STAT,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "perf_counters",
+		.lname	= "Hardware performance counters",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct thread_options, perf_counters),
+		.help	= "Count cycles, instructions and cache misses per job",
+		.def	= "0",
+		.category = FIO_OPT_C_STAT,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "overhead_stats",
+		.lname	= "Per IO fio overhead",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct thread_options, overhead_stats),
+		.help	= "Break down the CPU time fio spends per IO",
+		.def	= "0",
+		.category = FIO_OPT_C_STAT,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "lat_outliers",
+		.lname	= "Slowest IOs to keep",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct thread_options, lat_outliers),
+		.help	= "Report this many of the slowest IOs with their context",
+		.def	= "0",
+		.minval	= 0,
+		.maxval	= FIO_LAT_OUTLIERS_MAX,
+		.category = FIO_OPT_C_STAT,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "lat_outliers_msec",
+		.lname	= "Slowest IOs window",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct thread_options, lat_outliers_msec),
+		.help	= "Log the slowest IOs of each window of this length",
+		.def	= "0",
+		.parent	= "lat_outliers",
+		.category = FIO_OPT_C_STAT,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "lat_heatmap",
+		.lname	= "Latency heatmap regions",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct thread_options, lat_heatmap),
+		.help	= "Keep a latency histogram for each of this many offset regions",
+		.def	= "0",
+		.minval	= 0,
+		.maxval	= FIO_LATMAP_MAX_REGIONS,
+		.category = FIO_OPT_C_STAT,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "per_file_stats",
+		.lname	= "Per file statistics",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct thread_options, per_file_stats),
+		.help	= "Report IO counts and completion latency of each file",
+		.def	= "0",
+		.category = FIO_OPT_C_STAT,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "cpu_locality_stats",
+		.lname	= "CPU locality statistics",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct thread_options, cpu_locality_stats),
+		.help	= "Report whether IOs complete on the CPU and node they were submitted on",
+		.def	= "0",
+		.category = FIO_OPT_C_STAT,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "mem_report",
+		.lname	= "Memory report",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct thread_options, mem_report),
+		.help	= "Report the peak memory fio held for the job, by use",
+		.def	= "0",
+		.category = FIO_OPT_C_STAT,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "clat_source",
+		.lname	= "Completion latency source",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct thread_options, clat_source),
+		.help	= "Where completion latencies are measured",
+		.def	= "fio",
+		.category = FIO_OPT_C_STAT,
+		.group	= FIO_OPT_G_INVALID,
+		.posval = {
+			  { .ival = "fio",
+			    .oval = CLAT_SOURCE_FIO,
+			    .help = "Time completions in fio",
+			  },
+			  { .ival = "engine",
+			    .oval = CLAT_SOURCE_ENGINE,
+			    .help = "Use the timing reported by the IO engine",
+			  },
+		},
+	},
 	{
 		.name	= "disable_bw_measurement",
 		.alias	= "disable_bw",
@@ -5059,6 +6284,49 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_GENERAL,
 		.group	= FIO_OPT_G_CGROUP,
 	},
+	{
+		.name	= "cgroup_io_max",
+		.lname	= "Cgroup io.max",
+		.type	= FIO_OPT_STR_STORE,
+		.off1	= offsetof(struct thread_options, cgroup_io_max),
+		.help	= "io.max limits for the job's cgroup (cgroup2)",
+		.parent	= "cgroup",
+		.category = FIO_OPT_C_GENERAL,
+		.group	= FIO_OPT_G_CGROUP,
+	},
+	{
+		.name	= "cgroup_io_latency",
+		.lname	= "Cgroup io.latency",
+		.type	= FIO_OPT_STR_STORE,
+		.off1	= offsetof(struct thread_options, cgroup_io_latency),
+		.help	= "io.latency targets for the job's cgroup (cgroup2)",
+		.parent	= "cgroup",
+		.category = FIO_OPT_C_GENERAL,
+		.group	= FIO_OPT_G_CGROUP,
+	},
+	{
+		.name	= "cgroup_io_cost_qos",
+		.lname	= "Cgroup io.cost.qos",
+		.type	= FIO_OPT_STR_STORE,
+		.off1	= offsetof(struct thread_options, cgroup_io_cost_qos),
+		.help	= "io.cost.qos settings of the root cgroup (cgroup2)",
+		.parent	= "cgroup",
+		.category = FIO_OPT_C_GENERAL,
+		.group	= FIO_OPT_G_CGROUP,
+	},
+	{
+		.name	= "cgroup_stat_interval",
+		.lname	= "Cgroup stat interval",
+		.type	= FIO_OPT_STR_VAL_TIME,
+		.off1	= offsetof(struct thread_options, cgroup_stat_interval),
+		.help	= "Report the cgroup's io.stat and io.pressure, sampling at this interval",
+		.def	= "0",
+		.is_seconds = 1,
+		.is_time = 1,
+		.parent	= "cgroup",
+		.category = FIO_OPT_C_GENERAL,
+		.group	= FIO_OPT_G_CGROUP,
+	},
 	{
 		.name	= "uid",
 		.lname	= "User ID",
@@ -5203,6 +6471,14 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 			    .oval = FIO_SS_BW_SLOPE,
 			    .help = "slope calculated from bandwidth measurements",
 			  },
+			  { .ival = "lat",
+			    .oval = FIO_SS_LAT,
+			    .help = "maximum mean deviation of completion latency percentile measurements",
+			  },
+			  { .ival = "lat_slope",
+			    .oval = FIO_SS_LAT_SLOPE,
+			    .help = "slope calculated from completion latency percentile measurements",
+			  },
 		},
 		.category = FIO_OPT_C_GENERAL,
 		.group  = FIO_OPT_G_RUNTIME,
@@ -5249,6 +6525,33 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_GENERAL,
 		.group  = FIO_OPT_G_RUNTIME,
 	},
+	{
+		.name   = "steadystate_percentile",
+		.lname  = "Steady state latency percentile",
+		.alias  = "ss_percentile",
+		.parent	= "steadystate",
+		.type   = FIO_OPT_FLOAT_LIST,
+		.off1   = offsetof(struct thread_options, ss_percentile),
+		.maxlen = 1,
+		.help   = "Completion latency percentile tracked by the lat and lat_slope criteria",
+		.def    = "99.0",
+		.minfp  = 0.0,
+		.maxfp  = 100.0,
+		.category = FIO_OPT_C_GENERAL,
+		.group  = FIO_OPT_G_RUNTIME,
+	},
+	{
+		.name   = "steadystate_per_ddir",
+		.lname  = "Steady state per data direction",
+		.alias  = "ss_per_ddir",
+		.parent	= "steadystate",
+		.type   = FIO_OPT_BOOL,
+		.off1   = offsetof(struct thread_options, ss_per_ddir),
+		.help   = "Require the steady state criterion for reads, writes and trims separately",
+		.def    = "0",
+		.category = FIO_OPT_C_GENERAL,
+		.group  = FIO_OPT_G_RUNTIME,
+	},
 	{
 		.name = NULL,
 	},
@@ -5312,6 +6615,7 @@ void fio_options_dup_and_init(struct option *long_options)
 	unsigned int i;
 
 	options_init(fio_options);
+	options_hash_init(fio_options);
 
 	i = 0;
 	while (long_options[i].name)
@@ -5732,6 +7036,7 @@ int add_option(const struct fio_option *o)
 
 	memcpy(&fio_options[opt_index], o, sizeof(*o));
 	fio_options[opt_index + 1].name = NULL;
+	options_hash_init(fio_options);
 	return 0;
 }
 
@@ -5798,12 +7103,44 @@ void fio_options_free(struct thread_data *td)
 	}
 }
 
-void fio_dump_options_free(struct thread_data *td)
+/*
+ * A private copy of the job options of td, to start sweep points over from
+ */
+struct thread_options *fio_options_save(struct thread_data *td)
+{
+	struct thread_options *o;
+
+	o = malloc(sizeof(*o));
+	if (!o)
+		return NULL;
+
+	*o = td->o;
+	options_mem_dupe(fio_options, o);
+	return o;
+}
+
+void fio_options_restore(struct thread_data *td, const struct thread_options *o)
+{
+	options_free(fio_options, &td->o);
+	td->o = *o;
+	options_mem_dupe(fio_options, &td->o);
+}
+
+void fio_options_put(struct thread_options *o)
 {
-	while (!flist_empty(&td->opt_list)) {
+	if (!o)
+		return;
+
+	options_free(fio_options, o);
+	free(o);
+}
+
+void fio_dump_list_free(struct flist_head *list)
+{
+	while (!flist_empty(list)) {
 		struct print_option *p;
 
-		p = flist_first_entry(&td->opt_list, struct print_option, list);
+		p = flist_first_entry(list, struct print_option, list);
 		flist_del_init(&p->list);
 		free(p->name);
 		free(p->value);
@@ -5811,6 +7148,37 @@ void fio_dump_options_free(struct thread_data *td)
 	}
 }
 
+void fio_dump_options_free(struct thread_data *td)
+{
+	fio_dump_list_free(&td->opt_list);
+}
+
+/*
+ * Drop all but the last entry for 'name', for options set again over the
+ * ones a job was cloned with
+ */
+void fio_dump_list_dedup(struct flist_head *list, const char *name)
+{
+	struct print_option *p, *last = NULL;
+	struct flist_head *n, *tmp;
+
+	flist_for_each(n, list) {
+		p = flist_entry(n, struct print_option, list);
+		if (!strcmp(p->name, name))
+			last = p;
+	}
+
+	flist_for_each_safe(n, tmp, list) {
+		p = flist_entry(n, struct print_option, list);
+		if (p == last || strcmp(p->name, name))
+			continue;
+		flist_del(&p->list);
+		free(p->name);
+		free(p->value);
+		free(p);
+	}
+}
+
 struct fio_option *fio_option_find(const char *name)
 {
 	return find_option(fio_options, name);
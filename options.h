@@ -17,6 +17,11 @@ void del_opt_posval(const char *, const char *);
 struct thread_data;
 void fio_options_free(struct thread_data *);
 void fio_dump_options_free(struct thread_data *);
+void fio_dump_list_free(struct flist_head *);
+void fio_dump_list_dedup(struct flist_head *, const char *);
+struct thread_options *fio_options_save(struct thread_data *);
+void fio_options_restore(struct thread_data *, const struct thread_options *);
+void fio_options_put(struct thread_options *);
 char *get_next_str(char **ptr);
 int get_max_str_idx(char *input);
 char* get_name_by_idx(char *input, int index);
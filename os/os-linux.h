@@ -13,6 +13,7 @@
 #include <sys/sysmacros.h>
 #include <sys/vfs.h>
 #include <sys/mman.h>
+#include <sys/prctl.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -32,6 +33,12 @@
 #ifndef HWCAP_PMULL
 #define HWCAP_PMULL             (1 << 4)
 #endif /* HWCAP_PMULL */
+#ifndef HWCAP_SHA1
+#define HWCAP_SHA1              (1 << 5)
+#endif /* HWCAP_SHA1 */
+#ifndef HWCAP_SHA2
+#define HWCAP_SHA2              (1 << 6)
+#endif /* HWCAP_SHA2 */
 #ifndef HWCAP_CRC32
 #define HWCAP_CRC32             (1 << 7)
 #endif /* HWCAP_CRC32 */
@@ -45,6 +52,8 @@
 #endif
 
 #define FIO_HAVE_CPU_AFFINITY
+#define FIO_HAVE_CPUS_AUTO
+#define FIO_HAVE_BLK_MAX_IO
 #define FIO_HAVE_DISK_UTIL
 #define FIO_HAVE_SGIO
 #define FIO_HAVE_IOPRIO
@@ -54,10 +63,12 @@
 #define FIO_HAVE_HUGETLB
 #define FIO_HAVE_BLKTRACE
 #define FIO_HAVE_CL_SIZE
+#define FIO_HAVE_IOURING
 #define FIO_HAVE_CGROUPS
 #define FIO_HAVE_FS_STAT
 #define FIO_HAVE_TRIM
 #define FIO_HAVE_GETTID
+#define FIO_HAVE_GETCPU
 #define FIO_USE_GENERIC_INIT_RANDOM_STATE
 #define FIO_HAVE_BYTEORDER_FUNCS
 #define FIO_HAVE_PWRITEV2
@@ -163,6 +174,11 @@ static inline int gettid(void)
 }
 #endif
 
+static inline int fio_getcpu(void)
+{
+	return sched_getcpu();
+}
+
 #define SPLICE_DEF_SIZE	(64*1024)
 
 #ifndef BLKGETSIZE64
@@ -212,6 +228,11 @@ static inline unsigned long long os_phys_mem(void)
 #define FIO_MADV_FREE	MADV_REMOVE
 #endif
 
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ	22
+#define MADV_POPULATE_WRITE	23
+#endif
+
 /* Check for GCC or Clang byte swap intrinsics */
 #if (__has_builtin(__builtin_bswap16) && __has_builtin(__builtin_bswap32) \
      && __has_builtin(__builtin_bswap64)) || (__GNUC__ > 4 \
@@ -275,6 +296,68 @@ static inline int os_trim(struct fio_file *f, unsigned long long start,
 	return errno;
 }
 
+#ifndef BLKZEROOUT
+#define BLKZEROOUT	_IO(0x12, 127)
+#endif
+#ifndef FALLOC_FL_KEEP_SIZE
+#define FALLOC_FL_KEEP_SIZE	0x01
+#endif
+#ifndef FALLOC_FL_PUNCH_HOLE
+#define FALLOC_FL_PUNCH_HOLE	0x02
+#endif
+#ifndef FALLOC_FL_ZERO_RANGE
+#define FALLOC_FL_ZERO_RANGE	0x10
+#endif
+
+#define FIO_HAVE_WRITE_ZEROES
+static inline int os_write_zeroes(struct fio_file *f, unsigned long long start,
+				  unsigned long long len)
+{
+	uint64_t range[2];
+
+#ifdef CONFIG_LINUX_FALLOCATE
+	if (f->filetype != FIO_TYPE_BLOCK) {
+		if (!fallocate(f->fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE,
+			       start, len))
+			return 0;
+		return errno;
+	}
+#endif
+
+	range[0] = start;
+	range[1] = len;
+
+	if (!ioctl(f->fd, BLKZEROOUT, range))
+		return 0;
+
+	return errno;
+}
+
+#ifdef __NR_copy_file_range
+#define FIO_HAVE_COPY_RANGE
+/*
+ * The kernel may copy less than asked for, keep going until it's all there
+ */
+static inline int os_copy_range(struct fio_file *f, unsigned long long src,
+				unsigned long long dst, unsigned long long len)
+{
+	loff_t off_in = src, off_out = dst;
+	long ret;
+
+	while (len) {
+		ret = syscall(__NR_copy_file_range, f->fd, &off_in, f->fd,
+				&off_out, (size_t) len, 0);
+		if (ret < 0)
+			return errno;
+		if (!ret)
+			return EIO;
+		len -= ret;
+	}
+
+	return 0;
+}
+#endif
+
 #ifdef CONFIG_SCHED_IDLE
 static inline int fio_set_sched_idle(void)
 {
@@ -317,10 +400,22 @@ static inline int fio_set_sched_idle(void)
 #define RWF_NOWAIT	0x00000008
 #endif
 
+#ifndef RWF_APPEND
+#define RWF_APPEND	0x00000010
+#endif
+
 #ifndef RWF_UNCACHED
 #define RWF_UNCACHED	0x00000040
 #endif
 
+/*
+ * Same value as the RWF_UNCACHED proposal above, which only applies to
+ * buffered IO while atomic writes need O_DIRECT
+ */
+#ifndef RWF_ATOMIC
+#define RWF_ATOMIC	0x00000040
+#endif
+
 #ifndef RWF_WRITE_LIFE_SHIFT
 #define RWF_WRITE_LIFE_SHIFT		4
 #define RWF_WRITE_LIFE_SHORT		(1 << RWF_WRITE_LIFE_SHIFT)
@@ -379,6 +474,17 @@ static inline int shm_attach_to_open_removed(void)
 	return 1;
 }
 
+#ifdef PR_SET_TIMERSLACK
+#define FIO_HAVE_TIMER_SLACK
+/*
+ * Sleeps of normal tasks may be extended by the 50 usec default slack
+ */
+static inline void os_min_timer_slack(void)
+{
+	prctl(PR_SET_TIMERSLACK, 1, 0, 0, 0);
+}
+#endif
+
 #ifdef CONFIG_LINUX_FALLOCATE
 #define FIO_HAVE_NATIVE_FALLOCATE
 static inline bool fio_fallocate(struct fio_file *f, uint64_t offset,
@@ -410,6 +516,11 @@ static inline bool os_cpu_has(cpu_features feature)
 		have_feature = (hwcap & (HWCAP_PMULL | HWCAP_CRC32)) ==
 			       (HWCAP_PMULL | HWCAP_CRC32);
 		break;
+	case CPU_ARM64_SHA:
+		hwcap = getauxval(AT_HWCAP);
+		have_feature = (hwcap & (HWCAP_SHA1 | HWCAP_SHA2)) ==
+			       (HWCAP_SHA1 | HWCAP_SHA2);
+		break;
 #endif
 	default:
 		have_feature = false;
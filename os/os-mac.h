@@ -111,7 +111,7 @@ static inline bool fio_fallocate(struct fio_file *f, uint64_t offset, uint64_t l
 static inline bool os_cpu_has(cpu_features feature)
 {
 	/* just check for arm on OSX for now, we know that has it */
-	if (feature != CPU_ARM64_CRC32C)
+	if (feature != CPU_ARM64_CRC32C && feature != CPU_ARM64_SHA)
 		return false;
 	return FIO_ARCH == arch_aarch64;
 }
@@ -30,6 +30,7 @@ enum {
 
 typedef enum {
         CPU_ARM64_CRC32C,
+        CPU_ARM64_SHA,
 } cpu_features;
 
 /* IWYU pragma: begin_exports */
@@ -373,6 +374,13 @@ static inline int CPU_COUNT(os_cpu_mask_t *mask)
 #endif
 #endif
 
+#ifndef FIO_HAVE_GETCPU
+static inline int fio_getcpu(void)
+{
+	return -1;
+}
+#endif
+
 #ifndef FIO_HAVE_GETTID
 #ifndef CONFIG_HAVE_GETTID
 static inline int gettid(void)
@@ -389,6 +397,12 @@ static inline int shm_attach_to_open_removed(void)
 }
 #endif
 
+#ifndef FIO_HAVE_TIMER_SLACK
+static inline void os_min_timer_slack(void)
+{
+}
+#endif
+
 #ifndef FIO_HAVE_NATIVE_FALLOCATE
 static inline bool fio_fallocate(struct fio_file *f, uint64_t offset, uint64_t len)
 {
@@ -2,6 +2,8 @@
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
 #include <dirent.h>
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -64,3 +66,133 @@ int blktrace_lookup_device(const char *redirect, char *path, unsigned int maj,
 	closedir(D);
 	return found;
 }
+
+/*
+ * Resolve a block device to its sysfs directory. For a partition, the
+ * directory of the disk it is on, which is where the queues are.
+ */
+static int blk_dev_sysfs_dir(unsigned int maj, unsigned int min, char *dir,
+			     size_t len)
+{
+	char path[64], real[PATH_MAX], file[PATH_MAX + 16];
+	char *p;
+
+	snprintf(path, sizeof(path), "/sys/dev/block/%u:%u", maj, min);
+	if (!realpath(path, real))
+		return -1;
+
+	snprintf(file, sizeof(file), "%s/partition", real);
+	if (!access(file, F_OK)) {
+		p = strrchr(real, '/');
+		if (p && p != real)
+			*p = '\0';
+	}
+
+	snprintf(dir, len, "%s", real);
+	return 0;
+}
+
+/*
+ * The NUMA node of a block device, from the first device up its sysfs
+ * path that knows it, which is usually the PCI function. -1 if unknown.
+ */
+int blk_dev_numa_node(unsigned int maj, unsigned int min)
+{
+	char dir[PATH_MAX], file[PATH_MAX + 16];
+	int node = -1;
+	FILE *fp;
+	char *p;
+
+	if (blk_dev_sysfs_dir(maj, min, dir, sizeof(dir)))
+		return -1;
+
+	while ((p = strrchr(dir, '/')) != NULL && p != dir) {
+		snprintf(file, sizeof(file), "%s/numa_node", dir);
+		fp = fopen(file, "r");
+		if (fp) {
+			if (fscanf(fp, "%d", &node) != 1)
+				node = -1;
+			fclose(fp);
+			break;
+		}
+		*p = '\0';
+	}
+
+	return node;
+}
+
+static int read_line(const char *file, char *buf, size_t len)
+{
+	FILE *fp;
+	int ret = -1;
+
+	fp = fopen(file, "r");
+	if (!fp)
+		return -1;
+	if (fgets(buf, len, fp)) {
+		buf[strcspn(buf, "\n")] = '\0';
+		ret = 0;
+	}
+	fclose(fp);
+	return ret;
+}
+
+/*
+ * Call fn with the cpu_list of each blk-mq hardware queue of a block
+ * device, in queue order. The kernel affines the completion interrupt of
+ * a managed queue to these CPUs. Returns the number of queues seen, or
+ * what fn returned if that was not 0.
+ */
+int blk_dev_for_each_queue(unsigned int maj, unsigned int min,
+			   int (*fn)(unsigned int, const char *, void *),
+			   void *data)
+{
+	char dir[PATH_MAX], file[PATH_MAX + 32], list[4096];
+	unsigned int nr;
+	int ret;
+
+	if (blk_dev_sysfs_dir(maj, min, dir, sizeof(dir)))
+		return 0;
+
+	/* the queues are numbered from 0 without holes */
+	for (nr = 0; ; nr++) {
+		snprintf(file, sizeof(file), "%s/mq/%u/cpu_list", dir, nr);
+		if (read_line(file, list, sizeof(list)) || !list[0])
+			break;
+		ret = fn(nr, list, data);
+		if (ret)
+			return ret;
+	}
+
+	return nr;
+}
+
+/*
+ * The CPUs of a NUMA node, as a cpu list
+ */
+int numa_node_cpu_list(int node, char *buf, size_t len)
+{
+	char file[64];
+
+	snprintf(file, sizeof(file), "/sys/devices/system/node/node%d/cpulist",
+		 node);
+	return read_line(file, buf, len);
+}
+
+/*
+ * The largest IO the block layer sends to a device without splitting it,
+ * in bytes. 0 if unknown.
+ */
+unsigned long long blk_dev_max_io_bytes(unsigned int maj, unsigned int min)
+{
+	char dir[PATH_MAX], file[PATH_MAX + 32], buf[32];
+
+	if (blk_dev_sysfs_dir(maj, min, dir, sizeof(dir)))
+		return 0;
+
+	snprintf(file, sizeof(file), "%s/queue/max_sectors_kb", dir);
+	if (read_line(file, buf, sizeof(buf)))
+		return 0;
+
+	return strtoull(buf, NULL, 10) * 1024;
+}
@@ -1,7 +1,15 @@
 #ifndef LINUX_DEV_LOOKUP
 #define LINUX_DEV_LOOKUP
 
+#include <stddef.h>
+
 int blktrace_lookup_device(const char *redirect, char *path, unsigned int maj,
 			   unsigned int min);
+int blk_dev_numa_node(unsigned int maj, unsigned int min);
+int blk_dev_for_each_queue(unsigned int maj, unsigned int min,
+			   int (*fn)(unsigned int, const char *, void *),
+			   void *data);
+int numa_node_cpu_list(int node, char *buf, size_t len);
+unsigned long long blk_dev_max_io_bytes(unsigned int maj, unsigned int min);
 
 #endif
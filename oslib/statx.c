@@ -1,18 +1,22 @@
-#ifndef CONFIG_HAVE_STATX
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
 #include "statx.h"
 
 #ifdef CONFIG_HAVE_STATX_SYSCALL
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/syscall.h>
+#endif
 
+#ifndef CONFIG_HAVE_STATX
+#ifdef CONFIG_HAVE_STATX_SYSCALL
 int statx(int dfd, const char *pathname, int flags, unsigned int mask,
 	  struct statx *buffer)
 {
 	return syscall(__NR_statx, dfd, pathname, flags, mask, buffer);
 }
 #else
-#include <errno.h>
-
 int statx(int dfd, const char *pathname, int flags, unsigned int mask,
 	  struct statx *buffer)
 {
@@ -21,3 +25,49 @@ int statx(int dfd, const char *pathname, int flags, unsigned int mask,
 }
 #endif
 #endif
+
+#ifdef CONFIG_HAVE_STATX_SYSCALL
+/*
+ * The atomic write fields are newer than most libc and kernel headers,
+ * so read them from the raw kernel struct statx by offset
+ */
+#define FIO_STATX_WRITE_ATOMIC		0x00010000U
+#define FIO_STATX_ATTR_WRITE_ATOMIC	0x00400000ULL
+#define FIO_STATX_OFF_MASK		0x00
+#define FIO_STATX_OFF_ATTRIBUTES	0x08
+#define FIO_STATX_OFF_AWU_MIN		0xa8
+#define FIO_STATX_OFF_AWU_MAX		0xac
+
+/*
+ * Get the smallest and largest atomic write the kernel takes for fd.
+ * Returns 0 on success, EOPNOTSUPP if the file can't do atomic writes.
+ */
+int statx_atomic_write_units(int fd, unsigned int *unit_min,
+			     unsigned int *unit_max)
+{
+	uint64_t buf[32], attr;
+	unsigned char *p = (unsigned char *) buf;
+	uint32_t mask;
+
+	memset(buf, 0, sizeof(buf));
+	if (syscall(__NR_statx, fd, "", AT_EMPTY_PATH, FIO_STATX_WRITE_ATOMIC,
+		    buf) < 0)
+		return errno;
+
+	memcpy(&mask, p + FIO_STATX_OFF_MASK, sizeof(mask));
+	memcpy(&attr, p + FIO_STATX_OFF_ATTRIBUTES, sizeof(attr));
+	if (!(mask & FIO_STATX_WRITE_ATOMIC) ||
+	    !(attr & FIO_STATX_ATTR_WRITE_ATOMIC))
+		return EOPNOTSUPP;
+
+	memcpy(unit_min, p + FIO_STATX_OFF_AWU_MIN, sizeof(*unit_min));
+	memcpy(unit_max, p + FIO_STATX_OFF_AWU_MAX, sizeof(*unit_max));
+	return 0;
+}
+#else
+int statx_atomic_write_units(int fd, unsigned int *unit_min,
+			     unsigned int *unit_max)
+{
+	return EOPNOTSUPP;
+}
+#endif
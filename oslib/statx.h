@@ -1,3 +1,6 @@
+#ifndef FIO_OSLIB_STATX_H
+#define FIO_OSLIB_STATX_H
+
 #ifndef CONFIG_HAVE_STATX
 #ifdef CONFIG_HAVE_STATX_SYSCALL
 #include <linux/stat.h>
@@ -12,3 +15,8 @@ struct statx
 int statx(int dfd, const char *pathname, int flags, unsigned int mask,
 	  struct statx *buffer);
 #endif
+
+int statx_atomic_write_units(int fd, unsigned int *unit_min,
+			     unsigned int *unit_max);
+
+#endif
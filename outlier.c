@@ -0,0 +1,280 @@
+/*
+ * Keep the slowest IOs of a job, see outlier.h
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "fio.h"
+#include "outlier.h"
+#include "zbd_types.h"
+#include "zbd.h"
+#include "json.h"
+
+int lat_outliers_init(struct thread_data *td)
+{
+	struct thread_stat *ts = &td->ts;
+	struct lat_outliers *lo;
+	char name[PATH_MAX];
+
+	if (!td->o.lat_outliers)
+		return 0;
+
+	lo = calloc(1, sizeof(*lo));
+	if (!lo) {
+		td_verror(td, ENOMEM, "lat_outliers_init");
+		return 1;
+	}
+
+	lo->max = td->o.lat_outliers;
+	lo->win_msec = td->o.lat_outliers_msec;
+	if (lo->win_msec) {
+		snprintf(name, sizeof(name), "%s_outliers.%d.log", td->o.name,
+			 td->thread_number);
+		lo->log = fopen(name, "w");
+		if (!lo->log) {
+			td_verror(td, errno, "fopen outlier log");
+			free(lo);
+			return 1;
+		}
+		lo->heap = lo->win_heap;
+		lo->nr = &lo->win_nr;
+		lo->win_end = td->epoch;
+		timespec_add_msec(&lo->win_end, lo->win_msec);
+	} else {
+		lo->heap = ts->lat_outliers;
+		lo->nr = &ts->nr_lat_outliers;
+	}
+
+	ts->nr_lat_outliers = 0;
+	td->outliers = lo;
+	return 0;
+}
+
+static void heap_sift_down(struct lat_outlier *heap, uint32_t nr,
+			   uint32_t i)
+{
+	struct lat_outlier tmp;
+
+	for (;;) {
+		uint32_t l = 2 * i + 1, r = l + 1, min = i;
+
+		if (l < nr && heap[l].lat_nsec < heap[min].lat_nsec)
+			min = l;
+		if (r < nr && heap[r].lat_nsec < heap[min].lat_nsec)
+			min = r;
+		if (min == i)
+			break;
+
+		tmp = heap[i];
+		heap[i] = heap[min];
+		heap[min] = tmp;
+		i = min;
+	}
+}
+
+/*
+ * Add 'o' to a min heap of at most 'max' entries, replacing the fastest
+ * entry once it is full.
+ */
+void lat_outlier_heap_add(struct lat_outlier *heap, uint32_t *nr,
+			  unsigned int max, const struct lat_outlier *o)
+{
+	struct lat_outlier tmp;
+	uint32_t i;
+
+	if (*nr < max) {
+		i = (*nr)++;
+		heap[i] = *o;
+		while (i) {
+			uint32_t parent = (i - 1) / 2;
+
+			if (heap[parent].lat_nsec <= heap[i].lat_nsec)
+				break;
+			tmp = heap[parent];
+			heap[parent] = heap[i];
+			heap[i] = tmp;
+			i = parent;
+		}
+		return;
+	}
+
+	if (!max || o->lat_nsec <= heap[0].lat_nsec)
+		return;
+
+	heap[0] = *o;
+	heap_sift_down(heap, *nr, 0);
+}
+
+void __lat_outlier_add(struct thread_data *td, struct io_u *io_u,
+		       unsigned long long nsec, const struct timespec *now)
+{
+	struct lat_outliers *lo = td->outliers;
+	struct fio_file *f = io_u->file;
+	struct lat_outlier o = {
+		.lat_nsec	= nsec,
+		.offset		= io_u->offset,
+		.bs		= io_u->xfer_buflen,
+		.ddir		= io_u->ddir,
+		.depth		= io_u->submit_depth,
+		.prio		= io_u->ioprio,
+		.zone		= -1,
+		.placement_id	= -1,
+		.complete_nsec	= ntime_since(&td->epoch, now),
+	};
+
+	if (io_u->issue_time.tv_sec || io_u->issue_time.tv_nsec)
+		o.issue_nsec = ntime_since(&td->epoch, &io_u->issue_time);
+	if (io_u->dtype)
+		o.placement_id = io_u->dspec;
+	if (f) {
+		const char *name = f->file_name;
+		size_t len = strlen(name);
+
+		/* keep the end of long paths, that's the part that differs */
+		if (len >= sizeof(o.file))
+			name += len - sizeof(o.file) + 1;
+		strcpy(o.file, name);
+
+		if (f->zbd_info) {
+			if (f->zbd_info->zone_size_log2)
+				o.zone = io_u->offset >> f->zbd_info->zone_size_log2;
+			else
+				o.zone = io_u->offset / f->zbd_info->zone_size;
+		}
+	}
+
+	lat_outlier_heap_add(lo->heap, lo->nr, lo->max, &o);
+}
+
+static int outlier_cmp(const void *p1, const void *p2)
+{
+	const struct lat_outlier *o1 = p1, *o2 = p2;
+
+	if (o1->lat_nsec > o2->lat_nsec)
+		return -1;
+	return o1->lat_nsec < o2->lat_nsec;
+}
+
+/*
+ * Copy a heap to 'sorted', slowest first
+ */
+static void lat_outliers_sort(struct lat_outlier *sorted,
+			      const struct lat_outlier *heap, uint32_t nr)
+{
+	memcpy(sorted, heap, nr * sizeof(*heap));
+	qsort(sorted, nr, sizeof(*sorted), outlier_cmp);
+}
+
+static void log_window(struct lat_outliers *lo, unsigned long long msec)
+{
+	struct lat_outlier sorted[FIO_LAT_OUTLIERS_MAX];
+	uint32_t i;
+
+	lat_outliers_sort(sorted, lo->win_heap, lo->win_nr);
+	for (i = 0; i < lo->win_nr; i++) {
+		struct lat_outlier *o = &sorted[i];
+
+		fprintf(lo->log, "%llu, %llu, %u, %llu, %llu, %u, %u, %llu, %llu, %d, %d, %s\n",
+			msec, (unsigned long long) o->lat_nsec, o->ddir,
+			(unsigned long long) o->bs,
+			(unsigned long long) o->offset, o->prio, o->depth,
+			(unsigned long long) o->issue_nsec,
+			(unsigned long long) o->complete_nsec, o->zone,
+			o->placement_id, o->file);
+	}
+}
+
+/*
+ * Close the window(s) that ended before 'now': log the window's IOs and
+ * fold them into the job's heap.
+ */
+void lat_outliers_window_end(struct thread_data *td, const struct timespec *now)
+{
+	struct lat_outliers *lo = td->outliers;
+	struct thread_stat *ts = &td->ts;
+	uint32_t i;
+
+	if (lo->win_nr) {
+		log_window(lo, mtime_since(&td->epoch, &lo->win_end));
+		for (i = 0; i < lo->win_nr; i++)
+			lat_outlier_heap_add(ts->lat_outliers,
+					     &ts->nr_lat_outliers, lo->max,
+					     &lo->win_heap[i]);
+		lo->win_nr = 0;
+	}
+
+	do {
+		timespec_add_msec(&lo->win_end, lo->win_msec);
+	} while (now->tv_sec > lo->win_end.tv_sec ||
+		 (now->tv_sec == lo->win_end.tv_sec &&
+		  now->tv_nsec >= lo->win_end.tv_nsec));
+}
+
+/*
+ * Stats were reset, e.g. at the end of ramp_time. Windows restart from
+ * the new epoch.
+ */
+void lat_outliers_clear(struct thread_data *td)
+{
+	struct lat_outliers *lo = td->outliers;
+
+	td->ts.nr_lat_outliers = 0;
+	if (!lo)
+		return;
+
+	lo->win_nr = 0;
+	lo->win_end = td->epoch;
+	timespec_add_msec(&lo->win_end, lo->win_msec);
+}
+
+void lat_outliers_exit(struct thread_data *td)
+{
+	struct lat_outliers *lo = td->outliers;
+	struct timespec now;
+
+	if (!lo)
+		return;
+
+	if (lo->log) {
+		fio_gettime(&now, NULL);
+		lat_outliers_window_end(td, &now);
+		fclose(lo->log);
+	}
+
+	free(lo);
+	td->outliers = NULL;
+}
+
+struct json_array *lat_outliers_json(const struct lat_outlier *heap,
+				     uint32_t nr)
+{
+	struct lat_outlier sorted[FIO_LAT_OUTLIERS_MAX];
+	struct json_array *array;
+	uint32_t i;
+
+	array = json_create_array();
+	lat_outliers_sort(sorted, heap, nr);
+	for (i = 0; i < nr; i++) {
+		struct lat_outlier *o = &sorted[i];
+		struct json_object *obj = json_create_object();
+
+		json_array_add_value_object(array, obj);
+		json_object_add_value_int(obj, "lat_ns", o->lat_nsec);
+		json_object_add_value_string(obj, "ddir",
+					     io_ddir_name(o->ddir));
+		json_object_add_value_int(obj, "offset", o->offset);
+		json_object_add_value_int(obj, "bs", o->bs);
+		json_object_add_value_string(obj, "file", o->file);
+		json_object_add_value_int(obj, "depth", o->depth);
+		json_object_add_value_int(obj, "issue_ns", o->issue_nsec);
+		json_object_add_value_int(obj, "complete_ns", o->complete_nsec);
+		json_object_add_value_int(obj, "prio", o->prio);
+		if (o->zone >= 0)
+			json_object_add_value_int(obj, "zone", o->zone);
+		if (o->placement_id >= 0)
+			json_object_add_value_int(obj, "placement_id",
+						  o->placement_id);
+	}
+
+	return array;
+}
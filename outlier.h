@@ -0,0 +1,62 @@
+#ifndef FIO_OUTLIER_H
+#define FIO_OUTLIER_H
+
+#include "stat.h"
+
+struct thread_data;
+struct io_u;
+struct json_array;
+
+/*
+ * lat_outliers=K keeps the K slowest IOs of a job in thread_stat, as a
+ * min heap so a completion faster than the fastest entry costs a single
+ * compare. With lat_outliers_msec, the heap below is filled per window
+ * instead. Each window is written to the outlier log when it ends and
+ * merged into the job's heap, so memory stays the same however long
+ * the job runs.
+ */
+struct lat_outliers {
+	struct lat_outlier *heap;
+	uint32_t *nr;
+	unsigned int max;
+
+	struct lat_outlier win_heap[FIO_LAT_OUTLIERS_MAX];
+	uint32_t win_nr;
+	unsigned long win_msec;
+	struct timespec win_end;
+	FILE *log;
+};
+
+extern int lat_outliers_init(struct thread_data *);
+extern void lat_outliers_exit(struct thread_data *);
+extern void lat_outliers_clear(struct thread_data *);
+extern void __lat_outlier_add(struct thread_data *, struct io_u *,
+			      unsigned long long, const struct timespec *);
+extern void lat_outliers_window_end(struct thread_data *,
+				    const struct timespec *);
+extern void lat_outlier_heap_add(struct lat_outlier *, uint32_t *,
+				 unsigned int, const struct lat_outlier *);
+extern struct json_array *lat_outliers_json(const struct lat_outlier *,
+					    uint32_t);
+
+static inline void lat_outlier_add(struct thread_data *td,
+				   struct io_u *io_u, unsigned long long nsec,
+				   const struct timespec *now)
+{
+	struct lat_outliers *lo = td->outliers;
+
+	if (!lo)
+		return;
+
+	if (lo->win_msec && (now->tv_sec > lo->win_end.tv_sec ||
+	    (now->tv_sec == lo->win_end.tv_sec &&
+	     now->tv_nsec >= lo->win_end.tv_nsec)))
+		lat_outliers_window_end(td, now);
+
+	if (*lo->nr == lo->max && nsec <= lo->heap[0].lat_nsec)
+		return;
+
+	__lat_outlier_add(td, io_u, nsec, now);
+}
+
+#endif
@@ -0,0 +1,108 @@
+/*
+ * Per IO fio overhead, split by where in do_io() the time went
+ */
+#include "fio.h"
+#include "overhead.h"
+
+#ifdef ARCH_HAVE_CPU_CLOCK
+
+int overhead_init(struct thread_data *td)
+{
+	if (!td->o.overhead_stats)
+		return 0;
+
+	td->ovh = calloc(1, sizeof(*td->ovh));
+	if (!td->ovh) {
+		td_verror(td, ENOMEM, "overhead_init");
+		return 1;
+	}
+
+	td->ovh->cur = FIO_OVH_OTHER;
+	return 0;
+}
+
+void overhead_start(struct thread_data *td)
+{
+	struct fio_overhead *ovh = td->ovh;
+
+	if (!ovh || ovh->running)
+		return;
+
+	fio_gettime(&ovh->start, NULL);
+	ovh->last = get_cpu_clock();
+	ovh->cur = FIO_OVH_OTHER;
+	ovh->running = true;
+}
+
+void overhead_stop(struct thread_data *td)
+{
+	struct fio_overhead *ovh = td->ovh;
+
+	if (!ovh || !ovh->running)
+		return;
+
+	__overhead_charge(ovh);
+	ovh->nsec += ntime_since_now(&ovh->start);
+	ovh->running = false;
+}
+
+/*
+ * Fold the cycles counted so far into the thread stats. Rather than
+ * trusting a separate cycles to nsec calibration, spread the wall time
+ * of the same interval over the sections by their share of cycles.
+ */
+void overhead_update(struct thread_data *td)
+{
+	struct fio_overhead *ovh = td->ovh;
+	struct thread_stat *ts = &td->ts;
+	uint64_t total = 0;
+	int i;
+
+	if (!ovh)
+		return;
+
+	if (ovh->running) {
+		struct timespec now;
+
+		__overhead_charge(ovh);
+		fio_gettime(&now, NULL);
+		ovh->nsec += ntime_since(&ovh->start, &now);
+		ovh->start = now;
+	}
+
+	for (i = 0; i < FIO_OVH_NR; i++)
+		total += ovh->cycles[i];
+
+	if (total && ovh->nsec) {
+		for (i = 0; i < FIO_OVH_NR; i++)
+			ts->overhead_nsec[i] += (double) ovh->cycles[i] *
+							ovh->nsec / total;
+	}
+
+	memset(ovh->cycles, 0, sizeof(ovh->cycles));
+	ovh->nsec = 0;
+}
+
+void overhead_clear(struct thread_data *td)
+{
+	struct fio_overhead *ovh = td->ovh;
+
+	memset(td->ts.overhead_nsec, 0, sizeof(td->ts.overhead_nsec));
+	if (!ovh)
+		return;
+
+	memset(ovh->cycles, 0, sizeof(ovh->cycles));
+	ovh->nsec = 0;
+	if (ovh->running) {
+		fio_gettime(&ovh->start, NULL);
+		ovh->last = get_cpu_clock();
+	}
+}
+
+void overhead_exit(struct thread_data *td)
+{
+	free(td->ovh);
+	td->ovh = NULL;
+}
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef FIO_OVERHEAD_H
+#define FIO_OVERHEAD_H
+
+#include "arch/arch.h"
+
+/*
+ * overhead_stats=1 splits the time a job spends in do_io() into
+ * FIO_OVH_* sections, timed with the CPU cycle counter. Sections are
+ * exclusive: entering one pauses the section that was active, and
+ * leaving it resumes that one, so the stats work done from inside a
+ * completion is charged to stats and not to complete.
+ */
+struct fio_overhead {
+	uint64_t cycles[FIO_OVH_NR];
+	uint64_t last;
+	uint64_t nsec;
+	struct timespec start;
+	int cur;
+	bool running;
+};
+
+#ifdef ARCH_HAVE_CPU_CLOCK
+
+extern int overhead_init(struct thread_data *);
+extern void overhead_start(struct thread_data *);
+extern void overhead_stop(struct thread_data *);
+extern void overhead_update(struct thread_data *);
+extern void overhead_clear(struct thread_data *);
+extern void overhead_exit(struct thread_data *);
+
+static inline void __overhead_charge(struct fio_overhead *ovh)
+{
+	uint64_t now = get_cpu_clock();
+
+	ovh->cycles[ovh->cur] += now - ovh->last;
+	ovh->last = now;
+}
+
+/*
+ * Enter section 'sec', returning the section to go back to. Costs a
+ * single branch when overhead_stats isn't set.
+ */
+static inline int overhead_enter(struct thread_data *td, int sec)
+{
+	struct fio_overhead *ovh = td->ovh;
+	int prev;
+
+	if (!ovh || !ovh->running)
+		return -1;
+
+	__overhead_charge(ovh);
+	prev = ovh->cur;
+	ovh->cur = sec;
+	return prev;
+}
+
+static inline void overhead_leave(struct thread_data *td, int prev)
+{
+	struct fio_overhead *ovh = td->ovh;
+
+	if (prev < 0 || !ovh || !ovh->running)
+		return;
+
+	__overhead_charge(ovh);
+	ovh->cur = prev;
+}
+
+#else
+
+static inline int overhead_init(struct thread_data *td)
+{
+	if (!td->o.overhead_stats)
+		return 0;
+
+	td_verror(td, EINVAL, "overhead_stats not supported on this platform");
+	return 1;
+}
+
+static inline void overhead_start(struct thread_data *td)
+{
+}
+
+static inline void overhead_stop(struct thread_data *td)
+{
+}
+
+static inline void overhead_update(struct thread_data *td)
+{
+}
+
+static inline void overhead_clear(struct thread_data *td)
+{
+}
+
+static inline void overhead_exit(struct thread_data *td)
+{
+}
+
+static inline int overhead_enter(struct thread_data *td, int sec)
+{
+	return -1;
+}
+
+static inline void overhead_leave(struct thread_data *td, int prev)
+{
+}
+
+#endif
+
+#endif
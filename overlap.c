@@ -0,0 +1,279 @@
+/*
+ * In-flight IO index for serialize_overlap, see overlap.h
+ */
+#include <stdlib.h>
+
+#include "fio.h"
+#include "overlap.h"
+#include "lib/roundup.h"
+
+/*
+ * An IO no larger than a bucket can overlap IOs of three buckets at most
+ */
+#define OVERLAP_SLOTS	3
+
+int overlap_index_init(struct thread_data *td)
+{
+	unsigned long long max_bs = 0;
+	struct overlap_index *oi;
+	unsigned int nr, i, shift;
+	int ddir;
+
+	if (!td->o.serialize_overlap)
+		return 0;
+
+	for (ddir = 0; ddir < DDIR_RWDIR_CNT; ddir++)
+		max_bs = max(max_bs, td->o.max_bs[ddir]);
+	for (shift = 12; shift < 40 && (1ULL << shift) < max_bs; shift++)
+		;
+
+	/* twice the IOs that can be in flight, so chains stay short */
+	nr = roundup_pow2(max(td->o.iodepth, 8U) * 2);
+
+	oi = calloc(1, sizeof(*oi) + nr * sizeof(oi->buckets[0]));
+	if (!oi) {
+		td_verror(td, ENOMEM, "overlap_index_init");
+		return 1;
+	}
+
+	oi->shift = shift;
+	oi->mask = nr - 1;
+	INIT_FLIST_HEAD(&oi->big.list);
+	pthread_mutex_init(&oi->big.lock, NULL);
+	for (i = 0; i < nr; i++) {
+		INIT_FLIST_HEAD(&oi->buckets[i].list);
+		pthread_mutex_init(&oi->buckets[i].lock, NULL);
+	}
+
+	pthread_rwlock_wrlock(&td->overlap_lock);
+	td->overlap = oi;
+	pthread_rwlock_unlock(&td->overlap_lock);
+	return 0;
+}
+
+/*
+ * Called once the job's own submitters are gone. Other offload jobs may
+ * still be looking at the index, wait for them through overlap_lock.
+ */
+void overlap_index_exit(struct thread_data *td)
+{
+	struct overlap_index *oi = td->overlap;
+	unsigned int i;
+
+	if (!oi)
+		return;
+
+	pthread_rwlock_wrlock(&td->overlap_lock);
+	td->overlap = NULL;
+	pthread_rwlock_unlock(&td->overlap_lock);
+
+	pthread_mutex_destroy(&oi->big.lock);
+	for (i = 0; i <= oi->mask; i++)
+		pthread_mutex_destroy(&oi->buckets[i].lock);
+	free(oi);
+}
+
+/*
+ * Fill slots with the buckets, sorted, that hold the IOs that can
+ * overlap io_u: those starting in (offset - bucket size, offset +
+ * buflen). Returns 0 if that's all of them.
+ */
+static unsigned int index_slots(struct overlap_index *oi, struct io_u *io_u,
+				unsigned int *slots)
+{
+	uint64_t span = 1ULL << oi->shift;
+	unsigned int nr = 0, i, j, s;
+	uint64_t lo, hi, b;
+
+	lo = io_u->offset >= span ? (io_u->offset - span + 1) >> oi->shift : 0;
+	hi = (io_u->offset + io_u->buflen - 1) >> oi->shift;
+	if (hi - lo >= OVERLAP_SLOTS)
+		return 0;
+
+	for (b = lo; b <= hi; b++) {
+		s = b & oi->mask;
+		for (i = 0; i < nr && slots[i] < s; i++)
+			;
+		if (i < nr && slots[i] == s)
+			continue;
+		for (j = nr; j > i; j--)
+			slots[j] = slots[j - 1];
+		slots[i] = s;
+		nr++;
+	}
+
+	return nr;
+}
+
+static bool bucket_overlap(struct overlap_bucket *b, struct io_u *io_u)
+{
+	unsigned long long x1 = io_u->offset, x2 = x1 + io_u->buflen;
+	struct flist_head *n;
+
+	flist_for_each(n, &b->list) {
+		struct io_u *check_io_u;
+		unsigned long long y1, y2;
+
+		check_io_u = flist_entry(n, struct io_u, overlap_list);
+		y1 = check_io_u->offset;
+		y2 = y1 + check_io_u->buflen;
+		if (x1 < y2 && y1 < x2) {
+			dprint(FD_IO, "in-flight overlap: %llu/%llu, %llu/%llu\n",
+					x1, io_u->buflen, y1, check_io_u->buflen);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool index_overlap(struct overlap_index *oi, struct io_u *io_u)
+{
+	unsigned int slots[OVERLAP_SLOTS], nr, i;
+
+	if (bucket_overlap(&oi->big, io_u))
+		return true;
+
+	nr = index_slots(oi, io_u, slots);
+	if (!nr) {
+		for (i = 0; i <= oi->mask; i++)
+			if (bucket_overlap(&oi->buckets[i], io_u))
+				return true;
+		return false;
+	}
+
+	for (i = 0; i < nr; i++)
+		if (bucket_overlap(&oi->buckets[slots[i]], io_u))
+			return true;
+	return false;
+}
+
+static void index_add(struct overlap_index *oi, struct io_u *io_u)
+{
+	struct overlap_bucket *b;
+
+	if (io_u->buflen > (1ULL << oi->shift))
+		b = &oi->big;
+	else
+		b = &oi->buckets[(io_u->offset >> oi->shift) & oi->mask];
+
+	flist_add_tail(&io_u->overlap_list, &b->list);
+	io_u->overlap_bucket = b;
+}
+
+/*
+ * Jobs whose IOs td checks with offload: itself, and the other offload
+ * jobs running as threads. Jobs running as processes can't see each
+ * other's IOs.
+ */
+static bool overlap_shared(struct thread_data *td, struct thread_data *o)
+{
+	if (o == td)
+		return true;
+
+	return td->o.use_thread && o->o.use_thread && td_offload_overlap(o);
+}
+
+/*
+ * Lock or unlock the buckets of o that io_u has to check, always in the
+ * same order so that claims from different workers can't deadlock
+ */
+static void job_lock(struct thread_data *td, struct thread_data *o,
+		     struct io_u *io_u, bool lock)
+{
+	unsigned int slots[OVERLAP_SLOTS], nr, i;
+	struct overlap_index *oi;
+
+	if (lock && o != td)
+		pthread_rwlock_rdlock(&o->overlap_lock);
+
+	oi = o->overlap;
+	if (oi) {
+		nr = index_slots(oi, io_u, slots);
+		if (lock)
+			pthread_mutex_lock(&oi->big.lock);
+		for (i = 0; i <= (nr ? nr - 1 : oi->mask); i++) {
+			struct overlap_bucket *b;
+
+			b = &oi->buckets[nr ? slots[i] : i];
+			if (lock)
+				pthread_mutex_lock(&b->lock);
+			else
+				pthread_mutex_unlock(&b->lock);
+		}
+		if (!lock)
+			pthread_mutex_unlock(&oi->big.lock);
+	}
+
+	if (!lock && o != td)
+		pthread_rwlock_unlock(&o->overlap_lock);
+}
+
+/*
+ * With offload, workers of this and other jobs claim at the same time.
+ * The buckets to check are locked in job order first, so of two
+ * overlapping IOs only one gets in.
+ */
+static bool overlap_claim_locked(struct thread_data *td, struct io_u *io_u)
+{
+	bool overlap = false;
+
+	for_each_td(o) {
+		if (overlap_shared(td, o))
+			job_lock(td, o, io_u, true);
+	} end_for_each();
+
+	for_each_td(o) {
+		if (overlap_shared(td, o) && o->overlap &&
+		    index_overlap(o->overlap, io_u)) {
+			overlap = true;
+			break;
+		}
+	} end_for_each();
+
+	if (!overlap)
+		index_add(td->overlap, io_u);
+
+	for_each_td(o) {
+		if (overlap_shared(td, o))
+			job_lock(td, o, io_u, false);
+	} end_for_each();
+
+	return !overlap;
+}
+
+/*
+ * Add io_u to the in-flight index, unless it overlaps an IO already in
+ * flight. Returns false for the latter, the io_u should be retried once
+ * something completed.
+ */
+bool overlap_claim(struct thread_data *td, struct io_u *io_u)
+{
+	bool locked = td_offload_overlap(td);
+
+	if (td->parent)
+		td = td->parent;
+
+	if (!ddir_rw(io_u->ddir) || !flist_empty(&io_u->overlap_list))
+		return true;
+	if (locked)
+		return overlap_claim_locked(td, io_u);
+
+	if (index_overlap(td->overlap, io_u))
+		return false;
+
+	index_add(td->overlap, io_u);
+	return true;
+}
+
+void __overlap_release(struct thread_data *td, struct io_u *io_u)
+{
+	struct overlap_bucket *b = io_u->overlap_bucket;
+	bool locked = td_offload_overlap(td);
+
+	if (locked)
+		pthread_mutex_lock(&b->lock);
+	flist_del_init(&io_u->overlap_list);
+	if (locked)
+		pthread_mutex_unlock(&b->lock);
+}
@@ -0,0 +1,51 @@
+#ifndef FIO_OVERLAP_H
+#define FIO_OVERLAP_H
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "flist.h"
+#include "io_u.h"
+
+struct thread_data;
+
+/*
+ * serialize_overlap keeps the in-flight IOs of a job in buckets hashed by
+ * offset. A bucket spans at least the largest block size, so an IO can
+ * only overlap IOs that start in its own bucket span or the one before,
+ * and a submission looks at two or three buckets instead of every io_u.
+ * IOs larger than a bucket, from an iolog replay say, go on a list that
+ * is always checked.
+ *
+ * With io_submit_mode=offload, the buckets have a lock each. A claim
+ * locks the buckets it checks, in this job and in the other offload
+ * jobs, checks and adds the IO and unlocks them again. overlap_lock
+ * keeps the index of a job around while other jobs look at it.
+ */
+struct overlap_bucket {
+	struct flist_head list;
+	pthread_mutex_t lock;
+};
+
+struct overlap_index {
+	unsigned int shift;
+	unsigned int mask;
+	struct overlap_bucket big;
+	struct overlap_bucket buckets[];
+};
+
+extern int overlap_index_init(struct thread_data *);
+extern void overlap_index_exit(struct thread_data *);
+extern bool overlap_claim(struct thread_data *, struct io_u *);
+extern void __overlap_release(struct thread_data *, struct io_u *);
+
+/*
+ * Take a completed or requeued io_u out of the index
+ */
+static inline void overlap_release(struct thread_data *td, struct io_u *io_u)
+{
+	if (!flist_empty(&io_u->overlap_list))
+		__overlap_release(td, io_u);
+}
+
+#endif
@@ -18,6 +18,7 @@
 #include "minmax.h"
 #include "lib/ieee754.h"
 #include "lib/pow2.h"
+#include "hash.h"
 
 #ifdef CONFIG_ARITHMETIC
 #include "y.tab.h"
@@ -1066,11 +1067,89 @@ static int handle_option(const struct fio_option *o, const char *__ptr,
 	return ret;
 }
 
+/*
+ * Hashed lookup for the main option table, which is searched for every
+ * key of every job. Other tables are small and are scanned linearly.
+ * Slots hold the option index plus one, zero means empty.
+ */
+#define OPT_HASH_BITS	11
+#define OPT_HASH_SIZE	(1U << OPT_HASH_BITS)
+#define OPT_HASH_MASK	(OPT_HASH_SIZE - 1)
+
+static const struct fio_option *opt_hash_options;
+static unsigned short opt_hash[OPT_HASH_SIZE];
+
+static unsigned int opt_hash_key(const char *name)
+{
+	return jhash(name, strlen(name), 0) & OPT_HASH_MASK;
+}
+
+static bool opt_hash_add(const char *name, unsigned int index)
+{
+	unsigned int h = opt_hash_key(name);
+	unsigned int i;
+
+	for (i = 0; i < OPT_HASH_SIZE; i++, h = (h + 1) & OPT_HASH_MASK) {
+		if (!opt_hash[h]) {
+			opt_hash[h] = index + 1;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void options_hash_init(const struct fio_option *options)
+{
+	unsigned int i;
+
+	opt_hash_options = NULL;
+	memset(opt_hash, 0, sizeof(opt_hash));
+
+	for (i = 0; options[i].name; i++) {
+		/* keep the table at most half full */
+		if (i >= OPT_HASH_SIZE / 4)
+			return;
+		if (!opt_hash_add(options[i].name, i))
+			return;
+		if (options[i].alias && !opt_hash_add(options[i].alias, i))
+			return;
+	}
+
+	opt_hash_options = options;
+}
+
+/*
+ * Returns the first option in the table matching opt, as the linear
+ * scan would find it, or NULL.
+ */
+static const struct fio_option *opt_hash_find(const char *opt)
+{
+	unsigned int h = opt_hash_key(opt);
+	int best = -1;
+
+	for (; opt_hash[h]; h = (h + 1) & OPT_HASH_MASK) {
+		int index = opt_hash[h] - 1;
+
+		if ((best == -1 || index < best) &&
+		    o_match(&opt_hash_options[index], opt))
+			best = index;
+	}
+
+	return best == -1 ? NULL : &opt_hash_options[best];
+}
+
 struct fio_option *find_option(struct fio_option *options, const char *opt)
 {
-	struct fio_option *o;
+	struct fio_option *o = &options[0];
 
-	for (o = &options[0]; o->name; o++) {
+	if (options == opt_hash_options) {
+		o = (struct fio_option *) opt_hash_find(opt);
+		if (!o)
+			return NULL;
+	}
+
+	for (; o->name; o++) {
 		if (!o_match(o, opt))
 			continue;
 		if (o->type == FIO_OPT_UNSUPPORTED) {
@@ -1087,9 +1166,15 @@ struct fio_option *find_option(struct fio_option *options, const char *opt)
 const struct fio_option *
 find_option_c(const struct fio_option *options, const char *opt)
 {
-	const struct fio_option *o;
+	const struct fio_option *o = &options[0];
 
-	for (o = &options[0]; o->name; o++) {
+	if (options == opt_hash_options) {
+		o = opt_hash_find(opt);
+		if (!o)
+			return NULL;
+	}
+
+	for (; o->name; o++) {
 		if (!o_match(o, opt))
 			continue;
 		if (o->type == FIO_OPT_UNSUPPORTED) {
@@ -0,0 +1,116 @@
+/*
+ * Per job hardware counters through perf_event_open()
+ */
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "fio.h"
+#include "perfcnt.h"
+
+static const uint64_t perfcnt_config[FIO_PERF_NR] = {
+	[FIO_PERF_CYCLES]	= PERF_COUNT_HW_CPU_CYCLES,
+	[FIO_PERF_INSTRUCTIONS]	= PERF_COUNT_HW_INSTRUCTIONS,
+	[FIO_PERF_CACHE_MISSES]	= PERF_COUNT_HW_CACHE_MISSES,
+};
+
+static int perfcnt_open(uint64_t config, bool exclude_kernel)
+{
+	struct perf_event_attr attr = {
+		.size		= sizeof(attr),
+		.type		= PERF_TYPE_HARDWARE,
+		.config		= config,
+		.read_format	= PERF_FORMAT_TOTAL_TIME_ENABLED |
+				  PERF_FORMAT_TOTAL_TIME_RUNNING,
+		.inherit	= 1,
+		.exclude_hv	= 1,
+		.exclude_kernel	= exclude_kernel,
+	};
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+/*
+ * Read a counter, scaled up if the kernel had to multiplex it with
+ * other events.
+ */
+static uint64_t perfcnt_read(int fd)
+{
+	uint64_t val[3];
+
+	if (read(fd, val, sizeof(val)) != sizeof(val))
+		return 0;
+	if (val[2] && val[2] < val[1])
+		return (uint64_t) ((double) val[0] * val[1] / val[2]);
+
+	return val[0];
+}
+
+/*
+ * Open the counters for the calling job thread. They are inherited by
+ * threads it creates later, such as offload and verify workers. If we
+ * may not count in the kernel, fall back to user space only.
+ */
+int perfcnt_init(struct thread_data *td)
+{
+	bool exclude_kernel = false;
+	int i, fd;
+
+	td->perf_nr = 0;
+	if (!td->o.perf_counters)
+		return 0;
+
+	for (i = 0; i < FIO_PERF_NR; i++) {
+		fd = perfcnt_open(perfcnt_config[i], exclude_kernel);
+		if (fd < 0 && (errno == EACCES || errno == EPERM) &&
+		    !exclude_kernel) {
+			log_info("fio: %s: perf_counters only count user space\n",
+					td->o.name);
+			exclude_kernel = true;
+			fd = perfcnt_open(perfcnt_config[i], true);
+		}
+		if (fd < 0) {
+			td_verror(td, errno, "perf_event_open");
+			perfcnt_exit(td);
+			return 1;
+		}
+		td->perf_fd[td->perf_nr++] = fd;
+	}
+
+	perfcnt_clear(td);
+	return 0;
+}
+
+void perfcnt_update(struct thread_data *td)
+{
+	struct thread_stat *ts = &td->ts;
+	int i;
+
+	for (i = 0; i < td->perf_nr; i++) {
+		uint64_t val;
+
+		val = perfcnt_read(td->perf_fd[i]);
+		if (val > td->perf_last[i])
+			ts->perf_count[i] += val - td->perf_last[i];
+		td->perf_last[i] = val;
+	}
+}
+
+void perfcnt_clear(struct thread_data *td)
+{
+	int i;
+
+	for (i = 0; i < FIO_PERF_NR; i++)
+		td->ts.perf_count[i] = 0;
+	for (i = 0; i < td->perf_nr; i++)
+		td->perf_last[i] = perfcnt_read(td->perf_fd[i]);
+}
+
+void perfcnt_exit(struct thread_data *td)
+{
+	int i;
+
+	for (i = 0; i < td->perf_nr; i++)
+		close(td->perf_fd[i]);
+	td->perf_nr = 0;
+}
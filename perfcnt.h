@@ -0,0 +1,36 @@
+#ifndef FIO_PERFCNT_H
+#define FIO_PERFCNT_H
+
+#ifdef CONFIG_HAVE_PERF_EVENT
+
+extern int perfcnt_init(struct thread_data *);
+extern void perfcnt_update(struct thread_data *);
+extern void perfcnt_clear(struct thread_data *);
+extern void perfcnt_exit(struct thread_data *);
+
+#else
+
+static inline int perfcnt_init(struct thread_data *td)
+{
+	if (!td->o.perf_counters)
+		return 0;
+
+	td_verror(td, EINVAL, "perf_counters not supported on this platform");
+	return 1;
+}
+
+static inline void perfcnt_update(struct thread_data *td)
+{
+}
+
+static inline void perfcnt_clear(struct thread_data *td)
+{
+}
+
+static inline void perfcnt_exit(struct thread_data *td)
+{
+}
+
+#endif
+
+#endif
@@ -0,0 +1,403 @@
+/*
+ * Time varying workload phases within one job. The phases= option is a
+ * comma separated list of duration:param=value[:param=value] entries, and
+ * the worker switches rwmix, block size distribution, rate and queue depth
+ * in place when a phase boundary is crossed, without draining the queue.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "fio.h"
+#include "phase.h"
+#include "zone-dist.h"
+#include "lib/alias.h"
+
+static int phase_parse_param(struct thread_data *td, struct fio_phase *p,
+			     char *key, char *val)
+{
+	struct thread_options *o = &td->o;
+	long long v;
+
+	if (!strcmp(key, "rwmixread") || !strcmp(key, "rwmixwrite")) {
+		v = atoi(val);
+		if (v < 0 || v > 100) {
+			log_err("fio: phases: %s must be between 0 and 100\n",
+				key);
+			return 1;
+		}
+		p->rwmixread = !strcmp(key, "rwmixread") ? v : 100 - v;
+	} else if (!strcmp(key, "rate")) {
+		if (check_str_bytes(val, &v, o) || v < 0) {
+			log_err("fio: phases: bad rate '%s'\n", val);
+			return 1;
+		}
+		p->rate = v;
+		p->rate_iops = 0;
+	} else if (!strcmp(key, "rate_iops")) {
+		if (str_to_decimal(val, &v, 0, o, 0, 0) || v < 0) {
+			log_err("fio: phases: bad rate_iops '%s'\n", val);
+			return 1;
+		}
+		p->rate_iops = v;
+		p->rate = 0;
+	} else if (!strcmp(key, "iodepth")) {
+		v = atoi(val);
+		if (v < 1) {
+			log_err("fio: phases: iodepth must be at least 1\n");
+			return 1;
+		}
+		p->iodepth = v;
+	} else if (!strcmp(key, "bs") || !strcmp(key, "bssplit")) {
+		if (p->bssplit) {
+			log_err("fio: phases: bs given twice in one phase\n");
+			return 1;
+		}
+		if (strchr(val, '-')) {
+			log_err("fio: phases: bs ranges are not supported, "
+				"use bssplit\n");
+			return 1;
+		}
+		if (bssplit_parse(o, val, &p->bssplit, &p->bssplit_nr,
+				  &p->min_bs, &p->max_bs))
+			return 1;
+		if (!p->bssplit_nr) {
+			log_err("fio: phases: empty %s\n", key);
+			return 1;
+		}
+		/* a plain bs=, get_next_buflen() has no min == max shortcut here */
+		if (p->bssplit_nr == 1)
+			p->bssplit[0].perc = 100;
+		p->bssplit_alias = bssplit_alias_new(p->bssplit,
+						     p->bssplit_nr);
+	} else {
+		log_err("fio: phases: unknown parameter '%s'\n", key);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int phase_parse(struct thread_data *td, struct fio_phase *p, char *str)
+{
+	char *dur, *tok, *key = NULL, *val = NULL;
+	char bssplit[256];
+	long long usec;
+
+	p->rwmixread = -1;
+
+	dur = strsep(&str, ":");
+	strip_blank_front(&dur);
+	strip_blank_end(dur);
+	if (check_str_time(dur, &usec, 1) || usec <= 0) {
+		log_err("fio: phases: bad duration '%s'\n", dur);
+		return 1;
+	}
+	p->usec = usec;
+
+	/*
+	 * bssplit entries are ':' separated as well, so a token without an
+	 * '=' continues the bssplit value before it.
+	 */
+	while ((tok = strsep(&str, ":")) != NULL) {
+		char *eq;
+
+		strip_blank_front(&tok);
+		strip_blank_end(tok);
+		if (!strlen(tok))
+			continue;
+
+		eq = strchr(tok, '=');
+		if (!eq) {
+			if (!key || strcmp(key, "bssplit") ||
+			    strlen(val) + strlen(tok) + 2 > sizeof(bssplit)) {
+				log_err("fio: phases: bad parameter '%s'\n", tok);
+				return 1;
+			}
+			strcat(val, ":");
+			strcat(val, tok);
+			continue;
+		}
+
+		if (key && phase_parse_param(td, p, key, val))
+			return 1;
+
+		*eq = '\0';
+		key = tok;
+		if (!strcmp(key, "bssplit")) {
+			snprintf(bssplit, sizeof(bssplit), "%s", eq + 1);
+			val = bssplit;
+		} else
+			val = eq + 1;
+	}
+
+	if (key && phase_parse_param(td, p, key, val))
+		return 1;
+
+	return 0;
+}
+
+static int phase_check(struct thread_data *td, struct fio_phase *p,
+		       unsigned int nr)
+{
+	struct thread_options *o = &td->o;
+	unsigned int i;
+
+	if (p->rwmixread != -1 && !td_rw(td)) {
+		log_err("fio: phases: phase %u sets rwmix on a job that "
+			"isn't mixed\n", nr);
+		return 1;
+	}
+
+	for (i = 0; i < p->bssplit_nr; i++) {
+		unsigned long long bs = p->bssplit[i].bs;
+
+		for_each_rw_ddir(ddir) {
+			if (bs < o->min_bs[ddir] ||
+			    (!o->bs_unaligned && bs % o->min_bs[ddir])) {
+				log_err("fio: phases: phase %u block size %llu "
+					"must be a multiple of the job bs %llu\n",
+					nr, bs, o->min_bs[ddir]);
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+int td_phases_init(struct thread_data *td)
+{
+	struct thread_options *o = &td->o;
+	struct phase_data *pd;
+	char *str, *p, *entry;
+	unsigned int i, max_qd;
+
+	if (!o->phases || !strlen(o->phases))
+		return 0;
+
+	if (o->read_iolog_file || o->zone_mode == ZONE_MODE_ZBD) {
+		log_err("fio: phases can't be combined with read_iolog or "
+			"zonemode=zbd\n");
+		return 1;
+	}
+
+	pd = calloc(1, sizeof(*pd));
+	td->phases = pd;
+
+	p = str = strdup(o->phases);
+	while ((entry = strsep(&p, ",")) != NULL) {
+		struct fio_phase *ph;
+
+		strip_blank_front(&entry);
+		if (!strlen(entry))
+			continue;
+
+		pd->phases = realloc(pd->phases, (pd->nr + 1) * sizeof(*ph));
+		ph = &pd->phases[pd->nr++];
+		memset(ph, 0, sizeof(*ph));
+		if (phase_parse(td, ph, entry) || phase_check(td, ph, pd->nr))
+			goto err;
+	}
+	free(str);
+	str = NULL;
+
+	if (!pd->nr) {
+		log_err("fio: phases: no phases given\n");
+		goto err;
+	}
+
+	pd->loop = o->phases_loop;
+	pd->iodepth = o->iodepth;
+	max_qd = o->iodepth;
+	for (i = 0; i < pd->nr; i++) {
+		struct fio_phase *ph = &pd->phases[i];
+
+		if (ph->iodepth > max_qd)
+			max_qd = ph->iodepth;
+		if (ph->max_bs > pd->phase_max_bs)
+			pd->phase_max_bs = ph->max_bs;
+		if (ph->rate || ph->rate_iops)
+			td->flags |= TD_F_CHECK_RATE;
+	}
+
+	/*
+	 * Allocate for the deepest phase, queue_full() holds each phase to
+	 * its own depth.
+	 */
+	if (max_qd > o->iodepth) {
+		if (o->iodepth_low == o->iodepth)
+			o->iodepth_low = max_qd;
+		o->iodepth = max_qd;
+	}
+
+	for_each_rw_ddir(ddir) {
+		pd->rwmix[ddir] = o->rwmix[ddir];
+		pd->bssplit[ddir] = o->bssplit[ddir];
+		pd->bssplit_nr[ddir] = o->bssplit_nr[ddir];
+		pd->max_bs[ddir] = o->max_bs[ddir];
+		pd->rate_bps[ddir] = td->rate_bps[ddir];
+	}
+
+	return 0;
+err:
+	free(str);
+	phases_free(td);
+	return 1;
+}
+
+void phases_free(struct thread_data *td)
+{
+	struct phase_data *pd = td->phases;
+	unsigned int i;
+
+	if (!pd)
+		return;
+
+	for (i = 0; i < pd->nr; i++) {
+		free(pd->phases[i].bssplit);
+		alias_table_free(pd->phases[i].bssplit_alias);
+	}
+	free(pd->phases);
+	free(pd);
+	td->phases = NULL;
+}
+
+/*
+ * Rate control works off the bytes issued since the epoch, so rebase that
+ * to the new rate at 'now' to switch without a burst or a stall.
+ */
+static void phase_set_rate(struct thread_data *td, enum fio_ddir ddir,
+			   uint64_t bps, uint64_t now)
+{
+	td->rate_bps[ddir] = bps;
+	td->rate_io_issue_bytes[ddir] = (bps / 1000000ULL) * now +
+					((bps % 1000000ULL) * now) / 1000000ULL;
+	td->rate_next_io_time[ddir] = now;
+	td->last_usec[ddir] = now;
+}
+
+static void phase_apply(struct thread_data *td, struct fio_phase *p,
+			uint64_t now)
+{
+	struct phase_data *pd = td->phases;
+	struct thread_options *o = &td->o;
+	unsigned int qd;
+
+	for_each_rw_ddir(ddir) {
+		uint64_t bps;
+
+		if (p && p->bssplit) {
+			o->bssplit[ddir] = p->bssplit;
+			o->bssplit_nr[ddir] = p->bssplit_nr;
+			o->max_bs[ddir] = p->max_bs;
+			td->bssplit_alias[ddir] = p->bssplit_alias;
+		} else {
+			o->bssplit[ddir] = pd->bssplit[ddir];
+			o->bssplit_nr[ddir] = pd->bssplit_nr[ddir];
+			o->max_bs[ddir] = pd->max_bs[ddir];
+			td->bssplit_alias[ddir] = pd->bssplit_alias[ddir];
+		}
+
+		if (p && p->rate)
+			bps = p->rate;
+		else if (p && p->rate_iops)
+			bps = (uint64_t) p->rate_iops *
+				(p->bssplit ? p->min_bs : o->min_bs[ddir]);
+		else
+			bps = pd->rate_bps[ddir];
+
+		if (bps != td->rate_bps[ddir])
+			phase_set_rate(td, ddir, bps, now);
+	}
+
+	if (td_rw(td)) {
+		unsigned int rwmixread = pd->rwmix[DDIR_READ];
+
+		if (p && p->rwmixread != -1)
+			rwmixread = p->rwmixread;
+		if (rwmixread != o->rwmix[DDIR_READ]) {
+			o->rwmix[DDIR_READ] = rwmixread;
+			o->rwmix[DDIR_WRITE] = 100 - rwmixread;
+			/*
+			 * Start the mix over from here, so the new ratio
+			 * isn't spent catching up with the old one
+			 */
+			for_each_rw_ddir(ddir)
+				td->rwmix_issues_base[ddir] = td->io_issues[ddir];
+			td->rwmix_issues = 0;
+		}
+	}
+
+	qd = (p && p->iodepth) ? p->iodepth : pd->iodepth;
+	td->phase_qd = qd < o->iodepth ? qd : 0;
+
+	if (p)
+		dprint(FD_RATE, "phase %u at %lluus: rwmix=%u qd=%u\n", pd->cur,
+			(unsigned long long) now, o->rwmix[DDIR_READ], qd);
+}
+
+static bool phase_advance(struct phase_data *pd, uint64_t now)
+{
+	bool changed = false;
+
+	while (now >= pd->end) {
+		if (pd->cur + 1 < pd->nr)
+			pd->cur++;
+		else if (pd->loop)
+			pd->cur = 0;
+		else {
+			/* the last phase runs until the job ends */
+			pd->end = -1ULL;
+			break;
+		}
+		pd->start = pd->end;
+		pd->end = pd->start + pd->phases[pd->cur].usec;
+		changed = true;
+	}
+
+	return changed;
+}
+
+void phases_start(struct thread_data *td)
+{
+	struct phase_data *pd = td->phases;
+	uint64_t now;
+
+	if (!pd)
+		return;
+
+	/* the job's own tables are built by the worker, not at init */
+	for_each_rw_ddir(ddir)
+		pd->bssplit_alias[ddir] = td->bssplit_alias[ddir];
+
+	now = utime_since_now(&td->epoch);
+	pd->cur = 0;
+	pd->start = 0;
+	pd->end = pd->phases[0].usec;
+	phase_advance(pd, now);
+	phase_apply(td, &pd->phases[pd->cur], now);
+}
+
+void phases_update(struct thread_data *td)
+{
+	struct phase_data *pd = td->phases;
+	uint64_t now;
+
+	now = utime_since_now(&td->epoch);
+	if (now < pd->end)
+		return;
+
+	if (phase_advance(pd, now))
+		phase_apply(td, &pd->phases[pd->cur], now);
+}
+
+/*
+ * Put the job values back, the parent still owns td->o
+ */
+void phases_stop(struct thread_data *td)
+{
+	if (!td->phases)
+		return;
+
+	phase_apply(td, NULL, utime_since_now(&td->epoch));
+}
@@ -0,0 +1,60 @@
+#ifndef FIO_PHASE_H
+#define FIO_PHASE_H
+
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "io_ddir.h"
+
+struct thread_data;
+struct bssplit;
+struct alias_table;
+
+/*
+ * One phases= entry. Anything a phase does not set runs at the job value.
+ */
+struct fio_phase {
+	uint64_t usec;
+
+	int rwmixread;			/* -1 if not set */
+	uint64_t rate;
+	unsigned int rate_iops;
+	unsigned int iodepth;
+
+	struct bssplit *bssplit;
+	unsigned int bssplit_nr;
+	unsigned long long min_bs, max_bs;
+	struct alias_table *bssplit_alias;
+};
+
+struct phase_data {
+	struct fio_phase *phases;
+	unsigned int nr;
+	bool loop;
+
+	unsigned int cur;
+	uint64_t start;
+	uint64_t end;
+
+	/*
+	 * Job values, put back when a phase doesn't override them
+	 */
+	unsigned int rwmix[DDIR_RWDIR_CNT];
+	struct bssplit *bssplit[DDIR_RWDIR_CNT];
+	unsigned int bssplit_nr[DDIR_RWDIR_CNT];
+	struct alias_table *bssplit_alias[DDIR_RWDIR_CNT];
+	unsigned long long max_bs[DDIR_RWDIR_CNT];
+	uint64_t rate_bps[DDIR_RWDIR_CNT];
+	unsigned int iodepth;
+
+	/* largest block size of any phase, for sizing the io buffers */
+	unsigned long long phase_max_bs;
+};
+
+extern int td_phases_init(struct thread_data *);
+extern void phases_free(struct thread_data *);
+extern void phases_start(struct thread_data *);
+extern void phases_stop(struct thread_data *);
+extern void phases_update(struct thread_data *);
+
+#endif
@@ -0,0 +1,198 @@
+/*
+ * Preconditioning passes, see precond.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "fio.h"
+#include "precond.h"
+#include "verify.h"
+#include "options.h"
+#ifdef FIO_HAVE_BLK_MAX_IO
+#include <sys/sysmacros.h>
+#include "oslib/linux-dev-lookup.h"
+#endif
+
+static const char *precond_names[] = {
+	[PRECOND_ZERO]	= "zero",
+	[PRECOND_SEQ]	= "seq",
+	[PRECOND_RAND]	= "rand",
+};
+
+int precond_parse(const char *spec, struct precond *pc)
+{
+	char *str, *p, *tok;
+	unsigned int i;
+
+	memset(pc, 0, sizeof(*pc));
+	str = p = strdup(spec);
+
+	while ((tok = strsep(&p, ",")) != NULL) {
+		if (!*tok)
+			continue;
+
+		for (i = PRECOND_ZERO; i <= PRECOND_RAND; i++)
+			if (!strcmp(tok, precond_names[i]))
+				break;
+		if (i > PRECOND_RAND) {
+			log_err("fio: precondition: unknown pass <%s>\n", tok);
+			goto err;
+		}
+		if (pc->nr == PRECOND_MAX_PASSES) {
+			log_err("fio: precondition: more than %d passes\n",
+				PRECOND_MAX_PASSES);
+			goto err;
+		}
+		pc->pass[pc->nr++] = i;
+	}
+
+	if (!pc->nr) {
+		log_err("fio: precondition: no passes given\n");
+		goto err;
+	}
+
+	free(str);
+	return 0;
+err:
+	free(str);
+	return 1;
+}
+
+/*
+ * The largest IO the device under the first of 'files' takes unsplit, or
+ * 1MiB if that's not known
+ */
+static unsigned long long precond_auto_bs(const char *files)
+{
+	unsigned long long bs = 0;
+#ifdef FIO_HAVE_BLK_MAX_IO
+	char *name = strdup(files);
+	struct stat sb;
+
+	name[strcspn(name, ":")] = '\0';
+	if (!stat(name, &sb)) {
+		if (S_ISBLK(sb.st_mode))
+			bs = blk_dev_max_io_bytes(major(sb.st_rdev),
+						  minor(sb.st_rdev));
+		else
+			bs = blk_dev_max_io_bytes(major(sb.st_dev),
+						  minor(sb.st_dev));
+	}
+	free(name);
+#endif
+
+	return bs ? bs : 1024 * 1024;
+}
+
+/*
+ * Set an option of the pass, in place of the job's in the job options too
+ */
+static int precond_set(struct thread_data *td, const char *name,
+		       const char *val)
+{
+	char *v = strdup(val);
+	int ret;
+
+	ret = fio_cmd_option_parse(td, name, v);
+	free(v);
+	if (!ret)
+		fio_dump_list_dedup(&td->opt_list, name);
+	return ret;
+}
+
+/*
+ * Turn td, a fresh copy of the options of the job to precondition, into
+ * the given pass over 'files'. The job's own I/O pattern, time limits,
+ * rates, verification and logs are dropped. size_mult scales size= up to
+ * the files of all clones of the job.
+ */
+int precond_apply(struct thread_data *td, unsigned int pass, const char *files,
+		  const char *jobname, unsigned int size_mult)
+{
+	struct thread_options *o = &td->o;
+	char name[FIO_JOBNAME_SIZE], val[32];
+	unsigned long long bs;
+
+	free(o->precondition);
+	o->precondition = NULL;
+	free(o->sweep);
+	o->sweep = NULL;
+	free(o->phases);
+	o->phases = NULL;
+
+	o->time_based = 0;
+	o->timeout = 0;
+	o->ramp_time = 0;
+	o->start_delay = o->start_delay_high = 0;
+	o->loops = 1;
+	o->io_size = 0;
+	o->io_size_percent = 0;
+	o->number_ios = 0;
+	o->fill_device = 0;
+	o->offset_increment = 0;
+	o->offset_increment_percent = 0;
+	o->thinktime = 0;
+	o->ss_dur = 0;
+	o->verify = VERIFY_NONE;
+	o->do_verify = 0;
+	o->verify_only = 0;
+	o->trim_percentage = 0;
+	o->write_bw_log = o->write_lat_log = 0;
+	o->write_iops_log = o->write_hist_log = 0;
+	o->overwrite = 0;
+	o->unlink = 0;
+	o->group_reporting = 1;
+	for_each_rw_ddir(ddir) {
+		o->rate[ddir] = o->ratemin[ddir] = 0;
+		o->rate_iops[ddir] = o->rate_iops_min[ddir] = 0;
+		o->bssplit_nr[ddir] = 0;
+		o->perc_rand[ddir] = 100;
+	}
+	if (!o->size_percent)
+		o->size *= size_mult;
+
+	snprintf(val, sizeof(val), "%u", o->precondition_jobs);
+	if (precond_set(td, "numjobs", val))
+		return 1;
+	snprintf(val, sizeof(val), "%u", o->precondition_iodepth);
+	if (precond_set(td, "iodepth", val))
+		return 1;
+
+	free(o->filename);
+	o->filename = NULL;
+	if (precond_set(td, "filename", files))
+		return 1;
+
+	if (pass == PRECOND_RAND) {
+		o->random_generator = FIO_RAND_GEN_LFSR;
+		o->random_distribution = FIO_RAND_DIST_RANDOM;
+		o->norandommap = 1;
+		o->random_partition = o->numjobs > 1;
+		bs = o->bs[DDIR_WRITE];
+	} else {
+		bs = o->precondition_bs;
+		if (!bs)
+			bs = precond_auto_bs(files);
+		if (pass == PRECOND_ZERO)
+			o->trim_mode = TRIM_MODE_WRITE_ZEROES;
+	}
+
+	snprintf(val, sizeof(val), "%llu", bs);
+	if (precond_set(td, "bs", val))
+		return 1;
+	if (precond_set(td, "rw", pass == PRECOND_ZERO ? "trim" :
+			pass == PRECOND_SEQ ? "write" : "randwrite"))
+		return 1;
+
+	snprintf(name, sizeof(name), "%s-precond-%s", jobname,
+		 precond_names[pass]);
+	free(o->name);
+	o->name = strdup(name);
+	free(o->description);
+	o->description = NULL;
+
+	td->precond_pass = pass;
+	return 0;
+}
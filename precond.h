@@ -0,0 +1,35 @@
+#ifndef FIO_PRECOND_H
+#define FIO_PRECOND_H
+
+struct thread_data;
+
+/*
+ * precondition=pass[,pass]... runs passes over the files of a job before
+ * the job itself. Each pass is a job of its own, split over
+ * precondition_jobs clones and stonewalled after the pass before it:
+ *
+ *	zero	the device writes zeroes (trim_mode=write_zeroes), each
+ *		clone over a slice of the range
+ *	seq	sequential write, each clone filling a slice of the range
+ *	rand	random overwrite, the clones splitting one LFSR sequence so
+ *		every block is written once without a random map
+ */
+enum {
+	PRECOND_NONE = 0,
+	PRECOND_ZERO,
+	PRECOND_SEQ,
+	PRECOND_RAND,
+};
+
+#define PRECOND_MAX_PASSES	8
+
+struct precond {
+	unsigned int pass[PRECOND_MAX_PASSES];
+	unsigned int nr;
+};
+
+extern int precond_parse(const char *, struct precond *);
+extern int precond_apply(struct thread_data *, unsigned int, const char *,
+			 const char *, unsigned int);
+
+#endif
@@ -2,6 +2,7 @@
 #define FIO_PROFILE_H
 
 #include "flist.h"
+#include "io_ddir.h"
 
 /*
  * Functions for overriding internal fio io_u functions
@@ -10,7 +11,8 @@ struct prof_io_ops {
 	int (*td_init)(struct thread_data *);
 	void (*td_exit)(struct thread_data *);
 
-	int (*io_u_lat)(struct thread_data *, uint64_t);
+	int (*io_u_lat)(struct thread_data *, enum fio_ddir, uint64_t,
+			const struct timespec *);
 };
 
 struct profile_ops {
@@ -1,7 +1,10 @@
+#include <libgen.h>
+
 #include "../fio.h"
 #include "../profile.h"
 #include "../parse.h"
 #include "../optgroup.h"
+#include "../lib/fls.h"
 
 /*
  * 1x loads
@@ -17,6 +20,10 @@ struct act_pass_criteria {
 };
 #define ACT_MAX_CRIT	3
 
+/*
+ * Thresholds are powers of two msec, so they line up with the histogram
+ * buckets below.
+ */
 static struct act_pass_criteria act_pass[ACT_MAX_CRIT] = {
 	{
 		.max_usec =	1000,
@@ -32,9 +39,35 @@ static struct act_pass_criteria act_pass[ACT_MAX_CRIT] = {
 	},
 };
 
+/*
+ * Latency histograms like ACT's: bucket 0 holds IOs of up to 1 msec,
+ * bucket i those of (2^(i-1), 2^i] msec. The report shows the percentage
+ * of IOs over 1, 2, 4, ... 64 msec.
+ */
+#define ACT_HIST_NR	18
+#define ACT_HIST_SHOW	7
+
+/*
+ * Transaction reads, large-block writes and large-block (defrag) reads
+ * are kept apart. The pass criteria apply to reads only.
+ */
+enum {
+	ACT_READ = 0,
+	ACT_LB_WRITE,
+	ACT_LB_READ,
+	ACT_NR_TYPES,
+};
+
+static const char *act_type_names[ACT_NR_TYPES] = {
+	"reads", "large-block writes", "large-block reads",
+};
+static const char *act_type_jobs[ACT_NR_TYPES] = {
+	"act-read-", "act-write-", "act-defrag-",
+};
+
 struct act_slice {
-	uint64_t lat_buckets[ACT_MAX_CRIT];
-	uint64_t total_ios;
+	uint64_t hist[ACT_NR_TYPES][ACT_HIST_NR];
+	uint64_t total_ios[ACT_NR_TYPES];
 };
 
 struct act_run_data {
@@ -47,38 +80,43 @@ struct act_run_data {
 static struct act_run_data *act_run_data;
 
 struct act_prof_data {
-	struct timespec sample_tv;
+	unsigned int type;
+	uint64_t slice_end;
 	struct act_slice *slices;
 	unsigned int cur_slice;
 	unsigned int nr_slices;
 };
 
-#define ACT_MAX_OPTS	128
-static const char *act_opts[ACT_MAX_OPTS] = {
+static const char *act_defaults[] = {
 	"direct=1",
 	"ioengine=sync",
 	"random_generator=lfsr",
 	"group_reporting=1",
 	"thread",
-	NULL,
 };
-static unsigned int opt_idx = 5;
-static unsigned int org_idx;
+static const char **act_opts;
+static unsigned int opt_idx, opt_max;
 
 static int act_add_opt(const char *format, ...) __attribute__ ((__format__ (__printf__, 1, 2)));
 
 struct act_options {
 	unsigned int pad;
 	char *device_names;
+	char *numa_nodes;
 	unsigned int load;
 	unsigned int prep;
 	unsigned int threads_per_queue;
 	unsigned int num_read_blocks;
 	unsigned int write_size;
+	unsigned int read_reqs;
+	unsigned int write_reqs;
+	unsigned int defrag_lwm;
 	unsigned long long test_duration;
+	unsigned long long slice_time;
 };
 
 static struct act_options act_options;
+static struct profile_ops act_profile;
 
 static struct fio_option options[] = {
 	{
@@ -91,6 +129,16 @@ static struct fio_option options[] = {
 		.group	= FIO_OPT_G_ACT,
 		.no_free = true,
 	},
+	{
+		.name	= "numa-nodes",
+		.lname	= "NUMA nodes of the devices",
+		.type	= FIO_OPT_STR_STORE,
+		.off1	= offsetof(struct act_options, numa_nodes),
+		.help	= "NUMA node per device, comma separated, or 'auto'",
+		.category = FIO_OPT_C_PROFILE,
+		.group	= FIO_OPT_G_ACT,
+		.no_free = true,
+	},
 	{
 		.name	= "load",
 		.lname	= "Load multiplier",
@@ -101,6 +149,37 @@ static struct fio_option options[] = {
 		.category = FIO_OPT_C_PROFILE,
 		.group	= FIO_OPT_G_ACT,
 	},
+	{
+		.name	= "read-reqs-per-sec",
+		.lname	= "Transaction reads per second per device",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct act_options, read_reqs),
+		.help	= "Transaction reads per second per device (default load * 2000)",
+		.def	= "0",
+		.category = FIO_OPT_C_PROFILE,
+		.group	= FIO_OPT_G_ACT,
+	},
+	{
+		.name	= "write-reqs-per-sec",
+		.lname	= "Transaction writes per second per device",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct act_options, write_reqs),
+		.help	= "Transaction writes per second per device (default load * 1000)",
+		.def	= "0",
+		.category = FIO_OPT_C_PROFILE,
+		.group	= FIO_OPT_G_ACT,
+	},
+	{
+		.name	= "defrag-lwm-pct",
+		.lname	= "Defrag low water mark",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct act_options, defrag_lwm),
+		.help	= "Defrag low water mark in percent, sets write amplification and defrag reads",
+		.def	= "50",
+		.maxval	= 99,
+		.category = FIO_OPT_C_PROFILE,
+		.group	= FIO_OPT_G_ACT,
+	},
 	{
 		.name	= "test-duration",
 		.lname	= "Test duration",
@@ -111,6 +190,16 @@ static struct fio_option options[] = {
 		.category = FIO_OPT_C_PROFILE,
 		.group	= FIO_OPT_G_ACT,
 	},
+	{
+		.name	= "slice-duration",
+		.lname	= "Histogram slice duration",
+		.type	= FIO_OPT_STR_VAL_TIME,
+		.off1	= offsetof(struct act_options, slice_time),
+		.help	= "Time covered by each histogram slice and pass check",
+		.def	= "1h",
+		.category = FIO_OPT_C_PROFILE,
+		.group	= FIO_OPT_G_ACT,
+	},
 	{
 		.name	= "threads-per-queue",
 		.lname	= "Number of read IO threads per device",
@@ -137,7 +226,7 @@ static struct fio_option options[] = {
 		.type	= FIO_OPT_INT,
 		.off1	= offsetof(struct act_options, write_size),
 		.help	= "Size of large block ops in KiB (writes)",
-		.def	= "131072",
+		.def	= "128",
 		.category = FIO_OPT_C_PROFILE,
 		.group	= FIO_OPT_G_ACT,
 	},
@@ -161,54 +250,90 @@ static int act_add_opt(const char *str, ...)
 	va_list args;
 	size_t len;
 
-	if (opt_idx == ACT_MAX_OPTS) {
-		log_err("act: ACT_MAX_OPTS is too small\n");
-		return 1;
+	if (opt_idx + 1 >= opt_max) {
+		unsigned int max = opt_max ? 2 * opt_max : 64;
+		const char **opts;
+
+		opts = realloc(act_opts, max * sizeof(*opts));
+		if (!opts) {
+			log_err("act: out of memory adding options\n");
+			return 1;
+		}
+		act_opts = opts;
+		opt_max = max;
 	}
 
 	va_start(args, str);
 	len = vsnprintf(buffer, sizeof(buffer), str, args);
 	va_end(args);
 
-	if (len)
+	if (len) {
 		act_opts[opt_idx++] = strdup(buffer);
+		act_opts[opt_idx] = NULL;
+	}
 
 	return 0;
 }
 
-static int act_add_rw(const char *dev, int reads)
+static unsigned int act_record_bytes(void)
+{
+	return act_options.num_read_blocks * 512;
+}
+
+/*
+ * Large-block writes needed to absorb the transaction writes, amplified
+ * by defrag: with a low water mark of lwm%, each large block written
+ * frees only (100 - lwm)% of a block. Defrag reads a large block for
+ * each one written.
+ */
+static unsigned int act_large_block_ops(void)
+{
+	struct act_options *ao = &act_options;
+	uint64_t wreqs = ao->write_reqs ? ao->write_reqs : ao->load * W_LOAD;
+	uint64_t bytes = wreqs * act_record_bytes() * 100;
+	uint64_t div = (uint64_t) ao->write_size * 1024 * (100 - ao->defrag_lwm);
+
+	return (bytes + div - 1) / div;
+}
+
+static int act_add_rw(const char *dev, const char *node, int type)
 {
 	struct act_options *ao = &act_options;
 
-	if (act_add_opt("name=act-%s-%s", reads ? "read" : "write", dev))
+	if (act_add_opt("name=%s%s", act_type_jobs[type], dev))
 		return 1;
 	if (act_add_opt("filename=%s", dev))
 		return 1;
-	if (act_add_opt("rw=%s", reads ? "randread" : "randwrite"))
+	if (node[0]) {
+		if (act_add_opt("numa_cpu_nodes=%s", node))
+			return 1;
+		if (act_add_opt("numa_mem_policy=bind:%s", node))
+			return 1;
+	}
+	if (act_add_opt("rw=%s", type == ACT_LB_WRITE ? "randwrite" : "randread"))
 		return 1;
-	if (reads) {
-		int rload = ao->load * R_LOAD / ao->threads_per_queue;
+	if (type == ACT_READ) {
+		unsigned int rreqs = ao->read_reqs ? ao->read_reqs : ao->load * R_LOAD;
+		unsigned int rload;
 
+		rload = (rreqs + ao->threads_per_queue - 1) / ao->threads_per_queue;
 		if (act_add_opt("numjobs=%u", ao->threads_per_queue))
 			return 1;
 		if (act_add_opt("rate_iops=%u", rload))
 			return 1;
-		if (act_add_opt("bs=%u", ao->num_read_blocks * 512))
+		if (act_add_opt("bs=%u", act_record_bytes()))
 			return 1;
 	} else {
-		const int rsize = ao->write_size / (ao->num_read_blocks * 512);
-		int wload = (ao->load * W_LOAD + rsize - 1) / rsize;
-
-		if (act_add_opt("rate_iops=%u", wload))
+		if (act_add_opt("rate_iops=%u", act_large_block_ops()))
 			return 1;
-		if (act_add_opt("bs=%u", ao->write_size))
+		if (act_add_opt("bs=%u", ao->write_size * 1024))
 			return 1;
 	}
 
 	return 0;
 }
 
-static int act_add_dev_prep(const char *dev)
+static int act_add_dev_prep(const char *dev, const char *node)
 {
 	/* Add sequential zero phase */
 	if (act_add_opt("name=act-prep-zeroes-%s", dev))
@@ -229,6 +354,12 @@ static int act_add_dev_prep(const char *dev)
 		return 1;
 	if (act_add_opt("filename=%s", dev))
 		return 1;
+	if (node[0]) {
+		if (act_add_opt("numa_cpu_nodes=%s", node))
+			return 1;
+		if (act_add_opt("numa_mem_policy=bind:%s", node))
+			return 1;
+	}
 	if (act_add_opt("bs=4096"))
 		return 1;
 	if (act_add_opt("ioengine=libaio"))
@@ -241,97 +372,236 @@ static int act_add_dev_prep(const char *dev)
 	return 0;
 }
 
-static int act_add_dev(const char *dev)
+static int act_add_dev(const char *dev, const char *node)
 {
 	if (act_options.prep)
-		return act_add_dev_prep(dev);
+		return act_add_dev_prep(dev, node);
 
-	if (act_add_opt("runtime=%llus", act_options.test_duration))
-		return 1;
-	if (act_add_opt("time_based=1"))
+	if (act_add_rw(dev, node, ACT_READ))
 		return 1;
-
-	if (act_add_rw(dev, 1))
+	if (!act_large_block_ops())
+		return 0;
+	if (act_add_rw(dev, node, ACT_LB_WRITE))
 		return 1;
-	if (act_add_rw(dev, 0))
+	if (act_options.defrag_lwm && act_add_rw(dev, node, ACT_LB_READ))
 		return 1;
 
 	return 0;
 }
 
+/*
+ * The node the device hangs off, from sysfs. Partitions look at their
+ * parent disk.
+ */
+static int act_sysfs_node(const char *dev)
+{
+	static const char *paths[] = {
+		"/sys/class/block/%s/device/numa_node",
+		"/sys/class/block/%s/device/device/numa_node",
+		"/sys/class/block/%s/../device/numa_node",
+		"/sys/class/block/%s/../device/device/numa_node",
+	};
+	char path[PATH_MAX], rpath[PATH_MAX], *name;
+	unsigned int i;
+	int node = -1;
+
+	if (!realpath(dev, rpath))
+		return -1;
+	name = basename(rpath);
+
+	for (i = 0; i < FIO_ARRAY_SIZE(paths) && node < 0; i++) {
+		FILE *f;
+
+		snprintf(path, sizeof(path), paths[i], name);
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+		if (fscanf(f, "%d", &node) != 1)
+			node = -1;
+		fclose(f);
+	}
+
+	return node;
+}
+
+/*
+ * Fill 'node' with the NUMA node of device number 'idx', or an empty
+ * string for no placement. A list of nodes is used round robin.
+ */
+static int act_dev_node(const char *dev, unsigned int idx, char *node,
+			size_t len)
+{
+	char *nodes, *str, *n = NULL;
+	unsigned int i = 0, nr = 0;
+
+	node[0] = '\0';
+	if (!act_options.numa_nodes)
+		return 0;
+
+#ifndef CONFIG_LIBNUMA
+	log_err("act: numa-nodes needs fio built with libnuma\n");
+	return 1;
+#endif
+
+	if (!strcmp(act_options.numa_nodes, "auto")) {
+		int ret = act_sysfs_node(dev);
+
+		if (ret >= 0)
+			snprintf(node, len, "%d", ret);
+		else
+			log_info("act: no NUMA node found for %s\n", dev);
+		return 0;
+	}
+
+	nodes = strdup(act_options.numa_nodes);
+	for (str = nodes; strsep(&str, ",") != NULL; )
+		nr++;
+	free(nodes);
+
+	nodes = str = strdup(act_options.numa_nodes);
+	while (i++ <= idx % nr)
+		n = strsep(&str, ",");
+	snprintf(node, len, "%s", n);
+	free(nodes);
+	return 0;
+}
+
 /*
  * Fill our private options into the command line
  */
 static int act_prep_cmdline(void)
 {
+	unsigned long long secs = act_options.test_duration / 1000000ULL;
+	unsigned int i, nr_devs = 0;
+
 	if (!act_options.device_names) {
 		log_err("act: you need to set IO target(s) with the "
 			"device-names option.\n");
 		return 1;
 	}
 
-	org_idx = opt_idx;
+	for (i = 0; i < FIO_ARRAY_SIZE(act_defaults); i++)
+		if (act_add_opt("%s", act_defaults[i]))
+			return 1;
+
+	if (!act_options.prep) {
+		if (act_add_opt("runtime=%llus", secs ? secs : 1))
+			return 1;
+		if (act_add_opt("time_based=1"))
+			return 1;
+	}
 
 	do {
+		char node[32];
 		char *dev;
 
 		dev = strsep(&act_options.device_names, ",");
 		if (!dev)
 			break;
 
-		if (act_add_dev(dev)) {
+		if (act_dev_node(dev, nr_devs++, node, sizeof(node)))
+			return 1;
+		if (act_add_dev(dev, node)) {
 			log_err("act: failed adding device to the mix\n");
 			break;
 		}
 	} while (1);
 
+	act_profile.cmdline = act_opts;
 	return 0;
 }
 
-static int act_io_u_lat(struct thread_data *td, uint64_t nsec)
+static inline unsigned int act_hist_idx(uint64_t usec)
 {
-	struct act_prof_data *apd = td->prof_data;
-	struct act_slice *slice;
-	uint64_t usec = nsec / 1000ULL;
-	int i, ret = 0;
-	double perm;
+	uint64_t msec;
 
-	if (act_options.prep)
+	if (!usec)
 		return 0;
+	msec = (usec - 1) / 1000;
+	if (msec >= 1ULL << (ACT_HIST_NR - 2))
+		return ACT_HIST_NR - 1;
+	return __fls(msec);
+}
 
-	/*
-	 * Really should not happen, but lets not let jitter at the end
-	 * ruin our day.
-	 */
-	if (apd->cur_slice >= apd->nr_slices)
-		return 0;
+/*
+ * Per mille of IOs in 'hist' over 'usec', a power of two msec
+ */
+static double act_perm_over(const uint64_t *hist, uint64_t total,
+			    unsigned int usec)
+{
+	unsigned int i;
+	uint64_t over = 0;
 
-	slice = &apd->slices[apd->cur_slice];
-	slice->total_ios++;
+	if (!total)
+		return 0.0;
 
-	for (i = ACT_MAX_CRIT - 1; i >= 0; i--) {
-		if (usec > act_pass[i].max_usec) {
-			slice->lat_buckets[i]++;
-			break;
-		}
-	}
+	for (i = act_hist_idx(usec) + 1; i < ACT_HIST_NR; i++)
+		over += hist[i];
 
-	if (time_since_now(&apd->sample_tv) < SAMPLE_SEC)
-		return 0;
+	return 1000.0 * over / total;
+}
+
+static int act_slice_failed(struct act_slice *slice, int verbose)
+{
+	uint64_t *hist = slice->hist[ACT_READ];
+	uint64_t total = slice->total_ios[ACT_READ];
+	unsigned int i;
+	double perm;
 
-	/* SAMPLE_SEC has passed, check criteria for pass */
 	for (i = 0; i < ACT_MAX_CRIT; i++) {
-		perm = (1000.0 * slice->lat_buckets[i]) / slice->total_ios;
+		perm = act_perm_over(hist, total, act_pass[i].max_usec);
 		if (perm < act_pass[i].max_perm)
 			continue;
 
-		log_err("act: %f%% exceeds pass criteria of %f%%\n", perm / 10.0, (double) act_pass[i].max_perm / 10.0);
-		ret = 1;
-		break;
+		if (verbose)
+			log_err("act: %f%% exceeds pass criteria of %f%%\n",
+				perm / 10.0, (double) act_pass[i].max_perm / 10.0);
+		return 1;
 	}
 
-	fio_gettime(&apd->sample_tv, NULL);
-	apd->cur_slice++;
+	return 0;
+}
+
+/*
+ * Called on the first completion past the end of the current slice.
+ * Check the finished slice and move on, the last slice takes whatever
+ * runs over the test duration.
+ */
+static int act_next_slice(struct act_prof_data *apd, const struct timespec *now)
+{
+	unsigned long long slice_sec = act_options.slice_time / 1000000ULL;
+	int ret = 0;
+
+	if (apd->type == ACT_READ)
+		ret = act_slice_failed(&apd->slices[apd->cur_slice], 1);
+
+	while (apd->cur_slice < apd->nr_slices - 1 &&
+	       (uint64_t) now->tv_sec >= apd->slice_end) {
+		apd->cur_slice++;
+		apd->slice_end += slice_sec ? slice_sec : 1;
+	}
+	if (apd->cur_slice == apd->nr_slices - 1)
+		apd->slice_end = UINT64_MAX;
+
+	return ret;
+}
+
+static int act_io_u_lat(struct thread_data *td, enum fio_ddir ddir,
+			uint64_t nsec, const struct timespec *now)
+{
+	struct act_prof_data *apd = td->prof_data;
+	struct act_slice *slice;
+	int ret = 0;
+
+	if (act_options.prep)
+		return 0;
+
+	if ((uint64_t) now->tv_sec >= apd->slice_end)
+		ret = act_next_slice(apd, now);
+
+	slice = &apd->slices[apd->cur_slice];
+	slice->hist[apd->type][act_hist_idx(nsec / 1000ULL)]++;
+	slice->total_ios[apd->type]++;
 	return ret;
 }
 
@@ -342,51 +612,69 @@ static void get_act_ref(void)
 	fio_sem_up(act_run_data->sem);
 }
 
-static int show_slice(struct act_slice *slice, unsigned int slice_num)
+static void show_hist_row(const char *label, const uint64_t *hist,
+			  uint64_t total)
 {
-	unsigned int i, failed = 0;
+	unsigned int i;
 
-	log_info("   %2u", slice_num);
+	log_info("%6s", label);
+	for (i = 0; i < ACT_HIST_SHOW; i++)
+		log_info("%8.2f", act_perm_over(hist, total, 1000U << i) / 10.0);
+	log_info("\n");
+}
 
-	for (i = 0; i < ACT_MAX_CRIT; i++) {
-		double perc = 0.0;
+static void show_hist(unsigned int type)
+{
+	struct act_slice *slices = act_run_data->slices;
+	uint64_t sum[ACT_HIST_NR] = { 0, }, total = 0;
+	unsigned int i, j, max_slice = 0;
+	double max_perm = -1.0;
+	char label[16];
 
-		if (slice->total_ios)
-			perc = 100.0 * (double) slice->lat_buckets[i] / (double) slice->total_ios;
-		if ((perc * 10.0) >= act_pass[i].max_perm)
-			failed++;
-		log_info("\t%2.2f", perc);
-	}
-	for (i = 0; i < ACT_MAX_CRIT; i++) {
-		double perc = 0.0;
+	for (i = 0; i < act_run_data->nr_slices; i++)
+		total += slices[i].total_ios[type];
+	if (!total)
+		return;
 
-		if (slice->total_ios)
-			perc = 100.0 * (double) slice->lat_buckets[i] / (double) slice->total_ios;
-		log_info("\t%2.2f", perc);
-	}
+	log_info("\n%s, %% > (ms)\n slice", act_type_names[type]);
+	for (i = 0; i < ACT_HIST_SHOW; i++)
+		log_info("%8u", 1U << i);
 	log_info("\n");
 
-	return failed;
+	for (i = 0; i < act_run_data->nr_slices; i++) {
+		struct act_slice *slice = &slices[i];
+		double perm;
+
+		if (!slice->total_ios[type])
+			continue;
+
+		snprintf(label, sizeof(label), "%u", i + 1);
+		show_hist_row(label, slice->hist[type], slice->total_ios[type]);
+
+		for (j = 0; j < ACT_HIST_NR; j++)
+			sum[j] += slice->hist[type][j];
+		perm = act_perm_over(slice->hist[type], slice->total_ios[type],
+				     1000);
+		if (perm > max_perm) {
+			max_perm = perm;
+			max_slice = i;
+		}
+	}
+
+	show_hist_row("avg", sum, total);
+	show_hist_row("max", slices[max_slice].hist[type],
+			slices[max_slice].total_ios[type]);
 }
 
 static void act_show_all_stats(void)
 {
 	unsigned int i, fails = 0;
 
-	log_info("        trans                   device\n");
-	log_info("        %%>(ms)                  %%>(ms)\n");
-	log_info(" slice");
-
-	for (i = 0; i < ACT_MAX_CRIT; i++)
-		log_info("\t %2u", act_pass[i].max_usec / 1000);
-	for (i = 0; i < ACT_MAX_CRIT; i++)
-		log_info("\t %2u", act_pass[i].max_usec / 1000);
-
-	log_info("\n");
-	log_info(" -----  -----   -----  ------   -----   -----  ------\n");
+	for (i = 0; i < ACT_NR_TYPES; i++)
+		show_hist(i);
 
 	for (i = 0; i < act_run_data->nr_slices; i++)
-		fails += show_slice(&act_run_data->slices[i], i + 1);
+		fails += act_slice_failed(&act_run_data->slices[i], 0);
 
 	log_info("\nact: test complete, device(s): %s\n", fails ? "FAILED" : "PASSED");
 }
@@ -407,13 +695,13 @@ static void put_act_ref(struct thread_data *td)
 		struct act_slice *dst = &act_run_data->slices[slice];
 		struct act_slice *src = &apd->slices[slice];
 
-		dst->total_ios += src->total_ios;
+		dst->total_ios[apd->type] += src->total_ios[apd->type];
 
-		for (i = 0; i < ACT_MAX_CRIT; i++)
-			dst->lat_buckets[i] += src->lat_buckets[i];
+		for (i = 0; i < ACT_HIST_NR; i++)
+			dst->hist[apd->type][i] += src->hist[apd->type][i];
 	}
 
-	if (!--act_run_data->pending)
+	if (!--act_run_data->pending && !act_options.prep)
 		act_show_all_stats();
 
 	fio_sem_up(act_run_data->sem);
@@ -421,16 +709,33 @@ static void put_act_ref(struct thread_data *td)
 
 static int act_td_init(struct thread_data *td)
 {
+	unsigned long long slice_sec = act_options.slice_time / 1000000ULL;
+	unsigned long long secs = act_options.test_duration / 1000000ULL;
 	struct act_prof_data *apd;
-	unsigned int nr_slices;
+	struct timespec now;
+	unsigned int i;
+
+	if (!slice_sec)
+		slice_sec = 1;
 
 	get_act_ref();
 
 	apd = calloc(1, sizeof(*apd));
-	nr_slices = (act_options.test_duration + SAMPLE_SEC - 1) / SAMPLE_SEC;
-	apd->slices = calloc(nr_slices, sizeof(struct act_slice));
-	apd->nr_slices = nr_slices;
-	fio_gettime(&apd->sample_tv, NULL);
+	for (i = 0; i < ACT_NR_TYPES; i++) {
+		if (!strncmp(td->o.name, act_type_jobs[i],
+			     strlen(act_type_jobs[i]))) {
+			apd->type = i;
+			break;
+		}
+	}
+	apd->nr_slices = (secs + slice_sec - 1) / slice_sec;
+	if (!apd->nr_slices)
+		apd->nr_slices = 1;
+	apd->slices = calloc(apd->nr_slices, sizeof(struct act_slice));
+	fio_gettime(&now, NULL);
+	apd->slice_end = now.tv_sec + slice_sec;
+	if (apd->nr_slices == 1)
+		apd->slice_end = UINT64_MAX;
 	td->prof_data = apd;
 	return 0;
 }
@@ -457,7 +762,6 @@ static struct profile_ops act_profile = {
 	.options	= options,
 	.opt_data	= &act_options,
 	.prep_cmd	= act_prep_cmdline,
-	.cmdline	= act_opts,
 	.io_ops		= &act_io_ops,
 };
 
@@ -472,8 +776,11 @@ static void fio_init act_register(void)
 
 static void fio_exit act_unregister(void)
 {
-	while (org_idx && org_idx < opt_idx)
-		free((void *) act_opts[++org_idx]);
+	unsigned int i;
+
+	for (i = 0; i < opt_idx; i++)
+		free((void *) act_opts[i]);
+	free(act_opts);
 
 	unregister_profile(&act_profile);
 	fio_sem_remove(act_run_data->sem);
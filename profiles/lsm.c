@@ -0,0 +1,588 @@
+#include "../fio.h"
+#include "../profile.h"
+#include "../parse.h"
+#include "../optgroup.h"
+
+/*
+ * Storage side of an LSM tree key/value store: a WAL appended in small
+ * fdatasync'ed writes, compaction streaming large sequential reads and
+ * writes under a rate limit, optionally in bursts, and zipf distributed
+ * point reads. Each class is its own reporting group, and a latency
+ * summary per class is printed when the test ends.
+ */
+enum {
+	LSM_WAL = 0,
+	LSM_COMPACT_READ,
+	LSM_COMPACT_WRITE,
+	LSM_POINT_READ,
+	LSM_NR_CLASSES,
+};
+
+static const char *lsm_class_names[LSM_NR_CLASSES] = {
+	"wal-commit", "compact-read", "compact-write", "point-read",
+};
+
+struct lsm_class_lat {
+	uint64_t plat[FIO_IO_U_PLAT_NR];
+	uint64_t nr;
+	uint64_t sum;
+	uint64_t max;
+};
+
+struct lsm_run_data {
+	struct fio_sem *sem;
+	unsigned int pending;
+	struct lsm_class_lat lat[LSM_NR_CLASSES];
+};
+static struct lsm_run_data *lsm_run_data;
+
+struct lsm_prof_data {
+	unsigned int class;
+	uint64_t wal_nsec;
+	struct lsm_class_lat lat;
+};
+
+static const char *lsm_defaults[] = {
+	"direct=1",
+	"ioengine=psync",
+	"group_reporting=1",
+	"time_based=1",
+	"thread",
+};
+static const char **lsm_opts;
+static unsigned int opt_idx, opt_max;
+
+static int lsm_add_opt(const char *format, ...) __attribute__ ((__format__ (__printf__, 1, 2)));
+
+struct lsm_options {
+	unsigned int pad;
+	char *dir;
+	unsigned long long db_size;
+	unsigned long long duration;
+	unsigned int wal_bs;
+	unsigned int wal_iops;
+	unsigned long long wal_size;
+	unsigned int compact_bs;
+	unsigned long long compact_rate;
+	unsigned long long sst_size;
+	unsigned long long compact_period;
+	unsigned int compact_duty;
+	unsigned int read_bs;
+	unsigned int read_threads;
+	unsigned int read_iops;
+	unsigned int read_iodepth;
+	char *read_ioengine;
+	char *read_zipf;
+};
+
+static struct lsm_options lsm_options;
+static struct profile_ops lsm_profile;
+
+static struct fio_option options[] = {
+	{
+		.name	= "lsm-dir",
+		.lname	= "LSM directory",
+		.type	= FIO_OPT_STR_STORE,
+		.off1	= offsetof(struct lsm_options, dir),
+		.help	= "Directory for the WAL and table files",
+		.category = FIO_OPT_C_PROFILE,
+		.group	= FIO_OPT_G_LSM,
+		.no_free = true,
+	},
+	{
+		.name	= "db-size",
+		.lname	= "LSM database size",
+		.type	= FIO_OPT_STR_VAL,
+		.off1	= offsetof(struct lsm_options, db_size),
+		.help	= "Size of the table file point reads and compaction use",
+		.def	= "1g",
+		.category = FIO_OPT_C_PROFILE,
+		.group	= FIO_OPT_G_LSM,
+	},
+	{
+		.name	= "lsm-duration",
+		.lname	= "LSM test duration",
+		.type	= FIO_OPT_STR_VAL_TIME,
+		.off1	= offsetof(struct lsm_options, duration),
+		.help	= "How long the test runs",
+		.def	= "60s",
+		.category = FIO_OPT_C_PROFILE,
+		.group	= FIO_OPT_G_LSM,
+	},
+	{
+		.name	= "wal-bs",
+		.lname	= "WAL append size",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct lsm_options, wal_bs),
+		.help	= "Size of each WAL append",
+		.def	= "4k",
+		.category = FIO_OPT_C_PROFILE,
+		.group	= FIO_OPT_G_LSM,
+	},
+	{
+		.name	= "wal-iops",
+		.lname	= "WAL appends per second",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct lsm_options, wal_iops),
+		.help	= "WAL appends per second, 0 for as fast as possible",
+		.def	= "1000",
+		.category = FIO_OPT_C_PROFILE,
+		.group	= FIO_OPT_G_LSM,
+	},
+	{
+		.name	= "wal-size",
+		.lname	= "WAL file size",
+		.type	= FIO_OPT_STR_VAL,
+		.off1	= offsetof(struct lsm_options, wal_size),
+		.help	= "Size of the WAL file before it wraps",
+		.def	= "64m",
+		.category = FIO_OPT_C_PROFILE,
+		.group	= FIO_OPT_G_LSM,
+	},
+	{
+		.name	= "compaction-bs",
+		.lname	= "Compaction IO size",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct lsm_options, compact_bs),
+		.help	= "Size of compaction reads and writes",
+		.def	= "1m",
+		.category = FIO_OPT_C_PROFILE,
+		.group	= FIO_OPT_G_LSM,
+	},
+	{
+		.name	= "compaction-rate",
+		.lname	= "Compaction rate",
+		.type	= FIO_OPT_STR_VAL,
+		.off1	= offsetof(struct lsm_options, compact_rate),
+		.help	= "Compaction bandwidth in each direction, 0 for unlimited",
+		.def	= "64m",
+		.category = FIO_OPT_C_PROFILE,
+		.group	= FIO_OPT_G_LSM,
+	},
+	{
+		.name	= "sst-size",
+		.lname	= "Table file size",
+		.type	= FIO_OPT_STR_VAL,
+		.off1	= offsetof(struct lsm_options, sst_size),
+		.help	= "Compaction output is fsync'ed after each table of this size",
+		.def	= "64m",
+		.category = FIO_OPT_C_PROFILE,
+		.group	= FIO_OPT_G_LSM,
+	},
+	{
+		.name	= "compaction-period",
+		.lname	= "Compaction burst period",
+		.type	= FIO_OPT_STR_VAL_TIME,
+		.off1	= offsetof(struct lsm_options, compact_period),
+		.help	= "Run compaction in bursts repeating with this period, 0 for steady",
+		.def	= "0",
+		.category = FIO_OPT_C_PROFILE,
+		.group	= FIO_OPT_G_LSM,
+	},
+	{
+		.name	= "compaction-duty",
+		.lname	= "Compaction burst duty cycle",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct lsm_options, compact_duty),
+		.help	= "Percentage of each compaction period spent compacting",
+		.def	= "50",
+		.minval	= 1,
+		.maxval	= 100,
+		.category = FIO_OPT_C_PROFILE,
+		.group	= FIO_OPT_G_LSM,
+	},
+	{
+		.name	= "read-bs",
+		.lname	= "Point read size",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct lsm_options, read_bs),
+		.help	= "Size of each point read",
+		.def	= "4k",
+		.category = FIO_OPT_C_PROFILE,
+		.group	= FIO_OPT_G_LSM,
+	},
+	{
+		.name	= "read-threads",
+		.lname	= "Point read threads",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct lsm_options, read_threads),
+		.help	= "Number of point read threads",
+		.def	= "4",
+		.minval	= 1,
+		.category = FIO_OPT_C_PROFILE,
+		.group	= FIO_OPT_G_LSM,
+	},
+	{
+		.name	= "read-iops",
+		.lname	= "Point reads per second",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct lsm_options, read_iops),
+		.help	= "Point reads per second over all threads, 0 for as fast as possible",
+		.def	= "0",
+		.category = FIO_OPT_C_PROFILE,
+		.group	= FIO_OPT_G_LSM,
+	},
+	{
+		.name	= "read-iodepth",
+		.lname	= "Point read queue depth",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct lsm_options, read_iodepth),
+		.help	= "Queue depth of each point read thread",
+		.def	= "1",
+		.minval	= 1,
+		.category = FIO_OPT_C_PROFILE,
+		.group	= FIO_OPT_G_LSM,
+	},
+	{
+		.name	= "read-ioengine",
+		.lname	= "Point read IO engine",
+		.type	= FIO_OPT_STR_STORE,
+		.off1	= offsetof(struct lsm_options, read_ioengine),
+		.help	= "IO engine of the point read threads",
+		.def	= "psync",
+		.category = FIO_OPT_C_PROFILE,
+		.group	= FIO_OPT_G_LSM,
+		.no_free = true,
+	},
+	{
+		.name	= "read-zipf",
+		.lname	= "Point read zipf theta",
+		.type	= FIO_OPT_STR_STORE,
+		.off1	= offsetof(struct lsm_options, read_zipf),
+		.help	= "Zipf theta of the point read keys",
+		.def	= "1.2",
+		.category = FIO_OPT_C_PROFILE,
+		.group	= FIO_OPT_G_LSM,
+		.no_free = true,
+	},
+	{
+		.name	= NULL,
+	},
+};
+
+static int lsm_add_opt(const char *str, ...)
+{
+	char buffer[512];
+	va_list args;
+	size_t len;
+
+	if (opt_idx + 1 >= opt_max) {
+		unsigned int max = opt_max ? 2 * opt_max : 64;
+		const char **opts;
+
+		opts = realloc(lsm_opts, max * sizeof(*opts));
+		if (!opts) {
+			log_err("lsm: out of memory adding options\n");
+			return 1;
+		}
+		lsm_opts = opts;
+		opt_max = max;
+	}
+
+	va_start(args, str);
+	len = vsnprintf(buffer, sizeof(buffer), str, args);
+	va_end(args);
+
+	if (len) {
+		lsm_opts[opt_idx++] = strdup(buffer);
+		lsm_opts[opt_idx] = NULL;
+	}
+
+	return 0;
+}
+
+static int lsm_add_job(unsigned int class)
+{
+	if (lsm_add_opt("name=lsm-%s", lsm_class_names[class]))
+		return 1;
+	return lsm_add_opt("new_group");
+}
+
+static int lsm_add_wal(void)
+{
+	struct lsm_options *lo = &lsm_options;
+
+	if (lsm_add_job(LSM_WAL))
+		return 1;
+	if (lsm_add_opt("filename=lsm.wal"))
+		return 1;
+	if (lsm_add_opt("rw=write"))
+		return 1;
+	if (lsm_add_opt("bs=%u", lo->wal_bs))
+		return 1;
+	if (lsm_add_opt("size=%llu", lo->wal_size))
+		return 1;
+	if (lsm_add_opt("fdatasync=1"))
+		return 1;
+	if (lo->wal_iops && lsm_add_opt("rate_iops=%u", lo->wal_iops))
+		return 1;
+
+	return 0;
+}
+
+/*
+ * Bursty compaction runs at the configured rate for the duty part of
+ * each period, and at one IO per second for the rest.
+ */
+static int lsm_add_compaction_phases(void)
+{
+	struct lsm_options *lo = &lsm_options;
+	unsigned long long on, off;
+
+	if (!lo->compact_period || lo->compact_duty == 100)
+		return 0;
+
+	on = lo->compact_period * lo->compact_duty / 100;
+	off = lo->compact_period - on;
+	if (lsm_add_opt("phases=%lluus:rate=%llu,%lluus:rate=%u", on,
+			lo->compact_rate, off, lo->compact_bs))
+		return 1;
+	return lsm_add_opt("phases_loop=1");
+}
+
+static int lsm_add_compaction(unsigned int class)
+{
+	struct lsm_options *lo = &lsm_options;
+	int reads = class == LSM_COMPACT_READ;
+
+	if (lsm_add_job(class))
+		return 1;
+	if (lsm_add_opt("filename=%s", reads ? "lsm.sst" : "lsm.compact"))
+		return 1;
+	if (lsm_add_opt("rw=%s", reads ? "read" : "write"))
+		return 1;
+	if (lsm_add_opt("bs=%u", lo->compact_bs))
+		return 1;
+	if (lsm_add_opt("size=%llu", lo->db_size))
+		return 1;
+	if (!reads && lo->sst_size >= lo->compact_bs &&
+	    lsm_add_opt("fsync=%llu", lo->sst_size / lo->compact_bs))
+		return 1;
+	if (lo->compact_rate) {
+		if (lsm_add_opt("rate=%llu", lo->compact_rate))
+			return 1;
+		if (lsm_add_compaction_phases())
+			return 1;
+	}
+
+	return 0;
+}
+
+static int lsm_add_point_reads(void)
+{
+	struct lsm_options *lo = &lsm_options;
+
+	if (lsm_add_job(LSM_POINT_READ))
+		return 1;
+	if (lsm_add_opt("filename=lsm.sst"))
+		return 1;
+	if (lsm_add_opt("rw=randread"))
+		return 1;
+	if (lsm_add_opt("bs=%u", lo->read_bs))
+		return 1;
+	if (lsm_add_opt("size=%llu", lo->db_size))
+		return 1;
+	if (lsm_add_opt("random_distribution=zipf:%s", lo->read_zipf))
+		return 1;
+	if (lsm_add_opt("norandommap"))
+		return 1;
+	if (lsm_add_opt("numjobs=%u", lo->read_threads))
+		return 1;
+	if (lsm_add_opt("ioengine=%s", lo->read_ioengine))
+		return 1;
+	if (lsm_add_opt("iodepth=%u", lo->read_iodepth))
+		return 1;
+	if (lo->read_iops) {
+		unsigned int iops;
+
+		iops = (lo->read_iops + lo->read_threads - 1) / lo->read_threads;
+		if (lsm_add_opt("rate_iops=%u", iops))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Fill our private options into the command line
+ */
+static int lsm_prep_cmdline(void)
+{
+	unsigned long long secs = lsm_options.duration / 1000000ULL;
+	unsigned int i;
+
+	if (!lsm_options.wal_bs || !lsm_options.compact_bs ||
+	    !lsm_options.read_bs) {
+		log_err("lsm: block sizes must be non-zero\n");
+		return 1;
+	}
+
+	for (i = 0; i < FIO_ARRAY_SIZE(lsm_defaults); i++)
+		if (lsm_add_opt("%s", lsm_defaults[i]))
+			return 1;
+	if (lsm_add_opt("runtime=%llus", secs ? secs : 1))
+		return 1;
+	if (lsm_add_opt("directory=%s", lsm_options.dir ? lsm_options.dir : "./"))
+		return 1;
+
+	if (lsm_add_wal())
+		return 1;
+	if (lsm_add_compaction(LSM_COMPACT_READ))
+		return 1;
+	if (lsm_add_compaction(LSM_COMPACT_WRITE))
+		return 1;
+	if (lsm_add_point_reads())
+		return 1;
+
+	lsm_profile.cmdline = lsm_opts;
+	return 0;
+}
+
+/*
+ * A WAL commit is an append plus the fdatasync after it, both count
+ * towards its latency. Other classes skip their syncs.
+ */
+static int lsm_io_u_lat(struct thread_data *td, enum fio_ddir ddir,
+			uint64_t nsec, const struct timespec *now)
+{
+	struct lsm_prof_data *lpd = td->prof_data;
+	struct lsm_class_lat *lat = &lpd->lat;
+
+	if (lpd->class == LSM_WAL) {
+		if (ddir_rw(ddir)) {
+			lpd->wal_nsec += nsec;
+			return 0;
+		}
+		nsec += lpd->wal_nsec;
+		lpd->wal_nsec = 0;
+	} else if (!ddir_rw(ddir))
+		return 0;
+
+	lat->plat[plat_val_to_idx(nsec)]++;
+	lat->nr++;
+	lat->sum += nsec;
+	if (nsec > lat->max)
+		lat->max = nsec;
+	return 0;
+}
+
+static void lsm_show_stats(void)
+{
+	unsigned int i;
+
+	log_info("\nlsm: latency per class (usec)\n");
+	log_info("%16s %12s %10s %10s %10s %10s %10s\n", "class", "ios",
+		 "avg", "p50", "p99", "p99.9", "max");
+
+	for (i = 0; i < LSM_NR_CLASSES; i++) {
+		struct lsm_class_lat *lat = &lsm_run_data->lat[i];
+		fio_fp64_t plist[4] = {
+			{ .u.f = 50.0 }, { .u.f = 99.0 }, { .u.f = 99.9 },
+		};
+		unsigned long long *ovals = NULL, minv, maxv;
+
+		if (!lat->nr)
+			continue;
+		if (calc_clat_percentiles(lat->plat, lat->nr, plist, &ovals,
+					  &maxv, &minv) != 3) {
+			free(ovals);
+			continue;
+		}
+
+		log_info("%16s %12llu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+			 lsm_class_names[i], (unsigned long long) lat->nr,
+			 (double) lat->sum / lat->nr / 1000.0,
+			 ovals[0] / 1000.0, ovals[1] / 1000.0,
+			 ovals[2] / 1000.0, lat->max / 1000.0);
+		free(ovals);
+	}
+}
+
+static int lsm_td_init(struct thread_data *td)
+{
+	struct lsm_prof_data *lpd;
+	unsigned int i;
+
+	lpd = calloc(1, sizeof(*lpd));
+	if (!lpd)
+		return 1;
+
+	for (i = 0; i < LSM_NR_CLASSES; i++) {
+		const char *name = lsm_class_names[i];
+
+		if (!strncmp(td->o.name, "lsm-", 4) &&
+		    !strcmp(td->o.name + 4, name)) {
+			lpd->class = i;
+			break;
+		}
+	}
+
+	fio_sem_down(lsm_run_data->sem);
+	lsm_run_data->pending++;
+	fio_sem_up(lsm_run_data->sem);
+
+	td->prof_data = lpd;
+	return 0;
+}
+
+static void lsm_td_exit(struct thread_data *td)
+{
+	struct lsm_prof_data *lpd = td->prof_data;
+	struct lsm_class_lat *dst = &lsm_run_data->lat[lpd->class];
+	unsigned int i;
+
+	fio_sem_down(lsm_run_data->sem);
+
+	for (i = 0; i < FIO_IO_U_PLAT_NR; i++)
+		dst->plat[i] += lpd->lat.plat[i];
+	dst->nr += lpd->lat.nr;
+	dst->sum += lpd->lat.sum;
+	if (lpd->lat.max > dst->max)
+		dst->max = lpd->lat.max;
+
+	if (!--lsm_run_data->pending)
+		lsm_show_stats();
+
+	fio_sem_up(lsm_run_data->sem);
+
+	free(lpd);
+	td->prof_data = NULL;
+}
+
+static struct prof_io_ops lsm_io_ops = {
+	.td_init	= lsm_td_init,
+	.td_exit	= lsm_td_exit,
+	.io_u_lat	= lsm_io_u_lat,
+};
+
+static struct profile_ops lsm_profile = {
+	.name		= "lsm",
+	.desc		= "LSM tree key/value store like workload",
+	.options	= options,
+	.opt_data	= &lsm_options,
+	.prep_cmd	= lsm_prep_cmdline,
+	.io_ops		= &lsm_io_ops,
+};
+
+static void fio_init lsm_register(void)
+{
+	lsm_run_data = calloc(1, sizeof(*lsm_run_data));
+	lsm_run_data->sem = fio_sem_init(FIO_SEM_UNLOCKED);
+
+	if (register_profile(&lsm_profile))
+		log_err("fio: failed to register profile 'lsm'\n");
+}
+
+static void fio_exit lsm_unregister(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < opt_idx; i++)
+		free((void *) lsm_opts[i]);
+	free(lsm_opts);
+
+	unregister_profile(&lsm_profile);
+	fio_sem_remove(lsm_run_data->sem);
+	free(lsm_run_data);
+	lsm_run_data = NULL;
+}
@@ -0,0 +1,236 @@
+#include "fio.h"
+#include "fio_sem.h"
+#include "smalloc.h"
+#include "flist.h"
+
+/*
+ * Token bucket shared by all jobs with the same rate_bucket_id. It is kept
+ * as a theoretical arrival time per data direction (GCRA): each IO moves
+ * tat forward by one refill interval, and an IO may go ahead as long as tat
+ * is no more than burst intervals in the future. A single CAS per IO is all
+ * the shared state sees, so jobs never take a lock to get a token.
+ */
+struct fio_rate_bucket {
+	unsigned int refs;
+	unsigned int id;
+	struct flist_head list;
+	unsigned int iops[DDIR_RWDIR_CNT];
+	unsigned int burst[DDIR_RWDIR_CNT];
+	uint64_t interval[DDIR_RWDIR_CNT];
+	uint64_t tau[DDIR_RWDIR_CNT];
+	uint64_t tat[DDIR_RWDIR_CNT];
+};
+
+static struct flist_head *rate_bucket_list;
+static struct fio_sem *rate_bucket_lock;
+
+static uint64_t rate_bucket_now(void)
+{
+	struct timespec ts;
+
+	if (fio_get_mono_time(&ts) < 0)
+		return 0;
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Take one token from the bucket, returning how many nsecs the caller has
+ * to wait before it may issue the IO.
+ */
+static uint64_t rate_bucket_take(struct fio_rate_bucket *rb,
+				 enum fio_ddir ddir, uint64_t now)
+{
+	uint64_t old, start, next;
+
+	old = __atomic_load_n(&rb->tat[ddir], __ATOMIC_RELAXED);
+	do {
+		start = old;
+		if (now > rb->tau[ddir] && start < now - rb->tau[ddir])
+			start = now - rb->tau[ddir];
+		next = start + rb->interval[ddir];
+	} while (!__atomic_compare_exchange_n(&rb->tat[ddir], &old, next,
+					      false, __ATOMIC_RELAXED,
+					      __ATOMIC_RELAXED));
+
+	return start > now ? start - now : 0;
+}
+
+/*
+ * Returns non-zero if the job should stop, because it was asked to
+ * terminate or would run past its timeout while waiting for a token.
+ */
+int rate_bucket_wait(struct thread_data *td, enum fio_ddir ddir)
+{
+	struct fio_rate_bucket *rb = td->rate_bucket;
+	uint64_t now, usec;
+
+	if (!rb || !ddir_rw(ddir) || !rb->interval[ddir])
+		return 0;
+
+	usec = rate_bucket_take(rb, ddir, rate_bucket_now()) / 1000;
+	if (!usec)
+		return 0;
+
+	if (td->o.io_submit_mode == IO_MODE_INLINE)
+		io_u_quiesce(td);
+
+	if (td->o.timeout) {
+		now = utime_since_now(&td->epoch);
+		if (now + usec > td->o.timeout) {
+			if (now < td->o.timeout)
+				usec_sleep(td, td->o.timeout - now);
+			return 1;
+		}
+	}
+
+	usec_sleep(td, usec);
+	return td->terminate;
+}
+
+static void rate_bucket_setup(struct fio_rate_bucket *rb,
+			      struct thread_options *o)
+{
+	int i;
+
+	for (i = 0; i < DDIR_RWDIR_CNT; i++) {
+		unsigned int burst = o->rate_bucket_burst[i];
+
+		rb->iops[i] = o->rate_bucket_iops[i];
+		rb->burst[i] = burst;
+		if (!rb->iops[i])
+			continue;
+
+		/*
+		 * Default to a tenth of a second worth of IO, and always
+		 * allow at least one IO to go ahead.
+		 */
+		if (!burst)
+			burst = rb->iops[i] / 10;
+		if (!burst)
+			burst = 1;
+
+		rb->interval[i] = 1000000000ULL / rb->iops[i];
+		rb->tau[i] = (burst - 1) * rb->interval[i];
+	}
+}
+
+static bool rate_bucket_match(struct fio_rate_bucket *rb,
+			      struct thread_options *o)
+{
+	int i;
+
+	for (i = 0; i < DDIR_RWDIR_CNT; i++) {
+		if (rb->iops[i] != o->rate_bucket_iops[i] ||
+		    rb->burst[i] != o->rate_bucket_burst[i])
+			return false;
+	}
+
+	return true;
+}
+
+static struct fio_rate_bucket *rate_bucket_get(struct thread_options *o)
+{
+	struct fio_rate_bucket *rb = NULL;
+	struct flist_head *n;
+
+	if (!rate_bucket_lock)
+		return NULL;
+
+	fio_sem_down(rate_bucket_lock);
+
+	flist_for_each(n, rate_bucket_list) {
+		rb = flist_entry(n, struct fio_rate_bucket, list);
+		if (rb->id == o->rate_bucket_id)
+			break;
+
+		rb = NULL;
+	}
+
+	if (!rb) {
+		rb = smalloc(sizeof(*rb));
+		if (!rb) {
+			fio_sem_up(rate_bucket_lock);
+			return NULL;
+		}
+		INIT_FLIST_HEAD(&rb->list);
+		rb->id = o->rate_bucket_id;
+		rate_bucket_setup(rb, o);
+
+		flist_add_tail(&rb->list, rate_bucket_list);
+	} else if (!rate_bucket_match(rb, o))
+		log_info("fio: rate_bucket_id=%u already set up by an earlier"
+			 " job, ignoring this job's rate_bucket settings\n",
+			 rb->id);
+
+	rb->refs++;
+	fio_sem_up(rate_bucket_lock);
+	return rb;
+}
+
+static void rate_bucket_put(struct fio_rate_bucket *rb)
+{
+	if (!rate_bucket_lock)
+		return;
+
+	fio_sem_down(rate_bucket_lock);
+
+	if (!--rb->refs) {
+		flist_del(&rb->list);
+		sfree(rb);
+	}
+
+	fio_sem_up(rate_bucket_lock);
+}
+
+int rate_bucket_init_job(struct thread_data *td)
+{
+	struct thread_options *o = &td->o;
+
+	if (!o->rate_bucket_id)
+		return 0;
+
+	td->rate_bucket = rate_bucket_get(o);
+	if (!td->rate_bucket) {
+		log_err("fio: failed to set up rate_bucket_id=%u\n",
+			o->rate_bucket_id);
+		return 1;
+	}
+
+	return 0;
+}
+
+void rate_bucket_exit_job(struct thread_data *td)
+{
+	if (td->rate_bucket) {
+		rate_bucket_put(td->rate_bucket);
+		td->rate_bucket = NULL;
+	}
+}
+
+void rate_bucket_init(void)
+{
+	rate_bucket_list = smalloc(sizeof(*rate_bucket_list));
+	if (!rate_bucket_list) {
+		log_err("fio: smalloc pool exhausted\n");
+		return;
+	}
+
+	rate_bucket_lock = fio_sem_init(FIO_SEM_UNLOCKED);
+	if (!rate_bucket_lock) {
+		log_err("fio: failed to allocate rate bucket lock\n");
+		sfree(rate_bucket_list);
+		rate_bucket_list = NULL;
+		return;
+	}
+
+	INIT_FLIST_HEAD(rate_bucket_list);
+}
+
+void rate_bucket_exit(void)
+{
+	if (rate_bucket_lock)
+		fio_sem_remove(rate_bucket_lock);
+	if (rate_bucket_list)
+		sfree(rate_bucket_list);
+}
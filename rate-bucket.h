@@ -0,0 +1,11 @@
+#ifndef FIO_RATE_BUCKET_H
+#define FIO_RATE_BUCKET_H
+
+int rate_bucket_wait(struct thread_data *td, enum fio_ddir ddir);
+int rate_bucket_init_job(struct thread_data *td);
+void rate_bucket_exit_job(struct thread_data *td);
+
+void rate_bucket_exit(void);
+void rate_bucket_init(void);
+
+#endif
@@ -9,43 +9,16 @@
 #include "ioengines.h"
 #include "lib/getrusage.h"
 #include "rate-submit.h"
+#include "overlap.h"
 
-static void check_overlap(struct io_u *io_u)
+/*
+ * Wait until io_u doesn't overlap an IO in flight. Those were submitted
+ * by other workers, which complete them without our help.
+ */
+static void check_overlap(struct thread_data *td, struct io_u *io_u)
 {
-	int res;
-
-	/*
-	 * Allow only one thread to check for overlap at a time to prevent two
-	 * threads from thinking the coast is clear and then submitting IOs
-	 * that overlap with each other.
-	 *
-	 * If an overlap is found, release the lock and re-acquire it before
-	 * checking again to give other threads a chance to make progress.
-	 *
-	 * If no overlap is found, release the lock when the io_u's
-	 * IO_U_F_FLIGHT flag is set so that this io_u can be checked by other
-	 * threads as they assess overlap.
-	 */
-	res = pthread_mutex_lock(&overlap_check);
-	assert(res == 0);
-
-retry:
-	for_each_td(td) {
-		if (td->runstate <= TD_SETTING_UP ||
-		    td->runstate >= TD_FINISHING ||
-		    !td->o.serialize_overlap ||
-		    td->o.io_submit_mode != IO_MODE_OFFLOAD)
-			continue;
-
-		if (!in_flight_overlap(&td->io_u_all, io_u))
-			continue;
-
-		res = pthread_mutex_unlock(&overlap_check);
-		assert(res == 0);
-		res = pthread_mutex_lock(&overlap_check);
-		assert(res == 0);
-		goto retry;
-	} end_for_each();
+	while (!overlap_claim(td, io_u))
+		nop;
 }
 
 static int io_workqueue_fn(struct submit_worker *sw,
@@ -57,7 +30,7 @@ static int io_workqueue_fn(struct submit_worker *sw,
 	int ret, error;
 
 	if (td->o.serialize_overlap)
-		check_overlap(io_u);
+		check_overlap(td, io_u);
 
 	dprint(FD_RATE, "io_u %p queued by %u\n", io_u, gettid());
 
@@ -154,6 +127,7 @@ static int io_workqueue_init_worker_fn(struct submit_worker *sw)
 	td->eo = parent->eo;
 	fio_options_mem_dupe(td);
 	td->iolog_f = parent->iolog_f;
+	td->iolog_cap = parent->iolog_cap;
 
 	if (ioengine_load(td))
 		goto err;
@@ -162,7 +136,6 @@ static int io_workqueue_init_worker_fn(struct submit_worker *sw)
 
 	INIT_FLIST_HEAD(&td->io_log_list);
 	INIT_FLIST_HEAD(&td->io_hist_list);
-	INIT_FLIST_HEAD(&td->verify_list);
 	INIT_FLIST_HEAD(&td->trim_list);
 	td->io_hist_tree = RB_ROOT;
 
@@ -274,7 +247,7 @@ static void io_workqueue_update_acct_fn(struct submit_worker *sw)
 	struct thread_data *src = sw->priv;
 	struct thread_data *dst = sw->wq->td;
 
-	if (td_read(src))
+	if (td_read(src) || td_verify_threads(src))
 		sum_ddir(dst, src, DDIR_READ);
 	if (td_write(src))
 		sum_ddir(dst, src, DDIR_WRITE);
@@ -296,6 +269,16 @@ static struct workqueue_ops rated_wq_ops = {
 
 int rate_submit_init(struct thread_data *td, struct sk_out *sk_out)
 {
+	if (td_verify_threads(td)) {
+		if (td_ioengine_flagged(td, FIO_NO_OFFLOAD)) {
+			log_err("%s: can't be used with verify_threads\n",
+				td->io_ops->name);
+			return 1;
+		}
+		return workqueue_init(td, &td->io_wq, &rated_wq_ops,
+				      td->o.verify_threads, sk_out);
+	}
+
 	if (td->o.io_submit_mode != IO_MODE_OFFLOAD)
 		return 0;
 
@@ -304,7 +287,7 @@ int rate_submit_init(struct thread_data *td, struct sk_out *sk_out)
 
 void rate_submit_exit(struct thread_data *td)
 {
-	if (td->o.io_submit_mode != IO_MODE_OFFLOAD)
+	if (td->o.io_submit_mode != IO_MODE_OFFLOAD && !td_verify_threads(td))
 		return;
 
 	workqueue_exit(&td->io_wq);
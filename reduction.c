@@ -0,0 +1,283 @@
+/*
+ * Measured compressibility and dedupe of the written data, see reduction.h
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <math.h>
+
+#include "fio.h"
+#include "hash.h"
+#include "reduction.h"
+#include "crc/xxhash.h"
+#include "lib/bloom.h"
+
+#ifdef CONFIG_ZLIB
+#include <zlib.h>
+#endif
+
+#define REDUCTION_SLOTS		16
+#define REDUCTION_MAX_LEN	(128 * 1024)
+#define REDUCTION_SKETCH_LEN	64
+
+/* bits in the fingerprint bloom, about 1M samples before it fills up */
+#define REDUCTION_BLOOM_BITS	(16 * 1024 * 1024)
+
+struct reduction_slot {
+	void *buf;
+	unsigned int len;
+	bool compress;
+	bool dedupe;
+};
+
+struct fio_reduction {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool exit;
+
+	/* filled by the job at head, emptied by the thread at tail */
+	struct reduction_slot slots[REDUCTION_SLOTS];
+	unsigned int head, tail, nr_full;
+	unsigned int max_len;
+
+	struct bloom *bloom;
+	void *zbuf;
+	unsigned long zlen;
+
+	uint64_t seen;
+	uint64_t samples;
+	uint64_t bytes;
+	uint64_t zbytes;
+	uint64_t fps;
+	uint64_t dups;
+	uint64_t dropped;
+};
+
+/*
+ * Without zlib, fall back to the order 0 entropy of the bytes, which is
+ * about what an entropy coder gets and ignores repeats
+ */
+static unsigned long reduction_entropy_size(const unsigned char *buf,
+					    unsigned int len)
+{
+	unsigned int count[256] = { 0 };
+	double bits = 0.0;
+	unsigned int i;
+
+	for (i = 0; i < len; i++)
+		count[buf[i]]++;
+	for (i = 0; i < 256; i++) {
+		double p = (double) count[i] / len;
+
+		if (count[i])
+			bits -= count[i] * log2(p);
+	}
+
+	return (unsigned long) (bits / 8);
+}
+
+static unsigned long reduction_zsize(struct fio_reduction *r, void *buf,
+				     unsigned int len)
+{
+#ifdef CONFIG_ZLIB
+	uLongf dst_len = r->zlen;
+
+	/* level 1 is closest to the fast compressors devices use */
+	if (compress2(r->zbuf, &dst_len, buf, len, 1) == Z_OK)
+		return dst_len < len ? dst_len : len;
+#endif
+	return reduction_entropy_size(buf, len);
+}
+
+static void reduction_measure(struct fio_reduction *r,
+			      struct reduction_slot *slot)
+{
+	uint32_t fp[3];
+
+	if (slot->compress) {
+		r->samples++;
+		r->bytes += slot->len;
+		r->zbytes += reduction_zsize(r, slot->buf, slot->len);
+	}
+	if (slot->dedupe) {
+		fp[0] = XXH32(slot->buf, slot->len, 0);
+		fp[1] = XXH32(slot->buf, slot->len, 0x9e3779b9);
+		fp[2] = slot->len;
+
+		r->fps++;
+		if (bloom_set(r->bloom, fp, FIO_ARRAY_SIZE(fp)))
+			r->dups++;
+	}
+}
+
+static void *reduction_thread(void *data)
+{
+	struct fio_reduction *r = data;
+	struct reduction_slot *slot;
+
+	pthread_mutex_lock(&r->lock);
+	while (1) {
+		while (!r->nr_full && !r->exit)
+			pthread_cond_wait(&r->cond, &r->lock);
+		if (!r->nr_full)
+			break;
+
+		slot = &r->slots[r->tail];
+		pthread_mutex_unlock(&r->lock);
+
+		reduction_measure(r, slot);
+
+		pthread_mutex_lock(&r->lock);
+		r->tail = (r->tail + 1) % REDUCTION_SLOTS;
+		r->nr_full--;
+	}
+	pthread_mutex_unlock(&r->lock);
+
+	return NULL;
+}
+
+static uint32_t reduction_sketch(const void *buf, unsigned long long len)
+{
+	const unsigned int w = min(len, (unsigned long long) REDUCTION_SKETCH_LEN);
+	uint32_t h;
+
+	h = jhash(buf, w, len);
+	if (len >= 3 * w) {
+		h = jhash(buf + len / 2, w, h);
+		h = jhash(buf + len - w, w, h);
+	}
+
+	return h;
+}
+
+/*
+ * Called for every write the job issues. Compression is measured on every
+ * N-th block, dedupe on the blocks picked by content, as a stream of
+ * identical blocks would otherwise be all or nothing. Offload workers
+ * issue the writes of their parent, so the copy is taken under the lock.
+ */
+void __reduction_sample(struct thread_data *td, const void *buf,
+			unsigned long long len)
+{
+	const unsigned int n = td->o.data_reduction_sample;
+	struct fio_reduction *r = td->reduction;
+	struct reduction_slot *slot;
+	bool compress, dedupe;
+
+	if (!len)
+		return;
+
+	compress = !(atomic_add(&r->seen, 1) % n);
+	dedupe = !(reduction_sketch(buf, len) % n);
+	if (!compress && !dedupe)
+		return;
+
+	pthread_mutex_lock(&r->lock);
+	if (r->nr_full == REDUCTION_SLOTS) {
+		r->dropped++;
+		pthread_mutex_unlock(&r->lock);
+		return;
+	}
+
+	slot = &r->slots[r->head];
+	slot->len = min(len, (unsigned long long) r->max_len);
+	slot->compress = compress;
+	slot->dedupe = dedupe;
+	memcpy(slot->buf, buf, slot->len);
+	r->head = (r->head + 1) % REDUCTION_SLOTS;
+	r->nr_full++;
+	pthread_cond_signal(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+}
+
+static void reduction_free(struct fio_reduction *r)
+{
+	int i;
+
+	for (i = 0; i < REDUCTION_SLOTS; i++)
+		free(r->slots[i].buf);
+	if (r->bloom)
+		bloom_free(r->bloom);
+	free(r->zbuf);
+	free(r);
+}
+
+int reduction_init(struct thread_data *td)
+{
+	struct fio_reduction *r;
+	int i;
+
+	if (!td->o.data_reduction_sample || !td_write(td))
+		return 0;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		goto err;
+
+	r->max_len = min(td->o.max_bs[DDIR_WRITE],
+			 (unsigned long long) REDUCTION_MAX_LEN);
+	for (i = 0; i < REDUCTION_SLOTS; i++) {
+		r->slots[i].buf = malloc(r->max_len);
+		if (!r->slots[i].buf)
+			goto err;
+	}
+#ifdef CONFIG_ZLIB
+	r->zlen = compressBound(r->max_len);
+	r->zbuf = malloc(r->zlen);
+	if (!r->zbuf)
+		goto err;
+#endif
+	r->bloom = bloom_new(REDUCTION_BLOOM_BITS);
+	if (!r->bloom)
+		goto err;
+
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->cond, NULL);
+	if (pthread_create(&r->thread, NULL, reduction_thread, r)) {
+		td_verror(td, errno, "reduction_init");
+		pthread_cond_destroy(&r->cond);
+		pthread_mutex_destroy(&r->lock);
+		reduction_free(r);
+		return 1;
+	}
+
+	td->reduction = r;
+	return 0;
+err:
+	if (r)
+		reduction_free(r);
+	td_verror(td, ENOMEM, "reduction_init");
+	return 1;
+}
+
+/*
+ * Let the thread work off what is queued and put the results in the
+ * job stats
+ */
+void reduction_exit(struct thread_data *td)
+{
+	struct fio_reduction *r = td->reduction;
+	struct thread_stat *ts = &td->ts;
+
+	if (!r)
+		return;
+
+	pthread_mutex_lock(&r->lock);
+	r->exit = true;
+	pthread_cond_signal(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+	pthread_join(r->thread, NULL);
+
+	ts->dr_samples = r->samples;
+	ts->dr_bytes = r->bytes;
+	ts->dr_zbytes = r->zbytes;
+	ts->dr_fps = r->fps;
+	ts->dr_dups = r->dups;
+	ts->dr_dropped = r->dropped;
+
+	pthread_cond_destroy(&r->cond);
+	pthread_mutex_destroy(&r->lock);
+	reduction_free(r);
+	td->reduction = NULL;
+}
@@ -0,0 +1,28 @@
+#ifndef FIO_REDUCTION_H
+#define FIO_REDUCTION_H
+
+struct thread_data;
+
+/*
+ * data_reduction_sample=N measures what the written data reduces to.
+ * Every N-th block is compressed. For dedupe, blocks are picked by a hash
+ * of a few bytes of their contents, roughly one in N, so copies of a
+ * picked block are picked too and the dedupe share among those samples
+ * stands for the whole stream. A background thread does the compressing
+ * and looks the fingerprints up in a bloom filter.
+ */
+struct fio_reduction;
+
+extern int reduction_init(struct thread_data *);
+extern void reduction_exit(struct thread_data *);
+extern void __reduction_sample(struct thread_data *, const void *,
+			       unsigned long long);
+
+static inline void reduction_sample(struct thread_data *td, const void *buf,
+				    unsigned long long len)
+{
+	if (td->reduction)
+		__reduction_sample(td, buf, len);
+}
+
+#endif
@@ -0,0 +1,263 @@
+/*
+ * Relay mode: a fio server started with --relay passes the jobs it gets
+ * on to its own set of servers instead of running them. Their final stats
+ * are summed per group, like the client does for "All clients", and sent
+ * upstream as the relay's own, with one thread_stat per group. Relays
+ * can point at other relays, so the results of large runs are collected
+ * along a tree rather than all by one client.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+
+#include "fio.h"
+#include "client.h"
+#include "server.h"
+#include "relay.h"
+#include "fio_sem.h"
+#include "flist.h"
+
+struct relay_host {
+	struct flist_head list;
+	char *name;
+};
+
+/*
+ * A job file received by the relay, either the contents or the name of
+ * a file local to the relay.
+ */
+struct relay_job {
+	struct flist_head list;
+	char *file;
+	void *buf;
+	size_t len;
+};
+
+/*
+ * The latest summed ETA of the downstream servers. It is written by the
+ * process running the relay and read by the connection process answering
+ * upstream ETA requests, so it lives in a shared mapping.
+ */
+struct relay_eta {
+	size_t size;
+	struct jobs_eta eta;
+};
+
+static FLIST_HEAD(relay_hosts);
+static FLIST_HEAD(relay_jobs);
+
+static struct relay_eta *relay_eta;
+static size_t relay_eta_size;
+static struct fio_sem *relay_eta_lock;
+
+static struct client_ops relay_client_ops;
+
+static int relay_eta_init(void)
+{
+	if (relay_eta)
+		return 0;
+
+	relay_eta_size = sizeof(*relay_eta) + __THREAD_RUNSTR_SZ(REAL_MAX_JOBS);
+	relay_eta = mmap(NULL, relay_eta_size, PROT_READ | PROT_WRITE,
+				OS_MAP_ANON | MAP_SHARED, -1, 0);
+	if (relay_eta == MAP_FAILED) {
+		log_err("fio: relay: mmap: %s\n", strerror(errno));
+		relay_eta = NULL;
+		return 1;
+	}
+
+	relay_eta_lock = fio_sem_init(FIO_SEM_UNLOCKED);
+	if (!relay_eta_lock) {
+		munmap(relay_eta, relay_eta_size);
+		relay_eta = NULL;
+		return 1;
+	}
+
+	relay_eta->size = 0;
+	return 0;
+}
+
+static void relay_add_host(const char *name)
+{
+	struct relay_host *host;
+
+	host = malloc(sizeof(*host));
+	host->name = strdup(name);
+	flist_add_tail(&host->list, &relay_hosts);
+}
+
+/*
+ * Add a downstream server, or every server listed in a file if 'arg'
+ * names one, just like --client.
+ */
+int fio_relay_add_hosts(const char *arg)
+{
+	if (!access(arg, R_OK)) {
+		char hostaddr[PATH_MAX] = {0};
+		char formatstr[8];
+		FILE *f;
+
+		f = fopen(arg, "r");
+		if (!f) {
+			log_err("fio: could not open relay list file %s\n", arg);
+			return 1;
+		}
+
+		sprintf(formatstr, "%%%ds", PATH_MAX - 1);
+		while (fscanf(f, formatstr, hostaddr) == 1)
+			relay_add_host(hostaddr);
+		fclose(f);
+	} else
+		relay_add_host(arg);
+
+	return relay_eta_init();
+}
+
+bool fio_relay_enabled(void)
+{
+	return !flist_empty(&relay_hosts);
+}
+
+void fio_relay_add_job(const void *buf, size_t len)
+{
+	struct relay_job *job;
+
+	job = calloc(1, sizeof(*job));
+	job->buf = malloc(len);
+	memcpy(job->buf, buf, len);
+	job->len = len;
+	flist_add_tail(&job->list, &relay_jobs);
+}
+
+int fio_relay_add_job_file(const char *file)
+{
+	struct relay_job *job;
+
+	if (access(file, R_OK)) {
+		log_err("fio: relay: job file <%s>: %s\n", file, strerror(errno));
+		return 1;
+	}
+
+	job = calloc(1, sizeof(*job));
+	job->file = strdup(file);
+	flist_add_tail(&job->list, &relay_jobs);
+	return 0;
+}
+
+/*
+ * The relay sends one summed thread_stat per group upstream
+ */
+unsigned int fio_relay_stat_outputs(void)
+{
+	unsigned int groups = 0;
+
+	for_each_td(td) {
+		if (td->groupid + 1 > groups)
+			groups = td->groupid + 1;
+	} end_for_each();
+
+	return groups;
+}
+
+static void relay_store_eta(struct jobs_eta *je)
+{
+	size_t size;
+
+	size = sizeof(*je) + strlen((char *) je->run_str) + 1;
+	if (size > relay_eta_size - offsetof(struct relay_eta, eta))
+		return;
+
+	fio_sem_down(relay_eta_lock);
+	memcpy(&relay_eta->eta, je, size);
+	relay_eta->size = size;
+	fio_sem_up(relay_eta_lock);
+}
+
+/*
+ * The upstream client only asks for ETAs once jobs have started
+ */
+static void relay_job_start(struct fio_client *client, struct fio_net_cmd *cmd)
+{
+	fio_server_send_start(NULL);
+}
+
+/*
+ * Returns a copy of the latest downstream ETA, or NULL if there isn't
+ * one yet.
+ */
+struct jobs_eta *fio_relay_get_eta(size_t *size)
+{
+	struct jobs_eta *je = NULL;
+
+	if (!relay_eta)
+		return NULL;
+
+	fio_sem_down(relay_eta_lock);
+	if (relay_eta->size) {
+		je = malloc(relay_eta->size);
+		memcpy(je, &relay_eta->eta, relay_eta->size);
+		*size = relay_eta->size;
+	}
+	fio_sem_up(relay_eta_lock);
+	return je;
+}
+
+static int relay_send_jobs(void)
+{
+	struct flist_head *entry;
+	struct relay_job *job;
+	int ret;
+
+	flist_for_each(entry, &relay_jobs) {
+		job = flist_entry(entry, struct relay_job, list);
+
+		ret = fio_clients_send_job(job->file, job->buf, job->len);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Runs in place of fio_backend() in the process forked for the run
+ * command. Text from the downstream servers is passed upstream as is,
+ * their stats only once summed.
+ */
+int fio_relay_backend(void)
+{
+	struct flist_head *entry;
+	struct relay_host *host;
+	void *cookie = NULL;
+
+	relay_client_ops = fio_client_ops;
+	relay_client_ops.eta = relay_store_eta;
+	relay_client_ops.job_start = relay_job_start;
+
+	fio_sem_down(relay_eta_lock);
+	relay_eta->size = 0;
+	fio_sem_up(relay_eta_lock);
+
+	flist_for_each(entry, &relay_hosts) {
+		host = flist_entry(entry, struct relay_host, list);
+
+		if (fio_client_add(&relay_client_ops, host->name, &cookie)) {
+			log_err("fio: relay: failed adding server %s\n", host->name);
+			return 1;
+		}
+	}
+
+	if (fio_clients_connect())
+		return 1;
+	if (relay_send_jobs())
+		return 1;
+	if (fio_start_all_clients())
+		return 1;
+
+	client_summary = true;
+	return fio_handle_clients(&relay_client_ops);
+}
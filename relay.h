@@ -0,0 +1,17 @@
+#ifndef FIO_RELAY_H
+#define FIO_RELAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct jobs_eta;
+
+extern int fio_relay_add_hosts(const char *);
+extern bool fio_relay_enabled(void);
+extern void fio_relay_add_job(const void *, size_t);
+extern int fio_relay_add_job_file(const char *);
+extern unsigned int fio_relay_stat_outputs(void);
+extern int fio_relay_backend(void);
+extern struct jobs_eta *fio_relay_get_eta(size_t *);
+
+#endif
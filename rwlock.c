@@ -32,27 +32,17 @@ void fio_rwlock_remove(struct fio_rwlock *lock)
 	munmap((void *) lock, sizeof(*lock));
 }
 
-struct fio_rwlock *fio_rwlock_init(void)
+int __fio_rwlock_init(struct fio_rwlock *lock)
 {
-	struct fio_rwlock *lock;
 	pthread_rwlockattr_t attr;
 	int ret;
 
-	lock = (void *) mmap(NULL, sizeof(struct fio_rwlock),
-				PROT_READ | PROT_WRITE,
-				OS_MAP_ANON | MAP_SHARED, -1, 0);
-	if (lock == MAP_FAILED) {
-		perror("mmap rwlock");
-		lock = NULL;
-		goto err;
-	}
-
 	lock->magic = FIO_RWLOCK_MAGIC;
 
 	ret = pthread_rwlockattr_init(&attr);
 	if (ret) {
 		log_err("pthread_rwlockattr_init: %s\n", strerror(ret));
-		goto err;
+		return ret;
 	}
 #ifdef CONFIG_PSHARED
 	ret = pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
@@ -72,12 +62,27 @@ struct fio_rwlock *fio_rwlock_init(void)
 	}
 
 	pthread_rwlockattr_destroy(&attr);
-
-	return lock;
+	return 0;
 destroy_attr:
 	pthread_rwlockattr_destroy(&attr);
-err:
-	if (lock)
-		fio_rwlock_remove(lock);
+	return ret;
+}
+
+struct fio_rwlock *fio_rwlock_init(void)
+{
+	struct fio_rwlock *lock;
+
+	lock = (void *) mmap(NULL, sizeof(struct fio_rwlock),
+				PROT_READ | PROT_WRITE,
+				OS_MAP_ANON | MAP_SHARED, -1, 0);
+	if (lock == MAP_FAILED) {
+		perror("mmap rwlock");
+		return NULL;
+	}
+
+	if (!__fio_rwlock_init(lock))
+		return lock;
+
+	fio_rwlock_remove(lock);
 	return NULL;
 }
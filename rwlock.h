@@ -13,6 +13,7 @@ struct fio_rwlock {
 extern void fio_rwlock_read(struct fio_rwlock *);
 extern void fio_rwlock_write(struct fio_rwlock *);
 extern void fio_rwlock_unlock(struct fio_rwlock *);
+extern int __fio_rwlock_init(struct fio_rwlock *);
 extern struct fio_rwlock *fio_rwlock_init(void);
 extern void fio_rwlock_remove(struct fio_rwlock *);
 
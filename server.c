@@ -25,6 +25,7 @@
 #include "lib/ieee754.h"
 #include "verify-state.h"
 #include "smalloc.h"
+#include "relay.h"
 
 int fio_net_port = FIO_NET_PORT;
 
@@ -118,6 +119,7 @@ static const char *fio_server_ops[FIO_NET_CMD_NR] = {
 	"VTRIGGER",
 	"SENDFILE",
 	"JOB_OPT",
+	"CLOCK",
 };
 
 static void sk_lock(struct sk_out *sk_out)
@@ -841,11 +843,39 @@ static void fio_server_check_jobs(struct flist_head *job_list)
 	fio_server_check_fork_items(job_list, true);
 }
 
+/*
+ * A relay runs no threads of its own, it is stopped through the process
+ * running it instead.
+ */
+static void fio_server_signal_jobs(struct flist_head *job_list, int sig)
+{
+#ifndef WIN32
+	struct flist_head *entry;
+	struct fio_fork_item *ffi;
+
+	flist_for_each(entry, job_list) {
+		ffi = flist_entry(entry, struct fio_fork_item, list);
+		kill(ffi->pid, sig);
+	}
+#endif
+}
+
 static void fio_server_check_conns(struct flist_head *conn_list)
 {
 	fio_server_check_fork_items(conn_list, false);
 }
 
+/*
+ * A relay reports one summed thread_stat per group
+ */
+static unsigned int server_stat_outputs(void)
+{
+	if (fio_relay_enabled())
+		return fio_relay_stat_outputs();
+
+	return stat_number;
+}
+
 static int handle_load_file_cmd(struct fio_net_cmd *cmd)
 {
 	struct cmd_load_file_pdu *pdu = (struct cmd_load_file_pdu *) cmd->payload;
@@ -857,13 +887,18 @@ static int handle_load_file_cmd(struct fio_net_cmd *cmd)
 	pdu->name_len = le16_to_cpu(pdu->name_len);
 	pdu->client_type = le16_to_cpu(pdu->client_type);
 
+	if (fio_relay_enabled() && fio_relay_add_job_file(file_name)) {
+		fio_net_queue_quit();
+		return -1;
+	}
+
 	if (parse_jobs_ini(file_name, 0, 0, pdu->client_type)) {
 		fio_net_queue_quit();
 		return -1;
 	}
 
 	spdu.jobs = cpu_to_le32(thread_number);
-	spdu.stat_outputs = cpu_to_le32(stat_number);
+	spdu.stat_outputs = cpu_to_le32(server_stat_outputs());
 	fio_net_queue_cmd(FIO_NET_CMD_START, &spdu, sizeof(spdu), NULL, SK_F_COPY);
 	return 0;
 }
@@ -884,11 +919,36 @@ static void *fio_backend_thread(void *data)
 }
 #endif
 
+/*
+ * Set while a --sync-start client is probing our clock. The connection
+ * then waits for the next probe on the socket, instead of on the xmit
+ * queue with a timeout that would add up to a second to its round trip.
+ */
+static bool clock_probed;
+
 static int handle_run_cmd(struct sk_out *sk_out, struct flist_head *job_list,
 			  struct fio_net_cmd *cmd)
 {
 	int ret;
 
+	clock_probed = false;
+	fio_start_at_ns = 0;
+	fio_clock_offset_ns = 0;
+	fio_shard_index = fio_shard_count = 0;
+	if (cmd->pdu_len >= sizeof(struct cmd_run_pdu)) {
+		struct cmd_run_pdu *pdu = (struct cmd_run_pdu *) cmd->payload;
+
+		fio_start_at_ns = le64_to_cpu(pdu->start_at);
+		fio_clock_offset_ns = (int64_t) le64_to_cpu(pdu->clock_offset);
+		fio_shard_index = le32_to_cpu(pdu->shard_index);
+		fio_shard_count = le32_to_cpu(pdu->shard_count);
+		dprint(FD_NET, "server: start at %llu, clock offset %lld, "
+				"shard %u/%u\n",
+				(unsigned long long) fio_start_at_ns,
+				(long long) fio_clock_offset_ns,
+				fio_shard_index, fio_shard_count);
+	}
+
 	fio_time_init();
 	set_genesis_time();
 
@@ -918,7 +978,10 @@ static int handle_run_cmd(struct sk_out *sk_out, struct flist_head *job_list,
 			return 0;
 		}
 
-		ret = fio_backend(sk_out);
+		if (fio_relay_enabled())
+			ret = fio_relay_backend();
+		else
+			ret = fio_backend(sk_out);
 		free_threads_shm();
 		sk_out_drop();
 		_exit(ret);
@@ -935,13 +998,16 @@ static int handle_job_cmd(struct fio_net_cmd *cmd)
 	pdu->buf_len = le32_to_cpu(pdu->buf_len);
 	pdu->client_type = le32_to_cpu(pdu->client_type);
 
+	if (fio_relay_enabled())
+		fio_relay_add_job(buf, pdu->buf_len);
+
 	if (parse_jobs_ini(buf, 1, 0, pdu->client_type)) {
 		fio_net_queue_quit();
 		return -1;
 	}
 
 	spdu.jobs = cpu_to_le32(thread_number);
-	spdu.stat_outputs = cpu_to_le32(stat_number);
+	spdu.stat_outputs = cpu_to_le32(server_stat_outputs());
 
 	fio_net_queue_cmd(FIO_NET_CMD_START, &spdu, sizeof(spdu), NULL, SK_F_COPY);
 	return 0;
@@ -988,6 +1054,25 @@ static int handle_jobline_cmd(struct fio_net_cmd *cmd)
 	return 0;
 }
 
+/*
+ * Sent inline, so t3 is as close to the reply going out as it gets
+ */
+static int handle_clock_cmd(struct fio_net_cmd *cmd)
+{
+	struct cmd_clock_pdu *pdu = (struct cmd_clock_pdu *) cmd->payload;
+	uint64_t t2 = fio_realtime_ns();
+	uint64_t tag = cmd->tag;
+	struct cmd_clock_pdu reply;
+
+	reply.t1 = pdu->t1;
+	reply.t2 = cpu_to_le64(t2);
+	reply.t3 = cpu_to_le64(fio_realtime_ns());
+	clock_probed = true;
+
+	return fio_net_queue_cmd(FIO_NET_CMD_CLOCK, &reply, sizeof(reply),
+				 &tag, SK_F_COPY | SK_F_INLINE);
+}
+
 static int handle_probe_cmd(struct fio_net_cmd *cmd)
 {
 	struct cmd_client_probe_pdu *pdu = (struct cmd_client_probe_pdu *) cmd->payload;
@@ -1024,6 +1109,44 @@ static int handle_probe_cmd(struct fio_net_cmd *cmd)
 	return fio_net_queue_cmd(FIO_NET_CMD_PROBE, &probe, sizeof(probe), &tag, SK_F_COPY);
 }
 
+#ifdef CONFIG_ZLIB
+/*
+ * The run string of a server with many jobs in different states runs into
+ * kilobytes, and goes out every ETA interval. Deflate it, if that helps.
+ */
+static struct jobs_eta *fio_deflate_eta(struct jobs_eta *je, size_t *size)
+{
+	size_t len = *size - sizeof(*je);
+	struct jobs_eta *gz;
+	uLongf gz_len;
+
+	if (len < FIO_ETA_GZ_MIN)
+		return je;
+
+	gz_len = compressBound(len);
+	gz = malloc(sizeof(*je) + gz_len);
+	if (!gz)
+		return je;
+
+	if (compress2(gz->run_str, &gz_len, je->run_str, len,
+		      Z_BEST_SPEED) != Z_OK || gz_len >= len) {
+		free(gz);
+		return je;
+	}
+
+	memcpy(gz, je, sizeof(*je));
+	gz->run_str_gz = cpu_to_le32((uint32_t) gz_len);
+	*size = sizeof(*je) + gz_len;
+	free(je);
+	return gz;
+}
+#else
+static struct jobs_eta *fio_deflate_eta(struct jobs_eta *je, size_t *size)
+{
+	return je;
+}
+#endif
+
 static int handle_send_eta_cmd(struct fio_net_cmd *cmd)
 {
 	struct jobs_eta *je;
@@ -1037,7 +1160,10 @@ static int handle_send_eta_cmd(struct fio_net_cmd *cmd)
 	 * Fake ETA return if we don't have a local one, otherwise the client
 	 * will end up timing out waiting for a response to the ETA request
 	 */
-	je = get_jobs_eta(true, &size);
+	if (fio_relay_enabled())
+		je = fio_relay_get_eta(&size);
+	else
+		je = get_jobs_eta(true, &size);
 	if (!je) {
 		size = sizeof(*je);
 		je = calloc(1, size);
@@ -1062,6 +1188,10 @@ static int handle_send_eta_cmd(struct fio_net_cmd *cmd)
 		je->nr_threads		= cpu_to_le32(je->nr_threads);
 		je->is_pow2		= cpu_to_le32(je->is_pow2);
 		je->unit_base		= cpu_to_le32(je->unit_base);
+		je->sig_figs		= cpu_to_le32(je->sig_figs);
+
+		if (use_zlib)
+			je = fio_deflate_eta(je, &size);
 	}
 
 	fio_net_queue_cmd(FIO_NET_CMD_ETA, je, size, &tag, SK_F_FREE);
@@ -1137,6 +1267,8 @@ static int handle_command(struct sk_out *sk_out, struct flist_head *job_list,
 	switch (cmd->opcode) {
 	case FIO_NET_CMD_QUIT:
 		fio_terminate_threads(TERMINATE_ALL, TERMINATE_ALL);
+		if (fio_relay_enabled())
+			fio_server_signal_jobs(job_list, SIGTERM);
 		ret = 0;
 		break;
 	case FIO_NET_CMD_EXIT:
@@ -1154,6 +1286,9 @@ static int handle_command(struct sk_out *sk_out, struct flist_head *job_list,
 	case FIO_NET_CMD_PROBE:
 		ret = handle_probe_cmd(cmd);
 		break;
+	case FIO_NET_CMD_CLOCK:
+		ret = handle_clock_cmd(cmd);
+		break;
 	case FIO_NET_CMD_SEND_ETA:
 		ret = handle_send_eta_cmd(cmd);
 		break;
@@ -1364,7 +1499,10 @@ static int handle_connection(struct sk_out *sk_out)
 				break;
 			} else if (!ret) {
 				fio_server_check_jobs(&job_list);
-				fio_sem_down_timeout(&sk_out->wait, timeout);
+				if (clock_probed)
+					poll(&pfd, 1, timeout);
+				else
+					fio_sem_down_timeout(&sk_out->wait, timeout);
 				continue;
 			}
 
@@ -1679,6 +1817,111 @@ static void convert_gs(struct group_run_stats *dst, struct group_run_stats *src)
 	dst->sig_figs	= cpu_to_le32(src->sig_figs);
 }
 
+/*
+ * Most of a thread_stat is latency histogram buckets that were never hit,
+ * so the FIO_NET_CMD_TS payload is sent with runs of zero words squeezed
+ * out. The encoded stream is the decoded size as a le64, followed by runs
+ * of a le32 count of zero words, a le32 count of literal words and then the
+ * literal words. A trailing partial word is sent zero padded.
+ */
+void *fio_net_zrle_encode(const void *buf, size_t len, size_t *enc_len)
+{
+	const size_t nr_words = (len + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+	uint64_t *words, *out, *wp;
+	size_t i = 0;
+
+	words = calloc(nr_words + 1, sizeof(uint64_t));
+	if (!words)
+		return NULL;
+	memcpy(words, buf, len);
+
+	/* worst case, alternating zero and literal words */
+	out = malloc((2 * nr_words + 2) * sizeof(uint64_t));
+	if (!out) {
+		free(words);
+		return NULL;
+	}
+
+	out[0] = cpu_to_le64(len);
+	wp = out + 1;
+	while (i < nr_words) {
+		uint32_t *run = (uint32_t *) wp++;
+		uint32_t nr_zero = 0, nr_lit = 0;
+
+		while (i < nr_words && !words[i]) {
+			nr_zero++;
+			i++;
+		}
+		while (i < nr_words && words[i]) {
+			*wp++ = words[i++];
+			nr_lit++;
+		}
+
+		run[0] = cpu_to_le32(nr_zero);
+		run[1] = cpu_to_le32(nr_lit);
+	}
+
+	free(words);
+	*enc_len = (char *) wp - (char *) out;
+	return out;
+}
+
+void *fio_net_zrle_decode(const void *buf, size_t len, size_t *dec_len)
+{
+	const uint64_t *in = buf, *end = in + len / sizeof(uint64_t);
+	size_t nr_words, i = 0;
+	uint64_t *words;
+
+	if (len < sizeof(uint64_t))
+		return NULL;
+
+	*dec_len = le64_to_cpu(*in++);
+	nr_words = (*dec_len + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+	if (nr_words / 1024 > FIO_SERVER_MAX_CMD_MB * 128)
+		return NULL;
+
+	words = calloc(nr_words + 1, sizeof(uint64_t));
+	if (!words)
+		return NULL;
+
+	while (in < end) {
+		const uint32_t *run = (const uint32_t *) in++;
+		uint32_t nr_zero = le32_to_cpu(run[0]);
+		uint32_t nr_lit = le32_to_cpu(run[1]);
+
+		if (nr_zero > nr_words - i || nr_lit > nr_words - i - nr_zero ||
+		    nr_lit > (size_t) (end - in))
+			goto err;
+
+		i += nr_zero;
+		memcpy(&words[i], in, nr_lit * sizeof(uint64_t));
+		in += nr_lit;
+		i += nr_lit;
+	}
+
+	return words;
+err:
+	free(words);
+	return NULL;
+}
+
+static void fio_net_queue_ts(void *buf, size_t size)
+{
+	size_t enc_len;
+	void *enc;
+
+	enc = fio_net_zrle_encode(buf, size, &enc_len);
+	if (!enc) {
+		log_err("fio: failed to allocate FIO_NET_CMD_TS buffer\n");
+		return;
+	}
+
+	dprint(FD_NET, "server: ts pdu %zu bytes, %zu encoded\n", size,
+	       enc_len);
+	fio_net_queue_cmd(FIO_NET_CMD_TS, enc, enc_len, NULL, SK_F_COPY);
+	free(enc);
+}
+
 /*
  * Send a CMD_TS, which packs struct thread_stat and group_run_stats
  * into a single payload.
@@ -1719,15 +1962,27 @@ void fio_server_send_ts(struct thread_stat *ts, struct group_run_stats *rs)
 		convert_io_stat(&p.ts.iops_stat[i], &ts->iops_stat[i]);
 	}
 	convert_io_stat(&p.ts.sync_stat, &ts->sync_stat);
+	convert_io_stat(&p.ts.trim_range_stat, &ts->trim_range_stat);
 
 	p.ts.usr_time		= cpu_to_le64(ts->usr_time);
 	p.ts.sys_time		= cpu_to_le64(ts->sys_time);
 	p.ts.ctx		= cpu_to_le64(ts->ctx);
+	for (i = 0; i < FIO_PERF_NR; i++)
+		p.ts.perf_count[i] = cpu_to_le64(ts->perf_count[i]);
+	for (i = 0; i < FIO_OVH_NR; i++)
+		p.ts.overhead_nsec[i] = cpu_to_le64(ts->overhead_nsec[i]);
+	p.ts.dr_samples		= cpu_to_le64(ts->dr_samples);
+	p.ts.dr_bytes		= cpu_to_le64(ts->dr_bytes);
+	p.ts.dr_zbytes		= cpu_to_le64(ts->dr_zbytes);
+	p.ts.dr_fps		= cpu_to_le64(ts->dr_fps);
+	p.ts.dr_dups		= cpu_to_le64(ts->dr_dups);
+	p.ts.dr_dropped		= cpu_to_le64(ts->dr_dropped);
 	p.ts.minf		= cpu_to_le64(ts->minf);
 	p.ts.majf		= cpu_to_le64(ts->majf);
 	p.ts.clat_percentiles	= cpu_to_le32(ts->clat_percentiles);
 	p.ts.lat_percentiles	= cpu_to_le32(ts->lat_percentiles);
 	p.ts.slat_percentiles	= cpu_to_le32(ts->slat_percentiles);
+	p.ts.lat_hist_bits	= cpu_to_le32(ts->lat_hist_bits);
 	p.ts.percentile_precision = cpu_to_le64(ts->percentile_precision);
 
 	for (i = 0; i < FIO_IO_U_LIST_MAX_LEN; i++) {
@@ -1769,6 +2024,31 @@ void fio_server_send_ts(struct thread_stat *ts, struct group_run_stats *rs)
 	p.ts.total_submit	= cpu_to_le64(ts->total_submit);
 	p.ts.total_complete	= cpu_to_le64(ts->total_complete);
 	p.ts.nr_zone_resets	= cpu_to_le64(ts->nr_zone_resets);
+	p.ts.clock_batch_err	= cpu_to_le64(ts->clock_batch_err);
+
+	for (i = 0; i < FIO_CG_NR; i++)
+		p.ts.cgroup_io[i]	= cpu_to_le64(ts->cgroup_io[i]);
+	p.ts.cgroup_some_avg10.u.i = cpu_to_le64(fio_double_to_uint64(ts->cgroup_some_avg10.u.f));
+	p.ts.cgroup_full_avg10.u.i = cpu_to_le64(fio_double_to_uint64(ts->cgroup_full_avg10.u.f));
+	p.ts.cgroup_stats	= cpu_to_le32(ts->cgroup_stats);
+
+	p.ts.nr_lat_outliers	= cpu_to_le32(ts->nr_lat_outliers);
+	for (i = 0; i < ts->nr_lat_outliers; i++) {
+		struct lat_outlier *src = &ts->lat_outliers[i];
+		struct lat_outlier *dst = &p.ts.lat_outliers[i];
+
+		dst->lat_nsec		= cpu_to_le64(src->lat_nsec);
+		dst->offset		= cpu_to_le64(src->offset);
+		dst->bs			= cpu_to_le64(src->bs);
+		dst->issue_nsec		= cpu_to_le64(src->issue_nsec);
+		dst->complete_nsec	= cpu_to_le64(src->complete_nsec);
+		dst->ddir		= cpu_to_le32(src->ddir);
+		dst->depth		= cpu_to_le32(src->depth);
+		dst->prio		= cpu_to_le32(src->prio);
+		dst->zone		= __cpu_to_le32(src->zone);
+		dst->placement_id	= __cpu_to_le32(src->placement_id);
+		memcpy(dst->file, src->file, sizeof(dst->file));
+	}
 
 	for (i = 0; i < DDIR_RWDIR_CNT; i++) {
 		p.ts.io_bytes[i]	= cpu_to_le64(ts->io_bytes[i]);
@@ -1800,6 +2080,8 @@ void fio_server_send_ts(struct thread_stat *ts, struct group_run_stats *rs)
 	p.ts.ss_slope.u.i	= cpu_to_le64(fio_double_to_uint64(ts->ss_slope.u.f));
 	p.ts.ss_deviation.u.i	= cpu_to_le64(fio_double_to_uint64(ts->ss_deviation.u.f));
 	p.ts.ss_criterion.u.i	= cpu_to_le64(fio_double_to_uint64(ts->ss_criterion.u.f));
+	for (i = 0; i < DDIR_RWDIR_CNT; i++)
+		p.ts.ss_ddir_criterion[i].u.i = cpu_to_le64(fio_double_to_uint64(ts->ss_ddir_criterion[i].u.f));
 
 	p.ts.cachehit		= cpu_to_le64(ts->cachehit);
 	p.ts.cachemiss		= cpu_to_le64(ts->cachemiss);
@@ -1818,7 +2100,7 @@ void fio_server_send_ts(struct thread_stat *ts, struct group_run_stats *rs)
 
 	extended_buf_size += ss_extra_size;
 	if (!extended_buf_size) {
-		fio_net_queue_cmd(FIO_NET_CMD_TS, &p, sizeof(p), NULL, SK_F_COPY);
+		fio_net_queue_ts(&p, sizeof(p));
 		return;
 	}
 
@@ -1884,7 +2166,7 @@ void fio_server_send_ts(struct thread_stat *ts, struct group_run_stats *rs)
 		extended_buf_wp = ss_bw + (int) ts->ss_dur;
 	}
 
-	fio_net_queue_cmd(FIO_NET_CMD_TS, extended_buf, extended_buf_size, NULL, SK_F_COPY);
+	fio_net_queue_ts(extended_buf, extended_buf_size);
 	free(extended_buf);
 }
 
@@ -2146,7 +2428,11 @@ static int fio_append_iolog_gz(struct sk_entry *first, struct io_log *log)
 	};
 	int ret = 0;
 
-	if (deflateInit(&stream, Z_DEFAULT_COMPRESSION) != Z_OK)
+	/*
+	 * Logs are compressed at the end of the run while the client waits
+	 * for them, favour speed over ratio.
+	 */
+	if (deflateInit(&stream, Z_BEST_SPEED) != Z_OK)
 		return 1;
 
 	while (!flist_empty(&log->io_logs)) {
@@ -2257,7 +2543,10 @@ int fio_send_iolog(struct thread_data *td, struct io_log *log, const char *name)
 		.nr_samples		= cpu_to_le64(iolog_nr_samples(log)),
 		.thread_number		= cpu_to_le32(td->thread_number),
 		.log_type		= cpu_to_le32(log->log_type),
+		.log_offset		= cpu_to_le32(log->log_offset),
+		.log_prio		= cpu_to_le32(log->log_prio),
 		.log_hist_coarseness	= cpu_to_le32(log->hist_coarseness),
+		.log_binary		= cpu_to_le32(log->log_binary),
 	};
 	struct sk_entry *first;
 	struct flist_head *entry;
@@ -2351,11 +2640,12 @@ void fio_server_send_start(struct thread_data *td)
 int fio_server_get_verify_state(const char *name, int threadnumber,
 				void **datap)
 {
-	struct thread_io_list *s;
 	struct cmd_sendfile out;
 	struct cmd_reply *rep;
 	uint64_t tag;
 	void *data;
+	ssize_t off;
+	size_t size;
 	int ret;
 
 	dprint(FD_NET, "server: request verify state\n");
@@ -2395,11 +2685,11 @@ fail:
 	}
 
 	/*
-	 * The format is verify_state_hdr, then thread_io_list. Verify
-	 * the header, and the thread_io_list checksum
+	 * The format is one or more verify_state_hdr, thread_io_list
+	 * records. Find the last one with a valid header and checksum.
 	 */
-	s = rep->data + sizeof(struct verify_state_hdr);
-	if (verify_state_hdr(rep->data, s)) {
+	off = verify_state_scan(rep->data, rep->size, &size);
+	if (off == -1) {
 		ret = EILSEQ;
 		goto fail;
 	}
@@ -2408,9 +2698,8 @@ fail:
 	 * Don't need the header from now, copy just the thread_io_list
 	 */
 	ret = 0;
-	rep->size -= sizeof(struct verify_state_hdr);
-	data = malloc(rep->size);
-	memcpy(data, s, rep->size);
+	data = malloc(size);
+	memcpy(data, rep->data + off, size);
 	*datap = data;
 
 	sfree(rep->data);
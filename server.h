@@ -51,11 +51,14 @@ struct fio_net_cmd_reply {
 };
 
 enum {
-	FIO_SERVER_VER			= 99,
+	FIO_SERVER_VER			= 158,
 
 	FIO_SERVER_MAX_FRAGMENT_PDU	= 1024,
 	FIO_SERVER_MAX_CMD_MB		= 2048,
 
+	/* ETA run strings shorter than this are sent as is */
+	FIO_ETA_GZ_MIN			= 256,
+
 	FIO_NET_CMD_QUIT		= 1,
 	FIO_NET_CMD_EXIT		= 2,
 	FIO_NET_CMD_JOB			= 3,
@@ -78,7 +81,8 @@ enum {
 	FIO_NET_CMD_VTRIGGER		= 20,
 	FIO_NET_CMD_SENDFILE		= 21,
 	FIO_NET_CMD_JOB_OPT		= 22,
-	FIO_NET_CMD_NR			= 23,
+	FIO_NET_CMD_CLOCK		= 23,
+	FIO_NET_CMD_NR			= 24,
 
 	FIO_NET_CMD_F_MORE		= 1UL << 0,
 
@@ -171,6 +175,31 @@ struct cmd_end_pdu {
 	uint32_t signal;
 };
 
+/*
+ * NTP style clock probe. The client sends its CLOCK_REALTIME in t1, the
+ * server sends it back with its own time when it got the probe (t2) and
+ * when it replied (t3). All in nsec.
+ */
+struct cmd_clock_pdu {
+	uint64_t t1;
+	uint64_t t2;
+	uint64_t t3;
+};
+
+/*
+ * Optional RUN payload for --sync-start and --shard. start_at is the
+ * server's CLOCK_REALTIME to start jobs at, or 0 to start right away,
+ * clock_offset the server's clock minus the client's, both in nsec. The
+ * offset is signed, sent as its two's complement. With shard_count set,
+ * the server runs slice shard_index of shard_count of every job.
+ */
+struct cmd_run_pdu {
+	uint64_t start_at;
+	uint64_t clock_offset;
+	uint32_t shard_index;
+	uint32_t shard_count;
+};
+
 struct cmd_add_job_pdu {
 	uint32_t thread_number;
 	uint32_t groupid;
@@ -198,6 +227,8 @@ struct cmd_iolog_pdu {
 	uint32_t log_offset;
 	uint32_t log_prio;
 	uint32_t log_hist_coarseness;
+	uint32_t log_binary;
+	uint32_t pad;
 	uint8_t name[FIO_NET_NAME_MAX];
 	struct io_sample samples[0];
 };
@@ -229,6 +260,8 @@ extern int fio_server_get_verify_state(const char *, int, void **);
 extern bool fio_server_poll_fd(int fd, short events, int timeout);
 
 extern struct fio_net_cmd *fio_net_recv_cmd(int sk, bool wait);
+extern void *fio_net_zrle_encode(const void *, size_t, size_t *);
+extern void *fio_net_zrle_decode(const void *, size_t, size_t *);
 
 extern int fio_send_iolog(struct thread_data *, struct io_log *, const char *);
 extern void fio_server_send_add_job(struct thread_data *);
@@ -5,6 +5,7 @@
 #include <sys/mman.h>
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "fio.h"
 #include "fio_sem.h"
@@ -21,7 +22,22 @@
 #define INITIAL_SIZE	16*1024*1024	/* new pool size */
 #define INITIAL_POOLS	8		/* maximum number of pools to setup */
 
-#define MAX_POOLS	16
+/*
+ * Pools are added on demand when the existing ones are full, each one
+ * twice the size of the one before up to MAX_GROW_SHIFT doublings. That
+ * keeps the number of pools this can hold out of the way.
+ */
+#define MAX_POOLS	64
+#define MAX_GROW_SHIFT	6
+#define MAX_GROW_SIZE	((size_t) 1 << 30)
+
+/*
+ * Freed blocks of up to SMALLOC_CACHE_CLASSES blocks are kept on per
+ * process free lists, one per size in blocks, and are handed out again
+ * without taking the pool lock.
+ */
+#define SMALLOC_CACHE_CLASSES	8
+#define SMALLOC_CACHE_DEPTH	64
 
 #define SMALLOC_PRE_RED		0xdeadbeefU
 #define SMALLOC_POST_RED	0x5aa55aa5U
@@ -48,19 +64,59 @@ struct block_hdr {
 #endif
 };
 
+/* Shared by all processes, so pool slots are never handed out twice */
+struct pool_area {
+	unsigned int nr_slots;
+	struct pool pools[MAX_POOLS];
+};
+
+/* Lives in the first block of a cached free block, after the header */
+struct cache_entry {
+	struct cache_entry *next;
+};
+
+struct cache_class {
+	struct cache_entry *head;
+	unsigned int nr;
+};
+
 /*
  * This suppresses the voluminous potential bitmap printout when
  * smalloc encounters an OOM error
  */
 static const bool enable_smalloc_debug = false;
 
+static struct pool_area *pool_area;
 static struct pool *mp;
+
+/*
+ * Which pools are mapped in this process. Pools added after a fork are
+ * private to the process that added them and its children.
+ */
+static uint64_t pool_mask;
 static unsigned int nr_pools;
 static unsigned int last_pool;
+static unsigned int grow_shift;
+static pthread_mutex_t grow_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct cache_class cache[SMALLOC_CACHE_CLASSES];
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Set in forked job processes. Their smalloc objects get linked into
+ * structures other processes walk, so they can't add pools only they have
+ * mapped, and they don't cache frees nobody would give back once they exit.
+ */
+static bool job_process;
+
+static inline bool pool_mapped(unsigned int i)
+{
+	return (pool_mask & (1ULL << i)) != 0;
+}
 
 static inline int ptr_valid(struct pool *pool, void *ptr)
 {
-	unsigned int pool_size = pool->nr_blocks * SMALLOC_BPL;
+	size_t pool_size = pool->nr_blocks * SMALLOC_BPL;
 
 	return (ptr >= pool->map) && (ptr < pool->map + pool_size);
 }
@@ -150,14 +206,18 @@ static int find_next_zero(int word, int start)
 	return ffz(word) + start;
 }
 
-static bool add_pool(struct pool *pool, unsigned int alloc_size)
+static bool add_pool(size_t alloc_size)
 {
+	struct pool *pool;
+	unsigned int slot;
 	int bitmap_blocks;
 	int mmap_flags;
 	void *ptr;
 
-	if (nr_pools == MAX_POOLS)
+	slot = __sync_fetch_and_add(&pool_area->nr_slots, 1);
+	if (slot >= MAX_POOLS)
 		return false;
+	pool = &mp[slot];
 
 #ifdef SMALLOC_REDZONE
 	alloc_size += sizeof(unsigned int);
@@ -194,7 +254,11 @@ static bool add_pool(struct pool *pool, unsigned int alloc_size)
 	if (!pool->lock)
 		goto out_fail;
 
-	nr_pools++;
+	/* publish the pool only once it's set up */
+	write_barrier();
+	pool_mask |= 1ULL << slot;
+	if (slot >= nr_pools)
+		nr_pools = slot + 1;
 	return true;
 out_fail:
 	log_err("smalloc: failed adding pool\n");
@@ -203,6 +267,25 @@ out_fail:
 	return false;
 }
 
+/*
+ * A forked child starts out with a copy of the parent's cache lists. The
+ * parent may still hand those blocks out, so the child must forget them.
+ */
+static void cache_atfork_child(void)
+{
+	pthread_mutex_init(&cache_lock, NULL);
+	pthread_mutex_init(&grow_lock, NULL);
+	memset(cache, 0, sizeof(cache));
+}
+
+/*
+ * Called by a job process right after it's forked, see job_process
+ */
+void smalloc_job_process(void)
+{
+	job_process = true;
+}
+
 void sinit(void)
 {
 	bool ret;
@@ -213,17 +296,18 @@ void sinit(void)
 	 * set. But we want to allocate space for the struct pool
 	 * instances only once.
 	 */
-	if (!mp) {
-		mp = (struct pool *) mmap(NULL,
-			MAX_POOLS * sizeof(struct pool),
+	if (!pool_area) {
+		pool_area = mmap(NULL, sizeof(*pool_area),
 			PROT_READ | PROT_WRITE,
 			OS_MAP_ANON | MAP_SHARED, -1, 0);
 
-		assert(mp != MAP_FAILED);
+		assert(pool_area != MAP_FAILED);
+		mp = pool_area->pools;
+		pthread_atfork(NULL, NULL, cache_atfork_child);
 	}
 
 	for (i = 0; i < INITIAL_POOLS; i++) {
-		ret = add_pool(&mp[nr_pools], smalloc_pool_size);
+		ret = add_pool(smalloc_pool_size);
 		if (!ret)
 			break;
 	}
@@ -252,9 +336,15 @@ void scleanup(void)
 	unsigned int i;
 
 	for (i = 0; i < nr_pools; i++)
-		cleanup_pool(&mp[i]);
-
-	munmap(mp, MAX_POOLS * sizeof(struct pool));
+		if (pool_mapped(i))
+			cleanup_pool(&mp[i]);
+
+	munmap(pool_area, sizeof(*pool_area));
+	pool_area = NULL;
+	mp = NULL;
+	pool_mask = 0;
+	nr_pools = last_pool = grow_shift = 0;
+	memset(cache, 0, sizeof(cache));
 }
 
 #ifdef SMALLOC_REDZONE
@@ -303,22 +393,12 @@ static void sfree_check_redzone(struct block_hdr *hdr)
 }
 #endif
 
-static void sfree_pool(struct pool *pool, void *ptr)
+static void __sfree_pool(struct pool *pool, struct block_hdr *hdr)
 {
-	struct block_hdr *hdr;
+	void *ptr = hdr;
 	unsigned int i, idx;
 	unsigned long offset;
 
-	if (!ptr)
-		return;
-
-	ptr -= sizeof(*hdr);
-	hdr = ptr;
-
-	assert(ptr_valid(pool, ptr));
-
-	sfree_check_redzone(hdr);
-
 	offset = ptr - pool->map;
 	i = offset / SMALLOC_BPL;
 	idx = (offset % SMALLOC_BPL) / SMALLOC_BPB;
@@ -331,27 +411,104 @@ static void sfree_pool(struct pool *pool, void *ptr)
 	fio_sem_up(pool->lock);
 }
 
-void sfree(void *ptr)
+static struct pool *find_pool(void *ptr)
 {
-	struct pool *pool = NULL;
 	unsigned int i;
 
-	if (!ptr)
-		return;
+	for (i = 0; i < nr_pools; i++)
+		if (pool_mapped(i) && ptr_valid(&mp[i], ptr))
+			return &mp[i];
 
-	for (i = 0; i < nr_pools; i++) {
-		if (ptr_valid(&mp[i], ptr)) {
-			pool = &mp[i];
-			break;
+	return NULL;
+}
+
+static bool cache_put(struct block_hdr *hdr)
+{
+	size_t nr_blocks = size_to_blocks(hdr->size);
+	struct cache_class *c;
+	struct cache_entry *e;
+	bool ret = false;
+
+	if (job_process || nr_blocks > SMALLOC_CACHE_CLASSES)
+		return false;
+
+	c = &cache[nr_blocks - 1];
+	e = (struct cache_entry *) (hdr + 1);
+
+	pthread_mutex_lock(&cache_lock);
+	if (c->nr < SMALLOC_CACHE_DEPTH) {
+		e->next = c->head;
+		c->head = e;
+		c->nr++;
+		ret = true;
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	return ret;
+}
+
+static struct block_hdr *cache_get(size_t alloc_size)
+{
+	size_t nr_blocks = size_to_blocks(alloc_size);
+	struct cache_entry *e = NULL;
+	struct cache_class *c;
+
+	if (nr_blocks > SMALLOC_CACHE_CLASSES)
+		return NULL;
+
+	c = &cache[nr_blocks - 1];
+
+	pthread_mutex_lock(&cache_lock);
+	if (c->head) {
+		e = c->head;
+		c->head = e->next;
+		c->nr--;
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	return e ? (struct block_hdr *) e - 1 : NULL;
+}
+
+/* Give all cached blocks back to their pools */
+static void cache_flush(void)
+{
+	struct cache_entry *e, *next;
+	unsigned int i;
+
+	pthread_mutex_lock(&cache_lock);
+	for (i = 0; i < SMALLOC_CACHE_CLASSES; i++) {
+		for (e = cache[i].head; e; e = next) {
+			struct block_hdr *hdr = (struct block_hdr *) e - 1;
+
+			next = e->next;
+			__sfree_pool(find_pool(hdr), hdr);
 		}
+		cache[i].head = NULL;
+		cache[i].nr = 0;
 	}
+	pthread_mutex_unlock(&cache_lock);
+}
+
+void sfree(void *ptr)
+{
+	struct block_hdr *hdr;
+	struct pool *pool;
+
+	if (!ptr)
+		return;
 
-	if (pool) {
-		sfree_pool(pool, ptr);
+	pool = find_pool(ptr);
+	if (!pool) {
+		log_err("smalloc: ptr %p not from smalloc pool\n", ptr);
 		return;
 	}
 
-	log_err("smalloc: ptr %p not from smalloc pool\n", ptr);
+	hdr = ptr - sizeof(*hdr);
+	assert(ptr_valid(pool, hdr));
+	sfree_check_redzone(hdr);
+
+	if (!cache_put(hdr))
+		__sfree_pool(pool, hdr);
 }
 
 static unsigned int find_best_index(struct pool *pool)
@@ -450,7 +607,10 @@ static void *smalloc_pool(struct pool *pool, size_t size)
 	size_t alloc_size = size_to_alloc_size(size);
 	void *ptr;
 
-	ptr = __smalloc_pool(pool, alloc_size);
+	if (pool)
+		ptr = __smalloc_pool(pool, alloc_size);
+	else
+		ptr = cache_get(alloc_size);
 	if (ptr) {
 		struct block_hdr *hdr = ptr;
 
@@ -511,6 +671,8 @@ void smalloc_debug(size_t size)
 			(unsigned long) size, (unsigned long) alloc_size,
 			(unsigned long) alloc_blocks);
 	for (i = 0; i < nr_pools; i++) {
+		if (!pool_mapped(i))
+			continue;
 		log_err("smalloc: pool %u, free/total blocks %u/%u\n", i,
 			(unsigned int) (mp[i].free_blocks),
 			(unsigned int) (mp[i].nr_blocks*sizeof(unsigned int)*8));
@@ -530,20 +692,42 @@ void smalloc_debug(size_t size)
 	}
 }
 
-void *smalloc(size_t size)
+/*
+ * Bytes handed out and bytes in total, over the pools this process has
+ * mapped. Blocks on the free lists count as handed out.
+ */
+void smalloc_usage(uint64_t *used, uint64_t *size)
 {
-	unsigned int i, end_pool;
+	unsigned int i;
 
-	if (size != (unsigned int) size)
-		return NULL;
+	*used = *size = 0;
+	for (i = 0; i < nr_pools; i++) {
+		struct pool *pool = &mp[i];
+
+		if (!pool_mapped(i))
+			continue;
+
+		*size += (uint64_t) pool->nr_blocks * SMALLOC_BPL;
+		*used += (uint64_t) (pool->nr_blocks * SMALLOC_BPI -
+				     pool->free_blocks) * SMALLOC_BPB;
+	}
+}
+
+static void *__smalloc(size_t size)
+{
+	unsigned int i, end_pool;
 
 	i = last_pool;
 	end_pool = nr_pools;
 
 	do {
 		for (; i < end_pool; i++) {
-			void *ptr = smalloc_pool(&mp[i], size);
+			void *ptr;
 
+			if (!pool_mapped(i))
+				continue;
+
+			ptr = smalloc_pool(&mp[i], size);
 			if (ptr) {
 				last_pool = i;
 				return ptr;
@@ -558,6 +742,62 @@ void *smalloc(size_t size)
 		break;
 	} while (1);
 
+	return NULL;
+}
+
+/*
+ * Add a pool big enough for size, unless another thread beat us to it.
+ * Memory from it is only shared with processes forked after this, so job
+ * processes never grow the pools.
+ */
+static bool grow_pools(size_t size, uint64_t seen_mask)
+{
+	bool ret = true;
+
+	if (job_process)
+		return false;
+
+	pthread_mutex_lock(&grow_lock);
+	if (pool_mask == seen_mask) {
+		size_t pool_size = (size_t) smalloc_pool_size << grow_shift;
+
+		pool_size = max(min(pool_size, MAX_GROW_SIZE),
+				(size_t) smalloc_pool_size);
+
+		ret = add_pool(max(size_to_alloc_size(size), pool_size));
+		if (ret && grow_shift < MAX_GROW_SHIFT)
+			grow_shift++;
+	}
+	pthread_mutex_unlock(&grow_lock);
+
+	return ret;
+}
+
+void *smalloc(size_t size)
+{
+	uint64_t seen_mask;
+	void *ptr;
+
+	if (size != (unsigned int) size)
+		return NULL;
+
+	ptr = smalloc_pool(NULL, size);
+	if (ptr)
+		return ptr;
+
+	do {
+		seen_mask = pool_mask;
+		ptr = __smalloc(size);
+		if (ptr)
+			return ptr;
+
+		/* cached blocks may be what keeps a large one from fitting */
+		cache_flush();
+		ptr = __smalloc(size);
+		if (ptr)
+			return ptr;
+	} while (grow_pools(size, seen_mask));
+
 	log_err("smalloc: OOM. Consider using --alloc-size to increase the "
 		"shared memory available.\n");
 	smalloc_debug(size);
@@ -2,6 +2,7 @@
 #define FIO_SMALLOC_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 extern void *smalloc(size_t);
 extern void *scalloc(size_t, size_t);
@@ -10,6 +11,8 @@ extern char *smalloc_strdup(const char *);
 extern void sinit(void);
 extern void scleanup(void);
 extern void smalloc_debug(size_t);
+extern void smalloc_usage(uint64_t *, uint64_t *);
+extern void smalloc_job_process(void);
 
 extern unsigned int smalloc_pool_size;
 
@@ -9,8 +9,16 @@
 #include "diskutil.h"
 #include "lib/ieee754.h"
 #include "json.h"
+#include "lib/columnar.h"
 #include "lib/getrusage.h"
 #include "idletime.h"
+#include "perfcnt.h"
+#include "overhead.h"
+#include "outlier.h"
+#include "latmap.h"
+#include "filestat.h"
+#include "cpuloc.h"
+#include "sweep.h"
 #include "lib/pow2.h"
 #include "lib/output_buffer.h"
 #include "helper_thread.h"
@@ -34,6 +42,8 @@ void clear_rusage_stat(struct thread_data *td)
 	ts->usr_time = ts->sys_time = 0;
 	ts->ctx = 0;
 	ts->minf = ts->majf = 0;
+	perfcnt_clear(td);
+	overhead_clear(td);
 }
 
 void update_rusage_stat(struct thread_data *td)
@@ -51,6 +61,9 @@ void update_rusage_stat(struct thread_data *td)
 	ts->majf += td->ru_end.ru_majflt - td->ru_start.ru_majflt;
 
 	memcpy(&td->ru_start, &td->ru_end, sizeof(td->ru_end));
+
+	perfcnt_update(td);
+	overhead_update(td);
 }
 
 /*
@@ -62,7 +75,7 @@ void update_rusage_stat(struct thread_data *td)
  * group by looking at the index bits.
  *
  */
-static unsigned int plat_val_to_idx(unsigned long long val)
+unsigned int plat_val_to_idx(unsigned long long val)
 {
 	unsigned int msb, error_bits, base, offset, idx;
 
@@ -143,10 +156,10 @@ unsigned int calc_clat_percentiles(uint64_t *io_u_plat, unsigned long long nr,
 				   fio_fp64_t *plist, unsigned long long **output,
 				   unsigned long long *maxv, unsigned long long *minv)
 {
+	unsigned long long thresh[FIO_IO_U_LIST_MAX_LEN];
 	unsigned long long sum = 0;
 	unsigned int len, i, j = 0;
 	unsigned long long *ovals = NULL;
-	bool is_last;
 
 	*minv = -1ULL;
 	*maxv = 0;
@@ -159,11 +172,14 @@ unsigned int calc_clat_percentiles(uint64_t *io_u_plat, unsigned long long nr,
 		return 0;
 
 	/*
-	 * Sort the percentile list. Note that it may already be sorted if
-	 * we are using the default values, but since it's a short list this
-	 * isn't a worry. Also note that this does not work for NaN values.
+	 * Sort the percentile list, unless it's already in order as it is
+	 * for the default values. Note that this does not work for NaN
+	 * values.
 	 */
-	if (len > 1)
+	for (i = 1; i < len; i++)
+		if (plist[i].u.f < plist[i - 1].u.f)
+			break;
+	if (i < len)
 		qsort(plist, len, sizeof(plist[0]), double_cmp);
 
 	ovals = malloc(len * sizeof(*ovals));
@@ -171,29 +187,37 @@ unsigned int calc_clat_percentiles(uint64_t *io_u_plat, unsigned long long nr,
 		return 0;
 
 	/*
-	 * Calculate bucket values, note down max and min values
+	 * The sample count each percentile is reached at, rounded up since
+	 * the sum is integral, so the bucket walk below is just integer adds
+	 * and compares.
 	 */
-	is_last = false;
-	for (i = 0; i < FIO_IO_U_PLAT_NR && !is_last; i++) {
-		sum += io_u_plat[i];
-		while (sum >= ((long double) plist[j].u.f / 100.0 * nr)) {
-			assert(plist[j].u.f <= 100.0);
+	for (i = 0; i < len; i++) {
+		long double t;
+
+		assert(plist[i].u.f <= 100.0);
+		t = (long double) plist[i].u.f / 100.0 * nr;
+		thresh[i] = t;
+		if (thresh[i] < t)
+			thresh[i]++;
+	}
 
+	/*
+	 * Calculate bucket values, note down max and min values. All
+	 * percentiles are answered in one pass over the cumulative sum.
+	 */
+	for (i = 0; i < FIO_IO_U_PLAT_NR && j < len; i++) {
+		sum += io_u_plat[i];
+		while (j < len && sum >= thresh[j]) {
 			ovals[j] = plat_idx_to_val(i);
 			if (ovals[j] < *minv)
 				*minv = ovals[j];
 			if (ovals[j] > *maxv)
 				*maxv = ovals[j];
-
-			is_last = (j == len - 1) != 0;
-			if (is_last)
-				break;
-
 			j++;
 		}
 	}
 
-	if (!is_last)
+	if (j < len)
 		log_err("fio: error calculating latency percentiles\n");
 
 	*output = ovals;
@@ -496,6 +520,7 @@ static struct thread_stat *gen_mixed_ddir_stats_from_ts(struct thread_stat *ts)
 	ts_lcl->lat_percentiles = ts->lat_percentiles;
 	ts_lcl->clat_percentiles = ts->clat_percentiles;
 	ts_lcl->slat_percentiles = ts->slat_percentiles;
+	ts_lcl->lat_hist_bits = ts->lat_hist_bits;
 	ts_lcl->percentile_precision = ts->percentile_precision;
 	memcpy(ts_lcl->percentile_list, ts->percentile_list, sizeof(ts->percentile_list));
 
@@ -586,6 +611,14 @@ static void show_ddir_status(struct group_run_stats *rs, struct thread_stat *ts,
 		display_lat("clat", min, max, mean, dev, out);
 	if (calc_lat(&ts->lat_stat[ddir], &min, &max, &mean, &dev))
 		display_lat(" lat", min, max, mean, dev, out);
+	if (ddir == DDIR_TRIM &&
+	    calc_lat(&ts->trim_range_stat, &min, &max, &mean, &dev)) {
+		log_buf(out, "    ranges: total=%llu, per trim=%.2f\n",
+			(unsigned long long) ts->trim_range_stat.samples,
+			(double) ts->trim_range_stat.samples /
+				ts->total_io_u[DDIR_TRIM]);
+		display_lat("range clat", min, max, mean, dev, out);
+	}
 
 	/* Only print per prio stats if there are >= 2 prios with samples */
 	if (get_nr_prios_with_samples(ts, ddir) >= 2) {
@@ -921,6 +954,83 @@ static void show_block_infos(int nr_block_infos, uint32_t *block_infos,
 			 i == BLOCK_STATE_COUNT - 1 ? '\n' : ',');
 }
 
+static void show_perf_counters(struct thread_stat *ts, struct buf_output *out)
+{
+	uint64_t ios = ddir_rw_sum(ts->total_io_u);
+	uint64_t cycles = ts->perf_count[FIO_PERF_CYCLES];
+	uint64_t insns = ts->perf_count[FIO_PERF_INSTRUCTIONS];
+
+	if (!cycles || !ios)
+		return;
+
+	log_buf(out, "  perf         : cycles/IO=%llu, instructions/IO=%llu,"
+		" cache misses/IO=%.2f, IPC=%.2f\n",
+			(unsigned long long) (cycles / ios),
+			(unsigned long long) (insns / ios),
+			(double) ts->perf_count[FIO_PERF_CACHE_MISSES] / ios,
+			(double) insns / cycles);
+}
+
+static const char *overhead_names[FIO_OVH_NR] = {
+	[FIO_OVH_GET]		= "get",
+	[FIO_OVH_SUBMIT]	= "submit",
+	[FIO_OVH_COMPLETE]	= "complete",
+	[FIO_OVH_STATS]		= "stats",
+	[FIO_OVH_LOG]		= "log",
+	[FIO_OVH_OTHER]		= "other",
+};
+
+static uint64_t overhead_total(struct thread_stat *ts)
+{
+	uint64_t total = 0;
+	int i;
+
+	for (i = 0; i < FIO_OVH_NR; i++)
+		total += ts->overhead_nsec[i];
+
+	return total;
+}
+
+static void show_overhead(struct thread_stat *ts, struct buf_output *out)
+{
+	uint64_t ios = ddir_rw_sum(ts->total_io_u);
+	uint64_t total = overhead_total(ts);
+	int i;
+
+	if (!total || !ios)
+		return;
+
+	log_buf(out, "  overhead     : nsec/IO=%llu (",
+			(unsigned long long) (total / ios));
+	for (i = 0; i < FIO_OVH_NR; i++)
+		log_buf(out, "%s%s=%llu", i ? ", " : "", overhead_names[i],
+			(unsigned long long) (ts->overhead_nsec[i] / ios));
+	log_buf(out, ")\n");
+}
+
+static void show_data_reduction(struct thread_stat *ts,
+				struct buf_output *out)
+{
+	if (!ts->dr_samples && !ts->dr_fps)
+		return;
+
+	log_buf(out, "  data reduce  : compress=");
+	if (ts->dr_bytes)
+		log_buf(out, "%3.2f%%", 100.0 - 100.0 * ts->dr_zbytes /
+						ts->dr_bytes);
+	else
+		log_buf(out, "n/a");
+	log_buf(out, " (%llu samples), dedupe=",
+		(unsigned long long) ts->dr_samples);
+	if (ts->dr_fps)
+		log_buf(out, "%3.2f%%", 100.0 * ts->dr_dups / ts->dr_fps);
+	else
+		log_buf(out, "n/a");
+	log_buf(out, " (%llu samples), dropped=%llu\n",
+		(unsigned long long) ts->dr_fps,
+		(unsigned long long) ts->dr_dropped);
+}
+
 static void show_ss_normal(struct thread_stat *ts, struct buf_output *out)
 {
 	char *p1, *p1alt, *p2;
@@ -940,11 +1050,26 @@ static void show_ss_normal(struct thread_stat *ts, struct buf_output *out)
 	log_buf(out, "  steadystate  : attained=%s, bw=%s (%s), iops=%s, %s%s=%.3f%s\n",
 		ts->ss_state & FIO_SS_ATTAINED ? "yes" : "no",
 		p1, p1alt, p2,
-		ts->ss_state & FIO_SS_IOPS ? "iops" : "bw",
+		steadystate_name(ts->ss_state),
 		ts->ss_state & FIO_SS_SLOPE ? " slope": " mean dev",
 		ts->ss_criterion.u.f,
 		ts->ss_state & FIO_SS_PCT ? "%" : "");
 
+	if (ts->ss_state & FIO_SS_DDIR) {
+		int ddir, n = 0;
+
+		log_buf(out, "                ");
+		for (ddir = 0; ddir < DDIR_RWDIR_CNT; ddir++) {
+			if (!ts->io_bytes[ddir])
+				continue;
+			log_buf(out, "%s %s=%.3f%s", n++ ? "," : "",
+				io_ddir_name(ddir),
+				ts->ss_ddir_criterion[ddir].u.f,
+				ts->ss_state & FIO_SS_PCT ? "%" : "");
+		}
+		log_buf(out, "\n");
+	}
+
 	free(p1);
 	free(p1alt);
 	free(p2);
@@ -1223,6 +1348,12 @@ static void show_thread_status_normal(struct thread_stat *ts,
 			(unsigned long long) ts->majf,
 			(unsigned long long) ts->minf);
 
+	show_perf_counters(ts, out);
+	show_overhead(ts, out);
+	show_data_reduction(ts, out);
+	cpu_locality_show(ts, out);
+	mem_acct_show(ts, out);
+
 	stat_calc_dist(ts->io_u_map, ddir_rw_sum(ts->total_io_u), io_u_dist);
 	log_buf(out, "  IO depths    : 1=%3.1f%%, 2=%3.1f%%, 4=%3.1f%%, 8=%3.1f%%,"
 		 " 16=%3.1f%%, 32=%3.1f%%, >=64=%3.1f%%\n", io_u_dist[0],
@@ -1268,6 +1399,10 @@ static void show_thread_status_normal(struct thread_stat *ts,
 					ts->latency_percentile.u.f,
 					ts->latency_depth);
 	}
+	if (ts->clock_batch_err) {
+		log_buf(out, "     clock batch: max error=%llu nsec\n",
+					(unsigned long long)ts->clock_batch_err);
+	}
 
 	if (ts->nr_block_infos)
 		show_block_infos(ts->nr_block_infos, ts->block_infos,
@@ -1680,6 +1815,38 @@ static void json_add_job_opts(struct json_object *root, const char *name,
 	}
 }
 
+static void add_cgroup_json(struct thread_stat *ts, struct json_object *root)
+{
+	struct json_object *cg, *io, *psi, *tmp;
+
+	cg = json_create_object();
+	json_object_add_value_object(root, "cgroup", cg);
+
+	io = json_create_object();
+	json_object_add_value_object(cg, "io_stat", io);
+	json_object_add_value_int(io, "rbytes", ts->cgroup_io[FIO_CG_RBYTES]);
+	json_object_add_value_int(io, "wbytes", ts->cgroup_io[FIO_CG_WBYTES]);
+	json_object_add_value_int(io, "rios", ts->cgroup_io[FIO_CG_RIOS]);
+	json_object_add_value_int(io, "wios", ts->cgroup_io[FIO_CG_WIOS]);
+	json_object_add_value_int(io, "dbytes", ts->cgroup_io[FIO_CG_DBYTES]);
+	json_object_add_value_int(io, "dios", ts->cgroup_io[FIO_CG_DIOS]);
+
+	psi = json_create_object();
+	json_object_add_value_object(cg, "io_pressure", psi);
+	tmp = json_create_object();
+	json_object_add_value_object(psi, "some", tmp);
+	json_object_add_value_int(tmp, "total_usec",
+				  ts->cgroup_io[FIO_CG_SOME_USEC]);
+	json_object_add_value_float(tmp, "avg10_max",
+				    ts->cgroup_some_avg10.u.f);
+	tmp = json_create_object();
+	json_object_add_value_object(psi, "full", tmp);
+	json_object_add_value_int(tmp, "total_usec",
+				  ts->cgroup_io[FIO_CG_FULL_USEC]);
+	json_object_add_value_float(tmp, "avg10_max",
+				    ts->cgroup_full_avg10.u.f);
+}
+
 static struct json_object *show_thread_status_json(struct thread_stat *ts,
 						   struct group_run_stats *rs,
 						   struct flist_head *opt_list)
@@ -1735,6 +1902,57 @@ static struct json_object *show_thread_status_json(struct thread_stat *ts,
 	json_object_add_value_int(root, "majf", ts->majf);
 	json_object_add_value_int(root, "minf", ts->minf);
 
+	if (ts->perf_count[FIO_PERF_CYCLES]) {
+		uint64_t ios = ddir_rw_sum(ts->total_io_u);
+
+		tmp = json_create_object();
+		json_object_add_value_object(root, "perf", tmp);
+		json_object_add_value_int(tmp, "cycles", ts->perf_count[FIO_PERF_CYCLES]);
+		json_object_add_value_int(tmp, "instructions", ts->perf_count[FIO_PERF_INSTRUCTIONS]);
+		json_object_add_value_int(tmp, "cache_misses", ts->perf_count[FIO_PERF_CACHE_MISSES]);
+		json_object_add_value_int(tmp, "cycles_per_io",
+				ios ? ts->perf_count[FIO_PERF_CYCLES] / ios : 0);
+		json_object_add_value_int(tmp, "instructions_per_io",
+				ios ? ts->perf_count[FIO_PERF_INSTRUCTIONS] / ios : 0);
+		json_object_add_value_float(tmp, "cache_misses_per_io",
+				ios ? (double) ts->perf_count[FIO_PERF_CACHE_MISSES] / ios : 0.0);
+	}
+
+	if (overhead_total(ts)) {
+		uint64_t ios = ddir_rw_sum(ts->total_io_u);
+		struct json_object *per_io;
+		int i;
+
+		tmp = json_create_object();
+		json_object_add_value_object(root, "overhead", tmp);
+		json_object_add_value_int(tmp, "ios", ios);
+		json_object_add_value_int(tmp, "total_ns", overhead_total(ts));
+		per_io = json_create_object();
+		json_object_add_value_object(tmp, "ns_per_io", per_io);
+		json_object_add_value_float(per_io, "total",
+				ios ? (double) overhead_total(ts) / ios : 0.0);
+		for (i = 0; i < FIO_OVH_NR; i++)
+			json_object_add_value_float(per_io, overhead_names[i],
+				ios ? (double) ts->overhead_nsec[i] / ios : 0.0);
+	}
+
+	if (ts->dr_samples || ts->dr_fps) {
+		tmp = json_create_object();
+		json_object_add_value_object(root, "data_reduction", tmp);
+		json_object_add_value_int(tmp, "compress_samples",
+					  ts->dr_samples);
+		json_object_add_value_int(tmp, "bytes", ts->dr_bytes);
+		json_object_add_value_int(tmp, "compressed_bytes",
+					  ts->dr_zbytes);
+		json_object_add_value_int(tmp, "dedupe_samples", ts->dr_fps);
+		json_object_add_value_int(tmp, "dups", ts->dr_dups);
+		json_object_add_value_int(tmp, "dropped", ts->dr_dropped);
+		json_object_add_value_float(tmp, "compress_pct", ts->dr_bytes ?
+			100.0 - 100.0 * ts->dr_zbytes / ts->dr_bytes : 0.0);
+		json_object_add_value_float(tmp, "dedupe_pct", ts->dr_fps ?
+			100.0 * ts->dr_dups / ts->dr_fps : 0.0);
+	}
+
 	/* Calc % distribution of IO depths */
 	stat_calc_dist(ts->io_u_map, ddir_rw_sum(ts->total_io_u), io_u_dist);
 	tmp = json_create_object();
@@ -1826,6 +2044,26 @@ static struct json_object *show_thread_status_json(struct thread_stat *ts,
 		json_object_add_value_int(root, "latency_window", ts->latency_window);
 	}
 
+	if (ts->clock_batch_err)
+		json_object_add_value_int(root, "clock_batch_err", ts->clock_batch_err);
+
+	if (ts->trim_range_stat.samples) {
+		tmp = add_ddir_lat_json(ts, 0, &ts->trim_range_stat, NULL);
+		json_object_add_value_object(root, "trim_range_clat_ns", tmp);
+	}
+
+	if (ts->cgroup_stats)
+		add_cgroup_json(ts, root);
+
+	if (ts->nr_lat_outliers)
+		json_object_add_value_array(root, "lat_outliers",
+			lat_outliers_json(ts->lat_outliers,
+					  ts->nr_lat_outliers));
+
+	file_stats_json(root, ts);
+	mem_acct_json(root, ts);
+	cpu_locality_json(root, ts);
+
 	/* Additional output if description is set */
 	if (strlen(ts->description))
 		json_object_add_value_string(root, "desc", ts->description);
@@ -1877,7 +2115,7 @@ static struct json_object *show_thread_status_json(struct thread_stat *ts,
 		int intervals = ts->ss_dur / (ss_check_interval / 1000L);
 
 		snprintf(ss_buf, sizeof(ss_buf), "%s%s:%f%s",
-			ts->ss_state & FIO_SS_IOPS ? "iops" : "bw",
+			steadystate_name(ts->ss_state),
 			ts->ss_state & FIO_SS_SLOPE ? "_slope" : "",
 			(float) ts->ss_limit.u.f,
 			ts->ss_state & FIO_SS_PCT ? "%" : "");
@@ -1894,6 +2132,21 @@ static struct json_object *show_thread_status_json(struct thread_stat *ts,
 		json_object_add_value_float(tmp, "max_deviation", ts->ss_deviation.u.f);
 		json_object_add_value_float(tmp, "slope", ts->ss_slope.u.f);
 
+		if (ts->ss_state & FIO_SS_DDIR) {
+			struct json_object *ddirs = json_create_object();
+
+			json_object_add_value_object(tmp, "ddir_criterion", ddirs);
+			for (j = 0; j < DDIR_RWDIR_CNT; j++) {
+				if (!ts->io_bytes[j])
+					continue;
+				snprintf(ss_buf, sizeof(ss_buf), "%f%s",
+					(float) ts->ss_ddir_criterion[j].u.f,
+					ts->ss_state & FIO_SS_PCT ? "%" : "");
+				json_object_add_value_string(ddirs,
+						io_ddir_name(j), ss_buf);
+			}
+		}
+
 		data = json_create_object();
 		json_object_add_value_object(tmp, "data", data);
 		bw = json_create_array();
@@ -1933,6 +2186,238 @@ static void show_thread_status_terse(struct thread_stat *ts,
 		log_err("fio: bad terse version!? %d\n", terse_version);
 }
 
+/*
+ * Stream the JSON output one job at a time, so only a single job's
+ * json_object tree is ever allocated, and the text goes out through a
+ * fixed size buffer instead of growing one big output buffer.
+ */
+static void show_run_stats_json(struct json_object *root,
+				struct thread_stat *threadstats, int nr_ts,
+				struct group_run_stats *runstats,
+				struct flist_head **opt_lists,
+				struct buf_output *output)
+{
+	struct buf_output *terse = &output[__FIO_OUTPUT_TERSE];
+	struct json_stream *js;
+	struct json_object *tmp;
+	int i;
+
+	js = malloc(sizeof(*js));
+	if (!js) {
+		log_err("fio: failed to allocate JSON output buffer\n");
+		json_free_object(root);
+		return;
+	}
+
+	/* terse output was always printed before the JSON */
+	log_info_buf(terse->buf, terse->buflen);
+	buf_output_free(terse);
+
+	json_stream_init(js, NULL);
+	json_stream_object_start(js, NULL);
+	json_stream_add_pairs(js, root);
+	json_free_object(root);
+
+	json_stream_array_start(js, "jobs");
+	for (i = 0; i < nr_ts; i++) {
+		struct thread_stat *ts = &threadstats[i];
+
+		tmp = show_thread_status_json(ts, &runstats[ts->groupid],
+						opt_lists[i]);
+		json_stream_add_object(js, NULL, tmp);
+		json_free_object(tmp);
+	}
+	json_stream_array_end(js);
+
+	/* disk util stats, if any */
+	tmp = json_create_object();
+	show_disk_util(1, tmp, &output[__FIO_OUTPUT_JSON]);
+	show_idle_prof_stats(FIO_OUTPUT_JSON, tmp, &output[__FIO_OUTPUT_JSON]);
+	sweep_json(tmp, threadstats, nr_ts);
+	json_stream_add_pairs(js, tmp);
+	json_free_object(tmp);
+
+	json_stream_object_end(js);
+	json_stream_finish(js);
+	free(js);
+}
+
+static const char *lat_names[FIO_LAT_CNT] = {
+	[FIO_SLAT]	= "slat",
+	[FIO_CLAT]	= "clat",
+	[FIO_LAT]	= "lat",
+};
+
+static void add_ddir_columns(struct col_batch *b, struct thread_stat *ts,
+			     int nr_ts, enum fio_ddir ddir, uint64_t *u,
+			     double *f)
+{
+	const char *dname = io_ddir_name(ddir);
+	unsigned long long min, max;
+	double mean, dev;
+	char name[64];
+	int i;
+
+#define DDIR_COL(suffix)	\
+	(snprintf(name, sizeof(name), "%s_%s", dname, suffix), name)
+
+	for (i = 0; i < nr_ts; i++)
+		u[i] = ts[i].io_bytes[ddir];
+	col_add_u64(b, DDIR_COL("io_bytes"), COL_ENC_VARINT, u);
+	for (i = 0; i < nr_ts; i++)
+		u[i] = ts[i].total_io_u[ddir];
+	col_add_u64(b, DDIR_COL("ios"), COL_ENC_VARINT, u);
+	for (i = 0; i < nr_ts; i++)
+		u[i] = ts[i].runtime[ddir];
+	col_add_u64(b, DDIR_COL("runtime_ms"), COL_ENC_VARINT, u);
+
+	for (i = 0; i < nr_ts; i++) {
+		if (!calc_lat(&ts[i].clat_stat[ddir], &min, &max, &mean, &dev))
+			min = max = 0;
+		u[i] = min;
+	}
+	col_add_u64(b, DDIR_COL("clat_min_ns"), COL_ENC_VARINT, u);
+	for (i = 0; i < nr_ts; i++) {
+		if (!calc_lat(&ts[i].clat_stat[ddir], &min, &max, &mean, &dev))
+			max = 0;
+		u[i] = max;
+	}
+	col_add_u64(b, DDIR_COL("clat_max_ns"), COL_ENC_VARINT, u);
+	for (i = 0; i < nr_ts; i++) {
+		if (!calc_lat(&ts[i].clat_stat[ddir], &min, &max, &mean, &dev))
+			mean = 0.0;
+		f[i] = mean;
+	}
+	col_add_f64(b, DDIR_COL("clat_mean_ns"), f);
+	for (i = 0; i < nr_ts; i++) {
+		if (!calc_lat(&ts[i].clat_stat[ddir], &min, &max, &mean, &dev))
+			dev = 0.0;
+		f[i] = dev;
+	}
+	col_add_f64(b, DDIR_COL("clat_stddev_ns"), f);
+	for (i = 0; i < nr_ts; i++) {
+		if (!calc_lat(&ts[i].lat_stat[ddir], &min, &max, &mean, &dev))
+			mean = 0.0;
+		f[i] = mean;
+	}
+	col_add_f64(b, DDIR_COL("lat_mean_ns"), f);
+
+#undef DDIR_COL
+}
+
+/*
+ * --output-format=columnar: a "run" table with one row, a "jobs" table
+ * with a row per job, and the non-zero latency histogram buckets of all
+ * jobs in a "hist" table. Job names are dictionary encoded, bucket
+ * indexes and values delta encoded.
+ */
+static void show_run_stats_columnar(struct thread_stat *ts, int nr_ts,
+				    struct buf_output *out)
+{
+	uint64_t *u, *job, *ddir, *bucket, *val, *count;
+	const char **str, **type;
+	uint64_t nr_hist = 0, n = 0;
+	struct col_batch *b;
+	struct timeval now;
+	double *f;
+	int i, j, k, l;
+
+	u = calloc(nr_ts + 1, sizeof(*u));
+	f = calloc(nr_ts + 1, sizeof(*f));
+	str = calloc(nr_ts + 1, sizeof(*str));
+	if (!u || !f || !str)
+		goto err;
+
+	col_file_header(out);
+
+	gettimeofday(&now, NULL);
+	b = col_batch_new("run", 1);
+	if (!b)
+		goto err;
+	str[0] = fio_version_string;
+	col_add_str(b, "fio_version", str);
+	u[0] = (uint64_t) now.tv_sec * 1000 + now.tv_usec / 1000;
+	col_add_u64(b, "timestamp_ms", COL_ENC_VARINT, u);
+	col_batch_write(b, out);
+	col_batch_free(b);
+
+	b = col_batch_new("jobs", nr_ts);
+	if (!b)
+		goto err;
+	for (i = 0; i < nr_ts; i++)
+		str[i] = ts[i].name;
+	col_add_str(b, "jobname", str);
+	for (i = 0; i < nr_ts; i++)
+		u[i] = ts[i].groupid;
+	col_add_u64(b, "groupid", COL_ENC_DELTA, u);
+	for (i = 0; i < nr_ts; i++)
+		u[i] = ts[i].error;
+	col_add_u64(b, "error", COL_ENC_VARINT, u);
+	for (i = 0; i < DDIR_RWDIR_CNT; i++)
+		add_ddir_columns(b, ts, nr_ts, i, u, f);
+	col_batch_write(b, out);
+	col_batch_free(b);
+
+	for (i = 0; i < nr_ts; i++)
+		for (j = 0; j < FIO_LAT_CNT; j++)
+			for (k = 0; k < DDIR_RWDIR_CNT; k++)
+				for (l = 0; l < FIO_IO_U_PLAT_NR; l++)
+					nr_hist += ts[i].io_u_plat[j][k][l] != 0;
+
+	job = calloc(5 * nr_hist + 1, sizeof(uint64_t));
+	type = calloc(nr_hist + 1, sizeof(*type));
+	b = col_batch_new("hist", nr_hist);
+	if (!job || !type || !b) {
+		free(job);
+		free(type);
+		if (b)
+			col_batch_free(b);
+		goto err;
+	}
+	ddir = job + nr_hist;
+	bucket = ddir + nr_hist;
+	val = bucket + nr_hist;
+	count = val + nr_hist;
+
+	for (i = 0; i < nr_ts; i++) {
+		for (j = 0; j < FIO_LAT_CNT; j++) {
+			for (k = 0; k < DDIR_RWDIR_CNT; k++) {
+				uint64_t *plat = ts[i].io_u_plat[j][k];
+
+				for (l = 0; l < FIO_IO_U_PLAT_NR; l++) {
+					if (!plat[l])
+						continue;
+					job[n] = i;
+					type[n] = lat_names[j];
+					ddir[n] = k;
+					bucket[n] = l;
+					val[n] = plat_idx_to_val(l);
+					count[n] = plat[l];
+					n++;
+				}
+			}
+		}
+	}
+
+	col_add_u64(b, "job", COL_ENC_DELTA, job);
+	col_add_str(b, "type", type);
+	col_add_u64(b, "ddir", COL_ENC_VARINT, ddir);
+	col_add_u64(b, "bucket", COL_ENC_DELTA, bucket);
+	col_add_u64(b, "value_ns", COL_ENC_DELTA, val);
+	col_add_u64(b, "count", COL_ENC_VARINT, count);
+	col_batch_write(b, out);
+	col_batch_free(b);
+	free(type);
+	free(job);
+	goto out;
+err:
+	log_err("fio: failed to allocate columnar output\n");
+out:
+	free(str);
+	free(f);
+	free(u);
+}
+
 struct json_object *show_thread_status(struct thread_stat *ts,
 				       struct group_run_stats *rs,
 				       struct flist_head *opt_list,
@@ -2287,9 +2772,40 @@ void sum_thread_stats(struct thread_stat *dst, struct thread_stat *src)
 	}
 
 	sum_stat(&dst->sync_stat, &src->sync_stat, false);
+	sum_stat(&dst->trim_range_stat, &src->trim_range_stat, false);
+
+	if (src->nr_lat_outliers) {
+		unsigned int nr = max(dst->nr_lat_outliers,
+				      src->nr_lat_outliers);
+
+		for (k = 0; k < src->nr_lat_outliers; k++)
+			lat_outlier_heap_add(dst->lat_outliers,
+					     &dst->nr_lat_outliers, nr,
+					     &src->lat_outliers[k]);
+	}
+
+	if (src->cgroup_stats) {
+		for (k = 0; k < FIO_CG_NR; k++)
+			dst->cgroup_io[k] += src->cgroup_io[k];
+		if (src->cgroup_some_avg10.u.f > dst->cgroup_some_avg10.u.f)
+			dst->cgroup_some_avg10.u.f = src->cgroup_some_avg10.u.f;
+		if (src->cgroup_full_avg10.u.f > dst->cgroup_full_avg10.u.f)
+			dst->cgroup_full_avg10.u.f = src->cgroup_full_avg10.u.f;
+		dst->cgroup_stats = 1;
+	}
 	dst->usr_time += src->usr_time;
 	dst->sys_time += src->sys_time;
 	dst->ctx += src->ctx;
+	for (k = 0; k < FIO_PERF_NR; k++)
+		dst->perf_count[k] += src->perf_count[k];
+	for (k = 0; k < FIO_OVH_NR; k++)
+		dst->overhead_nsec[k] += src->overhead_nsec[k];
+	dst->dr_samples += src->dr_samples;
+	dst->dr_bytes += src->dr_bytes;
+	dst->dr_zbytes += src->dr_zbytes;
+	dst->dr_fps += src->dr_fps;
+	dst->dr_dups += src->dr_dups;
+	dst->dr_dropped += src->dr_dropped;
 	dst->majf += src->majf;
 	dst->minf += src->minf;
 
@@ -2335,6 +2851,8 @@ void sum_thread_stats(struct thread_stat *dst, struct thread_stat *src)
 	dst->total_submit += src->total_submit;
 	dst->total_complete += src->total_complete;
 	dst->nr_zone_resets += src->nr_zone_resets;
+	if (src->clock_batch_err > dst->clock_batch_err)
+		dst->clock_batch_err = src->clock_batch_err;
 	dst->cachehit += src->cachehit;
 	dst->cachemiss += src->cachemiss;
 }
@@ -2360,6 +2878,7 @@ void init_thread_stat_min_vals(struct thread_stat *ts)
 		ts->iops_stat[i].min_val = ULONG_MAX;
 	}
 	ts->sync_stat.min_val = ULONG_MAX;
+	ts->trim_range_stat.min_val = ULONG_MAX;
 }
 
 void init_thread_stat(struct thread_stat *ts)
@@ -2429,7 +2948,6 @@ void __show_run_stats(void)
 	bool kb_base_warned = false;
 	bool unit_base_warned = false;
 	struct json_object *root = NULL;
-	struct json_array *array = NULL;
 	struct buf_output output[FIO_OUTPUT_NR];
 	struct flist_head **opt_lists;
 
@@ -2487,6 +3005,7 @@ void __show_run_stats(void)
 		ts->clat_percentiles = td->o.clat_percentiles;
 		ts->lat_percentiles = td->o.lat_percentiles;
 		ts->slat_percentiles = td->o.slat_percentiles;
+		ts->lat_hist_bits = td->o.lat_hist_bits;
 		ts->percentile_precision = td->o.percentile_precision;
 		memcpy(ts->percentile_list, td->o.percentile_list, sizeof(td->o.percentile_list));
 		opt_lists[j] = &td->opt_list;
@@ -2570,6 +3089,8 @@ void __show_run_stats(void)
 			ts->ss_slope.u.f = td->ss.slope;
 			ts->ss_deviation.u.f = td->ss.deviation;
 			ts->ss_criterion.u.f = td->ss.criterion;
+			for (k = 0; k < DDIR_RWDIR_CNT; k++)
+				ts->ss_ddir_criterion[k].u.f = td->ss.series[k].criterion;
 		}
 		else
 			ts->ss_dur = ts->ss_state = 0;
@@ -2650,8 +3171,6 @@ void __show_run_stats(void)
 		json_object_add_value_string(root, "time", time_buf);
 		global = get_global_options();
 		json_add_job_opts(root, "global options", &global->opt_list);
-		array = json_create_array();
-		json_object_add_value_array(root, "jobs", array);
 	}
 
 	if (is_backend)
@@ -2667,24 +3186,16 @@ void __show_run_stats(void)
 		} else {
 			if (output_format & FIO_OUTPUT_TERSE)
 				show_thread_status_terse(ts, rs, &output[__FIO_OUTPUT_TERSE]);
-			if (output_format & FIO_OUTPUT_JSON) {
-				struct json_object *tmp = show_thread_status_json(ts, rs, opt_lists[i]);
-				json_array_add_value_object(array, tmp);
-			}
 			if (output_format & FIO_OUTPUT_NORMAL)
 				show_thread_status_normal(ts, rs, &output[__FIO_OUTPUT_NORMAL]);
 		}
 	}
-	if (!is_backend && (output_format & FIO_OUTPUT_JSON)) {
-		/* disk util stats, if any */
-		show_disk_util(1, root, &output[__FIO_OUTPUT_JSON]);
-
-		show_idle_prof_stats(FIO_OUTPUT_JSON, root, &output[__FIO_OUTPUT_JSON]);
-
-		json_print_object(root, &output[__FIO_OUTPUT_JSON]);
-		log_buf(&output[__FIO_OUTPUT_JSON], "\n");
-		json_free_object(root);
-	}
+	if (!is_backend && (output_format & FIO_OUTPUT_JSON))
+		show_run_stats_json(root, threadstats, nr_ts, runstats,
+					opt_lists, output);
+	if (!is_backend && (output_format & FIO_OUTPUT_COLUMNAR))
+		show_run_stats_columnar(threadstats, nr_ts,
+					&output[__FIO_OUTPUT_COLUMNAR]);
 
 	for (i = 0; i < groupid + 1; i++) {
 		rs = &runstats[i];
@@ -2701,6 +3212,7 @@ void __show_run_stats(void)
 	else if (output_format & FIO_OUTPUT_NORMAL) {
 		show_disk_util(0, NULL, &output[__FIO_OUTPUT_NORMAL]);
 		show_idle_prof_stats(FIO_OUTPUT_NORMAL, NULL, &output[__FIO_OUTPUT_NORMAL]);
+		sweep_show(threadstats, nr_ts, &output[__FIO_OUTPUT_NORMAL]);
 	}
 
 	for (i = 0; i < FIO_OUTPUT_NR; i++) {
@@ -2883,10 +3395,20 @@ static struct io_logs *get_new_log(struct io_log *iolog)
 	}
 
 	cur_log = smalloc(sizeof(*cur_log));
-	if (cur_log) {
+	if (cur_log && iolog->log_mmap) {
+		INIT_FLIST_HEAD(&cur_log->list);
+		iolog->cur_log_max = new_samples;
+		if (iolog_mmap_next(iolog, cur_log)) {
+			flist_add_tail(&cur_log->list, &iolog->io_logs);
+			return cur_log;
+		}
+		sfree(cur_log);
+	} else if (cur_log) {
 		INIT_FLIST_HEAD(&cur_log->list);
 		cur_log->log = calloc(new_samples, log_entry_sz(iolog));
 		if (cur_log->log) {
+			mem_acct_add(iolog->td, MEM_IO_LOGS,
+				     new_samples * log_entry_sz(iolog));
 			cur_log->nr_samples = 0;
 			cur_log->max_samples = new_samples;
 			flist_add_tail(&cur_log->list, &iolog->io_logs);
@@ -2899,6 +3421,27 @@ static struct io_logs *get_new_log(struct io_log *iolog)
 	return NULL;
 }
 
+/*
+ * Give a flushed out chunk a new array, preferably the one the log helper
+ * thread is done writing out, so the job doesn't allocate as it goes.
+ */
+static struct io_logs *refill_log(struct io_log *iolog,
+				  struct io_logs *cur_log)
+{
+	cur_log->log = iolog_get_spare(iolog);
+	if (!cur_log->log) {
+		cur_log->log = calloc(iolog->cur_log_max, log_entry_sz(iolog));
+		if (!cur_log->log)
+			return NULL;
+		mem_acct_add(iolog->td, MEM_IO_LOGS,
+			     iolog->cur_log_max * log_entry_sz(iolog));
+	}
+
+	cur_log->nr_samples = 0;
+	cur_log->max_samples = iolog->cur_log_max;
+	return cur_log;
+}
+
 /*
  * Add and return a new log chunk, or return current log if big enough
  */
@@ -2921,10 +3464,10 @@ static struct io_logs *regrow_log(struct io_log *iolog)
 		return cur_log;
 
 	/*
-	 * No room for a new sample. If we're compressing on the fly, flush
-	 * out the current chunk
+	 * No room for a new sample. If we're compressing or writing behind
+	 * on the fly, flush out the current chunk
 	 */
-	if (iolog->log_gz) {
+	if (iolog->log_gz || iolog->write_behind) {
 		if (iolog_cur_flush(iolog, cur_log)) {
 			log_err("fio: failed flushing iolog! Will stop logging.\n");
 			return NULL;
@@ -2932,9 +3475,15 @@ static struct io_logs *regrow_log(struct io_log *iolog)
 	}
 
 	/*
-	 * Get a new log array, and add to our list
+	 * Get a new log array, and add to our list. With write behind or
+	 * a mapped log, the chunk keeps its size and is refilled in place.
 	 */
-	cur_log = get_new_log(iolog);
+	if (iolog->log_mmap)
+		cur_log = iolog_mmap_next(iolog, cur_log);
+	else if (iolog->write_behind)
+		cur_log = refill_log(iolog, cur_log);
+	else
+		cur_log = get_new_log(iolog);
 	if (!cur_log) {
 		log_err("fio: failed extending iolog! Will stop logging.\n");
 		return NULL;
@@ -3051,6 +3600,237 @@ static void __add_log_sample(struct io_log *iolog, union io_sample_data data,
 	iolog->disabled = true;
 }
 
+/*
+ * log_sample state. Reservoir mode holds up to 'held_max' I/Os of the
+ * current period, tail mode keeps a latency histogram per data direction
+ * and recomputes the cutoff bucket every LOG_TAIL_RECALC samples.
+ */
+#define LOG_TAIL_RECALC	1024
+
+struct log_held {
+	union io_sample_data data;
+	unsigned long time;
+	uint64_t offset;
+	unsigned long long bs;
+	enum fio_ddir ddir;
+	unsigned int priority;
+};
+
+struct io_log_sampler {
+	unsigned int mode;
+	uint64_t seen;
+
+	unsigned int nth;
+
+	struct log_held *held;
+	unsigned int held_max;
+	unsigned int held_nr;
+	unsigned long msec;
+	unsigned long period_end;
+	struct frand_state rand;
+
+	double percentile;
+	uint64_t *plat[DDIR_RWDIR_CNT];
+	uint64_t plat_nr[DDIR_RWDIR_CNT];
+	uint64_t plat_recalc[DDIR_RWDIR_CNT];
+	unsigned int cutoff[DDIR_RWDIR_CNT];
+	unsigned int max_idx[DDIR_RWDIR_CNT];
+};
+
+struct io_log_sampler *log_sampler_init(struct thread_data *td, int log_type)
+{
+	struct thread_options *o = &td->o;
+	struct io_log_sampler *s;
+	int i;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+
+	s->mode = o->log_sample;
+	switch (s->mode) {
+	case LOG_SAMPLE_NTH:
+		s->nth = o->log_sample_nth;
+		break;
+	case LOG_SAMPLE_RESERVOIR:
+		s->held_max = o->log_sample_reservoir;
+		s->msec = o->log_sample_msec;
+		s->period_end = s->msec;
+		s->held = calloc(s->held_max, sizeof(*s->held));
+		if (!s->held)
+			goto err;
+		init_rand_seed(&s->rand, o->rand_seed + log_type, false);
+		break;
+	case LOG_SAMPLE_TAIL:
+		s->percentile = o->log_sample_percentile.u.f;
+		for (i = 0; i < DDIR_RWDIR_CNT; i++) {
+			s->plat[i] = calloc(FIO_IO_U_PLAT_NR, sizeof(uint64_t));
+			if (!s->plat[i])
+				goto err;
+			s->plat_recalc[i] = LOG_TAIL_RECALC;
+		}
+		break;
+	}
+
+	return s;
+err:
+	log_sampler_free(s);
+	return NULL;
+}
+
+void log_sampler_free(struct io_log_sampler *s)
+{
+	int i;
+
+	if (!s)
+		return;
+
+	for (i = 0; i < DDIR_RWDIR_CNT; i++)
+		free(s->plat[i]);
+	free(s->held);
+	free(s);
+}
+
+static int log_held_cmp(const void *p1, const void *p2)
+{
+	const struct log_held *h1 = p1, *h2 = p2;
+
+	if (h1->time < h2->time)
+		return -1;
+	return h1->time > h2->time;
+}
+
+/*
+ * Log what the reservoir holds for the period that just ended, in time
+ * order.
+ */
+static void log_sampler_flush(struct io_log *iolog)
+{
+	struct io_log_sampler *s = iolog->sampler;
+	unsigned int i;
+
+	if (!s || !s->held_nr)
+		return;
+
+	qsort(s->held, s->held_nr, sizeof(*s->held), log_held_cmp);
+	for (i = 0; i < s->held_nr; i++) {
+		struct log_held *h = &s->held[i];
+
+		__add_log_sample(iolog, h->data, h->ddir, h->bs, h->time,
+				 h->offset, h->priority);
+	}
+	s->held_nr = 0;
+	s->seen = 0;
+}
+
+/*
+ * Keep a uniform random pick of held_max I/Os out of those seen in the
+ * period (Vitter's algorithm R).
+ */
+static void log_sample_reservoir(struct io_log *iolog,
+				 union io_sample_data data,
+				 enum fio_ddir ddir, unsigned long long bs,
+				 unsigned long t, uint64_t offset,
+				 unsigned int priority)
+{
+	struct io_log_sampler *s = iolog->sampler;
+	struct log_held *h;
+
+	if (t >= s->period_end) {
+		log_sampler_flush(iolog);
+		s->period_end = t - (t % s->msec) + s->msec;
+	}
+
+	if (s->held_nr < s->held_max)
+		h = &s->held[s->held_nr++];
+	else {
+		uint64_t slot = rand_between(&s->rand, 0, s->seen);
+
+		if (slot >= s->held_max) {
+			s->seen++;
+			return;
+		}
+		h = &s->held[slot];
+	}
+	s->seen++;
+
+	h->data = data;
+	h->time = t;
+	h->offset = offset;
+	h->bs = bs;
+	h->ddir = ddir;
+	h->priority = priority;
+}
+
+/*
+ * Find the bucket holding the configured percentile. Samples from that
+ * bucket up are logged.
+ */
+static void log_tail_recalc(struct io_log_sampler *s, enum fio_ddir ddir)
+{
+	uint64_t want, sum = 0;
+	unsigned int i;
+
+	want = (uint64_t) (s->plat_nr[ddir] * s->percentile / 100.0);
+	for (i = 0; i < FIO_IO_U_PLAT_NR - 1; i++) {
+		sum += s->plat[ddir][i];
+		if (sum > want)
+			break;
+	}
+
+	s->cutoff[ddir] = i;
+	s->plat_recalc[ddir] = s->plat_nr[ddir] + LOG_TAIL_RECALC;
+}
+
+static bool log_sample_tail(struct io_log_sampler *s, uint64_t val,
+			    enum fio_ddir ddir)
+{
+	unsigned int idx = plat_val_to_idx(val);
+
+	s->plat[ddir][idx]++;
+	if (++s->plat_nr[ddir] >= s->plat_recalc[ddir])
+		log_tail_recalc(s, ddir);
+
+	/*
+	 * Until the first cutoff is known, only log I/Os slower than
+	 * any seen so far.
+	 */
+	if (s->plat_nr[ddir] <= LOG_TAIL_RECALC) {
+		if (idx <= s->max_idx[ddir] && s->plat_nr[ddir] > 1)
+			return false;
+		s->max_idx[ddir] = idx;
+		return true;
+	}
+
+	return idx >= s->cutoff[ddir];
+}
+
+static void log_sample(struct io_log *iolog, union io_sample_data data,
+		       enum fio_ddir ddir, unsigned long long bs,
+		       unsigned long t, uint64_t offset,
+		       unsigned int priority)
+{
+	struct io_log_sampler *s = iolog->sampler;
+
+	switch (s->mode) {
+	case LOG_SAMPLE_NTH:
+		if (++s->seen < s->nth)
+			return;
+		s->seen = 0;
+		break;
+	case LOG_SAMPLE_RESERVOIR:
+		log_sample_reservoir(iolog, data, ddir, bs, t, offset,
+				     priority);
+		return;
+	case LOG_SAMPLE_TAIL:
+		if (!log_sample_tail(s, data.val, ddir))
+			return;
+		break;
+	}
+
+	__add_log_sample(iolog, data, ddir, bs, t, offset, priority);
+}
+
 static inline void reset_io_stat(struct io_stat *ios)
 {
 	ios->min_val = -1ULL;
@@ -3082,6 +3862,40 @@ static inline void reset_clat_prio_stats(struct thread_stat *ts)
 	}
 }
 
+void reset_stat_shard(struct thread_data *td)
+{
+	struct stat_shard *shard = &td->stat_shard;
+	int i;
+
+	for (i = 0; i < DDIR_RWDIR_CNT; i++) {
+		reset_io_stat(&shard->clat_stat[i]);
+		reset_io_stat(&shard->slat_stat[i]);
+		reset_io_stat(&shard->lat_stat[i]);
+	}
+}
+
+/*
+ * Fold the private latency stats into ->ts. Must be called from the job
+ * itself, the status output asks for it through ->update_rusage.
+ */
+void merge_stat_shard(struct thread_data *td)
+{
+	struct stat_shard *shard = &td->stat_shard;
+	struct thread_stat *ts = &td->ts;
+	int i;
+
+	if (!td->o.stats_shard)
+		return;
+
+	for (i = 0; i < DDIR_RWDIR_CNT; i++) {
+		sum_stat(&ts->clat_stat[i], &shard->clat_stat[i], false);
+		sum_stat(&ts->slat_stat[i], &shard->slat_stat[i], false);
+		sum_stat(&ts->lat_stat[i], &shard->lat_stat[i], false);
+	}
+
+	reset_stat_shard(td);
+}
+
 void reset_io_stats(struct thread_data *td)
 {
 	struct thread_stat *ts = &td->ts;
@@ -3106,9 +3920,11 @@ void reset_io_stats(struct thread_data *td)
 			reset_io_u_plat(ts->io_u_plat[i][j]);
 
 	reset_clat_prio_stats(ts);
+	reset_stat_shard(td);
 
 	ts->total_io_u[DDIR_SYNC] = 0;
 	reset_io_u_plat(ts->io_u_sync_plat);
+	reset_io_stat(&ts->trim_range_stat);
 
 	for (i = 0; i < FIO_IO_U_MAP_NR; i++) {
 		ts->io_u_map[i] = 0;
@@ -3126,7 +3942,11 @@ void reset_io_stats(struct thread_data *td)
 	ts->total_submit = 0;
 	ts->total_complete = 0;
 	ts->nr_zone_resets = 0;
+	ts->clock_batch_err = 0;
 	ts->cachehit = ts->cachemiss = 0;
+	lat_outliers_clear(td);
+	file_stats_reset(td);
+	cpu_locality_reset(td);
 }
 
 static void __add_stat_to_log(struct io_log *iolog, enum fio_ddir ddir,
@@ -3160,25 +3980,26 @@ static void _add_stat_to_log(struct io_log *iolog, unsigned long elapsed,
 		__add_stat_to_log(iolog, ddir, elapsed, log_max);
 }
 
-static unsigned long add_log_sample(struct thread_data *td,
-				    struct io_log *iolog,
-				    union io_sample_data data,
-				    enum fio_ddir ddir, unsigned long long bs,
-				    uint64_t offset, unsigned int ioprio)
+static unsigned long __add_td_log_sample(struct thread_data *td,
+					 struct io_log *iolog,
+					 union io_sample_data data,
+					 enum fio_ddir ddir,
+					 unsigned long long bs,
+					 uint64_t offset, unsigned int ioprio,
+					 unsigned long elapsed)
 {
-	unsigned long elapsed, this_window;
-
-	if (!ddir_rw(ddir))
-		return 0;
-
-	elapsed = mtime_since_now(&td->epoch);
+	unsigned long this_window;
 
 	/*
 	 * If no time averaging, just add the log sample.
 	 */
 	if (!iolog->avg_msec) {
-		__add_log_sample(iolog, data, ddir, bs, elapsed, offset,
-				 ioprio);
+		if (iolog->sampler)
+			log_sample(iolog, data, ddir, bs, elapsed, offset,
+				   ioprio);
+		else
+			__add_log_sample(iolog, data, ddir, bs, elapsed, offset,
+					 ioprio);
 		return 0;
 	}
 
@@ -3209,12 +4030,122 @@ static unsigned long add_log_sample(struct thread_data *td,
 	return iolog->avg_msec;
 }
 
+static unsigned long add_log_sample(struct thread_data *td,
+				    struct io_log *iolog,
+				    union io_sample_data data,
+				    enum fio_ddir ddir, unsigned long long bs,
+				    uint64_t offset, unsigned int ioprio)
+{
+	unsigned long ret;
+	int prev;
+
+	if (!ddir_rw(ddir))
+		return 0;
+
+	prev = overhead_enter(td, FIO_OVH_LOG);
+	ret = __add_td_log_sample(td, iolog, data, ddir, bs, offset, ioprio,
+				  mtime_since_now(&td->epoch));
+	overhead_leave(td, prev);
+	return ret;
+}
+
+/*
+ * Queue a sample for a window the helper thread closed. Returns false if
+ * the job stopped taking them.
+ */
+static bool push_log_window(struct thread_data *td, struct io_log *iolog,
+			    uint64_t val, enum fio_ddir ddir,
+			    unsigned long long bs, unsigned long elapsed)
+{
+	struct io_log_win *w;
+	bool ret = false;
+
+	pthread_mutex_lock(&iolog->win_lock);
+	if (!iolog->win_closed && iolog->win_nr < IOLOG_WIN_NR) {
+		w = &iolog->win[iolog->win_nr++];
+		w->val = val;
+		w->time = elapsed;
+		w->bs = bs;
+		w->ddir = ddir;
+		ret = true;
+	}
+	pthread_mutex_unlock(&iolog->win_lock);
+
+	if (ret)
+		td->log_win_pending = 1;
+	return ret;
+}
+
+static bool log_window_room(struct io_log *iolog)
+{
+	bool ret;
+
+	pthread_mutex_lock(&iolog->win_lock);
+	ret = !iolog->win_closed &&
+		iolog->win_nr + DDIR_RWDIR_CNT <= IOLOG_WIN_NR;
+	pthread_mutex_unlock(&iolog->win_lock);
+	return ret;
+}
+
+static void __drain_log_window(struct thread_data *td, struct io_log *iolog,
+			       bool close)
+{
+	struct io_log_win win[IOLOG_WIN_NR];
+	unsigned int i, nr;
+
+	if (!helper_window_log(iolog))
+		return;
+
+	pthread_mutex_lock(&iolog->win_lock);
+	nr = iolog->win_nr;
+	memcpy(win, iolog->win, nr * sizeof(win[0]));
+	iolog->win_nr = 0;
+	if (close)
+		iolog->win_closed = true;
+	pthread_mutex_unlock(&iolog->win_lock);
+
+	for (i = 0; i < nr; i++) {
+		union io_sample_data data = { .val = win[i].val, };
+
+		__add_td_log_sample(td, iolog, data, win[i].ddir, win[i].bs,
+				    0, 0, win[i].time);
+	}
+}
+
+/*
+ * Called by the job when the helper thread flagged closed windows, so
+ * the job itself never has to look at the clock for them. A window
+ * closed while we drain is picked up next time, or at the end of the job.
+ */
+void drain_log_windows(struct thread_data *td)
+{
+	int prev;
+
+	td->log_win_pending = 0;
+
+	prev = overhead_enter(td, FIO_OVH_LOG);
+	__drain_log_window(td, td->bw_log, false);
+	__drain_log_window(td, td->iops_log, false);
+	overhead_leave(td, prev);
+}
+
 void finalize_logs(struct thread_data *td, bool unit_logs)
 {
 	unsigned long elapsed;
 
 	elapsed = mtime_since_now(&td->epoch);
 
+	if (unit_logs) {
+		__drain_log_window(td, td->bw_log, true);
+		__drain_log_window(td, td->iops_log, true);
+		if (td->clat_log)
+			log_sampler_flush(td->clat_log);
+		if (td->slat_log)
+			log_sampler_flush(td->slat_log);
+		if (td->lat_log)
+			log_sampler_flush(td->lat_log);
+	}
+
 	if (td->clat_log && unit_logs)
 		_add_stat_to_log(td->clat_log, elapsed, td->o.log_max != 0);
 	if (td->slat_log && unit_logs)
@@ -3241,19 +4172,32 @@ void add_agg_sample(union io_sample_data data, enum fio_ddir ddir,
 
 void add_sync_clat_sample(struct thread_stat *ts, unsigned long long nsec)
 {
-	unsigned int idx = plat_val_to_idx(nsec);
+	unsigned int idx = plat_val_to_idx_bits(nsec, ts->lat_hist_bits);
 	assert(idx < FIO_IO_U_PLAT_NR);
 
 	ts->io_u_sync_plat[idx]++;
 	add_stat_sample(&ts->sync_stat, nsec);
 }
 
+/*
+ * A multi-range trim completes all its ranges at once, charge each of them
+ * an equal share of the command latency.
+ */
+void add_trim_range_samples(struct thread_stat *ts, unsigned long long nsec,
+			    unsigned int nr)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr; i++)
+		add_stat_sample(&ts->trim_range_stat, nsec / nr);
+}
+
 static inline void add_lat_percentile_sample(struct thread_stat *ts,
 					     unsigned long long nsec,
 					     enum fio_ddir ddir,
 					     enum fio_lat lat)
 {
-	unsigned int idx = plat_val_to_idx(nsec);
+	unsigned int idx = plat_val_to_idx_bits(nsec, ts->lat_hist_bits);
 	assert(idx < FIO_IO_U_PLAT_NR);
 
 	ts->io_u_plat[lat][ddir][idx]++;
@@ -3264,12 +4208,26 @@ add_lat_percentile_prio_sample(struct thread_stat *ts, unsigned long long nsec,
 			       enum fio_ddir ddir,
 			       unsigned short clat_prio_index)
 {
-	unsigned int idx = plat_val_to_idx(nsec);
+	unsigned int idx = plat_val_to_idx_bits(nsec, ts->lat_hist_bits);
 
 	if (ts->clat_prio[ddir])
 		ts->clat_prio[ddir][clat_prio_index].io_u_plat[idx]++;
 }
 
+/*
+ * With stats_shard=1, the clat/slat/lat summaries are accumulated in the
+ * job private shard. Not if completions may be handled by other threads,
+ * those serialize on the io_u lock and update ->ts directly.
+ */
+static inline struct stat_shard *td_stat_shard(struct thread_data *td,
+					       bool needs_lock)
+{
+	if (!td->o.stats_shard || needs_lock)
+		return NULL;
+
+	return &td->stat_shard;
+}
+
 void add_clat_sample(struct thread_data *td, enum fio_ddir ddir,
 		     unsigned long long nsec, unsigned long long bs,
 		     uint64_t offset, unsigned int ioprio,
@@ -3279,11 +4237,15 @@ void add_clat_sample(struct thread_data *td, enum fio_ddir ddir,
 	unsigned long elapsed, this_window;
 	struct thread_stat *ts = &td->ts;
 	struct io_log *iolog = td->clat_hist_log;
+	struct stat_shard *shard = td_stat_shard(td, needs_lock);
 
 	if (needs_lock)
 		__td_io_u_lock(td);
 
-	add_stat_sample(&ts->clat_stat[ddir], nsec);
+	if (shard)
+		add_stat_sample(&shard->clat_stat[ddir], nsec);
+	else
+		add_stat_sample(&ts->clat_stat[ddir], nsec);
 
 	/*
 	 * When lat_percentiles=1 (default 0), the reported per priority
@@ -3302,6 +4264,8 @@ void add_clat_sample(struct thread_data *td, enum fio_ddir ddir,
 		add_log_sample(td, td->clat_log, sample_val(nsec), ddir, bs,
 			       offset, ioprio);
 
+	latmap_add(td->latmap, ddir, offset, nsec);
+
 	if (ts->clat_percentiles) {
 		/*
 		 * Because of the above definition, add a prio lat percentile
@@ -3336,6 +4300,7 @@ void add_clat_sample(struct thread_data *td, enum fio_ddir ddir,
 			 */
 			io_u_plat = (uint64_t *) td->ts.io_u_plat[FIO_CLAT][ddir];
 			dst = malloc(sizeof(struct io_u_plat_entry));
+			mem_acct_add(td, MEM_IO_LOGS, sizeof(*dst));
 			memcpy(&(dst->io_u_plat), io_u_plat,
 				FIO_IO_U_PLAT_NR * sizeof(uint64_t));
 			flist_add(&dst->list, &hw->list);
@@ -3362,6 +4327,7 @@ void add_slat_sample(struct thread_data *td, enum fio_ddir ddir,
 {
 	const bool needs_lock = td_async_processing(td);
 	struct thread_stat *ts = &td->ts;
+	struct stat_shard *shard = td_stat_shard(td, needs_lock);
 
 	if (!ddir_rw(ddir))
 		return;
@@ -3369,7 +4335,10 @@ void add_slat_sample(struct thread_data *td, enum fio_ddir ddir,
 	if (needs_lock)
 		__td_io_u_lock(td);
 
-	add_stat_sample(&ts->slat_stat[ddir], nsec);
+	if (shard)
+		add_stat_sample(&shard->slat_stat[ddir], nsec);
+	else
+		add_stat_sample(&ts->slat_stat[ddir], nsec);
 
 	if (td->slat_log)
 		add_log_sample(td, td->slat_log, sample_val(nsec), ddir, bs,
@@ -3389,6 +4358,7 @@ void add_lat_sample(struct thread_data *td, enum fio_ddir ddir,
 {
 	const bool needs_lock = td_async_processing(td);
 	struct thread_stat *ts = &td->ts;
+	struct stat_shard *shard = td_stat_shard(td, needs_lock);
 
 	if (!ddir_rw(ddir))
 		return;
@@ -3396,7 +4366,10 @@ void add_lat_sample(struct thread_data *td, enum fio_ddir ddir,
 	if (needs_lock)
 		__td_io_u_lock(td);
 
-	add_stat_sample(&ts->lat_stat[ddir], nsec);
+	if (shard)
+		add_stat_sample(&shard->lat_stat[ddir], nsec);
+	else
+		add_stat_sample(&ts->lat_stat[ddir], nsec);
 
 	if (td->lat_log)
 		add_log_sample(td, td->lat_log, sample_val(nsec), ddir, bs,
@@ -3466,6 +4439,13 @@ static int __add_samples(struct thread_data *td, struct timespec *parent_tv,
 	if (spent < avg_time && avg_time - spent > LOG_MSEC_SLACK)
 		return avg_time - spent;
 
+	/*
+	 * If the job hasn't picked up the last windows yet, keep counting
+	 * into this one rather than dropping it.
+	 */
+	if (helper_window_log(log) && !log_window_room(log))
+		return avg_time;
+
 	if (needs_lock)
 		__td_io_u_lock(td);
 
@@ -3495,9 +4475,19 @@ static int __add_samples(struct thread_data *td, struct timespec *parent_tv,
 			if (td->o.min_bs[ddir] == td->o.max_bs[ddir])
 				bs = td->o.min_bs[ddir];
 
-			next = add_log_sample(td, log, sample_val(rate), ddir,
-					      bs, 0, 0);
-			next_log = min(next_log, next);
+			/*
+			 * Runs in the helper thread, so don't charge the
+			 * job's overhead stats through add_log_sample().
+			 */
+			if (helper_window_log(log)) {
+				push_log_window(td, log, rate, ddir, bs,
+						mtime_since(&td->epoch, t));
+			} else {
+				next = __add_td_log_sample(td, log,
+						sample_val(rate), ddir, bs, 0, 0,
+						mtime_since_now(&td->epoch));
+				next_log = min(next_log, next);
+			}
 		}
 
 		stat_io_bytes[ddir] = this_io_bytes[ddir];
@@ -3572,15 +4562,15 @@ int calc_log_samples(void)
 			next = min(td->o.iops_avg_time, td->o.bw_avg_time);
 			continue;
 		}
-		if (!td->bw_log ||
-			(td->bw_log && !per_unit_log(td->bw_log))) {
+		if (!per_unit_log(td->bw_log) ||
+		    helper_window_log(td->bw_log)) {
 			tmp = add_bw_samples(td, &now);
 
 			if (td->bw_log)
 				log_avg_msec_min = min(log_avg_msec_min, (unsigned int)td->bw_log->avg_msec);
 		}
-		if (!td->iops_log ||
-			(td->iops_log && !per_unit_log(td->iops_log))) {
+		if (!per_unit_log(td->iops_log) ||
+		    helper_window_log(td->iops_log)) {
 			tmp = add_iops_samples(td, &now);
 
 			if (td->iops_log)
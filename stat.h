@@ -157,12 +157,84 @@ enum fio_lat {
 	FIO_LAT_CNT = 3,
 };
 
+enum fio_perf_counter {
+	FIO_PERF_CYCLES = 0,
+	FIO_PERF_INSTRUCTIONS,
+	FIO_PERF_CACHE_MISSES,
+
+	FIO_PERF_NR,
+};
+
+/* overhead_stats sections of do_io(), in thread_stat->overhead_nsec */
+enum fio_overhead_section {
+	FIO_OVH_GET = 0,
+	FIO_OVH_SUBMIT,
+	FIO_OVH_COMPLETE,
+	FIO_OVH_STATS,
+	FIO_OVH_LOG,
+	FIO_OVH_OTHER,
+
+	FIO_OVH_NR,
+};
+
+/*
+ * lat_outliers, one of the slowest IOs of a job. Times are nsec since the
+ * start of the job, zone and placement_id are -1 if not applicable.
+ */
+#define FIO_LAT_OUTLIERS_MAX	64
+#define FIO_LAT_OUTLIER_FNAME	64
+
+/*
+ * Most offset regions lat_heatmap splits a job into
+ */
+#define FIO_LATMAP_MAX_REGIONS	65536
+
+struct lat_outlier {
+	uint64_t lat_nsec;
+	uint64_t offset;
+	uint64_t bs;
+	uint64_t issue_nsec;
+	uint64_t complete_nsec;
+	uint32_t ddir;
+	uint32_t depth;
+	uint32_t prio;
+	int32_t zone;
+	int32_t placement_id;
+	uint32_t pad;
+	char file[FIO_LAT_OUTLIER_FNAME];
+};
+
+/* cgroup2 io.stat and io.pressure counters, in thread_stat->cgroup_io */
+enum fio_cgroup_io {
+	FIO_CG_RBYTES = 0,
+	FIO_CG_WBYTES,
+	FIO_CG_RIOS,
+	FIO_CG_WIOS,
+	FIO_CG_DBYTES,
+	FIO_CG_DIOS,
+	FIO_CG_SOME_USEC,
+	FIO_CG_FULL_USEC,
+
+	FIO_CG_NR,
+};
+
 struct clat_prio_stat {
 	uint64_t io_u_plat[FIO_IO_U_PLAT_NR];
 	struct io_stat clat_stat;
 	uint32_t ioprio;
 };
 
+/*
+ * Latency stats that a job accumulates privately with stats_shard=1. They
+ * live on their own cache lines, away from the thread_stat that the status
+ * output reads, and are folded into it by merge_stat_shard().
+ */
+struct stat_shard {
+	struct io_stat clat_stat[DDIR_RWDIR_CNT];
+	struct io_stat slat_stat[DDIR_RWDIR_CNT];
+	struct io_stat lat_stat[DDIR_RWDIR_CNT];
+} __attribute__((aligned(64)));
+
 struct thread_stat {
 	char name[FIO_JOBNAME_SIZE];
 	char verror[FIO_VERROR_SIZE];
@@ -193,13 +265,27 @@ struct thread_stat {
 	uint64_t ctx;
 	uint64_t minf, majf;
 
+	/* perf_counters, in FIO_PERF_* order */
+	uint64_t perf_count[FIO_PERF_NR];
+
+	/* overhead_stats, nsec spent in each FIO_OVH_* section */
+	uint64_t overhead_nsec[FIO_OVH_NR];
+
+	/* data_reduction_sample, what the sampled written blocks reduce to */
+	uint64_t dr_samples;
+	uint64_t dr_bytes;
+	uint64_t dr_zbytes;		/* compressed */
+	uint64_t dr_fps;		/* fingerprinted for dedupe */
+	uint64_t dr_dups;		/* fingerprints seen before */
+	uint64_t dr_dropped;		/* picked while the thread was behind */
+
 	/*
 	 * IO depth and latency stats
 	 */
 	uint32_t clat_percentiles;
 	uint32_t lat_percentiles;
 	uint32_t slat_percentiles;
-	uint32_t pad;
+	uint32_t lat_hist_bits;
 	uint64_t percentile_precision;
 	fio_fp64_t percentile_list[FIO_IO_U_LIST_MAX_LEN];
 
@@ -235,6 +321,27 @@ struct thread_stat {
 	/* ZBD stats */
 	uint64_t nr_zone_resets;
 
+	/* max timestamp error from clock_batch, in nsec */
+	uint64_t clock_batch_err;
+
+	/* completion latency of each range of a multi-range trim */
+	struct io_stat trim_range_stat;
+
+	/*
+	 * With cgroup_stat_interval, how much the job's cgroup counters
+	 * grew while it ran, and the highest io.pressure avg10 seen.
+	 */
+	uint64_t cgroup_io[FIO_CG_NR];
+	fio_fp64_t cgroup_some_avg10;
+	fio_fp64_t cgroup_full_avg10;
+	uint32_t cgroup_stats;
+	uint32_t pad7;
+
+	/* lat_outliers, a min heap on ->lat_nsec */
+	uint32_t nr_lat_outliers;
+	uint32_t pad8;
+	struct lat_outlier lat_outliers[FIO_LAT_OUTLIERS_MAX];
+
 	uint64_t nr_block_infos;
 	uint32_t block_infos[MAX_NR_BLOCK_INFOS];
 
@@ -257,6 +364,7 @@ struct thread_stat {
 	fio_fp64_t ss_slope;
 	fio_fp64_t ss_deviation;
 	fio_fp64_t ss_criterion;
+	fio_fp64_t ss_ddir_criterion[DDIR_RWDIR_CNT];
 
 	/* A mirror of td->ioprio. */
 	uint32_t ioprio;
@@ -323,7 +431,10 @@ struct thread_stat {
 	 * Network 'copy' of run_str[]					\
 	 */								\
 	uint32_t nr_threads;						\
-	uint32_t pad2;							\
+	/*								\
+	 * If set, run_str[] is deflated and this is its size		\
+	 */								\
+	uint32_t run_str_gz;						\
 	uint8_t run_str[];						\
 }
 
@@ -357,6 +468,26 @@ extern void init_thread_stat(struct thread_stat *ts);
 extern void init_group_run_stat(struct group_run_stats *gs);
 extern void eta_to_str(char *str, unsigned long eta_sec);
 extern bool calc_lat(struct io_stat *is, unsigned long long *min, unsigned long long *max, double *mean, double *dev);
+extern unsigned int plat_val_to_idx(unsigned long long val);
+
+/*
+ * Bucket of val in a histogram kept with 'bits' bits of precision, see
+ * lat_hist_bits. The buckets keep the layout of full precision, so
+ * reports, logs and clients need no conversion. A coarse bucket counts
+ * in the middle one of the fine buckets it covers, the group below
+ * FIO_IO_U_PLAT_VAL stays exact.
+ */
+static inline unsigned int plat_val_to_idx_bits(unsigned long long val,
+						unsigned int bits)
+{
+	unsigned int idx = plat_val_to_idx(val), shift;
+
+	if (!bits || bits >= FIO_IO_U_PLAT_BITS || idx < FIO_IO_U_PLAT_VAL)
+		return idx;
+
+	shift = FIO_IO_U_PLAT_BITS - bits;
+	return ((idx >> shift) << shift) | (1U << (shift - 1));
+}
 extern unsigned int calc_clat_percentiles(uint64_t *io_u_plat, unsigned long long nr, fio_fp64_t *plist, unsigned long long **output, unsigned long long *maxv, unsigned long long *minv);
 extern void stat_calc_lat_n(struct thread_stat *ts, double *io_u_lat);
 extern void stat_calc_lat_m(struct thread_stat *ts, double *io_u_lat);
@@ -364,6 +495,8 @@ extern void stat_calc_lat_u(struct thread_stat *ts, double *io_u_lat);
 extern void stat_calc_dist(uint64_t *map, unsigned long total, double *io_u_dist);
 extern void reset_io_stats(struct thread_data *);
 extern void update_rusage_stat(struct thread_data *);
+extern void reset_stat_shard(struct thread_data *);
+extern void merge_stat_shard(struct thread_data *);
 extern void clear_rusage_stat(struct thread_data *);
 
 extern void add_lat_sample(struct thread_data *, enum fio_ddir, unsigned long long,
@@ -379,6 +512,8 @@ extern void add_bw_sample(struct thread_data *, struct io_u *,
 				unsigned int, unsigned long long);
 extern void add_sync_clat_sample(struct thread_stat *ts,
 				unsigned long long nsec);
+extern void add_trim_range_samples(struct thread_stat *ts,
+				unsigned long long nsec, unsigned int nr);
 extern int calc_log_samples(void);
 extern void free_clat_prio_stats(struct thread_stat *);
 extern int alloc_clat_prio_stat_ddir(struct thread_stat *, enum fio_ddir, int);
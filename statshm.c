@@ -0,0 +1,187 @@
+/*
+ * Keep a seqlock protected snapshot of per-job stats in a shared file,
+ * updated by a helper thread timer. See statshm.h for the layout.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "fio.h"
+#include "statshm.h"
+
+char *statshm_file = NULL;
+unsigned int statshm_interval = 1000;
+
+/* Counters as of the previous update, per job */
+struct statshm_prev {
+	uint64_t io_blocks[DDIR_RWDIR_CNT];
+	uint64_t io_bytes[DDIR_RWDIR_CNT];
+};
+
+static struct statshm_hdr *statshm_hdr;
+static size_t statshm_size;
+static struct statshm_prev *statshm_prev;
+static struct timespec statshm_prev_time;
+
+int statshm_parse(const char *str)
+{
+	if (!*str) {
+		log_err("fio: status-shm needs a file name\n");
+		return 1;
+	}
+
+	free(statshm_file);
+	statshm_file = strdup(str);
+	return 0;
+}
+
+void statshm_setup(void)
+{
+	struct statshm_hdr *hdr;
+	void *map;
+	int fd;
+
+	if (!statshm_file || !statshm_interval)
+		return;
+
+	statshm_size = sizeof(*hdr) + thread_number * sizeof(struct statshm_job);
+	statshm_prev = calloc(thread_number, sizeof(*statshm_prev));
+	if (!statshm_prev)
+		return;
+
+	fd = open(statshm_file, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		log_err("fio: status-shm open %s: %s\n", statshm_file,
+			strerror(errno));
+		goto err;
+	}
+	if (ftruncate(fd, statshm_size) < 0) {
+		log_err("fio: status-shm truncate %s: %s\n", statshm_file,
+			strerror(errno));
+		close(fd);
+		goto err_unlink;
+	}
+	map = mmap(NULL, statshm_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		log_err("fio: status-shm mmap %s: %s\n", statshm_file,
+			strerror(errno));
+		goto err_unlink;
+	}
+
+	hdr = map;
+	hdr->version = FIO_STATSHM_VERSION;
+	hdr->job_size = sizeof(struct statshm_job);
+	seqlock_init(&hdr->seq);
+	hdr->nr_jobs = thread_number;
+	hdr->pid = getpid();
+	hdr->interval_ms = statshm_interval;
+	/* readers go by the magic, so it goes in last */
+	write_barrier();
+	hdr->magic = FIO_STATSHM_MAGIC;
+
+	statshm_hdr = hdr;
+	fio_gettime(&statshm_prev_time, NULL);
+	return;
+err_unlink:
+	unlink(statshm_file);
+err:
+	free(statshm_prev);
+	statshm_prev = NULL;
+}
+
+static uint64_t statshm_delta(uint64_t cur, uint64_t *prev)
+{
+	uint64_t val = cur >= *prev ? cur - *prev : cur;
+
+	*prev = cur;
+	return val;
+}
+
+static void statshm_fill_job(struct thread_data *td, struct statshm_prev *p,
+			     uint64_t msec, struct statshm_job *sj)
+{
+	int ddir;
+
+	snprintf(sj->name, sizeof(sj->name), "%s", td->o.name ? : "");
+	sj->thread_number = td->thread_number;
+	sj->groupid = td->groupid;
+	sj->runstate = td->runstate;
+	sj->error = td->error;
+
+	for (ddir = 0; ddir < DDIR_RWDIR_CNT; ddir++) {
+		struct statshm_ddir *sd = &sj->ddir[ddir];
+		struct io_stat *clat = &td->ts.clat_stat[ddir];
+
+		sd->ios = td->io_blocks[ddir];
+		sd->bytes = td->io_bytes[ddir];
+		sd->iops = statshm_delta(sd->ios, &p->io_blocks[ddir]) *
+				1000 / msec;
+		sd->bw = statshm_delta(sd->bytes, &p->io_bytes[ddir]) *
+				1000 / msec;
+		sd->clat_mean = clat->samples ? clat->mean.u.f : 0;
+		sd->clat_max = clat->max_val;
+	}
+}
+
+static void statshm_update(bool done)
+{
+	struct statshm_hdr *hdr = statshm_hdr;
+	struct statshm_job *jobs = (void *) (hdr + 1);
+	struct timespec now;
+	struct timeval tv;
+	uint64_t msec;
+
+	fio_gettime(&now, NULL);
+	msec = mtime_since(&statshm_prev_time, &now);
+	if (!msec)
+		msec = 1;
+	statshm_prev_time = now;
+	gettimeofday(&tv, NULL);
+
+	write_seqlock_begin(&hdr->seq);
+	write_barrier();
+
+	for_each_td(td) {
+		if (__td_index >= hdr->nr_jobs)
+			break;
+		statshm_fill_job(td, &statshm_prev[__td_index], msec,
+				 &jobs[__td_index]);
+	} end_for_each();
+
+	hdr->updates++;
+	hdr->timestamp_ms = (uint64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	hdr->done = done;
+
+	write_seqlock_end(&hdr->seq);
+}
+
+int statshm_update_check(void)
+{
+	if (statshm_hdr)
+		statshm_update(false);
+
+	return 0;
+}
+
+void statshm_exit(void)
+{
+	if (!statshm_hdr)
+		return;
+
+	/*
+	 * The final stats go in for readers that have it mapped, the file
+	 * itself goes away with the run.
+	 */
+	statshm_update(true);
+	munmap(statshm_hdr, statshm_size);
+	statshm_hdr = NULL;
+	unlink(statshm_file);
+
+	free(statshm_prev);
+	statshm_prev = NULL;
+}
@@ -0,0 +1,60 @@
+#ifndef FIO_STATSHM_H
+#define FIO_STATSHM_H
+
+#include <inttypes.h>
+#include "io_ddir.h"
+#include "lib/seqlock.h"
+
+#define FIO_STATSHM_MAGIC	0x736f6966	/* "fios" */
+#define FIO_STATSHM_VERSION	1
+
+#define FIO_STATSHM_NAME_LEN	64
+
+/*
+ * Live per-job stats in a shared file, for local agents that map it and
+ * read without any syscalls. The file is a header followed by nr_jobs
+ * job entries, in host byte order. fio is the only writer and bumps
+ * seq.sequence before and after each update, so a reader copies what
+ * it wants while the sequence is even and the same before and after.
+ */
+struct statshm_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t job_size;		/* sizeof(struct statshm_job) */
+	struct seqlock seq;
+	uint32_t nr_jobs;
+	uint32_t pid;
+	uint32_t interval_ms;		/* how often it is updated */
+	uint32_t done;			/* set by the last update */
+	uint32_t pad;
+	uint64_t updates;
+	uint64_t timestamp_ms;		/* wall clock, ms since the epoch */
+};
+
+struct statshm_ddir {
+	uint64_t ios;			/* since the job started */
+	uint64_t bytes;
+	uint64_t iops;			/* over the last interval */
+	uint64_t bw;			/* bytes/sec, over the last interval */
+	uint64_t clat_mean;		/* nsec */
+	uint64_t clat_max;
+};
+
+struct statshm_job {
+	char name[FIO_STATSHM_NAME_LEN];
+	uint32_t thread_number;
+	uint32_t groupid;
+	uint32_t runstate;
+	uint32_t error;
+	struct statshm_ddir ddir[DDIR_RWDIR_CNT];
+};
+
+extern int statshm_parse(const char *);
+extern void statshm_setup(void);
+extern void statshm_exit(void);
+extern int statshm_update_check(void);
+
+extern char *statshm_file;
+extern unsigned int statshm_interval;
+
+#endif
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "fio.h"
 #include "steadystate.h"
@@ -6,27 +7,62 @@
 bool steadystate_enabled = false;
 unsigned int ss_check_interval = 1000;
 
+/* per interval latency histograms, summed over a reporting group */
+static uint64_t ss_group_plat[DDIR_RWDIR_CNT][FIO_IO_U_PLAT_NR];
+
+static void ss_series_free(struct steadystate_series *s)
+{
+	free(s->data);
+	free(s->minq);
+	free(s->maxq);
+	s->data = s->minq = s->maxq = NULL;
+}
+
 void steadystate_free(struct thread_data *td)
 {
+	int i;
+
 	free(td->ss.iops_data);
 	free(td->ss.bw_data);
+	free(td->ss.prev_plat);
 	td->ss.iops_data = NULL;
 	td->ss.bw_data = NULL;
+	td->ss.prev_plat = NULL;
+
+	for (i = 0; i <= SS_SERIES_TOTAL; i++)
+		ss_series_free(&td->ss.series[i]);
+}
+
+static void ss_series_alloc(struct steadystate_series *s,
+			    unsigned int intervals)
+{
+	s->data = calloc(intervals, sizeof(uint64_t));
+	s->minq = calloc(intervals, sizeof(uint64_t));
+	s->maxq = calloc(intervals, sizeof(uint64_t));
 }
 
 static void steadystate_alloc(struct thread_data *td)
 {
-	int intervals = td->ss.dur / (ss_check_interval / 1000L);
+	struct steadystate_data *ss = &td->ss;
+	int i;
+
+	ss->bw_data = calloc(ss->intervals, sizeof(uint64_t));
+	ss->iops_data = calloc(ss->intervals, sizeof(uint64_t));
 
-	td->ss.bw_data = calloc(intervals, sizeof(uint64_t));
-	td->ss.iops_data = calloc(intervals, sizeof(uint64_t));
+	ss_series_alloc(&ss->series[SS_SERIES_TOTAL], ss->intervals);
+	if (ss->state & FIO_SS_DDIR) {
+		for (i = 0; i < DDIR_RWDIR_CNT; i++)
+			if (ss->ddir_mask & (1U << i))
+				ss_series_alloc(&ss->series[i], ss->intervals);
+	}
 
-	td->ss.state |= FIO_SS_DATA;
+	ss->state |= FIO_SS_DATA;
 }
 
 void steadystate_setup(void)
 {
 	struct thread_data *prev_td;
+	unsigned int ddir_mask = 0;
 	int prev_groupid;
 
 	if (!steadystate_enabled)
@@ -35,7 +71,8 @@ void steadystate_setup(void)
 	/*
 	 * if group reporting is enabled, identify the last td
 	 * for each group and use it for storing steady state
-	 * data
+	 * data. It also gets the data directions of the whole
+	 * group.
 	 */
 	prev_groupid = -1;
 	prev_td = NULL;
@@ -52,7 +89,10 @@ void steadystate_setup(void)
 			if (prev_td)
 				steadystate_alloc(prev_td);
 			prev_groupid = td->groupid;
+			ddir_mask = 0;
 		}
+		ddir_mask |= td->ss.ddir_mask;
+		td->ss.ddir_mask = ddir_mask;
 		prev_td = td;
 	} end_for_each();
 
@@ -60,174 +100,256 @@ void steadystate_setup(void)
 		steadystate_alloc(prev_td);
 }
 
-static bool steadystate_slope(uint64_t iops, uint64_t bw,
-			      struct thread_data *td)
+/*
+ * Push sequence number 'seq' onto a monotonic queue after dropping the
+ * entries that left the window and those the new value supersedes. The
+ * front is then the window maximum (is_max) or minimum.
+ */
+static void ss_queue_push(struct steadystate_series *s, unsigned int intervals,
+			  uint64_t *q, unsigned int *first, unsigned int *nr,
+			  uint64_t seq, bool is_max)
 {
-	int i, j;
-	double result;
-	struct steadystate_data *ss = &td->ss;
-	uint64_t new_val;
-	int intervals = ss->dur / (ss_check_interval / 1000L);
+	const uint64_t val = s->data[seq % intervals];
 
-	ss->bw_data[ss->tail] = bw;
-	ss->iops_data[ss->tail] = iops;
+	while (*nr && q[*first] + intervals <= seq) {
+		*first = (*first + 1) % intervals;
+		(*nr)--;
+	}
 
-	if (ss->state & FIO_SS_IOPS)
-		new_val = iops;
-	else
-		new_val = bw;
-
-	if (ss->state & FIO_SS_BUFFER_FULL || ss->tail - ss->head == intervals - 1) {
-		if (!(ss->state & FIO_SS_BUFFER_FULL)) {
-			/* first time through */
-			for (i = 0, ss->sum_y = 0; i < intervals; i++) {
-				if (ss->state & FIO_SS_IOPS)
-					ss->sum_y += ss->iops_data[i];
-				else
-					ss->sum_y += ss->bw_data[i];
-				j = (ss->head + i) % intervals;
-				if (ss->state & FIO_SS_IOPS)
-					ss->sum_xy += i * ss->iops_data[j];
-				else
-					ss->sum_xy += i * ss->bw_data[j];
-			}
-			ss->state |= FIO_SS_BUFFER_FULL;
-		} else {		/* easy to update the sums */
-			ss->sum_y -= ss->oldest_y;
-			ss->sum_y += new_val;
-			ss->sum_xy = ss->sum_xy - ss->sum_y + intervals * new_val;
-		}
+	while (*nr) {
+		uint64_t last = q[(*first + *nr - 1) % intervals];
+		uint64_t v = s->data[last % intervals];
 
-		if (ss->state & FIO_SS_IOPS)
-			ss->oldest_y = ss->iops_data[ss->head];
-		else
-			ss->oldest_y = ss->bw_data[ss->head];
+		if (is_max ? v > val : v < val)
+			break;
+		(*nr)--;
+	}
 
-		/*
-		 * calculate slope as (sum_xy - sum_x * sum_y / n) / (sum_(x^2)
-		 * - (sum_x)^2 / n) This code assumes that all x values are
-		 * equally spaced when they are often off by a few milliseconds.
-		 * This assumption greatly simplifies the calculations.
-		 */
-		ss->slope = (ss->sum_xy - (double) ss->sum_x * ss->sum_y / intervals) /
-				(ss->sum_x_sq - (double) ss->sum_x * ss->sum_x / intervals);
-		if (ss->state & FIO_SS_PCT)
-			ss->criterion = 100.0 * ss->slope / (ss->sum_y / intervals);
-		else
-			ss->criterion = ss->slope;
+	q[(*first + *nr) % intervals] = seq;
+	(*nr)++;
+}
 
-		dprint(FD_STEADYSTATE, "sum_y: %llu, sum_xy: %llu, slope: %f, "
-					"criterion: %f, limit: %f\n",
-					(unsigned long long) ss->sum_y,
-					(unsigned long long) ss->sum_xy,
-					ss->slope, ss->criterion, ss->limit);
+/*
+ * Add the value of check 'seq'. x is the position in the window, oldest
+ * first, so once the window is full every x drops by one when the oldest
+ * value leaves:
+ *
+ *	sum_xy' = sum_xy - (sum_y - y_oldest) + (n - 1) * y_new
+ */
+static void ss_series_add(struct steadystate_series *s, unsigned int intervals,
+			  uint64_t seq, uint64_t val)
+{
+	const unsigned int pos = seq % intervals;
 
-		result = ss->criterion * (ss->criterion < 0.0 ? -1.0 : 1.0);
-		if (result < ss->limit)
-			return true;
-	}
+	if (seq >= intervals) {
+		s->sum_y -= s->data[pos];
+		s->sum_xy = s->sum_xy - s->sum_y + (intervals - 1) * val;
+	} else
+		s->sum_xy += seq * val;
 
-	ss->tail = (ss->tail + 1) % intervals;
-	if (ss->tail <= ss->head)
-		ss->head = (ss->head + 1) % intervals;
+	s->sum_y += val;
+	s->data[pos] = val;
 
-	return false;
+	ss_queue_push(s, intervals, s->minq, &s->min_first, &s->min_nr, seq, false);
+	ss_queue_push(s, intervals, s->maxq, &s->max_first, &s->max_nr, seq, true);
 }
 
-static bool steadystate_deviation(uint64_t iops, uint64_t bw,
-				  struct thread_data *td)
+/*
+ * Work out slope and maximum deviation from the mean of a full window and
+ * return whether the series meets the limit.
+ */
+static bool ss_series_check(struct steadystate_data *ss,
+			    struct steadystate_series *s, const char *name)
 {
-	int i;
-	double diff;
-	double mean;
+	const unsigned int intervals = ss->intervals;
+	double mean, result;
+	uint64_t minv, maxv;
+
+	mean = (double) s->sum_y / intervals;
+
+	/*
+	 * calculate slope as (sum_xy - sum_x * sum_y / n) / (sum_(x^2)
+	 * - (sum_x)^2 / n) This code assumes that all x values are
+	 * equally spaced when they are often off by a few milliseconds.
+	 * This assumption greatly simplifies the calculations.
+	 */
+	s->slope = (s->sum_xy - (double) ss->sum_x * s->sum_y / intervals) /
+			(ss->sum_x_sq - (double) ss->sum_x * ss->sum_x / intervals);
+
+	minv = s->data[s->minq[s->min_first] % intervals];
+	maxv = s->data[s->maxq[s->max_first] % intervals];
+	s->deviation = max(maxv - mean, mean - minv);
+
+	if (ss->state & FIO_SS_SLOPE)
+		s->criterion = s->slope;
+	else
+		s->criterion = s->deviation;
+	if (ss->state & FIO_SS_PCT)
+		s->criterion = 100.0 * s->criterion / mean;
+
+	dprint(FD_STEADYSTATE, "%s: intervals: %u, sum_y: %llu, sum_xy: %llu, "
+				"mean: %f, slope: %f, max diff: %f, "
+				"criterion: %f, limit: %f\n",
+				name, intervals,
+				(unsigned long long) s->sum_y,
+				(unsigned long long) s->sum_xy, mean,
+				s->slope, s->deviation, s->criterion,
+				ss->limit);
+
+	result = s->criterion * (s->criterion < 0.0 ? -1.0 : 1.0);
+	return result < ss->limit;
+}
 
+/*
+ * Add the results of one check interval; iops, bw and lat are indexed by
+ * data direction with the total at SS_SERIES_TOTAL. Returns true if steady
+ * state was attained.
+ */
+static bool steadystate_add(struct thread_data *td, uint64_t *iops,
+			    uint64_t *bw, uint64_t *lat)
+{
 	struct steadystate_data *ss = &td->ss;
-	int intervals = ss->dur / (ss_check_interval / 1000L);
-
-	ss->bw_data[ss->tail] = bw;
-	ss->iops_data[ss->tail] = iops;
-
-	if (ss->state & FIO_SS_BUFFER_FULL || ss->tail - ss->head == intervals  - 1) {
-		if (!(ss->state & FIO_SS_BUFFER_FULL)) {
-			/* first time through */
-			for (i = 0, ss->sum_y = 0; i < intervals; i++) {
-				if (ss->state & FIO_SS_IOPS)
-					ss->sum_y += ss->iops_data[i];
-				else
-					ss->sum_y += ss->bw_data[i];
-			}
-			ss->state |= FIO_SS_BUFFER_FULL;
-		} else {		/* easy to update the sum */
-			ss->sum_y -= ss->oldest_y;
-			if (ss->state & FIO_SS_IOPS)
-				ss->sum_y += ss->iops_data[ss->tail];
-			else
-				ss->sum_y += ss->bw_data[ss->tail];
-		}
+	bool attained, ddir_attained = true;
+	int i;
 
-		if (ss->state & FIO_SS_IOPS)
-			ss->oldest_y = ss->iops_data[ss->head];
-		else
-			ss->oldest_y = ss->bw_data[ss->head];
+	ss->bw_data[ss->tail] = bw[SS_SERIES_TOTAL];
+	ss->iops_data[ss->tail] = iops[SS_SERIES_TOTAL];
 
-		mean = (double) ss->sum_y / intervals;
-		ss->deviation = 0.0;
+	for (i = 0; i <= SS_SERIES_TOTAL; i++) {
+		uint64_t val;
 
-		for (i = 0; i < intervals; i++) {
-			if (ss->state & FIO_SS_IOPS)
-				diff = ss->iops_data[i] - mean;
-			else
-				diff = ss->bw_data[i] - mean;
-			ss->deviation = max(ss->deviation, diff * (diff < 0.0 ? -1.0 : 1.0));
-		}
+		if (!ss->series[i].data)
+			continue;
 
-		if (ss->state & FIO_SS_PCT)
-			ss->criterion = 100.0 * ss->deviation / mean;
+		if (ss->state & FIO_SS_LAT)
+			val = lat[i];
+		else if (ss->state & FIO_SS_IOPS)
+			val = iops[i];
 		else
-			ss->criterion = ss->deviation;
+			val = bw[i];
+
+		ss_series_add(&ss->series[i], ss->intervals, ss->samples, val);
+	}
+
+	if (++ss->samples >= ss->intervals) {
+		ss->state |= FIO_SS_BUFFER_FULL;
+
+		for (i = 0; i < DDIR_RWDIR_CNT; i++) {
+			if (!ss->series[i].data)
+				continue;
+			if (!ss_series_check(ss, &ss->series[i], io_ddir_name(i)))
+				ddir_attained = false;
+		}
 
-		dprint(FD_STEADYSTATE, "intervals: %d, sum_y: %llu, mean: %f, max diff: %f, "
-					"objective: %f, limit: %f\n",
-					intervals,
-					(unsigned long long) ss->sum_y, mean,
-					ss->deviation, ss->criterion, ss->limit);
+		attained = ss_series_check(ss, &ss->series[SS_SERIES_TOTAL], "total");
+		ss->slope = ss->series[SS_SERIES_TOTAL].slope;
+		ss->deviation = ss->series[SS_SERIES_TOTAL].deviation;
+		ss->criterion = ss->series[SS_SERIES_TOTAL].criterion;
 
-		if (ss->criterion < ss->limit)
+		/* with per direction criteria, every direction must meet it */
+		if ((ss->state & FIO_SS_DDIR) && ss->ddir_mask)
+			attained = ddir_attained;
+		if (attained)
 			return true;
 	}
 
-	ss->tail = (ss->tail + 1) % intervals;
+	ss->tail = (ss->tail + 1) % ss->intervals;
 	if (ss->tail == ss->head)
-		ss->head = (ss->head + 1) % intervals;
+		ss->head = (ss->head + 1) % ss->intervals;
 
 	return false;
 }
 
+/*
+ * Add the latency histogram entries since the previous check to the group
+ * sums. A sample count that went backwards means the stats were reset.
+ */
+static void ss_add_plat(struct thread_data *td, bool ramp_over)
+{
+	uint64_t *prev = td->ss.prev_plat;
+	int ddir, i;
+
+	for (ddir = 0; ddir < DDIR_RWDIR_CNT; ddir++) {
+		uint64_t *cur = td->ts.io_u_plat[FIO_CLAT][ddir];
+
+		for (i = 0; i < FIO_IO_U_PLAT_NR; i++, prev++) {
+			uint64_t val = cur[i];
+
+			if (ramp_over)
+				ss_group_plat[ddir][i] += val >= *prev ? val - *prev : val;
+			*prev = val;
+		}
+	}
+}
+
+static uint64_t ss_plat_percentile(uint64_t *plat, double percentile)
+{
+	unsigned long long *ovals = NULL, minv, maxv, nr = 0, val = 0;
+	fio_fp64_t plist[2];
+	int i;
+
+	for (i = 0; i < FIO_IO_U_PLAT_NR; i++)
+		nr += plat[i];
+	if (!nr)
+		return 0;
+
+	memset(plist, 0, sizeof(plist));
+	plist[0].u.f = percentile;
+	if (calc_clat_percentiles(plat, nr, plist, &ovals, &maxv, &minv))
+		val = ovals[0];
+
+	free(ovals);
+	return val;
+}
+
+static void ss_group_lat(struct steadystate_data *ss, uint64_t *lat)
+{
+	static uint64_t total[FIO_IO_U_PLAT_NR];
+	int ddir, i;
+
+	memset(total, 0, sizeof(total));
+	for (ddir = 0; ddir < DDIR_RWDIR_CNT; ddir++) {
+		lat[ddir] = ss_plat_percentile(ss_group_plat[ddir],
+						ss->percentile);
+		for (i = 0; i < FIO_IO_U_PLAT_NR; i++)
+			total[i] += ss_group_plat[ddir][i];
+	}
+	lat[SS_SERIES_TOTAL] = ss_plat_percentile(total, ss->percentile);
+}
+
+static inline uint64_t ss_rate(unsigned long rate_time, uint64_t delta)
+{
+	return rate_time * delta /
+		(ss_check_interval * ss_check_interval / 1000L);
+}
+
 int steadystate_check(void)
 {
 	int  ddir, prev_groupid, group_ramp_time_over = 0;
 	unsigned long rate_time;
 	struct timespec now;
-	uint64_t group_bw = 0, group_iops = 0;
-	uint64_t td_iops, td_bytes;
+	uint64_t group_bw[SS_SERIES_TOTAL + 1], group_iops[SS_SERIES_TOTAL + 1];
+	uint64_t group_lat[SS_SERIES_TOTAL + 1] = { 0, };
+	uint64_t td_iops[DDIR_RWDIR_CNT], td_bytes[DDIR_RWDIR_CNT];
 	bool ret;
 
 	prev_groupid = -1;
 	for_each_td(td) {
 		const bool needs_lock = td_async_processing(td);
 		struct steadystate_data *ss = &td->ss;
+		bool ramp_over;
 
 		if (!ss->dur || td->runstate <= TD_SETTING_UP ||
 		    td->runstate >= TD_EXITED || !ss->state ||
 		    ss->state & FIO_SS_ATTAINED)
 			continue;
 
-		td_iops = 0;
-		td_bytes = 0;
 		if (!td->o.group_reporting ||
 		    (td->o.group_reporting && td->groupid != prev_groupid)) {
-			group_bw = 0;
-			group_iops = 0;
+			memset(group_bw, 0, sizeof(group_bw));
+			memset(group_iops, 0, sizeof(group_iops));
+			if (ss->state & FIO_SS_LAT)
+				memset(ss_group_plat, 0, sizeof(ss_group_plat));
 			group_ramp_time_over = 0;
 		}
 		prev_groupid = td->groupid;
@@ -241,14 +363,17 @@ int steadystate_check(void)
 			if (utime_since(&td->epoch, &now) >= (ss->ramp_time + ss_check_interval * 1000L))
 				ss->state |= FIO_SS_RAMP_OVER;
 		}
+		ramp_over = (ss->state & FIO_SS_RAMP_OVER) != 0;
 
 		if (needs_lock)
 			__td_io_u_lock(td);
 
 		for (ddir = 0; ddir < DDIR_RWDIR_CNT; ddir++) {
-			td_iops += td->io_blocks[ddir];
-			td_bytes += td->io_bytes[ddir];
+			td_iops[ddir] = td->io_blocks[ddir];
+			td_bytes[ddir] = td->io_bytes[ddir];
 		}
+		if (ss->state & FIO_SS_LAT)
+			ss_add_plat(td, ramp_over);
 
 		if (needs_lock)
 			__td_io_u_unlock(td);
@@ -256,15 +381,22 @@ int steadystate_check(void)
 		rate_time = mtime_since(&ss->prev_time, &now);
 		memcpy(&ss->prev_time, &now, sizeof(now));
 
-		if (ss->state & FIO_SS_RAMP_OVER) {
-			group_bw += rate_time * (td_bytes - ss->prev_bytes) /
-				(ss_check_interval * ss_check_interval / 1000L);
-			group_iops += rate_time * (td_iops - ss->prev_iops) /
-				(ss_check_interval * ss_check_interval / 1000L);
-			++group_ramp_time_over;
+		for (ddir = 0; ddir < DDIR_RWDIR_CNT; ddir++) {
+			if (ramp_over) {
+				uint64_t bw, iops;
+
+				bw = ss_rate(rate_time, td_bytes[ddir] - ss->prev_bytes[ddir]);
+				iops = ss_rate(rate_time, td_iops[ddir] - ss->prev_iops[ddir]);
+				group_bw[ddir] += bw;
+				group_iops[ddir] += iops;
+				group_bw[SS_SERIES_TOTAL] += bw;
+				group_iops[SS_SERIES_TOTAL] += iops;
+			}
+			ss->prev_iops[ddir] = td_iops[ddir];
+			ss->prev_bytes[ddir] = td_bytes[ddir];
 		}
-		ss->prev_iops = td_iops;
-		ss->prev_bytes = td_bytes;
+		if (ramp_over)
+			++group_ramp_time_over;
 
 		if (td->o.group_reporting && !(ss->state & FIO_SS_DATA))
 			continue;
@@ -276,19 +408,21 @@ int steadystate_check(void)
 		if (!group_ramp_time_over)
 			continue;
 
+		if (ss->state & FIO_SS_LAT)
+			ss_group_lat(ss, group_lat);
+
 		dprint(FD_STEADYSTATE, "steadystate_check() thread: %d, "
 					"groupid: %u, rate_msec: %ld, "
-					"iops: %llu, bw: %llu, head: %d, tail: %d\n",
+					"iops: %llu, bw: %llu, lat: %llu, "
+					"head: %d, tail: %d\n",
 					__td_index, td->groupid, rate_time,
-					(unsigned long long) group_iops,
-					(unsigned long long) group_bw,
+					(unsigned long long) group_iops[SS_SERIES_TOTAL],
+					(unsigned long long) group_bw[SS_SERIES_TOTAL],
+					(ss->state & FIO_SS_LAT) ?
+					   (unsigned long long) group_lat[SS_SERIES_TOTAL] : 0ULL,
 					ss->head, ss->tail);
 
-		if (ss->state & FIO_SS_SLOPE)
-			ret = steadystate_slope(group_iops, group_bw, td);
-		else
-			ret = steadystate_deviation(group_iops, group_bw, td);
-
+		ret = steadystate_add(td, group_iops, group_bw, group_lat);
 		if (ret) {
 			if (td->o.group_reporting) {
 				for_each_td(td2) {
@@ -321,16 +455,36 @@ int td_steadystate_init(struct thread_data *td)
 		/* put all steady state info in one place */
 		ss->dur = o->ss_dur;
 		ss->limit = o->ss_limit.u.f;
+		ss->percentile = o->ss_percentile.u.f;
 		ss->ramp_time = o->ss_ramp_time;
 		ss_check_interval = o->ss_check_interval / 1000L;
 
 		ss->state = o->ss_state;
 		if (!td->ss.ramp_time)
 			ss->state |= FIO_SS_RAMP_OVER;
+		if (o->ss_per_ddir)
+			ss->state |= FIO_SS_DDIR;
+
+		if (td_read(td))
+			ss->ddir_mask |= 1U << DDIR_READ;
+		if (td_write(td))
+			ss->ddir_mask |= 1U << DDIR_WRITE;
+		if (td_trim(td))
+			ss->ddir_mask |= 1U << DDIR_TRIM;
 
 		intervals = ss->dur / (ss_check_interval / 1000L);
+		ss->intervals = intervals;
 		ss->sum_x = intervals * (intervals - 1) / 2;
 		ss->sum_x_sq = (intervals - 1) * (intervals) * (2*intervals - 1) / 6;
+
+		if (ss->state & FIO_SS_LAT) {
+			if (!o->clat_percentiles || o->disable_clat) {
+				td_verror(td, EINVAL, "job rejected: latency steadystate needs clat_percentiles");
+				return 1;
+			}
+			ss->prev_plat = calloc(DDIR_RWDIR_CNT * FIO_IO_U_PLAT_NR,
+						sizeof(uint64_t));
+		}
 	}
 
 	/* make sure that ss options are consistent within reporting group */
@@ -340,6 +494,7 @@ int td_steadystate_init(struct thread_data *td)
 
 			if (ss2->dur != ss->dur ||
 			    ss2->limit != ss->limit ||
+			    ss2->percentile != ss->percentile ||
 			    ss2->ramp_time != ss->ramp_time ||
 			    ss2->state != ss->state ||
 			    ss2->sum_x != ss->sum_x ||
@@ -353,6 +508,15 @@ int td_steadystate_init(struct thread_data *td)
 	return 0;
 }
 
+const char *steadystate_name(uint32_t state)
+{
+	if (state & FIO_SS_LAT)
+		return "lat";
+	if (state & FIO_SS_IOPS)
+		return "iops";
+	return "bw";
+}
+
 uint64_t steadystate_bw_mean(struct thread_stat *ts)
 {
 	int i;
@@ -9,16 +9,43 @@ extern void steadystate_setup(void);
 extern int td_steadystate_init(struct thread_data *);
 extern uint64_t steadystate_bw_mean(struct thread_stat *);
 extern uint64_t steadystate_iops_mean(struct thread_stat *);
+extern const char *steadystate_name(uint32_t);
 
 extern bool steadystate_enabled;
 extern unsigned int ss_check_interval;
 
+/*
+ * One tracked series: the last 'intervals' values with running sums for
+ * the least squares slope, and sequence numbers of the window minimum and
+ * maximum candidates for the deviation. Every check is O(1) amortized.
+ */
+struct steadystate_series {
+	uint64_t *data;
+	uint64_t *minq;
+	uint64_t *maxq;
+	unsigned int min_first, min_nr;
+	unsigned int max_first, max_nr;
+
+	uint64_t sum_y;
+	uint64_t sum_xy;
+
+	double slope;
+	double deviation;
+	double criterion;
+};
+
+/* series[DDIR_READ..DDIR_TRIM] are per direction, this one is the total */
+#define SS_SERIES_TOTAL	DDIR_RWDIR_CNT
+
 struct steadystate_data {
 	double limit;
+	double percentile;
 	unsigned long long dur;
 	unsigned long long ramp_time;
 
 	uint32_t state;
+	unsigned int intervals;
+	unsigned int ddir_mask;
 
 	unsigned int head;
 	unsigned int tail;
@@ -29,15 +56,15 @@ struct steadystate_data {
 	double deviation;
 	double criterion;
 
-	uint64_t sum_y;
 	uint64_t sum_x;
 	uint64_t sum_x_sq;
-	uint64_t sum_xy;
-	uint64_t oldest_y;
+	uint64_t samples;
+	struct steadystate_series series[DDIR_RWDIR_CNT + 1];
 
 	struct timespec prev_time;
-	uint64_t prev_iops;
-	uint64_t prev_bytes;
+	uint64_t prev_iops[DDIR_RWDIR_CNT];
+	uint64_t prev_bytes[DDIR_RWDIR_CNT];
+	uint64_t *prev_plat;
 };
 
 enum {
@@ -49,6 +76,8 @@ enum {
 	__FIO_SS_DATA,
 	__FIO_SS_PCT,
 	__FIO_SS_BUFFER_FULL,
+	__FIO_SS_LAT,
+	__FIO_SS_DDIR,
 };
 
 enum {
@@ -60,9 +89,12 @@ enum {
 	FIO_SS_DATA		= 1 << __FIO_SS_DATA,
 	FIO_SS_PCT		= 1 << __FIO_SS_PCT,
 	FIO_SS_BUFFER_FULL	= 1 << __FIO_SS_BUFFER_FULL,
+	FIO_SS_LAT		= 1 << __FIO_SS_LAT,
+	FIO_SS_DDIR		= 1 << __FIO_SS_DDIR,
 
 	FIO_SS_IOPS_SLOPE	= FIO_SS_IOPS | FIO_SS_SLOPE,
 	FIO_SS_BW_SLOPE		= FIO_SS_BW | FIO_SS_SLOPE,
+	FIO_SS_LAT_SLOPE	= FIO_SS_LAT | FIO_SS_SLOPE,
 };
 
 #endif
@@ -0,0 +1,339 @@
+/*
+ * Parameter sweeps, see sweep.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fio.h"
+#include "sweep.h"
+#include "options.h"
+#include "json.h"
+#include "lib/pow2.h"
+
+void sweep_free(struct sweep *s)
+{
+	unsigned int i, j;
+
+	if (!s)
+		return;
+
+	for (i = 0; i < s->nr_params; i++) {
+		struct sweep_param *p = &s->params[i];
+
+		for (j = 0; j < p->nr; j++)
+			free(p->vals[j]);
+		free(p->vals);
+		free(p->name);
+	}
+	free(s->params);
+	free(s);
+}
+
+static int sweep_parse_param(struct sweep_param *p, char *str)
+{
+	char *val, *v;
+
+	val = strchr(str, '=');
+	if (!val || val == str || !val[1]) {
+		log_err("fio: sweep: expected param=v1:v2..., got <%s>\n", str);
+		return 1;
+	}
+	*val++ = '\0';
+
+	p->name = strdup(str);
+	if (!strcmp(p->name, "sweep")) {
+		log_err("fio: sweep: can't sweep sweep\n");
+		return 1;
+	}
+
+	while ((v = strsep(&val, ":")) != NULL) {
+		if (!*v) {
+			log_err("fio: sweep: empty value for %s\n", p->name);
+			return 1;
+		}
+		p->vals = realloc(p->vals, (p->nr + 1) * sizeof(char *));
+		p->vals[p->nr++] = strdup(v);
+	}
+
+	return 0;
+}
+
+/*
+ * Parse a sweep= value. Returns NULL with the error logged if it's bad.
+ */
+struct sweep *sweep_parse(const char *spec)
+{
+	char *str, *p, *tok;
+	struct sweep *s;
+
+	s = calloc(1, sizeof(*s));
+	str = p = strdup(spec);
+	s->nr_points = 1;
+
+	while ((tok = strsep(&p, ",")) != NULL) {
+		struct sweep_param *sp;
+
+		if (!*tok)
+			continue;
+
+		s->params = realloc(s->params,
+				    (s->nr_params + 1) * sizeof(*s->params));
+		sp = &s->params[s->nr_params++];
+		memset(sp, 0, sizeof(*sp));
+		if (sweep_parse_param(sp, tok))
+			goto err;
+
+		s->nr_points *= sp->nr;
+		if (s->nr_points > 65536) {
+			log_err("fio: sweep: too many points\n");
+			goto err;
+		}
+	}
+
+	if (!s->nr_params) {
+		log_err("fio: sweep: no parameters given\n");
+		goto err;
+	}
+
+	free(str);
+	return s;
+err:
+	free(str);
+	sweep_free(s);
+	return NULL;
+}
+
+/*
+ * Set the options of 'point' on td. The first parameter varies slowest.
+ */
+int sweep_apply(struct thread_data *td, const struct sweep *s,
+		unsigned int point)
+{
+	unsigned int i, idx, stride = s->nr_points;
+	size_t len = 0;
+
+	td->sweep_desc[0] = '\0';
+
+	for (i = 0; i < s->nr_params; i++) {
+		const struct sweep_param *p = &s->params[i];
+		char *val;
+		int ret;
+
+		stride /= p->nr;
+		idx = (point / stride) % p->nr;
+
+		val = strdup(p->vals[idx]);
+		ret = fio_cmd_option_parse(td, p->name, val);
+		free(val);
+		if (ret) {
+			log_err("fio: sweep: bad point %s=%s\n", p->name,
+				p->vals[idx]);
+			return 1;
+		}
+		fio_dump_list_dedup(&td->opt_list, p->name);
+
+		if (len < sizeof(td->sweep_desc))
+			len += snprintf(td->sweep_desc + len,
+					sizeof(td->sweep_desc) - len, "%s%s=%s",
+					i ? "," : "", p->name, p->vals[idx]);
+	}
+
+	if (!td->o.description)
+		td->o.description = strdup(td->sweep_desc);
+
+	td->sweep_point = point + 1;
+	return 0;
+}
+
+static struct thread_data *sweep_td(struct thread_stat *ts)
+{
+	for_each_td(td) {
+		if (td->thread_number == ts->thread_number)
+			return td->sweep_point ? td : NULL;
+	} end_for_each();
+
+	return NULL;
+}
+
+static const double sweep_pcts[] = { 50.0, 99.0, 99.9 };
+
+/*
+ * Completion latency percentiles of ts in ddir, or lat if the job
+ * reports those. Returns false if there are none.
+ */
+static bool sweep_pct(struct thread_stat *ts, enum fio_ddir ddir,
+		      unsigned long long *vals)
+{
+	fio_fp64_t plist[FIO_IO_U_LIST_MAX_LEN];
+	unsigned long long *ovals = NULL, min, max;
+	struct io_stat *stat;
+	uint64_t *plat;
+	unsigned int i, len;
+
+	if (ts->lat_percentiles) {
+		plat = ts->io_u_plat[FIO_LAT][ddir];
+		stat = &ts->lat_stat[ddir];
+	} else if (ts->clat_percentiles) {
+		plat = ts->io_u_plat[FIO_CLAT][ddir];
+		stat = &ts->clat_stat[ddir];
+	} else
+		return false;
+
+	if (!stat->samples)
+		return false;
+
+	memset(plist, 0, sizeof(plist));
+	for (i = 0; i < FIO_ARRAY_SIZE(sweep_pcts); i++)
+		plist[i].u.f = sweep_pcts[i];
+
+	len = calc_clat_percentiles(plat, stat->samples, plist, &ovals, &max,
+				    &min);
+	if (len != FIO_ARRAY_SIZE(sweep_pcts)) {
+		free(ovals);
+		return false;
+	}
+
+	memcpy(vals, ovals, len * sizeof(*vals));
+	free(ovals);
+	return true;
+}
+
+static void sweep_ddir_json(struct json_object *parent,
+			    struct thread_stat *ts, enum fio_ddir ddir)
+{
+	unsigned long long runt = ts->runtime[ddir];
+	unsigned long long vals[FIO_ARRAY_SIZE(sweep_pcts)];
+	struct json_object *obj, *pct;
+	char name[32];
+	unsigned int i;
+
+	obj = json_create_object();
+	json_object_add_value_object(parent, io_ddir_name(ddir), obj);
+	json_object_add_value_float(obj, "iops",
+		(double) ts->total_io_u[ddir] * 1000.0 / runt);
+	json_object_add_value_int(obj, "bw_bytes",
+		ts->io_bytes[ddir] * 1000 / runt);
+
+	if (!sweep_pct(ts, ddir, vals))
+		return;
+
+	pct = json_create_object();
+	json_object_add_value_object(obj, ts->lat_percentiles ?
+				     "lat_ns" : "clat_ns", pct);
+	for (i = 0; i < FIO_ARRAY_SIZE(sweep_pcts); i++) {
+		snprintf(name, sizeof(name), "%f", sweep_pcts[i]);
+		json_object_add_value_int(pct, name, vals[i]);
+	}
+}
+
+/*
+ * Add a "sweep" array with a row per point to root, if any job swept.
+ * Only the backend has the jobs around, clients don't get these.
+ */
+void sweep_json(struct json_object *root, struct thread_stat *threadstats,
+		int nr_ts)
+{
+	struct json_array *array = NULL;
+	int i;
+
+	for (i = 0; i < nr_ts; i++) {
+		struct thread_stat *ts = &threadstats[i];
+		struct json_object *obj, *params;
+		struct thread_data *td;
+		char *desc, *p, *tok;
+
+		td = sweep_td(ts);
+		if (!td)
+			continue;
+
+		if (!array) {
+			array = json_create_array();
+			json_object_add_value_array(root, "sweep", array);
+		}
+
+		obj = json_create_object();
+		json_array_add_value_object(array, obj);
+		json_object_add_value_string(obj, "jobname", ts->name);
+		json_object_add_value_int(obj, "groupid", ts->groupid);
+		json_object_add_value_int(obj, "point", td->sweep_point);
+
+		params = json_create_object();
+		json_object_add_value_object(obj, "params", params);
+		desc = p = strdup(td->sweep_desc);
+		while ((tok = strsep(&p, ",")) != NULL) {
+			char *val = strchr(tok, '=');
+
+			if (!val)
+				continue;
+			*val++ = '\0';
+			json_object_add_value_string(params, tok, val);
+		}
+		free(desc);
+
+		for_each_rw_ddir(ddir) {
+			if (ts->runtime[ddir] && ts->total_io_u[ddir])
+				sweep_ddir_json(obj, ts, ddir);
+		}
+
+		if (ts->ss_dur)
+			json_object_add_value_int(obj, "steadystate",
+				!!(ts->ss_state & FIO_SS_ATTAINED));
+	}
+}
+
+/*
+ * One line per point and data direction, after the group stats
+ */
+void sweep_show(struct thread_stat *threadstats, int nr_ts,
+		struct buf_output *out)
+{
+	bool header = false;
+	int i;
+
+	for (i = 0; i < nr_ts; i++) {
+		struct thread_stat *ts = &threadstats[i];
+		struct thread_data *td;
+		int i2p;
+
+		td = sweep_td(ts);
+		if (!td)
+			continue;
+
+		if (!header) {
+			log_buf(out, "\nSweep:\n");
+			header = true;
+		}
+
+		i2p = is_power_of_2(ts->kb_base);
+		for_each_rw_ddir(ddir) {
+			unsigned long long vals[FIO_ARRAY_SIZE(sweep_pcts)];
+			unsigned long long runt = ts->runtime[ddir];
+			char *iops_p, *bw_p;
+
+			if (!runt || !ts->total_io_u[ddir])
+				continue;
+
+			iops_p = num2str(ts->total_io_u[ddir] * 1000 / runt,
+					 ts->sig_figs, 1, 0, N2S_NONE);
+			bw_p = num2str(ts->io_bytes[ddir] * 1000 / runt,
+				       ts->sig_figs, 1, i2p, ts->unit_base);
+			log_buf(out, "  %s [%s] %s: IOPS=%s, BW=%s", ts->name,
+				td->sweep_desc, io_ddir_name(ddir), iops_p,
+				bw_p);
+			if (sweep_pct(ts, ddir, vals))
+				log_buf(out, ", %s p50/p99/p99.9=%llu/%llu/%lluus",
+					ts->lat_percentiles ? "lat" : "clat",
+					vals[0] / 1000, vals[1] / 1000,
+					vals[2] / 1000);
+			if (ts->ss_dur)
+				log_buf(out, ", steady=%s",
+					ts->ss_state & FIO_SS_ATTAINED ?
+					"yes" : "no");
+			log_buf(out, "\n");
+
+			free(iops_p);
+			free(bw_p);
+		}
+	}
+}
@@ -0,0 +1,35 @@
+#ifndef FIO_SWEEP_H
+#define FIO_SWEEP_H
+
+struct thread_data;
+struct thread_stat;
+struct json_object;
+struct buf_output;
+
+/*
+ * sweep=param=v1:v2[:...][,param=v1:v2...] runs a job once per combination
+ * of the listed values, the first parameter varying slowest. Each point is
+ * a job of its own, cloned from the parsed options of the section and
+ * stonewalled after the one before it, so it reports in a group of its own.
+ * The points use the files of the first one, so only that lays them out.
+ */
+struct sweep_param {
+	char *name;
+	char **vals;
+	unsigned int nr;
+};
+
+struct sweep {
+	struct sweep_param *params;
+	unsigned int nr_params;
+	unsigned int nr_points;
+};
+
+extern struct sweep *sweep_parse(const char *);
+extern void sweep_free(struct sweep *);
+extern int sweep_apply(struct thread_data *, const struct sweep *,
+		       unsigned int);
+extern void sweep_json(struct json_object *, struct thread_stat *, int);
+extern void sweep_show(struct thread_stat *, int, struct buf_output *);
+
+#endif
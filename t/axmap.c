@@ -393,6 +393,110 @@ static int test_overlap(void)
 	return err;
 }
 
+/*
+ * Fill the map, clear every third bit and check that next_set skips exactly
+ * the cleared ones, and that a cleared bit in a full map is free again.
+ */
+static int test_clear(uint64_t size, int seed)
+{
+	struct fio_lfsr lfsr;
+	struct axmap *map;
+	uint64_t i, val, nr;
+	int err = 0;
+
+	printf("Test clear/next_set %llu entries...", (unsigned long long) size);
+	fflush(stdout);
+
+	map = axmap_new(size);
+
+	if (axmap_next_set(map, 0) != -1ULL) {
+		printf("next_set on empty map\n");
+		err = 1;
+		goto out;
+	}
+
+	lfsr_init(&lfsr, size, seed, seed & 0xF);
+	for (i = 0; i < size; i++) {
+		if (lfsr_next(&lfsr, &val)) {
+			printf("lfsr: short loop\n");
+			err = 1;
+			goto out;
+		}
+		axmap_set(map, val);
+	}
+
+	for (i = 0; i < size; i += 3)
+		axmap_clear(map, i);
+
+	if (axmap_next_free(map, size - 1) != 0) {
+		printf("cleared bit 0 not free\n");
+		err = 1;
+		goto out;
+	}
+
+	nr = 0;
+	val = axmap_next_set(map, 0);
+	for (i = 0; i < size; i++) {
+		if (!(i % 3)) {
+			if (axmap_isset(map, i)) {
+				printf("bit %llu still set\n", (unsigned long long) i);
+				err = 1;
+				goto out;
+			}
+			continue;
+		}
+		if (val != i) {
+			printf("next_set: expected %llu, got %llu\n",
+				(unsigned long long) i, (unsigned long long) val);
+			err = 1;
+			goto out;
+		}
+		nr++;
+		val = axmap_next_set(map, val + 1);
+	}
+
+	if (val != -1ULL || nr != size - (size + 2) / 3) {
+		printf("next_set: %llu bits found\n", (unsigned long long) nr);
+		err = 1;
+		goto out;
+	}
+
+	printf("pass!\n");
+out:
+	axmap_free(map);
+	return err;
+}
+
+/*
+ * With every bit set, the search must not descend from the unused trailing
+ * bits of an upper level into words past the end of the level below
+ */
+static int test_full(uint64_t size)
+{
+	struct axmap *map;
+	uint64_t i;
+	int err = 0;
+
+	printf("Test full %llu entries...", (unsigned long long) size);
+	fflush(stdout);
+
+	map = axmap_new(size);
+	for (i = 0; i < size; i++)
+		axmap_set(map, i);
+
+	for (i = 1; i <= 64 && i <= size; i++) {
+		if (check_next_free(map, size - i, -1ULL)) {
+			err = 1;
+			goto out;
+		}
+	}
+
+	printf("pass!\n");
+out:
+	axmap_free(map);
+	return err;
+}
+
 int main(int argc, char *argv[])
 {
 	uint64_t size = (1ULL << 23) - 200;
@@ -423,5 +527,12 @@ int main(int argc, char *argv[])
 	if (test_next_free(((((64*64)-63)*64)-63)*64*12, seed))
 		return 7;
 
+	if (test_clear(size, seed))
+		return 8;
+	if (test_clear(64*64*64, seed))
+		return 9;
+	if (test_full(65*64))
+		return 10;
+
 	return 0;
 }
@@ -12,6 +12,7 @@
 #include "../os/os.h"
 #include "../log.h"
 #include "../minmax.h"
+#include "../lib/fls.h"
 #include "../oslib/linux-dev-lookup.h"
 
 #define TRACE_FIFO_SIZE	8192
@@ -21,6 +22,8 @@ static unsigned int ios_threshold = 10;
 static unsigned int rate_threshold;
 static unsigned int set_rate;
 static unsigned int max_depth = 256;
+static unsigned int zoned = 1;
+static uint64_t phase_nsec;
 static int output_ascii = 1;
 static char *filename;
 
@@ -34,6 +37,33 @@ static unsigned int collapse_entries = 0;
 static unsigned int depth_diff = 1;
 static unsigned int random_diff = 5;
 
+/*
+ * Offset heat: random IOs are counted in HEAT_BINS bins per data direction,
+ * 1MiB each to start with. A bin doubles in size when an IO lands past
+ * the last one, so the map covers any device in constant space.
+ */
+#define HEAT_BINS	64
+#define HEAT_MIN_SHIFT	11
+
+/*
+ * Adjacent bins go in the same zone while their counts stay within this
+ * factor of the zone's average
+ */
+#define HEAT_ZONE_RATIO	2.0
+
+/*
+ * Time spent at each queue depth, in power of 2 buckets
+ */
+#define DEPTH_BUCKETS	10
+
+/*
+ * A window starts a new phase if its IOPS differ by more than this
+ * factor from the phase so far, or its read or sequential percentage
+ * by more than this many points.
+ */
+#define PHASE_RATE_RATIO	2.0
+#define PHASE_PERC_DIFF		20.0
+
 struct bs {
 	unsigned int bs;
 	unsigned int nr;
@@ -45,6 +75,16 @@ struct trace_file {
 	int major, minor;
 };
 
+/*
+ * Inter-arrival times of queued IOs in usec, running mean and variance
+ */
+struct arrivals {
+	uint64_t last;
+	uint64_t nr;
+	double mean;
+	double m2;
+};
+
 struct btrace_out {
 	unsigned long ios[DDIR_RWDIR_CNT];
 	unsigned long merges[DDIR_RWDIR_CNT];
@@ -65,6 +105,24 @@ struct btrace_out {
 	uint64_t kib[DDIR_RWDIR_CNT];
 
 	uint64_t start_delay;
+
+	unsigned long heat[DDIR_RWDIR_CNT][HEAT_BINS];
+	unsigned int heat_shift;
+	unsigned int heat_nr;
+
+	uint64_t depth_time[DEPTH_BUCKETS];
+	uint64_t depth_ttime;
+
+	struct arrivals arr;
+};
+
+struct btrace_phase {
+	uint64_t start, end, last;
+	unsigned long ios[DDIR_RWDIR_CNT];
+	uint64_t seq[DDIR_RWDIR_CNT];
+	uint64_t kib[DDIR_RWDIR_CNT];
+	unsigned int depth;
+	struct arrivals arr;
 };
 
 struct btrace_pid {
@@ -82,6 +140,12 @@ struct btrace_pid {
 	int ignore;
 
 	struct btrace_out o;
+
+	/* current window, the phase it may belong to, and finished phases */
+	struct btrace_phase win;
+	struct btrace_phase cur;
+	struct btrace_phase *phases;
+	unsigned int nr_phases;
 };
 
 struct inflight {
@@ -101,6 +165,21 @@ static FLIST_HEAD(pid_list);
 static struct flist_head inflight_hash[INFLIGHT_HASH_SIZE];
 
 static uint64_t first_ttime = -1ULL;
+static uint64_t cur_ttime;
+
+/*
+ * Charge the time since the last queue depth change to the current depth
+ */
+static void depth_account(struct btrace_out *o)
+{
+	unsigned int b;
+
+	if (o->inflight > 0 && cur_ttime > o->depth_ttime) {
+		b = min(__fls(o->inflight) - 1, DEPTH_BUCKETS - 1);
+		o->depth_time[b] += cur_ttime - o->depth_ttime;
+	}
+	o->depth_ttime = cur_ttime;
+}
 
 static struct inflight *inflight_find(uint64_t sector)
 {
@@ -123,6 +202,7 @@ static void inflight_remove(struct inflight *i)
 {
 	struct btrace_out *o = &i->p->o;
 
+	depth_account(o);
 	o->inflight--;
 	assert(o->inflight >= 0);
 	flist_del(&i->list);
@@ -144,6 +224,7 @@ static void inflight_add(struct btrace_pid *p, uint64_t sector, uint32_t len)
 
 	i = calloc(1, sizeof(*i));
 	i->p = p;
+	depth_account(o);
 	o->inflight++;
 	if (!o->depth_disabled) {
 		o->depth = max((int) o->depth, o->inflight);
@@ -323,6 +404,190 @@ static int t_to_rwdir(struct blk_io_trace *t)
 	return (t->action & BLK_TC_ACT(BLK_TC_WRITE)) != 0;
 }
 
+/*
+ * Double the size of the heat bins
+ */
+static void heat_coarsen(struct btrace_out *o)
+{
+	int i, j;
+
+	for (i = 0; i < DDIR_RWDIR_CNT; i++) {
+		for (j = 0; j < HEAT_BINS / 2; j++)
+			o->heat[i][j] = o->heat[i][2 * j] + o->heat[i][2 * j + 1];
+		for (; j < HEAT_BINS; j++)
+			o->heat[i][j] = 0;
+	}
+
+	o->heat_shift++;
+	o->heat_nr = (o->heat_nr + 1) / 2;
+}
+
+static void heat_add(struct btrace_out *o, int rw, uint64_t sector,
+		     uint32_t bytes)
+{
+	uint64_t last = sector + (bytes >> 9);
+
+	if (last > sector)
+		last--;
+	while ((last >> o->heat_shift) >= HEAT_BINS)
+		heat_coarsen(o);
+
+	o->heat[rw][sector >> o->heat_shift]++;
+	o->heat_nr = max(o->heat_nr, (unsigned int) (last >> o->heat_shift) + 1);
+}
+
+static void arrival_add(struct arrivals *a, uint64_t ttime)
+{
+	double x, delta;
+
+	if (a->last != -1ULL && ttime >= a->last) {
+		x = (ttime - a->last) / 1000.0;
+		a->nr++;
+		delta = x - a->mean;
+		a->mean += delta / a->nr;
+		a->m2 += delta * (x - a->mean);
+	}
+
+	a->last = ttime;
+}
+
+static void arrival_merge(struct arrivals *a, struct arrivals *b)
+{
+	uint64_t nr = a->nr + b->nr;
+	double delta;
+
+	if (!b->nr)
+		return;
+
+	delta = b->mean - a->mean;
+	a->mean += delta * b->nr / nr;
+	a->m2 += b->m2 + delta * delta * a->nr * b->nr / nr;
+	a->nr = nr;
+}
+
+static double arrival_cv(struct arrivals *a)
+{
+	if (a->nr < 2 || a->mean == 0.0)
+		return 0.0;
+
+	return sqrt(a->m2 / a->nr) / a->mean;
+}
+
+static double phase_perc(uint64_t val, unsigned long total)
+{
+	return total ? (double) val * 100.0 / (double) total : 0.0;
+}
+
+static int phase_differs(struct btrace_phase *a, struct btrace_phase *b)
+{
+	unsigned long ia = ddir_rw_sum(a->ios), ib = ddir_rw_sum(b->ios);
+	double ra, rb;
+
+	if (!ia != !ib)
+		return 1;
+	if (!ia)
+		return 0;
+
+	ra = (double) ia / (a->end - a->start);
+	rb = (double) ib / (b->end - b->start);
+	if (ra > rb * PHASE_RATE_RATIO || rb > ra * PHASE_RATE_RATIO)
+		return 1;
+
+	if (fabs(phase_perc(a->ios[DDIR_READ], ia) -
+		 phase_perc(b->ios[DDIR_READ], ib)) > PHASE_PERC_DIFF)
+		return 1;
+	if (fabs(phase_perc(ddir_rw_sum(a->seq), ia) -
+		 phase_perc(ddir_rw_sum(b->seq), ib)) > PHASE_PERC_DIFF)
+		return 1;
+
+	return 0;
+}
+
+/*
+ * A window is done, add it to the current phase or start a new one
+ */
+static void phase_fold(struct btrace_pid *p, struct btrace_phase *w,
+		       int force)
+{
+	struct btrace_phase *ph = &p->cur;
+	int i;
+
+	if (!ph->end) {
+		*ph = *w;
+		return;
+	}
+
+	if (!force && phase_differs(ph, w)) {
+		p->phases = realloc(p->phases,
+				(p->nr_phases + 1) * sizeof(*ph));
+		p->phases[p->nr_phases++] = *ph;
+		*ph = *w;
+		return;
+	}
+
+	for (i = 0; i < DDIR_RWDIR_CNT; i++) {
+		ph->ios[i] += w->ios[i];
+		ph->seq[i] += w->seq[i];
+		ph->kib[i] += w->kib[i];
+	}
+	ph->depth = max(ph->depth, w->depth);
+	arrival_merge(&ph->arr, &w->arr);
+	ph->end = w->end;
+	ph->last = w->last;
+}
+
+static void phase_account(struct btrace_pid *p, struct blk_io_trace *t,
+			  int rw, int seq)
+{
+	struct btrace_phase *w = &p->win;
+
+	if (!phase_nsec)
+		return;
+
+	if (!w->end) {
+		w->start = t->time;
+		w->end = t->time + phase_nsec;
+		w->arr.last = -1ULL;
+	} else if (t->time >= w->end) {
+		uint64_t idle = (t->time - w->end) / phase_nsec;
+
+		phase_fold(p, w, 0);
+		memset(w, 0, sizeof(*w));
+		w->start = p->cur.end;
+		if (idle) {
+			w->end = w->start + idle * phase_nsec;
+			phase_fold(p, w, 0);
+			w->start = w->end;
+		}
+		w->end = w->start + phase_nsec;
+		w->arr.last = -1ULL;
+	}
+
+	w->ios[rw]++;
+	w->seq[rw] += seq;
+	w->kib[rw] += t->bytes >> 10;
+	w->depth = max(w->depth, min((unsigned int) p->o.inflight, max_depth));
+	w->last = t->time;
+	arrival_add(&w->arr, t->time);
+}
+
+/*
+ * End of trace. A last window that's less than half full is too short
+ * to judge and stays with the current phase, which ends at its last IO.
+ */
+static void phase_finish(struct btrace_pid *p)
+{
+	struct btrace_phase *w = &p->win;
+
+	if (!w->end)
+		return;
+
+	phase_fold(p, w, w->last - w->start < phase_nsec / 2);
+	p->cur.end = max(w->last, p->cur.start + 1);
+	p->phases = realloc(p->phases, (p->nr_phases + 1) * sizeof(*w));
+	p->phases[p->nr_phases++] = p->cur;
+}
+
 static int handle_trace_discard(struct blk_io_trace *t, struct btrace_pid *p)
 {
 	struct btrace_out *o = &p->o;
@@ -335,13 +600,16 @@ static int handle_trace_discard(struct blk_io_trace *t, struct btrace_pid *p)
 
 	o->ios[DDIR_TRIM]++;
 	add_bs(o, t->bytes, DDIR_TRIM);
+	heat_add(o, DDIR_TRIM, t->sector, t->bytes);
+	arrival_add(&o->arr, t->time);
+	phase_account(p, t, DDIR_TRIM, 0);
 	return 0;
 }
 
 static int handle_trace_fs(struct blk_io_trace *t, struct btrace_pid *p)
 {
 	struct btrace_out *o = &p->o;
-	int rw;
+	int rw, seq = 0;
 
 	if (btrace_add_file(p, t->device))
 		return 1;
@@ -356,10 +624,16 @@ static int handle_trace_fs(struct blk_io_trace *t, struct btrace_pid *p)
 	add_bs(o, t->bytes, rw);
 	o->ios[rw]++;
 
-	if (t->sector == o->last_end[rw] || o->last_end[rw] == -1ULL)
+	if (t->sector == o->last_end[rw] || o->last_end[rw] == -1ULL) {
 		o->seq[rw]++;
+		seq = 1;
+	}
 
 	o->last_end[rw] = t->sector + (t->bytes >> 9);
+	if (!seq)
+		heat_add(o, rw, t->sector, t->bytes);
+	arrival_add(&o->arr, t->time);
+	phase_account(p, t, rw, seq);
 	return 0;
 }
 
@@ -462,6 +736,8 @@ static struct btrace_pid *pid_hash_get(pid_t pid)
 			p->o.last_ttime[i] = -1ULL;
 			p->o.last_end[i] = -1ULL;
 		}
+		p->o.heat_shift = HEAT_MIN_SHIFT;
+		p->o.arr.last = -1ULL;
 
 		p->pid = pid;
 		p->numjobs = 1;
@@ -525,6 +801,7 @@ static int load_blktrace(const char *fname, int need_swap)
 		}
 
 		p = pid_hash_get(t.pid);
+		cur_ttime = t.time;
 		ret = handle_trace(&t, p);
 		if (ret)
 			break;
@@ -595,6 +872,132 @@ static uint64_t o_longest_ttime(struct btrace_out *o)
 	return ret;
 }
 
+/*
+ * Print the offset heat of rw as zoned_abs zones, or of all data
+ * directions with IOs if rw is -1. Bins of about the same heat are
+ * merged, then the zones get whole percentages that add up to 100.
+ */
+static void output_zones(struct btrace_out *o, int rw, const char *prefix)
+{
+	unsigned long zone_ios[HEAT_BINS], total = 0;
+	unsigned int zone_bins[HEAT_BINS], perc[HEAT_BINS];
+	unsigned long long rem[HEAT_BINS];
+	unsigned int nr = 0, left, i, j, best;
+
+	for (i = 0; i < o->heat_nr; i++) {
+		unsigned long h = 0;
+		double avg = 0.0;
+
+		for (j = 0; j < DDIR_RWDIR_CNT; j++)
+			if (j == rw || (rw == -1 && o->ios[j]))
+				h += o->heat[j][i];
+
+		if (nr)
+			avg = (double) zone_ios[nr - 1] / zone_bins[nr - 1];
+		/*
+		 * Sparse bins are noisy, let them differ by the expected
+		 * deviation too
+		 */
+		if (nr && ((h <= avg * HEAT_ZONE_RATIO &&
+			    h * HEAT_ZONE_RATIO >= avg) ||
+			   fabs(h - avg) <= 3.0 * sqrt(h + avg))) {
+			zone_ios[nr - 1] += h;
+			zone_bins[nr - 1]++;
+		} else {
+			zone_ios[nr] = h;
+			zone_bins[nr] = 1;
+			nr++;
+		}
+		total += h;
+	}
+	if (!total)
+		return;
+
+	/* nothing is accessed past the last zone anyway */
+	while (!zone_ios[nr - 1])
+		nr--;
+
+	/*
+	 * Round down, then hand what's left to the largest remainders
+	 */
+	left = 100;
+	for (i = 0; i < nr; i++) {
+		perc[i] = zone_ios[i] * 100ULL / total;
+		rem[i] = zone_ios[i] * 100ULL % total;
+		left -= perc[i];
+	}
+	while (left) {
+		best = 0;
+		for (i = 1; i < nr; i++)
+			if (rem[i] > rem[best])
+				best = i;
+		perc[best]++;
+		rem[best] = 0;
+		left--;
+	}
+
+	printf("%s", prefix);
+	for (i = 0; i < nr; i++) {
+		if (i)
+			printf(":");
+		printf("%u/%lluk", perc[i],
+			((unsigned long long) zone_bins[i] << o->heat_shift) >> 1);
+	}
+	printf("\n");
+}
+
+static void output_depth_profile(struct btrace_out *o)
+{
+	uint64_t total = 0;
+	int i, first = 1;
+
+	for (i = 0; i < DEPTH_BUCKETS; i++)
+		total += o->depth_time[i];
+	if (!total || !o->complete_seen)
+		return;
+
+	printf("depth profile:\t");
+	for (i = 0; i < DEPTH_BUCKETS; i++) {
+		if (!o->depth_time[i])
+			continue;
+		if (!first)
+			printf(", ");
+		first = 0;
+		if (!i)
+			printf("1");
+		else if (i == DEPTH_BUCKETS - 1)
+			printf("%u+", 1U << i);
+		else
+			printf("%u-%u", 1U << i, (2U << i) - 1);
+		printf("=%3.2f%%", o->depth_time[i] * 100.0 / total);
+	}
+	printf("\n");
+}
+
+static void output_phases_ascii(struct btrace_pid *p)
+{
+	int i;
+
+	printf("phases:\n");
+	for (i = 0; i < p->nr_phases; i++) {
+		struct btrace_phase *ph = &p->phases[i];
+		unsigned long total = ddir_rw_sum(ph->ios);
+		uint64_t msec = (ph->end - ph->start) / 1000000ULL;
+
+		printf("\t%d: start=%llu msec, len=%llu msec", i,
+			(unsigned long long) (ph->start / 1000ULL - first_ttime) / 1000ULL,
+			(unsigned long long) msec);
+		if (!total) {
+			printf(", idle\n");
+			continue;
+		}
+		printf(", iops=%llu, reads=%3.2f%%, seq=%3.2f%%, depth=%u\n",
+			(unsigned long long) (total * 1000ULL / max(msec, (uint64_t) 1)),
+			phase_perc(ph->ios[DDIR_READ], total),
+			phase_perc(ddir_rw_sum(ph->seq), total), ph->depth);
+	}
+}
+
 static void __output_p_ascii(struct btrace_pid *p, unsigned long *ios)
 {
 	const char *msg[] = { "reads", "writes", "trims" };
@@ -634,8 +1037,24 @@ static void __output_p_ascii(struct btrace_pid *p, unsigned long *ios)
 	}
 
 	printf("depth:\t%u\n", o->depth);
+	output_depth_profile(o);
 	usec = o_longest_ttime(o) / 1000ULL;
 	printf("usec:\t%lu (delay=%llu)\n", usec, (unsigned long long) o->start_delay);
+	if (o->arr.nr)
+		printf("arrival:\tmean=%.1f usec, cv=%.2f\n", o->arr.mean,
+				arrival_cv(&o->arr));
+
+	for (i = 0; i < DDIR_RWDIR_CNT; i++) {
+		char prefix[32];
+
+		if (!o->ios[i] || o->heat_nr < 2)
+			continue;
+		snprintf(prefix, sizeof(prefix), "zones:\t%s ", msg[i]);
+		output_zones(o, i, prefix);
+	}
+
+	if (p->nr_phases > 1)
+		output_phases_ascii(p);
 
 	printf("files:\t");
 	for (i = 0; i < p->nr_files; i++)
@@ -652,22 +1071,24 @@ static int __output_p_fio(struct btrace_pid *p, unsigned long *ios,
 	unsigned long total;
 	unsigned long long time;
 	float perc;
-	int i, j;
+	int i, j, n;
 
 	if ((o->ios[0] + o->ios[1]) && o->ios[2]) {
 		unsigned long ios_bak[DDIR_RWDIR_CNT];
+		char name[64];
 
 		memcpy(ios_bak, o->ios, DDIR_RWDIR_CNT * sizeof(unsigned long));
 
 		/* create job for read/write */
 		o->ios[2] = 0;
-		__output_p_fio(p, ios, "");
+		__output_p_fio(p, ios, name_postfix);
 		o->ios[2] = ios_bak[2];
 
 		/* create job for trim */
 		o->ios[0] = 0;
 		o->ios[1] = 0;
-		__output_p_fio(p, ios, "_trim");
+		snprintf(name, sizeof(name), "%s_trim", name_postfix);
+		__output_p_fio(p, ios, name);
 		o->ios[0] = ios_bak[0];
 		o->ios[1] = ios_bak[1];
 
@@ -735,21 +1156,37 @@ static int __output_p_fio(struct btrace_pid *p, unsigned long *ios,
 	time = (time + 1000000000ULL - 1) / 1000000000ULL;
 	printf("runtime=%llus\n", time);
 
+	/*
+	 * One field per data direction. Sizes under 1% are left out, the
+	 * last size printed gets what remains.
+	 */
 	printf("bssplit=");
 	for (i = 0; i < DDIR_RWDIR_CNT; i++) {
+		unsigned long nr = 0;
+		int last = -1;
 
-		if (i && o->nr_bs[i - 1] && o->nr_bs[i])
+		if (i)
 			printf(",");
+		if (!o->ios[i])
+			continue;
 
+		for (j = 0; j < o->nr_bs[i]; j++)
+			nr += o->bs[i][j].nr;
 		for (j = 0; j < o->nr_bs[i]; j++) {
+			perc = (((float) o->bs[i][j].nr * 100.0) / (float) nr);
+			if (perc >= 1.00 || last == -1)
+				last = j;
+		}
+
+		for (j = 0, n = 0; j <= last; j++) {
 			struct bs *bs = &o->bs[i][j];
 
-			perc = (((float) bs->nr * 100.0) / (float) o->ios[i]);
-			if (perc < 1.00)
+			perc = (((float) bs->nr * 100.0) / (float) nr);
+			if (perc < 1.00 && j != last)
 				continue;
-			if (j)
+			if (n++)
 				printf(":");
-			if (j + 1 == o->nr_bs[i])
+			if (j == last)
 				printf("%u/", bs->bs);
 			else
 				printf("%u/%u", bs->bs, (int) floor(perc + 0.5));
@@ -757,6 +1194,13 @@ static int __output_p_fio(struct btrace_pid *p, unsigned long *ios,
 	}
 	printf("\n");
 
+	/*
+	 * The option parser only takes one set of zones, for all data
+	 * directions
+	 */
+	if (zoned && o->heat_nr > 1)
+		output_zones(o, -1, "random_distribution=zoned_abs:");
+
 	if (set_rate) {
 		printf("rate=");
 		for (i = 0; i < DDIR_RWDIR_CNT; i++) {
@@ -769,6 +1213,13 @@ static int __output_p_fio(struct btrace_pid *p, unsigned long *ios,
 				printf("%luk", rate);
 		}
 		printf("\n");
+
+		/*
+		 * Arrivals closer to a Poisson process (cv=1) than to a
+		 * fixed interval (cv=0)
+		 */
+		if (arrival_cv(&o->arr) >= 0.5)
+			printf("rate_process=poisson\n");
 	}
 
 	if (n_add_opts)
@@ -779,6 +1230,41 @@ static int __output_p_fio(struct btrace_pid *p, unsigned long *ios,
 	return 0;
 }
 
+/*
+ * A job per phase: the phase's mix, rate and depth, over the offsets and
+ * block sizes of the whole trace
+ */
+static int output_phases_fio(struct btrace_pid *p, unsigned long *ios)
+{
+	struct btrace_out *o = &p->o, bak = *o;
+	char name[32];
+	int i, j, ret = 0;
+
+	for (i = 0; i < p->nr_phases && !ret; i++) {
+		struct btrace_phase *ph = &p->phases[i];
+
+		if (!ddir_rw_sum(ph->ios))
+			continue;
+
+		for (j = 0; j < DDIR_RWDIR_CNT; j++) {
+			o->ios[j] = ph->ios[j];
+			o->seq[j] = ph->seq[j];
+			o->kib[j] = ph->kib[j];
+			o->first_ttime[j] = ph->start;
+			o->last_ttime[j] = ph->end;
+		}
+		o->depth = max(ph->depth, 1U);
+		o->arr = ph->arr;
+		o->start_delay = ph->start / 1000ULL - first_ttime;
+
+		snprintf(name, sizeof(name), "_phase%d", i);
+		ret = __output_p_fio(p, ios, name);
+		*o = bak;
+	}
+
+	return ret;
+}
+
 static int __output_p(struct btrace_pid *p, unsigned long *ios)
 {
 	struct btrace_out *o = &p->o;
@@ -798,6 +1284,8 @@ static int __output_p(struct btrace_pid *p, unsigned long *ios)
 
 	if (output_ascii)
 		__output_p_ascii(p, ios);
+	else if (p->nr_phases > 1)
+		ret = output_phases_fio(p, ios);
 	else
 		ret = __output_p_fio(p, ios, "");
 
@@ -862,6 +1350,7 @@ static void free_p(struct btrace_pid *p)
 		free(o->bs[i]);
 
 	free(p->files);
+	free(p->phases);
 	flist_del(&p->pid_list);
 	flist_del(&p->hash_list);
 	free(p);
@@ -872,6 +1361,9 @@ static int entries_close(struct btrace_pid *pida, struct btrace_pid *pidb)
 	float perca, percb, fdiff;
 	int i, idiff;
 
+	if (pida->nr_phases > 1 || pidb->nr_phases > 1)
+		return 0;
+
 	for (i = 0; i < DDIR_RWDIR_CNT; i++) {
 		if ((pida->o.ios[i] && !pidb->o.ios[i]) ||
 		    (pidb->o.ios[i] && !pida->o.ios[i]))
@@ -924,6 +1416,21 @@ static void merge_bs(struct bs **bsap, unsigned int *nr_bsap,
 	}
 }
 
+static void merge_heat(struct btrace_out *oa, struct btrace_out *ob)
+{
+	int i, j;
+
+	while (oa->heat_shift < ob->heat_shift)
+		heat_coarsen(oa);
+	while (ob->heat_shift < oa->heat_shift)
+		heat_coarsen(ob);
+
+	for (i = 0; i < DDIR_RWDIR_CNT; i++)
+		for (j = 0; j < HEAT_BINS; j++)
+			oa->heat[i][j] += ob->heat[i][j];
+	oa->heat_nr = max(oa->heat_nr, ob->heat_nr);
+}
+
 static int merge_entries(struct btrace_pid *pida, struct btrace_pid *pidb)
 {
 	int i;
@@ -948,6 +1455,11 @@ static int merge_entries(struct btrace_pid *pida, struct btrace_pid *pidb)
 		merge_bs(&oa->bs[i], &oa->nr_bs[i], ob->bs[i], ob->nr_bs[i]);
 	}
 
+	for (i = 0; i < DEPTH_BUCKETS; i++)
+		pida->o.depth_time[i] += pidb->o.depth_time[i];
+	merge_heat(&pida->o, &pidb->o);
+	arrival_merge(&pida->o.arr, &pidb->o.arr);
+
 	pida->o.start_delay = min(pida->o.start_delay, pidb->o.start_delay);
 	pida->o.depth = (pida->o.depth + pidb->o.depth) / 2;
 	return 1;
@@ -985,6 +1497,7 @@ static int output_p(void)
 		struct btrace_pid *p;
 
 		p = flist_entry(e, struct btrace_pid, pid_list);
+		phase_finish(p);
 		if (prune_entry(&p->o)) {
 			free_p(p);
 			continue;
@@ -1044,6 +1557,8 @@ static int usage(char *argv[])
 	log_err("\t-u\tDepth difference for collapse (def=%u)\n", depth_diff);
 	log_err("\t-x\tRandom difference for collapse (def=%u)\n", random_diff);
 	log_err("\t-a\tAdditional fio option to add to job file\n");
+	log_err("\t-z\tFit zoned random_distribution to offsets (def=%u)\n", zoned);
+	log_err("\t-P\tSplit jobs into phases, msec window (def=0, off)\n");
 	return 1;
 }
 
@@ -1099,7 +1614,7 @@ int main(int argc, char *argv[])
 	if (argc < 2)
 		return usage(argv);
 
-	while ((c = getopt(argc, argv, "t:n:fd:r:RD:c:u:x:a:")) != -1) {
+	while ((c = getopt(argc, argv, "t:n:fd:r:RD:c:u:x:a:z:P:")) != -1) {
 		switch (c) {
 		case 'R':
 			set_rate = 1;
@@ -1136,6 +1651,12 @@ int main(int argc, char *argv[])
 			add_opts[n_add_opts] = strdup(optarg);
 			n_add_opts++;
 			break;
+		case 'z':
+			zoned = atoi(optarg);
+			break;
+		case 'P':
+			phase_nsec = strtoull(optarg, NULL, 10) * 1000000ULL;
+			break;
 		case '?':
 		default:
 			return usage(argv);
@@ -2,6 +2,10 @@
  * Small tool to check for dedupable blocks in a file or device. Basically
  * just scans the filename for extents of the given size, checksums them,
  * and orders them up.
+ *
+ * With -v, extents are cut where the content says so instead (FastCDC
+ * style gear hashing), so inserting or removing data doesn't shift every
+ * extent after it and hide the duplicates from a fixed size scan.
  */
 #include <fcntl.h>
 #include <inttypes.h>
@@ -28,7 +32,6 @@
 
 struct zlib_ctrl {
 	z_stream stream;
-	unsigned char *buf_in;
 	unsigned char *buf_out;
 };
 
@@ -40,6 +43,8 @@ struct worker_thread {
 	unsigned long long unique_capacity;
 	unsigned long items;
 	unsigned long dupes;
+	uint64_t bytes;
+	uint64_t dupe_bytes;
 	int err;
 	int fd;
 	volatile int done;
@@ -53,12 +58,15 @@ struct extent {
 struct chunk {
 	struct fio_rb_node rb_node;
 	uint64_t count;
+	uint32_t len;
 	uint32_t hash[MD5_HASH_WORDS];
 	struct flist_head extent_list[0];
 };
 
 struct item {
 	uint64_t offset;
+	uint32_t len;
+	uint32_t unique;
 	uint32_t hash[MD5_HASH_WORDS];
 };
 
@@ -75,6 +83,15 @@ static unsigned int collision_check;
 static unsigned int print_progress = 1;
 static unsigned int use_bloom = 1;
 static unsigned int compression = 0;
+static unsigned int variable;
+
+/*
+ * Content defined chunking: extents are cut between cdc_min and cdc_max
+ * bytes, aiming for blocksize on average
+ */
+static unsigned int cdc_min, cdc_max;
+static uint64_t cdc_mask_s, cdc_mask_l;
+static uint64_t gear[256];
 
 static uint64_t total_size;
 static uint64_t cur_offset;
@@ -138,35 +155,32 @@ static int __read_block(int fd, void *buf, off_t offset, size_t count)
 	return 0;
 }
 
-static int read_block(int fd, void *buf, off_t offset)
-{
-	return __read_block(fd, buf, offset, blocksize);
-}
-
-static int account_unique_capacity(uint64_t offset, uint64_t *unique_capacity,
+/*
+ * Compressed size of a unique extent, it's still in the buffer it was
+ * hashed from
+ */
+static int account_unique_capacity(struct item *i, void *buf,
+				   uint64_t *unique_capacity,
 				   struct zlib_ctrl *zc)
 {
 	z_stream *stream = &zc->stream;
 	unsigned int compressed_len;
 	int ret;
 
-	if (read_block(file.fd, zc->buf_in, offset))
-		return 1;
-
-	stream->next_in = zc->buf_in;
-	stream->avail_in = blocksize;
-	stream->avail_out = deflateBound(stream, blocksize);
+	stream->next_in = buf;
+	stream->avail_in = i->len;
+	stream->avail_out = deflateBound(stream, i->len);
 	stream->next_out = zc->buf_out;
 
 	ret = deflate(stream, Z_FINISH);
 	if (ret == Z_STREAM_ERROR)
 		return 1;
-	compressed_len = blocksize - stream->avail_out;
+	compressed_len = stream->total_out;
 
 	if (dump_output)
-		printf("offset 0x%lx compressed to %d blocksize %d ratio %.2f \n",
-				(unsigned long) offset, compressed_len, blocksize,
-				(float)compressed_len / (float)blocksize);
+		printf("offset 0x%lx compressed to %d len %d ratio %.2f \n",
+				(unsigned long) i->offset, compressed_len, i->len,
+				(float)compressed_len / (float)i->len);
 
 	*unique_capacity += compressed_len;
 	deflateReset(stream);
@@ -196,20 +210,23 @@ static int col_check(struct chunk *c, struct item *i)
 	char *cbuf, *ibuf;
 	int ret = 1;
 
-	cbuf = fio_memalign(blocksize, blocksize, false);
-	ibuf = fio_memalign(blocksize, blocksize, false);
+	if (c->len != i->len)
+		return 1;
+
+	cbuf = fio_memalign(blocksize, i->len, false);
+	ibuf = fio_memalign(blocksize, i->len, false);
 
 	e = flist_entry(c->extent_list[0].next, struct extent, list);
-	if (read_block(file.fd, cbuf, e->offset))
+	if (__read_block(file.fd, cbuf, e->offset, i->len))
 		goto out;
 
-	if (read_block(file.fd, ibuf, i->offset))
+	if (__read_block(file.fd, ibuf, i->offset, i->len))
 		goto out;
 
-	ret = memcmp(ibuf, cbuf, blocksize);
+	ret = memcmp(ibuf, cbuf, i->len);
 out:
-	fio_memfree(cbuf, blocksize, false);
-	fio_memfree(ibuf, blocksize, false);
+	fio_memfree(cbuf, i->len, false);
+	fio_memfree(ibuf, i->len, false);
 	return ret;
 }
 
@@ -227,8 +244,7 @@ static struct chunk *alloc_chunk(void)
 	return c;
 }
 
-static int insert_chunk(struct item *i, uint64_t *unique_capacity,
-			struct zlib_ctrl *zc)
+static void insert_chunk(struct item *i)
 {
 	struct fio_rb_node **p, *parent;
 	struct chunk *c;
@@ -263,24 +279,19 @@ static int insert_chunk(struct item *i, uint64_t *unique_capacity,
 	c = alloc_chunk();
 	RB_CLEAR_NODE(&c->rb_node);
 	c->count = 0;
+	c->len = i->len;
 	memcpy(c->hash, i->hash, sizeof(i->hash));
 	rb_link_node(&c->rb_node, parent, p);
 	rb_insert_color(&c->rb_node, &rb_root);
-	if (compression) {
-		ret = account_unique_capacity(i->offset, unique_capacity, zc);
-		if (ret)
-			return ret;
-	}
+	i->unique = 1;
 add:
 	add_item(c, i);
-	return 0;
 }
 
-static int insert_chunks(struct item *items, unsigned int nitems,
-			 uint64_t *ndupes, uint64_t *unique_capacity,
-			 struct zlib_ctrl *zc)
+static void insert_chunks(struct item *items, unsigned int nitems,
+			  uint64_t *ndupes, uint64_t *dupe_bytes)
 {
-	int i, ret = 0;
+	int i;
 
 	fio_sem_down(rb_lock);
 
@@ -292,68 +303,148 @@ static int insert_chunks(struct item *items, unsigned int nitems,
 			s = sizeof(items[i].hash) / sizeof(uint32_t);
 			r = bloom_set(bloom, items[i].hash, s);
 			*ndupes += r;
-		} else {
-			ret = insert_chunk(&items[i], unique_capacity, zc);
-			if (ret)
-				break;
-		}
+			if (r)
+				*dupe_bytes += items[i].len;
+		} else
+			insert_chunk(&items[i]);
 	}
 
 	fio_sem_up(rb_lock);
-	return ret;
 }
 
-static void crc_buf(void *buf, uint32_t *hash)
+static void crc_buf(void *buf, unsigned int len, uint32_t *hash)
 {
 	struct fio_md5_ctx ctx = { .hash = hash };
 
 	fio_md5_init(&ctx);
-	fio_md5_update(&ctx, buf, blocksize);
+	fio_md5_update(&ctx, buf, len);
 	fio_md5_final(&ctx);
 }
 
-static unsigned int read_blocks(int fd, void *buf, off_t offset, size_t size)
+static uint64_t cdc_mask(unsigned int bits)
 {
-	if (__read_block(fd, buf, offset, size))
-		return 0;
+	return ~0ULL << (64 - bits);
+}
+
+/*
+ * Gear hash setup for an average extent of blocksize bytes, normalized
+ * FastCDC style: below the average a cut needs one more zero bit than
+ * the average implies, above it one less, which keeps most extents
+ * close to blocksize.
+ */
+static void cdc_init(void)
+{
+	uint64_t x = 0x9e3779b97f4a7c15ULL;
+	unsigned int i, bits;
 
-	return size / blocksize;
+	for (i = 0; i < FIO_ARRAY_SIZE(gear); i++) {
+		uint64_t z;
+
+		x += 0x9e3779b97f4a7c15ULL;
+		z = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		gear[i] = z ^ (z >> 31);
+	}
+
+	bits = __fls(blocksize) - 1;
+	cdc_mask_s = cdc_mask(bits + 1);
+	cdc_mask_l = cdc_mask(bits - 1);
+	cdc_min = blocksize / 4;
+	cdc_max = blocksize * 4;
 }
 
+/*
+ * Length of the extent starting at buf, at most len bytes. The hash only
+ * covers the bytes after cdc_min, a cut can't happen before that anyway.
+ * The top bits of the hash are tested, they depend on the last 64 bytes
+ * where the low ones only see the last few.
+ */
+static unsigned int cdc_cut(const unsigned char *buf, unsigned int len)
+{
+	unsigned int i = cdc_min, normal;
+	uint64_t h = 0;
+
+	if (len <= cdc_min)
+		return len;
+	if (len > cdc_max)
+		len = cdc_max;
+	normal = min(blocksize, len);
+
+	for (; i < normal; i++) {
+		h = (h << 1) + gear[buf[i]];
+		if (!(h & cdc_mask_s))
+			return i + 1;
+	}
+	for (; i < len; i++) {
+		h = (h << 1) + gear[buf[i]];
+		if (!(h & cdc_mask_l))
+			return i + 1;
+	}
+
+	return len;
+}
+
+/*
+ * Hash the extents of one unit of work. Content defined extents don't
+ * cross the end of the unit, the cut points are back in sync a couple
+ * of extents into the next one.
+ */
 static int do_work(struct worker_thread *thread, void *buf)
 {
-	unsigned int nblocks, i;
+	unsigned int pos, len, size, max_items, i;
 	off_t offset;
 	int nitems = 0;
-	uint64_t ndupes = 0;
+	uint64_t ndupes = 0, dupe_bytes = 0;
 	uint64_t unique_capacity = 0;
 	struct item *items;
-	int ret;
+	int ret = 0;
 
 	offset = thread->cur_offset;
+	size = min(thread->size, (uint64_t) chunk_size);
 
-	nblocks = read_blocks(thread->fd, buf, offset,
-				min(thread->size, (uint64_t) chunk_size));
-	if (!nblocks)
+	if (__read_block(thread->fd, buf, offset, size))
 		return 1;
 
-	items = malloc(sizeof(*items) * nblocks);
+	max_items = variable ? size / cdc_min + 1 : size / blocksize;
+	items = malloc(sizeof(*items) * max_items);
 
-	for (i = 0; i < nblocks; i++) {
-		void *thisptr = buf + (i * blocksize);
+	for (pos = 0; pos < size; pos += len) {
+		if (variable)
+			len = cdc_cut(buf + pos, size - pos);
+		else if (size - pos >= blocksize)
+			len = blocksize;
+		else
+			break;
 
-		items[i].offset = offset;
-		crc_buf(thisptr, items[i].hash);
-		offset += blocksize;
+		items[nitems].offset = offset + pos;
+		items[nitems].len = len;
+		items[nitems].unique = 0;
+		crc_buf(buf + pos, len, items[nitems].hash);
 		nitems++;
 	}
 
-	ret = insert_chunks(items, nitems, &ndupes, &unique_capacity, &thread->zc);
+	insert_chunks(items, nitems, &ndupes, &dupe_bytes);
+
+	/*
+	 * Compress the extents that were new to the tree here, without
+	 * holding the lock, while they are still in the buffer
+	 */
+	for (i = 0; compression && i < nitems; i++) {
+		if (!items[i].unique)
+			continue;
+		ret = account_unique_capacity(&items[i],
+					buf + (items[i].offset - offset),
+					&unique_capacity, &thread->zc);
+		if (ret)
+			break;
+	}
 
 	free(items);
 	if (!ret) {
 		thread->items += nitems;
 		thread->dupes += ndupes;
+		thread->bytes += pos;
+		thread->dupe_bytes += dupe_bytes;
 		thread->unique_capacity += unique_capacity;
 		return 0;
 	}
@@ -373,8 +464,7 @@ static void thread_init_zlib_control(struct worker_thread *thread)
 	if (deflateInit(stream, Z_DEFAULT_COMPRESSION) != Z_OK)
 		return;
 
-	thread->zc.buf_in = fio_memalign(blocksize, blocksize, false);
-	sz = deflateBound(stream, blocksize);
+	sz = deflateBound(stream, variable ? cdc_max : blocksize);
 	thread->zc.buf_out = fio_memalign(blocksize, sz, false);
 }
 
@@ -402,23 +492,23 @@ static void *thread_fn(void *data)
 	return NULL;
 }
 
-static void show_progress(struct worker_thread *threads, unsigned long total)
+static void show_progress(struct worker_thread *threads, uint64_t total)
 {
-	unsigned long last_nitems = 0;
+	uint64_t last_nbytes = 0;
 	struct timespec last_tv;
 
 	fio_gettime(&last_tv, NULL);
 
 	while (print_progress) {
 		unsigned long this_items;
-		unsigned long nitems = 0;
+		uint64_t nbytes = 0;
 		uint64_t tdiff;
 		float perc;
 		int some_done = 0;
 		int i;
 
 		for (i = 0; i < num_threads; i++) {
-			nitems += threads[i].items;
+			nbytes += threads[i].bytes;
 			some_done = threads[i].done;
 			if (some_done)
 				break;
@@ -427,15 +517,14 @@ static void show_progress(struct worker_thread *threads, unsigned long total)
 		if (some_done)
 			break;
 
-		perc = (float) nitems / (float) total;
+		perc = (float) nbytes / (float) total;
 		perc *= 100.0;
-		this_items = nitems - last_nitems;
-		this_items *= blocksize;
+		this_items = nbytes - last_nbytes;
 		tdiff = mtime_since_now(&last_tv);
 		if (tdiff) {
 			this_items = (this_items * 1000) / (tdiff * 1024);
 			printf("%3.2f%% done (%luKiB/sec)\r", perc, this_items);
-			last_nitems = nitems;
+			last_nbytes = nbytes;
 			fio_gettime(&last_tv, NULL);
 		} else {
 			printf("%3.2f%% done\r", perc);
@@ -447,14 +536,14 @@ static void show_progress(struct worker_thread *threads, unsigned long total)
 
 static int run_dedupe_threads(struct fio_file *f, uint64_t dev_size,
 			      uint64_t *nextents, uint64_t *nchunks,
+			      uint64_t *nbytes, uint64_t *unique_bytes,
 			      uint64_t *unique_capacity)
 {
 	struct worker_thread *threads;
-	unsigned long nitems, total_items;
+	unsigned long nitems;
 	int i, err = 0;
 
 	total_size = dev_size;
-	total_items = dev_size / blocksize;
 	cur_offset = 0;
 	size_lock = fio_sem_init(FIO_SEM_UNLOCKED);
 
@@ -470,17 +559,20 @@ static int run_dedupe_threads(struct fio_file *f, uint64_t dev_size,
 		}
 	}
 
-	show_progress(threads, total_items);
+	show_progress(threads, dev_size);
 
 	nitems = 0;
 	*nextents = 0;
 	*nchunks = 1;
+	*nbytes = *unique_bytes = 0;
 	*unique_capacity = 0;
 	for (i = 0; i < num_threads; i++) {
 		void *ret;
 		pthread_join(threads[i].thread, &ret);
 		nitems += threads[i].items;
 		*nchunks += threads[i].dupes;
+		*nbytes += threads[i].bytes;
+		*unique_bytes += threads[i].bytes - threads[i].dupe_bytes;
 		*unique_capacity += threads[i].unique_capacity;
 	}
 
@@ -495,7 +587,8 @@ static int run_dedupe_threads(struct fio_file *f, uint64_t dev_size,
 }
 
 static int dedupe_check(const char *filename, uint64_t *nextents,
-			uint64_t *nchunks, uint64_t *unique_capacity)
+			uint64_t *nchunks, uint64_t *nbytes,
+			uint64_t *unique_bytes, uint64_t *unique_capacity)
 {
 	uint64_t dev_size;
 	struct stat sb;
@@ -533,8 +626,8 @@ static int dedupe_check(const char *filename, uint64_t *nextents,
 	printf("Will check <%s>, size <%llu>, using %u threads\n", filename,
 				(unsigned long long) dev_size, num_threads);
 
-	return run_dedupe_threads(&file, dev_size, nextents, nchunks,
-					unique_capacity);
+	return run_dedupe_threads(&file, dev_size, nextents, nchunks, nbytes,
+					unique_bytes, unique_capacity);
 err:
 	if (file.fd != -1)
 		close(file.fd);
@@ -547,8 +640,9 @@ static void show_chunk(struct chunk *c)
 	struct flist_head *n;
 	struct extent *e;
 
-	printf("c hash %8x %8x %8x %8x, count %lu\n", c->hash[0], c->hash[1],
-			c->hash[2], c->hash[3], (unsigned long) c->count);
+	printf("c hash %8x %8x %8x %8x, len %u, count %lu\n", c->hash[0],
+			c->hash[1], c->hash[2], c->hash[3], c->len,
+			(unsigned long) c->count);
 	flist_for_each(n, &c->extent_list[0]) {
 		e = flist_entry(n, struct extent, list);
 		printf("\toffset %llu\n", (unsigned long long) e->offset);
@@ -571,6 +665,7 @@ static uint64_t bytes_to_human_readable_unit(uint64_t n, const char **unit_out)
 }
 
 static void show_stat(uint64_t nextents, uint64_t nchunks, uint64_t ndupextents,
+		      uint64_t nbytes, uint64_t unique_bytes,
 		      uint64_t unique_capacity)
 {
 	double perc, ratio;
@@ -595,7 +690,17 @@ static void show_stat(uint64_t nextents, uint64_t nchunks, uint64_t ndupextents,
 			100.0 * (double) ndupextents / (double) nextents);
 	}
 
-	perc = 1.00 - ((double) nchunks / (double) nextents);
+	/*
+	 * Variable extents don't all count the same, go by bytes for those
+	 */
+	if (variable && nbytes) {
+		printf("Bytes=%llu, Unique bytes=%llu, average extent %llu\n",
+			(unsigned long long) nbytes,
+			(unsigned long long) unique_bytes,
+			(unsigned long long) (nbytes / nextents));
+		perc = 1.00 - ((double) unique_bytes / (double) nbytes);
+	} else
+		perc = 1.00 - ((double) nchunks / (double) nextents);
 	perc *= 100.0;
 	printf("Fio setting: dedupe_percentage=%u\n", (int) (perc + 0.50));
 
@@ -606,10 +711,12 @@ static void show_stat(uint64_t nextents, uint64_t nchunks, uint64_t ndupextents,
 	}
 }
 
-static void iter_rb_tree(uint64_t *nextents, uint64_t *nchunks, uint64_t *ndupextents)
+static void iter_rb_tree(uint64_t *nextents, uint64_t *nchunks, uint64_t *ndupextents,
+			 uint64_t *nbytes, uint64_t *unique_bytes)
 {
 	struct fio_rb_node *n;
 	*nchunks = *nextents = *ndupextents = 0;
+	*nbytes = *unique_bytes = 0;
 
 	n = rb_first(&rb_root);
 	if (!n)
@@ -622,6 +729,8 @@ static void iter_rb_tree(uint64_t *nextents, uint64_t *nchunks, uint64_t *ndupex
 		(*nchunks)++;
 		*nextents += c->count;
 		*ndupextents += (c->count > 1);
+		*nbytes += c->count * c->len;
+		*unique_bytes += c->len;
 
 		if (dump_output)
 			show_chunk(c);
@@ -641,18 +750,20 @@ static int usage(char *argv[])
 	log_err("\t-B\tUse probabilistic bloom filter\n");
 	log_err("\t-p\tPrint progress indicator\n");
 	log_err("\t-C\tCalculate compressible size\n");
+	log_err("\t-v\tContent defined extents, -b sets the average size\n");
 	return 1;
 }
 
 int main(int argc, char *argv[])
 {
 	uint64_t nextents = 0, nchunks = 0, ndupextents = 0, unique_capacity;
+	uint64_t nbytes = 0, unique_bytes = 0;
 	int c, ret;
 
 	arch_init(argv);
 	debug_init();
 
-	while ((c = getopt(argc, argv, "b:t:d:o:c:p:B:C:")) != -1) {
+	while ((c = getopt(argc, argv, "b:t:d:o:c:p:B:C:v:")) != -1) {
 		switch (c) {
 		case 'b':
 			blocksize = atoi(optarg);
@@ -678,6 +789,9 @@ int main(int argc, char *argv[])
 		case 'C':
 			compression = atoi(optarg);
 			break;
+		case 'v':
+			variable = atoi(optarg);
+			break;
 		case '?':
 		default:
 			return usage(argv);
@@ -690,6 +804,16 @@ int main(int argc, char *argv[])
 	if (!num_threads)
 		num_threads = cpus_configured();
 
+	if (variable) {
+		if (blocksize < 64 || (blocksize & (blocksize - 1)) ||
+		    blocksize * 4 > chunk_size) {
+			log_err("dedupe: -v needs a power of 2 -b between 64 and %u\n",
+				chunk_size / 4);
+			return 1;
+		}
+		cdc_init();
+	}
+
 	if (argc == optind)
 		return usage(argv);
 
@@ -698,13 +822,16 @@ int main(int argc, char *argv[])
 	rb_root = RB_ROOT;
 	rb_lock = fio_sem_init(FIO_SEM_UNLOCKED);
 
-	ret = dedupe_check(argv[optind], &nextents, &nchunks, &unique_capacity);
+	ret = dedupe_check(argv[optind], &nextents, &nchunks, &nbytes,
+				&unique_bytes, &unique_capacity);
 
 	if (!ret) {
 		if (!bloom)
-			iter_rb_tree(&nextents, &nchunks, &ndupextents);
+			iter_rb_tree(&nextents, &nchunks, &ndupextents, &nbytes,
+					&unique_bytes);
 
-		show_stat(nextents, nchunks, ndupextents, unique_capacity);
+		show_stat(nextents, nchunks, ndupextents, nbytes,
+				unique_bytes, unique_capacity);
 	}
 
 	fio_sem_remove(rb_lock);
@@ -8,6 +8,11 @@
  *
  *	./t/fio-genzipf -t zipf -i 1.2 -g 1 -b 4096 -o 20
  *
+ * Or time zipf setup and sampling on a 100 TiB data set, with both the
+ * default and the rejection-inversion generator:
+ *
+ *	./t/fio-genzipf -t zipf -i 1.2 -g 102400 -B
+ *
  * Only the distribution type (zipf or pareto) and spread input need
  * to be given, if not given defaults are used.
  *
@@ -16,6 +21,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
 
 #include "../lib/zipf.h"
 #include "../lib/gauss.h"
@@ -54,6 +60,10 @@ static unsigned long output_nranges = DEF_NR_OUTPUT;
 static double percentage;
 static double dist_val;
 static int output_type = OUTPUT_NORMAL;
+static int use_rejection;
+static int benchmark;
+
+#define BENCH_SAMPLES	10000000UL
 
 #define DEF_ZIPF_VAL	1.2
 #define DEF_PARETO_VAL	0.3
@@ -99,11 +109,13 @@ static void usage(void)
 	printf("\t-g\tSize of data set (in gigabytes)\n");
 	printf("\t-o\tNumber of output rows\n");
 	printf("\t-c\tOutput ranges in CSV format\n");
+	printf("\t-r\tUse the rejection-inversion zipf generator\n");
+	printf("\t-B\tBenchmark zipf setup and sampling\n");
 }
 
 static int parse_options(int argc, char *argv[])
 {
-	const char *optstring = "t:g:i:o:b:p:ch";
+	const char *optstring = "t:g:i:o:b:p:chrB";
 	int c, dist_val_set = 0;
 
 	while ((c = getopt(argc, argv, optstring)) != -1) {
@@ -142,6 +154,12 @@ static int parse_options(int argc, char *argv[])
 		case 'c':
 			output_type = OUTPUT_CSV;
 			break;
+		case 'r':
+			use_rejection = 1;
+			break;
+		case 'B':
+			benchmark = 1;
+			break;
 		default:
 			printf("bad option %c\n", c);
 			return 1;
@@ -156,7 +174,7 @@ static int parse_options(int argc, char *argv[])
 		if (!dist_val_set)
 			dist_val = DEF_PARETO_VAL;
 	} else if (dist_type == TYPE_ZIPF) {
-		if (dist_val == 1.0) {
+		if (dist_val == 1.0 && !use_rejection) {
 			printf("zipf input must be different than 1.0\n");
 			return 1;
 		}
@@ -276,6 +294,39 @@ static void output_normal(struct node *nodes, unsigned long nnodes,
 	free(output_sums);
 }
 
+static double time_since(struct timespec *s)
+{
+	struct timespec e;
+
+	clock_gettime(CLOCK_MONOTONIC, &e);
+	return (e.tv_sec - s->tv_sec) + (e.tv_nsec - s->tv_nsec) / 1e9;
+}
+
+static void bench_zipf(unsigned long long nranges, int rejection)
+{
+	struct zipf_state zs;
+	struct timespec s;
+	unsigned long long sum = 0;
+	double init_time, sample_time;
+	unsigned long i;
+
+	clock_gettime(CLOCK_MONOTONIC, &s);
+	if (rejection)
+		zipf_init_rejection(&zs, nranges, dist_val, -1, 1);
+	else
+		zipf_init(&zs, nranges, dist_val, -1, 1);
+	init_time = time_since(&s);
+
+	clock_gettime(CLOCK_MONOTONIC, &s);
+	for (i = 0; i < BENCH_SAMPLES; i++)
+		sum += zipf_next(&zs);
+	sample_time = time_since(&s);
+
+	printf("%-10s init %10.3f ms   %8.2f ns/sample   (%llx)\n",
+		rejection ? "rejection" : "zipf_init", init_time * 1000.0,
+		sample_time * 1e9 / BENCH_SAMPLES, sum);
+}
+
 int main(int argc, char *argv[])
 {
 	unsigned long offset;
@@ -296,7 +347,20 @@ int main(int argc, char *argv[])
 	nranges = gib_size * 1024 * 1024 * 1024ULL;
 	nranges /= block_size;
 
-	if (dist_type == TYPE_ZIPF)
+	if (benchmark) {
+		if (dist_type != TYPE_ZIPF) {
+			printf("benchmark only supports zipf\n");
+			return 1;
+		}
+		if (dist_val != 1.0)
+			bench_zipf(nranges, 0);
+		bench_zipf(nranges, 1);
+		return 0;
+	}
+
+	if (dist_type == TYPE_ZIPF && use_rejection)
+		zipf_init_rejection(&zs, nranges, dist_val, -1, 1);
+	else if (dist_type == TYPE_ZIPF)
 		zipf_init(&zs, nranges, dist_val, -1, 1);
 	else if (dist_type == TYPE_PARETO)
 		pareto_init(&zs, nranges, dist_val, -1, 1);
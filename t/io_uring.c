@@ -22,6 +22,7 @@
 #include <sys/resource.h>
 #include <sys/mman.h>
 #include <sys/uio.h>
+#include <sys/sysmacros.h>
 #include <linux/fs.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -61,6 +62,7 @@ struct io_cq_ring {
 #define BS			4096
 
 #define MAX_FDS			16
+#define MAX_SWEEP		16
 
 static unsigned sq_ring_mask, cq_ring_mask;
 
@@ -74,6 +76,9 @@ struct file {
 	int real_fd;
 	int fixed_fd;
 	int fileno;
+	const char *name;
+	unsigned long done;	/* completions, for the per device stats */
+	unsigned long *plat;
 };
 
 #define PLAT_BITS		6
@@ -126,6 +131,14 @@ static long t_io_uring_page_size;
 static int depth = DEPTH;
 static int batch_submit = BATCH_SUBMIT;
 static int batch_complete = BATCH_COMPLETE;
+static int depths[MAX_SWEEP] = { DEPTH };	/* -d and -s sweep lists */
+static int nr_depths = 1;
+static int batches[MAX_SWEEP] = { BATCH_SUBMIT };
+static int nr_batches = 1;
+static int batch_complete_opt = BATCH_COMPLETE;
+static FILE *json_out;			/* -j, JSON results */
+static const char *json_sep = "";
+static volatile int aborted;
 static int bs = BS;
 static int polled = 1;		/* use IO polling */
 static int fixedbufs = 1;	/* use fixed user buffers */
@@ -353,7 +366,7 @@ out:
 }
 
 #ifdef ARCH_HAVE_CPU_CLOCK
-static unsigned int plat_val_to_idx(unsigned long val)
+static unsigned int t_plat_val_to_idx(unsigned long val)
 {
 	unsigned int msb, error_bits, base, offset, idx;
 
@@ -390,7 +403,8 @@ static unsigned int plat_val_to_idx(unsigned long val)
 }
 #endif
 
-static void add_stat(struct submitter *s, int clock_index, int nr)
+static void add_stat(struct submitter *s, struct file *f, int clock_index,
+		     int nr)
 {
 #ifdef ARCH_HAVE_CPU_CLOCK
 	unsigned long cycles;
@@ -399,8 +413,10 @@ static void add_stat(struct submitter *s, int clock_index, int nr)
 	if (!s->finish && clock_index) {
 		cycles = get_cpu_clock();
 		cycles -= s->clock_batch[clock_index];
-		pidx = plat_val_to_idx(cycles);
+		pidx = t_plat_val_to_idx(cycles);
 		s->plat[pidx] += nr;
+		if (f)
+			f->plat[pidx] += nr;
 	}
 #endif
 }
@@ -732,10 +748,11 @@ static int reap_events_uring(struct submitter *s)
 	struct io_uring_cqe *cqe;
 	unsigned head, reaped = 0;
 	int last_idx = -1, stat_nr = 0;
+	struct file *last_f = NULL;
 
 	head = *ring->head;
 	do {
-		struct file *f;
+		struct file *f = NULL;
 
 		if (head == atomic_load_acquire(ring->tail))
 			break;
@@ -745,6 +762,7 @@ static int reap_events_uring(struct submitter *s)
 
 			f = &s->files[fileno];
 			f->pending_ios--;
+			f->done++;
 			if (cqe->res != bs) {
 				printf("io: unexpected ret=%d\n", cqe->res);
 				if (polled && cqe->res == -EOPNOTSUPP)
@@ -755,12 +773,13 @@ static int reap_events_uring(struct submitter *s)
 		if (stats) {
 			int clock_index = cqe->user_data >> 32;
 
-			if (last_idx != clock_index) {
+			if (last_idx != clock_index || last_f != f) {
 				if (last_idx != -1) {
-					add_stat(s, last_idx, stat_nr);
+					add_stat(s, last_f, last_idx, stat_nr);
 					stat_nr = 0;
 				}
 				last_idx = clock_index;
+				last_f = f;
 			}
 			stat_nr++;
 		}
@@ -769,7 +788,7 @@ static int reap_events_uring(struct submitter *s)
 	} while (1);
 
 	if (stat_nr)
-		add_stat(s, last_idx, stat_nr);
+		add_stat(s, last_f, last_idx, stat_nr);
 
 	if (reaped) {
 		s->inflight -= reaped;
@@ -784,6 +803,7 @@ static int reap_events_uring_pt(struct submitter *s)
 	struct io_uring_cqe *cqe;
 	unsigned head, reaped = 0;
 	int last_idx = -1, stat_nr = 0;
+	struct file *last_f = NULL;
 	unsigned index;
 	int fileno;
 
@@ -798,6 +818,7 @@ static int reap_events_uring_pt(struct submitter *s)
 		fileno = cqe->user_data & 0xffffffff;
 		f = &s->files[fileno];
 		f->pending_ios--;
+		f->done++;
 
 		if (cqe->res != 0) {
 			printf("io: unexpected ret=%d\n", cqe->res);
@@ -808,12 +829,13 @@ static int reap_events_uring_pt(struct submitter *s)
 		if (stats) {
 			int clock_index = cqe->user_data >> 32;
 
-			if (last_idx != clock_index) {
+			if (last_idx != clock_index || last_f != f) {
 				if (last_idx != -1) {
-					add_stat(s, last_idx, stat_nr);
+					add_stat(s, last_f, last_idx, stat_nr);
 					stat_nr = 0;
 				}
 				last_idx = clock_index;
+				last_f = f;
 			}
 			stat_nr++;
 		}
@@ -822,7 +844,7 @@ static int reap_events_uring_pt(struct submitter *s)
 	} while (1);
 
 	if (stat_nr)
-		add_stat(s, last_idx, stat_nr);
+		add_stat(s, last_f, last_idx, stat_nr);
 
 	if (reaped) {
 		s->inflight -= reaped;
@@ -831,6 +853,46 @@ static int reap_events_uring_pt(struct submitter *s)
 	return reaped;
 }
 
+#ifndef CONFIG_LIBNUMA
+/*
+ * Without libnuma, pin to the CPUs sysfs lists for the node
+ */
+static int node_to_cpuset(int node, cpu_set_t *mask)
+{
+	char path[64], buf[4096], *p, *tok;
+	int fd, ret;
+
+	sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	ret = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (ret <= 0)
+		return -1;
+	buf[ret] = '\0';
+
+	CPU_ZERO(mask);
+	p = buf;
+	while ((tok = strsep(&p, ",\n")) != NULL) {
+		int first, last;
+
+		if (!strlen(tok))
+			continue;
+		ret = sscanf(tok, "%d-%d", &first, &last);
+		if (ret < 1)
+			return -1;
+		if (ret == 1)
+			last = first;
+		for (; first <= last && first < CPU_SETSIZE; first++)
+			CPU_SET(first, mask);
+	}
+
+	return CPU_COUNT(mask) ? 0 : -1;
+}
+#endif
+
 static void set_affinity(struct submitter *s)
 {
 #ifdef CONFIG_LIBNUMA
@@ -844,35 +906,77 @@ static void set_affinity(struct submitter *s)
 	mask = numa_allocate_cpumask();
 	numa_node_to_cpus(s->numa_node, mask);
 	numa_sched_setaffinity(s->tid, mask);
+#else
+	cpu_set_t mask;
+
+	if (s->numa_node == -1)
+		return;
+
+	if (node_to_cpuset(s->numa_node, &mask) ||
+	    sched_setaffinity(s->tid, sizeof(mask), &mask))
+		printf("submitter=%d: failed pinning to node %d\n", s->index,
+								s->numa_node);
 #endif
 }
 
-static int detect_node(struct submitter *s, const char *name)
+static int read_node(const char *path)
 {
-#ifdef CONFIG_LIBNUMA
-	const char *base = basename(name);
-	char str[128];
-	int ret, fd, node;
+	char str[32];
+	int ret, fd;
 
-	if (pt)
-		sprintf(str, "/sys/class/nvme-generic/%s/device/numa_node", base);
-	else
-		sprintf(str, "/sys/block/%s/device/numa_node", base);
-	fd = open(str, O_RDONLY);
+	fd = open(path, O_RDONLY);
 	if (fd < 0)
 		return -1;
 
-	ret = read(fd, str, sizeof(str));
-	if (ret < 0) {
-		close(fd);
+	ret = read(fd, str, sizeof(str) - 1);
+	close(fd);
+	if (ret <= 0)
 		return -1;
+
+	str[ret] = '\0';
+	return atoi(str);
+}
+
+/*
+ * Find the NUMA node of the device backing 'name'. That's the device
+ * itself for a block device, and the device the file lives on for a
+ * regular file. Partitions have no device link of their own, so try the
+ * parent disk as well.
+ */
+static int detect_node(struct submitter *s, const char *name)
+{
+	char path[256];
+	struct stat sb;
+	dev_t dev;
+	int node;
+
+	if (pt) {
+		const char *base = basename(name);
+
+		snprintf(path, sizeof(path),
+			"/sys/class/nvme-generic/%s/device/numa_node", base);
+		node = read_node(path);
+	} else {
+		if (stat(name, &sb) < 0)
+			return -1;
+		dev = S_ISBLK(sb.st_mode) ? sb.st_rdev : sb.st_dev;
+
+		snprintf(path, sizeof(path),
+			"/sys/dev/block/%u:%u/device/numa_node",
+			major(dev), minor(dev));
+		node = read_node(path);
+		if (node < 0) {
+			snprintf(path, sizeof(path),
+				"/sys/dev/block/%u:%u/../device/numa_node",
+				major(dev), minor(dev));
+			node = read_node(path);
+		}
 	}
-	node = atoi(str);
+
+	if (node < 0)
+		return -1;
+
 	s->numa_node = node;
-	close(fd);
-#else
-	s->numa_node = -1;
-#endif
 	return 0;
 }
 
@@ -1084,6 +1188,8 @@ static int submitter_init(struct submitter *s)
 		s->clock_index = 1;
 
 		s->plat = calloc(PLAT_NR, sizeof(unsigned long));
+		for (i = 0; i < s->nr_files; i++)
+			s->files[i].plat = calloc(PLAT_NR, sizeof(unsigned long));
 	} else {
 		s->clock_batch = NULL;
 		s->plat = NULL;
@@ -1130,6 +1236,7 @@ static int prep_more_ios_aio(struct submitter *s, int max_ios, struct iocb *iocb
 static int reap_events_aio(struct submitter *s, struct io_event *events, int evs)
 {
 	int last_idx = -1, stat_nr = 0;
+	struct file *last_f = NULL;
 	int reaped = 0;
 
 	while (evs) {
@@ -1137,6 +1244,7 @@ static int reap_events_aio(struct submitter *s, struct io_event *events, int evs
 		struct file *f = &s->files[data & 0xffffffff];
 
 		f->pending_ios--;
+		f->done++;
 		if (events[reaped].res != bs) {
 			printf("io: unexpected ret=%ld\n", events[reaped].res);
 			return -1;
@@ -1144,12 +1252,13 @@ static int reap_events_aio(struct submitter *s, struct io_event *events, int evs
 		if (stats) {
 			int clock_index = data >> 32;
 
-			if (last_idx != clock_index) {
+			if (last_idx != clock_index || last_f != f) {
 				if (last_idx != -1) {
-					add_stat(s, last_idx, stat_nr);
+					add_stat(s, last_f, last_idx, stat_nr);
 					stat_nr = 0;
 				}
 				last_idx = clock_index;
+				last_f = f;
 			}
 			stat_nr++;
 		}
@@ -1158,7 +1267,7 @@ static int reap_events_aio(struct submitter *s, struct io_event *events, int evs
 	}
 
 	if (stat_nr)
-		add_stat(s, last_idx, stat_nr);
+		add_stat(s, last_f, last_idx, stat_nr);
 
 	s->inflight -= reaped;
 	s->done += reaped;
@@ -1426,8 +1535,9 @@ static void *submitter_sync_fn(void *data)
 		s->done++;
 		s->inflight--;
 		f->pending_ios--;
+		f->done++;
 		if (stats)
-			add_stat(s, s->clock_index, 1);
+			add_stat(s, f, s->clock_index, 1);
 	} while (!s->finish);
 
 	finish = 1;
@@ -1474,6 +1584,7 @@ static void do_finish(const char *reason)
 
 static void sig_int(int sig)
 {
+	aborted = 1;
 	do_finish("signal");
 }
 
@@ -1497,8 +1608,8 @@ static void usage(char *argv, int status)
 	char runtime_str[16];
 	snprintf(runtime_str, sizeof(runtime_str), "%d", runtime);
 	printf("%s [options] -- [filenames]\n"
-		" -d <int>  : IO Depth, default %d\n"
-		" -s <int>  : Batch submit, default %d\n"
+		" -d <list> : IO Depth, default %d\n"
+		" -s <list> : Batch submit, default %d\n"
 		" -c <int>  : Batch complete, default %d\n"
 		" -b <int>  : Block size, default %d\n"
 		" -p <bool> : Polled IO, default %d\n"
@@ -1516,7 +1627,10 @@ static void usage(char *argv, int status)
 		" -S <bool> : Use sync IO (preadv2), default %d\n"
 		" -X <bool> : Use registered ring %d\n"
 		" -P <bool> : Automatically place on device home node %d\n"
-		" -u <bool> : Use nvme-passthrough I/O, default %d\n",
+		" -u <bool> : Use nvme-passthrough I/O, default %d\n"
+		" -j <file> : Write JSON results to file, - for stdout\n"
+		"A comma separated list for -d or -s runs each combination in\n"
+		"turn, for -r seconds each.\n",
 		argv, DEPTH, BATCH_SUBMIT, BATCH_COMPLETE, BS, polled,
 		fixedbufs, dma_map, register_files, nthreads, !buffered, do_nop,
 		stats, runtime == 0 ? "unlimited" : runtime_str, random_io, aio,
@@ -1524,6 +1638,29 @@ static void usage(char *argv, int status)
 	exit(status);
 }
 
+static int parse_list(char *str, int *vals, int *nr)
+{
+	char *tok;
+
+	*nr = 0;
+	while ((tok = strsep(&str, ",")) != NULL) {
+		if (!strlen(tok))
+			continue;
+		if (*nr == MAX_SWEEP) {
+			printf("Max of %d sweep values\n", MAX_SWEEP);
+			return 1;
+		}
+		vals[*nr] = atoi(tok);
+		if (vals[*nr] < 0) {
+			printf("Bad value: %s\n", tok);
+			return 1;
+		}
+		(*nr)++;
+	}
+
+	return !*nr;
+}
+
 static void read_tsc_rate(void)
 {
 	char buffer[32];
@@ -1568,118 +1705,168 @@ static void write_tsc_rate(void)
 	close(fd);
 }
 
-int main(int argc, char *argv[])
+static const char *engine_name(void)
+{
+	if (use_sync)
+		return "preadv2";
+	if (aio)
+		return "aio";
+	return "io_uring";
+}
+
+static void json_lat(unsigned long *plat)
+{
+	unsigned long *ovals, minv, maxv, nr = 0;
+	unsigned int i, len;
+
+	if (!plat)
+		return;
+
+	for (i = 0; i < PLAT_NR; i++)
+		nr += plat[i];
+	if (!nr)
+		return;
+
+	len = calculate_clat_percentiles(plat, nr, &ovals, &maxv, &minv);
+	if (!len || !ovals)
+		return;
+
+	fprintf(json_out, ", \"lat_samples\": %lu, \"lat_unit\": \"%s\", "
+			"\"lat_percentiles\": {", nr,
+			tsc_rate ? "nsec" : "ticks");
+	for (i = 0; i < len; i++)
+		fprintf(json_out, "%s\"%f\": %lu", i ? ", " : "", plist[i],
+			ovals[i]);
+	fprintf(json_out, "}");
+	free(ovals);
+}
+
+static void json_io(unsigned long ios, unsigned long msec)
+{
+	unsigned long iops = msec ? ios * 1000 / msec : 0;
+
+	fprintf(json_out, "\"ios\": %lu, \"iops\": %lu, \"bw_bytes\": %llu",
+		ios, iops, (unsigned long long) iops * bs);
+}
+
+static void json_header(void)
+{
+	fprintf(json_out, "{\n  \"config\": {\"engine\": \"%s\", \"bs\": %d, "
+		"\"polled\": %d, \"fixedbufs\": %d, \"register_files\": %d, "
+		"\"buffered\": %d, \"random\": %d, \"nthreads\": %d, "
+		"\"numa_placement\": %d, \"runtime\": %d},\n  \"runs\": [",
+		engine_name(), bs, polled, fixedbufs, register_files, buffered,
+		random_io, nthreads, numa_placement, runtime);
+}
+
+/*
+ * One sweep point: aggregate, per device and per thread results.
+ */
+static void json_run(char *files[], int nfiles, unsigned long msec)
 {
+	unsigned long *plat = NULL, done = 0;
 	struct submitter *s;
-	unsigned long done, calls, reap;
-	int i, j, flags, fd, opt, threads_per_f, threads_rem = 0, nfiles;
-	struct file f;
-	void *ret;
+	int i, j, k, l;
 
-	if (!do_nop && argc < 2)
-		usage(argv[0], 1);
+	if (stats)
+		plat = calloc(PLAT_NR, sizeof(unsigned long));
 
-	while ((opt = getopt(argc, argv, "d:s:c:b:p:B:F:n:N:O:t:T:a:r:D:R:X:S:P:u:h?")) != -1) {
-		switch (opt) {
-		case 'a':
-			aio = !!atoi(optarg);
-			break;
-		case 'd':
-			depth = atoi(optarg);
-			break;
-		case 's':
-			batch_submit = atoi(optarg);
-			if (!batch_submit)
-				batch_submit = 1;
-			break;
-		case 'c':
-			batch_complete = atoi(optarg);
-			if (!batch_complete)
-				batch_complete = 1;
-			break;
-		case 'b':
-			bs = atoi(optarg);
-			break;
-		case 'p':
-			polled = !!atoi(optarg);
-			break;
-		case 'B':
-			fixedbufs = !!atoi(optarg);
-			break;
-		case 'F':
-			register_files = !!atoi(optarg);
-			break;
-		case 'n':
-			nthreads = atoi(optarg);
-			if (!nthreads) {
-				printf("Threads must be non-zero\n");
-				usage(argv[0], 1);
+	for (j = 0; j < nthreads; j++) {
+		s = get_submitter(j);
+		for (k = 0; k < s->nr_files; k++)
+			done += s->files[k].done;
+		for (i = 0; plat && i < PLAT_NR; i++)
+			plat[i] += s->plat[i];
+	}
+
+	fprintf(json_out, "%s\n    {\"depth\": %d, \"batch_submit\": %d, "
+		"\"batch_complete\": %d, \"elapsed_msec\": %lu, "
+		"\"max_iops\": %lu, ", json_sep, depth, batch_submit,
+		batch_complete, msec, max_iops);
+	json_io(done, msec);
+	json_lat(plat);
+	json_sep = ",";
+
+	fprintf(json_out, ",\n     \"devices\": [");
+	for (i = 0; i < nfiles; i++) {
+		int node = -1;
+
+		if (plat)
+			memset(plat, 0, PLAT_NR * sizeof(unsigned long));
+		done = 0;
+		for (j = 0; j < nthreads; j++) {
+			s = get_submitter(j);
+			for (k = 0; k < s->nr_files; k++) {
+				struct file *f = &s->files[k];
+
+				if (f->name != files[i])
+					continue;
+				done += f->done;
+				node = s->numa_node;
+				for (l = 0; plat && l < PLAT_NR; l++)
+					plat[l] += f->plat[l];
 			}
-			break;
-		case 'N':
-			do_nop = !!atoi(optarg);
-			break;
-		case 'O':
-			buffered = !atoi(optarg);
-			break;
-		case 't':
-#ifndef ARCH_HAVE_CPU_CLOCK
-			fprintf(stderr, "Stats not supported on this CPU\n");
-			return 1;
-#endif
-			stats = !!atoi(optarg);
-			break;
-		case 'T':
-#ifndef ARCH_HAVE_CPU_CLOCK
-			fprintf(stderr, "Stats not supported on this CPU\n");
-			return 1;
-#endif
-			tsc_rate = strtoul(optarg, NULL, 10);
-			write_tsc_rate();
-			break;
-		case 'r':
-			runtime = atoi(optarg);
-			break;
-		case 'D':
-			dma_map = !!atoi(optarg);
-			break;
-		case 'R':
-			random_io = !!atoi(optarg);
-			break;
-		case 'X':
-			register_ring = !!atoi(optarg);
-			break;
-		case 'S':
-#ifdef CONFIG_PWRITEV2
-			use_sync = !!atoi(optarg);
-#else
-			fprintf(stderr, "preadv2 not supported\n");
-			exit(1);
-#endif
-			break;
-		case 'P':
-			numa_placement = !!atoi(optarg);
-			break;
-		case 'u':
-			pt = !!atoi(optarg);
-			break;
-		case 'h':
-		case '?':
-		default:
-			usage(argv[0], 0);
-			break;
 		}
+
+		fprintf(json_out, "%s\n       {\"name\": \"%s\", \"node\": %d, ",
+			i ? "," : "", files[i], node);
+		json_io(done, msec);
+		json_lat(plat);
+		fprintf(json_out, "}");
 	}
 
-	if (stats)
-		read_tsc_rate();
+	fprintf(json_out, "],\n     \"threads\": [");
+	for (j = 0; j < nthreads; j++) {
+		s = get_submitter(j);
+		done = 0;
+		for (k = 0; k < s->nr_files; k++)
+			done += s->files[k].done;
+
+		fprintf(json_out, "%s\n       {\"index\": %d, \"tid\": %d, "
+			"\"node\": %d, \"calls\": %lu, \"reaps\": %lu, ",
+			j ? "," : "", s->index, s->tid, s->numa_node, s->calls,
+			s->reaps);
+		json_io(do_nop ? s->done : done, msec);
+		json_lat(s->plat);
+		fprintf(json_out, "}");
+	}
+	fprintf(json_out, "]}");
+	fflush(json_out);
+	free(plat);
+}
 
+static unsigned long msec_since(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 +
+		(now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/*
+ * Set up the submitters for the current depth and batch, run them and
+ * report. argv[first] and on are the files.
+ */
+static int run_one(int argc, char *argv[], int first)
+{
+	struct submitter *s;
+	unsigned long done, calls, reap;
+	int i, j, flags, fd, threads_per_f, threads_rem = 0, nfiles;
+	int left = runtime, nopen = 0, *fds;
+	struct timespec start;
+	struct file f;
+	void *ret;
+
+	finish = 0;
+	stats_running = 0;
+	max_iops = 0;
+
+	batch_complete = batch_complete_opt;
 	if (batch_complete > depth)
 		batch_complete = depth;
 	if (batch_submit > depth)
 		batch_submit = depth;
-	if (!fixedbufs && dma_map)
-		dma_map = 0;
 
 	submitter = calloc(nthreads, sizeof(*submitter) +
 				roundup_pow2(depth) * sizeof(struct iovec));
@@ -1695,8 +1882,9 @@ int main(int argc, char *argv[])
 		flags |= O_DIRECT;
 
 	j = 0;
-	i = optind;
+	i = first;
 	nfiles = argc - i;
+	fds = calloc(nfiles + 1, sizeof(int));
 	if (!do_nop) {
 		if (!nfiles) {
 			printf("No files specified\n");
@@ -1720,7 +1908,9 @@ int main(int argc, char *argv[])
 			perror("open");
 			return 1;
 		}
+		fds[nopen++] = fd;
 		f.real_fd = fd;
+		f.name = argv[i];
 		if (get_file_size(&f)) {
 			printf("failed getting size of device/file\n");
 			return 1;
@@ -1754,12 +1944,7 @@ int main(int argc, char *argv[])
 		j += limit;
 	}
 
-	arm_sig_int();
-
-	t_io_uring_page_size = sysconf(_SC_PAGESIZE);
-	if (t_io_uring_page_size < 0)
-		t_io_uring_page_size = 4096;
-
+	clock_gettime(CLOCK_MONOTONIC, &start);
 	for (j = 0; j < nthreads; j++) {
 		s = get_submitter(j);
 		if (use_sync)
@@ -1781,7 +1966,7 @@ int main(int argc, char *argv[])
 		unsigned long iops, bw;
 
 		sleep(1);
-		if (runtime && !--runtime)
+		if (left && !--left)
 			do_finish("timeout");
 
 		/* don't print partial run, if interrupted by signal */
@@ -1836,7 +2021,8 @@ int main(int argc, char *argv[])
 	for (j = 0; j < nthreads; j++) {
 		s = get_submitter(j);
 		pthread_join(s->thread, &ret);
-		close(s->ring_fd);
+		if (!aio && !use_sync)
+			close(s->ring_fd);
 
 		if (stats) {
 			unsigned long nr;
@@ -1845,11 +2031,181 @@ int main(int argc, char *argv[])
 			for (i = 0, nr = 0; i < PLAT_NR; i++)
 				nr += s->plat[i];
 			show_clat_percentiles(s->plat, nr, 4);
-			free(s->clock_batch);
-			free(s->plat);
 		}
 	}
 
+	if (json_out)
+		json_run(&argv[first], nfiles, msec_since(&start));
+
+	for (j = 0; j < nthreads; j++) {
+		s = get_submitter(j);
+		for (i = 0; i < s->nr_files; i++)
+			free(s->files[i].plat);
+		free(s->clock_batch);
+		free(s->plat);
+	}
+
+	for (i = 0; i < nopen; i++)
+		close(fds[i]);
+	free(fds);
 	free(submitter);
+	submitter = NULL;
 	return 0;
 }
+
+int main(int argc, char *argv[])
+{
+	int i, j, opt, ret = 0;
+
+	if (!do_nop && argc < 2)
+		usage(argv[0], 1);
+
+	while ((opt = getopt(argc, argv, "d:s:c:b:p:B:F:n:N:O:t:T:a:r:D:R:X:S:P:u:j:h?")) != -1) {
+		switch (opt) {
+		case 'a':
+			aio = !!atoi(optarg);
+			break;
+		case 'd':
+			if (parse_list(optarg, depths, &nr_depths))
+				usage(argv[0], 1);
+			for (i = 0; i < nr_depths; i++) {
+				if (!depths[i]) {
+					printf("Depth must be non-zero\n");
+					usage(argv[0], 1);
+				}
+			}
+			break;
+		case 's':
+			if (parse_list(optarg, batches, &nr_batches))
+				usage(argv[0], 1);
+			for (i = 0; i < nr_batches; i++)
+				if (!batches[i])
+					batches[i] = 1;
+			break;
+		case 'c':
+			batch_complete_opt = atoi(optarg);
+			if (!batch_complete_opt)
+				batch_complete_opt = 1;
+			break;
+		case 'b':
+			bs = atoi(optarg);
+			break;
+		case 'p':
+			polled = !!atoi(optarg);
+			break;
+		case 'B':
+			fixedbufs = !!atoi(optarg);
+			break;
+		case 'F':
+			register_files = !!atoi(optarg);
+			break;
+		case 'n':
+			nthreads = atoi(optarg);
+			if (!nthreads) {
+				printf("Threads must be non-zero\n");
+				usage(argv[0], 1);
+			}
+			break;
+		case 'N':
+			do_nop = !!atoi(optarg);
+			break;
+		case 'O':
+			buffered = !atoi(optarg);
+			break;
+		case 't':
+#ifndef ARCH_HAVE_CPU_CLOCK
+			fprintf(stderr, "Stats not supported on this CPU\n");
+			return 1;
+#endif
+			stats = !!atoi(optarg);
+			break;
+		case 'T':
+#ifndef ARCH_HAVE_CPU_CLOCK
+			fprintf(stderr, "Stats not supported on this CPU\n");
+			return 1;
+#endif
+			tsc_rate = strtoul(optarg, NULL, 10);
+			write_tsc_rate();
+			break;
+		case 'r':
+			runtime = atoi(optarg);
+			break;
+		case 'D':
+			dma_map = !!atoi(optarg);
+			break;
+		case 'R':
+			random_io = !!atoi(optarg);
+			break;
+		case 'X':
+			register_ring = !!atoi(optarg);
+			break;
+		case 'S':
+#ifdef CONFIG_PWRITEV2
+			use_sync = !!atoi(optarg);
+#else
+			fprintf(stderr, "preadv2 not supported\n");
+			exit(1);
+#endif
+			break;
+		case 'P':
+			numa_placement = !!atoi(optarg);
+			break;
+		case 'u':
+			pt = !!atoi(optarg);
+			break;
+		case 'j':
+			if (!strcmp(optarg, "-"))
+				json_out = stdout;
+			else
+				json_out = fopen(optarg, "w");
+			if (!json_out) {
+				perror("fopen");
+				return 1;
+			}
+			break;
+		case 'h':
+		case '?':
+		default:
+			usage(argv[0], 0);
+			break;
+		}
+	}
+
+	if (nr_depths * nr_batches > 1 && !runtime) {
+		printf("A depth/batch sweep needs a runtime (-r)\n");
+		return 1;
+	}
+
+	if (stats)
+		read_tsc_rate();
+
+	if (!fixedbufs && dma_map)
+		dma_map = 0;
+
+	arm_sig_int();
+
+	t_io_uring_page_size = sysconf(_SC_PAGESIZE);
+	if (t_io_uring_page_size < 0)
+		t_io_uring_page_size = 4096;
+
+	if (json_out)
+		json_header();
+
+	for (i = 0; i < nr_depths && !aborted && !ret; i++) {
+		for (j = 0; j < nr_batches && !aborted && !ret; j++) {
+			depth = depths[i];
+			batch_submit = batches[j];
+			if (nr_depths * nr_batches > 1)
+				printf("Run: QD=%d, batch_submit=%d\n", depth,
+								batch_submit);
+			ret = run_one(argc, argv, optind);
+		}
+	}
+
+	if (json_out) {
+		fprintf(json_out, "\n  ]\n}\n");
+		if (json_out != stdout)
+			fclose(json_out);
+	}
+	return ret;
+}
@@ -0,0 +1,624 @@
+/*
+ * Native backend for tools/fiologparser.py. Aggregates fio bw/iops/lat
+ * logs, text or log_binary=1, into time weighted intervals:
+ *
+ *	fio-logparser [-i msec] [-d divisor] [-t threads] [-s|-a|-f] files
+ *
+ * A sample covers the time from the previous sample in its file to its
+ * own timestamp, and adds value * overlap / interval to each interval it
+ * overlaps. Output matches fiologparser.py.
+ *
+ * Files are mmap'ed and cut into line (or record) aligned chunks, which
+ * worker threads parse into per interval sums. The intervals end at the
+ * earliest end time of all files, so the last interval is usually short.
+ * Its sums are redone for the files that run past it, from the byte range
+ * each interval records.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../log.h"
+#include "../minmax.h"
+#include "../os/os.h"
+#include "../iolog.h"
+#include "../lib/columnar.h"
+
+#define CHUNK_MIN	(32ULL * 1024 * 1024)
+
+enum {
+	OUT_DEFAULT = 0,
+	OUT_SUM,
+	OUT_AVG,
+	OUT_FULL,
+};
+
+/*
+ * Per interval sums of value * overlap. first/last are the byte range of
+ * the samples that overlap the interval.
+ */
+struct bins {
+	uint64_t lo;
+	uint64_t nr;
+	uint64_t size;
+	double *sum;
+	uint64_t *first;
+	uint64_t *last;
+};
+
+struct lp_file {
+	const char *name;
+	const char *map;
+	uint64_t size;
+	uint64_t data_off;
+	int binary;
+
+	struct bins bins;
+	uint64_t max_end;
+	uint64_t nr_samples;
+};
+
+struct lp_chunk {
+	struct lp_file *f;
+	uint64_t start;
+	uint64_t end;
+
+	struct bins bins;
+	uint64_t max_end;
+	uint64_t nr_samples;
+	int err;
+};
+
+struct lp_iter {
+	const struct lp_file *f;
+	uint64_t pos;
+	uint64_t end;
+	uint64_t prev;
+};
+
+static uint64_t interval = 1000;
+static unsigned int divisor = 1;
+static unsigned int num_threads;
+static int out_mode = OUT_DEFAULT;
+
+static struct lp_chunk *chunks;
+static unsigned int nr_chunks, next_chunk;
+static pthread_mutex_t chunk_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Make interval 'k' addressable, the array grows both ways.
+ */
+static int bins_get(struct bins *b, uint64_t k, uint64_t *idx)
+{
+	uint64_t lo, hi, size, shift;
+
+	if (b->nr && k >= b->lo && k < b->lo + b->nr) {
+		*idx = k - b->lo;
+		return 0;
+	}
+
+	lo = b->nr ? min(b->lo, k) : k;
+	hi = b->nr ? max(b->lo + b->nr, k + 1) : k + 1;
+	shift = b->nr ? b->lo - lo : 0;
+
+	if (hi - lo > b->size) {
+		double *sum;
+		uint64_t *first, *last;
+
+		size = max(hi - lo, 2 * b->size);
+		size = max(size, (uint64_t) 64);
+		sum = realloc(b->sum, size * sizeof(*sum));
+		if (sum)
+			b->sum = sum;
+		first = realloc(b->first, size * sizeof(*first));
+		if (first)
+			b->first = first;
+		last = realloc(b->last, size * sizeof(*last));
+		if (last)
+			b->last = last;
+		if (!sum || !first || !last)
+			return ENOMEM;
+		b->size = size;
+	}
+
+	if (shift) {
+		memmove(&b->sum[shift], b->sum, b->nr * sizeof(*b->sum));
+		memmove(&b->first[shift], b->first, b->nr * sizeof(*b->first));
+		memmove(&b->last[shift], b->last, b->nr * sizeof(*b->last));
+	}
+	for (size = b->nr + shift; size < hi - lo; size++) {
+		b->sum[size] = 0;
+		b->first[size] = UINT64_MAX;
+		b->last[size] = 0;
+	}
+	for (size = 0; size < shift; size++) {
+		b->sum[size] = 0;
+		b->first[size] = UINT64_MAX;
+		b->last[size] = 0;
+	}
+
+	b->lo = lo;
+	b->nr = hi - lo;
+	*idx = k - lo;
+	return 0;
+}
+
+static void bins_free(struct bins *b)
+{
+	free(b->sum);
+	free(b->first);
+	free(b->last);
+	memset(b, 0, sizeof(*b));
+}
+
+/*
+ * Parse "time, value, ..." at 'p'. Returns 0 for lines that don't start
+ * with two numbers.
+ */
+static int parse_line(const char *p, const char *end, uint64_t *time,
+		      uint64_t *val)
+{
+	uint64_t v[2];
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		const char *start;
+
+		while (p < end && (*p == ' ' || *p == ','))
+			p++;
+		start = p;
+		v[i] = 0;
+		while (p < end && *p >= '0' && *p <= '9')
+			v[i] = v[i] * 10 + (*p++ - '0');
+		if (p == start)
+			return 0;
+	}
+
+	*time = v[0];
+	*val = v[1];
+	return 1;
+}
+
+static const char *line_end(const struct lp_file *f, uint64_t pos)
+{
+	const char *nl;
+
+	nl = memchr(f->map + pos, '\n', f->size - pos);
+	return nl ? nl : f->map + f->size;
+}
+
+/*
+ * The time of the last sample before 'pos', where the first sample at
+ * 'pos' starts.
+ */
+static uint64_t prev_time(const struct lp_file *f, uint64_t pos)
+{
+	uint64_t time, val, start;
+
+	if (f->binary) {
+		const struct io_binlog_sample *s;
+
+		if (pos == f->data_off)
+			return 0;
+		s = (const void *) (f->map + pos - sizeof(*s));
+		return le64_to_cpu(s->time);
+	}
+
+	while (pos > f->data_off) {
+		start = pos - 1;
+		while (start > f->data_off && f->map[start - 1] != '\n')
+			start--;
+		if (parse_line(f->map + start, f->map + pos, &time, &val))
+			return time;
+		pos = start;
+	}
+
+	return 0;
+}
+
+static void iter_init(struct lp_iter *it, const struct lp_file *f,
+		      uint64_t start, uint64_t end)
+{
+	it->f = f;
+	it->pos = start;
+	it->end = end;
+	it->prev = prev_time(f, start);
+}
+
+/*
+ * Next sample in the range, [*s, *e] is the time it covers and *off its
+ * byte offset.
+ */
+static int iter_next(struct lp_iter *it, uint64_t *s, uint64_t *e,
+		     uint64_t *val, uint64_t *off)
+{
+	const struct lp_file *f = it->f;
+
+	if (f->binary) {
+		const struct io_binlog_sample *bs;
+
+		if (it->pos + sizeof(*bs) > it->end)
+			return 0;
+		bs = (const void *) (f->map + it->pos);
+		*off = it->pos;
+		*s = it->prev;
+		*e = it->prev = le64_to_cpu(bs->time);
+		*val = le64_to_cpu(bs->val);
+		it->pos += sizeof(*bs);
+		return 1;
+	}
+
+	while (it->pos < it->end) {
+		const char *eol = line_end(f, it->pos);
+		uint64_t time;
+
+		*off = it->pos;
+		it->pos = eol - f->map + 1;
+		if (!parse_line(f->map + *off, eol, &time, val))
+			continue;
+
+		*s = it->prev;
+		*e = it->prev = time;
+		return 1;
+	}
+
+	return 0;
+}
+
+static int parse_chunk(struct lp_chunk *c)
+{
+	struct lp_iter it;
+	uint64_t s, e, val, off, k, idx;
+
+	iter_init(&it, c->f, c->start, c->end);
+	while (iter_next(&it, &s, &e, &val, &off)) {
+		c->nr_samples++;
+		if (e > c->max_end)
+			c->max_end = e;
+		if (e <= s)
+			continue;
+
+		for (k = s / interval; k * interval < e; k++) {
+			uint64_t lo = max(s, k * interval);
+			uint64_t hi = min(e, (k + 1) * interval);
+
+			if (bins_get(&c->bins, k, &idx))
+				return ENOMEM;
+			c->bins.sum[idx] += (double) val * (hi - lo);
+			if (off < c->bins.first[idx])
+				c->bins.first[idx] = off;
+			if (it.pos > c->bins.last[idx])
+				c->bins.last[idx] = it.pos;
+		}
+	}
+
+	return 0;
+}
+
+static void *worker_fn(void *data)
+{
+	struct lp_chunk *c;
+	unsigned int i;
+
+	for (;;) {
+		pthread_mutex_lock(&chunk_lock);
+		i = next_chunk++;
+		pthread_mutex_unlock(&chunk_lock);
+		if (i >= nr_chunks)
+			break;
+
+		c = &chunks[i];
+		c->err = parse_chunk(c);
+	}
+
+	return NULL;
+}
+
+static int map_file(struct lp_file *f)
+{
+	struct stat sb;
+	void *map;
+	int fd;
+
+	fd = open(f->name, O_RDONLY);
+	if (fd < 0 || fstat(fd, &sb) < 0) {
+		log_err("fio-logparser: %s: %s\n", f->name, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return 1;
+	}
+	if (!sb.st_size) {
+		log_err("fio-logparser: %s: empty log\n", f->name);
+		close(fd);
+		return 1;
+	}
+
+	map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		log_err("fio-logparser: mmap %s: %s\n", f->name, strerror(errno));
+		return 1;
+	}
+#ifdef MADV_SEQUENTIAL
+	madvise(map, sb.st_size, MADV_SEQUENTIAL);
+#endif
+
+	f->map = map;
+	f->size = sb.st_size;
+
+	if (f->size >= 8 && !memcmp(f->map, FIO_COLUMNAR_MAGIC, 8)) {
+		log_err("fio-logparser: %s: columnar log, use fio_columnar\n",
+			f->name);
+		return 1;
+	}
+	if (f->size >= sizeof(struct io_binlog_hdr) &&
+	    !memcmp(f->map, FIO_BINLOG_MAGIC, 8)) {
+		f->binary = 1;
+		f->data_off = sizeof(struct io_binlog_hdr);
+	}
+
+	return 0;
+}
+
+/*
+ * Cut a file in chunks of about size / threads, on line or record
+ * boundaries.
+ */
+static int add_chunks(struct lp_file *f)
+{
+	uint64_t len = f->size - f->data_off, step, pos, end;
+	struct lp_chunk *c;
+
+	step = max(len / num_threads, (uint64_t) CHUNK_MIN);
+	if (f->binary) {
+		step -= step % sizeof(struct io_binlog_sample);
+		len -= len % sizeof(struct io_binlog_sample);
+	}
+
+	for (pos = f->data_off; pos < f->data_off + len; pos = end) {
+		end = min(pos + step, f->data_off + len);
+		if (!f->binary && end < f->size)
+			end = line_end(f, end) - f->map + 1;
+		if (len - (end - f->data_off) < step / 4)
+			end = f->data_off + len;
+
+		c = realloc(chunks, (nr_chunks + 1) * sizeof(*chunks));
+		if (!c)
+			return ENOMEM;
+		chunks = c;
+		c = &chunks[nr_chunks++];
+		memset(c, 0, sizeof(*c));
+		c->f = f;
+		c->start = pos;
+		c->end = end;
+	}
+
+	return 0;
+}
+
+static int merge_chunk(struct lp_chunk *c)
+{
+	struct lp_file *f = c->f;
+	uint64_t i, idx;
+
+	f->nr_samples += c->nr_samples;
+	f->max_end = max(f->max_end, c->max_end);
+
+	for (i = 0; i < c->bins.nr; i++) {
+		if (c->bins.first[i] == UINT64_MAX)
+			continue;
+		if (bins_get(&f->bins, c->bins.lo + i, &idx))
+			return ENOMEM;
+		f->bins.sum[idx] += c->bins.sum[i];
+		f->bins.first[idx] = min(f->bins.first[idx], c->bins.first[i]);
+		f->bins.last[idx] = max(f->bins.last[idx], c->bins.last[i]);
+	}
+
+	bins_free(&c->bins);
+	return 0;
+}
+
+static double bin_sum(const struct lp_file *f, uint64_t k)
+{
+	if (k < f->bins.lo || k >= f->bins.lo + f->bins.nr)
+		return 0;
+	return f->bins.sum[k - f->bins.lo];
+}
+
+/*
+ * Redo the sum of interval 'k', ending at 'ftime', for a file with samples
+ * past ftime.
+ */
+static double clip_bin(struct lp_file *f, uint64_t k, uint64_t ftime)
+{
+	uint64_t s, e, val, off, idx;
+	struct lp_iter it;
+	double sum = 0;
+
+	if (f->max_end <= ftime)
+		return bin_sum(f, k);
+	if (k < f->bins.lo || k >= f->bins.lo + f->bins.nr)
+		return 0;
+
+	idx = k - f->bins.lo;
+	if (f->bins.first[idx] == UINT64_MAX)
+		return 0;
+
+	iter_init(&it, f, f->bins.first[idx], f->bins.last[idx]);
+	while (iter_next(&it, &s, &e, &val, &off)) {
+		uint64_t lo = max(s, k * interval);
+		uint64_t hi = min(e, ftime);
+
+		if (hi > lo)
+			sum += (double) val * (hi - lo);
+	}
+
+	return sum;
+}
+
+static void show(struct lp_file *files, unsigned int nr_files, uint64_t ftime)
+{
+	double *vals, total = 0;
+	uint64_t k, start, end;
+	unsigned int i;
+
+	vals = calloc(nr_files, sizeof(*vals));
+	if (!vals)
+		return;
+
+	for (k = 0, start = 0; start < ftime; k++, start += interval) {
+		double sum = 0;
+
+		end = min(start + interval, ftime);
+		for (i = 0; i < nr_files; i++) {
+			if (end == ftime && end != start + interval)
+				vals[i] = clip_bin(&files[i], k, ftime);
+			else
+				vals[i] = bin_sum(&files[i], k);
+			vals[i] /= (double) (end - start) * divisor;
+			sum += vals[i];
+		}
+
+		switch (out_mode) {
+		case OUT_SUM:
+			printf("%llu, %0.3f\n", (unsigned long long) end, sum);
+			break;
+		case OUT_AVG:
+			printf("%llu, %0.3f\n", (unsigned long long) end,
+				sum / nr_files);
+			break;
+		case OUT_FULL:
+			printf("%llu", (unsigned long long) end);
+			for (i = 0; i < nr_files; i++)
+				printf(", %0.3f", vals[i]);
+			printf("\n");
+			break;
+		default:
+			total += sum * (end - start);
+			break;
+		}
+	}
+
+	if (out_mode == OUT_DEFAULT)
+		printf("%0.3f\n", total / ftime);
+
+	free(vals);
+}
+
+static int usage(char *argv[])
+{
+	log_err("Aggregate fio logs into time weighted intervals\n\n");
+	log_err("%s: [options] <log files>\n", argv[0]);
+	log_err("\t-i\tInterval in msec (1000)\n");
+	log_err("\t-d\tDivide the results by this value\n");
+	log_err("\t-t\tNumber of threads to use\n");
+	log_err("\t-s\tPrint the sum for each interval\n");
+	log_err("\t-a\tPrint the average for each interval\n");
+	log_err("\t-f\tPrint the value of each file for each interval\n");
+	log_err("With none of -s/-a/-f, print the time weighted average of "
+		"the sums\n");
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct lp_file *files;
+	unsigned int nr_files, i;
+	pthread_t *threads;
+	uint64_t ftime = 0;
+	int c, ret = 1;
+
+	while ((c = getopt(argc, argv, "i:d:t:saf")) != -1) {
+		switch (c) {
+		case 'i':
+			interval = strtoull(optarg, NULL, 10);
+			break;
+		case 'd':
+			divisor = atoi(optarg);
+			break;
+		case 't':
+			num_threads = atoi(optarg);
+			break;
+		case 's':
+			out_mode = OUT_SUM;
+			break;
+		case 'a':
+			out_mode = OUT_AVG;
+			break;
+		case 'f':
+			out_mode = OUT_FULL;
+			break;
+		case '?':
+		default:
+			return usage(argv);
+		}
+	}
+
+	if (argc == optind || !interval || !divisor)
+		return usage(argv);
+	if (!num_threads)
+		num_threads = cpus_configured();
+
+	nr_files = argc - optind;
+	files = calloc(nr_files, sizeof(*files));
+	threads = calloc(num_threads, sizeof(*threads));
+	if (!files || !threads)
+		goto out;
+
+	for (i = 0; i < nr_files; i++) {
+		files[i].name = argv[optind + i];
+		if (map_file(&files[i]) || add_chunks(&files[i]))
+			goto out;
+	}
+
+	num_threads = min(num_threads, nr_chunks);
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&threads[i], NULL, worker_fn, NULL)) {
+			log_err("fio-logparser: thread startup failed\n");
+			num_threads = i;
+			break;
+		}
+	}
+	for (i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+	if (next_chunk < nr_chunks)
+		worker_fn(NULL);
+
+	for (i = 0; i < nr_chunks; i++) {
+		if (chunks[i].err || merge_chunk(&chunks[i])) {
+			log_err("fio-logparser: out of memory\n");
+			goto out;
+		}
+	}
+
+	for (i = 0; i < nr_files; i++) {
+		if (!files[i].nr_samples) {
+			log_err("fio-logparser: %s: no samples\n", files[i].name);
+			goto out;
+		}
+		if (!ftime || files[i].max_end < ftime)
+			ftime = files[i].max_end;
+	}
+
+	show(files, nr_files, ftime);
+	ret = 0;
+out:
+	for (i = 0; files && i < nr_files; i++) {
+		if (files[i].map)
+			munmap((void *) files[i].map, files[i].size);
+		bins_free(&files[i].bins);
+	}
+	for (i = 0; i < nr_chunks; i++)
+		bins_free(&chunks[i].bins);
+	free(chunks);
+	free(threads);
+	free(files);
+	return ret;
+}
@@ -0,0 +1,204 @@
+#!/usr/bin/env python3
+#
+# overhead.py
+#
+# Track the CPU time fio itself spends per IO. Runs a fixed set of
+# workloads pinned to one CPU with overhead_stats=1 and prints one JSON
+# document. Run it against two fio builds on the same machine and diff
+# the ns_per_io numbers to see whether an upgrade moved the baseline.
+#
+# The null engine runs measure nothing but fio. The io_uring runs need a
+# null_blk device (modprobe null_blk) and include the kernel submit and
+# completion cost in the submit and complete sections.
+#
+# USAGE
+# python3 t/overhead.py [-f fio] [-c cpu] [-r runtime] [-n repeats]
+#                       [-d /dev/nullb0] [-o output.json]
+#
+# The output schema is versioned by "schema_version". Fields are only
+# ever added within a version.
+#
+
+import os
+import sys
+import json
+import argparse
+import shutil
+import platform
+import tempfile
+import statistics
+import subprocess
+
+SCHEMA_VERSION = 1
+
+SECTIONS = ["total", "get", "submit", "complete", "stats", "log", "other"]
+
+NULL_RUNS = [
+    {
+        "name": "null-qd1",
+        "args": ["--ioengine=null", "--iodepth=1"],
+    },
+    {
+        "name": "null-qd32",
+        "args": ["--ioengine=null", "--iodepth=32",
+                 "--iodepth_batch_submit=32",
+                 "--iodepth_batch_complete_min=32"],
+    },
+    {
+        "name": "null-qd32-latlog",
+        "args": ["--ioengine=null", "--iodepth=32",
+                 "--iodepth_batch_submit=32",
+                 "--iodepth_batch_complete_min=32",
+                 "--write_lat_log=overhead"],
+    },
+]
+
+# Roughly what t/io_uring runs by default
+URING_RUNS = [
+    {
+        "name": "io_uring-qd128",
+        "args": ["--ioengine=io_uring", "--iodepth=128", "--direct=1",
+                 "--iodepth_batch_submit=32",
+                 "--iodepth_batch_complete_min=32",
+                 "--iodepth_batch_complete_max=32",
+                 "--registerfiles=1", "--fixedbufs=1"],
+    },
+    {
+        "name": "io_uring-qd1",
+        "args": ["--ioengine=io_uring", "--iodepth=1", "--direct=1",
+                 "--registerfiles=1", "--fixedbufs=1"],
+    },
+]
+
+
+def parse_args():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('-f', '--fio', default='./fio',
+                        help='path to fio executable (default ./fio)')
+    parser.add_argument('-c', '--cpu', type=int, default=0,
+                        help='CPU to pin the jobs to (default 0)')
+    parser.add_argument('-r', '--runtime', type=int, default=5,
+                        help='seconds per run (default 5)')
+    parser.add_argument('-n', '--repeats', type=int, default=3,
+                        help='runs per workload, the median is reported')
+    parser.add_argument('-d', '--device', default='/dev/nullb0',
+                        help='null_blk device for the io_uring runs')
+    parser.add_argument('-o', '--output', help='write JSON here, not stdout')
+
+    return parser.parse_args()
+
+
+def run_fio(args, run):
+    cmd = [args.fio, "--name=" + run["name"], "--output-format=json",
+           "--rw=randread", "--bs=4k", "--norandommap", "--randrepeat=1",
+           "--time_based", "--runtime={0}".format(args.runtime),
+           "--ramp_time=1", "--cpus_allowed={0}".format(args.cpu),
+           "--overhead_stats=1"] + run["args"]
+    if "filename" in run:
+        cmd.append("--filename=" + run["filename"])
+    else:
+        cmd.append("--size=1T")
+
+    # logs, if any, go to a scratch directory
+    tmpdir = tempfile.mkdtemp(prefix="fio-overhead-")
+    try:
+        out = subprocess.run(cmd, stdout=subprocess.PIPE, cwd=tmpdir,
+                             stderr=subprocess.PIPE, universal_newlines=True)
+    finally:
+        shutil.rmtree(tmpdir, ignore_errors=True)
+    if out.returncode:
+        raise RuntimeError("{0} failed: {1}".format(run["name"],
+                                                    out.stderr.strip()))
+
+    job = json.loads(out.stdout)["jobs"][0]
+    ovh = job.get("overhead")
+    if not ovh:
+        raise RuntimeError("{0}: no overhead stats, is fio too old?".format(
+            run["name"]))
+
+    return {
+        "fio_version": json.loads(out.stdout)["fio version"],
+        "iops": job["read"]["iops"],
+        "ns_per_io": ovh["ns_per_io"],
+    }
+
+
+def median_run(args, run):
+    samples = [run_fio(args, run) for _ in range(args.repeats)]
+
+    result = {
+        "name": run["name"],
+        "args": run["args"],
+        "repeats": args.repeats,
+        "iops": statistics.median(s["iops"] for s in samples),
+        "ns_per_io": {},
+    }
+    for sec in SECTIONS:
+        result["ns_per_io"][sec] = round(statistics.median(
+            s["ns_per_io"][sec] for s in samples), 1)
+
+    return result, samples[0]["fio_version"]
+
+
+def cpu_model():
+    try:
+        with open("/proc/cpuinfo") as f:
+            for line in f:
+                if line.startswith("model name"):
+                    return line.split(":", 1)[1].strip()
+    except OSError:
+        pass
+
+    return platform.processor()
+
+
+def main():
+    args = parse_args()
+    if os.sep in args.fio:
+        args.fio = os.path.abspath(args.fio)
+
+    runs = list(NULL_RUNS)
+    if os.path.exists(args.device):
+        for run in URING_RUNS:
+            run = dict(run)
+            run["filename"] = args.device
+            runs.append(run)
+    else:
+        print("{0} not found, skipping io_uring runs".format(args.device),
+              file=sys.stderr)
+
+    results = []
+    version = None
+    for run in runs:
+        try:
+            result, version = median_run(args, run)
+        except RuntimeError as e:
+            print(e, file=sys.stderr)
+            continue
+        results.append(result)
+
+    doc = {
+        "schema_version": SCHEMA_VERSION,
+        "fio_version": version,
+        "host": {
+            "kernel": platform.release(),
+            "machine": platform.machine(),
+            "cpu": cpu_model(),
+            "pinned_cpu": args.cpu,
+        },
+        "runtime": args.runtime,
+        "runs": results,
+    }
+
+    text = json.dumps(doc, indent=2)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(text + "\n")
+    else:
+        print(text)
+
+    return 0 if results else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <string.h>
 
 #include "../smalloc.h"
 #include "../flist.h"
@@ -13,6 +14,8 @@
 #define LOOPS	32
 #define MAXSMALLOC	120*1024*1024UL
 #define LARGESMALLOC	128*1024U
+#define GROWSMALLOC	256*1024*1024UL
+#define NR_SMALL	4096
 
 struct elem {
 	unsigned int magic1;
@@ -79,6 +82,85 @@ static int do_rand_allocs(void)
 	return ret;
 }
 
+/*
+ * Allocate more than the initial pools hold, so pools get added on demand
+ */
+static int do_grow_allocs(void)
+{
+	unsigned long total = 0;
+	unsigned int nr = 0;
+	struct elem *e;
+	int ret = 0;
+
+	while (total < GROWSMALLOC) {
+		e = smalloc(LARGESMALLOC);
+		if (!e) {
+			printf("grow: fail at %lu\n", total);
+			ret++;
+			break;
+		}
+		e->magic1 = MAGIC1;
+		e->magic2 = MAGIC2;
+		e->size = LARGESMALLOC;
+		total += LARGESMALLOC;
+		flist_add_tail(&e->list, &list);
+		nr++;
+	}
+
+	printf("Grow items: %u\n", nr);
+
+	while (!flist_empty(&list)) {
+		e = flist_entry(list.next, struct elem, list);
+		assert(e->magic1 == MAGIC1);
+		assert(e->magic2 == MAGIC2);
+		flist_del(&e->list);
+		sfree(e);
+	}
+
+	return ret;
+}
+
+/*
+ * Small blocks are recycled through the free block cache, check that
+ * recycled blocks come back zeroed and never overlap live ones.
+ */
+static int do_small_allocs(void)
+{
+	static unsigned char *ptrs[NR_SMALL];
+	static unsigned int sizes[NR_SMALL];
+	unsigned int i, j, round;
+
+	for (round = 0; round < LOOPS; round++) {
+		for (i = 0; i < NR_SMALL; i++) {
+			if (ptrs[i] && (rand() & 1))
+				continue;
+			if (ptrs[i]) {
+				for (j = 0; j < sizes[i]; j++)
+					assert(ptrs[i][j] == (unsigned char) i);
+				sfree(ptrs[i]);
+			}
+			sizes[i] = 1 + rand() % 240;
+			ptrs[i] = smalloc(sizes[i]);
+			if (!ptrs[i]) {
+				printf("small: fail at %u\n", i);
+				return 1;
+			}
+			for (j = 0; j < sizes[i]; j++)
+				assert(!ptrs[i][j]);
+			memset(ptrs[i], i, sizes[i]);
+		}
+	}
+
+	for (i = 0; i < NR_SMALL; i++) {
+		for (j = 0; j < sizes[i]; j++)
+			assert(ptrs[i][j] == (unsigned char) i);
+		sfree(ptrs[i]);
+		ptrs[i] = NULL;
+	}
+
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	int ret;
@@ -88,6 +170,8 @@ int main(int argc, char *argv[])
 	debug_init();
 
 	ret = do_rand_allocs();
+	ret += do_small_allocs();
+	ret += do_grow_allocs();
 	smalloc_debug(0);	/* TODO: check that free and total blocks
 				** match */
 
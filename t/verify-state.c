@@ -63,37 +63,59 @@ static void show(struct thread_io_list *s, size_t size)
 	} while (size != 0);
 }
 
+/*
+ * A state file with checkpoints holds several records, the last intact one
+ * is what fio loads.
+ */
 static void show_verify_state(void *buf, size_t size)
 {
-	struct verify_state_hdr *hdr = buf;
-	struct thread_io_list *s;
-	uint32_t crc;
+	unsigned int nr = 0;
 
-	hdr->version = le64_to_cpu(hdr->version);
-	hdr->size = le64_to_cpu(hdr->size);
-	hdr->crc = le64_to_cpu(hdr->crc);
+	while (size) {
+		struct verify_state_hdr *hdr = buf;
+		struct thread_io_list *s;
+		uint32_t crc;
 
-	printf("Version:\t0x%x\n", (unsigned int) hdr->version);
-	printf("Size:\t\t%u\n", (unsigned int) hdr->size);
-	printf("CRC:\t\t0x%x\n", (unsigned int) hdr->crc);
+		if (size < sizeof(*hdr)) {
+			log_err("Torn record header\n");
+			return;
+		}
 
-	size -= sizeof(*hdr);
-	if (hdr->size != size) {
-		log_err("Size mismatch\n");
-		return;
-	}
+		hdr->version = le64_to_cpu(hdr->version);
+		hdr->size = le64_to_cpu(hdr->size);
+		hdr->crc = le64_to_cpu(hdr->crc);
+
+		if (nr)
+			printf("\n");
+		printf("Record:\t\t%u\n", nr);
+		printf("Version:\t0x%x\n", (unsigned int) hdr->version);
+		printf("Size:\t\t%u\n", (unsigned int) hdr->size);
+		printf("CRC:\t\t0x%x\n", (unsigned int) hdr->crc);
+
+		size -= sizeof(*hdr);
+		if (hdr->size > size) {
+			log_err("Size mismatch\n");
+			return;
+		}
 
-	s = buf + sizeof(*hdr);
-	crc = fio_crc32c((unsigned char *) s, hdr->size);
-	if (crc != hdr->crc) {
-		log_err("crc mismatch %x != %x\n", crc, (unsigned int) hdr->crc);
-		return;
-	}
+		s = buf + sizeof(*hdr);
+		crc = fio_crc32c((unsigned char *) s, hdr->size);
+		if (crc != hdr->crc) {
+			log_err("crc mismatch %x != %x\n", crc, (unsigned int) hdr->crc);
+			return;
+		}
 
-	if (hdr->version == 0x03)
-		show(s, size);
-	else
-		log_err("Unsupported version %d\n", (int) hdr->version);
+		if (hdr->version == 0x03)
+			show(s, hdr->size);
+		else {
+			log_err("Unsupported version %d\n", (int) hdr->version);
+			return;
+		}
+
+		buf += sizeof(*hdr) + hdr->size;
+		size -= hdr->size;
+		nr++;
+	}
 }
 
 static int show_file(const char *file)
@@ -18,6 +18,15 @@ enum fio_zone_mode {
 	ZONE_MODE_ZBD		= 3,
 };
 
+/*
+ * Which zones a zonemode=zbd job may write to, see zone_owner=
+ */
+enum fio_zone_owner {
+	ZONE_OWNER_SHARED	= 0, /* any zone of the job's range */
+	ZONE_OWNER_STRIPE	= 1, /* every nth zone, n the number of jobs */
+	ZONE_OWNER_LEASE	= 2, /* zones claimed until they are full */
+};
+
 /*
  * What type of allocation to use for io buffers
  */
@@ -31,12 +40,72 @@ enum fio_memtype {
 	MEM_CUDA_MALLOC,/* use GPU memory */
 };
 
+/*
+ * Which NUMA node to place io buffers on
+ */
+enum fio_iomem_numa {
+	IOMEM_NUMA_NONE = 0,	/* leave it to the memory policy */
+	IOMEM_NUMA_CPUS,	/* node of the CPUs the job runs on */
+	IOMEM_NUMA_DEVICE,	/* node of the device backing the files */
+	IOMEM_NUMA_NODE,	/* an explicit node */
+};
+
+/*
+ * How latency_target adjusts the queue depth
+ */
+enum fio_latency_mode {
+	LATENCY_MODE_BISECT = 0,	/* bisect the queue depth */
+	LATENCY_MODE_AIMD,		/* additive increase, multiplicative decrease */
+};
+
+/*
+ * Where completion latencies come from
+ */
+enum fio_clat_source {
+	CLAT_SOURCE_FIO = 0,	/* time completions in fio */
+	CLAT_SOURCE_ENGINE,	/* use the timing reported by the engine */
+};
+
+/*
+ * How FDP writes pick a placement ID
+ */
+enum fio_fdp_pli_select {
+	FDP_PLI_RR = 0,		/* cycle through the placement IDs */
+	FDP_PLI_RANDOM,		/* any placement ID, picked at random */
+	FDP_PLI_OFFSET,		/* split the io range equally between them */
+	FDP_PLI_ZONED,		/* one per random_distribution zone */
+	FDP_PLI_JOB,		/* one per job */
+};
+
 /*
  * What mode to use for deduped data generation
  */
 enum dedupe_mode {
 	DEDUPE_MODE_REPEAT = 0,
 	DEDUPE_MODE_WORKING_SET = 1,
+	DEDUPE_MODE_SHIFTED = 2,
+	DEDUPE_MODE_SIMILAR = 3,
+};
+
+/*
+ * How compressible data is generated
+ */
+enum compress_mode {
+	COMPRESS_MODE_FIXED = 0,
+	COMPRESS_MODE_ENTROPY = 1,
+	COMPRESS_MODE_ZLIB = 2,
+};
+
+/*
+ * What a trim does to the blocks it covers
+ */
+enum fio_trim_mode {
+	TRIM_MODE_DISCARD = 0,
+	TRIM_MODE_WRITE_ZEROES = 1,
+	TRIM_MODE_COPY = 2,
+	TRIM_MODE_ALLOCATE = 3,
+	TRIM_MODE_PUNCH_HOLE = 4,
+	TRIM_MODE_TRUNCATE = 5,
 };
 
 #define ERROR_STR_MAX	128
@@ -96,6 +165,7 @@ struct thread_options {
 	unsigned int iodepth_batch;
 	unsigned int iodepth_batch_complete_min;
 	unsigned int iodepth_batch_complete_max;
+	unsigned int iodepth_batch_complete_adaptive;
 	unsigned int serialize_overlap;
 
 	unsigned int unique_filename;
@@ -128,6 +198,7 @@ struct thread_options {
 	unsigned int nr_files;
 	unsigned int open_files;
 	enum file_lock_mode file_lock_mode;
+	unsigned int lockfile_stripe;
 
 	unsigned int odirect;
 	unsigned int oatomic;
@@ -136,6 +207,10 @@ struct thread_options {
 	unsigned int create_fsync;
 	unsigned int create_on_open;
 	unsigned int create_only;
+	unsigned int create_threads;
+	unsigned int tree_depth;
+	unsigned int tree_fanout;
+	unsigned int tree_files;
 	unsigned int end_fsync;
 	unsigned int pre_read;
 	unsigned int sync_io;
@@ -151,11 +226,18 @@ struct thread_options {
 	unsigned int verify_fatal;
 	unsigned int verify_dump;
 	unsigned int verify_async;
+	unsigned int verify_threads;
 	unsigned long long verify_backlog;
 	unsigned int verify_batch;
+	unsigned int verify_backlog_mode;
 	unsigned int experimental_verify;
 	unsigned int verify_state;
 	unsigned int verify_state_save;
+	unsigned long long verify_state_interval;
+	unsigned int verify_bitmap;
+	unsigned int verify_table;
+	fio_fp64_t verify_sample_rate;
+	unsigned int verify_sample_mode;
 	unsigned int use_thread;
 	unsigned int unlink;
 	unsigned int unlink_each_loop;
@@ -176,9 +258,12 @@ struct thread_options {
 	unsigned int log_alternate_epoch_clock_id;
 	unsigned int norandommap;
 	unsigned int softrandommap;
+	unsigned int randommap_shared;
 	unsigned int bs_unaligned;
 	unsigned int fsync_on_close;
 	unsigned int bs_is_seq_rand;
+	unsigned int num_range;
+	unsigned int trim_mode;
 
 	unsigned int verify_only;
 
@@ -194,10 +279,13 @@ struct thread_options {
 	fio_fp64_t random_center;
 
 	unsigned int random_generator;
+	unsigned int random_partition;
 
 	unsigned int perc_rand[DDIR_RWDIR_CNT];
 
 	unsigned int hugepage_size;
+	unsigned int iomem_numa;
+	unsigned int iomem_numa_node;
 	unsigned long long rw_min_bs;
 	unsigned int fsync_blocks;
 	unsigned int fdatasync_blocks;
@@ -212,6 +300,8 @@ struct thread_options {
 	unsigned long long ss_dur;
 	unsigned long long ss_ramp_time;
 	unsigned long long ss_check_interval;
+	fio_fp64_t ss_percentile;
+	unsigned int ss_per_ddir;
 	unsigned int overwrite;
 	unsigned int bw_avg_time;
 	unsigned int iops_avg_time;
@@ -225,6 +315,7 @@ struct thread_options {
 	unsigned long long lockmem;
 	enum fio_memtype mem_type;
 	unsigned int mem_align;
+	unsigned int shared_read_buffers;
 
 	unsigned long long max_latency[DDIR_RWDIR_CNT];
 
@@ -236,6 +327,7 @@ struct thread_options {
 	os_cpu_mask_t verify_cpumask;
 	os_cpu_mask_t log_gz_cpumask;
 	unsigned int cpus_allowed_policy;
+	unsigned int cpus_allowed_auto;
 	char *numa_cpunodes;
 	unsigned short numa_mem_mode;
 	unsigned int numa_mem_prefer_node;
@@ -252,23 +344,39 @@ struct thread_options {
 	unsigned int file_service_type;
 	unsigned int group_reporting;
 	unsigned int stats;
+	unsigned int stats_shard;
 	unsigned int fadvise_hint;
 	enum fio_fallocate_mode fallocate_mode;
 	unsigned int zero_buffers;
 	unsigned int refill_buffers;
 	unsigned int scramble_buffers;
+	unsigned int buffer_generator;
 	char *buffer_pattern;
 	unsigned int buffer_pattern_bytes;
 	unsigned int compress_percentage;
 	unsigned int compress_chunk;
+	unsigned int compress_mode;
 	unsigned int dedupe_percentage;
 	unsigned int dedupe_mode;
 	unsigned int dedupe_working_set_percentage;
 	unsigned int dedupe_global;
+	unsigned int dedupe_similar_bits;
+	unsigned int data_reduction_sample;
+	unsigned int buffer_stamp;
 	unsigned int time_based;
 	unsigned int disable_lat;
 	unsigned int disable_clat;
 	unsigned int disable_slat;
+	unsigned int clock_batch;
+	unsigned int perf_counters;
+	unsigned int overhead_stats;
+	unsigned int lat_outliers;
+	unsigned int lat_outliers_msec;
+	unsigned int lat_heatmap;
+	unsigned int per_file_stats;
+	unsigned int cpu_locality_stats;
+	unsigned int mem_report;
+	unsigned int clat_source;
 	unsigned int disable_bw;
 	unsigned int unified_rw_rep;
 	unsigned int gtod_reduce;
@@ -282,6 +390,7 @@ struct thread_options {
 	unsigned int clat_percentiles;
 	unsigned int slat_percentiles;
 	unsigned int lat_percentiles;
+	unsigned int lat_hist_bits;
 	unsigned int percentile_precision;	/* digits after decimal for percentiles */
 	fio_fp64_t percentile_list[FIO_IO_U_LIST_MAX_LEN];
 
@@ -311,6 +420,7 @@ struct thread_options {
 
 	unsigned int thinktime;
 	unsigned int thinktime_spin;
+	unsigned int precise_pacing;
 	unsigned int thinktime_blocks;
 	unsigned int thinktime_blocks_type;
 	unsigned int thinktime_iotime;
@@ -319,11 +429,23 @@ struct thread_options {
 	uint64_t ratemin[DDIR_RWDIR_CNT];
 	unsigned int ratecycle;
 	unsigned int io_submit_mode;
+	unsigned int freelist_order;
+	unsigned int sync_workers;
 	unsigned int rate_iops[DDIR_RWDIR_CNT];
 	unsigned int rate_iops_min[DDIR_RWDIR_CNT];
 	unsigned int rate_process;
 	unsigned int rate_ign_think;
 
+	char *phases;
+	unsigned int phases_loop;
+
+	char *sweep;
+
+	char *precondition;
+	unsigned int precondition_jobs;
+	unsigned int precondition_iodepth;
+	unsigned long long precondition_bs;
+
 	char *ioscheduler;
 
 	/*
@@ -342,6 +464,10 @@ struct thread_options {
 	char *cgroup;
 	unsigned int cgroup_weight;
 	unsigned int cgroup_nodelete;
+	char *cgroup_io_max;
+	char *cgroup_io_latency;
+	char *cgroup_io_cost_qos;
+	unsigned long long cgroup_stat_interval;
 
 	unsigned int uid;
 	unsigned int gid;
@@ -357,6 +483,8 @@ struct thread_options {
 	unsigned long long latency_window;
 	fio_fp64_t latency_percentile;
 	uint32_t latency_run;
+	unsigned int latency_mode;
+	char *latency_log_file;
 
 	/*
 	 * flow support
@@ -365,6 +493,10 @@ struct thread_options {
 	unsigned int flow;
 	unsigned int flow_sleep;
 
+	unsigned int rate_bucket_id;
+	unsigned int rate_bucket_iops[DDIR_RWDIR_CNT];
+	unsigned int rate_bucket_burst[DDIR_RWDIR_CNT];
+
 	unsigned int sig_figs;
 
 	unsigned block_error_hist;
@@ -373,6 +505,9 @@ struct thread_options {
 	unsigned int replay_scale;
 	unsigned int replay_time_scale;
 	unsigned int replay_skip;
+	unsigned int replay_shard;
+	unsigned int write_iolog_format;
+	unsigned int replay_queue_depth;
 
 	unsigned int per_job_logs;
 
@@ -384,6 +519,9 @@ struct thread_options {
 	int max_open_zones;
 	unsigned int job_max_open_zones;
 	unsigned int ignore_zone_limits;
+	unsigned int zone_append;
+	unsigned int zone_reset_async;
+	unsigned int zone_owner;
 	fio_fp64_t zrt;
 	fio_fp64_t zrf;
 
@@ -391,9 +529,18 @@ struct thread_options {
 	unsigned int fdp;
 	unsigned int fdp_plis[FIO_MAX_PLIS];
 	unsigned int fdp_nrpli;
+	unsigned int fdp_pli_select;
 
 	unsigned int log_entries;
 	unsigned int log_prio;
+	unsigned int log_binary;
+	unsigned int log_write_behind;
+	unsigned int log_mmap;
+	unsigned int log_sample;
+	unsigned int log_sample_nth;
+	unsigned int log_sample_reservoir;
+	unsigned int log_sample_msec;
+	fio_fp64_t log_sample_percentile;
 };
 
 #define FIO_TOP_STR_MAX		256
@@ -421,7 +568,7 @@ struct thread_options_pack {
 	uint32_t iodepth_batch_complete_min;
 	uint32_t iodepth_batch_complete_max;
 	uint32_t serialize_overlap;
-	uint32_t pad;
+	uint32_t iodepth_batch_complete_adaptive;
 
 	uint64_t size;
 	uint64_t io_size;
@@ -454,6 +601,8 @@ struct thread_options_pack {
 	uint32_t nr_files;
 	uint32_t open_files;
 	uint32_t file_lock_mode;
+	uint32_t lockfile_stripe;
+	uint32_t pad8;
 
 	uint32_t odirect;
 	uint32_t oatomic;
@@ -476,9 +625,14 @@ struct thread_options_pack {
 	uint32_t verify_async;
 	uint64_t verify_backlog;
 	uint32_t verify_batch;
+	uint32_t verify_backlog_mode;
+	uint32_t verify_threads;
 	uint32_t experimental_verify;
 	uint32_t verify_state;
 	uint32_t verify_state_save;
+	uint64_t verify_state_interval;
+	uint32_t verify_bitmap;
+	uint32_t verify_table;
 	uint32_t use_thread;
 	uint32_t unlink;
 	uint32_t unlink_each_loop;
@@ -500,6 +654,8 @@ struct thread_options_pack {
 	uint32_t log_alternate_epoch_clock_id;
 	uint32_t norandommap;
 	uint32_t softrandommap;
+	uint32_t randommap_shared;
+	uint32_t pad6;
 	uint32_t bs_unaligned;
 	uint32_t fsync_on_close;
 	uint32_t bs_is_seq_rand;
@@ -518,10 +674,13 @@ struct thread_options_pack {
 	fio_fp64_t random_center;
 
 	uint32_t random_generator;
+	uint32_t random_partition;
 
 	uint32_t perc_rand[DDIR_RWDIR_CNT];
 
 	uint32_t hugepage_size;
+	uint32_t iomem_numa;
+	uint32_t iomem_numa_node;
 	uint64_t rw_min_bs;
 	uint32_t fsync_blocks;
 	uint32_t fdatasync_blocks;
@@ -534,6 +693,7 @@ struct thread_options_pack {
 	uint64_t ss_ramp_time;
 	uint32_t ss_state;
 	fio_fp64_t ss_limit;
+	fio_fp64_t ss_percentile;
 	uint64_t ss_check_interval;
 	uint32_t overwrite;
 	uint32_t bw_avg_time;
@@ -578,13 +738,18 @@ struct thread_options_pack {
 	uint32_t zero_buffers;
 	uint32_t refill_buffers;
 	uint32_t scramble_buffers;
+	uint32_t buffer_generator;
 	uint32_t buffer_pattern_bytes;
 	uint32_t compress_percentage;
 	uint32_t compress_chunk;
+	uint32_t compress_mode;
 	uint32_t dedupe_percentage;
 	uint32_t dedupe_mode;
 	uint32_t dedupe_working_set_percentage;
 	uint32_t dedupe_global;
+	uint32_t dedupe_similar_bits;
+	uint32_t data_reduction_sample;
+	uint32_t buffer_stamp;
 	uint32_t time_based;
 	uint32_t disable_lat;
 	uint32_t disable_clat;
@@ -603,7 +768,7 @@ struct thread_options_pack {
 	uint32_t lat_percentiles;
 	uint32_t slat_percentiles;
 	uint32_t percentile_precision;
-	uint32_t pad5;
+	uint32_t stats_shard;
 	fio_fp64_t percentile_list[FIO_IO_U_LIST_MAX_LEN];
 
 	uint8_t read_iolog_file[FIO_TOP_STR_MAX];
@@ -660,6 +825,13 @@ struct thread_options_pack {
 	 * blkio cgroup support
 	 */
 	uint8_t cgroup[FIO_TOP_STR_MAX];
+	uint8_t phases[FIO_TOP_STR_MAX];
+	uint8_t sweep[FIO_TOP_STR_MAX];
+	uint8_t precondition[FIO_TOP_STR_MAX];
+	uint8_t cgroup_io_max[FIO_TOP_STR_MAX];
+	uint8_t cgroup_io_latency[FIO_TOP_STR_MAX];
+	uint8_t cgroup_io_cost_qos[FIO_TOP_STR_MAX];
+	uint8_t latency_log_file[FIO_TOP_STR_MAX];
 	uint32_t cgroup_weight;
 	uint32_t cgroup_nodelete;
 
@@ -692,6 +864,18 @@ struct thread_options_pack {
 	uint32_t replay_scale;
 	uint32_t replay_time_scale;
 	uint32_t replay_skip;
+	uint32_t replay_shard;
+	uint32_t write_iolog_format;
+	uint32_t replay_queue_depth;
+	uint32_t per_file_stats;
+	uint32_t precise_pacing;
+	uint32_t shared_read_buffers;
+	uint32_t cpus_allowed_auto;
+	uint32_t cpu_locality_stats;
+	uint32_t lat_hist_bits;
+	uint32_t precondition_jobs;
+	uint32_t precondition_iodepth;
+	uint32_t mem_report;
 
 	uint32_t per_job_logs;
 
@@ -701,13 +885,50 @@ struct thread_options_pack {
 	uint32_t zone_mode;
 	int32_t max_open_zones;
 	uint32_t ignore_zone_limits;
+	uint32_t zone_append;
+	uint32_t zone_reset_async;
+	uint32_t zone_owner;
 
 	uint32_t log_entries;
 	uint32_t log_prio;
+	uint32_t log_binary;
+	uint32_t log_write_behind;
+	uint32_t log_mmap;
+	uint32_t log_sample;
+	uint32_t log_sample_nth;
+	uint32_t log_sample_reservoir;
+	uint32_t log_sample_msec;
+	fio_fp64_t log_sample_percentile;
 
 	uint32_t fdp;
 	uint32_t fdp_plis[FIO_MAX_PLIS];
 	uint32_t fdp_nrpli;
+	uint32_t fdp_pli_select;
+	uint32_t create_threads;
+	uint32_t rate_bucket_id;
+	uint32_t rate_bucket_iops[DDIR_RWDIR_CNT];
+	uint32_t rate_bucket_burst[DDIR_RWDIR_CNT];
+	uint32_t clock_batch;
+	uint32_t clat_source;
+	uint32_t latency_mode;
+	uint32_t ss_per_ddir;
+	uint32_t perf_counters;
+	uint32_t freelist_order;
+	uint32_t sync_workers;
+	uint32_t tree_depth;
+	uint32_t tree_fanout;
+	uint32_t tree_files;
+	uint32_t num_range;
+	uint32_t trim_mode;
+	uint32_t phases_loop;
+	uint32_t overhead_stats;
+	uint32_t lat_outliers;
+	uint32_t lat_outliers_msec;
+	uint32_t lat_heatmap;
+	uint32_t verify_sample_mode;
+	uint64_t cgroup_stat_interval;
+	uint64_t precondition_bs;
+	fio_fp64_t verify_sample_rate;
 
 	/*
 	 * verify_pattern followed by buffer_pattern from the unpacked struct
@@ -731,6 +952,10 @@ extern int str_split_parse(struct thread_data *td, char *str,
 extern int split_parse_ddir(struct thread_options *o, struct split *split,
 			    char *str, bool absolute, unsigned int max_splits);
 
+extern int bssplit_parse(struct thread_options *o, char *str,
+			 struct bssplit **bssplit, unsigned int *nr,
+			 unsigned long long *min_bs, unsigned long long *max_bs);
+
 extern int split_parse_prio_ddir(struct thread_options *o,
 				 struct split_prio **entries, int *nr_entries,
 				 char *str);
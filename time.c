@@ -6,6 +6,10 @@
 static struct timespec genesis;
 static unsigned long ns_granularity;
 
+/* from a client's --sync-start, see fio_wait_start_at() */
+uint64_t fio_start_at_ns;
+int64_t fio_clock_offset_ns;
+
 void timespec_add_msec(struct timespec *ts, unsigned int msec)
 {
 	uint64_t adj_nsec = 1000000ULL * msec;
@@ -38,12 +42,73 @@ uint64_t usec_spin(unsigned int usec)
 	return t;
 }
 
+/*
+ * Bounds of the spin at the end of a precise_pacing sleep
+ */
+#define PACE_MIN_SPIN_NSEC	((uint64_t) 1000)
+#define PACE_MAX_SPIN_NSEC	((uint64_t) 200000)
+
+/*
+ * precise_pacing: sleep until pace_spin_nsec before the deadline, then
+ * spin. Every sleep updates the spin with how late it woke up, faster
+ * when it was later than expected than when it wasn't, so the spin
+ * follows the wakeup latency of the CPU the job runs on. Wakeups later
+ * than the largest spin are preemption rather than timer latency, and
+ * are left out.
+ */
+static uint64_t usec_pace(struct thread_data *td, unsigned long usec)
+{
+	uint64_t spin = td->pace_spin_nsec, nsec = usec * 1000ULL;
+	uint64_t now, left, req_nsec, late;
+	struct timespec start, req;
+
+	if (!spin)
+		spin = min((uint64_t) ns_granularity * 1000, PACE_MAX_SPIN_NSEC);
+
+	fio_gettime(&start, NULL);
+	while (!td->terminate) {
+		now = ntime_since_now(&start);
+		if (now >= nsec)
+			break;
+		left = nsec - now;
+		if (left <= spin)
+			break;
+
+		/* wake up at least once a second to notice terminate */
+		req_nsec = min(left - spin, (uint64_t) 1000000000);
+		req.tv_sec = req_nsec / 1000000000ULL;
+		req.tv_nsec = req_nsec % 1000000000ULL;
+		if (nanosleep(&req, NULL) < 0)
+			break;
+
+		late = ntime_since_now(&start) - now;
+		late = late > req_nsec ? late - req_nsec : 0;
+		if (late > PACE_MAX_SPIN_NSEC)
+			continue;
+		if (late > spin)
+			spin += (late - spin) / 4;
+		else
+			spin -= (spin - late) / 16;
+		spin = max(spin, PACE_MIN_SPIN_NSEC);
+	}
+
+	while (ntime_since_now(&start) < nsec && !td->terminate)
+		nop;
+
+	td->pace_spin_nsec = spin;
+	td->clock_batch_valid = false;
+	return utime_since_now(&start);
+}
+
 uint64_t usec_sleep(struct thread_data *td, unsigned long usec)
 {
 	struct timespec req;
 	struct timespec tv;
 	uint64_t t = 0;
 
+	if (td->o.precise_pacing)
+		return usec_pace(td, usec);
+
 	do {
 		unsigned long ts = usec;
 
@@ -81,6 +146,8 @@ uint64_t usec_sleep(struct thread_data *td, unsigned long usec)
 		usec -= ts;
 	} while (!td->terminate);
 
+	/* a sleep makes the last completion time useless for new IO */
+	td->clock_batch_valid = false;
 	return t;
 }
 
@@ -180,6 +247,47 @@ void set_epoch_time(struct thread_data *td, int log_alternate_epoch, clockid_t c
 		clock_gettime(clock_id, &ts);
 		td->alternate_epoch = (unsigned long long)(ts.tv_sec) * 1000 +
 		                 (unsigned long long)(ts.tv_nsec) / 1000000;
+		/* put the logs of all --sync-start servers on the client's clock */
+		if (clock_id == CLOCK_REALTIME)
+			td->alternate_epoch -= fio_clock_offset_ns / 1000000;
+	}
+}
+
+uint64_t fio_realtime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Sleep until the CLOCK_REALTIME instant a client's --sync-start asked
+ * the jobs to start at, if any
+ */
+void fio_wait_start_at(void)
+{
+	uint64_t now = fio_realtime_ns();
+
+	if (!fio_start_at_ns)
+		return;
+
+	if (now > fio_start_at_ns) {
+		log_info("fio: synchronized start time passed %llu msec ago, "
+			 "raise --sync-start\n",
+			 (unsigned long long) (now - fio_start_at_ns) / 1000000);
+		return;
+	}
+
+	while (now < fio_start_at_ns) {
+		uint64_t left = fio_start_at_ns - now;
+		struct timespec ts = {
+			.tv_sec		= left / 1000000000ULL,
+			.tv_nsec	= left % 1000000000ULL,
+		};
+
+		nanosleep(&ts, NULL);
+		now = fio_realtime_ns();
 	}
 }
 
@@ -13,13 +13,25 @@
 # fiologparser.py -a *clat*
 #
 # to see per-interval average completion latency.
+#
+# Unless -A is used, the work is handed to the native fio-logparser
+# (t/logparser.c) when it is found next to this script, in ../t or in
+# PATH. It parses logs in parallel and is much faster on large logs.
+# Use -p to force the Python code.
 
 from __future__ import absolute_import
 from __future__ import print_function
 import argparse
 import math
+import os
+import struct
+import sys
 from functools import reduce
 
+BINLOG_MAGIC = b'fiobinlg'
+BINLOG_HDR_SIZE = 16
+BINLOG_REC = struct.Struct('<QQQQII')
+
 def parse_args():
     parser = argparse.ArgumentParser()
     parser.add_argument('-i', '--interval', required=False, type=int, default=1000, help='interval of time in seconds.')
@@ -29,11 +41,39 @@ def parse_args():
                         help='print all stats for each interval.')
     parser.add_argument('-a', '--average', dest='average', action='store_true', default=False, help='print the average for each interval.')
     parser.add_argument('-s', '--sum', dest='sum', action='store_true', default=False, help='print the sum for each interval.')
+    parser.add_argument('-p', '--python', dest='python', action='store_true', default=False,
+                        help='do not use the native fio-logparser.')
     parser.add_argument("FILE", help="collectl log output files to parse", nargs="+")
     args = parser.parse_args()
 
     return args
 
+NATIVE = 'fio-logparser'
+
+def find_native():
+    here = os.path.dirname(os.path.realpath(__file__))
+    paths = [here, os.path.join(here, '..', 't')]
+    paths += os.environ.get('PATH', '').split(os.pathsep)
+    for p in paths:
+        fn = os.path.join(p, NATIVE)
+        if os.path.isfile(fn) and os.access(fn, os.X_OK):
+            return fn
+    return None
+
+def run_native(ctx):
+    native = find_native()
+    if not native:
+        return
+    args = [native, '-i', str(ctx.interval), '-d', str(ctx.divisor)]
+    if ctx.sum:
+        args.append('-s')
+    elif ctx.average:
+        args.append('-a')
+    elif ctx.full:
+        args.append('-f')
+    sys.stdout.flush()
+    os.execv(native, args + ctx.FILE)
+
 def get_ftime(series):
     ftime = 0
     for ts in series:
@@ -163,12 +203,32 @@ class TimeSeries(object):
         self.read_data(fn)
 
     def read_data(self, fn):
+        with open(fn, 'rb') as f:
+            binary = f.read(len(BINLOG_MAGIC)) == BINLOG_MAGIC
+        if binary:
+            self.read_binary_data(fn)
+            return
+
         f = open(fn, 'r')
         p_time = 0
         for line in f:
             (time, value) = line.rstrip('\r\n').rsplit(', ')[:2]
             self.add_sample(p_time, int(time), int(value))
             p_time = int(time)
+
+    # log_binary=1 logs, see struct io_binlog_sample in iolog.h
+    def read_binary_data(self, fn):
+        f = open(fn, 'rb')
+        f.seek(BINLOG_HDR_SIZE)
+        p_time = 0
+        while True:
+            buf = f.read(BINLOG_REC.size * 4096)
+            if not buf:
+                break
+            for i in range(0, len(buf) - BINLOG_REC.size + 1, BINLOG_REC.size):
+                (time, value) = BINLOG_REC.unpack_from(buf, i)[:2]
+                self.add_sample(p_time, time, value)
+                p_time = time
  
     def add_sample(self, start, end, value):
         sample = Sample(ctx, start, end, value)
@@ -209,6 +269,8 @@ class Sample(object):
 
 if __name__ == '__main__':
     ctx = parse_args()
+    if not ctx.python and not ctx.allstats:
+        run_native(ctx)
     series = []
     for fn in ctx.FILE:
        series.append(TimeSeries(ctx, fn)) 
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <limits.h>
+#include <sys/types.h>
 #include "lib/nowarn_snprintf.h"
 
 struct thread_rand32_state {
@@ -65,6 +66,11 @@ extern void verify_free_state(struct thread_data *);
 extern int verify_state_should_stop(struct thread_data *, struct io_u *);
 extern void verify_assign_state(struct thread_data *, void *);
 extern int verify_state_hdr(struct verify_state_hdr *, struct thread_io_list *);
+extern ssize_t verify_state_scan(void *, size_t, size_t *);
+extern int verify_state_ckpt_check(void);
+extern void verify_state_checkpoint(struct thread_data *);
+
+extern unsigned int verify_state_ckpt_msec;
 
 static inline size_t __thread_io_list_sz(uint32_t depth, uint32_t nofiles)
 {
@@ -81,9 +87,9 @@ static inline struct thread_io_list *io_list_next(struct thread_io_list *s)
 	return (struct thread_io_list *)((char *) s + thread_io_list_sz(s));
 }
 
-static inline void verify_state_gen_name(char *out, size_t size,
-					 const char *name, const char *prefix,
-					 int num)
+static inline void __verify_state_gen_name(char *out, size_t size,
+					   const char *name, const char *prefix,
+					   int num, const char *suffix)
 {
 	char ename[PATH_MAX];
 	char *ptr;
@@ -102,8 +108,15 @@ static inline void verify_state_gen_name(char *out, size_t size,
 		name++;
 	} while (1);
 
-	nowarn_snprintf(out, size, "%s-%s-%d-verify.state", prefix, ename, num);
+	nowarn_snprintf(out, size, "%s-%s-%d-%s", prefix, ename, num, suffix);
 	out[size - 1] = '\0';
 }
 
+static inline void verify_state_gen_name(char *out, size_t size,
+					 const char *name, const char *prefix,
+					 int num)
+{
+	__verify_state_gen_name(out, size, name, prefix, num, "verify.state");
+}
+
 #endif
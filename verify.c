@@ -7,14 +7,19 @@
 #include <assert.h>
 #include <pthread.h>
 #include <libgen.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "arch/arch.h"
 #include "fio.h"
 #include "verify.h"
 #include "trim.h"
+#include "hash.h"
 #include "lib/rand.h"
 #include "lib/hweight.h"
 #include "lib/pattern.h"
+#include "lib/memeq.h"
 #include "oslib/asprintf.h"
 
 #include "crc/md5.h"
@@ -26,25 +31,45 @@
 #include "crc/sha256.h"
 #include "crc/sha512.h"
 #include "crc/sha1.h"
+#include "crc/sha-accel.h"
 #include "crc/xxhash.h"
 #include "crc/sha3.h"
 
 static void populate_hdr(struct thread_data *td, struct io_u *io_u,
 			 struct verify_header *hdr, unsigned int header_num,
 			 unsigned int header_len);
+static void populate_md5_hdrs(struct thread_data *td, struct io_u *io_u,
+			      unsigned int hdr_inc);
+static inline unsigned int __hdr_size(int verify_type);
+static int verify_table_check(struct thread_data *td, struct io_u *io_u);
+static void verify_state_prefix(char *prefix);
 static void __fill_hdr(struct thread_data *td, struct io_u *io_u,
 		       struct verify_header *hdr, unsigned int header_num,
 		       unsigned int header_len, uint64_t rand_seed);
 
+/*
+ * Formats are patched into a filled buffer once per pattern period when the
+ * pattern is at least this long, shorter ones are rebuilt from scratch.
+ */
+#define VERIFY_FMT_PATCH_MIN	512
+
 void fill_buffer_pattern(struct thread_data *td, void *p, unsigned int len)
 {
 	(void)cpy_pattern(td->o.buffer_pattern, td->o.buffer_pattern_bytes, p, len);
 }
 
-static void __fill_buffer(struct thread_options *o, uint64_t seed, void *p,
+static void __fill_buffer(struct thread_data *td, uint64_t seed, void *p,
 			  unsigned int len)
 {
-	__fill_random_buf_percentage(seed, p, o->compress_percentage, len, len, o->buffer_pattern, o->buffer_pattern_bytes);
+	struct thread_options *o = &td->o;
+
+	if (o->compress_percentage && o->compress_mode != COMPRESS_MODE_FIXED) {
+		__fill_random_buf_entropy(seed, p, len, td->compress_level,
+					  o->buffer_generator);
+		return;
+	}
+
+	__fill_random_buf_percentage(seed, p, o->compress_percentage, len, len, o->buffer_pattern, o->buffer_pattern_bytes, o->buffer_generator);
 }
 
 void fill_verify_pattern(struct thread_data *td, void *p, unsigned int len,
@@ -61,7 +86,20 @@ void fill_verify_pattern(struct thread_data *td, void *p, unsigned int len,
 				seed *= (unsigned long)__rand(&td->verify_state);
 		}
 		io_u->rand_seed = seed;
-		__fill_buffer(o, seed, p, len);
+
+		/*
+		 * With buffer_stamp, a buffer that still holds data we
+		 * generated is stamped instead of refilled. The header seed
+		 * stays as is, the checksums cover whatever the data is.
+		 */
+		if (td->o.buffer_stamp && !use_seed) {
+			if (io_u->buf_filled_len >= len) {
+				io_u_stamp_buffer(td, p, len);
+				return;
+			}
+			io_u->buf_filled_len = len;
+		}
+		__fill_buffer(td, seed, p, len);
 		return;
 	}
 
@@ -73,10 +111,57 @@ void fill_verify_pattern(struct thread_data *td, void *p, unsigned int len,
 		return;
 	}
 
-	(void)paste_format(td->o.verify_pattern, td->o.verify_pattern_bytes,
-			   td->o.verify_fmt, td->o.verify_fmt_sz,
-			   p, len, io_u);
-	io_u->buf_filled_len = len;
+	/* Build from the pattern if there's no usable copy to start from */
+	if (!td->pattern_buf || len > td->pattern_buf_len ||
+	    (o->verify_fmt_sz &&
+	     o->verify_pattern_bytes < VERIFY_FMT_PATCH_MIN)) {
+		(void)paste_format(td->o.verify_pattern,
+				   td->o.verify_pattern_bytes,
+				   td->o.verify_fmt, td->o.verify_fmt_sz,
+				   p, len, io_u);
+		io_u->buf_filled_len = len;
+		return;
+	}
+
+	if (io_u->buf_filled_len < len) {
+		memcpy(p, td->pattern_buf, len);
+		io_u->buf_filled_len = len;
+	}
+	if (o->verify_fmt_sz)
+		(void)paste_format_repeat(o->verify_pattern_bytes,
+					  o->verify_fmt, o->verify_fmt_sz,
+					  p, len, io_u);
+}
+
+/*
+ * Keep a copy of the verify pattern spread over the largest block size, so
+ * buffers that were clobbered by a read are refilled with a single copy, and
+ * buffers that still hold the pattern only get their formats patched.
+ */
+int verify_pattern_init(struct thread_data *td, unsigned long long len)
+{
+	verify_pattern_free(td);
+
+	if (!td_write(td) || !td->o.verify_pattern_bytes || !len)
+		return 0;
+
+	td->pattern_buf = malloc(len);
+	if (!td->pattern_buf) {
+		log_err("fio: failed allocating verify pattern buffer\n");
+		return 1;
+	}
+
+	(void)cpy_pattern(td->o.verify_pattern, td->o.verify_pattern_bytes,
+			  td->pattern_buf, len);
+	td->pattern_buf_len = len;
+	return 0;
+}
+
+void verify_pattern_free(struct thread_data *td)
+{
+	free(td->pattern_buf);
+	td->pattern_buf = NULL;
+	td->pattern_buf_len = 0;
 }
 
 static unsigned int get_hdr_inc(struct thread_data *td, struct io_u *io_u)
@@ -105,6 +190,11 @@ static void fill_pattern_headers(struct thread_data *td, struct io_u *io_u,
 	fill_verify_pattern(td, p, io_u->buflen, io_u, seed, use_seed);
 
 	hdr_inc = get_hdr_inc(td, io_u);
+	if (td->o.verify == VERIFY_MD5 && hdr_inc > __hdr_size(VERIFY_MD5)) {
+		populate_md5_hdrs(td, io_u, hdr_inc);
+		return;
+	}
+
 	header_num = 0;
 	for (; p < io_u->buf + io_u->buflen; p += hdr_inc) {
 		hdr = p;
@@ -227,6 +317,12 @@ struct vcont {
 	unsigned int hdr_num;
 	struct thread_data *td;
 
+	/*
+	 * md5 of the data area if it was already calculated together with
+	 * other verify intervals
+	 */
+	uint32_t *md5_hash;
+
 	/*
 	 * Output, only valid in case of error
 	 */
@@ -708,9 +804,13 @@ static int verify_io_u_md5(struct verify_header *hdr, struct vcont *vc)
 
 	dprint(FD_VERIFY, "md5 verify io_u %p, len %u\n", vc->io_u, hdr->len);
 
-	fio_md5_init(&md5_ctx);
-	fio_md5_update(&md5_ctx, p, hdr->len - hdr_size(vc->td, hdr));
-	fio_md5_final(&md5_ctx);
+	if (vc->md5_hash)
+		md5_ctx.hash = vc->md5_hash;
+	else {
+		fio_md5_init(&md5_ctx);
+		fio_md5_update(&md5_ctx, p, hdr->len - hdr_size(vc->td, hdr));
+		fio_md5_final(&md5_ctx);
+	}
 
 	if (!memcmp(vh->md5_digest, md5_ctx.hash, sizeof(hash)))
 		return 0;
@@ -723,12 +823,30 @@ static int verify_io_u_md5(struct verify_header *hdr, struct vcont *vc)
 	return EILSEQ;
 }
 
+/*
+ * Async verify: every verify thread has its own queue. Completions are
+ * handed out round robin, a thread takes its whole queue at once, and
+ * steals from the others when it runs dry.
+ */
+struct verify_worker {
+	struct thread_data *td;
+	unsigned int idx;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct flist_head list;
+	unsigned int nr;
+	bool exit;
+};
+
 /*
  * Push IO verification to a separate thread
  */
 int verify_io_u_async(struct thread_data *td, struct io_u **io_u_ptr)
 {
 	struct io_u *io_u = *io_u_ptr;
+	struct verify_worker *w;
+	bool was_empty;
 
 	pthread_mutex_lock(&td->io_u_lock);
 
@@ -739,36 +857,19 @@ int verify_io_u_async(struct thread_data *td, struct io_u **io_u_ptr)
 		td->cur_depth--;
 		io_u_clear(td, io_u, IO_U_F_IN_CUR_DEPTH);
 	}
-	flist_add_tail(&io_u->verify_list, &td->verify_list);
-	*io_u_ptr = NULL;
-
-	pthread_cond_signal(&td->verify_cond);
+	w = &td->verify_workers[td->verify_next++ % td->nr_verify_workers];
 	pthread_mutex_unlock(&td->io_u_lock);
-	return 0;
-}
-
-/*
- * Thanks Rusty, for spending the time so I don't have to.
- *
- * http://rusty.ozlabs.org/?p=560
- */
-static int mem_is_zero(const void *data, size_t length)
-{
-	const unsigned char *p = data;
-	size_t len;
 
-	/* Check first 16 bytes manually */
-	for (len = 0; len < 16; len++) {
-		if (!length)
-			return 1;
-		if (*p)
-			return 0;
-		p++;
-		length--;
-	}
+	*io_u_ptr = NULL;
 
-	/* Now we know that's zero, memcmp with self. */
-	return memcmp(data, p, length) == 0;
+	pthread_mutex_lock(&w->lock);
+	was_empty = flist_empty(&w->list);
+	flist_add_tail(&io_u->verify_list, &w->list);
+	w->nr++;
+	if (was_empty)
+		pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+	return 0;
 }
 
 static int mem_is_zero_slow(const void *data, size_t length, size_t *offset)
@@ -843,7 +944,7 @@ static int verify_header(struct io_u *io_u, struct thread_data *td,
 	 * numberio check is skipped.
 	 */
 	if (td_write(td) && (td_min_bs(td) == td_max_bs(td)) &&
-	    !td->o.time_based)
+	    !td->o.time_based && !(io_u->flags & IO_U_F_VER_MAP))
 		if (!td->o.verify_only)
 			if (hdr->numberio != io_u->numberio) {
 				log_err("verify: bad header numberio %"PRIu16
@@ -874,11 +975,113 @@ err:
 	return EILSEQ;
 }
 
-int verify_io_u(struct thread_data *td, struct io_u **io_u_ptr)
+/*
+ * Can the md5 of the verify intervals of this io_u be calculated up front
+ * and together with others
+ */
+static bool verify_md5_mb(struct thread_data *td, struct io_u *io_u)
+{
+	return td->o.verify == VERIFY_MD5 && !td->o.verify_offset &&
+		io_u->ddir == DDIR_READ && !(io_u->flags & IO_U_F_TRIMMED) &&
+		!td_ioengine_flagged(td, FIO_FAKEIO) &&
+		get_hdr_inc(td, io_u) > __hdr_size(VERIFY_MD5);
+}
+
+/*
+ * md5 the data area of up to MD5_MB_LANES verify intervals starting at p.
+ * Only valid for intervals with an md5 header, which verify_io_u_md5()
+ * checks before using it.
+ */
+static void verify_md5_hdrs(struct io_u *io_u, void *p, unsigned int hdr_inc,
+			    uint32_t (*md5)[MD5_HASH_WORDS])
+{
+	unsigned int hdr_size = __hdr_size(VERIFY_MD5);
+	const uint8_t *data[MD5_MB_LANES];
+	uint32_t *hash[MD5_MB_LANES];
+	unsigned int nr;
+
+	for (nr = 0; nr < MD5_MB_LANES && p < io_u->buf + io_u->buflen;
+	     nr++, p += hdr_inc) {
+		data[nr] = p + hdr_size;
+		hash[nr] = md5[nr];
+	}
+
+	fio_md5_mb(data, hdr_inc - hdr_size, hash, nr);
+}
+
+/*
+ * Is hdr a valid header for the verify interval at off in io_u? Unlike
+ * verify_header(), this only looks at what the header says about itself
+ * and stays quiet.
+ */
+static bool torn_hdr_valid(struct thread_data *td, struct io_u *io_u,
+			   struct verify_header *hdr, unsigned int hdr_num,
+			   unsigned int hdr_len)
+{
+	if (hdr->magic != FIO_HDR_MAGIC || hdr->len != hdr_len ||
+	    hdr->offset != io_u->verify_offset + hdr_num * td->o.verify_interval)
+		return false;
+
+	return hdr->crc32 == fio_crc32c((void *) hdr,
+					offsetof(struct verify_header, crc32));
+}
+
+/*
+ * An atomic write that may have been in flight at the crash. Each of its
+ * verify intervals carries a header, and a write that landed whole left
+ * all of them, with the same seed, number and time. A write that never
+ * landed left the block as it was. Anything in between is a torn write.
+ *
+ * Returns 0 if the block holds a whole write to verify as usual, -1 if it
+ * holds no write at all and EILSEQ if the write was torn.
+ */
+static int verify_torn_io_u(struct thread_data *td, struct io_u *io_u)
+{
+	struct verify_header *hdr, *first = NULL;
+	unsigned int hdr_inc, hdr_num = 0, valid = 0, torn = 0;
+	void *p;
+
+	hdr_inc = get_hdr_inc(td, io_u);
+	for (p = io_u->buf; p < io_u->buf + io_u->buflen;
+	     p += hdr_inc, hdr_num++) {
+		hdr = p + td->o.verify_offset;
+		if (!torn_hdr_valid(td, io_u, hdr, hdr_num, hdr_inc))
+			continue;
+
+		valid++;
+		if (!first)
+			first = hdr;
+		else if (hdr->rand_seed != first->rand_seed ||
+			 hdr->numberio != first->numberio ||
+			 hdr->time_sec != first->time_sec ||
+			 hdr->time_nsec != first->time_nsec)
+			torn++;
+	}
+
+	if (!valid)
+		return -1;
+	if (!torn && valid == hdr_num)
+		return 0;
+
+	log_err("verify: torn atomic write at file %s offset %llu, length "
+		"%llu: %u of %u intervals from the same write\n",
+		io_u->file->file_name, io_u->verify_offset, io_u->buflen,
+		valid - torn, hdr_num);
+	if (td->o.verify_dump)
+		dump_buf(io_u->buf, io_u->buflen, io_u->verify_offset,
+				"torn", io_u->file);
+
+	return EILSEQ;
+}
+
+static int __verify_io_u(struct thread_data *td, struct io_u **io_u_ptr,
+			 uint32_t *md5_hash)
 {
+	uint32_t md5[MD5_MB_LANES][MD5_HASH_WORDS];
 	struct verify_header *hdr;
 	struct io_u *io_u = *io_u_ptr;
 	unsigned int header_size, hdr_inc, hdr_num = 0;
+	bool md5_mb;
 	void *p;
 	int ret;
 
@@ -896,7 +1099,21 @@ int verify_io_u(struct thread_data *td, struct io_u **io_u_ptr)
 		goto done;
 	}
 
+	if (td->o.verify_table) {
+		ret = verify_table_check(td, io_u);
+		goto done;
+	}
+
+	if (io_u->flags & IO_U_F_TORN_CHECK) {
+		ret = verify_torn_io_u(td, io_u);
+		if (ret < 0)
+			return 0;
+		if (ret)
+			goto done;
+	}
+
 	hdr_inc = get_hdr_inc(td, io_u);
+	md5_mb = !md5_hash && hdr_inc < io_u->buflen && verify_md5_mb(td, io_u);
 
 	ret = 0;
 	for (p = io_u->buf; p < io_u->buf + io_u->buflen;
@@ -911,6 +1128,13 @@ int verify_io_u(struct thread_data *td, struct io_u **io_u_ptr)
 		if (ret && td->o.verify_fatal)
 			break;
 
+		if (md5_mb) {
+			if (!(hdr_num % MD5_MB_LANES))
+				verify_md5_hdrs(io_u, p, hdr_inc, md5);
+			vc.md5_hash = md5[hdr_num % MD5_MB_LANES];
+		} else if (!hdr_num)
+			vc.md5_hash = md5_hash;
+
 		header_size = __hdr_size(td->o.verify);
 		if (td->o.verify_offset)
 			memswp(p, p + td->o.verify_offset, header_size);
@@ -918,10 +1142,10 @@ int verify_io_u(struct thread_data *td, struct io_u **io_u_ptr)
 
 		/*
 		 * Make rand_seed check pass when have verify_backlog or
-		 * zone reset frequency for zonemode=zbd.
+		 * zone reset frequency or zone appends for zonemode=zbd.
 		 */
 		if (!td_rw(td) || (td->flags & TD_F_VER_BACKLOG) ||
-		    td->o.zrf.u.f)
+		    td->o.zrf.u.f || td->o.zone_append)
 			io_u->rand_seed = hdr->rand_seed;
 
 		if (td->o.verify != VERIFY_PATTERN_NO_HDR) {
@@ -943,6 +1167,8 @@ int verify_io_u(struct thread_data *td, struct io_u **io_u_ptr)
 				ret = verify_io_u_pattern(hdr, &vc);
 			break;
 		case VERIFY_MD5:
+			if (vc.md5_hash && hdr->verify_type != VERIFY_MD5)
+				vc.md5_hash = NULL;
 			ret = verify_io_u_md5(hdr, &vc);
 			break;
 		case VERIFY_CRC64:
@@ -1006,6 +1232,11 @@ done:
 	return ret;
 }
 
+int verify_io_u(struct thread_data *td, struct io_u **io_u_ptr)
+{
+	return __verify_io_u(td, io_u_ptr, NULL);
+}
+
 static void fill_xxhash(struct verify_header *hdr, void *p, unsigned int len)
 {
 	struct vhdr_xxhash *vh = hdr_priv(hdr);
@@ -1280,21 +1511,455 @@ static void populate_hdr(struct thread_data *td, struct io_u *io_u,
 		memswp(p, p + td->o.verify_offset, hdr_size(td, hdr));
 }
 
+/*
+ * Like populate_hdr() for all the verify intervals of an io_u, but md5 up
+ * to MD5_MB_LANES of them together
+ */
+static void populate_md5_hdrs(struct thread_data *td, struct io_u *io_u,
+			      unsigned int hdr_inc)
+{
+	unsigned int hdr_size = __hdr_size(VERIFY_MD5);
+	struct verify_header *hdrs[MD5_MB_LANES];
+	const uint8_t *data[MD5_MB_LANES];
+	uint32_t *hash[MD5_MB_LANES];
+	unsigned int header_num = 0, nr = 0, i;
+	struct vhdr_md5 *vh;
+	void *p;
+
+	for (p = io_u->buf; p < io_u->buf + io_u->buflen; p += hdr_inc) {
+		hdrs[nr] = p;
+		fill_hdr(td, io_u, hdrs[nr], header_num++, hdr_inc,
+				io_u->rand_seed);
+		vh = hdr_priv(hdrs[nr]);
+		data[nr] = p + hdr_size;
+		hash[nr] = (uint32_t *) vh->md5_digest;
+
+		if (++nr < MD5_MB_LANES && p + hdr_inc < io_u->buf + io_u->buflen)
+			continue;
+
+		dprint(FD_VERIFY, "fill md5 io_u %p, len %u, nr %u\n",
+						io_u, hdr_inc, nr);
+		fio_md5_mb(data, hdr_inc - hdr_size, hash, nr);
+
+		if (td->o.verify_offset) {
+			for (i = 0; i < nr; i++)
+				memswp(hdrs[i], (void *) hdrs[i] + td->o.verify_offset,
+					hdr_size);
+		}
+		nr = 0;
+	}
+}
+
 /*
  * fill body of io_u->buf with random data and add a header with the
  * checksum of choice
  */
 void populate_verify_io_u(struct thread_data *td, struct io_u *io_u)
 {
-	if (td->o.verify == VERIFY_NULL)
+	if (td->o.verify == VERIFY_NULL || td->o.verify_table)
 		return;
 
 	fill_pattern_headers(td, io_u, 0, 0);
 }
 
+/*
+ * With verify_bitmap, written blocks are tracked in a bitmap per file
+ * instead of an io_piece each. A bit is cleared when a write to the block
+ * is issued and set when it completes, so a set bit is a completed write
+ * that hasn't been verified yet. Writes that don't map to a whole block
+ * fall back to an io_piece.
+ */
+int verify_map_init(struct thread_data *td)
+{
+	unsigned long long bs = td->o.min_bs[DDIR_WRITE];
+	struct fio_file *f;
+	unsigned int i;
+
+	if (!td->o.verify_bitmap || td->o.verify == VERIFY_NONE ||
+	    !td_write(td) || !td->o.do_verify || td->o.experimental_verify)
+		return 0;
+
+	for_each_file(td, f, i) {
+		if (f->verify_map || f->io_size < bs)
+			continue;
+
+		f->verify_map = axmap_new(f->io_size / bs);
+		if (!f->verify_map) {
+			log_err("fio: failed allocating verify bitmap for %s\n",
+					f->file_name);
+			return 1;
+		}
+		mem_acct_add(td, MEM_IO_HIST, axmap_size(f->verify_map));
+	}
+
+	td->verify_map_file = 0;
+	td->verify_map_next = 0;
+	return 0;
+}
+
+void verify_map_reset(struct thread_data *td)
+{
+	struct fio_file *f;
+	unsigned int i;
+
+	for_each_file(td, f, i) {
+		if (f->verify_map)
+			axmap_reset(f->verify_map);
+	}
+
+	td->verify_map_file = 0;
+	td->verify_map_next = 0;
+}
+
+static bool verify_map_block(struct thread_data *td, struct io_u *io_u,
+			     uint64_t *block)
+{
+	unsigned long long bs = td->o.min_bs[DDIR_WRITE];
+	struct fio_file *f = io_u->file;
+	uint64_t off;
+
+	if (!f->verify_map || io_u->offset < f->file_offset ||
+	    io_u->buflen != bs)
+		return false;
+
+	off = io_u->offset - f->file_offset;
+	if (off % bs || off + bs > f->io_size)
+		return false;
+
+	*block = off / bs;
+	return true;
+}
+
+/*
+ * A write is about to be issued. Returns true if it is tracked in the
+ * bitmap, an unverified earlier write to the block is dropped.
+ */
+bool verify_map_log(struct thread_data *td, struct io_u *io_u)
+{
+	uint64_t block;
+
+	if (!verify_map_block(td, io_u, &block))
+		return false;
+
+	if (axmap_isset(io_u->file->verify_map, block)) {
+		axmap_clear(io_u->file->verify_map, block);
+		td->io_hist_len--;
+	}
+
+	io_u_set(td, io_u, IO_U_F_VER_MAP);
+	return true;
+}
+
+void verify_map_complete(struct thread_data *td, struct io_u *io_u)
+{
+	uint64_t block;
+
+	io_u_clear(td, io_u, IO_U_F_VER_MAP);
+
+	if (!verify_map_block(td, io_u, &block) ||
+	    axmap_isset(io_u->file->verify_map, block))
+		return;
+
+	axmap_set(io_u->file->verify_map, block);
+	td->io_hist_len++;
+}
+
+/*
+ * Fill @io_u with the next block to verify. Blocks are handed out in offset
+ * order. With verify_backlog, blocks may be written behind the cursor, so
+ * wrap around once before giving up.
+ */
+static bool verify_map_get(struct thread_data *td, struct io_u *io_u)
+{
+	unsigned long long bs = td->o.min_bs[DDIR_WRITE];
+	bool wrapped = false;
+
+	if (!td->io_hist_len)
+		return false;
+
+	for (;;) {
+		struct fio_file *f;
+		uint64_t block;
+
+		if (td->verify_map_file >= td->files_index) {
+			if (wrapped)
+				return false;
+			wrapped = true;
+			td->verify_map_file = 0;
+			td->verify_map_next = 0;
+			continue;
+		}
+
+		f = td->files[td->verify_map_file];
+		if (f && f->verify_map) {
+			block = axmap_next_set(f->verify_map, td->verify_map_next);
+			if (block != -1ULL) {
+				axmap_clear(f->verify_map, block);
+				td->verify_map_next = block + 1;
+				td->io_hist_len--;
+
+				io_u->file = f;
+				io_u->offset = f->file_offset + block * bs;
+				io_u->verify_offset = io_u->offset;
+				io_u->buflen = bs;
+				io_u->numberio = 0;
+				io_u_set(td, io_u, IO_U_F_VER_MAP);
+				return true;
+			}
+		}
+
+		td->verify_map_file++;
+		td->verify_map_next = 0;
+	}
+}
+
+/*
+ * With verify_table, blocks carry no header and the data written is just
+ * the job's buffer contents. The crc32c of each verify_interval block is
+ * kept in a table per file, indexed by offset. 0 marks a block that hasn't
+ * been written, a block whose crc32c is 0 is stored as 1. With the verify
+ * state enabled, the table is a shared mapping of a file next to the state
+ * files, so a later verify_only job with verify_state_load can check the
+ * data against it.
+ */
+static bool verify_table_file(struct thread_data *td)
+{
+	return td->o.verify_state_save || td->o.verify_state;
+}
+
+static int verify_table_map(struct thread_data *td, struct fio_file *f,
+			    unsigned int fileno)
+{
+	uint64_t nr = f->io_size / td->o.verify_interval;
+	size_t len = nr * sizeof(uint32_t);
+	char prefix[PATH_MAX], name[PATH_MAX], suffix[32];
+	int flags = O_RDWR | O_CREAT;
+	void *p;
+	int fd;
+
+	if (!nr)
+		return 0;
+
+	if (!verify_table_file(td)) {
+		f->verify_table = calloc(nr, sizeof(uint32_t));
+		if (!f->verify_table) {
+			td_verror(td, ENOMEM, "verify table");
+			return 1;
+		}
+		f->verify_table_nr = nr;
+		return 0;
+	}
+
+	/*
+	 * A job that writes starts a new table, unless it picks up where a
+	 * saved state left off
+	 */
+	if (td_write(td) && !td->o.verify_only && !td->o.verify_state)
+		flags |= O_TRUNC;
+
+	verify_state_prefix(prefix);
+	snprintf(suffix, sizeof(suffix), "%u-verify.table", fileno);
+	__verify_state_gen_name(name, sizeof(name), td->o.name, prefix,
+				td->thread_number - 1, suffix);
+
+	fd = open(name, flags, 0644);
+	if (fd < 0) {
+		td_verror(td, errno, "open verify table");
+		log_err("fio: verify table: %s\n", name);
+		return 1;
+	}
+	if (ftruncate(fd, len) < 0) {
+		td_verror(td, errno, "ftruncate verify table");
+		close(fd);
+		return 1;
+	}
+
+	p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		td_verror(td, errno, "mmap verify table");
+		return 1;
+	}
+
+	f->verify_table = p;
+	f->verify_table_nr = nr;
+	return 0;
+}
+
+int verify_table_init(struct thread_data *td)
+{
+	struct fio_file *f;
+	unsigned int i;
+
+	if (!td->o.verify_table || td->o.verify == VERIFY_NONE)
+		return 0;
+
+	for_each_file(td, f, i) {
+		if (!f->verify_table && verify_table_map(td, f, i))
+			return 1;
+	}
+
+	return 0;
+}
+
+void verify_table_exit(struct thread_data *td)
+{
+	struct fio_file *f;
+	unsigned int i;
+
+	for_each_file(td, f, i) {
+		if (!f->verify_table)
+			continue;
+		if (verify_table_file(td))
+			munmap(f->verify_table,
+			       f->verify_table_nr * sizeof(uint32_t));
+		else
+			free(f->verify_table);
+		f->verify_table = NULL;
+	}
+}
+
+/*
+ * The table blocks covered by @io_u. Only whole blocks count, a partial
+ * block at the end is left alone.
+ */
+static bool verify_table_range(struct thread_data *td, struct io_u *io_u,
+			       uint64_t *block, uint64_t *nr)
+{
+	unsigned int bs = td->o.verify_interval;
+	struct fio_file *f = io_u->file;
+	uint64_t off;
+
+	if (io_u->offset < f->file_offset)
+		return false;
+
+	off = io_u->offset - f->file_offset;
+	if (off % bs)
+		return false;
+
+	*block = off / bs;
+	if (*block >= f->verify_table_nr)
+		return false;
+
+	*nr = min((uint64_t) (io_u->buflen / bs), f->verify_table_nr - *block);
+	return *nr != 0;
+}
+
+static inline uint32_t verify_table_crc(void *p, unsigned int len)
+{
+	uint32_t crc = fio_crc32c(p, len);
+
+	return crc ? crc : 1;
+}
+
+/*
+ * A write completed, record the checksums of its blocks. A trim makes
+ * them unknown. The writes of a verify_only job are never issued, so they
+ * leave the table alone.
+ */
+void verify_table_complete(struct thread_data *td, struct io_u *io_u)
+{
+	unsigned int bs = td->o.verify_interval;
+	uint32_t *table = io_u->file->verify_table;
+	uint64_t block, nr, i;
+
+	if (td->o.verify_only ||
+	    (io_u->ddir != DDIR_WRITE && io_u->ddir != DDIR_TRIM) ||
+	    io_u->nr_trim_ranges || !verify_table_range(td, io_u, &block, &nr))
+		return;
+
+	for (i = 0; i < nr; i++) {
+		if (io_u->ddir == DDIR_TRIM)
+			table[block + i] = 0;
+		else
+			table[block + i] = verify_table_crc(io_u->buf + i * bs,
+							    bs);
+	}
+}
+
+static int verify_table_check(struct thread_data *td, struct io_u *io_u)
+{
+	unsigned int bs = td->o.verify_interval;
+	uint32_t *table = io_u->file->verify_table;
+	uint64_t block, nr, i;
+	uint32_t crc;
+	int ret = 0;
+
+	if (!table || !verify_table_range(td, io_u, &block, &nr))
+		return 0;
+
+	for (i = 0; i < nr; i++) {
+		if (!table[block + i])
+			continue;
+
+		crc = verify_table_crc(io_u->buf + i * bs, bs);
+		if (crc == table[block + i])
+			continue;
+
+		log_err("crc32c: verify failed at file %s offset %llu, length %u"
+			" (requested block: offset=%llu, length=%llu, flags=%x)\n",
+			io_u->file->file_name, io_u->offset + i * bs, bs,
+			io_u->offset, io_u->buflen, io_u->flags);
+		log_err("       Expected CRC: %08x\n", table[block + i]);
+		log_err("       Received CRC: %08x\n", crc);
+		ret = EILSEQ;
+		if (td->o.verify_fatal)
+			break;
+	}
+
+	return ret;
+}
+
+/*
+ * With verify_sample_rate, is the block of @f at @offset, written as the
+ * @numberio'th write of the job, one to verify? The choice hashes the
+ * block with the verify seed, so a verify_only run makes the same one.
+ * With verify_sample_mode=recent, the chance of a block grows linearly
+ * with @numberio, from 0 for the first write to twice the rate for the
+ * last.
+ */
+static bool verify_sample_keep(struct thread_data *td, struct fio_file *f,
+			       uint64_t offset, uint64_t numberio)
+{
+	double rate = td->o.verify_sample_rate.u.f / 100.0;
+	uint64_t writes = td->io_issues[DDIR_WRITE];
+	uint64_t h;
+
+	if (td->o.verify_sample_mode == VERIFY_SAMPLE_RECENT && writes)
+		rate *= 2.0 * (numberio + 1) / writes;
+
+	h = __hash_u64(offset ^ ((uint64_t) f->fileno << 48) ^
+			td->rand_seeds[FIO_RAND_VER_OFF]);
+	return (h >> 11) * 0x1.0p-53 < rate;
+}
+
+void verify_sample_report(struct thread_data *td)
+{
+	uint64_t total = td->verify_sampled + td->verify_skipped;
+	double p;
+
+	if (!td->verify_skipped || !(output_format & FIO_OUTPUT_NORMAL))
+		return;
+
+	p = (double) td->verify_sampled / total;
+	log_info("%s: verified %llu of %llu written blocks (%.2f%%)",
+		 td->o.name, (unsigned long long) td->verify_sampled,
+		 (unsigned long long) total, 100.0 * p);
+
+	/*
+	 * Each bad block is picked with chance p, so m of them all go
+	 * unnoticed with chance (1 - p)^m
+	 */
+	if (td->o.verify_sample_mode == VERIFY_SAMPLE_UNIFORM && p > 0.0)
+		log_info(", 95%% confidence of catching %.0f or more bad blocks",
+			 ceil(log(0.05) / log1p(-p)));
+	log_info("\n");
+}
+
 int get_next_verify(struct thread_data *td, struct io_u *io_u)
 {
-	struct io_piece *ipo = NULL;
+	bool sample = td->o.verify_sample_rate.u.f < 100.0;
+	struct io_piece *ipo;
 
 	/*
 	 * this io_u is from a requeue, we already filled the offsets
@@ -1302,6 +1967,8 @@ int get_next_verify(struct thread_data *td, struct io_u *io_u)
 	if (io_u->file)
 		return 0;
 
+again:
+	ipo = NULL;
 	if (!RB_EMPTY_ROOT(&td->io_hist_tree)) {
 		struct fio_rb_node *n = rb_first(&td->io_hist_tree);
 
@@ -1333,43 +2000,62 @@ int get_next_verify(struct thread_data *td, struct io_u *io_u)
 	if (ipo) {
 		td->io_hist_len--;
 
+		if (sample && !verify_sample_keep(td, ipo->file, ipo->offset,
+						  ipo->numberio)) {
+			td->verify_skipped++;
+			remove_trim_entry(td, ipo);
+			free_io_piece(td, ipo);
+			goto again;
+		}
+
 		io_u->offset = ipo->offset;
-		io_u->verify_offset = ipo->offset;
+		io_u->verify_offset = ipo->verify_offset;
 		io_u->buflen = ipo->len;
 		io_u->numberio = ipo->numberio;
 		io_u->file = ipo->file;
-		io_u_set(td, io_u, IO_U_F_VER_LIST);
 
 		if (ipo->flags & IP_F_TRIMMED)
 			io_u_set(td, io_u, IO_U_F_TRIMMED);
 
-		if (!fio_file_open(io_u->file)) {
-			int r = td_io_open_file(td, io_u->file);
+		remove_trim_entry(td, ipo);
+		free_io_piece(td, ipo);
+	} else if (!td->o.verify_bitmap || !verify_map_get(td, io_u))
+		goto nothing;
+	else if (sample && !verify_sample_keep(td, io_u->file, io_u->offset, 0)) {
+		td->verify_skipped++;
+		io_u_clear(td, io_u, IO_U_F_VER_MAP);
+		io_u->file = NULL;
+		goto again;
+	}
 
-			if (r) {
-				dprint(FD_VERIFY, "failed file %s open\n",
-						io_u->file->file_name);
-				return 1;
-			}
+	if (sample)
+		td->verify_sampled++;
+	io_u_set(td, io_u, IO_U_F_VER_LIST);
+
+	if (!fio_file_open(io_u->file)) {
+		int r = td_io_open_file(td, io_u->file);
+
+		if (r) {
+			dprint(FD_VERIFY, "failed file %s open\n",
+					io_u->file->file_name);
+			return 1;
 		}
+	}
 
-		get_file(ipo->file);
-		assert(fio_file_open(io_u->file));
-		io_u->ddir = DDIR_READ;
-		io_u->xfer_buf = io_u->buf;
-		io_u->xfer_buflen = io_u->buflen;
+	get_file(io_u->file);
+	assert(fio_file_open(io_u->file));
+	io_u->ddir = DDIR_READ;
+	io_u->xfer_buf = io_u->buf;
+	io_u->xfer_buflen = io_u->buflen;
 
-		remove_trim_entry(td, ipo);
-		free(ipo);
-		dprint(FD_VERIFY, "get_next_verify: ret io_u %p\n", io_u);
+	dprint(FD_VERIFY, "get_next_verify: ret io_u %p\n", io_u);
 
-		if (!td->o.verify_pattern_bytes) {
-			io_u->rand_seed = __rand(&td->verify_state);
-			if (sizeof(int) != sizeof(long *))
-				io_u->rand_seed *= __rand(&td->verify_state);
-		}
-		return 0;
+	if (!td->o.verify_pattern_bytes) {
+		io_u->rand_seed = __rand(&td->verify_state);
+		if (sizeof(int) != sizeof(long *))
+			io_u->rand_seed *= __rand(&td->verify_state);
 	}
+	return 0;
 
 nothing:
 	dprint(FD_VERIFY, "get_next_verify: empty\n");
@@ -1382,12 +2068,123 @@ void fio_verify_init(struct thread_data *td)
 	    td->o.verify == VERIFY_CRC32C) {
 		crc32c_arm64_probe();
 		crc32c_intel_probe();
+	} else if (td->o.verify == VERIFY_SHA1 ||
+		   td->o.verify == VERIFY_SHA256) {
+		sha_arm64_probe();
+		sha_intel_probe();
+	} else if (td->o.verify == VERIFY_CRC64)
+		crc64_intel_probe();
+	else if (td->o.verify == VERIFY_MD5)
+		md5_intel_probe();
+
+	if (td->o.verify_pattern_bytes || td->o.trim_zero)
+		memeq_probe();
+}
+
+/*
+ * Take half of the queue of a busier verify thread. Owners consume from the
+ * head, so take from the tail.
+ */
+static bool verify_steal(struct verify_worker *w, struct flist_head *list)
+{
+	struct thread_data *td = w->td;
+	struct verify_worker *v;
+	struct flist_head *entry;
+	unsigned int i, nr;
+
+	for (i = 1; i < td->nr_verify_workers; i++) {
+		v = &td->verify_workers[(w->idx + i) % td->nr_verify_workers];
+		if (pthread_mutex_trylock(&v->lock))
+			continue;
+		if (v->nr < 2) {
+			pthread_mutex_unlock(&v->lock);
+			continue;
+		}
+
+		for (nr = v->nr / 2; nr; nr--) {
+			entry = v->list.prev;
+			flist_del(entry);
+			flist_add(entry, list);
+			v->nr--;
+		}
+		pthread_mutex_unlock(&v->lock);
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * Get the next batch of io_us to verify, returns false when told to exit
+ * with nothing left to do
+ */
+static bool verify_worker_get(struct verify_worker *w, struct flist_head *list)
+{
+	pthread_mutex_lock(&w->lock);
+	while (flist_empty(&w->list) && !w->exit) {
+		pthread_mutex_unlock(&w->lock);
+		if (verify_steal(w, list))
+			return true;
+
+		pthread_mutex_lock(&w->lock);
+		if (flist_empty(&w->list) && !w->exit)
+			pthread_cond_wait(&w->cond, &w->lock);
+	}
+
+	if (flist_empty(&w->list)) {
+		pthread_mutex_unlock(&w->lock);
+		return false;
+	}
+
+	flist_splice_tail_init(&w->list, list);
+	w->nr = 0;
+	pthread_mutex_unlock(&w->lock);
+	return true;
+}
+
+/*
+ * Take up to MD5_MB_LANES io_us off the list. Those that are a single md5
+ * verify interval of the same size are hashed together, md5[i] is set
+ * for them.
+ */
+static unsigned int verify_async_batch(struct thread_data *td,
+				       struct flist_head *list,
+				       struct io_u **io_us,
+				       uint32_t (*hashes)[MD5_HASH_WORDS],
+				       uint32_t **md5)
+{
+	unsigned int hdr_size = __hdr_size(VERIFY_MD5);
+	const uint8_t *data[MD5_MB_LANES];
+	uint32_t *hash[MD5_MB_LANES];
+	unsigned int nr = 0, nr_mb = 0, len = 0;
+	struct io_u *io_u;
+
+	while (!flist_empty(list) && nr < MD5_MB_LANES) {
+		io_u = flist_first_entry(list, struct io_u, verify_list);
+		flist_del_init(&io_u->verify_list);
+
+		io_us[nr] = io_u;
+		md5[nr] = NULL;
+		if (verify_md5_mb(td, io_u) &&
+		    get_hdr_inc(td, io_u) == io_u->buflen &&
+		    (!nr_mb || io_u->buflen == len)) {
+			len = io_u->buflen;
+			data[nr_mb] = io_u->buf + hdr_size;
+			hash[nr_mb++] = md5[nr] = hashes[nr];
+		}
+		nr++;
 	}
+
+	if (nr_mb)
+		fio_md5_mb(data, len - hdr_size, hash, nr_mb);
+
+	return nr;
 }
 
 static void *verify_async_thread(void *data)
 {
-	struct thread_data *td = data;
+	struct verify_worker *w = data;
+	struct thread_data *td = w->td;
 	struct io_u *io_u;
 	int ret = 0;
 
@@ -1400,41 +2197,29 @@ static void *verify_async_thread(void *data)
 	do {
 		FLIST_HEAD(list);
 
-		read_barrier();
-		if (td->verify_thread_exit)
+		if (!verify_worker_get(w, &list))
 			break;
 
-		pthread_mutex_lock(&td->io_u_lock);
-
-		while (flist_empty(&td->verify_list) &&
-		       !td->verify_thread_exit) {
-			ret = pthread_cond_wait(&td->verify_cond,
-							&td->io_u_lock);
-			if (ret) {
-				break;
-			}
-		}
-
-		flist_splice_init(&td->verify_list, &list);
-		pthread_mutex_unlock(&td->io_u_lock);
-
-		if (flist_empty(&list))
-			continue;
-
 		while (!flist_empty(&list)) {
-			io_u = flist_first_entry(&list, struct io_u, verify_list);
-			flist_del_init(&io_u->verify_list);
-
-			io_u_set(td, io_u, IO_U_F_NO_FILE_PUT);
-			ret = verify_io_u(td, &io_u);
-
-			put_io_u(td, io_u);
-			if (!ret)
-				continue;
-			if (td_non_fatal_error(td, ERROR_TYPE_VERIFY_BIT, ret)) {
-				update_error_count(td, ret);
-				td_clear_error(td);
-				ret = 0;
+			struct io_u *io_us[MD5_MB_LANES];
+			uint32_t hashes[MD5_MB_LANES][MD5_HASH_WORDS];
+			uint32_t *md5[MD5_MB_LANES];
+			unsigned int i, nr;
+
+			nr = verify_async_batch(td, &list, io_us, hashes, md5);
+			for (i = 0; i < nr; i++) {
+				io_u = io_us[i];
+				io_u_set(td, io_u, IO_U_F_NO_FILE_PUT);
+				ret = __verify_io_u(td, &io_u, md5[i]);
+
+				put_io_u(td, io_u);
+				if (!ret)
+					continue;
+				if (td_non_fatal_error(td, ERROR_TYPE_VERIFY_BIT, ret)) {
+					update_error_count(td, ret);
+					td_clear_error(td);
+					ret = 0;
+				}
 			}
 		}
 	} while (!ret);
@@ -1454,44 +2239,65 @@ done:
 	return NULL;
 }
 
+static void verify_workers_stop(struct thread_data *td)
+{
+	struct verify_worker *w;
+	unsigned int i;
+
+	for (i = 0; i < td->nr_verify_workers; i++) {
+		w = &td->verify_workers[i];
+		pthread_mutex_lock(&w->lock);
+		w->exit = true;
+		pthread_cond_signal(&w->cond);
+		pthread_mutex_unlock(&w->lock);
+	}
+}
+
 int verify_async_init(struct thread_data *td)
 {
-	int i, ret;
+	struct verify_worker *w;
 	pthread_attr_t attr;
+	int i, ret;
 
 	pthread_attr_init(&attr);
 	pthread_attr_setstacksize(&attr, 2 * PTHREAD_STACK_MIN);
 
-	td->verify_thread_exit = 0;
+	td->verify_workers = calloc(td->o.verify_async, sizeof(*w));
+	td->nr_verify_workers = td->o.verify_async;
+	td->verify_next = 0;
+	for (i = 0; i < td->o.verify_async; i++) {
+		w = &td->verify_workers[i];
+		w->td = td;
+		w->idx = i;
+		INIT_FLIST_HEAD(&w->list);
+		pthread_mutex_init(&w->lock, NULL);
+		pthread_cond_init(&w->cond, NULL);
+	}
 
-	td->verify_threads = malloc(sizeof(pthread_t) * td->o.verify_async);
 	for (i = 0; i < td->o.verify_async; i++) {
-		ret = pthread_create(&td->verify_threads[i], &attr,
-					verify_async_thread, td);
+		w = &td->verify_workers[i];
+		ret = pthread_create(&w->thread, &attr, verify_async_thread, w);
 		if (ret) {
 			log_err("fio: async verify creation failed: %s\n",
 					strerror(ret));
 			break;
 		}
-		ret = pthread_detach(td->verify_threads[i]);
+		ret = pthread_detach(w->thread);
 		if (ret) {
 			log_err("fio: async verify thread detach failed: %s\n",
 					strerror(ret));
 			break;
 		}
+		pthread_mutex_lock(&td->io_u_lock);
 		td->nr_verify_threads++;
+		pthread_mutex_unlock(&td->io_u_lock);
 	}
 
 	pthread_attr_destroy(&attr);
 
 	if (i != td->o.verify_async) {
 		log_err("fio: only %d verify threads started, exiting\n", i);
-
-		pthread_mutex_lock(&td->io_u_lock);
-		td->verify_thread_exit = 1;
-		pthread_cond_broadcast(&td->verify_cond);
-		pthread_mutex_unlock(&td->io_u_lock);
-
+		verify_workers_stop(td);
 		return 1;
 	}
 
@@ -1500,16 +2306,22 @@ int verify_async_init(struct thread_data *td)
 
 void verify_async_exit(struct thread_data *td)
 {
-	pthread_mutex_lock(&td->io_u_lock);
-	td->verify_thread_exit = 1;
-	pthread_cond_broadcast(&td->verify_cond);
+	unsigned int i;
+
+	verify_workers_stop(td);
 
+	pthread_mutex_lock(&td->io_u_lock);
 	while (td->nr_verify_threads)
 		pthread_cond_wait(&td->free_cond, &td->io_u_lock);
-
 	pthread_mutex_unlock(&td->io_u_lock);
-	free(td->verify_threads);
-	td->verify_threads = NULL;
+
+	for (i = 0; i < td->nr_verify_workers; i++) {
+		pthread_cond_destroy(&td->verify_workers[i].cond);
+		pthread_mutex_destroy(&td->verify_workers[i].lock);
+	}
+	free(td->verify_workers);
+	td->verify_workers = NULL;
+	td->nr_verify_workers = 0;
 }
 
 int paste_blockoff(char *buf, unsigned int len, void *priv)
@@ -1565,6 +2377,43 @@ static int fill_file_completions(struct thread_data *td,
 	return comps;
 }
 
+static void fill_thread_io_list(struct thread_data *td,
+				struct thread_io_list *s, int td_index)
+{
+	unsigned int comps, index = 0;
+	int i;
+
+	comps = fill_file_completions(td, s, &index);
+
+	s->no_comps = cpu_to_le64((uint64_t) comps);
+	s->depth = cpu_to_le64((uint64_t) td->o.iodepth);
+	s->nofiles = cpu_to_le64((uint64_t) td->o.nr_files);
+	s->numberio = cpu_to_le64((uint64_t) td->io_issues[DDIR_WRITE]);
+	s->index = cpu_to_le64((uint64_t) td_index);
+	if (td->random_state.use64 == FRAND_XOSHIRO) {
+		for (i = 0; i < 4; i++)
+			s->rand.state64.s[i] = cpu_to_le64(td->random_state.state256.s[i]);
+		s->rand.state64.s[4] = 0;
+		s->rand.state64.s[5] = 0;
+		s->rand.use64 = cpu_to_le64((uint64_t)FRAND_XOSHIRO);
+	} else if (td->random_state.use64) {
+		s->rand.state64.s[0] = cpu_to_le64(td->random_state.state64.s1);
+		s->rand.state64.s[1] = cpu_to_le64(td->random_state.state64.s2);
+		s->rand.state64.s[2] = cpu_to_le64(td->random_state.state64.s3);
+		s->rand.state64.s[3] = cpu_to_le64(td->random_state.state64.s4);
+		s->rand.state64.s[4] = cpu_to_le64(td->random_state.state64.s5);
+		s->rand.state64.s[5] = 0;
+		s->rand.use64 = cpu_to_le64((uint64_t)1);
+	} else {
+		s->rand.state32.s[0] = cpu_to_le32(td->random_state.state32.s1);
+		s->rand.state32.s[1] = cpu_to_le32(td->random_state.state32.s2);
+		s->rand.state32.s[2] = cpu_to_le32(td->random_state.state32.s3);
+		s->rand.state32.s[3] = 0;
+		s->rand.use64 = 0;
+	}
+	snprintf((char *) s->name, sizeof(s->name), "%s", td->o.name);
+}
+
 struct all_io_list *get_all_io_list(int save_mask, size_t *sz)
 {
 	struct all_io_list *rep;
@@ -1603,34 +2452,11 @@ struct all_io_list *get_all_io_list(int save_mask, size_t *sz)
 	next = &rep->state[0];
 	for_each_td(td) {
 		struct thread_io_list *s = next;
-		unsigned int comps, index = 0;
 
 		if (save_mask != IO_LIST_ALL && (__td_index + 1) != save_mask)
 			continue;
 
-		comps = fill_file_completions(td, s, &index);
-
-		s->no_comps = cpu_to_le64((uint64_t) comps);
-		s->depth = cpu_to_le64((uint64_t) td->o.iodepth);
-		s->nofiles = cpu_to_le64((uint64_t) td->o.nr_files);
-		s->numberio = cpu_to_le64((uint64_t) td->io_issues[DDIR_WRITE]);
-		s->index = cpu_to_le64((uint64_t) __td_index);
-		if (td->random_state.use64) {
-			s->rand.state64.s[0] = cpu_to_le64(td->random_state.state64.s1);
-			s->rand.state64.s[1] = cpu_to_le64(td->random_state.state64.s2);
-			s->rand.state64.s[2] = cpu_to_le64(td->random_state.state64.s3);
-			s->rand.state64.s[3] = cpu_to_le64(td->random_state.state64.s4);
-			s->rand.state64.s[4] = cpu_to_le64(td->random_state.state64.s5);
-			s->rand.state64.s[5] = 0;
-			s->rand.use64 = cpu_to_le64((uint64_t)1);
-		} else {
-			s->rand.state32.s[0] = cpu_to_le32(td->random_state.state32.s1);
-			s->rand.state32.s[1] = cpu_to_le32(td->random_state.state32.s2);
-			s->rand.state32.s[2] = cpu_to_le32(td->random_state.state32.s3);
-			s->rand.state32.s[3] = 0;
-			s->rand.use64 = 0;
-		}
-		snprintf((char *) s->name, sizeof(s->name), "%s", td->o.name);
+		fill_thread_io_list(td, s, __td_index);
 		next = io_list_next(s);
 	} end_for_each();
 
@@ -1638,13 +2464,15 @@ struct all_io_list *get_all_io_list(int save_mask, size_t *sz)
 }
 
 static int open_state_file(const char *name, const char *prefix, int num,
-			   int for_write)
+			   int for_write, bool append)
 {
 	char out[PATH_MAX];
 	int flags;
 	int fd;
 
-	if (for_write)
+	if (for_write && append)
+		flags = O_CREAT | O_APPEND | O_WRONLY | O_SYNC;
+	else if (for_write)
 		flags = O_CREAT | O_TRUNC | O_WRONLY | O_SYNC;
 	else
 		flags = O_RDONLY;
@@ -1661,15 +2489,20 @@ static int open_state_file(const char *name, const char *prefix, int num,
 	return fd;
 }
 
+/*
+ * Write one state record. With @append the record is added to the end of
+ * the file, the loader picks the last intact one.
+ */
 static int write_thread_list_state(struct thread_io_list *s,
-				   const char *prefix)
+				   const char *prefix, bool append)
 {
 	struct verify_state_hdr hdr;
 	uint64_t crc;
 	ssize_t ret;
 	int fd;
 
-	fd = open_state_file((const char *) s->name, prefix, s->index, 1);
+	fd = open_state_file((const char *) s->name, prefix, s->index, 1,
+				append);
 	if (fd == -1)
 		return 1;
 
@@ -1702,11 +2535,19 @@ void __verify_save_state(struct all_io_list *state, const char *prefix)
 	unsigned int i;
 
 	for (i = 0; i < le64_to_cpu(state->threads); i++) {
-		write_thread_list_state(s,  prefix);
+		write_thread_list_state(s,  prefix, false);
 		s = io_list_next(s);
 	}
 }
 
+static void verify_state_prefix(char *prefix)
+{
+	if (aux_path)
+		sprintf(prefix, "%s%clocal", aux_path, FIO_OS_PATH_SEPARATOR);
+	else
+		strcpy(prefix, "local");
+}
+
 void verify_save_state(int mask)
 {
 	struct all_io_list *state;
@@ -1714,18 +2555,92 @@ void verify_save_state(int mask)
 
 	state = get_all_io_list(mask, &sz);
 	if (state) {
+		struct thread_io_list *s = &state->state[0];
 		char prefix[PATH_MAX];
+		unsigned int i;
 
-		if (aux_path)
-			sprintf(prefix, "%s%clocal", aux_path, FIO_OS_PATH_SEPARATOR);
-		else
-			strcpy(prefix, "local");
+		verify_state_prefix(prefix);
+
+		/*
+		 * Don't truncate away the checkpoints of a job, if the final
+		 * record is torn the last checkpoint is still there.
+		 */
+		for (i = 0; i < le64_to_cpu(state->threads); i++) {
+			struct thread_data *td = tnumber_to_td(le64_to_cpu(s->index));
 
-		__verify_save_state(state, prefix);
+			write_thread_list_state(s, prefix, td->vstate_ckpt_written);
+			s = io_list_next(s);
+		}
 		free(state);
 	}
 }
 
+/* helper thread checkpoint tick, the smallest verify_state_interval */
+unsigned int verify_state_ckpt_msec;
+
+/*
+ * Called from the helper thread, flag jobs that are due a verify state
+ * checkpoint. The job writes the checkpoint from its own context, so that
+ * the completion ring and the random state it records are consistent.
+ */
+int verify_state_ckpt_check(void)
+{
+	for_each_td(td) {
+		uint64_t interval = td->o.verify_state_interval / 1000;
+		uint64_t elapsed;
+
+		if (!interval || (td->runstate != TD_RUNNING &&
+				  td->runstate != TD_VERIFYING))
+			continue;
+
+		elapsed = mtime_since_now(&td->epoch);
+		if (elapsed + verify_state_ckpt_msec / 2 < td->vstate_ckpt_next)
+			continue;
+
+		td->vstate_ckpt_next = elapsed + interval;
+		td->vstate_ckpt_pending = 1;
+	} end_for_each();
+
+	return 0;
+}
+
+/*
+ * Append a checkpoint of the write state of @td to its state file, without
+ * stopping the job. The first checkpoint of a run truncates the file.
+ */
+void verify_state_checkpoint(struct thread_data *td)
+{
+	struct thread_io_list *s;
+	char prefix[PATH_MAX];
+	size_t sz;
+
+	td->vstate_ckpt_pending = 0;
+
+	if (!td->o.verify_state_save || td->o.verify == VERIFY_NONE ||
+	    !td_write(td) || td->o.verify_only ||
+	    (td->flags & TD_F_VSTATE_SAVED))
+		return;
+	if (td->vstate_ckpt_written &&
+	    td->io_issues[DDIR_WRITE] == td->vstate_ckpt_numberio)
+		return;
+
+	sz = __thread_io_list_sz(td->o.iodepth, td->o.nr_files);
+	s = calloc(1, sz);
+	if (!s)
+		return;
+
+	fill_thread_io_list(td, s, td->thread_number - 1);
+	verify_state_prefix(prefix);
+	if (!write_thread_list_state(s, prefix, td->vstate_ckpt_written)) {
+		dprint(FD_VERIFY, "verify state checkpoint, numberio=%llu\n",
+			(unsigned long long) td->io_issues[DDIR_WRITE]);
+		td->vstate_ckpt_numberio = td->io_issues[DDIR_WRITE];
+		td->vstate_ckpt_written = 1;
+	}
+
+	free(s);
+}
+
 void verify_free_state(struct thread_data *td)
 {
 	if (td->vstate)
@@ -1777,61 +2692,102 @@ int verify_state_hdr(struct verify_state_hdr *hdr, struct thread_io_list *s)
 	return 0;
 }
 
+/*
+ * A state file holds one or more records of a verify_state_hdr followed by
+ * its thread_io_list. Each record is a full snapshot, so the last intact one
+ * wins, anything after it is the tail of a checkpoint that did not make it
+ * to disk. Returns the offset of that thread_io_list in @buf and its size
+ * in @size, or -1 if there is no intact record.
+ */
+ssize_t verify_state_scan(void *buf, size_t len, size_t *size)
+{
+	ssize_t found = -1;
+	size_t off = 0;
+	unsigned int nr = 0;
+
+	while (len - off >= sizeof(struct verify_state_hdr)) {
+		struct verify_state_hdr hdr;
+		void *s = buf + off + sizeof(hdr);
+
+		memcpy(&hdr, buf + off, sizeof(hdr));
+		if (le64_to_cpu(hdr.size) > len - off - sizeof(hdr) ||
+		    le64_to_cpu(hdr.size) < sizeof(struct thread_io_list))
+			break;
+		if (verify_state_hdr(&hdr, s))
+			break;
+
+		found = off + sizeof(hdr);
+		*size = hdr.size;
+		off += sizeof(hdr) + hdr.size;
+		nr++;
+	}
+
+	if (found != -1 && off != len)
+		log_info("fio: ignoring %zu bytes of torn verify state after record %u\n",
+				len - off, nr);
+
+	dprint(FD_VERIFY, "verify state: %u records\n", nr);
+	return found;
+}
+
 int verify_load_state(struct thread_data *td, const char *prefix)
 {
-	struct verify_state_hdr hdr;
-	void *s = NULL;
-	uint64_t crc;
-	ssize_t ret;
+	void *buf = NULL, *s;
+	struct stat sb;
+	ssize_t ret, off;
+	size_t size;
 	int fd;
 
 	if (!td->o.verify_state)
 		return 0;
 
-	fd = open_state_file(td->o.name, prefix, td->thread_number - 1, 0);
+	fd = open_state_file(td->o.name, prefix, td->thread_number - 1, 0,
+				false);
 	if (fd == -1)
 		return 1;
 
-	ret = read(fd, &hdr, sizeof(hdr));
-	if (ret != sizeof(hdr)) {
-		if (ret < 0)
-			td_verror(td, errno, "read verify state hdr");
-		log_err("fio: failed reading verify state header\n");
+	if (fstat(fd, &sb) < 0) {
+		td_verror(td, errno, "stat verify state");
 		goto err;
 	}
 
-	hdr.version = le64_to_cpu(hdr.version);
-	hdr.size = le64_to_cpu(hdr.size);
-	hdr.crc = le64_to_cpu(hdr.crc);
-
-	if (hdr.version != VSTATE_HDR_VERSION) {
-		log_err("fio: unsupported (%d) version in verify state header\n",
-				(unsigned int) hdr.version);
+	if (sb.st_size < sizeof(struct verify_state_hdr)) {
+		log_err("fio: failed reading verify state header\n");
 		goto err;
 	}
 
-	s = malloc(hdr.size);
-	ret = read(fd, s, hdr.size);
-	if (ret != hdr.size) {
+	buf = malloc(sb.st_size);
+	ret = read(fd, buf, sb.st_size);
+	if (ret != sb.st_size) {
 		if (ret < 0)
 			td_verror(td, errno, "read verify state");
 		log_err("fio: failed reading verity state\n");
 		goto err;
 	}
 
-	crc = fio_crc32c(s, hdr.size);
-	if (crc != hdr.crc) {
-		log_err("fio: verify state is corrupt\n");
+	off = verify_state_scan(buf, sb.st_size, &size);
+	if (off == -1) {
+		struct verify_state_hdr *hdr = buf;
+
+		if (le64_to_cpu(hdr->version) != VSTATE_HDR_VERSION)
+			log_err("fio: unsupported (%d) version in verify state header\n",
+				(unsigned int) le64_to_cpu(hdr->version));
+		else
+			log_err("fio: verify state is corrupt\n");
 		goto err;
 	}
 
 	close(fd);
 
+	s = malloc(size);
+	memcpy(s, buf + off, size);
+	free(buf);
+
 	verify_assign_state(td, s);
 	return 0;
 err:
-	if (s)
-		free(s);
+	if (buf)
+		free(buf);
 	close(fd);
 	return 1;
 }
@@ -1869,6 +2825,16 @@ int verify_state_should_stop(struct thread_data *td, struct io_u *io_u)
 			return 0;
 	}
 
+	/*
+	 * An atomic write in flight at the crash either landed whole or not
+	 * at all. Check the blocks up to the last write issued for tearing
+	 * rather than stopping at the first one.
+	 */
+	if (td->o.oatomic && td->io_issues[DDIR_READ] < s->numberio) {
+		io_u_set(td, io_u, IO_U_F_TORN_CHECK);
+		return 0;
+	}
+
 	/*
 	 * Not found, we have to stop
 	 */
@@ -32,6 +32,16 @@ enum {
 	VERIFY_NULL,			/* pretend to verify */
 };
 
+enum {
+	VERIFY_SAMPLE_UNIFORM = 0,
+	VERIFY_SAMPLE_RECENT,
+};
+
+enum {
+	VERIFY_BACKLOG_BATCH = 0,
+	VERIFY_BACKLOG_INTERLEAVE,
+};
+
 /*
  * A header structure associated with each checksummed data block. It is
  * followed by a checksum specific header that contains the verification
@@ -101,6 +111,32 @@ extern void fill_verify_pattern(struct thread_data *td, void *p, unsigned int le
 extern void fill_buffer_pattern(struct thread_data *td, void *p, unsigned int len);
 extern void fio_verify_init(struct thread_data *td);
 
+/*
+ * Template copy of the verify pattern, for refilling buffers
+ */
+extern int verify_pattern_init(struct thread_data *, unsigned long long);
+extern void verify_pattern_free(struct thread_data *);
+
+/*
+ * Written block bitmap, for verify_bitmap
+ */
+extern int verify_map_init(struct thread_data *);
+extern void verify_map_reset(struct thread_data *);
+extern bool verify_map_log(struct thread_data *, struct io_u *);
+extern void verify_map_complete(struct thread_data *, struct io_u *);
+
+/*
+ * Per block checksum table, for verify_table
+ */
+extern int verify_table_init(struct thread_data *);
+extern void verify_table_exit(struct thread_data *);
+extern void verify_table_complete(struct thread_data *, struct io_u *);
+
+/*
+ * Sampled verification, for verify_sample_rate
+ */
+extern void verify_sample_report(struct thread_data *);
+
 /*
  * Async verify offload
  */
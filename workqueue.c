@@ -95,43 +95,110 @@ void workqueue_flush(struct workqueue *wq)
 	pthread_mutex_unlock(&wq->flush_lock);
 }
 
+static unsigned int nr_sw_idle(struct workqueue *wq)
+{
+	unsigned int i, nr = 0;
+
+	for (i = 0; i < wq->max_workers; i++)
+		if (wq->workers[i].flags & SW_F_IDLE)
+			nr++;
+
+	return nr;
+}
+
 /*
- * Must be serialized by caller.
+ * Must be serialized by caller. The work is split in even chunks over
+ * the idle workers, with one lock and wakeup per chunk rather than per
+ * item. What ends up unevenly spread is evened out by stealing.
  */
-void workqueue_enqueue(struct workqueue *wq, struct workqueue_work *work)
+void workqueue_enqueue_batch(struct workqueue *wq,
+			     struct workqueue_work **work, unsigned int nr)
 {
 	struct submit_worker *sw;
+	unsigned int i = 0, j, chunk = nr;
 
-	sw = get_submit_worker(wq);
-	assert(sw);
+	if (nr > 1) {
+		unsigned int idle = max(nr_sw_idle(wq), 1U);
 
-	pthread_mutex_lock(&sw->lock);
-	flist_add_tail(&work->list, &sw->work_list);
-	sw->seq = ++wq->work_seq;
-	sw->flags &= ~SW_F_IDLE;
+		chunk = (nr + idle - 1) / idle;
+	}
 
-	pthread_cond_signal(&sw->cond);
-	pthread_mutex_unlock(&sw->lock);
+	while (i < nr) {
+		sw = get_submit_worker(wq);
+		assert(sw);
+
+		pthread_mutex_lock(&sw->lock);
+		for (j = 0; j < chunk && i < nr; j++, i++)
+			flist_add_tail(&work[i]->list, &sw->work_list);
+		sw->nr_work += j;
+		sw->seq = ++wq->work_seq;
+
+		/*
+		 * A worker only sleeps once it has marked itself idle, and
+		 * a busy one picks the work up before it goes to sleep again.
+		 */
+		if (sw->flags & SW_F_IDLE) {
+			sw->flags &= ~SW_F_IDLE;
+			pthread_cond_signal(&sw->cond);
+		}
+		pthread_mutex_unlock(&sw->lock);
+	}
+}
+
+/*
+ * Must be serialized by caller.
+ */
+void workqueue_enqueue(struct workqueue *wq, struct workqueue_work *work)
+{
+	workqueue_enqueue_batch(wq, &work, 1);
 }
 
-static void handle_list(struct submit_worker *sw, struct flist_head *list)
+/*
+ * Called with sw->lock held and an empty work list. Take half of the
+ * queued work of another worker, from the tail of its list while it
+ * works off the head. Victims are only trylocked, so holding our own
+ * lock can't deadlock against another thief.
+ */
+static bool steal_work(struct submit_worker *sw)
 {
 	struct workqueue *wq = sw->wq;
+	struct submit_worker *victim;
 	struct workqueue_work *work;
+	unsigned int i, nr;
+
+	for (i = 1; i < wq->max_workers; i++) {
+		victim = &wq->workers[(sw->index + i) % wq->max_workers];
+		if (!victim->nr_work)
+			continue;
+		if (pthread_mutex_trylock(&victim->lock))
+			continue;
+
+		nr = victim->nr_work / 2;
+		victim->nr_work -= nr;
+		sw->nr_work = nr;
+		while (nr--) {
+			work = flist_last_entry(&victim->work_list,
+						struct workqueue_work, list);
+			flist_del(&work->list);
+			flist_add(&work->list, &sw->work_list);
+		}
+		pthread_mutex_unlock(&victim->lock);
 
-	while (!flist_empty(list)) {
-		work = flist_first_entry(list, struct workqueue_work, list);
-		flist_del_init(&work->list);
-		wq->ops.fn(sw, work);
+		if (sw->nr_work) {
+			sw->flags &= ~SW_F_IDLE;
+			return true;
+		}
 	}
+
+	return false;
 }
 
 static void *worker_thread(void *data)
 {
 	struct submit_worker *sw = data;
 	struct workqueue *wq = sw->wq;
+	struct workqueue_work *work;
 	unsigned int ret = 0;
-	FLIST_HEAD(local_list);
 
 	sk_out_assign(sw->sk_out);
 
@@ -179,7 +246,7 @@ static void *worker_thread(void *data)
 			if (sw->flags & SW_F_EXIT) {
 				break;
 			}
-			if (!(sw->flags & SW_F_IDLE)) {
+			if (!steal_work(sw) && !(sw->flags & SW_F_IDLE)) {
 				sw->flags |= SW_F_IDLE;
 				wq->next_free_worker = sw->index;
 				pthread_mutex_unlock(&sw->lock);
@@ -195,14 +262,25 @@ static void *worker_thread(void *data)
 				break;
 			}
 			pthread_cond_wait(&sw->cond, &sw->lock);
-		} else {
-			flist_splice_init(&sw->work_list, &local_list);
+			continue;
 		}
+
+		/*
+		 * Take one item at a time, what is left on the list can be
+		 * stolen by idle workers while this one runs.
+		 */
+		work = flist_first_entry(&sw->work_list, struct workqueue_work,
+					 list);
+		flist_del_init(&work->list);
+		sw->nr_work--;
 		pthread_mutex_unlock(&sw->lock);
-		handle_list(sw, &local_list);
-		if (wq->ops.update_acct_fn)
-			wq->ops.update_acct_fn(sw);
+		wq->ops.fn(sw, work);
 		pthread_mutex_lock(&sw->lock);
+		if (!sw->nr_work && wq->ops.update_acct_fn) {
+			pthread_mutex_unlock(&sw->lock);
+			wq->ops.update_acct_fn(sw);
+			pthread_mutex_lock(&sw->lock);
+		}
 	}
 	pthread_mutex_unlock(&sw->lock);
 
@@ -291,13 +369,14 @@ static int start_worker(struct workqueue *wq, unsigned int index,
 			return ret;
 	}
 
+	/*
+	 * Set before the thread runs, it adds SW_F_RUNNING to the flags
+	 * and overwriting them afterwards would lose that.
+	 */
+	sw->flags = SW_F_IDLE;
 	ret = pthread_create(&sw->thread, NULL, worker_thread, sw);
-	if (!ret) {
-		pthread_mutex_lock(&sw->lock);
-		sw->flags = SW_F_IDLE;
-		pthread_mutex_unlock(&sw->lock);
+	if (!ret)
 		return 0;
-	}
 
 	free_worker(sw, NULL);
 	return 1;
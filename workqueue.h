@@ -19,6 +19,7 @@ struct submit_worker {
 	pthread_mutex_t lock;
 	pthread_cond_t cond;
 	struct flist_head work_list;
+	unsigned int nr_work;
 	unsigned int flags;
 	unsigned int index;
 	uint64_t seq;
@@ -72,6 +73,7 @@ int workqueue_init(struct thread_data *td, struct workqueue *wq, struct workqueu
 void workqueue_exit(struct workqueue *wq);
 
 void workqueue_enqueue(struct workqueue *wq, struct workqueue_work *work);
+void workqueue_enqueue_batch(struct workqueue *wq, struct workqueue_work **work, unsigned int nr);
 void workqueue_flush(struct workqueue *wq);
 
 static inline bool workqueue_pre_sleep_check(struct submit_worker *sw)
@@ -5,6 +5,7 @@
  */
 
 #include <errno.h>
+#include <pthread.h>
 #include <string.h>
 #include <stdlib.h>
 #include <fcntl.h>
@@ -225,6 +226,107 @@ static int zbd_report_zones(struct thread_data *td, struct fio_file *f,
 	return ret;
 }
 
+/*
+ * Maximum number of zones to report in one operation.
+ */
+#define ZBD_REPORT_MAX_ZONES	8192U
+
+/*
+ * Store the device zone report in zones @zone_idx_b .. @zone_idx_e - 1 of
+ * f->zbd_info if that has not been done yet, by this or another job sharing
+ * the zone information.
+ *
+ * Returns 0 upon success and a negative error code upon failure.
+ */
+static int zbd_report_zone_range(struct thread_data *td, struct fio_file *f,
+				 uint32_t zone_idx_b, uint32_t zone_idx_e)
+{
+	struct zoned_block_device_info *zbdi = f->zbd_info;
+	const uint64_t zone_size = zbdi->zone_size;
+	struct zbd_zone *zones = NULL, *z;
+	struct fio_zone_info *p;
+	uint32_t j, k;
+	int i, nrz, ret = 0;
+
+	pthread_mutex_lock(&zbdi->mutex);
+
+	zone_idx_e = min(zone_idx_e, zbdi->nr_zones);
+	for (j = zone_idx_b; j < zone_idx_e;) {
+		if (zbdi->zone_info[j].reported) {
+			j++;
+			continue;
+		}
+
+		if (!zones) {
+			zones = calloc(ZBD_REPORT_MAX_ZONES,
+				       sizeof(struct zbd_zone));
+			if (!zones) {
+				ret = -ENOMEM;
+				goto out;
+			}
+		}
+
+		/* Report the run of zones that are not known yet */
+		for (k = j + 1; k < zone_idx_e && k - j < ZBD_REPORT_MAX_ZONES;
+		     k++)
+			if (zbdi->zone_info[k].reported)
+				break;
+
+		p = &zbdi->zone_info[j];
+		nrz = zbd_report_zones(td, f, p->start, zones, k - j);
+		if (nrz < 0) {
+			ret = nrz;
+			log_info("fio: report zones (offset %"PRIu64") failed for %s (%d).\n",
+				 p->start, f->file_name, -ret);
+			goto out;
+		}
+
+		dprint(FD_ZBD, "%s: reported zones %u .. %u\n",
+		       f->file_name, j, j + nrz - 1);
+
+		z = &zones[0];
+		for (i = 0; i < nrz && j < zbdi->nr_zones; i++, j++, z++, p++) {
+			if (z->start != p->start) {
+				log_info("%s: invalid zone data [%u:%d]: %"PRIu64" != %"PRIu64"\n",
+					 f->file_name, j, i, z->start,
+					 p->start);
+				ret = -EINVAL;
+				goto out;
+			}
+
+			p->capacity = z->capacity;
+
+			switch (z->cond) {
+			case ZBD_ZONE_COND_NOT_WP:
+			case ZBD_ZONE_COND_FULL:
+				p->wp = p->start + p->capacity;
+				break;
+			default:
+				assert(z->start <= z->wp);
+				assert(z->wp <= z->start + zone_size);
+				p->wp = z->wp;
+				break;
+			}
+
+			switch (z->type) {
+			case ZBD_ZONE_TYPE_SWR:
+				p->has_wp = 1;
+				break;
+			default:
+				p->has_wp = 0;
+			}
+			p->type = z->type;
+			p->cond = z->cond;
+			p->reported = 1;
+		}
+	}
+
+out:
+	pthread_mutex_unlock(&zbdi->mutex);
+	free(zones);
+	return ret;
+}
+
 /**
  * zbd_reset_wp - reset the write pointer of a range of zones
  * @td: FIO thread data.
@@ -253,6 +355,23 @@ static int zbd_reset_wp(struct thread_data *td, struct fio_file *f,
 	return ret;
 }
 
+/*
+ * Zone appends don't hold the zone lock while in flight, so ours and those
+ * of other jobs have to drain before the zone changes state under them.
+ *
+ * The caller must hold z->mutex.
+ */
+static void zbd_wait_zone_appends(struct thread_data *td,
+				  struct fio_zone_info *z)
+{
+	if (!__atomic_load_n(&z->appends, __ATOMIC_ACQUIRE))
+		return;
+
+	io_u_quiesce(td);
+	while (__atomic_load_n(&z->appends, __ATOMIC_ACQUIRE))
+		usleep(10);
+}
+
 /**
  * zbd_reset_zone - reset the write pointer of a single zone
  * @td: FIO thread data.
@@ -279,6 +398,8 @@ static int zbd_reset_zone(struct thread_data *td, struct fio_file *f,
 	dprint(FD_ZBD, "%s: resetting wp of zone %u.\n",
 	       f->file_name, zbd_zone_idx(f, z));
 
+	zbd_wait_zone_appends(td, z);
+
 	switch (f->zbd_info->model) {
 	case ZBD_HOST_AWARE:
 	case ZBD_HOST_MANAGED:
@@ -290,15 +411,14 @@ static int zbd_reset_zone(struct thread_data *td, struct fio_file *f,
 		break;
 	}
 
-	if (accounting_vdb(td, f)) {
-		pthread_mutex_lock(&f->zbd_info->mutex);
-		f->zbd_info->wp_valid_data_bytes -= data_in_zone;
-		pthread_mutex_unlock(&f->zbd_info->mutex);
-	}
+	if (accounting_vdb(td, f))
+		__atomic_fetch_sub(&f->zbd_info->wp_valid_data_bytes,
+				   data_in_zone, __ATOMIC_RELAXED);
 
 	z->wp = z->start;
 
-	td->ts.nr_zone_resets++;
+	/* A job's zone reset worker resets zones as well */
+	__atomic_fetch_add(&td->ts.nr_zone_resets, 1, __ATOMIC_RELAXED);
 
 	return ret;
 }
@@ -339,6 +459,111 @@ static void zbd_close_zone(struct thread_data *td, const struct fio_file *f,
 	z->open = 0;
 }
 
+/*
+ * Whether another job owns zone @z. Always false unless the job writes with
+ * zone_owner set.
+ */
+static bool zbd_zone_foreign(const struct thread_data *td,
+			     const struct fio_file *f, struct fio_zone_info *z)
+{
+	const struct zbd_owned_zones *oz = f->zbd_owned;
+	uint32_t owner;
+
+	if (!oz)
+		return false;
+
+	if (td->o.zone_owner == ZONE_OWNER_STRIPE)
+		return zbd_zone_idx(f, z) % oz->nr_jobs != oz->job;
+
+	owner = __atomic_load_n(&z->owner, __ATOMIC_ACQUIRE);
+	return owner && owner != td->thread_number;
+}
+
+/**
+ * zbd_own_zone - add a zone to the zones the job has open with zone_owner set
+ * @td: fio thread data.
+ * @f: fio file that has the zone.
+ * @z: zone to open.
+ *
+ * Returns false if the job has its share of open zones already or if the
+ * zone belongs to another job. With zone_owner=lease, the zone is claimed
+ * here, so no other job opens it until zbd_release_zone().
+ */
+static bool zbd_own_zone(struct thread_data *td, const struct fio_file *f,
+			 struct fio_zone_info *z)
+{
+	struct zbd_owned_zones *oz = f->zbd_owned;
+	uint32_t none = 0;
+
+	if (oz->nr_open >= oz->max_open || zbd_zone_foreign(td, f, z))
+		return false;
+
+	if (td->o.zone_owner == ZONE_OWNER_LEASE &&
+	    !__atomic_compare_exchange_n(&z->owner, &none, td->thread_number,
+					 false, __ATOMIC_ACQUIRE,
+					 __ATOMIC_RELAXED))
+		return false;
+
+	dprint(FD_ZBD, "%s: job %u opening zone %u\n",
+	       f->file_name, oz->job, zbd_zone_idx(f, z));
+
+	oz->open[oz->nr_open++] = zbd_zone_idx(f, z);
+	td->num_open_zones++;
+	z->open = 1;
+	return true;
+}
+
+/**
+ * zbd_release_zone - remove a zone from the zones the job has open
+ * @td: fio thread data.
+ * @f: fio file that has the zone.
+ * @z: zone to close.
+ *
+ * With zone_owner=lease, other jobs may claim the zone from here on.
+ */
+static void zbd_release_zone(struct thread_data *td, const struct fio_file *f,
+			     struct fio_zone_info *z)
+{
+	struct zbd_owned_zones *oz = f->zbd_owned;
+	uint32_t zone_idx = zbd_zone_idx(f, z);
+	uint32_t i;
+
+	for (i = 0; i < oz->nr_open; i++) {
+		if (oz->open[i] == zone_idx)
+			break;
+	}
+	if (i == oz->nr_open)
+		return;
+
+	dprint(FD_ZBD, "%s: job %u closing zone %u\n",
+	       f->file_name, oz->job, zone_idx);
+
+	memmove(oz->open + i, oz->open + i + 1,
+		(oz->nr_open - (i + 1)) * sizeof(oz->open[0]));
+	oz->nr_open--;
+	td->num_open_zones--;
+	z->open = 0;
+	if (td->o.zone_owner == ZONE_OWNER_LEASE)
+		__atomic_store_n(&z->owner, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Close zone @z for the job, under zbdi->mutex unless the job owns its
+ * zones.
+ */
+static void zbd_put_zone(struct thread_data *td, const struct fio_file *f,
+			 struct fio_zone_info *z)
+{
+	if (f->zbd_owned) {
+		zbd_release_zone(td, f, z);
+		return;
+	}
+
+	pthread_mutex_lock(&f->zbd_info->mutex);
+	zbd_close_zone(td, f, z);
+	pthread_mutex_unlock(&f->zbd_info->mutex);
+}
+
 /**
  * zbd_finish_zone - finish the specified zone
  * @td: FIO thread data.
@@ -354,6 +579,8 @@ static int zbd_finish_zone(struct thread_data *td, struct fio_file *f,
 	uint64_t length = f->zbd_info->zone_size;
 	int ret = 0;
 
+	zbd_wait_zone_appends(td, z);
+
 	switch (f->zbd_info->model) {
 	case ZBD_HOST_AWARE:
 	case ZBD_HOST_MANAGED:
@@ -400,13 +627,11 @@ static int zbd_reset_zones(struct thread_data *td, struct fio_file *f,
 	       f->file_name, zbd_zone_idx(f, zb), zbd_zone_idx(f, ze));
 
 	for (z = zb; z < ze; z++) {
-		if (!z->has_wp)
+		if (!z->has_wp || zbd_zone_foreign(td, f, z))
 			continue;
 
 		zone_lock(td, f, z);
-		pthread_mutex_lock(&f->zbd_info->mutex);
-		zbd_close_zone(td, f, z);
-		pthread_mutex_unlock(&f->zbd_info->mutex);
+		zbd_put_zone(td, f, z);
 
 		if (z->wp != z->start) {
 			dprint(FD_ZBD, "%s: resetting zone %u\n",
@@ -487,18 +712,16 @@ static bool zbd_open_zone(struct thread_data *td, const struct fio_file *f,
 	if (!zbdi->max_open_zones)
 		return true;
 
-	pthread_mutex_lock(&zbdi->mutex);
+	/*
+	 * An open zone with room left stays open while the caller holds
+	 * z->mutex, so writes to it don't need zbdi->mutex. If the zone
+	 * is going to be completely filled by writes already in-flight, handle
+	 * it as a full zone instead of an open zone.
+	 */
+	if (z->open)
+		return zbd_zone_remainder(z) != 0;
 
-	if (z->open) {
-		/*
-		 * If the zone is going to be completely filled by writes
-		 * already in-flight, handle it as a full zone instead of an
-		 * open zone.
-		 */
-		if (!zbd_zone_remainder(z))
-			res = false;
-		goto out;
-	}
+	pthread_mutex_lock(&zbdi->mutex);
 
 	res = false;
 	/* Zero means no limit */
@@ -575,6 +798,16 @@ static bool zbd_zone_align_file_sizes(struct thread_data *td,
 		return true;
 	if (f->file_offset >= f->real_file_size)
 		return true;
+
+	/*
+	 * Only the zones in the I/O range and the one right after it are
+	 * looked at once the job runs.
+	 */
+	if (zbd_report_zone_range(td, f,
+			zbd_offset_to_zone_idx(f, f->file_offset),
+			zbd_offset_to_zone_idx(f, f->file_offset + f->io_size) + 1))
+		return false;
+
 	if (!zbd_is_seq_job(f))
 		return true;
 
@@ -750,6 +983,7 @@ static int init_zone_info(struct thread_data *td, struct fio_file *f)
 		p->cond = ZBD_ZONE_COND_EMPTY;
 		p->capacity = zone_capacity;
 		p->has_wp = 1;
+		p->reported = 1;
 	}
 	/* a sentinel */
 	p->start = nr_zones * zone_size;
@@ -763,36 +997,28 @@ static int init_zone_info(struct thread_data *td, struct fio_file *f)
 }
 
 /*
- * Maximum number of zones to report in one operation.
- */
-#define ZBD_REPORT_MAX_ZONES	8192U
-
-/*
- * Parse the device zone report and store it in f->zbd_info. Must be called
- * only for devices that are zoned, namely those with a model != ZBD_NONE.
+ * Parse the zone report of the first zone of the device and allocate
+ * f->zbd_info for all of its zones. Must be called only for devices that are
+ * zoned, namely those with a model != ZBD_NONE. The remaining zones are only
+ * reported once a job needs them, see zbd_report_zone_range().
  */
 static int parse_zone_info(struct thread_data *td, struct fio_file *f)
 {
 	int nr_zones, nrz;
-	struct zbd_zone *zones, *z;
+	struct zbd_zone zone;
 	struct fio_zone_info *p;
-	uint64_t zone_size, offset;
+	uint64_t zone_size;
 	struct zoned_block_device_info *zbd_info = NULL;
-	int i, j, ret = -ENOMEM;
-
-	zones = calloc(ZBD_REPORT_MAX_ZONES, sizeof(struct zbd_zone));
-	if (!zones)
-		goto out;
+	int i;
 
-	nrz = zbd_report_zones(td, f, 0, zones, ZBD_REPORT_MAX_ZONES);
+	nrz = zbd_report_zones(td, f, 0, &zone, 1);
 	if (nrz < 0) {
-		ret = nrz;
 		log_info("fio: report zones (offset 0) failed for %s (%d).\n",
-			 f->file_name, -ret);
-		goto out;
+			 f->file_name, -nrz);
+		return nrz;
 	}
 
-	zone_size = zones[0].len;
+	zone_size = zone.len;
 	nr_zones = (f->real_file_size + zone_size - 1) / zone_size;
 
 	if (td->o.zone_size == 0) {
@@ -800,89 +1026,34 @@ static int parse_zone_info(struct thread_data *td, struct fio_file *f)
 	} else if (td->o.zone_size != zone_size) {
 		log_err("fio: %s job parameter zonesize %llu does not match disk zone size %"PRIu64".\n",
 			f->file_name, td->o.zone_size, zone_size);
-		ret = -EINVAL;
-		goto out;
+		return -EINVAL;
 	}
 
 	dprint(FD_ZBD, "Device %s has %d zones of size %"PRIu64" KB and capacity %"PRIu64" KB\n",
-	       f->file_name, nr_zones, zone_size / 1024, zones[0].capacity / 1024);
+	       f->file_name, nr_zones, zone_size / 1024, zone.capacity / 1024);
 
 	zbd_info = scalloc(1, sizeof(*zbd_info) +
 			   (nr_zones + 1) * sizeof(zbd_info->zone_info[0]));
 	if (!zbd_info)
-		goto out;
+		return -ENOMEM;
 	mutex_init_pshared(&zbd_info->mutex);
 	zbd_info->refcount = 1;
 	p = &zbd_info->zone_info[0];
-	for (offset = 0, j = 0; j < nr_zones;) {
-		z = &zones[0];
-		for (i = 0; i < nrz; i++, j++, z++, p++) {
-			mutex_init_pshared_with_type(&p->mutex,
-						     PTHREAD_MUTEX_RECURSIVE);
-			p->start = z->start;
-			p->capacity = z->capacity;
-
-			switch (z->cond) {
-			case ZBD_ZONE_COND_NOT_WP:
-			case ZBD_ZONE_COND_FULL:
-				p->wp = p->start + p->capacity;
-				break;
-			default:
-				assert(z->start <= z->wp);
-				assert(z->wp <= z->start + zone_size);
-				p->wp = z->wp;
-				break;
-			}
-
-			switch (z->type) {
-			case ZBD_ZONE_TYPE_SWR:
-				p->has_wp = 1;
-				break;
-			default:
-				p->has_wp = 0;
-			}
-			p->type = z->type;
-			p->cond = z->cond;
-
-			if (j > 0 && p->start != p[-1].start + zone_size) {
-				log_info("%s: invalid zone data [%d:%d]: %"PRIu64" + %"PRIu64" != %"PRIu64"\n",
-					 f->file_name, j, i,
-					 p[-1].start, zone_size, p->start);
-				ret = -EINVAL;
-				goto out;
-			}
-		}
-		z--;
-		offset = z->start + z->len;
-		if (j >= nr_zones)
-			break;
-
-		nrz = zbd_report_zones(td, f, offset, zones,
-				       min((uint32_t)(nr_zones - j),
-					   ZBD_REPORT_MAX_ZONES));
-		if (nrz < 0) {
-			ret = nrz;
-			log_info("fio: report zones (offset %"PRIu64") failed for %s (%d).\n",
-				 offset, f->file_name, -ret);
-			goto out;
-		}
+	for (i = 0; i < nr_zones; i++, p++) {
+		mutex_init_pshared_with_type(&p->mutex,
+					     PTHREAD_MUTEX_RECURSIVE);
+		p->start = i * zone_size;
 	}
-
 	/* a sentinel */
-	zbd_info->zone_info[nr_zones].start = offset;
+	p->start = nr_zones * zone_size;
 
 	f->zbd_info = zbd_info;
 	f->zbd_info->zone_size = zone_size;
 	f->zbd_info->zone_size_log2 = is_power_of_2(zone_size) ?
 		ilog2(zone_size) : 0;
 	f->zbd_info->nr_zones = nr_zones;
-	zbd_info = NULL;
-	ret = 0;
 
-out:
-	sfree(zbd_info);
-	free(zones);
-	return ret;
+	return 0;
 }
 
 static int zbd_set_max_open_zones(struct thread_data *td, struct fio_file *f)
@@ -981,12 +1152,37 @@ static int zbd_create_zone_info(struct thread_data *td, struct fio_file *f)
 	return 0;
 }
 
+/*
+ * Hand back the zones the job had open with zone_owner set, so the jobs
+ * that run later can open them.
+ */
+static void zbd_free_owned_zones(struct fio_file *f)
+{
+	struct zbd_owned_zones *oz = f->zbd_owned;
+	uint32_t i;
+
+	if (!oz)
+		return;
+
+	for (i = 0; i < oz->nr_open; i++) {
+		struct fio_zone_info *z = zbd_get_zone(f, oz->open[i]);
+
+		z->open = 0;
+		__atomic_store_n(&z->owner, 0, __ATOMIC_RELEASE);
+	}
+
+	sfree(oz);
+	f->zbd_owned = NULL;
+}
+
 void zbd_free_zone_info(struct fio_file *f)
 {
 	uint32_t refcount;
 
 	assert(f->zbd_info);
 
+	zbd_free_owned_zones(f);
+
 	pthread_mutex_lock(&f->zbd_info->mutex);
 	refcount = --f->zbd_info->refcount;
 	pthread_mutex_unlock(&f->zbd_info->mutex);
@@ -1117,8 +1313,74 @@ static uint64_t zbd_verify_and_set_vdb(struct thread_data *td,
 	return wp_vdb;
 }
 
+/*
+ * Set up the zones a job writing with zone_owner set may use. The jobs
+ * writing to the device are ranked by thread number, so each of them finds
+ * the same split, and the open zones limit of the device is divided
+ * between them.
+ */
+static int zbd_setup_owned_zones(struct thread_data *td, struct fio_file *f)
+{
+	struct zoned_block_device_info *zbdi = f->zbd_info;
+	uint32_t job = 0, nr_jobs = 0, max_open;
+	struct zbd_owned_zones *oz;
+	struct fio_file *f2;
+	int j;
+
+	for_each_td(td2) {
+		if (td2->o.zone_mode != ZONE_MODE_ZBD || !td_write(td2))
+			continue;
+		for_each_file(td2, f2, j) {
+			if (strcmp(f2->file_name, f->file_name))
+				continue;
+			if (td2->o.zone_owner != td->o.zone_owner) {
+				log_err("%s: all jobs writing to it need the same 'zone_owner'\n",
+					f->file_name);
+				return 1;
+			}
+			if (td2->thread_number < td->thread_number)
+				job++;
+			nr_jobs++;
+			break;
+		}
+	} end_for_each();
+
+	if (td->o.job_max_open_zones)
+		max_open = td->o.job_max_open_zones;
+	else if (zbdi->max_open_zones)
+		max_open = zbdi->max_open_zones / nr_jobs;
+	else
+		max_open = min(f->max_zone - f->min_zone,
+			       (uint32_t) ZBD_MAX_OPEN_ZONES);
+
+	if (!max_open || (zbdi->max_open_zones &&
+			  max_open * nr_jobs > zbdi->max_open_zones)) {
+		log_err("%s: %u jobs with 'zone_owner' can't share %u open zones\n",
+			f->file_name, nr_jobs, zbdi->max_open_zones);
+		return 1;
+	}
+
+	if (f->zbd_owned)
+		sfree(f->zbd_owned);
+	oz = scalloc(1, sizeof(*oz) + max_open * sizeof(oz->open[0]));
+	if (!oz) {
+		log_err("%s: out of memory for owned zones\n", f->file_name);
+		return 1;
+	}
+	oz->job = job;
+	oz->nr_jobs = nr_jobs;
+	oz->max_open = max_open;
+	f->zbd_owned = oz;
+
+	dprint(FD_ZBD, "%s: job %u of %u, up to %u open zones\n",
+	       f->file_name, job, nr_jobs, max_open);
+
+	return 0;
+}
+
 int zbd_setup_files(struct thread_data *td)
 {
+	uint64_t zone_bytes = 0;
 	struct fio_file *f;
 	int i;
 
@@ -1138,6 +1400,12 @@ int zbd_setup_files(struct thread_data *td)
 		return 1;
 	}
 
+	if (td->o.zone_append && !td_ioengine_flagged(td, FIO_ZONE_APPEND)) {
+		log_err("ioengine %s does not support zone append\n",
+			td->io_ops->name);
+		return 1;
+	}
+
 	for_each_file(td, f, i) {
 		struct zoned_block_device_info *zbd = f->zbd_info;
 		struct fio_zone_info *z;
@@ -1164,6 +1432,17 @@ int zbd_setup_files(struct thread_data *td)
 		if (zbd_is_seq_job(f))
 			assert(f->min_zone < f->max_zone);
 
+		if (td->o.zone_owner != ZONE_OWNER_SHARED && td_write(td) &&
+		    zbd_setup_owned_zones(td, f))
+			return 1;
+
+		zone_bytes += sizeof(*zbd) +
+			(zbd->nr_zones + 1) * sizeof(zbd->zone_info[0]);
+		if (f->zbd_owned)
+			zone_bytes += sizeof(*f->zbd_owned) +
+				f->zbd_owned->max_open *
+				sizeof(f->zbd_owned->open[0]);
+
 		if (td->o.max_open_zones > 0 &&
 		    zbd->max_open_zones != td->o.max_open_zones) {
 			log_err("Different 'max_open_zones' values\n");
@@ -1174,8 +1453,10 @@ int zbd_setup_files(struct thread_data *td)
 		 * The per job max open zones limit cannot be used without a
 		 * global max open zones limit. (As the tracking of open zones
 		 * is disabled when there is no global max open zones limit.)
+		 * Jobs that own their zones track their open zones themselves.
 		 */
-		if (td->o.job_max_open_zones && !zbd->max_open_zones) {
+		if (td->o.job_max_open_zones && !zbd->max_open_zones &&
+		    !f->zbd_owned) {
 			log_err("'job_max_open_zones' cannot be used without a global open zones limit\n");
 			return 1;
 		}
@@ -1193,7 +1474,11 @@ int zbd_setup_files(struct thread_data *td)
 			if (z->cond != ZBD_ZONE_COND_IMP_OPEN &&
 			    z->cond != ZBD_ZONE_COND_EXP_OPEN)
 				continue;
-			if (zbd_open_zone(td, f, z))
+			if (f->zbd_owned) {
+				if (zbd_zone_foreign(td, f, z) ||
+				    zbd_own_zone(td, f, z))
+					continue;
+			} else if (zbd_open_zone(td, f, z))
 				continue;
 			/*
 			 * If the number of open zones exceeds specified limits,
@@ -1206,44 +1491,44 @@ int zbd_setup_files(struct thread_data *td)
 		}
 	}
 
+	mem_acct_set(td, MEM_ZONES, zone_bytes);
 	return 0;
 }
 
 /*
- * Reset zbd_info.write_cnt, the counter that counts down towards the next
- * zone reset.
+ * The value zbd_info.write_cnt, the counter that counts down towards the next
+ * zone reset, starts from.
  */
-static void _zbd_reset_write_cnt(const struct thread_data *td,
-				 const struct fio_file *f)
+static uint32_t zbd_write_cnt_start(const struct thread_data *td)
 {
 	assert(0 <= td->o.zrf.u.f && td->o.zrf.u.f <= 1);
 
-	f->zbd_info->write_cnt = td->o.zrf.u.f ?
+	return td->o.zrf.u.f ?
 		min(1.0 / td->o.zrf.u.f, 0.0 + UINT_MAX) : UINT_MAX;
 }
 
 static void zbd_reset_write_cnt(const struct thread_data *td,
 				const struct fio_file *f)
 {
-	pthread_mutex_lock(&f->zbd_info->mutex);
-	_zbd_reset_write_cnt(td, f);
-	pthread_mutex_unlock(&f->zbd_info->mutex);
+	__atomic_store_n(&f->zbd_info->write_cnt, zbd_write_cnt_start(td),
+			 __ATOMIC_RELAXED);
 }
 
 static bool zbd_dec_and_reset_write_cnt(const struct thread_data *td,
 					const struct fio_file *f)
 {
-	uint32_t write_cnt = 0;
-
-	pthread_mutex_lock(&f->zbd_info->mutex);
-	assert(f->zbd_info->write_cnt);
-	if (f->zbd_info->write_cnt)
-		write_cnt = --f->zbd_info->write_cnt;
-	if (write_cnt == 0)
-		_zbd_reset_write_cnt(td, f);
-	pthread_mutex_unlock(&f->zbd_info->mutex);
-
-	return write_cnt == 0;
+	uint32_t *cnt = &f->zbd_info->write_cnt;
+	uint32_t old, new;
+
+	old = __atomic_load_n(cnt, __ATOMIC_RELAXED);
+	do {
+		assert(old);
+		new = old > 1 ? old - 1 : zbd_write_cnt_start(td);
+	} while (!__atomic_compare_exchange_n(cnt, &old, new, false,
+					      __ATOMIC_RELAXED,
+					      __ATOMIC_RELAXED));
+
+	return old <= 1;
 }
 
 void zbd_file_reset(struct thread_data *td, struct fio_file *f)
@@ -1275,6 +1560,170 @@ void zbd_file_reset(struct thread_data *td, struct fio_file *f)
 	zbd_reset_write_cnt(td, f);
 }
 
+/*
+ * Zone reset worker. With zone_reset_async, full zones are finished and
+ * reset from a per-job thread as soon as the last write to them completes,
+ * instead of synchronously when a write next lands in them.
+ */
+struct zbd_reset_worker {
+	struct thread_data *td;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool kick;
+	bool exit;
+};
+
+/* How often the worker also looks for zones filled by other jobs, in ms */
+#define ZBD_RESET_WORKER_POLL	10
+
+static void zbd_kick_reset_worker(struct thread_data *td)
+{
+	struct zbd_reset_worker *w = td->zbd_reset_worker;
+
+	if (!w)
+		return;
+
+	pthread_mutex_lock(&w->lock);
+	w->kick = true;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+}
+
+/*
+ * Finish and reset the zones of the job's I/O range that have no room left
+ * for a write. Zones that are open, locked by a write or have zone appends in
+ * flight are skipped, those are picked up once their writes complete. With
+ * zone_reset_threshold, zones are only reset while the valid data is above
+ * the threshold.
+ */
+static void zbd_reset_worker_scan(struct thread_data *td)
+{
+	const uint64_t min_bs = td->o.min_bs[DDIR_WRITE];
+	struct fio_file *f;
+	unsigned int i;
+
+	for_each_file(td, f, i) {
+		struct zoned_block_device_info *zbdi = f->zbd_info;
+		struct fio_zone_info *z, *ze;
+
+		if (!zbdi)
+			continue;
+
+		z = zbd_get_zone(f, f->min_zone);
+		ze = zbd_get_zone(f, f->max_zone);
+		for (; z < ze; z++) {
+			if (!z->has_wp || z->cond == ZBD_ZONE_COND_OFFLINE ||
+			    z->wp == z->start || z->open ||
+			    zbd_zone_remainder(z) >= min_bs ||
+			    zbd_zone_foreign(td, f, z))
+				continue;
+
+			/* Never wait for a zone a write is using */
+			if (pthread_mutex_trylock(&z->mutex))
+				continue;
+
+			if (z->open || zbd_zone_remainder(z) >= min_bs ||
+			    __atomic_load_n(&z->appends, __ATOMIC_ACQUIRE))
+				goto unlock;
+
+			if (zbd_zone_remainder(z) &&
+			    zbd_finish_zone(td, f, z) < 0)
+				goto unlock;
+
+			if (td->o.zrt.u.f &&
+			    __atomic_load_n(&zbdi->wp_valid_data_bytes,
+					    __ATOMIC_RELAXED) <
+			    f->io_size * td->o.zrt.u.f)
+				goto unlock;
+
+			dprint(FD_ZBD, "%s: async reset of zone %u\n",
+			       f->file_name, zbd_zone_idx(f, z));
+			zbd_reset_zone(td, f, z);
+unlock:
+			zone_unlock(z);
+		}
+	}
+}
+
+static void *zbd_reset_worker_thread(void *data)
+{
+	struct zbd_reset_worker *w = data;
+	struct timespec t;
+
+	pthread_mutex_lock(&w->lock);
+	while (!w->exit) {
+		w->kick = false;
+		pthread_mutex_unlock(&w->lock);
+
+		zbd_reset_worker_scan(w->td);
+
+		pthread_mutex_lock(&w->lock);
+		if (w->kick || w->exit)
+			continue;
+
+		clock_gettime(CLOCK_REALTIME, &t);
+		t.tv_nsec += ZBD_RESET_WORKER_POLL * 1000000;
+		if (t.tv_nsec >= 1000000000) {
+			t.tv_nsec -= 1000000000;
+			t.tv_sec++;
+		}
+		pthread_cond_timedwait(&w->cond, &w->lock, &t);
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return NULL;
+}
+
+int zbd_reset_worker_init(struct thread_data *td)
+{
+	struct zbd_reset_worker *w;
+	int ret;
+
+	if (!td->o.zone_reset_async || !td_write(td))
+		return 0;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return 1;
+
+	w->td = td;
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->cond, NULL);
+
+	ret = pthread_create(&w->thread, NULL, zbd_reset_worker_thread, w);
+	if (ret) {
+		log_err("fio: zone reset worker creation failed: %s\n",
+			strerror(ret));
+		pthread_cond_destroy(&w->cond);
+		pthread_mutex_destroy(&w->lock);
+		free(w);
+		return 1;
+	}
+
+	td->zbd_reset_worker = w;
+	return 0;
+}
+
+void zbd_reset_worker_exit(struct thread_data *td)
+{
+	struct zbd_reset_worker *w = td->zbd_reset_worker;
+
+	if (!w)
+		return;
+
+	pthread_mutex_lock(&w->lock);
+	w->exit = true;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+
+	pthread_join(w->thread, NULL);
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->lock);
+	free(w);
+	td->zbd_reset_worker = NULL;
+}
+
 /* Return random zone index for one of the open zones. */
 static uint32_t pick_random_zone_idx(const struct fio_file *f,
 				     const struct io_u *io_u)
@@ -1519,6 +1968,90 @@ out:
 	return z;
 }
 
+/*
+ * Finish a zone the job has open that has no room left for a write, and
+ * close it. The caller must hold z->mutex.
+ */
+static void zbd_retire_zone(struct thread_data *td, struct fio_file *f,
+			    struct fio_zone_info *z)
+{
+	if (zbd_zone_remainder(z)) {
+		io_u_quiesce(td);
+		zbd_finish_zone(td, f, z);
+	}
+	zbd_release_zone(td, f, z);
+}
+
+/*
+ * zone_owner counterpart of zbd_convert_to_open_zone(). Open another zone of
+ * the job's own, searching from the zone of the I/O unit on, while the job is
+ * below its share of open zones, and else pick one of the zones it has open.
+ * Zones without room for the write are finished and closed on the way. Only
+ * the job itself touches its open zones, so neither f->zbd_info->mutex nor
+ * the open zones of other jobs are involved. Returns with z->mutex held upon
+ * success.
+ */
+static struct fio_zone_info *zbd_convert_to_owned_zone(struct thread_data *td,
+						       struct io_u *io_u)
+{
+	const uint64_t min_bs = td->o.min_bs[io_u->ddir];
+	struct fio_file *f = io_u->file;
+	struct zbd_owned_zones *oz = f->zbd_owned;
+	uint32_t zone_idx, i, nr = f->max_zone - f->min_zone;
+	struct fio_zone_info *z;
+
+	assert(is_valid_offset(f, io_u->offset));
+
+	zone_idx = zbd_offset_to_zone_idx(f, io_u->offset);
+	if (zone_idx < f->min_zone)
+		zone_idx = f->min_zone;
+	else if (zone_idx >= f->max_zone)
+		zone_idx = f->max_zone - 1;
+
+	for (;;) {
+		for (i = 0; i < nr && oz->nr_open < oz->max_open; i++) {
+			z = zbd_get_zone(f, zone_idx);
+			if (++zone_idx >= f->max_zone)
+				zone_idx = f->min_zone;
+
+			if (!z->has_wp || z->open ||
+			    z->cond == ZBD_ZONE_COND_OFFLINE)
+				continue;
+			/* As in zbd_open_zone(), resetting loses verify data */
+			if (td->o.verify != VERIFY_NONE &&
+			    zbd_zone_full(f, z, min_bs))
+				continue;
+			if (!zbd_own_zone(td, f, z))
+				continue;
+
+			zone_lock(td, f, z);
+			goto out;
+		}
+
+		if (!oz->nr_open) {
+			dprint(FD_ZBD, "%s(%s): no zone to open\n",
+			       __func__, f->file_name);
+			return NULL;
+		}
+
+		z = zbd_get_zone(f, oz->open[(io_u->offset - f->file_offset) *
+					    oz->nr_open / f->io_size]);
+		zone_lock(td, f, z);
+		if (zbd_zone_remainder(z) >= min_bs)
+			goto out;
+
+		zbd_retire_zone(td, f, z);
+		zone_unlock(z);
+	}
+
+out:
+	dprint(FD_ZBD, "%s(%s): returning zone %u\n",
+	       __func__, f->file_name, zbd_zone_idx(f, z));
+
+	io_u->offset = z->start;
+	return z;
+}
+
 /*
  * Find another zone which has @min_bytes of readable data. Search in zones
  * @zb + 1 .. @zl. For random workload, also search in zones @zb - 1 .. @zf.
@@ -1573,7 +2106,8 @@ zbd_find_zone(struct thread_data *td, struct io_u *io_u, uint64_t min_bytes,
  * @io_u: I/O unit
  * @z: zone info pointer
  *
- * If the write command made the zone full, close it.
+ * If the write command made the zone full, close it. For zone appends that
+ * is when the last one in flight completes, as they complete in any order.
  *
  * The caller must hold z->mutex.
  */
@@ -1581,12 +2115,57 @@ static void zbd_end_zone_io(struct thread_data *td, const struct io_u *io_u,
 			    struct fio_zone_info *z)
 {
 	const struct fio_file *f = io_u->file;
+	uint64_t end;
+
+	if (io_u->ddir != DDIR_WRITE)
+		return;
+
+	if (io_u->flags & IO_U_F_ZONE_APPEND) {
+		if (__atomic_load_n(&z->appends, __ATOMIC_ACQUIRE))
+			return;
+		end = z->wp;
+	} else
+		end = io_u->offset + io_u->buflen;
+
+	if (end < zbd_zone_capacity_end(z))
+		return;
+
+	if (z->open)
+		zbd_put_zone(td, f, z);
+
+	zbd_kick_reset_worker(td);
+}
+
+/**
+ * zbd_put_append_io - Account for the completion of a queued zone append
+ * @io_u: I/O unit
+ *
+ * The zone lock was dropped when the zone append was queued and is not taken
+ * again here: this may run while reaping from io_u_quiesce(), and the job
+ * holding the lock may be in zbd_wait_zone_appends() for this very append.
+ * Nothing can be appended to a full zone, so the completion that drops the
+ * last append in flight closes it, holding only zbdi->mutex. A reset or
+ * finish waiting for the appends to drain may close it first, closing an
+ * already closed zone is a no-op.
+ */
+static void zbd_put_append_io(struct thread_data *td, const struct io_u *io_u)
+{
+	const struct fio_file *f = io_u->file;
+	struct fio_zone_info *z;
+
+	assert(f->zbd_info);
 
-	if (io_u->ddir == DDIR_WRITE &&
-	    io_u->offset + io_u->buflen >= zbd_zone_capacity_end(z)) {
-		pthread_mutex_lock(&f->zbd_info->mutex);
-		zbd_close_zone(td, f, z);
-		pthread_mutex_unlock(&f->zbd_info->mutex);
+	z = zbd_offset_to_zone(f, io_u->offset);
+	assert(z->has_wp);
+
+	dprint(FD_ZBD,
+	       "%s: completed zone append (%lld, %llu) for zone %u\n",
+	       f->file_name, io_u->offset, io_u->buflen, zbd_zone_idx(f, z));
+
+	if (__atomic_sub_fetch(&z->appends, 1, __ATOMIC_ACQ_REL) == 0 &&
+	    z->wp >= zbd_zone_capacity_end(z)) {
+		zbd_put_zone(td, f, z);
+		zbd_kick_reset_worker(td);
 	}
 }
 
@@ -1621,18 +2200,24 @@ static void zbd_queue_io(struct thread_data *td, struct io_u *io_u, int q,
 
 	switch (io_u->ddir) {
 	case DDIR_WRITE:
-		zone_end = min((uint64_t)(io_u->offset + io_u->buflen),
-			       zbd_zone_capacity_end(z));
+		/*
+		 * A zone append is issued at the zone start, the device picks
+		 * where it goes. It takes the next io_u->buflen bytes.
+		 */
+		if (io_u->flags & IO_U_F_ZONE_APPEND)
+			zone_end = min((uint64_t)(z->wp + io_u->buflen),
+				       zbd_zone_capacity_end(z));
+		else
+			zone_end = min((uint64_t)(io_u->offset + io_u->buflen),
+				       zbd_zone_capacity_end(z));
 
 		/*
 		 * z->wp > zone_end means that one or more I/O errors
 		 * have occurred.
 		 */
-		if (accounting_vdb(td, f) && z->wp <= zone_end) {
-			pthread_mutex_lock(&zbd_info->mutex);
-			zbd_info->wp_valid_data_bytes += zone_end - z->wp;
-			pthread_mutex_unlock(&zbd_info->mutex);
-		}
+		if (accounting_vdb(td, f) && z->wp <= zone_end)
+			__atomic_fetch_add(&zbd_info->wp_valid_data_bytes,
+					   zone_end - z->wp, __ATOMIC_RELAXED);
 		z->wp = zone_end;
 		break;
 	default:
@@ -1642,6 +2227,17 @@ static void zbd_queue_io(struct thread_data *td, struct io_u *io_u, int q,
 	if (q == FIO_Q_COMPLETED && !io_u->error)
 		zbd_end_zone_io(td, io_u, z);
 
+	/*
+	 * Queued zone appends don't need the zone to themselves, let other
+	 * writes to it be issued while this one is in flight.
+	 */
+	if (q == FIO_Q_QUEUED && (io_u->flags & IO_U_F_ZONE_APPEND)) {
+		__atomic_fetch_add(&z->appends, 1, __ATOMIC_RELEASE);
+		io_u->zbd_put_io = zbd_put_append_io;
+		zone_unlock(z);
+		return;
+	}
+
 unlock:
 	if (!success || q != FIO_Q_QUEUED) {
 		/* BUSY or COMPLETED: unlock the zone */
@@ -1941,6 +2537,23 @@ enum io_u_action zbd_adjust_block(struct thread_data *td, struct io_u *io_u)
 			goto eof;
 		}
 
+		if (f->zbd_owned) {
+			if (zb->open && !zbd_zone_foreign(td, f, zb) &&
+			    zbd_zone_remainder(zb) < min_bs)
+				zbd_retire_zone(td, f, zb);
+			if (!zb->open || zbd_zone_foreign(td, f, zb)) {
+				zone_unlock(zb);
+				zb = zbd_convert_to_owned_zone(td, io_u);
+				if (!zb) {
+					dprint(FD_IO,
+					       "%s: can't convert to owned zone",
+					       f->file_name);
+					goto eof;
+				}
+			}
+			goto zone_open;
+		}
+
 retry:
 		if (zbd_zone_remainder(zb) > 0 &&
 		    zbd_zone_remainder(zb) < min_bs) {
@@ -1982,9 +2595,11 @@ retry:
 		    zbd_zone_remainder(zb) < min_bs)
 			goto retry;
 
+zone_open:
 		/* Check whether the zone reset threshold has been exceeded */
 		if (td->o.zrf.u.f) {
-			if (zbdi->wp_valid_data_bytes >=
+			if (__atomic_load_n(&zbdi->wp_valid_data_bytes,
+					    __ATOMIC_RELAXED) >=
 			    f->io_size * td->o.zrt.u.f &&
 			    zbd_dec_and_reset_write_cnt(td, f))
 				zb->reset_zone = 1;
@@ -2094,6 +2709,15 @@ accept:
 	assert(!io_u->zbd_queue_io);
 	assert(!io_u->zbd_put_io);
 
+	/*
+	 * Zone appends are issued at the start of the zone, the engine sets
+	 * io_u->offset to where the data went when they complete.
+	 */
+	if (io_u->ddir == DDIR_WRITE && td->o.zone_append) {
+		io_u_set(td, io_u, IO_U_F_ZONE_APPEND);
+		io_u->offset = zb->start;
+	}
+
 	io_u->zbd_queue_io = zbd_queue_io;
 	io_u->zbd_put_io = zbd_put_io;
 
@@ -23,26 +23,39 @@ enum io_u_action {
 /**
  * struct fio_zone_info - information about a single ZBD zone
  * @start: zone start location (bytes)
- * @wp: zone write pointer location (bytes)
+ * @wp: zone write pointer location (bytes). With zone appends, this is where
+ *	the writes queued so far will have taken the write pointer.
  * @capacity: maximum size usable from the start of a zone (bytes)
+ * @appends: number of zone append writes in flight to this zone. These don't
+ *		hold @mutex while in flight.
  * @mutex: protects the modifiable members in this structure
  * @type: zone type (BLK_ZONE_TYPE_*)
  * @cond: zone state (BLK_ZONE_COND_*)
  * @has_wp: whether or not this zone can have a valid write pointer
  * @open: whether or not this zone is currently open. Only relevant if
- *		max_open_zones > 0.
+ *		max_open_zones > 0. Only changes with
+ *		zoned_block_device_info.mutex held, and with @mutex held as
+ *		well except when the last zone append to a full zone completes.
+ *		Not a bit-field for that reason.
  * @reset_zone: whether or not this zone should be reset before writing to it
+ * @reported: whether or not the members other than @start and @mutex have been
+ *		read from the device zone report
+ * @owner: thread number of the job that claimed this zone with
+ *		zone_owner=lease, 0 if none did. Updated atomically.
  */
 struct fio_zone_info {
 	pthread_mutex_t		mutex;
 	uint64_t		start;
 	uint64_t		wp;
 	uint64_t		capacity;
+	uint32_t		appends;
+	uint32_t		owner;
+	bool			open;
 	enum zbd_zone_type	type:2;
 	enum zbd_zone_cond	cond:4;
 	unsigned int		has_wp:1;
-	unsigned int		open:1;
 	unsigned int		reset_zone:1;
+	unsigned int		reported:1;
 };
 
 /**
@@ -54,7 +67,8 @@ struct fio_zone_info {
  * @mutex: Protects the modifiable members in this structure (refcount and
  *		num_open_zones).
  * @zone_size: size of a single zone in bytes.
- * @wp_valid_data_bytes: total size of data in zones with write pointers
+ * @wp_valid_data_bytes: total size of data in zones with write pointers,
+ *		updated atomically
  * @write_min_zone: Minimum zone index of all job's write ranges. Inclusive.
  * @write_max_zone: Maximum zone index of all job's write ranges. Exclusive.
  * @zone_size_log2: log2 of the zone size in bytes if it is a power of 2 or 0
@@ -63,7 +77,7 @@ struct fio_zone_info {
  * @refcount: number of fio files that share this structure
  * @num_open_zones: number of open zones
  * @write_cnt: Number of writes since the latest zone reset triggered by
- *	       the zone_reset_frequency fio job parameter.
+ *	       the zone_reset_frequency fio job parameter, updated atomically.
  * @open_zones: zone numbers of open zones
  * @zone_info: description of the individual zones
  *
@@ -88,11 +102,33 @@ struct zoned_block_device_info {
 	struct fio_zone_info	zone_info[0];
 };
 
+/**
+ * struct zbd_owned_zones - the zones a job writes to with zone_owner set
+ * @job: rank of the job among the jobs writing to the device
+ * @nr_jobs: number of jobs writing to the device
+ * @max_open: most zones the job keeps open at once
+ * @nr_open: number of zones in @open
+ * @open: indices of the zones the job has open
+ *
+ * Only the job itself changes this, so opening and closing zones doesn't
+ * take zoned_block_device_info.mutex. Each job gets its share of the open
+ * zones limit of the device instead.
+ */
+struct zbd_owned_zones {
+	uint32_t		job;
+	uint32_t		nr_jobs;
+	uint32_t		max_open;
+	uint32_t		nr_open;
+	uint32_t		open[];
+};
+
 int zbd_init_files(struct thread_data *td);
 void zbd_recalc_options_with_zone_granularity(struct thread_data *td);
 int zbd_setup_files(struct thread_data *td);
 void zbd_free_zone_info(struct fio_file *f);
 void zbd_file_reset(struct thread_data *td, struct fio_file *f);
+int zbd_reset_worker_init(struct thread_data *td);
+void zbd_reset_worker_exit(struct thread_data *td);
 bool zbd_unaligned_write(int error_code);
 void setup_zbd_zone_mode(struct thread_data *td, struct io_u *io_u);
 enum fio_ddir zbd_adjust_ddir(struct thread_data *td, struct io_u *io_u,
@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include "fio.h"
 #include "zone-dist.h"
+#include "lib/alias.h"
 
 static void __td_zone_gen_index(struct thread_data *td, enum fio_ddir ddir)
 {
@@ -72,3 +73,57 @@ void td_zone_free_index(struct thread_data *td)
 	free(td->zone_state_index);
 	td->zone_state_index = NULL;
 }
+
+/*
+ * Alias table with the same distribution as the bssplit percentage scan:
+ * each entry gets its share of the running percentage up to 100, and the
+ * last entry picks up whatever the percentages fall short of 100.
+ */
+struct alias_table *bssplit_alias_new(const struct bssplit *bssplit,
+				      unsigned int nr)
+{
+	uint64_t weights[BSSPLIT_MAX];
+	unsigned int i, perc, last;
+	struct alias_table *at;
+
+	if (!nr || nr > BSSPLIT_MAX)
+		return NULL;
+
+	perc = last = 0;
+	for (i = 0; i < nr; i++) {
+		unsigned int next = perc + bssplit[i].perc;
+
+		if (next > 100)
+			next = 100;
+		weights[i] = next - perc;
+		if (bssplit[i].perc)
+			last = i;
+		perc = next;
+	}
+	weights[last] += 100 - perc;
+
+	at = alias_table_new(weights, nr);
+	if (!at)
+		log_err("fio: failed allocating bssplit table\n");
+
+	return at;
+}
+
+void td_bssplit_gen_alias(struct thread_data *td)
+{
+	int i;
+
+	for (i = 0; i < DDIR_RWDIR_CNT; i++)
+		td->bssplit_alias[i] = bssplit_alias_new(td->o.bssplit[i],
+							 td->o.bssplit_nr[i]);
+}
+
+void td_bssplit_free_alias(struct thread_data *td)
+{
+	int i;
+
+	for (i = 0; i < DDIR_RWDIR_CNT; i++) {
+		alias_table_free(td->bssplit_alias[i]);
+		td->bssplit_alias[i] = NULL;
+	}
+}
@@ -4,4 +4,9 @@
 void td_zone_gen_index(struct thread_data *td);
 void td_zone_free_index(struct thread_data *td);
 
+struct alias_table *bssplit_alias_new(const struct bssplit *bssplit,
+				      unsigned int nr);
+void td_bssplit_gen_alias(struct thread_data *td);
+void td_bssplit_free_alias(struct thread_data *td);
+
 #endif